@@ -12,12 +12,12 @@ ASAN=0
 PLATFORM="[linux|pi|android|ios]"
 
 #basic libraries
-BASIC_LIBS="libposix libtime liblog libdarray libthread libgevent libworkq libdict libhash libsort \
+BASIC_LIBS="libposix libtime libtrace liblog libdarray libthread libgevent libworkq libdict libhash libsort \
 	    librbtree libringbuffer libvector libstrex libmedia-io \
-            libdebug libfile libqueue libplugin libhal libsubmask"
-MEDIA_LIBS="libavcap libmp4"
+            libdebug libfile libqueue libmempool libmetrics libbench libplugin libhal libsubmask"
+MEDIA_LIBS="libavcap libmp4 libmedia-graph"
 FRAMEWORK_LIBS="libipc"
-NETWORK_LIBS="libsock libptcp librpc librtsp librtmpc"
+NETWORK_LIBS="libsock libptcp librpc librtsp librtmpc libhttpd"
 
 
 
@@ -1,6 +1,6 @@
 GEAR_LIB = libposix libthread libdarray libmedia-io libqueue liblog libavcap \
 	libfile libhal librbtree librtmpc libgevent libsock libstrex libconfig \
-	libdict libhash libtime libworkq
+	libdict libhash libtime libworkq libmempool
 COMPONENT_ADD_INCLUDEDIRS = $(GEAR_LIB)
 COMPONENT_SRCDIRS =  $(GEAR_LIB) libconfig/ini libconfig/json
 COMPONENT_OBJEXCLUDE = libposix/libposix4win.o libposix/libposix4nix.o \
@@ -16,7 +16,8 @@ COMPONENT_OBJEXCLUDE = libposix/libposix4win.o libposix/libposix4nix.o \
 		       librbtree/test_librbtree.o libconfig/test_libconfig.o \
 		       libsock/test_libsock.o libstrex/test_libstrex.o \
 		       libdict/test_libdict.o libhash/test_libhash.o \
-		       libtime/test_libtime.o libworkq/test_libworkq.o
+		       libtime/test_libtime.o libworkq/test_libworkq.o \
+		       libmempool/test_libmempool.o
 
 
 COMPONENT_DEPENDS := newlib
@@ -34,6 +34,7 @@ struct audiocap_config {
     uint32_t           sample_rate;
     uint8_t            channels;
     const char        *device;
+    uint32_t           latency_ms;      /* capture fragment, 0 for 25ms */
 };
 
 
@@ -20,9 +20,18 @@
  * SOFTWARE.
  ******************************************************************************/
 #include "libavcap.h"
+#include <libqueue.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <stdarg.h>
+#if defined (ENABLE_TRACE)
+#include <libtrace.h>
+#else
+#define TRACE_SCOPE(cat, name)
+#define TRACE_FLOW_BEGIN(cat, name, id)
+#define TRACE_FLOW_STEP(cat, name, id)
+#endif
 
 #if defined (OS_LINUX)
 extern struct avcap_ops dummy_ops;
@@ -70,6 +79,8 @@ struct avcap_ctx *avcap_open(const char *dev, struct avcap_config *conf)
         printf("malloc failed!\n");
         return NULL;
     }
+    avcap->conf.type = conf->type;
+    avcap->conf.backend = backend;
     avcap->ops = avcap_list[backend].ops;
     if (!avcap->ops) {
         printf("avcap->ops %d is NULL!\n", backend);
@@ -93,6 +104,8 @@ void avcap_close(struct avcap_ctx *avcap)
         return;
     }
     avcap->ops->_close(avcap);
+    /* frames left in ring give their buffers back to closed backend */
+    queue_destroy(avcap->ring);
     free(avcap);
 }
 
@@ -153,3 +166,137 @@ int avcap_stop_stream(struct avcap_ctx *avcap)
 }
 
 
+
+static void *ring_frame_ref(void *data, size_t len, void *arg)
+{
+    struct media_frame *src = (struct media_frame *)data;
+    struct media_frame *dst;
+
+    dst = (struct media_frame *)calloc(1, sizeof(struct media_frame));
+    if (!dst) {
+        return NULL;
+    }
+    dst->type = src->type;
+    if (0 != video_frame_ref(&dst->video, &src->video)) {
+        free(dst);
+        return NULL;
+    }
+    return dst;
+}
+
+static void ring_frame_unref(void *data)
+{
+    struct media_frame *frame = (struct media_frame *)data;
+    if (!frame) {
+        return;
+    }
+    video_frame_deinit(&frame->video);
+    free(frame);
+}
+
+/*
+ * runs in backend thread, only takes a reference, so capture never waits
+ * for consumer. a full ring drops its oldest frame
+ */
+static int ring_on_frame(struct avcap_ctx *avcap, struct media_frame *frame)
+{
+    struct queue_item *item;
+
+    TRACE_SCOPE("avcap", "capture");
+    __atomic_add_fetch(&avcap->ring_frames, 1, __ATOMIC_RELAXED);
+    if (frame->type != MEDIA_TYPE_VIDEO) {
+        __atomic_add_fetch(&avcap->ring_failed, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+    item = queue_item_alloc(avcap->ring, frame, sizeof(struct media_frame), NULL);
+    if (!item || !item->opaque.iov_base || 0 != queue_push(avcap->ring, item)) {
+        queue_item_free(avcap->ring, item);
+        __atomic_add_fetch(&avcap->ring_failed, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+    TRACE_FLOW_BEGIN("frame", "frame", frame->video.frame_id);
+    return 0;
+}
+
+int avcap_start_stream_ring(struct avcap_ctx *avcap, int depth)
+{
+    if (!avcap || depth <= 0) {
+        printf("%s:%d invalid paraments!\n", __func__, __LINE__);
+        return -1;
+    }
+    if (avcap->ring && avcap->ring_size != depth) {
+        queue_destroy(avcap->ring);
+        avcap->ring = NULL;
+    }
+    if (!avcap->ring) {
+        avcap->ring_frames = 0;
+        avcap->ring_failed = 0;
+        /*
+         * capture thread evicts oldest itself when full, which is a second
+         * consumer, so MPMC ring is needed for drop oldest
+         */
+        avcap->ring = queue_create_by(QUEUE_MPMC, depth);
+        if (!avcap->ring) {
+            printf("queue_create_by failed!\n");
+            return -1;
+        }
+        queue_set_mode(avcap->ring, QUEUE_FULL_RING);
+        queue_set_hook(avcap->ring, ring_frame_ref, ring_frame_unref);
+        avcap->ring_size = depth;
+    } else {
+        /* stale frames of last stream */
+        queue_flush(avcap->ring);
+    }
+    avcap->on_media_frame = ring_on_frame;
+    return avcap->ops->start_stream(avcap);
+}
+
+int avcap_pop_frame(struct avcap_ctx *avcap, struct media_frame *frame, int timeout_ms)
+{
+    struct queue_item *item;
+    struct media_frame *src;
+
+    TRACE_SCOPE("avcap", "pop_frame");
+    if (!avcap || !frame || !avcap->ring) {
+        printf("%s:%d invalid paraments!\n", __func__, __LINE__);
+        return -1;
+    }
+    item = queue_pop_wait(avcap->ring, timeout_ms);
+    if (!item) {
+        return -1;
+    }
+    /* move reference of ring frame to caller */
+    src = (struct media_frame *)item->opaque.iov_base;
+    *frame = *src;
+    src->video.buf = NULL;
+    queue_item_free(avcap->ring, item);
+    TRACE_FLOW_STEP("frame", "frame", frame->video.frame_id);
+    return 0;
+}
+
+int avcap_get_stats(struct avcap_ctx *avcap, struct avcap_stats *st)
+{
+    struct queue_stats qs;
+
+    if (!avcap || !st) {
+        printf("%s:%d invalid paraments!\n", __func__, __LINE__);
+        return -1;
+    }
+    memset(st, 0, sizeof(struct avcap_stats));
+    st->captured = __atomic_load_n(&avcap->ring_frames, __ATOMIC_RELAXED);
+    st->ring_failed = __atomic_load_n(&avcap->ring_failed, __ATOMIC_RELAXED);
+    if (avcap->ring && 0 == queue_get_stats(avcap->ring, &qs)) {
+        st->popped = qs.pop;
+        st->ring_dropped = qs.drop;
+        st->ring_depth = qs.depth;
+    }
+#if defined (OS_LINUX)
+    if (avcap->conf.backend == AVCAP_BACKEND_V4L2) {
+        struct video_cap_stats vs;
+        if (0 == avcap->ops->ioctl(avcap, VIDCAP_GET_STATS, &vs)) {
+            st->driver_dropped = vs.dropped;
+        }
+    }
+#endif
+    return 0;
+}
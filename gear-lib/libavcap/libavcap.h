@@ -63,6 +63,7 @@ enum avcap_backend_type {
 #include "videocap.h"
 
 struct avcap_ctx;
+struct queue;
 typedef int (media_frame_cb)(struct avcap_ctx *c, struct media_frame *frame);
 
 struct avcap_config {
@@ -80,6 +81,26 @@ struct avcap_ctx {
     const struct avcap_ops *ops;
     media_frame_cb *on_media_frame;
     void *opaque;
+    void *user;                 /* for on_media_frame, not used by avcap */
+    struct queue *ring;         /* frame ring of decoupled mode, or NULL */
+    int ring_size;
+    uint64_t ring_frames;       /* frames delivered by backend into ring */
+    uint64_t ring_failed;       /* frames could not be referenced */
+};
+
+/*
+ * drop counters per stage of a stream:
+ * driver_dropped: sequence gaps reported by backend (v4l2 only)
+ * ring_dropped: oldest frames discarded because consumer fell behind
+ * ring_failed: frames could not be referenced into ring
+ */
+struct avcap_stats {
+    uint64_t captured;
+    uint64_t popped;
+    uint64_t driver_dropped;
+    uint64_t ring_dropped;
+    uint64_t ring_failed;
+    int      ring_depth;        /* frames waiting in ring now */
 };
 
 struct avcap_ops {
@@ -118,6 +139,17 @@ GEAR_API int avcap_query_frame(struct avcap_ctx *c, struct media_frame *frame);
 GEAR_API int avcap_start_stream(struct avcap_ctx *avcap, media_frame_cb *cb);
 GEAR_API int avcap_stop_stream(struct avcap_ctx *avcap);
 
+/*
+ * decoupled mode: backend thread pushes referenced video frames into a
+ * lock-free ring of depth, dropping oldest when full, and consumer pops
+ * them at its own pace. popped frame must be released by
+ * video_frame_deinit. keep depth below driver buffer count, every frame in
+ * ring holds one driver buffer
+ */
+GEAR_API int avcap_start_stream_ring(struct avcap_ctx *avcap, int depth);
+GEAR_API int avcap_pop_frame(struct avcap_ctx *avcap, struct media_frame *frame, int timeout_ms);
+GEAR_API int avcap_get_stats(struct avcap_ctx *avcap, struct avcap_stats *st);
+
 
 #ifdef __cplusplus
 }
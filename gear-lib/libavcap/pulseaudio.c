@@ -27,6 +27,8 @@
 #include <unistd.h>
 #include <errno.h>
 #include <time.h>
+#include <stdarg.h>
+#include <libringbuffer.h>
 #include <pulse/pulseaudio.h>
 
 enum speaker_layout {
@@ -52,6 +54,13 @@ struct pulse_ctx {
     uint8_t               channels;
     uint64_t              first_ts;
     enum speaker_layout   speakers;
+    uint32_t              latency_ms;
+    uint64_t              dropped;      /* bytes lost on full ring */
+
+    /* query mode: read_cb writes chunks into ring, query_frame reads */
+    struct ringbuffer    *ring;
+    uint8_t              *chunk;
+    size_t                chunk_size;
 
     /* pulseaudio defination */
     pa_threaded_mainloop *pa_mainloop;
@@ -82,6 +91,38 @@ static inline uint64_t get_sample_time(size_t frames, uint32_t rate)
     return timespec2ns(ts) - samples_to_ns(frames, rate);
 }
 
+/* ring holds chunk as it came from server, header then samples */
+struct pulse_chunk {
+    uint64_t timestamp;
+    uint64_t frame_id;
+    uint32_t bytes;
+};
+
+#define PULSE_DEFAULT_LATENCY_MS    25
+#define PULSE_RING_CHUNKS           4
+
+/*
+ * latency of record stream is age of the sample at read index, it comes
+ * from pa_stream_get_time interpolated from server timing, so the chunk
+ * is stamped when it was captured, not when the callback ran
+ */
+static uint64_t pulse_chunk_time(struct pulse_ctx *c, size_t frames)
+{
+    struct timespec ts;
+    pa_usec_t latency;
+    int negative = 0;
+    uint64_t now, age;
+
+    if (pa_stream_get_latency(c->pa_stream, &latency, &negative) < 0) {
+        /* no timing info yet, assume last sample was just captured */
+        return get_sample_time(frames, c->sample_rate);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    now = timespec2ns(ts);
+    age = negative ? 0 : latency * 1000;
+    return now > age ? now - age : 0;
+}
+
 static pa_proplist *pulse_properties()
 {
     pa_proplist *p = pa_proplist_new();
@@ -438,12 +479,31 @@ exit:
     return ret;
 }
 
+static void pulse_ring_write(struct pulse_ctx *c, const void *data, size_t nbytes,
+                uint64_t timestamp)
+{
+    struct pulse_chunk hdr;
+
+    /* reader only frees space, so free space checked here stays free */
+    if (rb_get_space_free(c->ring) < sizeof(hdr) + nbytes) {
+        c->dropped += nbytes;
+        printf("pulse ring full, drop %zu bytes\n", nbytes);
+        return;
+    }
+    hdr.timestamp = timestamp;
+    hdr.frame_id = c->frame_id;
+    hdr.bytes = nbytes;
+    rb_write(c->ring, &hdr, sizeof(hdr));
+    rb_write(c->ring, data, nbytes);
+}
+
 static void read_cb(pa_stream *ps, size_t bytes, void *arg)
 {
     struct pulse_ctx *c = arg;
     struct avcap_ctx *avcap = c->parent;
     struct media_frame media;
     struct audio_frame *frame = &media.audio;
+    uint64_t timestamp;
 
     const void *frames;
     size_t nbytes;
@@ -452,37 +512,39 @@ static void read_cb(pa_stream *ps, size_t bytes, void *arg)
         printf("%s: c->pa_ctx=%p, ps=%p\n", __func__, c->pa_ctx, ps);
         return;
     }
-    pa_stream_peek(ps, &frames, &nbytes);
-    if (!nbytes) {
-        goto exit;
-    } else if (!frames) {
-        printf("Got audio hole of %zu bytes", nbytes);
-        pa_stream_drop(ps);
-        goto exit;
-    }
-
-    media.type = MEDIA_TYPE_AUDIO;
-
-    frame->sample_rate = c->sample_rate;
-    frame->format = pulse_to_sample_format(c->format);
-    frame->data[0] = (uint8_t *)frames;
-    frame->total_size = nbytes;
-    frame->frames = nbytes / c->bytes_per_frame;
-    frame->timestamp = get_sample_time(frame->frames, frame->sample_rate);
-
-    if (c->frame_id == 0) {
-        c->first_ts = frame->timestamp;
-    }
-    frame->timestamp -= c->first_ts;
-    frame->frame_id = c->frame_id;
-    c->frame_id++;
+    /* take every fragment ready, one per callback lets latency pile up */
+    while (pa_stream_readable_size(ps) > 0) {
+        if (pa_stream_peek(ps, &frames, &nbytes) < 0 || !nbytes) {
+            break;
+        } else if (!frames) {
+            printf("Got audio hole of %zu bytes", nbytes);
+            pa_stream_drop(ps);
+            continue;
+        }
 
-    if (avcap->on_media_frame) {
-        avcap->on_media_frame(avcap, &media);
+        timestamp = pulse_chunk_time(c, nbytes / c->bytes_per_frame);
+        if (c->frame_id == 0) {
+            c->first_ts = timestamp;
+        }
+        timestamp = timestamp > c->first_ts ? timestamp - c->first_ts : 0;
+
+        if (avcap->on_media_frame) {
+            media.type = MEDIA_TYPE_AUDIO;
+            memset(frame, 0, sizeof(struct audio_frame));
+            frame->sample_rate = c->sample_rate;
+            frame->format = pulse_to_sample_format(c->format);
+            frame->data[0] = (uint8_t *)frames;
+            frame->total_size = nbytes;
+            frame->frames = nbytes / c->bytes_per_frame;
+            frame->timestamp = timestamp;
+            frame->frame_id = c->frame_id;
+            avcap->on_media_frame(avcap, &media);
+        } else if (c->ring) {
+            pulse_ring_write(c, frames, nbytes, timestamp);
+        }
+        c->frame_id++;
+        pa_stream_drop(ps);
     }
-
-    pa_stream_drop(ps);
-exit:
     pa_threaded_mainloop_signal(c->pa_mainloop, 0);
 }
 
@@ -618,7 +680,9 @@ static void *_pa_open(struct avcap_ctx *avcap, const char *dev, struct avcap_con
     avcap->conf.audio.channels = c->pa_server_info.sample_spec.channels;
     avcap->conf.audio.format = pulse_to_sample_format(c->pa_server_info.sample_spec.format);
     avcap->conf.audio.device = c->device;
+    avcap->conf.audio.latency_ms = conf->audio.latency_ms;
 
+    c->latency_ms = conf->audio.latency_ms ? conf->audio.latency_ms : PULSE_DEFAULT_LATENCY_MS;
     c->parent = avcap;
     c->frame_id = 0;
 
@@ -655,6 +719,29 @@ static int _pa_start_stream(struct avcap_ctx *avcap)
 
     pulse_channel_map(&c->pa_channel_map, c->speakers);
 
+    /*
+     * fragsize is how much server collects before it wakes us, with
+     * ADJUST_LATENCY the source is also run at that latency
+     */
+    attr.fragsize = pa_usec_to_bytes(c->latency_ms * 1000, &c->pa_sample_spec);
+    attr.maxlength = (uint32_t)-1;
+    attr.minreq = (uint32_t)-1;
+    attr.prebuf = (uint32_t)-1;
+    attr.tlength = (uint32_t)-1;
+
+    rb_destroy(c->ring);
+    c->ring = NULL;
+    if (!avcap->on_media_frame) {
+        size_t chunk = attr.fragsize + sizeof(struct pulse_chunk);
+        c->ring = rb_create_mirror(chunk * PULSE_RING_CHUNKS);
+        if (!c->ring) {
+            printf("rb_create_mirror failed!\n");
+            return -1;
+        }
+    }
+    c->frame_id = 0;
+    c->is_streaming = true;
+
     pa_proplist *p = pulse_properties();
 
     c->pa_stream = pa_stream_new_with_proplist(c->pa_ctx, c->device, &c->pa_sample_spec, &c->pa_channel_map, p);
@@ -671,12 +758,6 @@ static int _pa_start_stream(struct avcap_ctx *avcap)
     pa_stream_set_latency_update_callback(c->pa_stream, stream_latency_update_cb, c);
     pa_threaded_mainloop_unlock(c->pa_mainloop);
 
-    attr.fragsize = pa_usec_to_bytes(25000, &c->pa_sample_spec);
-    attr.maxlength = (uint32_t)-1;
-    attr.minreq = (uint32_t)-1;
-    attr.prebuf = (uint32_t)-1;
-    attr.tlength = (uint32_t)-1;
-
     pa_stream_flags_t flags = PA_STREAM_INTERPOLATE_TIMING
                             | PA_STREAM_ADJUST_LATENCY
                             | PA_STREAM_AUTO_TIMING_UPDATE;
@@ -699,21 +780,85 @@ static int _pa_stop_stream(struct avcap_ctx *avcap)
     struct pulse_ctx *c = (struct pulse_ctx *)avcap->opaque;
 
     pa_threaded_mainloop_lock(c->pa_mainloop);
+    c->is_streaming = false;
     pa_stream_set_state_callback(c->pa_stream, NULL, NULL);
     pa_stream_disconnect(c->pa_stream);
     pa_stream_unref(c->pa_stream);
     c->pa_stream = NULL;
+    /* wake query_frame */
+    pa_threaded_mainloop_signal(c->pa_mainloop, 0);
     pa_threaded_mainloop_unlock(c->pa_mainloop);
 
     return 0;
 }
 
-static int _pa_query_frame(struct avcap_ctx *avcap, struct media_frame *frame)
+/*
+ * wait until ring has len bytes. read_cb writes a whole chunk with the
+ * mainloop lock held, so waiting only happens between chunks
+ */
+static int pulse_ring_wait(struct pulse_ctx *c, size_t len)
+{
+    if (rb_get_space_used(c->ring) >= len) {
+        return 0;
+    }
+    pa_threaded_mainloop_lock(c->pa_mainloop);
+    while (c->is_streaming && rb_get_space_used(c->ring) < len) {
+        pa_threaded_mainloop_wait(c->pa_mainloop);
+    }
+    pa_threaded_mainloop_unlock(c->pa_mainloop);
+    return rb_get_space_used(c->ring) >= len ? 0 : -1;
+}
+
+/*
+ * blocks for next chunk captured without on_media_frame, samples are valid
+ * until next query_frame
+ */
+static int _pa_query_frame(struct avcap_ctx *avcap, struct media_frame *media)
 {
-    printf("%s not support\n", __func__);
+    struct pulse_ctx *c = (struct pulse_ctx *)avcap->opaque;
+    struct audio_frame *frame = &media->audio;
+    struct pulse_chunk hdr;
+
+    if (!c->ring) {
+        printf("%s: stream not started or on_media_frame is set\n", __func__);
+        return -1;
+    }
+    if (pulse_ring_wait(c, sizeof(hdr)) != 0) {
+        return -1;
+    }
+    rb_read(c->ring, &hdr, sizeof(hdr));
+    if (hdr.bytes > c->chunk_size) {
+        uint8_t *chunk = realloc(c->chunk, hdr.bytes);
+        if (!chunk) {
+            printf("malloc %u bytes failed!\n", hdr.bytes);
+            return -1;
+        }
+        c->chunk = chunk;
+        c->chunk_size = hdr.bytes;
+    }
+    if (pulse_ring_wait(c, hdr.bytes) != 0) {
+        return -1;
+    }
+    rb_read(c->ring, c->chunk, hdr.bytes);
+
+    media->type = MEDIA_TYPE_AUDIO;
+    memset(frame, 0, sizeof(struct audio_frame));
+    frame->sample_rate = c->sample_rate;
+    frame->format = pulse_to_sample_format(c->format);
+    frame->data[0] = c->chunk;
+    frame->total_size = hdr.bytes;
+    frame->frames = hdr.bytes / c->bytes_per_frame;
+    frame->timestamp = hdr.timestamp;
+    frame->frame_id = hdr.frame_id;
     return 0;
 }
 
+static int _pa_ioctl(struct avcap_ctx *avcap, unsigned long int cmd, ...)
+{
+    printf("pulseaudio ioctl unsupport cmd!\n");
+    return -1;
+}
+
 static void _pa_close(struct avcap_ctx *avcap)
 {
     struct pulse_ctx *c = (struct pulse_ctx *)avcap->opaque;
@@ -726,6 +871,8 @@ static void _pa_close(struct avcap_ctx *avcap)
 
     pa_threaded_mainloop_stop(c->pa_mainloop);
     pa_threaded_mainloop_free(c->pa_mainloop);
+    rb_destroy(c->ring);
+    free(c->chunk);
     free(c->device);
     free(c);
 }
@@ -733,7 +880,7 @@ static void _pa_close(struct avcap_ctx *avcap)
 struct avcap_ops pulseaudio_ops = {
     ._open         = _pa_open,
     ._close        = _pa_close,
-    .ioctl        = NULL,
+    .ioctl        = _pa_ioctl,
     .start_stream = _pa_start_stream,
     .stop_stream  = _pa_stop_stream,
     .query_frame  = _pa_query_frame,
@@ -29,6 +29,7 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <stdarg.h>
+#include <poll.h>
 #include <sys/mman.h>
 #include <sys/epoll.h>
 #include <sys/eventfd.h>
@@ -69,40 +70,71 @@ static const uint32_t v4l2_cid_supported[] = {
 };
 
 #define MAX_V4L2_CID             (sizeof(v4l2_cid_supported)/sizeof(uint32_t))
-#define MAX_V4L_BUF              (32)
+#define MAX_V4L_BUF              (VIDEOCAP_MAX_BUFS)
 #define MAX_V4L_REQBUF_CNT       (4)
 #define MAX_V4L2_DQBUF_RETYR_CNT (5)
 
+struct v4l2_ctx;
+
+/*
+ * one capture buffer, handed out as media_buffer while held by frames and
+ * queued back to the driver when the last reference is dropped
+ */
+struct v4l2_buf {
+    struct iovec mem[VIDEO_MAX_PLANES];     /* one per memory plane */
+    int dmabuf_fd[VIDEO_MAX_PLANES];        /* exported or imported, -1 for none */
+    bool allocated;                         /* userptr allocated by us */
+    bool held;
+    int index;
+    struct v4l2_ctx *ctx;
+};
+
 struct v4l2_ctx {
     int fd;
     int cancel_fd;
     int channel; /*one video node may contain several input channel */
     int standard;
     uint32_t pixfmt;
-    uint32_t linesize;
     int dv_timing;
     uint32_t width;
     uint32_t height;
     uint32_t fps_num;
     uint32_t fps_den;
-    struct iovec buf[MAX_V4L_BUF];
+    enum v4l2_buf_type type;    /* single or multi planar capture */
+    uint32_t mem_planes;
+    uint32_t bytesperline[VIDEO_MAX_PLANES];
+    uint32_t sizeimage[VIDEO_MAX_PLANES];
+    enum v4l2_memory memory;
+    struct v4l2_buf buf[MAX_V4L_BUF];
     int buf_index;
     int req_count;
     bool qbuf_done;
     uint64_t first_ts;
     uint64_t frame_id;
+    /* driver sequence of this stream, gaps are frames the driver dropped */
+    uint64_t seq_base;
+    uint32_t last_seq;
+    bool seq_started;
+    uint64_t frames;
+    uint64_t dropped;
     struct v4l2_queryctrl controls[MAX_V4L2_CID];
     struct avcap_ctx *parent;
     struct thread *thread;
     bool is_streaming;
     int epfd;
     struct epoll_event events;
+    /* frames out in the wild keep the ctx alive past _close */
+    mutex_lock_t lock;
+    int outstanding;
+    bool closed;
 };
 
 static int avcap_v4l2_init(struct v4l2_ctx *c);
-static int avcap_v4l2_create_mmap(struct v4l2_ctx *c);
-static int avcap_v4l2_set_format(int fd, uint32_t *w, uint32_t *h, uint32_t *pixelformat, uint32_t *bytesperline);
-static int avcap_v4l2_set_framerate(int fd, uint32_t *fps_num, uint32_t *fps_den);
+static int avcap_v4l2_create_mmap(struct v4l2_ctx *c, struct videocap_config *conf);
+static int avcap_v4l2_import_bufs(struct v4l2_ctx *c, struct videocap_config *conf);
+static int avcap_v4l2_set_format(struct v4l2_ctx *c);
+static int avcap_v4l2_set_framerate(struct v4l2_ctx *c);
+static void avcap_v4l2_free(struct v4l2_ctx *c);
 //static int _v4l2_start_stream(struct avcap_ctx *avcap);
 
 
@@ -123,6 +155,8 @@ static const struct v4l2_fourcc_pixel_format {
     {PIXEL_FORMAT_I420,     V4L2_PIX_FMT_YVU420},
     {PIXEL_FORMAT_I420,     V4L2_PIX_FMT_YUV420},
     {PIXEL_FORMAT_NV12,     V4L2_PIX_FMT_NV12},
+    {PIXEL_FORMAT_NV12,     V4L2_PIX_FMT_NV12M},
+    {PIXEL_FORMAT_I420,     V4L2_PIX_FMT_YUV420M},
     {PIXEL_FORMAT_YVYU,     V4L2_PIX_FMT_YVYU},
     {PIXEL_FORMAT_YUY2,     V4L2_PIX_FMT_YUYV},
     {PIXEL_FORMAT_YUY2,     V4L2_PIX_FMT_VYUY},
@@ -203,6 +237,18 @@ static void *_v4l2_open(struct avcap_ctx *avcap, const char *dev, struct avcap_c
 #define v4l2_mmap   mmap_f
 #define v4l2_munmap munmap_f
 
+    c->fd = -1;
+    c->cancel_fd = -1;
+    c->epfd = -1;
+    mutex_lock_init(&c->lock);
+    for (int i = 0; i < MAX_V4L_BUF; i++) {
+        for (int p = 0; p < VIDEO_MAX_PLANES; p++) {
+            c->buf[i].dmabuf_fd[p] = -1;
+        }
+        c->buf[i].index = i;
+        c->buf[i].ctx = c;
+    }
+
     fd = v4l2_open(dev, O_RDWR);
     if (fd == -1) {
         printf("open %s failed: %d\n", dev, errno);
@@ -226,19 +272,37 @@ static void *_v4l2_open(struct avcap_ctx *avcap, const char *dev, struct avcap_c
         goto failed;
     }
 
-    if (avcap_v4l2_set_format(c->fd, &c->width, &c->height, &c->pixfmt, &c->linesize) < 0) {
+    if (avcap_v4l2_set_format(c) < 0) {
         printf("%s:%d avcap_v4l2_set_format failed %d\n", __func__, __LINE__, errno);
         goto failed;
     }
 
-    if (avcap_v4l2_set_framerate(c->fd, &c->fps_num, &c->fps_den) < 0) {
+    if (avcap_v4l2_set_framerate(c) < 0) {
         printf("avcap_v4l2_set_framerate failed\n");
         //goto failed;
     }
 
-    if (avcap_v4l2_create_mmap(c) < 0) {
-        printf("avcap_v4l2_create_mmap failed\n");
-        goto failed;
+    switch (conf->memory) {
+    case VIDEOCAP_MEMORY_DMABUF:
+        c->memory = V4L2_MEMORY_DMABUF;
+        break;
+    case VIDEOCAP_MEMORY_USERPTR:
+        c->memory = V4L2_MEMORY_USERPTR;
+        break;
+    default:
+        c->memory = V4L2_MEMORY_MMAP;
+        break;
+    }
+    if (c->memory == V4L2_MEMORY_MMAP) {
+        if (avcap_v4l2_create_mmap(c, conf) < 0) {
+            printf("avcap_v4l2_create_mmap failed\n");
+            goto failed;
+        }
+    } else {
+        if (avcap_v4l2_import_bufs(c, conf) < 0) {
+            printf("avcap_v4l2_import_bufs failed\n");
+            goto failed;
+        }
     }
 
     avcap->conf.video.width = c->width;
@@ -251,12 +315,7 @@ static void *_v4l2_open(struct avcap_ctx *avcap, const char *dev, struct avcap_c
     return c;
 
 failed:
-    if (fd != -1) {
-        v4l2_close(fd);
-    }
-    if (c) {
-        free(c);
-    }
+    avcap_v4l2_free(c);
     return NULL;
 }
 
@@ -271,12 +330,12 @@ static int avcap_v4l2_set_config(struct avcap_ctx *avcap, struct avcap_config *a
     c->fps_den = conf->fps.den;
     c->pixfmt  = pxlfmt_to_v4l2fmt(conf->format);
 
-    if (avcap_v4l2_set_format(c->fd, &c->width, &c->height, &c->pixfmt, &c->linesize) < 0) {
+    if (avcap_v4l2_set_format(c) < 0) {
         printf("%s:%d avcap_v4l2_set_format failed %d\n", __func__, __LINE__, errno);
         return -1;
     }
 
-    if (avcap_v4l2_set_framerate(c->fd, &c->fps_num, &c->fps_den) < 0) {
+    if (avcap_v4l2_set_framerate(c) < 0) {
         printf("avcap_v4l2_set_framerate failed\n");
         return -1;
     }
@@ -379,10 +438,30 @@ static int v4l2_set_control(int fd, uint32_t id, int val)
 
 static int avcap_v4l2_init(struct v4l2_ctx *c)
 {
+    uint32_t caps;
+    struct v4l2_capability cap;
     struct v4l2_input in;
     memset(&in, 0, sizeof(in));
 
+    if (v4l2_ioctl(c->fd, VIDIOC_QUERYCAP, &cap) < 0) {
+        printf("ioctl VIDIOC_QUERYCAP failed:%d\n", errno);
+        return -1;
+    }
+    caps = (cap.capabilities & V4L2_CAP_DEVICE_CAPS) ? cap.device_caps : cap.capabilities;
+    if (caps & V4L2_CAP_VIDEO_CAPTURE) {
+        c->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    } else if (caps & V4L2_CAP_VIDEO_CAPTURE_MPLANE) {
+        c->type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    } else {
+        printf("Device does not support capturing.\n");
+        return -1;
+    }
+
     if (v4l2_ioctl(c->fd, VIDIOC_G_INPUT, &in.index) < 0) {
+        /* isp video nodes often have no input to select */
+        if (errno == ENOTTY) {
+            return 0;
+        }
         printf("ioctl VIDIOC_G_INPUT failed:%d\n", errno);
         return -1;
     }
@@ -408,126 +487,274 @@ static int avcap_v4l2_init(struct v4l2_ctx *c)
     return 0;
 }
 
-static int avcap_v4l2_set_format(int fd, uint32_t *width, uint32_t *height,
-                uint32_t *pixelformat, uint32_t *bytesperline)
+static void v4l2_fmt_get(struct v4l2_format *fmt, uint32_t *width,
+                uint32_t *height, uint32_t *pixelformat)
+{
+    if (fmt->type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
+        *width = fmt->fmt.pix_mp.width;
+        *height = fmt->fmt.pix_mp.height;
+        *pixelformat = fmt->fmt.pix_mp.pixelformat;
+    } else {
+        *width = fmt->fmt.pix.width;
+        *height = fmt->fmt.pix.height;
+        *pixelformat = fmt->fmt.pix.pixelformat;
+    }
+}
+
+static void v4l2_fmt_set(struct v4l2_format *fmt, uint32_t width,
+                uint32_t height, uint32_t pixelformat)
+{
+    if (fmt->type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
+        fmt->fmt.pix_mp.width = width;
+        fmt->fmt.pix_mp.height = height;
+        fmt->fmt.pix_mp.pixelformat = pixelformat;
+    } else {
+        fmt->fmt.pix.width = width;
+        fmt->fmt.pix.height = height;
+        fmt->fmt.pix.pixelformat = pixelformat;
+    }
+}
+
+static int avcap_v4l2_set_format(struct v4l2_ctx *c)
 {
     bool update;
     struct v4l2_format fmt;
+    uint32_t width, height, pixelformat;
+    bool mplane = (c->type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE);
 
-    fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    memset(&fmt, 0, sizeof(fmt));
+    fmt.type = c->type;
 
-    if (v4l2_ioctl(fd, VIDIOC_G_FMT, &fmt) < 0) {
+    if (v4l2_ioctl(c->fd, VIDIOC_G_FMT, &fmt) < 0) {
         printf("%s VIDIOC_G_FMT failed: %d\n", __func__, errno);
         return -1;
     }
+    v4l2_fmt_get(&fmt, &width, &height, &pixelformat);
 
-    if (fmt.fmt.pix.width == *width && fmt.fmt.pix.height == *height &&
-        fmt.fmt.pix.pixelformat == *pixelformat) {
+    if (width == c->width && height == c->height &&
+        pixelformat == c->pixfmt) {
         update = false;
     } else {
         update = true;
-        fmt.fmt.pix.width       = *width;
-        fmt.fmt.pix.height      = *height;
-        fmt.fmt.pix.pixelformat = *pixelformat;
+        v4l2_fmt_set(&fmt, c->width, c->height, c->pixfmt);
     }
 
-    if (update && v4l2_ioctl(fd, VIDIOC_S_FMT, &fmt) < 0) {
+    if (update && v4l2_ioctl(c->fd, VIDIOC_S_FMT, &fmt) < 0) {
         printf("%s VIDIOC_S_FMT failed: %d\n", __func__, errno);
         return -1;
     }
+    v4l2_fmt_get(&fmt, &width, &height, &pixelformat);
 
-    if (fmt.fmt.pix.width != *width || fmt.fmt.pix.height != *height) {
+    if (width != c->width || height != c->height) {
         printf("v4l2 resolution force from %d*%d to %d*%d\n",
-                *width, *height, fmt.fmt.pix.width,fmt.fmt.pix.height);
+                c->width, c->height, width, height);
     }
 
-    if (fmt.fmt.pix.pixelformat != *pixelformat) {
+    if (pixelformat != c->pixfmt) {
         printf("v4l2 format force from %s to %s\n",
-                V4L2_FOURCC_STR(*pixelformat),
-                V4L2_FOURCC_STR(fmt.fmt.pix.pixelformat));
+                V4L2_FOURCC_STR(c->pixfmt),
+                V4L2_FOURCC_STR(pixelformat));
+    }
+
+    c->width = width;
+    c->height = height;
+    c->pixfmt = pixelformat;
+    memset(c->bytesperline, 0, sizeof(c->bytesperline));
+    memset(c->sizeimage, 0, sizeof(c->sizeimage));
+    if (mplane) {
+        c->mem_planes = fmt.fmt.pix_mp.num_planes;
+        if (c->mem_planes < 1 || c->mem_planes > VIDEO_MAX_PLANES) {
+            printf("v4l2 invalid num_planes %d\n", c->mem_planes);
+            return -1;
+        }
+        for (int i = 0; i < c->mem_planes; i++) {
+            c->bytesperline[i] = fmt.fmt.pix_mp.plane_fmt[i].bytesperline;
+            c->sizeimage[i] = fmt.fmt.pix_mp.plane_fmt[i].sizeimage;
+        }
+    } else {
+        c->mem_planes = 1;
+        c->bytesperline[0] = fmt.fmt.pix.bytesperline;
+        c->sizeimage[0] = fmt.fmt.pix.sizeimage;
     }
-
-    *width = fmt.fmt.pix.width;
-    *height = fmt.fmt.pix.height;
-    *pixelformat = fmt.fmt.pix.pixelformat;
-    *bytesperline = fmt.fmt.pix.bytesperline;
     return 0;
 }
 
-static int avcap_v4l2_set_framerate(int fd, uint32_t *fps_num, uint32_t *fps_den)
+static int avcap_v4l2_set_framerate(struct v4l2_ctx *c)
 {
     bool update;
     struct v4l2_streamparm par;
+    struct v4l2_fract *tpf = &par.parm.capture.timeperframe;
 
-    par.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    memset(&par, 0, sizeof(par));
+    par.type = c->type;
 
-    if (v4l2_ioctl(fd, VIDIOC_G_PARM, &par) < 0) {
+    if (v4l2_ioctl(c->fd, VIDIOC_G_PARM, &par) < 0) {
         printf("%s VIDIOC_G_PARM failed:%d\n", __func__, errno);
         return -1;
     }
 
-    if (par.parm.capture.timeperframe.numerator == *fps_den &&
-        par.parm.capture.timeperframe.denominator == *fps_num) {
+    if (tpf->numerator == c->fps_den && tpf->denominator == c->fps_num) {
         update = false;
     } else {
         update = true;
-        par.parm.capture.timeperframe.numerator = *fps_den;
-        par.parm.capture.timeperframe.denominator = *fps_num;
+        tpf->numerator = c->fps_den;
+        tpf->denominator = c->fps_num;
     }
 
-    if (update && v4l2_ioctl(fd, VIDIOC_S_PARM, &par) < 0) {
+    if (update && v4l2_ioctl(c->fd, VIDIOC_S_PARM, &par) < 0) {
         printf("%s VIDIOC_S_PARM failed:%d\n", __func__, errno);
         return -1;
     }
 
-    if (par.parm.capture.timeperframe.numerator != *fps_den ||
-        par.parm.capture.timeperframe.denominator != *fps_num) {
+    if (tpf->numerator != c->fps_den || tpf->denominator != c->fps_num) {
         printf("v4l2 framerate force from %d/%d to %d/%d\n",
-                *fps_num, *fps_den,
-                par.parm.capture.timeperframe.denominator,
-                par.parm.capture.timeperframe.numerator);
+                c->fps_num, c->fps_den, tpf->denominator, tpf->numerator);
     }
-    *fps_den = par.parm.capture.timeperframe.numerator;
-    *fps_num = par.parm.capture.timeperframe.denominator;
+    c->fps_den = tpf->numerator;
+    c->fps_num = tpf->denominator;
     return 0;
 }
 
-static int avcap_v4l2_enqueue(struct avcap_ctx *avcap, void *buf, size_t len)
+static int avcap_v4l2_qbuf(struct v4l2_ctx *c, int index)
 {
-    struct v4l2_ctx *c = (struct v4l2_ctx *)avcap->opaque;
+    struct v4l2_buf *b = &c->buf[index];
+    struct v4l2_plane planes[VIDEO_MAX_PLANES];
     struct v4l2_buffer qbuf = {
-        .type = V4L2_BUF_TYPE_VIDEO_CAPTURE,
-        .memory = V4L2_MEMORY_MMAP,
-        .index = c->buf_index
+        .type = c->type,
+        .memory = c->memory,
+        .index = index
     };
 
-    if (c->qbuf_done) {
-        return 0;
+    if (c->type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
+        memset(planes, 0, sizeof(planes));
+        qbuf.m.planes = planes;
+        qbuf.length = c->mem_planes;
+        for (int p = 0; p < c->mem_planes; p++) {
+            if (c->memory == V4L2_MEMORY_DMABUF) {
+                planes[p].m.fd = b->dmabuf_fd[p];
+                planes[p].length = b->mem[p].iov_len;
+            } else if (c->memory == V4L2_MEMORY_USERPTR) {
+                planes[p].m.userptr = (unsigned long)b->mem[p].iov_base;
+                planes[p].length = b->mem[p].iov_len;
+            }
+        }
+    } else {
+        switch (c->memory) {
+        case V4L2_MEMORY_DMABUF:
+            qbuf.m.fd = b->dmabuf_fd[0];
+            qbuf.length = b->mem[0].iov_len;
+            break;
+        case V4L2_MEMORY_USERPTR:
+            qbuf.m.userptr = (unsigned long)b->mem[0].iov_base;
+            qbuf.length = b->mem[0].iov_len;
+            break;
+        default:
+            break;
+        }
     }
     if (v4l2_ioctl(c->fd, VIDIOC_QBUF, &qbuf) < 0) {
         printf("%s ioctl(VIDIOC_QBUF) failed: %d\n", __func__, errno);
         return -1;
     }
+    return 0;
+}
+
+static int avcap_v4l2_enqueue(struct avcap_ctx *avcap, void *buf, size_t len)
+{
+    struct v4l2_ctx *c = (struct v4l2_ctx *)avcap->opaque;
+
+    if (c->qbuf_done) {
+        return 0;
+    }
+    if (avcap_v4l2_qbuf(c, c->buf_index) < 0) {
+        return -1;
+    }
     c->qbuf_done = true;
     return 0;
 }
 
-static int avcap_v4l2_dequeue(struct avcap_ctx *avcap, struct video_frame *frame)
+/*
+ * point the planes of frame into a capture buffer with the driver strides,
+ * a single memory plane holds the planes back to back as v4l2 lays them out
+ */
+static void avcap_v4l2_map_planes(struct v4l2_ctx *c, struct video_frame *frame, uint8_t **base)
 {
-    int retry_cnt = 0;
-    uint8_t *start;
-    struct v4l2_buffer qbuf;
+    uint32_t bpl = c->bytesperline[0];
     int i;
 
-    struct v4l2_ctx *c = (struct v4l2_ctx *)avcap->opaque;
-    if (!c->qbuf_done) {
-        printf("v4l2 need VIDIOC_QBUF first!\n");
-        return -1;
+    if (!base[0]) {
+        /* dmabuf without cpu mapping is only reachable by fd */
+        for (i = 0; i < frame->planes; i++) {
+            frame->data[i] = NULL;
+        }
+        return;
+    }
+    if (c->mem_planes > 1) {
+        for (i = 0; i < c->mem_planes && i < frame->planes; i++) {
+            frame->data[i] = base[i];
+            frame->linesize[i] = c->bytesperline[i];
+        }
+        return;
     }
+    frame->data[0] = base[0];
+    if (!bpl) {
+        for (i = 1; i < frame->planes; i++) {
+            frame->data[i] = base[0] + frame->plane_offsets[i];
+        }
+        return;
+    }
+    frame->linesize[0] = bpl;
+    switch (frame->format) {
+    case PIXEL_FORMAT_NV12:
+        frame->data[1] = base[0] + bpl * c->height;
+        frame->linesize[1] = bpl;
+        break;
+    case PIXEL_FORMAT_I420:
+        frame->data[1] = base[0] + bpl * c->height;
+        frame->linesize[1] = bpl / 2;
+        frame->data[2] = frame->data[1] + bpl / 2 * c->height / 2;
+        frame->linesize[2] = bpl / 2;
+        break;
+    default:
+        for (i = 1; i < frame->planes; i++) {
+            frame->data[i] = base[0] + frame->plane_offsets[i];
+        }
+        break;
+    }
+}
+
+static void avcap_v4l2_copy_planes(struct video_frame *dst, const struct video_frame *src)
+{
+    for (int i = 0; i < src->planes; i++) {
+        uint32_t h = src->height;
+        uint32_t len = dst->linesize[i] < src->linesize[i] ? dst->linesize[i] : src->linesize[i];
+        if (i > 0 && (src->format == PIXEL_FORMAT_I420 || src->format == PIXEL_FORMAT_NV12)) {
+            h /= 2;
+        }
+        for (uint32_t y = 0; y < h; y++) {
+            memcpy(dst->data[i] + y * dst->linesize[i], src->data[i] + y * src->linesize[i], len);
+        }
+    }
+}
+
+static int avcap_v4l2_dqbuf(struct v4l2_ctx *c, struct video_frame *frame)
+{
+    int retry_cnt = 0;
+    uint8_t *base[VIDEO_MAX_PLANES] = {NULL};
+    struct v4l2_plane planes[VIDEO_MAX_PLANES];
+    struct v4l2_buffer qbuf;
+    struct v4l2_buf *b;
+    uint64_t bytesused = 0;
+    uint32_t seq;
 
     memset(&qbuf, 0, sizeof(qbuf));
-    qbuf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    qbuf.memory = V4L2_MEMORY_MMAP;
+    qbuf.type = c->type;
+    qbuf.memory = c->memory;
+    if (c->type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
+        memset(planes, 0, sizeof(planes));
+        qbuf.m.planes = planes;
+        qbuf.length = c->mem_planes;
+    }
 
 retry:
     if (v4l2_ioctl(c->fd, VIDIOC_DQBUF, &qbuf) < 0) {
@@ -542,42 +769,147 @@ retry:
         }
     }
 
-    c->qbuf_done = false;
     c->buf_index = qbuf.index;
+    b = &c->buf[qbuf.index];
 
     frame->timestamp = timeval2ns(qbuf.timestamp);
     if (c->frame_id == 0) {
         c->first_ts = frame->timestamp;
     }
     frame->timestamp -= c->first_ts;
-    frame->frame_id = c->frame_id;
-    c->frame_id++;
 
-    start = (uint8_t *)c->buf[qbuf.index].iov_base;
+    /* frame_id follows the driver sequence, so a gap is a dropped frame */
+    seq = qbuf.sequence;
+    if (!c->seq_started) {
+        c->dropped += seq;
+        c->seq_started = true;
+    } else if (seq > c->last_seq) {
+        c->dropped += seq - c->last_seq - 1;
+    } else {
+        seq = c->last_seq + 1;  /* driver without sequence numbers */
+    }
+    c->last_seq = seq;
+    c->frames++;
+    frame->frame_id = c->seq_base + seq;
+    c->frame_id = frame->frame_id + 1;
 
-    if (frame->mem_type == MEDIA_MEM_SHALLOW) {//frame data ptr
-        for (i = 0; i < frame->planes; ++i) {
-            frame->data[i] = start + frame->plane_offsets[i];
-        }
-    } else if (frame->mem_type == MEDIA_MEM_DEEP) {//frame data copy
-        switch (frame->format) {
-        case PIXEL_FORMAT_YUY2:
-            memcpy(frame->data[0], start + frame->plane_offsets[0], frame->linesize[0]*frame->height);
-            break;
-        case PIXEL_FORMAT_I420:
-            memcpy(frame->data[0], start + frame->plane_offsets[0], frame->linesize[0]*frame->height);
-            memcpy(frame->data[1], start + frame->plane_offsets[1], frame->linesize[1]*frame->height / 2);
-            memcpy(frame->data[2], start + frame->plane_offsets[2], frame->linesize[2]*frame->height / 2);
-            break;
-        default:
-            break;
+    if (c->type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
+        for (int p = 0; p < c->mem_planes; p++) {
+            if (b->mem[p].iov_base) {
+                base[p] = (uint8_t *)b->mem[p].iov_base + planes[p].data_offset;
+            }
+            bytesused += planes[p].bytesused - planes[p].data_offset;
         }
+    } else {
+        base[0] = (uint8_t *)b->mem[0].iov_base;
+        bytesused = qbuf.bytesused;
+    }
+
+    if (frame->mem_type == MEDIA_MEM_SHALLOW) {//frame data ptr
+        avcap_v4l2_map_planes(c, frame, base);
+    } else if (frame->mem_type == MEDIA_MEM_DEEP && base[0]) {//frame data copy
+        struct video_frame view = *frame;
+        avcap_v4l2_map_planes(c, &view, base);
+        avcap_v4l2_copy_planes(frame, &view);
     }
-    frame->total_size = qbuf.bytesused;
+    frame->total_size = bytesused;
 
     return frame->total_size;
 }
 
+static int avcap_v4l2_dequeue(struct avcap_ctx *avcap, struct video_frame *frame)
+{
+    int ret;
+    struct v4l2_ctx *c = (struct v4l2_ctx *)avcap->opaque;
+    if (!c->qbuf_done) {
+        printf("v4l2 need VIDIOC_QBUF first!\n");
+        return -1;
+    }
+    ret = avcap_v4l2_dqbuf(c, frame);
+    if (ret != -1) {
+        c->qbuf_done = false;
+    }
+    return ret;
+}
+
+static void v4l2_buf_release(void *opaque, uint8_t *data)
+{
+    struct v4l2_buf *b = (struct v4l2_buf *)opaque;
+    struct v4l2_ctx *c = b->ctx;
+    bool last;
+
+    mutex_lock(&c->lock);
+    b->held = false;
+    if (c->is_streaming) {
+        avcap_v4l2_qbuf(c, b->index);
+    }
+    last = (--c->outstanding == 0 && c->closed);
+    mutex_unlock(&c->lock);
+    if (last) {
+        avcap_v4l2_free(c);
+    }
+}
+
+/*
+ * the frame takes the dequeued buffer as refcounted memory, it goes back to
+ * the driver when the last video_frame_ref of it is deinit, not on the next
+ * dequeue, so consumers may keep frames without copying them
+ */
+static int avcap_v4l2_hold(struct v4l2_ctx *c, struct video_frame *frame)
+{
+    struct v4l2_buf *b = &c->buf[c->buf_index];
+
+    frame->buf = media_buffer_wrap(b->mem[0].iov_base, b->mem[0].iov_len, v4l2_buf_release, b);
+    mutex_lock(&c->lock);
+    if (!frame->buf) {
+        if (c->is_streaming) {
+            avcap_v4l2_qbuf(c, b->index);
+        }
+        mutex_unlock(&c->lock);
+        return -1;
+    }
+    b->held = true;
+    c->outstanding++;
+    mutex_unlock(&c->lock);
+    return 0;
+}
+
+static int avcap_v4l2_get_dmabuf(struct v4l2_ctx *c, struct video_dmabuf *dmabuf)
+{
+    struct media_buffer *mb;
+    struct v4l2_buf *b;
+
+    if (!dmabuf || !dmabuf->frame) {
+        printf("%s:%d invalid paraments!\n", __func__, __LINE__);
+        return -1;
+    }
+    mb = dmabuf->frame->buf;
+    if (!mb || mb->free_cb != v4l2_buf_release) {
+        printf("frame is not held on a v4l2 buffer\n");
+        return -1;
+    }
+    b = (struct v4l2_buf *)mb->opaque;
+    if (b->ctx != c || b->dmabuf_fd[0] == -1) {
+        printf("v4l2 buffer %d has no dmabuf, set export_dmabuf\n", b->index);
+        return -1;
+    }
+    dmabuf->planes = c->mem_planes;
+    for (int p = 0; p < c->mem_planes; p++) {
+        dmabuf->fd[p] = b->dmabuf_fd[p];
+        dmabuf->size[p] = b->mem[p].iov_len;
+    }
+    return 0;
+}
+
+static bool avcap_v4l2_ready(struct v4l2_ctx *c)
+{
+    struct pollfd pfd = {
+        .fd = c->fd,
+        .events = POLLIN
+    };
+    return poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN);
+}
+
 static int avcap_v4l2_poll_init(struct v4l2_ctx *c)
 {
     struct epoll_event epev;
@@ -630,6 +962,7 @@ static void avcap_v4l2_poll_deinit(struct v4l2_ctx *c)
         printf("epoll_ctl EPOLL_CTL_DEL failed %d!\n", errno);
     }
     close(c->epfd);
+    c->epfd = -1;
 }
 
 static void *v4l2_thread(struct thread *t, void *arg)
@@ -645,19 +978,26 @@ static void *v4l2_thread(struct thread *t, void *arg)
     media.type = MEDIA_TYPE_VIDEO;
     video_frame_init(&media.video, conf->format, conf->width, conf->height, MEDIA_MEM_SHALLOW);
     while (c->is_streaming) {
-        if (avcap_v4l2_enqueue(avcap, NULL, 0) != 0) {
-            printf("avcap_v4l2_enqueue failed\n");
-            continue;
-        }
         if (avcap_v4l2_poll(avcap, -1) != 0) {
             printf("avcap_v4l2_poll failed\n");
             continue;
         }
-
-        if (avcap_v4l2_dequeue(avcap, &media.video) == -1) {
-            printf("avcap_v4l2_dequeue failed\n");
+        if (!c->is_streaming) {
+            break;
         }
-        avcap->on_media_frame(avcap, &media);
+        /* one wakeup may stand for several finished buffers, take them all */
+        do {
+            if (avcap_v4l2_dqbuf(c, &media.video) == -1) {
+                printf("avcap_v4l2_dqbuf failed\n");
+                break;
+            }
+            if (avcap_v4l2_hold(c, &media.video) != 0) {
+                printf("avcap_v4l2_hold failed\n");
+                continue;
+            }
+            avcap->on_media_frame(avcap, &media);
+            video_frame_deinit(&media.video);
+        } while (c->is_streaming && avcap_v4l2_ready(c));
     }
     avcap_v4l2_poll_deinit(c);
     return NULL;
@@ -666,32 +1006,40 @@ static void *v4l2_thread(struct thread *t, void *arg)
 static int _v4l2_start_stream(struct avcap_ctx *avcap)
 {
     enum v4l2_buf_type type;
-    struct v4l2_buffer enq;
     struct v4l2_ctx *c = (struct v4l2_ctx *)avcap->opaque;
 
     if (c->is_streaming) {
         printf("v4l2 is streaming already!\n");
         return -1;
     }
-    memset(&enq, 0, sizeof(enq));
-    enq.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    enq.memory = V4L2_MEMORY_MMAP;
 
-    for (enq.index = 0; enq.index < c->req_count; ++enq.index) {
-        if (v4l2_ioctl(c->fd, VIDIOC_QBUF, &enq) < 0) {
+    /* buffers still held by frames of last stream are queued on release */
+    mutex_lock(&c->lock);
+    for (int i = 0; i < c->req_count; ++i) {
+        if (c->buf[i].held) {
+            continue;
+        }
+        if (avcap_v4l2_qbuf(c, i) < 0) {
+            mutex_unlock(&c->lock);
             printf("unable to queue buffer\n");
             return -1;
         }
     }
     c->qbuf_done = true;
+    c->is_streaming = true;
+    mutex_unlock(&c->lock);
+    c->seq_base = c->frame_id;
+    c->seq_started = false;
 
-    type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    type = c->type;
     if (v4l2_ioctl(c->fd, VIDIOC_STREAMON, &type) < 0) {
         printf("unable to start stream\n");
+        mutex_lock(&c->lock);
+        c->is_streaming = false;
+        mutex_unlock(&c->lock);
         return -1;
     }
 
-    c->is_streaming = true;
     if (avcap->on_media_frame) {
         c->thread = thread_create(v4l2_thread, avcap);
         if (!c->thread) {
@@ -703,11 +1051,36 @@ static int _v4l2_start_stream(struct avcap_ctx *avcap)
     return 0;
 }
 
-static void avcap_v4l2_destroy_mmap(struct v4l2_ctx *c)
+static void avcap_v4l2_destroy_bufs(struct v4l2_ctx *c)
 {
     for (int i = 0; i < c->req_count; ++i) {
-        if (c->buf[i].iov_base != MAP_FAILED && c->buf[i].iov_base != 0)
-            v4l2_munmap(c->buf[i].iov_base, c->buf[i].iov_len);
+        struct v4l2_buf *b = &c->buf[i];
+        for (int p = 0; p < VIDEO_MAX_PLANES; p++) {
+            struct iovec *mem = &b->mem[p];
+            switch (c->memory) {
+            case V4L2_MEMORY_MMAP:
+                if (mem->iov_base != MAP_FAILED && mem->iov_base != 0)
+                    v4l2_munmap(mem->iov_base, mem->iov_len);
+                if (b->dmabuf_fd[p] != -1)
+                    close(b->dmabuf_fd[p]);
+                break;
+            case V4L2_MEMORY_DMABUF:
+                /* fd belongs to the caller, only our cpu mapping is dropped */
+                if (mem->iov_base)
+                    munmap(mem->iov_base, mem->iov_len);
+                break;
+            case V4L2_MEMORY_USERPTR:
+                if (b->allocated)
+                    free(mem->iov_base);
+                break;
+            default:
+                break;
+            }
+            mem->iov_base = NULL;
+            mem->iov_len = 0;
+            b->dmabuf_fd[p] = -1;
+        }
+        b->allocated = false;
     }
 
     if (c->req_count) {
@@ -718,16 +1091,18 @@ static void avcap_v4l2_destroy_mmap(struct v4l2_ctx *c)
 static int _v4l2_stop_stream(struct avcap_ctx *avcap)
 {
     uint64_t notify = '1';
-    enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
     struct v4l2_ctx *c = (struct v4l2_ctx *)avcap->opaque;
+    enum v4l2_buf_type type = c->type;
 
     if (!c->is_streaming) {
         printf("v4l2 stream stopped already!\n");
         return -1;
     }
 
+    mutex_lock(&c->lock);
+    c->is_streaming = false;
+    mutex_unlock(&c->lock);
     if (avcap->on_media_frame) {
-        c->is_streaming = false;
         if (sizeof(uint64_t) != write(c->cancel_fd, &notify, sizeof(uint64_t))) {
             perror("write error");
         }
@@ -751,56 +1126,173 @@ static int _v4l2_query_frame(struct avcap_ctx *avcap, struct media_frame *frame)
     return avcap_v4l2_dequeue(avcap, &frame->video);
 }
 
-static int avcap_v4l2_create_mmap(struct v4l2_ctx *c)
+static int avcap_v4l2_create_mmap(struct v4l2_ctx *c, struct videocap_config *conf)
 {
     struct v4l2_buffer buf;
+    struct v4l2_plane planes[VIDEO_MAX_PLANES];
+    bool mplane = (c->type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE);
     struct v4l2_requestbuffers req = {
-        .type = V4L2_BUF_TYPE_VIDEO_CAPTURE,
-        .count = MAX_V4L_REQBUF_CNT,
+        .type = c->type,
+        .count = conf->buf_count > 0 ? conf->buf_count : MAX_V4L_REQBUF_CNT,
         .memory = V4L2_MEMORY_MMAP
     };
+    if (req.count > MAX_V4L_BUF) {
+        req.count = MAX_V4L_BUF;
+    }
     //request buffer
     if (v4l2_ioctl(c->fd, VIDIOC_REQBUFS, &req) < 0) {
         printf("%s ioctl(VIDIOC_REQBUFS) failed: %d\n", __func__, errno);
         return -1;
     }
-    c->req_count = req.count;
-    if (req.count > MAX_V4L_REQBUF_CNT || req.count < 2) {
+    if (req.count > MAX_V4L_BUF || req.count < 2) {
         printf("Insufficient buffer memory\n");
         return -1;
     }
+    c->req_count = req.count;
 
     memset(&buf, 0, sizeof(buf));
     buf.type = req.type;
     buf.memory = req.memory;
 
     for (buf.index = 0; buf.index < c->req_count; ++buf.index) {
+        struct v4l2_buf *b = &c->buf[buf.index];
+        if (mplane) {
+            memset(planes, 0, sizeof(planes));
+            buf.m.planes = planes;
+            buf.length = c->mem_planes;
+        }
         //query buffer
         if (v4l2_ioctl(c->fd, VIDIOC_QUERYBUF, &buf) < 0) {
             printf("%s ioctl(VIDIOC_QUERYBUF) failed: %d\n", __func__, errno);
             return -1;
         }
-        //mmap buffer
-        c->buf[buf.index].iov_len = buf.length;
-        c->buf[buf.index].iov_base =
-                v4l2_mmap(NULL, buf.length, PROT_READ|PROT_WRITE,
-                                MAP_SHARED, c->fd, buf.m.offset);
-        if (MAP_FAILED == c->buf[buf.index].iov_base) {
-            printf("mmap failed: %d\n", errno);
-            return -1;
+        for (int p = 0; p < c->mem_planes; p++) {
+            uint32_t length = mplane ? planes[p].length : buf.length;
+            uint32_t offset = mplane ? planes[p].m.mem_offset : buf.m.offset;
+            //mmap buffer
+            b->mem[p].iov_len = length;
+            b->mem[p].iov_base = v4l2_mmap(NULL, length, PROT_READ|PROT_WRITE,
+                                MAP_SHARED, c->fd, offset);
+            if (MAP_FAILED == b->mem[p].iov_base) {
+                printf("mmap failed: %d\n", errno);
+                return -1;
+            }
+            //export buffer, hardware encoder imports the fd
+            if (conf->export_dmabuf) {
+                struct v4l2_exportbuffer expbuf = {
+                    .type = c->type,
+                    .index = buf.index,
+                    .plane = p,
+                    .flags = O_RDONLY | O_CLOEXEC
+                };
+                if (v4l2_ioctl(c->fd, VIDIOC_EXPBUF, &expbuf) < 0) {
+                    printf("%s ioctl(VIDIOC_EXPBUF) failed: %d\n", __func__, errno);
+                    return -1;
+                }
+                b->dmabuf_fd[p] = expbuf.fd;
+            }
         }
     }
     return 0;
 }
 
+static int avcap_v4l2_import_bufs(struct v4l2_ctx *c, struct videocap_config *conf)
+{
+    long page = sysconf(_SC_PAGESIZE);
+    size_t size = conf->buf_size ? conf->buf_size : c->sizeimage[0];
+    struct v4l2_requestbuffers req = {
+        .type = c->type,
+        .count = conf->buf_count > 0 ? conf->buf_count : MAX_V4L_REQBUF_CNT,
+        .memory = c->memory
+    };
+
+    if (req.count > MAX_V4L_BUF) {
+        printf("%s: at most %d buffers\n", __func__, MAX_V4L_BUF);
+        return -1;
+    }
+    /* one fd or pointer per buffer, formats with several memory planes can't */
+    if (c->mem_planes != 1) {
+        printf("%s: %d memory planes need mmap\n", __func__, c->mem_planes);
+        return -1;
+    }
+    if (c->memory == V4L2_MEMORY_DMABUF && conf->buf_count <= 0) {
+        printf("%s: dmabuf import needs buf_count fds\n", __func__);
+        return -1;
+    }
+    if (v4l2_ioctl(c->fd, VIDIOC_REQBUFS, &req) < 0) {
+        printf("%s ioctl(VIDIOC_REQBUFS) failed: %d\n", __func__, errno);
+        return -1;
+    }
+    /* driver may raise the count, but we have no memory for the extra */
+    if (req.count < 2 || (conf->buf_count > 0 && req.count > conf->buf_count) ||
+        req.count > MAX_V4L_BUF) {
+        printf("Insufficient buffer memory\n");
+        return -1;
+    }
+    c->req_count = req.count;
+
+    for (int i = 0; i < c->req_count; i++) {
+        struct v4l2_buf *b = &c->buf[i];
+        if (c->memory == V4L2_MEMORY_DMABUF) {
+            off_t len = conf->buf_size;
+            b->dmabuf_fd[0] = conf->dmabuf_fd[i];
+            if (!len) {
+                len = lseek(b->dmabuf_fd[0], 0, SEEK_END);
+            }
+            if (len <= 0) {
+                printf("dmabuf %d has unknown size: %d\n", b->dmabuf_fd[0], errno);
+                return -1;
+            }
+            b->mem[0].iov_len = len;
+            b->mem[0].iov_base = mmap(NULL, len, PROT_READ, MAP_SHARED, b->dmabuf_fd[0], 0);
+            if (b->mem[0].iov_base == MAP_FAILED) {
+                b->mem[0].iov_base = NULL;
+            }
+        } else {
+            b->mem[0].iov_len = size;
+            b->mem[0].iov_base = conf->userptr[i];
+            if (!b->mem[0].iov_base) {
+                void *ptr = NULL;
+                if (posix_memalign(&ptr, page, (size + page - 1) / page * page)) {
+                    printf("malloc userptr buffer %zu failed!\n", size);
+                    return -1;
+                }
+                b->mem[0].iov_base = ptr;
+                b->allocated = true;
+            }
+        }
+    }
+    return 0;
+}
+
+static void avcap_v4l2_free(struct v4l2_ctx *c)
+{
+    avcap_v4l2_destroy_bufs(c);
+    if (c->fd != -1) {
+        v4l2_close(c->fd);
+    }
+    if (c->cancel_fd != -1) {
+        close(c->cancel_fd);
+    }
+    if (c->epfd != -1) {
+        close(c->epfd);
+    }
+    mutex_lock_deinit(&c->lock);
+    free(c);
+}
+
 static void _v4l2_close(struct avcap_ctx *avcap)
 {
+    bool last;
     struct v4l2_ctx *c = (struct v4l2_ctx *)avcap->opaque;
     //_v4l2_stop_stream(avcap);
-    avcap_v4l2_destroy_mmap(c);
-    v4l2_close(c->fd);
-    close(c->epfd);
-    free(c);
+    mutex_lock(&c->lock);
+    c->closed = true;
+    last = (c->outstanding == 0);
+    mutex_unlock(&c->lock);
+    if (last) {
+        avcap_v4l2_free(c);
+    }
 }
 
 static int v4l2_get_input(struct v4l2_ctx *c)
@@ -855,6 +1347,8 @@ static int v4l2_get_cap(struct v4l2_ctx *c)
     printf("\tcap.capabilities: 0x%x\n", cap.capabilities);
     if (cap.capabilities & V4L2_CAP_VIDEO_CAPTURE)
         printf("\t\t\t VIDEO_CAPTURE\n");
+    if (cap.capabilities & V4L2_CAP_VIDEO_CAPTURE_MPLANE)
+        printf("\t\t\t VIDEO_CAPTURE_MPLANE\n");
     if (cap.capabilities & V4L2_CAP_VIDEO_OUTPUT)
         printf("\t\t\t VIDEO_OUTPUT\n");
     if (cap.capabilities & V4L2_CAP_VIDEO_OVERLAY)
@@ -884,7 +1378,7 @@ static int v4l2_get_cap(struct v4l2_ctx *c)
     if (cap.capabilities & V4L2_CAP_EXT_PIX_FORMAT)
         printf("\t\t\t EXT_PIX_FORMAT\n");
 
-    if (!(cap.capabilities & V4L2_CAP_VIDEO_CAPTURE)) {
+    if (!(cap.capabilities & (V4L2_CAP_VIDEO_CAPTURE | V4L2_CAP_VIDEO_CAPTURE_MPLANE))) {
         printf("Device does not support capturing.\n");
         return -1;
     }
@@ -895,7 +1389,7 @@ static void v4l2_get_fmt(struct v4l2_ctx *c)
 {
     struct v4l2_fmtdesc fmtdesc;
     fmtdesc.index = 0;
-    fmtdesc.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    fmtdesc.type = c->type;
     printf("[V4L2 Support Format]:\n");
     while (0 == v4l2_ioctl(c->fd, VIDIOC_ENUM_FMT, &fmtdesc)) {
         printf("\t%d. [%s] \"%s\"\n", fmtdesc.index,
@@ -956,6 +1450,16 @@ static int _v4l2_ioctl(struct avcap_ctx *avcap, unsigned long int cmd, ...)
     case VIDCAP_SET_CONF:
         ret = avcap_v4l2_set_config(avcap, (struct avcap_config *)arg);
         break;
+    case VIDCAP_GET_DMABUF:
+        ret = avcap_v4l2_get_dmabuf(c, (struct video_dmabuf *)arg);
+        break;
+    case VIDCAP_GET_STATS: {
+        struct video_cap_stats *st = (struct video_cap_stats *)arg;
+        st->frames = c->frames;
+        st->dropped = c->dropped;
+        st->base_ts = c->first_ts;
+        ret = 0;
+        } break;
     case VIDCAP_SET_LUMA:
         ret = v4l2_set_control(avcap->fd, V4L2_CID_BRIGHTNESS, *(int *)&arg);
         break;
@@ -29,12 +29,33 @@
 extern "C" {
 #endif
 
+#define VIDEOCAP_MAX_BUFS   32
+
+/*
+ * capture buffer memory of v4l2, zeroed config is mmap with 4 buffers.
+ * dmabuf and userptr import buf_count buffers of buf_size from the caller,
+ * a NULL userptr is allocated by avcap. imported memory stays owned by the
+ * caller and must outlive avcap_close and every frame still referenced
+ */
+enum videocap_memory {
+    VIDEOCAP_MEMORY_MMAP,
+    VIDEOCAP_MEMORY_DMABUF,
+    VIDEOCAP_MEMORY_USERPTR,
+};
+
 struct videocap_config {
     enum pixel_format format;
     uint32_t          width;
     uint32_t          height;
     rational_t        fps;
 	const char       *dev;
+    enum videocap_memory memory;
+    int               buf_count;                    /* 0 for default */
+    bool              export_dmabuf;                /* mmap: VIDIOC_EXPBUF */
+    int               dmabuf_fd[VIDEOCAP_MAX_BUFS];
+    void             *userptr[VIDEOCAP_MAX_BUFS];
+    size_t            buf_size;                     /* 0 for sizeimage */
+    bool              skip_static;                  /* xcb: no frame if screen unchanged */
 };
 
 struct videocap_image_quality {
@@ -57,6 +78,41 @@ struct video_ctrl {
     uint32_t val;
 };
 
+/*
+ * dmabuf behind a frame from on_media_frame, one per memory plane (NV12M
+ * has two). fds stay owned by avcap and valid while the frame is
+ * referenced, dup them to keep them longer
+ */
+struct video_dmabuf {
+    const struct video_frame *frame;
+    int                       planes;
+    int                       fd[VIDEO_MAX_PLANES];
+    uint32_t                  size[VIDEO_MAX_PLANES];
+};
+
+/*
+ * frame_id follows the driver sequence, dropped counts its gaps. frame
+ * timestamp is the driver timestamp minus base_ts
+ */
+struct video_cap_stats {
+    uint64_t frames;
+    uint64_t dropped;
+    uint64_t base_ts;
+    uint64_t repeated;          /* xcb: ticks without screen change */
+};
+
+/*
+ * xcb: bounding box of screen change in the last frame, relative to the
+ * capture area. repeat is set and the box is empty when the frame is the
+ * same as the one before
+ */
+struct video_damage {
+    uint64_t frame_id;
+    bool     repeat;
+    int      x, y;
+    int      width, height;
+};
+
 #define VIDCAP_GET_CAP         _IOWR('V',  0, struct video_cap)
 #define VIDCAP_SET_CTRL        _IOWR('V',  1, struct video_ctrl)
 #define VIDCAP_SET_CONF        _IOWR('V',  2, struct avcap_config)
@@ -74,6 +130,9 @@ struct video_ctrl {
 #define VIDCAP_SET_GAMMA       _IOWR('V', 14, int)
 #define VIDCAP_GET_SHARP       _IOWR('V', 15, int *)
 #define VIDCAP_SET_SHARP       _IOWR('V', 16, int)
+#define VIDCAP_GET_DMABUF      _IOWR('V', 17, struct video_dmabuf)
+#define VIDCAP_GET_STATS       _IOWR('V', 18, struct video_cap_stats)
+#define VIDCAP_GET_DAMAGE      _IOWR('V', 19, struct video_damage)
 
 
 
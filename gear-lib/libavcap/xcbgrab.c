@@ -20,21 +20,32 @@
  * SOFTWARE.
  ******************************************************************************/
 #include "libavcap.h"
-
+#include <libthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
 #include <errno.h>
 #include <xcb/xcb.h>
 #include <xcb/randr.h>
 #include <xcb/shm.h>
+#include <xcb/damage.h>
 #include <xcb/xfixes.h>
 #include <xcb/xinerama.h>
 
 #include <sys/ipc.h>
 #include <sys/shm.h>
 
+#define timespec2ns(ts) \
+    (((uint64_t)ts.tv_sec * 1000000000) + ((uint64_t)ts.tv_nsec))
+
 struct xcbgrab_ctx {
     xcb_connection_t *xcb;
     xcb_screen_t     *xcb_screen;
+    bool has_shm;               /* buffer is MIT-SHM segment shared with server */
     xcb_shm_seg_t segment;
+    int shmid;
     uint8_t *buffer;
     int x, y;
     int width, height;
@@ -42,7 +53,20 @@ struct xcbgrab_ctx {
     int pix_fmt;
     int bits_per_pixel;
     int frame_size;
-    int shmid;
+    bool has_damage;
+    xcb_damage_damage_t damage;
+    uint8_t damage_event;
+    bool dirty;                 /* damage reported since last grab */
+    int dirty_x0, dirty_y0, dirty_x1, dirty_y1;
+    bool grabbed;               /* buffer holds a frame */
+    bool skip_static;
+    struct video_damage last;
+    uint64_t frame_id;
+    uint64_t repeated;
+    uint64_t first_ts;
+    uint64_t interval_ns;
+    struct thread *thread;
+    bool is_streaming;
 };
 
 static bool _xcb_check_extensions(xcb_connection_t *xcb)
@@ -88,8 +112,14 @@ static int xcb_get_pixfmt(struct xcbgrab_ctx *c)
     xcb_get_geometry_cookie_t gc = xcb_get_geometry(c->xcb, c->xcb_screen->root);
     xcb_get_geometry_reply_t *geo = xcb_get_geometry_reply(c->xcb, gc, NULL);
 
-    c->width = c->xcb_screen->width_in_pixels;
-    c->height = c->xcb_screen->height_in_pixels;
+    if (!geo) {
+        printf("xcb_get_geometry_reply failed!\n");
+        return -1;
+    }
+    if (!c->width || !c->height) {
+        c->width = c->xcb_screen->width_in_pixels;
+        c->height = c->xcb_screen->height_in_pixels;
+    }
 
     if (c->x + c->width > geo->width || c->y + c->height > geo->height) {
         printf("Capture area %dx%d at position %d.%d "
@@ -97,6 +127,7 @@ static int xcb_get_pixfmt(struct xcbgrab_ctx *c)
                c->width, c->height,
                c->x, c->y,
                geo->width, geo->height);
+        free(geo);
         return -1;
     }
 
@@ -108,12 +139,11 @@ static int xcb_get_pixfmt(struct xcbgrab_ctx *c)
 
         switch (geo->depth) {
         case 32:
-            if (fmt->bits_per_pixel == 32)
-                c->pix_fmt = PIXEL_FORMAT_0RGB;
-            break;
         case 24:
+            /* pixel is B,G,R,X in memory on LSBFirst server */
             if (fmt->bits_per_pixel == 32)
-                c->pix_fmt = PIXEL_FORMAT_0RGB;
+                c->pix_fmt = (setup->image_byte_order == XCB_IMAGE_ORDER_LSB_FIRST) ?
+                             PIXEL_FORMAT_BGRX : PIXEL_FORMAT_0RGB;
             else if (fmt->bits_per_pixel == 24)
                 c->pix_fmt = PIXEL_FORMAT_RGB24;
             break;
@@ -136,130 +166,301 @@ static int xcb_get_pixfmt(struct xcbgrab_ctx *c)
 
         if (c->pix_fmt) {
             c->bits_per_pixel = fmt->bits_per_pixel;
-            c->frame_size = c->width * c->height * fmt->bits_per_pixel / 8;
-            c->stride = c->width * (c->bits_per_pixel >> 3);
-            printf("width=%d, height=%d, stride=%d\n", c->width, c->height, c->stride);
+            /* Z_PIXMAP scanlines are padded to scanline_pad bits */
+            c->stride = ((c->width * fmt->bits_per_pixel + fmt->scanline_pad - 1) /
+                         fmt->scanline_pad) * fmt->scanline_pad / 8;
+            c->frame_size = c->stride * c->height;
             printf("capture area %dx%d at position %d.%d, screen size %dx%d\n"
-                   "depth = %d, %d, bits_per_pixel = %d\n",
+                   "depth = %d, %d, bits_per_pixel = %d, stride = %d\n",
                    c->width, c->height, c->x, c->y, geo->width, geo->height,
-                   geo->depth, fmt->depth, fmt->bits_per_pixel);
+                   geo->depth, fmt->depth, fmt->bits_per_pixel, c->stride);
+            free(geo);
             return 0;
         }
     }
 
+    free(geo);
     return -1;
 }
 
-static void create_stream(struct xcbgrab_ctx *c)
-{
-    xcb_get_pixfmt(c);
-}
-
-
+/*
+ * one segment for the whole stream, server writes frames straight into it,
+ * it is marked removed once attached, so it never outlives us
+ */
 static int alloc_buffer(struct xcbgrab_ctx *c)
 {
-    int size = c->stride * c->height;
+    xcb_generic_error_t *e;
 
-    c->shmid = shmget(IPC_PRIVATE, size, IPC_CREAT | 0777);
+    c->shmid = shmget(IPC_PRIVATE, c->frame_size, IPC_CREAT | 0600);
     if (c->shmid == -1) {
-        printf("Cannot get %d bytes of shared memory: %s.\n", size, strerror(errno));
+        printf("Cannot get %d bytes of shared memory: %s.\n", c->frame_size, strerror(errno));
         return -1;
     }
-    xcb_shm_attach(c->xcb, c->segment, c->shmid, 0);
     c->buffer = shmat(c->shmid, NULL, 0);
-    //shmctl(c->shmid, IPC_RMID, 0);
+    if (c->buffer == (void *)-1) {
+        printf("shmat failed: %s.\n", strerror(errno));
+        c->buffer = NULL;
+        shmctl(c->shmid, IPC_RMID, NULL);
+        return -1;
+    }
+    c->segment = xcb_generate_id(c->xcb);
+    e = xcb_request_check(c->xcb, xcb_shm_attach_checked(c->xcb, c->segment, c->shmid, 0));
+    shmctl(c->shmid, IPC_RMID, NULL);
+    if (e) {
+        /* remote display can't see our memory */
+        printf("xcb_shm_attach failed, error_code:%u\n", e->error_code);
+        free(e);
+        shmdt(c->buffer);
+        c->buffer = NULL;
+        return -1;
+    }
     return 0;
 }
 
-#if 0
-static void free_buffer(struct xcbgrab_ctx *c)
+static void xcb_damage_init(struct xcbgrab_ctx *c)
+{
+    const xcb_query_extension_reply_t *ext;
+    xcb_damage_query_version_cookie_t vq;
+    xcb_damage_query_version_reply_t *ver;
+
+    ext = xcb_get_extension_data(c->xcb, &xcb_damage_id);
+    if (!ext || !ext->present) {
+        printf("Missing Damage extension, grab every tick!\n");
+        return;
+    }
+    vq = xcb_damage_query_version(c->xcb, XCB_DAMAGE_MAJOR_VERSION, XCB_DAMAGE_MINOR_VERSION);
+    ver = xcb_damage_query_version_reply(c->xcb, vq, NULL);
+    if (!ver) {
+        printf("xcb_damage_query_version failed!\n");
+        return;
+    }
+    free(ver);
+    c->damage = xcb_generate_id(c->xcb);
+    xcb_damage_create(c->xcb, c->damage, c->xcb_screen->root,
+                      XCB_DAMAGE_REPORT_LEVEL_BOUNDING_BOX);
+    c->damage_event = ext->first_event + XCB_DAMAGE_NOTIFY;
+    c->has_damage = true;
+}
+
+static void damage_add(struct xcbgrab_ctx *c, const xcb_rectangle_t *area)
 {
-    xcb_shm_detach(c->xcb, c->segment);
+    int x0 = area->x - c->x;
+    int y0 = area->y - c->y;
+    int x1 = x0 + area->width;
+    int y1 = y0 + area->height;
+
+    x0 = x0 < 0 ? 0 : x0;
+    y0 = y0 < 0 ? 0 : y0;
+    x1 = x1 > c->width ? c->width : x1;
+    y1 = y1 > c->height ? c->height : y1;
+    if (x0 >= x1 || y0 >= y1) {
+        return;
+    }
+    if (!c->dirty) {
+        c->dirty_x0 = x0;
+        c->dirty_y0 = y0;
+        c->dirty_x1 = x1;
+        c->dirty_y1 = y1;
+        c->dirty = true;
+        return;
+    }
+    c->dirty_x0 = x0 < c->dirty_x0 ? x0 : c->dirty_x0;
+    c->dirty_y0 = y0 < c->dirty_y0 ? y0 : c->dirty_y0;
+    c->dirty_x1 = x1 > c->dirty_x1 ? x1 : c->dirty_x1;
+    c->dirty_y1 = y1 > c->dirty_y1 ? y1 : c->dirty_y1;
+}
 
-    shmdt(shminfo.shmaddr);
-    shmctl(shminfo.shmid, IPC_RMID, 0);
+static void damage_collect(struct xcbgrab_ctx *c)
+{
+    xcb_generic_event_t *ev;
 
-    xcb_disconnect(connection);
+    while ((ev = xcb_poll_for_event(c->xcb)) != NULL) {
+        if ((ev->response_type & ~0x80) == c->damage_event) {
+            damage_add(c, &((xcb_damage_notify_event_t *)ev)->area);
+        }
+        free(ev);
+    }
 }
-#endif
 
-static int xcbgrab_frame(struct xcbgrab_ctx *c)
+static int xcbgrab_get_image(struct xcbgrab_ctx *c)
 {
-    xcb_get_image_cookie_t iq;
-    xcb_get_image_reply_t *img;
     xcb_drawable_t drawable = c->xcb_screen->root;
     xcb_generic_error_t *e = NULL;
-    uint8_t *data;
     int length;
 
-    iq  = xcb_get_image(c->xcb, XCB_IMAGE_FORMAT_Z_PIXMAP, drawable,
-                        c->x, c->y, c->width, c->height, ~0);
-
-    img = xcb_get_image_reply(c->xcb, iq, &e);
-
+    if (c->has_shm) {
+        xcb_shm_get_image_cookie_t iq;
+        xcb_shm_get_image_reply_t *img;
+        iq = xcb_shm_get_image(c->xcb, drawable,
+                               c->x, c->y, c->width, c->height, ~0,
+                               XCB_IMAGE_FORMAT_Z_PIXMAP, c->segment, 0);
+        img = xcb_shm_get_image_reply(c->xcb, iq, &e);
+        free(img);
+    } else {
+        xcb_get_image_cookie_t iq;
+        xcb_get_image_reply_t *img;
+        iq = xcb_get_image(c->xcb, XCB_IMAGE_FORMAT_Z_PIXMAP, drawable,
+                           c->x, c->y, c->width, c->height, ~0);
+        img = xcb_get_image_reply(c->xcb, iq, &e);
+        if (img) {
+            length = xcb_get_image_data_length(img);
+            memcpy(c->buffer, xcb_get_image_data(img),
+                   length < c->frame_size ? length : c->frame_size);
+            free(img);
+        }
+    }
     if (e) {
         printf("Cannot get the image data "
                "event_error: response_type:%u error_code:%u "
                "sequence:%u resource_id:%u minor_code:%u major_code:%u.\n",
                e->response_type, e->error_code,
                e->sequence, e->resource_id, e->minor_code, e->major_code);
+        free(e);
         return -1;
-    } else {
-        printf("xcb_get_image_reply ok!\n");
     }
-
-    if (!img)
-        return -1;
-
-    data   = xcb_get_image_data(img);
-    data = data;
-    length = xcb_get_image_data_length(img);
-    length = length;
-
-    free(img);
-
     return 0;
 }
-static int xcbgrab_frame_shm(struct xcbgrab_ctx *c)
-{
-    xcb_shm_get_image_cookie_t iq;
-    xcb_shm_get_image_reply_t *img;
-    xcb_drawable_t drawable = c->xcb_screen->root;
-    xcb_generic_error_t *e = NULL;
-    int ret;
-
-    ret = alloc_buffer(c);
-    if (ret < 0)
-        return ret;
-
-    iq = xcb_shm_get_image(c->xcb, drawable,
-                           c->x, c->y, c->width, c->height, ~0,
-                           XCB_IMAGE_FORMAT_Z_PIXMAP, c->segment, 0);
-    img = xcb_shm_get_image_reply(c->xcb, iq, &e);
-
-    //xcb_flush(c->xcb);
 
-    if (e) {
-        printf("Cannot get the image data "
-               "event_error: response_type:%u error_code:%u "
-               "sequence:%u resource_id:%u minor_code:%u major_code:%u.\n",
-               e->response_type, e->error_code,
-               e->sequence, e->resource_id, e->minor_code, e->major_code);
+/*
+ * grab only when damage reported a change since last grab, otherwise the
+ * buffer still holds the current screen and *repeat is set
+ */
+static int xcbgrab_update(struct xcbgrab_ctx *c, bool force, bool *repeat)
+{
+    struct video_damage *d = &c->last;
 
+    if (c->has_damage) {
+        damage_collect(c);
+    }
+    *repeat = c->grabbed && c->has_damage && !c->dirty && !force;
+    if (*repeat) {
+        c->repeated++;
+        return 0;
+    }
+    if (c->has_damage) {
+        /* reset before grab, so change during grab is reported next tick */
+        xcb_damage_subtract(c->xcb, c->damage, XCB_NONE, XCB_NONE);
+    }
+    if (xcbgrab_get_image(c) != 0) {
         return -1;
     }
+    if (c->grabbed && c->has_damage && c->dirty) {
+        d->x = c->dirty_x0;
+        d->y = c->dirty_y0;
+        d->width = c->dirty_x1 - c->dirty_x0;
+        d->height = c->dirty_y1 - c->dirty_y0;
+    } else {
+        d->x = 0;
+        d->y = 0;
+        d->width = c->width;
+        d->height = c->height;
+    }
+    c->dirty = false;
+    c->grabbed = true;
+    if (c->has_damage) {
+        /*
+         * events which raced with subtract may be for pixels already in this
+         * grab, keep them dirty and grab once more rather than miss a change
+         */
+        damage_collect(c);
+    }
+    return 0;
+}
 
-    free(img);
+static void xcbgrab_fill_frame(struct xcbgrab_ctx *c, struct video_frame *frame, bool repeat)
+{
+    struct timespec ts;
+    uint64_t now;
 
-    //pkt->data = c->buffer;
-    //pkt->size = c->frame_size;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    now = timespec2ns(ts);
+    if (!c->first_ts) {
+        c->first_ts = now;
+    }
+    memset(frame, 0, sizeof(struct video_frame));
+    frame->format = c->pix_fmt;
+    frame->width = c->width;
+    frame->height = c->height;
+    frame->mem_type = MEDIA_MEM_SHALLOW;
+    frame->planes = 1;
+    frame->data[0] = c->buffer;
+    frame->linesize[0] = c->stride;
+    frame->total_size = c->frame_size;
+    frame->timestamp = now - c->first_ts;
+    frame->frame_id = c->frame_id++;
+
+    c->last.frame_id = frame->frame_id;
+    c->last.repeat = repeat;
+    if (repeat) {
+        c->last.x = 0;
+        c->last.y = 0;
+        c->last.width = 0;
+        c->last.height = 0;
+    }
+}
 
-    return 0;
+static void *xcbgrab_thread(struct thread *t, void *arg)
+{
+    struct avcap_ctx *avcap = arg;
+    struct xcbgrab_ctx *c = (struct xcbgrab_ctx *)avcap->opaque;
+    struct media_frame media;
+    struct timespec ts;
+    uint64_t next, now;
+    bool repeat;
+
+    media.type = MEDIA_TYPE_VIDEO;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    next = timespec2ns(ts);
+    while (c->is_streaming) {
+        if (xcbgrab_update(c, false, &repeat) != 0) {
+            printf("xcbgrab_update failed\n");
+        } else if (!repeat || !c->skip_static) {
+            xcbgrab_fill_frame(c, &media.video, repeat);
+            avcap->on_media_frame(avcap, &media);
+        }
+        /* tick on absolute time, grab and callback don't add up to drift */
+        next += c->interval_ns;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        now = timespec2ns(ts);
+        if (next < now) {
+            next = now;
+            continue;
+        }
+        ts.tv_sec = next / 1000000000;
+        ts.tv_nsec = next % 1000000000;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+    }
+    return NULL;
 }
+
+static void xcbgrab_free(struct xcbgrab_ctx *c)
+{
+    if (c->xcb) {
+        if (c->has_damage) {
+            xcb_damage_destroy(c->xcb, c->damage);
+        }
+        if (c->has_shm && c->buffer) {
+            xcb_shm_detach(c->xcb, c->segment);
+        }
+        xcb_flush(c->xcb);
+        xcb_disconnect(c->xcb);
+    }
+    if (c->buffer) {
+        if (c->has_shm) {
+            shmdt(c->buffer);
+        } else {
+            free(c->buffer);
+        }
+    }
+    free(c);
+}
+
 static void *xcbgrab_open(struct avcap_ctx *avcap, const char *dev, struct avcap_config *avconf)
 {
     const xcb_setup_t *setup;
     int screen_num;
+    rational_t fps;
+    struct videocap_config *conf = &avconf->video;
     struct xcbgrab_ctx *c = calloc(1, sizeof(struct xcbgrab_ctx));
     if (!c) {
         printf("malloc xcbgrab failed!\n");
@@ -268,48 +469,144 @@ static void *xcbgrab_open(struct avcap_ctx *avcap, const char *dev, struct avcap
     c->xcb = xcb_connect(dev, &screen_num);
     if (!c->xcb || xcb_connection_has_error(c->xcb)) {
         printf("xcb_connect X display failed!\n");
-        return NULL;
+        goto failed;
     }
     printf("xcb_connect X display %d success!\n", screen_num);
 
-    _xcb_check_extensions(c->xcb);
+    c->has_shm = _xcb_check_extensions(c->xcb);
 
     setup = xcb_get_setup(c->xcb);
 
     c->xcb_screen = get_screen(setup, screen_num);
     if (!c->xcb_screen) {
         printf("The screen %d does not exist.\n", screen_num);
-        return NULL;
+        goto failed;
     }
 
-    create_stream(c);
-    //alloc_buffer(c);
-    if (0)
-            xcbgrab_frame_shm(c);
-    xcbgrab_frame(c);
-    printf("The screen %d does not exist.\n", screen_num);
+    c->width = conf->width;
+    c->height = conf->height;
+    if (xcb_get_pixfmt(c) != 0) {
+        printf("xcb_get_pixfmt failed!\n");
+        goto failed;
+    }
+    if (c->has_shm && alloc_buffer(c) != 0) {
+        printf("MIT-SHM unavailable, fallback to xcb_get_image\n");
+        c->has_shm = false;
+    }
+    if (!c->has_shm) {
+        c->buffer = calloc(1, c->frame_size);
+        if (!c->buffer) {
+            printf("malloc %d bytes failed!\n", c->frame_size);
+            goto failed;
+        }
+    }
+    xcb_damage_init(c);
+    xcb_flush(c->xcb);
 
+    fps = conf->fps;
+    if (!fps.num || !fps.den) {
+        fps.num = 30;
+        fps.den = 1;
+    }
+    c->interval_ns = 1000000000ULL * fps.den / fps.num;
+    c->skip_static = conf->skip_static;
+
+    avcap->conf.video.format = c->pix_fmt;
+    avcap->conf.video.width = c->width;
+    avcap->conf.video.height = c->height;
+    avcap->conf.video.fps = fps;
+    avcap->conf.video.skip_static = conf->skip_static;
     return c;
+
+failed:
+    xcbgrab_free(c);
+    return NULL;
 }
 
-static void xcbgrab_close(struct avcap_ctx *avcap)
+static int xcbgrab_stop_stream(struct avcap_ctx *avcap)
 {
+    struct xcbgrab_ctx *c = (struct xcbgrab_ctx *)avcap->opaque;
 
+    if (!c->is_streaming) {
+        return 0;
+    }
+    c->is_streaming = false;
+    if (c->thread) {
+        thread_join(c->thread);
+        thread_destroy(c->thread);
+        c->thread = NULL;
+    }
+    return 0;
+}
+
+static void xcbgrab_close(struct avcap_ctx *avcap)
+{
+    struct xcbgrab_ctx *c = (struct xcbgrab_ctx *)avcap->opaque;
+    xcbgrab_stop_stream(avcap);
+    xcbgrab_free(c);
 }
 
 static int xcbgrab_ioctl(struct avcap_ctx *avcap, unsigned long int cmd, ...)
 {
-    printf("xcbgrab_ioctl unsupport cmd!\n");
+    struct xcbgrab_ctx *c = (struct xcbgrab_ctx *)avcap->opaque;
+    void *arg;
+    va_list ap;
+    va_start(ap, cmd);
+    arg = va_arg(ap, void *);
+    va_end(ap);
+
+    switch (cmd) {
+    case VIDCAP_GET_STATS: {
+        struct video_cap_stats *st = (struct video_cap_stats *)arg;
+        memset(st, 0, sizeof(struct video_cap_stats));
+        st->frames = c->frame_id;
+        st->base_ts = c->first_ts;
+        st->repeated = c->repeated;
+        } break;
+    case VIDCAP_GET_DAMAGE:
+        memcpy(arg, &c->last, sizeof(struct video_damage));
+        break;
+    default:
+        printf("xcbgrab_ioctl unsupport cmd!\n");
+        return -1;
+    }
     return 0;
 }
 
 static int xcbgrab_start_stream(struct avcap_ctx *avcap)
 {
+    struct xcbgrab_ctx *c = (struct xcbgrab_ctx *)avcap->opaque;
+
+    if (c->is_streaming) {
+        printf("xcbgrab is streaming already!\n");
+        return -1;
+    }
+    if (!avcap->on_media_frame) {
+        return 0;
+    }
+    c->is_streaming = true;
+    c->thread = thread_create(xcbgrab_thread, avcap);
+    if (!c->thread) {
+        printf("thread_create xcbgrab_thread failed!\n");
+        c->is_streaming = false;
+        return -1;
+    }
     return 0;
 }
 
-static int xcbgrab_stop_stream(struct avcap_ctx *avcap)
+/*
+ * frame points into the grab buffer, valid until next query
+ */
+static int xcbgrab_query_frame(struct avcap_ctx *avcap, struct media_frame *frame)
 {
+    struct xcbgrab_ctx *c = (struct xcbgrab_ctx *)avcap->opaque;
+    bool repeat;
+
+    if (xcbgrab_update(c, false, &repeat) != 0) {
+        return -1;
+    }
+    frame->type = MEDIA_TYPE_VIDEO;
+    xcbgrab_fill_frame(c, &frame->video, repeat);
     return 0;
 }
 
@@ -319,7 +616,5 @@ struct avcap_ops xcbgrab_ops = {
     .ioctl        = xcbgrab_ioctl,
     .start_stream = xcbgrab_start_stream,
     .stop_stream  = xcbgrab_stop_stream,
-#if 0
-    .query_frame  = avcap_xcbgrab_query_frame,
-#endif
+    .query_frame  = xcbgrab_query_frame,
 };
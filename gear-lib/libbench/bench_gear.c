@@ -0,0 +1,545 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#include "libbench.h"
+#include <libgevent.h>
+#include <libqueue.h>
+#include <libworkq.h>
+#include <libhash.h>
+#include <libstrex.h>
+#include <libserializer.h>
+#include <libmedia-io.h>
+#include <video-conv.h>
+#include "rtp.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+/*
+ * benchmarks of gear-lib modules on one harness, see README
+ *   ./bench_gear [-j out.json] [-b baseline.json] [-f filter]
+ * exits 1 if any case is slower than baseline by the threshold
+ */
+
+#define HASH_KEYS       (1024)
+#define PAYLOAD_SIZE    (64)
+#define B64_SIZE        (1024)
+#define RTP_FRAME_SIZE  (64 * 1024)
+#define VIDEO_WIDTH     (1280)
+#define VIDEO_HEIGHT    (720)
+
+/******************************************************************************
+ * libgevent
+ ******************************************************************************/
+struct gevent_case {
+    struct gevent_base *eb;
+    int fds[2];
+};
+
+static void on_pipe(int fd, void *arg)
+{
+    char c;
+    if (read(fd, &c, 1) != 1) {
+        printf("read pipe failed!\n");
+    }
+}
+
+/* one write wakes one dispatch round with one callback */
+static int bench_gevent_dispatch(void *arg, uint64_t n)
+{
+    struct gevent_case *c = (struct gevent_case *)arg;
+    char ch = 0;
+    while (n--) {
+        if (write(c->fds[1], &ch, 1) != 1) {
+            return -1;
+        }
+        gevent_base_wait(c->eb);
+    }
+    return 0;
+}
+
+static void run_gevent(struct bench *b)
+{
+    struct gevent *e;
+    struct gevent_case c;
+
+    c.eb = gevent_base_create();
+    if (!c.eb || pipe(c.fds)) {
+        printf("gevent case setup failed!\n");
+        return;
+    }
+    e = gevent_create(c.fds[0], on_pipe, NULL, NULL, NULL);
+    if (!e || -1 == gevent_add(c.eb, &e)) {
+        printf("gevent_add failed!\n");
+    } else {
+        bench_run(b, "gevent_dispatch_pipe", bench_gevent_dispatch, &c, 0);
+    }
+    gevent_base_destroy(c.eb);
+    close(c.fds[0]);
+    close(c.fds[1]);
+}
+
+/******************************************************************************
+ * libqueue
+ ******************************************************************************/
+struct queue_case {
+    struct queue *q;
+    char payload[PAYLOAD_SIZE];
+};
+
+/* single thread, so this is the uncontended cost of one handoff */
+static int bench_queue(void *arg, uint64_t n)
+{
+    struct queue_case *c = (struct queue_case *)arg;
+    struct queue_item *it;
+    while (n--) {
+        it = queue_item_alloc(c->q, c->payload, sizeof(c->payload), NULL);
+        if (!it || 0 != queue_push(c->q, it)) {
+            return -1;
+        }
+        it = queue_pop(c->q);
+        if (!it) {
+            return -1;
+        }
+        queue_item_free(c->q, it);
+    }
+    return 0;
+}
+
+static void run_queue(struct bench *b)
+{
+    static const struct {
+        const char *name;
+        enum queue_type type;
+    } types[] = {
+        {"queue_list_push_pop", QUEUE_LIST},
+        {"queue_spsc_push_pop", QUEUE_SPSC},
+        {"queue_mpmc_push_pop", QUEUE_MPMC},
+    };
+    struct queue_case c;
+    size_t i;
+
+    memset(&c, 0, sizeof(c));
+    for (i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+        c.q = queue_create_by(types[i].type, 64);
+        if (!c.q) {
+            printf("queue_create_by failed!\n");
+            continue;
+        }
+        queue_set_pool(c.q, 64, PAYLOAD_SIZE);
+        bench_run(b, types[i].name, bench_queue, &c, 0);
+        queue_destroy(c.q);
+    }
+}
+
+/******************************************************************************
+ * libworkq
+ ******************************************************************************/
+struct workq_case {
+    struct workq_pool *pool;
+    uint64_t done;
+};
+
+static void task_done(void *arg)
+{
+    struct workq_case *c = (struct workq_case *)arg;
+    __atomic_add_fetch(&c->done, 1, __ATOMIC_RELEASE);
+}
+
+/* push n empty tasks and wait until all ran, ns per task */
+static int bench_workq(void *arg, uint64_t n)
+{
+    struct workq_case *c = (struct workq_case *)arg;
+    uint64_t i, target = __atomic_load_n(&c->done, __ATOMIC_ACQUIRE) + n;
+    for (i = 0; i < n; i++) {
+        while (0 != workq_pool_task_push(c->pool, task_done, c)) {
+            sched_yield();
+        }
+    }
+    while (__atomic_load_n(&c->done, __ATOMIC_ACQUIRE) < target) {
+        sched_yield();
+    }
+    return 0;
+}
+
+static void run_workq(struct bench *b)
+{
+    struct workq_case c;
+
+    memset(&c, 0, sizeof(c));
+    c.pool = workq_pool_create();
+    if (!c.pool) {
+        printf("workq_pool_create failed!\n");
+        return;
+    }
+    bench_run(b, "workq_task_throughput", bench_workq, &c, 0);
+    workq_pool_destroy(c.pool);
+}
+
+/******************************************************************************
+ * libhash
+ ******************************************************************************/
+struct hash_case {
+    struct hash *h;
+    char keys[HASH_KEYS][16];
+    char miss[HASH_KEYS][16];
+};
+
+static int bench_hash_get(void *arg, uint64_t n)
+{
+    struct hash_case *c = (struct hash_case *)arg;
+    uint64_t i;
+    for (i = 0; i < n; i++) {
+        if (!hash_get(c->h, c->keys[i % HASH_KEYS])) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int bench_hash_set(void *arg, uint64_t n)
+{
+    struct hash_case *c = (struct hash_case *)arg;
+    uint64_t i;
+    for (i = 0; i < n; i++) {
+        hash_set(c->h, c->keys[i % HASH_KEYS], c);
+    }
+    return 0;
+}
+
+/* insert a new key and delete it, two ops counted as one */
+static int bench_hash_insert_del(void *arg, uint64_t n)
+{
+    struct hash_case *c = (struct hash_case *)arg;
+    uint64_t i;
+    for (i = 0; i < n; i++) {
+        const char *key = c->miss[i % HASH_KEYS];
+        if (0 != hash_set(c->h, key, c) || 0 != hash_del(c->h, key)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void run_hash(struct bench *b)
+{
+    int i;
+    struct hash_case *c = (struct hash_case *)calloc(1, sizeof(*c));
+
+    if (!c || !(c->h = hash_create(HASH_KEYS))) {
+        printf("hash_create failed!\n");
+        free(c);
+        return;
+    }
+    for (i = 0; i < HASH_KEYS; i++) {
+        snprintf(c->keys[i], sizeof(c->keys[i]), "key%d", i);
+        snprintf(c->miss[i], sizeof(c->miss[i]), "miss%d", i);
+        hash_set(c->h, c->keys[i], c);
+    }
+    bench_run(b, "hash_get", bench_hash_get, c, 0);
+    bench_run(b, "hash_set_update", bench_hash_set, c, 0);
+    bench_run(b, "hash_insert_del", bench_hash_insert_del, c, 0);
+    hash_destroy(c->h);
+    free(c);
+}
+
+/******************************************************************************
+ * libstrex base64
+ ******************************************************************************/
+struct base64_case {
+    uint8_t raw[B64_SIZE];
+    char text[B64_SIZE * 2];
+    uint8_t out[B64_SIZE * 2];
+    size_t text_len;
+};
+
+static int bench_base64_encode(void *arg, uint64_t n)
+{
+    struct base64_case *c = (struct base64_case *)arg;
+    while (n--) {
+        base64_encode(c->text, c->raw, sizeof(c->raw));
+    }
+    return 0;
+}
+
+static int bench_base64_decode(void *arg, uint64_t n)
+{
+    struct base64_case *c = (struct base64_case *)arg;
+    while (n--) {
+        if (base64_decode(c->out, c->text, c->text_len) != B64_SIZE) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void run_base64(struct bench *b)
+{
+    int i;
+    struct base64_case c;
+
+    for (i = 0; i < B64_SIZE; i++) {
+        c.raw[i] = (uint8_t)(i * 31 + 7);
+    }
+    c.text_len = base64_encode(c.text, c.raw, sizeof(c.raw));
+    bench_run(b, "base64_encode_1k", bench_base64_encode, &c, B64_SIZE);
+    bench_run(b, "base64_decode_1k", bench_base64_decode, &c, B64_SIZE);
+}
+
+/******************************************************************************
+ * libdarray serializer
+ ******************************************************************************/
+#define SERIALIZER_RESET    (4096)
+
+struct serializer_case {
+    struct serializer s;
+    uint8_t block[PAYLOAD_SIZE];
+};
+
+static int bench_serializer_wb32(void *arg, uint64_t n)
+{
+    struct serializer_case *c = (struct serializer_case *)arg;
+    uint64_t i;
+    for (i = 0; i < n; i++) {
+        if (i % SERIALIZER_RESET == 0) {
+            serializer_array_reset(&c->s);
+        }
+        s_wb32(&c->s, (uint32_t)i);
+    }
+    return 0;
+}
+
+static int bench_serializer_write(void *arg, uint64_t n)
+{
+    struct serializer_case *c = (struct serializer_case *)arg;
+    uint64_t i;
+    for (i = 0; i < n; i++) {
+        if (i % SERIALIZER_RESET == 0) {
+            serializer_array_reset(&c->s);
+        }
+        s_write(&c->s, c->block, sizeof(c->block));
+    }
+    return 0;
+}
+
+static void run_serializer(struct bench *b)
+{
+    struct serializer_case c;
+
+    memset(&c, 0, sizeof(c));
+    if (0 != serializer_array_init(&c.s)) {
+        printf("serializer_array_init failed!\n");
+        return;
+    }
+    bench_run(b, "serializer_wb32", bench_serializer_wb32, &c, 4);
+    bench_run(b, "serializer_write_64", bench_serializer_write, &c, PAYLOAD_SIZE);
+    serializer_array_deinit(&c.s);
+}
+
+/******************************************************************************
+ * librtsp rtp packetization
+ ******************************************************************************/
+struct rtp_case {
+    struct rtp_socket *sock;
+    struct rtp_packet *pkt;
+    uint8_t frame[RTP_FRAME_SIZE];
+    int fds[2];
+    pthread_t drain;
+    uint32_t ts;
+};
+
+static void *rtp_drain(void *arg)
+{
+    struct rtp_case *c = (struct rtp_case *)arg;
+    char buf[65536];
+    while (read(c->fds[1], buf, sizeof(buf)) > 0) {
+    }
+    return NULL;
+}
+
+/* one idr-sized frame into fu-a packets, one writev per frame to a socketpair */
+static int bench_rtp_h264(void *arg, uint64_t n)
+{
+    struct rtp_case *c = (struct rtp_case *)arg;
+    while (n--) {
+        if (0 != rtp_tcp_frame_begin(c->sock)) {
+            continue;
+        }
+        rtp_payload_h264_encode(c->sock, c->pkt, c->frame, sizeof(c->frame), c->ts);
+        rtp_tcp_frame_end(c->sock);
+        c->ts += 3000;
+    }
+    return 0;
+}
+
+static void run_rtp(struct bench *b)
+{
+    size_t i;
+    struct rtp_case *c = (struct rtp_case *)calloc(1, sizeof(*c));
+
+    if (!c || socketpair(AF_UNIX, SOCK_STREAM, 0, c->fds)) {
+        printf("socketpair failed!\n");
+        free(c);
+        return;
+    }
+    /* start code, idr nal header, then a payload without start codes */
+    c->frame[2] = 0x01;
+    c->frame[3] = 0x65;
+    for (i = 4; i < sizeof(c->frame); i++) {
+        c->frame[i] = (uint8_t)(i | 0x80);
+    }
+    c->sock = rtp_socket_create(RTP_TCP, c->fds[0], NULL, NULL);
+    c->pkt = rtp_packet_create(RTP_PT_H264, sizeof(c->frame), 0, rtp_ssrc());
+    if (c->sock && c->pkt && 0 == rtp_tcp_batch_enable(c->sock, true) &&
+        0 == pthread_create(&c->drain, NULL, rtp_drain, c)) {
+        bench_run(b, "rtp_h264_packetize_64k", bench_rtp_h264, c, sizeof(c->frame));
+        shutdown(c->fds[0], SHUT_WR);
+        pthread_join(c->drain, NULL);
+    } else {
+        printf("rtp case setup failed!\n");
+    }
+    if (c->pkt) {
+        rtp_packet_destroy(c->pkt);
+    }
+    if (c->sock) {
+        rtp_socket_destroy(c->sock);
+    }
+    close(c->fds[0]);
+    close(c->fds[1]);
+    free(c);
+}
+
+/******************************************************************************
+ * libmedia-io pixel conversion
+ ******************************************************************************/
+struct video_case {
+    struct video_frame *src;
+    struct video_frame *dst;
+};
+
+static int bench_video_convert(void *arg, uint64_t n)
+{
+    struct video_case *c = (struct video_case *)arg;
+    while (n--) {
+        if (0 != video_frame_convert(c->dst, c->src)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void run_video(struct bench *b)
+{
+    static const struct {
+        const char *name;
+        enum pixel_format src;
+        enum pixel_format dst;
+    } convs[] = {
+        {"video_yuy2_to_i420_720p", PIXEL_FORMAT_YUY2, PIXEL_FORMAT_I420},
+        {"video_nv12_to_i420_720p", PIXEL_FORMAT_NV12, PIXEL_FORMAT_I420},
+        {"video_i420_to_rgba_720p", PIXEL_FORMAT_I420, PIXEL_FORMAT_RGBA},
+    };
+    struct video_case c;
+    size_t i;
+
+    for (i = 0; i < sizeof(convs) / sizeof(convs[0]); i++) {
+        c.src = video_frame_create(convs[i].src, VIDEO_WIDTH, VIDEO_HEIGHT, MEDIA_MEM_DEEP);
+        c.dst = video_frame_create(convs[i].dst, VIDEO_WIDTH, VIDEO_HEIGHT, MEDIA_MEM_DEEP);
+        if (c.src && c.dst) {
+            memset(c.src->data[0], 0x80, c.src->total_size);
+            bench_run(b, convs[i].name, bench_video_convert, &c, c.src->total_size);
+        } else {
+            printf("video_frame_create failed!\n");
+        }
+        video_frame_destroy(c.src);
+        video_frame_destroy(c.dst);
+    }
+}
+
+static void usage(const char *prog)
+{
+    printf("usage: %s [-j out.json] [-b baseline.json] [-f filter]\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+    int opt, regress;
+    FILE *fp;
+    const char *json = NULL, *baseline = NULL, *filter = NULL;
+    struct bench *b;
+
+    while ((opt = getopt(argc, argv, "j:b:f:h")) != -1) {
+        switch (opt) {
+        case 'j':
+            json = optarg;
+            break;
+        case 'b':
+            baseline = optarg;
+            break;
+        case 'f':
+            filter = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return -1;
+        }
+    }
+    b = bench_create("gear-lib", NULL);
+    if (!b) {
+        printf("bench_create failed!\n");
+        return -1;
+    }
+    bench_set_filter(b, filter);
+    if (baseline && bench_load_baseline(b, baseline) < 0) {
+        bench_destroy(b);
+        return -1;
+    }
+    printf("video_conv simd: %s\n", video_conv_simd_to_string(video_conv_simd_get()));
+    run_gevent(b);
+    run_queue(b);
+    run_workq(b);
+    run_hash(b);
+    run_base64(b);
+    run_serializer(b);
+    run_rtp(b);
+    run_video(b);
+
+    bench_report(b, stdout);
+    if (json) {
+        fp = fopen(json, "w");
+        if (!fp) {
+            printf("open %s failed!\n", json);
+        } else {
+            bench_report_json(b, fp);
+            fclose(fp);
+        }
+    }
+    regress = bench_regressions(b);
+    if (regress) {
+        printf("%d regressions against %s\n", regress, baseline);
+    }
+    bench_destroy(b);
+    return regress ? 1 : 0;
+}
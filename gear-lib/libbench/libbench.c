@@ -0,0 +1,365 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#include "libbench.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <inttypes.h>
+#include <sys/utsname.h>
+
+#define BENCH_RESULTS_INIT      (32)
+#define BENCH_LINE_MAX          (1024)
+#define BENCH_OPS_MAX           (1ULL << 40)
+
+struct bench_base {
+    char name[BENCH_NAME_MAX];
+    double p50;
+};
+
+struct bench {
+    char suite[BENCH_NAME_MAX];
+    char filter[BENCH_NAME_MAX];
+    struct bench_conf conf;
+    struct bench_result *results;
+    int nresults;
+    int cap;
+    struct bench_base *base;
+    int nbase;
+    double samples[BENCH_SAMPLES_MAX];
+};
+
+static uint64_t bench_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+struct bench *bench_create(const char *suite, const struct bench_conf *conf)
+{
+    struct bench *b = (struct bench *)calloc(1, sizeof(struct bench));
+    if (!b) {
+        return NULL;
+    }
+    snprintf(b->suite, sizeof(b->suite), "%s", suite ? suite : "bench");
+    if (conf) {
+        b->conf = *conf;
+    }
+    if (b->conf.warmup_ms <= 0) {
+        b->conf.warmup_ms = 200;
+    }
+    if (b->conf.sample_ms <= 0) {
+        b->conf.sample_ms = 10;
+    }
+    if (b->conf.samples <= 0) {
+        b->conf.samples = 50;
+    }
+    if (b->conf.samples > BENCH_SAMPLES_MAX) {
+        b->conf.samples = BENCH_SAMPLES_MAX;
+    }
+    if (b->conf.threshold <= 0) {
+        b->conf.threshold = 0.10;
+    }
+    return b;
+}
+
+void bench_destroy(struct bench *b)
+{
+    if (!b) {
+        return;
+    }
+    free(b->results);
+    free(b->base);
+    free(b);
+}
+
+void bench_set_filter(struct bench *b, const char *filter)
+{
+    if (b) {
+        snprintf(b->filter, sizeof(b->filter), "%s", filter ? filter : "");
+    }
+}
+
+static double baseline_find(struct bench *b, const char *name)
+{
+    int i;
+    for (i = 0; i < b->nbase; i++) {
+        if (!strcmp(b->base[i].name, name)) {
+            return b->base[i].p50;
+        }
+    }
+    return 0;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* nearest rank on sorted samples */
+static double percentile(const double *v, int n, int pct)
+{
+    int rank = (pct * n + 99) / 100;
+    if (rank < 1) {
+        rank = 1;
+    }
+    return v[rank - 1];
+}
+
+/* ops of one batch taking about sample_ms, -1 if fn failed */
+static int64_t calibrate(struct bench *b, bench_func fn, void *arg)
+{
+    uint64_t n = 1, t, target = (uint64_t)b->conf.sample_ms * 1000000ULL;
+
+    for (;;) {
+        t = bench_now_ns();
+        if (0 != fn(arg, n)) {
+            return -1;
+        }
+        t = bench_now_ns() - t;
+        if (t >= target / 2 || n >= BENCH_OPS_MAX) {
+            break;
+        }
+        /* grow by the measured rate, at most 10x, at least 2x */
+        if (t == 0 || t * 10 < target / 2) {
+            n *= 10;
+        } else {
+            n *= 2;
+        }
+    }
+    if (t > 0) {
+        n = (uint64_t)((double)n * target / t);
+    }
+    return n > 0 ? (int64_t)n : 1;
+}
+
+int bench_run(struct bench *b, const char *name, bench_func fn, void *arg,
+              size_t bytes)
+{
+    int i, ns;
+    int64_t ops;
+    uint64_t t, end;
+    double sum = 0, var = 0;
+    struct bench_result *r;
+
+    if (!b || !name || !fn) {
+        return -1;
+    }
+    if (b->filter[0] && !strstr(name, b->filter)) {
+        return 1;
+    }
+    if (b->nresults == b->cap) {
+        int cap = b->cap ? b->cap * 2 : BENCH_RESULTS_INIT;
+        r = (struct bench_result *)realloc(b->results, cap * sizeof(*r));
+        if (!r) {
+            return -1;
+        }
+        b->results = r;
+        b->cap = cap;
+    }
+    ops = calibrate(b, fn, arg);
+    if (ops < 0) {
+        printf("bench %s failed!\n", name);
+        return -1;
+    }
+    end = bench_now_ns() + (uint64_t)b->conf.warmup_ms * 1000000ULL;
+    while (bench_now_ns() < end) {
+        if (0 != fn(arg, ops)) {
+            printf("bench %s failed!\n", name);
+            return -1;
+        }
+    }
+    ns = b->conf.samples;
+    for (i = 0; i < ns; i++) {
+        t = bench_now_ns();
+        if (0 != fn(arg, ops)) {
+            printf("bench %s failed!\n", name);
+            return -1;
+        }
+        b->samples[i] = (double)(bench_now_ns() - t) / ops;
+        sum += b->samples[i];
+    }
+    qsort(b->samples, ns, sizeof(double), cmp_double);
+
+    r = &b->results[b->nresults++];
+    memset(r, 0, sizeof(*r));
+    snprintf(r->name, sizeof(r->name), "%s", name);
+    r->ops = ops;
+    r->bytes = bytes;
+    r->samples = ns;
+    r->min = b->samples[0];
+    r->max = b->samples[ns - 1];
+    r->p50 = percentile(b->samples, ns, 50);
+    r->p90 = percentile(b->samples, ns, 90);
+    r->p99 = percentile(b->samples, ns, 99);
+    r->mean = sum / ns;
+    for (i = 0; i < ns; i++) {
+        var += (b->samples[i] - r->mean) * (b->samples[i] - r->mean);
+    }
+    r->stddev = ns > 1 ? sqrt(var / (ns - 1)) : 0;
+    r->baseline = baseline_find(b, r->name);
+    return 0;
+}
+
+int bench_count(struct bench *b)
+{
+    return b ? b->nresults : 0;
+}
+
+const struct bench_result *bench_get(struct bench *b, int idx)
+{
+    if (!b || idx < 0 || idx >= b->nresults) {
+        return NULL;
+    }
+    return &b->results[idx];
+}
+
+static int is_regression(struct bench *b, const struct bench_result *r)
+{
+    return r->baseline > 0 && r->p50 > r->baseline * (1 + b->conf.threshold);
+}
+
+static double mb_per_sec(const struct bench_result *r)
+{
+    return r->bytes && r->p50 > 0 ? r->bytes * 1000.0 / r->p50 : 0;
+}
+
+void bench_report(struct bench *b, FILE *fp)
+{
+    int i;
+    const struct bench_result *r;
+
+    if (!b || !fp) {
+        return;
+    }
+    fprintf(fp, "%-32s %10s %10s %10s %10s %10s %10s\n", "benchmark (ns/op)",
+            "min", "p50", "p90", "p99", "MB/s", "baseline");
+    for (i = 0; i < b->nresults; i++) {
+        r = &b->results[i];
+        fprintf(fp, "%-32s %10.1f %10.1f %10.1f %10.1f", r->name,
+                r->min, r->p50, r->p90, r->p99);
+        if (r->bytes) {
+            fprintf(fp, " %10.1f", mb_per_sec(r));
+        } else {
+            fprintf(fp, " %10s", "-");
+        }
+        if (r->baseline > 0) {
+            fprintf(fp, " %+9.1f%%%s", (r->p50 / r->baseline - 1) * 100,
+                    is_regression(b, r) ? " REGRESSION" : "");
+        }
+        fputc('\n', fp);
+    }
+}
+
+/* one result per line, bench_load_baseline relies on it */
+void bench_report_json(struct bench *b, FILE *fp)
+{
+    int i;
+    struct utsname un;
+    const struct bench_result *r;
+
+    if (!b || !fp) {
+        return;
+    }
+    memset(&un, 0, sizeof(un));
+    uname(&un);
+    fprintf(fp, "{\"suite\":\"%s\",\"machine\":\"%s\",\"release\":\"%s\","
+            "\"time\":%" PRIu64 ",\n\"conf\":{\"warmup_ms\":%d,\"sample_ms\":%d,"
+            "\"samples\":%d,\"threshold\":%.3f},\n\"results\":[\n",
+            b->suite, un.machine, un.release, (uint64_t)time(NULL),
+            b->conf.warmup_ms, b->conf.sample_ms, b->conf.samples,
+            b->conf.threshold);
+    for (i = 0; i < b->nresults; i++) {
+        r = &b->results[i];
+        fprintf(fp, "{\"name\":\"%s\",\"p50_ns\":%.3f,\"min_ns\":%.3f,"
+                "\"p90_ns\":%.3f,\"p99_ns\":%.3f,\"max_ns\":%.3f,"
+                "\"mean_ns\":%.3f,\"stddev_ns\":%.3f,\"ops\":%" PRIu64
+                ",\"samples\":%d,\"bytes\":%zu,\"mb_per_sec\":%.3f",
+                r->name, r->p50, r->min, r->p90, r->p99, r->max, r->mean,
+                r->stddev, r->ops, r->samples, r->bytes, mb_per_sec(r));
+        if (r->baseline > 0) {
+            fprintf(fp, ",\"baseline_p50_ns\":%.3f,\"regression\":%s",
+                    r->baseline, is_regression(b, r) ? "true" : "false");
+        }
+        fprintf(fp, "}%s\n", i + 1 < b->nresults ? "," : "");
+    }
+    fprintf(fp, "]}\n");
+}
+
+int bench_load_baseline(struct bench *b, const char *path)
+{
+    int i;
+    FILE *fp;
+    char line[BENCH_LINE_MAX];
+    char *name, *end, *p50;
+    struct bench_base *base;
+
+    if (!b || !path) {
+        return -1;
+    }
+    fp = fopen(path, "r");
+    if (!fp) {
+        printf("open %s failed!\n", path);
+        return -1;
+    }
+    b->nbase = 0;
+    while (fgets(line, sizeof(line), fp)) {
+        name = strstr(line, "{\"name\":\"");
+        p50 = strstr(line, "\"p50_ns\":");
+        if (!name || !p50) {
+            continue;
+        }
+        name += strlen("{\"name\":\"");
+        end = strchr(name, '"');
+        if (!end || end - name >= BENCH_NAME_MAX) {
+            continue;
+        }
+        *end = '\0';
+        base = (struct bench_base *)realloc(b->base, (b->nbase + 1) * sizeof(*base));
+        if (!base) {
+            break;
+        }
+        b->base = base;
+        snprintf(base[b->nbase].name, BENCH_NAME_MAX, "%s", name);
+        base[b->nbase].p50 = strtod(p50 + strlen("\"p50_ns\":"), NULL);
+        b->nbase++;
+    }
+    fclose(fp);
+    for (i = 0; i < b->nresults; i++) {
+        b->results[i].baseline = baseline_find(b, b->results[i].name);
+    }
+    return b->nbase;
+}
+
+int bench_regressions(struct bench *b)
+{
+    int i, n = 0;
+    if (!b) {
+        return 0;
+    }
+    for (i = 0; i < b->nresults; i++) {
+        n += is_regression(b, &b->results[i]);
+    }
+    return n;
+}
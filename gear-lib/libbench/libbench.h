@@ -0,0 +1,104 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#ifndef LIBBENCH_H
+#define LIBBENCH_H
+
+#include <libposix.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define LIBBENCH_VERSION "0.1.0"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * microbenchmark harness.
+ *
+ * a case is a function running n operations. the harness doubles n until
+ * one batch takes sample_ms, runs batches for warmup_ms, then times
+ * samples batches and reports ns per op as min/p50/p90/p99/max/mean.
+ * results are printed as text or json, a json report of an earlier run
+ * loads as baseline and p50 slower than it by threshold is a regression
+ */
+
+#define BENCH_NAME_MAX          (64)
+#define BENCH_SAMPLES_MAX       (1000)
+
+/* run n ops, 0 or -1 to abort the case */
+typedef int (*bench_func)(void *arg, uint64_t n);
+
+struct bench_conf {
+    int warmup_ms;      /* default 200 */
+    int sample_ms;      /* time of one batch, default 10 */
+    int samples;        /* timed batches, default 50 */
+    double threshold;   /* regression of p50 vs baseline, default 0.10 */
+};
+
+struct bench_result {
+    char name[BENCH_NAME_MAX];
+    uint64_t ops;       /* ops per batch */
+    size_t bytes;       /* bytes per op, 0 if not a throughput case */
+    int samples;
+    double min;         /* ns per op */
+    double p50;
+    double p90;
+    double p99;
+    double max;
+    double mean;
+    double stddev;
+    double baseline;    /* p50 of baseline, 0 if not in it */
+};
+
+struct bench;
+
+/* conf NULL or 0 fields take defaults */
+GEAR_API struct bench *bench_create(const char *suite, const struct bench_conf *conf);
+GEAR_API void bench_destroy(struct bench *b);
+
+/* run only cases whose name contains filter, NULL runs all */
+GEAR_API void bench_set_filter(struct bench *b, const char *filter);
+
+/*
+ * bytes is the data one op handles, it adds MB/s to the report.
+ * returns 0, 1 if skipped by filter, -1 on error
+ */
+GEAR_API int bench_run(struct bench *b, const char *name, bench_func fn,
+                void *arg, size_t bytes);
+
+GEAR_API int bench_count(struct bench *b);
+GEAR_API const struct bench_result *bench_get(struct bench *b, int idx);
+
+GEAR_API void bench_report(struct bench *b, FILE *fp);
+GEAR_API void bench_report_json(struct bench *b, FILE *fp);
+
+/* json of bench_report_json, results run later are compared to it */
+GEAR_API int bench_load_baseline(struct bench *b, const char *path);
+/* results with p50 above baseline * (1 + threshold) */
+GEAR_API int bench_regressions(struct bench *b);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,631 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+
+/*
+ * connection soak of gear-lib servers: a forked server of one module takes
+ * n idle connections, then a of them send a request per interval for some
+ * seconds. RSS, threads, fds and the mem_account of modules are sampled in
+ * the server before, with all connections and after they are closed, and
+ * reported per connection with the round trip percentiles
+ *
+ *   ./soak_gear -m sock -n 10000 -a 100 -s 30
+ * exits 1 if objects of an account are left after all connections closed
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <libposix.h>
+#include <libsock.h>
+#include <libsock_ext.h>
+#include <libhttpd.h>
+#include <librpc.h>
+#include <librtsp.h>
+#include <libtime.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <signal.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#define SOAK_ACCOUNT_MAX    (16)
+#define SOAK_PAYLOAD        (64)
+#define SOAK_RX_LEN         (1024)
+#define SOAK_TIMEOUT_MS     (2000)
+#define SOAK_CLOSE_WAIT_MS  (1000)
+
+enum soak_module {
+    SOAK_SOCK,
+    SOAK_HTTPD,
+    SOAK_RTSP,
+    SOAK_RPC,
+    SOAK_MAX,
+};
+
+static const char *soak_module_names[SOAK_MAX] = {"sock", "httpd", "rtsp", "rpc"};
+
+struct soak_conf {
+    enum soak_module module;
+    int nidle;
+    int nactive;
+    int seconds;
+    int interval_ms;
+    int nshard;
+    uint16_t port;
+};
+
+struct soak_snap {
+    long rss_kb;
+    int threads;
+    int fds;
+    int naccount;
+    struct mem_account account[SOAK_ACCOUNT_MAX];
+    char names[SOAK_ACCOUNT_MAX][32];
+};
+
+struct soak_conn {
+    int fd;
+    int cseq;
+    size_t len;
+    uint64_t start_us;
+    char rx[SOAK_RX_LEN];
+};
+
+/******************************************************************************
+ * server side, runs in a forked child
+ ******************************************************************************/
+static size_t sock_on_data(struct sock_server_conn *c, void *buf, size_t len)
+{
+    sock_server_conn_write(c, buf, len);
+    return len;
+}
+
+static void httpd_on_request(struct httpd_conn *c, const struct httpd_request *req, void *arg)
+{
+    httpd_reply(c, 200, "text/plain", "ok", 2);
+}
+
+static void *sock_dispatch_thread(void *arg)
+{
+    sock_server_dispatch(arg);
+    return NULL;
+}
+
+static void *rpc_dispatch_thread(void *arg)
+{
+    rpc_server_dispatch(arg);
+    return NULL;
+}
+
+static int server_start(struct soak_conf *conf)
+{
+    pthread_t tid;
+    struct sock_server *ss;
+    struct sock_server_conn_cbs cbs;
+    struct httpd_config hc;
+    struct httpd *h;
+    struct rtsp_server *rs;
+    struct rpcs *rpc;
+
+    switch (conf->module) {
+    case SOAK_SOCK:
+        ss = sock_server_create_sharded(NULL, conf->port, SOCK_TYPE_TCP, conf->nshard);
+        if (!ss) {
+            return -1;
+        }
+        memset(&cbs, 0, sizeof(cbs));
+        cbs.on_data = sock_on_data;
+        sock_server_set_conn_callback(ss, &cbs);
+        return pthread_create(&tid, NULL, sock_dispatch_thread, ss);
+    case SOAK_HTTPD:
+        memset(&hc, 0, sizeof(hc));
+        hc.port = conf->port;
+        hc.nthread = conf->nshard;
+        /* idle connections must outlive the run */
+        hc.idle_timeout_ms = (conf->seconds + 600) * 1000;
+        h = httpd_create(&hc);
+        if (!h) {
+            return -1;
+        }
+        httpd_route(h, "/", httpd_on_request, NULL);
+        return httpd_start(h);
+    case SOAK_RTSP:
+        rs = rtsp_server_init_sharded(NULL, conf->port, conf->nshard);
+        if (!rs) {
+            return -1;
+        }
+        return rtsp_server_dispatch(rs);
+    case SOAK_RPC:
+        rpc = rpc_server_create(NULL, conf->port);
+        if (!rpc) {
+            return -1;
+        }
+        return pthread_create(&tid, NULL, rpc_dispatch_thread, rpc);
+    default:
+        return -1;
+    }
+}
+
+static void proc_sample(long *rss_kb, int *threads, int *fds)
+{
+    FILE *fp;
+    DIR *dir;
+    char line[128];
+    long size, resident;
+
+    *rss_kb = 0;
+    *threads = 0;
+    *fds = 0;
+    fp = fopen("/proc/self/statm", "r");
+    if (fp) {
+        if (2 == fscanf(fp, "%ld %ld", &size, &resident)) {
+            *rss_kb = resident * (sysconf(_SC_PAGESIZE) / 1024);
+        }
+        fclose(fp);
+    }
+    fp = fopen("/proc/self/status", "r");
+    if (fp) {
+        while (fgets(line, sizeof(line), fp)) {
+            if (1 == sscanf(line, "Threads: %d", threads)) {
+                break;
+            }
+        }
+        fclose(fp);
+    }
+    dir = opendir("/proc/self/fd");
+    if (dir) {
+        while (readdir(dir)) {
+            (*fds)++;
+        }
+        /* ., .. and fd of opendir itself */
+        *fds -= 3;
+        closedir(dir);
+    }
+}
+
+static void account_print(const struct mem_account *a, void *arg)
+{
+    fprintf(arg, "%s %" PRId64 " %" PRId64 " %" PRId64 "\n",
+            a->name, a->bytes, a->peak, a->objects);
+}
+
+/* one byte of cmd_fd asks for a sample, answered as lines ended by "." */
+static void server_loop(int cmd_fd, int reply_fd)
+{
+    char cmd;
+    long rss_kb;
+    int threads, fds;
+    FILE *out = fdopen(reply_fd, "w");
+
+    while (1 == read(cmd_fd, &cmd, 1)) {
+        proc_sample(&rss_kb, &threads, &fds);
+        fprintf(out, "%ld %d %d\n", rss_kb, threads, fds);
+        mem_account_foreach(account_print, out);
+        fprintf(out, ".\n");
+        fflush(out);
+    }
+    exit(0);
+}
+
+/******************************************************************************
+ * client side
+ ******************************************************************************/
+static int snap_take(int cmd_fd, FILE *reply, struct soak_snap *s)
+{
+    char line[128];
+    struct mem_account *a;
+
+    memset(s, 0, sizeof(*s));
+    if (1 != write(cmd_fd, "s", 1) || !fgets(line, sizeof(line), reply) ||
+        3 != sscanf(line, "%ld %d %d", &s->rss_kb, &s->threads, &s->fds)) {
+        return -1;
+    }
+    while (fgets(line, sizeof(line), reply)) {
+        if (line[0] == '.') {
+            return 0;
+        }
+        if (s->naccount == SOAK_ACCOUNT_MAX) {
+            continue;
+        }
+        a = &s->account[s->naccount];
+        if (4 == sscanf(line, "%31s %" SCNd64 " %" SCNd64 " %" SCNd64,
+                        s->names[s->naccount], &a->bytes, &a->peak, &a->objects)) {
+            a->name = s->names[s->naccount];
+            s->naccount++;
+        }
+    }
+    return -1;
+}
+
+static const struct mem_account *snap_account(const struct soak_snap *s, const char *name)
+{
+    int i;
+    for (i = 0; i < s->naccount; i++) {
+        if (!strcmp(s->account[i].name, name)) {
+            return &s->account[i];
+        }
+    }
+    return NULL;
+}
+
+static int conn_open(uint16_t port)
+{
+    int fd, one = 1;
+    struct sockaddr_in sa;
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(port);
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+        close(fd);
+        return -1;
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+}
+
+static int conn_request(struct soak_conf *conf, struct soak_conn *c)
+{
+    char req[256];
+    int n;
+
+    switch (conf->module) {
+    case SOAK_SOCK:
+        memset(req, 'x', SOAK_PAYLOAD);
+        n = SOAK_PAYLOAD;
+        break;
+    case SOAK_HTTPD:
+        n = snprintf(req, sizeof(req), "GET / HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n");
+        break;
+    case SOAK_RTSP:
+        n = snprintf(req, sizeof(req),
+                     "OPTIONS rtsp://127.0.0.1:%d/ RTSP/1.0\r\nCSeq: %d\r\n\r\n",
+                     conf->port, ++c->cseq);
+        break;
+    default:
+        return -1;
+    }
+    c->len = 0;
+    c->start_us = time_now_usec(NULL);
+    return send(c->fd, req, n, MSG_NOSIGNAL) == n ? 0 : -1;
+}
+
+/* one request is in flight per connection, so a whole reply ends the rx */
+static int conn_reply_done(struct soak_conf *conf, struct soak_conn *c)
+{
+    switch (conf->module) {
+    case SOAK_SOCK:
+        return c->len >= SOAK_PAYLOAD;
+    case SOAK_HTTPD:
+        return c->len >= 2 && !memcmp(c->rx + c->len - 2, "ok", 2);
+    default:
+        return c->len >= 4 && !memcmp(c->rx + c->len - 4, "\r\n\r\n", 4);
+    }
+}
+
+static int u64_cmp(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* returns rtt samples in us, sorted */
+static uint64_t *active_run(struct soak_conf *conf, int *fds, int n, size_t *nrtt, int *nerr)
+{
+    struct soak_conn *conns;
+    struct epoll_event ev, evs[256];
+    uint64_t *rtt = NULL, *tmp, end_us, round_us;
+    size_t cap = 0;
+    ssize_t r;
+    int i, j, epfd, waiting, nev;
+
+    *nrtt = 0;
+    *nerr = 0;
+    conns = calloc(n, sizeof(*conns));
+    epfd = epoll_create1(0);
+    if (!conns || epfd < 0) {
+        free(conns);
+        return NULL;
+    }
+    for (i = 0; i < n; i++) {
+        conns[i].fd = fds[i];
+        ev.events = EPOLLIN;
+        ev.data.ptr = &conns[i];
+        epoll_ctl(epfd, EPOLL_CTL_ADD, fds[i], &ev);
+    }
+    end_us = time_now_usec(NULL) + (uint64_t)conf->seconds * 1000000;
+    while (time_now_usec(NULL) < end_us) {
+        round_us = time_now_usec(NULL);
+        waiting = 0;
+        for (i = 0; i < n; i++) {
+            if (conns[i].fd < 0) {
+                continue;
+            }
+            if (conn_request(conf, &conns[i]) < 0) {
+                (*nerr)++;
+                close(conns[i].fd);
+                conns[i].fd = -1;
+                continue;
+            }
+            waiting++;
+        }
+        if (*nrtt + waiting > cap) {
+            cap = (*nrtt + waiting) * 2;
+            tmp = realloc(rtt, cap * sizeof(*rtt));
+            if (!tmp) {
+                break;
+            }
+            rtt = tmp;
+        }
+        while (waiting > 0) {
+            nev = epoll_wait(epfd, evs, 256, SOAK_TIMEOUT_MS);
+            if (nev <= 0) {
+                *nerr += waiting;
+                break;
+            }
+            for (j = 0; j < nev; j++) {
+                struct soak_conn *c = evs[j].data.ptr;
+                r = recv(c->fd, c->rx + c->len, sizeof(c->rx) - c->len, 0);
+                if (r <= 0) {
+                    if (r < 0 && errno == EAGAIN) {
+                        continue;
+                    }
+                    (*nerr)++;
+                    waiting--;
+                    epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+                    close(c->fd);
+                    c->fd = -1;
+                    continue;
+                }
+                c->len += r;
+                if (conn_reply_done(conf, c) || c->len == sizeof(c->rx)) {
+                    rtt[(*nrtt)++] = time_now_usec(NULL) - c->start_us;
+                    waiting--;
+                }
+            }
+        }
+        round_us = time_now_usec(NULL) - round_us;
+        if (round_us < (uint64_t)conf->interval_ms * 1000) {
+            usleep(conf->interval_ms * 1000 - round_us);
+        }
+    }
+    /* the fds are closed by caller with the idle ones */
+    for (i = 0; i < n; i++) {
+        fds[i] = conns[i].fd;
+    }
+    close(epfd);
+    free(conns);
+    if (rtt) {
+        qsort(rtt, *nrtt, sizeof(*rtt), u64_cmp);
+    }
+    return rtt;
+}
+
+static int nofile_raise(int want)
+{
+    struct rlimit rl;
+
+    if (getrlimit(RLIMIT_NOFILE, &rl) < 0) {
+        return -1;
+    }
+    if (rl.rlim_cur < (rlim_t)want) {
+        rl.rlim_cur = rl.rlim_max < (rlim_t)want ? rl.rlim_max : (rlim_t)want;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+    return (int)rl.rlim_cur;
+}
+
+static void report(struct soak_conf *conf, struct soak_snap *base, struct soak_snap *full,
+                   struct soak_snap *closed, int nconn)
+{
+    int i;
+    const struct mem_account *a, *b;
+    int per = nconn > 0 ? nconn : 1;
+
+    printf("%-20s %12s %12s %12s\n", "", "baseline", "connected", "per conn");
+    printf("%-20s %12ld %12ld %12.2f\n", "rss KB", base->rss_kb, full->rss_kb,
+           (double)(full->rss_kb - base->rss_kb) / per);
+    printf("%-20s %12d %12d %12.2f\n", "threads", base->threads, full->threads,
+           (double)(full->threads - base->threads) / per);
+    printf("%-20s %12d %12d %12.2f\n", "fds", base->fds, full->fds,
+           (double)(full->fds - base->fds) / per);
+    for (i = 0; i < full->naccount; i++) {
+        a = &full->account[i];
+        b = snap_account(base, a->name);
+        printf("%-20s %12" PRId64 " %12" PRId64 " %12.1f  objects %" PRId64 " peak %" PRId64 "\n",
+               a->name, b ? b->bytes : 0, a->bytes,
+               (double)(a->bytes - (b ? b->bytes : 0)) / per, a->objects, a->peak);
+    }
+    printf("after close: rss %ld KB, threads %d, fds %d\n",
+           closed->rss_kb, closed->threads, closed->fds);
+}
+
+static void usage(const char *prog)
+{
+    printf("usage: %s [-m sock|httpd|rtsp|rpc] [-n idle] [-a active] [-s seconds]\n"
+           "          [-i interval_ms] [-t shards] [-p port]\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+    struct soak_conf conf = {SOAK_SOCK, 1000, 10, 10, 100, 0, 5500};
+    struct soak_snap base, full, closed;
+    const struct mem_account *a, *b;
+    int cmd_pipe[2], reply_pipe[2];
+    int opt, i, nconn, nerr, limit, leaked = 0;
+    int *fds;
+    uint64_t *rtt;
+    size_t nrtt;
+    uint64_t start_us;
+    FILE *reply;
+    pid_t pid;
+
+    while ((opt = getopt(argc, argv, "m:n:a:s:i:t:p:h")) != -1) {
+        switch (opt) {
+        case 'm':
+            for (i = 0; i < SOAK_MAX; i++) {
+                if (!strcmp(optarg, soak_module_names[i])) {
+                    conf.module = i;
+                    break;
+                }
+            }
+            if (i == SOAK_MAX) {
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'n':
+            conf.nidle = atoi(optarg);
+            break;
+        case 'a':
+            conf.nactive = atoi(optarg);
+            break;
+        case 's':
+            conf.seconds = atoi(optarg);
+            break;
+        case 'i':
+            conf.interval_ms = atoi(optarg);
+            break;
+        case 't':
+            conf.nshard = atoi(optarg);
+            break;
+        case 'p':
+            conf.port = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return -1;
+        }
+    }
+    if (conf.module == SOAK_RPC && conf.nactive > 0) {
+        /* rpc has no request without a registered message map */
+        printf("rpc soak is idle only, -a ignored\n");
+        conf.nactive = 0;
+    }
+    nconn = conf.nidle + conf.nactive;
+    limit = nofile_raise(nconn + 64);
+    if (limit < nconn + 64) {
+        nconn = limit - 64;
+        conf.nactive = conf.nactive < nconn ? conf.nactive : nconn;
+        conf.nidle = nconn - conf.nactive;
+        printf("RLIMIT_NOFILE %d, connections cut to %d\n", limit, nconn);
+    }
+    signal(SIGPIPE, SIG_IGN);
+    if (pipe(cmd_pipe) < 0 || pipe(reply_pipe) < 0) {
+        return -1;
+    }
+    pid = fork();
+    if (pid < 0) {
+        return -1;
+    }
+    if (pid == 0) {
+        close(cmd_pipe[1]);
+        close(reply_pipe[0]);
+        if (server_start(&conf) < 0) {
+            fprintf(stderr, "%s server start failed\n", soak_module_names[conf.module]);
+            exit(1);
+        }
+        server_loop(cmd_pipe[0], reply_pipe[1]);
+    }
+    close(cmd_pipe[0]);
+    close(reply_pipe[1]);
+    reply = fdopen(reply_pipe[0], "r");
+    fds = calloc(nconn > 0 ? nconn : 1, sizeof(int));
+    if (!fds || snap_take(cmd_pipe[1], reply, &base) < 0) {
+        fprintf(stderr, "server did not answer\n");
+        goto out;
+    }
+
+    printf("%s: %d idle, %d active, %d s\n", soak_module_names[conf.module],
+           conf.nidle, conf.nactive, conf.seconds);
+    start_us = time_now_usec(NULL);
+    for (i = 0; i < nconn; i++) {
+        fds[i] = conn_open(conf.port);
+        if (fds[i] < 0) {
+            fprintf(stderr, "connect %d failed: %s\n", i, strerror(errno));
+            nconn = i;
+            break;
+        }
+    }
+    printf("ramp: %d connections in %" PRIu64 " ms\n", nconn,
+           (time_now_usec(NULL) - start_us) / 1000);
+    /* accepts complete in the server loops, give them time to settle */
+    usleep(SOAK_CLOSE_WAIT_MS * 1000);
+
+    if (conf.nactive > 0 && nconn > conf.nidle) {
+        rtt = active_run(&conf, fds + conf.nidle, nconn - conf.nidle, &nrtt, &nerr);
+        if (rtt && nrtt > 0) {
+            printf("rtt us: n %zu p50 %" PRIu64 " p99 %" PRIu64 " max %" PRIu64 ", errors %d\n",
+                   nrtt, rtt[nrtt / 2], rtt[nrtt * 99 / 100], rtt[nrtt - 1], nerr);
+        } else {
+            printf("rtt: no reply, errors %d\n", nerr);
+        }
+        free(rtt);
+    } else {
+        sleep(conf.seconds);
+    }
+    snap_take(cmd_pipe[1], reply, &full);
+
+    for (i = 0; i < nconn; i++) {
+        if (fds[i] >= 0) {
+            close(fds[i]);
+        }
+    }
+    usleep(SOAK_CLOSE_WAIT_MS * 1000);
+    snap_take(cmd_pipe[1], reply, &closed);
+    report(&conf, &base, &full, &closed, nconn);
+
+    for (i = 0; i < closed.naccount; i++) {
+        a = &closed.account[i];
+        b = snap_account(&base, a->name);
+        if (a->objects > (b ? b->objects : 0)) {
+            printf("%s: %" PRId64 " objects left after close\n", a->name,
+                   a->objects - (b ? b->objects : 0));
+            leaked = 1;
+        }
+    }
+
+out:
+    free(fds);
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    return leaked;
+}
@@ -0,0 +1,85 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "libbench.h"
+
+#define COPY_SIZE       (64 * 1024)
+
+static char src[COPY_SIZE], dst[COPY_SIZE];
+
+static int bench_memcpy(void *arg, uint64_t n)
+{
+    size_t len = *(size_t *)arg;
+    while (n--) {
+        memcpy(dst, src, len);
+        __asm__ __volatile__("" : : "r"(dst) : "memory");
+    }
+    return 0;
+}
+
+static int bench_rand(void *arg, uint64_t n)
+{
+    unsigned int seed = 1;
+    volatile int sink = 0;
+    while (n--) {
+        sink += rand_r(&seed);
+    }
+    (void)sink;
+    return 0;
+}
+
+/*
+ * ./test_libbench [json] [baseline]
+ * writes json report, compares to baseline json of an earlier run
+ */
+int main(int argc, char **argv)
+{
+    FILE *fp;
+    int regress;
+    size_t small = 64, large = COPY_SIZE;
+    struct bench_conf conf = {100, 5, 20, 0.10};
+    struct bench *b = bench_create("test_libbench", &conf);
+    if (!b) {
+        printf("bench_create failed!\n");
+        return -1;
+    }
+    if (argc > 2 && bench_load_baseline(b, argv[2]) < 0) {
+        printf("bench_load_baseline %s failed!\n", argv[2]);
+    }
+    bench_run(b, "memcpy_64", bench_memcpy, &small, small);
+    bench_run(b, "memcpy_64k", bench_memcpy, &large, large);
+    bench_run(b, "rand_r", bench_rand, NULL, 0);
+    bench_report(b, stdout);
+    if (argc > 1) {
+        fp = fopen(argv[1], "w");
+        if (fp) {
+            bench_report_json(b, fp);
+            fclose(fp);
+        }
+    }
+    regress = bench_regressions(b);
+    bench_destroy(b);
+    return regress ? 1 : 0;
+}
@@ -13,6 +13,9 @@
  */
 static __always_inline unsigned long __ffs(unsigned long word)
 {
+#if defined (__GNUC__) || defined (__clang__)
+	return __builtin_ctzl(word);
+#else
 	int num = 0;
 
 #if __BITS_PER_LONG == 64
@@ -40,6 +43,7 @@ static __always_inline unsigned long __ffs(unsigned long word)
 	if ((word & 0x1) == 0)
 		num += 1;
 	return num;
+#endif
 }
 
 #endif /* _TOOLS_LINUX_ASM_GENERIC_BITOPS___FFS_H_ */
@@ -4,9 +4,18 @@
 
 #include <asm/types.h>
 
+/* builtin compiles to popcnt when target has it, table free otherwise */
+#if defined (__GNUC__) || defined (__clang__)
+#define HWEIGHT_BUILTIN
+#endif
+
 static inline unsigned int __arch_hweight32(unsigned int w)
 {
+#ifdef HWEIGHT_BUILTIN
+	return __builtin_popcount(w);
+#else
 	return __sw_hweight32(w);
+#endif
 }
 
 static inline unsigned int __arch_hweight16(unsigned int w)
@@ -21,6 +30,10 @@ static inline unsigned int __arch_hweight8(unsigned int w)
 
 static inline unsigned long __arch_hweight64(__u64 w)
 {
+#ifdef HWEIGHT_BUILTIN
+	return __builtin_popcountll(w);
+#else
 	return __sw_hweight64(w);
+#endif
 }
 #endif /* _ASM_GENERIC_BITOPS_HWEIGHT_H_ */
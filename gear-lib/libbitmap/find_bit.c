@@ -0,0 +1,180 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#include "libbitmap.h"
+
+#if defined (__AVX2__)
+#include <immintrin.h>
+#define BITMAP_USE_AVX2
+#elif defined (__SSE2__) || defined (_M_X64)
+#include <emmintrin.h>
+#define BITMAP_USE_SSE2
+#elif defined (__aarch64__)
+#include <arm_neon.h>
+#define BITMAP_USE_NEON
+#endif
+
+#if defined (BITMAP_USE_AVX2) || defined (BITMAP_USE_SSE2) || defined (BITMAP_USE_NEON)
+#define BITMAP_USE_SIMD
+#endif
+
+/*
+ * find_bit from linux kernel lib/find_bit.c, word at a time scan, with
+ * avx2/sse2/neon skipping 64 bytes of all zero (or all one) words per
+ * step, sparse bitmaps scan several times faster
+ */
+
+#if defined (BITMAP_USE_AVX2)
+/* return first word index from idx, whose 64 byte block isn't all pattern */
+static unsigned long simd_skip(const unsigned long *addr, unsigned long idx,
+			       unsigned long end, int invert)
+{
+	const unsigned long step = 64 / sizeof(unsigned long);
+	const __m256i pat = invert ? _mm256_set1_epi8(-1) : _mm256_setzero_si256();
+	__m256i m;
+
+	while (idx + step <= end) {
+		const __m256i *p = (const __m256i *)(addr + idx);
+		m = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_loadu_si256(p), pat),
+				     _mm256_cmpeq_epi8(_mm256_loadu_si256(p + 1), pat));
+		if ((unsigned int)_mm256_movemask_epi8(m) != 0xFFFFFFFFu)
+			break;
+		idx += step;
+	}
+	return idx;
+}
+#elif defined (BITMAP_USE_NEON)
+static unsigned long simd_skip(const unsigned long *addr, unsigned long idx,
+			       unsigned long end, int invert)
+{
+	const unsigned long step = 64 / sizeof(unsigned long);
+	const uint64x2_t pat = vdupq_n_u64(invert ? ~0ULL : 0ULL);
+	uint64x2_t m;
+
+	while (idx + step <= end) {
+		const uint64_t *p = (const uint64_t *)(addr + idx);
+		m = vandq_u64(vandq_u64(vceqq_u64(vld1q_u64(p), pat),
+					vceqq_u64(vld1q_u64(p + 2), pat)),
+			      vandq_u64(vceqq_u64(vld1q_u64(p + 4), pat),
+					vceqq_u64(vld1q_u64(p + 6), pat)));
+		if (vminvq_u32(vreinterpretq_u32_u64(m)) != 0xFFFFFFFFu)
+			break;
+		idx += step;
+	}
+	return idx;
+}
+#elif defined (BITMAP_USE_SSE2)
+static unsigned long simd_skip(const unsigned long *addr, unsigned long idx,
+			       unsigned long end, int invert)
+{
+	const unsigned long step = 64 / sizeof(unsigned long);
+	const __m128i pat = invert ? _mm_set1_epi8(-1) : _mm_setzero_si128();
+	__m128i m;
+
+	while (idx + step <= end) {
+		const __m128i *p = (const __m128i *)(addr + idx);
+		m = _mm_and_si128(
+			_mm_and_si128(_mm_cmpeq_epi8(_mm_loadu_si128(p), pat),
+				      _mm_cmpeq_epi8(_mm_loadu_si128(p + 1), pat)),
+			_mm_and_si128(_mm_cmpeq_epi8(_mm_loadu_si128(p + 2), pat),
+				      _mm_cmpeq_epi8(_mm_loadu_si128(p + 3), pat)));
+		if (_mm_movemask_epi8(m) != 0xFFFF)
+			break;
+		idx += step;
+	}
+	return idx;
+}
+#endif
+
+/*
+ * This is a common helper function for find_next_bit, find_next_zero_bit, and
+ * find_next_and_bit. The differences are:
+ *  - The "invert" argument, which is XORed with each fetched word before
+ *    searching it for one bits.
+ *  - The optional "addr2", which is anded with "addr1" if present.
+ */
+static unsigned long _find_next_bit(const unsigned long *addr1,
+		const unsigned long *addr2, unsigned long nbits,
+		unsigned long start, unsigned long invert)
+{
+	unsigned long tmp, idx, end;
+
+	if (start >= nbits)
+		return nbits;
+
+	idx = start / BITS_PER_LONG;
+	end = BITS_TO_LONGS(nbits);
+	tmp = addr1[idx];
+	if (addr2)
+		tmp &= addr2[idx];
+	tmp ^= invert;
+
+	/* Handle 1st word. */
+	tmp &= BITMAP_FIRST_WORD_MASK(start);
+
+	while (!tmp) {
+		if (++idx >= end)
+			return nbits;
+#ifdef BITMAP_USE_SIMD
+		if (!addr2) {
+			idx = simd_skip(addr1, idx, end, invert != 0);
+			if (idx >= end)
+				return nbits;
+		}
+#endif
+		tmp = addr1[idx];
+		if (addr2)
+			tmp &= addr2[idx];
+		tmp ^= invert;
+	}
+
+	start = idx * BITS_PER_LONG + __ffs(tmp);
+	return start < nbits ? start : nbits;
+}
+
+unsigned long find_next_bit(const unsigned long *addr, unsigned long size,
+			    unsigned long offset)
+{
+	return _find_next_bit(addr, NULL, size, offset, 0UL);
+}
+
+unsigned long find_next_zero_bit(const unsigned long *addr, unsigned long size,
+				 unsigned long offset)
+{
+	return _find_next_bit(addr, NULL, size, offset, ~0UL);
+}
+
+unsigned long find_next_and_bit(const unsigned long *addr1,
+		const unsigned long *addr2, unsigned long size,
+		unsigned long offset)
+{
+	return _find_next_bit(addr1, addr2, size, offset, 0UL);
+}
+
+unsigned long find_first_bit(const unsigned long *addr, unsigned long size)
+{
+	return _find_next_bit(addr, NULL, size, 0, 0UL);
+}
+
+unsigned long find_first_zero_bit(const unsigned long *addr, unsigned long size)
+{
+	return _find_next_bit(addr, NULL, size, 0, ~0UL);
+}
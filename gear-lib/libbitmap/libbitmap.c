@@ -21,6 +21,7 @@
  ******************************************************************************/
 #define _GNU_SOURCE
 #include <string.h>
+#include <stdio.h>
 #include "libbitmap.h"
 #include <stdbool.h>
 
@@ -1112,7 +1113,7 @@ unsigned long *bitmap_alloc(unsigned int nbits)
 
 unsigned long *bitmap_zalloc(unsigned int nbits)
 {
-	return calloc(nbits, 1);
+	return calloc(BITS_TO_LONGS(nbits), sizeof(unsigned long));
 }
 
 void bitmap_free(const unsigned long *bitmap)
@@ -1166,3 +1167,177 @@ void bitmap_to_arr32(uint32_t *buf, const unsigned long *bitmap, unsigned int nb
 }
 
 #endif
+
+int vscnprintf(char *buf, size_t size, const char *fmt, va_list args)
+{
+	int i = vsnprintf(buf, size, fmt, args);
+
+	if ((size_t)i < size)
+		return i;
+	return size ? (int)size - 1 : 0;
+}
+
+int scnprintf(char *buf, size_t size, const char *fmt, ...)
+{
+	va_list args;
+	int i;
+
+	va_start(args, fmt);
+	i = vscnprintf(buf, size, fmt, args);
+	va_end(args);
+	return i;
+}
+
+/*
+ * lock free id allocator, set bit with cas on the word, a hint word
+ * remembers where free ids were seen last so get doesn't rescan from 0
+ */
+struct idalloc *idalloc_create(unsigned int nbits)
+{
+	struct idalloc *ida;
+
+	if (nbits == 0) {
+		printf("%s: invalid nbits!\n", __func__);
+		return NULL;
+	}
+	ida = (struct idalloc *)calloc(1, sizeof(*ida));
+	if (!ida) {
+		printf("%s: malloc failed!\n", __func__);
+		return NULL;
+	}
+	ida->nbits = nbits;
+	ida->nwords = BITS_TO_LONGS(nbits);
+	ida->nsum = BITS_TO_LONGS(ida->nwords);
+	ida->map = bitmap_zalloc(nbits);
+	ida->full = bitmap_zalloc(ida->nwords);
+	if (!ida->map || !ida->full) {
+		printf("%s: malloc failed!\n", __func__);
+		bitmap_free(ida->map);
+		bitmap_free(ida->full);
+		free(ida);
+		return NULL;
+	}
+	/* tail bits beyond nbits look used, get never returns them */
+	if (nbits % BITS_PER_LONG)
+		ida->map[ida->nwords - 1] = ~BITMAP_LAST_WORD_MASK(nbits);
+	if (ida->nwords % BITS_PER_LONG)
+		ida->full[ida->nsum - 1] = ~BITMAP_LAST_WORD_MASK(ida->nwords);
+	return ida;
+}
+
+void idalloc_destroy(struct idalloc *ida)
+{
+	if (!ida)
+		return;
+	bitmap_free(ida->map);
+	bitmap_free(ida->full);
+	free(ida);
+}
+
+/*
+ * word i was seen full, mark it in summary. a put may free a bit before
+ * the mark lands, so reload the word after marking and undo if not full,
+ * put clears the mark after its own clear, one of them sees the other
+ */
+static void ida_mark_full(struct idalloc *ida, unsigned int i)
+{
+	unsigned long bit = BIT_MASK(i);
+
+	__atomic_fetch_or(&ida->full[BIT_WORD(i)], bit, __ATOMIC_SEQ_CST);
+	if (~__atomic_load_n(&ida->map[i], __ATOMIC_SEQ_CST))
+		__atomic_fetch_and(&ida->full[BIT_WORD(i)], ~bit, __ATOMIC_SEQ_CST);
+}
+
+/* take lowest free bit of word i, -1 if it is full */
+static int ida_take(struct idalloc *ida, unsigned int i)
+{
+	unsigned long w, bit, pos;
+
+	w = __atomic_load_n(&ida->map[i], __ATOMIC_RELAXED);
+	while (~w) {
+		pos = __ffs(~w);
+		bit = 1UL << pos;
+		if (__atomic_compare_exchange_n(&ida->map[i], &w, w | bit,
+				true, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+			if (!~(w | bit))
+				ida_mark_full(ida, i);
+			return (int)pos;
+		}
+		/* w reloaded by failed cas, retry same word */
+	}
+	ida_mark_full(ida, i);
+	return -1;
+}
+
+int idalloc_get(struct idalloc *ida)
+{
+	unsigned int n, s, i;
+	unsigned long sw;
+	int pos;
+
+	s = BIT_WORD(__atomic_load_n(&ida->hint, __ATOMIC_RELAXED));
+	for (n = 0; n < ida->nsum; n++, s++) {
+		if (s >= ida->nsum)
+			s = 0;
+		sw = __atomic_load_n(&ida->full[s], __ATOMIC_RELAXED);
+		while (~sw) {
+			i = s * BITS_PER_LONG + __ffs(~sw);
+			pos = ida_take(ida, i);
+			if (pos >= 0) {
+				if (i != __atomic_load_n(&ida->hint, __ATOMIC_RELAXED))
+					__atomic_store_n(&ida->hint, i, __ATOMIC_RELAXED);
+				return (int)(i * BITS_PER_LONG + pos);
+			}
+			/* word filled by others meanwhile, skip it */
+			sw |= BIT_MASK(i);
+		}
+	}
+	return -1;
+}
+
+int idalloc_get_at(struct idalloc *ida, unsigned int id)
+{
+	unsigned long old, bit = BIT_MASK(id);
+
+	if (id >= ida->nbits)
+		return -1;
+	old = __atomic_fetch_or(&ida->map[BIT_WORD(id)], bit, __ATOMIC_SEQ_CST);
+	if (old & bit)
+		return -1;
+	if (!~(old | bit))
+		ida_mark_full(ida, BIT_WORD(id));
+	return 0;
+}
+
+void idalloc_put(struct idalloc *ida, unsigned int id)
+{
+	unsigned long old, bit = BIT_MASK(id);
+	unsigned int i = BIT_WORD(id);
+
+	if (id >= ida->nbits) {
+		printf("%s: invalid id %u!\n", __func__, id);
+		return;
+	}
+	old = __atomic_fetch_and(&ida->map[i], ~bit, __ATOMIC_SEQ_CST);
+	if (!(old & bit)) {
+		printf("%s: id %u is not allocated!\n", __func__, id);
+		return;
+	}
+	if (__atomic_load_n(&ida->full[BIT_WORD(i)], __ATOMIC_SEQ_CST) & BIT_MASK(i))
+		__atomic_fetch_and(&ida->full[BIT_WORD(i)], ~BIT_MASK(i), __ATOMIC_SEQ_CST);
+	if (i < __atomic_load_n(&ida->hint, __ATOMIC_RELAXED))
+		__atomic_store_n(&ida->hint, i, __ATOMIC_RELAXED);
+}
+
+bool idalloc_test(struct idalloc *ida, unsigned int id)
+{
+	if (id >= ida->nbits)
+		return false;
+	return (__atomic_load_n(&ida->map[BIT_WORD(id)], __ATOMIC_RELAXED) &
+		BIT_MASK(id)) != 0;
+}
+
+unsigned int idalloc_count(struct idalloc *ida)
+{
+	return __bitmap_weight(ida->map, ida->nbits);
+}
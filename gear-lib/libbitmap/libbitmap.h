@@ -497,6 +497,32 @@ static inline void bitmap_from_u64(unsigned long *dst, uint64_t mask)
 }
 
 
+/*
+ * lock free id allocator, ids are bits in a bitmap, get/put from any
+ * thread without lock, get returns lowest free id near the last hint.
+ * two levels: bit i of full is set while map word i has no free id, so
+ * get skips BITS_PER_LONG full words per summary word
+ */
+struct idalloc {
+	unsigned int nbits;
+	unsigned int nwords;
+	unsigned int nsum;
+	unsigned int hint;
+	unsigned long *map;
+	unsigned long *full;
+};
+
+struct idalloc *idalloc_create(unsigned int nbits);
+void idalloc_destroy(struct idalloc *ida);
+/* return id, or -1 if all ids are used */
+int idalloc_get(struct idalloc *ida);
+/* reserve given id, -1 if already used */
+int idalloc_get_at(struct idalloc *ida, unsigned int id);
+void idalloc_put(struct idalloc *ida, unsigned int id);
+bool idalloc_test(struct idalloc *ida, unsigned int id);
+unsigned int idalloc_count(struct idalloc *ida);
+
+
 #ifdef __cplusplus
 }
 #endif
@@ -22,8 +22,163 @@
 #include "libbitmap.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#define FIND_BITS   (1 << 20)
+
+static uint64_t now_us(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static int foo_find(void)
+{
+    int err = 0;
+    unsigned long bit, n = 0;
+    uint64_t t;
+    unsigned long *map = bitmap_zalloc(FIND_BITS);
+    unsigned long *mask = bitmap_zalloc(FIND_BITS);
+
+    /* sparse bitmap, one bit every 10000 */
+    for (bit = 7; bit < FIND_BITS; bit += 10000) {
+        set_bit(bit, map);
+    }
+    t = now_us();
+    for_each_set_bit(bit, map, FIND_BITS) {
+        if (bit % 10000 != 7) {
+            err++;
+        }
+        n++;
+    }
+    printf("find set bit: %lu bits in %lu us\n", n, (unsigned long)(now_us() - t));
+    if (n != (FIND_BITS - 7 + 9999) / 10000 ||
+        (unsigned long)bitmap_weight(map, FIND_BITS) != n) {
+        err++;
+    }
+    bitmap_fill(map, FIND_BITS);
+    clear_bit(FIND_BITS - 3, map);
+    if (find_first_zero_bit(map, FIND_BITS) != FIND_BITS - 3 ||
+        find_next_zero_bit(map, FIND_BITS, FIND_BITS - 2) != FIND_BITS) {
+        err++;
+    }
+    set_bit(100000, mask);
+    set_bit(FIND_BITS - 3, mask);
+    if (find_next_and_bit(map, mask, FIND_BITS, 0) != 100000 ||
+        find_next_and_bit(map, mask, FIND_BITS, 100001) != FIND_BITS) {
+        err++;
+    }
+    printf("find: %d error\n", err);
+    bitmap_free(map);
+    bitmap_free(mask);
+    return err;
+}
+
+#define IDA_BITS    5000
+#define IDA_THREADS 4
+#define IDA_LOOPS   100000
+/* small allocator, threads together want more ids than it has */
+#define IDA_SMALL   130
+#define IDA_BURST   48
+
+static void *ida_worker(void *arg)
+{
+    int i, j, id[8];
+    struct idalloc *ida = (struct idalloc *)arg;
+    for (i = 0; i < IDA_LOOPS; i++) {
+        for (j = 0; j < 8; j++) {
+            id[j] = idalloc_get(ida);
+        }
+        for (j = 0; j < 8; j++) {
+            if (id[j] >= 0) {
+                idalloc_put(ida, id[j]);
+            }
+        }
+    }
+    return NULL;
+}
+
+static void *ida_full_worker(void *arg)
+{
+    int i, j, id[IDA_BURST];
+    struct idalloc *ida = (struct idalloc *)arg;
+    for (i = 0; i < IDA_LOOPS / 10; i++) {
+        for (j = 0; j < IDA_BURST; j++) {
+            id[j] = idalloc_get(ida);
+        }
+        for (j = 0; j < IDA_BURST; j++) {
+            if (id[j] >= 0) {
+                idalloc_put(ida, id[j]);
+            }
+        }
+    }
+    return NULL;
+}
+
+static int foo_idalloc(void)
+{
+    int i, id, err = 0;
+    pthread_t tid[IDA_THREADS];
+    struct idalloc *ida = idalloc_create(IDA_BITS);
+
+    for (i = 0; i < IDA_BITS; i++) {
+        if (idalloc_get(ida) != i) {
+            err++;
+        }
+    }
+    if (idalloc_get(ida) != -1 || idalloc_count(ida) != IDA_BITS) {
+        err++;
+    }
+    idalloc_put(ida, 500);
+    if (idalloc_test(ida, 500) || idalloc_get(ida) != 500) {
+        err++;
+    }
+    for (i = 0; i < IDA_BITS; i++) {
+        idalloc_put(ida, i);
+    }
+    if (idalloc_get_at(ida, 42) != 0 || idalloc_get_at(ida, 42) != -1) {
+        err++;
+    }
+    idalloc_put(ida, 42);
+
+    for (i = 0; i < IDA_THREADS; i++) {
+        pthread_create(&tid[i], NULL, ida_worker, ida);
+    }
+    for (i = 0; i < IDA_THREADS; i++) {
+        pthread_join(tid[i], NULL);
+    }
+    if (idalloc_count(ida) != 0) {
+        err++;
+    }
+    idalloc_destroy(ida);
+
+    /* summary must not keep a word marked full after it got a free id */
+    ida = idalloc_create(IDA_SMALL);
+    for (i = 0; i < IDA_THREADS; i++) {
+        pthread_create(&tid[i], NULL, ida_full_worker, ida);
+    }
+    for (i = 0; i < IDA_THREADS; i++) {
+        pthread_join(tid[i], NULL);
+    }
+    for (i = 0; i < IDA_SMALL; i++) {
+        if (idalloc_get(ida) < 0) {
+            err++;
+        }
+    }
+    for (i = 0; i < IDA_SMALL; i++) {
+        idalloc_put(ida, i);
+    }
+    id = idalloc_get(ida);
+    printf("idalloc: %d threads, first id %d, %d error\n", IDA_THREADS, id, err);
+    idalloc_destroy(ida);
+    return err;
+}
 
 int main(int argc, char **argv)
 {
+    foo_find();
+    foo_idalloc();
     return 0;
 }
@@ -162,6 +162,222 @@ void fifo_peek(fifo_t *ptr, void *data)
     memcpy(data, ptr->data + (ptr->tail_ptr * ptr->data_len), ptr->data_len);
 }
 
+/////////////
+// lf_lifo //
+/////////////
+
+/* head packs node index in low 32 bits and ABA tag in high 32 bits */
+#define LF_NIL          0xffffffffu
+#define LF_IDX(h)       ((uint32_t)(h))
+#define LF_HEAD(idx, h) (((uint64_t)((uint32_t)((h) >> 32) + 1) << 32) | (idx))
+
+typedef struct lf_node
+{
+    uint32_t next;
+    char data[];
+}
+lf_node_t;
+
+static lf_node_t *lf_lifo_node(lf_lifo_t *ptr, uint32_t idx)
+{
+    return (lf_node_t *) (ptr->data + idx * ptr->node_len);
+}
+
+static void lf_stack_push(lf_lifo_t *ptr, uint64_t *head, uint32_t idx)
+{
+    lf_node_t *node = lf_lifo_node(ptr, idx);
+    uint64_t old = __atomic_load_n(head, __ATOMIC_RELAXED);
+
+    do {
+        __atomic_store_n(&node->next, LF_IDX(old), __ATOMIC_RELAXED);
+    } while (!__atomic_compare_exchange_n(head, &old, LF_HEAD(idx, old),
+                true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+static uint32_t lf_stack_pop(lf_lifo_t *ptr, uint64_t *head)
+{
+    uint32_t next;
+    uint64_t old = __atomic_load_n(head, __ATOMIC_ACQUIRE);
+
+    do {
+        if (LF_IDX(old) == LF_NIL) {
+            return LF_NIL;
+        }
+        /* node may be reused meanwhile, tag makes the cas fail then */
+        next = __atomic_load_n(&lf_lifo_node(ptr, LF_IDX(old))->next, __ATOMIC_RELAXED);
+    } while (!__atomic_compare_exchange_n(head, &old, LF_HEAD(next, old),
+                true, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE));
+    return LF_IDX(old);
+}
+
+int lf_lifo_alloc(lf_lifo_t *ptr, size_t size, size_t data_len)
+{
+    size_t i;
+
+    if (!size || size >= LF_NIL) {
+        return -1;
+    }
+    ptr->len = 0;
+    ptr->size = size;
+    ptr->data_len = data_len;
+    ptr->node_len = (sizeof(lf_node_t) + data_len + 7) & ~(size_t) 7;
+    ptr->data = (char *) malloc(size * ptr->node_len);
+    if (!ptr->data) {
+        return -1;
+    }
+    for (i = 0; i < size; i++) {
+        lf_lifo_node(ptr, i)->next = (i + 1 < size) ? i + 1 : LF_NIL;
+    }
+    ptr->free_head = 0;
+    ptr->used_head = LF_NIL;
+    return 0;
+}
+
+void lf_lifo_free(lf_lifo_t *ptr)
+{
+    if (ptr->data) {
+        free(ptr->data);
+        ptr->data = NULL;
+    }
+}
+
+size_t lf_lifo_size(lf_lifo_t *ptr)
+{
+    return __atomic_load_n(&ptr->len, __ATOMIC_RELAXED);
+}
+
+bool lf_lifo_enqueue(lf_lifo_t *ptr, void *data)
+{
+    uint32_t idx = lf_stack_pop(ptr, &ptr->free_head);
+
+    if (idx == LF_NIL) {
+        return false;
+    }
+    memcpy(lf_lifo_node(ptr, idx)->data, data, ptr->data_len);
+    /* count before publish, so concurrent dequeue never underflows len */
+    __atomic_add_fetch(&ptr->len, 1, __ATOMIC_RELAXED);
+    lf_stack_push(ptr, &ptr->used_head, idx);
+    return true;
+}
+
+bool lf_lifo_dequeue(lf_lifo_t *ptr, void *data)
+{
+    uint32_t idx = lf_stack_pop(ptr, &ptr->used_head);
+
+    if (idx == LF_NIL) {
+        return false;
+    }
+    if (data) {
+        memcpy(data, lf_lifo_node(ptr, idx)->data, ptr->data_len);
+    }
+    __atomic_sub_fetch(&ptr->len, 1, __ATOMIC_RELAXED);
+    lf_stack_push(ptr, &ptr->free_head, idx);
+    return true;
+}
+
+/////////////
+// lf_fifo //
+/////////////
+
+static size_t *lf_fifo_seq(lf_fifo_t *ptr, size_t pos)
+{
+    return (size_t *) (ptr->data + (pos & ptr->mask) * ptr->cell_len);
+}
+
+int lf_fifo_alloc(lf_fifo_t *ptr, size_t size, size_t data_len)
+{
+    size_t i, n = 2;
+
+    while (n < size) {
+        n <<= 1;
+    }
+    ptr->enqueue_pos = 0;
+    ptr->dequeue_pos = 0;
+    ptr->mask = n - 1;
+    ptr->data_len = data_len;
+    ptr->cell_len = (sizeof(size_t) + data_len + 7) & ~(size_t) 7;
+    ptr->data = (char *) malloc(n * ptr->cell_len);
+    if (!ptr->data) {
+        return -1;
+    }
+    for (i = 0; i < n; i++) {
+        *lf_fifo_seq(ptr, i) = i;
+    }
+    return 0;
+}
+
+void lf_fifo_free(lf_fifo_t *ptr)
+{
+    if (ptr->data) {
+        free(ptr->data);
+        ptr->data = NULL;
+    }
+}
+
+size_t lf_fifo_size(lf_fifo_t *ptr)
+{
+    size_t tail = __atomic_load_n(&ptr->dequeue_pos, __ATOMIC_RELAXED);
+    size_t head = __atomic_load_n(&ptr->enqueue_pos, __ATOMIC_RELAXED);
+
+    return ((intptr_t) (head - tail) > 0) ? head - tail : 0;
+}
+
+/*
+ * cell seq == pos means free for producer at pos,
+ * seq == pos + 1 means filled for consumer at pos
+ */
+bool lf_fifo_enqueue(lf_fifo_t *ptr, void *data)
+{
+    size_t *seq;
+    intptr_t diff;
+    size_t pos = __atomic_load_n(&ptr->enqueue_pos, __ATOMIC_RELAXED);
+
+    for (;;) {
+        seq = lf_fifo_seq(ptr, pos);
+        diff = (intptr_t) __atomic_load_n(seq, __ATOMIC_ACQUIRE) - (intptr_t) pos;
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&ptr->enqueue_pos, &pos, pos + 1,
+                        true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = __atomic_load_n(&ptr->enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+    memcpy(seq + 1, data, ptr->data_len);
+    __atomic_store_n(seq, pos + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+bool lf_fifo_dequeue(lf_fifo_t *ptr, void *data)
+{
+    size_t *seq;
+    intptr_t diff;
+    size_t pos = __atomic_load_n(&ptr->dequeue_pos, __ATOMIC_RELAXED);
+
+    for (;;) {
+        seq = lf_fifo_seq(ptr, pos);
+        diff = (intptr_t) __atomic_load_n(seq, __ATOMIC_ACQUIRE) - (intptr_t) (pos + 1);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&ptr->dequeue_pos, &pos, pos + 1,
+                        true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = __atomic_load_n(&ptr->dequeue_pos, __ATOMIC_RELAXED);
+        }
+    }
+    if (data) {
+        memcpy(data, seq + 1, ptr->data_len);
+    }
+    __atomic_store_n(seq, pos + ptr->mask + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
 //////////
 // list //
 //////////
@@ -12,6 +12,7 @@
 #define __COLLECTIONS_H__
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #define LIBCOLLECTIONS_VERSION "0.0.1"
 
@@ -63,6 +64,58 @@ void fifo_dequeue(fifo_t *ptr, void *data);
 void fifo_poke(fifo_t *ptr, void *data);
 void fifo_peek(fifo_t *ptr, void *data);
 
+/////////////
+// lf_lifo //
+/////////////
+
+/*
+ * lock free bounded lifo, safe for multiple producers and consumers.
+ * treiber stack over a preallocated node pool, head carries a tag
+ * against ABA. enqueue/dequeue return false when full/empty.
+ */
+typedef struct lf_lifo
+{
+    uint64_t used_head;
+    uint64_t free_head;
+    size_t len, size, data_len, node_len;
+    char *data;
+}
+lf_lifo_t;
+
+int lf_lifo_alloc(lf_lifo_t *ptr, size_t size, size_t data_len);
+void lf_lifo_free(lf_lifo_t *ptr);
+size_t lf_lifo_size(lf_lifo_t *ptr);
+bool lf_lifo_enqueue(lf_lifo_t *ptr, void *data);
+bool lf_lifo_dequeue(lf_lifo_t *ptr, void *data);
+
+/////////////
+// lf_fifo //
+/////////////
+
+/*
+ * lock free bounded fifo, safe for multiple producers and consumers.
+ * ring of cells with sequence number, size rounds up to power of 2.
+ * enqueue/dequeue return false when full/empty.
+ */
+#define LF_CACHELINE 64
+
+typedef struct lf_fifo
+{
+    size_t enqueue_pos;
+    char pad0[LF_CACHELINE - sizeof(size_t)];
+    size_t dequeue_pos;
+    char pad1[LF_CACHELINE - sizeof(size_t)];
+    size_t mask, data_len, cell_len;
+    char *data;
+}
+lf_fifo_t;
+
+int lf_fifo_alloc(lf_fifo_t *ptr, size_t size, size_t data_len);
+void lf_fifo_free(lf_fifo_t *ptr);
+size_t lf_fifo_size(lf_fifo_t *ptr);
+bool lf_fifo_enqueue(lf_fifo_t *ptr, void *data);
+bool lf_fifo_dequeue(lf_fifo_t *ptr, void *data);
+
 //////////
 // list //
 //////////
@@ -22,6 +22,7 @@
 #include "libcollections.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <pthread.h>
 
 void test_lifo()
 {
@@ -117,11 +118,68 @@ void test_iterator()
     printf("this list size:%d\n", (int)list_size(&tmp));
 }
 
+#define LF_PRODUCERS    2
+#define LF_PER_PRODUCER 100000
+
+static lf_fifo_t lf_q;
+static lf_lifo_t lf_s;
+static int lf_use_fifo;
+static uint64_t lf_sum;
+
+static void *lf_producer(void *arg)
+{
+    uint64_t v;
+    for (v = 1; v <= LF_PER_PRODUCER; v++) {
+        while (!(lf_use_fifo ? lf_fifo_enqueue(&lf_q, &v) : lf_lifo_enqueue(&lf_s, &v)));
+    }
+    return NULL;
+}
+
+static void *lf_consumer(void *arg)
+{
+    uint64_t v, sum = 0;
+    size_t i;
+    for (i = 0; i < LF_PER_PRODUCER; i++) {
+        while (!(lf_use_fifo ? lf_fifo_dequeue(&lf_q, &v) : lf_lifo_dequeue(&lf_s, &v)));
+        sum += v;
+    }
+    __atomic_add_fetch(&lf_sum, sum, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+void test_lockfree()
+{
+    int i, round;
+    pthread_t tid[LF_PRODUCERS * 2];
+    uint64_t expect = (uint64_t)LF_PRODUCERS * LF_PER_PRODUCER * (LF_PER_PRODUCER + 1) / 2;
+
+    printf("------------------test lockfree------------------\n");
+    lf_fifo_alloc(&lf_q, 1000, sizeof(uint64_t));
+    lf_lifo_alloc(&lf_s, 1000, sizeof(uint64_t));
+    for (round = 0; round < 2; round++) {
+        lf_use_fifo = round;
+        lf_sum = 0;
+        for (i = 0; i < LF_PRODUCERS; i++) {
+            pthread_create(&tid[i], NULL, lf_producer, NULL);
+            pthread_create(&tid[LF_PRODUCERS + i], NULL, lf_consumer, NULL);
+        }
+        for (i = 0; i < LF_PRODUCERS * 2; i++) {
+            pthread_join(tid[i], NULL);
+        }
+        printf("lf_%s mpmc sum %s, size %d\n", round ? "fifo" : "lifo",
+               lf_sum == expect ? "ok" : "failed",
+               (int)(round ? lf_fifo_size(&lf_q) : lf_lifo_size(&lf_s)));
+    }
+    lf_fifo_free(&lf_q);
+    lf_lifo_free(&lf_s);
+}
+
 int main(int argc, char **argv)
 {
     test_lifo();
     test_fifo();
     test_list();
     test_iterator();
+    test_lockfree();
     return 0;
 }
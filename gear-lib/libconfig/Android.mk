@@ -14,6 +14,6 @@ LOCAL_C_INCLUDES := $(LOCAL_PATH)
 
 # Add your application source files here...
 INI_SRC_FILES	:= ini/iniparser.c ini/dictionary.c ini/ini_config.c
-LOCAL_SRC_FILES := libconfig.c $(INI_SRC_FILES)
+LOCAL_SRC_FILES := libconfig.c snapshot.c $(INI_SRC_FILES)
 
 include $(BUILD_SHARED_LIBRARY)
@@ -258,6 +258,19 @@ static int ini_save(struct config *c)
     return 0;
 }
 
+static int ini_walk(struct config *c, conf_walk_cb cb, void *arg)
+{
+    int i;
+    dictionary *ini = (dictionary *)c->priv;
+    for (i = 0; i < ini->size; i++) {
+        /* section entries have no value */
+        if (ini->key[i] && ini->val[i]) {
+            cb(ini->key[i], ini->val[i], CONF_STRING, arg);
+        }
+    }
+    return 0;
+}
+
 struct config_ops ini_ops = {
     ini_load,
     ini_unload,
@@ -277,4 +290,5 @@ struct config_ops ini_ops = {
     ini_set_boolean,
 
     ini_del,
+    ini_walk,
 };
@@ -221,6 +221,12 @@ CJSON_PUBLIC(void) cJSON_Delete(cJSON *item)
         {
             cJSON_Delete(item->child);
         }
+        if (item->type & cJSON_InArena)
+        {
+            /* memory belongs to arena, children may not */
+            item = next;
+            continue;
+        }
         if (!(item->type & cJSON_IsReference) && (item->valuestring != NULL))
         {
             global_hooks.deallocate(item->valuestring);
@@ -252,8 +258,116 @@ typedef struct
     size_t offset;
     size_t depth; /* How deeply nested (in arrays/objects) is the input at the current offset. */
     internal_hooks hooks;
+    cJSON_Arena *arena; /* not NULL when parsing in situ */
 } parse_buffer;
 
+#define CJSON_ARENA_ALIGN (sizeof(void*) > sizeof(double) ? sizeof(void*) : sizeof(double))
+#define CJSON_ARENA_MIN_CHUNK 4096
+
+typedef struct cJSON_ArenaChunk
+{
+    struct cJSON_ArenaChunk *next;
+    size_t size;
+    size_t offset;
+} cJSON_ArenaChunk;
+
+struct cJSON_Arena
+{
+    cJSON_ArenaChunk *head;
+    size_t chunk_size;
+    size_t used;
+};
+
+#define CJSON_ARENA_HEADER ((sizeof(cJSON_ArenaChunk) + CJSON_ARENA_ALIGN - 1) & ~(CJSON_ARENA_ALIGN - 1))
+#define arena_chunk_data(chunk) ((unsigned char*)(chunk) + CJSON_ARENA_HEADER)
+
+CJSON_PUBLIC(cJSON_Arena *) cJSON_ArenaCreate(size_t chunk_size)
+{
+    cJSON_Arena *arena = (cJSON_Arena*)global_hooks.allocate(sizeof(cJSON_Arena));
+    if (arena == NULL)
+    {
+        return NULL;
+    }
+    arena->head = NULL;
+    arena->chunk_size = (chunk_size < CJSON_ARENA_MIN_CHUNK) ? CJSON_ARENA_MIN_CHUNK : chunk_size;
+    arena->used = 0;
+
+    return arena;
+}
+
+CJSON_PUBLIC(void) cJSON_ArenaDestroy(cJSON_Arena *arena)
+{
+    cJSON_ArenaChunk *chunk = NULL;
+    if (arena == NULL)
+    {
+        return;
+    }
+    while (arena->head != NULL)
+    {
+        chunk = arena->head;
+        arena->head = chunk->next;
+        global_hooks.deallocate(chunk);
+    }
+    global_hooks.deallocate(arena);
+}
+
+CJSON_PUBLIC(size_t) cJSON_ArenaUsed(const cJSON_Arena *arena)
+{
+    return (arena != NULL) ? arena->used : 0;
+}
+
+static void *arena_allocate(cJSON_Arena * const arena, size_t size)
+{
+    cJSON_ArenaChunk *chunk = arena->head;
+    size_t chunk_size = 0;
+    unsigned char *pointer = NULL;
+
+    size = (size + CJSON_ARENA_ALIGN - 1) & ~(CJSON_ARENA_ALIGN - 1);
+    if ((chunk == NULL) || ((chunk->size - chunk->offset) < size))
+    {
+        chunk_size = (size > arena->chunk_size) ? size : arena->chunk_size;
+        chunk = (cJSON_ArenaChunk*)global_hooks.allocate(CJSON_ARENA_HEADER + chunk_size);
+        if (chunk == NULL)
+        {
+            return NULL;
+        }
+        chunk->size = chunk_size;
+        chunk->offset = 0;
+        chunk->next = arena->head;
+        arena->head = chunk;
+    }
+    pointer = arena_chunk_data(chunk) + chunk->offset;
+    chunk->offset += size;
+    arena->used += size;
+
+    return pointer;
+}
+
+static cJSON *parse_new_item(parse_buffer * const input_buffer)
+{
+    cJSON *node = NULL;
+    if (input_buffer->arena == NULL)
+    {
+        return cJSON_New_Item(&(input_buffer->hooks));
+    }
+    node = (cJSON*)arena_allocate(input_buffer->arena, sizeof(cJSON));
+    if (node)
+    {
+        memset(node, '\0', sizeof(cJSON));
+    }
+
+    return node;
+}
+
+/* arena items can not be freed one by one, the arena is dropped as a whole */
+static void parse_delete(parse_buffer * const input_buffer, cJSON *item)
+{
+    if (input_buffer->arena == NULL)
+    {
+        cJSON_Delete(item);
+    }
+}
+
 /* check if the given size is left to read in a given parse buffer (starting with 1) */
 #define can_read(buffer, size) ((buffer != NULL) && (((buffer)->offset + size) <= (buffer)->length))
 /* check if the buffer can be accessed at the given index (starting with 0) */
@@ -734,7 +848,15 @@ static cJSON_bool parse_string(cJSON * const item, parse_buffer * const input_bu
 
         /* This is at most how much we need for the output */
         allocation_length = (size_t) (input_end - buffer_at_offset(input_buffer)) - skipped_bytes;
-        output = (unsigned char*)input_buffer->hooks.allocate(allocation_length + sizeof(""));
+        if (input_buffer->arena != NULL)
+        {
+            /* unescaped output is never longer than input, decode over it and terminate at the closing quote */
+            output = (unsigned char*)input_pointer;
+        }
+        else
+        {
+            output = (unsigned char*)input_buffer->hooks.allocate(allocation_length + sizeof(""));
+        }
         if (output == NULL)
         {
             goto fail; /* allocation failure */
@@ -742,6 +864,12 @@ static cJSON_bool parse_string(cJSON * const item, parse_buffer * const input_bu
     }
 
     output_pointer = output;
+    if ((output == input_pointer) && (memchr(input_pointer, '\\', (size_t)(input_end - input_pointer)) == NULL))
+    {
+        /* in situ without escape, the text is already the value */
+        output_pointer = (unsigned char*)input_end;
+        input_pointer = input_end;
+    }
     /* loop through the string literal */
     while (input_pointer < input_end)
     {
@@ -810,7 +938,7 @@ static cJSON_bool parse_string(cJSON * const item, parse_buffer * const input_bu
     return true;
 
 fail:
-    if (output != NULL)
+    if ((output != NULL) && (input_buffer->arena == NULL))
     {
         input_buffer->hooks.deallocate(output);
     }
@@ -999,7 +1127,7 @@ static parse_buffer *skip_utf8_bom(parse_buffer * const buffer)
 /* Parse an object - create a new root, and populate. */
 CJSON_PUBLIC(cJSON *) cJSON_ParseWithOpts(const char *value, const char **return_parse_end, cJSON_bool require_null_terminated)
 {
-    parse_buffer buffer = { 0, 0, 0, 0, { 0, 0, 0 } };
+    parse_buffer buffer = { 0, 0, 0, 0, { 0, 0, 0 }, 0 };
     cJSON *item = NULL;
 
     /* reset error position */
@@ -1076,6 +1204,54 @@ fail:
     return NULL;
 }
 
+static void arena_mark(cJSON *item)
+{
+    while (item != NULL)
+    {
+        item->type |= cJSON_InArena;
+        arena_mark(item->child);
+        item = item->next;
+    }
+}
+
+CJSON_PUBLIC(cJSON *) cJSON_ParseInSitu(char *value, cJSON_Arena *arena)
+{
+    parse_buffer buffer = { 0, 0, 0, 0, { 0, 0, 0 }, 0 };
+    cJSON *item = NULL;
+
+    /* reset error position */
+    global_error.json = NULL;
+    global_error.position = 0;
+
+    if ((value == NULL) || (arena == NULL))
+    {
+        return NULL;
+    }
+
+    buffer.content = (const unsigned char*)value;
+    buffer.length = strlen((const char*)value) + sizeof("");
+    buffer.offset = 0;
+    buffer.hooks = global_hooks;
+    buffer.arena = arena;
+
+    item = parse_new_item(&buffer);
+    if (item == NULL) /* memory fail */
+    {
+        return NULL;
+    }
+
+    if (!parse_value(item, buffer_skip_whitespace(skip_utf8_bom(&buffer))))
+    {
+        /* parse failure, items stay in arena until it is destroyed */
+        global_error.json = (const unsigned char*)value;
+        global_error.position = (buffer.offset < buffer.length) ? buffer.offset : buffer.length - 1;
+        return NULL;
+    }
+    arena_mark(item);
+
+    return item;
+}
+
 /* Default options for cJSON_Parse */
 CJSON_PUBLIC(cJSON *) cJSON_Parse(const char *value)
 {
@@ -1376,7 +1552,7 @@ static cJSON_bool parse_array(cJSON * const item, parse_buffer * const input_buf
     do
     {
         /* allocate next item */
-        cJSON *new_item = cJSON_New_Item(&(input_buffer->hooks));
+        cJSON *new_item = parse_new_item(input_buffer);
         if (new_item == NULL)
         {
             goto fail; /* allocation failure */
@@ -1425,7 +1601,7 @@ success:
 fail:
     if (head != NULL)
     {
-        cJSON_Delete(head);
+        parse_delete(input_buffer, head);
     }
 
     return false;
@@ -1530,7 +1706,7 @@ static cJSON_bool parse_object(cJSON * const item, parse_buffer * const input_bu
     do
     {
         /* allocate next item */
-        cJSON *new_item = cJSON_New_Item(&(input_buffer->hooks));
+        cJSON *new_item = parse_new_item(input_buffer);
         if (new_item == NULL)
         {
             goto fail; /* allocation failure */
@@ -1596,7 +1772,7 @@ success:
 fail:
     if (head != NULL)
     {
-        cJSON_Delete(head);
+        parse_delete(input_buffer, head);
     }
 
     return false;
@@ -1922,7 +2098,7 @@ static cJSON_bool add_item_to_object(cJSON * const object, const char * const st
         new_type = item->type & ~cJSON_StringIsConst;
     }
 
-    if (!(item->type & cJSON_StringIsConst) && (item->string != NULL))
+    if (!(item->type & (cJSON_StringIsConst | cJSON_InArena)) && (item->string != NULL))
     {
         hooks->deallocate(item->string);
     }
@@ -2570,7 +2746,7 @@ CJSON_PUBLIC(cJSON *) cJSON_Duplicate(const cJSON *item, cJSON_bool recurse)
         goto fail;
     }
     /* Copy over all vars */
-    newitem->type = item->type & (~cJSON_IsReference);
+    newitem->type = item->type & (~(cJSON_IsReference | cJSON_InArena));
     newitem->valueint = item->valueint;
     newitem->valuedouble = item->valuedouble;
     if (item->valuestring)
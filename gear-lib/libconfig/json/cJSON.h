@@ -99,6 +99,7 @@ then using the CJSON_API_VISIBILITY flag to "export" the same symbols the way CJ
 
 #define cJSON_IsReference 256
 #define cJSON_StringIsConst 512
+#define cJSON_InArena 1024 /* item and its strings are owned by a cJSON_Arena */
 
 /* The cJSON structure: */
 typedef struct cJSON
@@ -151,6 +152,16 @@ CJSON_PUBLIC(cJSON *) cJSON_Parse(const char *value);
 /* If you supply a ptr in return_parse_end and parsing fails, then return_parse_end will contain a pointer to the error so will match cJSON_GetErrorPtr(). */
 CJSON_PUBLIC(cJSON *) cJSON_ParseWithOpts(const char *value, const char **return_parse_end, cJSON_bool require_null_terminated);
 
+/* Arena: bump allocator for parsed items, released all at once with cJSON_ArenaDestroy. */
+typedef struct cJSON_Arena cJSON_Arena;
+CJSON_PUBLIC(cJSON_Arena *) cJSON_ArenaCreate(size_t chunk_size);
+CJSON_PUBLIC(void) cJSON_ArenaDestroy(cJSON_Arena *arena);
+CJSON_PUBLIC(size_t) cJSON_ArenaUsed(const cJSON_Arena *arena);
+/* Parse a null terminated, writable buffer in place: strings are unescaped inside value and items come from arena,
+ * so nothing is copied or malloc'ed. value and arena must outlive the returned tree.
+ * Items added later are heap allocated as usual, call cJSON_Delete first, then cJSON_ArenaDestroy. */
+CJSON_PUBLIC(cJSON *) cJSON_ParseInSitu(char *value, cJSON_Arena *arena);
+
 /* Render a cJSON entity to text for transfer/storage. */
 CJSON_PUBLIC(char *) cJSON_Print(const cJSON *item);
 /* Render a cJSON entity to text for transfer/storage without any formatting. */
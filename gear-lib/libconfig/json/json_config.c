@@ -26,6 +26,18 @@
 #include <stdarg.h>
 #include <string.h>
 
+/*
+ * file buffer is parsed in place, strings of the tree point into it and
+ * items come from arena, so load does no malloc per node
+ */
+struct js_ctx {
+    cJSON *root;
+    cJSON_Arena *arena;
+    char *buf;
+};
+
+#define js_root(c) (((struct js_ctx *)(c)->priv)->root)
+
 static int read_file(const char *name, void **buf, size_t *len)
 {
     FILE *fp = NULL;
@@ -96,7 +108,7 @@ cleanup:
 
 static int js_load(struct config *c, const char *name)
 {
-    cJSON *json;
+    struct js_ctx *ctx;
     size_t len;
     void *buf = NULL;
     read_file(name, &buf, &len);
@@ -104,30 +116,50 @@ static int js_load(struct config *c, const char *name)
         printf("read_file %s failed!\n", name);
         return -1;
     }
-    json = cJSON_Parse((char *)buf);
-    if (!json) {
+    ctx = (struct js_ctx *)calloc(1, sizeof(struct js_ctx));
+    if (!ctx) {
+        printf("malloc js_ctx failed!\n");
+        free(buf);
+        return -1;
+    }
+    /* one cJSON item per few bytes of text at most */
+    ctx->arena = cJSON_ArenaCreate(len * 2);
+    if (!ctx->arena) {
+        printf("cJSON_ArenaCreate failed!\n");
+        free(buf);
+        free(ctx);
+        return -1;
+    }
+    ctx->buf = (char *)buf;
+    ctx->root = cJSON_ParseInSitu(ctx->buf, ctx->arena);
+    if (!ctx->root) {
         printf("cJSON_Parse failed!\n");
+        cJSON_ArenaDestroy(ctx->arena);
         free(buf);
+        free(ctx);
         return -1;
     }
-    free(buf);
-    c->priv = (void *)json;
+    c->priv = (void *)ctx;
     strncpy(c->path, name, sizeof(c->path));
     return 0;
 }
 
 static void js_unload(struct config *c)
 {
-    cJSON *json = (cJSON *)c->priv;
-    if (json) {
-        cJSON_Delete(json);
-        json = NULL;
+    struct js_ctx *ctx = (struct js_ctx *)c->priv;
+    if (ctx) {
+        /* items added by set are on heap, free them before arena */
+        cJSON_Delete(ctx->root);
+        cJSON_ArenaDestroy(ctx->arena);
+        free(ctx->buf);
+        free(ctx);
+        c->priv = NULL;
     }
 }
 
 static void js_dump(struct config *c, FILE *f)
 {
-    cJSON *json = (cJSON *)c->priv;
+    cJSON *json = js_root(c);
     char *tmp = cJSON_Print(json);
     if (tmp) {
         printf("%s\n", tmp);
@@ -137,7 +169,7 @@ static void js_dump(struct config *c, FILE *f)
 
 static int js_save(struct config *c)
 {
-    cJSON *json = (cJSON *)c->priv;
+    cJSON *json = js_root(c);
     char *tmp = cJSON_Print(json);
     if (tmp) {
         write_file(c->path, tmp, strlen(tmp));
@@ -148,7 +180,7 @@ static int js_save(struct config *c)
 
 static int js_set_string(struct config *c, ...)
 {
-    cJSON *json = (cJSON *)c->priv;
+    cJSON *json = js_root(c);
     struct int_charp *type_list = NULL;
     struct int_charp mix;
     int cnt = 0;
@@ -185,7 +217,7 @@ static int js_set_string(struct config *c, ...)
 
 static char *js_get_string(struct config *c, ...)
 {
-    cJSON *json = (cJSON *)c->priv;
+    cJSON *json = js_root(c);
     struct int_charp *type_list = NULL;
     struct int_charp mix;
     int cnt = 0;
@@ -220,7 +252,7 @@ static char *js_get_string(struct config *c, ...)
 
 static int js_get_int(struct config *c, ...)
 {
-    cJSON *json = (cJSON *)c->priv;
+    cJSON *json = js_root(c);
     struct int_charp *type_list = NULL;
     struct int_charp mix;
     int cnt = 0;
@@ -255,7 +287,7 @@ static int js_get_int(struct config *c, ...)
 
 static int js_set_int(struct config *c, ...)
 {
-    cJSON *json = (cJSON *)c->priv;
+    cJSON *json = js_root(c);
     struct int_charp *type_list = NULL;
     struct int_charp mix;
     int cnt = 0;
@@ -292,7 +324,7 @@ static int js_set_int(struct config *c, ...)
 
 static double js_get_double(struct config *c, ...)
 {
-    cJSON *json = (cJSON *)c->priv;
+    cJSON *json = js_root(c);
     struct int_charp *type_list = NULL;
     struct int_charp mix;
     int cnt = 0;
@@ -327,7 +359,7 @@ static double js_get_double(struct config *c, ...)
 
 static int js_set_double(struct config *c, ...)
 {
-    cJSON *json = (cJSON *)c->priv;
+    cJSON *json = js_root(c);
     struct int_charp *type_list = NULL;
     struct int_charp mix;
     int cnt = 0;
@@ -364,7 +396,7 @@ static int js_set_double(struct config *c, ...)
 
 static bool js_get_boolean(struct config *c, ...)
 {
-    cJSON *json = (cJSON *)c->priv;
+    cJSON *json = js_root(c);
     struct int_charp *type_list = NULL;
     struct int_charp mix;
     int cnt = 0;
@@ -404,7 +436,7 @@ static bool js_get_boolean(struct config *c, ...)
 
 static int js_set_boolean(struct config *c, ...)
 {
-    cJSON *json = (cJSON *)c->priv;
+    cJSON *json = js_root(c);
     struct int_charp *type_list = NULL;
     struct int_charp mix;
     int cnt = 0;
@@ -439,6 +471,64 @@ static int js_set_boolean(struct config *c, ...)
     return 0;
 }
 
+static void js_walk_node(cJSON *node, char *key, size_t len,
+                conf_walk_cb cb, void *arg)
+{
+    int i = 1, n;
+    char num[32];
+    cJSON *child;
+
+    switch (node->type & 0xFF) {
+    case cJSON_Object:
+    case cJSON_Array:
+        for (child = node->child; child; child = child->next, i++) {
+            /* array index starts from 1 like conf_get_xxx */
+            if ((node->type & 0xFF) == cJSON_Object) {
+                n = snprintf(key + len, PATH_MAX - len, "%s%s",
+                             len ? "." : "", child->string);
+            } else {
+                n = snprintf(key + len, PATH_MAX - len, "%s%d",
+                             len ? "." : "", i);
+            }
+            if (n < 0 || len + n >= PATH_MAX) {
+                continue;
+            }
+            js_walk_node(child, key, len + n, cb, arg);
+        }
+        key[len] = '\0';
+        break;
+    case cJSON_String:
+        cb(key, node->valuestring, CONF_STRING, arg);
+        break;
+    case cJSON_Number:
+        snprintf(num, sizeof(num), "%.17g", node->valuedouble);
+        cb(key, num, CONF_NUMBER, arg);
+        break;
+    case cJSON_True:
+        cb(key, "true", CONF_BOOLEAN, arg);
+        break;
+    case cJSON_False:
+        cb(key, "false", CONF_BOOLEAN, arg);
+        break;
+    case cJSON_NULL:
+        cb(key, NULL, CONF_NULL, arg);
+        break;
+    default:
+        break;
+    }
+}
+
+static int js_walk(struct config *c, conf_walk_cb cb, void *arg)
+{
+    char key[PATH_MAX] = {0};
+    cJSON *json = js_root(c);
+    if (!json) {
+        return -1;
+    }
+    js_walk_node(json, key, 0, cb, arg);
+    return 0;
+}
+
 struct config_ops json_ops = {
     js_load,
     js_unload,
@@ -455,4 +545,5 @@ struct config_ops json_ops = {
     js_set_boolean,
 
     NULL,
+    js_walk,
 };
@@ -85,7 +85,8 @@ static struct config_ops *find_backend(const char *name)
     return conf_ops_list[i].ops;
 }
 
-struct config *conf_load(const char *name)
+/* same as conf_load without touching g_config, for loading in other threads */
+struct config *conf_load_private(const char *name)
 {
     struct config *c;
     struct config_ops *ops = find_backend(name);
@@ -105,7 +106,15 @@ struct config *conf_load(const char *name)
             return NULL;
         }
     }
-    g_config = c;
+    return c;
+}
+
+struct config *conf_load(const char *name)
+{
+    struct config *c = conf_load_private(name);
+    if (c) {
+        g_config = c;
+    }
     return c;
 }
 
@@ -144,6 +153,17 @@ void conf_dump_to_file(FILE *f, struct config *c)
     c->ops->dump(c, f);
 }
 
+int conf_walk(struct config *c, conf_walk_cb cb, void *arg)
+{
+    if (!c || !cb)
+        return -1;
+    if (!c->ops->walk) {
+        printf("config backend can not be walked\n");
+        return -1;
+    }
+    return c->ops->walk(c, cb, arg);
+}
+
 void conf_unload(struct config *c)
 {
     if (c && c->ops->unload) {
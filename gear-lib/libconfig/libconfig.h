@@ -26,6 +26,7 @@
 
 #include <libposix.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <stdbool.h>
 #include <limits.h>
 
@@ -33,6 +34,17 @@
 extern "C" {
 #endif
 
+enum conf_value_type {
+    CONF_STRING,
+    CONF_NUMBER,
+    CONF_BOOLEAN,
+    CONF_NULL,
+};
+
+/* leaf visitor, key is full path: "wine:year" for ini, "test.rgn.1.id" for json */
+typedef void (*conf_walk_cb)(const char *key, const char *val,
+                enum conf_value_type type, void *arg);
+
 typedef struct config {
     struct config_ops *ops;
     char path[PATH_MAX];
@@ -55,6 +67,7 @@ typedef struct config_ops {
     int    (*set_boolean)(struct config *c, ...);
 
     void   (*del)     (struct config *c, const char *key);
+    int    (*walk)    (struct config *c, conf_walk_cb cb, void *arg);
 } config_ops_t;
 
 
@@ -65,6 +78,46 @@ GEAR_API void conf_del(struct config *c, const char *key);
 GEAR_API void conf_dump(struct config *c);
 GEAR_API int conf_save(struct config *c);
 GEAR_API void conf_dump_to_file(FILE *f, struct config *c);
+GEAR_API int conf_walk(struct config *c, conf_walk_cb cb, void *arg);
+
+/*
+ * snapshot is an immutable flattened copy of config, every leaf is parsed
+ * once into string/int/double/bool and indexed by full key in a hash table.
+ * lookups are O(1) and need no lock, snapshot can be shared by threads.
+ * conf_snapshot_find returns an index which makes later lookups direct.
+ */
+struct conf_snapshot;
+GEAR_API struct conf_snapshot *conf_snapshot_create(struct config *c);
+GEAR_API void conf_snapshot_destroy(struct conf_snapshot *s);
+GEAR_API int conf_snapshot_count(struct conf_snapshot *s);
+GEAR_API int conf_snapshot_find(struct conf_snapshot *s, const char *key);
+GEAR_API const char *conf_snapshot_key_at(struct conf_snapshot *s, int idx);
+GEAR_API const char *conf_snapshot_string_at(struct conf_snapshot *s, int idx, const char *def);
+GEAR_API int64_t conf_snapshot_int_at(struct conf_snapshot *s, int idx, int64_t def);
+GEAR_API double conf_snapshot_double_at(struct conf_snapshot *s, int idx, double def);
+GEAR_API bool conf_snapshot_bool_at(struct conf_snapshot *s, int idx, bool def);
+GEAR_API const char *conf_snapshot_get_string(struct conf_snapshot *s, const char *key, const char *def);
+GEAR_API int64_t conf_snapshot_get_int(struct conf_snapshot *s, const char *key, int64_t def);
+GEAR_API double conf_snapshot_get_double(struct conf_snapshot *s, const char *key, double def);
+GEAR_API bool conf_snapshot_get_bool(struct conf_snapshot *s, const char *key, bool def);
+
+/*
+ * watch reloads config file when it is modified or replaced, parsed into a
+ * new snapshot which is published by rcu. readers take current snapshot
+ * with conf_watch_acquire without lock, and must call conf_watch_release
+ * before the snapshot is no longer used. old snapshot is freed after all
+ * readers released it. parse failure keeps previous snapshot.
+ * linux only, libconfig should be built with ENABLE_FILEWATCHER
+ */
+struct conf_watch;
+typedef void (*conf_reload_cb)(struct conf_watch *w, struct conf_snapshot *s, void *arg);
+GEAR_API struct conf_watch *conf_watch_create(const char *name, int latency_ms,
+                conf_reload_cb cb, void *arg);
+GEAR_API void conf_watch_destroy(struct conf_watch *w);
+GEAR_API struct conf_snapshot *conf_watch_acquire(struct conf_watch *w);
+GEAR_API void conf_watch_release(struct conf_watch *w);
+GEAR_API int conf_watch_reload(struct conf_watch *w);
+GEAR_API uint64_t conf_watch_version(struct conf_watch *w);
 
 
 /*
@@ -31,6 +31,11 @@
 #include <vector>
 #include <sstream>
 #include <cmath>
+#include <map>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
 
 extern "C"
 {
@@ -43,7 +48,9 @@ extern "C"
 
 #if defined(WIN32) || defined (_WIN32)
 	#include <direct.h>
+	#include <process.h>
 	#define get_current_dir _getcwd
+	#define getpid _getpid
 	#define DIRECTORY_SEPARATOR "\\"
 #elif defined(linux) || defined (__linux) || defined(__linux__) || defined(__APPLE__)
 	#include <unistd.h>
@@ -84,6 +91,308 @@ void bail(lua_State *L, const char *msg){
 	abort();
 }
 
+//
+// Lua state pool and compiled chunk cache
+//
+// luaL_newstate + luaL_openlibs dominates loading of a small config, states
+// of unloaded configs are reset and kept for next load. compiled chunks are
+// cached per file as bytecode, a file with unchanged stat is not parsed again.
+// bytecode is also persisted next to the source as <file>c, so a new process
+// skips parsing as well, it's written to a temp file and renamed in place.
+#define LUATABLES_STATE_POOL_MAX	4
+#define LUATABLES_CHUNK_CACHE_MAX	32
+#define LUATABLES_BC_SUFFIX		"c"
+#define LUATABLES_BC_MAGIC		"LTBC"
+
+#define LUATABLES_KEY_PATH		"luatables.path"
+#define LUATABLES_KEY_LOADED		"luatables.loaded"
+#define LUATABLES_KEY_SERIALIZE	"luatables.serialize"
+
+struct LuaChunk {
+	time_t mtime;
+	long mtime_nsec;
+	off_t size;
+	ino_t ino;
+	std::string code;
+};
+
+// header of persisted bytecode, source is checked by mtime and size
+struct LuaChunkHeader {
+	char magic[4];
+	int32_t version;
+	int64_t mtime;
+	int64_t mtime_nsec;
+	int64_t size;
+};
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static std::vector<lua_State*> state_pool;
+static std::map<std::string, LuaChunk> chunk_cache;
+static bool bytecode_persist = true;
+
+static lua_State *state_new () {
+	lua_State *L = luaL_newstate();
+	if (L == NULL) {
+		return NULL;
+	}
+	luaL_openlibs (L);
+
+	// remember pristine package.path and package.loaded to reset state later
+	lua_getglobal (L, "package");
+	lua_getfield (L, -1, "path");
+	lua_setfield (L, LUA_REGISTRYINDEX, LUATABLES_KEY_PATH);
+	lua_getfield (L, -1, "loaded");
+	lua_newtable (L);
+	lua_pushnil (L);
+	while (lua_next (L, -3)) {
+		lua_pop (L, 1);
+		lua_pushvalue (L, -1);
+		lua_pushboolean (L, 1);
+		lua_rawset (L, -4);
+	}
+	lua_setfield (L, LUA_REGISTRYINDEX, LUATABLES_KEY_LOADED);
+	lua_pop (L, 2);
+	return L;
+}
+
+static lua_State *state_pool_acquire () {
+	lua_State *L = NULL;
+	pthread_mutex_lock (&cache_lock);
+	if (!state_pool.empty()) {
+		L = state_pool.back();
+		state_pool.pop_back();
+	}
+	pthread_mutex_unlock (&cache_lock);
+	if (L == NULL) {
+		L = state_new();
+	}
+	return L;
+}
+
+static void state_pool_release (lua_State *L) {
+	lua_settop (L, 0);
+
+	// drop search path added by config and modules it required, so next
+	// user does not see stale modules
+	lua_getglobal (L, "package");
+	lua_getfield (L, LUA_REGISTRYINDEX, LUATABLES_KEY_PATH);
+	lua_setfield (L, -2, "path");
+	lua_getfield (L, -1, "loaded");
+	lua_getfield (L, LUA_REGISTRYINDEX, LUATABLES_KEY_LOADED);
+	lua_pushnil (L);
+	while (lua_next (L, -3)) {
+		lua_pop (L, 1);
+		lua_pushvalue (L, -1);
+		lua_rawget (L, -3);
+		bool keep = !lua_isnil (L, -1);
+		lua_pop (L, 1);
+		if (!keep) {
+			lua_pushvalue (L, -1);
+			lua_pushnil (L);
+			lua_rawset (L, -5);
+		}
+	}
+	lua_pop (L, 3);
+	lua_gc (L, LUA_GCCOLLECT, 0);
+
+	pthread_mutex_lock (&cache_lock);
+	if (state_pool.size() < LUATABLES_STATE_POOL_MAX) {
+		state_pool.push_back (L);
+		L = NULL;
+	}
+	pthread_mutex_unlock (&cache_lock);
+	if (L) {
+		lua_close (L);
+	}
+}
+
+static void state_unref (LuaStateRef *ref) {
+	if (ref->pooled) {
+		state_pool_release (ref->L);
+	} else if (ref->freeOnZeroRefs) {
+		lua_close (ref->L);
+	}
+}
+
+static int chunk_writer (lua_State *L, const void *p, size_t sz, void *ud) {
+	((std::string*)ud)->append ((const char*)p, sz);
+	return 0;
+}
+
+static long stat_mtime_nsec (const struct stat &st) {
+#if defined(linux) || defined (__linux) || defined(__linux__)
+	return st.st_mtim.tv_nsec;
+#elif defined(__APPLE__)
+	return st.st_mtimespec.tv_nsec;
+#else
+	return 0;
+#endif
+}
+
+static bool chunk_same (const LuaChunk &chunk, const struct stat &st) {
+	return chunk.mtime == st.st_mtime && chunk.mtime_nsec == stat_mtime_nsec (st) &&
+		chunk.size == st.st_size && chunk.ino == st.st_ino;
+}
+
+static void chunk_header_init (LuaChunkHeader *hdr, const struct stat &st) {
+	memset (hdr, 0, sizeof(*hdr));
+	memcpy (hdr->magic, LUATABLES_BC_MAGIC, sizeof(hdr->magic));
+	hdr->version = LUA_VERSION_NUM;
+	hdr->mtime = st.st_mtime;
+	hdr->mtime_nsec = stat_mtime_nsec (st);
+	hdr->size = st.st_size;
+}
+
+/// reads persisted bytecode of filename, false if missing or stale
+static bool chunk_read_persisted (const char *filename, const struct stat &st,
+		std::string &code) {
+	LuaChunkHeader want, hdr;
+	std::string path = std::string(filename) + LUATABLES_BC_SUFFIX;
+	FILE *fp = fopen (path.c_str(), "rb");
+	if (fp == NULL) {
+		return false;
+	}
+	chunk_header_init (&want, st);
+	bool ok = (fread (&hdr, sizeof(hdr), 1, fp) == 1 &&
+			memcmp (&hdr, &want, sizeof(hdr)) == 0);
+	if (ok) {
+		char buf[4096];
+		size_t n;
+		code.clear();
+		while ((n = fread (buf, 1, sizeof(buf), fp)) > 0) {
+			code.append (buf, n);
+		}
+		ok = !ferror (fp) && !code.empty();
+	}
+	fclose (fp);
+	return ok;
+}
+
+/// best effort, a read-only config dir just keeps the in-memory cache
+static void chunk_write_persisted (const char *filename, const struct stat &st,
+		const std::string &code) {
+	LuaChunkHeader hdr;
+	std::string path = std::string(filename) + LUATABLES_BC_SUFFIX;
+	std::ostringstream tmp;
+	tmp << path << ".tmp." << getpid() << "." << pthread_self();
+	FILE *fp = fopen (tmp.str().c_str(), "wb");
+	if (fp == NULL) {
+		return;
+	}
+	chunk_header_init (&hdr, st);
+	bool ok = (fwrite (&hdr, sizeof(hdr), 1, fp) == 1 &&
+			fwrite (code.data(), 1, code.size(), fp) == code.size());
+	ok = (fclose (fp) == 0) && ok;
+	if (!ok || rename (tmp.str().c_str(), path.c_str()) != 0) {
+		remove (tmp.str().c_str());
+	}
+}
+
+void LuaTable::setBytecodePersist (bool enable) {
+	bytecode_persist = enable;
+}
+
+/// loads file as function on top of stack like luaL_loadfile, from cache if unchanged
+static int load_file_cached (lua_State *L, const char *filename) {
+	struct stat st;
+	bool cacheable = (stat (filename, &st) == 0);
+	std::string chunkname = std::string("@") + filename;
+	std::string code;
+	int ret;
+
+	if (cacheable) {
+		bool hit = false;
+		pthread_mutex_lock (&cache_lock);
+		std::map<std::string, LuaChunk>::iterator it = chunk_cache.find (filename);
+		if (it != chunk_cache.end() && chunk_same (it->second, st)) {
+			code = it->second.code;
+			hit = true;
+		}
+		pthread_mutex_unlock (&cache_lock);
+		if (hit) {
+			return luaL_loadbuffer (L, code.data(), code.size(), chunkname.c_str());
+		}
+	}
+
+	ret = -1;
+	if (cacheable && bytecode_persist && chunk_read_persisted (filename, st, code)) {
+		ret = luaL_loadbuffer (L, code.data(), code.size(), chunkname.c_str());
+		if (ret != 0) {
+			// stale or foreign bytecode, compile from source below
+			lua_pop (L, 1);
+		}
+	}
+	if (ret != 0) {
+		ret = luaL_loadfile (L, filename);
+		if (ret != 0 || !cacheable) {
+			return ret;
+		}
+		code.clear();
+#if LUA_VERSION_NUM >= 503
+		lua_dump (L, chunk_writer, &code, 0);
+#else
+		lua_dump (L, chunk_writer, &code);
+#endif
+		if (bytecode_persist) {
+			chunk_write_persisted (filename, st, code);
+		}
+	}
+	LuaChunk chunk;
+	chunk.mtime = st.st_mtime;
+	chunk.mtime_nsec = stat_mtime_nsec (st);
+	chunk.size = st.st_size;
+	chunk.ino = st.st_ino;
+	chunk.code.swap (code);
+	pthread_mutex_lock (&cache_lock);
+	if (chunk_cache.size() >= LUATABLES_CHUNK_CACHE_MAX &&
+			chunk_cache.find (filename) == chunk_cache.end()) {
+		chunk_cache.erase (chunk_cache.begin());
+	}
+	chunk_cache[filename] = chunk;
+	pthread_mutex_unlock (&cache_lock);
+	return 0;
+}
+
+/// runs chunk on top of stack with its own globals table that falls back to _G,
+//  so globals set by one config do not leak into pooled state
+static void set_chunk_env (lua_State *L) {
+	lua_newtable (L);
+	lua_newtable (L);
+#if LUA_VERSION_NUM >= 502
+	lua_pushglobaltable (L);
+#else
+	lua_pushvalue (L, LUA_GLOBALSINDEX);
+#endif
+	lua_setfield (L, -2, "__index");
+	lua_setmetatable (L, -2);
+#if LUA_VERSION_NUM >= 502
+	lua_setupvalue (L, -2, 1);
+#else
+	lua_setfenv (L, -2);
+#endif
+}
+
+/// pushes serialize function, compiled once per state
+static void push_serialize_function (lua_State *L) {
+	lua_getfield (L, LUA_REGISTRYINDEX, LUATABLES_KEY_SERIALIZE);
+	if (lua_isfunction (L, -1)) {
+		return;
+	}
+	lua_pop (L, 1);
+	if (luaL_loadstring(L, serialize_lua)) {
+		bail (L, "Error loading serialization function: ");
+	}
+
+	if (lua_pcall(L, 0, 0, 0)) {
+		bail (L, "Error compiling serialization function: " );
+	}
+
+	lua_getglobal (L, "serialize");
+	assert (lua_isfunction (L, -1));
+	lua_pushvalue (L, -1);
+	lua_setfield (L, LUA_REGISTRYINDEX, LUATABLES_KEY_SERIALIZE);
+}
+
 void stack_print (const char *file, int line, lua_State *L) {
 	cout << file << ":" << line << ": stack size: " << lua_gettop(L) << endl;;
 	for (int i = 1; i < lua_gettop(L) + 1; i++) {
@@ -509,9 +818,7 @@ LuaTable& LuaTable::operator= (const LuaTable &other) {
 			int ref_count = luaStateRef->release();
 
 			if (ref_count == 0) {
-				if (luaStateRef->freeOnZeroRefs) {
-					lua_close (luaStateRef->L);
-				}
+				state_unref (luaStateRef);
 				delete luaStateRef;
 				luaStateRef = NULL;
 			}
@@ -543,9 +850,7 @@ LuaTable::~LuaTable() {
 		int ref_count = luaStateRef->release();
 
 		if (ref_count == 0) {
-			if (luaStateRef->freeOnZeroRefs) {
-				lua_close (luaStateRef->L);
-			}
+			state_unref (luaStateRef);
 			delete luaStateRef;
 			luaStateRef = NULL;
 		}
@@ -594,15 +899,19 @@ LuaTable LuaTable::fromFile (const char* _filename) {
 	
 	result.filename = _filename;
 	result.luaStateRef = new LuaStateRef();
-	result.luaStateRef->L = luaL_newstate();
+	result.luaStateRef->L = state_pool_acquire();
 	result.luaStateRef->count = 1;
-	luaL_openlibs (result.luaStateRef->L);
+	result.luaStateRef->pooled = true;
 
 	// Add the directory of _filename to package.path
 	result.addSearchPath(get_file_directory (_filename).c_str());
 
 	// run the file we 
-	if (luaL_dofile (result.luaStateRef->L, _filename)) {
+	if (load_file_cached (result.luaStateRef->L, _filename)) {
+		bail (result.luaStateRef->L, "Error running file: ");
+	}
+	set_chunk_env (result.luaStateRef->L);
+	if (lua_pcall (result.luaStateRef->L, 0, LUA_MULTRET, 0)) {
 		bail (result.luaStateRef->L, "Error running file: ");
 	}
 
@@ -679,16 +988,7 @@ std::string LuaTable::serialize() {
 
 	int current_top = lua_gettop(L);
 	if (lua_gettop(L) != 0) {
-		if (luaL_loadstring(L, serialize_lua)) {
-			bail (L, "Error loading serialization function: ");
-		}
-
-		if (lua_pcall(L, 0, 0, 0)) {
-			bail (L, "Error compiling serialization function: " );
-		}
-
-		lua_getglobal (L, "serialize");
-		assert (lua_isfunction (L, -1));
+		push_serialize_function (L);
 		lua_pushvalue (L, -2);
 		if (lua_pcall (L, 1, 1, 0)) {
 			bail (L, "Error while serializing: ");
@@ -713,16 +1013,7 @@ std::string LuaTable::orderedSerialize() {
 
 	int current_top = lua_gettop(L);
 	if (lua_gettop(L) != 0) {
-		if (luaL_loadstring(L, serialize_lua)) {
-			bail (L, "Error loading serialization function: ");
-		}
-
-		if (lua_pcall(L, 0, 0, 0)) {
-			bail (L, "Error compiling serialization function: " );
-		}
-
-		lua_getglobal (L, "serialize");
-		assert (lua_isfunction (L, -1));
+		push_serialize_function (L);
 		lua_pushvalue (L, -2);
 		lua_pushstring (L, "");
 		lua_pushboolean (L, true);
@@ -184,7 +184,8 @@ class LuaStateRef {
 	LuaStateRef () :
 		L (NULL),
 		count (0),
-		freeOnZeroRefs(true)
+		freeOnZeroRefs(true),
+		pooled(false)
 	{}
 
 	LuaStateRef* acquire() {
@@ -200,6 +201,8 @@ class LuaStateRef {
 	lua_State *L;
 	unsigned int count;
 	bool freeOnZeroRefs;
+	/// state comes from the state pool and goes back there instead of lua_close
+	bool pooled;
 };
 
 class LuaTable {
@@ -253,6 +256,8 @@ class LuaTable {
 	static LuaTable fromFile (const char *_filename);
 	static LuaTable fromLuaExpression (const char* lua_expr);
 	static LuaTable fromLuaState (lua_State *L);
+	/// persist compiled chunks next to source files as <file>c, default on
+	static void setBytecodePersist (bool enable);
 
 	std::string filename;
 	LuaStateRef *luaStateRef;
@@ -0,0 +1,289 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#include "libconfig.h"
+
+#if defined (OS_LINUX)
+#include <libfilewatcher.h>
+#include <libthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <libgen.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#define CONF_WATCH_LATENCY  (100)
+
+extern struct config *conf_load_private(const char *name);
+
+struct conf_reader {
+    struct rcu_reader r;
+    struct conf_watch *w;
+};
+
+struct conf_watch {
+    char path[PATH_MAX];
+    char dir[PATH_MAX];
+    struct conf_snapshot *snap;
+    uint64_t version;
+    struct stat st;                 /* file state of current snapshot */
+    struct rcu rcu;
+    pthread_key_t key;
+    mutex_lock_t lock;              /* serialize writers */
+    struct fw *fw;
+    struct thread *thread;
+    conf_reload_cb cb;
+    void *arg;
+};
+
+static bool conf_stat_same(const struct stat *a, const struct stat *b)
+{
+    return a->st_ino == b->st_ino && a->st_dev == b->st_dev &&
+           a->st_size == b->st_size &&
+           a->st_mtim.tv_sec == b->st_mtim.tv_sec &&
+           a->st_mtim.tv_nsec == b->st_mtim.tv_nsec;
+}
+
+static int conf_watch_update(struct conf_watch *w, bool force)
+{
+    struct stat st;
+    struct config *c;
+    struct conf_snapshot *s, *old;
+
+    mutex_lock(&w->lock);
+    if (-1 == stat(w->path, &st)) {
+        /* replaced by rename, new file will come with next event */
+        mutex_unlock(&w->lock);
+        return -1;
+    }
+    if (!force && w->snap && conf_stat_same(&st, &w->st)) {
+        mutex_unlock(&w->lock);
+        return 0;
+    }
+    c = conf_load_private(w->path);
+    if (!c) {
+        printf("reload %s failed, keep previous config\n", w->path);
+        mutex_unlock(&w->lock);
+        return -1;
+    }
+    s = conf_snapshot_create(c);
+    conf_unload(c);
+    if (!s) {
+        mutex_unlock(&w->lock);
+        return -1;
+    }
+    old = w->snap;
+    w->st = st;
+    rcu_assign_pointer(w->snap, s);
+    __atomic_add_fetch(&w->version, 1, __ATOMIC_RELEASE);
+    if (old && w->cb) {
+        w->cb(w, s, w->arg);
+    }
+    if (old) {
+        /* wait readers still holding old one */
+        rcu_synchronize(&w->rcu);
+        conf_snapshot_destroy(old);
+    }
+    mutex_unlock(&w->lock);
+    return 0;
+}
+
+static bool conf_watch_match(enum fw_type type)
+{
+    return type == FW_MODIFY_FILE || type == FW_CREATE_FILE ||
+           type == FW_MOVE_TO_FILE;
+}
+
+static void conf_watch_batch(struct fw *fw, const struct fw_event *events, int num)
+{
+    int i;
+    struct conf_watch *w = (struct conf_watch *)fw->arg;
+    for (i = 0; i < num; i++) {
+        if (conf_watch_match(events[i].type) && !strcmp(events[i].path, w->path)) {
+            conf_watch_update(w, false);
+            break;
+        }
+    }
+}
+
+static void *conf_watch_loop(struct thread *t, void *arg)
+{
+    struct conf_watch *w = (struct conf_watch *)arg;
+    fw_dispatch(w->fw);
+    return NULL;
+}
+
+static void conf_reader_free(void *arg)
+{
+    struct conf_reader *r = (struct conf_reader *)arg;
+    rcu_unregister(&r->w->rcu, &r->r);
+    free(r);
+}
+
+static struct conf_reader *conf_reader_get(struct conf_watch *w)
+{
+    struct conf_reader *r = (struct conf_reader *)pthread_getspecific(w->key);
+    if (r) {
+        return r;
+    }
+    r = CALLOC(1, struct conf_reader);
+    if (!r) {
+        printf("malloc conf_reader failed!\n");
+        return NULL;
+    }
+    r->w = w;
+    rcu_register(&w->rcu, &r->r);
+    pthread_setspecific(w->key, r);
+    return r;
+}
+
+struct conf_watch *conf_watch_create(const char *name, int latency_ms,
+                conf_reload_cb cb, void *arg)
+{
+    char tmp[PATH_MAX];
+    struct conf_watch *w;
+
+    if (!name) {
+        printf("%s:%d paraments is invalid\n", __func__, __LINE__);
+        return NULL;
+    }
+    w = CALLOC(1, struct conf_watch);
+    if (!w) {
+        printf("malloc conf_watch failed!\n");
+        return NULL;
+    }
+    if (!realpath(name, w->path)) {
+        printf("realpath %s failed(%d): %s\n", name, errno, strerror(errno));
+        free(w);
+        return NULL;
+    }
+    strncpy(tmp, w->path, sizeof(tmp));
+    strncpy(w->dir, dirname(tmp), sizeof(w->dir) - 1);
+    w->cb = cb;
+    w->arg = arg;
+    rcu_init(&w->rcu);
+    mutex_lock_init(&w->lock);
+    if (0 != pthread_key_create(&w->key, conf_reader_free)) {
+        printf("pthread_key_create failed!\n");
+        goto err_key;
+    }
+    if (0 != conf_watch_update(w, true)) {
+        goto err_load;
+    }
+    w->fw = fw_init(NULL);
+    if (!w->fw) {
+        goto err_fw;
+    }
+    w->fw->arg = w;
+    fw_set_batch(w->fw, latency_ms > 0 ? latency_ms : CONF_WATCH_LATENCY,
+                 conf_watch_batch);
+    if (0 != fw_add_watch_dir(w->fw, w->dir)) {
+        goto err_watch;
+    }
+    w->thread = thread_create(conf_watch_loop, w);
+    if (!w->thread) {
+        goto err_watch;
+    }
+    return w;
+
+err_watch:
+    fw_deinit(w->fw);
+err_fw:
+    conf_snapshot_destroy(w->snap);
+err_load:
+    pthread_key_delete(w->key);
+err_key:
+    mutex_lock_deinit(&w->lock);
+    rcu_deinit(&w->rcu);
+    free(w);
+    return NULL;
+}
+
+/* all readers must have released before destroy */
+void conf_watch_destroy(struct conf_watch *w)
+{
+    struct rcu_reader *rr, *next;
+    if (!w) {
+        return;
+    }
+    gevent_base_loop_break(w->fw->evbase);
+    thread_join(w->thread);
+    thread_destroy(w->thread);
+    fw_deinit(w->fw);
+
+    /* key destructor will not run anymore, free readers of alive threads */
+    pthread_key_delete(w->key);
+    list_for_each_entry_safe(rr, next, &w->rcu.readers, entry) {
+        list_del(&rr->entry);
+        free(container_of(rr, struct conf_reader, r));
+    }
+    conf_snapshot_destroy(w->snap);
+    mutex_lock_deinit(&w->lock);
+    rcu_deinit(&w->rcu);
+    free(w);
+}
+
+struct conf_snapshot *conf_watch_acquire(struct conf_watch *w)
+{
+    struct conf_reader *r;
+    if (!w) {
+        return NULL;
+    }
+    r = conf_reader_get(w);
+    if (!r) {
+        return NULL;
+    }
+    rcu_read_lock(&w->rcu, &r->r);
+    return rcu_dereference(w->snap);
+}
+
+void conf_watch_release(struct conf_watch *w)
+{
+    struct conf_reader *r;
+    if (!w) {
+        return;
+    }
+    r = (struct conf_reader *)pthread_getspecific(w->key);
+    if (r) {
+        rcu_read_unlock(&w->rcu, &r->r);
+    }
+}
+
+/* must not be called between acquire and release */
+int conf_watch_reload(struct conf_watch *w)
+{
+    if (!w) {
+        return -1;
+    }
+    return conf_watch_update(w, true);
+}
+
+uint64_t conf_watch_version(struct conf_watch *w)
+{
+    if (!w) {
+        return 0;
+    }
+    return __atomic_load_n(&w->version, __ATOMIC_ACQUIRE);
+}
+
+#endif
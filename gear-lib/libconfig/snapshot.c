@@ -0,0 +1,306 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#include "libconfig.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+
+#define SNAP_HAS_INT        (1 << 0)
+#define SNAP_HAS_DOUBLE     (1 << 1)
+#define SNAP_HAS_BOOL       (1 << 2)
+#define SNAP_INIT_ENTRIES   (64)
+
+struct snap_entry {
+    uint32_t hash;
+    uint32_t flags;
+    char *key;
+    char *sval;
+    int64_t ival;
+    double dval;
+    bool bval;
+};
+
+struct conf_snapshot {
+    int count;
+    int cap;
+    uint32_t mask;
+    int *slots;
+    struct snap_entry *entries;
+    char *pool;
+    size_t pool_len;
+    size_t pool_cap;
+    bool failed;
+};
+
+static uint32_t snap_hash(const char *key)
+{
+    uint32_t h = 2166136261u;
+    while (*key) {
+        h = (h ^ (uint8_t)*key++) * 16777619u;
+    }
+    return h;
+}
+
+/* strings are kept as offsets while pool grows, fixed up after walk */
+static ssize_t snap_pool_add(struct conf_snapshot *s, const char *str)
+{
+    size_t len = strlen(str) + 1;
+    size_t off = s->pool_len;
+    if (s->pool_len + len > s->pool_cap) {
+        size_t cap = s->pool_cap ? s->pool_cap * 2 : 4096;
+        char *p;
+        while (cap < s->pool_len + len) {
+            cap *= 2;
+        }
+        p = (char *)realloc(s->pool, cap);
+        if (!p) {
+            return -1;
+        }
+        s->pool = p;
+        s->pool_cap = cap;
+    }
+    memcpy(s->pool + off, str, len);
+    s->pool_len += len;
+    return off;
+}
+
+static void snap_parse(struct snap_entry *e, const char *val,
+                enum conf_value_type type)
+{
+    char *end;
+    long long ll;
+    double d;
+
+    if (!val || type == CONF_NULL) {
+        return;
+    }
+    if (!strcasecmp(val, "true") || !strcasecmp(val, "yes") ||
+        !strcasecmp(val, "on")) {
+        e->bval = true;
+        e->flags |= SNAP_HAS_BOOL;
+    } else if (!strcasecmp(val, "false") || !strcasecmp(val, "no") ||
+               !strcasecmp(val, "off")) {
+        e->bval = false;
+        e->flags |= SNAP_HAS_BOOL;
+    }
+    if (type == CONF_BOOLEAN) {
+        return;
+    }
+    errno = 0;
+    ll = strtoll(val, &end, 0);
+    if (end != val && *end == '\0' && errno == 0) {
+        e->ival = ll;
+        e->dval = (double)ll;
+        e->flags |= SNAP_HAS_INT | SNAP_HAS_DOUBLE;
+        if (!(e->flags & SNAP_HAS_BOOL)) {
+            e->bval = (ll != 0);
+            e->flags |= SNAP_HAS_BOOL;
+        }
+        return;
+    }
+    errno = 0;
+    d = strtod(val, &end);
+    if (end != val && *end == '\0' && errno == 0) {
+        e->dval = d;
+        e->flags |= SNAP_HAS_DOUBLE;
+        /* json numbers are printed with %g, integral ones still count */
+        if (d >= -9.2e18 && d <= 9.2e18 && d == (double)(int64_t)d) {
+            e->ival = (int64_t)d;
+            e->flags |= SNAP_HAS_INT;
+        }
+    }
+}
+
+static void snap_add(const char *key, const char *val,
+                enum conf_value_type type, void *arg)
+{
+    struct conf_snapshot *s = (struct conf_snapshot *)arg;
+    struct snap_entry *e;
+    ssize_t koff, voff = -1;
+
+    if (s->failed) {
+        return;
+    }
+    if (s->count == s->cap) {
+        int cap = s->cap ? s->cap * 2 : SNAP_INIT_ENTRIES;
+        e = (struct snap_entry *)realloc(s->entries, cap * sizeof(*e));
+        if (!e) {
+            s->failed = true;
+            return;
+        }
+        s->entries = e;
+        s->cap = cap;
+    }
+    koff = snap_pool_add(s, key);
+    if (val) {
+        voff = snap_pool_add(s, val);
+    }
+    if (koff < 0 || (val && voff < 0)) {
+        s->failed = true;
+        return;
+    }
+    e = &s->entries[s->count++];
+    memset(e, 0, sizeof(*e));
+    e->hash = snap_hash(key);
+    e->key = (char *)(uintptr_t)koff;
+    e->sval = (char *)(intptr_t)voff;
+    snap_parse(e, val, type);
+}
+
+static int *snap_slot(struct conf_snapshot *s, const char *key, uint32_t hash)
+{
+    uint32_t i = hash & s->mask;
+    while (s->slots[i]) {
+        struct snap_entry *e = &s->entries[s->slots[i] - 1];
+        if (e->hash == hash && !strcmp(e->key, key)) {
+            break;
+        }
+        i = (i + 1) & s->mask;
+    }
+    return &s->slots[i];
+}
+
+struct conf_snapshot *conf_snapshot_create(struct config *c)
+{
+    int i;
+    uint32_t nslots = 16;
+    struct conf_snapshot *s;
+
+    if (!c) {
+        return NULL;
+    }
+    s = (struct conf_snapshot *)calloc(1, sizeof(struct conf_snapshot));
+    if (!s) {
+        printf("malloc conf_snapshot failed!\n");
+        return NULL;
+    }
+    if (0 != conf_walk(c, snap_add, s) || s->failed) {
+        printf("conf_snapshot_create failed!\n");
+        conf_snapshot_destroy(s);
+        return NULL;
+    }
+    /* pool is final now, turn offsets into pointers */
+    for (i = 0; i < s->count; i++) {
+        struct snap_entry *e = &s->entries[i];
+        e->key = s->pool + (uintptr_t)e->key;
+        e->sval = ((intptr_t)e->sval < 0) ? NULL : s->pool + (intptr_t)e->sval;
+    }
+    while (nslots < (uint32_t)s->count * 2) {
+        nslots <<= 1;
+    }
+    s->slots = (int *)calloc(nslots, sizeof(int));
+    if (!s->slots) {
+        printf("malloc conf_snapshot failed!\n");
+        conf_snapshot_destroy(s);
+        return NULL;
+    }
+    s->mask = nslots - 1;
+    for (i = 0; i < s->count; i++) {
+        /* duplicated keys, the last one wins like in parsers */
+        *snap_slot(s, s->entries[i].key, s->entries[i].hash) = i + 1;
+    }
+    return s;
+}
+
+void conf_snapshot_destroy(struct conf_snapshot *s)
+{
+    if (!s) {
+        return;
+    }
+    free(s->slots);
+    free(s->entries);
+    free(s->pool);
+    free(s);
+}
+
+int conf_snapshot_count(struct conf_snapshot *s)
+{
+    return s ? s->count : 0;
+}
+
+int conf_snapshot_find(struct conf_snapshot *s, const char *key)
+{
+    if (!s || !key || !s->slots) {
+        return -1;
+    }
+    return *snap_slot(s, key, snap_hash(key)) - 1;
+}
+
+static struct snap_entry *snap_at(struct conf_snapshot *s, int idx)
+{
+    if (!s || idx < 0 || idx >= s->count) {
+        return NULL;
+    }
+    return &s->entries[idx];
+}
+
+const char *conf_snapshot_key_at(struct conf_snapshot *s, int idx)
+{
+    struct snap_entry *e = snap_at(s, idx);
+    return e ? e->key : NULL;
+}
+
+const char *conf_snapshot_string_at(struct conf_snapshot *s, int idx, const char *def)
+{
+    struct snap_entry *e = snap_at(s, idx);
+    return (e && e->sval) ? e->sval : def;
+}
+
+int64_t conf_snapshot_int_at(struct conf_snapshot *s, int idx, int64_t def)
+{
+    struct snap_entry *e = snap_at(s, idx);
+    return (e && (e->flags & SNAP_HAS_INT)) ? e->ival : def;
+}
+
+double conf_snapshot_double_at(struct conf_snapshot *s, int idx, double def)
+{
+    struct snap_entry *e = snap_at(s, idx);
+    return (e && (e->flags & SNAP_HAS_DOUBLE)) ? e->dval : def;
+}
+
+bool conf_snapshot_bool_at(struct conf_snapshot *s, int idx, bool def)
+{
+    struct snap_entry *e = snap_at(s, idx);
+    return (e && (e->flags & SNAP_HAS_BOOL)) ? e->bval : def;
+}
+
+const char *conf_snapshot_get_string(struct conf_snapshot *s, const char *key, const char *def)
+{
+    return conf_snapshot_string_at(s, conf_snapshot_find(s, key), def);
+}
+
+int64_t conf_snapshot_get_int(struct conf_snapshot *s, const char *key, int64_t def)
+{
+    return conf_snapshot_int_at(s, conf_snapshot_find(s, key), def);
+}
+
+double conf_snapshot_get_double(struct conf_snapshot *s, const char *key, double def)
+{
+    return conf_snapshot_double_at(s, conf_snapshot_find(s, key), def);
+}
+
+bool conf_snapshot_get_bool(struct conf_snapshot *s, const char *key, bool def)
+{
+    return conf_snapshot_bool_at(s, conf_snapshot_find(s, key), def);
+}
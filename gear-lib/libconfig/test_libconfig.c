@@ -23,7 +23,10 @@
 #include <libfile.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <signal.h>
+#include <unistd.h>
+#include <inttypes.h>
 #include <sys/types.h>
 
 static int ini_test(void)
@@ -67,6 +70,120 @@ static int json_test(void)
     return 0;
 }
 
+static int json_insitu_test(void)
+{
+    int ok = 1;
+    struct config *conf;
+    FILE *f = fopen("json/insitu.json", "w");
+    if (!f) {
+        return -1;
+    }
+    fprintf(f, "{\"name\": \"a\\\"b\\u00e9\\n\", \"list\": [{\"k\": \"v\"}, 7]}");
+    fclose(f);
+    conf = conf_load("json/insitu.json");
+    if (!conf) {
+        printf("conf_load failed!\n");
+        unlink("json/insitu.json");
+        return -1;
+    }
+    ok &= !strcmp(conf_get_string(conf, "name"), "a\"b\xc3\xa9\n");
+    ok &= !strcmp(conf_get_string(conf, "list", 1, "k"), "v");
+    ok &= (conf_get_int(conf, "list", 2) == 7);
+    /* replaced items are on heap, original ones stay in arena */
+    conf_set_string(conf, "list", 1, "k", "value");
+    ok &= !strcmp(conf_get_string(conf, "list", 1, "k"), "value");
+    printf("json in situ %s\n", ok ? "ok" : "failed");
+    conf_unload(conf);
+    unlink("json/insitu.json");
+    return ok ? 0 : -1;
+}
+
+static int snapshot_test(void)
+{
+    int idx, ok = 1;
+    struct conf_snapshot *snap;
+    struct config *ini = conf_load("ini/example.ini");
+    struct config *js = conf_load("json/all.json");
+    if (!ini || !js) {
+        printf("conf_load failed!\n");
+        return -1;
+    }
+    snap = conf_snapshot_create(ini);
+    ok &= (conf_snapshot_get_int(snap, "wine:year", 0) == 1122);
+    ok &= (conf_snapshot_get_double(snap, "wine:alcohol", 0) == 12.5);
+    ok &= conf_snapshot_get_bool(snap, "pizza:ham", false);
+    ok &= !strcmp(conf_snapshot_get_string(snap, "wine:grape", ""), "Cabernet Sauvignon");
+    ok &= (conf_snapshot_get_int(snap, "wine:nothing", -1) == -1);
+    conf_snapshot_destroy(snap);
+
+    snap = conf_snapshot_create(js);
+    idx = conf_snapshot_find(snap, "test.rgn.1.port");
+    ok &= (conf_snapshot_int_at(snap, idx, 0) == conf_get_int(js, "test", "rgn", 1, "port"));
+    ok &= !strcmp(conf_snapshot_get_string(snap, "test.rgn.1.id", ""),
+                  conf_get_string(js, "test", "rgn", 1, "id"));
+    printf("snapshot entries=%d %s\n", conf_snapshot_count(snap), ok ? "ok" : "failed");
+    conf_snapshot_destroy(snap);
+    conf_unload(js);
+    conf_unload(ini);
+    return ok ? 0 : -1;
+}
+
+#ifdef ENABLE_FILEWATCHER
+static int watch_write(const char *name, int port)
+{
+    FILE *f = fopen("ini/watch.ini.tmp", "w");
+    if (!f) {
+        return -1;
+    }
+    fprintf(f, "[net]\nport = %d\n", port);
+    fclose(f);
+    /* replace by rename like most editors do */
+    return rename("ini/watch.ini.tmp", name);
+}
+
+static void on_reload(struct conf_watch *w, struct conf_snapshot *s, void *arg)
+{
+    printf("config reloaded, port=%d\n", (int)conf_snapshot_get_int(s, "net:port", 0));
+}
+
+static int watch_test(void)
+{
+    int i, ok = 1;
+    uint64_t ver;
+    struct conf_watch *w;
+    struct conf_snapshot *snap;
+    const char *name = "ini/watch.ini";
+
+    if (0 != watch_write(name, 80)) {
+        printf("write %s failed!\n", name);
+        return -1;
+    }
+    w = conf_watch_create(name, 50, on_reload, NULL);
+    if (!w) {
+        printf("conf_watch_create failed!\n");
+        unlink(name);
+        return -1;
+    }
+    snap = conf_watch_acquire(w);
+    ok &= (conf_snapshot_get_int(snap, "net:port", 0) == 80);
+    conf_watch_release(w);
+
+    ver = conf_watch_version(w);
+    watch_write(name, 81);
+    for (i = 0; i < 200 && conf_watch_version(w) == ver; i++) {
+        usleep(10 * 1000);
+    }
+    snap = conf_watch_acquire(w);
+    ok &= (conf_snapshot_get_int(snap, "net:port", 0) == 81);
+    conf_watch_release(w);
+
+    printf("watch version=%" PRIu64 " %s\n", conf_watch_version(w), ok ? "ok" : "failed");
+    conf_watch_destroy(w);
+    unlink(name);
+    return ok ? 0 : -1;
+}
+#endif
+
 static int lua_test(void)
 {
 #ifdef ENABLE_LUA
@@ -106,6 +223,11 @@ int main(int argc, char **argv)
 {
     ini_test();
     json_test();
+    json_insitu_test();
+    snapshot_test();
+#ifdef ENABLE_FILEWATCHER
+    watch_test();
+#endif
     lua_test();
 
     return 0;
@@ -24,20 +24,47 @@
 #include <stdlib.h>
 
 #define DARRAY_INVALID ((size_t)-1)
+#define DARRAY_MIN_CAP  4
+#define DARRAY_GROWTH_MIN 110
+#define DARRAY_TMP_SIZE 64
+
+#define darray_inline(da) ((da)->sbo && (da)->array == (da)->sbo)
 
 void darray_init(struct darray *dst)
 {
     dst->array = NULL;
     dst->num = 0;
     dst->capacity = 0;
+    dst->sbo = NULL;
+    dst->sbo_cap = 0;
+    dst->growth = 0;
+}
+
+void darray_init_sbo(struct darray *dst, void *buf, const size_t capacity)
+{
+    dst->array = buf;
+    dst->num = 0;
+    dst->capacity = capacity;
+    dst->sbo = buf;
+    dst->sbo_cap = capacity;
+    dst->growth = 0;
+}
+
+void darray_set_growth(struct darray *dst, unsigned int percent)
+{
+    if (percent && percent < DARRAY_GROWTH_MIN)
+            percent = DARRAY_GROWTH_MIN;
+    dst->growth = percent;
 }
 
 void darray_free(struct darray *dst)
 {
-    free(dst->array);
-    dst->array = NULL;
+    if (!darray_inline(dst))
+            free(dst->array);
+    /* fall back to inline buffer if any */
+    dst->array = dst->sbo;
     dst->num = 0;
-    dst->capacity = 0;
+    dst->capacity = dst->sbo_cap;
 }
 
 size_t darray_alloc_size(const size_t element_size,
@@ -61,63 +88,78 @@ void *darray_end(const size_t element_size,
     return darray_item(element_size, da, da->num - 1);
 }
 
-void darray_reserve(const size_t element_size, struct darray *dst,
+/*
+ * realloc keeps data in place when allocator can extend the block and
+ * only copies num elements otherwise, inline buffer is copied out once
+ */
+static int darray_realloc(const size_t element_size, struct darray *dst,
                 const size_t capacity)
 {
     void *ptr;
-    if (capacity == 0 || capacity <= dst->num)
-            return;
-
-    ptr = malloc(element_size * capacity);
-    if (dst->num)
-            memcpy(ptr, dst->array, element_size * dst->num);
-    if (dst->array)
-            free(dst->array);
+    if (element_size && capacity > SIZE_MAX / element_size) {
+            printf("darray capacity %zu overflow\n", capacity);
+            return -1;
+    }
+    if (darray_inline(dst)) {
+            ptr = malloc(element_size * capacity);
+            if (ptr && dst->num)
+                    memcpy(ptr, dst->array, element_size * dst->num);
+    } else {
+            ptr = realloc(dst->array, element_size * capacity);
+    }
+    if (!ptr) {
+            printf("darray realloc %zu failed!\n", element_size * capacity);
+            return -1;
+    }
     dst->array = ptr;
     dst->capacity = capacity;
+    return 0;
 }
 
-static void darray_ensure_capacity(const size_t element_size,
+void darray_reserve(const size_t element_size, struct darray *dst,
+                const size_t capacity)
+{
+    if (capacity == 0 || capacity <= dst->capacity)
+            return;
+
+    darray_realloc(element_size, dst, capacity);
+}
+
+static int darray_ensure_capacity(const size_t element_size,
                 struct darray *dst,
                 const size_t new_size)
 {
-    size_t new_cap;
-    void *ptr;
+    size_t new_cap, extra;
+    unsigned int g = dst->growth ? dst->growth : DARRAY_GROWTH_DEFAULT;
     if (new_size <= dst->capacity)
-            return;
+            return 0;
 
-    new_cap = (!dst->capacity) ? new_size : dst->capacity * 2;
+    /* split to keep capacity * percent from overflowing */
+    extra = dst->capacity / 100 * (g - 100) + dst->capacity % 100 * (g - 100) / 100;
+    new_cap = dst->capacity + extra;
+    if (new_cap < DARRAY_MIN_CAP)
+            new_cap = DARRAY_MIN_CAP;
     if (new_size > new_cap)
             new_cap = new_size;
-    ptr = malloc(element_size * new_cap);
-    if (dst->capacity)
-            memcpy(ptr, dst->array, element_size * dst->capacity);
-    if (dst->array)
-            free(dst->array);
-    dst->array = ptr;
-    dst->capacity = new_cap;
+    return darray_realloc(element_size, dst, new_cap);
 }
 
-void darray_resize(const size_t element_size, struct darray *dst,
+void darray_resize_uninit(const size_t element_size, struct darray *dst,
                 const size_t size)
 {
-    int b_clear;
-    size_t old_num;
-
-    if (size == dst->num) {
-            return;
-    } else if (size == 0) {
-            dst->num = 0;
+    if (size > dst->num &&
+        0 != darray_ensure_capacity(element_size, dst, size))
             return;
-    }
-
-    b_clear = size > dst->num;
-    old_num = dst->num;
-
-    darray_ensure_capacity(element_size, dst, size);
     dst->num = size;
+}
+
+void darray_resize(const size_t element_size, struct darray *dst,
+                const size_t size)
+{
+    size_t old_num = dst->num;
 
-    if (b_clear)
+    darray_resize_uninit(element_size, dst, size);
+    if (dst->num > old_num)
             memset(darray_item(element_size, dst, old_num), 0,
                             element_size * (dst->num - old_num));
 }
@@ -128,8 +170,9 @@ static void darray_copy(const size_t element_size, struct darray *dst,
     if (da->num == 0) {
             darray_free(dst);
     } else {
-            darray_resize(element_size, dst, da->num);
-            memcpy(dst->array, da->array, element_size * da->num);
+            darray_resize_uninit(element_size, dst, da->num);
+            if (dst->num == da->num)
+                    memcpy(dst->array, da->array, element_size * da->num);
     }
 }
 
@@ -137,16 +180,31 @@ static void darray_copy_array(const size_t element_size,
                 struct darray *dst, const void *array,
                 const size_t num)
 {
-    darray_resize(element_size, dst, num);
-    memcpy(dst->array, array, element_size * dst->num);
+    darray_resize_uninit(element_size, dst, num);
+    if (dst->num == num && num)
+            memcpy(dst->array, array, element_size * num);
 }
 
-void darray_move(struct darray *dst, struct darray *src)
+void darray_move(const size_t element_size, struct darray *dst,
+                struct darray *src)
 {
     darray_free(dst);
-    memcpy(dst, src, sizeof(struct darray));
-    src->array = NULL;
-    src->capacity = 0;
+    if (darray_inline(src)) {
+            /* inline data can not be stolen, copy it */
+            if (src->num > dst->capacity &&
+                0 != darray_realloc(element_size, dst, src->num))
+                    return;
+            memcpy(dst->array, src->array, element_size * src->num);
+            dst->num = src->num;
+    } else {
+            if (!darray_inline(dst))
+                    free(dst->array);
+            dst->array = src->array;
+            dst->num = src->num;
+            dst->capacity = src->capacity;
+    }
+    src->array = src->sbo;
+    src->capacity = src->sbo_cap;
     src->num = 0;
 }
 
@@ -172,10 +230,11 @@ size_t darray_find(const size_t element_size,
 size_t darray_push_back(const size_t element_size,
                 struct darray *dst, const void *item)
 {
-    darray_ensure_capacity(element_size, dst, ++dst->num);
-    memcpy(darray_end(element_size, dst), item, element_size);
+    if (0 != darray_ensure_capacity(element_size, dst, dst->num + 1))
+            return DARRAY_INVALID;
+    memcpy(darray_item(element_size, dst, dst->num), item, element_size);
 
-    return dst->num - 1;
+    return dst->num++;
 }
 
 static void *darray_push_back_new(const size_t element_size,
@@ -183,9 +242,10 @@ static void *darray_push_back_new(const size_t element_size,
 {
     void *last;
 
-    darray_ensure_capacity(element_size, dst, ++dst->num);
+    if (0 != darray_ensure_capacity(element_size, dst, dst->num + 1))
+            return NULL;
 
-    last = darray_end(element_size, dst);
+    last = darray_item(element_size, dst, dst->num++);
     memset(last, 0, element_size);
     return last;
 }
@@ -201,9 +261,11 @@ size_t darray_push_back_array(const size_t element_size,
             return dst->num;
 
     old_num = dst->num;
-    darray_resize(element_size, dst, dst->num + num);
+    if (0 != darray_ensure_capacity(element_size, dst, old_num + num))
+            return old_num;
     memcpy(darray_item(element_size, dst, old_num), array,
                     element_size * num);
+    dst->num += num;
 
     return old_num;
 }
@@ -231,7 +293,9 @@ void darray_insert(const size_t element_size, struct darray *dst,
     }
 
     move_count = dst->num - idx;
-    darray_ensure_capacity(element_size, dst, ++dst->num);
+    if (0 != darray_ensure_capacity(element_size, dst, dst->num + 1))
+            return;
+    dst->num++;
 
     new_item = darray_item(element_size, dst, idx);
 
@@ -252,10 +316,13 @@ void *darray_insert_new(const size_t element_size,
     if (idx == dst->num)
             return darray_push_back_new(element_size, dst);
 
-    item = darray_item(element_size, dst, idx);
-
     move_count = dst->num - idx;
-    darray_ensure_capacity(element_size, dst, ++dst->num);
+    if (0 != darray_ensure_capacity(element_size, dst, dst->num + 1))
+            return NULL;
+    dst->num++;
+
+    /* array may move in ensure_capacity, get item after it */
+    item = darray_item(element_size, dst, idx);
     memmove(darray_item(element_size, dst, idx + 1), item,
                     move_count * element_size);
 
@@ -277,7 +344,9 @@ static void darray_insert_array(const size_t element_size,
             return;
 
     old_num = dst->num;
-    darray_resize(element_size, dst, dst->num + num);
+    if (0 != darray_ensure_capacity(element_size, dst, old_num + num))
+            return;
+    dst->num += num;
 
     memmove(darray_item(element_size, dst, idx + num),
                     darray_item(element_size, dst, idx),
@@ -396,12 +465,16 @@ void darray_move_item(const size_t element_size,
                 struct darray *dst, const size_t from,
                 const size_t to)
 {
+    uint8_t buf[DARRAY_TMP_SIZE];
     void *temp, *p_from, *p_to;
 
     if (from == to)
             return;
 
-    temp = malloc(element_size);
+    /* small element uses stack buffer, no malloc */
+    temp = element_size <= sizeof(buf) ? buf : malloc(element_size);
+    if (!temp)
+            return;
     p_from = darray_item(element_size, dst, from);
     p_to = darray_item(element_size, dst, to);
 
@@ -415,12 +488,14 @@ void darray_move_item(const size_t element_size,
                             element_size * (to - from));
 
     memcpy(p_to, temp, element_size);
-    free(temp);
+    if (temp != buf)
+            free(temp);
 }
 
 void darray_swap(const size_t element_size, struct darray *dst,
                 const size_t a, const size_t b)
 {
+    uint8_t buf[DARRAY_TMP_SIZE];
     void *temp, *a_ptr, *b_ptr;
 
     if (a >= dst->num)
@@ -431,7 +506,9 @@ void darray_swap(const size_t element_size, struct darray *dst,
     if (a == b)
             return;
 
-    temp = malloc(element_size);
+    temp = element_size <= sizeof(buf) ? buf : malloc(element_size);
+    if (!temp)
+            return;
     a_ptr = darray_item(element_size, dst, a);
     b_ptr = darray_item(element_size, dst, b);
 
@@ -439,5 +516,6 @@ void darray_swap(const size_t element_size, struct darray *dst,
     memcpy(a_ptr, b_ptr, element_size);
     memcpy(b_ptr, temp, element_size);
 
-    free(temp);
+    if (temp != buf)
+            free(temp);
 }
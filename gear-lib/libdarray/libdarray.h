@@ -38,10 +38,21 @@ struct darray {
     void *array;
     size_t num;
     size_t capacity;
+    void *sbo;          /* inline buffer of DARRAY_SBO, NULL if none */
+    size_t sbo_cap;
+    unsigned int growth; /* capacity percent after grow, 0 is default */
 };
 
 GEAR_API void darray_init(struct darray *dst);
+GEAR_API void darray_init_sbo(struct darray *dst, void *buf, const size_t capacity);
 GEAR_API void darray_free(struct darray *dst);
+/*
+ * growth factor in percent of capacity when push needs room, e.g. 150 for
+ * 1.5x which lets freed blocks be reused, less than 110 is raised to 110,
+ * 0 restores default DARRAY_GROWTH_DEFAULT
+ */
+#define DARRAY_GROWTH_DEFAULT   200
+GEAR_API void darray_set_growth(struct darray *dst, unsigned int percent);
 GEAR_API size_t darray_push_back(const size_t size, struct darray *dst, const void *item);
 GEAR_API void darray_pop_back(const size_t size, struct darray *dst);
 GEAR_API size_t darray_find(const size_t size, const struct darray *da, const void *item,
@@ -58,6 +69,11 @@ GEAR_API void darray_erase_item(const size_t element_size,
                 struct darray *dst, const void *item);
 GEAR_API void darray_resize(const size_t element_size, struct darray *dst,
                 const size_t size);
+/* same as darray_resize but new elements are not zeroed */
+GEAR_API void darray_resize_uninit(const size_t element_size, struct darray *dst,
+                const size_t size);
+GEAR_API void darray_move(const size_t element_size, struct darray *dst,
+                struct darray *src);
 
 
 /*
@@ -74,10 +90,25 @@ GEAR_API void darray_resize(const size_t element_size, struct darray *dst,
         };                              \
     }
 
+/*
+ * darray with n elements stored inline, no malloc until it grows beyond,
+ * da_free returns to inline buffer, must be initialized by da_init_sbo
+ */
+#define DARRAY_SBO(type, n)             \
+    struct {                            \
+        DARRAY(type);                   \
+        type sbo_buf[n];                \
+    }
+
 #define da_init(v) darray_init(&v.da)
 
+#define da_init_sbo(v) \
+        darray_init_sbo(&v.da, v.sbo_buf, sizeof(v.sbo_buf) / sizeof(v.sbo_buf[0]))
+
 #define da_free(v) darray_free(&v.da)
 
+#define da_set_growth(v, percent) darray_set_growth(&v.da, percent)
+
 #define da_alloc_size(v) (sizeof(*v.array) * v.num)
 
 #define da_end(v) darray_end(sizeof(*v.array), &v.da)
@@ -87,12 +118,15 @@ GEAR_API void darray_resize(const size_t element_size, struct darray *dst,
 
 #define da_resize(v, size) darray_resize(sizeof(*v.array), &v.da, size)
 
+#define da_resize_uninit(v, size) \
+        darray_resize_uninit(sizeof(*v.array), &v.da, size)
+
 #define da_copy(dst, src) darray_copy(sizeof(*dst.array), &dst.da, &src.da)
 
 #define da_copy_array(dst, src_array, n) \
         darray_copy_array(sizeof(*dst.array), &dst.da, src_array, n)
 
-#define da_move(dst, src) darray_move(&dst.da, &src.da)
+#define da_move(dst, src) darray_move(sizeof(*dst.array), &dst.da, &src.da)
 
 #define da_find(v, item, idx) darray_find(sizeof(*v.array), &v.da, item, idx)
 
@@ -30,6 +30,7 @@
 #include <wctype.h>
 #include <limits.h>
 #include <stdarg.h>
+#include <pthread.h>
 
 static const char *astrblank = "";
 static const wchar_t *wstrblank = L"";
@@ -358,9 +359,6 @@ void dstr_copy(struct dstr *dst, const char *array)
 
 void dstr_copy_strref(struct dstr *dst, const struct strref *src)
 {
-	if (dst->array)
-		dstr_free(dst);
-
 	dstr_ncopy(dst, src->array, src->len);
 }
 
@@ -371,15 +369,23 @@ static inline size_t size_min(size_t a, size_t b)
 
 void dstr_ncopy(struct dstr *dst, const char *array, const size_t len)
 {
-	if (dst->array)
+	if (!len) {
 		dstr_free(dst);
-
-	if (!len)
 		return;
+	}
 
-	dst->array = memdup(array, len + 1);
+	/* keep current buffer if big enough, memmove as array may be inside */
+	if (len + 1 > dst->capacity) {
+		if (array >= dst->array && array < dst->array + dst->capacity) {
+			char *tmp = (char *)memdup(array, len);
+			dstr_ncopy(dst, tmp, len);
+			free(tmp);
+			return;
+		}
+		dstr_ensure_capacity(dst, len + 1);
+	}
+	memmove(dst->array, array, len);
 	dst->len = len;
-	dst->capacity = len + 1;
 
 	dst->array[len] = 0;
 }
@@ -388,18 +394,13 @@ void dstr_ncopy_dstr(struct dstr *dst, const struct dstr *str, const size_t len)
 {
 	size_t newlen;
 
-	if (dst->array)
+	if (!len || !str->len) {
 		dstr_free(dst);
-
-	if (!len)
 		return;
+	}
 
 	newlen = size_min(len, str->len);
-	dst->array = memdup(str->array, newlen + 1);
-	dst->len = newlen;
-	dst->capacity = newlen + 1;
-
-	dst->array[newlen] = 0;
+	dstr_ncopy(dst, str->array, newlen);
 }
 
 void dstr_cat_dstr(struct dstr *dst, const struct dstr *str)
@@ -714,8 +715,16 @@ void dstr_right(struct dstr *dst, const struct dstr *str, const size_t pos)
 
 void dstr_from_mbs(struct dstr *dst, const char *mbstr)
 {
+	char *out = NULL;
+	size_t len;
+
 	dstr_free(dst);
-	dst->len = mbs_to_utf8_ptr(mbstr, 0, &dst->array);
+	len = mbs_to_utf8_ptr(mbstr, 0, &out);
+	if (out) {
+		dst->array = out;
+		dst->len = len;
+		dst->capacity = len + 1;
+	}
 }
 
 char *dstr_to_mbs(const struct dstr *str)
@@ -789,3 +798,113 @@ void dstr_to_lower(struct dstr *str)
 	dstr_from_wcs(str, wstr);
 	free(wstr);
 }
+
+/* ------------------------------------------------------------------------- */
+/* string interning, open addressing table of pointers to entries */
+
+struct intern_entry {
+	uint32_t hash;
+	size_t len;
+	char str[1];
+};
+
+static pthread_mutex_t intern_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct intern_entry **intern_slots;
+static size_t intern_cap;
+static size_t intern_num;
+
+static uint32_t intern_hash(const char *str, size_t len)
+{
+	/* fnv-1a */
+	uint32_t h = 2166136261u;
+	size_t i;
+	for (i = 0; i < len; i++) {
+		h ^= (uint8_t)str[i];
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static int intern_grow(void)
+{
+	size_t i, j, cap = intern_cap ? intern_cap * 2 : 256;
+	struct intern_entry **slots = calloc(cap, sizeof(*slots));
+	if (!slots)
+		return -1;
+	for (i = 0; i < intern_cap; i++) {
+		struct intern_entry *e = intern_slots[i];
+		if (!e)
+			continue;
+		for (j = e->hash & (cap - 1); slots[j]; j = (j + 1) & (cap - 1))
+			;
+		slots[j] = e;
+	}
+	free(intern_slots);
+	intern_slots = slots;
+	intern_cap = cap;
+	return 0;
+}
+
+const char *str_intern_n(const char *str, size_t len)
+{
+	size_t i;
+	uint32_t hash;
+	struct intern_entry *e;
+	const char *ret = NULL;
+
+	if (!str)
+		return NULL;
+	hash = intern_hash(str, len);
+	pthread_mutex_lock(&intern_lock);
+	/* keep load factor under 3/4 */
+	if ((intern_num + 1) * 4 > intern_cap * 3 && 0 != intern_grow())
+		goto out;
+	for (i = hash & (intern_cap - 1); (e = intern_slots[i]) != NULL;
+	     i = (i + 1) & (intern_cap - 1)) {
+		if (e->hash == hash && e->len == len &&
+		    !memcmp(e->str, str, len)) {
+			ret = e->str;
+			goto out;
+		}
+	}
+	e = malloc(offsetof(struct intern_entry, str) + len + 1);
+	if (!e)
+		goto out;
+	e->hash = hash;
+	e->len = len;
+	memcpy(e->str, str, len);
+	e->str[len] = 0;
+	intern_slots[i] = e;
+	intern_num++;
+	ret = e->str;
+out:
+	pthread_mutex_unlock(&intern_lock);
+	return ret;
+}
+
+const char *str_intern(const char *str)
+{
+	return str ? str_intern_n(str, strlen(str)) : NULL;
+}
+
+size_t str_intern_count(void)
+{
+	size_t n;
+	pthread_mutex_lock(&intern_lock);
+	n = intern_num;
+	pthread_mutex_unlock(&intern_lock);
+	return n;
+}
+
+void str_intern_cleanup(void)
+{
+	size_t i;
+	pthread_mutex_lock(&intern_lock);
+	for (i = 0; i < intern_cap; i++)
+		free(intern_slots[i]);
+	free(intern_slots);
+	intern_slots = NULL;
+	intern_cap = 0;
+	intern_num = 0;
+	pthread_mutex_unlock(&intern_lock);
+}
@@ -90,8 +90,29 @@ struct dstr {
 	char *array;
 	size_t len; /* number of characters, excluding null terminator */
 	size_t capacity;
+	char *sso; /* inline buffer of DSTR_SSO, NULL if none */
+	size_t sso_cap;
 };
 
+/*
+ * dstr with n bytes stored inline, short strings need no malloc,
+ * dstr_free returns to inline buffer, must be initialized by dstr_init_sso
+ *
+ *   DSTR_SSO(32) name;
+ *   dstr_init_sso(&name);
+ *   dstr_copy(&name.str, "short");
+ */
+#define DSTR_SSO(n)			\
+	struct {			\
+		struct dstr str;	\
+		char sso_buf[n];	\
+	}
+
+#define dstr_init_sso(v) \
+	dstr_init_buf(&(v)->str, (v)->sso_buf, sizeof((v)->sso_buf))
+
+#define dstr_inline(d) ((d)->sso && (d)->array == (d)->sso)
+
 #ifndef _MSC_VER
 #define PRINTFATTR(f, a) __attribute__((__format__(__printf__, f, a)))
 #else
@@ -115,6 +136,7 @@ GEAR_API char **strlist_split(const char *str, char split_ch, bool include_empty
 GEAR_API void strlist_free(char **strlist);
 
 static inline void dstr_init(struct dstr *dst);
+static inline void dstr_init_buf(struct dstr *dst, char *buf, size_t size);
 static inline void dstr_init_move(struct dstr *dst, struct dstr *src);
 static inline void dstr_init_move_array(struct dstr *dst, char *str);
 static inline void dstr_init_copy(struct dstr *dst, const char *src);
@@ -202,6 +224,16 @@ GEAR_API wchar_t *dstr_to_wcs(const struct dstr *str);
 GEAR_API void dstr_to_upper(struct dstr *str);
 GEAR_API void dstr_to_lower(struct dstr *str);
 
+/*
+ * string interning: return the one shared copy of str, equal strings
+ * get the same pointer so they compare with ==, thread safe,
+ * interned strings live until str_intern_cleanup
+ */
+GEAR_API const char *str_intern(const char *str);
+GEAR_API const char *str_intern_n(const char *str, size_t len);
+GEAR_API size_t str_intern_count(void);
+GEAR_API void str_intern_cleanup(void);
+
 #undef PRINTFATTR
 
 /* ------------------------------------------------------------------------- */
@@ -211,10 +243,33 @@ static inline void dstr_init(struct dstr *dst)
 	dst->array = NULL;
 	dst->len = 0;
 	dst->capacity = 0;
+	dst->sso = NULL;
+	dst->sso_cap = 0;
+}
+
+static inline void dstr_init_buf(struct dstr *dst, char *buf, size_t size)
+{
+	dst->array = buf;
+	dst->len = 0;
+	dst->capacity = size;
+	dst->sso = buf;
+	dst->sso_cap = size;
+	buf[0] = 0;
+}
+
+/* drop content, fall back to inline buffer if any, caller frees heap */
+static inline void dstr_reset(struct dstr *dst)
+{
+	dst->array = dst->sso;
+	dst->len = 0;
+	dst->capacity = dst->sso_cap;
+	if (dst->sso)
+		dst->sso[0] = 0;
 }
 
 static inline void dstr_init_move_array(struct dstr *dst, char *str)
 {
+	dstr_init(dst);
 	dst->array = str;
 	dst->len = (!str) ? 0 : strlen(str);
 	dst->capacity = dst->len + 1;
@@ -222,8 +277,8 @@ static inline void dstr_init_move_array(struct dstr *dst, char *str)
 
 static inline void dstr_init_move(struct dstr *dst, struct dstr *src)
 {
-	*dst = *src;
-	dstr_init(src);
+	dstr_init(dst);
+	dstr_move(dst, src);
 }
 
 static inline void dstr_init_copy(struct dstr *dst, const char *str)
@@ -240,10 +295,9 @@ static inline void dstr_init_copy_dstr(struct dstr *dst, const struct dstr *src)
 
 static inline void dstr_free(struct dstr *dst)
 {
-	free(dst->array);
-	dst->array = NULL;
-	dst->len = 0;
-	dst->capacity = 0;
+	if (!dstr_inline(dst))
+		free(dst->array);
+	dstr_reset(dst);
 }
 
 static inline void dstr_array_free(struct dstr *array, const size_t count)
@@ -261,10 +315,21 @@ static inline void dstr_move_array(struct dstr *dst, char *str)
 	dst->capacity = dst->len + 1;
 }
 
-static inline void dstr_move(struct dstr *dst, struct dstr *src)
+static inline void dstr_set_capacity(struct dstr *dst, const size_t capacity)
 {
-	dstr_free(dst);
-	dstr_init_move(dst, src);
+	char *ptr;
+	if (dstr_inline(dst)) {
+		/* leave inline buffer, copy it out once */
+		ptr = (char *)malloc(capacity);
+		if (ptr)
+			memcpy(ptr, dst->array, dst->len + 1);
+	} else {
+		ptr = (char *)realloc(dst->array, capacity);
+	}
+	if (!ptr)
+		return;
+	dst->array = ptr;
+	dst->capacity = capacity;
 }
 
 static inline void dstr_ensure_capacity(struct dstr *dst, const size_t new_size)
@@ -276,29 +341,49 @@ static inline void dstr_ensure_capacity(struct dstr *dst, const size_t new_size)
 	new_cap = (!dst->capacity) ? new_size : dst->capacity * 2;
 	if (new_size > new_cap)
 		new_cap = new_size;
-	dst->array = (char *)realloc(dst->array, new_cap);
-	dst->capacity = new_cap;
+	dstr_set_capacity(dst, new_cap);
+}
+
+static inline void dstr_move(struct dstr *dst, struct dstr *src)
+{
+	if (dst == src)
+		return;
+	dstr_free(dst);
+	if (dstr_inline(src)) {
+		/* inline data can not be stolen */
+		if (src->len) {
+			dstr_ensure_capacity(dst, src->len + 1);
+			memcpy(dst->array, src->array, src->len + 1);
+			dst->len = src->len;
+		}
+	} else if (src->array) {
+		dst->array = src->array;
+		dst->len = src->len;
+		dst->capacity = src->capacity;
+	}
+	dstr_reset(src);
 }
 
 static inline void dstr_copy_dstr(struct dstr *dst, const struct dstr *src)
 {
-	if (dst->array)
+	if (dst == src)
+		return;
+	if (!src->len) {
 		dstr_free(dst);
-
-	if (src->len) {
-		dstr_ensure_capacity(dst, src->len + 1);
-		memcpy(dst->array, src->array, src->len + 1);
-		dst->len = src->len;
+		return;
 	}
+	/* reuse current buffer, no free and malloc */
+	dstr_ensure_capacity(dst, src->len + 1);
+	memcpy(dst->array, src->array, src->len + 1);
+	dst->len = src->len;
 }
 
 static inline void dstr_reserve(struct dstr *dst, const size_t capacity)
 {
-	if (capacity == 0 || capacity <= dst->len)
+	if (capacity == 0 || capacity <= dst->capacity)
 		return;
 
-	dst->array = (char *)realloc(dst->array, capacity);
-	dst->capacity = capacity;
+	dstr_set_capacity(dst, capacity);
 }
 
 static inline void dstr_resize(struct dstr *dst, const size_t num)
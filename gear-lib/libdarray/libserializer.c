@@ -19,9 +19,18 @@
  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
  * SOFTWARE.
  ******************************************************************************/
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE     /* O_DIRECT */
+#endif
 #include <stdio.h>
+#include <errno.h>
 #include "libdarray.h"
 #include "libserializer.h"
+#if !defined (OS_WINDOWS)
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#endif
 
 struct array_data {
 	DARRAY(uint8_t) bytes;
@@ -85,6 +94,188 @@ void serializer_array_deinit(struct serializer *s)
     memset(s, 0, sizeof(struct serializer));
 }
 
+/*
+ * iovec backend: small writes are copied into chunks, serializer_iovec_ref
+ * adds caller buffer as its own iovec without copy, output feeds writev
+ */
+struct iovec_data {
+    DARRAY(struct iovec) iov;
+    DARRAY(uint8_t *) chunks;
+    size_t chunk_size;
+    uint8_t *cur;           /* current chunk for copy */
+    size_t cur_used;
+    size_t cur_size;
+    size_t total;
+    bool last_copy;         /* last iovec ends at cur + cur_used */
+};
+
+static int iovec_push(struct iovec_data *d, void *base, size_t len)
+{
+    struct iovec v;
+    v.iov_base = base;
+    v.iov_len = len;
+    return da_push_back(d->iov, &v) == (size_t)-1 ? -1 : 0;
+}
+
+static size_t iovec_write(void *param, const void *data, size_t size)
+{
+    struct iovec_data *d = param;
+    const uint8_t *src = data;
+    size_t left = size, n;
+    uint8_t *chunk;
+
+    while (left > 0) {
+        if (!d->cur || d->cur_used == d->cur_size) {
+            n = d->chunk_size > left ? d->chunk_size : left;
+            chunk = malloc(n);
+            if (!chunk) {
+                printf("malloc iovec chunk failed!\n");
+                break;
+            }
+            da_push_back(d->chunks, &chunk);
+            d->cur = chunk;
+            d->cur_used = 0;
+            d->cur_size = n;
+            d->last_copy = false;
+        }
+        n = d->cur_size - d->cur_used;
+        if (n > left)
+            n = left;
+        memcpy(d->cur + d->cur_used, src, n);
+        if (d->last_copy) {
+            d->iov.array[d->iov.num - 1].iov_len += n;
+        } else if (0 != iovec_push(d, d->cur + d->cur_used, n)) {
+            break;
+        }
+        d->last_copy = true;
+        d->cur_used += n;
+        src += n;
+        left -= n;
+    }
+    d->total += size - left;
+    return size - left;
+}
+
+static size_t iovec_getpos(void *param)
+{
+    struct iovec_data *d = param;
+    return d->total;
+}
+
+static void iovec_free(void *param)
+{
+    size_t i;
+    struct iovec_data *d = param;
+    for (i = 0; i < d->chunks.num; i++) {
+        free(d->chunks.array[i]);
+    }
+    da_free(d->chunks);
+    da_free(d->iov);
+    d->cur = NULL;
+    d->cur_used = 0;
+    d->cur_size = 0;
+    d->total = 0;
+    d->last_copy = false;
+}
+
+int serializer_iovec_init(struct serializer *s, size_t chunk_size)
+{
+    struct iovec_data *data = calloc(1, sizeof(struct iovec_data));
+    if (!data) {
+        return -1;
+    }
+    memset(s, 0, sizeof(struct serializer));
+    da_init(data->iov);
+    da_init(data->chunks);
+    data->chunk_size = chunk_size ? chunk_size : 4096;
+    s->data   = data;
+    s->read   = NULL;
+    s->write  = iovec_write;
+    s->getpos = iovec_getpos;
+    s->free   = iovec_free;
+    return 0;
+}
+
+int serializer_iovec_ref(struct serializer *s, const void *data, size_t size)
+{
+    struct iovec_data *d;
+    if (!s || s->write != iovec_write || !data || !size)
+        return -1;
+    d = s->data;
+    if (0 != iovec_push(d, (void *)data, size))
+        return -1;
+    d->last_copy = false;
+    d->total += size;
+    return 0;
+}
+
+int serializer_iovec_get_data(struct serializer *s, struct iovec **iov, int *iovcnt)
+{
+    struct iovec_data *d;
+    if (!s || s->write != iovec_write || !iov || !iovcnt)
+        return -1;
+    d = s->data;
+    *iov = d->iov.array;
+    *iovcnt = (int)d->iov.num;
+    return 0;
+}
+
+void serializer_iovec_reset(struct serializer *s)
+{
+    if (s && s->data)
+        iovec_free(s->data);
+}
+
+void serializer_iovec_deinit(struct serializer *s)
+{
+    serializer_array_deinit(s);
+}
+
+/* memory reader backend over const buffer */
+struct mem_data {
+    const uint8_t *data;
+    size_t size;
+    size_t pos;
+};
+
+static size_t mem_read(void *param, void *data, size_t size)
+{
+    struct mem_data *m = param;
+    size_t n = m->size - m->pos;
+    if (n > size)
+        n = size;
+    memcpy(data, m->data + m->pos, n);
+    m->pos += n;
+    return n;
+}
+
+static size_t mem_getpos(void *param)
+{
+    struct mem_data *m = param;
+    return m->pos;
+}
+
+int serializer_mem_init(struct serializer *s, const void *data, size_t size)
+{
+    struct mem_data *m = calloc(1, sizeof(struct mem_data));
+    if (!m) {
+        return -1;
+    }
+    memset(s, 0, sizeof(struct serializer));
+    m->data = data;
+    m->size = size;
+    s->data   = m;
+    s->read   = mem_read;
+    s->getpos = mem_getpos;
+    return 0;
+}
+
+void serializer_mem_deinit(struct serializer *s)
+{
+    free(s->data);
+    memset(s, 0, sizeof(struct serializer));
+}
+
 static size_t file_read(void *file, void *data, size_t size)
 {
     return fread(data, 1, size, file);
@@ -113,8 +304,268 @@ int serializer_file_init(struct serializer *s, const char *path)
     return 0;
 }
 
+/*
+ * buffered file writer: fields are copied into a block, only full blocks
+ * at block aligned offsets go to the file, so O_DIRECT works. two blocks
+ * are kept, with submit set the full one is written by a worker while the
+ * other one fills, at most one write is in flight
+ */
+#define FBUF_ALIGN          4096
+#define FBUF_DEFAULT_BLOCK  (256 * 1024)
+
+#if !defined (OS_WINDOWS)
+struct fbuf_data {
+    int fd;
+    bool direct;
+    size_t block_size;
+    uint8_t *buf[2];
+    int cur;                /* block being filled */
+    size_t used;
+    uint64_t flushed;       /* file offset of current block */
+    int error;
+
+    int (*submit)(void *ctx, void (*func)(void *), void *arg);
+    void *submit_ctx;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool busy;
+    uint8_t *pending;
+    size_t pending_len;
+    uint64_t pending_off;
+};
+
+static int fbuf_pwrite(int fd, const uint8_t *p, size_t len, uint64_t off)
+{
+    ssize_t n;
+    while (len > 0) {
+        n = pwrite(fd, p, len, off);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        p += n;
+        len -= n;
+        off += n;
+    }
+    return 0;
+}
+
+static void fbuf_flush_task(void *arg)
+{
+    struct fbuf_data *d = arg;
+    int ret = fbuf_pwrite(d->fd, d->pending, d->pending_len, d->pending_off);
+    pthread_mutex_lock(&d->lock);
+    if (ret != 0)
+        d->error = errno ? errno : EIO;
+    d->busy = false;
+    pthread_cond_signal(&d->cond);
+    pthread_mutex_unlock(&d->lock);
+}
+
+static void fbuf_wait(struct fbuf_data *d)
+{
+    pthread_mutex_lock(&d->lock);
+    while (d->busy)
+        pthread_cond_wait(&d->cond, &d->lock);
+    pthread_mutex_unlock(&d->lock);
+}
+
+/* current block is full, write it and switch to the other one */
+static int fbuf_flush_block(struct fbuf_data *d)
+{
+    uint8_t *full = d->buf[d->cur];
+    uint64_t off = d->flushed;
+
+    d->flushed += d->used;
+    d->used = 0;
+    if (!d->submit) {
+        if (0 != fbuf_pwrite(d->fd, full, d->block_size, off)) {
+            d->error = errno ? errno : EIO;
+            return -1;
+        }
+        return 0;
+    }
+    fbuf_wait(d);
+    if (d->error)
+        return -1;
+    d->busy = true;
+    d->pending = full;
+    d->pending_len = d->block_size;
+    d->pending_off = off;
+    d->cur ^= 1;
+    if (0 != d->submit(d->submit_ctx, fbuf_flush_task, d)) {
+        /* no worker, write inline */
+        fbuf_flush_task(d);
+        return d->error ? -1 : 0;
+    }
+    return 0;
+}
+
+static size_t fbuf_write(void *param, const void *data, size_t size)
+{
+    struct fbuf_data *d = param;
+    const uint8_t *src = data;
+    size_t left = size, n;
+
+    while (left > 0 && !d->error) {
+        n = d->block_size - d->used;
+        if (n > left)
+            n = left;
+        memcpy(d->buf[d->cur] + d->used, src, n);
+        d->used += n;
+        src += n;
+        left -= n;
+        if (d->used == d->block_size && 0 != fbuf_flush_block(d))
+            break;
+    }
+    return size - left;
+}
+
+static size_t fbuf_getpos(void *param)
+{
+    struct fbuf_data *d = param;
+    return (size_t)(d->flushed + d->used);
+}
+
+/* partial tail is written without O_DIRECT and kept in the block, the next
+ * full block rewrites it at the aligned offset */
+static int fbuf_sync_tail(struct fbuf_data *d)
+{
+    int ret = 0;
+    fbuf_wait(d);
+    if (d->error)
+        return -1;
+    if (!d->used)
+        return 0;
+#ifdef O_DIRECT
+    if (d->direct)
+        fcntl(d->fd, F_SETFL, fcntl(d->fd, F_GETFL) & ~O_DIRECT);
+#endif
+    if (0 != fbuf_pwrite(d->fd, d->buf[d->cur], d->used, d->flushed)) {
+        d->error = errno ? errno : EIO;
+        ret = -1;
+    }
+#ifdef O_DIRECT
+    if (d->direct)
+        fcntl(d->fd, F_SETFL, fcntl(d->fd, F_GETFL) | O_DIRECT);
+#endif
+    return ret;
+}
+
+static void fbuf_free(void *param)
+{
+    struct fbuf_data *d = param;
+    free(d->buf[0]);
+    free(d->buf[1]);
+    if (d->fd >= 0)
+        close(d->fd);
+    pthread_mutex_destroy(&d->lock);
+    pthread_cond_destroy(&d->cond);
+    free(d);
+}
+#endif
+
+int serializer_file_open(struct serializer *s, const char *path,
+                const struct serializer_file_opt *opt)
+{
+    size_t block = opt && opt->block_size ? opt->block_size : FBUF_DEFAULT_BLOCK;
+    block = (block + FBUF_ALIGN - 1) & ~(size_t)(FBUF_ALIGN - 1);
+#if !defined (OS_WINDOWS)
+    struct fbuf_data *d;
+    int flags = O_WRONLY | O_CREAT | O_TRUNC;
+
+    memset(s, 0, sizeof(struct serializer));
+    d = calloc(1, sizeof(struct fbuf_data));
+    if (!d)
+        return -1;
+    d->fd = -1;
+#ifdef O_DIRECT
+    if (opt && opt->direct) {
+        d->fd = open(path, flags | O_DIRECT, 0644);
+        d->direct = d->fd >= 0;
+    }
+#endif
+    if (d->fd < 0)
+        d->fd = open(path, flags, 0644);
+    if (d->fd < 0) {
+        printf("open %s failed: %d\n", path, errno);
+        free(d);
+        return -1;
+    }
+    pthread_mutex_init(&d->lock, NULL);
+    pthread_cond_init(&d->cond, NULL);
+    d->block_size = block;
+    if (0 != posix_memalign((void **)&d->buf[0], FBUF_ALIGN, block) ||
+        (opt && opt->submit &&
+         0 != posix_memalign((void **)&d->buf[1], FBUF_ALIGN, block))) {
+        printf("malloc file serializer block failed!\n");
+        fbuf_free(d);
+        return -1;
+    }
+    if (opt && opt->submit) {
+        d->submit = opt->submit;
+        d->submit_ctx = opt->submit_ctx;
+    }
+    s->data   = d;
+    s->read   = NULL;
+    s->write  = fbuf_write;
+    s->getpos = fbuf_getpos;
+    s->free   = fbuf_free;
+    return 0;
+#else
+    /* no O_DIRECT or async here, a stdio buffer of block size */
+    FILE *fp;
+    memset(s, 0, sizeof(struct serializer));
+    fp = fopen(path, "wb");
+    if (!fp)
+        return -1;
+    setvbuf(fp, NULL, _IOFBF, block);
+    s->data   = fp;
+    s->write  = file_write;
+    s->getpos = file_getpos;
+    return 0;
+#endif
+}
+
+int serializer_file_flush(struct serializer *s)
+{
+    if (!s || !s->data)
+        return -1;
+#if !defined (OS_WINDOWS)
+    if (s->write == fbuf_write)
+        return fbuf_sync_tail(s->data);
+#endif
+    return fflush(s->data) == 0 ? 0 : -1;
+}
+
+int serializer_file_close(struct serializer *s)
+{
+    int ret;
+    if (!s || !s->data)
+        return -1;
+#if !defined (OS_WINDOWS)
+    if (s->write == fbuf_write) {
+        struct fbuf_data *d = s->data;
+        ret = fbuf_sync_tail(d);
+        s->free(d);
+        memset(s, 0, sizeof(struct serializer));
+        return ret;
+    }
+#endif
+    ret = fclose(s->data) == 0 ? 0 : -1;
+    memset(s, 0, sizeof(struct serializer));
+    return ret;
+}
+
 void serializer_file_deinit(struct serializer *s)
 {
+#if !defined (OS_WINDOWS)
+    if (s->write == fbuf_write) {
+        serializer_file_close(s);
+        return;
+    }
+#endif
     if (s->data)
         fclose(s->data);
     memset(s, 0, sizeof(struct serializer));
@@ -141,6 +592,82 @@ size_t s_getpos(struct serializer *s)
     return -1;
 }
 
+/*
+ * byte wise put/get compile to a single load/store plus bswap on gcc and
+ * clang, and the array loops below are plain enough to be vectorized
+ */
+static inline void put_le16(uint8_t *p, uint16_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static inline void put_le32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+static inline void put_le64(uint8_t *p, uint64_t v)
+{
+    put_le32(p, (uint32_t)v);
+    put_le32(p + 4, (uint32_t)(v >> 32));
+}
+
+static inline void put_be16(uint8_t *p, uint16_t v)
+{
+    p[0] = (uint8_t)(v >> 8);
+    p[1] = (uint8_t)v;
+}
+
+static inline void put_be32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+static inline void put_be64(uint8_t *p, uint64_t v)
+{
+    put_be32(p, (uint32_t)(v >> 32));
+    put_be32(p + 4, (uint32_t)v);
+}
+
+static inline uint16_t get_le16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static inline uint32_t get_le32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+           ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint64_t get_le64(const uint8_t *p)
+{
+    return (uint64_t)get_le32(p) | ((uint64_t)get_le32(p + 4) << 32);
+}
+
+static inline uint16_t get_be16(const uint8_t *p)
+{
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static inline uint32_t get_be32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+           ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static inline uint64_t get_be64(const uint8_t *p)
+{
+    return ((uint64_t)get_be32(p) << 32) | (uint64_t)get_be32(p + 4);
+}
+
 void s_w8(struct serializer *s, uint8_t u8)
 {
     s_write(s, &u8, sizeof(uint8_t));
@@ -148,68 +675,165 @@ void s_w8(struct serializer *s, uint8_t u8)
 
 void s_wl16(struct serializer *s, uint16_t u16)
 {
-    s_w8(s, (uint8_t)u16);
-    s_w8(s, u16 >> 8);
+    uint8_t b[2];
+    put_le16(b, u16);
+    s_write(s, b, sizeof(b));
 }
 
 void s_wl24(struct serializer *s, uint32_t u24)
 {
-    s_w8(s, (uint8_t)u24);
-    s_wl16(s, (uint16_t)(u24 >> 8));
+    uint8_t b[4];
+    put_le32(b, u24);
+    s_write(s, b, 3);
 }
 
 void s_wl32(struct serializer *s, uint32_t u32)
 {
-    s_wl16(s, (uint16_t)u32);
-    s_wl16(s, (uint16_t)(u32 >> 16));
+    uint8_t b[4];
+    put_le32(b, u32);
+    s_write(s, b, sizeof(b));
 }
 
 void s_wl64(struct serializer *s, uint64_t u64)
 {
-    s_wl32(s, (uint32_t)u64);
-    s_wl32(s, (uint32_t)(u64 >> 32));
+    uint8_t b[8];
+    put_le64(b, u64);
+    s_write(s, b, sizeof(b));
 }
 
 void s_wlf(struct serializer *s, float f)
 {
-    s_wl32(s, *(uint32_t *)&f);
+    uint32_t u32;
+    memcpy(&u32, &f, sizeof(u32));
+    s_wl32(s, u32);
 }
 
 void s_wld(struct serializer *s, double d)
 {
-    s_wl64(s, *(uint64_t *)&d);
+    uint64_t u64;
+    memcpy(&u64, &d, sizeof(u64));
+    s_wl64(s, u64);
 }
 
 void s_wb16(struct serializer *s, uint16_t u16)
 {
-    s_w8(s, u16 >> 8);
-    s_w8(s, (uint8_t)u16);
+    uint8_t b[2];
+    put_be16(b, u16);
+    s_write(s, b, sizeof(b));
 }
 
 void s_wb24(struct serializer *s, uint32_t u24)
 {
-    s_wb16(s, (uint16_t)(u24 >> 8));
-    s_w8(s, (uint8_t)u24);
+    uint8_t b[4];
+    put_be32(b, u24 << 8);
+    s_write(s, b, 3);
 }
 
 void s_wb32(struct serializer *s, uint32_t u32)
 {
-    s_wb16(s, (uint16_t)(u32 >> 16));
-    s_wb16(s, (uint16_t)u32);
+    uint8_t b[4];
+    put_be32(b, u32);
+    s_write(s, b, sizeof(b));
 }
 
 void s_wb64(struct serializer *s, uint64_t u64)
 {
-    s_wb32(s, (uint32_t)(u64 >> 32));
-    s_wb32(s, (uint32_t)u64);
+    uint8_t b[8];
+    put_be64(b, u64);
+    s_write(s, b, sizeof(b));
 }
 
 void s_wbf(struct serializer *s, float f)
 {
-    s_wb32(s, *(uint32_t *)&f);
+    uint32_t u32;
+    memcpy(&u32, &f, sizeof(u32));
+    s_wb32(s, u32);
 }
 
 void s_wbd(struct serializer *s, double d)
 {
-    s_wb64(s, *(uint64_t *)&d);
+    uint64_t u64;
+    memcpy(&u64, &d, sizeof(u64));
+    s_wb64(s, u64);
+}
+
+/*
+ * bulk writers convert through a stack buffer and call write once per
+ * SER_BULK bytes instead of once per byte
+ */
+#define SER_BULK    1024
+
+#define S_WRITE_ARRAY(name, type, put)                                        \
+size_t name(struct serializer *s, const type *v, size_t n)                    \
+{                                                                             \
+    uint8_t buf[SER_BULK];                                                    \
+    size_t i, j, cnt, done = 0;                                               \
+    while (done < n) {                                                        \
+        cnt = n - done;                                                       \
+        if (cnt > SER_BULK / sizeof(type))                                    \
+            cnt = SER_BULK / sizeof(type);                                    \
+        for (i = 0, j = done; i < cnt; i++, j++)                              \
+            put(buf + i * sizeof(type), v[j]);                                \
+        if (s_write(s, buf, cnt * sizeof(type)) != cnt * sizeof(type))        \
+            break;                                                            \
+        done += cnt;                                                          \
+    }                                                                         \
+    return done;                                                              \
+}
+
+#define S_READ_ARRAY(name, type, get)                                         \
+size_t name(struct serializer *s, type *v, size_t n)                          \
+{                                                                             \
+    uint8_t buf[SER_BULK];                                                    \
+    size_t i, cnt, got, done = 0;                                             \
+    while (done < n) {                                                        \
+        cnt = n - done;                                                       \
+        if (cnt > SER_BULK / sizeof(type))                                    \
+            cnt = SER_BULK / sizeof(type);                                    \
+        got = s_read(s, buf, cnt * sizeof(type)) / sizeof(type);              \
+        for (i = 0; i < got; i++)                                             \
+            v[done + i] = get(buf + i * sizeof(type));                        \
+        done += got;                                                          \
+        if (got < cnt)                                                        \
+            break;                                                            \
+    }                                                                         \
+    return done;                                                              \
+}
+
+S_WRITE_ARRAY(s_wl16_array, uint16_t, put_le16)
+S_WRITE_ARRAY(s_wl32_array, uint32_t, put_le32)
+S_WRITE_ARRAY(s_wl64_array, uint64_t, put_le64)
+S_WRITE_ARRAY(s_wb16_array, uint16_t, put_be16)
+S_WRITE_ARRAY(s_wb32_array, uint32_t, put_be32)
+S_WRITE_ARRAY(s_wb64_array, uint64_t, put_be64)
+
+S_READ_ARRAY(s_rl16_array, uint16_t, get_le16)
+S_READ_ARRAY(s_rl32_array, uint32_t, get_le32)
+S_READ_ARRAY(s_rl64_array, uint64_t, get_le64)
+S_READ_ARRAY(s_rb16_array, uint16_t, get_be16)
+S_READ_ARRAY(s_rb32_array, uint32_t, get_be32)
+S_READ_ARRAY(s_rb64_array, uint64_t, get_be64)
+
+bool s_r8(struct serializer *s, uint8_t *u8)
+{
+    return s_read(s, u8, 1) == 1;
 }
+
+#define S_READ_ONE(name, type, len, expr)                                     \
+bool name(struct serializer *s, type *v)                                      \
+{                                                                             \
+    uint8_t b[8];                                                             \
+    if (s_read(s, b, len) != len)                                             \
+        return false;                                                         \
+    *v = expr;                                                                \
+    return true;                                                              \
+}
+
+S_READ_ONE(s_rl16, uint16_t, 2, get_le16(b))
+S_READ_ONE(s_rl24, uint32_t, 3, (uint32_t)get_le16(b) | ((uint32_t)b[2] << 16))
+S_READ_ONE(s_rl32, uint32_t, 4, get_le32(b))
+S_READ_ONE(s_rl64, uint64_t, 8, get_le64(b))
+S_READ_ONE(s_rb16, uint16_t, 2, get_be16(b))
+S_READ_ONE(s_rb24, uint32_t, 3, ((uint32_t)get_be16(b) << 8) | b[2])
+S_READ_ONE(s_rb32, uint32_t, 4, get_be32(b))
+S_READ_ONE(s_rb64, uint64_t, 8, get_be64(b))
@@ -41,9 +41,46 @@ GEAR_API void serializer_array_deinit(struct serializer *s);
 GEAR_API int serializer_array_get_data(struct serializer *s, uint8_t **output, size_t *size);
 GEAR_API void serializer_array_reset(struct serializer *s);
 
+/*
+ * iovec serializer for writev/sendmsg, s_write copies into chunks of
+ * chunk_size, serializer_iovec_ref appends caller buffer without copy,
+ * the buffer must be valid until data is sent
+ */
+GEAR_API int serializer_iovec_init(struct serializer *s, size_t chunk_size);
+GEAR_API void serializer_iovec_deinit(struct serializer *s);
+GEAR_API int serializer_iovec_ref(struct serializer *s, const void *data, size_t size);
+GEAR_API int serializer_iovec_get_data(struct serializer *s, struct iovec **iov, int *iovcnt);
+GEAR_API void serializer_iovec_reset(struct serializer *s);
+
+/* read from memory buffer, data must be valid until deinit */
+GEAR_API int serializer_mem_init(struct serializer *s, const void *data, size_t size);
+GEAR_API void serializer_mem_deinit(struct serializer *s);
+
+/* read from file */
 GEAR_API int serializer_file_init(struct serializer *s, const char *path);
 GEAR_API void serializer_file_deinit(struct serializer *s);
 
+/*
+ * buffered file writer, s_wxx copy into a block of block_size (default
+ * 256KB, rounded up to 4KB), the file is written one full block at a time.
+ * direct opens with O_DIRECT when the filesystem allows it. with submit
+ * (workq_pool_task_push fits, ctx is the pool) full blocks are written in
+ * background while writing goes on into a second block
+ */
+struct serializer_file_opt {
+    size_t block_size;
+    bool direct;
+    int (*submit)(void *ctx, void (*func)(void *), void *arg);
+    void *submit_ctx;
+};
+
+GEAR_API int serializer_file_open(struct serializer *s, const char *path,
+                const struct serializer_file_opt *opt);
+/* write out buffered tail, data stays buffered for aligned block writes */
+GEAR_API int serializer_file_flush(struct serializer *s);
+/* flush, close and return -1 if any write failed */
+GEAR_API int serializer_file_close(struct serializer *s);
+
 GEAR_API size_t s_read(struct serializer *s, void *data, size_t size);
 GEAR_API size_t s_write(struct serializer *s, const void *data, size_t size);
 GEAR_API size_t s_getpos(struct serializer *s);
@@ -62,6 +99,33 @@ GEAR_API void s_wb64(struct serializer *s, uint64_t u64);
 GEAR_API void s_wbf(struct serializer *s, float f);
 GEAR_API void s_wbd(struct serializer *s, double d);
 
+/* bulk writers, return count of elements written */
+GEAR_API size_t s_wl16_array(struct serializer *s, const uint16_t *v, size_t n);
+GEAR_API size_t s_wl32_array(struct serializer *s, const uint32_t *v, size_t n);
+GEAR_API size_t s_wl64_array(struct serializer *s, const uint64_t *v, size_t n);
+GEAR_API size_t s_wb16_array(struct serializer *s, const uint16_t *v, size_t n);
+GEAR_API size_t s_wb32_array(struct serializer *s, const uint32_t *v, size_t n);
+GEAR_API size_t s_wb64_array(struct serializer *s, const uint64_t *v, size_t n);
+
+/* readers return false on short read */
+GEAR_API bool s_r8(struct serializer *s, uint8_t *u8);
+GEAR_API bool s_rl16(struct serializer *s, uint16_t *u16);
+GEAR_API bool s_rl24(struct serializer *s, uint32_t *u24);
+GEAR_API bool s_rl32(struct serializer *s, uint32_t *u32);
+GEAR_API bool s_rl64(struct serializer *s, uint64_t *u64);
+GEAR_API bool s_rb16(struct serializer *s, uint16_t *u16);
+GEAR_API bool s_rb24(struct serializer *s, uint32_t *u24);
+GEAR_API bool s_rb32(struct serializer *s, uint32_t *u32);
+GEAR_API bool s_rb64(struct serializer *s, uint64_t *u64);
+
+/* bulk readers, return count of elements read */
+GEAR_API size_t s_rl16_array(struct serializer *s, uint16_t *v, size_t n);
+GEAR_API size_t s_rl32_array(struct serializer *s, uint32_t *v, size_t n);
+GEAR_API size_t s_rl64_array(struct serializer *s, uint64_t *v, size_t n);
+GEAR_API size_t s_rb16_array(struct serializer *s, uint16_t *v, size_t n);
+GEAR_API size_t s_rb32_array(struct serializer *s, uint32_t *v, size_t n);
+GEAR_API size_t s_rb64_array(struct serializer *s, uint64_t *v, size_t n);
+
 #ifdef __cplusplus
 }
 #endif
@@ -21,6 +21,7 @@
  ******************************************************************************/
 #include "libdarray.h"
 #include "libserializer.h"
+#include "libdstring.h"
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -37,11 +38,184 @@ static int foo()
 }
 
 
+static int foo_iovec()
+{
+    int iovcnt, i;
+    struct iovec *iov;
+    struct serializer ss, *s = &ss;
+    static const char payload[] = "payload sent without copy";
+
+    serializer_iovec_init(s, 16);
+    s_w8(s, 0x09);          /* tag type */
+    s_wb24(s, sizeof(payload));
+    s_wb32(s, 0);
+    serializer_iovec_ref(s, payload, sizeof(payload));
+    s_wb32(s, sizeof(payload) + 8);
+    serializer_iovec_get_data(s, &iov, &iovcnt);
+    printf("iovec total=%zu iovcnt=%d\n", s_getpos(s), iovcnt);
+    for (i = 0; i < iovcnt; i++) {
+        printf("  iov[%d] len=%zu\n", i, iov[i].iov_len);
+    }
+    serializer_iovec_deinit(s);
+    return 0;
+}
+
+static int foo_endian()
+{
+    int i;
+    uint8_t *out;
+    size_t size;
+    uint8_t u8;
+    uint32_t u32, in[256], back[256];
+    struct serializer ws, rs;
+
+    for (i = 0; i < 256; i++) {
+        in[i] = (uint32_t)i * 0x01010101;
+    }
+    serializer_array_init(&ws);
+    s_wb24(&ws, 0x123456);
+    s_wb32_array(&ws, in, 256);
+    serializer_array_get_data(&ws, &out, &size);
+
+    serializer_mem_init(&rs, out, size);
+    s_rb24(&rs, &u32);
+    s_rb32_array(&rs, back, 256);
+    printf("endian size=%zu u24=%x array %s, read more=%d\n", size, u32,
+           memcmp(in, back, sizeof(in)) ? "mismatch" : "match", s_r8(&rs, &u8));
+    serializer_mem_deinit(&rs);
+    serializer_array_deinit(&ws);
+    return 0;
+}
+
+static int foo_file()
+{
+    int i, ok = 1;
+    uint32_t u32;
+    size_t pos;
+    struct serializer ws, rs;
+    struct serializer_file_opt opt = {0};
+    const char *path = "test_serializer.bin";
+
+    opt.block_size = 4096;
+    if (serializer_file_open(&ws, path, &opt)) {
+        printf("serializer_file_open failed!\n");
+        return -1;
+    }
+    for (i = 0; i < 3000; i++) {
+        s_wb32(&ws, i);
+    }
+    serializer_file_flush(&ws);
+    pos = s_getpos(&ws);
+    s_wb32(&ws, 0xdeadbeef);
+    serializer_file_close(&ws);
+
+    serializer_file_init(&rs, path);
+    for (i = 0; i < 3000; i++) {
+        if (!s_rb32(&rs, &u32) || u32 != (uint32_t)i) {
+            ok = 0;
+        }
+    }
+    s_rb32(&rs, &u32);
+    printf("file pos=%zu last=%x %s\n", pos, u32, ok ? "match" : "mismatch");
+    serializer_file_deinit(&rs);
+    remove(path);
+    return 0;
+}
+
+static int foo_dstr()
+{
+    int same;
+    char key[16];
+    struct dstr heap;
+    DSTR_SSO(16) name;
+
+    dstr_init_sso(&name);
+    dstr_copy(&name.str, "short");
+    printf("dstr %s inline=%d\n", name.str.array, dstr_inline(&name.str));
+    dstr_cat(&name.str, " string grows out of inline buffer");
+    printf("dstr %s inline=%d\n", name.str.array, dstr_inline(&name.str));
+    dstr_init(&heap);
+    dstr_move(&heap, &name.str);
+    dstr_copy(&name.str, "again");
+    printf("dstr %s inline=%d, moved len=%zu\n", name.str.array,
+           dstr_inline(&name.str), heap.len);
+    dstr_free(&heap);
+    dstr_free(&name.str);
+
+    snprintf(key, sizeof(key), "%s", "video");
+    same = str_intern(key) == str_intern("video");
+    printf("intern same=%d count=%zu\n", same, str_intern_count());
+    str_intern_cleanup();
+    return 0;
+}
+
+static int foo_sbo()
+{
+    int j;
+    DARRAY(int) h;
+    DARRAY_SBO(int, 8) v;
+    da_init_sbo(v);
+    for (j = 0; j < 8; j++) {
+        da_push_back(v, &j);
+    }
+    printf("sbo inline=%d num=%zu\n", v.array == v.sbo_buf, v.num);
+    for (j = 8; j < 20; j++) {
+        da_push_back(v, &j);
+    }
+    printf("sbo inline=%d num=%zu capacity=%zu\n", v.array == v.sbo_buf,
+           v.num, v.capacity);
+    da_init(h);
+    da_move(h, v);
+    printf("moved num=%zu last=%d, sbo inline=%d\n", h.num, h.array[h.num - 1],
+           v.array == v.sbo_buf);
+    da_resize_uninit(v, 4);
+    da_free(v);
+    da_free(h);
+    return 0;
+}
+
+/* count reallocs of 1000 pushes by default and 1.5x growth */
+static int foo_growth()
+{
+    int j, err = 0;
+    int grows[2] = {0, 0};
+    unsigned int pct[2] = {0, 150};
+    size_t cap, k;
+    DARRAY(int) v;
+    for (k = 0; k < 2; k++) {
+        da_init(v);
+        da_set_growth(v, pct[k]);
+        for (j = 0; j < 1000; j++) {
+            cap = v.capacity;
+            da_push_back(v, &j);
+            if (v.capacity != cap) {
+                grows[k]++;
+                if (cap >= 100 && v.capacity != cap + cap * (pct[k] ? pct[k] - 100 : 100) / 100) {
+                    err++;
+                }
+            }
+        }
+        if (v.num != 1000 || v.array[999] != 999) {
+            err++;
+        }
+        da_free(v);
+    }
+    printf("growth 2x: %d reallocs, 1.5x: %d reallocs, %d error\n",
+           grows[0], grows[1], err);
+    return err;
+}
+
 int main(int argc, char **argv)
 {
     int j;
     DARRAY(int) i;
     foo();
+    foo_sbo();
+    foo_growth();
+    foo_dstr();
+    foo_iovec();
+    foo_endian();
+    foo_file();
     da_init(i);
     for (j = 0; j < 10; j++) {
         da_push_back(i, &j);
@@ -11,6 +11,6 @@ LIBRARIES_DIR	:= $(LOCAL_PATH)/../
 LOCAL_C_INCLUDES := $(LOCAL_PATH)
 
 # Add your application source files here...
-LOCAL_SRC_FILES := libdebug.c
+LOCAL_SRC_FILES := libdebug.c profiler.c
 
 include $(BUILD_SHARED_LIBRARY)
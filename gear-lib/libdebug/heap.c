@@ -0,0 +1,610 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#ifndef __cplusplus
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <time.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#if defined(__linux__) && !defined(__UCLIBC__)
+#include <execinfo.h>
+#include <dlfcn.h>
+#define HEAP_SUPPORT
+#endif
+
+#include "libdebug.h"
+
+/*
+ * sampled heap profiler, this file is built alone as libdebug_heap and
+ * interposes malloc family like HOOK_CALL of libplugin: the next symbol is
+ * resolved by dlsym(RTLD_NEXT). a thread samples one allocation every
+ * ~rate bytes, only sampled objects are tracked so free of an unsampled
+ * pointer costs one lock-free probe when anything is live
+ */
+#if defined(HEAP_SUPPORT)
+
+#define HEAP_MAX_DEPTH      32
+#define HEAP_SKIP_FRAMES    3       /* heap_sample, heap_account, malloc */
+#define HEAP_SITE_MAX       8192    /* power of 2 */
+#define HEAP_OBJ_MAX        (1 << 18)
+#define HEAP_BOOT_SIZE      (16 * 1024)
+#define HEAP_RATE_DEFAULT   (512 * 1024)
+#define HEAP_MIN(a, b)      ((a) < (b) ? (a) : (b))
+#define HEAP_TLS            __thread __attribute__((tls_model("initial-exec")))
+
+struct heap_site {
+    uint64_t hash;
+    int depth;
+    void *pc[HEAP_MAX_DEPTH];
+    uint64_t alloc_count;
+    uint64_t alloc_bytes;
+    int64_t live_count;
+    int64_t live_bytes;
+};
+
+struct heap_obj {
+    uintptr_t ptr;                  /* 0 empty, published last */
+    uint32_t site;
+    uint64_t weight;
+};
+
+static struct {
+    void *(*malloc)(size_t);
+    void (*free)(void *);
+    void *(*calloc)(size_t, size_t);
+    void *(*realloc)(void *, size_t);
+    int (*posix_memalign)(void **, size_t, size_t);
+    void *(*aligned_alloc)(size_t, size_t);
+    void *(*memalign)(size_t, size_t);
+    int resolving;
+    int on;
+    size_t rate;
+    int lock;                       /* spin, taken on sampled path only */
+    uint32_t seq;                   /* odd while obj table entries move */
+    uint64_t live_objs;
+    uint64_t sampled;
+    uint64_t dropped;
+    uint32_t site_count;
+    int signo;
+    int pipe[2];
+    pthread_t dumper;
+    char prefix[256];
+    int dump_seq;
+} heap;
+
+static struct heap_site heap_sites[HEAP_SITE_MAX];
+static struct heap_obj heap_objs[HEAP_OBJ_MAX];
+
+/* dlsym may calloc before real allocator is known */
+static char heap_boot[HEAP_BOOT_SIZE] __attribute__((aligned(16)));
+static size_t heap_boot_used;
+
+static HEAP_TLS int64_t heap_left;
+static HEAP_TLS uint64_t heap_rand;
+static HEAP_TLS int heap_busy;      /* no sampling inside ourselves */
+
+static void *heap_boot_alloc(size_t size)
+{
+    void *p;
+    size = (size + 15) & ~(size_t)15;
+    if (heap_boot_used + size > HEAP_BOOT_SIZE) {
+        return NULL;
+    }
+    p = heap_boot + heap_boot_used;
+    heap_boot_used += size;
+    return p;
+}
+
+static inline bool heap_is_boot(void *p)
+{
+    return (char *)p >= heap_boot && (char *)p < heap_boot + HEAP_BOOT_SIZE;
+}
+
+static void heap_resolve(void)
+{
+    heap.resolving = 1;
+    heap.malloc = dlsym(RTLD_NEXT, "malloc");
+    heap.free = dlsym(RTLD_NEXT, "free");
+    heap.calloc = dlsym(RTLD_NEXT, "calloc");
+    heap.realloc = dlsym(RTLD_NEXT, "realloc");
+    heap.posix_memalign = dlsym(RTLD_NEXT, "posix_memalign");
+    heap.aligned_alloc = dlsym(RTLD_NEXT, "aligned_alloc");
+    heap.memalign = dlsym(RTLD_NEXT, "memalign");
+    heap.resolving = 0;
+}
+
+static inline void heap_spin_lock(void)
+{
+    while (__atomic_exchange_n(&heap.lock, 1, __ATOMIC_ACQUIRE)) {
+        while (__atomic_load_n(&heap.lock, __ATOMIC_RELAXED)) {
+        }
+    }
+}
+
+static inline void heap_spin_unlock(void)
+{
+    __atomic_store_n(&heap.lock, 0, __ATOMIC_RELEASE);
+}
+
+static inline size_t heap_ptr_hash(uintptr_t p)
+{
+    return (size_t)((p >> 4) * 0x9E3779B97F4A7C15ULL >> 40) & (HEAP_OBJ_MAX - 1);
+}
+
+/* randomized interval with mean rate so periodic patterns are not missed */
+static int64_t heap_next_interval(void)
+{
+    uint64_t x = heap_rand;
+    if (!x) {
+        x = (uintptr_t)&heap_rand ^ (uint64_t)time(NULL) ^ 0x2545F4914F6CDD1DULL;
+    }
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    heap_rand = x;
+    return 1 + (int64_t)(x % (2 * heap.rate));
+}
+
+static int heap_obj_find(uintptr_t p)
+{
+    size_t n, i = heap_ptr_hash(p);
+    uintptr_t k;
+    for (n = 0; n < HEAP_OBJ_MAX; n++, i = (i + 1) & (HEAP_OBJ_MAX - 1)) {
+        k = __atomic_load_n(&heap_objs[i].ptr, __ATOMIC_ACQUIRE);
+        if (k == p) {
+            return (int)i;
+        }
+        if (!k) {
+            break;
+        }
+    }
+    return -1;
+}
+
+/* linear probing delete by backward shift, under heap.lock */
+static void heap_obj_delete(size_t i)
+{
+    size_t j = i, home;
+    uintptr_t k;
+    __atomic_store_n(&heap.seq, heap.seq + 1, __ATOMIC_RELEASE);
+    for (;;) {
+        j = (j + 1) & (HEAP_OBJ_MAX - 1);
+        k = heap_objs[j].ptr;
+        if (!k) {
+            break;
+        }
+        home = heap_ptr_hash(k);
+        if ((j > i && (home <= i || home > j)) ||
+            (j < i && (home <= i && home > j))) {
+            heap_objs[i].site = heap_objs[j].site;
+            heap_objs[i].weight = heap_objs[j].weight;
+            __atomic_store_n(&heap_objs[i].ptr, k, __ATOMIC_RELEASE);
+            i = j;
+        }
+    }
+    __atomic_store_n(&heap_objs[i].ptr, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&heap.seq, heap.seq + 1, __ATOMIC_RELEASE);
+}
+
+static uint32_t heap_site_get(void **pc, int depth)
+{
+    int i;
+    uint64_t h = 1469598103934665603ULL;
+    size_t idx, n;
+    struct heap_site *s;
+    for (i = 0; i < depth; i++) {
+        h = (h ^ (uintptr_t)pc[i]) * 1099511628211ULL;
+    }
+    h = h ? h : 1;
+    idx = h & (HEAP_SITE_MAX - 1);
+    for (n = 0; n < HEAP_SITE_MAX; n++, idx = (idx + 1) & (HEAP_SITE_MAX - 1)) {
+        s = &heap_sites[idx];
+        if (s->hash == h && s->depth == depth &&
+            !memcmp(s->pc, pc, depth * sizeof(void *))) {
+            return idx;
+        }
+        if (!s->hash) {
+            if (heap.site_count >= HEAP_SITE_MAX * 3 / 4) {
+                break;
+            }
+            memcpy(s->pc, pc, depth * sizeof(void *));
+            s->depth = depth;
+            __atomic_store_n(&s->hash, h, __ATOMIC_RELEASE);
+            heap.site_count++;
+            return idx;
+        }
+    }
+    return UINT32_MAX;
+}
+
+static __attribute__((noinline)) void heap_sample(void *p, size_t size)
+{
+    void *bt[HEAP_MAX_DEPTH + HEAP_SKIP_FRAMES];
+    int depth;
+    size_t i;
+    uint32_t site;
+    /* small objects stand for the rate bytes between two samples */
+    uint64_t weight = size < heap.rate ? heap.rate : size;
+
+    depth = backtrace(bt, HEAP_MAX_DEPTH + HEAP_SKIP_FRAMES) - HEAP_SKIP_FRAMES;
+    if (depth <= 0) {
+        return;
+    }
+    heap_spin_lock();
+    if (heap.live_objs >= HEAP_OBJ_MAX * 3 / 4 ||
+        UINT32_MAX == (site = heap_site_get(bt + HEAP_SKIP_FRAMES, depth))) {
+        heap.dropped++;
+        heap_spin_unlock();
+        return;
+    }
+    for (i = heap_ptr_hash((uintptr_t)p); heap_objs[i].ptr; i = (i + 1) & (HEAP_OBJ_MAX - 1)) {
+    }
+    heap_objs[i].site = site;
+    heap_objs[i].weight = weight;
+    __atomic_store_n(&heap_objs[i].ptr, (uintptr_t)p, __ATOMIC_RELEASE);
+    __atomic_store_n(&heap.live_objs, heap.live_objs + 1, __ATOMIC_RELEASE);
+    heap.sampled++;
+    __atomic_fetch_add(&heap_sites[site].alloc_count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&heap_sites[site].alloc_bytes, weight, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&heap_sites[site].live_count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&heap_sites[site].live_bytes, weight, __ATOMIC_RELAXED);
+    heap_spin_unlock();
+}
+
+static __attribute__((noinline)) void heap_account(void *p, size_t size)
+{
+    if (!p || heap_busy) {
+        return;
+    }
+    if (__builtin_expect(!heap_rand, 0)) {
+        heap_left = heap_next_interval();   /* first allocation of this thread */
+    }
+    heap_left -= (int64_t)size;
+    if (heap_left > 0) {
+        return;
+    }
+    heap_left = heap_next_interval();
+    heap_busy = 1;
+    heap_sample(p, size);
+    heap_busy = 0;
+}
+
+static void heap_untrack(void *p)
+{
+    int i;
+    uint32_t seq;
+    struct heap_obj *o;
+    for (;;) {
+        seq = __atomic_load_n(&heap.seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            continue;
+        }
+        i = heap_obj_find((uintptr_t)p);
+        if (i >= 0) {
+            break;
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (seq == __atomic_load_n(&heap.seq, __ATOMIC_RELAXED)) {
+            return;         /* not sampled, the common case */
+        }
+    }
+    heap_spin_lock();
+    i = heap_obj_find((uintptr_t)p);
+    if (i >= 0) {
+        o = &heap_objs[i];
+        __atomic_fetch_sub(&heap_sites[o->site].live_count, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_sub(&heap_sites[o->site].live_bytes, o->weight, __ATOMIC_RELAXED);
+        heap_obj_delete(i);
+        __atomic_store_n(&heap.live_objs, heap.live_objs - 1, __ATOMIC_RELEASE);
+    }
+    heap_spin_unlock();
+}
+
+static inline void heap_before_free(void *p)
+{
+    if (__atomic_load_n(&heap.live_objs, __ATOMIC_ACQUIRE)) {
+        heap_untrack(p);
+    }
+}
+
+void *malloc(size_t size)
+{
+    void *p;
+    if (__builtin_expect(!heap.malloc, 0)) {
+        if (heap.resolving) {
+            return heap_boot_alloc(size);
+        }
+        heap_resolve();
+    }
+    p = heap.malloc(size);
+    if (__atomic_load_n(&heap.on, __ATOMIC_RELAXED)) {
+        heap_account(p, size);
+    }
+    return p;
+}
+
+void free(void *p)
+{
+    if (!p || heap_is_boot(p)) {
+        return;
+    }
+    if (__builtin_expect(!heap.free, 0)) {
+        heap_resolve();
+    }
+    heap_before_free(p);
+    heap.free(p);
+}
+
+void *calloc(size_t n, size_t size)
+{
+    void *p;
+    if (__builtin_expect(!heap.calloc, 0)) {
+        if (heap.resolving) {
+            return heap_boot_alloc(n * size);   /* boot buffer is zeroed bss */
+        }
+        heap_resolve();
+    }
+    p = heap.calloc(n, size);
+    if (__atomic_load_n(&heap.on, __ATOMIC_RELAXED)) {
+        heap_account(p, n * size);
+    }
+    return p;
+}
+
+void *realloc(void *old, size_t size)
+{
+    void *p;
+    if (__builtin_expect(!heap.realloc, 0)) {
+        heap_resolve();
+    }
+    if (old && heap_is_boot(old)) {
+        p = malloc(size);
+        if (p) {
+            memcpy(p, old, HEAP_MIN(size, (size_t)(heap_boot + HEAP_BOOT_SIZE - (char *)old)));
+        }
+        return p;
+    }
+    if (old) {
+        heap_before_free(old);
+    }
+    p = heap.realloc(old, size);
+    if (__atomic_load_n(&heap.on, __ATOMIC_RELAXED)) {
+        heap_account(p, size);
+    }
+    return p;
+}
+
+int posix_memalign(void **pp, size_t align, size_t size)
+{
+    int ret;
+    if (__builtin_expect(!heap.posix_memalign, 0)) {
+        heap_resolve();
+    }
+    ret = heap.posix_memalign(pp, align, size);
+    if (!ret && __atomic_load_n(&heap.on, __ATOMIC_RELAXED)) {
+        heap_account(*pp, size);
+    }
+    return ret;
+}
+
+void *aligned_alloc(size_t align, size_t size)
+{
+    void *p;
+    if (__builtin_expect(!heap.aligned_alloc, 0)) {
+        heap_resolve();
+    }
+    p = heap.aligned_alloc(align, size);
+    if (__atomic_load_n(&heap.on, __ATOMIC_RELAXED)) {
+        heap_account(p, size);
+    }
+    return p;
+}
+
+void *memalign(size_t align, size_t size)
+{
+    void *p;
+    if (__builtin_expect(!heap.memalign, 0)) {
+        heap_resolve();
+    }
+    p = heap.memalign(align, size);
+    if (__atomic_load_n(&heap.on, __ATOMIC_RELAXED)) {
+        heap_account(p, size);
+    }
+    return p;
+}
+
+static void heap_frame_name(void *pc, bool leaf, char *buf, size_t len)
+{
+    Dl_info info;
+    const char *mod;
+    void *addr = leaf ? pc : (void *)((uintptr_t)pc - 1);
+    if (dladdr(addr, &info) && info.dli_sname) {
+        snprintf(buf, len, "%s", info.dli_sname);
+    } else if (dladdr(addr, &info) && info.dli_fname) {
+        mod = strrchr(info.dli_fname, '/');
+        snprintf(buf, len, "%s+0x%lx", mod ? mod + 1 : info.dli_fname,
+                 (unsigned long)((uintptr_t)addr - (uintptr_t)info.dli_fbase));
+    } else {
+        snprintf(buf, len, "%p", pc);
+    }
+}
+
+/* folded stacks of estimated live bytes, root first */
+int debug_heap_dump(const char *path)
+{
+    int i, j;
+    char name[256];
+    struct heap_site *s;
+    int64_t live;
+    FILE *fp;
+
+    heap_busy++;
+    fp = path ? fopen(path, "w") : stdout;
+    if (!fp) {
+        fprintf(stderr, "heap: open %s failed: %s\n", path, strerror(errno));
+        heap_busy--;
+        return -1;
+    }
+    for (i = 0; i < HEAP_SITE_MAX; i++) {
+        s = &heap_sites[i];
+        if (!__atomic_load_n(&s->hash, __ATOMIC_ACQUIRE)) {
+            continue;
+        }
+        live = __atomic_load_n(&s->live_bytes, __ATOMIC_RELAXED);
+        if (live <= 0) {
+            continue;
+        }
+        for (j = s->depth - 1; j >= 0; j--) {
+            heap_frame_name(s->pc[j], false, name, sizeof(name));
+            fprintf(fp, "%s%s", name, j ? ";" : "");
+        }
+        fprintf(fp, " %" PRId64 "\n", live);
+    }
+    if (path) {
+        fclose(fp);
+    }
+    heap_busy--;
+    return 0;
+}
+
+void debug_heap_get_stats(struct debug_heap_stats *st)
+{
+    int i;
+    if (!st) {
+        return;
+    }
+    memset(st, 0, sizeof(*st));
+    st->sampled = __atomic_load_n(&heap.sampled, __ATOMIC_RELAXED);
+    st->live_objs = __atomic_load_n(&heap.live_objs, __ATOMIC_RELAXED);
+    st->dropped = __atomic_load_n(&heap.dropped, __ATOMIC_RELAXED);
+    st->sites = __atomic_load_n(&heap.site_count, __ATOMIC_RELAXED);
+    for (i = 0; i < HEAP_SITE_MAX; i++) {
+        int64_t live = __atomic_load_n(&heap_sites[i].live_bytes, __ATOMIC_RELAXED);
+        st->live_bytes += live > 0 ? live : 0;
+    }
+}
+
+static void heap_signal(int signo)
+{
+    int saved = errno;
+    char c = 1;
+    if (write(heap.pipe[1], &c, 1) < 0) {
+    }
+    errno = saved;
+}
+
+/* signal handler only wakes this thread, stdio is not signal safe */
+static void *heap_dumper(void *arg)
+{
+    char c, path[320];
+    while (read(heap.pipe[0], &c, 1) == 1) {
+        snprintf(path, sizeof(path), "%s.%d.%d.heap", heap.prefix, getpid(), heap.dump_seq++);
+        if (0 == debug_heap_dump(path)) {
+            fprintf(stderr, "heap: dumped %s\n", path);
+        }
+    }
+    return NULL;
+}
+
+int debug_heap_start(size_t rate, int signo, const char *path_prefix)
+{
+    struct sigaction sa;
+    void *warm[4];
+    if (!heap.malloc) {
+        heap_resolve();
+    }
+    /* first backtrace() dlopens libgcc, do it before sampling is on */
+    heap_busy++;
+    backtrace(warm, 4);
+    heap_busy--;
+    heap.rate = rate ? rate : HEAP_RATE_DEFAULT;
+    snprintf(heap.prefix, sizeof(heap.prefix), "%s", path_prefix ? path_prefix : "heap");
+    if (signo && !heap.signo) {
+        if (pipe2(heap.pipe, O_CLOEXEC)) {
+            fprintf(stderr, "heap: pipe failed: %s\n", strerror(errno));
+            return -1;
+        }
+        if (pthread_create(&heap.dumper, NULL, heap_dumper, NULL)) {
+            fprintf(stderr, "heap: create dump thread failed!\n");
+            return -1;
+        }
+        pthread_detach(heap.dumper);
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = heap_signal;
+        sa.sa_flags = SA_RESTART;
+        sigemptyset(&sa.sa_mask);
+        sigaction(signo, &sa, NULL);
+        heap.signo = signo;
+    }
+    __atomic_store_n(&heap.on, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void debug_heap_stop(void)
+{
+    /* live samples are still untracked on free */
+    __atomic_store_n(&heap.on, 0, __ATOMIC_RELEASE);
+}
+
+/* LD_PRELOAD=libdebug_heap.so DEBUG_HEAP_RATE=524288 DEBUG_HEAP_SIGNAL=12 */
+__attribute__((constructor)) static void heap_init_from_env(void)
+{
+    const char *rate = getenv("DEBUG_HEAP_RATE");
+    const char *sig = getenv("DEBUG_HEAP_SIGNAL");
+    if (rate) {
+        debug_heap_start(strtoul(rate, NULL, 0), sig ? atoi(sig) : SIGUSR2,
+                         getenv("DEBUG_HEAP_PATH"));
+    }
+}
+
+#else
+int debug_heap_start(size_t rate, int signo, const char *path_prefix)
+{
+    fprintf(stderr, "%s not support!\n", __func__);
+    return -1;
+}
+
+void debug_heap_stop(void)
+{
+}
+
+int debug_heap_dump(const char *path)
+{
+    return -1;
+}
+
+void debug_heap_get_stats(struct debug_heap_stats *st)
+{
+    if (st) {
+        memset(st, 0, sizeof(*st));
+    }
+}
+#endif
@@ -22,6 +22,9 @@
 #ifndef LIBDEBUG_H
 #define LIBDEBUG_H
 
+#include <stdint.h>
+#include <stddef.h>
+
 #define LIBDEBUG_VERSION "0.1.0"
 
 #ifdef __cplusplus
@@ -47,6 +50,57 @@ void debug_backtrace_dump();
  */
 int debug_signals_init();
 
+
+/*! sampling cpu profiler, SIGPROF from a per-thread cpu time timer at hz.
+ * the calling thread is sampled, other threads call
+ * debug_profiler_thread_register() themselves. stacks go to a lock-free
+ * ring from the signal handler, dump drains it
+ */
+int debug_profiler_start(int hz);
+void debug_profiler_stop();
+int debug_profiler_thread_register();
+void debug_profiler_thread_unregister();
+
+
+/*! write folded stacks "main;foo;bar 42" for flamegraph.pl, NULL to stdout
+ *
+ */
+int debug_profiler_dump(const char *path);
+void debug_profiler_reset();
+
+
+/*! lock wait tracer, hook it to libthread by
+ * lock_set_wait_hook(debug_lock_trace_wait), waits shorter than
+ * min_wait_ns are ignored. dump weights are wait time in us
+ */
+int debug_lock_trace_start(uint64_t min_wait_ns);
+void debug_lock_trace_stop();
+void debug_lock_trace_wait(void *lock, uint64_t wait_ns);
+int debug_lock_trace_dump(const char *path);
+
+
+/*! sampled heap profiler, built alone as libdebug_heap.a/.so which
+ * interposes malloc/free/calloc/realloc, link it or LD_PRELOAD it with
+ * DEBUG_HEAP_RATE=<bytes> [DEBUG_HEAP_SIGNAL=<signo>] [DEBUG_HEAP_PATH=<prefix>].
+ * one allocation is sampled every rate bytes on average, estimated live
+ * bytes are kept per call site, signo dumps <prefix>.<pid>.<n>.heap
+ */
+struct debug_heap_stats {
+    uint64_t sampled;
+    uint64_t live_objs;     /* sampled objects not freed yet */
+    uint64_t live_bytes;    /* estimated */
+    uint64_t sites;
+    uint64_t dropped;       /* table full */
+};
+
+int debug_heap_start(size_t rate, int signo, const char *path_prefix);
+void debug_heap_stop();
+/*! folded stacks weighted by live bytes, NULL to stdout
+ *
+ */
+int debug_heap_dump(const char *path);
+void debug_heap_get_stats(struct debug_heap_stats *st);
+
 #ifdef __cplusplus
 }
 #endif
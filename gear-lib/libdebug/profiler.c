@@ -0,0 +1,584 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#ifndef __cplusplus
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#if defined(__linux__) && !defined(__UCLIBC__)
+#include <ucontext.h>
+#include <execinfo.h>
+#include <dlfcn.h>
+#include <sys/syscall.h>
+#define PROFILER_SUPPORT
+#endif
+
+#include "libdebug.h"
+
+#if defined(PROFILER_SUPPORT)
+
+#define PROF_MAX_DEPTH      64
+#define PROF_RING_SIZE      4096    /* power of 2 */
+#define PROF_MAX_THREADS    256
+#define PROF_TABLE_INIT     1024
+#define PROF_MIN(a, b)      ((a) < (b) ? (a) : (b))
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+enum prof_kind {
+    PROF_CPU = 0,
+    PROF_LOCK,
+};
+
+/* ring slot, seq is published last so the reader knows it is complete */
+struct prof_slot {
+    uint64_t seq;
+    uint64_t weight;
+    uint16_t kind;
+    uint16_t depth;
+    void *pc[PROF_MAX_DEPTH];
+};
+
+/* aggregate of identical stacks */
+struct prof_entry {
+    uint64_t hash;
+    uint64_t weight;
+    uint16_t kind;
+    uint16_t depth;
+    void **pc;
+};
+
+struct prof_thread {
+    pid_t tid;
+    timer_t timer;
+    bool used;
+};
+
+static struct {
+    struct prof_slot *ring;
+    uint64_t head;                  /* producers reserve with CAS */
+    uint64_t tail;                  /* consumer, under lock */
+    uint64_t dropped;
+    int cpu_on;
+    int lock_on;
+    uint64_t lock_min_ns;
+    long period_ns;
+    struct prof_thread threads[PROF_MAX_THREADS];
+    struct prof_entry *table;
+    size_t table_size;
+    size_t table_used;
+    pthread_mutex_t lock;           /* consumer side and thread registry */
+} prof = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static void *prof_uc_pc(ucontext_t *uc)
+{
+#if defined(__i386__)
+    return (void *)uc->uc_mcontext.gregs[REG_EIP];
+#elif defined(__x86_64__)
+    return (void *)uc->uc_mcontext.gregs[REG_RIP];
+#elif defined(__arm__)
+    return (void *)uc->uc_mcontext.arm_pc;
+#elif defined(__aarch64__)
+    return (void *)uc->uc_mcontext.pc;
+#else
+    return NULL;
+#endif
+}
+
+static int prof_ring_init(void)
+{
+    struct prof_slot *ring;
+    void *warm[4];
+    if (__atomic_load_n(&prof.ring, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+    /* first backtrace() loads libgcc, never let that happen in a handler */
+    backtrace(warm, 4);
+    ring = calloc(PROF_RING_SIZE, sizeof(struct prof_slot));
+    if (!ring) {
+        fprintf(stderr, "profiler: malloc ring failed!\n");
+        return -1;
+    }
+    __atomic_store_n(&prof.ring, ring, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/* async-signal-safe: no lock, no malloc */
+static void prof_ring_push(int kind, uint64_t weight, void **pc, int depth)
+{
+    struct prof_slot *s;
+    uint64_t pos = __atomic_load_n(&prof.head, __ATOMIC_RELAXED);
+    do {
+        if (pos - __atomic_load_n(&prof.tail, __ATOMIC_ACQUIRE) >= PROF_RING_SIZE) {
+            __atomic_fetch_add(&prof.dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+    } while (!__atomic_compare_exchange_n(&prof.head, &pos, pos + 1, true,
+                                          __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+    s = &prof.ring[pos & (PROF_RING_SIZE - 1)];
+    s->kind = kind;
+    s->weight = weight;
+    s->depth = depth;
+    memcpy(s->pc, pc, depth * sizeof(void *));
+    __atomic_store_n(&s->seq, pos + 1, __ATOMIC_RELEASE);
+}
+
+static uint64_t prof_hash(int kind, void **pc, int depth)
+{
+    int i;
+    uint64_t h = 1469598103934665603ULL ^ kind;
+    for (i = 0; i < depth; i++) {
+        h ^= (uintptr_t)pc[i];
+        h *= 1099511628211ULL;
+    }
+    return h ? h : 1;
+}
+
+static int prof_table_insert(int kind, uint64_t hash, uint64_t weight,
+                void **pc, int depth);
+
+static int prof_table_grow(void)
+{
+    size_t i, old_size = prof.table_size;
+    struct prof_entry *old = prof.table;
+    size_t size = old_size ? old_size * 2 : PROF_TABLE_INIT;
+    struct prof_entry *t = calloc(size, sizeof(struct prof_entry));
+    if (!t) {
+        return -1;
+    }
+    prof.table = t;
+    prof.table_size = size;
+    prof.table_used = 0;
+    for (i = 0; i < old_size; i++) {
+        if (old[i].hash) {
+            struct prof_entry *e = &old[i];
+            size_t j = e->hash & (size - 1);
+            while (t[j].hash) {
+                j = (j + 1) & (size - 1);
+            }
+            t[j] = *e;
+            prof.table_used++;
+        }
+    }
+    free(old);
+    return 0;
+}
+
+static int prof_table_insert(int kind, uint64_t hash, uint64_t weight,
+                void **pc, int depth)
+{
+    size_t i;
+    struct prof_entry *e;
+    if (prof.table_used * 2 >= prof.table_size && prof_table_grow()) {
+        return -1;
+    }
+    for (i = hash & (prof.table_size - 1); ; i = (i + 1) & (prof.table_size - 1)) {
+        e = &prof.table[i];
+        if (!e->hash) {
+            break;
+        }
+        if (e->hash == hash && e->kind == kind && e->depth == depth &&
+            !memcmp(e->pc, pc, depth * sizeof(void *))) {
+            e->weight += weight;
+            return 0;
+        }
+    }
+    e->pc = malloc(depth * sizeof(void *));
+    if (!e->pc) {
+        return -1;
+    }
+    memcpy(e->pc, pc, depth * sizeof(void *));
+    e->hash = hash;
+    e->kind = kind;
+    e->depth = depth;
+    e->weight = weight;
+    prof.table_used++;
+    return 0;
+}
+
+/* move published samples from ring into table, called with prof.lock */
+static void prof_drain(void)
+{
+    struct prof_slot *s;
+    uint64_t tail = prof.tail;
+    if (!prof.ring) {
+        return;
+    }
+    while (tail != __atomic_load_n(&prof.head, __ATOMIC_ACQUIRE)) {
+        s = &prof.ring[tail & (PROF_RING_SIZE - 1)];
+        if (__atomic_load_n(&s->seq, __ATOMIC_ACQUIRE) != tail + 1) {
+            break;      /* reserved but not written yet */
+        }
+        prof_table_insert(s->kind, prof_hash(s->kind, s->pc, s->depth),
+                          s->weight, s->pc, s->depth);
+        tail++;
+        __atomic_store_n(&prof.tail, tail, __ATOMIC_RELEASE);
+    }
+}
+
+static void prof_frame_name(void *pc, bool leaf, char *buf, size_t len)
+{
+    Dl_info info;
+    const char *mod;
+    /* return address points after the call, look up the call itself */
+    void *addr = leaf ? pc : (void *)((uintptr_t)pc - 1);
+    if (dladdr(addr, &info) && info.dli_sname) {
+        snprintf(buf, len, "%s", info.dli_sname);
+    } else if (dladdr(addr, &info) && info.dli_fname) {
+        mod = strrchr(info.dli_fname, '/');
+        snprintf(buf, len, "%s+0x%lx", mod ? mod + 1 : info.dli_fname,
+                 (unsigned long)((uintptr_t)addr - (uintptr_t)info.dli_fbase));
+    } else {
+        snprintf(buf, len, "%p", pc);
+    }
+}
+
+struct prof_line {
+    char *stack;
+    uint64_t weight;
+};
+
+static int prof_line_cmp(const void *a, const void *b)
+{
+    return strcmp(((const struct prof_line *)a)->stack,
+                  ((const struct prof_line *)b)->stack);
+}
+
+/* symbolized stack, root first: "main;foo;bar" */
+static char *prof_stack_str(const struct prof_entry *e)
+{
+    int j;
+    char name[256];
+    size_t len = 0, cap = 256;
+    char *str = malloc(cap), *tmp;
+    if (!str) {
+        return NULL;
+    }
+    str[0] = '\0';
+    for (j = e->depth - 1; j >= 0; j--) {
+        if (e->kind == PROF_LOCK && j == 0) {
+            snprintf(name, sizeof(name), "lock@%p", e->pc[0]);
+        } else {
+            prof_frame_name(e->pc[j], j == 0, name, sizeof(name));
+        }
+        while (len + strlen(name) + 2 > cap) {
+            cap *= 2;
+            if (NULL == (tmp = realloc(str, cap))) {
+                free(str);
+                return NULL;
+            }
+            str = tmp;
+        }
+        len += sprintf(str + len, "%s%s", name, j ? ";" : "");
+    }
+    return str;
+}
+
+/* folded stacks, pcs in the same function merge into one line */
+static int prof_dump(int kind, const char *path, uint64_t div)
+{
+    size_t i, n = 0;
+    struct prof_line *lines;
+    struct prof_entry *e;
+    uint64_t w;
+    FILE *fp = path ? fopen(path, "w") : stdout;
+    if (!fp) {
+        fprintf(stderr, "profiler: open %s failed: %s\n", path, strerror(errno));
+        return -1;
+    }
+    pthread_mutex_lock(&prof.lock);
+    prof_drain();
+    lines = calloc(prof.table_used + 1, sizeof(struct prof_line));
+    for (i = 0; lines && i < prof.table_size; i++) {
+        e = &prof.table[i];
+        if (!e->hash || e->kind != kind) {
+            continue;
+        }
+        if (NULL != (lines[n].stack = prof_stack_str(e))) {
+            lines[n++].weight = e->weight;
+        }
+    }
+    if (__atomic_load_n(&prof.dropped, __ATOMIC_RELAXED)) {
+        fprintf(stderr, "profiler: %" PRIu64 " samples dropped, dump more often\n",
+                __atomic_load_n(&prof.dropped, __ATOMIC_RELAXED));
+    }
+    pthread_mutex_unlock(&prof.lock);
+    if (lines) {
+        qsort(lines, n, sizeof(struct prof_line), prof_line_cmp);
+        for (i = 0; i < n; i++) {
+            w = lines[i].weight;
+            while (i + 1 < n && !strcmp(lines[i].stack, lines[i+1].stack)) {
+                free(lines[i].stack);
+                w += lines[++i].weight;
+            }
+            if (w / div) {
+                fprintf(fp, "%s %" PRIu64 "\n", lines[i].stack, w / div);
+            }
+            free(lines[i].stack);
+        }
+        free(lines);
+    }
+    if (path) {
+        fclose(fp);
+    }
+    return 0;
+}
+
+static void prof_sigprof(int sig, siginfo_t *info, void *ucontext)
+{
+    void *bt[PROF_MAX_DEPTH + 3];
+    void *pc;
+    int i, n, start = 2, saved = errno;
+
+    if (!__atomic_load_n(&prof.cpu_on, __ATOMIC_RELAXED)) {
+        return;
+    }
+    n = backtrace(bt, PROF_MAX_DEPTH + 3);
+    /* skip handler and signal trampoline, start at interrupted pc */
+    pc = prof_uc_pc((ucontext_t *)ucontext);
+    for (i = 0; i < n && i < 4; i++) {
+        if (bt[i] == pc) {
+            start = i;
+            break;
+        }
+    }
+    if (start < n) {
+        bt[start] = pc ? pc : bt[start];
+        n = PROF_MIN(n - start, PROF_MAX_DEPTH);
+        prof_ring_push(PROF_CPU, 1, bt + start, n);
+    }
+    errno = saved;
+}
+
+int debug_profiler_thread_register(void)
+{
+    int i;
+    struct sigevent sev;
+    struct itimerspec its;
+    struct prof_thread *t = NULL;
+    pid_t tid = (pid_t)syscall(SYS_gettid);
+
+    if (!prof.period_ns) {
+        fprintf(stderr, "profiler: call debug_profiler_start first!\n");
+        return -1;
+    }
+    pthread_mutex_lock(&prof.lock);
+    for (i = 0; i < PROF_MAX_THREADS; i++) {
+        if (prof.threads[i].used && prof.threads[i].tid == tid) {
+            pthread_mutex_unlock(&prof.lock);
+            return 0;
+        }
+        if (!t && !prof.threads[i].used) {
+            t = &prof.threads[i];
+        }
+    }
+    if (!t) {
+        pthread_mutex_unlock(&prof.lock);
+        fprintf(stderr, "profiler: too many threads!\n");
+        return -1;
+    }
+    /* thread cpu clock, so idle threads cost nothing and samples are per cpu time */
+    memset(&sev, 0, sizeof(sev));
+    sev.sigev_notify = SIGEV_THREAD_ID;
+    sev.sigev_signo = SIGPROF;
+    sev.sigev_notify_thread_id = tid;
+    if (timer_create(CLOCK_THREAD_CPUTIME_ID, &sev, &t->timer)) {
+        pthread_mutex_unlock(&prof.lock);
+        fprintf(stderr, "profiler: timer_create failed: %s\n", strerror(errno));
+        return -1;
+    }
+    its.it_interval.tv_sec = prof.period_ns / 1000000000L;
+    its.it_interval.tv_nsec = prof.period_ns % 1000000000L;
+    its.it_value = its.it_interval;
+    timer_settime(t->timer, 0, &its, NULL);
+    t->tid = tid;
+    t->used = true;
+    pthread_mutex_unlock(&prof.lock);
+    return 0;
+}
+
+void debug_profiler_thread_unregister(void)
+{
+    int i;
+    pid_t tid = (pid_t)syscall(SYS_gettid);
+    pthread_mutex_lock(&prof.lock);
+    for (i = 0; i < PROF_MAX_THREADS; i++) {
+        if (prof.threads[i].used && prof.threads[i].tid == tid) {
+            timer_delete(prof.threads[i].timer);
+            prof.threads[i].used = false;
+        }
+    }
+    pthread_mutex_unlock(&prof.lock);
+}
+
+int debug_profiler_start(int hz)
+{
+    struct sigaction sa;
+    if (hz <= 0 || hz > 10000) {
+        fprintf(stderr, "profiler: invalid hz %d\n", hz);
+        return -1;
+    }
+    if (prof_ring_init()) {
+        return -1;
+    }
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = prof_sigprof;
+    sa.sa_flags = SA_RESTART | SA_SIGINFO;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGPROF, &sa, NULL)) {
+        fprintf(stderr, "profiler: sigaction failed: %s\n", strerror(errno));
+        return -1;
+    }
+    prof.period_ns = 1000000000L / hz;
+    __atomic_store_n(&prof.cpu_on, 1, __ATOMIC_RELEASE);
+    return debug_profiler_thread_register();
+}
+
+void debug_profiler_stop(void)
+{
+    int i;
+    __atomic_store_n(&prof.cpu_on, 0, __ATOMIC_RELEASE);
+    pthread_mutex_lock(&prof.lock);
+    for (i = 0; i < PROF_MAX_THREADS; i++) {
+        if (prof.threads[i].used) {
+            timer_delete(prof.threads[i].timer);
+            prof.threads[i].used = false;
+        }
+    }
+    pthread_mutex_unlock(&prof.lock);
+}
+
+int debug_profiler_dump(const char *path)
+{
+    return prof_dump(PROF_CPU, path, 1);
+}
+
+void debug_profiler_reset(void)
+{
+    size_t i;
+    pthread_mutex_lock(&prof.lock);
+    prof_drain();
+    for (i = 0; i < prof.table_size; i++) {
+        free(prof.table[i].pc);
+    }
+    free(prof.table);
+    prof.table = NULL;
+    prof.table_size = 0;
+    prof.table_used = 0;
+    __atomic_store_n(&prof.dropped, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&prof.lock);
+}
+
+int debug_lock_trace_start(uint64_t min_wait_ns)
+{
+    if (prof_ring_init()) {
+        return -1;
+    }
+    prof.lock_min_ns = min_wait_ns;
+    __atomic_store_n(&prof.lock_on, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void debug_lock_trace_stop(void)
+{
+    __atomic_store_n(&prof.lock_on, 0, __ATOMIC_RELEASE);
+}
+
+void debug_lock_trace_wait(void *lock, uint64_t wait_ns)
+{
+    void *bt[PROF_MAX_DEPTH + 1];
+    int n;
+    if (!__atomic_load_n(&prof.lock_on, __ATOMIC_RELAXED) || wait_ns < prof.lock_min_ns) {
+        return;
+    }
+    /* bt[0] is this function, keep lock address as the leaf instead */
+    n = backtrace(bt, PROF_MAX_DEPTH + 1);
+    bt[0] = lock;
+    prof_ring_push(PROF_LOCK, wait_ns, bt, PROF_MIN(n, PROF_MAX_DEPTH));
+}
+
+int debug_lock_trace_dump(const char *path)
+{
+    return prof_dump(PROF_LOCK, path, 1000);
+}
+
+#else
+int debug_profiler_start(int hz)
+{
+    fprintf(stderr, "%s not support!\n", __func__);
+    return -1;
+}
+
+void debug_profiler_stop(void)
+{
+}
+
+int debug_profiler_thread_register(void)
+{
+    return -1;
+}
+
+void debug_profiler_thread_unregister(void)
+{
+}
+
+int debug_profiler_dump(const char *path)
+{
+    return -1;
+}
+
+void debug_profiler_reset(void)
+{
+}
+
+int debug_lock_trace_start(uint64_t min_wait_ns)
+{
+    fprintf(stderr, "%s not support!\n", __func__);
+    return -1;
+}
+
+void debug_lock_trace_stop(void)
+{
+}
+
+void debug_lock_trace_wait(void *lock, uint64_t wait_ns)
+{
+}
+
+int debug_lock_trace_dump(const char *path)
+{
+    return -1;
+}
+#endif
@@ -21,6 +21,11 @@
  ******************************************************************************/
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <signal.h>
+#include <inttypes.h>
 #include "libdebug.h"
 
 static void foo(void)
@@ -42,8 +47,122 @@ static void foo3(void)
     foo2();
 }
 
+static volatile uint64_t sink;
+static pthread_mutex_t mtx = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void burn_inner(void)
+{
+    int i;
+    for (i = 0; i < 1000; i++) {
+        sink += i * i;
+    }
+}
+
+void burn(uint64_t ms)
+{
+    uint64_t end = now_ns() + ms * 1000000;
+    while (now_ns() < end) {
+        burn_inner();
+    }
+}
+
+/* what lock_set_wait_hook does inside libthread */
+void locked_work(void)
+{
+    uint64_t start = now_ns();
+    pthread_mutex_lock(&mtx);
+    debug_lock_trace_wait(&mtx, now_ns() - start);
+    burn(5);
+    pthread_mutex_unlock(&mtx);
+}
+
+void *worker(void *arg)
+{
+    int i;
+    debug_profiler_thread_register();
+    for (i = 0; i < 40; i++) {
+        locked_work();
+    }
+    debug_profiler_thread_unregister();
+    return NULL;
+}
+
+static void prof_test(void)
+{
+    int i;
+    pthread_t tid[2];
+    debug_profiler_start(997);
+    debug_lock_trace_start(0);
+    for (i = 0; i < 2; i++) {
+        pthread_create(&tid[i], NULL, worker, NULL);
+    }
+    burn(200);
+    for (i = 0; i < 2; i++) {
+        pthread_join(tid[i], NULL);
+    }
+    debug_profiler_stop();
+    debug_lock_trace_stop();
+    printf("== cpu folded stacks ==\n");
+    debug_profiler_dump(NULL);
+    printf("== lock wait folded stacks (us) ==\n");
+    debug_lock_trace_dump(NULL);
+}
+
+void *leak_small(void)
+{
+    return malloc(64);
+}
+
+void *churn(void *arg)
+{
+    int i;
+    void *p;
+    for (i = 0; i < 200000; i++) {
+        p = malloc(128 + (i & 1023));
+        free(p);
+    }
+    return NULL;
+}
+
+static void heap_test(void)
+{
+    int i;
+    pthread_t tid[2];
+    struct debug_heap_stats st;
+    debug_heap_start(64 * 1024, SIGUSR2, "test");
+    for (i = 0; i < 2; i++) {
+        pthread_create(&tid[i], NULL, churn, NULL);
+    }
+    /* 100000 * 64 = 6.4MB leaked from one site */
+    for (i = 0; i < 100000; i++) {
+        leak_small();
+    }
+    for (i = 0; i < 2; i++) {
+        pthread_join(tid[i], NULL);
+    }
+    debug_heap_get_stats(&st);
+    printf("sampled %" PRIu64 " live objs %" PRIu64 " live bytes %" PRIu64 " sites %" PRIu64 "\n",
+           st.sampled, st.live_objs, st.live_bytes, st.sites);
+    debug_heap_dump(NULL);
+}
+
 int main(int argc, char **argv)
 {
+    if (argc > 1 && !strcmp(argv[1], "heap")) {
+        heap_test();
+        return 0;
+    }
+    if (argc > 1 && !strcmp(argv[1], "prof")) {
+        prof_test();
+        return 0;
+    }
     debug_backtrace_init();
     foo3();
 
@@ -37,6 +37,8 @@
 #define PERTURB_SHIFT   5
 /** Beyond this size, a dictionary will not be grown by the same factor */
 #define DICT_BIGSZ      64000
+/** Keys moved from old table on each add/del while rehashing */
+#define DICT_REHASH_STEP 16
 
 /** Define this to:
     0 for no debugging
@@ -49,13 +51,80 @@
  * Specify which hash function to use
  * MurmurHash is fast but may not work on all architectures
  * Dobbs is a tad bit slower but not by much and works everywhere
+ * wyhash reads 8 bytes per step and is the fastest on string keys
  */
-#define dict_hash   dict_hash_murmur
+#define dict_hash   dict_hash_wy
+/* #define dict_hash   dict_hash_murmur */
 /* #define dict_hash   dict_hash_dobbs */
 
 /* Forward definitions */
 static int dict_resize(dict *d);
 
+/*
+ * key storage, keys are copied into blocks by bump pointer instead of
+ * malloc per key, dict_free frees blocks at once. deleted keys leave a
+ * hole, blocks are rebuilt when holes are over half of stored bytes
+ */
+#define DICT_KEY_BLOCK  (4096)
+
+struct dict_key_block {
+    struct dict_key_block *next;
+    uint32_t size;
+    uint32_t used;
+    char data[];
+};
+
+static struct dict_key_block *key_block_new(uint32_t size)
+{
+    struct dict_key_block *b;
+    b = (struct dict_key_block *)malloc(sizeof(*b) + size);
+    if (!b) {
+        printf("%s: malloc failed %s\n", __func__, strerror(errno));
+        return NULL;
+    }
+    b->next = NULL;
+    b->size = size;
+    b->used = 0;
+    return b;
+}
+
+static void key_blocks_free(struct dict_key_block *b)
+{
+    struct dict_key_block *next;
+    for (; b; b = next) {
+        next = b->next;
+        free(b);
+    }
+}
+
+static char *key_store(struct dict_key_block **head, const char *key, uint32_t len)
+{
+    char *p;
+    struct dict_key_block *b = *head;
+    if (!b || b->size - b->used < len) {
+        if (b && len > DICT_KEY_BLOCK / 4) {
+            /* big key gets own block behind head, keep head usable */
+            b = key_block_new(len);
+            if (!b) {
+                return NULL;
+            }
+            b->next = (*head)->next;
+            (*head)->next = b;
+        } else {
+            b = key_block_new(len > DICT_KEY_BLOCK ? len : DICT_KEY_BLOCK);
+            if (!b) {
+                return NULL;
+            }
+            b->next = *head;
+            *head = b;
+        }
+    }
+    p = b->data + b->used;
+    memcpy(p, key, len);
+    b->used += len;
+    return p;
+}
+
 /** Replacement for strdup() which is not always provided by libc */
 static char *xstrdup(char *s)
 {
@@ -95,6 +164,7 @@ static uint32_t dict_hash_dobbs(char *key, size_t len)
 #endif
 
 /* Murmurhash */
+#if 0
 static uint32_t dict_hash_murmur(char *key, size_t len)
 {
     uint32_t h, k;
@@ -110,7 +180,7 @@ static uint32_t dict_hash_murmur(char *key, size_t len)
     h = seed ^ len;
     data = (uint8_t *)key;
     while (len >= 4) {
-        k = *(uint32_t *)data;
+        memcpy(&k, data, sizeof(k));
 
         k *= m;
         k ^= k >> r;
@@ -133,26 +203,137 @@ static uint32_t dict_hash_murmur(char *key, size_t len)
     h ^= h >> 15;
     return h;
 }
+#endif
 
-/** Lookup an element in a dict
+/*
+ * wyhash, https://github.com/wangyi-fudan/wyhash (public domain)
+ * 64x64->128 multiply and fold, reads 8 or 16 bytes per step and handles
+ * short keys without loop, much faster than byte wise hash on strings
+ */
+#define WY_S0   0xa0761d6478bd642fULL
+#define WY_S1   0xe7037ed1a0b428dbULL
+#define WY_S2   0x8ebc6af09c88c6e3ULL
+#define WY_S3   0x589965cc75374cc3ULL
+#define WY_SEED 0x0badcafeULL
+
+static inline void wy_mum(uint64_t *a, uint64_t *b)
+{
+#if defined (__SIZEOF_INT128__)
+    __uint128_t r = (__uint128_t)*a * *b;
+    *a = (uint64_t)r;
+    *b = (uint64_t)(r >> 64);
+#else
+    uint64_t ha = *a >> 32, hb = *b >> 32;
+    uint64_t la = (uint32_t)*a, lb = (uint32_t)*b;
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64_t t = rl + (rm0 << 32), c = t < rl;
+    uint64_t lo = t + (rm1 << 32);
+    c += lo < t;
+    *a = lo;
+    *b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+static inline uint64_t wy_mix(uint64_t a, uint64_t b)
+{
+    wy_mum(&a, &b);
+    return a ^ b;
+}
+
+static inline uint64_t wy_r8(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t wy_r4(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t wy_r3(const uint8_t *p, size_t k)
+{
+    return ((uint64_t)p[0] << 16) | ((uint64_t)p[k >> 1] << 8) | p[k - 1];
+}
+
+uint64_t dict_hash_wy64(const void *key, size_t len, uint64_t seed)
+{
+    const uint8_t *p = (const uint8_t *)key;
+    uint64_t a, b, see1, see2;
+    size_t i = len;
+
+    seed ^= wy_mix(seed ^ WY_S0, WY_S1);
+    if (len <= 16) {
+        if (len >= 4) {
+            a = (wy_r4(p) << 32) | wy_r4(p + ((len >> 3) << 2));
+            b = (wy_r4(p + len - 4) << 32) | wy_r4(p + len - 4 - ((len >> 3) << 2));
+        } else if (len > 0) {
+            a = wy_r3(p, len);
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        if (i > 48) {
+            see1 = seed;
+            see2 = seed;
+            do {
+                seed = wy_mix(wy_r8(p) ^ WY_S1, wy_r8(p + 8) ^ seed);
+                see1 = wy_mix(wy_r8(p + 16) ^ WY_S2, wy_r8(p + 24) ^ see1);
+                see2 = wy_mix(wy_r8(p + 32) ^ WY_S3, wy_r8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16) {
+            seed = wy_mix(wy_r8(p) ^ WY_S1, wy_r8(p + 8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+        a = wy_r8(p + i - 16);
+        b = wy_r8(p + i - 8);
+    }
+    a ^= WY_S1;
+    b ^= seed;
+    wy_mum(&a, &b);
+    return wy_mix(a ^ WY_S0 ^ len, b ^ WY_S1);
+}
+
+static uint32_t dict_hash_wy(char *key, size_t len)
+{
+    uint64_t h;
+    if (!key) {
+        return 0;
+    }
+    h = dict_hash_wy64(key, len, WY_SEED);
+    return (uint32_t)(h ^ (h >> 32));
+}
+
+/** Lookup an element in a table
     This implementation copied almost verbatim from the Python dictionary
     object, without the Pythonisms.
+    Return the slot holding key, or a free slot to insert key.
     */
-static keypair *dict_lookup(dict *d, char *key, uint32_t hash)
+static keypair *dict_lookup(keypair *table, uint32_t size, char *key,
+                uint32_t hash)
 {
     keypair * freeslot;
     keypair * ep;
     uint32_t i;
     uint32_t perturb;
 
-    if (!d || !key) {
+    if (!table || !key) {
         printf("%s:%d invalid paraments!\n", __func__, __LINE__);
         return NULL;
     }
 
-    i = hash & (d->size-1);
+    i = hash & (size-1);
     /* Look for empty slot */
-    ep = d->table + i;
+    ep = table + i;
     if (ep->key == NULL || ep->key == key) {
         return ep ;
     }
@@ -167,8 +348,8 @@ static keypair *dict_lookup(dict *d, char *key, uint32_t hash)
     }
     for (perturb = hash; ; perturb >>= PERTURB_SHIFT) {
         i = (i<<2) + i + perturb + 1;
-        i &= (d->size-1);
-        ep = d->table + i;
+        i &= (size-1);
+        ep = table + i;
         if (ep->key == NULL) {
             return freeslot == NULL ? ep : freeslot;
         }
@@ -185,42 +366,102 @@ static keypair *dict_lookup(dict *d, char *key, uint32_t hash)
     return NULL;
 }
 
-/** Add an item to a dictionary without copying key/val
-    Used by dict_resize() only.
- */
-static int dict_add_p(dict *d, char *key, char *val)
+#define SLOT_USED(kp)   ((kp)->key && (kp)->key != DUMMY_PTR)
+
+/** Find slot holding key in current or old table, NULL if absent */
+static keypair *dict_find(dict *d, char *key, uint32_t hash)
 {
-    uint32_t hash;
-    keypair * slot;
+    keypair *kp = dict_lookup(d->table, d->size, key, hash);
+    if (kp && SLOT_USED(kp)) {
+        return kp;
+    }
+    if (d->old_table) {
+        kp = dict_lookup(d->old_table, d->old_size, key, hash);
+        if (kp && SLOT_USED(kp)) {
+            return kp;
+        }
+    }
+    return NULL;
+}
 
-    if (!d || !key) {
-        return -1;
+/** Move up to n keys from old table, spreading resize cost over calls */
+static void dict_rehash_step(dict *d, uint32_t n)
+{
+    keypair *kp, *slot;
+    uint32_t empty_visits = n * 10;
+
+    while (n > 0 && d->old_table && d->rehash_idx < d->old_size) {
+        kp = &d->old_table[d->rehash_idx++];
+        if (!SLOT_USED(kp)) {
+            if (--empty_visits == 0) {
+                break;
+            }
+            continue;
+        }
+        slot = dict_lookup(d->table, d->size, kp->key, kp->hash);
+        if (!slot->key) {
+            d->fill++;
+        }
+        slot->key = kp->key;
+        slot->val = kp->val;
+        slot->hash = kp->hash;
+        kp->key = (char *)DUMMY_PTR;
+        kp->val = NULL;
+        n--;
+    }
+    if (d->old_table && d->rehash_idx >= d->old_size) {
+        free(d->old_table);
+        d->old_table = NULL;
+        d->old_size = 0;
+        d->rehash_idx = 0;
+    }
+}
+
+static void dict_rehash_all(dict *d)
+{
+    while (d->old_table) {
+        dict_rehash_step(d, UINT32_MAX / 16);
     }
+}
+
+/** Smallest table size holding n keys under 2/3 fill */
+static uint32_t dict_size_for(uint32_t n)
+{
+    uint32_t size = DICT_MIN_SZ;
+    while (3 * (uint64_t)n >= 2 * (uint64_t)size && size < (1U << 31)) {
+        size *= 2;
+    }
+    return size;
+}
 
+/** Switch to a new table, keys are moved later by dict_rehash_step */
+static int dict_resize_to(dict *d, uint32_t newsize)
+{
+    keypair *table;
+    /* only one migration at a time */
+    dict_rehash_all(d);
 #if DEBUG>2
-    printf("dict_add_p[%s][%s]\n", key, val ? val : "UNDEF");
+    printf("resizing %d to %d (used: %d)\n", d->size, newsize, d->used);
 #endif
-    hash = dict_hash(key, strlen(key));
-    slot = dict_lookup(d, key, hash);
-    if (slot) {
-        slot->key = key;
-        slot->val = val;
-        slot->hash = hash;
-        d->used++;
-        d->fill++;
-        if ((3*d->fill) >= (d->size*2)) {
-            if (dict_resize(d) != 0) {
-                return -1;
-            }
-        }
+    table = (keypair *)calloc(newsize, sizeof(keypair));
+    if (!table) {
+        /* Memory allocation failure */
+        printf("%s: malloc failed %s\n", __func__, strerror(errno));
+        return -1;
     }
+    d->old_table = d->table;
+    d->old_size = d->size;
+    d->rehash_idx = 0;
+    d->table = table;
+    d->size = newsize;
+    d->fill = 0;
     return 0;
 }
 
-/** Add an item to a dictionary by copying key/val into the dict. */
+/** Add an item to a dictionary by copying key into the dict. */
 int dict_add(dict *d, char *key, char *val)
 {
-    uint32_t hash;
+    uint32_t hash, len;
     keypair *slot;
 
     if (!d || !key) {
@@ -230,33 +471,41 @@ int dict_add(dict *d, char *key, char *val)
 #if DEBUG>1
     printf("dict_add[%s][%s]\n", key, val ? val : "UNDEF");
 #endif
+    dict_rehash_step(d, DICT_REHASH_STEP);
     hash = dict_hash(key, strlen(key));
-    slot = dict_lookup(d, key, hash);
+    slot = dict_find(d, key, hash);
     if (slot) {
-        slot->key = xstrdup(key);
-        if (!(slot->key)) {
-            return -1;
-        }
-#if 0
-        slot->val = val ? xstrdup(val) : val;
-        if (val && !(slot->val)) {
-            free(slot->key);
-            return -1;
-        }
-#endif
+        /* key exists, update value only */
         slot->val = val;
-        slot->hash = hash;
-        d->used++;
-        d->fill++;
-        if ((3*d->fill) >= (d->size*2)) {
-            if (dict_resize(d) != 0) {
-                return -1;
-            }
-        }
-    } else {
+        return 0;
+    }
+    slot = dict_lookup(d->table, d->size, key, hash);
+    if (!slot) {
         printf("dict_lookup key:%s hash:0x%x empty!\n", key, hash);
         return -1;
     }
+    len = strlen(key) + 1;
+    slot->key = key_store((struct dict_key_block **)&d->key_blocks, key, len);
+    if (!(slot->key)) {
+        return -1;
+    }
+    d->key_bytes += len;
+#if 0
+    slot->val = val ? xstrdup(val) : val;
+    if (val && !(slot->val)) {
+        free(slot->key);
+        return -1;
+    }
+#endif
+    slot->val = val;
+    slot->hash = hash;
+    d->used++;
+    d->fill++;
+    if ((3*d->fill) >= (d->size*2)) {
+        if (dict_resize(d) != 0) {
+            return -1;
+        }
+    }
     return 0;
 }
 
@@ -264,9 +513,6 @@ int dict_add(dict *d, char *key, char *val)
 static int dict_resize(dict *d)
 {
     uint32_t newsize;
-    keypair *oldtable;
-    uint32_t i;
-    uint32_t oldsize;
     uint32_t factor;
 
     newsize = d->size;
@@ -278,45 +524,22 @@ static int dict_resize(dict *d)
     while (newsize <= (factor*d->used)) {
         newsize *= 2;
     }
-    /* Exit early if no re-sizing needed */
-    if (newsize == d->size)
-        return 0;
-#if DEBUG>2
-    printf("resizing %d to %d (used: %d)\n", d->size, newsize, d->used);
-#endif
-    /* Shuffle pointers, re-allocate new table, re-insert data */
-    oldtable = d->table;
-    d->table = (keypair *)calloc(newsize, sizeof(keypair));
-    if (!(d->table)) {
-        /* Memory allocation failure */
-        printf("%s: malloc failed %s\n", __func__, strerror(errno));
-        return -1;
-    }
-    oldsize = d->size;
-    d->size = newsize;
-    d->used = 0;
-    d->fill = 0;
-    for (i = 0; i < oldsize; i++) {
-        if (oldtable[i].key && (oldtable[i].key!=DUMMY_PTR)) {
-            dict_add_p(d, oldtable[i].key, oldtable[i].val);
-        }
-    }
-    free(oldtable);
-    return 0 ;
+    /* same size is still needed to purge deleted slots */
+    return dict_resize_to(d, newsize);
 }
 
 /** Public: allocate a new dict */
-dict *dict_new(void)
+dict *dict_new_size(uint32_t n)
 {
     dict * d = (dict *)calloc(1, sizeof(dict));
     if (!d) {
         printf("%s: malloc failed %s\n", __func__, strerror(errno));
         return NULL;
     }
-    d->size = DICT_MIN_SZ;
+    d->size = dict_size_for(n);
     d->used = 0;
     d->fill = 0;
-    d->table = (keypair *)calloc(DICT_MIN_SZ, sizeof(keypair));
+    d->table = (keypair *)calloc(d->size, sizeof(keypair));
     if (!d->table) {
         printf("%s: malloc failed %s\n", __func__, strerror(errno));
         free(d);
@@ -325,29 +548,96 @@ dict *dict_new(void)
     return d;
 }
 
-/** Public: deallocate a dict */
-void dict_free(dict *d)
+dict *dict_new(void)
 {
-    int i;
-    if (!d)
-        return;
+    return dict_new_size(0);
+}
 
-    for (i = 0; i < (int)d->size; i++) {
-        if (d->table[i].key && d->table[i].key != DUMMY_PTR) {
-            free(d->table[i].key);
+/** Public: grow table for n keys at once, no resize while adding them */
+int dict_reserve(dict *d, uint32_t n)
+{
+    uint32_t newsize;
+    if (!d) {
+        return -1;
+    }
+    newsize = dict_size_for(n);
+    if (newsize <= d->size) {
+        return 0;
+    }
+    if (0 != dict_resize_to(d, newsize)) {
+        return -1;
+    }
+    dict_rehash_all(d);
+    return 0;
+}
+
+static void dict_free_table(keypair *table, uint32_t size)
+{
+    uint32_t i;
+    for (i = 0; i < size; i++) {
+        if (SLOT_USED(&table[i])) {
+            /* keys live in key blocks */
 #if 0
 //val is not copyed, no need to free
-            if (d->table[i].val)
-                free(d->table[i].val);
+            if (table[i].val)
+                free(table[i].val);
 #endif
         }
     }
-    free(d->table);
+    free(table);
+}
+
+static void key_compact_table(keypair *table, uint32_t size,
+                struct dict_key_block *b)
+{
+    uint32_t i, len;
+    for (i = 0; i < size; i++) {
+        if (!SLOT_USED(&table[i])) {
+            continue;
+        }
+        len = strlen(table[i].key) + 1;
+        memcpy(b->data + b->used, table[i].key, len);
+        table[i].key = b->data + b->used;
+        b->used += len;
+    }
+}
+
+/** Copy live keys into one new block, drop holes left by deleted keys */
+static void dict_key_compact(dict *d)
+{
+    uint32_t live = d->key_bytes - d->key_waste;
+    struct dict_key_block *b;
+
+    b = key_block_new(live > DICT_KEY_BLOCK ? live : DICT_KEY_BLOCK);
+    if (!b) {
+        return;
+    }
+    key_compact_table(d->table, d->size, b);
+    if (d->old_table) {
+        key_compact_table(d->old_table, d->old_size, b);
+    }
+    key_blocks_free((struct dict_key_block *)d->key_blocks);
+    d->key_blocks = b;
+    d->key_bytes = live;
+    d->key_waste = 0;
+}
+
+/** Public: deallocate a dict */
+void dict_free(dict *d)
+{
+    if (!d)
+        return;
+
+    dict_free_table(d->table, d->size);
+    if (d->old_table) {
+        dict_free_table(d->old_table, d->old_size);
+    }
+    key_blocks_free((struct dict_key_block *)d->key_blocks);
     free(d);
     return ;
 }
 
-/** Public: get an item from a dict */
+/** Public: get an item from a dict, read only, never move keys */
 char *dict_get(dict *d, char *key, char *defval)
 {
     keypair *kp;
@@ -358,7 +648,7 @@ char *dict_get(dict *d, char *key, char *defval)
     }
 
     hash = dict_hash(key, strlen(key));
-    kp = dict_lookup(d, key, hash);
+    kp = dict_find(d, key, hash);
     if (kp) {
         return kp->val;
     }
@@ -376,11 +666,10 @@ int dict_del(dict *d, char *key)
     }
 
     hash = dict_hash(key, strlen(key));
-    kp = dict_lookup(d, key, hash);
+    kp = dict_find(d, key, hash);
     if (!kp)
         return -1;
-    if (kp->key && kp->key != DUMMY_PTR)
-        free(kp->key);
+    d->key_waste += strlen(kp->key) + 1;
     kp->key = (char *)DUMMY_PTR;
 #if 0
     if (kp->val)
@@ -388,32 +677,89 @@ int dict_del(dict *d, char *key)
 #endif
     kp->val = NULL;
     d->used--;
+    dict_rehash_step(d, DICT_REHASH_STEP);
+    if (d->key_waste > DICT_KEY_BLOCK && d->key_waste > d->key_bytes / 2) {
+        dict_key_compact(d);
+    }
     return 0;
 }
 
+/** rank covers current table first, then old table while rehashing */
+static keypair *dict_slot(dict *d, uint32_t rank)
+{
+    if (rank < d->size) {
+        return &d->table[rank];
+    }
+    if (d->old_table && rank - d->size < d->old_size) {
+        return &d->old_table[rank - d->size];
+    }
+    return NULL;
+}
+
 /** Public: enumerate a dictionary */
 int dict_enumerate(dict * d, int rank, char ** key, char ** val)
 {
+    keypair *kp;
     if (!d || !key || !val || (rank<0)) {
         return -1 ;
     }
 
-    while ((rank < (int)d->size) &&
-           (d->table[rank].key == NULL || d->table[rank].key == DUMMY_PTR))
+    while ((kp = dict_slot(d, rank)) && !SLOT_USED(kp))
         rank++;
 
-    if (rank >= (int)d->size) {
+    if (!kp) {
         *key = NULL;
         *val = NULL;
         rank = -1;
     } else {
-        *key = d->table[rank].key;
-        *val = d->table[rank].val;
+        *key = kp->key;
+        *val = kp->val;
         rank++;
     }
     return rank;
 }
 
+void dict_iter_init(dict *d, dict_iter *it)
+{
+    it->d = d;
+    it->pos = 0;
+}
+
+int dict_iter_next(dict_iter *it, char **key, char **val)
+{
+    keypair *kp;
+    if (!it->d) {
+        return 0;
+    }
+    while ((kp = dict_slot(it->d, it->pos))) {
+        it->pos++;
+        if (!SLOT_USED(kp)) {
+            continue;
+        }
+        *key = kp->key;
+        *val = kp->val;
+        return 1;
+    }
+    return 0;
+}
+
+int dict_foreach(dict *d, int (*fn)(char *key, char *val, void *arg), void *arg)
+{
+    int ret;
+    char *key, *val;
+    dict_iter it;
+    if (!d || !fn) {
+        return -1;
+    }
+    dict_for_each(d, it, key, val) {
+        ret = fn(key, val, arg);
+        if (ret) {
+            return ret;
+        }
+    }
+    return 0;
+}
+
 /** Public: dump a dict to a file pointer */
 void dict_dump(dict * d, FILE * out)
 {
@@ -43,6 +43,14 @@ typedef struct _dict_ {
     uint32_t used;
     uint32_t size;
     keypair *table;
+    /* table being migrated step by step after resize, NULL when done */
+    keypair *old_table;
+    uint32_t old_size;
+    uint32_t rehash_idx;
+    /* keys are packed in blocks, deleted key bytes reclaimed by compaction */
+    void *key_blocks;
+    uint32_t key_bytes;
+    uint32_t key_waste;
 } dict;
 
 typedef struct _key_list_ {
@@ -50,8 +58,16 @@ typedef struct _key_list_ {
     struct _key_list_ *next;
 } key_list;
 
+typedef struct _dict_iter_ {
+    dict *d;
+    uint32_t pos;
+} dict_iter;
+
 
 dict *dict_new(void);
+/* preallocate for n keys, so adding n keys never resize */
+dict *dict_new_size(uint32_t n);
+int dict_reserve(dict *d, uint32_t n);
 void dict_free(dict *d);
 int dict_add(dict *d, char *key, char *val);
 int dict_del(dict *d, char * key);
@@ -60,6 +76,17 @@ int dict_enumerate(dict *d, int rank, char **key, char **val);
 void dict_dump(dict *d, FILE *out);
 void dict_get_key_list(dict *d, key_list **klist);
 
+/* iterate in place without allocation, dict must not change meanwhile */
+void dict_iter_init(dict *d, dict_iter *it);
+int dict_iter_next(dict_iter *it, char **key, char **val);
+/* fn return non zero to stop, return the value, or 0 when all visited */
+int dict_foreach(dict *d, int (*fn)(char *key, char *val, void *arg), void *arg);
+/* 64 bit wyhash used by dict, same output as hash_wy64 of libhash */
+uint64_t dict_hash_wy64(const void *key, size_t len, uint64_t seed);
+
+#define dict_for_each(d, it, key, val) \
+    for (dict_iter_init(d, &(it)); dict_iter_next(&(it), &(key), &(val));)
+
 #ifdef __cplusplus
 }
 #endif
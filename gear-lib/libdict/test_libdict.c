@@ -22,6 +22,7 @@
 #include "libdict.h"
 #include <string.h>
 #include <sys/time.h>
+#include <inttypes.h>
 
 #define ALIGN   "%15s: %6.4f sec\n"
 #define NKEYS   1024*1024
@@ -102,6 +103,21 @@ int test(int argc, char * argv[])
     t2 = epoch_double();
     printf(ALIGN, "adding", t2 - t1);
 
+    t1 = epoch_double();
+    {
+        dict_iter it;
+        char *key;
+        int n = 0;
+        dict_for_each(d, it, key, val) {
+            n++;
+        }
+        t2 = epoch_double();
+        printf(ALIGN, "iterate", t2 - t1);
+        if (n != nkeys) {
+            printf("-> WRONG iterate %d exp %d\n", n, nkeys);
+        }
+    }
+
     t1 = epoch_double();
     dict_free(d);
     t2 = epoch_double();
@@ -111,8 +127,110 @@ int test(int argc, char * argv[])
     return 0;
 }
 
+static int foo_rehash(int n)
+{
+    int i, err = 0;
+    char key[16];
+    char *val;
+    uint32_t size;
+    dict *d = dict_new();
+    for (i = 0; i < n; i++) {
+        snprintf(key, sizeof(key), "r%d", i);
+        dict_add(d, key, (char *)"a");
+        /* delete while old table is still being migrated */
+        if (i % 3 == 0) {
+            dict_del(d, key);
+        }
+    }
+    dict_add(d, (char *)"r1", (char *)"b");
+    if (dict_del(d, (char *)"missing") != -1) {
+        err++;
+    }
+    for (i = 0; i < n; i++) {
+        snprintf(key, sizeof(key), "r%d", i);
+        val = dict_get(d, key, NULL);
+        if ((i % 3 == 0 && val) || (i % 3 != 0 && !val)) {
+            err++;
+        }
+    }
+    if (strcmp(dict_get(d, (char *)"r1", NULL), "b") ||
+        d->used != (uint32_t)(n - (n + 2) / 3)) {
+        err++;
+    }
+    dict_free(d);
+
+    /* preallocated dict never resize */
+    d = dict_new_size(n);
+    size = d->size;
+    for (i = 0; i < n; i++) {
+        snprintf(key, sizeof(key), "p%d", i);
+        dict_add(d, key, (char *)"a");
+    }
+    if (d->old_table || d->size != size) {
+        err++;
+    }
+    dict_free(d);
+    printf("%15s: %d keys, %d error\n", "rehash", n, err);
+    return err;
+}
+
+static int foo_keys(int n)
+{
+    int i, round, err = 0;
+    char key[16];
+    uint32_t peak = 0;
+    dict *d = dict_new();
+    /* churn keys, holes must be compacted instead of piling up */
+    for (round = 0; round < 10; round++) {
+        for (i = 0; i < n; i++) {
+            snprintf(key, sizeof(key), "k%d.%d", round, i);
+            dict_add(d, key, (char *)"a");
+        }
+        if (d->key_bytes > peak) {
+            peak = d->key_bytes;
+        }
+        for (i = 0; i < n; i++) {
+            snprintf(key, sizeof(key), "k%d.%d", round, i);
+            if (i % 10 && dict_del(d, key)) {
+                err++;
+            }
+        }
+    }
+    for (round = 0; round < 10; round++) {
+        for (i = 0; i < n; i += 10) {
+            snprintf(key, sizeof(key), "k%d.%d", round, i);
+            if (!dict_get(d, key, NULL)) {
+                err++;
+            }
+        }
+    }
+    if (peak > 4 * (uint32_t)n * 10) {
+        err++;
+    }
+    printf("%15s: %d keys, key bytes peak %u now %u, %d error\n", "keys", n,
+           peak, d->key_bytes, err);
+    dict_free(d);
+    return err;
+}
+
+/* fixed vector, libhash and libdict must agree on it */
+static int foo_wy64(void)
+{
+    int err = 0;
+    uint64_t h = dict_hash_wy64("gear-lib", 8, 0);
+    if (h != 0x9d020be227ab4dfeULL || dict_hash_wy64("", 0, 0) != 0x409638ee2bde459ULL ||
+        dict_hash_wy64("gear-lib", 8, 1) == h) {
+        err++;
+    }
+    printf("%15s: %016" PRIx64 ", %d error\n", "wy64", h, err);
+    return err;
+}
+
 int main(int argc, char * argv[])
 {
     test(argc, argv);
+    foo_rehash(100000);
+    foo_keys(10000);
+    foo_wy64();
     return 0;
 }
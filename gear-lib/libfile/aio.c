@@ -0,0 +1,642 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#include "libfile.h"
+
+#if defined (OS_LINUX) || defined (OS_APPLE)
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/time.h>
+
+#if defined (OS_LINUX) && defined (__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define FILE_HAVE_IO_URING
+#endif
+#endif
+
+#if defined (FILE_HAVE_IO_URING)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+/*
+ * asynchronous pread/pwrite/fsync.
+ * io_uring backend uses raw syscalls like libgevent, requests are queued
+ * in sq ring and pushed to kernel in batch by file_aio_submit/poll.
+ * thread backend runs requests on a small pool of workers, it is used
+ * when io_uring is not available or disabled.
+ * completions are always delivered in the thread calling file_aio_poll.
+ */
+#define FILE_AIO_DEPTH      (256)
+#define FILE_AIO_THREADS    (4)
+
+enum aio_op {
+    AIO_READ,
+    AIO_WRITE,
+    AIO_FSYNC,
+};
+
+struct aio_req {
+    enum aio_op op;
+    int fd;
+    void *buf;
+    size_t len;
+    off_t offset;
+    ssize_t res;
+    file_aio_cb cb;
+    void *arg;
+    struct aio_req *next;
+};
+
+struct aio_queue {
+    struct aio_req *head;
+    struct aio_req *tail;
+};
+
+struct file_aio {
+    enum file_aio_backend type;
+    int depth;
+    int inflight;
+    pthread_mutex_t lock;
+
+    /* thread backend */
+    pthread_cond_t cond_req;
+    pthread_cond_t cond_done;
+    struct aio_queue reqs;
+    struct aio_queue done;
+    int ndone;
+    pthread_t *workers;
+    int nworkers;
+    bool running;
+
+#if defined (FILE_HAVE_IO_URING)
+    int ring_fd;
+    void *sq_ptr;
+    size_t sq_size;
+    void *cq_ptr;
+    size_t cq_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    unsigned *sq_khead;
+    unsigned *sq_ktail;
+    unsigned *sq_kmask;
+    unsigned *sq_array;
+    unsigned sq_entries;
+    unsigned sq_tail;
+    unsigned sq_pending;
+    unsigned *cq_khead;
+    unsigned *cq_ktail;
+    unsigned *cq_kmask;
+    struct io_uring_cqe *cqes;
+#endif
+};
+
+static void aio_queue_push(struct aio_queue *q, struct aio_req *r)
+{
+    r->next = NULL;
+    if (q->tail) {
+        q->tail->next = r;
+    } else {
+        q->head = r;
+    }
+    q->tail = r;
+}
+
+static struct aio_req *aio_queue_pop(struct aio_queue *q)
+{
+    struct aio_req *r = q->head;
+    if (r) {
+        q->head = r->next;
+        if (!q->head) {
+            q->tail = NULL;
+        }
+    }
+    return r;
+}
+
+static ssize_t aio_do_rw(struct aio_req *r)
+{
+    ssize_t n;
+    size_t done = 0;
+    uint8_t *p = (uint8_t *)r->buf;
+
+    while (done < r->len) {
+        if (r->op == AIO_READ) {
+            n = pread(r->fd, p + done, r->len - done, r->offset + done);
+        } else {
+            n = pwrite(r->fd, p + done, r->len - done, r->offset + done);
+        }
+        if (n > 0) {
+            done += n;
+            continue;
+        }
+        if (n == 0) {
+            break;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        return done > 0 ? (ssize_t)done : -errno;
+    }
+    return done;
+}
+
+static void *aio_worker(void *arg)
+{
+    struct file_aio *aio = (struct file_aio *)arg;
+    struct aio_req *r;
+
+    pthread_mutex_lock(&aio->lock);
+    while (1) {
+        while (aio->running && !aio->reqs.head) {
+            pthread_cond_wait(&aio->cond_req, &aio->lock);
+        }
+        r = aio_queue_pop(&aio->reqs);
+        if (!r) {
+            break;
+        }
+        pthread_mutex_unlock(&aio->lock);
+        if (r->op == AIO_FSYNC) {
+            r->res = fsync(r->fd) < 0 ? -errno : 0;
+        } else {
+            r->res = aio_do_rw(r);
+        }
+        pthread_mutex_lock(&aio->lock);
+        aio_queue_push(&aio->done, r);
+        aio->ndone++;
+        pthread_cond_signal(&aio->cond_done);
+    }
+    pthread_mutex_unlock(&aio->lock);
+    return NULL;
+}
+
+static int aio_thread_init(struct file_aio *aio)
+{
+    int i;
+    aio->nworkers = MIN2(aio->depth, FILE_AIO_THREADS);
+    aio->workers = CALLOC(aio->nworkers, pthread_t);
+    if (!aio->workers) {
+        printf("malloc aio workers failed!\n");
+        return -1;
+    }
+    pthread_cond_init(&aio->cond_req, NULL);
+    pthread_cond_init(&aio->cond_done, NULL);
+    aio->running = true;
+    for (i = 0; i < aio->nworkers; i++) {
+        if (0 != pthread_create(&aio->workers[i], NULL, aio_worker, aio)) {
+            printf("pthread_create aio worker failed!\n");
+            aio->nworkers = i;
+            return -1;
+        }
+    }
+    aio->type = FILE_AIO_THREAD;
+    return 0;
+}
+
+static void aio_thread_deinit(struct file_aio *aio)
+{
+    int i;
+    if (!aio->workers) {
+        return;
+    }
+    pthread_mutex_lock(&aio->lock);
+    aio->running = false;
+    pthread_cond_broadcast(&aio->cond_req);
+    pthread_mutex_unlock(&aio->lock);
+    for (i = 0; i < aio->nworkers; i++) {
+        pthread_join(aio->workers[i], NULL);
+    }
+    pthread_cond_destroy(&aio->cond_req);
+    pthread_cond_destroy(&aio->cond_done);
+    free(aio->workers);
+    aio->workers = NULL;
+}
+
+#if defined (FILE_HAVE_IO_URING)
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+                unsigned flags, void *arg, size_t argsz)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+                        flags, arg, argsz);
+}
+
+static void aio_uring_unmap(struct file_aio *aio)
+{
+    if (aio->sqes && aio->sqes != MAP_FAILED) {
+        munmap(aio->sqes, aio->sqes_size);
+    }
+    if (aio->cq_ptr && aio->cq_ptr != MAP_FAILED && aio->cq_ptr != aio->sq_ptr) {
+        munmap(aio->cq_ptr, aio->cq_size);
+    }
+    if (aio->sq_ptr && aio->sq_ptr != MAP_FAILED) {
+        munmap(aio->sq_ptr, aio->sq_size);
+    }
+}
+
+static int aio_uring_init(struct file_aio *aio)
+{
+    struct io_uring_params p;
+
+    memset(&p, 0, sizeof(p));
+    aio->ring_fd = sys_io_uring_setup(aio->depth, &p);
+    if (aio->ring_fd < 0) {
+        printf("io_uring_setup failed %d: %s\n", errno, strerror(errno));
+        return -1;
+    }
+    if (!(p.features & IORING_FEAT_EXT_ARG)) {
+        printf("io_uring IORING_FEAT_EXT_ARG not supported by kernel\n");
+        goto failed;
+    }
+    aio->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    aio->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        aio->sq_size = MAX2(aio->sq_size, aio->cq_size);
+        aio->cq_size = aio->sq_size;
+    }
+    aio->sq_ptr = mmap(NULL, aio->sq_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, aio->ring_fd, IORING_OFF_SQ_RING);
+    if (aio->sq_ptr == MAP_FAILED) {
+        printf("mmap sq ring failed %d\n", errno);
+        goto failed;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        aio->cq_ptr = aio->sq_ptr;
+    } else {
+        aio->cq_ptr = mmap(NULL, aio->cq_size, PROT_READ | PROT_WRITE,
+                           MAP_SHARED | MAP_POPULATE, aio->ring_fd, IORING_OFF_CQ_RING);
+        if (aio->cq_ptr == MAP_FAILED) {
+            printf("mmap cq ring failed %d\n", errno);
+            goto failed;
+        }
+    }
+    aio->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    aio->sqes = (struct io_uring_sqe *)mmap(NULL, aio->sqes_size,
+                       PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       aio->ring_fd, IORING_OFF_SQES);
+    if (aio->sqes == MAP_FAILED) {
+        printf("mmap sqes failed %d\n", errno);
+        goto failed;
+    }
+    aio->sq_khead   = (unsigned *)((char *)aio->sq_ptr + p.sq_off.head);
+    aio->sq_ktail   = (unsigned *)((char *)aio->sq_ptr + p.sq_off.tail);
+    aio->sq_kmask   = (unsigned *)((char *)aio->sq_ptr + p.sq_off.ring_mask);
+    aio->sq_array   = (unsigned *)((char *)aio->sq_ptr + p.sq_off.array);
+    aio->sq_entries = p.sq_entries;
+    aio->sq_tail    = *aio->sq_ktail;
+    aio->cq_khead   = (unsigned *)((char *)aio->cq_ptr + p.cq_off.head);
+    aio->cq_ktail   = (unsigned *)((char *)aio->cq_ptr + p.cq_off.tail);
+    aio->cq_kmask   = (unsigned *)((char *)aio->cq_ptr + p.cq_off.ring_mask);
+    aio->cqes       = (struct io_uring_cqe *)((char *)aio->cq_ptr + p.cq_off.cqes);
+    /* inflight never exceeds sq entries, cq ring is twice as big */
+    aio->depth = MIN2(aio->depth, (int)p.sq_entries);
+    aio->type = FILE_AIO_URING;
+    return 0;
+
+failed:
+    aio_uring_unmap(aio);
+    close(aio->ring_fd);
+    aio->ring_fd = -1;
+    return -1;
+}
+
+static void aio_uring_deinit(struct file_aio *aio)
+{
+    aio_uring_unmap(aio);
+    close(aio->ring_fd);
+}
+
+/* must be called with lock held */
+static int aio_uring_queue(struct file_aio *aio, struct aio_req *r)
+{
+    unsigned idx;
+    struct io_uring_sqe *sqe;
+
+    idx = aio->sq_tail & *aio->sq_kmask;
+    sqe = &aio->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->fd = r->fd;
+    switch (r->op) {
+    case AIO_READ:
+        sqe->opcode = IORING_OP_READ;
+        break;
+    case AIO_WRITE:
+        sqe->opcode = IORING_OP_WRITE;
+        break;
+    case AIO_FSYNC:
+        sqe->opcode = IORING_OP_FSYNC;
+        break;
+    }
+    sqe->addr = (uint64_t)(uintptr_t)r->buf;
+    sqe->len = (unsigned)r->len;
+    sqe->off = (uint64_t)r->offset;
+    sqe->user_data = (uint64_t)(uintptr_t)r;
+    aio->sq_array[idx] = idx;
+    aio->sq_tail++;
+    aio->sq_pending++;
+    return 0;
+}
+
+/* must be called with lock held */
+static int aio_uring_enter(struct file_aio *aio, unsigned min_complete,
+                int timeout_ms)
+{
+    int ret;
+    unsigned flags = 0;
+    unsigned submit = aio->sq_pending;
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+
+    memset(&arg, 0, sizeof(arg));
+    if (min_complete > 0) {
+        flags |= IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+        if (timeout_ms >= 0) {
+            ts.tv_sec = timeout_ms / 1000;
+            ts.tv_nsec = (timeout_ms % 1000) * 1000000LL;
+            arg.ts = (uint64_t)(uintptr_t)&ts;
+        }
+    }
+    if (submit == 0 && flags == 0) {
+        return 0;
+    }
+    __atomic_store_n(aio->sq_ktail, aio->sq_tail, __ATOMIC_RELEASE);
+    ret = sys_io_uring_enter(aio->ring_fd, submit, min_complete, flags,
+                             flags ? &arg : NULL, flags ? sizeof(arg) : 0);
+    if (ret < 0) {
+        if (errno == ETIME || errno == EINTR || errno == EBUSY) {
+            return 0;
+        }
+        printf("io_uring_enter failed %d: %s\n", errno, strerror(errno));
+        return -1;
+    }
+    aio->sq_pending -= MIN2((unsigned)ret, submit);
+    return 0;
+}
+
+/* must be called with lock held, move cqes to done queue */
+static void aio_uring_reap(struct file_aio *aio)
+{
+    struct aio_req *r;
+    unsigned head = *aio->cq_khead;
+    unsigned tail = __atomic_load_n(aio->cq_ktail, __ATOMIC_ACQUIRE);
+
+    while (head != tail) {
+        struct io_uring_cqe *cqe = &aio->cqes[head & *aio->cq_kmask];
+        r = (struct aio_req *)(uintptr_t)cqe->user_data;
+        r->res = cqe->res;
+        aio_queue_push(&aio->done, r);
+        aio->ndone++;
+        head++;
+    }
+    __atomic_store_n(aio->cq_khead, head, __ATOMIC_RELEASE);
+}
+#endif
+
+struct file_aio *file_aio_create(enum file_aio_backend type, int depth)
+{
+    struct file_aio *aio = CALLOC(1, struct file_aio);
+    if (!aio) {
+        printf("malloc file_aio failed!\n");
+        return NULL;
+    }
+    aio->depth = depth > 0 ? depth : FILE_AIO_DEPTH;
+    pthread_mutex_init(&aio->lock, NULL);
+#if defined (FILE_HAVE_IO_URING)
+    aio->ring_fd = -1;
+    if (type != FILE_AIO_THREAD) {
+        if (0 == aio_uring_init(aio)) {
+            return aio;
+        }
+        if (type == FILE_AIO_URING) {
+            goto failed;
+        }
+        printf("io_uring unavailable, fallback to thread pool\n");
+    }
+#else
+    if (type == FILE_AIO_URING) {
+        printf("io_uring is not supported on this platform\n");
+        goto failed;
+    }
+#endif
+    if (0 == aio_thread_init(aio)) {
+        return aio;
+    }
+    aio_thread_deinit(aio);
+
+failed:
+    pthread_mutex_destroy(&aio->lock);
+    free(aio);
+    return NULL;
+}
+
+void file_aio_destroy(struct file_aio *aio)
+{
+    if (!aio) {
+        return;
+    }
+    /* kernel or workers may still write into user buffers, drain first */
+    while (aio->inflight > 0) {
+        if (file_aio_poll(aio, 1, -1) < 0) {
+            break;
+        }
+    }
+#if defined (FILE_HAVE_IO_URING)
+    if (aio->type == FILE_AIO_URING) {
+        aio_uring_deinit(aio);
+    }
+#endif
+    if (aio->type == FILE_AIO_THREAD) {
+        aio_thread_deinit(aio);
+    }
+    pthread_mutex_destroy(&aio->lock);
+    free(aio);
+}
+
+enum file_aio_backend file_aio_backend(struct file_aio *aio)
+{
+    return aio ? aio->type : FILE_AIO_AUTO;
+}
+
+static int aio_queue_req(struct file_aio *aio, enum aio_op op, int fd,
+                void *buf, size_t len, off_t offset, file_aio_cb cb, void *arg)
+{
+    struct aio_req *r;
+
+    if (!aio || fd < 0 || (op != AIO_FSYNC && (!buf || len == 0))) {
+        printf("%s paraments invalid!\n", __func__);
+        return -1;
+    }
+    pthread_mutex_lock(&aio->lock);
+    if (aio->inflight >= aio->depth) {
+        pthread_mutex_unlock(&aio->lock);
+        errno = EAGAIN;
+        return -1;
+    }
+    r = CALLOC(1, struct aio_req);
+    if (!r) {
+        pthread_mutex_unlock(&aio->lock);
+        printf("malloc aio_req failed!\n");
+        return -1;
+    }
+    r->op = op;
+    r->fd = fd;
+    r->buf = buf;
+    r->len = len;
+    r->offset = offset;
+    r->cb = cb;
+    r->arg = arg;
+    aio->inflight++;
+#if defined (FILE_HAVE_IO_URING)
+    if (aio->type == FILE_AIO_URING) {
+        aio_uring_queue(aio, r);
+        pthread_mutex_unlock(&aio->lock);
+        return 0;
+    }
+#endif
+    aio_queue_push(&aio->reqs, r);
+    pthread_cond_signal(&aio->cond_req);
+    pthread_mutex_unlock(&aio->lock);
+    return 0;
+}
+
+int file_aio_read(struct file_aio *aio, int fd, void *buf, size_t len,
+                off_t offset, file_aio_cb cb, void *arg)
+{
+    return aio_queue_req(aio, AIO_READ, fd, buf, len, offset, cb, arg);
+}
+
+int file_aio_write(struct file_aio *aio, int fd, const void *buf, size_t len,
+                off_t offset, file_aio_cb cb, void *arg)
+{
+    return aio_queue_req(aio, AIO_WRITE, fd, (void *)buf, len, offset, cb, arg);
+}
+
+int file_aio_fsync(struct file_aio *aio, int fd, file_aio_cb cb, void *arg)
+{
+    return aio_queue_req(aio, AIO_FSYNC, fd, NULL, 0, 0, cb, arg);
+}
+
+int file_aio_submit(struct file_aio *aio)
+{
+    int ret = 0;
+    if (!aio) {
+        return -1;
+    }
+#if defined (FILE_HAVE_IO_URING)
+    if (aio->type == FILE_AIO_URING) {
+        pthread_mutex_lock(&aio->lock);
+        ret = aio_uring_enter(aio, 0, 0);
+        pthread_mutex_unlock(&aio->lock);
+    }
+#endif
+    return ret;
+}
+
+static void aio_timeout_abs(struct timespec *ts, int timeout_ms)
+{
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    ts->tv_sec = now.tv_sec + timeout_ms / 1000;
+    ts->tv_nsec = now.tv_usec * 1000 + (timeout_ms % 1000) * 1000000L;
+    if (ts->tv_nsec >= 1000000000L) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000L;
+    }
+}
+
+int file_aio_poll(struct file_aio *aio, int min_complete, int timeout_ms)
+{
+    int n = 0;
+    struct aio_req *r;
+    struct aio_queue done;
+    struct timespec ts;
+
+    if (!aio) {
+        return -1;
+    }
+    pthread_mutex_lock(&aio->lock);
+    min_complete = MIN2(min_complete, aio->inflight);
+#if defined (FILE_HAVE_IO_URING)
+    if (aio->type == FILE_AIO_URING) {
+        aio_uring_reap(aio);
+        if (aio->ndone < min_complete || aio->sq_pending) {
+            if (0 != aio_uring_enter(aio, MAX2(min_complete - aio->ndone, 0), timeout_ms)) {
+                pthread_mutex_unlock(&aio->lock);
+                return -1;
+            }
+            aio_uring_reap(aio);
+        }
+    }
+#endif
+    if (aio->type == FILE_AIO_THREAD && aio->ndone < min_complete) {
+        if (timeout_ms < 0) {
+            while (aio->ndone < min_complete) {
+                pthread_cond_wait(&aio->cond_done, &aio->lock);
+            }
+        } else {
+            aio_timeout_abs(&ts, timeout_ms);
+            while (aio->ndone < min_complete) {
+                if (ETIMEDOUT == pthread_cond_timedwait(&aio->cond_done, &aio->lock, &ts)) {
+                    break;
+                }
+            }
+        }
+    }
+    done = aio->done;
+    memset(&aio->done, 0, sizeof(aio->done));
+    aio->inflight -= aio->ndone;
+    aio->ndone = 0;
+    pthread_mutex_unlock(&aio->lock);
+
+    /* run callbacks without lock, they may queue new requests */
+    while ((r = aio_queue_pop(&done))) {
+        if (r->cb) {
+            r->cb(r->arg, r->res);
+        }
+        free(r);
+        n++;
+    }
+    return n;
+}
+
+int file_aio_inflight(struct file_aio *aio)
+{
+    int n;
+    if (!aio) {
+        return 0;
+    }
+    pthread_mutex_lock(&aio->lock);
+    n = aio->inflight;
+    pthread_mutex_unlock(&aio->lock);
+    return n;
+}
+
+#endif
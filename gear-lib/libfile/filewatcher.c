@@ -33,6 +33,210 @@
 #define WATCH_MODIFY    1
 #define KEY_LEN         9
 
+#define FW_READ_BUF     (64 * 1024)
+#define FW_BATCH_INIT   (64)
+#define FW_BATCH_MAX    (4096)
+
+struct fw_pending {
+    struct fw_event ev;
+    bool dropped;
+};
+
+/*
+ * pending events in arrival order, slots is an open addressing index of
+ * the latest event of each path, so coalescing is O(1) per event
+ */
+struct fw_batch {
+    struct fw_pending *pending;
+    int count;
+    int cap;
+    int *slots;
+    int nslots;
+    bool armed;
+    struct gevent_wtimer timer;
+    char *rbuf;
+};
+
+static uint32_t fw_path_hash(const char *path)
+{
+    uint32_t h = 2166136261u;
+    while (*path) {
+        h = (h ^ (uint8_t)*path++) * 16777619u;
+    }
+    return h;
+}
+
+/* return slot of path, slot holds 0 if not found */
+static int *fw_batch_slot(struct fw_batch *b, const char *path)
+{
+    uint32_t mask = b->nslots - 1;
+    uint32_t i = fw_path_hash(path) & mask;
+    while (b->slots[i]) {
+        if (!strcmp(b->pending[b->slots[i] - 1].ev.path, path)) {
+            break;
+        }
+        i = (i + 1) & mask;
+    }
+    return &b->slots[i];
+}
+
+static int fw_batch_grow(struct fw_batch *b)
+{
+    int i, cap = b->cap ? b->cap * 2 : FW_BATCH_INIT;
+    struct fw_pending *p = realloc(b->pending, cap * sizeof(*p));
+    int *slots = calloc(cap * 2, sizeof(int));
+    if (!p || !slots) {
+        printf("malloc fw_batch failed\n");
+        if (p) {
+            b->pending = p;
+        }
+        free(slots);
+        return -1;
+    }
+    b->pending = p;
+    b->cap = cap;
+    free(b->slots);
+    b->slots = slots;
+    b->nslots = cap * 2;
+    for (i = 0; i < b->count; i++) {
+        *fw_batch_slot(b, b->pending[i].ev.path) = i + 1;
+    }
+    return 0;
+}
+
+static bool fw_is_write(enum fw_type type)
+{
+    return type == FW_CREATE_FILE || type == FW_MODIFY_FILE ||
+           type == FW_MOVE_TO_FILE;
+}
+
+static void fw_batch_flush(struct fw *fw)
+{
+    int i, n = 0;
+    struct fw_batch *b = fw->batch;
+    struct fw_event *events;
+
+    if (!b || b->count == 0) {
+        return;
+    }
+    events = calloc(b->count, sizeof(struct fw_event));
+    for (i = 0; i < b->count; i++) {
+        if (b->pending[i].dropped) {
+            continue;
+        }
+        if (events) {
+            events[n++] = b->pending[i].ev;
+        } else if (fw->notify_cb) {
+            /* no memory for a batch, deliver one by one */
+            fw->notify_cb(fw, b->pending[i].ev.type, b->pending[i].ev.path);
+        }
+    }
+    if (events && fw->batch_cb) {
+        fw->batch_cb(fw, events, n);
+    } else if (events && fw->notify_cb) {
+        for (i = 0; i < n; i++) {
+            fw->notify_cb(fw, events[i].type, events[i].path);
+        }
+    }
+    for (i = 0; i < b->count; i++) {
+        free(b->pending[i].ev.path);
+    }
+    b->count = 0;
+    memset(b->slots, 0, b->nslots * sizeof(int));
+    free(events);
+}
+
+static void fw_notify(struct fw *fw, enum fw_type type, const char *path)
+{
+    int *slot;
+    struct fw_pending *prev = NULL;
+    struct fw_batch *b = fw->batch;
+
+    if (b->count == b->cap && 0 != fw_batch_grow(b)) {
+        fw_batch_flush(fw);
+        if (fw->notify_cb) {
+            fw->notify_cb(fw, type, (char *)path);
+        }
+        return;
+    }
+    slot = fw_batch_slot(b, path);
+    if (*slot) {
+        prev = &b->pending[*slot - 1];
+        if (prev->dropped) {
+            prev = NULL;
+        }
+    }
+    if (prev) {
+        if (type == FW_MODIFY_FILE && fw_is_write(prev->ev.type)) {
+            return;
+        }
+        if (type == FW_DELETE_FILE && prev->ev.type == FW_CREATE_FILE) {
+            /* short lived file, nobody needs to know */
+            prev->dropped = true;
+            return;
+        }
+        if (type == FW_DELETE_FILE && prev->ev.type == FW_MODIFY_FILE) {
+            prev->dropped = true;
+        }
+    }
+    b->pending[b->count].ev.type = type;
+    b->pending[b->count].ev.path = strdup(path);
+    b->pending[b->count].dropped = false;
+    b->count++;
+    *slot = b->count;
+}
+
+static void fw_batch_timeout(struct gevent_wtimer *t, void *arg)
+{
+    struct fw *fw = (struct fw *)arg;
+    fw->batch->armed = false;
+    fw_batch_flush(fw);
+}
+
+static void fw_batch_schedule(struct fw *fw)
+{
+    struct fw_batch *b = fw->batch;
+    if (b->count == 0) {
+        return;
+    }
+    if (fw->latency_ms <= 0 || b->count >= FW_BATCH_MAX) {
+        if (b->armed) {
+            gevent_wtimer_del(fw->evbase, &b->timer);
+            b->armed = false;
+        }
+        fw_batch_flush(fw);
+        return;
+    }
+    if (!b->armed) {
+        if (0 != gevent_wtimer_add(fw->evbase, &b->timer, fw->latency_ms,
+                                   TIMER_ONESHOT)) {
+            fw_batch_flush(fw);
+            return;
+        }
+        b->armed = true;
+    }
+}
+
+static void fw_batch_free(struct fw *fw)
+{
+    int i;
+    struct fw_batch *b = fw->batch;
+    if (!b) {
+        return;
+    }
+    if (b->armed) {
+        gevent_wtimer_del(fw->evbase, &b->timer);
+    }
+    for (i = 0; i < b->count; i++) {
+        free(b->pending[i].ev.path);
+    }
+    free(b->pending);
+    free(b->slots);
+    free(b->rbuf);
+    free(b);
+    fw->batch = NULL;
+}
+
 int add_path_list(struct fw *fw, int wd, const char *path)
 {
     char key[KEY_LEN];
@@ -140,6 +344,22 @@ int fw_add_watch_recursive(struct fw *fw, const char *path)
     return 0;
 }
 
+int fw_add_watch_dir(struct fw *fw, const char *path)
+{
+    uint32_t mask = IN_CREATE | IN_DELETE;
+#if WATCH_MOVED
+    mask |= IN_MOVE | IN_MOVE_SELF;
+#endif
+#if WATCH_MODIFY
+    mask |= IN_MODIFY;
+#endif
+    if (fw->fd == -1 || path == NULL) {
+        printf("invalid paraments\n");
+        return -1;
+    }
+    return fw_add_watch(fw, path, mask);
+}
+
 int fw_del_watch_recursive(struct fw *fw, const char *path)
 {
     int rank = 0;
@@ -179,47 +399,38 @@ int fw_update_watch(struct fw *fw, struct inotify_event *iev)
     if (iev->mask & IN_CREATE) {
         if (iev->mask & IN_ISDIR) {
             fw_add_watch_recursive(fw, full_path);
-            if (fw->notify_cb)
-                fw->notify_cb(fw, FW_CREATE_DIR, full_path);
+            fw_notify(fw, FW_CREATE_DIR, full_path);
         } else {
             fw_add_watch(fw, full_path, mask);
-            if (fw->notify_cb)
-                fw->notify_cb(fw, FW_CREATE_FILE, full_path);
+            fw_notify(fw, FW_CREATE_FILE, full_path);
         }
     } else if (iev->mask & IN_DELETE) {
         if (iev->mask & IN_ISDIR) {
             fw_del_watch_recursive(fw, full_path);
-            if (fw->notify_cb)
-                fw->notify_cb(fw, FW_DELETE_DIR, full_path);
+            fw_notify(fw, FW_DELETE_DIR, full_path);
         } else {
             fw_del_watch(fw, full_path);
-            if (fw->notify_cb)
-                fw->notify_cb(fw, FW_DELETE_FILE, full_path);
+            fw_notify(fw, FW_DELETE_FILE, full_path);
         }
     } else if (iev->mask & IN_MOVED_FROM){
         if (iev->mask & IN_ISDIR) {
             fw_del_watch_recursive(fw, full_path);
-            if (fw->notify_cb)
-                fw->notify_cb(fw, FW_MOVE_FROM_DIR, full_path);
+            fw_notify(fw, FW_MOVE_FROM_DIR, full_path);
         } else {
             fw_del_watch(fw, full_path);
-            if (fw->notify_cb)
-                fw->notify_cb(fw, FW_MOVE_FROM_FILE, full_path);
+            fw_notify(fw, FW_MOVE_FROM_FILE, full_path);
         }
     } else if (iev->mask & IN_MOVED_TO){
         if (iev->mask & IN_ISDIR) {
             fw_add_watch_recursive(fw, full_path);
-            if (fw->notify_cb)
-                fw->notify_cb(fw, FW_MOVE_TO_DIR, full_path);
+            fw_notify(fw, FW_MOVE_TO_DIR, full_path);
         } else {
             fw_add_watch(fw, full_path, mask);
-            if (fw->notify_cb)
-                fw->notify_cb(fw, FW_MOVE_TO_FILE, full_path);
+            fw_notify(fw, FW_MOVE_TO_FILE, full_path);
         }
     } else if (iev->mask & IN_IGNORED){
     } else if (iev->mask & IN_MODIFY){
-        if (fw->notify_cb)
-            fw->notify_cb(fw, FW_MODIFY_FILE, full_path);
+        fw_notify(fw, FW_MODIFY_FILE, full_path);
     } else {
         printf("unknown inotify_event:%d\n", iev->mask);
     }
@@ -233,7 +444,7 @@ struct fw *fw_init(void (notify_cb)(struct fw *fw, enum fw_type type, char *path
         printf("malloc fw failed\n");
         goto err;
     }
-    int fd = inotify_init();
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
     if (fd == -1) {
         printf("inotify_init failed: %d\n", errno);
         goto err;
@@ -247,14 +458,33 @@ struct fw *fw_init(void (notify_cb)(struct fw *fw, enum fw_type type, char *path
     fw->evbase = evbase;
     fw->dict_path = dict_new();
     fw->notify_cb = notify_cb;
+    fw->batch = calloc(1, sizeof(struct fw_batch));
+    if (!fw->batch || 0 != fw_batch_grow(fw->batch) ||
+        !(fw->batch->rbuf = malloc(FW_READ_BUF))) {
+        printf("malloc fw_batch failed\n");
+        goto err;
+    }
+    gevent_wtimer_init(&fw->batch->timer, fw_batch_timeout, fw);
     return fw;
 err:
     if (fw) {
+        fw_batch_free(fw);
         free(fw);
     }
     return NULL;
 }
 
+int fw_set_batch(struct fw *fw, int latency_ms,
+                void (*batch_cb)(struct fw *fw, const struct fw_event *events, int num))
+{
+    if (!fw) {
+        return -1;
+    }
+    fw->latency_ms = latency_ms > 0 ? latency_ms : 0;
+    fw->batch_cb = batch_cb;
+    return 0;
+}
+
 void fw_deinit(struct fw *fw)
 {
     if (!fw) {
@@ -271,6 +501,7 @@ void fw_deinit(struct fw *fw)
         free(val);
     }
     dict_free(fw->dict_path);
+    fw_batch_free(fw);
     gevent_base_loop_break(fw->evbase);
     close(fw->fd);
     gevent_base_destroy(fw->evbase);
@@ -279,34 +510,40 @@ void fw_deinit(struct fw *fw)
 
 void on_read_ops(int fd, void *arg)
 {
-#define INOTIFYEVENTBUFSIZE (1024)
     int i, len;
     struct inotify_event *iev;
     size_t iev_size;
-    char ibuf[INOTIFYEVENTBUFSIZE] __attribute__ ((aligned(4))) = {0};
     struct fw *fw = (struct fw *)arg;
+    char *ibuf = fw->batch->rbuf;
 
-again:
-    len = read(fd, ibuf, sizeof(ibuf));
-    if (len == 0) {
-        printf("read inofity event buffer 0, error: %s\n", strerror(errno));
-    } else if (len == -1) {
-        printf("read inofity event buffer error: %s\n", strerror(errno));
-        if (errno == EINTR) {
-            goto again;
+    /* edge triggered and nonblocking, drain all then deliver one batch */
+    while (1) {
+        len = read(fd, ibuf, FW_READ_BUF);
+        if (len == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN) {
+                printf("read inofity event buffer error: %s\n", strerror(errno));
+            }
+            break;
+        } else if (len == 0) {
+            printf("read inofity event buffer 0, error: %s\n", strerror(errno));
+            break;
         }
-    } else {
         i = 0;
         while (i < len) {
             iev = (struct inotify_event *)(ibuf + i);
-            if (iev->len > 0) {
+            if (iev->mask & IN_Q_OVERFLOW) {
+                printf("inotify event queue overflow, events lost\n");
+            } else if (iev->len > 0) {
                 fw_update_watch(fw, iev);
-            } else {
             }
             iev_size = sizeof(struct inotify_event) + iev->len;
             i += iev_size;
         }
     }
+    fw_batch_schedule(fw);
 }
 
 int fw_dispatch(struct fw *fw)
@@ -192,4 +192,6 @@ struct file_ops fio_ops = {
     fio_sync,
     fio_size,
     fio_close,
+    NULL,
+    NULL,
 };
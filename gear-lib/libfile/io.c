@@ -195,4 +195,6 @@ struct file_ops io_ops = {
     io_sync,
     io_size,
     io_close,
+    NULL,
+    NULL,
 };
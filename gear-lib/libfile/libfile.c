@@ -116,11 +116,18 @@ static struct {
 
 extern const struct file_ops io_ops;
 extern const struct file_ops fio_ops;
-
+#if defined (OS_LINUX) || defined (OS_APPLE)
+extern const struct file_ops mio_ops;
+#endif
 
 static const struct file_ops *file_ops[] = {
     &io_ops,
     &fio_ops,
+#if defined (OS_LINUX) || defined (OS_APPLE)
+    &mio_ops,
+#else
+    NULL,
+#endif
     NULL
 };
 
@@ -131,6 +138,10 @@ static char local_path[PATH_MAX];
 
 void file_backend(file_backend_type type)
 {
+    if ((int)type < 0 || type >= SIZEOF(file_ops) || !file_ops[type]) {
+        printf("file backend %d is not supported, use io\n", type);
+        type = FILE_BACKEND_IO;
+    }
     backend = type;
 }
 
@@ -234,6 +245,22 @@ off_t file_seek(struct file *file, off_t offset, int whence)
     return file->ops->_seek(file->fd, offset, whence);
 }
 
+void *file_mmap(struct file *file, size_t *len)
+{
+    if (!file || !file->ops->_mmap) {
+        return NULL;
+    }
+    return file->ops->_mmap(file->fd, len);
+}
+
+int file_madvise(struct file *file, enum file_advice advice)
+{
+    if (!file || !file->ops->_madvise) {
+        return -1;
+    }
+    return file->ops->_madvise(file->fd, advice);
+}
+
 int file_rename(const char *old_file, const char *new_file)
 {
     return rename(old_file, new_file);
@@ -440,6 +467,21 @@ int file_dir_remove(const char *path)
     return remove(path);
 }
 
+#if defined (OS_LINUX) || defined (OS_APPLE)
+static int dir_tree_cb(const struct file_walk_entry *e, void *arg)
+{
+    if (e->type == F_DIR) {
+        printf("%s\n", e->path);
+    }
+    return 0;
+}
+
+int file_dir_tree(const char *path)
+{
+    /* one worker keeps output in depth first order */
+    return file_dir_walk(path, 1, 0, dir_tree_cb, NULL);
+}
+#else
 int file_dir_tree(const char *path)
 {
     DIR *pdir = NULL;
@@ -475,6 +517,7 @@ int file_dir_tree(const char *path)
     closedir(pdir);
     return 0;
 }
+#endif
 
 int dfs_dir_size(const char *path, uint64_t *size)
 {
@@ -511,10 +554,24 @@ int dfs_dir_size(const char *path, uint64_t *size)
     return 0;
 }
 
+#if defined (OS_LINUX) || defined (OS_APPLE)
+static int dir_size_cb(const struct file_walk_entry *e, void *arg)
+{
+    if (e->type == F_NORMAL) {
+        __atomic_add_fetch((uint64_t *)arg, e->size, __ATOMIC_RELAXED);
+    }
+    return 0;
+}
+#endif
+
 int file_dir_size(const char *path, uint64_t *size)
 {
     *size = 0;
+#if defined (OS_LINUX) || defined (OS_APPLE)
+    return file_dir_walk(path, 0, FILE_WALK_STAT, dir_size_cb, size);
+#else
     return dfs_dir_size(path, size);
+#endif
 }
 
 int file_num_in_dir(const char *path)
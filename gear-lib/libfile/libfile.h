@@ -88,11 +88,14 @@ typedef struct file_ops {
     int (*_sync)(struct file_desc *fd);
     size_t (*_size)(struct file_desc *fd);
     void (*_close)(struct file_desc *fd);
+    void *(*_mmap)(struct file_desc *fd, size_t *len);
+    int (*_madvise)(struct file_desc *fd, int advice);
 } file_ops_t;
 
 typedef enum file_backend_type {
     FILE_BACKEND_IO,
     FILE_BACKEND_FIO,
+    FILE_BACKEND_MIO,
 } file_backend_type;
 
 GEAR_API void file_backend(file_backend_type type);
@@ -112,8 +115,105 @@ GEAR_API int file_get_info(const char *path, struct file_info *info);
 GEAR_API struct iovec *file_dump(const char *path);
 GEAR_API int file_sync(struct file *file);
 GEAR_API off_t file_seek(struct file *file, off_t offset, int whence);
+/* direct access to file content, only FILE_BACKEND_MIO, NULL otherwise */
+GEAR_API void *file_mmap(struct file *file, size_t *len);
+
+/* access pattern hint for mapped pages, madvise(2) */
+enum file_advice {
+    FILE_ADV_NORMAL,
+    FILE_ADV_SEQUENTIAL,
+    FILE_ADV_RANDOM,
+    FILE_ADV_WILLNEED,
+    FILE_ADV_DONTNEED,
+    FILE_ADV_HUGEPAGE,  /* linux only */
+};
+
+/* hint for the FILE_BACKEND_MIO mapping, kept across remap when it grows */
+GEAR_API int file_madvise(struct file *file, enum file_advice advice);
+
+/*
+ * map [offset, offset + len) of fd only, offset need not be page aligned.
+ * addr points at offset, base/map_len is the real page aligned mapping.
+ * useful to walk files larger than address space or to keep the resident
+ * window small, see file_map_advise to drop or prefetch it.
+ */
+struct file_map {
+    void *addr;
+    size_t len;
+    void *base;
+    size_t map_len;
+};
+
+GEAR_API int file_map(struct file_map *m, int fd, off_t offset, size_t len, bool writable);
+GEAR_API int file_map_advise(struct file_map *m, enum file_advice advice);
+GEAR_API int file_map_sync(struct file_map *m);
+GEAR_API void file_unmap(struct file_map *m);
 GEAR_API int file_rename(const char* old_file, const char* new_file);
 
+/*
+ * asynchronous pread/pwrite/fsync on raw fd, io_uring on linux or a thread
+ * pool fallback. requests are batched until file_aio_submit/file_aio_poll,
+ * callbacks run in the thread calling file_aio_poll with res as bytes
+ * transferred or -errno. buffers must stay valid until callback.
+ */
+enum file_aio_backend {
+    FILE_AIO_AUTO,
+    FILE_AIO_URING,
+    FILE_AIO_THREAD,
+};
+
+struct file_aio;
+typedef void (*file_aio_cb)(void *arg, ssize_t res);
+
+GEAR_API struct file_aio *file_aio_create(enum file_aio_backend type, int depth);
+GEAR_API void file_aio_destroy(struct file_aio *aio);
+GEAR_API enum file_aio_backend file_aio_backend(struct file_aio *aio);
+GEAR_API int file_aio_read(struct file_aio *aio, int fd, void *buf, size_t len,
+                off_t offset, file_aio_cb cb, void *arg);
+GEAR_API int file_aio_write(struct file_aio *aio, int fd, const void *buf, size_t len,
+                off_t offset, file_aio_cb cb, void *arg);
+GEAR_API int file_aio_fsync(struct file_aio *aio, int fd, file_aio_cb cb, void *arg);
+GEAR_API int file_aio_submit(struct file_aio *aio);
+/* wait at most timeout_ms (-1 forever) for min_complete, return callbacks run */
+GEAR_API int file_aio_poll(struct file_aio *aio, int min_complete, int timeout_ms);
+GEAR_API int file_aio_inflight(struct file_aio *aio);
+
+/*
+ * zero copy transfer between fds, sendfile for file to socket, copy_file_range
+ * for file to file, splice through a pipe for socket to file. fallback to
+ * read/write when not supported. return bytes moved or -1.
+ */
+GEAR_API ssize_t file_sendfile(int out_fd, int in_fd, off_t *offset, size_t count);
+GEAR_API ssize_t file_copy_range(int in_fd, off_t *in_off, int out_fd, off_t *out_off,
+                size_t len);
+GEAR_API ssize_t file_splice(int out_fd, int in_fd, size_t count);
+GEAR_API int file_copy(const char *src, const char *dst);
+
+/*
+ * segment writer for recording, files are named prefix_000001suffix,
+ * a new segment starts when segment_size would be exceeded.
+ * prealloc_size 0 means segment_size, writebehind 0 means 1MB window,
+ * (size_t)-1 disables write behind.
+ */
+struct file_segment_param {
+    const char *prefix;
+    const char *suffix;
+    int start_index;
+    uint64_t segment_size;
+    uint64_t prealloc_size;
+    size_t writebehind;
+    void (*on_close)(const char *path, uint64_t size, void *arg);
+    void *arg;
+};
+
+struct file_segment;
+GEAR_API struct file_segment *file_segment_open(const struct file_segment_param *param);
+GEAR_API ssize_t file_segment_write(struct file_segment *s, const void *buf, size_t len);
+GEAR_API int file_segment_rotate(struct file_segment *s);
+GEAR_API int file_segment_sync(struct file_segment *s);
+GEAR_API const char *file_segment_path(struct file_segment *s);
+GEAR_API void file_segment_close(struct file_segment *s);
+
 GEAR_API struct file_systat *file_get_systat(const char *path);
 GEAR_API char *file_path_pwd();
 GEAR_API char *file_path_suffix(char *path);
@@ -125,6 +225,27 @@ GEAR_API int file_dir_tree(const char *path);
 GEAR_API int file_dir_size(const char *path, uint64_t *size);
 GEAR_API int file_num_in_dir(const char *path);
 
+/*
+ * walk directory tree with nthreads workers (0 for cpu number), cb may run
+ * concurrently in several threads, return nonzero from cb to stop the walk.
+ * size and modify_sec are valid only with FILE_WALK_STAT.
+ */
+#define FILE_WALK_STAT  (1 << 0)
+
+struct file_walk_entry {
+    const char *path;
+    const char *name;
+    enum file_type type;
+    int depth;
+    bool stat;
+    uint64_t size;
+    uint64_t modify_sec;
+};
+
+typedef int (*file_walk_cb)(const struct file_walk_entry *e, void *arg);
+GEAR_API int file_dir_walk(const char *path, int nthreads, int flags,
+                file_walk_cb cb, void *arg);
+
 #ifdef __cplusplus
 }
 #endif
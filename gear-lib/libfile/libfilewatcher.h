@@ -42,11 +42,22 @@ enum fw_type {
     FW_MODIFY_FILE,
 };
 
+struct fw_event {
+    enum fw_type type;
+    char *path;
+};
+
+struct fw_batch;
+
 typedef struct fw {
     int fd;
     struct gevent_base *evbase;
     dict *dict_path;
     void (*notify_cb)(struct fw *fw, enum fw_type type, char *path);
+    void (*batch_cb)(struct fw *fw, const struct fw_event *events, int num);
+    int latency_ms;
+    struct fw_batch *batch;
+    void *arg;
 } fw_t;
 
 
@@ -54,8 +65,19 @@ GEAR_API struct fw *fw_init(void (notify_cb)(struct fw *fw, enum fw_type type, c
 GEAR_API void fw_deinit(struct fw *fw);
 GEAR_API int fw_add_watch_recursive(struct fw *fw, const char *path);
 GEAR_API int fw_del_watch_recursive(struct fw *fw, const char *path);
+/* watch entries of one directory without going into sub directory */
+GEAR_API int fw_add_watch_dir(struct fw *fw, const char *path);
 GEAR_API int fw_dispatch(struct fw *fw);
 
+/*
+ * events are coalesced before delivery: repeated modify of one path, modify
+ * right after create, and create followed by delete are merged. with
+ * latency_ms > 0 events are held that long to merge more, batch_cb if set
+ * gets all of them in one call, otherwise notify_cb is called per event.
+ */
+GEAR_API int fw_set_batch(struct fw *fw, int latency_ms,
+                void (*batch_cb)(struct fw *fw, const struct fw_event *events, int num));
+
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,401 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include "libfile.h"
+
+#if defined (OS_LINUX) || defined (OS_APPLE)
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+/*
+ * memory mapped backend: the whole file is mapped MAP_SHARED, read and
+ * write are plain memcpy on the mapping. writes beyond the mapping grow
+ * the file with ftruncate and remap, on close the file is truncated back
+ * to the bytes really written.
+ * file_madvise sets a hint that is reapplied after every remap, file_map
+ * maps only a window of any fd.
+ */
+#define MIO_GROW_MIN    (64 * 1024)
+
+struct mio_desc {
+    struct file_desc base;
+    int fd;
+    bool writable;
+    bool append;
+    uint8_t *map;
+    size_t len;
+    size_t cap;
+    size_t pos;
+    int advice;
+};
+
+static size_t mio_page_align(size_t len)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    return (len + page - 1) & ~(page - 1);
+}
+
+static int file_advice_to_madv(int advice)
+{
+    switch (advice) {
+    case FILE_ADV_NORMAL:     return MADV_NORMAL;
+    case FILE_ADV_SEQUENTIAL: return MADV_SEQUENTIAL;
+    case FILE_ADV_RANDOM:     return MADV_RANDOM;
+    case FILE_ADV_WILLNEED:   return MADV_WILLNEED;
+    case FILE_ADV_DONTNEED:   return MADV_DONTNEED;
+#if defined (OS_LINUX) && defined (MADV_HUGEPAGE)
+    case FILE_ADV_HUGEPAGE:   return MADV_HUGEPAGE;
+#endif
+    default:                  return -1;
+    }
+}
+
+static int mio_advise(void *addr, size_t len, int advice)
+{
+    int madv = file_advice_to_madv(advice);
+    if (madv < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (len == 0) {
+        return 0;
+    }
+    if (madvise(addr, len, madv) < 0) {
+        printf("madvise %d failed:%d %s\n", advice, errno, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+static int mio_map(struct mio_desc *m, size_t cap)
+{
+    void *p;
+    int prot = PROT_READ | (m->writable ? PROT_WRITE : 0);
+
+    if (cap == 0) {
+        return 0;
+    }
+#if defined (OS_LINUX)
+    if (m->map) {
+        p = mremap(m->map, m->cap, cap, MREMAP_MAYMOVE);
+    } else {
+        p = mmap(NULL, cap, prot, MAP_SHARED, m->fd, 0);
+    }
+#else
+    if (m->map) {
+        munmap(m->map, m->cap);
+        m->map = NULL;
+    }
+    p = mmap(NULL, cap, prot, MAP_SHARED, m->fd, 0);
+#endif
+    if (p == MAP_FAILED) {
+        printf("mmap %s failed:%d %s\n", m->base.name, errno, strerror(errno));
+        return -1;
+    }
+    m->map = (uint8_t *)p;
+    m->cap = cap;
+    /* a new mapping starts as MADV_NORMAL, carry the hint over.
+     * DONTNEED/WILLNEED are one shot actions, not kept */
+    if (m->advice != FILE_ADV_NORMAL) {
+        mio_advise(m->map, m->cap, m->advice);
+    }
+    return 0;
+}
+
+static struct file_desc *mio_open(const char *path, file_open_mode_t mode)
+{
+    int flags = -1;
+    struct stat st;
+    struct mio_desc *m = CALLOC(1, struct mio_desc);
+    if (!m) {
+        printf("malloc failed:%d %s\n", errno, strerror(errno));
+        return NULL;
+    }
+    /* a shared writable mapping needs the fd opened for read too */
+    switch (mode) {
+    case F_RDONLY:
+        flags = O_RDONLY;
+        break;
+    case F_WRONLY:
+    case F_RDWR:
+        flags = O_RDWR;
+        break;
+    case F_CREATE:
+    case F_WRCLEAR:
+        flags = O_RDWR|O_TRUNC|O_CREAT;
+        break;
+    case F_APPEND:
+        flags = O_RDWR;
+        m->append = true;
+        break;
+    default:
+        printf("unsupport file mode!\n");
+        break;
+    }
+    m->writable = (mode != F_RDONLY);
+    m->fd = open(path, flags, 0666);
+    if (m->fd == -1) {
+        printf("open %s failed:%d %s\n", path, errno, strerror(errno));
+        free(m);
+        return NULL;
+    }
+    m->base.fd = m->fd;
+    m->base.name = strdup(path);
+    if (fstat(m->fd, &st) < 0) {
+        printf("fstat %s failed:%d %s\n", path, errno, strerror(errno));
+        goto failed;
+    }
+    m->len = (size_t)st.st_size;
+    if (0 != mio_map(m, m->len)) {
+        goto failed;
+    }
+    return &m->base;
+
+failed:
+    close(m->fd);
+    free(m->base.name);
+    free(m);
+    return NULL;
+}
+
+static int mio_grow(struct mio_desc *m, size_t need)
+{
+    size_t cap = MAX2(m->cap * 2, (size_t)MIO_GROW_MIN);
+    while (cap < need) {
+        cap *= 2;
+    }
+    cap = mio_page_align(cap);
+    if (ftruncate(m->fd, cap) < 0) {
+        printf("ftruncate %s failed:%d %s\n", m->base.name, errno, strerror(errno));
+        return -1;
+    }
+    return mio_map(m, cap);
+}
+
+static ssize_t mio_read(struct file_desc *file, void *buf, size_t len)
+{
+    size_t n;
+    struct mio_desc *m = (struct mio_desc *)file;
+    if (file == NULL || buf == NULL || len == 0) {
+        printf("%s paraments invalid!\n", __func__);
+        return -1;
+    }
+    if (m->pos >= m->len) {
+        return 0;
+    }
+    n = MIN2(len, m->len - m->pos);
+    memcpy(buf, m->map + m->pos, n);
+    m->pos += n;
+    return n;
+}
+
+static ssize_t mio_write(struct file_desc *file, const void *buf, size_t len)
+{
+    struct mio_desc *m = (struct mio_desc *)file;
+    if (file == NULL || buf == NULL || len == 0) {
+        printf("%s paraments invalid!\n", __func__);
+        return -1;
+    }
+    if (!m->writable) {
+        printf("%s is opened readonly\n", m->base.name);
+        return -1;
+    }
+    if (m->append) {
+        m->pos = m->len;
+    }
+    if (m->pos + len > m->cap && 0 != mio_grow(m, m->pos + len)) {
+        return -1;
+    }
+    memcpy(m->map + m->pos, buf, len);
+    m->pos += len;
+    if (m->pos > m->len) {
+        m->len = m->pos;
+    }
+    return len;
+}
+
+static off_t mio_seek(struct file_desc *file, off_t offset, int whence)
+{
+    off_t pos;
+    struct mio_desc *m = (struct mio_desc *)file;
+    if (!file) {
+        return -1;
+    }
+    switch (whence) {
+    case SEEK_SET:
+        pos = offset;
+        break;
+    case SEEK_CUR:
+        pos = (off_t)m->pos + offset;
+        break;
+    case SEEK_END:
+        pos = (off_t)m->len + offset;
+        break;
+    default:
+        return -1;
+    }
+    if (pos < 0) {
+        return -1;
+    }
+    m->pos = (size_t)pos;
+    return pos;
+}
+
+static int mio_sync(struct file_desc *file)
+{
+    struct mio_desc *m = (struct mio_desc *)file;
+    if (!file) {
+        return -1;
+    }
+    if (!m->map || !m->writable) {
+        return 0;
+    }
+    return msync(m->map, m->cap, MS_SYNC);
+}
+
+static size_t mio_size(struct file_desc *file)
+{
+    struct mio_desc *m = (struct mio_desc *)file;
+    if (!file) {
+        return 0;
+    }
+    return m->len;
+}
+
+static void mio_close(struct file_desc *file)
+{
+    struct mio_desc *m = (struct mio_desc *)file;
+    if (!file) {
+        return;
+    }
+    if (m->map) {
+        munmap(m->map, m->cap);
+    }
+    /* drop the slack left by mio_grow */
+    if (m->writable && m->cap > m->len) {
+        if (ftruncate(m->fd, m->len) < 0) {
+            printf("ftruncate %s failed:%d %s\n", m->base.name, errno, strerror(errno));
+        }
+    }
+    close(m->fd);
+    free(m->base.name);
+    free(m);
+}
+
+static void *mio_mmap(struct file_desc *file, size_t *len)
+{
+    struct mio_desc *m = (struct mio_desc *)file;
+    if (!file) {
+        return NULL;
+    }
+    if (len) {
+        *len = m->len;
+    }
+    return m->map;
+}
+
+static int mio_madvise(struct file_desc *file, int advice)
+{
+    struct mio_desc *m = (struct mio_desc *)file;
+    if (!file) {
+        return -1;
+    }
+    if (0 != mio_advise(m->map, m->cap, advice)) {
+        return -1;
+    }
+    if (advice != FILE_ADV_WILLNEED && advice != FILE_ADV_DONTNEED) {
+        m->advice = advice;
+    }
+    return 0;
+}
+
+struct file_ops mio_ops = {
+    mio_open,
+    mio_write,
+    mio_read,
+    mio_seek,
+    mio_sync,
+    mio_size,
+    mio_close,
+    mio_mmap,
+    mio_madvise,
+};
+
+int file_map(struct file_map *m, int fd, off_t offset, size_t len, bool writable)
+{
+    void *p;
+    off_t delta;
+    off_t page = (off_t)sysconf(_SC_PAGESIZE);
+    int prot = PROT_READ | (writable ? PROT_WRITE : 0);
+
+    if (!m || fd < 0 || offset < 0 || len == 0) {
+        printf("%s paraments invalid!\n", __func__);
+        return -1;
+    }
+    delta = offset & (page - 1);
+    p = mmap(NULL, len + delta, prot, MAP_SHARED, fd, offset - delta);
+    if (p == MAP_FAILED) {
+        printf("mmap fd %d at %jd failed:%d %s\n", fd, (intmax_t)offset, errno, strerror(errno));
+        return -1;
+    }
+    m->base = p;
+    m->map_len = len + delta;
+    m->addr = (uint8_t *)p + delta;
+    m->len = len;
+    return 0;
+}
+
+int file_map_advise(struct file_map *m, enum file_advice advice)
+{
+    if (!m || !m->base) {
+        return -1;
+    }
+    return mio_advise(m->base, m->map_len, advice);
+}
+
+int file_map_sync(struct file_map *m)
+{
+    if (!m || !m->base) {
+        return -1;
+    }
+    return msync(m->base, m->map_len, MS_SYNC);
+}
+
+void file_unmap(struct file_map *m)
+{
+    if (!m || !m->base) {
+        return;
+    }
+    munmap(m->base, m->map_len);
+    memset(m, 0, sizeof(*m));
+}
+
+#endif
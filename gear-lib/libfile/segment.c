@@ -0,0 +1,246 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include "libfile.h"
+
+#if defined (OS_LINUX) || defined (OS_APPLE)
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/*
+ * segment writer for recording: output is split into files of about
+ * segment_size bytes, a write is never split between two segments.
+ * each segment is preallocated with fallocate(KEEP_SIZE) so the fs gets
+ * contiguous extents and no block allocation happens in write path.
+ * write behind: after every window of bytes, writeback of that window is
+ * started with sync_file_range, the window before it is waited for and
+ * dropped from page cache, so dirty memory stays bounded to two windows
+ * and there is no big flush stall when the segment is closed.
+ */
+#define SEGMENT_WB_DEFAULT  (1024 * 1024)
+
+struct file_segment {
+    struct file_segment_param param;
+    char *prefix;
+    char *suffix;
+    char path[PATH_MAX];
+    int fd;
+    int index;
+    uint64_t size;
+    uint64_t wb_start;
+};
+
+static void segment_writebehind(struct file_segment *s)
+{
+#if defined (OS_LINUX)
+    size_t win = s->param.writebehind;
+    while (s->size - s->wb_start >= win) {
+        sync_file_range(s->fd, s->wb_start, win, SYNC_FILE_RANGE_WRITE);
+        if (s->wb_start >= win) {
+            uint64_t prev = s->wb_start - win;
+            sync_file_range(s->fd, prev, win, SYNC_FILE_RANGE_WAIT_BEFORE |
+                            SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+            posix_fadvise(s->fd, prev, win, POSIX_FADV_DONTNEED);
+        }
+        s->wb_start += win;
+    }
+#endif
+}
+
+static void segment_prealloc(struct file_segment *s)
+{
+    uint64_t len = s->param.prealloc_size;
+    if (len == 0) {
+        return;
+    }
+#if defined (OS_LINUX)
+    /* keep size, readers of a growing segment never see zero tail */
+    if (fallocate(s->fd, FALLOC_FL_KEEP_SIZE, 0, len) < 0 &&
+        errno != EOPNOTSUPP && errno != ENOSYS) {
+        printf("fallocate %s failed:%d %s\n", s->path, errno, strerror(errno));
+    }
+#elif defined (OS_APPLE)
+    fstore_t fst;
+    memset(&fst, 0, sizeof(fst));
+    fst.fst_flags = F_ALLOCATECONTIG;
+    fst.fst_posmode = F_PEOFPOSMODE;
+    fst.fst_length = len;
+    if (fcntl(s->fd, F_PREALLOCATE, &fst) < 0) {
+        fst.fst_flags = F_ALLOCATEALL;
+        fcntl(s->fd, F_PREALLOCATE, &fst);
+    }
+#endif
+}
+
+static int segment_open_next(struct file_segment *s)
+{
+    s->index++;
+    snprintf(s->path, sizeof(s->path), "%s_%06d%s", s->prefix, s->index,
+             s->suffix);
+    s->fd = open(s->path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (s->fd < 0) {
+        printf("open %s failed:%d %s\n", s->path, errno, strerror(errno));
+        return -1;
+    }
+    s->size = 0;
+    s->wb_start = 0;
+    segment_prealloc(s);
+    return 0;
+}
+
+static void segment_close_cur(struct file_segment *s)
+{
+    if (s->fd < 0) {
+        return;
+    }
+    /* give back preallocated blocks beyond what was written */
+    if (s->param.prealloc_size > s->size && ftruncate(s->fd, s->size) < 0) {
+        printf("ftruncate %s failed:%d %s\n", s->path, errno, strerror(errno));
+    }
+    if (s->param.writebehind > 0) {
+#if defined (OS_LINUX)
+        posix_fadvise(s->fd, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+    }
+    close(s->fd);
+    s->fd = -1;
+    if (s->param.on_close) {
+        s->param.on_close(s->path, s->size, s->param.arg);
+    }
+}
+
+struct file_segment *file_segment_open(const struct file_segment_param *param)
+{
+    struct file_segment *s;
+
+    if (!param || !param->prefix) {
+        printf("%s paraments invalid!\n", __func__);
+        return NULL;
+    }
+    s = CALLOC(1, struct file_segment);
+    if (!s) {
+        printf("malloc file_segment failed!\n");
+        return NULL;
+    }
+    s->param = *param;
+    s->prefix = strdup(param->prefix);
+    s->suffix = strdup(param->suffix ? param->suffix : "");
+    s->index = param->start_index > 0 ? param->start_index - 1 : 0;
+    if (s->param.prealloc_size == 0) {
+        s->param.prealloc_size = s->param.segment_size;
+    }
+    if (s->param.writebehind == (size_t)-1) {
+        s->param.writebehind = 0;
+    } else if (s->param.writebehind == 0) {
+        s->param.writebehind = SEGMENT_WB_DEFAULT;
+    }
+    s->fd = -1;
+    if (0 != segment_open_next(s)) {
+        free(s->prefix);
+        free(s->suffix);
+        free(s);
+        return NULL;
+    }
+    return s;
+}
+
+ssize_t file_segment_write(struct file_segment *s, const void *buf, size_t len)
+{
+    ssize_t n;
+    size_t left = len;
+    const uint8_t *p = (const uint8_t *)buf;
+
+    if (!s || !buf || len == 0) {
+        printf("%s paraments invalid!\n", __func__);
+        return -1;
+    }
+    if (s->param.segment_size > 0 && s->size > 0 &&
+        s->size + len > s->param.segment_size) {
+        if (0 != file_segment_rotate(s)) {
+            return -1;
+        }
+    }
+    if (s->fd < 0) {
+        return -1;
+    }
+    while (left > 0) {
+        n = write(s->fd, p, left);
+        if (n > 0) {
+            p += n;
+            left -= n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        printf("write %s failed:%d %s\n", s->path, errno, strerror(errno));
+        break;
+    }
+    s->size += len - left;
+    if (s->param.writebehind > 0) {
+        segment_writebehind(s);
+    }
+    return len - left;
+}
+
+int file_segment_rotate(struct file_segment *s)
+{
+    if (!s) {
+        return -1;
+    }
+    segment_close_cur(s);
+    return segment_open_next(s);
+}
+
+const char *file_segment_path(struct file_segment *s)
+{
+    return s ? s->path : NULL;
+}
+
+int file_segment_sync(struct file_segment *s)
+{
+    if (!s || s->fd < 0) {
+        return -1;
+    }
+    return fsync(s->fd);
+}
+
+void file_segment_close(struct file_segment *s)
+{
+    if (!s) {
+        return;
+    }
+    segment_close_cur(s);
+    free(s->prefix);
+    free(s->suffix);
+    free(s);
+}
+
+#endif
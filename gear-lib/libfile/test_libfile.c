@@ -22,12 +22,15 @@
 #include "libfile.h"
 #ifdef ENABLE_FILEWATCHER
 #include "libfilewatcher.h"
+#include <pthread.h>
 #endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 #define __STDC_FORMAT_MACROS
 #include <inttypes.h>
 #include <signal.h>
@@ -72,6 +75,206 @@ static void foo(void)
     }
 }
 
+static void foo_mmap(void)
+{
+    int i, fd;
+    size_t len = 0;
+    char buf[128] = {0};
+    char *map;
+    struct file *f;
+    struct file_map win;
+
+    file_backend(FILE_BACKEND_MIO);
+    f = file_open("mmap.txt", F_CREATE);
+    for (i = 0; i < 10000; i++) {
+        file_write(f, "hello mmap\n", 11);
+    }
+    file_seek(f, 0, SEEK_SET);
+    file_read(f, buf, 11);
+    printf("mmap size=%zd, buf = %s", file_size(f), buf);
+    file_close(f);
+    printf("mmap file len=%zd\n", file_get_size("mmap.txt"));
+
+    f = file_open("mmap.txt", F_RDONLY);
+    file_madvise(f, FILE_ADV_SEQUENTIAL);
+    map = (char *)file_mmap(f, &len);
+    if (map && len == 110000 && !memcmp(map + len - 11, "hello mmap\n", 11)) {
+        printf("file_mmap ok\n");
+    } else {
+        printf("file_mmap failed\n");
+    }
+    file_close(f);
+
+    /* window at an unaligned offset deep in the file */
+    fd = open("mmap.txt", O_RDONLY);
+    if (0 == file_map(&win, fd, 11 * 5000 + 6, 5, false)) {
+        file_map_advise(&win, FILE_ADV_WILLNEED);
+        printf("file_map %s\n", !memcmp(win.addr, "mmap\n", 5) ? "ok" : "failed");
+        file_unmap(&win);
+    } else {
+        printf("file_map failed\n");
+    }
+    close(fd);
+    file_delete("mmap.txt");
+    file_backend(FILE_BACKEND_IO);
+}
+
+#if defined (OS_LINUX) || defined (OS_APPLE)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#define AIO_BLOCKS  (64)
+#define AIO_BSIZE   (4096)
+
+static void aio_done(void *arg, ssize_t res)
+{
+    int *ok = (int *)arg;
+    if (res == AIO_BSIZE) {
+        (*ok)++;
+    }
+}
+
+static void foo_aio(enum file_aio_backend type)
+{
+    int i, fd, wok = 0, rok = 0, match = 1;
+    enum file_aio_backend real;
+    static uint8_t wbuf[AIO_BLOCKS][AIO_BSIZE];
+    static uint8_t rbuf[AIO_BLOCKS][AIO_BSIZE];
+    struct file_aio *aio = file_aio_create(type, 16);
+
+    if (!aio) {
+        printf("file_aio_create %d failed\n", type);
+        return;
+    }
+    fd = open("aio.bin", O_RDWR|O_CREAT|O_TRUNC, 0666);
+    for (i = 0; i < AIO_BLOCKS; i++) {
+        memset(wbuf[i], i, AIO_BSIZE);
+        while (0 != file_aio_write(aio, fd, wbuf[i], AIO_BSIZE,
+                    (off_t)i * AIO_BSIZE, aio_done, &wok)) {
+            /* queue is full, reap some */
+            file_aio_poll(aio, 1, -1);
+        }
+    }
+    file_aio_fsync(aio, fd, NULL, NULL);
+    while (file_aio_inflight(aio) > 0) {
+        file_aio_poll(aio, 1, -1);
+    }
+    for (i = AIO_BLOCKS - 1; i >= 0; i--) {
+        while (0 != file_aio_read(aio, fd, rbuf[i], AIO_BSIZE,
+                    (off_t)i * AIO_BSIZE, aio_done, &rok)) {
+            file_aio_poll(aio, 1, -1);
+        }
+    }
+    file_aio_submit(aio);
+    real = file_aio_backend(aio);
+    file_aio_destroy(aio);
+    close(fd);
+    for (i = 0; i < AIO_BLOCKS; i++) {
+        match &= !memcmp(wbuf[i], rbuf[i], AIO_BSIZE);
+    }
+    printf("file_aio backend=%d write=%d read=%d %s\n", real, wok, rok,
+           (wok == AIO_BLOCKS && rok == AIO_BLOCKS && match) ? "ok" : "failed");
+    file_delete("aio.bin");
+}
+
+static void foo_xfer(void)
+{
+    int i, fd, sv[2], ok = 1;
+    off_t off = 100;
+    ssize_t n;
+    static char data[200000];
+    static char back[200000];
+
+    for (i = 0; i < (int)sizeof(data); i++) {
+        data[i] = 'a' + i % 26;
+    }
+    file_write_path("xfer_src.bin", data, sizeof(data));
+    ok &= (0 == file_copy("xfer_src.bin", "xfer_dst.bin"));
+    ok &= (file_get_size("xfer_dst.bin") == sizeof(data));
+
+    /* file to socket and back with sendfile and splice */
+    socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+    fd = open("xfer_src.bin", O_RDONLY);
+    n = file_sendfile(sv[0], fd, &off, 50000);
+    ok &= (n == 50000 && off == 50100);
+    close(fd);
+    fd = open("xfer_out.bin", O_WRONLY|O_CREAT|O_TRUNC, 0666);
+    n = file_splice(fd, sv[1], 50000);
+    ok &= (n == 50000);
+    close(fd);
+    close(sv[0]);
+    close(sv[1]);
+    file_read_path("xfer_out.bin", back, 50000);
+    ok &= !memcmp(back, data + 100, 50000);
+    printf("file zero copy %s\n", ok ? "ok" : "failed");
+    file_delete("xfer_src.bin");
+    file_delete("xfer_dst.bin");
+    file_delete("xfer_out.bin");
+}
+
+static int walk_count_cb(const struct file_walk_entry *e, void *arg)
+{
+    __atomic_add_fetch((int *)arg, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+static void foo_walk(void)
+{
+    int i, j, cnt1 = 0, cnt4 = 0;
+    char path[256];
+    uint64_t size = 0;
+
+    for (i = 0; i < 8; i++) {
+        snprintf(path, sizeof(path), "walk_test/d%d/sub", i);
+        file_dir_create(path);
+        for (j = 0; j < 16; j++) {
+            snprintf(path, sizeof(path), "walk_test/d%d/sub/f%d", i, j);
+            file_write_path(path, "0123456789", 10);
+        }
+    }
+    file_dir_walk("walk_test", 1, 0, walk_count_cb, &cnt1);
+    file_dir_walk("walk_test", 4, 0, walk_count_cb, &cnt4);
+    file_dir_size("walk_test", &size);
+    printf("file_dir_walk entries=%d/%d size=%" PRIu64 " %s\n", cnt1, cnt4,
+           size, (cnt1 == 8 * 18 && cnt4 == cnt1 && size == 8 * 16 * 10) ?
+           "ok" : "failed");
+    file_dir_remove("walk_test");
+}
+
+static void segment_closed(const char *path, uint64_t size, void *arg)
+{
+    int *ok = (int *)arg;
+    if (size == 300000 && file_get_size(path) == 300000) {
+        (*ok)++;
+    }
+    file_delete(path);
+}
+
+static void foo_segment(void)
+{
+    int i, ok = 0;
+    static char frame[100000];
+    struct file_segment_param param;
+    struct file_segment *s;
+
+    memset(&param, 0, sizeof(param));
+    param.prefix = "record";
+    param.suffix = ".ts";
+    param.segment_size = 350000;
+    param.writebehind = 64 * 1024;
+    param.on_close = segment_closed;
+    param.arg = &ok;
+    s = file_segment_open(&param);
+    memset(frame, 0x47, sizeof(frame));
+    for (i = 0; i < 9; i++) {
+        file_segment_write(s, frame, sizeof(frame));
+    }
+    file_segment_close(s);
+    printf("file_segment %s\n", ok == 3 ? "ok" : "failed");
+}
+#endif
+
 static void foo2(void)
 {
     struct file_systat *stat = file_get_systat("./Makefile");
@@ -156,6 +359,61 @@ void on_change(struct fw *fw, enum fw_type type, char *path)
 }
 
 
+static int batch_num = 0;
+static int batch_events = 0;
+static int batch_modify = 0;
+
+static void on_batch(struct fw *fw, const struct fw_event *events, int num)
+{
+    int i;
+    batch_num++;
+    for (i = 0; i < num; i++) {
+        batch_events++;
+        if (events[i].type == FW_MODIFY_FILE) {
+            batch_modify++;
+        }
+    }
+}
+
+static void *fw_loop(void *arg)
+{
+    fw_dispatch((struct fw *)arg);
+    return NULL;
+}
+
+static void file_watcher_batch(void)
+{
+    int i;
+    pthread_t tid;
+    struct file *f;
+    struct fw *fw = fw_init(on_change);
+
+    file_dir_create("fw_test");
+    f = file_open("fw_test/a.txt", F_CREATE);
+    file_close(f);
+    fw_add_watch_recursive(fw, "fw_test");
+    fw_set_batch(fw, 100, on_batch);
+    pthread_create(&tid, NULL, fw_loop, fw);
+    usleep(50 * 1000);
+
+    /* 20 writes of one file, plus a file created and deleted at once */
+    f = file_open("fw_test/a.txt", F_WRONLY);
+    for (i = 0; i < 20; i++) {
+        file_write(f, "x", 1);
+    }
+    file_close(f);
+    file_create("fw_test/tmp.txt");
+    file_delete("fw_test/tmp.txt");
+    usleep(300 * 1000);
+
+    gevent_base_loop_break(fw->evbase);
+    pthread_join(tid, NULL);
+    fw_deinit(fw);
+    file_dir_remove("fw_test");
+    printf("fw batch=%d events=%d modify=%d %s\n", batch_num, batch_events,
+           batch_modify, (batch_num == 1 && batch_modify == 1) ? "ok" : "failed");
+}
+
 int file_watcher_foo()
 {
     _fw = fw_init(on_change);
@@ -194,10 +452,19 @@ int main(int argc, char **argv)
     foo();
     foo2();
     foo3();
+    foo_mmap();
+#if defined (OS_LINUX) || defined (OS_APPLE)
+    foo_aio(FILE_AIO_AUTO);
+    foo_aio(FILE_AIO_THREAD);
+    foo_xfer();
+    foo_walk();
+    foo_segment();
+#endif
     if (0 != file_create("jjj.c")) {
         printf("file_create failed!\n");
     }
 #ifdef ENABLE_FILEWATCHER
+    file_watcher_batch();
     file_watcher_foo();
 #endif
     return 0;
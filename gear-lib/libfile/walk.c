@@ -0,0 +1,320 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include "libfile.h"
+
+#if defined (OS_LINUX) || defined (OS_APPLE)
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#if defined (OS_LINUX)
+#include <sys/syscall.h>
+#endif
+
+/*
+ * directory walker: a shared stack of pending directories drained by a
+ * few worker threads. each directory is opened once and its entries are
+ * read in big batches with getdents64 on linux, attributes come from
+ * fstatat relative to the directory fd, so no full path lookup per file.
+ */
+#define WALK_DENTS_BUF      (32 * 1024)
+#define WALK_MAX_THREADS    (8)
+
+struct walk_node {
+    struct walk_node *next;
+    int depth;
+    char path[0];
+};
+
+struct walk_ctx {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct walk_node *stack;
+    int active;
+    int flags;
+    bool stop;
+    file_walk_cb cb;
+    void *arg;
+};
+
+#if defined (OS_LINUX)
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+#endif
+
+static struct walk_node *walk_node_create(const char *dir, const char *name,
+                int depth)
+{
+    size_t dlen = strlen(dir);
+    size_t nlen = name ? strlen(name) : 0;
+    struct walk_node *n;
+
+    if (dlen + nlen + 2 > PATH_MAX) {
+        printf("path too long: %s/%s\n", dir, name);
+        return NULL;
+    }
+    n = (struct walk_node *)malloc(sizeof(*n) + dlen + nlen + 2);
+    if (!n) {
+        printf("malloc walk_node failed!\n");
+        return NULL;
+    }
+    memcpy(n->path, dir, dlen);
+    if (name) {
+        if (dlen > 0 && dir[dlen - 1] != '/') {
+            n->path[dlen++] = '/';
+        }
+        memcpy(n->path + dlen, name, nlen);
+    }
+    n->path[dlen + nlen] = '\0';
+    n->depth = depth;
+    n->next = NULL;
+    return n;
+}
+
+static enum file_type walk_type_of_mode(mode_t mode)
+{
+    switch (mode & S_IFMT) {
+    case S_IFDIR:
+        return F_DIR;
+    case S_IFLNK:
+        return F_LINK;
+    case S_IFSOCK:
+        return F_SOCKET;
+    case S_IFBLK:
+    case S_IFCHR:
+        return F_DEVICE;
+    default:
+        return F_NORMAL;
+    }
+}
+
+/* return -1 if attributes must come from fstatat */
+static int walk_type_of_dtype(unsigned char d_type)
+{
+    switch (d_type) {
+    case DT_DIR:
+        return F_DIR;
+    case DT_LNK:
+        return F_LINK;
+    case DT_SOCK:
+        return F_SOCKET;
+    case DT_BLK:
+    case DT_CHR:
+        return F_DEVICE;
+    case DT_REG:
+    case DT_FIFO:
+        return F_NORMAL;
+    default:
+        return -1;
+    }
+}
+
+/* report one entry, queue it in subs if it is a directory to descend */
+static void walk_entry(struct walk_ctx *ctx, int dfd, struct walk_node *dir,
+                const char *name, unsigned char d_type, struct walk_node **subs)
+{
+    char path[PATH_MAX];
+    struct stat st;
+    struct file_walk_entry e;
+    struct walk_node *sub;
+    int type;
+
+    if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+        return;
+    }
+    memset(&e, 0, sizeof(e));
+    type = walk_type_of_dtype(d_type);
+    if ((ctx->flags & FILE_WALK_STAT) || type < 0) {
+        if (fstatat(dfd, name, &st, AT_SYMLINK_NOFOLLOW) < 0) {
+            return;
+        }
+        type = walk_type_of_mode(st.st_mode);
+        e.size = st.st_size;
+        e.modify_sec = st.st_mtime;
+        e.stat = true;
+    }
+    snprintf(path, sizeof(path), "%s%s%s", dir->path,
+             dir->path[strlen(dir->path) - 1] == '/' ? "" : "/", name);
+    e.path = path;
+    e.name = name;
+    e.type = (enum file_type)type;
+    e.depth = dir->depth + 1;
+    if (ctx->cb && 0 != ctx->cb(&e, ctx->arg)) {
+        __atomic_store_n(&ctx->stop, true, __ATOMIC_RELAXED);
+        return;
+    }
+    if (type == F_DIR) {
+        sub = walk_node_create(dir->path, name, dir->depth + 1);
+        if (sub) {
+            sub->next = *subs;
+            *subs = sub;
+        }
+    }
+}
+
+static void walk_scan(struct walk_ctx *ctx, struct walk_node *dir,
+                struct walk_node **subs)
+{
+    int dfd = open(dir->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dfd < 0) {
+        printf("can not open path: %s\n", dir->path);
+        return;
+    }
+#if defined (OS_LINUX) && defined (SYS_getdents64)
+    char buf[WALK_DENTS_BUF];
+    long n, pos;
+    while (!__atomic_load_n(&ctx->stop, __ATOMIC_RELAXED)) {
+        n = syscall(SYS_getdents64, dfd, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        for (pos = 0; pos < n; ) {
+            struct linux_dirent64 *d = (struct linux_dirent64 *)(buf + pos);
+            walk_entry(ctx, dfd, dir, d->d_name, d->d_type, subs);
+            pos += d->d_reclen;
+        }
+    }
+    close(dfd);
+#else
+    DIR *pdir = fdopendir(dfd);
+    struct dirent *ent;
+    if (!pdir) {
+        close(dfd);
+        return;
+    }
+    while (!__atomic_load_n(&ctx->stop, __ATOMIC_RELAXED) &&
+           NULL != (ent = readdir(pdir))) {
+        walk_entry(ctx, dfd, dir, ent->d_name, ent->d_type, subs);
+    }
+    closedir(pdir);
+#endif
+}
+
+static void *walk_worker(void *arg)
+{
+    struct walk_ctx *ctx = (struct walk_ctx *)arg;
+    struct walk_node *dir, *subs, *last;
+
+    pthread_mutex_lock(&ctx->lock);
+    while (1) {
+        while (!ctx->stack && ctx->active > 0) {
+            pthread_cond_wait(&ctx->cond, &ctx->lock);
+        }
+        if (!ctx->stack) {
+            /* nothing queued and nobody scanning, walk finished */
+            break;
+        }
+        dir = ctx->stack;
+        ctx->stack = dir->next;
+        ctx->active++;
+        pthread_mutex_unlock(&ctx->lock);
+
+        subs = NULL;
+        if (!__atomic_load_n(&ctx->stop, __ATOMIC_RELAXED)) {
+            walk_scan(ctx, dir, &subs);
+        }
+        free(dir);
+
+        pthread_mutex_lock(&ctx->lock);
+        ctx->active--;
+        if (subs) {
+            for (last = subs; last->next; last = last->next);
+            last->next = ctx->stack;
+            ctx->stack = subs;
+            pthread_cond_broadcast(&ctx->cond);
+        } else if (ctx->active == 0 && !ctx->stack) {
+            pthread_cond_broadcast(&ctx->cond);
+        }
+    }
+    pthread_mutex_unlock(&ctx->lock);
+    return NULL;
+}
+
+int file_dir_walk(const char *path, int nthreads, int flags,
+                file_walk_cb cb, void *arg)
+{
+    int i, started = 0;
+    struct walk_ctx ctx;
+    struct walk_node *n;
+    pthread_t tids[WALK_MAX_THREADS];
+
+    if (!path) {
+        printf("%s paraments invalid!\n", __func__);
+        return -1;
+    }
+    if (access(path, R_OK | X_OK) < 0) {
+        printf("can not open path: %s\n", path);
+        return (errno == EMFILE) ? -EMFILE : -1;
+    }
+    if (nthreads <= 0) {
+        nthreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    nthreads = MAX2(1, MIN2(nthreads, WALK_MAX_THREADS));
+
+    memset(&ctx, 0, sizeof(ctx));
+    pthread_mutex_init(&ctx.lock, NULL);
+    pthread_cond_init(&ctx.cond, NULL);
+    ctx.flags = flags;
+    ctx.cb = cb;
+    ctx.arg = arg;
+    ctx.stack = walk_node_create(path, NULL, 0);
+    if (!ctx.stack) {
+        return -1;
+    }
+    /* calling thread is a worker too */
+    for (i = 0; i < nthreads - 1; i++) {
+        if (0 != pthread_create(&tids[i], NULL, walk_worker, &ctx)) {
+            break;
+        }
+        started++;
+    }
+    walk_worker(&ctx);
+    for (i = 0; i < started; i++) {
+        pthread_join(tids[i], NULL);
+    }
+    while ((n = ctx.stack)) {
+        ctx.stack = n->next;
+        free(n);
+    }
+    pthread_cond_destroy(&ctx.cond);
+    pthread_mutex_destroy(&ctx.lock);
+    return 0;
+}
+
+#endif
@@ -0,0 +1,324 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include "libfile.h"
+
+#if defined (OS_LINUX) || defined (OS_APPLE)
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#if defined (OS_LINUX)
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#endif
+
+/*
+ * zero copy transfer: data moves between fds inside kernel, never comes
+ * to user space. each helper falls back to a read/write loop when the
+ * kernel or the fd types do not support the fast path.
+ * like sendfile(2), if offset is not NULL input is read from *offset and
+ * *offset is updated, file position of in_fd is untouched; otherwise read
+ * from current position.
+ * on non-blocking fds return bytes moved so far, -1 with EAGAIN if none.
+ */
+#define XFER_CHUNK      (64 * 1024)
+#define XFER_MAX        (0x7ffff000)
+
+static ssize_t xfer_fallback(int out_fd, int in_fd, off_t *offset, size_t count)
+{
+    char buf[XFER_CHUNK];
+    ssize_t n = 0, w, total = 0;
+    size_t done;
+
+    while ((size_t)total < count) {
+        size_t len = MIN2(count - (size_t)total, sizeof(buf));
+        if (offset) {
+            n = pread(in_fd, buf, len, *offset);
+        } else {
+            n = read(in_fd, buf, len);
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        done = 0;
+        while (done < (size_t)n) {
+            w = write(out_fd, buf + done, n - done);
+            if (w < 0 && errno == EINTR) {
+                continue;
+            }
+            if (w <= 0) {
+                /* give back what could not be written */
+                if (!offset && done < (size_t)n) {
+                    lseek(in_fd, (off_t)done - n, SEEK_CUR);
+                }
+                total += done;
+                if (offset) {
+                    *offset += done;
+                }
+                return total > 0 ? total : -1;
+            }
+            done += w;
+        }
+        total += n;
+        if (offset) {
+            *offset += n;
+        }
+    }
+    return (total > 0 || n == 0) ? total : -1;
+}
+
+ssize_t file_sendfile(int out_fd, int in_fd, off_t *offset, size_t count)
+{
+    ssize_t n, total = 0;
+
+    if (out_fd < 0 || in_fd < 0) {
+        printf("%s paraments invalid!\n", __func__);
+        return -1;
+    }
+#if defined (OS_LINUX)
+    while ((size_t)total < count) {
+        n = sendfile(out_fd, in_fd, offset, MIN2(count - (size_t)total, (size_t)XFER_MAX));
+        if (n > 0) {
+            total += n;
+            continue;
+        }
+        if (n == 0) {
+            break;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if ((errno == EINVAL || errno == ENOSYS) && total == 0) {
+            return xfer_fallback(out_fd, in_fd, offset, count);
+        }
+        return total > 0 ? total : -1;
+    }
+    return total;
+#elif defined (OS_APPLE)
+    /* apple sendfile only supports file to socket */
+    while ((size_t)total < count) {
+        off_t pos = offset ? *offset : lseek(in_fd, 0, SEEK_CUR);
+        off_t len = (off_t)(count - (size_t)total);
+        int ret = sendfile(in_fd, out_fd, pos, &len, NULL, 0);
+        if (len > 0) {
+            total += len;
+            if (offset) {
+                *offset += len;
+            } else {
+                lseek(in_fd, len, SEEK_CUR);
+            }
+        }
+        if (ret == 0) {
+            if (len == 0) {
+                break;
+            }
+            continue;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if ((errno == ENOTSOCK || errno == EOPNOTSUPP) && total == 0) {
+            return xfer_fallback(out_fd, in_fd, offset, count);
+        }
+        return total > 0 ? total : -1;
+    }
+    return total;
+#endif
+}
+
+ssize_t file_copy_range(int in_fd, off_t *in_off, int out_fd, off_t *out_off,
+                size_t len)
+{
+    ssize_t n, total = 0;
+
+    if (out_fd < 0 || in_fd < 0) {
+        printf("%s paraments invalid!\n", __func__);
+        return -1;
+    }
+#if defined (OS_LINUX) && defined (__NR_copy_file_range)
+    while ((size_t)total < len) {
+        n = syscall(__NR_copy_file_range, in_fd, in_off, out_fd, out_off,
+                    MIN2(len - (size_t)total, (size_t)XFER_MAX), 0);
+        if (n > 0) {
+            total += n;
+            continue;
+        }
+        if (n == 0) {
+            break;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        /* cross filesystem on old kernels, or not supported at all */
+        if ((errno == EXDEV || errno == ENOSYS || errno == EINVAL ||
+             errno == EOPNOTSUPP) && total == 0) {
+            break;
+        }
+        return total > 0 ? total : -1;
+    }
+    if (total > 0 || len == 0) {
+        return total;
+    }
+#endif
+    if (out_off) {
+        /* pwrite based path for explicit output offset */
+        char buf[XFER_CHUNK];
+        while ((size_t)total < len) {
+            size_t chunk = MIN2(len - (size_t)total, sizeof(buf));
+            ssize_t w;
+            n = in_off ? pread(in_fd, buf, chunk, *in_off) : read(in_fd, buf, chunk);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                break;
+            }
+            w = pwrite(out_fd, buf, n, *out_off);
+            if (w < 0) {
+                return total > 0 ? total : -1;
+            }
+            *out_off += w;
+            if (in_off) {
+                *in_off += w;
+            } else if (w < n) {
+                lseek(in_fd, (off_t)w - n, SEEK_CUR);
+            }
+            total += w;
+            if (w < n) {
+                break;
+            }
+        }
+        return total;
+    }
+    return xfer_fallback(out_fd, in_fd, in_off, len);
+}
+
+ssize_t file_splice(int out_fd, int in_fd, size_t count)
+{
+#if defined (OS_LINUX)
+    int pfd[2];
+    ssize_t n = 0, w, total = 0;
+    size_t buffered = 0;
+
+    if (out_fd < 0 || in_fd < 0) {
+        printf("%s paraments invalid!\n", __func__);
+        return -1;
+    }
+    /* splice needs a pipe on one side, use a private one in the middle */
+    if (pipe2(pfd, O_CLOEXEC) < 0) {
+        printf("pipe2 failed:%d %s\n", errno, strerror(errno));
+        return -1;
+    }
+    while ((size_t)total < count) {
+        n = splice(in_fd, NULL, pfd[1], NULL,
+                   MIN2(count - (size_t)total - buffered, (size_t)XFER_MAX),
+                   SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && errno == EINVAL && total == 0 && buffered == 0) {
+            close(pfd[0]);
+            close(pfd[1]);
+            return xfer_fallback(out_fd, in_fd, NULL, count);
+        }
+        if (n <= 0) {
+            break;
+        }
+        buffered += n;
+        while (buffered > 0) {
+            w = splice(pfd[0], NULL, out_fd, NULL, buffered,
+                       SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (w < 0 && errno == EINTR) {
+                continue;
+            }
+            if (w <= 0) {
+                /* data left in pipe is lost for caller, report written */
+                close(pfd[0]);
+                close(pfd[1]);
+                return total > 0 ? total : -1;
+            }
+            buffered -= w;
+            total += w;
+        }
+    }
+    close(pfd[0]);
+    close(pfd[1]);
+    return (total > 0 || n == 0) ? total : -1;
+#else
+    if (out_fd < 0 || in_fd < 0) {
+        printf("%s paraments invalid!\n", __func__);
+        return -1;
+    }
+    return xfer_fallback(out_fd, in_fd, NULL, count);
+#endif
+}
+
+int file_copy(const char *src, const char *dst)
+{
+    int ifd, ofd;
+    ssize_t n;
+    struct stat st;
+    off_t in_off = 0, out_off = 0;
+
+    if (!src || !dst) {
+        printf("%s paraments invalid!\n", __func__);
+        return -1;
+    }
+    ifd = open(src, O_RDONLY);
+    if (ifd < 0) {
+        printf("open %s failed:%d %s\n", src, errno, strerror(errno));
+        return -1;
+    }
+    if (fstat(ifd, &st) < 0) {
+        printf("fstat %s failed:%d %s\n", src, errno, strerror(errno));
+        close(ifd);
+        return -1;
+    }
+    ofd = open(dst, O_WRONLY|O_CREAT|O_TRUNC, st.st_mode & 0777);
+    if (ofd < 0) {
+        printf("open %s failed:%d %s\n", dst, errno, strerror(errno));
+        close(ifd);
+        return -1;
+    }
+    n = file_copy_range(ifd, &in_off, ofd, &out_off, (size_t)st.st_size);
+    close(ifd);
+    close(ofd);
+    if (n != st.st_size) {
+        printf("copy %s to %s failed: %zd/%lld\n", src, dst, n, (long long)st.st_size);
+        return -1;
+    }
+    return 0;
+}
+
+#endif
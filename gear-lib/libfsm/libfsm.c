@@ -55,16 +55,12 @@ int fsm_action(struct fsm *fsm, int event_id, void *args)
     int ret;
     pthread_mutex_lock(&fsm->mutex);
     for (i = 0; i < fsm->table_num; ++i) {
-        if (fsm->curr_state == fsm->table[i].current_state)
+        if (fsm->curr_state == fsm->table[i].current_state &&
+            event_id == fsm->table[i].trigger_event)
             break;
     }
     if (i == fsm->table_num) {
-        printf("can not find state %d\n", fsm->curr_state);
-        ret = -1;
-        goto out;
-    }
-    if (event_id != fsm->table[i].trigger_event) {
-        printf("invalid trigger_event[%d] from state[%d] to state[%d]\n", event_id, fsm->curr_state, fsm->table[i].next_state);
+        printf("invalid trigger_event[%d] in state[%d]\n", event_id, fsm->curr_state);
         ret = -1;
         goto out;
     }
@@ -75,3 +71,182 @@ out:
     pthread_mutex_unlock(&fsm->mutex);
     return ret;
 }
+
+struct fsm_table *fsm_table_create(const struct fsm_event_table *rows, int num,
+                int nstates, int nevents)
+{
+    struct fsm_table *t;
+    const struct fsm_event_table **cell;
+    int i;
+
+    if (!rows || num <= 0 || nstates <= 0 || nevents <= 0) {
+        printf("%s: paraments invalid!\n", __func__);
+        return NULL;
+    }
+    t = calloc(1, sizeof(struct fsm_table));
+    if (!t) {
+        return NULL;
+    }
+    t->nstates = nstates;
+    t->nevents = nevents;
+    t->cells = calloc((size_t)nstates * nevents, sizeof(*t->cells));
+    if (!t->cells) {
+        free(t);
+        return NULL;
+    }
+    for (i = 0; i < num; i++) {
+        if (rows[i].current_state < 0 || rows[i].current_state >= nstates ||
+            rows[i].next_state < 0 || rows[i].next_state >= nstates ||
+            rows[i].trigger_event < 0 || rows[i].trigger_event >= nevents) {
+            printf("%s: row %d out of range\n", __func__, i);
+            goto fail;
+        }
+        cell = &t->cells[rows[i].current_state * nevents + rows[i].trigger_event];
+        if (*cell) {
+            printf("%s: row %d duplicates state %d event %d\n", __func__, i,
+                   rows[i].current_state, rows[i].trigger_event);
+            goto fail;
+        }
+        *cell = &rows[i];
+    }
+    return t;
+
+fail:
+    free(t->cells);
+    free(t);
+    return NULL;
+}
+
+void fsm_table_destroy(struct fsm_table *t)
+{
+    if (t) {
+        free(t->cells);
+        free(t);
+    }
+}
+
+void fsm_table_set_names(struct fsm_table *t, const char **states, const char **events)
+{
+    if (t) {
+        t->state_names = states;
+        t->event_names = events;
+    }
+}
+
+struct fsm *fsm_create_with_table(const struct fsm_table *t, int state)
+{
+    struct fsm *fsm;
+    if (!t || state < 0 || state >= t->nstates) {
+        printf("%s: paraments invalid!\n", __func__);
+        return NULL;
+    }
+    fsm = fsm_create();
+    if (!fsm) {
+        return NULL;
+    }
+    fsm->tt = t;
+    fsm->curr_state = state;
+    return fsm;
+}
+
+static void fsm_dispatch(struct fsm *fsm, int event, void *arg)
+{
+    const struct fsm_table *t = fsm->tt;
+    const struct fsm_event_table *row;
+    int from = fsm->curr_state;
+
+    row = t->cells[from * t->nevents + event];
+    if (!row) {
+        fsm->unhandled++;
+        if (fsm->trace) {
+            fsm->trace(fsm, from, event, -1, fsm->trace_arg);
+        }
+        return;
+    }
+    fsm->dispatched++;
+    if (row->do_action && row->do_action(arg) < 0) {
+        if (fsm->trace) {
+            fsm->trace(fsm, from, event, from, fsm->trace_arg);
+        }
+        return;
+    }
+    __atomic_store_n(&fsm->curr_state, row->next_state, __ATOMIC_RELAXED);
+    if (fsm->trace) {
+        fsm->trace(fsm, from, event, row->next_state, fsm->trace_arg);
+    }
+}
+
+int fsm_post(struct fsm *fsm, int event, void *arg)
+{
+    struct fsm_queue_item *it;
+
+    if (!fsm || !fsm->tt || event < 0 || event >= fsm->tt->nevents) {
+        return -1;
+    }
+    pthread_mutex_lock(&fsm->mutex);
+    if (fsm->q_count == FSM_QUEUE_MAX) {
+        pthread_mutex_unlock(&fsm->mutex);
+        printf("%s: event queue full, drop event %d\n", __func__, event);
+        return -1;
+    }
+    it = &fsm->queue[(fsm->q_head + fsm->q_count) % FSM_QUEUE_MAX];
+    it->event = event;
+    it->arg = arg;
+    fsm->q_count++;
+    if (fsm->dispatching) {
+        /* the dispatching thread runs it after the current transition */
+        pthread_mutex_unlock(&fsm->mutex);
+        return 0;
+    }
+    fsm->dispatching = true;
+    while (fsm->q_count) {
+        it = &fsm->queue[fsm->q_head];
+        event = it->event;
+        arg = it->arg;
+        fsm->q_head = (fsm->q_head + 1) % FSM_QUEUE_MAX;
+        fsm->q_count--;
+        /* actions run unlocked so they can post to this machine */
+        pthread_mutex_unlock(&fsm->mutex);
+        fsm_dispatch(fsm, event, arg);
+        pthread_mutex_lock(&fsm->mutex);
+    }
+    fsm->dispatching = false;
+    pthread_mutex_unlock(&fsm->mutex);
+    return 0;
+}
+
+int fsm_get_state(struct fsm *fsm)
+{
+    return fsm ? __atomic_load_n(&fsm->curr_state, __ATOMIC_RELAXED) : -1;
+}
+
+void fsm_set_trace(struct fsm *fsm, fsm_trace_cb cb, void *arg)
+{
+    if (fsm) {
+        fsm->trace = cb;
+        fsm->trace_arg = arg;
+    }
+}
+
+void fsm_trace_print(struct fsm *fsm, int from, int event, int to, void *arg)
+{
+    const struct fsm_table *t = fsm->tt;
+    char sf[16], se[16], st[16];
+    const char *f = sf, *e = se, *n = st;
+
+    snprintf(sf, sizeof(sf), "%d", from);
+    snprintf(se, sizeof(se), "%d", event);
+    snprintf(st, sizeof(st), "%d", to);
+    if (t->state_names) {
+        f = t->state_names[from];
+        n = to < 0 ? n : t->state_names[to];
+    }
+    if (t->event_names) {
+        e = t->event_names[event];
+    }
+    if (to < 0) {
+        printf("fsm %p: %s unhandled in %s\n", (void *)fsm, e, f);
+    } else {
+        printf("fsm %p: %s --%s--> %s\n", (void *)fsm, f, e, n);
+    }
+}
@@ -24,6 +24,7 @@
 
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <pthread.h>
 
 #define LIBFSM_VERSION "0.1.0"
@@ -53,11 +54,58 @@ struct fsm_event_table {
     fsm_event_handle do_action;
 };
 
+/*
+ * table driven machine: rows of fsm_event_table are compiled once into a
+ * state x event matrix shared by any number of machines, dispatch is one
+ * lookup. events posted while a machine is dispatching, from its actions
+ * or other threads, are queued and run to completion in posting order by
+ * the dispatching thread. an action returning < 0 keeps the state.
+ *
+ * states and events can be declared once with X macros:
+ *   #define TCP_STATES(X) X(TCP_CLOSE) X(TCP_LISTEN) ...
+ *   enum tcp_state { TCP_STATES(FSM_ENUM) TCP_MAX_STATES };
+ *   static const char *tcp_state_names[] = { TCP_STATES(FSM_NAME) };
+ */
+#define FSM_ENUM(x)             x,
+#define FSM_NAME(x)             #x,
+#define FSM_TABLE_BEGIN(name)   static struct fsm_event_table name[] = {
+#define FSM_TRANSITION(state, event, next, action) {state, event, next, action},
+#define FSM_TABLE_END()         };
+#define FSM_TABLE_SIZE(name)    ((int)(sizeof(name) / sizeof(name[0])))
+
+#define FSM_QUEUE_MAX           64
+
+struct fsm_table {
+    int nstates;
+    int nevents;
+    const struct fsm_event_table **cells;   /* [state * nevents + event] */
+    const char **state_names;
+    const char **event_names;
+};
+
+struct fsm;
+/* to is -1 when event is unhandled in from */
+typedef void (*fsm_trace_cb)(struct fsm *fsm, int from, int event, int to, void *arg);
+
+struct fsm_queue_item {
+    int event;
+    void *arg;
+};
+
 struct fsm {
     int curr_state;
     struct fsm_event_table *table;
     int table_num;
     pthread_mutex_t mutex;
+    const struct fsm_table *tt;
+    struct fsm_queue_item queue[FSM_QUEUE_MAX];
+    int q_head;
+    int q_count;
+    bool dispatching;
+    fsm_trace_cb trace;
+    void *trace_arg;
+    uint64_t dispatched;
+    uint64_t unhandled;
 };
 
 struct fsm *fsm_create();
@@ -67,6 +115,20 @@ int fsm_state_init(struct fsm *fsm, int state);
 int fsm_action(struct fsm *fsm, int event_id, void *args);
 int fsm_traval(struct fsm *fsm);
 
+/* rows with state or event out of range, or duplicated, fail the build */
+struct fsm_table *fsm_table_create(const struct fsm_event_table *rows, int num,
+                int nstates, int nevents);
+void fsm_table_destroy(struct fsm_table *t);
+void fsm_table_set_names(struct fsm_table *t, const char **states, const char **events);
+
+struct fsm *fsm_create_with_table(const struct fsm_table *t, int state);
+/* -1 if the event is invalid or the queue is full */
+int fsm_post(struct fsm *fsm, int event, void *arg);
+int fsm_get_state(struct fsm *fsm);
+void fsm_set_trace(struct fsm *fsm, fsm_trace_cb cb, void *arg);
+/* trace callback printing names of the table */
+void fsm_trace_print(struct fsm *fsm, int from, int event, int to, void *arg);
+
 #ifdef __cplusplus
 }
 #endif
@@ -124,6 +124,55 @@ static struct fsm_event_table tcp_event_tbl[] = {
     {TCP_LISTEN, EV_SRV_RECV_FIN_SEND_ACK, TCP_SYN_RECV, do_recv},
 };
 
+static const char *tcp_state_names[TCP_MAX_STATES] = {
+    [TCP_ESTABLISHED] = "ESTABLISHED", [TCP_SYN_SENT] = "SYN_SENT",
+    [TCP_SYN_RECV] = "SYN_RECV", [TCP_FIN_WAIT1] = "FIN_WAIT1",
+    [TCP_FIN_WAIT2] = "FIN_WAIT2", [TCP_TIME_WAIT] = "TIME_WAIT",
+    [TCP_CLOSE] = "CLOSE", [TCP_CLOSE_WAIT] = "CLOSE_WAIT",
+    [TCP_LAST_ACK] = "LAST_ACK", [TCP_LISTEN] = "LISTEN",
+};
+
+static struct fsm *tfsm = NULL;
+
+/* posted from an action, runs after the current transition completes */
+static int do_recv_post(void *arg)
+{
+    fsm_post(tfsm, EV_SRV_RECV_ACK, NULL);
+    return 0;
+}
+
+FSM_TABLE_BEGIN(tcp_table_rows)
+    FSM_TRANSITION(TCP_CLOSE, EV_SRV_LISTEN, TCP_LISTEN, NULL)
+    FSM_TRANSITION(TCP_LISTEN, EV_SRV_RECV_FIN_SEND_ACK, TCP_SYN_RECV, do_recv_post)
+    FSM_TRANSITION(TCP_SYN_RECV, EV_SRV_RECV_ACK, TCP_ESTABLISHED, NULL)
+    FSM_TRANSITION(TCP_ESTABLISHED, EV_SRV_SEND_FIN, TCP_FIN_WAIT1, NULL)
+FSM_TABLE_END()
+
+static int test_table()
+{
+    struct fsm_table *t;
+    t = fsm_table_create(tcp_table_rows, FSM_TABLE_SIZE(tcp_table_rows),
+                         TCP_MAX_STATES, EV_WAIT_2MSL + 1);
+    if (!t) {
+        return -1;
+    }
+    fsm_table_set_names(t, tcp_state_names, NULL);
+    tfsm = fsm_create_with_table(t, TCP_CLOSE);
+    fsm_set_trace(tfsm, fsm_trace_print, NULL);
+    fsm_post(tfsm, EV_SRV_LISTEN, NULL);
+    fsm_post(tfsm, EV_SRV_RECV_FIN_SEND_ACK, NULL);
+    fsm_post(tfsm, EV_WAIT_2MSL, NULL);
+    printf("state %s, dispatched %d, unhandled %d\n",
+           tcp_state_names[fsm_get_state(tfsm)],
+           (int)tfsm->dispatched, (int)tfsm->unhandled);
+    if (fsm_get_state(tfsm) != TCP_ESTABLISHED) {
+        printf("test_table failed\n");
+    }
+    fsm_destroy(tfsm);
+    fsm_table_destroy(t);
+    return 0;
+}
+
 int loop()
 {
     gevent_base_loop(evbase);
@@ -157,6 +206,7 @@ int init()
 
 int main(int argc, char **argv)
 {
+    test_table();
     init();
     loop();
     return 0;
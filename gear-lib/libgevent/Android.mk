@@ -13,6 +13,6 @@ LIBRARIES_DIR	:= $(LOCAL_PATH)/../
 LOCAL_C_INCLUDES := $(LOCAL_PATH)
 
 # Add your application source files here...
-LOCAL_SRC_FILES := libgevent.c epoll.c poll.c select.c
+LOCAL_SRC_FILES := libgevent.c conn.c epoll.c io_uring.c poll.c select.c signal.c timerwheel.c
 
 include $(BUILD_SHARED_LIBRARY)
@@ -0,0 +1,586 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#include "libgevent.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#if defined (OS_LINUX)
+#include <sys/sendfile.h>
+#endif
+
+#define CONN_READ_CHUNK     (16 * 1024)
+#define CONN_IOV_MAX        (64)
+
+/* conn struct and its read/write buffers */
+static struct mem_account conn_mem = MEM_ACCOUNT_INIT("gevent_conn");
+
+struct gevent_buf {
+    uint8_t *data;
+    size_t head;
+    size_t tail;
+    size_t cap;
+};
+
+struct gevent_conn {
+    int fd;
+    bool closed;
+    bool in_callback;
+    struct gevent_base *eb;
+    struct gevent *ev;
+    struct gevent_buf rbuf;
+    struct gevent_buf wbuf;
+    int file_fd;                    /* sent after wbuf, owned by conn */
+    off_t file_off;
+    size_t file_left;
+    size_t high;                    /* output watermarks, 0 disabled */
+    size_t low;
+    bool above_high;                /* on_high called, on_low not yet */
+    struct gevent_conn_cbs cbs;
+    void *arg;
+};
+
+static size_t buf_len(struct gevent_buf *b)
+{
+    return b->tail - b->head;
+}
+
+/* make sure there is at least len bytes room after tail */
+static int buf_reserve(struct gevent_buf *b, size_t len)
+{
+    uint8_t *p;
+    size_t used = buf_len(b);
+    size_t cap;
+
+    if (b->cap - b->tail >= len) {
+        return 0;
+    }
+    if (b->head > 0 && b->cap - used >= len) {
+        memmove(b->data, b->data + b->head, used);
+        b->head = 0;
+        b->tail = used;
+        return 0;
+    }
+    cap = b->cap ? b->cap : CONN_READ_CHUNK;
+    while (cap - used < len) {
+        cap *= 2;
+    }
+    if (b->head > 0) {
+        memmove(b->data, b->data + b->head, used);
+        b->head = 0;
+        b->tail = used;
+    }
+    p = (uint8_t *)realloc(b->data, cap);
+    if (!p) {
+        printf("realloc gevent_buf failed!\n");
+        return -1;
+    }
+    mem_account_charge(&conn_mem, (int64_t)cap - (int64_t)b->cap, 0);
+    b->data = p;
+    b->cap = cap;
+    return 0;
+}
+
+static void buf_consume(struct gevent_buf *b, size_t len)
+{
+    b->head += MIN2(len, buf_len(b));
+    if (b->head == b->tail) {
+        b->head = b->tail = 0;
+    }
+}
+
+static void buf_free(struct gevent_buf *b)
+{
+    mem_account_charge(&conn_mem, -(int64_t)b->cap, 0);
+    free(b->data);
+    memset(b, 0, sizeof(*b));
+}
+
+static ssize_t fd_write(int fd, const void *buf, size_t len)
+{
+    ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+    if (n < 0 && errno == ENOTSOCK) {
+        n = write(fd, buf, len);
+    }
+    return n;
+}
+
+static ssize_t fd_writev(int fd, struct iovec *iov, int cnt)
+{
+    ssize_t n;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = cnt;
+    n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+    if (n < 0 && errno == ENOTSOCK) {
+        n = writev(fd, iov, cnt);
+    }
+    return n;
+}
+
+ssize_t gevent_read_drain(int fd, void *buf, size_t len,
+        void (*cb)(int fd, void *buf, size_t len, void *arg), void *arg,
+        bool *closed)
+{
+    ssize_t n, total = 0;
+    if (closed) {
+        *closed = false;
+    }
+    if (!buf || !len) {
+        return -1;
+    }
+    while (1) {
+        n = read(fd, buf, len);
+        if (n > 0) {
+            total += n;
+            if (cb) {
+                cb(fd, buf, n, arg);
+            }
+            continue;
+        }
+        if (n == 0) {
+            if (closed) {
+                *closed = true;
+            }
+            break;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK && closed) {
+            *closed = true;
+        }
+        break;
+    }
+    return total;
+}
+
+static void conn_file_close(struct gevent_conn *c)
+{
+    if (c->file_fd != -1) {
+        close(c->file_fd);
+        c->file_fd = -1;
+    }
+    c->file_left = 0;
+}
+
+/* return 0 when all sent or EAGAIN, -1 on error */
+static int conn_send_file(struct gevent_conn *c)
+{
+    ssize_t n;
+#if !defined (OS_LINUX)
+    uint8_t buf[CONN_READ_CHUNK];
+#endif
+
+    while (c->file_left > 0) {
+#if defined (OS_LINUX)
+        n = sendfile(c->fd, c->file_fd, &c->file_off, c->file_left);
+#else
+        n = pread(c->file_fd, buf, MIN2(c->file_left, sizeof(buf)), c->file_off);
+        if (n > 0) {
+            n = fd_write(c->fd, buf, n);
+            if (n > 0) {
+                c->file_off += n;
+            }
+        } else if (n == 0) {
+            errno = EIO;
+            n = -1;
+        }
+#endif
+        if (n > 0) {
+            c->file_left -= n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 0;
+        }
+        /* file shrank under us or socket error */
+        return -1;
+    }
+    conn_file_close(c);
+    return 0;
+}
+
+static int conn_update_events(struct gevent_conn *c)
+{
+    enum gevent_flags flags = c->ev->flags;
+    if (buf_len(&c->wbuf) > 0 || c->file_left > 0) {
+        flags |= EVENT_WRITE;
+    } else {
+        flags &= ~EVENT_WRITE;
+    }
+    if (flags == c->ev->flags) {
+        return 0;
+    }
+    c->ev->flags = flags;
+    return gevent_mod(c->eb, &c->ev);
+}
+
+static void conn_do_close(struct gevent_conn *c, int err)
+{
+    if (c->closed) {
+        return;
+    }
+    c->closed = true;
+    gevent_del(c->eb, &c->ev);
+    if (c->cbs.on_close) {
+        c->cbs.on_close(c, err, c->arg);
+    }
+}
+
+static void conn_release(struct gevent_conn *c)
+{
+    if (!c->closed) {
+        c->closed = true;
+        gevent_del(c->eb, &c->ev);
+    }
+    gevent_destroy(c->ev);
+    close(c->fd);
+    conn_file_close(c);
+    buf_free(&c->rbuf);
+    buf_free(&c->wbuf);
+    free(c);
+    mem_account_charge(&conn_mem, -(int64_t)sizeof(struct gevent_conn), -1);
+}
+
+static void conn_release_cb(void *arg)
+{
+    conn_release((struct gevent_conn *)arg);
+}
+
+static void conn_check_low(struct gevent_conn *c)
+{
+    size_t pending = buf_len(&c->wbuf) + c->file_left;
+    if (c->above_high && pending <= c->low) {
+        c->above_high = false;
+        if (c->cbs.on_low) {
+            c->cbs.on_low(c, pending, c->arg);
+        }
+    }
+}
+
+static void conn_check_high(struct gevent_conn *c)
+{
+    size_t pending = buf_len(&c->wbuf) + c->file_left;
+    if (c->high && !c->above_high && pending > c->high) {
+        c->above_high = true;
+        if (c->cbs.on_high) {
+            c->cbs.on_high(c, pending, c->arg);
+        }
+    }
+}
+
+static void conn_flush(struct gevent_conn *c)
+{
+    ssize_t n;
+    while (buf_len(&c->wbuf) > 0) {
+        n = fd_write(c->fd, c->wbuf.data + c->wbuf.head, buf_len(&c->wbuf));
+        if (n > 0) {
+            buf_consume(&c->wbuf, n);
+            continue;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        conn_do_close(c, errno);
+        return;
+    }
+    if (buf_len(&c->wbuf) == 0 && 0 != conn_send_file(c)) {
+        conn_do_close(c, errno ? errno : EIO);
+        return;
+    }
+    conn_update_events(c);
+    conn_check_low(c);
+    if (!c->closed && buf_len(&c->wbuf) == 0 && c->file_left == 0 && c->cbs.on_drain) {
+        c->cbs.on_drain(c, c->arg);
+    }
+}
+
+static void conn_on_in(int fd, void *arg)
+{
+    ssize_t n;
+    int err = 0;
+    bool eof = false;
+    struct gevent_conn *c = (struct gevent_conn *)arg;
+
+    c->in_callback = true;
+    /* edge triggered, must read until EAGAIN */
+    while (!c->closed) {
+        if (0 != buf_reserve(&c->rbuf, CONN_READ_CHUNK)) {
+            err = ENOMEM;
+            break;
+        }
+        n = read(fd, c->rbuf.data + c->rbuf.tail, c->rbuf.cap - c->rbuf.tail);
+        if (n > 0) {
+            c->rbuf.tail += n;
+            continue;
+        }
+        if (n == 0) {
+            eof = true;
+        } else if (errno == EINTR) {
+            continue;
+        } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            err = errno;
+        }
+        break;
+    }
+    if (!c->closed && buf_len(&c->rbuf) > 0 && c->cbs.on_read) {
+        c->cbs.on_read(c, c->arg);
+    }
+    if (eof || err) {
+        conn_do_close(c, err);
+    }
+    c->in_callback = false;
+}
+
+static void conn_on_out(int fd, void *arg)
+{
+    struct gevent_conn *c = (struct gevent_conn *)arg;
+    c->in_callback = true;
+    if (!c->closed) {
+        conn_flush(c);
+    }
+    c->in_callback = false;
+}
+
+static void conn_on_err(int fd, void *arg)
+{
+    struct gevent_conn *c = (struct gevent_conn *)arg;
+    c->in_callback = true;
+    conn_do_close(c, ECONNRESET);
+    c->in_callback = false;
+}
+
+struct gevent_conn *gevent_conn_create(struct gevent_base *eb, int fd,
+        const struct gevent_conn_cbs *cbs, void *arg)
+{
+    int flags;
+    struct gevent_conn *c;
+
+    if (!eb || fd < 0 || !cbs) {
+        printf("%s:%d paraments is invalid\n", __func__, __LINE__);
+        return NULL;
+    }
+    c = CALLOC(1, struct gevent_conn);
+    if (!c) {
+        printf("malloc gevent_conn failed!\n");
+        return NULL;
+    }
+    flags = fcntl(fd, F_GETFL, 0);
+    if (flags != -1 && !(flags & O_NONBLOCK)) {
+        fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+    }
+    c->fd = fd;
+    c->file_fd = -1;
+    c->eb = eb;
+    c->cbs = *cbs;
+    c->arg = arg;
+    c->ev = gevent_create(fd, conn_on_in, conn_on_out, conn_on_err, c);
+    if (!c->ev) {
+        free(c);
+        return NULL;
+    }
+    /* only watch output when there is pending data */
+    c->ev->flags &= ~EVENT_WRITE;
+    if (0 != gevent_add(eb, &c->ev)) {
+        gevent_destroy(c->ev);
+        free(c);
+        return NULL;
+    }
+    mem_account_charge(&conn_mem, sizeof(struct gevent_conn), 1);
+    return c;
+}
+
+void gevent_conn_destroy(struct gevent_conn *c)
+{
+    if (!c) {
+        return;
+    }
+    if (c->in_callback) {
+        /*
+         * called from callback of itself, backend may still touch the
+         * gevent in this dispatch round, free it in loop thread later
+         */
+        if (!c->closed) {
+            c->closed = true;
+            gevent_del(c->eb, &c->ev);
+        }
+        if (0 == gevent_base_post(c->eb, conn_release_cb, c)) {
+            return;
+        }
+    }
+    conn_release(c);
+}
+
+int gevent_conn_fd(struct gevent_conn *c)
+{
+    return c ? c->fd : -1;
+}
+
+void *gevent_conn_peek(struct gevent_conn *c, size_t *len)
+{
+    if (!c) {
+        return NULL;
+    }
+    if (len) {
+        *len = buf_len(&c->rbuf);
+    }
+    return c->rbuf.data + c->rbuf.head;
+}
+
+void gevent_conn_consume(struct gevent_conn *c, size_t len)
+{
+    if (!c) {
+        return;
+    }
+    buf_consume(&c->rbuf, len);
+}
+
+ssize_t gevent_conn_read(struct gevent_conn *c, void *buf, size_t len)
+{
+    size_t n;
+    if (!c || !buf) {
+        return -1;
+    }
+    n = MIN2(len, buf_len(&c->rbuf));
+    memcpy(buf, c->rbuf.data + c->rbuf.head, n);
+    buf_consume(&c->rbuf, n);
+    return n;
+}
+
+int gevent_conn_write(struct gevent_conn *c, const void *buf, size_t len)
+{
+    struct iovec iov;
+    iov.iov_base = (void *)buf;
+    iov.iov_len = len;
+    return gevent_conn_writev(c, &iov, 1);
+}
+
+int gevent_conn_writev(struct gevent_conn *c, const struct iovec *iov, int cnt)
+{
+    struct iovec v[CONN_IOV_MAX];
+    size_t pending, off;
+    ssize_t n;
+    int i, nv = 0;
+
+    if (!c || !iov || cnt <= 0 || c->closed || c->file_left > 0) {
+        return -1;
+    }
+    /* buffered output first, then as many pieces as fit, one syscall */
+    pending = buf_len(&c->wbuf);
+    if (pending > 0) {
+        v[nv].iov_base = c->wbuf.data + c->wbuf.head;
+        v[nv].iov_len = pending;
+        nv++;
+    }
+    for (i = 0; i < cnt && nv < CONN_IOV_MAX; i++) {
+        v[nv++] = iov[i];
+    }
+    do {
+        n = fd_writev(c->fd, v, nv);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            return -1;
+        }
+        n = 0;
+    }
+    off = MIN2((size_t)n, pending);
+    buf_consume(&c->wbuf, off);
+    n -= off;
+    /* pieces not fully sent are buffered in order */
+    for (i = 0; i < cnt; i++) {
+        if ((size_t)n >= iov[i].iov_len) {
+            n -= iov[i].iov_len;
+            continue;
+        }
+        off = n;
+        n = 0;
+        if (0 != buf_reserve(&c->wbuf, iov[i].iov_len - off)) {
+            return -1;
+        }
+        memcpy(c->wbuf.data + c->wbuf.tail, (uint8_t *)iov[i].iov_base + off,
+               iov[i].iov_len - off);
+        c->wbuf.tail += iov[i].iov_len - off;
+    }
+    if (0 != conn_update_events(c)) {
+        return -1;
+    }
+    conn_check_high(c);
+    conn_check_low(c);
+    return 0;
+}
+
+int gevent_conn_set_watermark(struct gevent_conn *c, size_t high, size_t low)
+{
+    if (!c || (high && low > high)) {
+        return -1;
+    }
+    c->high = high;
+    c->low = low;
+    if (!high) {
+        c->above_high = false;
+    }
+    return 0;
+}
+
+int gevent_conn_sendfile(struct gevent_conn *c, int fd, off_t offset, size_t len)
+{
+    if (!c || fd < 0 || c->closed || c->file_left > 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    if (len == 0) {
+        close(fd);
+        return 0;
+    }
+    c->file_fd = fd;
+    c->file_off = offset;
+    c->file_left = len;
+    if (buf_len(&c->wbuf) == 0 && 0 != conn_send_file(c)) {
+        conn_file_close(c);
+        return -1;
+    }
+    if (0 != conn_update_events(c)) {
+        return -1;
+    }
+    conn_check_high(c);
+    return 0;
+}
+
+size_t gevent_conn_pending(struct gevent_conn *c)
+{
+    return c ? buf_len(&c->wbuf) + c->file_left : 0;
+}
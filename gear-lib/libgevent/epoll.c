@@ -172,7 +172,6 @@ static int epoll_dispatch(struct gevent_base *eb, struct timeval *tv)
         return 0;
     }
     if (0 == n) {
-        printf("epoll_wait timeout\n");
         return 0;
     }
     for (i = 0; i < n; i++) {
@@ -180,12 +179,17 @@ static int epoll_dispatch(struct gevent_base *eb, struct timeval *tv)
         struct gevent *e = (struct gevent *)events[i].data.ptr;
 
         if (what & (EPOLLHUP|EPOLLERR)) {
+            /* e.g. refused connect, edge triggered so report it now */
+            if (e->evcb.ev_err)
+                gevent_base_invoke(eb, e->evcb.ev_err, e->evfd, e->evcb.args);
+            else if (e->evcb.ev_in)
+                gevent_base_invoke(eb, e->evcb.ev_in, e->evfd, e->evcb.args);
         } else {
             if (what & EPOLLIN) {
                 if (e->evcb.ev_in)
-                    e->evcb.ev_in(e->evfd, e->evcb.args);
+                    gevent_base_invoke(eb, e->evcb.ev_in, e->evfd, e->evcb.args);
                 if (e->evcb.ev_timer) {
-                    e->evcb.ev_timer(e->evfd, e->evcb.args);
+                    gevent_base_invoke(eb, e->evcb.ev_timer, e->evfd, e->evcb.args);
                     if (0 == (what & EPOLLONESHOT)) {
                         uint64_t expirations = 0;
                         int ret = 0;
@@ -199,10 +203,10 @@ static int epoll_dispatch(struct gevent_base *eb, struct timeval *tv)
             }
             if (what & EPOLLOUT)
                 if (e->evcb.ev_out)
-                    e->evcb.ev_out(e->evfd, e->evcb.args);
+                    gevent_base_invoke(eb, e->evcb.ev_out, e->evfd, e->evcb.args);
             if (what & EPOLLRDHUP)
                 if (e->evcb.ev_err)
-                    e->evcb.ev_err(e->evfd, e->evcb.args);
+                    gevent_base_invoke(eb, e->evcb.ev_err, e->evfd, e->evcb.args);
         }
     }
     return 0;
@@ -0,0 +1,706 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#include "libgevent.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#if defined (GEVENT_HAVE_IO_URING)
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#ifndef POLLRDHUP
+#define POLLRDHUP           (0x2000)
+#endif
+
+/*
+ * io_uring backend without liburing, only raw syscalls.
+ * readiness: one multishot IORING_OP_POLL_ADD per gevent
+ * completion: recv/send/accept submitted by gevent_uring_* APIs,
+ *             batched and submitted in dispatch together with wait
+ * require linux 5.13+ (multishot poll and IORING_ENTER_EXT_ARG)
+ *
+ * user_data of a poll is a token owned by the backend, not the gevent:
+ * completions of a deleted gevent may be posted after gevent_del returns,
+ * e.g. by task_work of the loop thread, so del only detaches the token
+ * and it is freed by the last completion of its polls
+ */
+#define URING_ENTRIES       (4096)
+#define URING_MAX_BGID      (16)
+#define URING_REQ_TAG       (1ULL)
+
+struct uring_req {
+    int fd;
+    int bgid;
+    void *buf;
+    gevent_uring_cb cb;
+    void *arg;
+};
+
+struct uring_poll {
+    struct gevent *e;               /* NULL once gevent is deleted */
+    int inflight;                   /* POLL_ADDs without final cqe */
+    struct list_head entry;         /* in orphans after detached */
+};
+
+struct uring_bufgroup {
+    void *base;
+    int len;
+    int nr;
+};
+
+struct uring_ctx {
+    int ring_fd;
+    mutex_lock_t lock;
+
+    void *sq_ptr;
+    size_t sq_size;
+    void *cq_ptr;
+    size_t cq_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+
+    unsigned *sq_khead;
+    unsigned *sq_ktail;
+    unsigned *sq_kmask;
+    unsigned *sq_array;
+    unsigned sq_entries;
+    unsigned sq_tail;
+    unsigned sq_pending;
+
+    unsigned *cq_khead;
+    unsigned *cq_ktail;
+    unsigned *cq_kmask;
+    struct io_uring_cqe *cqes;
+    unsigned cq_cur;
+    unsigned cq_end;
+
+    struct uring_bufgroup bufgroups[URING_MAX_BGID];
+    struct list_head orphans;       /* detached tokens waiting final cqe */
+};
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+                unsigned flags, void *arg, size_t argsz)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+                        flags, arg, argsz);
+}
+
+static void uring_unmap(struct uring_ctx *c)
+{
+    if (c->sqes && c->sqes != MAP_FAILED) {
+        munmap(c->sqes, c->sqes_size);
+    }
+    if (c->cq_ptr && c->cq_ptr != MAP_FAILED && c->cq_ptr != c->sq_ptr) {
+        munmap(c->cq_ptr, c->cq_size);
+    }
+    if (c->sq_ptr && c->sq_ptr != MAP_FAILED) {
+        munmap(c->sq_ptr, c->sq_size);
+    }
+}
+
+static void *uring_init(void)
+{
+    struct io_uring_params p;
+    struct uring_ctx *c = CALLOC(1, struct uring_ctx);
+    if (!c) {
+        printf("malloc uring_ctx failed!\n");
+        return NULL;
+    }
+    memset(&p, 0, sizeof(p));
+    c->ring_fd = sys_io_uring_setup(URING_ENTRIES, &p);
+    if (c->ring_fd < 0) {
+        printf("io_uring_setup failed %d: %s\n", errno, strerror(errno));
+        free(c);
+        return NULL;
+    }
+    if (!(p.features & IORING_FEAT_EXT_ARG)) {
+        printf("io_uring IORING_FEAT_EXT_ARG not supported by kernel\n");
+        goto failed;
+    }
+
+    c->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    c->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        c->sq_size = MAX2(c->sq_size, c->cq_size);
+        c->cq_size = c->sq_size;
+    }
+    c->sq_ptr = mmap(NULL, c->sq_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, c->ring_fd, IORING_OFF_SQ_RING);
+    if (c->sq_ptr == MAP_FAILED) {
+        printf("mmap sq ring failed %d\n", errno);
+        goto failed;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        c->cq_ptr = c->sq_ptr;
+    } else {
+        c->cq_ptr = mmap(NULL, c->cq_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, c->ring_fd, IORING_OFF_CQ_RING);
+        if (c->cq_ptr == MAP_FAILED) {
+            printf("mmap cq ring failed %d\n", errno);
+            goto failed;
+        }
+    }
+    c->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    c->sqes = (struct io_uring_sqe *)mmap(NULL, c->sqes_size,
+                     PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     c->ring_fd, IORING_OFF_SQES);
+    if (c->sqes == MAP_FAILED) {
+        printf("mmap sqes failed %d\n", errno);
+        goto failed;
+    }
+
+    c->sq_khead   = (unsigned *)((char *)c->sq_ptr + p.sq_off.head);
+    c->sq_ktail   = (unsigned *)((char *)c->sq_ptr + p.sq_off.tail);
+    c->sq_kmask   = (unsigned *)((char *)c->sq_ptr + p.sq_off.ring_mask);
+    c->sq_array   = (unsigned *)((char *)c->sq_ptr + p.sq_off.array);
+    c->sq_entries = p.sq_entries;
+    c->sq_tail    = *c->sq_ktail;
+    c->cq_khead   = (unsigned *)((char *)c->cq_ptr + p.cq_off.head);
+    c->cq_ktail   = (unsigned *)((char *)c->cq_ptr + p.cq_off.tail);
+    c->cq_kmask   = (unsigned *)((char *)c->cq_ptr + p.cq_off.ring_mask);
+    c->cqes       = (struct io_uring_cqe *)((char *)c->cq_ptr + p.cq_off.cqes);
+    mutex_lock_init(&c->lock);
+    INIT_LIST_HEAD(&c->orphans);
+    return c;
+
+failed:
+    uring_unmap(c);
+    close(c->ring_fd);
+    free(c);
+    return NULL;
+}
+
+static void uring_deinit(void *ctx)
+{
+    struct uring_poll *p, *next;
+    struct uring_ctx *c = (struct uring_ctx *)ctx;
+    if (!c) {
+        return;
+    }
+    list_for_each_entry_safe(p, next, &c->orphans, entry) {
+        list_del(&p->entry);
+        free(p);
+    }
+    uring_unmap(c);
+    close(c->ring_fd);
+    mutex_lock_deinit(&c->lock);
+    free(c);
+}
+
+/* must be called with lock held */
+static int uring_flush(struct uring_ctx *c, unsigned min_complete,
+                unsigned flags, void *arg, size_t argsz)
+{
+    int ret;
+    unsigned submit = c->sq_pending;
+    __atomic_store_n(c->sq_ktail, c->sq_tail, __ATOMIC_RELEASE);
+    ret = sys_io_uring_enter(c->ring_fd, submit, min_complete, flags, arg, argsz);
+    if (ret >= 0) {
+        c->sq_pending -= MIN2((unsigned)ret, submit);
+    }
+    return ret;
+}
+
+/* must be called with lock held */
+static struct io_uring_sqe *uring_get_sqe(struct uring_ctx *c)
+{
+    struct io_uring_sqe *sqe;
+    unsigned idx;
+    unsigned head = __atomic_load_n(c->sq_khead, __ATOMIC_ACQUIRE);
+    if (c->sq_tail - head >= c->sq_entries) {
+        /* sq full, push to kernel first */
+        if (uring_flush(c, 0, 0, NULL, 0) < 0) {
+            printf("io_uring_enter flush failed %d\n", errno);
+            return NULL;
+        }
+        head = __atomic_load_n(c->sq_khead, __ATOMIC_ACQUIRE);
+        if (c->sq_tail - head >= c->sq_entries) {
+            return NULL;
+        }
+    }
+    idx = c->sq_tail & *c->sq_kmask;
+    sqe = &c->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    c->sq_array[idx] = idx;
+    c->sq_tail++;
+    c->sq_pending++;
+    return sqe;
+}
+
+static unsigned uring_poll_mask(struct gevent *e)
+{
+    unsigned mask = 0;
+    if (e->flags & EVENT_READ)
+        mask |= POLLIN | POLLRDHUP;
+    if (e->flags & EVENT_WRITE)
+        mask |= POLLOUT;
+    if (e->flags & EVENT_ERROR)
+        mask |= POLLERR;
+    return mask;
+}
+
+/* must be called with lock held */
+static int uring_prep_poll_add(struct uring_ctx *c, struct gevent *e)
+{
+    struct io_uring_sqe *sqe;
+    struct uring_poll *p = (struct uring_poll *)e->backend;
+    if (!p) {
+        p = CALLOC(1, struct uring_poll);
+        if (!p) {
+            printf("malloc uring_poll failed!\n");
+            return -1;
+        }
+        p->e = e;
+        INIT_LIST_HEAD(&p->entry);
+        e->backend = p;
+    }
+    sqe = uring_get_sqe(c);
+    if (!sqe) {
+        printf("io_uring sq is full!\n");
+        return -1;
+    }
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = e->evfd;
+    sqe->poll32_events = uring_poll_mask(e);
+    if (e->flags & EVENT_PERSIST) {
+        sqe->len = IORING_POLL_ADD_MULTI;
+    }
+    sqe->user_data = (uint64_t)(uintptr_t)p;
+    p->inflight++;
+    return 0;
+}
+
+/* must be called with lock held */
+static int uring_prep_poll_remove(struct uring_ctx *c, struct gevent *e)
+{
+    struct io_uring_sqe *sqe;
+    struct uring_poll *p = (struct uring_poll *)e->backend;
+    if (!p || p->inflight == 0) {
+        return 0;
+    }
+    sqe = uring_get_sqe(c);
+    if (!sqe) {
+        printf("io_uring sq is full!\n");
+        return -1;
+    }
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->addr = (uint64_t)(uintptr_t)p;
+    sqe->user_data = 0;
+    return 0;
+}
+
+/* must be called with lock held, e may be freed right after return */
+static void uring_poll_detach(struct uring_ctx *c, struct gevent *e)
+{
+    struct uring_poll *p = (struct uring_poll *)e->backend;
+    if (!p) {
+        return;
+    }
+    e->backend = NULL;
+    p->e = NULL;
+    if (p->inflight == 0) {
+        free(p);
+    } else {
+        list_add_tail(&p->entry, &c->orphans);
+    }
+}
+
+static int uring_add(struct gevent_base *eb, struct gevent *e)
+{
+    int ret;
+    struct uring_ctx *c = (struct uring_ctx *)eb->ctx;
+    mutex_lock(&c->lock);
+    ret = uring_prep_poll_add(c, e);
+    if (ret == 0 && uring_flush(c, 0, 0, NULL, 0) < 0) {
+        printf("io_uring_enter POLL_ADD failed: %d %s\n", errno, strerror(errno));
+        ret = -1;
+    }
+    mutex_unlock(&c->lock);
+    return ret;
+}
+
+static int uring_del(struct gevent_base *eb, struct gevent *e)
+{
+    int ret;
+    struct uring_ctx *c = (struct uring_ctx *)eb->ctx;
+    mutex_lock(&c->lock);
+    ret = uring_prep_poll_remove(c, e);
+    if (ret == 0 && uring_flush(c, 0, 0, NULL, 0) < 0) {
+        printf("io_uring_enter POLL_REMOVE failed: %d %s\n", errno, strerror(errno));
+        ret = -1;
+    }
+    /* detach even if remove failed, caller is going to free e */
+    uring_poll_detach(c, e);
+    mutex_unlock(&c->lock);
+    return ret;
+}
+
+static int uring_mod(struct gevent_base *eb, struct gevent *e)
+{
+    int ret;
+    struct uring_ctx *c = (struct uring_ctx *)eb->ctx;
+    mutex_lock(&c->lock);
+    ret = uring_prep_poll_remove(c, e);
+    if (ret == 0) {
+        ret = uring_prep_poll_add(c, e);
+    }
+    if (ret == 0 && uring_flush(c, 0, 0, NULL, 0) < 0) {
+        printf("io_uring_enter POLL_UPDATE failed: %d %s\n", errno, strerror(errno));
+        ret = -1;
+    }
+    mutex_unlock(&c->lock);
+    return ret;
+}
+
+static void uring_handle_poll(struct gevent_base *eb, struct uring_poll *p,
+                int res, unsigned flags)
+{
+    struct gevent *e;
+    struct uring_ctx *c = (struct uring_ctx *)eb->ctx;
+
+    mutex_lock(&c->lock);
+    if (!(flags & IORING_CQE_F_MORE)) {
+        p->inflight--;
+    }
+    e = p->e;
+    if (!e) {
+        /* gevent already deleted, free token on its last completion */
+        if (p->inflight == 0) {
+            list_del(&p->entry);
+            free(p);
+        }
+        mutex_unlock(&c->lock);
+        return;
+    }
+    if (res >= 0 && (e->flags & EVENT_PERSIST) && !(flags & IORING_CQE_F_MORE)) {
+        /* multishot poll terminated by kernel, arm again before callback */
+        uring_prep_poll_add(c, e);
+    }
+    mutex_unlock(&c->lock);
+    if (res < 0) {
+        return;
+    }
+    if (res & (POLLERR | POLLHUP | POLLRDHUP)) {
+        if (e->evcb.ev_err)
+            gevent_base_invoke(eb, e->evcb.ev_err, e->evfd, e->evcb.args);
+        return;
+    }
+    if (res & POLLIN) {
+        if (e->evcb.ev_in)
+            gevent_base_invoke(eb, e->evcb.ev_in, e->evfd, e->evcb.args);
+        if (e->evcb.ev_timer) {
+            gevent_base_invoke(eb, e->evcb.ev_timer, e->evfd, e->evcb.args);
+            if (e->flags & EVENT_PERSIST) {
+                uint64_t expirations = 0;
+                if (sizeof(expirations) != read(e->evfd, &expirations, sizeof(expirations))) {
+                    printf("get expirations failed from timerfd!\n");
+                }
+            }
+        }
+    }
+    if (res & POLLOUT) {
+        if (e->evcb.ev_out)
+            gevent_base_invoke(eb, e->evcb.ev_out, e->evfd, e->evcb.args);
+    }
+}
+
+static void uring_handle_req(struct uring_ctx *c, struct uring_req *req,
+                int res, unsigned flags)
+{
+    void *buf = req->buf;
+    if ((flags & IORING_CQE_F_BUFFER) && req->bgid >= 0) {
+        struct uring_bufgroup *bg = &c->bufgroups[req->bgid];
+        int bid = flags >> IORING_CQE_BUFFER_SHIFT;
+        buf = (char *)bg->base + (size_t)bid * bg->len;
+    }
+    if (req->cb) {
+        req->cb(req->fd, res, buf, req->arg);
+    }
+    free(req);
+}
+
+static int uring_dispatch(struct gevent_base *eb, struct timeval *tv)
+{
+    int ret;
+    unsigned head, submit;
+    struct uring_ctx *c = (struct uring_ctx *)eb->ctx;
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    unsigned flags = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+
+    memset(&arg, 0, sizeof(arg));
+    if (tv) {
+        ts.tv_sec = tv->tv_sec;
+        ts.tv_nsec = tv->tv_usec * 1000;
+        arg.ts = (uint64_t)(uintptr_t)&ts;
+    }
+    /* publish sqes under lock, but never block in kernel with lock held */
+    mutex_lock(&c->lock);
+    head = *c->cq_khead;
+    if (head != __atomic_load_n(c->cq_ktail, __ATOMIC_ACQUIRE) ||
+        (tv && tv->tv_sec == 0 && tv->tv_usec == 0)) {
+        /* completions left or busy polling, don't block */
+        flags &= ~IORING_ENTER_GETEVENTS;
+    }
+    submit = c->sq_pending;
+    c->sq_pending = 0;
+    __atomic_store_n(c->sq_ktail, c->sq_tail, __ATOMIC_RELEASE);
+    mutex_unlock(&c->lock);
+    if (submit == 0 && !(flags & IORING_ENTER_GETEVENTS)) {
+        /* nothing to submit or wait, just reap cq ring, no syscall */
+        ret = 0;
+    } else {
+        ret = sys_io_uring_enter(c->ring_fd, submit, 1, flags, &arg, sizeof(arg));
+    }
+    if (ret < 0 && errno != ETIME && errno != EINTR && errno != EBUSY) {
+        printf("io_uring_enter failed %d: %s\n", errno, strerror(errno));
+        return -1;
+    }
+
+    c->cq_cur = head;
+    c->cq_end = __atomic_load_n(c->cq_ktail, __ATOMIC_ACQUIRE);
+    while (c->cq_cur != c->cq_end) {
+        struct io_uring_cqe *cqe = &c->cqes[c->cq_cur & *c->cq_kmask];
+        uint64_t ud = cqe->user_data;
+        int res = cqe->res;
+        unsigned cflags = cqe->flags;
+        c->cq_cur++;
+        if (ud == 0) {
+            continue;
+        }
+        if (ud & URING_REQ_TAG) {
+            uring_handle_req(c, (struct uring_req *)(uintptr_t)(ud & ~URING_REQ_TAG),
+                             res, cflags);
+        } else {
+            uring_handle_poll(eb, (struct uring_poll *)(uintptr_t)ud, res, cflags);
+        }
+    }
+    __atomic_store_n(c->cq_khead, c->cq_end, __ATOMIC_RELEASE);
+    return 0;
+}
+
+struct gevent_ops iouringops = {
+    .init     = uring_init,
+    .deinit   = uring_deinit,
+    .add      = uring_add,
+    .del      = uring_del,
+    .mod      = uring_mod,
+    .dispatch = uring_dispatch,
+};
+
+static struct uring_ctx *uring_ctx_of(struct gevent_base *eb)
+{
+    if (!eb || eb->ops != &iouringops) {
+        printf("gevent_base is not io_uring backend!\n");
+        return NULL;
+    }
+    return (struct uring_ctx *)eb->ctx;
+}
+
+static int uring_submit_req(struct gevent_base *eb, uint8_t opcode, int fd,
+                void *buf, size_t len, int bgid, gevent_uring_cb cb, void *arg)
+{
+    struct io_uring_sqe *sqe;
+    struct uring_req *req;
+    struct uring_ctx *c = uring_ctx_of(eb);
+    if (!c) {
+        return -1;
+    }
+    if (bgid >= URING_MAX_BGID || (bgid >= 0 && !c->bufgroups[bgid].base)) {
+        printf("invalid buffer group %d\n", bgid);
+        return -1;
+    }
+    req = CALLOC(1, struct uring_req);
+    if (!req) {
+        printf("malloc uring_req failed!\n");
+        return -1;
+    }
+    req->fd = fd;
+    req->buf = buf;
+    req->bgid = bgid;
+    req->cb = cb;
+    req->arg = arg;
+
+    mutex_lock(&c->lock);
+    sqe = uring_get_sqe(c);
+    if (!sqe) {
+        mutex_unlock(&c->lock);
+        free(req);
+        return -1;
+    }
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)buf;
+    sqe->len = len;
+    if (opcode == IORING_OP_SEND) {
+        sqe->msg_flags = MSG_NOSIGNAL;
+    }
+    if (bgid >= 0) {
+        sqe->flags |= IOSQE_BUFFER_SELECT;
+        sqe->buf_group = bgid;
+        sqe->addr = 0;
+        if (len == 0) {
+            sqe->len = c->bufgroups[bgid].len;
+        }
+    }
+    sqe->user_data = (uint64_t)(uintptr_t)req | URING_REQ_TAG;
+    mutex_unlock(&c->lock);
+    return 0;
+}
+
+int gevent_uring_recv(struct gevent_base *eb, int fd, void *buf, size_t len,
+        gevent_uring_cb cb, void *arg)
+{
+    return uring_submit_req(eb, IORING_OP_RECV, fd, buf, len, -1, cb, arg);
+}
+
+int gevent_uring_recv_select(struct gevent_base *eb, int fd, int bgid,
+        gevent_uring_cb cb, void *arg)
+{
+    if (bgid < 0) {
+        return -1;
+    }
+    return uring_submit_req(eb, IORING_OP_RECV, fd, NULL, 0, bgid, cb, arg);
+}
+
+int gevent_uring_send(struct gevent_base *eb, int fd, const void *buf, size_t len,
+        gevent_uring_cb cb, void *arg)
+{
+    return uring_submit_req(eb, IORING_OP_SEND, fd, (void *)buf, len, -1, cb, arg);
+}
+
+int gevent_uring_accept(struct gevent_base *eb, int fd,
+        gevent_uring_cb cb, void *arg)
+{
+    return uring_submit_req(eb, IORING_OP_ACCEPT, fd, NULL, 0, -1, cb, arg);
+}
+
+static int uring_provide(struct uring_ctx *c, int bgid, void *addr, int len,
+                int nr, int bid)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(c);
+    if (!sqe) {
+        return -1;
+    }
+    sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+    sqe->fd = nr;
+    sqe->addr = (uint64_t)(uintptr_t)addr;
+    sqe->len = len;
+    sqe->off = bid;
+    sqe->buf_group = bgid;
+    sqe->user_data = 0;
+    return 0;
+}
+
+int gevent_uring_provide_buffers(struct gevent_base *eb, int bgid,
+        void *base, int len, int nr)
+{
+    int ret;
+    struct uring_ctx *c = uring_ctx_of(eb);
+    if (!c || !base || len <= 0 || nr <= 0 || bgid < 0 || bgid >= URING_MAX_BGID) {
+        printf("%s:%d paraments is invalid\n", __func__, __LINE__);
+        return -1;
+    }
+    mutex_lock(&c->lock);
+    c->bufgroups[bgid].base = base;
+    c->bufgroups[bgid].len = len;
+    c->bufgroups[bgid].nr = nr;
+    ret = uring_provide(c, bgid, base, len, nr, 0);
+    if (ret == 0 && uring_flush(c, 0, 0, NULL, 0) < 0) {
+        printf("io_uring_enter PROVIDE_BUFFERS failed: %d %s\n", errno, strerror(errno));
+        ret = -1;
+    }
+    mutex_unlock(&c->lock);
+    return ret;
+}
+
+int gevent_uring_return_buffer(struct gevent_base *eb, int bgid, void *buf)
+{
+    int ret, bid;
+    struct uring_bufgroup *bg;
+    struct uring_ctx *c = uring_ctx_of(eb);
+    if (!c || bgid < 0 || bgid >= URING_MAX_BGID || !c->bufgroups[bgid].base) {
+        return -1;
+    }
+    bg = &c->bufgroups[bgid];
+    bid = ((char *)buf - (char *)bg->base) / bg->len;
+    if (bid < 0 || bid >= bg->nr) {
+        printf("buffer %p not belong to group %d\n", buf, bgid);
+        return -1;
+    }
+    /* queued, submitted together with next dispatch */
+    mutex_lock(&c->lock);
+    ret = uring_provide(c, bgid, (char *)bg->base + (size_t)bid * bg->len,
+                        bg->len, 1, bid);
+    mutex_unlock(&c->lock);
+    return ret;
+}
+
+#else /* !GEVENT_HAVE_IO_URING */
+
+int gevent_uring_recv(struct gevent_base *eb, int fd, void *buf, size_t len,
+        gevent_uring_cb cb, void *arg)
+{
+    return -1;
+}
+
+int gevent_uring_recv_select(struct gevent_base *eb, int fd, int bgid,
+        gevent_uring_cb cb, void *arg)
+{
+    return -1;
+}
+
+int gevent_uring_send(struct gevent_base *eb, int fd, const void *buf, size_t len,
+        gevent_uring_cb cb, void *arg)
+{
+    return -1;
+}
+
+int gevent_uring_accept(struct gevent_base *eb, int fd,
+        gevent_uring_cb cb, void *arg)
+{
+    return -1;
+}
+
+int gevent_uring_provide_buffers(struct gevent_base *eb, int bgid,
+        void *base, int len, int nr)
+{
+    return -1;
+}
+
+int gevent_uring_return_buffer(struct gevent_base *eb, int bgid, void *buf)
+{
+    return -1;
+}
+
+#endif
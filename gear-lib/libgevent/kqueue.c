@@ -0,0 +1,238 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#include "libgevent.h"
+
+#if defined (OS_APPLE) || defined (__FreeBSD__) || defined (__OpenBSD__) || defined (__NetBSD__)
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/event.h>
+#include <sys/time.h>
+
+#define KQUEUE_MAX_NEVENT   (4096)
+
+struct kqueue_ctx {
+    int kqfd;
+    int nevents;
+    struct kevent *events;
+};
+
+static void *kqueue_init(void)
+{
+    struct kqueue_ctx *c = CALLOC(1, struct kqueue_ctx);
+    if (!c) {
+        printf("malloc kqueue_ctx failed!\n");
+        return NULL;
+    }
+    c->kqfd = kqueue();
+    if (c->kqfd == -1) {
+        printf("kqueue failed %d: %s\n", errno, strerror(errno));
+        free(c);
+        return NULL;
+    }
+    c->nevents = KQUEUE_MAX_NEVENT;
+    c->events = CALLOC(KQUEUE_MAX_NEVENT, struct kevent);
+    if (!c->events) {
+        printf("malloc kevent failed!\n");
+        close(c->kqfd);
+        free(c);
+        return NULL;
+    }
+    return c;
+}
+
+static void kqueue_deinit(void *ctx)
+{
+    struct kqueue_ctx *c = (struct kqueue_ctx *)ctx;
+    if (!c) {
+        return;
+    }
+    close(c->kqfd);
+    free(c->events);
+    free(c);
+}
+
+/*
+ * apply read/write filter changes, EV_RECEIPT makes kernel report result
+ * of each change, so deleting a filter never added is not an error
+ */
+static int kqueue_apply(struct kqueue_ctx *c, struct gevent *e,
+                bool want_read, bool want_write, bool del_other)
+{
+    int i, n = 0, ret;
+    struct kevent changes[2], results[2];
+    u_short flags = EV_ADD | EV_ENABLE | EV_CLEAR | EV_RECEIPT;
+
+    if (0 == (e->flags & EVENT_PERSIST)) {
+        flags |= EV_ONESHOT;
+    }
+    if (want_read) {
+        EV_SET(&changes[n++], e->evfd, EVFILT_READ, flags, 0, 0, e);
+    } else if (del_other) {
+        EV_SET(&changes[n++], e->evfd, EVFILT_READ, EV_DELETE | EV_RECEIPT, 0, 0, e);
+    }
+    if (want_write) {
+        EV_SET(&changes[n++], e->evfd, EVFILT_WRITE, flags, 0, 0, e);
+    } else if (del_other) {
+        EV_SET(&changes[n++], e->evfd, EVFILT_WRITE, EV_DELETE | EV_RECEIPT, 0, 0, e);
+    }
+    if (n == 0) {
+        return 0;
+    }
+    ret = kevent(c->kqfd, changes, n, results, n, NULL);
+    if (ret == -1) {
+        printf("kevent change failed %d: %s\n", errno, strerror(errno));
+        return -1;
+    }
+    for (i = 0; i < ret; i++) {
+        if ((results[i].flags & EV_ERROR) && results[i].data != 0 &&
+            results[i].data != ENOENT) {
+            printf("kevent change fd=%d filter=%d failed: %s\n", e->evfd,
+                   results[i].filter, strerror((int)results[i].data));
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * timer has no fd, ident of EVFILT_TIMER only needs to be unique among
+ * timers of this kqueue, so the event address is used
+ */
+static int kqueue_timer(struct kqueue_ctx *c, struct gevent *e, bool add)
+{
+    struct kevent change;
+    u_short flags = EV_DELETE;
+
+    if (add) {
+        flags = EV_ADD | EV_ENABLE;
+        if (0 == (e->flags & EVENT_PERSIST)) {
+            flags |= EV_ONESHOT;
+        }
+    }
+    /* data unit is msec by default */
+    EV_SET(&change, (uintptr_t)e, EVFILT_TIMER, flags, 0,
+           e->evcb.timer_msec, e);
+    if (-1 == kevent(c->kqfd, &change, 1, NULL, 0, NULL)) {
+        if (!add && errno == ENOENT) {
+            return 0;           /* oneshot timer already fired */
+        }
+        printf("kevent timer %s failed %d: %s\n", add ? "add" : "del",
+               errno, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+static int kqueue_add(struct gevent_base *eb, struct gevent *e)
+{
+    struct kqueue_ctx *c = (struct kqueue_ctx *)eb->ctx;
+    if (e->flags & EVENT_TIMEOUT) {
+        return kqueue_timer(c, e, true);
+    }
+    return kqueue_apply(c, e, !!(e->flags & EVENT_READ),
+                        !!(e->flags & EVENT_WRITE), false);
+}
+
+static int kqueue_del(struct gevent_base *eb, struct gevent *e)
+{
+    struct kqueue_ctx *c = (struct kqueue_ctx *)eb->ctx;
+    if (e->flags & EVENT_TIMEOUT) {
+        return kqueue_timer(c, e, false);
+    }
+    return kqueue_apply(c, e, false, false, true);
+}
+
+static int kqueue_mod(struct gevent_base *eb, struct gevent *e)
+{
+    struct kqueue_ctx *c = (struct kqueue_ctx *)eb->ctx;
+    if (e->flags & EVENT_TIMEOUT) {
+        /* EV_ADD on existing ident updates period */
+        return kqueue_timer(c, e, true);
+    }
+    return kqueue_apply(c, e, !!(e->flags & EVENT_READ),
+                        !!(e->flags & EVENT_WRITE), true);
+}
+
+static int kqueue_dispatch(struct gevent_base *eb, struct timeval *tv)
+{
+    int i, n;
+    struct timespec ts, *pts = NULL;
+    struct kqueue_ctx *c = (struct kqueue_ctx *)eb->ctx;
+
+    if (tv) {
+        ts.tv_sec = tv->tv_sec;
+        ts.tv_nsec = tv->tv_usec * 1000;
+        pts = &ts;
+    }
+    n = kevent(c->kqfd, NULL, 0, c->events, c->nevents, pts);
+    if (n == -1) {
+        if (errno != EINTR) {
+            printf("kevent wait failed %d: %s\n", errno, strerror(errno));
+            return -1;
+        }
+        return 0;
+    }
+    for (i = 0; i < n; i++) {
+        struct kevent *kev = &c->events[i];
+        struct gevent *e = (struct gevent *)kev->udata;
+        if (!e) {
+            continue;
+        }
+        if (kev->flags & EV_ERROR) {
+            gevent_base_invoke(eb, e->evcb.ev_err, e->evfd, e->evcb.args);
+            continue;
+        }
+        if (kev->filter == EVFILT_TIMER) {
+            gevent_base_invoke(eb, e->evcb.ev_timer, e->evfd, e->evcb.args);
+        } else if (kev->filter == EVFILT_READ) {
+            /* deliver pending data before reporting EOF */
+            if (kev->data > 0 || !(kev->flags & EV_EOF)) {
+                gevent_base_invoke(eb, e->evcb.ev_in, e->evfd, e->evcb.args);
+            }
+            if (kev->flags & EV_EOF) {
+                gevent_base_invoke(eb, e->evcb.ev_err, e->evfd, e->evcb.args);
+            }
+        } else if (kev->filter == EVFILT_WRITE) {
+            if (kev->flags & EV_EOF) {
+                gevent_base_invoke(eb, e->evcb.ev_err, e->evfd, e->evcb.args);
+            } else {
+                gevent_base_invoke(eb, e->evcb.ev_out, e->evfd, e->evcb.args);
+            }
+        }
+    }
+    return 0;
+}
+
+struct gevent_ops kqueueops = {
+    .init     = kqueue_init,
+    .deinit   = kqueue_deinit,
+    .add      = kqueue_add,
+    .del      = kqueue_del,
+    .mod      = kqueue_mod,
+    .dispatch = kqueue_dispatch,
+};
+
+#endif
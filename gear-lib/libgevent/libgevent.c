@@ -19,17 +19,32 @@
  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
  * SOFTWARE.
  ******************************************************************************/
+#if defined (__linux__) || defined (__CYGWIN__)
+/*NOTE: must be firstly */
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#endif
 #include "libgevent.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <string.h>
 #include <fcntl.h>
 #include <errno.h>
-#if defined (OS_LINUX) || defined (OS_APPLE)
+#include <inttypes.h>
+#include <time.h>
+#if defined (OS_LINUX)
+#include <sys/socket.h>
 #ifndef __CYGWIN__
 #include <sys/eventfd.h>
 #endif
 #endif
+#if defined (ENABLE_TRACE)
+#include <libtrace.h>
+#else
+#define TRACE_SCOPE(cat, name)
+#endif
 
 #if defined (OS_LINUX) || defined (OS_RTTHREAD) || defined (OS_RTOS) || defined (OS_APPLE)
 extern const struct gevent_ops selectops;
@@ -43,19 +58,18 @@ extern const struct gevent_ops epollops;
 #if defined (OS_WINDOWS)
 extern const struct gevent_ops iocpops;
 #endif
-
-enum gevent_backend_type {
-#if defined (OS_LINUX) || defined (OS_RTTHREAD) || defined (OS_RTOS) || defined (OS_APPLE)
-    GEVENT_SELECT,
-    GEVENT_POLL,
-#endif
-#if defined (OS_LINUX) || defined (OS_WINDOWS)
-    GEVENT_EPOLL,
+#if defined (GEVENT_HAVE_IO_URING)
+extern const struct gevent_ops iouringops;
 #endif
-#if defined (OS_WINDOWS)
-    GEVENT_IOCP,
+#if defined (OS_APPLE)
+extern const struct gevent_ops kqueueops;
 #endif
-};
+
+extern struct gevent_timer_wheel *gevent_timer_wheel_create(void);
+extern void gevent_timer_wheel_destroy(struct gevent_timer_wheel *tw);
+extern int gevent_timer_wheel_timeout(struct gevent_timer_wheel *tw);
+extern void gevent_timer_wheel_run(struct gevent_timer_wheel *tw);
+extern void gevent_signal_ctx_destroy(struct gevent_signal_ctx *c);
 
 struct gevent_backend {
     enum gevent_backend_type type;
@@ -75,12 +89,18 @@ static struct gevent_backend gevent_backend_list[] = {
 #if defined (OS_WINDOWS)
     {GEVENT_IOCP,   &iocpops},
 #endif
+#if defined (GEVENT_HAVE_IO_URING)
+    {GEVENT_IO_URING, &iouringops},
+#endif
+#if defined (OS_APPLE)
+    {GEVENT_KQUEUE, &kqueueops},
+#endif
 };
 
 #if defined (OS_LINUX)
 #define GEVENT_BACKEND GEVENT_EPOLL
 #elif defined (OS_APPLE)
-#define GEVENT_BACKEND GEVENT_POLL
+#define GEVENT_BACKEND GEVENT_KQUEUE
 #elif defined (OS_WINDOWS)
 //#define GEVENT_BACKEND GEVENT_IOCP
 #define GEVENT_BACKEND GEVENT_EPOLL
@@ -88,16 +108,126 @@ static struct gevent_backend gevent_backend_list[] = {
 #define GEVENT_BACKEND GEVENT_POLL
 #endif
 
+static void post_push(struct gevent_base *eb, struct gevent_post *n)
+{
+    struct gevent_post *prev;
+    __atomic_store_n(&n->next, NULL, __ATOMIC_RELAXED);
+    prev = __atomic_exchange_n(&eb->post_tail, n, __ATOMIC_ACQ_REL);
+    __atomic_store_n(&prev->next, n, __ATOMIC_RELEASE);
+}
+
+/*
+ * Vyukov intrusive MPSC queue, post_stub keeps queue never empty
+ * return NULL if empty or producer is in the middle of push
+ */
+static struct gevent_post *post_pop(struct gevent_base *eb)
+{
+    struct gevent_post *head = eb->post_head;
+    struct gevent_post *next = __atomic_load_n(&head->next, __ATOMIC_ACQUIRE);
+    if (head == &eb->post_stub) {
+        if (!next) {
+            return NULL;
+        }
+        eb->post_head = next;
+        head = next;
+        next = __atomic_load_n(&next->next, __ATOMIC_ACQUIRE);
+    }
+    if (next) {
+        eb->post_head = next;
+        return head;
+    }
+    if (head != __atomic_load_n(&eb->post_tail, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    post_push(eb, &eb->post_stub);
+    next = __atomic_load_n(&head->next, __ATOMIC_ACQUIRE);
+    if (next) {
+        eb->post_head = next;
+        return head;
+    }
+    return NULL;
+}
+
+static void post_run(struct gevent_base *eb)
+{
+    struct gevent_post *n;
+    /* clear before drain, post after this point will wakeup again */
+    __atomic_store_n(&eb->post_pending, 0, __ATOMIC_SEQ_CST);
+    while ((n = post_pop(eb)) != NULL) {
+        n->func(n->arg);
+        free(n);
+    }
+}
+
+/*
+ * inner_fd is eventfd on linux, other platforms have no eventfd,
+ * use nonblock pipe instead, inner_wfd is the write end
+ */
+static int inner_fd_create(struct gevent_base *eb)
+{
+#if defined (OS_LINUX)
+    eb->inner_fd = eventfd(0, 0);
+    if (eb->inner_fd == -1) {
+        printf("eventfd failed %d\n", errno);
+        return -1;
+    }
+    eb->inner_wfd = eb->inner_fd;
+#else
+    int fds[2];
+    if (pipe(fds) == -1) {
+        printf("pipe failed %d\n", errno);
+        return -1;
+    }
+    fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL, 0) | O_NONBLOCK);
+    fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL, 0) | O_NONBLOCK);
+    eb->inner_fd = fds[0];
+    eb->inner_wfd = fds[1];
+#endif
+    return 0;
+}
+
+static void inner_fd_destroy(struct gevent_base *eb)
+{
+    if (eb->inner_wfd != eb->inner_fd) {
+        close(eb->inner_wfd);
+    }
+    close(eb->inner_fd);
+}
+
+static void inner_fd_notify(struct gevent_base *eb)
+{
+    uint64_t notify = '1';
+    if (sizeof(uint64_t) != write(eb->inner_wfd, &notify, sizeof(uint64_t))) {
+        if (errno != EAGAIN) {
+            perror("write error");
+        }
+    }
+}
+
 static void event_in(int fd, void *arg)
 {
     uint64_t notify;
+    struct gevent_base *eb = (struct gevent_base *)arg;
     if (sizeof(uint64_t) != read(fd, &notify, sizeof(uint64_t))) {
         printf("read notify failed %d\n", errno);
     }
+#if !defined (OS_LINUX)
+    /* pipe is not counter like eventfd, drain all notify */
+    while (read(fd, &notify, sizeof(uint64_t)) > 0);
+#endif
+    if (eb) {
+        post_run(eb);
+    }
 }
 
 struct gevent_base *gevent_base_create(void)
 {
+    return gevent_base_create_by(GEVENT_BACKEND);
+}
+
+struct gevent_base *gevent_base_create_by(enum gevent_backend_type type)
+{
+    int i;
     struct gevent_base *eb = NULL;
     eb = (struct gevent_base *)calloc(1, sizeof(struct gevent_base));
     if (!eb) {
@@ -105,21 +235,37 @@ struct gevent_base *gevent_base_create(void)
         return NULL;
     }
 
-    eb->ops = gevent_backend_list[GEVENT_BACKEND].ops;
+    for (i = 0; i < (int)ARRAY_SIZE(gevent_backend_list); i++) {
+        if (gevent_backend_list[i].type == type) {
+            eb->ops = gevent_backend_list[i].ops;
+            break;
+        }
+    }
     if (!eb->ops) {
-        printf("gevent_backend_list ops is invalid!\n");
+        printf("gevent backend %d is not supported!\n", type);
         goto failed;
     }
     eb->ctx = eb->ops->init();
+    if (!eb->ctx) {
+        printf("gevent backend %d init failed!\n", type);
+        goto failed;
+    }
 
     eb->loop = 1;
-    eb->inner_fd = eventfd(0, 0);
-    if (eb->inner_fd == -1) {
-        printf("eventfd failed %d\n", errno);
+    if (0 != inner_fd_create(eb)) {
         goto failed;
     }
-    da_init(eb->ev_array);
-    eb->inner_event = gevent_create(eb->inner_fd, event_in, NULL, NULL, NULL);
+    INIT_LIST_HEAD(&eb->ev_list);
+    eb->ev_num = 0;
+    eb->wheel = gevent_timer_wheel_create();
+    if (!eb->wheel) {
+        printf("gevent_timer_wheel_create failed!\n");
+        goto failed;
+    }
+    eb->post_stub.next = NULL;
+    eb->post_head = &eb->post_stub;
+    eb->post_tail = &eb->post_stub;
+    eb->inner_event = gevent_create(eb->inner_fd, event_in, NULL, NULL, eb);
     if (!eb->inner_event) {
         printf("gevent_create inner_event failed!\n");
         goto failed;
@@ -136,37 +282,346 @@ failed:
 
 void gevent_base_destroy(struct gevent_base *eb)
 {
+    struct gevent *e, *next;
+    struct gevent_post *n;
     if (!eb) {
         return;
     }
     if (eb->loop) {
         gevent_base_loop_break(eb);
     }
+    gevent_signal_ctx_destroy(eb->sig);
     gevent_del(eb, &eb->inner_event);
     gevent_destroy(eb->inner_event);
-    close(eb->inner_fd);
+    inner_fd_destroy(eb);
     eb->ops->deinit(eb->ctx);
-    while (eb->ev_array.num > 0) {
-        struct gevent **e = eb->ev_array.array + eb->ev_array.num-1;
-        da_erase_item(eb->ev_array, e);
-        free(*e);
+    gevent_timer_wheel_destroy(eb->wheel);
+    while ((n = post_pop(eb)) != NULL) {
+        free(n);
+    }
+    list_for_each_entry_safe(e, next, &eb->ev_list, entry) {
+        list_del_init(&e->entry);
+        free(e);
+    }
+    eb->ev_num = 0;
+    if (eb->stats) {
+        free(eb->stats);
     }
-    da_free(eb->ev_array);
     free(eb);
 }
 
+static uint64_t gevent_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t gevent_now_us(void)
+{
+    return gevent_now_ns() / 1000;
+}
+
+static int hist_bucket(uint64_t val)
+{
+    int i = 0;
+    while (val && i < GEVENT_HIST_BUCKETS - 1) {
+        val >>= 1;
+        i++;
+    }
+    return i;
+}
+
+void gevent_base_invoke(struct gevent_base *eb, void (*cb)(int, void *),
+        int fd, void *arg)
+{
+    uint64_t start, cost;
+    struct gevent_stats *st = eb->stats;
+    if (!cb) {
+        return;
+    }
+    TRACE_SCOPE("gevent", "callback");
+    if (eb->tick && !eb->round_hits) {
+        eb->tick();
+    }
+    eb->round_hits++;
+    if (LIKELY(!st)) {
+        cb(fd, arg);
+        return;
+    }
+    start = gevent_now_us();
+    if (st->round_events == 0) {
+        st->round_start_us = start;
+    }
+    cb(fd, arg);
+    cost = gevent_now_us() - start;
+    st->callbacks++;
+    st->round_events++;
+    st->callback_us += cost;
+    st->callback_hist[hist_bucket(cost)]++;
+    if (cost > st->callback_max_us) {
+        st->callback_max_us = cost;
+    }
+    if (st->slow_threshold_us && cost >= st->slow_threshold_us) {
+        st->slow_callbacks++;
+        if (st->slow_hook) {
+            st->slow_hook(eb, fd, cb, cost, st->slow_arg);
+        }
+    }
+}
+
+static void gevent_stats_round_end(struct gevent_base *eb)
+{
+    uint64_t busy;
+    struct gevent_stats *st = eb->stats;
+    if (LIKELY(!st)) {
+        return;
+    }
+    st->loops++;
+    st->events_hist[hist_bucket(st->round_events)]++;
+    if (st->round_events) {
+        busy = gevent_now_us() - st->round_start_us;
+        st->busy_us += busy;
+        st->loop_hist[hist_bucket(busy)]++;
+        if (busy > st->loop_max_us) {
+            st->loop_max_us = busy;
+        }
+    }
+    st->round_events = 0;
+}
+
+int gevent_base_stats_enable(struct gevent_base *eb, bool enable)
+{
+    if (!eb) {
+        return -1;
+    }
+    if (enable && !eb->stats) {
+        eb->stats = CALLOC(1, struct gevent_stats);
+        if (!eb->stats) {
+            printf("malloc gevent_stats failed!\n");
+            return -1;
+        }
+    } else if (!enable && eb->stats) {
+        /* NOTE: loop thread may be using it, only disable when loop stopped */
+        free(eb->stats);
+        eb->stats = NULL;
+    }
+    return 0;
+}
+
+int gevent_base_stats_get(struct gevent_base *eb, struct gevent_stats *stats)
+{
+    if (!eb || !eb->stats || !stats) {
+        return -1;
+    }
+    memcpy(stats, eb->stats, sizeof(*stats));
+    return 0;
+}
+
+void gevent_base_stats_reset(struct gevent_base *eb)
+{
+    struct gevent_stats *st;
+    if (!eb || !eb->stats) {
+        return;
+    }
+    st = eb->stats;
+    st->loops = 0;
+    st->callbacks = 0;
+    st->slow_callbacks = 0;
+    st->callback_max_us = 0;
+    st->loop_max_us = 0;
+    st->callback_us = 0;
+    st->busy_us = 0;
+    st->spin_ns = 0;
+    st->blocked_ns = 0;
+    st->spin_hits = 0;
+    st->spin_misses = 0;
+    memset(st->callback_hist, 0, sizeof(st->callback_hist));
+    memset(st->events_hist, 0, sizeof(st->events_hist));
+    memset(st->loop_hist, 0, sizeof(st->loop_hist));
+}
+
+int gevent_base_set_slow_hook(struct gevent_base *eb, uint64_t threshold_us,
+        gevent_slow_hook hook, void *arg)
+{
+    if (!eb || !eb->stats) {
+        printf("gevent_base stats is not enabled!\n");
+        return -1;
+    }
+    eb->stats->slow_threshold_us = threshold_us;
+    eb->stats->slow_arg = arg;
+    eb->stats->slow_hook = hook;
+    return 0;
+}
+
+static void hist_dump(const char *name, const uint64_t *hist)
+{
+    int i;
+    printf("%s:", name);
+    for (i = 0; i < GEVENT_HIST_BUCKETS; i++) {
+        if (hist[i]) {
+            printf(" <%llu:%" PRIu64, 1ULL << i, hist[i]);
+        }
+    }
+    printf("\n");
+}
+
+void gevent_base_stats_dump(struct gevent_base *eb)
+{
+    struct gevent_stats st;
+    if (0 != gevent_base_stats_get(eb, &st)) {
+        return;
+    }
+    printf("gevent_base %p: loops=%" PRIu64 " callbacks=%" PRIu64
+           " slow=%" PRIu64 " callback_max=%" PRIu64 "us loop_max=%" PRIu64 "us\n",
+           eb, st.loops, st.callbacks, st.slow_callbacks,
+           st.callback_max_us, st.loop_max_us);
+    hist_dump("  callback(us)", st.callback_hist);
+    hist_dump("  events/wakeup", st.events_hist);
+    hist_dump("  loop busy(us)", st.loop_hist);
+    if (st.spin_hits || st.spin_misses) {
+        printf("  busy poll: spin=%" PRIu64 "us blocked=%" PRIu64 "us"
+               " hits=%" PRIu64 " misses=%" PRIu64 "\n",
+               st.spin_ns / 1000, st.blocked_ns / 1000,
+               st.spin_hits, st.spin_misses);
+    }
+}
+
+#define BUSY_POLL_MIN_US    (8)
+
+int gevent_base_set_busy_poll(struct gevent_base *eb, uint32_t max_us)
+{
+    if (!eb) {
+        return -1;
+    }
+    if (max_us && max_us < BUSY_POLL_MIN_US) {
+        max_us = BUSY_POLL_MIN_US;
+    }
+    eb->busy_poll_max_us = max_us;
+    eb->busy_poll_us = max_us;
+    eb->busy_poll_last_us = 0;
+    eb->busy_polling = false;
+    return 0;
+}
+
+int gevent_base_set_sock_busy_poll(struct gevent_base *eb, int usec)
+{
+    if (!eb || usec < 0) {
+        return -1;
+    }
+#if defined (OS_LINUX) && defined (SO_BUSY_POLL)
+    eb->sock_busy_poll_us = usec;
+    return 0;
+#else
+    printf("SO_BUSY_POLL is not supported!\n");
+    return -1;
+#endif
+}
+
+static void sock_busy_poll_apply(struct gevent_base *eb, int fd)
+{
+#if defined (OS_LINUX) && defined (SO_BUSY_POLL)
+    int usec = eb->sock_busy_poll_us;
+    if (LIKELY(!usec) || fd < 0) {
+        return;
+    }
+    /* ENOTSOCK for pipe/eventfd/timerfd, best effort like other sockopts */
+    setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec));
+#else
+    (void)eb;
+    (void)fd;
+#endif
+}
+
+void gevent_base_set_tick(struct gevent_base *eb, void (*tick)(void))
+{
+    if (eb) {
+        eb->tick = tick;
+    }
+}
+
+static bool busy_poll_begin(struct gevent_base *eb)
+{
+    uint64_t now;
+    bool spin;
+    if (LIKELY(!eb->busy_poll_max_us)) {
+        return false;
+    }
+    now = gevent_now_us();
+    spin = (now - eb->busy_poll_last_us < eb->busy_poll_us);
+    if (!spin && eb->busy_polling) {
+        /* spin window passed without event, it was wasted, shrink */
+        eb->busy_poll_us = MAX2(eb->busy_poll_us / 2, BUSY_POLL_MIN_US);
+    }
+    eb->busy_polling = spin;
+    return spin;
+}
+
+static void busy_poll_end(struct gevent_base *eb, uint64_t start_ns)
+{
+    struct gevent_stats *st = eb->stats;
+    if (UNLIKELY(st != NULL)) {
+        if (eb->busy_polling) {
+            st->spin_ns += gevent_now_ns() - start_ns;
+            if (eb->round_hits) {
+                st->spin_hits++;
+            } else {
+                st->spin_misses++;
+            }
+        } else {
+            st->blocked_ns += gevent_now_ns() - start_ns;
+        }
+    }
+    if (LIKELY(!eb->busy_poll_max_us) || !eb->round_hits) {
+        return;
+    }
+    if (eb->busy_polling) {
+        /* event caught while spinning, spinning is worth it, grow */
+        eb->busy_poll_us = MIN2(eb->busy_poll_us * 2, eb->busy_poll_max_us);
+    }
+    eb->busy_poll_last_us = gevent_now_us();
+}
+
+static int gevent_base_dispatch(struct gevent_base *eb)
+{
+    int ret;
+    uint64_t start_ns = 0;
+    struct timeval tv, *ptv = NULL;
+    int timeout = gevent_timer_wheel_timeout(eb->wheel);
+    TRACE_SCOPE("gevent", "dispatch");
+    if (busy_poll_begin(eb)) {
+        tv.tv_sec = 0;
+        tv.tv_usec = 0;
+        ptv = &tv;
+    } else if (timeout >= 0) {
+        tv.tv_sec = timeout / 1000;
+        tv.tv_usec = (timeout % 1000) * 1000;
+        ptv = &tv;
+    }
+    eb->round_hits = 0;
+    if (eb->stats) {
+        start_ns = gevent_now_ns();
+    }
+    ret = eb->ops->dispatch(eb, ptv);
+    if (eb->tick && !eb->round_hits) {
+        eb->tick();             /* timers only round */
+    }
+    busy_poll_end(eb, start_ns);
+    gevent_timer_wheel_run(eb->wheel);
+    gevent_stats_round_end(eb);
+    return ret;
+}
+
 int gevent_base_wait(struct gevent_base *eb)
 {
-    const struct gevent_ops *ops = eb->ops;
-    return ops->dispatch(eb, NULL);
+    return gevent_base_dispatch(eb);
 }
 
 int gevent_base_loop(struct gevent_base *eb)
 {
-    const struct gevent_ops *ops = eb->ops;
     int ret;
     while (eb->loop) {
-        ret = ops->dispatch(eb, NULL);
+        ret = gevent_base_dispatch(eb);
         if (ret == -1) {
             printf("dispatch failed\n");
         }
@@ -197,19 +652,34 @@ int gevent_base_loop_stop(struct gevent_base *eb)
 
 void gevent_base_loop_break(struct gevent_base *eb)
 {
-    uint64_t notify = '1';
     eb->loop = 0;
-    if (sizeof(uint64_t) != write(eb->inner_fd, &notify, sizeof(uint64_t))) {
-        perror("write error");
-    }
+    inner_fd_notify(eb);
 }
 
 void gevent_base_signal(struct gevent_base *eb)
 {
-    uint64_t notify = '1';
-    if (sizeof(uint64_t) != write(eb->inner_fd, &notify, sizeof(uint64_t))) {
-        perror("write error");
+    inner_fd_notify(eb);
+}
+
+int gevent_base_post(struct gevent_base *eb, void (*func)(void *), void *arg)
+{
+    struct gevent_post *n;
+    if (!eb || !func) {
+        printf("%s:%d paraments is NULL\n", __func__, __LINE__);
+        return -1;
+    }
+    n = CALLOC(1, struct gevent_post);
+    if (!n) {
+        printf("malloc gevent_post failed!\n");
+        return -1;
+    }
+    n->func = func;
+    n->arg = arg;
+    post_push(eb, n);
+    if (0 == __atomic_exchange_n(&eb->post_pending, 1, __ATOMIC_SEQ_CST)) {
+        inner_fd_notify(eb);
     }
+    return 0;
 }
 
 struct gevent *gevent_create(int fd,
@@ -242,6 +712,7 @@ struct gevent *gevent_create(int fd,
     flags |= EVENT_PERSIST;
     e->evfd = fd;
     e->flags = flags;
+    INIT_LIST_HEAD(&e->entry);
 
     return e;
 }
@@ -251,7 +722,7 @@ void gevent_timer_destroy(struct gevent *e)
     if (!e) {
         return;
     }
-    if (e->evfd)
+    if (e->evfd > 0)
         close(e->evfd);
     if (e)
         free(e);
@@ -279,6 +750,7 @@ struct gevent *gevent_timer_create(time_t msec,
     e->evcb.ev_out = NULL;
     e->evcb.ev_err = NULL;
     e->evcb.args = args;
+    INIT_LIST_HEAD(&e->entry);
     flags = EVENT_READ;
     if (type == TIMER_PERSIST) {
         flags |= EVENT_PERSIST;
@@ -307,6 +779,22 @@ struct gevent *gevent_timer_create(time_t msec,
 
 failed:
     if (e) free(e);
+#elif defined (OS_APPLE)
+    struct gevent *e = (struct gevent *)calloc(1, sizeof(struct gevent));
+    if (!e) {
+        printf("malloc gevent failed!\n");
+        return NULL;
+    }
+    e->evcb.ev_timer = ev_timer;
+    e->evcb.args = args;
+    e->evcb.timer_msec = msec;
+    INIT_LIST_HEAD(&e->entry);
+    e->evfd = -1;
+    e->flags = EVENT_TIMEOUT;
+    if (type == TIMER_PERSIST) {
+        e->flags |= EVENT_PERSIST;
+    }
+    return e;
 #endif
     return NULL;
 }
@@ -318,35 +806,244 @@ void gevent_destroy(struct gevent *e)
     free(e);
 }
 
+static bool gevent_linked(struct gevent *e)
+{
+    /* entry may be zero if gevent is not alloced by gevent_create */
+    return e->entry.next && !list_empty(&e->entry);
+}
+
 int gevent_add(struct gevent_base *eb, struct gevent **e)
 {
-    if (!e || !eb) {
+    bool linked;
+    if (!e || !*e || !eb) {
         printf("%s:%d paraments is NULL\n", __func__, __LINE__);
         return -1;
     }
-    da_push_back(eb->ev_array, e);
-    return eb->ops->add(eb, *e);
+    linked = gevent_linked(*e);
+    if (!linked) {
+        list_add_tail(&(*e)->entry, &eb->ev_list);
+        /* read by gevent_base_group_pick from other threads */
+        __atomic_add_fetch(&eb->ev_num, 1, __ATOMIC_RELAXED);
+    }
+    if (!linked) {
+        sock_busy_poll_apply(eb, (*e)->evfd);
+    }
+    if (-1 == eb->ops->add(eb, *e)) {
+        /* callers destroy the event on failure, it must not stay listed */
+        if (!linked) {
+            list_del_init(&(*e)->entry);
+            __atomic_sub_fetch(&eb->ev_num, 1, __ATOMIC_RELAXED);
+        }
+        return -1;
+    }
+    return 0;
 }
 
 int gevent_del(struct gevent_base *eb, struct gevent **e)
 {
     int ret;
-    if (!e || !eb) {
+    if (!e || !*e || !eb) {
         printf("%s:%d paraments is NULL\n", __func__, __LINE__);
         return -1;
     }
     ret = eb->ops->del(eb, *e);
-    da_erase_item(eb->ev_array, e);
+    if (gevent_linked(*e)) {
+        list_del_init(&(*e)->entry);
+        __atomic_sub_fetch(&eb->ev_num, 1, __ATOMIC_RELAXED);
+    }
     return ret;
 }
 
 int gevent_mod(struct gevent_base *eb, struct gevent **e)
 {
-    if (!e || !eb) {
+    if (!e || !*e || !eb) {
         printf("%s:%d paraments is NULL\n", __func__, __LINE__);
         return -1;
     }
-    da_erase_item(eb->ev_array, e);
-    da_push_back(eb->ev_array, e);
     return eb->ops->mod(eb, *e);
 }
+
+size_t gevent_base_event_count(struct gevent_base *eb)
+{
+    if (!eb) {
+        return 0;
+    }
+    return __atomic_load_n(&eb->ev_num, __ATOMIC_RELAXED);
+}
+
+struct gevent_base_group *gevent_base_group_create(int nbase,
+        enum gevent_group_policy policy)
+{
+    int i;
+    struct gevent_base_group *g;
+
+    if (nbase <= 0) {
+        nbase = sysconf(_SC_NPROCESSORS_ONLN);
+        if (nbase <= 0) {
+            nbase = 1;
+        }
+    }
+    g = CALLOC(1, struct gevent_base_group);
+    if (!g) {
+        printf("malloc gevent_base_group failed!\n");
+        return NULL;
+    }
+    g->bases = CALLOC(nbase, struct gevent_base *);
+    if (!g->bases) {
+        printf("malloc gevent_base array failed!\n");
+        goto failed;
+    }
+    for (i = 0; i < nbase; i++) {
+        g->bases[i] = gevent_base_create();
+        if (!g->bases[i]) {
+            printf("gevent_base_create %d failed!\n", i);
+            goto failed;
+        }
+        g->nbase++;
+    }
+    g->policy = policy;
+    g->next = 0;
+    return g;
+
+failed:
+    gevent_base_group_destroy(g);
+    return NULL;
+}
+
+void gevent_base_group_destroy(struct gevent_base_group *g)
+{
+    int i;
+    if (!g) {
+        return;
+    }
+    if (g->bases) {
+        for (i = 0; i < g->nbase; i++) {
+            gevent_base_destroy(g->bases[i]);
+        }
+        free(g->bases);
+    }
+    free(g);
+}
+
+int gevent_base_group_loop_start(struct gevent_base_group *g, bool affinity)
+{
+    int i;
+    if (!g) {
+        return -1;
+    }
+    g->affinity = affinity;
+    for (i = 0; i < g->nbase; i++) {
+        struct gevent_base *eb = g->bases[i];
+        if (0 != gevent_base_loop_start(eb) || !eb->thread) {
+            printf("gevent_base_loop_start %d failed!\n", i);
+            return -1;
+        }
+#if defined (OS_LINUX) && !defined (__CYGWIN__) && !defined (ENV_MINGW)
+        if (affinity) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(i % sysconf(_SC_NPROCESSORS_ONLN), &set);
+            if (0 != pthread_setaffinity_np(eb->thread->tid, sizeof(set), &set)) {
+                printf("pthread_setaffinity_np cpu %d failed\n", i);
+            }
+        }
+#endif
+    }
+    return 0;
+}
+
+int gevent_base_group_loop_stop(struct gevent_base_group *g)
+{
+    int i;
+    if (!g) {
+        return -1;
+    }
+    for (i = 0; i < g->nbase; i++) {
+        if (g->bases[i]->thread) {
+            gevent_base_loop_stop(g->bases[i]);
+            g->bases[i]->thread = NULL;
+        }
+    }
+    return 0;
+}
+
+struct gevent_base *gevent_base_group_pick(struct gevent_base_group *g, int fd)
+{
+    int i, idx = 0;
+    uint32_t h;
+    size_t load;
+
+    if (!g || g->nbase == 0) {
+        return NULL;
+    }
+    switch (g->policy) {
+    case GEVENT_GROUP_LEAST_LOADED:
+        load = gevent_base_event_count(g->bases[0]);
+        for (i = 1; i < g->nbase; i++) {
+            if (gevent_base_event_count(g->bases[i]) < load) {
+                load = gevent_base_event_count(g->bases[i]);
+                idx = i;
+            }
+        }
+        break;
+    case GEVENT_GROUP_HASH:
+        /* fd is usually allocated sequentially, scramble it first */
+        h = (uint32_t)fd * 2654435761u;
+        idx = (h >> 16) % g->nbase;
+        break;
+    case GEVENT_GROUP_ROUND_ROBIN:
+    default:
+        /* pick may run in several acceptor threads */
+        idx = __atomic_fetch_add(&g->next, 1, __ATOMIC_RELAXED) % g->nbase;
+        break;
+    }
+    return g->bases[idx];
+}
+
+struct group_add_arg {
+    struct gevent_base *eb;
+    struct gevent *e;
+};
+
+static void group_add_post(void *arg)
+{
+    struct group_add_arg *a = (struct group_add_arg *)arg;
+    if (0 != gevent_add(a->eb, &a->e)) {
+        printf("gevent_add of fd %d posted by group failed!\n", a->e->evfd);
+    }
+    free(a);
+}
+
+struct gevent_base *gevent_base_group_add(struct gevent_base_group *g,
+        struct gevent **e)
+{
+    struct gevent_base *eb;
+    struct group_add_arg *a;
+    if (!g || !e || !*e) {
+        printf("%s:%d paraments is NULL\n", __func__, __LINE__);
+        return NULL;
+    }
+    eb = gevent_base_group_pick(g, (*e)->evfd);
+    if (!eb) {
+        return NULL;
+    }
+    /* ev_list and backend of a running base belong to its loop thread */
+    if (eb->thread && !pthread_equal(eb->thread->tid, pthread_self())) {
+        a = CALLOC(1, struct group_add_arg);
+        if (!a) {
+            return NULL;
+        }
+        a->eb = eb;
+        a->e = *e;
+        if (0 != gevent_base_post(eb, group_add_post, a)) {
+            free(a);
+            return NULL;
+        }
+        return eb;
+    }
+    if (0 != gevent_add(eb, e)) {
+        return NULL;
+    }
+    gevent_base_signal(eb);
+    return eb;
+}
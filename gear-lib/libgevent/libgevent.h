@@ -29,6 +29,11 @@
 
 #if defined (OS_LINUX)
 #include <sys/timerfd.h>
+#if defined (__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define GEVENT_HAVE_IO_URING
+#endif
+#endif
 #endif
 
 #ifdef __cplusplus
@@ -57,6 +62,8 @@ struct gevent_cbs {
     void (*ev_timer)(int fd, void *arg);
 #if defined (OS_LINUX)
     struct itimerspec itimer;
+#else
+    time_t timer_msec;              /* EVFILT_TIMER period, no timerfd */
 #endif
     void *args;
 };
@@ -65,9 +72,64 @@ struct gevent {
     int evfd;
     enum gevent_flags flags;
     struct gevent_cbs evcb;
+    struct list_head entry;         /* linked in gevent_base ev_list */
+    void *backend;                  /* backend private, io_uring poll token */
+};
+
+enum gevent_backend_type {
+    GEVENT_SELECT = 0,
+    GEVENT_POLL,
+    GEVENT_EPOLL,
+    GEVENT_IOCP,
+    GEVENT_IO_URING,
+    GEVENT_KQUEUE,
 };
 
 struct gevent_base;
+struct gevent_timer_wheel;
+struct gevent_signal_ctx;
+
+/*
+ * optional instrumentation of gevent_base, histogram bucket i counts
+ * values in [2^(i-1), 2^i), unit of duration is usec
+ */
+#define GEVENT_HIST_BUCKETS 20
+
+typedef void (*gevent_slow_hook)(struct gevent_base *eb, int fd,
+                void (*cb)(int, void *), uint64_t usec, void *arg);
+
+struct gevent_stats {
+    uint64_t loops;                 /* dispatch rounds */
+    uint64_t callbacks;             /* fd callbacks invoked */
+    uint64_t slow_callbacks;        /* callbacks over slow threshold */
+    uint64_t callback_max_us;
+    uint64_t loop_max_us;
+    uint64_t callback_us;           /* total callback duration */
+    uint64_t busy_us;               /* total busy time of rounds */
+    uint64_t callback_hist[GEVENT_HIST_BUCKETS];  /* callback duration */
+    uint64_t events_hist[GEVENT_HIST_BUCKETS];    /* callbacks per wakeup */
+    uint64_t loop_hist[GEVENT_HIST_BUCKETS];      /* busy time per round */
+    uint64_t spin_ns;               /* time in nonblocking busy poll dispatch */
+    uint64_t blocked_ns;            /* time in blocking dispatch */
+    uint64_t spin_hits;             /* busy poll rounds which caught events */
+    uint64_t spin_misses;           /* busy poll rounds which came back empty */
+    /* private */
+    uint64_t slow_threshold_us;
+    gevent_slow_hook slow_hook;
+    void *slow_arg;
+    uint64_t round_events;
+    uint64_t round_start_us;
+};
+
+/*
+ * node of lock-free MPSC queue for gevent_base_post
+ */
+struct gevent_post {
+    struct gevent_post *next;
+    void (*func)(void *arg);
+    void *arg;
+};
+
 struct gevent_ops {
     void *(*init)();
     void (*deinit)(void *ctx);
@@ -81,13 +143,30 @@ struct gevent_base {
     void *ctx;
     int loop;
     int inner_fd;
-    DARRAY(struct gevent *) ev_array; /* just for save and free event */
+    int inner_wfd;                  /* write end, same as inner_fd if eventfd */
+    struct list_head ev_list;       /* just for save and free event */
+    size_t ev_num;                  /* count of events added */
     struct thread *thread;
     const struct gevent_ops *ops;
     struct gevent *inner_event;     /* in case of no event added to run */
+    struct gevent_timer_wheel *wheel; /* software timers, drive by dispatch timeout */
+    struct gevent_post post_stub;
+    struct gevent_post *post_head;  /* consumer side, only touched by loop */
+    struct gevent_post *post_tail;  /* producer side, atomic exchange */
+    int post_pending;               /* inner_fd already written, coalesce wakeup */
+    struct gevent_stats *stats;     /* NULL if instrumentation disabled */
+    uint64_t round_hits;            /* callbacks invoked in this dispatch */
+    uint32_t busy_poll_max_us;      /* 0: busy poll disabled */
+    uint32_t busy_poll_us;          /* adaptive spin window */
+    uint64_t busy_poll_last_us;     /* last time any event was handled */
+    bool busy_polling;              /* last dispatch was nonblocking */
+    int sock_busy_poll_us;          /* SO_BUSY_POLL for added fds, 0: off */
+    struct gevent_signal_ctx *sig;  /* signalfd or pipe, created on first signal add */
+    void (*tick)(void);             /* called once per wakeup before callbacks */
 };
 
 GEAR_API struct gevent_base *gevent_base_create();
+GEAR_API struct gevent_base *gevent_base_create_by(enum gevent_backend_type type);
 GEAR_API void gevent_base_destroy(struct gevent_base *);
 GEAR_API int gevent_base_loop(struct gevent_base *);
 GEAR_API int gevent_base_loop_start(struct gevent_base *eb);
@@ -95,6 +174,48 @@ GEAR_API int gevent_base_loop_stop(struct gevent_base *eb);
 GEAR_API void gevent_base_loop_break(struct gevent_base *);
 GEAR_API int gevent_base_wait(struct gevent_base *eb);
 GEAR_API void gevent_base_signal(struct gevent_base *eb);
+GEAR_API size_t gevent_base_event_count(struct gevent_base *eb);
+/*
+ * busy poll: after handling events, loop polls backend without blocking
+ * for up to max_us before sleeping again, trade cpu for wakeup latency.
+ * spin window grows if events arrive while spinning and shrinks if it
+ * expires idle. max_us = 0 disable it, must be called in loop thread
+ * or before loop start
+ */
+GEAR_API int gevent_base_set_busy_poll(struct gevent_base *eb, uint32_t max_us);
+/*
+ * opt-in SO_BUSY_POLL, applied to socket fds on gevent_add afterwards,
+ * driver polls the device queue for up to usec on a blocking read.
+ * linux only, needs CAP_NET_ADMIN to raise it over net.core.busy_read
+ */
+GEAR_API int gevent_base_set_sock_busy_poll(struct gevent_base *eb, int usec);
+/*
+ * tick is run once per loop wakeup, before the first callback of the round,
+ * e.g. time_coarse_update to give callbacks a cached clock
+ */
+GEAR_API void gevent_base_set_tick(struct gevent_base *eb, void (*tick)(void));
+
+/*
+ * instrumentation, disabled by default, stats_get copies a snapshot
+ * slow hook is called in loop thread when callback runs over threshold_us
+ */
+GEAR_API int gevent_base_stats_enable(struct gevent_base *eb, bool enable);
+GEAR_API int gevent_base_stats_get(struct gevent_base *eb, struct gevent_stats *stats);
+GEAR_API void gevent_base_stats_reset(struct gevent_base *eb);
+GEAR_API void gevent_base_stats_dump(struct gevent_base *eb);
+GEAR_API int gevent_base_set_slow_hook(struct gevent_base *eb, uint64_t threshold_us,
+                gevent_slow_hook hook, void *arg);
+/*
+ * used by backends to call event callback with instrumentation
+ */
+GEAR_API void gevent_base_invoke(struct gevent_base *eb, void (*cb)(int, void *),
+                int fd, void *arg);
+/*
+ * post func to be called in loop thread of eb, safe to call from any thread,
+ * wakeups are coalesced, one eventfd write for a batch of posts.
+ * posts not run yet are dropped in gevent_base_destroy
+ */
+GEAR_API int gevent_base_post(struct gevent_base *eb, void (*func)(void *), void *arg);
 
 GEAR_API struct gevent *gevent_create(int fd,
                 void (ev_in)(int, void *),
@@ -105,7 +226,7 @@ GEAR_API struct gevent *gevent_create(int fd,
 GEAR_API void gevent_destroy(struct gevent *e);
 
 /*
- * gevent_add is to save alloced gevent memory to ev_array
+ * gevent_add is to save alloced gevent memory to ev_list, add/del/mod are O(1)
  * if gevent_del is called, gevent memory should be free by user
  * otherwise gevent memory will be freed in gevent_base_destroy automatically
  * add2/del2 will replace add/del API later
@@ -119,12 +240,170 @@ enum gevent_timer_type {
     TIMER_PERSIST,
 };
 
+/*
+ * timerfd on linux, EVFILT_TIMER on macos (evfd is -1, only the kqueue
+ * backend can run it). callback fd is evfd, read it only if it's valid
+ */
 GEAR_API struct gevent *gevent_timer_create(time_t msec,
                 enum gevent_timer_type type,
                 void (ev_timer)(int, void *),
                 void *args);
 GEAR_API void gevent_timer_destroy(struct gevent *e);
 
+/*
+ * gevent_wtimer is software timer in timing wheel of gevent_base,
+ * no fd and no syscall per timer, add/del are O(1).
+ * timer memory is owned by user, callback is called in loop thread.
+ * persist timer is re-armed after callback unless callback deleted or
+ * re-added it. oneshot timer may be freed in its callback, persist one
+ * must be deleted before free, also from other threads.
+ */
+struct gevent_wtimer {
+    struct list_head entry;
+    uint64_t expires;
+    time_t interval;
+    enum gevent_timer_type type;
+    void (*cb)(struct gevent_wtimer *t, void *arg);
+    void *arg;
+};
+
+GEAR_API void gevent_wtimer_init(struct gevent_wtimer *t,
+                void (*cb)(struct gevent_wtimer *, void *), void *arg);
+GEAR_API int gevent_wtimer_add(struct gevent_base *eb, struct gevent_wtimer *t,
+                time_t msec, enum gevent_timer_type type);
+GEAR_API int gevent_wtimer_del(struct gevent_base *eb, struct gevent_wtimer *t);
+GEAR_API bool gevent_wtimer_pending(struct gevent_wtimer *t);
+
+/*
+ * signal event, handled by signalfd in loop thread instead of async handler,
+ * so cb can call any function. the signal is blocked in calling thread,
+ * call it in main thread before creating other threads, so that they all
+ * inherit the blocked mask, otherwise the signal may be delivered to them.
+ * only process directed signal (kill) is seen, not raise/pthread_kill
+ * to another thread.
+ * without signalfd (macos/bsd), sigaction handler writes signo to a pipe
+ * polled by loop, signal is not blocked and a signal belongs to one base
+ */
+GEAR_API int gevent_signal_add(struct gevent_base *eb, int signo,
+                void (*cb)(int signo, void *arg), void *arg);
+GEAR_API int gevent_signal_del(struct gevent_base *eb, int signo);
+
+/*
+ * read fd until EAGAIN, which is required by edge triggered events.
+ * cb is called for each chunk read into buf, closed is set on EOF or error
+ * return total bytes read
+ */
+GEAR_API ssize_t gevent_read_drain(int fd, void *buf, size_t len,
+                void (*cb)(int fd, void *buf, size_t len, void *arg), void *arg,
+                bool *closed);
+
+/*
+ * gevent_conn is buffered connection on gevent_base:
+ * input is drained into read buffer and on_read is called, data can be
+ * peeked and consumed partially; output is written directly if possible,
+ * the rest is buffered and flushed when fd is writable.
+ * gevent_conn takes ownership of fd, it's closed in gevent_conn_destroy,
+ * which is safe to be called in its own callbacks.
+ */
+struct gevent_conn;
+struct gevent_conn_cbs {
+    void (*on_read)(struct gevent_conn *c, void *arg);
+    void (*on_drain)(struct gevent_conn *c, void *arg);     /* output flushed */
+    void (*on_close)(struct gevent_conn *c, int err, void *arg);
+    /* pending output rose above high watermark, called inside write */
+    void (*on_high)(struct gevent_conn *c, size_t pending, void *arg);
+    /* pending output fell to low watermark after on_high */
+    void (*on_low)(struct gevent_conn *c, size_t pending, void *arg);
+};
+
+GEAR_API struct gevent_conn *gevent_conn_create(struct gevent_base *eb, int fd,
+                const struct gevent_conn_cbs *cbs, void *arg);
+GEAR_API void gevent_conn_destroy(struct gevent_conn *c);
+GEAR_API int gevent_conn_fd(struct gevent_conn *c);
+GEAR_API void *gevent_conn_peek(struct gevent_conn *c, size_t *len);
+GEAR_API void gevent_conn_consume(struct gevent_conn *c, size_t len);
+GEAR_API ssize_t gevent_conn_read(struct gevent_conn *c, void *buf, size_t len);
+GEAR_API int gevent_conn_write(struct gevent_conn *c, const void *buf, size_t len);
+/*
+ * gather write, buffered output and the pieces go in one sendmsg, only
+ * what the socket doesn't take is copied to the output buffer
+ */
+GEAR_API int gevent_conn_writev(struct gevent_conn *c, const struct iovec *iov, int cnt);
+/*
+ * output watermarks, high = 0 disables them. on_high is called once when
+ * pending output goes above high, on_low when it is back to low or less,
+ * so producer can pause and resume instead of growing the buffer
+ */
+GEAR_API int gevent_conn_set_watermark(struct gevent_conn *c, size_t high, size_t low);
+/*
+ * queue len bytes of file fd from offset after the buffered output, sent
+ * with sendfile, no copy to user space. conn takes ownership of fd, closes
+ * it when sent or on destroy. one file at a time, write and sendfile fail
+ * until it's sent, on_drain tells when
+ */
+GEAR_API int gevent_conn_sendfile(struct gevent_conn *c, int fd, off_t offset, size_t len);
+GEAR_API size_t gevent_conn_pending(struct gevent_conn *c);
+
+/*
+ * completion style APIs, only for GEVENT_IO_URING backend
+ * request is batched and submitted in next dispatch, cb is called in loop
+ * thread with res as return value of recv/send/accept or -errno.
+ * recv_select use kernel provided buffer of group bgid, the buffer should
+ * be given back by gevent_uring_return_buffer after used.
+ */
+typedef void (*gevent_uring_cb)(int fd, int res, void *buf, void *arg);
+GEAR_API int gevent_uring_recv(struct gevent_base *eb, int fd, void *buf, size_t len,
+                gevent_uring_cb cb, void *arg);
+GEAR_API int gevent_uring_recv_select(struct gevent_base *eb, int fd, int bgid,
+                gevent_uring_cb cb, void *arg);
+GEAR_API int gevent_uring_send(struct gevent_base *eb, int fd, const void *buf, size_t len,
+                gevent_uring_cb cb, void *arg);
+GEAR_API int gevent_uring_accept(struct gevent_base *eb, int fd,
+                gevent_uring_cb cb, void *arg);
+GEAR_API int gevent_uring_provide_buffers(struct gevent_base *eb, int bgid,
+                void *base, int len, int nr);
+GEAR_API int gevent_uring_return_buffer(struct gevent_base *eb, int bgid, void *buf);
+
+/*
+ * gevent_base_group is multi-reactor mode, one gevent_base per thread,
+ * new fd is assigned to one member base by policy, and stays there.
+ */
+enum gevent_group_policy {
+    GEVENT_GROUP_ROUND_ROBIN = 0,
+    GEVENT_GROUP_LEAST_LOADED,
+    GEVENT_GROUP_HASH,
+};
+
+struct gevent_base_group {
+    int nbase;
+    unsigned int next;              /* round robin counter, atomic */
+    bool affinity;
+    enum gevent_group_policy policy;
+    struct gevent_base **bases;
+};
+
+/*
+ * nbase <= 0 means one gevent_base per online cpu core
+ */
+GEAR_API struct gevent_base_group *gevent_base_group_create(int nbase,
+                enum gevent_group_policy policy);
+GEAR_API void gevent_base_group_destroy(struct gevent_base_group *g);
+/*
+ * start one thread loop per member base, bind thread N to cpu N if affinity
+ */
+GEAR_API int gevent_base_group_loop_start(struct gevent_base_group *g, bool affinity);
+GEAR_API int gevent_base_group_loop_stop(struct gevent_base_group *g);
+GEAR_API struct gevent_base *gevent_base_group_pick(struct gevent_base_group *g, int fd);
+/*
+ * add event to the base picked by policy, return the picked base,
+ * caller should use the returned base for gevent_del/gevent_mod later.
+ * safe from any thread: if the loop of the base runs in another thread,
+ * the add is posted to it and done there, a failed posted add is only
+ * printed, the event is left unlinked
+ */
+GEAR_API struct gevent_base *gevent_base_group_add(struct gevent_base_group *g,
+                struct gevent **e);
+
 #ifdef __cplusplus
 }
 #endif
@@ -127,19 +127,18 @@ static int poll_dispatch(struct gevent_base *eb, struct timeval *tv)
         return -1;
     }
     if (0 == n) {
-        printf("poll timeout\n");
         return 0;
     }
     for (i = 0; i < c->ev_list.num; i++) {
         struct gevent *e = &c->ev_list.array[i];
         if ((c->fds[i].revents & POLLIN) && e->evcb.ev_in) {
-            e->evcb.ev_in(e->evfd, e->evcb.args);
+            gevent_base_invoke(eb, e->evcb.ev_in, e->evfd, e->evcb.args);
         }
         if ((c->fds[i].revents & POLLOUT) && e->evcb.ev_out) {
-            e->evcb.ev_out(e->evfd, e->evcb.args);
+            gevent_base_invoke(eb, e->evcb.ev_out, e->evfd, e->evcb.args);
         }
         if ((c->fds[i].revents & (POLLERR|POLLHUP|POLLNVAL)) && e->evcb.ev_err) {
-            e->evcb.ev_err(e->evfd, e->evcb.args);
+            gevent_base_invoke(eb, e->evcb.ev_err, e->evfd, e->evcb.args);
         }
         c->fds[i].revents = 0;
     }
@@ -104,19 +104,18 @@ static int select_dispatch(struct gevent_base *eb, struct timeval *tv)
         return -1;
     }
     if (0 == n) {
-        printf("select timeout\n");
         return 0;
     }
     for (i = 0; i < c->ev_list.num; i++) {
         struct gevent *e = &c->ev_list.array[i];
         if (FD_ISSET(e->evfd, &c->rfds) && e->evcb.ev_in) {
-            e->evcb.ev_in(e->evfd, e->evcb.args);
+            gevent_base_invoke(eb, e->evcb.ev_in, e->evfd, e->evcb.args);
         }
         if (FD_ISSET(e->evfd, &c->wfds) && e->evcb.ev_out) {
-            e->evcb.ev_out(e->evfd, e->evcb.args);
+            gevent_base_invoke(eb, e->evcb.ev_out, e->evfd, e->evcb.args);
         }
         if (FD_ISSET(e->evfd, &c->efds) && e->evcb.ev_err) {
-            e->evcb.ev_err(e->evfd, e->evcb.args);
+            gevent_base_invoke(eb, e->evcb.ev_err, e->evfd, e->evcb.args);
         }
     }
     return 0;
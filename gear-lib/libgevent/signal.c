@@ -0,0 +1,403 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#include "libgevent.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#if defined (OS_LINUX)
+#include <sys/signalfd.h>
+#endif
+
+#if defined (OS_LINUX)
+
+#define GEVENT_NSIG         (65)
+
+struct gevent_sig_handler {
+    void (*cb)(int signo, void *arg);
+    void *arg;
+};
+
+/*
+ * all signals of a base share one signalfd, the mask is updated in place
+ * by calling signalfd() again with the same fd
+ */
+struct gevent_signal_ctx {
+    int sfd;
+    int nsig;                       /* handlers installed */
+    sigset_t mask;
+    struct gevent *ev;
+    struct gevent_base *eb;
+    struct gevent_sig_handler handlers[GEVENT_NSIG];
+};
+
+static void signal_on_in(int fd, void *arg)
+{
+    int i, n;
+    struct signalfd_siginfo info[16];
+    struct gevent_signal_ctx *c = (struct gevent_signal_ctx *)arg;
+    struct gevent_sig_handler *h;
+
+    /* edge triggered, drain all pending signals */
+    while (1) {
+        n = read(fd, info, sizeof(info));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < (int)sizeof(struct signalfd_siginfo)) {
+            break;
+        }
+        for (i = 0; i < n / (int)sizeof(struct signalfd_siginfo); i++) {
+            if (info[i].ssi_signo >= GEVENT_NSIG) {
+                continue;
+            }
+            h = &c->handlers[info[i].ssi_signo];
+            if (h->cb) {
+                gevent_base_invoke(c->eb, h->cb, info[i].ssi_signo, h->arg);
+            }
+        }
+    }
+}
+
+static struct gevent_signal_ctx *signal_ctx_create(struct gevent_base *eb)
+{
+    struct gevent_signal_ctx *c = CALLOC(1, struct gevent_signal_ctx);
+    if (!c) {
+        printf("malloc gevent_signal_ctx failed!\n");
+        return NULL;
+    }
+    sigemptyset(&c->mask);
+    c->sfd = signalfd(-1, &c->mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (c->sfd == -1) {
+        printf("signalfd failed %d: %s\n", errno, strerror(errno));
+        free(c);
+        return NULL;
+    }
+    c->eb = eb;
+    c->ev = gevent_create(c->sfd, signal_on_in, NULL, NULL, c);
+    if (!c->ev) {
+        close(c->sfd);
+        free(c);
+        return NULL;
+    }
+    if (0 != gevent_add(eb, &c->ev)) {
+        gevent_destroy(c->ev);
+        close(c->sfd);
+        free(c);
+        return NULL;
+    }
+    return c;
+}
+
+void gevent_signal_ctx_destroy(struct gevent_signal_ctx *c)
+{
+    if (!c) {
+        return;
+    }
+    gevent_del(c->eb, &c->ev);
+    gevent_destroy(c->ev);
+    close(c->sfd);
+    /* leave signals blocked, unblocking may deliver default action */
+    free(c);
+}
+
+int gevent_signal_add(struct gevent_base *eb, int signo,
+        void (*cb)(int signo, void *arg), void *arg)
+{
+    sigset_t set;
+    struct gevent_signal_ctx *c;
+
+    if (!eb || !cb || signo <= 0 || signo >= GEVENT_NSIG ||
+        signo == SIGKILL || signo == SIGSTOP) {
+        printf("%s:%d paraments is invalid\n", __func__, __LINE__);
+        return -1;
+    }
+    if (!eb->sig) {
+        eb->sig = signal_ctx_create(eb);
+        if (!eb->sig) {
+            return -1;
+        }
+    }
+    c = eb->sig;
+    if (!c->handlers[signo].cb) {
+        sigemptyset(&set);
+        sigaddset(&set, signo);
+        /* signalfd only sees blocked signals */
+        pthread_sigmask(SIG_BLOCK, &set, NULL);
+        sigaddset(&c->mask, signo);
+        if (-1 == signalfd(c->sfd, &c->mask, SFD_NONBLOCK | SFD_CLOEXEC)) {
+            printf("signalfd update failed %d: %s\n", errno, strerror(errno));
+            sigdelset(&c->mask, signo);
+            return -1;
+        }
+        c->nsig++;
+    }
+    c->handlers[signo].cb = cb;
+    c->handlers[signo].arg = arg;
+    return 0;
+}
+
+int gevent_signal_del(struct gevent_base *eb, int signo)
+{
+    sigset_t set;
+    struct gevent_signal_ctx *c;
+
+    if (!eb || signo <= 0 || signo >= GEVENT_NSIG) {
+        printf("%s:%d paraments is invalid\n", __func__, __LINE__);
+        return -1;
+    }
+    c = eb->sig;
+    if (!c || !c->handlers[signo].cb) {
+        return -1;
+    }
+    sigdelset(&c->mask, signo);
+    signalfd(c->sfd, &c->mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    c->handlers[signo].cb = NULL;
+    c->handlers[signo].arg = NULL;
+    c->nsig--;
+    sigemptyset(&set);
+    sigaddset(&set, signo);
+    pthread_sigmask(SIG_UNBLOCK, &set, NULL);
+    /* keep ctx even if nsig is 0, del may be called in signal callback */
+    return 0;
+}
+
+#elif !defined (OS_WINDOWS)
+
+/*
+ * no signalfd, fallback to sigaction + self-pipe: handler writes signo into
+ * the pipe of the base which owns the signal, loop reads it and calls cb
+ */
+#include <fcntl.h>
+
+#define GEVENT_NSIG         (65)
+
+struct gevent_sig_handler {
+    void (*cb)(int signo, void *arg);
+    void *arg;
+    struct sigaction old;           /* restored on del */
+};
+
+struct gevent_signal_ctx {
+    int rfd;
+    int wfd;
+    int nsig;
+    struct gevent *ev;
+    struct gevent_base *eb;
+    struct gevent_sig_handler handlers[GEVENT_NSIG];
+};
+
+/* write end of owner pipe per signal, read by async handler */
+static volatile int sig_pipe_wfd[GEVENT_NSIG];
+
+static void signal_handler(int signo)
+{
+    int saved = errno;
+    unsigned char b = (unsigned char)signo;
+    int wfd = sig_pipe_wfd[signo];
+    if (wfd > 0) {
+        /* pipe full means wakeup pending already, drop is fine */
+        write(wfd, &b, 1);
+    }
+    errno = saved;
+}
+
+static void signal_on_in(int fd, void *arg)
+{
+    int i, n;
+    unsigned char buf[64];
+    struct gevent_signal_ctx *c = (struct gevent_signal_ctx *)arg;
+    struct gevent_sig_handler *h;
+
+    while (1) {
+        n = read(fd, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        for (i = 0; i < n; i++) {
+            if (buf[i] >= GEVENT_NSIG) {
+                continue;
+            }
+            h = &c->handlers[buf[i]];
+            if (h->cb) {
+                gevent_base_invoke(c->eb, h->cb, buf[i], h->arg);
+            }
+        }
+    }
+}
+
+static int pipe_nonblock(int fds[2])
+{
+    int i;
+    if (-1 == pipe(fds)) {
+        printf("pipe failed %d: %s\n", errno, strerror(errno));
+        return -1;
+    }
+    for (i = 0; i < 2; i++) {
+        fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+        fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+    }
+    return 0;
+}
+
+static struct gevent_signal_ctx *signal_ctx_create(struct gevent_base *eb)
+{
+    int fds[2];
+    struct gevent_signal_ctx *c = CALLOC(1, struct gevent_signal_ctx);
+    if (!c) {
+        printf("malloc gevent_signal_ctx failed!\n");
+        return NULL;
+    }
+    if (-1 == pipe_nonblock(fds)) {
+        free(c);
+        return NULL;
+    }
+    c->rfd = fds[0];
+    c->wfd = fds[1];
+    c->eb = eb;
+    c->ev = gevent_create(c->rfd, signal_on_in, NULL, NULL, c);
+    if (!c->ev) {
+        goto failed;
+    }
+    if (0 != gevent_add(eb, &c->ev)) {
+        gevent_destroy(c->ev);
+        goto failed;
+    }
+    return c;
+
+failed:
+    close(c->rfd);
+    close(c->wfd);
+    free(c);
+    return NULL;
+}
+
+static void signal_restore(struct gevent_signal_ctx *c, int signo)
+{
+    sigaction(signo, &c->handlers[signo].old, NULL);
+    sig_pipe_wfd[signo] = 0;
+    c->handlers[signo].cb = NULL;
+    c->handlers[signo].arg = NULL;
+    c->nsig--;
+}
+
+void gevent_signal_ctx_destroy(struct gevent_signal_ctx *c)
+{
+    int i;
+    if (!c) {
+        return;
+    }
+    /* handler must not write into the pipe after it's closed */
+    for (i = 1; i < GEVENT_NSIG && c->nsig > 0; i++) {
+        if (c->handlers[i].cb) {
+            signal_restore(c, i);
+        }
+    }
+    gevent_del(c->eb, &c->ev);
+    gevent_destroy(c->ev);
+    close(c->rfd);
+    close(c->wfd);
+    free(c);
+}
+
+int gevent_signal_add(struct gevent_base *eb, int signo,
+        void (*cb)(int signo, void *arg), void *arg)
+{
+    struct sigaction sa;
+    struct gevent_signal_ctx *c;
+
+    if (!eb || !cb || signo <= 0 || signo >= GEVENT_NSIG ||
+        signo == SIGKILL || signo == SIGSTOP) {
+        printf("%s:%d paraments is invalid\n", __func__, __LINE__);
+        return -1;
+    }
+    if (!eb->sig) {
+        eb->sig = signal_ctx_create(eb);
+        if (!eb->sig) {
+            return -1;
+        }
+    }
+    c = eb->sig;
+    if (!c->handlers[signo].cb) {
+        if (sig_pipe_wfd[signo] > 0) {
+            printf("signal %d is owned by another gevent_base!\n", signo);
+            return -1;
+        }
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = signal_handler;
+        sa.sa_flags = SA_RESTART;
+        sigemptyset(&sa.sa_mask);
+        sig_pipe_wfd[signo] = c->wfd;
+        if (-1 == sigaction(signo, &sa, &c->handlers[signo].old)) {
+            printf("sigaction failed %d: %s\n", errno, strerror(errno));
+            sig_pipe_wfd[signo] = 0;
+            return -1;
+        }
+        c->nsig++;
+    }
+    c->handlers[signo].cb = cb;
+    c->handlers[signo].arg = arg;
+    return 0;
+}
+
+int gevent_signal_del(struct gevent_base *eb, int signo)
+{
+    struct gevent_signal_ctx *c;
+
+    if (!eb || signo <= 0 || signo >= GEVENT_NSIG) {
+        printf("%s:%d paraments is invalid\n", __func__, __LINE__);
+        return -1;
+    }
+    c = eb->sig;
+    if (!c || !c->handlers[signo].cb) {
+        return -1;
+    }
+    signal_restore(c, signo);
+    /* keep ctx even if nsig is 0, del may be called in signal callback */
+    return 0;
+}
+
+#else
+
+void gevent_signal_ctx_destroy(struct gevent_signal_ctx *c)
+{
+}
+
+int gevent_signal_add(struct gevent_base *eb, int signo,
+        void (*cb)(int signo, void *arg), void *arg)
+{
+    printf("gevent_signal is not supported on this platform!\n");
+    return -1;
+}
+
+int gevent_signal_del(struct gevent_base *eb, int signo)
+{
+    return -1;
+}
+
+#endif
@@ -21,11 +21,14 @@
  ******************************************************************************/
 #include "libgevent.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 #if defined (OS_LINUX)
 #include <sys/sysinfo.h>
 #endif
 #include <signal.h>
+#include <string.h>
+#include <sys/socket.h>
 
 struct gevent_base *evbase = NULL;
 
@@ -43,12 +46,35 @@ static void on_time(int fd, void *arg)
     printf("on_time fd = %d, ch=%c\n", fd, ch[0]);
 }
 
+static void on_signal(int signo, void *arg)
+{
+    printf("on_signal %d in loop thread\n", signo);
+}
+
+static void on_wtimer(struct gevent_wtimer *t, void *arg)
+{
+    printf("on_wtimer %s\n", (char *)arg);
+}
+
+static int wtimer_fired;
+
+/* persist timer deletes and frees itself on third round */
+static void on_wtimer_self_free(struct gevent_wtimer *t, void *arg)
+{
+    if (++wtimer_fired == 3) {
+        gevent_wtimer_del((struct gevent_base *)arg, t);
+        free(t);
+    }
+}
+
 static int foo(void)
 {
     int fd = STDIN_FILENO;
     struct gevent *event_2000;
     struct gevent *event_1500;
     struct gevent *event_stdin;
+    struct gevent_wtimer wtimer_500;
+    struct gevent_wtimer *wtimer_self;
     evbase = gevent_base_create();
     if (!evbase) {
         printf("gevent_base_create failed!\n");
@@ -81,9 +107,21 @@ static int foo(void)
         printf("gevent_add failed!\n");
         return -1;
     }
+    gevent_base_stats_enable(evbase, true);
+    gevent_wtimer_init(&wtimer_500, on_wtimer, "500ms");
+    gevent_wtimer_add(evbase, &wtimer_500, 500, TIMER_PERSIST);
+    wtimer_self = calloc(1, sizeof(struct gevent_wtimer));
+    gevent_wtimer_init(wtimer_self, on_wtimer_self_free, evbase);
+    gevent_wtimer_add(evbase, wtimer_self, 100, TIMER_PERSIST);
+    gevent_signal_add(evbase, SIGUSR1, on_signal, NULL);
     gevent_base_loop_start(evbase);
+    kill(getpid(), SIGUSR1);
     sleep(10);
     gevent_base_loop_stop(evbase);
+    gevent_base_stats_dump(evbase);
+    printf("self free wtimer fired %d times\n", wtimer_fired);
+    gevent_wtimer_del(evbase, &wtimer_500);
+    gevent_signal_del(evbase, SIGUSR1);
     gevent_del(evbase, &event_1500);
     gevent_del(evbase, &event_2000);
     gevent_timer_destroy(event_1500);
@@ -94,6 +132,107 @@ static int foo(void)
     return 0;
 }
 
+static int foo_group(void)
+{
+    int i, fds[4][2];
+    struct gevent *events[4];
+    struct gevent_base *bases[4];
+    struct gevent_base_group *group;
+
+    group = gevent_base_group_create(0, GEVENT_GROUP_LEAST_LOADED);
+    if (!group) {
+        printf("gevent_base_group_create failed!\n");
+        return -1;
+    }
+    for (i = 0; i < group->nbase; i++) {
+        gevent_base_set_busy_poll(group->bases[i], 50);
+        gevent_base_set_sock_busy_poll(group->bases[i], 50);
+        gevent_base_stats_enable(group->bases[i], true);
+    }
+    gevent_base_group_loop_start(group, true);
+    for (i = 0; i < 4; i++) {
+        if (pipe(fds[i])) {
+            printf("pipe failed!\n");
+            return -1;
+        }
+        events[i] = gevent_create(fds[i][0], on_input, NULL, NULL, NULL);
+        bases[i] = gevent_base_group_add(group, &events[i]);
+        printf("fd %d assigned to base %p\n", fds[i][0], bases[i]);
+    }
+    for (i = 0; i < 4; i++) {
+        write(fds[i][1], "g", 2);
+    }
+    sleep(1);
+    /* del is not posted, do it after the loops stop */
+    gevent_base_group_loop_stop(group);
+    gevent_base_stats_dump(group->bases[0]);
+    for (i = 0; i < 4; i++) {
+        gevent_del(bases[i], &events[i]);
+        gevent_destroy(events[i]);
+        close(fds[i][0]);
+        close(fds[i][1]);
+    }
+    gevent_base_group_destroy(group);
+    printf("foo_group end\n");
+    return 0;
+}
+
+static int conn_high, conn_low, conn_drain;
+
+static void on_conn_high(struct gevent_conn *c, size_t pending, void *arg)
+{
+    conn_high++;
+}
+
+static void on_conn_low(struct gevent_conn *c, size_t pending, void *arg)
+{
+    conn_low++;
+}
+
+static void on_conn_drain(struct gevent_conn *c, void *arg)
+{
+    conn_drain++;
+}
+
+static int foo_conn(void)
+{
+    int sv[2], i;
+    char buf[16 * 1024];
+    ssize_t n, total = 0;
+    struct gevent_conn *c;
+    struct gevent_conn_cbs cbs;
+    struct gevent_base *eb = gevent_base_create();
+
+    if (!eb || socketpair(AF_UNIX, SOCK_STREAM, 0, sv)) {
+        return -1;
+    }
+    memset(&cbs, 0, sizeof(cbs));
+    cbs.on_drain = on_conn_drain;
+    cbs.on_high = on_conn_high;
+    cbs.on_low = on_conn_low;
+    c = gevent_conn_create(eb, sv[0], &cbs, NULL);
+    gevent_conn_set_watermark(c, 256 * 1024, 64 * 1024);
+    memset(buf, 'c', sizeof(buf));
+    for (i = 0; i < 64; i++) {
+        gevent_conn_write(c, buf, sizeof(buf));
+    }
+    gevent_base_loop_start(eb);
+    while (total < 64 * (ssize_t)sizeof(buf)) {
+        n = read(sv[1], buf, sizeof(buf));
+        if (n <= 0) {
+            break;
+        }
+        total += n;
+    }
+    usleep(100 * 1000);
+    gevent_base_loop_stop(eb);
+    printf("conn: read %zd, high %d, low %d, drain %d\n", total, conn_high, conn_low, conn_drain);
+    gevent_conn_destroy(c);
+    close(sv[1]);
+    gevent_base_destroy(eb);
+    return (conn_high == 1 && conn_low == 1 && conn_drain > 0) ? 0 : -1;
+}
+
 static void sigint_handler(int sig)
 {
     printf("catch sigint\n");
@@ -107,6 +246,8 @@ void signal_init()
 int main(int argc, char **argv)
 {
     signal_init();
+    foo_conn();
+    foo_group();
     foo();
     return 0;
 }
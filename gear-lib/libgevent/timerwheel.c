@@ -0,0 +1,301 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#include "libgevent.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * hierarchical timing wheel, same layout as linux kernel timer vector:
+ * root wheel has 256 slots of 1ms tick, then 4 levels of 64 slots,
+ * each level slot covers the whole lower wheel, timers cascade down
+ * when lower wheel wraps. add and del are O(1).
+ */
+#define TW_ROOT_BITS    8
+#define TW_LEVEL_BITS   6
+#define TW_ROOT_SIZE    (1 << TW_ROOT_BITS)
+#define TW_LEVEL_SIZE   (1 << TW_LEVEL_BITS)
+#define TW_ROOT_MASK    (TW_ROOT_SIZE - 1)
+#define TW_LEVEL_MASK   (TW_LEVEL_SIZE - 1)
+#define TW_LEVELS       4
+#define TW_MAX_TICKS    ((1ULL << (TW_ROOT_BITS + TW_LEVELS * TW_LEVEL_BITS)) - 1)
+
+#define TW_INDEX(jiffies, n) \
+    (((jiffies) >> (TW_ROOT_BITS + (n) * TW_LEVEL_BITS)) & TW_LEVEL_MASK)
+
+struct gevent_timer_wheel {
+    uint64_t jiffies;
+    size_t count;
+    mutex_lock_t lock;
+    struct gevent_wtimer *running;  /* cleared by del during its callback */
+    struct list_head root[TW_ROOT_SIZE];
+    struct list_head level[TW_LEVELS][TW_LEVEL_SIZE];
+};
+
+static uint64_t tw_now_ms(void)
+{
+#if defined (OS_LINUX) || defined (OS_APPLE)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#else
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+#endif
+}
+
+struct gevent_timer_wheel *gevent_timer_wheel_create(void)
+{
+    int i, j;
+    struct gevent_timer_wheel *tw = CALLOC(1, struct gevent_timer_wheel);
+    if (!tw) {
+        printf("malloc gevent_timer_wheel failed!\n");
+        return NULL;
+    }
+    for (i = 0; i < TW_ROOT_SIZE; i++) {
+        INIT_LIST_HEAD(&tw->root[i]);
+    }
+    for (i = 0; i < TW_LEVELS; i++) {
+        for (j = 0; j < TW_LEVEL_SIZE; j++) {
+            INIT_LIST_HEAD(&tw->level[i][j]);
+        }
+    }
+    mutex_lock_init(&tw->lock);
+    tw->jiffies = tw_now_ms();
+    return tw;
+}
+
+void gevent_timer_wheel_destroy(struct gevent_timer_wheel *tw)
+{
+    int i, j;
+    struct gevent_wtimer *t, *next;
+    if (!tw) {
+        return;
+    }
+    /* timer memory is owned by user, just unlink */
+    for (i = 0; i < TW_ROOT_SIZE; i++) {
+        list_for_each_entry_safe(t, next, &tw->root[i], entry) {
+            list_del_init(&t->entry);
+        }
+    }
+    for (i = 0; i < TW_LEVELS; i++) {
+        for (j = 0; j < TW_LEVEL_SIZE; j++) {
+            list_for_each_entry_safe(t, next, &tw->level[i][j], entry) {
+                list_del_init(&t->entry);
+            }
+        }
+    }
+    mutex_lock_deinit(&tw->lock);
+    free(tw);
+}
+
+static void tw_internal_add(struct gevent_timer_wheel *tw, struct gevent_wtimer *t)
+{
+    uint64_t expires = t->expires;
+    uint64_t idx = expires - tw->jiffies;
+    struct list_head *vec;
+
+    if ((int64_t)idx < 0) {
+        /* already expired, fire on next tick */
+        vec = &tw->root[tw->jiffies & TW_ROOT_MASK];
+    } else if (idx < TW_ROOT_SIZE) {
+        vec = &tw->root[expires & TW_ROOT_MASK];
+    } else if (idx < 1ULL << (TW_ROOT_BITS + TW_LEVEL_BITS)) {
+        vec = &tw->level[0][TW_INDEX(expires, 0)];
+    } else if (idx < 1ULL << (TW_ROOT_BITS + 2 * TW_LEVEL_BITS)) {
+        vec = &tw->level[1][TW_INDEX(expires, 1)];
+    } else if (idx < 1ULL << (TW_ROOT_BITS + 3 * TW_LEVEL_BITS)) {
+        vec = &tw->level[2][TW_INDEX(expires, 2)];
+    } else {
+        if (idx > TW_MAX_TICKS) {
+            expires = tw->jiffies + TW_MAX_TICKS;
+            t->expires = expires;
+        }
+        vec = &tw->level[3][TW_INDEX(expires, 3)];
+    }
+    list_add_tail(&t->entry, vec);
+}
+
+static int tw_cascade(struct gevent_timer_wheel *tw, int n, int index)
+{
+    struct gevent_wtimer *t, *next;
+    struct list_head work;
+
+    INIT_LIST_HEAD(&work);
+    list_splice_init(&tw->level[n][index], &work);
+    list_for_each_entry_safe(t, next, &work, entry) {
+        list_del_init(&t->entry);
+        tw_internal_add(tw, t);
+    }
+    return index;
+}
+
+void gevent_wtimer_init(struct gevent_wtimer *t,
+        void (*cb)(struct gevent_wtimer *, void *), void *arg)
+{
+    memset(t, 0, sizeof(*t));
+    INIT_LIST_HEAD(&t->entry);
+    t->cb = cb;
+    t->arg = arg;
+}
+
+bool gevent_wtimer_pending(struct gevent_wtimer *t)
+{
+    return !list_empty(&t->entry);
+}
+
+int gevent_wtimer_add(struct gevent_base *eb, struct gevent_wtimer *t,
+        time_t msec, enum gevent_timer_type type)
+{
+    struct gevent_timer_wheel *tw;
+    if (!eb || !eb->wheel || !t || !t->cb) {
+        printf("%s:%d paraments is NULL\n", __func__, __LINE__);
+        return -1;
+    }
+    tw = eb->wheel;
+    mutex_lock(&tw->lock);
+    if (gevent_wtimer_pending(t)) {
+        list_del_init(&t->entry);
+        tw->count--;
+    }
+    t->interval = (msec > 0) ? msec : 1;
+    t->type = type;
+    t->expires = tw_now_ms() + t->interval;
+    tw_internal_add(tw, t);
+    tw->count++;
+    mutex_unlock(&tw->lock);
+    /* loop may sleep with a longer timeout, let it recalculate */
+    if (eb->thread && !pthread_equal(pthread_self(), eb->thread->tid)) {
+        gevent_base_signal(eb);
+    }
+    return 0;
+}
+
+int gevent_wtimer_del(struct gevent_base *eb, struct gevent_wtimer *t)
+{
+    struct gevent_timer_wheel *tw;
+    if (!eb || !eb->wheel || !t) {
+        printf("%s:%d paraments is NULL\n", __func__, __LINE__);
+        return -1;
+    }
+    tw = eb->wheel;
+    mutex_lock(&tw->lock);
+    if (gevent_wtimer_pending(t)) {
+        list_del_init(&t->entry);
+        tw->count--;
+    }
+    t->type = TIMER_ONESHOT;
+    if (tw->running == t) {
+        tw->running = NULL;
+    }
+    mutex_unlock(&tw->lock);
+    return 0;
+}
+
+/*
+ * return msec to the nearest expiry in root wheel,
+ * or to the next cascade if root wheel is empty, -1 if no timer
+ */
+int gevent_timer_wheel_timeout(struct gevent_timer_wheel *tw)
+{
+    int i, timeout;
+    uint64_t now, base;
+    if (!tw) {
+        return -1;
+    }
+    mutex_lock(&tw->lock);
+    if (tw->count == 0) {
+        mutex_unlock(&tw->lock);
+        return -1;
+    }
+    now = tw_now_ms();
+    base = tw->jiffies;
+    for (i = 0; i < TW_ROOT_SIZE; i++) {
+        if (((base + i) & TW_ROOT_MASK) == 0 && i > 0) {
+            break;
+        }
+        if (!list_empty(&tw->root[(base + i) & TW_ROOT_MASK])) {
+            break;
+        }
+    }
+    mutex_unlock(&tw->lock);
+    if (base + i <= now) {
+        return 0;
+    }
+    timeout = (int)(base + i - now);
+    return timeout;
+}
+
+void gevent_timer_wheel_run(struct gevent_timer_wheel *tw)
+{
+    int index;
+    bool persist;
+    uint64_t now;
+    struct list_head work;
+    struct gevent_wtimer *t;
+
+    if (!tw) {
+        return;
+    }
+    now = tw_now_ms();
+    mutex_lock(&tw->lock);
+    if (tw->count == 0) {
+        tw->jiffies = now;
+        mutex_unlock(&tw->lock);
+        return;
+    }
+    INIT_LIST_HEAD(&work);
+    while (tw->jiffies <= now) {
+        index = tw->jiffies & TW_ROOT_MASK;
+        if (!index &&
+            !tw_cascade(tw, 0, TW_INDEX(tw->jiffies, 0)) &&
+            !tw_cascade(tw, 1, TW_INDEX(tw->jiffies, 1)) &&
+            !tw_cascade(tw, 2, TW_INDEX(tw->jiffies, 2))) {
+            tw_cascade(tw, 3, TW_INDEX(tw->jiffies, 3));
+        }
+        tw->jiffies++;
+        list_splice_tail_init(&tw->root[index], &work);
+    }
+    while (!list_empty(&work)) {
+        t = list_first_entry(&work, struct gevent_wtimer, entry);
+        list_del_init(&t->entry);
+        tw->count--;
+        persist = (t->type == TIMER_PERSIST);
+        tw->running = t;
+        mutex_unlock(&tw->lock);
+        t->cb(t, t->arg);
+        mutex_lock(&tw->lock);
+        /*
+         * t is not touched unless it is persist and still running, a
+         * oneshot may be freed in callback, a persist one after del
+         */
+        if (persist && tw->running == t && !gevent_wtimer_pending(t)) {
+            t->expires = now + t->interval;
+            tw_internal_add(tw, t);
+            tw->count++;
+        }
+        tw->running = NULL;
+    }
+    mutex_unlock(&tw->lock);
+}
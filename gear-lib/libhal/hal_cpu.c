@@ -0,0 +1,608 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#include "libhal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined (OS_LINUX)
+#include <unistd.h>
+#include <sys/sysinfo.h>
+#elif defined (OS_WINDOWS)
+#include <windows.h>
+#endif
+
+#define SYS_CPU                 "/sys/devices/system/cpu"
+#define SYS_NODE                "/sys/devices/system/node"
+
+void cpu_mask_zero(struct cpu_mask *mask)
+{
+    memset(mask, 0, sizeof(*mask));
+}
+
+void cpu_mask_set(struct cpu_mask *mask, int cpu)
+{
+    if (cpu >= 0 && cpu < CPU_MASK_MAX) {
+        mask->bits[cpu / 64] |= 1ULL << (cpu % 64);
+    }
+}
+
+bool cpu_mask_isset(const struct cpu_mask *mask, int cpu)
+{
+    if (cpu < 0 || cpu >= CPU_MASK_MAX) {
+        return false;
+    }
+    return !!(mask->bits[cpu / 64] & (1ULL << (cpu % 64)));
+}
+
+int cpu_mask_count(const struct cpu_mask *mask)
+{
+    int i, n = 0;
+    for (i = 0; i < CPU_MASK_MAX / 64; i++) {
+        n += __builtin_popcountll(mask->bits[i]);
+    }
+    return n;
+}
+
+static int cpu_mask_first(const struct cpu_mask *mask)
+{
+    int i;
+    for (i = 0; i < CPU_MASK_MAX / 64; i++) {
+        if (mask->bits[i]) {
+            return i * 64 + __builtin_ctzll(mask->bits[i]);
+        }
+    }
+    return -1;
+}
+
+static bool cpu_mask_equal(const struct cpu_mask *a, const struct cpu_mask *b)
+{
+    return !memcmp(a, b, sizeof(*a));
+}
+
+int cpu_mask_to_list(const struct cpu_mask *mask, int *cpus, int max)
+{
+    int i, n = 0;
+    for (i = 0; i < CPU_MASK_MAX && n < max; i++) {
+        if (cpu_mask_isset(mask, i)) {
+            cpus[n++] = i;
+        }
+    }
+    return n;
+}
+
+/* cpulist like "0-3,8,10-11", empty string is an empty mask */
+int cpu_mask_parse(struct cpu_mask *mask, const char *cpulist)
+{
+    int begin, end;
+    char *p = (char *)cpulist;
+    cpu_mask_zero(mask);
+    while (*p >= '0' && *p <= '9') {
+        begin = end = (int)strtol(p, &p, 10);
+        if (*p == '-') {
+            end = (int)strtol(p + 1, &p, 10);
+        }
+        for (; begin <= end && begin < CPU_MASK_MAX; begin++) {
+            cpu_mask_set(mask, begin);
+        }
+        if (*p != ',') {
+            break;
+        }
+        p++;
+    }
+    return cpu_mask_count(mask);
+}
+
+static struct cpu_cache *cpu_cache_find(struct cpu_topology *topo, int cpu, int level)
+{
+    int i;
+    for (i = 0; i < topo->cache_count; i++) {
+        struct cpu_cache *c = &topo->caches[i];
+        if (c->level == level && c->type != CPU_CACHE_INSTRUCTION &&
+            cpu_mask_isset(&c->shared, cpu)) {
+            return c;
+        }
+    }
+    return NULL;
+}
+
+/* dedup, a shared cache is seen once from every cpu behind it */
+static struct cpu_cache *cpu_cache_add(struct cpu_topology *topo, int level,
+                enum cpu_cache_type type, const struct cpu_mask *shared)
+{
+    int i;
+    struct cpu_cache *c;
+    for (i = 0; i < topo->cache_count; i++) {
+        c = &topo->caches[i];
+        if (c->level == level && c->type == type && cpu_mask_equal(&c->shared, shared)) {
+            return NULL;
+        }
+    }
+    if (topo->cache_count >= CPU_CACHE_MAX) {
+        return NULL;
+    }
+    c = &topo->caches[topo->cache_count++];
+    c->level = level;
+    c->type = type;
+    c->shared = *shared;
+    return c;
+}
+
+static struct cpu_topology *cpu_topology_alloc(int cpu_count)
+{
+    int i;
+    struct cpu_topology *topo = calloc(1, sizeof(*topo));
+    if (!topo) {
+        return NULL;
+    }
+    topo->cpu_count = cpu_count;
+    topo->cpus = calloc(cpu_count, sizeof(struct cpu_logical));
+    if (!topo->cpus) {
+        free(topo);
+        return NULL;
+    }
+    for (i = 0; i < cpu_count; i++) {
+        topo->cpus[i].package_id = -1;
+        topo->cpus[i].core_id = -1;
+        topo->cpus[i].numa_node = -1;
+    }
+    return topo;
+}
+
+/* derive counts and unique core index once siblings are known */
+static void cpu_topology_finish(struct cpu_topology *topo)
+{
+    int i, j, first, n;
+    int packages[CPU_MASK_MAX];
+    for (i = 0; i < topo->cpu_count; i++) {
+        struct cpu_logical *l = &topo->cpus[i];
+        if (!l->online) {
+            continue;
+        }
+        topo->online_count++;
+        cpu_mask_set(&topo->online, i);
+        if (!cpu_mask_count(&l->siblings)) {
+            cpu_mask_set(&l->siblings, i);
+        }
+        first = cpu_mask_first(&l->siblings);
+        if (first == i || first >= topo->cpu_count || topo->cpus[first].core_id < 0) {
+            l->core_id = topo->core_count++;
+        } else {
+            l->core_id = topo->cpus[first].core_id;
+        }
+        n = cpu_mask_count(&l->siblings);
+        if (n > topo->smt) {
+            topo->smt = n;
+        }
+        for (j = 0; j < topo->package_count; j++) {
+            if (packages[j] == l->package_id) {
+                break;
+            }
+        }
+        if (j == topo->package_count) {
+            packages[topo->package_count++] = l->package_id;
+        }
+    }
+    for (i = 0; i < topo->numa_count; i++) {
+        for (j = 0; j < topo->cpu_count; j++) {
+            if (cpu_mask_isset(&topo->nodes[i].cpus, j)) {
+                topo->cpus[j].numa_node = topo->nodes[i].id;
+            }
+        }
+    }
+}
+
+#if defined (OS_LINUX)
+static int sysfs_read(const char *path, char *buf, size_t len)
+{
+    size_t n;
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        return -1;
+    }
+    n = fread(buf, 1, len - 1, fp);
+    fclose(fp);
+    while (n > 0 && (buf[n-1] == '\n' || buf[n-1] == ' ')) {
+        n--;
+    }
+    buf[n] = '\0';
+    return (int)n;
+}
+
+static int sysfs_read_int(const char *path, int def)
+{
+    char buf[32];
+    if (sysfs_read(path, buf, sizeof(buf)) <= 0) {
+        return def;
+    }
+    return atoi(buf);
+}
+
+static int sysfs_read_mask(const char *path, struct cpu_mask *mask)
+{
+    char buf[4096];
+    cpu_mask_zero(mask);
+    if (sysfs_read(path, buf, sizeof(buf)) < 0) {
+        return -1;
+    }
+    return cpu_mask_parse(mask, buf);
+}
+
+static void cpu_topology_caches(struct cpu_topology *topo, int cpu)
+{
+    int i;
+    char path[256], buf[32];
+    struct cpu_mask shared;
+    struct cpu_cache *c;
+    enum cpu_cache_type type;
+    char *end;
+    uint32_t size;
+
+    for (i = 0; ; i++) {
+        snprintf(path, sizeof(path), SYS_CPU "/cpu%d/cache/index%d/type", cpu, i);
+        if (sysfs_read(path, buf, sizeof(buf)) <= 0) {
+            break;
+        }
+        if (!strcmp(buf, "Data")) {
+            type = CPU_CACHE_DATA;
+        } else if (!strcmp(buf, "Instruction")) {
+            type = CPU_CACHE_INSTRUCTION;
+        } else {
+            type = CPU_CACHE_UNIFIED;
+        }
+        snprintf(path, sizeof(path), SYS_CPU "/cpu%d/cache/index%d/shared_cpu_list", cpu, i);
+        if (sysfs_read_mask(path, &shared) <= 0) {
+            cpu_mask_set(&shared, cpu);
+        }
+        snprintf(path, sizeof(path), SYS_CPU "/cpu%d/cache/index%d/level", cpu, i);
+        c = cpu_cache_add(topo, sysfs_read_int(path, 0), type, &shared);
+        if (!c) {
+            continue;
+        }
+        snprintf(path, sizeof(path), SYS_CPU "/cpu%d/cache/index%d/size", cpu, i);
+        if (sysfs_read(path, buf, sizeof(buf)) > 0) {
+            size = (uint32_t)strtoul(buf, &end, 10);
+            if (*end == 'K') {
+                size <<= 10;
+            } else if (*end == 'M') {
+                size <<= 20;
+            }
+            c->size = size;
+        }
+        snprintf(path, sizeof(path), SYS_CPU "/cpu%d/cache/index%d/coherency_line_size", cpu, i);
+        c->line_size = sysfs_read_int(path, 0);
+        snprintf(path, sizeof(path), SYS_CPU "/cpu%d/cache/index%d/ways_of_associativity", cpu, i);
+        c->ways = sysfs_read_int(path, 0);
+    }
+}
+
+static void cpu_topology_numa(struct cpu_topology *topo)
+{
+    int i;
+    char path[256], line[128];
+    struct cpu_mask nodes;
+    struct cpu_numa_node *nd;
+    unsigned long long kb;
+    FILE *fp;
+
+    if (sysfs_read_mask(SYS_NODE "/online", &nodes) <= 0) {
+        return;
+    }
+    for (i = 0; i < CPU_MASK_MAX && topo->numa_count < CPU_NUMA_MAX; i++) {
+        if (!cpu_mask_isset(&nodes, i)) {
+            continue;
+        }
+        nd = &topo->nodes[topo->numa_count++];
+        nd->id = i;
+        snprintf(path, sizeof(path), SYS_NODE "/node%d/cpulist", i);
+        sysfs_read_mask(path, &nd->cpus);
+        snprintf(path, sizeof(path), SYS_NODE "/node%d/meminfo", i);
+        if (NULL == (fp = fopen(path, "r"))) {
+            continue;
+        }
+        while (fgets(line, sizeof(line), fp)) {
+            if (strstr(line, "MemTotal:") &&
+                1 == sscanf(strstr(line, "MemTotal:") + 9, "%llu", &kb)) {
+                nd->mem_total = (uint64_t)kb * 1024;
+                break;
+            }
+        }
+        fclose(fp);
+    }
+}
+
+struct cpu_topology *cpu_topology_get()
+{
+    int i, cpu_count;
+    char path[256];
+    struct cpu_mask possible, online;
+    struct cpu_topology *topo;
+    struct cpu_logical *l;
+
+    if (sysfs_read_mask(SYS_CPU "/possible", &possible) > 0) {
+        cpu_count = 0;
+        for (i = 0; i < CPU_MASK_MAX; i++) {
+            if (cpu_mask_isset(&possible, i)) {
+                cpu_count = i + 1;
+            }
+        }
+    } else {
+        cpu_count = get_nprocs_conf();
+    }
+    if (cpu_count <= 0 || cpu_count > CPU_MASK_MAX) {
+        cpu_count = CPU_MASK_MAX;
+    }
+    if (sysfs_read_mask(SYS_CPU "/online", &online) <= 0) {
+        cpu_mask_zero(&online);
+        for (i = 0; i < get_nprocs(); i++) {
+            cpu_mask_set(&online, i);
+        }
+    }
+    topo = cpu_topology_alloc(cpu_count);
+    if (!topo) {
+        printf("%s: malloc failed!\n", __func__);
+        return NULL;
+    }
+    for (i = 0; i < cpu_count; i++) {
+        l = &topo->cpus[i];
+        l->online = cpu_mask_isset(&online, i);
+        if (!l->online) {
+            continue;
+        }
+        snprintf(path, sizeof(path), SYS_CPU "/cpu%d/topology/physical_package_id", i);
+        l->package_id = sysfs_read_int(path, 0);
+        snprintf(path, sizeof(path), SYS_CPU "/cpu%d/topology/thread_siblings_list", i);
+        sysfs_read_mask(path, &l->siblings);
+        cpu_topology_caches(topo, i);
+    }
+    sysfs_read_mask(SYS_CPU "/isolated", &topo->isolated);
+    cpu_topology_numa(topo);
+    cpu_topology_finish(topo);
+    return topo;
+}
+
+#elif defined (OS_WINDOWS)
+static void group_mask_to_cpus(const GROUP_AFFINITY *ga, struct cpu_mask *mask)
+{
+    int i;
+    for (i = 0; i < 64; i++) {
+        if (ga->Mask & ((KAFFINITY)1 << i)) {
+            cpu_mask_set(mask, ga->Group * 64 + i);
+        }
+    }
+}
+
+struct cpu_topology *cpu_topology_get()
+{
+    int i, j, cpu_count = 0, package = 0;
+    DWORD len = 0;
+    char *buf, *p;
+    struct cpu_mask mask;
+    struct cpu_topology *topo;
+    struct cpu_cache *c;
+    struct cpu_numa_node *nd;
+    SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX *info;
+    enum cpu_cache_type type;
+
+    GetLogicalProcessorInformationEx(RelationAll, NULL, &len);
+    if (!len || NULL == (buf = malloc(len))) {
+        return NULL;
+    }
+    if (!GetLogicalProcessorInformationEx(RelationAll,
+                    (SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX *)buf, &len)) {
+        printf("GetLogicalProcessorInformationEx failed %lu\n", GetLastError());
+        free(buf);
+        return NULL;
+    }
+    /* cpu id is group * 64 + bit, size array by the highest one */
+    for (p = buf; p < buf + len; p += info->Size) {
+        info = (SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX *)p;
+        if (info->Relationship != RelationProcessorCore) {
+            continue;
+        }
+        cpu_mask_zero(&mask);
+        for (j = 0; j < info->Processor.GroupCount; j++) {
+            group_mask_to_cpus(&info->Processor.GroupMask[j], &mask);
+        }
+        for (i = 0; i < CPU_MASK_MAX; i++) {
+            if (cpu_mask_isset(&mask, i) && i + 1 > cpu_count) {
+                cpu_count = i + 1;
+            }
+        }
+    }
+    topo = cpu_topology_alloc(cpu_count ? cpu_count : 1);
+    if (!topo) {
+        free(buf);
+        return NULL;
+    }
+    for (p = buf; p < buf + len; p += info->Size) {
+        info = (SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX *)p;
+        cpu_mask_zero(&mask);
+        switch (info->Relationship) {
+        case RelationProcessorCore:
+            for (j = 0; j < info->Processor.GroupCount; j++) {
+                group_mask_to_cpus(&info->Processor.GroupMask[j], &mask);
+            }
+            for (i = 0; i < topo->cpu_count; i++) {
+                if (cpu_mask_isset(&mask, i)) {
+                    topo->cpus[i].online = true;
+                    topo->cpus[i].siblings = mask;
+                }
+            }
+            break;
+        case RelationProcessorPackage:
+            for (j = 0; j < info->Processor.GroupCount; j++) {
+                group_mask_to_cpus(&info->Processor.GroupMask[j], &mask);
+            }
+            for (i = 0; i < topo->cpu_count; i++) {
+                if (cpu_mask_isset(&mask, i)) {
+                    topo->cpus[i].package_id = package;
+                }
+            }
+            package++;
+            break;
+        case RelationNumaNode:
+            if (topo->numa_count >= CPU_NUMA_MAX) {
+                break;
+            }
+            nd = &topo->nodes[topo->numa_count++];
+            nd->id = info->NumaNode.NodeNumber;
+            group_mask_to_cpus(&info->NumaNode.GroupMask, &nd->cpus);
+            break;
+        case RelationCache:
+            if (info->Cache.Type == CacheTrace) {
+                break;
+            }
+            type = info->Cache.Type == CacheData ? CPU_CACHE_DATA :
+                   info->Cache.Type == CacheInstruction ? CPU_CACHE_INSTRUCTION :
+                   CPU_CACHE_UNIFIED;
+            group_mask_to_cpus(&info->Cache.GroupMask, &mask);
+            c = cpu_cache_add(topo, info->Cache.Level, type, &mask);
+            if (c) {
+                c->size = info->Cache.CacheSize;
+                c->line_size = info->Cache.LineSize;
+                c->ways = info->Cache.Associativity;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+    free(buf);
+    cpu_topology_finish(topo);
+    return topo;
+}
+
+#else
+struct cpu_topology *cpu_topology_get()
+{
+    return NULL;
+}
+#endif
+
+void cpu_topology_free(struct cpu_topology *topo)
+{
+    if (!topo) {
+        return;
+    }
+    free(topo->cpus);
+    free(topo);
+}
+
+uint32_t cpu_topology_cache_size(struct cpu_topology *topo, int cpu, int level)
+{
+    struct cpu_cache *c;
+    if (!topo) {
+        return 0;
+    }
+    c = cpu_cache_find(topo, cpu, level);
+    return c ? c->size : 0;
+}
+
+int cpu_topology_cache_peers(struct cpu_topology *topo, int cpu, int level,
+                             struct cpu_mask *mask)
+{
+    struct cpu_cache *c;
+    if (!topo || !mask) {
+        return -1;
+    }
+    c = cpu_cache_find(topo, cpu, level);
+    if (!c) {
+        return -1;
+    }
+    *mask = c->shared;
+    return cpu_mask_count(mask);
+}
+
+int cpu_topology_numa_node(struct cpu_topology *topo, int cpu)
+{
+    if (!topo || cpu < 0 || cpu >= topo->cpu_count) {
+        return -1;
+    }
+    return topo->cpus[cpu].numa_node;
+}
+
+/* position of cpu among its SMT siblings */
+static int cpu_sibling_rank(const struct cpu_logical *l, int cpu)
+{
+    int i, rank = 0;
+    for (i = 0; i < cpu; i++) {
+        if (cpu_mask_isset(&l->siblings, i)) {
+            rank++;
+        }
+    }
+    return rank;
+}
+
+int cpu_topology_spread(struct cpu_topology *topo, int node, int *cpus, int n)
+{
+    int i, b, rank, pos, k = 0, any;
+    int buckets = 1;
+    int start[CPU_NUMA_MAX + 1];
+    int *order;
+    struct cpu_logical *l;
+
+    if (!topo || !cpus || n <= 0) {
+        return -1;
+    }
+    order = calloc(topo->cpu_count, sizeof(int));
+    if (!order) {
+        return -1;
+    }
+    if (topo->numa_count > 0 && node < 0) {
+        buckets = topo->numa_count;
+    }
+    for (rank = 0; rank < topo->smt && k < n; rank++) {
+        /* group candidates of this sibling rank by node, keep cpu order */
+        pos = 0;
+        for (b = 0; b < buckets; b++) {
+            start[b] = pos;
+            for (i = 0; i < topo->cpu_count; i++) {
+                l = &topo->cpus[i];
+                if (!l->online || cpu_mask_isset(&topo->isolated, i)) {
+                    continue;
+                }
+                if (node >= 0 && l->numa_node != node) {
+                    continue;
+                }
+                if (buckets > 1 && l->numa_node != topo->nodes[b].id) {
+                    continue;
+                }
+                if (cpu_sibling_rank(l, i) == rank) {
+                    order[pos++] = i;
+                }
+            }
+        }
+        start[buckets] = pos;
+        /* interleave nodes */
+        for (i = 0, any = 1; any && k < n; i++) {
+            any = 0;
+            for (b = 0; b < buckets && k < n; b++) {
+                if (start[b] + i < start[b+1]) {
+                    cpus[k++] = order[start[b] + i];
+                    any = 1;
+                }
+            }
+        }
+    }
+    free(order);
+    return k;
+}
@@ -28,6 +28,10 @@
 #include <string.h>
 #include <fcntl.h>
 #include <signal.h>
+#include <spawn.h>
+#include <dirent.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/ioctl.h>
@@ -41,6 +45,9 @@
 
 #include <linux/if.h>
 #include <linux/wireless.h>
+#include <linux/netlink.h>
+#include <linux/sock_diag.h>
+#include <linux/inet_diag.h>
 
 #define ARRAY_SIZE(a) (sizeof(a) / sizeof(a[0]))
 #define is_str_equal(a,b) \
@@ -357,187 +364,414 @@ int os_get_version(struct os_info *os)
     return 0;
 }
 
-int network_get_port_occupied(struct network_ports *np)
-{
-    FILE* fp;
-    char line[256];
-    unsigned int port;
+/*
+ * incremental line reader on a fixed buffer, lines longer than the buffer
+ * are cut, no allocation per file or line
+ */
+struct proc_reader {
+    int fd;
+    char buf[4096];
+    size_t start;
+    size_t end;
+};
 
-    memset(np, 0, sizeof(*np));
+static int proc_reader_open(struct proc_reader *r, const char *path)
+{
+    r->fd = open(path, O_RDONLY | O_CLOEXEC);
+    r->start = r->end = 0;
+    return r->fd;
+}
 
-    if (NULL != (fp = fopen("/proc/self/net/tcp", "r"))) {
-        while (fgets(line, sizeof(line), fp)) {
-            if (1 == sscanf(line, " %*d: %*p:%x", &port)) {
-                np->tcp[np->tcp_cnt] = port;
-                np->tcp_cnt++;
+static char *proc_reader_line(struct proc_reader *r)
+{
+    char *nl;
+    ssize_t n;
+
+    for (;;) {
+        nl = memchr(r->buf + r->start, '\n', r->end - r->start);
+        if (nl) {
+            *nl = '\0';
+            nl = r->buf + r->start;
+            r->start += strlen(nl) + 1;
+            return nl;
+        }
+        if (r->start > 0) {
+            memmove(r->buf, r->buf + r->start, r->end - r->start);
+            r->end -= r->start;
+            r->start = 0;
+        }
+        if (r->end == sizeof(r->buf) - 1) {
+            r->buf[r->end] = '\0';
+            r->end = 0;
+            return r->buf;
+        }
+        n = read(r->fd, r->buf + r->end, sizeof(r->buf) - 1 - r->end);
+        if (n <= 0) {
+            if (r->end == 0) {
+                return NULL;
             }
+            r->buf[r->end] = '\0';
+            r->start = r->end = 0;
+            return r->buf;
         }
-        fclose(fp);
+        r->end += n;
     }
+}
 
-    if (NULL != (fp = fopen("/proc/self/net/udp", "r"))) {
-        while (fgets(line, sizeof(line), fp)) {
-            if (1 == sscanf(line, " %*d: %*p:%x", &port)) {
-                np->udp[np->udp_cnt] = port;
-                np->udp_cnt++;
-            }
-        }
-        fclose(fp);
+static void proc_reader_close(struct proc_reader *r)
+{
+    if (r->fd != -1) {
+        close(r->fd);
     }
-    return 0;
 }
 
-int system_noblock(char **argv)
+static inline void port_map_set(uint64_t *map, uint16_t port)
 {
-    pid_t pid;
-    struct sigaction ignore, saveintr, savequit;
-    sigset_t chldmask, savemask;
+    map[port >> 6] |= 1ULL << (port & 63);
+}
 
-    if (argv == NULL)
+/* local port of "  sl: ADDR:PORT REM:PORT ..." of /proc/net/{tcp,udp}[6] */
+static int proc_net_scan(const char *path, uint64_t *map)
+{
+    struct proc_reader r;
+    char *line, *p;
+    unsigned int port;
+    int n = 0;
+
+    if (-1 == proc_reader_open(&r, path)) {
         return -1;
+    }
+    proc_reader_line(&r);   /* header */
+    while ((line = proc_reader_line(&r))) {
+        p = strchr(line, ':');
+        if (!p || !(p = strchr(p + 1, ':'))) {
+            continue;
+        }
+        port = strtoul(p + 1, NULL, 16);
+        port_map_set(map, port);
+        n++;
+    }
+    proc_reader_close(&r);
+    return n;
+}
 
-    ignore.sa_handler = SIG_IGN;
-    sigemptyset(&ignore.sa_mask);
-    ignore.sa_flags = 0;
-    if (sigaction(SIGINT, &ignore, &saveintr) < 0) return -1;
-    if (sigaction(SIGQUIT, &ignore, &savequit) < 0) return -1;
-    if (sigaction(SIGCHLD, &ignore, &savequit) < 0) return -1;
+/* local ports of all sockets of a family and protocol with sock_diag */
+static int sock_diag_scan(int family, int protocol, uint64_t *map)
+{
+    struct {
+        struct nlmsghdr nlh;
+        struct inet_diag_req_v2 req;
+    } msg;
+    struct sockaddr_nl nladdr;
+    struct inet_diag_msg *diag;
+    struct nlmsghdr *h;
+    long buf[8192 / sizeof(long)];
+    ssize_t len;
+    int fd, n = 0, done = 0;
+
+    fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_SOCK_DIAG);
+    if (fd == -1) {
+        return -1;
+    }
+    memset(&msg, 0, sizeof(msg));
+    msg.nlh.nlmsg_len = sizeof(msg);
+    msg.nlh.nlmsg_type = SOCK_DIAG_BY_FAMILY;
+    msg.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    msg.req.sdiag_family = family;
+    msg.req.sdiag_protocol = protocol;
+    msg.req.idiag_states = ~0U;
+    memset(&nladdr, 0, sizeof(nladdr));
+    nladdr.nl_family = AF_NETLINK;
+    if (sendto(fd, &msg, sizeof(msg), 0, (struct sockaddr *)&nladdr, sizeof(nladdr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    while (!done) {
+        len = recv(fd, buf, sizeof(buf), 0);
+        if (len <= 0) {
+            n = -1;
+            break;
+        }
+        for (h = (struct nlmsghdr *)buf; NLMSG_OK(h, len); h = NLMSG_NEXT(h, len)) {
+            if (h->nlmsg_type == NLMSG_DONE) {
+                /* negative errno if the protocol has no diag module */
+                if (h->nlmsg_len >= NLMSG_LENGTH(sizeof(int)) && *(int *)NLMSG_DATA(h) < 0) {
+                    n = -1;
+                }
+                done = 1;
+                break;
+            }
+            if (h->nlmsg_type == NLMSG_ERROR) {
+                done = 1;
+                n = -1;
+                break;
+            }
+            diag = (struct inet_diag_msg *)NLMSG_DATA(h);
+            port_map_set(map, ntohs(diag->id.idiag_sport));
+            n++;
+        }
+    }
+    close(fd);
+    return n;
+}
 
-    sigemptyset(&chldmask);
-    sigaddset(&chldmask, SIGCHLD);
-    if (sigprocmask(SIG_BLOCK, &chldmask, &savemask) < 0) return -1;
+static int port_map_scan(int protocol, const char *v4, const char *v6, uint64_t *map)
+{
+    int n4, n6;
 
-    if ((pid = fork()) < 0) {
-        perror("fork");
+    n4 = sock_diag_scan(AF_INET, protocol, map);
+    n6 = sock_diag_scan(AF_INET6, protocol, map);
+    if (n4 >= 0 && n6 >= 0) {
+        return 0;
+    }
+    /* no diag module for the protocol or family, /proc has them all */
+    memset(map, 0, 1024 * sizeof(uint64_t));
+    n4 = proc_net_scan(v4, map);
+    n6 = proc_net_scan(v6, map);
+    return (n4 >= 0 || n6 >= 0) ? 0 : -1;
+}
+
+int network_get_port_map(struct network_port_map *pm)
+{
+    memset(pm, 0, sizeof(*pm));
+    if (port_map_scan(IPPROTO_TCP, "/proc/self/net/tcp", "/proc/self/net/tcp6", pm->tcp) < 0 ||
+        port_map_scan(IPPROTO_UDP, "/proc/self/net/udp", "/proc/self/net/udp6", pm->udp) < 0) {
         return -1;
-    } else if (pid == 0) {
-        sigaction(SIGINT, &saveintr, NULL);
-        sigaction(SIGQUIT, &savequit, NULL);
-        sigaction(SIGCHLD, &savequit, NULL);
-        sigprocmask(SIG_SETMASK, &savemask, NULL);
-        if (-1 == execvp(argv[0], argv)) {
-            perror("exec");
-        }
-        _exit(127);
-    } else {
     }
+    return 0;
+}
 
-    if (sigaction(SIGINT, &saveintr, NULL) < 0) return -1;
-    if (sigaction(SIGQUIT, &savequit, NULL) < 0) return -1;
-    if (sigaction(SIGCHLD, &ignore, &savequit) < 0) return -1;
-    if (sigprocmask(SIG_SETMASK, &savemask, NULL) < 0) return -1;
-    return pid;
+bool network_port_is_occupied(const struct network_port_map *pm, int proto, uint16_t port)
+{
+    const uint64_t *map = (proto == IPPROTO_UDP) ? pm->udp : pm->tcp;
+    return !!(map[port >> 6] & (1ULL << (port & 63)));
 }
 
-ssize_t system_noblock_with_result(char **argv, void *buf, size_t count)
+static uint16_t port_map_list(const uint64_t *map, uint16_t *ports, int max)
 {
-    int len = -1;
-    int old_fd, new_fd;
-    int fd[2];
-    if (pipe(fd)) {
-        printf("pipe failed\n");
-        return -1;
+    uint64_t w;
+    int i, n = 0;
+
+    for (i = 0; i < 1024 && n < max; i++) {
+        for (w = map[i]; w && n < max; w &= w - 1) {
+            ports[n++] = (i << 6) + __builtin_ctzll(w);
+        }
     }
-    int rfd = fd[0];
-    int wfd = fd[1];
+    return n;
+}
 
-    if (EOF == fflush(stdout)) {
-        printf("fflush failed: %s\n", strerror(errno));
+int network_get_port_occupied(struct network_ports *np)
+{
+    struct network_port_map pm;
+
+    memset(np, 0, sizeof(*np));
+    if (network_get_port_map(&pm) < 0) {
         return -1;
     }
-    if (-1 == (old_fd = dup(STDOUT_FILENO))) {
-        printf("dup STDOUT_FILENO failed: %s\n", strerror(errno));
-        return -1;
+    np->tcp_cnt = port_map_list(pm.tcp, np->tcp, ARRAY_SIZE(np->tcp));
+    np->udp_cnt = port_map_list(pm.udp, np->udp, ARRAY_SIZE(np->udp));
+    return 0;
+}
+
+extern char **environ;
+
+/*
+ * posix_spawn is vfork based in glibc and musl, the child shares the
+ * parent memory until exec, so no page tables of a big process are copied
+ */
+static pid_t spawn_capture(char *const argv[], bool search, int *rfd)
+{
+    posix_spawn_file_actions_t fa;
+    posix_spawnattr_t attr;
+    sigset_t mask, def;
+    int fd[2] = {-1, -1};
+    pid_t pid;
+    int ret;
+
+    if (rfd) {
+        if (pipe(fd)) {
+            printf("pipe failed: %s\n", strerror(errno));
+            return -1;
+        }
+        fcntl(fd[0], F_SETFD, FD_CLOEXEC);
+        fcntl(fd[1], F_SETFD, FD_CLOEXEC);
     }
-    if (-1 == (new_fd = dup2(wfd, STDOUT_FILENO))) {
-        //no need to check failed??
-        //printf("dup2 STDOUT_FILENO failed: %s\n", strerror(errno));
-        //return -1;
+    posix_spawn_file_actions_init(&fa);
+    if (rfd) {
+        posix_spawn_file_actions_adddup2(&fa, fd[1], STDOUT_FILENO);
     }
-    if (-1 == system_noblock(argv)) {
-        printf("system call failed!\n");
-        return -1;
+    posix_spawnattr_init(&attr);
+    sigemptyset(&mask);
+    sigfillset(&def);
+    posix_spawnattr_setsigmask(&attr, &mask);
+    posix_spawnattr_setsigdefault(&attr, &def);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+    if (search) {
+        ret = posix_spawnp(&pid, argv[0], &fa, &attr, argv, environ);
+    } else {
+        ret = posix_spawn(&pid, argv[0], &fa, &attr, argv, environ);
     }
-    if (-1 == read(rfd, buf, count-1)) {
-        printf("read buffer failed!\n");
-        return -1;
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&fa);
+    if (rfd) {
+        close(fd[1]);
     }
-    len = strlen(buf);
-    *((char *)buf + len - 1) = '\0';
-    if (-1 == dup2(old_fd, new_fd)) {
-        printf("dup2 failed: %s\n", strerror(errno));
+    if (ret != 0) {
+        printf("spawn %s failed: %s\n", argv[0], strerror(ret));
+        if (rfd) {
+            close(fd[0]);
+        }
         return -1;
     }
+    if (rfd) {
+        *rfd = fd[0];
+    }
+    return pid;
+}
+
+/* read output until eof or buf is full, then reap the child */
+static ssize_t spawn_read_result(pid_t pid, int rfd, void *buf, size_t count)
+{
+    char *p = (char *)buf;
+    size_t len = 0;
+    ssize_t n;
+
+    while (len + 1 < count) {
+        n = read(rfd, p + len, count - 1 - len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        len += n;
+    }
+    close(rfd);
+    while (waitpid(pid, NULL, 0) < 0 && errno == EINTR);
+    if (count == 0) {
+        return 0;
+    }
+    if (len > 0 && p[len - 1] == '\n') {
+        len--;
+    }
+    p[len] = '\0';
     return len;
 }
 
-ssize_t system_with_result(const char *cmd, void *buf, size_t count)
+int system_noblock(char **argv)
 {
-    int len = -1;
-    int old_fd, new_fd;
-    int fd[2];
-    if (pipe(fd)) {
-        printf("pipe failed\n");
+    struct sigaction ignore;
+
+    if (argv == NULL)
         return -1;
-    }
-    int rfd = fd[0];
-    int wfd = fd[1];
-    if (EOF == fflush(stdout)) {
-        printf("fflush failed: %s\n", strerror(errno));
+
+    /* not waited for, the kernel reaps it */
+    ignore.sa_handler = SIG_IGN;
+    sigemptyset(&ignore.sa_mask);
+    ignore.sa_flags = 0;
+    if (sigaction(SIGCHLD, &ignore, NULL) < 0) return -1;
+    return spawn_capture(argv, true, NULL);
+}
+
+ssize_t system_noblock_with_result(char **argv, void *buf, size_t count)
+{
+    pid_t pid;
+    int rfd;
+
+    if (argv == NULL || buf == NULL)
         return -1;
-    }
-    if (-1 == (old_fd = dup(STDOUT_FILENO))) {
-        printf("dup STDOUT_FILENO failed: %s\n", strerror(errno));
+    if (-1 == (pid = spawn_capture(argv, true, &rfd))) {
+        printf("system call failed!\n");
         return -1;
     }
-    if (-1 == (new_fd = dup2(wfd, STDOUT_FILENO))) {
-        //no need to check failed??
-        //printf("dup2 STDOUT_FILENO failed: %s\n", strerror(errno));
-        //return -1;
-    }
-    if (-1 == system(cmd)) {
+    return spawn_read_result(pid, rfd, buf, count);
+}
+
+ssize_t system_with_result(const char *cmd, void *buf, size_t count)
+{
+    char *argv[] = {"/bin/sh", "-c", (char *)cmd, NULL};
+    pid_t pid;
+    int rfd;
+
+    if (cmd == NULL || buf == NULL)
+        return -1;
+    if (-1 == (pid = spawn_capture(argv, false, &rfd))) {
         printf("system call failed!\n");
         return -1;
     }
-    if (-1 == read(rfd, buf, count-1)) {
-        printf("read buffer failed!\n");
-        return -1;
+    return spawn_read_result(pid, rfd, buf, count);
+}
+
+/* match comm, or argv[0] basename for names longer than comm keeps */
+static bool proc_match(const char *pid, const char *proc)
+{
+    char path[64], name[256], *base;
+    ssize_t n;
+    int fd;
+
+    snprintf(path, sizeof(path), "/proc/%s/comm", pid);
+    if (-1 == (fd = open(path, O_RDONLY | O_CLOEXEC))) {
+        return false;
     }
-    len = strlen(buf);
-    *((char *)buf + len - 1) = '\0';
-    if (-1 == dup2(old_fd, new_fd)) {
-        printf("dup2 failed: %s\n", strerror(errno));
-        return -1;
+    n = read(fd, name, sizeof(name) - 1);
+    close(fd);
+    if (n <= 0) {
+        return false;
     }
-    return len;
+    name[n] = '\0';
+    if (name[n - 1] == '\n') {
+        name[n - 1] = '\0';
+    }
+    if (!strcmp(name, proc)) {
+        return true;
+    }
+    if (strlen(proc) < 15 || strncmp(name, proc, strlen(name))) {
+        return false;
+    }
+    snprintf(path, sizeof(path), "/proc/%s/cmdline", pid);
+    if (-1 == (fd = open(path, O_RDONLY | O_CLOEXEC))) {
+        return false;
+    }
+    n = read(fd, name, sizeof(name) - 1);
+    close(fd);
+    if (n <= 0) {
+        return false;
+    }
+    name[n] = '\0';
+    base = strrchr(name, '/');
+    return !strcmp(base ? base + 1 : name, proc);
 }
 
 bool proc_exist(const char *proc)
 {
-#define MAX_CMD_BUFSZ               128
-    FILE* fp;
-    int count;
-    char buf[MAX_CMD_BUFSZ];
-    char cmd[MAX_CMD_BUFSZ];
+    struct linux_dirent64 {
+        uint64_t d_ino;
+        int64_t d_off;
+        unsigned short d_reclen;
+        unsigned char d_type;
+        char d_name[];
+    } *d;
+    char buf[4096];
     bool exist = false;
-    snprintf(cmd, sizeof(cmd), "ps -ef | grep -w %s | grep -v grep | wc -l", proc);
+    long n, off;
+    int fd;
 
-    do {
-        if ((fp = popen(cmd, "r")) == NULL) {
-            printf("popen failed\n");
-            break;
-        }
-        if ((fgets(buf, MAX_CMD_BUFSZ, fp)) != NULL) {
-            count = atoi(buf);
-            if (count <= 0) {
-                exist = false;
-            } else if (count == 1) {
-                exist = true;
-            } else {
-                printf("process number may be wrong");
+    if (!proc || !*proc) {
+        return false;
+    }
+    /* getdents on /proc directly, no ps, shell or readdir allocation */
+    if (-1 == (fd = open("/proc", O_RDONLY | O_DIRECTORY | O_CLOEXEC))) {
+        return false;
+    }
+    while (!exist && (n = syscall(SYS_getdents64, fd, buf, sizeof(buf))) > 0) {
+        for (off = 0; off < n && !exist; off += d->d_reclen) {
+            d = (struct linux_dirent64 *)(buf + off);
+            if (d->d_name[0] < '1' || d->d_name[0] > '9') {
+                continue;
             }
+            exist = proc_match(d->d_name, proc);
         }
-        pclose(fp);
-    } while (0);
+    }
+    close(fd);
     return exist;
 }
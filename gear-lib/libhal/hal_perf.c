@@ -0,0 +1,300 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#include "libhal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#define __STDC_FORMAT_MACROS
+#include <inttypes.h>
+#if defined (OS_LINUX)
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+static const char *perf_counter_name[PERF_CNT_MAX] = {
+    "cycles",
+    "instructions",
+    "cache-references",
+    "cache-misses",
+    "branches",
+    "branch-misses",
+    "task-clock(ns)",
+    "context-switches",
+};
+
+#if defined (OS_LINUX)
+static const struct {
+    uint32_t type;
+    uint64_t config;
+} perf_counter_attr[PERF_CNT_MAX] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_INSTRUCTIONS},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES},
+};
+
+struct perf_group {
+    int leader;
+    int nr;
+    int fd[PERF_CNT_MAX];
+    int idx[PERF_CNT_MAX];          /* read order -> enum perf_counter */
+    uint32_t valid;
+    uint64_t *buf;                  /* PERF_FORMAT_GROUP read buffer */
+};
+
+static int perf_event_open(struct perf_event_attr *attr, pid_t pid, int cpu,
+                           int group_fd, unsigned long flags)
+{
+    return (int)syscall(__NR_perf_event_open, attr, pid, cpu, group_fd, flags);
+}
+
+struct perf_group *perf_group_create(uint32_t counters)
+{
+    int i, fd;
+    struct perf_event_attr attr;
+    struct perf_group *g = calloc(1, sizeof(*g));
+    if (!g) {
+        return NULL;
+    }
+    g->leader = -1;
+    for (i = 0; i < PERF_CNT_MAX; i++) {
+        if (!(counters & PERF_CNT_BIT(i))) {
+            continue;
+        }
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = perf_counter_attr[i].type;
+        attr.config = perf_counter_attr[i].config;
+        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                           PERF_FORMAT_TOTAL_TIME_RUNNING;
+        attr.disabled = (g->leader == -1);  /* members follow the leader */
+        attr.exclude_kernel = 1;            /* allowed with perf_event_paranoid 2 */
+        attr.exclude_hv = 1;
+        fd = perf_event_open(&attr, 0, -1, g->leader, 0);
+        if (fd == -1) {
+            /* no PMU in vm, or counter not supported, skip it */
+            continue;
+        }
+        if (g->leader == -1) {
+            g->leader = fd;
+        }
+        g->fd[g->nr] = fd;
+        g->idx[g->nr] = i;
+        g->nr++;
+        g->valid |= PERF_CNT_BIT(i);
+    }
+    if (g->leader == -1) {
+        printf("perf_event_open failed %d:%s\n", errno, strerror(errno));
+        free(g);
+        return NULL;
+    }
+    g->buf = calloc(3 + g->nr, sizeof(uint64_t));
+    if (!g->buf) {
+        perf_group_destroy(g);
+        return NULL;
+    }
+    return g;
+}
+
+void perf_group_destroy(struct perf_group *g)
+{
+    int i;
+    if (!g) {
+        return;
+    }
+    for (i = 0; i < g->nr; i++) {
+        close(g->fd[i]);
+    }
+    free(g->buf);
+    free(g);
+}
+
+static int perf_group_sample(struct perf_group *g, struct perf_sample *s)
+{
+    int i;
+    uint64_t *b = g->buf;
+    size_t len = (3 + g->nr) * sizeof(uint64_t);
+    double scale = 1.0;
+
+    if (read(g->leader, b, len) != (ssize_t)len) {
+        printf("perf read failed %d:%s\n", errno, strerror(errno));
+        return -1;
+    }
+    /* {nr, time_enabled, time_running, value[nr]} */
+    memset(s, 0, sizeof(*s));
+    s->valid = g->valid;
+    s->time_enabled = b[1];
+    s->time_running = b[2];
+    if (b[2] && b[2] < b[1]) {
+        scale = (double)b[1] / b[2];
+    }
+    for (i = 0; i < g->nr && i < (int)b[0]; i++) {
+        s->value[g->idx[i]] = (uint64_t)(b[3 + i] * scale);
+    }
+    return 0;
+}
+
+int perf_group_start(struct perf_group *g)
+{
+    if (!g) {
+        return -1;
+    }
+    if (-1 == ioctl(g->leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP) ||
+        -1 == ioctl(g->leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP)) {
+        printf("perf ioctl failed %d:%s\n", errno, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+int perf_group_stop(struct perf_group *g, struct perf_sample *s,
+                    struct perf_region *r)
+{
+    struct perf_sample tmp;
+    if (!g) {
+        return -1;
+    }
+    ioctl(g->leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    if (!s) {
+        s = &tmp;
+    }
+    if (-1 == perf_group_sample(g, s)) {
+        return -1;
+    }
+    if (r) {
+        perf_region_add(r, s);
+    }
+    return 0;
+}
+
+int perf_group_read(struct perf_group *g, struct perf_sample *s)
+{
+    if (!g || !s) {
+        return -1;
+    }
+    return perf_group_sample(g, s);
+}
+
+uint32_t perf_group_counters(struct perf_group *g)
+{
+    return g ? g->valid : 0;
+}
+
+#else
+struct perf_group *perf_group_create(uint32_t counters)
+{
+    printf("%s not support!\n", __func__);
+    return NULL;
+}
+
+void perf_group_destroy(struct perf_group *g)
+{
+}
+
+uint32_t perf_group_counters(struct perf_group *g)
+{
+    return 0;
+}
+
+int perf_group_start(struct perf_group *g)
+{
+    return -1;
+}
+
+int perf_group_stop(struct perf_group *g, struct perf_sample *s,
+                    struct perf_region *r)
+{
+    return -1;
+}
+
+int perf_group_read(struct perf_group *g, struct perf_sample *s)
+{
+    return -1;
+}
+#endif
+
+void perf_region_init(struct perf_region *r, const char *name)
+{
+    memset(r, 0, sizeof(*r));
+    r->name = name;
+}
+
+void perf_region_add(struct perf_region *r, const struct perf_sample *s)
+{
+    int i;
+    if (!r || !s) {
+        return;
+    }
+    __atomic_fetch_or(&r->valid, s->valid, __ATOMIC_RELAXED);
+    for (i = 0; i < PERF_CNT_MAX; i++) {
+        if (s->valid & PERF_CNT_BIT(i)) {
+            __atomic_fetch_add(&r->sum[i], s->value[i], __ATOMIC_RELAXED);
+        }
+    }
+    __atomic_fetch_add(&r->runs, 1, __ATOMIC_RELAXED);
+}
+
+static double perf_ratio(const struct perf_region *r, int a, int b)
+{
+    if (!(r->valid & PERF_CNT_BIT(a)) || !(r->valid & PERF_CNT_BIT(b)) || !r->sum[b]) {
+        return -1.0;
+    }
+    return (double)r->sum[a] / r->sum[b];
+}
+
+void perf_region_report(const struct perf_region *r, FILE *fp)
+{
+    int i;
+    double v;
+    if (!r) {
+        return;
+    }
+    if (!fp) {
+        fp = stdout;
+    }
+    fprintf(fp, "perf region %s: %" PRIu64 " runs\n", r->name ? r->name : "", r->runs);
+    if (!r->runs) {
+        return;
+    }
+    for (i = 0; i < PERF_CNT_MAX; i++) {
+        if (r->valid & PERF_CNT_BIT(i)) {
+            fprintf(fp, "  %-18s %16" PRIu64 " total %14.1f per run\n",
+                    perf_counter_name[i], r->sum[i], (double)r->sum[i] / r->runs);
+        }
+    }
+    if ((v = perf_ratio(r, PERF_CNT_INSTRUCTIONS, PERF_CNT_CYCLES)) >= 0) {
+        fprintf(fp, "  IPC                %16.2f\n", v);
+    }
+    if ((v = perf_ratio(r, PERF_CNT_CACHE_MISSES, PERF_CNT_CACHE_REFERENCES)) >= 0) {
+        fprintf(fp, "  cache miss rate    %15.2f%%\n", v * 100);
+    }
+    if ((v = perf_ratio(r, PERF_CNT_BRANCH_MISSES, PERF_CNT_BRANCHES)) >= 0) {
+        fprintf(fp, "  branch miss rate   %15.2f%%\n", v * 100);
+    }
+}
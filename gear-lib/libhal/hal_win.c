@@ -202,6 +202,17 @@ int network_get_port_occupied(struct network_ports *np)
     return 0;
 }
 
+int network_get_port_map(struct network_port_map *pm)
+{
+    memset(pm, 0, sizeof(*pm));
+    return -1;
+}
+
+bool network_port_is_occupied(const struct network_port_map *pm, int proto, uint16_t port)
+{
+    return !!(((proto == IPPROTO_UDP) ? pm->udp : pm->tcp)[port >> 6] & (1ULL << (port & 63)));
+}
+
 int system_noblock(char **argv)
 {
     return 0;
@@ -41,6 +41,98 @@ struct cpu_info {
     char features[1024];
 };
 
+/*
+ * cpu topology, cpu ids are logical cpu index as used by affinity api
+ */
+#define CPU_MASK_MAX        1024
+#define CPU_CACHE_MAX       64      /* distinct cache instances */
+#define CPU_NUMA_MAX        64
+
+struct cpu_mask {
+    uint64_t bits[CPU_MASK_MAX / 64];
+};
+
+enum cpu_cache_type {
+    CPU_CACHE_UNIFIED = 0,
+    CPU_CACHE_DATA,
+    CPU_CACHE_INSTRUCTION,
+};
+
+struct cpu_cache {
+    int level;
+    enum cpu_cache_type type;
+    uint32_t size;                  /* bytes */
+    uint32_t line_size;
+    int ways;
+    struct cpu_mask shared;         /* cpus sharing this instance */
+};
+
+struct cpu_logical {
+    bool online;
+    int package_id;
+    int core_id;                    /* index into physical cores, unique */
+    int numa_node;                  /* -1 if unknown */
+    struct cpu_mask siblings;       /* SMT threads of the same core */
+};
+
+struct cpu_numa_node {
+    int id;
+    uint64_t mem_total;
+    struct cpu_mask cpus;
+};
+
+struct cpu_topology {
+    int cpu_count;                  /* size of cpus[], highest cpu id + 1 */
+    int online_count;
+    int package_count;
+    int core_count;
+    int smt;                        /* max threads per core */
+    struct cpu_logical *cpus;
+    int cache_count;
+    struct cpu_cache caches[CPU_CACHE_MAX];
+    int numa_count;
+    struct cpu_numa_node nodes[CPU_NUMA_MAX];
+    struct cpu_mask online;
+    struct cpu_mask isolated;       /* isolcpus=, kept out of spread */
+};
+
+/*
+ * hardware counters of the calling thread, a group is read atomically so
+ * ratios like IPC are consistent. counters not supported by the cpu/vm are
+ * skipped, check valid bits
+ */
+enum perf_counter {
+    PERF_CNT_CYCLES = 0,
+    PERF_CNT_INSTRUCTIONS,
+    PERF_CNT_CACHE_REFERENCES,
+    PERF_CNT_CACHE_MISSES,
+    PERF_CNT_BRANCHES,
+    PERF_CNT_BRANCH_MISSES,
+    PERF_CNT_TASK_CLOCK,            /* ns, software */
+    PERF_CNT_CONTEXT_SWITCHES,      /* software */
+    PERF_CNT_MAX,
+};
+
+#define PERF_CNT_BIT(c)     (1U << (c))
+#define PERF_CNT_ALL        ((1U << PERF_CNT_MAX) - 1)
+
+struct perf_sample {
+    uint32_t valid;                 /* PERF_CNT_BIT of counters present */
+    uint64_t value[PERF_CNT_MAX];   /* scaled if counters were multiplexed */
+    uint64_t time_enabled;
+    uint64_t time_running;
+};
+
+/* aggregate of many runs, may be shared by threads */
+struct perf_region {
+    const char *name;
+    uint32_t valid;
+    uint64_t runs;
+    uint64_t sum[PERF_CNT_MAX];
+};
+
+struct perf_group;
+
 struct memory_info {
     uint64_t total;
     uint64_t free;
@@ -81,18 +173,29 @@ struct network_info {
 };
 
 struct network_ports {
-    uint16_t tcp[8192];
+    uint16_t tcp[GEAR_CONFIG_PORTS_MAX];
     uint16_t tcp_cnt;
-    uint16_t udp[8192];
+    uint16_t udp[GEAR_CONFIG_PORTS_MAX];
     uint16_t udp_cnt;
 };
 
+/* bit per local port in use, ipv4 and ipv6 */
+struct network_port_map {
+    uint64_t tcp[1024];
+    uint64_t udp[1024];
+};
+
 /******************************************************************************
  * network
  ******************************************************************************/
 
 int network_get_info(const char *inf, struct network_info *info);
+/* unique ports in use, ascending, from network_get_port_map */
 int network_get_port_occupied(struct network_ports *ports);
+/* sock_diag netlink dump, /proc/net parsing if netlink is unavailable */
+int network_get_port_map(struct network_port_map *pm);
+/* proto is IPPROTO_TCP or IPPROTO_UDP */
+bool network_port_is_occupied(const struct network_port_map *pm, int proto, uint16_t port);
 
 typedef void (*wifi_event_cb_t)(void *ctx);
 void wifi_setup(const char *ssid, const char *pswd, wifi_event_cb_t event_cb);
@@ -100,9 +203,52 @@ void wifi_setup(const char *ssid, const char *pswd, wifi_event_cb_t event_cb);
 
 int sdcard_get_info(const char *mount_point, struct sdcard_info *info);
 int cpu_get_info(struct cpu_info *info);
+
+struct cpu_topology *cpu_topology_get();
+void cpu_topology_free(struct cpu_topology *topo);
+/* size of data/unified cache of level seen by cpu, 0 if unknown */
+uint32_t cpu_topology_cache_size(struct cpu_topology *topo, int cpu, int level);
+/* cpus sharing the level cache with cpu, e.g. an LLC group for a reactor */
+int cpu_topology_cache_peers(struct cpu_topology *topo, int cpu, int level,
+                             struct cpu_mask *mask);
+int cpu_topology_numa_node(struct cpu_topology *topo, int cpu);
+/*
+ * placement order for n workers: online non-isolated cpus, one thread per
+ * physical core first, cores interleaved across numa nodes, then SMT
+ * siblings. node >= 0 restricts to that node. returns count written
+ */
+int cpu_topology_spread(struct cpu_topology *topo, int node, int *cpus, int n);
+
+/* open counters for calling thread, use the group in this thread only */
+struct perf_group *perf_group_create(uint32_t counters);
+void perf_group_destroy(struct perf_group *g);
+uint32_t perf_group_counters(struct perf_group *g);
+int perf_group_start(struct perf_group *g);
+/* stop and read counts since start, optionally accumulate into region */
+int perf_group_stop(struct perf_group *g, struct perf_sample *s,
+                    struct perf_region *r);
+/* counts since start without stopping */
+int perf_group_read(struct perf_group *g, struct perf_sample *s);
+
+void perf_region_init(struct perf_region *r, const char *name);
+void perf_region_add(struct perf_region *r, const struct perf_sample *s);
+/* per-run averages, IPC and miss rates */
+void perf_region_report(const struct perf_region *r, FILE *fp);
+
+void cpu_mask_zero(struct cpu_mask *mask);
+void cpu_mask_set(struct cpu_mask *mask, int cpu);
+bool cpu_mask_isset(const struct cpu_mask *mask, int cpu);
+int cpu_mask_count(const struct cpu_mask *mask);
+/* to int list for thread_set_affinity, returns count */
+int cpu_mask_to_list(const struct cpu_mask *mask, int *cpus, int max);
+int cpu_mask_parse(struct cpu_mask *mask, const char *cpulist);
 int memory_get_info(struct memory_info *info);
 int os_get_version(struct os_info *os);
 
+/*
+ * commands are started with posix_spawn instead of fork, output is read
+ * from a pipe until eof or buf is full, trailing newline removed
+ */
 int system_noblock(char **argv);
 ssize_t system_with_result(const char *cmd, void *buf, size_t count);
 ssize_t system_noblock_with_result(char **argv, void *buf, size_t count);
@@ -32,6 +32,60 @@ void foo2()
     system_with_result(cmd, buf, sizeof(buf));
     printf("buf = %s\n", buf);
 }
+void foo_topology()
+{
+    int i, n;
+    int cpus[CPU_MASK_MAX];
+    struct cpu_topology *topo = cpu_topology_get();
+    if (!topo) {
+        return;
+    }
+    printf("cpus %d online %d packages %d cores %d smt %d numa %d isolated %d\n",
+           topo->cpu_count, topo->online_count, topo->package_count,
+           topo->core_count, topo->smt, topo->numa_count,
+           cpu_mask_count(&topo->isolated));
+    for (i = 0; i < topo->cache_count; i++) {
+        struct cpu_cache *c = &topo->caches[i];
+        printf("L%d type %d size %uKB line %u ways %d shared by %d cpus\n",
+               c->level, c->type, c->size >> 10, c->line_size, c->ways,
+               cpu_mask_count(&c->shared));
+    }
+    for (i = 0; i < topo->numa_count; i++) {
+        printf("node %d: %d cpus, %" PRIu64 "MB\n", topo->nodes[i].id,
+               cpu_mask_count(&topo->nodes[i].cpus), topo->nodes[i].mem_total >> 20);
+    }
+    printf("cpu0 L1 %u L2 %u L3 %u\n", cpu_topology_cache_size(topo, 0, 1),
+           cpu_topology_cache_size(topo, 0, 2), cpu_topology_cache_size(topo, 0, 3));
+    n = cpu_topology_spread(topo, -1, cpus, topo->cpu_count);
+    printf("spread:");
+    for (i = 0; i < n; i++) {
+        printf(" %d", cpus[i]);
+    }
+    printf("\n");
+    cpu_topology_free(topo);
+}
+
+void foo_perf()
+{
+    int i, j;
+    volatile uint64_t sum = 0;
+    struct perf_region region;
+    struct perf_group *g = perf_group_create(PERF_CNT_ALL);
+    if (!g) {
+        return;
+    }
+    perf_region_init(&region, "sum loop");
+    for (i = 0; i < 10; i++) {
+        perf_group_start(g);
+        for (j = 0; j < 100000; j++) {
+            sum += j & (j >> 3);
+        }
+        perf_group_stop(g, NULL, &region);
+    }
+    perf_region_report(&region, stdout);
+    perf_group_destroy(g);
+}
+
 int main(int argc, char **argv)
 {
     struct network_ports ports;
@@ -48,6 +102,9 @@ int main(int argc, char **argv)
     printf("CPU speed: %s\n", ci.name);
     printf("Physical cores: %d, Logical cores: %d\n", ci.cores_physical, ci.cores_logical);
 
+    foo_topology();
+    foo_perf();
+
     memory_get_info(&mi);
     printf("Physical Memory: %" PRIu64 "MB Total, %" PRIu64 "MB Free\n",
                     mi.total/1024/1024, mi.free/1024/1024);
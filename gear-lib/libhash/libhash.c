@@ -24,32 +24,61 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 #define __STDC_FORMAT_MACROS
 #include <inttypes.h>
+#if defined (__SSE2__) || defined (_M_X64) || (defined (_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define HASH_USE_SSE2
+#endif
+
 /*
- * [opaque_list]
- * [bucket0] -> item[1] -> item[2] -> ... -> item[m0]
- * [bucket1] -> item[1] -> item[2] -> ... -> item[m1]
- * [bucket2] -> item[1] -> item[2] -> ... -> item[m2]
- * ...
- * [bucketn] -> item[1] -> item[2] -> ... -> item[mn]
+ * [opaque_list] -> struct hash_table
+ *
+ * open addressing table in swiss table style: one control byte per slot,
+ * 0x80 empty, 0xFE deleted, or 7 low bits of hash when full. lookup scans
+ * a group of 16 (sse2) or 8 (swar) control bytes at once and compares
+ * the key only on matched slots, stops at group owning an empty slot.
  *
+ * ctrl:  [g0: c c c ... c][g1: c c c ... c] ... [gn]
+ * slots: [g0: s s s ... s][g1: s s s ... s] ... [gn]
  */
 
-#define HASH_MAX_KEY_STRLEN 32
-
+/* key is NULL for u32 keys, which live inline in key32, no allocation */
 struct hash_item {
-    struct hlist_node item;
     uint32_t hash;
+    uint32_t key32;
     char *key;
     void *val;
 };
 
+#define CTRL_EMPTY      ((int8_t)-128)
+#define CTRL_DELETED    ((int8_t)-2)
+#define HASH_H1(h)      ((h) >> 7)
+#define HASH_H2(h)      ((int8_t)((h) & 0x7f))
+
+#ifdef HASH_USE_SSE2
+#define GROUP_WIDTH     16
+#define MASK_SHIFT      0
+#else
+#define GROUP_WIDTH     8
+#define MASK_SHIFT      3
+#endif
+
+struct hash_table {
+    int8_t *ctrl;
+    struct hash_item *slots;
+    size_t capacity;        /* power of 2, multiple of GROUP_WIDTH */
+    size_t count;
+    size_t growth_left;     /* inserts into empty slot before rehash */
+};
+
 enum hash_fn_id {
     HASH_DOBBS,
     HASH_MURMUR,
     HASH_CITY,
-    HASH_SPOOKY
+    HASH_SPOOKY,
+    HASH_WY
 };
 
 typedef struct hash_fn_item {
@@ -84,7 +113,7 @@ static uint32_t hash_murmur(const char *key, size_t len)
     h = MURMUR_MAGIC_2 ^ len;
     data = (uint8_t *)key;
     while(len >= 4) {
-        k = *(uint32_t *)data;
+        memcpy(&k, data, sizeof(k));
         k *= MURMUR_MAGIC_1;
         k ^= k >> 24;
         k *= MURMUR_MAGIC_1;
@@ -121,87 +150,433 @@ static uint32_t hash_spooky(const char *key, size_t len)
     return 0;
 }
 
+/*
+ * wyhash, https://github.com/wangyi-fudan/wyhash (public domain)
+ * 64x64->128 multiply and fold, reads 8 or 16 bytes per step and handles
+ * short keys without loop, much faster than byte wise hash on strings
+ */
+#define WY_S0   0xa0761d6478bd642fULL
+#define WY_S1   0xe7037ed1a0b428dbULL
+#define WY_S2   0x8ebc6af09c88c6e3ULL
+#define WY_S3   0x589965cc75374cc3ULL
+#define WY_SEED 0x0badcafeULL
+
+static inline void wy_mum(uint64_t *a, uint64_t *b)
+{
+#if defined (__SIZEOF_INT128__)
+    __uint128_t r = (__uint128_t)*a * *b;
+    *a = (uint64_t)r;
+    *b = (uint64_t)(r >> 64);
+#else
+    uint64_t ha = *a >> 32, hb = *b >> 32;
+    uint64_t la = (uint32_t)*a, lb = (uint32_t)*b;
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64_t t = rl + (rm0 << 32), c = t < rl;
+    uint64_t lo = t + (rm1 << 32);
+    c += lo < t;
+    *a = lo;
+    *b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+static inline uint64_t wy_mix(uint64_t a, uint64_t b)
+{
+    wy_mum(&a, &b);
+    return a ^ b;
+}
+
+static inline uint64_t wy_r8(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t wy_r4(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t wy_r3(const uint8_t *p, size_t k)
+{
+    return ((uint64_t)p[0] << 16) | ((uint64_t)p[k >> 1] << 8) | p[k - 1];
+}
+
+uint64_t hash_wy64(const void *key, size_t len, uint64_t seed)
+{
+    const uint8_t *p = (const uint8_t *)key;
+    uint64_t a, b, see1, see2;
+    size_t i = len;
+
+    seed ^= wy_mix(seed ^ WY_S0, WY_S1);
+    if (len <= 16) {
+        if (len >= 4) {
+            a = (wy_r4(p) << 32) | wy_r4(p + ((len >> 3) << 2));
+            b = (wy_r4(p + len - 4) << 32) | wy_r4(p + len - 4 - ((len >> 3) << 2));
+        } else if (len > 0) {
+            a = wy_r3(p, len);
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        if (i > 48) {
+            see1 = seed;
+            see2 = seed;
+            do {
+                seed = wy_mix(wy_r8(p) ^ WY_S1, wy_r8(p + 8) ^ seed);
+                see1 = wy_mix(wy_r8(p + 16) ^ WY_S2, wy_r8(p + 24) ^ see1);
+                see2 = wy_mix(wy_r8(p + 32) ^ WY_S3, wy_r8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16) {
+            seed = wy_mix(wy_r8(p) ^ WY_S1, wy_r8(p + 8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+        a = wy_r8(p + i - 16);
+        b = wy_r8(p + i - 8);
+    }
+    a ^= WY_S1;
+    b ^= seed;
+    wy_mum(&a, &b);
+    return wy_mix(a ^ WY_S0 ^ len, b ^ WY_S1);
+}
+
+static uint32_t hash_wy(const char *key, size_t len)
+{
+    uint64_t h = hash_wy64(key, len, WY_SEED);
+    return (uint32_t)(h ^ (h >> 32));
+}
+
 static hash_fn_item hash_fn_table[] = {
     {HASH_DOBBS, &hash_dobbs},
     {HASH_MURMUR, &hash_murmur},
     {HASH_CITY, &hash_city},
     {HASH_SPOOKY, &hash_spooky},
+    {HASH_WY, &hash_wy},
 };
 
 uint32_t hash_gen32(const char *key, size_t len)
 {
-    return hash_fn_table[HASH_MURMUR].func(key, len);
+    return hash_fn_table[HASH_WY].func(key, len);
 }
 
-static struct hash_item *hash_lookup(struct hash *h, const char *key, uint32_t *hash)
+/* murmur3 fmix32, full avalanche so both H1 and H2 bits are usable */
+static inline uint32_t hash_mix32(uint32_t x)
 {
-    struct hlist_head *list;
-    struct hash_item *hi;
-    struct hlist_node *next;
-    uint32_t i;
+    x ^= x >> 16;
+    x *= 0x85ebca6b;
+    x ^= x >> 13;
+    x *= 0xc2b2ae35;
+    x ^= x >> 16;
+    return x;
+}
 
-    *hash = hash_gen32(key, strlen(key));
-    i = *hash & (h->bucket-1);
-    list = &((struct hlist_head *)h->opaque_list)[i];
+static inline int item_match(const struct hash_item *hi, const char *key,
+                uint32_t key32)
+{
+    if (key) {
+        return hi->key && strcmp(hi->key, key) == 0;
+    }
+    return !hi->key && hi->key32 == key32;
+}
 
-#if defined (OS_LINUX) || defined (OS_RTOS) || defined (ENV_MINGW)
-    hlist_for_each_entry_safe(hi, next, list, item) {
-#elif defined (OS_WINDOWS)
-    hlist_for_each_entry_safe(hi, struct hash_item, next, struct hlist_node, list, item) {
+/*
+ * bitmask of slots in group, bit i (sse2) or bit 8*i+7 (swar) per slot,
+ * swar match may report false positive which key compare filters out
+ */
+#ifdef HASH_USE_SSE2
+static inline uint32_t group_match(const int8_t *ctrl, int8_t h2)
+{
+    __m128i g = _mm_loadu_si128((const __m128i *)ctrl);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8(h2)));
+}
+
+static inline uint32_t group_match_empty(const int8_t *ctrl)
+{
+    return group_match(ctrl, CTRL_EMPTY);
+}
+
+static inline uint32_t group_match_free(const int8_t *ctrl)
+{
+    /* empty and deleted both have high bit set */
+    __m128i g = _mm_loadu_si128((const __m128i *)ctrl);
+    return (uint32_t)_mm_movemask_epi8(g);
+}
+#else
+#define SWAR_LSB    0x0101010101010101ULL
+#define SWAR_MSB    0x8080808080808080ULL
+
+static inline uint64_t group_load(const int8_t *ctrl)
+{
+    uint64_t g;
+    memcpy(&g, ctrl, sizeof(g));
+    return g;
+}
+
+static inline uint64_t group_match64(const int8_t *ctrl, int8_t h2)
+{
+    uint64_t x = group_load(ctrl) ^ (SWAR_LSB * (uint8_t)h2);
+    return (x - SWAR_LSB) & ~x & SWAR_MSB;
+}
+
+static inline uint64_t group_match_empty64(const int8_t *ctrl)
+{
+    /* empty 10000000, deleted 11111110, only empty has bit 6 clear */
+    uint64_t g = group_load(ctrl);
+    return g & ~(g << 6) & SWAR_MSB;
+}
+
+static inline uint64_t group_match_free64(const int8_t *ctrl)
+{
+    return group_load(ctrl) & SWAR_MSB;
+}
+#endif
+
+#ifdef HASH_USE_SSE2
+typedef uint32_t group_mask;
+#define GROUP_MATCH(c, h)       group_match(c, h)
+#define GROUP_MATCH_EMPTY(c)    group_match_empty(c)
+#define GROUP_MATCH_FREE(c)     group_match_free(c)
+#else
+typedef uint64_t group_mask;
+#define GROUP_MATCH(c, h)       group_match64(c, h)
+#define GROUP_MATCH_EMPTY(c)    group_match_empty64(c)
+#define GROUP_MATCH_FREE(c)     group_match_free64(c)
+#endif
+
+static inline int mask_first(group_mask m)
+{
+#if defined (__GNUC__) || defined (__clang__)
+    return (int)(__builtin_ctzll((uint64_t)m) >> MASK_SHIFT);
+#else
+    int n = 0;
+    while (!(m & 1)) {
+        m >>= 1;
+        n++;
+    }
+    return n >> MASK_SHIFT;
 #endif
-        if ((hi->hash == *hash) && strcmp(hi->key, key) == 0) {
-            return hi;
+}
+
+static size_t table_growth(size_t capacity)
+{
+    /* max load factor 7/8 */
+    return capacity - capacity / 8;
+}
+
+static int table_init(struct hash_table *t, size_t capacity)
+{
+    size_t cap = GROUP_WIDTH;
+    while (cap < capacity) {
+        cap <<= 1;
+    }
+    t->ctrl = (int8_t *)malloc(cap);
+    t->slots = (struct hash_item *)malloc(cap * sizeof(struct hash_item));
+    if (!t->ctrl || !t->slots) {
+        printf("malloc hash table %zu failed!\n", cap);
+        free(t->ctrl);
+        free(t->slots);
+        return -1;
+    }
+    memset(t->ctrl, CTRL_EMPTY, cap);
+    t->capacity = cap;
+    t->count = 0;
+    t->growth_left = table_growth(cap);
+    return 0;
+}
+
+/* probe group by group with triangular step, visits all groups */
+#define PROBE_START(t, hash, g, step) \
+    do { (g) = HASH_H1(hash) & ((t)->capacity / GROUP_WIDTH - 1); (step) = 0; } while (0)
+#define PROBE_NEXT(t, g, step) \
+    do { (step)++; (g) = ((g) + (step)) & ((t)->capacity / GROUP_WIDTH - 1); } while (0)
+
+static struct hash_item *table_find(struct hash_table *t, const char *key,
+                uint32_t key32, uint32_t hash)
+{
+    size_t g, step, idx;
+    group_mask m;
+    const int8_t *ctrl;
+    struct hash_item *hi;
+
+    PROBE_START(t, hash, g, step);
+    while (1) {
+        ctrl = t->ctrl + g * GROUP_WIDTH;
+        for (m = GROUP_MATCH(ctrl, HASH_H2(hash)); m; m &= m - 1) {
+            idx = g * GROUP_WIDTH + mask_first(m);
+            hi = &t->slots[idx];
+            if (t->ctrl[idx] == HASH_H2(hash) && hi->hash == hash &&
+                item_match(hi, key, key32)) {
+                return hi;
+            }
+        }
+        if (GROUP_MATCH_EMPTY(ctrl)) {
+            return NULL;
+        }
+        if (step >= t->capacity / GROUP_WIDTH) {
+            return NULL;
         }
+        PROBE_NEXT(t, g, step);
+    }
+}
+
+/* first empty or deleted slot on probe sequence of hash */
+static size_t table_find_free(struct hash_table *t, uint32_t hash)
+{
+    size_t g, step;
+    group_mask m;
+    PROBE_START(t, hash, g, step);
+    while (1) {
+        m = GROUP_MATCH_FREE(t->ctrl + g * GROUP_WIDTH);
+        if (m) {
+            return g * GROUP_WIDTH + mask_first(m);
+        }
+        PROBE_NEXT(t, g, step);
     }
-    return NULL;
+}
+
+static int table_rehash(struct hash_table *t, size_t capacity)
+{
+    size_t i, idx;
+    struct hash_table nt;
+    if (0 != table_init(&nt, capacity)) {
+        return -1;
+    }
+    for (i = 0; i < t->capacity; i++) {
+        if (t->ctrl[i] < 0) {
+            continue;
+        }
+        idx = table_find_free(&nt, t->slots[i].hash);
+        nt.ctrl[idx] = t->ctrl[i];
+        nt.slots[idx] = t->slots[i];
+    }
+    nt.count = t->count;
+    nt.growth_left -= t->count;
+    free(t->ctrl);
+    free(t->slots);
+    *t = nt;
+    return 0;
+}
+
+static void table_erase(struct hash_table *t, struct hash_item *hi)
+{
+    size_t idx = hi - t->slots;
+    size_t g = idx / GROUP_WIDTH;
+    /*
+     * probe never passes a group with empty slot, such group can get
+     * slot back as empty, otherwise leave tombstone
+     */
+    if (GROUP_MATCH_EMPTY(t->ctrl + g * GROUP_WIDTH)) {
+        t->ctrl[idx] = CTRL_EMPTY;
+        t->growth_left++;
+    } else {
+        t->ctrl[idx] = CTRL_DELETED;
+    }
+    t->count--;
+}
+
+static int table_insert(struct hash_table *t, const char *key, uint32_t key32,
+                uint32_t hash, void *val)
+{
+    size_t idx;
+    char *dup = NULL;
+    struct hash_item *hi;
+
+    if (t->growth_left == 0) {
+        /* grow if really full, else just purge tombstones */
+        size_t cap = t->count * 2 > table_growth(t->capacity) ?
+                     t->capacity * 2 : t->capacity;
+        if (0 != table_rehash(t, cap)) {
+            return -1;
+        }
+    }
+    if (key) {
+        dup = strdup(key);
+        if (!dup) {
+            printf("strdup hash key failed!\n");
+            return -1;
+        }
+    }
+    idx = table_find_free(t, hash);
+    if (t->ctrl[idx] == CTRL_EMPTY) {
+        t->growth_left--;
+    }
+    t->ctrl[idx] = HASH_H2(hash);
+    hi = &t->slots[idx];
+    hi->key = dup;
+    hi->key32 = key32;
+    hi->val = val;
+    hi->hash = hash;
+    t->count++;
+    return 0;
+}
+
+static void table_deinit(struct hash_table *t, void (*destory)(void *val))
+{
+    size_t i;
+    for (i = 0; i < t->capacity; i++) {
+        if (t->ctrl[i] < 0) {
+            continue;
+        }
+        free(t->slots[i].key);
+        if (destory) {
+            destory(t->slots[i].val);
+        }
+    }
+    free(t->ctrl);
+    free(t->slots);
+}
+
+static struct hash_item *hash_lookup32(struct hash *h, uint32_t key)
+{
+    return table_find((struct hash_table *)h->opaque_list, NULL, key,
+                      hash_mix32(key));
+}
+
+static struct hash_item *hash_lookup(struct hash *h, const char *key, uint32_t *hash)
+{
+    *hash = hash_gen32(key, strlen(key));
+    return table_find((struct hash_table *)h->opaque_list, key, 0, *hash);
 }
 
 struct hash *hash_create(int bucket)
 {
-    int i;
-    struct hlist_head *list;
+    struct hash_table *t;
     struct hash *h = (struct hash *)calloc(1, sizeof(*h));
     if (!h) {
         return NULL;
     }
-    list = (struct hlist_head *)calloc(bucket, sizeof(struct hlist_head));
-    if (!list) {
+    t = (struct hash_table *)calloc(1, sizeof(*t));
+    if (!t) {
         free(h);
         return NULL;
     }
-    h->bucket = bucket;
-    for (i = 0; i < bucket; i++) {
-        INIT_HLIST_HEAD(&list[i]);
+    if (0 != table_init(t, bucket > 0 ? (size_t)bucket : GROUP_WIDTH)) {
+        free(t);
+        free(h);
+        return NULL;
     }
-    h->opaque_list = list;
+    h->bucket = (int)t->capacity;
+    h->opaque_list = t;
     return h;
 }
 
 void hash_destroy(struct hash *h)
 {
-    int i;
-    struct hlist_head *list;
-    struct hash_item *hi;
-    struct hlist_node *next;
+    struct hash_table *t;
     if (!h) {
         return;
     }
-    list = h->opaque_list;
-    for (i = 0; i < h->bucket; i++) {
-#if defined (OS_LINUX) || defined (OS_RTOS) || defined (ENV_MINGW)
-        hlist_for_each_entry_safe(hi, next, &list[i], item) {
-#elif defined (OS_WINDOWS)
-        hlist_for_each_entry_safe(hi, struct hash_item, next, struct hlist_node, &list[i], item) {
-#endif
-            hlist_del((struct hlist_node *)hi);
-            free(hi->key);
-            if (h->destory) {
-                h->destory(hi->val);
-            }
-            free(hi);
-        }
-    }
-    free(list);
+    t = (struct hash_table *)h->opaque_list;
+    table_deinit(t, h->destory);
+    free(t);
     free(h);
 }
 
@@ -222,41 +597,40 @@ void *hash_get(struct hash *h, const char *key)
 
 void *hash_get32(struct hash *h, uint32_t key)
 {
-    char key_str[HASH_MAX_KEY_STRLEN];
-    snprintf(key_str, sizeof(key_str), "%" PRIu32, key);
-    return hash_get(h, key_str);
+    struct hash_item *hi = hash_lookup32(h, key);
+    if (hi) {
+        return hi->val;
+    }
+    return NULL;
 }
 
 int hash_set(struct hash *h, const char *key, void *val)
 {
+    int ret;
     uint32_t hash = 0;
-    struct hlist_head *list = h->opaque_list;
+    struct hash_table *t = (struct hash_table *)h->opaque_list;
     struct hash_item *hi = hash_lookup(h, key, &hash);
     if (hi) {
         hi->val = val;
         return 0;
     }
-
-    hi = (struct hash_item *)calloc(1, sizeof(*hi));
-    if (!hi) {
-        printf("calloc hash_item failed!\n");
-        return -1;
-    }
-
-    hi->key = strdup(key);
-    hi->val = val;
-    hi->hash = hash;
-    INIT_HLIST_NODE(&hi->item);
-    int pos = hash & (h->bucket-1);
-    hlist_add_head(&hi->item, &list[pos]);
-    return 0;
+    ret = table_insert(t, key, 0, hash, val);
+    h->bucket = (int)t->capacity;
+    return ret;
 }
 
 int hash_set32(struct hash *h, uint32_t key, void *val)
 {
-    char key_str[HASH_MAX_KEY_STRLEN];
-    snprintf(key_str, sizeof(key_str), "%" PRIu32, key);
-    return hash_set(h, key_str, val);
+    int ret;
+    struct hash_table *t = (struct hash_table *)h->opaque_list;
+    struct hash_item *hi = hash_lookup32(h, key);
+    if (hi) {
+        hi->val = val;
+        return 0;
+    }
+    ret = table_insert(t, NULL, key, hash_mix32(key), val);
+    h->bucket = (int)t->capacity;
+    return ret;
 }
 
 int hash_del(struct hash *h, const char *key)
@@ -264,9 +638,8 @@ int hash_del(struct hash *h, const char *key)
     uint32_t hash = 0;
     struct hash_item *hi = hash_lookup(h, key, &hash);
     if (hi) {
-        hlist_del((struct hlist_node *)hi);
         free(hi->key);
-        free(hi);
+        table_erase((struct hash_table *)h->opaque_list, hi);
         return 0;
     }
 
@@ -275,9 +648,12 @@ int hash_del(struct hash *h, const char *key)
 
 int hash_del32(struct hash *h, uint32_t key)
 {
-    char key_str[HASH_MAX_KEY_STRLEN];
-    snprintf(key_str, sizeof(key_str), "%" PRIu32, key);
-    return hash_del(h, key_str);
+    struct hash_item *hi = hash_lookup32(h, key);
+    if (hi) {
+        table_erase((struct hash_table *)h->opaque_list, hi);
+        return 0;
+    }
+    return -1;
 }
 
 void *hash_get_and_del(struct hash *h, const char *key)
@@ -286,9 +662,8 @@ void *hash_get_and_del(struct hash *h, const char *key)
     struct hash_item *hi = hash_lookup(h, key, &hash);
     if (hi) {
         void *val = memdup(hi->val, sizeof(void *));
-        hlist_del((struct hlist_node *)hi);
         free(hi->key);
-        free(hi);
+        table_erase((struct hash_table *)h->opaque_list, hi);
         return val;
     }
     return NULL;
@@ -296,51 +671,382 @@ void *hash_get_and_del(struct hash *h, const char *key)
 
 void *hash_get_and_del32(struct hash *h, uint32_t key)
 {
-    char key_str[HASH_MAX_KEY_STRLEN];
-    snprintf(key_str, sizeof(key_str), "%" PRIu32, key);
-    return hash_get_and_del(h, key_str);
+    struct hash_item *hi = hash_lookup32(h, key);
+    if (hi) {
+        void *val = memdup(hi->val, sizeof(void *));
+        table_erase((struct hash_table *)h->opaque_list, hi);
+        return val;
+    }
+    return NULL;
 }
 
 int hash_get_all_cnt(struct hash *h)
 {
-    struct hlist_head *list;
+    return (int)((struct hash_table *)h->opaque_list)->count;
+}
+
+void hash_dump_all(struct hash *h, int *num, char **key, void **val)
+{
+    size_t i;
+    struct hash_table *t = (struct hash_table *)h->opaque_list;
+    *num = 0;
+
+    for (i = 0; i < t->capacity; i++) {
+        struct hash_item *hi = &t->slots[i];
+        if (t->ctrl[i] < 0) {
+            continue;
+        }
+        if (hi->key) {
+            printf("key:val = %s:%p\n", hi->key, hi->val);
+        } else {
+            printf("key:val = %" PRIu32 ":%p\n", hi->key32, hi->val);
+        }
+        *(key+*num) = hi->key;
+        *(val+*num) = hi->val;
+        (*num)++;
+    }
+}
+
+void hash_iter_init(struct hash *h, struct hash_iter *it)
+{
+    it->table = h->opaque_list;
+    it->pos = 0;
+}
+
+int hash_iter_next(struct hash_iter *it, const char **key, void **val)
+{
+    struct hash_table *t = (struct hash_table *)it->table;
+    while (it->pos < t->capacity) {
+        size_t i = it->pos++;
+        if (t->ctrl[i] < 0) {
+            continue;
+        }
+        *key = t->slots[i].key;
+        *val = t->slots[i].val;
+        return 1;
+    }
+    return 0;
+}
+
+void hash_iter_del(struct hash_iter *it)
+{
+    struct hash_table *t = (struct hash_table *)it->table;
     struct hash_item *hi;
-    struct hlist_node *next;
-    uint32_t i;
-    int num = 0;
-
-    for (i = 0; i < h->bucket - 1; i++) {
-        list = &((struct hlist_head *)h->opaque_list)[i];
-#if defined (OS_LINUX) || defined (OS_RTOS) || defined (ENV_MINGW)
-        hlist_for_each_entry_safe(hi, next, list, item) {
-#elif defined (OS_WINDOWS)
-        hlist_for_each_entry_safe(hi, struct hash_item, next, struct hlist_node, list, item) {
-#endif
-            num++;
+    if (it->pos == 0 || t->ctrl[it->pos - 1] < 0) {
+        return;
+    }
+    /* erase never moves other slots, iteration stays valid */
+    hi = &t->slots[it->pos - 1];
+    free(hi->key);
+    table_erase(t, hi);
+}
+
+static int table_foreach(struct hash_table *t,
+                int (*fn)(const char *key, void *val, void *arg), void *arg)
+{
+    int ret;
+    size_t i;
+    for (i = 0; i < t->capacity; i++) {
+        if (t->ctrl[i] < 0) {
+            continue;
+        }
+        ret = fn(t->slots[i].key, t->slots[i].val, arg);
+        if (ret) {
+            return ret;
         }
     }
-    return num;
+    return 0;
 }
 
-void hash_dump_all(struct hash *h, int *num, char **key, void **val)
+int hash_foreach(struct hash *h, int (*fn)(const char *key, void *val, void *arg), void *arg)
+{
+    return table_foreach((struct hash_table *)h->opaque_list, fn, arg);
+}
+
+/*
+ * striped hash: key hash top bits select one of 2^n stripes, each stripe
+ * is an independent table with its own mutex, so threads touching
+ * different stripes never contend. stripes are padded to cache line.
+ */
+#define HASH_CACHELINE      64
+#define HASH_STRIPES_DEFAULT 16
+
+struct hash_stripe {
+    pthread_mutex_t lock;
+    struct hash_table table;
+    char pad[HASH_CACHELINE];
+};
+
+struct hash_striped {
+    int bits;
+    int nstripe;
+    void (*destory)(void *val);
+    struct hash_stripe *stripes;
+};
+
+static inline struct hash_stripe *stripe_of(struct hash_striped *h, uint32_t hash)
+{
+    return &h->stripes[h->bits ? hash >> (32 - h->bits) : 0];
+}
+
+struct hash_striped *hash_striped_create(int bucket, int stripes)
+{
+    int i;
+    size_t per;
+    struct hash_striped *h = (struct hash_striped *)calloc(1, sizeof(*h));
+    if (!h) {
+        printf("malloc hash_striped failed!\n");
+        return NULL;
+    }
+    if (stripes <= 0) {
+        stripes = HASH_STRIPES_DEFAULT;
+    }
+    h->nstripe = 1;
+    while (h->nstripe < stripes && h->bits < 16) {
+        h->nstripe <<= 1;
+        h->bits++;
+    }
+    h->stripes = (struct hash_stripe *)calloc(h->nstripe, sizeof(struct hash_stripe));
+    if (!h->stripes) {
+        printf("malloc hash_stripe failed!\n");
+        free(h);
+        return NULL;
+    }
+    per = bucket > 0 ? (size_t)bucket / h->nstripe : 0;
+    for (i = 0; i < h->nstripe; i++) {
+        if (0 != table_init(&h->stripes[i].table, per)) {
+            while (--i >= 0) {
+                table_deinit(&h->stripes[i].table, NULL);
+                pthread_mutex_destroy(&h->stripes[i].lock);
+            }
+            free(h->stripes);
+            free(h);
+            return NULL;
+        }
+        pthread_mutex_init(&h->stripes[i].lock, NULL);
+    }
+    return h;
+}
+
+void hash_striped_destroy(struct hash_striped *h)
+{
+    int i;
+    if (!h) {
+        return;
+    }
+    for (i = 0; i < h->nstripe; i++) {
+        table_deinit(&h->stripes[i].table, h->destory);
+        pthread_mutex_destroy(&h->stripes[i].lock);
+    }
+    free(h->stripes);
+    free(h);
+}
+
+void hash_striped_set_destory(struct hash_striped *h, void (*destory)(void *val))
+{
+    h->destory = destory;
+}
+
+void *hash_striped_get(struct hash_striped *h, const char *key)
 {
-    struct hlist_head *list;
+    void *val = NULL;
     struct hash_item *hi;
-    struct hlist_node *next;
-    uint32_t i;
-    *num = 0;
+    uint32_t hash = hash_gen32(key, strlen(key));
+    struct hash_stripe *st = stripe_of(h, hash);
 
-    for (i = 0; i < h->bucket - 1; i++) {
-        list = &((struct hlist_head *)h->opaque_list)[i];
-#if defined (OS_LINUX) || defined (OS_RTOS) || defined (ENV_MINGW)
-        hlist_for_each_entry_safe(hi, next, list, item) {
-#elif defined (OS_WINDOWS)
-        hlist_for_each_entry_safe(hi, struct hash_item, next, struct hlist_node, list, item) {
-#endif
-            printf("key:val = %s:%p\n", hi->key, hi->val);
-            *(key+*num) = hi->key;
-            *(val+*num) = hi->val;
-            (*num)++;
+    pthread_mutex_lock(&st->lock);
+    hi = table_find(&st->table, key, 0, hash);
+    if (hi) {
+        val = hi->val;
+    }
+    pthread_mutex_unlock(&st->lock);
+    return val;
+}
+
+int hash_striped_set(struct hash_striped *h, const char *key, void *val)
+{
+    int ret = 0;
+    struct hash_item *hi;
+    uint32_t hash = hash_gen32(key, strlen(key));
+    struct hash_stripe *st = stripe_of(h, hash);
+
+    pthread_mutex_lock(&st->lock);
+    hi = table_find(&st->table, key, 0, hash);
+    if (hi) {
+        hi->val = val;
+    } else {
+        ret = table_insert(&st->table, key, 0, hash, val);
+    }
+    pthread_mutex_unlock(&st->lock);
+    return ret;
+}
+
+void *hash_striped_set_nx(struct hash_striped *h, const char *key, void *val)
+{
+    void *old = NULL;
+    struct hash_item *hi;
+    uint32_t hash = hash_gen32(key, strlen(key));
+    struct hash_stripe *st = stripe_of(h, hash);
+
+    pthread_mutex_lock(&st->lock);
+    hi = table_find(&st->table, key, 0, hash);
+    if (hi) {
+        old = hi->val;
+    } else {
+        table_insert(&st->table, key, 0, hash, val);
+    }
+    pthread_mutex_unlock(&st->lock);
+    return old;
+}
+
+void *hash_striped_update(struct hash_striped *h, const char *key,
+                void *(*fn)(void *old, void *arg), void *arg)
+{
+    void *val;
+    struct hash_item *hi;
+    uint32_t hash = hash_gen32(key, strlen(key));
+    struct hash_stripe *st = stripe_of(h, hash);
+
+    pthread_mutex_lock(&st->lock);
+    hi = table_find(&st->table, key, 0, hash);
+    val = fn(hi ? hi->val : NULL, arg);
+    if (hi && val) {
+        hi->val = val;
+    } else if (hi) {
+        free(hi->key);
+        table_erase(&st->table, hi);
+    } else if (val) {
+        if (0 != table_insert(&st->table, key, 0, hash, val)) {
+            val = NULL;
         }
     }
+    pthread_mutex_unlock(&st->lock);
+    return val;
+}
+
+void *hash_striped_get_and_del(struct hash_striped *h, const char *key)
+{
+    void *val = NULL;
+    struct hash_item *hi;
+    uint32_t hash = hash_gen32(key, strlen(key));
+    struct hash_stripe *st = stripe_of(h, hash);
+
+    pthread_mutex_lock(&st->lock);
+    hi = table_find(&st->table, key, 0, hash);
+    if (hi) {
+        val = hi->val;
+        free(hi->key);
+        table_erase(&st->table, hi);
+    }
+    pthread_mutex_unlock(&st->lock);
+    return val;
+}
+
+int hash_striped_del(struct hash_striped *h, const char *key)
+{
+    int ret = -1;
+    struct hash_item *hi;
+    uint32_t hash = hash_gen32(key, strlen(key));
+    struct hash_stripe *st = stripe_of(h, hash);
+
+    pthread_mutex_lock(&st->lock);
+    hi = table_find(&st->table, key, 0, hash);
+    if (hi) {
+        free(hi->key);
+        table_erase(&st->table, hi);
+        ret = 0;
+    }
+    pthread_mutex_unlock(&st->lock);
+    return ret;
+}
+
+void *hash_striped_get32(struct hash_striped *h, uint32_t key)
+{
+    void *val = NULL;
+    struct hash_item *hi;
+    uint32_t hash = hash_mix32(key);
+    struct hash_stripe *st = stripe_of(h, hash);
+
+    pthread_mutex_lock(&st->lock);
+    hi = table_find(&st->table, NULL, key, hash);
+    if (hi) {
+        val = hi->val;
+    }
+    pthread_mutex_unlock(&st->lock);
+    return val;
+}
+
+int hash_striped_set32(struct hash_striped *h, uint32_t key, void *val)
+{
+    int ret = 0;
+    struct hash_item *hi;
+    uint32_t hash = hash_mix32(key);
+    struct hash_stripe *st = stripe_of(h, hash);
+
+    pthread_mutex_lock(&st->lock);
+    hi = table_find(&st->table, NULL, key, hash);
+    if (hi) {
+        hi->val = val;
+    } else {
+        ret = table_insert(&st->table, NULL, key, hash, val);
+    }
+    pthread_mutex_unlock(&st->lock);
+    return ret;
+}
+
+void *hash_striped_get_and_del32(struct hash_striped *h, uint32_t key)
+{
+    void *val = NULL;
+    struct hash_item *hi;
+    uint32_t hash = hash_mix32(key);
+    struct hash_stripe *st = stripe_of(h, hash);
+
+    pthread_mutex_lock(&st->lock);
+    hi = table_find(&st->table, NULL, key, hash);
+    if (hi) {
+        val = hi->val;
+        table_erase(&st->table, hi);
+    }
+    pthread_mutex_unlock(&st->lock);
+    return val;
+}
+
+int hash_striped_del32(struct hash_striped *h, uint32_t key)
+{
+    int ret = -1;
+    struct hash_item *hi;
+    uint32_t hash = hash_mix32(key);
+    struct hash_stripe *st = stripe_of(h, hash);
+
+    pthread_mutex_lock(&st->lock);
+    hi = table_find(&st->table, NULL, key, hash);
+    if (hi) {
+        table_erase(&st->table, hi);
+        ret = 0;
+    }
+    pthread_mutex_unlock(&st->lock);
+    return ret;
+}
+
+int hash_striped_get_all_cnt(struct hash_striped *h)
+{
+    int i, cnt = 0;
+    for (i = 0; i < h->nstripe; i++) {
+        pthread_mutex_lock(&h->stripes[i].lock);
+        cnt += (int)h->stripes[i].table.count;
+        pthread_mutex_unlock(&h->stripes[i].lock);
+    }
+    return cnt;
+}
+
+int hash_striped_foreach(struct hash_striped *h,
+                int (*fn)(const char *key, void *val, void *arg), void *arg)
+{
+    int i, ret = 0;
+    for (i = 0; i < h->nstripe && !ret; i++) {
+        pthread_mutex_lock(&h->stripes[i].lock);
+        ret = table_foreach(&h->stripes[i].table, fn, arg);
+        pthread_mutex_unlock(&h->stripes[i].lock);
+    }
+    return ret;
 }
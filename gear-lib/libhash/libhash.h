@@ -42,6 +42,12 @@ void hash_destroy(struct hash *h);
 void hash_set_destory(struct hash *h, void (*destory)(void *val));
 
 uint32_t hash_gen32(const char *key, size_t len);
+/* 64 bit wyhash behind hash_gen32, for callers keying their own tables */
+uint64_t hash_wy64(const void *key, size_t len, uint64_t seed);
+/*
+ * *32 APIs keep u32 key inline without allocation, it never matches a
+ * string key, iteration and hash_dump_all report it with key NULL
+ */
 void *hash_get(struct hash *h, const char *key);
 void *hash_get32(struct hash *h, uint32_t key);
 int hash_set(struct hash *h, const char *key, void *val);
@@ -53,6 +59,53 @@ void *hash_get_and_del32(struct hash *h, uint32_t key);
 void hash_dump_all(struct hash *h, int *num, char **key, void **val);
 int hash_get_all_cnt(struct hash *h);
 
+/*
+ * iterate in place without allocation, current item can be deleted by
+ * hash_iter_del, other changes during iteration are undefined
+ */
+struct hash_iter {
+    void *table;
+    size_t pos;
+};
+
+void hash_iter_init(struct hash *h, struct hash_iter *it);
+int hash_iter_next(struct hash_iter *it, const char **key, void **val);
+void hash_iter_del(struct hash_iter *it);
+/* fn return non zero to stop, return the value, or 0 when all visited */
+int hash_foreach(struct hash *h, int (*fn)(const char *key, void *val, void *arg), void *arg);
+
+#define hash_for_each(h, it, key, val) \
+    for (hash_iter_init(h, &(it)); hash_iter_next(&(it), &(key), &(val));)
+
+/*
+ * thread safe hash, keys are spread over lock striped sub tables.
+ * value returned by get is not protected after return, use update
+ * for read-modify-write under stripe lock.
+ */
+struct hash_striped;
+
+struct hash_striped *hash_striped_create(int bucket, int stripes);
+void hash_striped_destroy(struct hash_striped *h);
+void hash_striped_set_destory(struct hash_striped *h, void (*destory)(void *val));
+void *hash_striped_get(struct hash_striped *h, const char *key);
+int hash_striped_set(struct hash_striped *h, const char *key, void *val);
+/* insert if key absent, return existing value or NULL if inserted */
+void *hash_striped_set_nx(struct hash_striped *h, const char *key, void *val);
+/* store fn(old, arg), old is NULL if absent, returning NULL deletes key */
+void *hash_striped_update(struct hash_striped *h, const char *key,
+                void *(*fn)(void *old, void *arg), void *arg);
+int hash_striped_del(struct hash_striped *h, const char *key);
+void *hash_striped_get_and_del(struct hash_striped *h, const char *key);
+/* u32 keys inline like hash_set32, get_and_del32 returns the stored value */
+void *hash_striped_get32(struct hash_striped *h, uint32_t key);
+int hash_striped_set32(struct hash_striped *h, uint32_t key, void *val);
+int hash_striped_del32(struct hash_striped *h, uint32_t key);
+void *hash_striped_get_and_del32(struct hash_striped *h, uint32_t key);
+int hash_striped_get_all_cnt(struct hash_striped *h);
+/* fn runs with stripe lock held, must not call back into h */
+int hash_striped_foreach(struct hash_striped *h,
+                int (*fn)(const char *key, void *val, void *arg), void *arg);
+
 #ifdef __cplusplus
 }
 #endif
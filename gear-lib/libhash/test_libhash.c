@@ -24,6 +24,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/time.h>
+#include <pthread.h>
+#include <inttypes.h>
 
 #define PALIGN   "%15s: %6.4f sec\n"
 //#define NKEYS   1024*1024
@@ -36,6 +38,223 @@ static double epoch_double(void)
     return t.tv_sec + (t.tv_usec * 1.0) / 1000000.0;
 }
 
+static int foo_probe(int n)
+{
+    int i, err = 0;
+    char key[16];
+    /* small table to go through growth, tombstones and reuse */
+    struct hash *h = hash_create(4);
+    for (i = 0; i < n; i++) {
+        snprintf(key, sizeof(key), "k%d", i);
+        hash_set(h, key, (void *)(intptr_t)(i + 1));
+    }
+    for (i = 0; i < n; i += 2) {
+        snprintf(key, sizeof(key), "k%d", i);
+        hash_del(h, key);
+    }
+    for (i = 0; i < n; i++) {
+        snprintf(key, sizeof(key), "k%d", i);
+        void *v = hash_get(h, key);
+        if ((i % 2 == 0 && v) || (i % 2 == 1 && v != (void *)(intptr_t)(i + 1))) {
+            err++;
+        }
+    }
+    for (i = 0; i < n; i += 2) {
+        snprintf(key, sizeof(key), "k%d", i);
+        hash_set(h, key, (void *)(intptr_t)(i + 1));
+    }
+    if (hash_get_all_cnt(h) != n) {
+        err++;
+    }
+    {
+        /* iterate and drop odd keys in place */
+        struct hash_iter it;
+        const char *k;
+        void *v;
+        int visit = 0;
+        hash_for_each(h, it, k, v) {
+            visit++;
+            if ((intptr_t)v % 2 == 0) {
+                hash_iter_del(&it);
+            }
+        }
+        if (visit != n || hash_get_all_cnt(h) != (n + 1) / 2) {
+            err++;
+        }
+    }
+    printf("%15s: %d keys, bucket %d, %d error\n", "probe", n, h->bucket, err);
+    hash_destroy(h);
+    return err;
+}
+
+static int foo_u32(int n)
+{
+    int i, err = 0, nul = 0;
+    struct hash_iter it;
+    const char *k;
+    void *v;
+    struct hash *h = hash_create(4);
+    for (i = 0; i < n; i++) {
+        hash_set32(h, i, (void *)(intptr_t)(i + 1));
+    }
+    /* same digits as string key is another entry */
+    hash_set(h, "1", (void *)(intptr_t)-1);
+    for (i = 0; i < n; i += 2) {
+        hash_del32(h, i);
+    }
+    for (i = 0; i < n; i++) {
+        v = hash_get32(h, i);
+        if ((i % 2 == 0 && v) || (i % 2 == 1 && v != (void *)(intptr_t)(i + 1))) {
+            err++;
+        }
+    }
+    if (hash_get(h, "1") != (void *)(intptr_t)-1 ||
+        hash_get_all_cnt(h) != n / 2 + 1) {
+        err++;
+    }
+    hash_for_each(h, it, k, v) {
+        nul += (k == NULL);
+    }
+    if (nul != n / 2) {
+        err++;
+    }
+    printf("%15s: %d keys, bucket %d, %d error\n", "u32", n, h->bucket, err);
+    hash_destroy(h);
+    return err;
+}
+
+#define STRIPED_THREADS 4
+#define STRIPED_KEYS    512
+#define STRIPED_LOOPS   20000
+
+static void *counter_inc(void *old, void *arg)
+{
+    return (void *)((intptr_t)old + 1);
+}
+
+static void *striped_worker(void *arg)
+{
+    int i;
+    char key[16];
+    struct hash_striped *h = (struct hash_striped *)arg;
+    for (i = 0; i < STRIPED_LOOPS; i++) {
+        snprintf(key, sizeof(key), "c%d", i % STRIPED_KEYS);
+        hash_striped_update(h, key, counter_inc, NULL);
+    }
+    return NULL;
+}
+
+struct striped_arg32 {
+    struct hash_striped *h;
+    uint32_t base;
+    int err;
+};
+
+/* each thread owns its key range, keys of all threads share stripes */
+static void *striped_worker32(void *arg)
+{
+    uint32_t i;
+    struct striped_arg32 *a = (struct striped_arg32 *)arg;
+    for (i = a->base; i < a->base + STRIPED_KEYS; i++) {
+        hash_striped_set32(a->h, i, (void *)(uintptr_t)(i + 1));
+    }
+    for (i = a->base; i < a->base + STRIPED_KEYS; i++) {
+        if (hash_striped_get32(a->h, i) != (void *)(uintptr_t)(i + 1)) {
+            a->err++;
+        }
+        if (i & 1) {
+            if (hash_striped_get_and_del32(a->h, i) != (void *)(uintptr_t)(i + 1)) {
+                a->err++;
+            }
+        } else if (0 != hash_striped_del32(a->h, i)) {
+            a->err++;
+        }
+        if (hash_striped_get32(a->h, i) != NULL) {
+            a->err++;
+        }
+        if (i % 4 == 0) {
+            hash_striped_set32(a->h, i, (void *)(uintptr_t)i);
+        }
+    }
+    return NULL;
+}
+
+static int foo_striped32(void)
+{
+    int i, err = 0;
+    pthread_t tid[STRIPED_THREADS];
+    struct striped_arg32 args[STRIPED_THREADS];
+    struct hash_striped *h = hash_striped_create(64, 8);
+
+    for (i = 0; i < STRIPED_THREADS; i++) {
+        args[i].h = h;
+        args[i].base = (uint32_t)i * STRIPED_KEYS;
+        args[i].err = 0;
+        pthread_create(&tid[i], NULL, striped_worker32, &args[i]);
+    }
+    for (i = 0; i < STRIPED_THREADS; i++) {
+        pthread_join(tid[i], NULL);
+        err += args[i].err;
+    }
+    if (hash_striped_get_all_cnt(h) != STRIPED_THREADS * STRIPED_KEYS / 4 ||
+        hash_striped_del32(h, 1) != -1) {
+        err++;
+    }
+    printf("%15s: %d threads, %d keys left, %d error\n", "striped32",
+           STRIPED_THREADS, hash_striped_get_all_cnt(h), err);
+    hash_striped_destroy(h);
+    return err;
+}
+
+static int foo_striped(void)
+{
+    int i, err = 0;
+    intptr_t total = 0;
+    char key[16];
+    pthread_t tid[STRIPED_THREADS];
+    struct hash_striped *h = hash_striped_create(64, 8);
+
+    for (i = 0; i < STRIPED_THREADS; i++) {
+        pthread_create(&tid[i], NULL, striped_worker, h);
+    }
+    for (i = 0; i < STRIPED_THREADS; i++) {
+        pthread_join(tid[i], NULL);
+    }
+    for (i = 0; i < STRIPED_KEYS; i++) {
+        snprintf(key, sizeof(key), "c%d", i);
+        total += (intptr_t)hash_striped_get(h, key);
+    }
+    if (total != STRIPED_THREADS * STRIPED_LOOPS ||
+        hash_striped_get_all_cnt(h) != STRIPED_KEYS) {
+        err++;
+    }
+    if (hash_striped_set_nx(h, "c0", (void *)1) == NULL) {
+        err++;
+    }
+    hash_striped_del(h, "c0");
+    if (hash_striped_set_nx(h, "c0", (void *)1) != NULL ||
+        hash_striped_get_and_del(h, "c0") != (void *)1) {
+        err++;
+    }
+    printf("%15s: %d threads, total %d, %d error\n", "striped",
+           STRIPED_THREADS, (int)total, err);
+    hash_striped_destroy(h);
+    return err;
+}
+
+/* fixed vector, libhash and libdict must agree on it */
+static int foo_wy64(void)
+{
+    int err = 0;
+    uint64_t h = hash_wy64("gear-lib", 8, 0);
+    if (h != 0x9d020be227ab4dfeULL || hash_wy64("", 0, 0) != 0x409638ee2bde459ULL ||
+        hash_wy64("gear-lib", 8, 1) == h) {
+        err++;
+    }
+    printf("%15s: %016" PRIx64 ", %d error\n", "wy64", h, err);
+    return err;
+}
+
 int main(int argc, char * argv[])
 {
     struct hash * d;
@@ -123,6 +342,11 @@ int main(int argc, char * argv[])
     printf(PALIGN, "free", t2 - t1);
 
     free(buffer);
+    foo_probe(nkeys);
+    foo_u32(nkeys);
+    foo_striped();
+    foo_striped32();
+    foo_wy64();
     return 0 ;
 
 }
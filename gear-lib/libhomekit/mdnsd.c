@@ -0,0 +1,850 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <libgevent.h>
+
+#include "mdnsd.h"
+
+#define MDNS_PORT               5353
+#define MDNS_GROUP              0xE00000FBU     /* 224.0.0.251 */
+#define MDNS_PKT_SIZE           1500
+#define MDNS_NAME_SIZE          256
+#define MDNS_MAX_ADDRS          4
+#define MDNS_MAX_RR             (RR_IDX_A + MDNS_MAX_ADDRS)
+#define MDNS_PKT_CACHE          4
+#define MDNS_RECV_BUDGET        16
+#define MDNS_ADDR_CHECK_MS      5000
+#define MDNS_ANNOUNCE_DELAY_MS  100
+#define MDNS_ANNOUNCE_COUNT     2
+
+#define RR_A            1
+#define RR_PTR          12
+#define RR_TXT          16
+#define RR_SRV          33
+#define RR_ANY          255
+#define CLASS_IN        1
+#define CLASS_FLUSH     0x8000
+#define QU_BIT          0x8000
+
+/* records of a service, A records of the host follow */
+enum {
+    RR_IDX_BROWSE = 0,
+    RR_IDX_PTR,
+    RR_IDX_SRV,
+    RR_IDX_TXT,
+    RR_IDX_A,
+};
+
+#define RR_BIT(i)       (1U << (i))
+#define RR_A_BITS(s)    (((1U << (s)->nrr) - 1) & ~(RR_BIT(RR_IDX_A) - 1))
+
+/* wire is the whole uncompressed record, name type class ttl rdlen rdata */
+struct mdnsd_rr {
+    uint16_t type;
+    uint32_t ttl;
+    uint8_t *wire;
+    size_t len;
+    size_t name_len;
+    uint64_t last_mcast;
+};
+
+/* multicast response for an answer/additional record set */
+struct mdnsd_pkt {
+    uint32_t amask;
+    uint32_t xmask;
+    uint8_t *buf;
+    size_t len;
+};
+
+struct mdnsd_service {
+    bool used;
+    bool dirty;
+    char instance[64];
+    char service[32];
+    char proto[8];
+    uint16_t port;
+    char txt_key[MDNSD_MAX_TXT][16];
+    char txt_val[MDNSD_MAX_TXT][128];
+    int ntxt;
+    struct mdnsd_rr rr[MDNS_MAX_RR];
+    int nrr;
+    struct mdnsd_pkt cache[MDNS_PKT_CACHE];
+    int cache_next;
+};
+
+static struct {
+    pthread_mutex_t lock;
+    bool running;
+    int fd;
+    struct gevent_base *evbase;
+    struct gevent *ev;
+    struct gevent_wtimer announce;
+    struct gevent_wtimer addr_check;
+    int announce_left;
+    char hostname[64];
+    struct in_addr addrs[MDNS_MAX_ADDRS];
+    int naddrs;
+    struct mdnsd_service svc[MDNSD_MAX_SERVICES];
+    struct mdnsd_stats stats;
+} mdnsd = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .fd = -1,
+};
+
+
+static uint64_t mdnsd_now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+/* dotted name to uncompressed wire labels */
+static int name_make(uint8_t *out, size_t cap, const char *name) {
+    size_t o = 0;
+    const char *p = name;
+
+    while (*p) {
+        const char *dot = strchr(p, '.');
+        size_t l = dot ? (size_t)(dot - p) : strlen(p);
+        if (l == 0 || l > 63 || o + 1 + l + 1 > cap)
+            return -1;
+        out[o++] = l;
+        memcpy(out + o, p, l);
+        o += l;
+        p += l;
+        if (*p == '.')
+            p++;
+    }
+    if (o + 1 > cap)
+        return -1;
+    out[o++] = 0;
+    return o;
+}
+
+
+/* read a possibly compressed name at *off into uncompressed wire labels */
+static int name_read(const uint8_t *pkt, size_t len, size_t *off, uint8_t *out, size_t cap) {
+    size_t pos = *off, o = 0;
+    bool jumped = false;
+    int jumps = 0;
+
+    while (true) {
+        if (pos >= len)
+            return -1;
+        uint8_t l = pkt[pos];
+        if ((l & 0xc0) == 0xc0) {
+            if (pos + 1 >= len || ++jumps > 16)
+                return -1;
+            if (!jumped)
+                *off = pos + 2;
+            jumped = true;
+            pos = ((l & 0x3f) << 8) | pkt[pos + 1];
+            continue;
+        }
+        if (l & 0xc0)
+            return -1;
+        if (pos + 1 + l > len || o + 1 + l > cap)
+            return -1;
+        memcpy(out + o, pkt + pos, 1 + l);
+        o += 1 + l;
+        pos += 1 + l;
+        if (l == 0)
+            break;
+    }
+    if (!jumped)
+        *off = pos;
+    return o;
+}
+
+
+static bool name_equal(const uint8_t *a, const uint8_t *b) {
+    while (*a == *b) {
+        int l = *a;
+        if (l == 0)
+            return true;
+        for (int i = 1; i <= l; i++) {
+            if (tolower(a[i]) != tolower(b[i]))
+                return false;
+        }
+        a += l + 1;
+        b += l + 1;
+    }
+    return false;
+}
+
+
+static inline void put16(uint8_t *p, uint16_t v) {
+    p[0] = v >> 8;
+    p[1] = v & 0xff;
+}
+
+
+static inline uint16_t get16(const uint8_t *p) {
+    return (p[0] << 8) | p[1];
+}
+
+
+static int rr_set(struct mdnsd_rr *rr, const char *name, uint16_t type, uint16_t cls,
+                  uint32_t ttl, const uint8_t *rdata, size_t rdlen) {
+    uint8_t wname[MDNS_NAME_SIZE];
+    int n = name_make(wname, sizeof(wname), name);
+    if (n < 0)
+        return -1;
+
+    rr->wire = malloc(n + 10 + rdlen);
+    if (!rr->wire)
+        return -1;
+    memcpy(rr->wire, wname, n);
+    uint8_t *p = rr->wire + n;
+    put16(p, type);
+    put16(p + 2, cls);
+    put16(p + 4, ttl >> 16);
+    put16(p + 6, ttl & 0xffff);
+    put16(p + 8, rdlen);
+    memcpy(p + 10, rdata, rdlen);
+
+    rr->type = type;
+    rr->ttl = ttl;
+    rr->name_len = n;
+    rr->len = n + 10 + rdlen;
+    rr->last_mcast = 0;
+    return 0;
+}
+
+
+static void service_clear(struct mdnsd_service *s) {
+    for (int i = 0; i < s->nrr; i++) {
+        free(s->rr[i].wire);
+        s->rr[i].wire = NULL;
+    }
+    s->nrr = 0;
+    for (int i = 0; i < MDNS_PKT_CACHE; i++) {
+        free(s->cache[i].buf);
+        memset(&s->cache[i], 0, sizeof(s->cache[i]));
+    }
+    s->cache_next = 0;
+}
+
+
+static int service_build(struct mdnsd_service *s) {
+    char type[MDNS_NAME_SIZE], inst[MDNS_NAME_SIZE], host[MDNS_NAME_SIZE];
+    uint8_t rdata[MDNS_PKT_SIZE];
+    size_t o = 0;
+    int n;
+
+    service_clear(s);
+    s->dirty = false;
+
+    snprintf(type, sizeof(type), "%s.%s.local", s->service, s->proto);
+    snprintf(inst, sizeof(inst), "%s.%s", s->instance, type);
+    snprintf(host, sizeof(host), "%s.local", mdnsd.hostname[0] ? mdnsd.hostname : s->instance);
+
+    n = name_make(rdata, sizeof(rdata), type);
+    if (n < 0 || rr_set(&s->rr[RR_IDX_BROWSE], "_services._dns-sd._udp.local",
+                        RR_PTR, CLASS_IN, MDNSD_TTL, rdata, n))
+        goto fail;
+    s->nrr++;
+
+    n = name_make(rdata, sizeof(rdata), inst);
+    if (n < 0 || rr_set(&s->rr[RR_IDX_PTR], type, RR_PTR, CLASS_IN, MDNSD_TTL, rdata, n))
+        goto fail;
+    s->nrr++;
+
+    put16(rdata, 0);
+    put16(rdata + 2, 0);
+    put16(rdata + 4, s->port);
+    n = name_make(rdata + 6, sizeof(rdata) - 6, host);
+    if (n < 0 || rr_set(&s->rr[RR_IDX_SRV], inst, RR_SRV, CLASS_IN | CLASS_FLUSH,
+                        MDNSD_HOST_TTL, rdata, n + 6))
+        goto fail;
+    s->nrr++;
+
+    for (int i = 0; i < s->ntxt; i++) {
+        n = snprintf((char *)rdata + o + 1, sizeof(rdata) - o - 1, "%s=%s",
+                     s->txt_key[i], s->txt_val[i]);
+        if (n > 255 || o + 1 + n >= sizeof(rdata))
+            goto fail;
+        rdata[o] = n;
+        o += 1 + n;
+    }
+    if (o == 0)
+        rdata[o++] = 0;
+    if (rr_set(&s->rr[RR_IDX_TXT], inst, RR_TXT, CLASS_IN | CLASS_FLUSH, MDNSD_TTL, rdata, o))
+        goto fail;
+    s->nrr++;
+
+    for (int i = 0; i < mdnsd.naddrs; i++) {
+        if (rr_set(&s->rr[RR_IDX_A + i], host, RR_A, CLASS_IN | CLASS_FLUSH, MDNSD_HOST_TTL,
+                   (const uint8_t *)&mdnsd.addrs[i], 4))
+            goto fail;
+        s->nrr++;
+    }
+    return 0;
+
+fail:
+    printf("mdnsd: failed to build records of %s\n", inst);
+    service_clear(s);
+    return -1;
+}
+
+
+static struct mdnsd_service *service_find(const char *service, const char *proto) {
+    for (int i = 0; i < MDNSD_MAX_SERVICES; i++) {
+        struct mdnsd_service *s = &mdnsd.svc[i];
+        if (s->used && !strcmp(s->service, service) && !strcmp(s->proto, proto))
+            return s;
+    }
+    return NULL;
+}
+
+
+/* known answer matches our record with at least half of its ttl left */
+static bool rr_known(const struct mdnsd_rr *rr, const uint8_t *name, uint16_t type,
+                     uint32_t ttl, const uint8_t *rdata, size_t rdlen) {
+    const uint8_t *our = rr->wire + rr->name_len + 10;
+    size_t our_len = rr->len - rr->name_len - 10;
+
+    if (rr->type != type || ttl < rr->ttl / 2 || rdlen != our_len)
+        return false;
+    if (!name_equal(rr->wire, name))
+        return false;
+    switch (type) {
+    case RR_PTR:
+        return name_equal(our, rdata);
+    case RR_SRV:
+        return !memcmp(our, rdata, 6) && name_equal(our + 6, rdata + 6);
+    default:
+        return !memcmp(our, rdata, rdlen);
+    }
+}
+
+
+static size_t pkt_build(uint8_t *buf, size_t cap, uint16_t id,
+                        const uint8_t *question, size_t qlen, uint16_t qd,
+                        const uint32_t *amask, const uint32_t *xmask) {
+    uint16_t an = 0, ar = 0;
+    size_t o = 12;
+
+    memset(buf, 0, 12);
+    put16(buf, id);
+    put16(buf + 2, 0x8400);
+    if (qlen && qlen <= cap - o) {
+        memcpy(buf + o, question, qlen);
+        o += qlen;
+        put16(buf + 4, qd);
+    }
+    for (int pass = 0; pass < 2; pass++) {
+        const uint32_t *mask = pass ? xmask : amask;
+        for (int i = 0; i < MDNSD_MAX_SERVICES; i++) {
+            struct mdnsd_service *s = &mdnsd.svc[i];
+            for (int j = 0; j < s->nrr; j++) {
+                if (!(mask[i] & RR_BIT(j)) || o + s->rr[j].len > cap)
+                    continue;
+                memcpy(buf + o, s->rr[j].wire, s->rr[j].len);
+                o += s->rr[j].len;
+                if (pass)
+                    ar++;
+                else
+                    an++;
+            }
+        }
+    }
+    put16(buf + 6, an);
+    put16(buf + 10, ar);
+    return o;
+}
+
+
+/* cached multicast packet of a single service, built on first use */
+static struct mdnsd_pkt *pkt_cached(int idx, const uint32_t *amask, const uint32_t *xmask) {
+    struct mdnsd_service *s = &mdnsd.svc[idx];
+    uint8_t buf[MDNS_PKT_SIZE];
+
+    for (int i = 0; i < MDNS_PKT_CACHE; i++) {
+        struct mdnsd_pkt *p = &s->cache[i];
+        if (p->buf && p->amask == amask[idx] && p->xmask == xmask[idx]) {
+            mdnsd.stats.cache_hits++;
+            return p;
+        }
+    }
+
+    struct mdnsd_pkt *p = &s->cache[s->cache_next];
+    size_t len = pkt_build(buf, sizeof(buf), 0, NULL, 0, 0, amask, xmask);
+    uint8_t *copy = malloc(len);
+    if (!copy)
+        return NULL;
+    memcpy(copy, buf, len);
+    free(p->buf);
+    p->buf = copy;
+    p->len = len;
+    p->amask = amask[idx];
+    p->xmask = xmask[idx];
+    s->cache_next = (s->cache_next + 1) % MDNS_PKT_CACHE;
+    return p;
+}
+
+
+static void mdnsd_send(const uint8_t *buf, size_t len, const struct sockaddr_in *to) {
+    if (sendto(mdnsd.fd, buf, len, 0, (const struct sockaddr *)to, sizeof(*to)) < 0)
+        printf("mdnsd: sendto failed: %s\n", strerror(errno));
+    else
+        mdnsd.stats.responses++;
+}
+
+
+static void mdnsd_send_masks(uint16_t id, const uint8_t *question, size_t qlen, uint16_t qd,
+                             const uint32_t *amask, const uint32_t *xmask,
+                             const struct sockaddr_in *to) {
+    uint8_t buf[MDNS_PKT_SIZE];
+    int only = -1, nsvc = 0;
+
+    for (int i = 0; i < MDNSD_MAX_SERVICES; i++) {
+        if (amask[i] | xmask[i]) {
+            only = i;
+            nsvc++;
+        }
+    }
+    if (nsvc == 1 && qlen == 0 && id == 0) {
+        struct mdnsd_pkt *p = pkt_cached(only, amask, xmask);
+        if (p) {
+            mdnsd_send(p->buf, p->len, to);
+            return;
+        }
+    }
+    size_t len = pkt_build(buf, sizeof(buf), id, question, qlen, qd, amask, xmask);
+    mdnsd_send(buf, len, to);
+}
+
+
+static void mdnsd_multicast_addr(struct sockaddr_in *addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_addr.s_addr = htonl(MDNS_GROUP);
+    addr->sin_port = htons(MDNS_PORT);
+}
+
+
+static void mdnsd_on_query(const uint8_t *pkt, size_t len, const struct sockaddr_in *from) {
+    uint32_t amask[MDNSD_MAX_SERVICES] = {0};
+    uint32_t xmask[MDNSD_MAX_SERVICES] = {0};
+    uint32_t known[MDNSD_MAX_SERVICES] = {0};
+    uint8_t name[MDNS_NAME_SIZE], rdata[MDNS_PKT_SIZE];
+    bool legacy = ntohs(from->sin_port) != MDNS_PORT;
+    bool unicast = true;
+    size_t off = 12, qend;
+    bool any = false;
+
+    if (len < 12)
+        return;
+    uint16_t id = get16(pkt);
+    uint16_t flags = get16(pkt + 2);
+    uint16_t qd = get16(pkt + 4);
+    uint16_t an = get16(pkt + 6);
+    // responses and non standard queries are none of our business
+    if ((flags & 0x8000) || (flags & 0x7800) || qd == 0)
+        return;
+
+    mdnsd.stats.queries++;
+
+    for (int q = 0; q < qd; q++) {
+        if (name_read(pkt, len, &off, name, sizeof(name)) < 0 || off + 4 > len)
+            return;
+        uint16_t qtype = get16(pkt + off);
+        uint16_t qclass = get16(pkt + off + 2);
+        off += 4;
+        if (!(qclass & QU_BIT))
+            unicast = false;
+        qclass &= ~QU_BIT;
+        if (qclass != CLASS_IN && qclass != RR_ANY)
+            continue;
+        for (int i = 0; i < MDNSD_MAX_SERVICES; i++) {
+            struct mdnsd_service *s = &mdnsd.svc[i];
+            if (!s->used)
+                continue;
+            if (s->dirty)
+                service_build(s);
+            for (int j = 0; j < s->nrr; j++) {
+                if ((qtype == s->rr[j].type || qtype == RR_ANY) &&
+                    name_equal(s->rr[j].wire, name))
+                    amask[i] |= RR_BIT(j);
+            }
+        }
+    }
+    qend = off;
+
+    for (int a = 0; a < an; a++) {
+        if (name_read(pkt, len, &off, name, sizeof(name)) < 0 || off + 10 > len)
+            return;
+        uint16_t type = get16(pkt + off);
+        uint32_t ttl = ((uint32_t)get16(pkt + off + 4) << 16) | get16(pkt + off + 6);
+        uint16_t rdlen = get16(pkt + off + 8);
+        off += 10;
+        if (off + rdlen > len)
+            return;
+        size_t roff = off;
+        int n = 0;
+        if (type == RR_PTR) {
+            n = name_read(pkt, len, &roff, rdata, sizeof(rdata));
+        } else if (type == RR_SRV && rdlen > 6) {
+            memcpy(rdata, pkt + off, 6);
+            roff += 6;
+            n = name_read(pkt, len, &roff, rdata + 6, sizeof(rdata) - 6);
+            n = n < 0 ? n : n + 6;
+        } else {
+            memcpy(rdata, pkt + off, rdlen);
+            n = rdlen;
+        }
+        off += rdlen;
+        if (n < 0)
+            continue;
+        for (int i = 0; i < MDNSD_MAX_SERVICES; i++) {
+            struct mdnsd_service *s = &mdnsd.svc[i];
+            for (int j = 0; j < s->nrr; j++) {
+                if (amask[i] & RR_BIT(j) &&
+                    rr_known(&s->rr[j], name, type, ttl, rdata, n))
+                    known[i] |= RR_BIT(j);
+            }
+        }
+    }
+
+    uint64_t now = mdnsd_now_ms();
+    for (int i = 0; i < MDNSD_MAX_SERVICES; i++) {
+        struct mdnsd_service *s = &mdnsd.svc[i];
+        if (!amask[i])
+            continue;
+        if (amask[i] & RR_BIT(RR_IDX_PTR))
+            xmask[i] |= RR_BIT(RR_IDX_SRV) | RR_BIT(RR_IDX_TXT) | RR_A_BITS(s);
+        if (amask[i] & RR_BIT(RR_IDX_SRV))
+            xmask[i] |= RR_A_BITS(s);
+        xmask[i] &= ~amask[i];
+
+        mdnsd.stats.suppressed += __builtin_popcount(amask[i] & known[i]);
+        amask[i] &= ~known[i];
+        xmask[i] &= ~known[i];
+
+        if (!legacy && !unicast) {
+            for (int j = 0; j < s->nrr; j++) {
+                if (!((amask[i] | xmask[i]) & RR_BIT(j)) ||
+                    now - s->rr[j].last_mcast >= MDNSD_RATE_LIMIT_MS)
+                    continue;
+                amask[i] &= ~RR_BIT(j);
+                xmask[i] &= ~RR_BIT(j);
+                mdnsd.stats.rate_limited++;
+            }
+        }
+        if (amask[i])
+            any = true;
+        else
+            xmask[i] = 0;
+    }
+    if (!any)
+        return;
+
+    if (legacy) {
+        mdnsd_send_masks(id, pkt + 12, qend - 12, qd, amask, xmask, from);
+    } else if (unicast) {
+        mdnsd_send_masks(0, NULL, 0, 0, amask, xmask, from);
+    } else {
+        struct sockaddr_in group;
+        mdnsd_multicast_addr(&group);
+        for (int i = 0; i < MDNSD_MAX_SERVICES; i++) {
+            for (int j = 0; j < mdnsd.svc[i].nrr; j++) {
+                if ((amask[i] | xmask[i]) & RR_BIT(j))
+                    mdnsd.svc[i].rr[j].last_mcast = now;
+            }
+        }
+        mdnsd_send_masks(0, NULL, 0, 0, amask, xmask, &group);
+    }
+}
+
+
+static void mdnsd_on_recv(int fd, void *arg) {
+    uint8_t buf[MDNS_PKT_SIZE];
+    struct sockaddr_in from;
+    socklen_t fromlen;
+
+    for (int i = 0; i < MDNS_RECV_BUDGET; i++) {
+        fromlen = sizeof(from);
+        ssize_t n = recvfrom(fd, buf, sizeof(buf), 0, (struct sockaddr *)&from, &fromlen);
+        if (n <= 0)
+            break;
+        pthread_mutex_lock(&mdnsd.lock);
+        mdnsd_on_query(buf, n, &from);
+        pthread_mutex_unlock(&mdnsd.lock);
+    }
+}
+
+
+static void mdnsd_on_error(int fd, void *arg) {
+    printf("mdnsd: socket error: %s\n", strerror(errno));
+}
+
+
+static void mdnsd_announce_once() {
+    uint32_t amask[MDNSD_MAX_SERVICES], xmask[MDNSD_MAX_SERVICES] = {0};
+    struct sockaddr_in group;
+    uint64_t now = mdnsd_now_ms();
+
+    mdnsd_multicast_addr(&group);
+    pthread_mutex_lock(&mdnsd.lock);
+    for (int i = 0; i < MDNSD_MAX_SERVICES; i++) {
+        struct mdnsd_service *s = &mdnsd.svc[i];
+        memset(amask, 0, sizeof(amask));
+        if (!s->used)
+            continue;
+        if (s->dirty && service_build(s))
+            continue;
+        amask[i] = (1U << s->nrr) - 1;
+        for (int j = 0; j < s->nrr; j++)
+            s->rr[j].last_mcast = now;
+        mdnsd_send_masks(0, NULL, 0, 0, amask, xmask, &group);
+    }
+    pthread_mutex_unlock(&mdnsd.lock);
+}
+
+
+static void mdnsd_on_announce(struct gevent_wtimer *t, void *arg) {
+    mdnsd_announce_once();
+    if (--mdnsd.announce_left > 0)
+        gevent_wtimer_add(mdnsd.evbase, t, MDNSD_RATE_LIMIT_MS, TIMER_ONESHOT);
+}
+
+
+/* runs in loop thread, a burst of changes gives one announcement */
+static void mdnsd_announce_kick(void *arg) {
+    mdnsd.announce_left = MDNS_ANNOUNCE_COUNT;
+    if (!gevent_wtimer_pending(&mdnsd.announce))
+        gevent_wtimer_add(mdnsd.evbase, &mdnsd.announce, MDNS_ANNOUNCE_DELAY_MS, TIMER_ONESHOT);
+}
+
+
+static void mdnsd_changed() {
+    if (mdnsd.running)
+        gevent_base_post(mdnsd.evbase, mdnsd_announce_kick, NULL);
+}
+
+
+static int mdnsd_addrs_load(struct in_addr *addrs, int max) {
+    struct ifaddrs *ifa, *p;
+    int n = 0;
+
+    if (getifaddrs(&ifa))
+        return 0;
+    for (p = ifa; p && n < max; p = p->ifa_next) {
+        if (!p->ifa_addr || p->ifa_addr->sa_family != AF_INET)
+            continue;
+        if (!(p->ifa_flags & IFF_UP) || (p->ifa_flags & IFF_LOOPBACK))
+            continue;
+        addrs[n++] = ((struct sockaddr_in *)p->ifa_addr)->sin_addr;
+    }
+    freeifaddrs(ifa);
+    return n;
+}
+
+
+static void mdnsd_on_addr_check(struct gevent_wtimer *t, void *arg) {
+    struct in_addr addrs[MDNS_MAX_ADDRS];
+    int n = mdnsd_addrs_load(addrs, MDNS_MAX_ADDRS);
+
+    pthread_mutex_lock(&mdnsd.lock);
+    bool changed = n != mdnsd.naddrs || memcmp(addrs, mdnsd.addrs, n * sizeof(addrs[0]));
+    if (changed) {
+        memcpy(mdnsd.addrs, addrs, n * sizeof(addrs[0]));
+        mdnsd.naddrs = n;
+        for (int i = 0; i < MDNSD_MAX_SERVICES; i++)
+            mdnsd.svc[i].dirty = true;
+    }
+    pthread_mutex_unlock(&mdnsd.lock);
+    if (changed)
+        mdnsd_announce_kick(NULL);
+}
+
+
+static int mdnsd_socket() {
+    struct sockaddr_in addr;
+    struct ip_mreq req;
+    unsigned char ttl = 255, loop = 1;
+    int on = 1;
+
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0)
+        return -1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+#ifdef SO_REUSEPORT
+    setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+#endif
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(MDNS_PORT);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)))
+        goto fail;
+
+    memset(&req, 0, sizeof(req));
+    req.imr_multiaddr.s_addr = htonl(MDNS_GROUP);
+    req.imr_interface.s_addr = htonl(INADDR_ANY);
+    if (setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &req, sizeof(req)))
+        goto fail;
+    setsockopt(fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+    setsockopt(fd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    return fd;
+
+fail:
+    close(fd);
+    return -1;
+}
+
+
+int mdnsd_init() {
+    if (mdnsd.running)
+        return 0;
+
+    mdnsd.fd = mdnsd_socket();
+    if (mdnsd.fd < 0) {
+        printf("mdnsd: failed to open socket: %s\n", strerror(errno));
+        return -1;
+    }
+    mdnsd.evbase = gevent_base_create();
+    if (!mdnsd.evbase)
+        goto fail;
+    mdnsd.ev = gevent_create(mdnsd.fd, mdnsd_on_recv, NULL, mdnsd_on_error, NULL);
+    if (!mdnsd.ev || -1 == gevent_add(mdnsd.evbase, &mdnsd.ev))
+        goto fail;
+
+    pthread_mutex_lock(&mdnsd.lock);
+    mdnsd.naddrs = mdnsd_addrs_load(mdnsd.addrs, MDNS_MAX_ADDRS);
+    pthread_mutex_unlock(&mdnsd.lock);
+
+    gevent_wtimer_init(&mdnsd.announce, mdnsd_on_announce, NULL);
+    gevent_wtimer_init(&mdnsd.addr_check, mdnsd_on_addr_check, NULL);
+    gevent_wtimer_add(mdnsd.evbase, &mdnsd.addr_check, MDNS_ADDR_CHECK_MS, TIMER_PERSIST);
+    mdnsd.announce_left = MDNS_ANNOUNCE_COUNT;
+    gevent_wtimer_add(mdnsd.evbase, &mdnsd.announce, MDNS_ANNOUNCE_DELAY_MS, TIMER_ONESHOT);
+
+    if (gevent_base_loop_start(mdnsd.evbase))
+        goto fail;
+    mdnsd.running = true;
+    return 0;
+
+fail:
+    printf("mdnsd: failed to start event loop\n");
+    if (mdnsd.evbase)
+        gevent_base_destroy(mdnsd.evbase);
+    mdnsd.evbase = NULL;
+    mdnsd.ev = NULL;
+    close(mdnsd.fd);
+    mdnsd.fd = -1;
+    return -1;
+}
+
+
+void mdnsd_deinit() {
+    if (!mdnsd.running)
+        return;
+    gevent_base_loop_stop(mdnsd.evbase);
+    gevent_base_destroy(mdnsd.evbase);
+    mdnsd.evbase = NULL;
+    mdnsd.ev = NULL;
+    close(mdnsd.fd);
+    mdnsd.fd = -1;
+    mdnsd.running = false;
+
+    pthread_mutex_lock(&mdnsd.lock);
+    for (int i = 0; i < MDNSD_MAX_SERVICES; i++) {
+        service_clear(&mdnsd.svc[i]);
+        mdnsd.svc[i].used = false;
+    }
+    pthread_mutex_unlock(&mdnsd.lock);
+}
+
+
+int mdnsd_hostname_set(const char *hostname) {
+    pthread_mutex_lock(&mdnsd.lock);
+    snprintf(mdnsd.hostname, sizeof(mdnsd.hostname), "%s", hostname);
+    for (int i = 0; i < MDNSD_MAX_SERVICES; i++)
+        mdnsd.svc[i].dirty = true;
+    pthread_mutex_unlock(&mdnsd.lock);
+    mdnsd_changed();
+    return 0;
+}
+
+
+int mdnsd_service_add(const char *instance, const char *service, const char *proto,
+                      uint16_t port) {
+    pthread_mutex_lock(&mdnsd.lock);
+    struct mdnsd_service *s = service_find(service, proto);
+    for (int i = 0; !s && i < MDNSD_MAX_SERVICES; i++) {
+        if (!mdnsd.svc[i].used)
+            s = &mdnsd.svc[i];
+    }
+    if (!s) {
+        pthread_mutex_unlock(&mdnsd.lock);
+        return -1;
+    }
+    service_clear(s);
+    s->used = true;
+    s->dirty = true;
+    s->ntxt = 0;
+    s->port = port;
+    snprintf(s->instance, sizeof(s->instance), "%s", instance);
+    snprintf(s->service, sizeof(s->service), "%s", service);
+    snprintf(s->proto, sizeof(s->proto), "%s", proto);
+    pthread_mutex_unlock(&mdnsd.lock);
+    mdnsd_changed();
+    return 0;
+}
+
+
+int mdnsd_service_txt_set(const char *service, const char *proto,
+                          const char *key, const char *value) {
+    int i;
+
+    pthread_mutex_lock(&mdnsd.lock);
+    struct mdnsd_service *s = service_find(service, proto);
+    if (!s) {
+        pthread_mutex_unlock(&mdnsd.lock);
+        return -1;
+    }
+    for (i = 0; i < s->ntxt; i++) {
+        if (!strcmp(s->txt_key[i], key))
+            break;
+    }
+    if (i < s->ntxt && !strcmp(s->txt_val[i], value)) {
+        pthread_mutex_unlock(&mdnsd.lock);
+        return 0;
+    }
+    if (i == MDNSD_MAX_TXT) {
+        pthread_mutex_unlock(&mdnsd.lock);
+        return -1;
+    }
+    if (i == s->ntxt) {
+        snprintf(s->txt_key[i], sizeof(s->txt_key[i]), "%s", key);
+        s->ntxt++;
+    }
+    snprintf(s->txt_val[i], sizeof(s->txt_val[i]), "%s", value);
+    s->dirty = true;
+    pthread_mutex_unlock(&mdnsd.lock);
+    mdnsd_changed();
+    return 0;
+}
+
+
+void mdnsd_stats_get(struct mdnsd_stats *stats) {
+    pthread_mutex_lock(&mdnsd.lock);
+    *stats = mdnsd.stats;
+    pthread_mutex_unlock(&mdnsd.lock);
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * mDNS/DNS-SD responder on libgevent, IPv4 only.
+ * records of a service are prebuilt once and the response packets are
+ * cached per service, a TXT change drops the cache and announces again.
+ * known answers in a query are suppressed and a record is multicast at
+ * most once per MDNSD_RATE_LIMIT_MS, queries with QU bit or from a
+ * legacy resolver are answered unicast without limit
+ */
+
+#define MDNSD_MAX_SERVICES      4
+#define MDNSD_MAX_TXT           16
+#define MDNSD_RATE_LIMIT_MS     1000
+#define MDNSD_TTL               4500
+#define MDNSD_HOST_TTL          120
+
+struct mdnsd_stats {
+    uint64_t queries;
+    uint64_t responses;
+    uint64_t cache_hits;
+    uint64_t suppressed;    /* records dropped by known answer */
+    uint64_t rate_limited;  /* records dropped by multicast rate limit */
+};
+
+int mdnsd_init();
+void mdnsd_deinit();
+
+int mdnsd_hostname_set(const char *hostname);
+int mdnsd_service_add(const char *instance, const char *service, const char *proto,
+                      uint16_t port);
+int mdnsd_service_txt_set(const char *service, const char *proto,
+                          const char *key, const char *value);
+
+void mdnsd_stats_get(struct mdnsd_stats *stats);
@@ -1,9 +1,10 @@
+#include "mdnsd.h"
+
 #define esp_random()        random()
 #define esp_restart()               printf("esp_restart\n")
-#define mdns_init()                 printf("mdns_init\n")
-#define mdns_hostname_set(name)      printf("mdns_hostname_set %s\n", name)
-#define mdns_instance_name_set(name) printf("mdns_instance_name_set %s\n", name)
+#define mdns_init()                 mdnsd_init()
+#define mdns_hostname_set(name)      mdnsd_hostname_set(name)
+#define mdns_instance_name_set(name) do {} while (0)
 #define mdns_service_add(inst, svc, proto, port, txt, num)       \
-                printf("mdns_service_add %s %s %s %d %p %d\n", \
-                        inst, svc, proto, port, txt, num)
-#define mdns_service_txt_item_set(svc, proto, key, val) printf("mdns_service_txt_item_set %s %s %s %s \n", svc, proto, key, val)
+                mdnsd_service_add(inst, svc, proto, port)
+#define mdns_service_txt_item_set(svc, proto, key, val) mdnsd_service_txt_set(svc, proto, key, val)
@@ -2197,12 +2197,16 @@ void homekit_server_on_update_characteristics(client_context_t *context, const b
     CLIENT_INFO(context, "Update Characteristics");
     DEBUG_HEAP();
 
+    // parse in place: strings stay in data1 and items come from arena,
+    // both are released when the request is done
     char *data1 = strndup((char *)data, size);
-    cJSON *json = cJSON_Parse(data1);
-    free(data1);
+    cJSON_Arena *arena = cJSON_ArenaCreate(size * 2);
+    cJSON *json = (data1 && arena) ? cJSON_ParseInSitu(data1, arena) : NULL;
 
     if (!json) {
         CLIENT_ERROR(context, "Failed to parse request JSON");
+        cJSON_ArenaDestroy(arena);
+        free(data1);
         send_json_error_response(context, 400, HAPStatus_InvalidValue);
         return;
     }
@@ -2211,12 +2215,16 @@ void homekit_server_on_update_characteristics(client_context_t *context, const b
     if (!characteristics) {
         CLIENT_ERROR(context, "Failed to parse request: no \"characteristics\" field");
         cJSON_Delete(json);
+        cJSON_ArenaDestroy(arena);
+        free(data1);
         send_json_error_response(context, 400, HAPStatus_InvalidValue);
         return;
     }
-    if (characteristics->type != cJSON_Array) {
+    if (!cJSON_IsArray(characteristics)) {
         CLIENT_ERROR(context, "Failed to parse request: \"characteristics\" field is not an list");
         cJSON_Delete(json);
+        cJSON_ArenaDestroy(arena);
+        free(data1);
         send_json_error_response(context, 400, HAPStatus_InvalidValue);
         return;
     }
@@ -2227,7 +2235,7 @@ void homekit_server_on_update_characteristics(client_context_t *context, const b
             CLIENT_ERROR(context, "Failed to process request: no \"aid\" field");
             return HAPStatus_NoResource;
         }
-        if (j_aid->type != cJSON_Number) {
+        if (!cJSON_IsNumber(j_aid)) {
             CLIENT_ERROR(context, "Failed to process request: \"aid\" field is not a number");
             return HAPStatus_NoResource;
         }
@@ -2237,7 +2245,7 @@ void homekit_server_on_update_characteristics(client_context_t *context, const b
             CLIENT_ERROR(context, "Failed to process request: no \"iid\" field");
             return HAPStatus_NoResource;
         }
-        if (j_iid->type != cJSON_Number) {
+        if (!cJSON_IsNumber(j_iid)) {
             CLIENT_ERROR(context, "Failed to process request: \"iid\" field is not a number");
             return HAPStatus_NoResource;
         }
@@ -2266,11 +2274,11 @@ void homekit_server_on_update_characteristics(client_context_t *context, const b
             switch (ch->format) {
                 case homekit_format_bool: {
                     bool value = false;
-                    if (j_value->type == cJSON_True) {
+                    if (cJSON_IsTrue(j_value)) {
                         value = true;
-                    } else if (j_value->type == cJSON_False) {
+                    } else if (cJSON_IsFalse(j_value)) {
                         value = false;
-                    } else if (j_value->type == cJSON_Number &&
+                    } else if (cJSON_IsNumber(j_value) &&
                             (j_value->valueint == 0 || j_value->valueint == 1)) {
                         value = j_value->valueint == 1;
                     } else {
@@ -2294,7 +2302,7 @@ void homekit_server_on_update_characteristics(client_context_t *context, const b
                 case homekit_format_uint64:
                 case homekit_format_int: {
                     // We accept boolean values here in order to fix a bug in HomeKit. HomeKit sometimes sends a boolean instead of an integer of value 0 or 1.
-                    if (j_value->type != cJSON_Number && j_value->type != cJSON_False && j_value->type != cJSON_True) {
+                    if (!cJSON_IsNumber(j_value) && !cJSON_IsFalse(j_value) && !cJSON_IsTrue(j_value)) {
                         CLIENT_ERROR(context, "Failed to update %d.%d: value is not a number", aid, iid);
                         return HAPStatus_InvalidValue;
                     }
@@ -2410,7 +2418,7 @@ void homekit_server_on_update_characteristics(client_context_t *context, const b
                     break;
                 }
                 case homekit_format_float: {
-                    if (j_value->type != cJSON_Number) {
+                    if (!cJSON_IsNumber(j_value)) {
                         CLIENT_ERROR(context, "Failed to update %d.%d: value is not a number", aid, iid);
                         return HAPStatus_InvalidValue;
                     }
@@ -2433,7 +2441,7 @@ void homekit_server_on_update_characteristics(client_context_t *context, const b
                     break;
                 }
                 case homekit_format_string: {
-                    if (j_value->type != cJSON_String) {
+                    if (!cJSON_IsString(j_value)) {
                         CLIENT_ERROR(context, "Failed to update %d.%d: value is not a string", aid, iid);
                         return HAPStatus_InvalidValue;
                     }
@@ -2458,7 +2466,7 @@ void homekit_server_on_update_characteristics(client_context_t *context, const b
                     break;
                 }
                 case homekit_format_tlv: {
-                    if (j_value->type != cJSON_String) {
+                    if (!cJSON_IsString(j_value)) {
                         CLIENT_ERROR(context, "Failed to update %d.%d: value is not a string", aid, iid);
                         return HAPStatus_InvalidValue;
                     }
@@ -2532,12 +2540,12 @@ void homekit_server_on_update_characteristics(client_context_t *context, const b
                 return HAPStatus_NotificationsUnsupported;
             }
 
-            if ((j_events->type != cJSON_True) && (j_events->type != cJSON_False)) {
+            if (!cJSON_IsTrue(j_events) && !cJSON_IsFalse(j_events)) {
                 CLIENT_ERROR(context, "Failed to set notification state for %d.%d: "
                       "invalid state value", aid, iid);
             }
 
-            if (j_events->type == cJSON_True) {
+            if (cJSON_IsTrue(j_events)) {
                 homekit_characteristic_add_notify_callback(ch, client_notify_characteristic, context);
             } else {
                 homekit_characteristic_remove_notify_callback(ch, client_notify_characteristic, context);
@@ -2595,6 +2603,8 @@ void homekit_server_on_update_characteristics(client_context_t *context, const b
 
     free(statuses);
     cJSON_Delete(json);
+    cJSON_ArenaDestroy(arena);
+    free(data1);
 }
 
 void homekit_server_on_pairings(client_context_t *context, const byte *data, size_t size) {
@@ -1,3 +1,6 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
 #include <stdint.h>
 #include <stdbool.h>
 #include <stddef.h>
@@ -24,6 +27,8 @@
 #endif
 #include <x264.h>
 #include <jpeglib.h>
+#include <libmedia-io.h>
+#include <video-conv.h>
 
 #include "config.h"
 #include "debug.h"
@@ -50,6 +55,9 @@
 #define RTP_VERSION 2
 #define RTCP_VERSION 2
 #define RTP_MAX_PACKET_LENGTH 2048 // 8192
+#define RTP_BATCH_SIZE 32
+
+#define STREAM_FRAME_WAIT_MS 1000
 
 
 #define NTP_OFFSET 2208988800ULL
@@ -152,6 +160,7 @@ uint8_t* find_nal_start(uint8_t* start, uint8_t* end) {
 
 static int video_socket = -1;
 static int video_port = 0;
+static int encoder_threads = 1;
 
 
 static int session_send_encrypted(streaming_session_t *session, uint8_t *buffer, size_t size) {
@@ -176,6 +185,65 @@ static int session_send_encrypted(streaming_session_t *session, uint8_t *buffer,
 }
 
 
+static int session_flush_batch(streaming_session_t *session) {
+    int sent = 0;
+    while (sent < session->batch_count) {
+        int r = sendmmsg(video_socket, session->batch_msgs + sent,
+                         session->batch_count - sent, 0);
+        if (r > 0) {
+            sent += r;
+            continue;
+        }
+        if (r < 0 && errno == EAGAIN)
+            continue;
+        if (r < 0 && errno != ENOSYS) {
+            ESP_LOGE(TAG, "Failed to send encrypted packets (code %d)", errno);
+            break;
+        }
+        // no sendmmsg, one sendto per packet
+        for (; sent < session->batch_count; sent++) {
+            struct iovec *iov = &session->batch_iovs[sent];
+            do {
+                r = sendto(video_socket, iov->iov_base, iov->iov_len, 0,
+                           (struct sockaddr*)&session->controller_addr,
+                           sizeof(session->controller_addr));
+            } while (r == -1 && errno == EAGAIN);
+            if (r < 0) {
+                ESP_LOGE(TAG, "Failed to send encrypted packet (code %d)", errno);
+                break;
+            }
+        }
+        break;
+    }
+
+    int failed = sent < session->batch_count;
+    session->batch_count = 0;
+    session->video_buffer = session->batch;
+    session->video_buffer_ptr = session->video_buffer + sizeof(rtp_header_t);
+    return failed ? -2 : 0;
+}
+
+
+/* encrypt the packet in its batch slot and move video_buffer to the next one */
+static int session_queue_encrypted(streaming_session_t *session, size_t size) {
+    int encrypted_size = session_encrypt(session, session->video_buffer, size, RTP_MAX_PACKET_LENGTH);
+    if (encrypted_size < 0) {
+        ESP_LOGE(TAG, "Failed to encrypt payload (code %d)", encrypted_size);
+        session->video_buffer_ptr = session->video_buffer + sizeof(rtp_header_t);
+        return -1;
+    }
+
+    session->batch_iovs[session->batch_count].iov_len = encrypted_size;
+    session->batch_count++;
+    if (session->batch_count == RTP_BATCH_SIZE)
+        return session_flush_batch(session);
+
+    session->video_buffer = session->batch + session->batch_count * RTP_MAX_PACKET_LENGTH;
+    session->video_buffer_ptr = session->video_buffer + sizeof(rtp_header_t);
+    return 0;
+}
+
+
 static int session_send_rtcp_sender_report(streaming_session_t *session) {
     uint8_t *buffer = (uint8_t*) malloc(RTP_MAX_PACKET_LENGTH);
     if (!buffer) {
@@ -228,9 +296,7 @@ static int session_send_data(streaming_session_t *session, bool last) {
 
     session->sequence = (session->sequence + 1) & 0xffff;
 
-    int r = session_send_encrypted(session, session->video_buffer, size);
-    session->video_buffer_ptr = session->video_buffer + sizeof(rtp_header_t);
-
+    int r = session_queue_encrypted(session, size);
     if (r < 0) {
         ESP_LOGE(TAG, "Failed to send RTP packet (code %d)", r);
         return -1;
@@ -462,19 +528,22 @@ int grab_camera_frame(x264_picture_t *pic) {
 
 
 static streaming_session_t *streaming_sessions = NULL;
-#if 0
-static SemaphoreHandle_t streaming_sessions_mutex = NULL;
-#endif
-
-#if 0
-TaskHandle_t stream_task_handle = NULL;
-EventGroupHandle_t stream_control_events;
-#endif
+static pthread_mutex_t streaming_sessions_mutex = PTHREAD_MUTEX_INITIALIZER;
 
-#define STREAM_CONTROL_EVENT_STOP (1 << 0)
+/* latest frame from the pipeline, the encoder always takes the newest */
+static pthread_mutex_t stream_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t stream_cond = PTHREAD_COND_INITIALIZER;
+static bool stream_active = false;
+static bool stream_stopping = false;
+static bool frame_pending = false;
+static struct video_frame pending_frame;
+static uint64_t frames_dropped = 0;
 
 
-void stream_task(void *arg);
+void *stream_task(void *arg);
+static void streaming_sessions_lock();
+static void streaming_sessions_unlock();
+void streaming_session_free(streaming_session_t *session);
 
 
 int streaming_get_video_port() {
@@ -487,6 +556,11 @@ int streaming_get_audio_port() {
 }
 
 
+void streaming_set_encoder_threads(int threads) {
+    encoder_threads = threads < 0 ? 1 : threads;
+}
+
+
 int streaming_init() {
     ESP_LOGI(TAG, "Initializing streaming");
     video_socket = socket(PF_INET, SOCK_DGRAM, 0);
@@ -513,69 +587,128 @@ int streaming_init() {
     video_port = ntohs(addr.sin_port);
 
     streaming_sessions = NULL;
-#if 0
-    streaming_sessions_mutex = xSemaphoreCreateBinary();
-    xSemaphoreGive(streaming_sessions_mutex);
-#endif
 
-#if 0
-    stream_control_events = xEventGroupCreate();
-    if (stream_control_events == NULL) {
-        ESP_LOGE(TAG, "Failed to create camera control event group");
+    ESP_LOGI(TAG, "Streaming initialized");
+    return 0;
+}
+
+
+int streaming_push_frame(const struct video_frame *frame) {
+    if (frame->format != PIXEL_FORMAT_I420 &&
+        !video_frame_convert_supported(PIXEL_FORMAT_I420, frame->format)) {
+        ESP_LOGE(TAG, "Unsupported frame format %s", pixel_format_to_string(frame->format));
         return -1;
     }
-#endif
 
-    ESP_LOGI(TAG, "Streaming initialized");
+    pthread_mutex_lock(&stream_lock);
+    if (!stream_active || stream_stopping) {
+        pthread_mutex_unlock(&stream_lock);
+        return 0;
+    }
+    if (frame_pending) {
+        video_frame_deinit(&pending_frame);
+        frame_pending = false;
+        frames_dropped++;
+    }
+    if (video_frame_ref(&pending_frame, frame)) {
+        pthread_mutex_unlock(&stream_lock);
+        return -1;
+    }
+    frame_pending = true;
+    pthread_cond_signal(&stream_cond);
+    pthread_mutex_unlock(&stream_lock);
     return 0;
 }
 
 
-static bool stream_running() {
-#if 0
-    return stream_task_handle != NULL;
-#endif
+/* wait for the next pipeline frame, false when the stream should stop */
+static bool stream_take_frame(struct video_frame *frame) {
+    struct timespec ts;
+    bool ok = false;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += STREAM_FRAME_WAIT_MS / 1000;
+
+    pthread_mutex_lock(&stream_lock);
+    while (!frame_pending && !stream_stopping) {
+        if (pthread_cond_timedwait(&stream_cond, &stream_lock, &ts) == ETIMEDOUT)
+            break;
+    }
+    if (frame_pending && !stream_stopping) {
+        *frame = pending_frame;
+        frame_pending = false;
+        ok = true;
+    }
+    pthread_mutex_unlock(&stream_lock);
+    return ok;
 }
 
+
+/*
+ * the session list decides, so a session added while the task winds
+ * down either keeps this task or sees it gone and starts a new one
+ */
+static bool stream_exit_if_idle() {
+    bool idle = false;
+
+    streaming_sessions_lock();
+    pthread_mutex_lock(&stream_lock);
+    if (!streaming_sessions) {
+        if (frame_pending) {
+            video_frame_deinit(&pending_frame);
+            frame_pending = false;
+        }
+        ESP_LOGI(TAG, "Stream idle, %llu frames dropped", (unsigned long long)frames_dropped);
+        stream_active = false;
+        stream_stopping = false;
+        idle = true;
+    }
+    pthread_mutex_unlock(&stream_lock);
+    streaming_sessions_unlock();
+    return idle;
+}
+
+
 static void stream_start() {
-    if (stream_running())
+    pthread_mutex_lock(&stream_lock);
+    if (stream_active) {
+        stream_stopping = false;
+        pthread_mutex_unlock(&stream_lock);
         return;
+    }
+    stream_active = true;
+    stream_stopping = false;
+    pthread_mutex_unlock(&stream_lock);
 
-#if 0
-    xEventGroupClearBits(stream_control_events, STREAM_CONTROL_EVENT_STOP);
-#endif
-
-#if 0
-    xTaskCreate(stream_task, "Camera Stream",
-                4096*8, NULL, 1, &stream_task_handle);
-#else
     pthread_t tid;
-    pthread_create(&tid, NULL, stream_task, NULL);
-#endif
+    if (pthread_create(&tid, NULL, stream_task, NULL)) {
+        ESP_LOGE(TAG, "Failed to start video stream");
+        pthread_mutex_lock(&stream_lock);
+        stream_active = false;
+        pthread_mutex_unlock(&stream_lock);
+        return;
+    }
+    pthread_detach(tid);
 }
 
 static void stream_stop() {
-    if (!stream_running())
-        return;
-
     ESP_LOGI(TAG, "Stopping video stream");
-#if 0
-    xEventGroupSetBits(stream_control_events, STREAM_CONTROL_EVENT_STOP);
-#endif
+    pthread_mutex_lock(&stream_lock);
+    if (stream_active) {
+        stream_stopping = true;
+        pthread_cond_signal(&stream_cond);
+    }
+    pthread_mutex_unlock(&stream_lock);
 }
 
 
 static void streaming_sessions_lock() {
-#if 0
-    xSemaphoreTake(streaming_sessions_mutex, 5000 / portTICK_PERIOD_MS);
-#endif
+    pthread_mutex_lock(&streaming_sessions_mutex);
 }
 
 
 static void streaming_sessions_unlock() {
-#if 0
-    xSemaphoreGive(streaming_sessions_mutex);
-#endif
+    pthread_mutex_unlock(&streaming_sessions_mutex);
 }
 
 
@@ -593,12 +726,16 @@ static streaming_session_t *streaming_session_new(camera_session_t *settings) {
     session->timestamp = 0;
 
     session->sequence = 123;
-    session->video_buffer = (uint8_t*) calloc(1, RTP_MAX_PACKET_LENGTH);
-    if (!session->video_buffer) {
+    session->batch = (uint8_t*) calloc(RTP_BATCH_SIZE, RTP_MAX_PACKET_LENGTH);
+    session->batch_msgs = (struct mmsghdr*) calloc(RTP_BATCH_SIZE, sizeof(struct mmsghdr));
+    session->batch_iovs = (struct iovec*) calloc(RTP_BATCH_SIZE, sizeof(struct iovec));
+    if (!session->batch || !session->batch_msgs || !session->batch_iovs) {
         ESP_LOGE(TAG, "Failed to allocate streaming session video buffer");
-        free(session);
+        streaming_session_free(session);
         return NULL;
     }
+    session->batch_count = 0;
+    session->video_buffer = session->batch;
     session->video_buffer_ptr = session->video_buffer + sizeof(rtp_header_t);
 
     session_init_crypto(session);
@@ -607,18 +744,26 @@ static streaming_session_t *streaming_session_new(camera_session_t *settings) {
     session->controller_addr.sin_port = htons(session->settings->controller_video_port);
     if (inet_pton(AF_INET, session->settings->controller_ip_address, &session->controller_addr.sin_addr) <= 0) {
         ESP_LOGE(TAG, "Failed to parse controller IP address");
-        free(session->video_buffer);
-        free(session);
+        streaming_session_free(session);
         return NULL;
     }
 
+    for (int i = 0; i < RTP_BATCH_SIZE; i++) {
+        session->batch_iovs[i].iov_base = session->batch + i * RTP_MAX_PACKET_LENGTH;
+        session->batch_msgs[i].msg_hdr.msg_name = &session->controller_addr;
+        session->batch_msgs[i].msg_hdr.msg_namelen = sizeof(session->controller_addr);
+        session->batch_msgs[i].msg_hdr.msg_iov = &session->batch_iovs[i];
+        session->batch_msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
     return session;
 }
 
 
 void streaming_session_free(streaming_session_t *session) {
-    if (session->video_buffer)
-        free(session->video_buffer);
+    free(session->batch);
+    free(session->batch_msgs);
+    free(session->batch_iovs);
 
     free(session);
 }
@@ -652,26 +797,15 @@ void streaming_sessions_remove(camera_session_t *settings) {
 
     ESP_LOGI(TAG, "Removing streaming session");
 
-    if (!streaming_sessions) {
-        streaming_sessions_unlock();
-        return;
-    }
-
-    if (streaming_sessions->settings == settings) {
-        streaming_session_t *s = streaming_sessions;
-        streaming_sessions = streaming_sessions->next;
-        streaming_session_free(s);
-    } else {
-        streaming_session_t *t = streaming_sessions;
-        while (t->next) {
-            if (t->next->settings == settings) {
-                streaming_session_t *s = t->next;
-                t->next = t->next->next;
-                streaming_session_free(s);
-                break;
-            }
-            t = t->next;
+    streaming_session_t **t = &streaming_sessions;
+    while (*t) {
+        if ((*t)->settings == settings) {
+            streaming_session_t *s = *t;
+            *t = s->next;
+            streaming_session_free(s);
+            break;
         }
+        t = &(*t)->next;
     }
 
     if (!streaming_sessions)
@@ -681,94 +815,121 @@ void streaming_sessions_remove(camera_session_t *settings) {
 }
 
 
-void stream_task(void *arg) {
-    ESP_LOGI(TAG, "Starting streaming");
-    ESP_LOGI(TAG, "Total free memory: %u", heap_caps_get_free_size(MALLOC_CAP_DEFAULT));
+static x264_t *stream_encoder_open(x264_param_t *param, int width, int height) {
+    x264_param_default(param);
 
-    x264_param_t param;
-    x264_param_default(&param);
+    if (x264_param_default_preset(param, "ultrafast", "zerolatency") < 0) {
+        ESP_LOGE(TAG, "Failed to initialize H.264 preset");
+        return NULL;
+    }
+
+    param->i_width = width;
+    param->i_height = height;
+    param->i_csp = X264_CSP_I420;
+    // zerolatency slices each frame across the threads, no frame delay
+    param->i_threads = encoder_threads ? encoder_threads : X264_THREADS_AUTO;
+    param->i_fps_num = CAMERA_FRAME_RATE;
+    param->i_fps_den = 1;
+    // param.b_repeat_headers = 1;
+
+    param->i_keyint_max = 1;
+
+    param->rc.i_qp_constant = 26;
 
-    if (x264_param_apply_profile(&param, "baseline") < 0) {
+    if (x264_param_apply_profile(param, "baseline") < 0) {
         ESP_LOGE(TAG, "Failed to intialize H.264 profile");
-        return;
+        return NULL;
     }
 
-    if (x264_param_default_preset(&param, "ultrafast", "zerolatency") < 0) {
-        ESP_LOGE(TAG, "Failed to initialize H.264 preset");
-        return;
+    x264_t *encoder = x264_encoder_open(param);
+    if (!encoder) {
+        ESP_LOGE(TAG, "Failed to open H.264 encoder");
+        return NULL;
     }
+    ESP_LOGI(TAG, "H.264 encoder %dx%d, %d threads", width, height, param->i_threads);
+    return encoder;
+}
 
-    param.i_width = VIDEO_WIDTH;
-    param.i_height = VIDEO_HEIGHT;
-#if 0
-    param.i_bitdepth = 8;
-#endif
-    param.i_csp = X264_CSP_I420;
-    param.i_threads = 1;
-    // param.b_repeat_headers = 1;
 
-    param.i_keyint_max = 1;
+/* point pic at an I420 view of frame, converting into yuv when needed */
+static int stream_frame_to_picture(struct video_frame *frame, struct video_frame *yuv,
+                                   x264_picture_t *pic) {
+    struct video_frame *src = frame;
+
+    if (frame->format != PIXEL_FORMAT_I420) {
+        if (yuv->width != frame->width || yuv->height != frame->height) {
+            video_frame_deinit(yuv);
+            memset(yuv, 0, sizeof(*yuv));
+            if (video_frame_init(yuv, PIXEL_FORMAT_I420, frame->width, frame->height, MEDIA_MEM_DEEP))
+                return -1;
+        }
+        if (video_frame_convert(yuv, frame))
+            return -1;
+        src = yuv;
+    }
+
+    pic->img.i_csp = X264_CSP_I420;
+    pic->img.i_plane = 3;
+    for (int i = 0; i < 3; i++) {
+        pic->img.plane[i] = src->data[i];
+        pic->img.i_stride[i] = src->linesize[i];
+    }
+    return 0;
+}
 
-    param.rc.i_qp_constant = 26;
 
+void *stream_task(void *arg) {
+    ESP_LOGI(TAG, "Starting streaming");
+
+    x264_param_t param;
+    x264_t *encoder = NULL;
     x264_picture_t pic, pic_out;
+    struct video_frame frame, yuv;
 
+    memset(&yuv, 0, sizeof(yuv));
     x264_picture_init(&pic);
-    pic.img.i_csp = param.i_csp;
-    pic.img.i_plane = 3;
-    pic.img.i_stride[0] = param.i_width;
-    pic.img.i_stride[1] = param.i_width / 2;
-    pic.img.i_stride[2] = param.i_width / 2;
-
-    const int plane_size = VIDEO_WIDTH * VIDEO_HEIGHT;
-    pic.img.plane[0] = (uint8_t*) malloc(plane_size * 3);
-    pic.img.plane[1] = pic.img.plane[0] + plane_size;
-    pic.img.plane[2] = pic.img.plane[1] + plane_size / 4;
-
-    x264_t *encoder = x264_encoder_open(&param);
-    if (!encoder) {
-        ESP_LOGE(TAG, "Failed to open H.264 encoder");
-        free(pic.img.plane[0]);
-        return;
-    }
 
     x264_nal_t *nal = NULL;
     int i_nal;
     int frame_size = 0;
 
     ESP_LOGI(TAG, "Executing streaming loop");
-    ESP_LOGI(TAG, "Total free memory: %u", heap_caps_get_free_size(MALLOC_CAP_DEFAULT));
 
     while (true) {
-#if 0
-        if (xEventGroupGetBits(stream_control_events) & STREAM_CONTROL_EVENT_STOP)
-            break;
-#endif
+        if (!stream_take_frame(&frame)) {
+            if (stream_exit_if_idle())
+                break;
+            continue;
+        }
 
-        ESP_LOGI(TAG, "Getting a frame");
-        ESP_LOGI(TAG, "Total free memory: %u", heap_caps_get_free_size(MALLOC_CAP_DEFAULT));
+        if (encoder && (param.i_width != frame.width || param.i_height != frame.height)) {
+            x264_encoder_close(encoder);
+            encoder = NULL;
+        }
+        if (!encoder) {
+            encoder = stream_encoder_open(&param, frame.width, frame.height);
+            if (!encoder) {
+                video_frame_deinit(&frame);
+                continue;
+            }
+        }
 
-        if (grab_camera_frame(&pic) < 0) {
+        if (stream_frame_to_picture(&frame, &yuv, &pic) < 0) {
+            ESP_LOGE(TAG, "Failed to convert frame to I420");
+            video_frame_deinit(&frame);
             continue;
         }
 
-        ESP_LOGI(TAG, "Encoding a frame");
-        ESP_LOGI(TAG, "Total free memory: %u", heap_caps_get_free_size(MALLOC_CAP_DEFAULT));
-
         frame_size = x264_encoder_encode(encoder, &nal, &i_nal, &pic, &pic_out);
-        // TODO: free up pic_out
+        video_frame_deinit(&frame);
 
-        ESP_LOGI(TAG, "Encoded frame, size = %d", frame_size);
         if( frame_size < 0 ) {
             ESP_LOGE(TAG, "Image H264 encoding failed error = %d", frame_size);
             continue;
         } else if( frame_size == 0 ) {
-            ESP_LOGE(TAG, "Frame is empty");
             continue;
         }
 
-        // dump_binary("Frame: ", nal->p_payload, 20);
-
         streaming_sessions_lock();
         for (streaming_session_t *session = streaming_sessions; session; session=session->next) {
             if (session->started)
@@ -788,8 +949,6 @@ void stream_task(void *arg) {
             session->timestamp = get_time_millis() * 1000;
         }
 
-        // dump_binary("Frame: ", nal->p_payload, frame_size);
-
         uint8_t* end = nal->p_payload + frame_size;
         uint8_t* nal_data = find_nal_start(nal->p_payload, end);
 
@@ -807,48 +966,36 @@ void stream_task(void *arg) {
             nal_data = next_nal_data;
         }
 
-        ESP_LOGI(TAG, "Done sending frame data");
-
         for (streaming_session_t *session = streaming_sessions; session; session=session->next) {
             if (session_flush_buffered(session, true))
                 session->failed = true;
+            if (session_flush_batch(session))
+                session->failed = true;
         }
 
         // cleanup failed streaming sessions
-        while (streaming_sessions && streaming_sessions->failed) {
-            streaming_session_t *t = streaming_sessions;
-            streaming_sessions = streaming_sessions->next;
-            streaming_session_free(t);
-        }
-        if (!streaming_sessions) {
-            streaming_sessions_unlock();
-            break;
-        }
-
-        streaming_session_t *t = streaming_sessions;
-        while (t->next) {
-            if (t->next->failed) {
-                streaming_session_t *tt = t;
-                t = t->next;
-                streaming_session_free(tt);
+        streaming_session_t **t = &streaming_sessions;
+        while (*t) {
+            if ((*t)->failed) {
+                streaming_session_t *s = *t;
+                *t = s->next;
+                streaming_session_free(s);
             } else {
-                t = t->next;
+                t = &(*t)->next;
             }
         }
+        bool empty = (streaming_sessions == NULL);
 
         streaming_sessions_unlock();
 
-        vTaskDelay(10 / portTICK_PERIOD_MS);
+        if (empty && stream_exit_if_idle())
+            break;
     }
 
-    x264_encoder_close(encoder);
-
-    free(pic.img.plane[0]);
+    if (encoder)
+        x264_encoder_close(encoder);
+    video_frame_deinit(&yuv);
 
     ESP_LOGI(TAG, "Done with stream");
-
-#if 0
-    stream_task_handle = NULL;
-    vTaskDelete(NULL);
-#endif
+    return NULL;
 }
@@ -1,5 +1,7 @@
 #pragma once
 
+struct video_frame;
+
 int streaming_init();
 
 int streaming_get_video_port();
@@ -7,3 +9,16 @@ int streaming_get_audio_port();
 
 int streaming_sessions_add(camera_session_t *session);
 void streaming_sessions_remove(camera_session_t *session);
+
+/*
+ * x264 threads of this camera, 0 lets x264 pick by cpu count, default 1.
+ * takes effect on the next encoder open
+ */
+void streaming_set_encoder_threads(int threads);
+
+/*
+ * feed a frame from the shared libavcap/media-io pipeline, the frame is
+ * referenced and only the latest one is kept until the encoder takes it.
+ * I420 is encoded in place, other raw formats are converted once
+ */
+int streaming_push_frame(const struct video_frame *frame);
@@ -2,9 +2,13 @@
 
 
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include "camera_session.h"
 
 
+struct mmsghdr;
+
+
 typedef struct {
     uint8_t key[16];
     uint8_t salt[14];
@@ -29,6 +33,12 @@ typedef struct _streaming_session {
     uint8_t *video_buffer;
     uint8_t *video_buffer_ptr;
 
+    /* encrypted packets of a frame waiting for one sendmmsg */
+    uint8_t *batch;
+    int batch_count;
+    struct mmsghdr *batch_msgs;
+    struct iovec *batch_iovs;
+
     srtp_keys_t video_rtp;
     srtp_keys_t video_rtcp;
 
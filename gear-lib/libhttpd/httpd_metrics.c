@@ -0,0 +1,183 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#include "httpd_metrics.h"
+#include <libgevent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+#define METRICS_CONTENT_TYPE    "text/plain; version=0.0.4; charset=utf-8"
+
+struct stat_field {
+    const char *name;
+    const char *help;
+    size_t off;
+};
+
+static const struct stat_field httpd_fields[] = {
+    {"httpd_accepted_total", "connections accepted", offsetof(struct httpd_stats, accepted)},
+    {"httpd_closed_total", "connections closed", offsetof(struct httpd_stats, closed)},
+    {"httpd_requests_total", "requests dispatched", offsetof(struct httpd_stats, requests)},
+};
+
+static const struct stat_field gevent_fields[] = {
+    {"gevent_loops_total", "dispatch rounds", offsetof(struct gevent_stats, loops)},
+    {"gevent_callbacks_total", "fd callbacks invoked", offsetof(struct gevent_stats, callbacks)},
+    {"gevent_slow_callbacks_total", "callbacks over slow threshold",
+        offsetof(struct gevent_stats, slow_callbacks)},
+};
+
+#define FIELD(p, f) (*(const uint64_t *)((const char *)(p) + (f)->off))
+
+static void on_metrics(struct httpd_conn *c, const struct httpd_request *req, void *arg)
+{
+    struct metrics *m = (struct metrics *)arg;
+    char *text;
+    size_t len;
+
+    if (!(req->method.len == 3 && 0 == memcmp(req->method.array, "GET", 3)) &&
+        !(req->method.len == 4 && 0 == memcmp(req->method.array, "HEAD", 4))) {
+        httpd_add_header(c, "Allow: GET, HEAD");
+        httpd_reply(c, 405, "text/plain", NULL, 0);
+        return;
+    }
+    text = metrics_render(m, &len);
+    if (!text) {
+        httpd_reply(c, 500, "text/plain", NULL, 0);
+        return;
+    }
+    httpd_add_header(c, "Cache-Control: no-cache");
+    httpd_reply(c, 200, METRICS_CONTENT_TYPE, text, len);
+    free(text);
+}
+
+int httpd_metrics_route(struct httpd *h, const char *path, struct metrics *m)
+{
+    if (!h || !path || !m) {
+        return -1;
+    }
+    return httpd_route(h, path, on_metrics, m);
+}
+
+/*
+ * gevent bucket i holds values of bit length i, so its upper bound is
+ * 2^i - 1 and the last one is open
+ */
+static void gevent_hist(struct metrics_hist *mh, const uint64_t *hist, uint64_t sum)
+{
+    int i;
+
+    memset(mh, 0, sizeof(*mh));
+    mh->nbounds = GEVENT_HIST_BUCKETS - 1;
+    for (i = 0; i < GEVENT_HIST_BUCKETS; i++) {
+        if (i < mh->nbounds) {
+            mh->bounds[i] = (1ULL << i) - 1;
+        }
+        mh->counts[i] = hist[i];
+        mh->count += hist[i];
+    }
+    mh->sum = sum;
+}
+
+void httpd_metrics_collect(struct metrics_writer *w, void *arg)
+{
+    static const char *classes[5] = {"1xx", "2xx", "3xx", "4xx", "5xx"};
+    struct httpd *h = (struct httpd *)arg;
+    struct httpd_stats *hs;
+    struct gevent_stats *gs;
+    struct metrics_hist mh;
+    char label[64];
+    bool *has;
+    int n = httpd_reactors(h);
+    int i, k;
+
+    if (n <= 0) {
+        return;
+    }
+    hs = calloc(n, sizeof(*hs));
+    gs = calloc(n, sizeof(*gs));
+    has = calloc(n, sizeof(*has));
+    if (!hs || !gs || !has) {
+        goto out;
+    }
+    /* snapshot first, lines of one name must go together */
+    for (i = 0; i < n; i++) {
+        httpd_get_stats(h, i, &hs[i]);
+        has[i] = 0 == gevent_base_stats_get(httpd_base(h, i), &gs[i]);
+    }
+    for (k = 0; k < (int)(sizeof(httpd_fields) / sizeof(httpd_fields[0])); k++) {
+        for (i = 0; i < n; i++) {
+            snprintf(label, sizeof(label), "reactor=\"%d\"", i);
+            metrics_write_counter(w, httpd_fields[k].name, label, httpd_fields[k].help,
+                                  FIELD(&hs[i], &httpd_fields[k]));
+        }
+    }
+    for (i = 0; i < n; i++) {
+        snprintf(label, sizeof(label), "reactor=\"%d\"", i);
+        metrics_write_gauge(w, "httpd_connections", label, "open connections",
+                            (int64_t)(hs[i].accepted - hs[i].closed));
+    }
+    for (i = 0; i < n; i++) {
+        for (k = 0; k < 5; k++) {
+            snprintf(label, sizeof(label), "reactor=\"%d\",code=\"%s\"", i, classes[k]);
+            metrics_write_counter(w, "httpd_replies_total", label, "replies by status class",
+                                  hs[i].replies[k]);
+        }
+    }
+
+    for (k = 0; k < (int)(sizeof(gevent_fields) / sizeof(gevent_fields[0])); k++) {
+        for (i = 0; i < n; i++) {
+            if (has[i]) {
+                snprintf(label, sizeof(label), "reactor=\"%d\"", i);
+                metrics_write_counter(w, gevent_fields[k].name, label, gevent_fields[k].help,
+                                      FIELD(&gs[i], &gevent_fields[k]));
+            }
+        }
+    }
+    for (i = 0; i < n; i++) {
+        if (has[i]) {
+            snprintf(label, sizeof(label), "reactor=\"%d\"", i);
+            gevent_hist(&mh, gs[i].callback_hist, gs[i].callback_us);
+            metrics_write_hist(w, "gevent_callback_us", label, "callback duration", &mh);
+        }
+    }
+    for (i = 0; i < n; i++) {
+        if (has[i]) {
+            snprintf(label, sizeof(label), "reactor=\"%d\"", i);
+            /* every callback is one event of some wakeup */
+            gevent_hist(&mh, gs[i].events_hist, gs[i].callbacks);
+            metrics_write_hist(w, "gevent_events_per_wakeup", label, "callbacks per wakeup", &mh);
+        }
+    }
+    for (i = 0; i < n; i++) {
+        if (has[i]) {
+            snprintf(label, sizeof(label), "reactor=\"%d\"", i);
+            gevent_hist(&mh, gs[i].loop_hist, gs[i].busy_us);
+            metrics_write_hist(w, "gevent_loop_busy_us", label, "busy time per round", &mh);
+        }
+    }
+out:
+    free(hs);
+    free(gs);
+    free(has);
+}
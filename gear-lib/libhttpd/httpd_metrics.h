@@ -0,0 +1,48 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#ifndef HTTPD_METRICS_H
+#define HTTPD_METRICS_H
+
+#include "libhttpd.h"
+#include <libmetrics.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * prometheus endpoint on libhttpd, GET path answers metrics_render of m.
+ * it is rendered in the reactor thread, collectors of m must not block.
+ *
+ * httpd_metrics_collect is a collector of the server itself, httpd_*
+ * counters of each reactor and gevent_* loop stats of reactors started
+ * with httpd_config.stats. add it with
+ * metrics_collector_add(m, httpd_metrics_collect, h) and delete it before
+ * httpd_destroy
+ */
+GEAR_API int httpd_metrics_route(struct httpd *h, const char *path, struct metrics *m);
+GEAR_API void httpd_metrics_collect(struct metrics_writer *w, void *httpd);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,1152 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#include "httpd_stream.h"
+#include <libgevent.h>
+#include <libqueue.h>
+#include <flv_mux.h>
+#include <fmp4muxer.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define STREAM_DEPTH            (64)
+#define STREAM_MAX_PENDING      (1024 * 1024)
+#define STREAM_GOP_MAX          (256)
+#define STREAM_BOUNDARY         "gearframe"
+#define STREAM_ITEM_KEY         ((void *)1)     /* queue_item arg of keyframes */
+
+#define HLS_PART_MS             (200)
+#define HLS_SEGMENT_MS          (2000)
+#define HLS_SEGMENTS            (6)
+#define HLS_SEGMENT_SPARE       (2)     /* kept after leaving playlist */
+#define HLS_PART_HOLD           (3)     /* PART-HOLD-BACK in part targets */
+#define HLS_PART_SEGMENTS       (3)     /* newest segments listing parts */
+
+/* bytes shared by all requests of a file, last reference frees */
+struct stream_buf {
+    int ref;
+    size_t len;
+    uint8_t data[1];
+};
+
+struct hls_part {
+    struct stream_buf *buf;
+    int64_t duration_us;
+    bool independent;
+};
+
+struct hls_segment {
+    uint32_t msn;
+    int64_t duration_us;
+    struct hls_part *parts;
+    int nparts;
+    int max_parts;
+    bool complete;
+};
+
+struct hls_index {
+    struct fmp4_muxer *mux;
+    struct stream_buf *init;
+    struct hls_segment *segs;       /* ring indexed by msn */
+    int cap;
+    int count;
+    uint32_t oldest;
+    uint32_t newest;                /* open segment */
+    int64_t target_us;              /* longest segment so far */
+    int64_t part_target_us;
+    bool frag_open;                 /* fragment bytes in scratch */
+    bool frag_independent;
+    int64_t frag_duration_us;
+};
+
+struct httpd_stream {
+    struct httpd_stream_config conf;
+    size_t prefix_len;
+    struct queue *q;
+    pthread_mutex_t lock;           /* caches and branch set vs subscribe */
+    uint32_t seq;                   /* branch names */
+    uint8_t *scratch;               /* wire bytes of one packet */
+    size_t scratch_len;
+    size_t scratch_cap;
+    struct video_encoder venc;
+    struct audio_encoder aenc;
+    bool has_video;
+    bool has_audio;
+    /* MJPEG */
+    struct queue_item *last;
+    /* FLV */
+    struct flv_muxer *flv;
+    uint8_t *init;                  /* flv header to sequence headers */
+    size_t init_len;
+    bool got_key;
+    struct queue_item *gop[STREAM_GOP_MAX];
+    int gop_cnt;
+    /* LLHLS */
+    struct hls_index hls;
+};
+
+enum hls_file {
+    HLS_PLAYLIST = 0,
+    HLS_INIT,
+    HLS_SEGMENT,
+    HLS_PART,
+};
+
+struct hls_want {
+    enum hls_file file;
+    uint32_t msn;
+    int part;                       /* -1 for none */
+    bool block;                     /* playlist with _HLS_msn */
+};
+
+/* a stream viewer, or a LLHLS request waiting for its part */
+struct stream_viewer {
+    struct httpd_stream *s;
+    struct httpd_conn *c;
+    struct gevent_base *base;
+    struct gevent *ev;
+    struct gevent_wtimer timeout;
+    char name[16];
+    bool skipping;                  /* until next keyframe */
+    bool failed;
+    bool in_cb;
+    struct hls_want want;
+};
+
+static struct stream_buf *stream_buf_new(const void *data, size_t len)
+{
+    struct stream_buf *b = malloc(sizeof(struct stream_buf) + len);
+    if (!b) {
+        printf("malloc stream_buf failed!\n");
+        return NULL;
+    }
+    b->ref = 1;
+    b->len = len;
+    memcpy(b->data, data, len);
+    return b;
+}
+
+static struct stream_buf *stream_buf_get(struct stream_buf *b)
+{
+    __atomic_add_fetch(&b->ref, 1, __ATOMIC_RELAXED);
+    return b;
+}
+
+static void stream_buf_put(struct stream_buf *b)
+{
+    if (b && 0 == __atomic_sub_fetch(&b->ref, 1, __ATOMIC_ACQ_REL)) {
+        free(b);
+    }
+}
+
+static int scratch_append(struct httpd_stream *s, const void *data, size_t len)
+{
+    uint8_t *p;
+    size_t cap;
+
+    if (s->scratch_len + len > s->scratch_cap) {
+        cap = s->scratch_cap ? s->scratch_cap : 64 * 1024;
+        while (cap < s->scratch_len + len) {
+            cap *= 2;
+        }
+        p = realloc(s->scratch, cap);
+        if (!p) {
+            printf("realloc stream scratch failed!\n");
+            return -1;
+        }
+        s->scratch = p;
+        s->scratch_cap = cap;
+    }
+    memcpy(s->scratch + s->scratch_len, data, len);
+    s->scratch_len += len;
+    return 0;
+}
+
+static bool video_is_key(const struct video_packet *vp)
+{
+    const uint8_t *p = vp->data, *end = vp->data + vp->size;
+    bool hevc = vp->encoder.type == VIDEO_CODEC_H265;
+    int type;
+
+    if (vp->key_frame || vp->type == H26X_FRAME_IDR || vp->type == H26X_FRAME_I) {
+        return true;
+    }
+    for (; p + 3 < end; p++) {
+        if (p[0] || p[1] || p[2] != 1) {
+            continue;
+        }
+        type = hevc ? (p[3] >> 1) & 0x3f : p[3] & 0x1f;
+        if (hevc ? (type >= 16 && type <= 23) : type == H264_NAL_IDR_SLICE) {
+            return true;
+        }
+        p += 3;
+    }
+    return false;
+}
+
+/******************************************************************************
+ * fan-out, producer side
+ ******************************************************************************/
+static void gop_clear(struct httpd_stream *s)
+{
+    int i;
+    for (i = 0; i < s->gop_cnt; i++) {
+        queue_item_free(s->q, s->gop[i]);
+    }
+    s->gop_cnt = 0;
+}
+
+/* cache from the last keyframe on, a longer gop isn't cached */
+static void gop_update(struct httpd_stream *s, struct queue_item *it, bool key)
+{
+    if (key) {
+        gop_clear(s);
+    } else if (s->gop_cnt == 0) {
+        return;
+    }
+    if (s->gop_cnt == STREAM_GOP_MAX) {
+        gop_clear(s);
+        return;
+    }
+    s->gop[s->gop_cnt++] = queue_item_get(it);
+}
+
+/*
+ * wire bytes become one item referenced by every viewer, cache and push
+ * go together, so a new viewer sees each item once
+ */
+static int stream_publish(struct httpd_stream *s, const void *data, size_t len, bool key)
+{
+    struct queue_item *it = queue_item_alloc(s->q, (void *)data, len,
+                                             key ? STREAM_ITEM_KEY : NULL);
+    if (!it) {
+        printf("queue_item_alloc failed!\n");
+        return -1;
+    }
+    pthread_mutex_lock(&s->lock);
+    if (s->conf.type == HTTPD_STREAM_MJPEG) {
+        if (s->last) {
+            queue_item_free(s->q, s->last);
+        }
+        s->last = queue_item_get(it);
+    } else if (s->conf.type == HTTPD_STREAM_FLV) {
+        gop_update(s, it, key);
+    }
+    if (s->q->branch_cnt == 0 || 0 != queue_push(s->q, it)) {
+        queue_item_free(s->q, it);
+    }
+    pthread_mutex_unlock(&s->lock);
+    return 0;
+}
+
+static int mjpeg_push(struct httpd_stream *s, struct video_packet *vp)
+{
+    char hdr[128];
+    int n;
+
+    n = snprintf(hdr, sizeof(hdr), "--" STREAM_BOUNDARY "\r\n"
+                 "Content-Type: image/jpeg\r\n"
+                 "Content-Length: %zu\r\n\r\n", vp->size);
+    s->scratch_len = 0;
+    if (0 != scratch_append(s, hdr, n) ||
+        0 != scratch_append(s, vp->data, vp->size) ||
+        0 != scratch_append(s, "\r\n", 2)) {
+        return -1;
+    }
+    return stream_publish(s, s->scratch, s->scratch_len, true);
+}
+
+static int flv_output(void *ctx, uint8_t *data, size_t size, int stream_idx)
+{
+    return scratch_append((struct httpd_stream *)ctx, data, size);
+}
+
+/* offset of the last tag in the first output, the rest is init */
+static size_t flv_last_tag(const uint8_t *data, size_t len)
+{
+    size_t off = 13, last = 13, tag;
+
+    while (off + 11 <= len) {
+        tag = 11 + ((size_t)data[off + 1] << 16 | data[off + 2] << 8 | data[off + 3]) + 4;
+        if (off + tag > len) {
+            break;
+        }
+        last = off;
+        off += tag;
+    }
+    return last;
+}
+
+static int flv_push(struct httpd_stream *s, struct media_packet *pkt)
+{
+    bool key = pkt->type != MEDIA_TYPE_VIDEO || video_is_key(pkt->video);
+    struct video_packet vp;
+    struct media_packet mp;
+    size_t off = 0;
+
+    if (s->has_video && !s->got_key) {
+        /* header and sequence headers come from the first keyframe */
+        if (pkt->type != MEDIA_TYPE_VIDEO || !key) {
+            return 0;
+        }
+        s->got_key = true;
+        if (!pkt->video->encoder.extra_size) {
+            /* no extra data, take the parameter sets in band */
+            vp = *pkt->video;
+            vp.encoder.extra_data = vp.data;
+            vp.encoder.extra_size = vp.size;
+            mp = *pkt;
+            mp.video = &vp;
+            pkt = &mp;
+        }
+    }
+    if (s->has_video && pkt->type == MEDIA_TYPE_AUDIO) {
+        key = false;
+    }
+    s->scratch_len = 0;
+    if (0 != flv_write_packet(s->flv, pkt) || s->scratch_len == 0) {
+        return -1;
+    }
+    if (!s->init) {
+        off = flv_last_tag(s->scratch, s->scratch_len);
+        pthread_mutex_lock(&s->lock);
+        s->init = memdup(s->scratch, off);
+        s->init_len = s->init ? off : 0;
+        pthread_mutex_unlock(&s->lock);
+        if (!s->init) {
+            return -1;
+        }
+    }
+    return stream_publish(s, s->scratch + off, s->scratch_len - off, key);
+}
+
+/******************************************************************************
+ * LLHLS index, producer side
+ ******************************************************************************/
+static struct hls_segment *hls_find(struct hls_index *h, uint32_t msn)
+{
+    if (h->count == 0 || msn < h->oldest || msn > h->newest) {
+        return NULL;
+    }
+    return &h->segs[msn % h->cap];
+}
+
+static void hls_segment_clear(struct hls_segment *seg)
+{
+    int i;
+    for (i = 0; i < seg->nparts; i++) {
+        stream_buf_put(seg->parts[i].buf);
+    }
+    free(seg->parts);
+    memset(seg, 0, sizeof(*seg));
+}
+
+/* open segment msn, the oldest goes once the ring is full */
+static struct hls_segment *hls_open(struct hls_index *h, uint32_t msn)
+{
+    struct hls_segment *seg;
+
+    if (h->count == h->cap) {
+        hls_segment_clear(&h->segs[h->oldest % h->cap]);
+        h->oldest++;
+        h->count--;
+    }
+    if (h->count == 0) {
+        h->oldest = msn;
+    }
+    h->newest = msn;
+    h->count++;
+    seg = &h->segs[msn % h->cap];
+    seg->msn = msn;
+    return seg;
+}
+
+/* the fragment muxed by the last write is one part */
+static void hls_publish(struct httpd_stream *s)
+{
+    struct hls_index *h = &s->hls;
+    struct hls_segment *seg;
+    struct hls_part *p;
+    struct stream_buf *b;
+    struct queue_item *it;
+    uint32_t msn;
+    int max;
+
+    if (!h->frag_open || s->scratch_len == 0) {
+        return;
+    }
+    h->frag_open = false;
+    b = stream_buf_new(s->scratch, s->scratch_len);
+    s->scratch_len = 0;
+    if (!b) {
+        return;
+    }
+    pthread_mutex_lock(&s->lock);
+    seg = h->count ? &h->segs[h->newest % h->cap] : NULL;
+    /* segments start at keyframes, within half a part of the target */
+    if (!seg || (h->frag_independent && seg->nparts &&
+        seg->duration_us + s->conf.part_ms * 500 >= (int64_t)s->conf.segment_ms * 1000)) {
+        if (seg) {
+            seg->complete = true;
+            if (seg->duration_us > h->target_us) {
+                h->target_us = seg->duration_us;
+            }
+        }
+        seg = hls_open(h, seg ? h->newest + 1 : 0);
+    }
+    if (seg->nparts == seg->max_parts) {
+        max = seg->max_parts ? seg->max_parts * 2 : 16;
+        p = realloc(seg->parts, max * sizeof(struct hls_part));
+        if (!p) {
+            pthread_mutex_unlock(&s->lock);
+            stream_buf_put(b);
+            printf("realloc hls parts failed!\n");
+            return;
+        }
+        seg->parts = p;
+        seg->max_parts = max;
+    }
+    p = &seg->parts[seg->nparts++];
+    p->buf = b;
+    p->duration_us = h->frag_duration_us;
+    p->independent = h->frag_independent;
+    seg->duration_us += h->frag_duration_us;
+    if (h->frag_duration_us > h->part_target_us) {
+        h->part_target_us = h->frag_duration_us;
+    }
+    /* wake up blocked requests */
+    msn = seg->msn;
+    if (s->q->branch_cnt > 0) {
+        it = queue_item_alloc(s->q, &msn, sizeof(msn), NULL);
+        if (it && 0 != queue_push(s->q, it)) {
+            queue_item_free(s->q, it);
+        }
+    }
+    pthread_mutex_unlock(&s->lock);
+}
+
+static int hls_write(void *arg, const void *data, size_t len)
+{
+    return scratch_append((struct httpd_stream *)arg, data, len);
+}
+
+/* bytes so far are init.mp4, or a fragment the last write didn't publish */
+static int hls_fragment(void *arg, bool independent, int64_t duration_us)
+{
+    struct httpd_stream *s = (struct httpd_stream *)arg;
+    struct hls_index *h = &s->hls;
+    struct stream_buf *b;
+
+    if (!h->init) {
+        b = stream_buf_new(s->scratch, s->scratch_len);
+        if (!b) {
+            return -1;
+        }
+        pthread_mutex_lock(&s->lock);
+        h->init = b;
+        pthread_mutex_unlock(&s->lock);
+        s->scratch_len = 0;
+    } else {
+        hls_publish(s);
+    }
+    h->frag_open = true;
+    h->frag_independent = independent;
+    h->frag_duration_us = duration_us;
+    return 0;
+}
+
+static int hls_push(struct httpd_stream *s, struct media_packet *pkt)
+{
+    struct hls_index *h = &s->hls;
+    struct fmp4_config conf;
+    struct fmp4_output out;
+    int ret;
+
+    if (!h->mux) {
+        memset(&conf, 0, sizeof(conf));
+        conf.video = s->has_video;
+        conf.audio = s->has_audio;
+        conf.part_ms = s->conf.part_ms;
+        conf.fragment_ms = s->conf.part_ms;
+        memset(&out, 0, sizeof(out));
+        out.write = hls_write;
+        out.fragment = hls_fragment;
+        out.arg = s;
+        h->mux = fmp4_muxer_open_output(&conf, &out);
+        if (!h->mux) {
+            return -1;
+        }
+    }
+    ret = fmp4_muxer_write(h->mux, pkt);
+    hls_publish(s);
+    return ret;
+}
+
+/******************************************************************************
+ * LLHLS requests
+ ******************************************************************************/
+static double us_to_sec(int64_t us)
+{
+    return (double)us / 1000000;
+}
+
+/* media playlist of the segments in window, called with lock held */
+static char *hls_playlist(struct httpd_stream *s, size_t *len)
+{
+    struct hls_index *h = &s->hls;
+    struct hls_segment *seg;
+    struct hls_part *p;
+    uint32_t first, msn;
+    int64_t target = h->target_us, part_target = h->part_target_us;
+    size_t size, n;
+    char *buf;
+    int i;
+
+    first = h->newest + 1 >= (uint32_t)s->conf.segments + h->oldest ?
+            h->newest + 1 - s->conf.segments : h->oldest;
+    size = 512;
+    for (msn = first; msn <= h->newest; msn++) {
+        size += 64 + 96 * h->segs[msn % h->cap].nparts;
+    }
+    buf = malloc(size);
+    if (!buf) {
+        return NULL;
+    }
+    if (target < (int64_t)s->conf.segment_ms * 1000) {
+        target = (int64_t)s->conf.segment_ms * 1000;
+    }
+    if (part_target < (int64_t)s->conf.part_ms * 1000) {
+        part_target = (int64_t)s->conf.part_ms * 1000;
+    }
+    n = snprintf(buf, size,
+                 "#EXTM3U\n"
+                 "#EXT-X-VERSION:6\n"
+                 "#EXT-X-TARGETDURATION:%d\n"
+                 "#EXT-X-PART-INF:PART-TARGET=%.3f\n"
+                 "#EXT-X-SERVER-CONTROL:CAN-BLOCK-RELOAD=YES,PART-HOLD-BACK=%.3f\n"
+                 "#EXT-X-MEDIA-SEQUENCE:%u\n"
+                 "#EXT-X-MAP:URI=\"init.mp4\"\n",
+                 (int)((target + 999999) / 1000000), us_to_sec(part_target),
+                 us_to_sec(part_target * HLS_PART_HOLD), first);
+    for (msn = first; msn <= h->newest; msn++) {
+        seg = &h->segs[msn % h->cap];
+        if (msn + HLS_PART_SEGMENTS > h->newest) {
+            for (i = 0; i < seg->nparts; i++) {
+                p = &seg->parts[i];
+                n += snprintf(buf + n, size - n,
+                              "#EXT-X-PART:DURATION=%.5f,URI=\"part%u.%d.m4s\"%s\n",
+                              us_to_sec(p->duration_us), msn, i,
+                              p->independent ? ",INDEPENDENT=YES" : "");
+            }
+        }
+        if (seg->complete) {
+            n += snprintf(buf + n, size - n, "#EXTINF:%.5f,\nseg%u.m4s\n",
+                          us_to_sec(seg->duration_us), msn);
+        }
+    }
+    seg = &h->segs[h->newest % h->cap];
+    n += snprintf(buf + n, size - n, "#EXT-X-PRELOAD-HINT:TYPE=PART,URI=\"part%u.%d.m4s\"\n",
+                  h->newest, seg->nparts);
+    *len = n;
+    return buf;
+}
+
+/* request is answered at once or, 0, must wait for later parts */
+static int hls_answer(struct httpd_stream *s, struct httpd_conn *c, const struct hls_want *w)
+{
+    struct hls_index *h = &s->hls;
+    struct hls_segment *seg = NULL;
+    struct stream_buf *one[1], **bufs = one;
+    struct iovec iov[1], *vec = iov;
+    const char *type = "video/mp4";
+    char *text = NULL;
+    size_t len = 0;
+    int i, n = 0, status = 0;
+
+    pthread_mutex_lock(&s->lock);
+    if (h->count == 0 || !h->init) {
+        goto wait;
+    }
+    switch (w->file) {
+    case HLS_PLAYLIST:
+        if (w->block) {
+            if (w->msn > h->newest + 2) {
+                status = 400;
+                break;
+            }
+            seg = &h->segs[h->newest % h->cap];
+            if (w->msn > h->newest || (w->msn == h->newest &&
+                (w->part < 0 || w->part >= seg->nparts))) {
+                goto wait;
+            }
+        }
+        text = hls_playlist(s, &len);
+        status = text ? 200 : 500;
+        type = "application/vnd.apple.mpegurl";
+        break;
+    case HLS_INIT:
+        bufs[n++] = stream_buf_get(h->init);
+        status = 200;
+        break;
+    case HLS_SEGMENT:
+        seg = hls_find(h, w->msn);
+        if (!seg) {
+            if (w->msn == h->newest + 1) {
+                goto wait;
+            }
+            status = 404;
+            break;
+        }
+        if (!seg->complete) {
+            goto wait;
+        }
+        if (seg->nparts > 1) {
+            bufs = malloc(seg->nparts * sizeof(*bufs));
+            vec = malloc(seg->nparts * sizeof(*vec));
+            if (!bufs || !vec) {
+                status = 500;
+                break;
+            }
+        }
+        for (i = 0; i < seg->nparts; i++) {
+            bufs[n++] = stream_buf_get(seg->parts[i].buf);
+        }
+        status = 200;
+        break;
+    case HLS_PART:
+        seg = hls_find(h, w->msn);
+        if (seg && w->part < seg->nparts) {
+            bufs[n++] = stream_buf_get(seg->parts[w->part].buf);
+            status = 200;
+            break;
+        }
+        /* the hinted part, or the first one of the next segment */
+        if ((seg && !seg->complete && w->part == seg->nparts) ||
+            (w->msn == h->newest + 1 && w->part == 0)) {
+            goto wait;
+        }
+        status = 404;
+        break;
+    }
+    pthread_mutex_unlock(&s->lock);
+
+    httpd_add_header(c, "Access-Control-Allow-Origin: *");
+    if (status == 200 && text) {
+        httpd_add_header(c, "Cache-Control: no-cache");
+        httpd_reply(c, status, type, text, len);
+    } else if (status == 200) {
+        for (i = 0; i < n; i++) {
+            vec[i].iov_base = bufs[i]->data;
+            vec[i].iov_len = bufs[i]->len;
+        }
+        httpd_replyv(c, status, type, vec, n);
+    } else {
+        httpd_reply(c, status, "text/plain", NULL, 0);
+    }
+    for (i = 0; i < n; i++) {
+        stream_buf_put(bufs[i]);
+    }
+    if (bufs != one) {
+        free(bufs);
+    }
+    if (vec != iov) {
+        free(vec);
+    }
+    free(text);
+    return 1;
+
+wait:
+    pthread_mutex_unlock(&s->lock);
+    return 0;
+}
+
+static int hls_parse(const struct httpd_request *req, const char *name, struct hls_want *w)
+{
+    char query[128], *p;
+    int end = 0;
+
+    memset(w, 0, sizeof(*w));
+    w->part = -1;
+    if (0 == strcmp(name, "index.m3u8")) {
+        w->file = HLS_PLAYLIST;
+        if (req->query.len == 0 || req->query.len >= sizeof(query)) {
+            return 0;
+        }
+        memcpy(query, req->query.array, req->query.len);
+        query[req->query.len] = '\0';
+        p = strstr(query, "_HLS_msn=");
+        if (p) {
+            w->msn = strtoul(p + 9, NULL, 10);
+            w->block = true;
+            p = strstr(query, "_HLS_part=");
+            if (p) {
+                w->part = atoi(p + 10);
+            }
+        }
+        return 0;
+    }
+    if (0 == strcmp(name, "init.mp4")) {
+        w->file = HLS_INIT;
+        return 0;
+    }
+    if (1 == sscanf(name, "seg%u.m4s%n", &w->msn, &end) && end && !name[end]) {
+        w->file = HLS_SEGMENT;
+        return 0;
+    }
+    if (2 == sscanf(name, "part%u.%d.m4s%n", &w->msn, &w->part, &end) && end &&
+        !name[end] && w->part >= 0) {
+        w->file = HLS_PART;
+        return 0;
+    }
+    return -1;
+}
+
+/******************************************************************************
+ * viewers, in the loop thread of their connection
+ ******************************************************************************/
+static void viewer_free(void *arg)
+{
+    struct stream_viewer *v = (struct stream_viewer *)arg;
+    if (v->ev) {
+        gevent_destroy(v->ev);
+    }
+    free(v);
+}
+
+static void viewer_release(struct stream_viewer *v)
+{
+    struct httpd_stream *s = v->s;
+
+    httpd_set_close_cb(v->c, NULL, NULL);
+    gevent_wtimer_del(v->base, &v->timeout);
+    if (v->ev) {
+        gevent_del(v->base, &v->ev);
+    }
+    pthread_mutex_lock(&s->lock);
+    queue_branch_del(s->q, v->name);
+    pthread_mutex_unlock(&s->lock);
+    /* its own event may be dispatching, free it after this round */
+    if (!v->in_cb || 0 != gevent_base_post(v->base, viewer_free, v)) {
+        viewer_free(v);
+    }
+}
+
+static void viewer_on_close(struct httpd_conn *c, void *arg)
+{
+    viewer_release((struct stream_viewer *)arg);
+}
+
+static void viewer_send(struct stream_viewer *v, struct queue_item *it)
+{
+    bool key = it->arg == STREAM_ITEM_KEY;
+
+    if (v->failed || (v->skipping && !key)) {
+        return;
+    }
+    if (httpd_pending(v->c) > v->s->conf.max_pending) {
+        v->skipping = true;
+        return;
+    }
+    v->skipping = false;
+    if (0 != httpd_write(v->c, it->data.iov_base, it->data.iov_len)) {
+        /* the connection reports its close by itself */
+        v->failed = true;
+    }
+}
+
+static void viewer_on_packet(int fd, void *arg)
+{
+    struct stream_viewer *v = (struct stream_viewer *)arg;
+    struct httpd_stream *s = v->s;
+    struct queue_item *it;
+
+    while ((it = queue_branch_pop(s->q, v->name)) != NULL) {
+        viewer_send(v, it);
+        queue_item_free(s->q, it);
+    }
+}
+
+static void waiter_on_wake(int fd, void *arg)
+{
+    struct stream_viewer *v = (struct stream_viewer *)arg;
+    struct httpd_stream *s = v->s;
+    struct queue_item *it;
+
+    while ((it = queue_branch_pop(s->q, v->name)) != NULL) {
+        queue_item_free(s->q, it);
+    }
+    v->in_cb = true;
+    if (hls_answer(s, v->c, &v->want)) {
+        viewer_release(v);
+        return;
+    }
+    v->in_cb = false;
+}
+
+static void waiter_on_timeout(struct gevent_wtimer *t, void *arg)
+{
+    struct stream_viewer *v = (struct stream_viewer *)arg;
+    struct httpd_conn *c = v->c;
+
+    viewer_release(v);
+    httpd_reply(c, 503, "text/plain", NULL, 0);
+}
+
+static void viewer_on_error(int fd, void *arg)
+{
+}
+
+/*
+ * branch and cached items are taken under the lock, every item is either
+ * in the snapshot or in the branch, never both
+ */
+static struct stream_viewer *viewer_create(struct httpd_stream *s, struct httpd_conn *c,
+                bool waiter, struct queue_item **snap, int *nsnap)
+{
+    struct stream_viewer *v = CALLOC(1, struct stream_viewer);
+    struct queue_branch *qb;
+    int i;
+
+    if (!v) {
+        return NULL;
+    }
+    v->s = s;
+    v->c = c;
+    v->base = httpd_conn_base(c);
+    gevent_wtimer_init(&v->timeout, waiter_on_timeout, v);
+    pthread_mutex_lock(&s->lock);
+    snprintf(v->name, sizeof(v->name), "v%u", s->seq++);
+    qb = queue_branch_new(s->q, v->name);
+    if (!qb) {
+        pthread_mutex_unlock(&s->lock);
+        free(v);
+        return NULL;
+    }
+    if (snap) {
+        *nsnap = 0;
+        if (s->conf.type == HTTPD_STREAM_MJPEG && s->last) {
+            snap[(*nsnap)++] = queue_item_get(s->last);
+        } else if (s->conf.type == HTTPD_STREAM_FLV) {
+            for (i = 0; i < s->gop_cnt; i++) {
+                snap[(*nsnap)++] = queue_item_get(s->gop[i]);
+            }
+        }
+    }
+    pthread_mutex_unlock(&s->lock);
+    v->ev = gevent_create(qb->evfd, waiter ? waiter_on_wake : viewer_on_packet, NULL,
+                          viewer_on_error, v);
+    if (!v->ev || -1 == gevent_add(v->base, &v->ev)) {
+        printf("httpd_stream: gevent_add branch fd failed\n");
+        if (v->ev) {
+            gevent_destroy(v->ev);
+            v->ev = NULL;
+        }
+        viewer_release(v);
+        return NULL;
+    }
+    httpd_set_close_cb(c, viewer_on_close, v);
+    return v;
+}
+
+/******************************************************************************
+ * handlers
+ ******************************************************************************/
+static bool method_allowed(struct httpd_conn *c, const struct httpd_request *req)
+{
+    if ((req->method.len == 3 && 0 == memcmp(req->method.array, "GET", 3)) ||
+        (req->method.len == 4 && 0 == memcmp(req->method.array, "HEAD", 4))) {
+        return true;
+    }
+    httpd_add_header(c, "Allow: GET, HEAD");
+    httpd_reply(c, 405, "text/plain", NULL, 0);
+    return false;
+}
+
+static void on_stream(struct httpd_conn *c, const struct httpd_request *req, void *arg)
+{
+    struct httpd_stream *s = (struct httpd_stream *)arg;
+    struct stream_viewer *v;
+    struct queue_item **snap;
+    const char *type;
+    uint8_t *init = NULL;
+    size_t init_len = 0;
+    int i, nsnap = 0;
+
+    if (!method_allowed(c, req)) {
+        return;
+    }
+    if (s->conf.type == HTTPD_STREAM_FLV) {
+        pthread_mutex_lock(&s->lock);
+        init = s->init;
+        init_len = s->init_len;
+        pthread_mutex_unlock(&s->lock);
+        if (!init) {
+            httpd_reply(c, 503, "text/plain", NULL, 0);
+            return;
+        }
+        type = "video/x-flv";
+    } else {
+        type = "multipart/x-mixed-replace; boundary=" STREAM_BOUNDARY;
+    }
+    httpd_add_header(c, "Access-Control-Allow-Origin: *");
+    if (0 != httpd_reply_stream(c, 200, type, s->conf.type == HTTPD_STREAM_FLV)) {
+        return;
+    }
+    snap = malloc(STREAM_GOP_MAX * sizeof(*snap));
+    if (!snap) {
+        httpd_close(c);
+        return;
+    }
+    v = viewer_create(s, c, false, snap, &nsnap);
+    if (!v) {
+        free(snap);
+        httpd_close(c);
+        return;
+    }
+    /* init never changes once set, late joiners decode from the cached gop */
+    httpd_write(c, init, init_len);
+    v->skipping = s->conf.type == HTTPD_STREAM_FLV && nsnap == 0;
+    for (i = 0; i < nsnap; i++) {
+        viewer_send(v, snap[i]);
+        queue_item_free(s->q, snap[i]);
+    }
+    free(snap);
+}
+
+static void on_hls(struct httpd_conn *c, const struct httpd_request *req, void *arg)
+{
+    struct httpd_stream *s = (struct httpd_stream *)arg;
+    struct stream_viewer *v;
+    struct hls_want want;
+    char name[64];
+    size_t len;
+
+    if (!method_allowed(c, req)) {
+        return;
+    }
+    len = req->path.len - s->prefix_len;
+    if (len == 0 || len >= sizeof(name)) {
+        httpd_reply(c, 404, "text/plain", NULL, 0);
+        return;
+    }
+    memcpy(name, req->path.array + s->prefix_len, len);
+    name[len] = '\0';
+    if (0 != hls_parse(req, name, &want)) {
+        httpd_reply(c, 404, "text/plain", NULL, 0);
+        return;
+    }
+    if (hls_answer(s, c, &want)) {
+        return;
+    }
+    /* blocking reload or preload hint, answered when the part is out */
+    if (0 != httpd_defer(c)) {
+        httpd_reply(c, 500, "text/plain", NULL, 0);
+        return;
+    }
+    v = viewer_create(s, c, true, NULL, NULL);
+    if (!v) {
+        httpd_reply(c, 503, "text/plain", NULL, 0);
+        return;
+    }
+    v->want = want;
+    gevent_wtimer_add(v->base, &v->timeout, 3 * s->conf.segment_ms, TIMER_ONESHOT);
+    /* a part may be out between the first answer and the branch */
+    waiter_on_wake(-1, v);
+}
+
+/******************************************************************************
+ * hub
+ ******************************************************************************/
+struct httpd_stream *httpd_stream_create(struct httpd *h, const char *prefix,
+                const struct httpd_stream_config *conf)
+{
+    struct httpd_stream *s;
+
+    if (!h || !prefix || !conf) {
+        return NULL;
+    }
+    s = CALLOC(1, struct httpd_stream);
+    if (!s) {
+        return NULL;
+    }
+    s->conf = *conf;
+    if (s->conf.depth <= 0) {
+        s->conf.depth = STREAM_DEPTH;
+    }
+    if (s->conf.max_pending == 0) {
+        s->conf.max_pending = STREAM_MAX_PENDING;
+    }
+    if (s->conf.part_ms == 0) {
+        s->conf.part_ms = HLS_PART_MS;
+    }
+    if (s->conf.segment_ms == 0) {
+        s->conf.segment_ms = HLS_SEGMENT_MS;
+    }
+    if (s->conf.segments <= 0) {
+        s->conf.segments = HLS_SEGMENTS;
+    }
+    s->prefix_len = strlen(prefix);
+    pthread_mutex_init(&s->lock, NULL);
+    s->q = queue_create();
+    if (!s->q) {
+        goto failed;
+    }
+    /* a slow viewer drops its own oldest items, never blocks the producer */
+    queue_set_mode(s->q, QUEUE_FULL_RING);
+    queue_set_depth(s->q, s->conf.depth);
+    switch (s->conf.type) {
+    case HTTPD_STREAM_MJPEG:
+        break;
+    case HTTPD_STREAM_FLV:
+        s->flv = flv_mux_create(flv_output, s);
+        if (!s->flv) {
+            goto failed;
+        }
+        break;
+    case HTTPD_STREAM_LLHLS:
+        s->hls.cap = s->conf.segments + HLS_SEGMENT_SPARE;
+        s->hls.segs = calloc(s->hls.cap, sizeof(struct hls_segment));
+        if (!s->hls.segs) {
+            goto failed;
+        }
+        break;
+    default:
+        goto failed;
+    }
+    if (0 != httpd_route(h, prefix, s->conf.type == HTTPD_STREAM_LLHLS ? on_hls : on_stream, s)) {
+        printf("httpd_stream: route %s failed\n", prefix);
+        goto failed;
+    }
+    return s;
+
+failed:
+    httpd_stream_destroy(s);
+    return NULL;
+}
+
+void httpd_stream_destroy(struct httpd_stream *s)
+{
+    int i;
+
+    if (!s) {
+        return;
+    }
+    if (s->hls.mux) {
+        fmp4_muxer_close(s->hls.mux);
+    }
+    for (i = 0; s->hls.segs && i < s->hls.cap; i++) {
+        hls_segment_clear(&s->hls.segs[i]);
+    }
+    free(s->hls.segs);
+    stream_buf_put(s->hls.init);
+    if (s->flv) {
+        flv_mux_destroy(s->flv);
+    }
+    if (s->q) {
+        gop_clear(s);
+        if (s->last) {
+            queue_item_free(s->q, s->last);
+        }
+        queue_destroy(s->q);
+    }
+    free(s->init);
+    free(s->venc.extra_data);
+    free(s->aenc.extra_data);
+    free(s->scratch);
+    pthread_mutex_destroy(&s->lock);
+    free(s);
+}
+
+int httpd_stream_add_media(struct httpd_stream *s, struct media_packet *pkt)
+{
+    struct media_packet mp;
+    struct video_packet vp;
+    struct audio_packet ap;
+    uint8_t **extra;
+    size_t size;
+
+    if (!s || !pkt) {
+        return -1;
+    }
+    mp.type = pkt->type;
+    switch (pkt->type) {
+    case MEDIA_TYPE_VIDEO:
+        if (s->has_video) {
+            return -1;
+        }
+        s->venc = pkt->video->encoder;
+        extra = &s->venc.extra_data;
+        size = s->venc.extra_size;
+        vp = *pkt->video;
+        mp.video = &vp;
+        s->has_video = true;
+        break;
+    case MEDIA_TYPE_AUDIO:
+        if (s->has_audio) {
+            return -1;
+        }
+        s->aenc = pkt->audio->encoder;
+        extra = &s->aenc.extra_data;
+        size = s->aenc.extra_size;
+        ap = *pkt->audio;
+        mp.audio = &ap;
+        s->has_audio = true;
+        break;
+    default:
+        return -1;
+    }
+    /* the muxers keep the encoder, extra data must live as long as s */
+    if (*extra && size) {
+        *extra = memdup(*extra, size);
+        if (!*extra) {
+            return -1;
+        }
+    }
+    vp.encoder = s->venc;
+    ap.encoder = s->aenc;
+    if (s->flv) {
+        return flv_mux_add_media(s->flv, &mp);
+    }
+    return 0;
+}
+
+int httpd_stream_push(struct httpd_stream *s, struct media_packet *pkt)
+{
+    if (!s || !pkt) {
+        return -1;
+    }
+    switch (s->conf.type) {
+    case HTTPD_STREAM_MJPEG:
+        if (pkt->type != MEDIA_TYPE_VIDEO || !pkt->video->size) {
+            return -1;
+        }
+        return mjpeg_push(s, pkt->video);
+    case HTTPD_STREAM_FLV:
+        return flv_push(s, pkt);
+    case HTTPD_STREAM_LLHLS:
+        return hls_push(s, pkt);
+    default:
+        break;
+    }
+    return -1;
+}
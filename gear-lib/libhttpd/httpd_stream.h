@@ -0,0 +1,75 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#ifndef HTTPD_STREAM_H
+#define HTTPD_STREAM_H
+
+#include "libhttpd.h"
+#include <libmedia-io.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * live streaming endpoints on libhttpd. each packet pushed is muxed once
+ * into its wire format and fanned out by reference to every viewer through
+ * a libqueue branch, viewers send it from their own reactor. a viewer that
+ * can't keep up skips to the next keyframe, never slowing the others.
+ *
+ * MJPEG   GET prefix, multipart/x-mixed-replace, one JPEG per video packet
+ * FLV     GET prefix, chunked HTTP-FLV of h264/h265 and aac
+ * LLHLS   prefix/index.m3u8, init.mp4, seg<msn>.m4s, part<msn>.<n>.m4s,
+ *         fmp4 partial segments with blocking playlist reload
+ */
+enum httpd_stream_type {
+    HTTPD_STREAM_MJPEG = 0,
+    HTTPD_STREAM_FLV,
+    HTTPD_STREAM_LLHLS,
+};
+
+struct httpd_stream_config {
+    enum httpd_stream_type type;
+    int depth;                      /* packets queued per viewer, 0 for 64 */
+    size_t max_pending;             /* unsent bytes before skipping, 0 for 1MB */
+    uint32_t part_ms;               /* LLHLS part target, 0 for 200 */
+    uint32_t segment_ms;            /* LLHLS segment target, 0 for 2000 */
+    int segments;                   /* LLHLS segments in playlist, 0 for 6 */
+};
+
+struct httpd_stream;
+
+/*
+ * routes prefix on h, so it must be called before httpd_start, and
+ * httpd_stream_destroy after httpd_destroy
+ */
+GEAR_API struct httpd_stream *httpd_stream_create(struct httpd *h, const char *prefix,
+                const struct httpd_stream_config *conf);
+GEAR_API void httpd_stream_destroy(struct httpd_stream *s);
+/* declare a track of FLV and LLHLS from its first packet, before push */
+GEAR_API int httpd_stream_add_media(struct httpd_stream *s, struct media_packet *pkt);
+/* called from the producer thread, pkt is copied */
+GEAR_API int httpd_stream_push(struct httpd_stream *s, struct media_packet *pkt);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
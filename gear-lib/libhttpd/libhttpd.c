@@ -0,0 +1,1282 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#include "libhttpd.h"
+#include <libgevent.h>
+#include <libsock.h>
+#include <libthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define HTTPD_IDLE_TIMEOUT      (30 * 1000)
+#define HTTPD_REQUEST_MAX       (64 * 1024)
+#define HTTPD_EXTRA_HEADER_MAX  (1024)
+#define HTTPD_INLINE_BODY       (4096)  /* smaller bodies go with headers */
+#define HTTPD_IOV_MAX           (16)
+
+struct httpd_shard {
+    struct httpd *httpd;
+    int listen_fd;
+    struct gevent_base *evbase;
+    struct gevent *ev_accept;
+    struct thread *thread;
+    struct list_head conns;
+    struct httpd_stats stats;
+    time_t date_sec;                /* Date header cached per second */
+    char date[32];
+};
+
+struct httpd_route {
+    char *prefix;
+    size_t len;
+    httpd_handler cb;
+    void *arg;
+};
+
+struct httpd {
+    char host[64];
+    uint16_t port;
+    char root[PATH_MAX];
+    bool has_root;
+    int idle_timeout_ms;
+    size_t max_request;
+    bool stats;
+    struct httpd_route routes[HTTPD_ROUTE_MAX];
+    int nroute;
+    struct httpd_shard *shards;
+    int nshard;
+};
+
+struct httpd_conn {
+    struct gevent_conn *gc;
+    struct httpd_shard *shard;
+    struct httpd_request req;
+    const struct httpd_request *cur;    /* request in handler */
+    struct gevent_wtimer idle;
+    struct list_head entry;
+    bool replied;
+    bool waiting;                   /* reply still in flight, hold pipeline */
+    bool deferred;                  /* handler returned, reply comes later */
+    bool streaming;                 /* reply body without end */
+    bool chunked;
+    bool keep_alive;                /* of request being answered */
+    bool head;
+    bool http11;
+    bool close_after;
+    bool closed;
+    httpd_close_cb on_close;
+    void *close_arg;
+    char extra[HTTPD_EXTRA_HEADER_MAX];
+    size_t extra_len;
+};
+
+/******************************************************************************
+ * request parser
+ ******************************************************************************/
+static bool strref_equal_nocase(const struct strref *s, const char *str)
+{
+    size_t n = strlen(str);
+    return s->len == n && strncasecmp(s->array, str, n) == 0;
+}
+
+/* comma separated token list contains token, e.g. Connection: keep-alive */
+static bool strref_has_token(const struct strref *s, const char *token)
+{
+    size_t n = strlen(token);
+    const char *p = s->array, *end = s->array + s->len, *q;
+
+    while (p < end) {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == ',')) {
+            ++p;
+        }
+        q = p;
+        while (q < end && *q != ',') {
+            ++q;
+        }
+        while (q > p && (q[-1] == ' ' || q[-1] == '\t')) {
+            --q;
+        }
+        if ((size_t)(q - p) == n && strncasecmp(p, token, n) == 0) {
+            return true;
+        }
+        while (p < end && *p != ',') {
+            ++p;
+        }
+    }
+    return false;
+}
+
+static const char *line_end(const char *p, const char *end)
+{
+    const char *eol = memchr(p, '\n', end - p);
+    return eol ? eol : end;
+}
+
+static struct strref trim(const char *p, const char *end)
+{
+    struct strref s;
+    while (p < end && (*p == ' ' || *p == '\t')) {
+        ++p;
+    }
+    while (end > p && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r')) {
+        --end;
+    }
+    strref_set(&s, p, end - p);
+    return s;
+}
+
+static int content_length(const struct httpd_request *r, size_t max, size_t *clen)
+{
+    const struct strref *h = httpd_request_header(r, "Content-Length");
+    size_t i, n = 0;
+
+    *clen = 0;
+    if (!h) {
+        return 0;
+    }
+    if (h->len == 0) {
+        return -1;
+    }
+    for (i = 0; i < h->len; i++) {
+        if (!isdigit((unsigned char)h->array[i]) || n > max) {
+            return -1;
+        }
+        n = n * 10 + (h->array[i] - '0');
+    }
+    if (n > max) {
+        return -1;
+    }
+    *clen = n;
+    return 0;
+}
+
+const struct strref *httpd_request_header(const struct httpd_request *r, const char *name)
+{
+    int i;
+    for (i = 0; i < r->nheader; i++) {
+        if (strref_equal_nocase(&r->headers[i].name, name)) {
+            return &r->headers[i].value;
+        }
+    }
+    return NULL;
+}
+
+int httpd_request_parse(struct httpd_request *r, const char *buf, size_t len, size_t max)
+{
+    const char *start = buf, *end, *p, *eol, *sp, *q;
+    const struct strref *h;
+    size_t i, hdr, clen;
+    struct httpd_header *hd;
+
+    /* be liberal, skip line breaks left between pipelined requests */
+    while (start < buf + len && (*start == '\r' || *start == '\n')) {
+        ++start;
+    }
+    if (start == buf + len) {
+        r->scanned = 0;
+        return 0;
+    }
+    /* end of headers is an empty line, only new bytes are searched */
+    hdr = 0;
+    i = r->scanned > (size_t)(start - buf) ? r->scanned : (size_t)(start - buf);
+    for (; i < len; i++) {
+        if (buf[i] != '\n') {
+            continue;
+        }
+        if (i + 1 < len && buf[i + 1] == '\n') {
+            hdr = i + 2;
+            break;
+        }
+        if (i + 2 < len && buf[i + 1] == '\r' && buf[i + 2] == '\n') {
+            hdr = i + 3;
+            break;
+        }
+        if (i + 2 >= len) {
+            break;
+        }
+    }
+    r->scanned = i;
+    if (hdr == 0) {
+        return 0;
+    }
+
+    end = buf + hdr;
+    eol = line_end(start, end);
+    p = start;
+    sp = memchr(p, ' ', eol - p);
+    if (!sp) {
+        return -1;
+    }
+    strref_set(&r->method, p, sp - p);
+    p = sp + 1;
+    while (p < eol && *p == ' ') {
+        ++p;
+    }
+    sp = memchr(p, ' ', eol - p);
+    if (!sp) {
+        return -1;
+    }
+    strref_set(&r->uri, p, sp - p);
+    r->version = trim(sp + 1, eol);
+    if (r->method.len == 0 || r->uri.len == 0 || r->version.len != 8 ||
+        strncmp(r->version.array, "HTTP/1.", 7) != 0) {
+        return -1;
+    }
+    q = memchr(r->uri.array, '?', r->uri.len);
+    if (q) {
+        strref_set(&r->path, r->uri.array, q - r->uri.array);
+        strref_set(&r->query, q + 1, r->uri.array + r->uri.len - q - 1);
+    } else {
+        strref_copy(&r->path, &r->uri);
+        strref_clear(&r->query);
+    }
+
+    r->nheader = 0;
+    for (p = eol + 1; p < end; p = eol + 1) {
+        eol = line_end(p, end);
+        if (*p == '\r' || *p == '\n') {
+            break;
+        }
+        if (*p == ' ' || *p == '\t') {
+            /* obsolete line folding, RFC 7230 3.2.4 */
+            return -1;
+        }
+        sp = memchr(p, ':', eol - p);
+        if (!sp) {
+            return -1;
+        }
+        if (r->nheader == HTTPD_HEADER_MAX) {
+            continue;
+        }
+        hd = &r->headers[r->nheader++];
+        hd->name = trim(p, sp);
+        hd->value = trim(sp + 1, eol);
+    }
+
+    h = httpd_request_header(r, "Connection");
+    if (r->version.array[7] == '0') {
+        r->keep_alive = h && strref_has_token(h, "keep-alive");
+    } else {
+        r->keep_alive = !(h && strref_has_token(h, "close"));
+    }
+    h = httpd_request_header(r, "Transfer-Encoding");
+    r->chunked = h != NULL;
+    if (-1 == content_length(r, max, &clen)) {
+        return -1;
+    }
+    if (hdr + clen > len) {
+        /* headers are complete, resume right at the empty line */
+        return 0;
+    }
+    strref_set(&r->body, buf + hdr, clen);
+    strref_set(&r->raw, start, hdr + clen - (start - buf));
+    r->scanned = 0;
+    return (int)(hdr + clen);
+}
+
+/******************************************************************************
+ * reply
+ ******************************************************************************/
+static const char *status_text(int status)
+{
+    switch (status) {
+    case 200: return "OK";
+    case 204: return "No Content";
+    case 206: return "Partial Content";
+    case 301: return "Moved Permanently";
+    case 302: return "Found";
+    case 304: return "Not Modified";
+    case 400: return "Bad Request";
+    case 403: return "Forbidden";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 413: return "Payload Too Large";
+    case 416: return "Range Not Satisfiable";
+    case 431: return "Request Header Fields Too Large";
+    case 500: return "Internal Server Error";
+    case 501: return "Not Implemented";
+    case 503: return "Service Unavailable";
+    default:  return "Unknown";
+    }
+}
+
+static const char *mime_type(const char *path)
+{
+    static const struct {
+        const char *ext;
+        const char *type;
+    } types[] = {
+        {"html", "text/html; charset=utf-8"},
+        {"htm",  "text/html; charset=utf-8"},
+        {"css",  "text/css"},
+        {"js",   "application/javascript"},
+        {"json", "application/json"},
+        {"txt",  "text/plain; charset=utf-8"},
+        {"png",  "image/png"},
+        {"jpg",  "image/jpeg"},
+        {"jpeg", "image/jpeg"},
+        {"gif",  "image/gif"},
+        {"svg",  "image/svg+xml"},
+        {"ico",  "image/x-icon"},
+        {"mp4",  "video/mp4"},
+        {"m4s",  "video/iso.segment"},
+        {"flv",  "video/x-flv"},
+        {"264",  "video/h264"},
+        {"h264", "video/h264"},
+        {"m3u8", "application/vnd.apple.mpegurl"},
+        {"ts",   "video/mp2t"},
+    };
+    const char *dot = strrchr(path, '.');
+    size_t i;
+
+    if (dot && !strchr(dot, '/')) {
+        for (i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+            if (strcasecmp(dot + 1, types[i].ext) == 0) {
+                return types[i].type;
+            }
+        }
+    }
+    return "application/octet-stream";
+}
+
+static const char *shard_date(struct httpd_shard *s)
+{
+    struct tm tm;
+    time_t now = time(NULL);
+
+    if (now != s->date_sec) {
+        gmtime_r(&now, &tm);
+        strftime(s->date, sizeof(s->date), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+        s->date_sec = now;
+    }
+    return s->date;
+}
+
+static void conn_resume(void *arg);
+
+/* a deferred reply resumes the pipeline once the handler round is over */
+static void reply_done(struct httpd_conn *c)
+{
+    if (!c->deferred) {
+        return;
+    }
+    c->deferred = false;
+    if (0 != gevent_base_post(c->shard->evbase, conn_resume, c)) {
+        c->close_after = true;
+    }
+}
+
+/*
+ * status line and common headers into buf, return length or -1.
+ * len < 0 leaves out Content-Length, body then ends with chunks or close
+ */
+static int reply_header(struct httpd_conn *c, char *buf, size_t size,
+                int status, const char *type, int64_t len)
+{
+    char clen[48];
+    int n;
+    bool keep = c->keep_alive && !c->close_after;
+
+    if (status >= 100 && status < 600) {
+        c->shard->stats.replies[status / 100 - 1]++;
+    }
+
+    if (len >= 0) {
+        snprintf(clen, sizeof(clen), "Content-Length: %lld\r\n", (long long)len);
+    } else {
+        snprintf(clen, sizeof(clen), "%s",
+                 c->chunked ? "Transfer-Encoding: chunked\r\n" : "");
+    }
+    n = snprintf(buf, size,
+                 "HTTP/1.1 %d %s\r\n"
+                 "Date: %s\r\n"
+                 "Server: libhttpd/" LIBHTTPD_VERSION "\r\n"
+                 "%s"
+                 "%s%s%s"
+                 "Connection: %s\r\n"
+                 "%.*s\r\n",
+                 status, status_text(status), shard_date(c->shard), clen,
+                 type ? "Content-Type: " : "", type ? type : "", type ? "\r\n" : "",
+                 keep ? "keep-alive" : "close",
+                 (int)c->extra_len, c->extra);
+    c->extra_len = 0;
+    if (!keep) {
+        c->close_after = true;
+    }
+    if (n < 0 || (size_t)n >= size) {
+        return -1;
+    }
+    return n;
+}
+
+int httpd_add_header(struct httpd_conn *c, const char *fmt, ...)
+{
+    va_list ap;
+    int n;
+    size_t room;
+
+    if (!c || !fmt) {
+        return -1;
+    }
+    room = sizeof(c->extra) - c->extra_len;
+    va_start(ap, fmt);
+    n = vsnprintf(c->extra + c->extra_len, room, fmt, ap);
+    va_end(ap);
+    if (n < 0 || (size_t)n + 2 >= room) {
+        c->extra[c->extra_len] = '\0';
+        return -1;
+    }
+    memcpy(c->extra + c->extra_len + n, "\r\n", 2);
+    c->extra_len += n + 2;
+    return 0;
+}
+
+int httpd_reply(struct httpd_conn *c, int status, const char *type,
+                const void *body, size_t len)
+{
+    char buf[HTTPD_EXTRA_HEADER_MAX + 512 + HTTPD_INLINE_BODY];
+    struct iovec iov[2];
+    int n;
+
+    if (!c || c->replied || c->closed || (len && !body)) {
+        return -1;
+    }
+    c->replied = true;
+    reply_done(c);
+    n = reply_header(c, buf, sizeof(buf) - HTTPD_INLINE_BODY, status, type, len);
+    if (n < 0) {
+        return -1;
+    }
+    if (c->head) {
+        len = 0;
+    }
+    if (len <= HTTPD_INLINE_BODY) {
+        /* one send for small replies */
+        if (len) {
+            memcpy(buf + n, body, len);
+        }
+        return gevent_conn_write(c->gc, buf, n + len);
+    }
+    iov[0].iov_base = buf;
+    iov[0].iov_len = n;
+    iov[1].iov_base = (void *)body;
+    iov[1].iov_len = len;
+    return gevent_conn_writev(c->gc, iov, 2);
+}
+
+int httpd_replyv(struct httpd_conn *c, int status, const char *type,
+                const struct iovec *iov, int cnt)
+{
+    char buf[HTTPD_EXTRA_HEADER_MAX + 512];
+    struct iovec vec[HTTPD_IOV_MAX];
+    size_t len = 0;
+    int i, n, ret;
+
+    if (!c || c->replied || c->closed || cnt < 0 || (cnt && !iov)) {
+        return -1;
+    }
+    for (i = 0; i < cnt; i++) {
+        len += iov[i].iov_len;
+    }
+    c->replied = true;
+    reply_done(c);
+    n = reply_header(c, buf, sizeof(buf), status, type, len);
+    if (n < 0) {
+        return -1;
+    }
+    if (c->head) {
+        cnt = 0;
+    }
+    vec[0].iov_base = buf;
+    vec[0].iov_len = n;
+    i = 0;
+    n = 1;
+    do {
+        while (n < HTTPD_IOV_MAX && i < cnt) {
+            vec[n++] = iov[i++];
+        }
+        ret = gevent_conn_writev(c->gc, vec, n);
+        n = 0;
+    } while (ret == 0 && i < cnt);
+    return ret;
+}
+
+int httpd_reply_stream(struct httpd_conn *c, int status, const char *type, bool chunked)
+{
+    char buf[HTTPD_EXTRA_HEADER_MAX + 512];
+    int n;
+
+    if (!c || c->replied || c->closed) {
+        return -1;
+    }
+    c->replied = true;
+    reply_done(c);
+    /* http/1.0 has no chunks, its stream ends with the connection */
+    c->chunked = chunked && c->http11;
+    if (!c->chunked) {
+        c->close_after = true;
+    }
+    httpd_add_header(c, "Cache-Control: no-cache");
+    n = reply_header(c, buf, sizeof(buf), status, type, -1);
+    if (n < 0 || 0 != gevent_conn_write(c->gc, buf, n) || c->head) {
+        c->chunked = false;
+        return -1;
+    }
+    c->streaming = true;
+    gevent_wtimer_del(c->shard->evbase, &c->idle);
+    return 0;
+}
+
+int httpd_write(struct httpd_conn *c, const void *data, size_t len)
+{
+    char hdr[24];
+    struct iovec iov[3];
+
+    if (!c || !c->streaming || c->closed || (len && !data)) {
+        return -1;
+    }
+    if (len == 0) {
+        return 0;
+    }
+    if (!c->chunked) {
+        return gevent_conn_write(c->gc, data, len);
+    }
+    iov[0].iov_base = hdr;
+    iov[0].iov_len = snprintf(hdr, sizeof(hdr), "%zx\r\n", len);
+    iov[1].iov_base = (void *)data;
+    iov[1].iov_len = len;
+    iov[2].iov_base = "\r\n";
+    iov[2].iov_len = 2;
+    return gevent_conn_writev(c->gc, iov, 3);
+}
+
+int httpd_defer(struct httpd_conn *c)
+{
+    if (!c || !c->cur || c->replied || c->deferred) {
+        return -1;
+    }
+    c->deferred = true;
+    return 0;
+}
+
+void httpd_set_close_cb(struct httpd_conn *c, httpd_close_cb cb, void *arg)
+{
+    if (c) {
+        c->on_close = cb;
+        c->close_arg = arg;
+    }
+}
+
+size_t httpd_pending(struct httpd_conn *c)
+{
+    return c ? gevent_conn_pending(c->gc) : 0;
+}
+
+static void conn_close(struct httpd_conn *c);
+
+void httpd_close(struct httpd_conn *c)
+{
+    if (c) {
+        conn_close(c);
+    }
+}
+
+struct gevent_base *httpd_conn_base(struct httpd_conn *c)
+{
+    return c ? c->shard->evbase : NULL;
+}
+
+static int reply_error(struct httpd_conn *c, int status)
+{
+    char body[64];
+    int n = snprintf(body, sizeof(body), "%d %s\n", status, status_text(status));
+    return httpd_reply(c, status, "text/plain; charset=utf-8", body, n);
+}
+
+/* single range of bytes=a-b, bytes=a- or bytes=-n, 1 if valid, 0 if none */
+static int parse_range(const struct strref *h, size_t size, size_t *off, size_t *len)
+{
+    char tmp[64], *p, *end;
+    unsigned long long a, b;
+
+    if (h->len >= sizeof(tmp) || h->len < 7 || strncasecmp(h->array, "bytes=", 6)) {
+        return 0;
+    }
+    memcpy(tmp, h->array + 6, h->len - 6);
+    tmp[h->len - 6] = '\0';
+    if (strchr(tmp, ',')) {
+        /* multipart ranges, send whole file */
+        return 0;
+    }
+    p = tmp;
+    if (*p == '-') {
+        b = strtoull(p + 1, &end, 10);
+        if (end == p + 1 || *end || b == 0) {
+            return -1;
+        }
+        *len = b < size ? b : size;
+        *off = size - *len;
+        return size ? 1 : -1;
+    }
+    a = strtoull(p, &end, 10);
+    if (end == p || *end != '-') {
+        return -1;
+    }
+    p = end + 1;
+    if (*p) {
+        b = strtoull(p, &end, 10);
+        if (*end || b < a) {
+            return -1;
+        }
+    } else {
+        b = size - 1;
+    }
+    if (a >= size) {
+        return -1;
+    }
+    if (b >= size) {
+        b = size - 1;
+    }
+    *off = a;
+    *len = b - a + 1;
+    return 1;
+}
+
+int httpd_reply_file(struct httpd_conn *c, const char *path, const char *type)
+{
+    char buf[HTTPD_EXTRA_HEADER_MAX + 512];
+    char mtime[32];
+    struct stat st;
+    struct tm tm;
+    const struct strref *h;
+    size_t off = 0, len;
+    int fd, n, status = 200, ret;
+
+    if (!c || !path || c->replied || c->closed) {
+        return -1;
+    }
+    reply_done(c);
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return reply_error(c, errno == EACCES ? 403 : 404);
+    }
+    if (-1 == fstat(fd, &st) || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return reply_error(c, 404);
+    }
+    gmtime_r(&st.st_mtime, &tm);
+    strftime(mtime, sizeof(mtime), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    h = c->cur ? httpd_request_header(c->cur, "If-Modified-Since") : NULL;
+    if (h && strref_equal_nocase(h, mtime)) {
+        close(fd);
+        httpd_add_header(c, "Last-Modified: %s", mtime);
+        c->replied = true;
+        n = reply_header(c, buf, sizeof(buf), 304, NULL, 0);
+        /* 304 has no body, Content-Length of 0 is harmless */
+        return n < 0 ? -1 : gevent_conn_write(c->gc, buf, n);
+    }
+    len = st.st_size;
+    h = c->cur ? httpd_request_header(c->cur, "Range") : NULL;
+    if (h) {
+        ret = parse_range(h, st.st_size, &off, &len);
+        if (ret < 0) {
+            close(fd);
+            httpd_add_header(c, "Content-Range: bytes */%lld", (long long)st.st_size);
+            return reply_error(c, 416);
+        }
+        if (ret > 0) {
+            status = 206;
+            httpd_add_header(c, "Content-Range: bytes %zu-%zu/%lld",
+                             off, off + len - 1, (long long)st.st_size);
+        }
+    }
+    httpd_add_header(c, "Accept-Ranges: bytes");
+    httpd_add_header(c, "Last-Modified: %s", mtime);
+    c->replied = true;
+    n = reply_header(c, buf, sizeof(buf), status, type ? type : mime_type(path), len);
+    if (n < 0 || 0 != gevent_conn_write(c->gc, buf, n)) {
+        close(fd);
+        return -1;
+    }
+    if (c->head) {
+        close(fd);
+        return 0;
+    }
+    /* gevent_conn owns fd from here */
+    return gevent_conn_sendfile(c->gc, fd, off, len);
+}
+
+int httpd_conn_fd(struct httpd_conn *c)
+{
+    return c ? gevent_conn_fd(c->gc) : -1;
+}
+
+/******************************************************************************
+ * static files
+ ******************************************************************************/
+static int hexval(int ch)
+{
+    if (ch >= '0' && ch <= '9') return ch - '0';
+    if (ch >= 'a' && ch <= 'f') return ch - 'a' + 10;
+    if (ch >= 'A' && ch <= 'F') return ch - 'A' + 10;
+    return -1;
+}
+
+/* percent decode path, reject NUL and dot-dot segments */
+static int decode_path(const struct strref *path, char *out, size_t size)
+{
+    size_t i, n = 0;
+    int hi, lo;
+    char ch;
+
+    for (i = 0; i < path->len; i++) {
+        ch = path->array[i];
+        if (ch == '%') {
+            if (i + 2 >= path->len) {
+                return -1;
+            }
+            hi = hexval((unsigned char)path->array[i + 1]);
+            lo = hexval((unsigned char)path->array[i + 2]);
+            if (hi < 0 || lo < 0) {
+                return -1;
+            }
+            ch = (char)(hi << 4 | lo);
+            i += 2;
+        }
+        if (ch == '\0' || n + 1 >= size) {
+            return -1;
+        }
+        out[n++] = ch;
+    }
+    out[n] = '\0';
+    if (out[0] != '/' || strstr(out, "/../") ||
+        (n >= 3 && strcmp(out + n - 3, "/..") == 0)) {
+        return -1;
+    }
+    return 0;
+}
+
+static void serve_static(struct httpd_conn *c, const struct httpd_request *req)
+{
+    struct httpd *h = c->shard->httpd;
+    char path[PATH_MAX], file[PATH_MAX];
+    struct stat st;
+    int n;
+
+    if (!h->has_root) {
+        reply_error(c, 404);
+        return;
+    }
+    if (!strref_equal_nocase(&req->method, "GET") &&
+        !strref_equal_nocase(&req->method, "HEAD")) {
+        httpd_add_header(c, "Allow: GET, HEAD");
+        reply_error(c, 405);
+        return;
+    }
+    if (0 != decode_path(&req->path, path, sizeof(path))) {
+        reply_error(c, 400);
+        return;
+    }
+    n = snprintf(file, sizeof(file), "%s%s", h->root, path);
+    if (n < 0 || (size_t)n >= sizeof(file)) {
+        reply_error(c, 404);
+        return;
+    }
+    if (0 == stat(file, &st) && S_ISDIR(st.st_mode)) {
+        if (file[n - 1] != '/') {
+            httpd_add_header(c, "Location: %s/", path);
+            reply_error(c, 301);
+            return;
+        }
+        if ((size_t)n + sizeof("index.html") > sizeof(file)) {
+            reply_error(c, 404);
+            return;
+        }
+        strcpy(file + n, "index.html");
+    }
+    httpd_reply_file(c, file, NULL);
+}
+
+/******************************************************************************
+ * connection
+ ******************************************************************************/
+static struct mem_account conn_mem = MEM_ACCOUNT_INIT("httpd_conn");
+
+static void conn_free(void *arg)
+{
+    free(arg);
+    mem_account_charge(&conn_mem, -(int64_t)sizeof(struct httpd_conn), -1);
+}
+
+static void conn_close_notify(struct httpd_conn *c)
+{
+    httpd_close_cb cb = c->on_close;
+
+    c->on_close = NULL;
+    if (cb) {
+        cb(c, c->close_arg);
+    }
+}
+
+static void conn_close(struct httpd_conn *c)
+{
+    if (c->closed) {
+        return;
+    }
+    c->closed = true;
+    c->shard->stats.closed++;
+    conn_close_notify(c);
+    gevent_wtimer_del(c->shard->evbase, &c->idle);
+    list_del(&c->entry);
+    gevent_conn_destroy(c->gc);
+    /* may be inside callbacks that still look at c, free after this round */
+    if (0 != gevent_base_post(c->shard->evbase, conn_free, c)) {
+        conn_free(c);
+    }
+}
+
+static void conn_dispatch(struct httpd_conn *c, const struct httpd_request *req)
+{
+    struct httpd *h = c->shard->httpd;
+    struct httpd_route *best = NULL;
+    int i;
+
+    c->shard->stats.requests++;
+    c->replied = false;
+    c->extra_len = 0;
+    c->cur = req;
+    c->keep_alive = req->keep_alive;
+    c->head = strref_equal_nocase(&req->method, "HEAD");
+    c->http11 = req->version.array[7] != '0';
+    for (i = 0; i < h->nroute; i++) {
+        if (req->path.len >= h->routes[i].len &&
+            0 == memcmp(req->path.array, h->routes[i].prefix, h->routes[i].len) &&
+            (!best || h->routes[i].len > best->len)) {
+            best = &h->routes[i];
+        }
+    }
+    if (best) {
+        best->cb(c, req, best->arg);
+        if (!c->replied && !c->deferred) {
+            printf("httpd: handler of %s gave no reply\n", best->prefix);
+            reply_error(c, 500);
+        }
+    } else {
+        serve_static(c, req);
+    }
+    c->cur = NULL;
+}
+
+/* handle every complete request in buffer, one reply in flight at a time */
+static void conn_process(struct httpd_conn *c)
+{
+    struct httpd *h = c->shard->httpd;
+    const char *data;
+    size_t len;
+    int n;
+
+    while (!c->closed && !c->waiting && !c->deferred && !c->streaming && !c->close_after) {
+        data = gevent_conn_peek(c->gc, &len);
+        if (len == 0) {
+            break;
+        }
+        /* errors below answer no request, nothing of the last one applies */
+        c->replied = false;
+        c->keep_alive = false;
+        c->head = false;
+        n = httpd_request_parse(&c->req, data, len, h->max_request);
+        if (n == 0) {
+            if (len > h->max_request + HTTPD_EXTRA_HEADER_MAX) {
+                c->close_after = true;
+                reply_error(c, 431);
+            }
+            break;
+        }
+        if (n < 0) {
+            c->close_after = true;
+            reply_error(c, 400);
+            break;
+        }
+        if (c->req.chunked) {
+            c->close_after = true;
+            c->cur = &c->req;
+            reply_error(c, 501);
+            c->cur = NULL;
+            break;
+        }
+        conn_dispatch(c, &c->req);
+        gevent_conn_consume(c->gc, n);
+        if (c->deferred || c->streaming) {
+            /* waits on its source, not on the client */
+            gevent_wtimer_del(c->shard->evbase, &c->idle);
+        } else if (gevent_conn_pending(c->gc) > 0) {
+            /* a long download is not idle, timer restarts when it's sent */
+            c->waiting = true;
+            gevent_wtimer_del(c->shard->evbase, &c->idle);
+        }
+    }
+    if (!c->closed && !c->deferred && !c->streaming && c->close_after &&
+        gevent_conn_pending(c->gc) == 0) {
+        conn_close(c);
+    }
+}
+
+static void conn_resume(void *arg)
+{
+    struct httpd_conn *c = (struct httpd_conn *)arg;
+
+    if (c->closed || c->deferred || c->streaming) {
+        return;
+    }
+    if (gevent_conn_pending(c->gc) > 0) {
+        /* on_drain goes on */
+        c->waiting = true;
+        return;
+    }
+    gevent_wtimer_add(c->shard->evbase, &c->idle, c->shard->httpd->idle_timeout_ms,
+                      TIMER_ONESHOT);
+    conn_process(c);
+}
+
+static void on_read(struct gevent_conn *gc, void *arg)
+{
+    struct httpd_conn *c = (struct httpd_conn *)arg;
+    struct httpd *h = c->shard->httpd;
+    size_t len;
+
+    if (c->streaming) {
+        /* nothing more is read from a stream viewer */
+        gevent_conn_peek(gc, &len);
+        gevent_conn_consume(gc, len);
+        return;
+    }
+    if (!c->waiting && !c->deferred) {
+        /* re-arms a pending timer */
+        gevent_wtimer_add(c->shard->evbase, &c->idle, h->idle_timeout_ms, TIMER_ONESHOT);
+    }
+    gevent_conn_peek(gc, &len);
+    if ((c->waiting || c->deferred) &&
+        len > 2 * (h->max_request + HTTPD_EXTRA_HEADER_MAX)) {
+        /* pipelining without reading replies */
+        conn_close(c);
+        return;
+    }
+    conn_process(c);
+}
+
+static void on_drain(struct gevent_conn *gc, void *arg)
+{
+    struct httpd_conn *c = (struct httpd_conn *)arg;
+    c->waiting = false;
+    if (c->streaming || c->deferred) {
+        return;
+    }
+    if (c->close_after) {
+        conn_close(c);
+        return;
+    }
+    gevent_wtimer_add(c->shard->evbase, &c->idle, c->shard->httpd->idle_timeout_ms,
+                      TIMER_ONESHOT);
+    conn_process(c);
+}
+
+static void on_close(struct gevent_conn *gc, int err, void *arg)
+{
+    conn_close((struct httpd_conn *)arg);
+}
+
+static void on_idle(struct gevent_wtimer *t, void *arg)
+{
+    conn_close((struct httpd_conn *)arg);
+}
+
+static const struct gevent_conn_cbs conn_cbs = {
+    .on_read  = on_read,
+    .on_drain = on_drain,
+    .on_close = on_close,
+};
+
+static void on_accept(int fd, void *arg)
+{
+    struct httpd_shard *s = (struct httpd_shard *)arg;
+    struct httpd_conn *c;
+    uint32_t ip;
+    uint16_t port;
+    int afd;
+
+    /* listen fd is nonblock and edge triggered, accept until EAGAIN */
+    while (1) {
+        afd = sock_accept(fd, &ip, &port);
+        if (afd == -1) {
+            return;
+        }
+        c = CALLOC(1, struct httpd_conn);
+        if (!c) {
+            sock_close(afd);
+            continue;
+        }
+        c->shard = s;
+        c->gc = gevent_conn_create(s->evbase, afd, &conn_cbs, c);
+        if (!c->gc) {
+            sock_close(afd);
+            free(c);
+            continue;
+        }
+        list_add_tail(&c->entry, &s->conns);
+        s->stats.accepted++;
+        mem_account_charge(&conn_mem, sizeof(struct httpd_conn), 1);
+        gevent_wtimer_init(&c->idle, on_idle, c);
+        gevent_wtimer_add(s->evbase, &c->idle, s->httpd->idle_timeout_ms, TIMER_ONESHOT);
+    }
+}
+
+static void on_accept_err(int fd, void *arg)
+{
+    printf("httpd: listen fd %d error\n", fd);
+}
+
+/******************************************************************************
+ * shards
+ ******************************************************************************/
+static void *shard_loop(struct thread *t, void *arg)
+{
+    struct httpd_shard *s = (struct httpd_shard *)arg;
+    gevent_base_loop(s->evbase);
+    return NULL;
+}
+
+static void shard_destroy(struct httpd_shard *s)
+{
+    struct httpd_conn *c, *next;
+
+    if (s->thread) {
+        gevent_base_loop_break(s->evbase);
+        thread_join(s->thread);
+        thread_destroy(s->thread);
+        s->thread = NULL;
+    }
+    list_for_each_entry_safe(c, next, &s->conns, entry) {
+        c->closed = true;
+        conn_close_notify(c);
+        gevent_wtimer_del(s->evbase, &c->idle);
+        list_del(&c->entry);
+        gevent_conn_destroy(c->gc);
+        conn_free(c);
+    }
+    if (s->ev_accept) {
+        gevent_del(s->evbase, &s->ev_accept);
+        gevent_destroy(s->ev_accept);
+        s->ev_accept = NULL;
+    }
+    if (s->evbase) {
+        /* runs posted conn_free of connections closed last round */
+        gevent_base_destroy(s->evbase);
+        s->evbase = NULL;
+    }
+    if (s->listen_fd != -1) {
+        sock_close(s->listen_fd);
+        s->listen_fd = -1;
+    }
+}
+
+static int shard_create(struct httpd *h, struct httpd_shard *s)
+{
+    s->httpd = h;
+    INIT_LIST_HEAD(&s->conns);
+    /* sock_tcp_bind_listen sets SO_REUSEPORT, kernel spreads connections */
+    s->listen_fd = sock_tcp_bind_listen(h->host, h->port);
+    if (s->listen_fd == -1) {
+        goto failed;
+    }
+    sock_set_noblk(s->listen_fd, 1);
+    s->evbase = gevent_base_create();
+    if (!s->evbase) {
+        goto failed;
+    }
+    if (h->stats) {
+        gevent_base_stats_enable(s->evbase, true);
+    }
+    s->ev_accept = gevent_create(s->listen_fd, on_accept, NULL, on_accept_err, s);
+    if (!s->ev_accept || -1 == gevent_add(s->evbase, &s->ev_accept)) {
+        printf("httpd: gevent_add listen fd failed\n");
+        goto failed;
+    }
+    s->thread = thread_create(shard_loop, s);
+    if (!s->thread) {
+        printf("httpd: thread_create failed\n");
+        goto failed;
+    }
+    return 0;
+
+failed:
+    shard_destroy(s);
+    return -1;
+}
+
+struct httpd *httpd_create(const struct httpd_config *conf)
+{
+    struct httpd *h;
+    int i, n;
+
+    if (!conf) {
+        return NULL;
+    }
+    h = CALLOC(1, struct httpd);
+    if (!h) {
+        return NULL;
+    }
+    if (conf->host) {
+        snprintf(h->host, sizeof(h->host), "%s", conf->host);
+    }
+    h->port = conf->port;
+    if (conf->root) {
+        if (!realpath(conf->root, h->root)) {
+            printf("httpd: root %s: %s\n", conf->root, strerror(errno));
+            free(h);
+            return NULL;
+        }
+        n = strlen(h->root);
+        if (n > 0 && h->root[n - 1] == '/') {
+            h->root[n - 1] = '\0';
+        }
+        h->has_root = true;
+    }
+    h->idle_timeout_ms = conf->idle_timeout_ms > 0 ? conf->idle_timeout_ms : HTTPD_IDLE_TIMEOUT;
+    h->max_request = conf->max_request > 0 ? conf->max_request : HTTPD_REQUEST_MAX;
+    h->stats = conf->stats;
+    h->nshard = conf->nthread;
+    if (h->nshard <= 0) {
+        h->nshard = sysconf(_SC_NPROCESSORS_ONLN);
+        if (h->nshard <= 0) {
+            h->nshard = 1;
+        }
+    }
+    h->shards = calloc(h->nshard, sizeof(struct httpd_shard));
+    if (!h->shards) {
+        free(h);
+        return NULL;
+    }
+    for (i = 0; i < h->nshard; i++) {
+        h->shards[i].listen_fd = -1;
+    }
+    return h;
+}
+
+int httpd_route(struct httpd *h, const char *prefix, httpd_handler cb, void *arg)
+{
+    struct httpd_route *r;
+
+    if (!h || !prefix || !cb || h->nroute == HTTPD_ROUTE_MAX || h->shards[0].thread) {
+        return -1;
+    }
+    r = &h->routes[h->nroute];
+    r->prefix = strdup(prefix);
+    if (!r->prefix) {
+        return -1;
+    }
+    r->len = strlen(prefix);
+    r->cb = cb;
+    r->arg = arg;
+    h->nroute++;
+    return 0;
+}
+
+int httpd_start(struct httpd *h)
+{
+    struct sock_addr addr;
+    int i;
+
+    if (!h) {
+        return -1;
+    }
+    for (i = 0; i < h->nshard; i++) {
+        if (-1 == shard_create(h, &h->shards[i])) {
+            printf("httpd: shard %d create failed\n", i);
+            goto failed;
+        }
+        /* shards of random port must share the port of shard 0 */
+        if (h->port == 0 &&
+            0 == sock_getaddr_by_fd(h->shards[i].listen_fd, &addr)) {
+            h->port = addr.port;
+        }
+    }
+    return 0;
+
+failed:
+    while (--i >= 0) {
+        shard_destroy(&h->shards[i]);
+    }
+    return -1;
+}
+
+uint16_t httpd_port(struct httpd *h)
+{
+    return h ? h->port : 0;
+}
+
+int httpd_reactors(struct httpd *h)
+{
+    return h ? h->nshard : 0;
+}
+
+struct gevent_base *httpd_base(struct httpd *h, int idx)
+{
+    if (!h || idx < 0 || idx >= h->nshard) {
+        return NULL;
+    }
+    return h->shards[idx].evbase;
+}
+
+int httpd_get_stats(struct httpd *h, int idx, struct httpd_stats *st)
+{
+    if (!h || !st || idx < 0 || idx >= h->nshard) {
+        return -1;
+    }
+    memcpy(st, &h->shards[idx].stats, sizeof(*st));
+    return 0;
+}
+
+void httpd_destroy(struct httpd *h)
+{
+    int i;
+
+    if (!h) {
+        return;
+    }
+    for (i = 0; i < h->nshard; i++) {
+        shard_destroy(&h->shards[i]);
+    }
+    for (i = 0; i < h->nroute; i++) {
+        free(h->routes[i].prefix);
+    }
+    free(h->shards);
+    free(h);
+}
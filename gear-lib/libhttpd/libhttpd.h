@@ -1 +1,164 @@
-#include "mongoose.h"
\ No newline at end of file
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#ifndef LIBHTTPD_H
+#define LIBHTTPD_H
+
+#include <libposix.h>
+#include <libdarray.h>
+#include <libdstring.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define LIBHTTPD_VERSION "0.1.0"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * libhttpd is HTTP/1.1 server on libgevent, one gevent_base per thread,
+ * each with its own SO_REUSEPORT listener, connections stay on the thread
+ * that accepted them. requests are parsed in place from the gevent_conn
+ * read buffer, handlers run in that loop thread and must not block.
+ */
+
+#define HTTPD_HEADER_MAX        (32)
+#define HTTPD_ROUTE_MAX         (32)
+
+struct httpd_header {
+    struct strref name;
+    struct strref value;
+};
+
+/*
+ * views point into the connection buffer and are valid until the handler
+ * returns
+ */
+struct httpd_request {
+    struct strref raw;              /* request line to end of body */
+    struct strref method;
+    struct strref uri;
+    struct strref path;             /* uri without query, not decoded */
+    struct strref query;
+    struct strref version;
+    struct httpd_header headers[HTTPD_HEADER_MAX];
+    int nheader;
+    struct strref body;
+    bool keep_alive;
+    bool chunked;                   /* Transfer-Encoding of body, not supported */
+    size_t scanned;                 /* resume point of end of headers search */
+};
+
+struct httpd;
+struct httpd_conn;
+struct gevent_base;
+
+typedef void (*httpd_handler)(struct httpd_conn *c,
+                const struct httpd_request *req, void *arg);
+typedef void (*httpd_close_cb)(struct httpd_conn *c, void *arg);
+
+struct httpd_config {
+    const char *host;               /* NULL or "" for any */
+    uint16_t port;                  /* 0 for random, see httpd_port */
+    int nthread;                    /* reactors, <= 0 one per cpu core */
+    const char *root;               /* static files, NULL to disable */
+    int idle_timeout_ms;            /* keep-alive idle, 0 for 30s */
+    size_t max_request;             /* headers plus body, 0 for 64KB */
+    bool stats;                     /* gevent_base stats of each reactor */
+};
+
+/*
+ * counters of one reactor, updated by its loop thread only, reading them
+ * is racy but cheap like gevent_stats
+ */
+struct httpd_stats {
+    uint64_t accepted;
+    uint64_t closed;
+    uint64_t requests;
+    uint64_t replies[5];            /* by status class, 1xx to 5xx */
+};
+
+GEAR_API struct httpd *httpd_create(const struct httpd_config *conf);
+GEAR_API void httpd_destroy(struct httpd *h);
+/*
+ * uri path starting with prefix goes to cb, longest prefix wins, other
+ * paths are served from root. must be called before httpd_start
+ */
+GEAR_API int httpd_route(struct httpd *h, const char *prefix, httpd_handler cb, void *arg);
+GEAR_API int httpd_start(struct httpd *h);
+GEAR_API uint16_t httpd_port(struct httpd *h);
+/* reactors are numbered from 0, base is NULL before httpd_start */
+GEAR_API int httpd_reactors(struct httpd *h);
+GEAR_API struct gevent_base *httpd_base(struct httpd *h, int idx);
+GEAR_API int httpd_get_stats(struct httpd *h, int idx, struct httpd_stats *st);
+
+/*
+ * return length of a complete request at buf, 0 if more data is needed,
+ * -1 if malformed. partial reads resume the search where it stopped
+ */
+GEAR_API int httpd_request_parse(struct httpd_request *r, const char *buf, size_t len, size_t max);
+GEAR_API const struct strref *httpd_request_header(const struct httpd_request *r, const char *name);
+
+/*
+ * one reply per request, called in handler. extra header lines added by
+ * httpd_add_header go out with the next reply. HEAD gets headers only
+ */
+GEAR_API int httpd_add_header(struct httpd_conn *c, const char *fmt, ...);
+GEAR_API int httpd_reply(struct httpd_conn *c, int status, const char *type,
+                const void *body, size_t len);
+/* body gathered from pieces, sent without copy as far as the socket takes */
+GEAR_API int httpd_replyv(struct httpd_conn *c, int status, const char *type,
+                const struct iovec *iov, int cnt);
+/*
+ * send file with sendfile(2), honors single Range and If-Modified-Since,
+ * type NULL is guessed from extension
+ */
+GEAR_API int httpd_reply_file(struct httpd_conn *c, const char *path, const char *type);
+
+/*
+ * reply without Content-Length, body is sent by httpd_write until the
+ * connection closes. chunked is ignored for HTTP/1.0, such a stream ends
+ * with the connection. return -1 if no body may follow, e.g. HEAD
+ */
+GEAR_API int httpd_reply_stream(struct httpd_conn *c, int status, const char *type,
+                bool chunked);
+GEAR_API int httpd_write(struct httpd_conn *c, const void *data, size_t len);
+/* bytes not taken by the socket yet, for viewers to skip data */
+GEAR_API size_t httpd_pending(struct httpd_conn *c);
+
+/*
+ * called in handler to reply later from the loop thread of c, e.g. when
+ * the data is ready. request views are gone once handler returns, the
+ * pipeline goes on after the reply
+ */
+GEAR_API int httpd_defer(struct httpd_conn *c);
+/* cb is called once when c closes, c can't be used after that */
+GEAR_API void httpd_set_close_cb(struct httpd_conn *c, httpd_close_cb cb, void *arg);
+/* close at once, unsent output is dropped */
+GEAR_API void httpd_close(struct httpd_conn *c);
+GEAR_API struct gevent_base *httpd_conn_base(struct httpd_conn *c);
+GEAR_API int httpd_conn_fd(struct httpd_conn *c);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
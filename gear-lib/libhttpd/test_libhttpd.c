@@ -1,8 +1,210 @@
-#include <stdio.h>
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
 #include "libhttpd.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#ifdef ENABLE_STREAM
+#include "httpd_stream.h"
+#include <libthread.h>
+#endif
+#ifdef ENABLE_METRICS
+#include "httpd_metrics.h"
+#endif
 
-int main(void)
+static void on_hello(struct httpd_conn *c, const struct httpd_request *req, void *arg)
 {
-    printf("hello world!\n");
+    char body[256];
+    int n = snprintf(body, sizeof(body), "hello %.*s\n", (int)req->query.len,
+                     req->query.array ? req->query.array : "");
+    httpd_add_header(c, "Cache-Control: no-cache");
+    httpd_reply(c, 200, "text/plain", body, n);
+}
+
+static void on_echo(struct httpd_conn *c, const struct httpd_request *req, void *arg)
+{
+    httpd_reply(c, 200, "application/octet-stream", req->body.array, req->body.len);
+}
+
+#ifdef ENABLE_STREAM
+#define FEED_FPS    25
+
+struct feed {
+    const char *file;
+    struct httpd_stream *flv;
+    struct httpd_stream *hls;
+    struct thread *thread;
+};
+
+/* next access unit of annexb h264 at p, a slice after a slice starts one */
+static size_t feed_next_au(const uint8_t *p, size_t len)
+{
+    size_t i;
+    bool slice = false;
+    int type;
+
+    for (i = 0; i + 3 < len; i++) {
+        if (p[i] || p[i + 1] || p[i + 2] != 1) {
+            continue;
+        }
+        type = p[i + 3] & 0x1f;
+        if (slice && (type == 1 || type == 5 || type == 7 || type == 9)) {
+            return i > 0 && p[i - 1] == 0 ? i - 1 : i;
+        }
+        if (type == 1 || type == 5) {
+            slice = true;
+        }
+    }
+    return len;
+}
+
+/* loops an annexb file at FEED_FPS into both streams */
+static void *feed_thread(struct thread *t, void *arg)
+{
+    struct feed *f = (struct feed *)arg;
+    struct media_packet mp;
+    struct video_packet vp;
+    uint8_t *data;
+    size_t size, off = 0, n;
+    uint64_t pts = 0;
+    FILE *fp;
+    long len;
+
+    fp = fopen(f->file, "rb");
+    if (!fp || fseek(fp, 0, SEEK_END) || (len = ftell(fp)) <= 0) {
+        printf("open %s failed\n", f->file);
+        if (fp) {
+            fclose(fp);
+        }
+        return NULL;
+    }
+    size = len;
+    data = malloc(size);
+    rewind(fp);
+    if (!data || size != fread(data, 1, size, fp)) {
+        fclose(fp);
+        free(data);
+        return NULL;
+    }
+    fclose(fp);
+    memset(&vp, 0, sizeof(vp));
+    vp.encoder.type = VIDEO_CODEC_H264;
+    vp.encoder.framerate = (rational_t){FEED_FPS, 1};
+    vp.encoder.timebase = (rational_t){1, 90000};
+    mp.type = MEDIA_TYPE_VIDEO;
+    mp.video = &vp;
+    httpd_stream_add_media(f->flv, &mp);
+    httpd_stream_add_media(f->hls, &mp);
+    while (t->run) {
+        n = feed_next_au(data + off, size - off);
+        vp.data = data + off;
+        vp.size = n;
+        vp.pts = vp.dts = pts;
+        vp.key_frame = false;
+        httpd_stream_push(f->flv, &mp);
+        httpd_stream_push(f->hls, &mp);
+        pts += 90000 / FEED_FPS;
+        off += n;
+        if (off >= size) {
+            off = 0;
+        }
+        usleep(1000000 / FEED_FPS);
+    }
+    free(data);
+    return NULL;
+}
+#endif
+
+static void on_signal(int signo)
+{
+}
+
+int main(int argc, char **argv)
+{
+    struct httpd_config conf;
+    struct httpd *h;
+#ifdef ENABLE_STREAM
+    struct httpd_stream_config sconf;
+    struct feed feed;
+#endif
+#ifdef ENABLE_METRICS
+    struct metrics *m = metrics_create();
+#endif
+
+    memset(&conf, 0, sizeof(conf));
+    conf.port = argc > 1 ? atoi(argv[1]) : 8080;
+    conf.nthread = argc > 2 ? atoi(argv[2]) : 1;
+    conf.root = argc > 3 ? argv[3] : ".";
+    conf.stats = true;
+    h = httpd_create(&conf);
+    if (!h) {
+        return -1;
+    }
+    httpd_route(h, "/hello", on_hello, NULL);
+    httpd_route(h, "/echo", on_echo, NULL);
+#ifdef ENABLE_METRICS
+    /* curl http://localhost:8080/metrics */
+    httpd_metrics_route(h, "/metrics", m);
+    metrics_collector_add(m, httpd_metrics_collect, h);
+#endif
+#ifdef ENABLE_STREAM
+    /* ffplay http://localhost:8080/live.flv, hls.js on /hls/index.m3u8 */
+    memset(&feed, 0, sizeof(feed));
+    memset(&sconf, 0, sizeof(sconf));
+    feed.file = argc > 4 ? argv[4] : "../librtsp/sample.264";
+    sconf.type = HTTPD_STREAM_FLV;
+    feed.flv = httpd_stream_create(h, "/live.flv", &sconf);
+    sconf.type = HTTPD_STREAM_LLHLS;
+    feed.hls = httpd_stream_create(h, "/hls/", &sconf);
+#endif
+    if (0 != httpd_start(h)) {
+        httpd_destroy(h);
+        return -1;
+    }
+    printf("http://localhost:%d/ serving %s with %d threads\n",
+           httpd_port(h), conf.root, conf.nthread);
+#ifdef ENABLE_STREAM
+    feed.thread = thread_create(feed_thread, &feed);
+#endif
+    /* ^C ends pause and cleans up */
+    signal(SIGINT, on_signal);
+    pause();
+#ifdef ENABLE_STREAM
+    feed.thread->run = false;
+    thread_join(feed.thread);
+    thread_destroy(feed.thread);
+#endif
+#ifdef ENABLE_METRICS
+    metrics_collector_del(m, httpd_metrics_collect, h);
+#endif
+    httpd_destroy(h);
+#ifdef ENABLE_STREAM
+    httpd_stream_destroy(feed.flv);
+    httpd_stream_destroy(feed.hls);
+#endif
+#ifdef ENABLE_METRICS
+    metrics_destroy(m);
+#endif
     return 0;
-}
\ No newline at end of file
+}
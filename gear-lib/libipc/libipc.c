@@ -31,9 +31,17 @@ extern const struct ipc_ops socket_ops;
 extern const struct ipc_ops nlk_ops;
 extern const struct ipc_ops shm_ops;
 
+/*
+ * handlers are indexed directly by group and cmd id of func_id, func_ids
+ * only differ in other bits share the slot, later ones go to overflow map
+ */
+#define IPC_HANDLER_SLOTS   ((IPC_GROUP_MASK + 1) * (IPC_CMD_MASK + 1))
+#define IPC_HANDLER_INDEX(func_id) \
+    ((GET_IPC_MSG_GROUP(func_id) * (IPC_CMD_MASK + 1)) + ((func_id) & IPC_CMD_MASK))
+
+static ipc_handler_t message_index[IPC_HANDLER_SLOTS];
 static ipc_handler_t message_map[MAX_MESSAGES_IN_MAP];
 static int           message_map_registered;
-static struct ipc_packet *_pkt_sbuf = NULL;
 static void *_arg_buf = NULL;
 
 typedef enum ipc_backend_type {
@@ -53,6 +61,34 @@ static const struct ipc_ops *ipc_ops[] = {
     NULL
 };
 
+#define IPC_BACKEND_ENV     "LIBIPC_BACKEND"
+
+static const char *ipc_backend_name[] = {
+    "mq_posix",
+    "mq_sysv",
+    "socket",
+    "netlink",
+    "shm",
+};
+
+/* posix mqueue by default, LIBIPC_BACKEND=shm etc. selects another one */
+static ipc_backend_type ipc_backend_select(void)
+{
+    size_t i;
+    const char *env = getenv(IPC_BACKEND_ENV);
+    if (!env) {
+        return IPC_BACKEND_MQ_POSIX;
+    }
+    for (i = 0; i < sizeof(ipc_backend_name)/sizeof(ipc_backend_name[0]); i++) {
+        if (!strcmp(env, ipc_backend_name[i])) {
+            return (ipc_backend_type)i;
+        }
+    }
+    printf("unknown %s=%s, use %s\n", IPC_BACKEND_ENV, env,
+           ipc_backend_name[IPC_BACKEND_MQ_POSIX]);
+    return IPC_BACKEND_MQ_POSIX;
+}
+
 static int pack_msg(struct ipc_packet *pkt, uint32_t func_id,
                     const void *in_arg, size_t in_len)
 {
@@ -101,74 +137,198 @@ static int unpack_msg(struct ipc_packet *pkt, uint32_t *func_id,
     return 0;
 }
 
-static int push_async_cmd(struct ipc *ipc, uint32_t func_id)
+/* caller holds ipc->lock */
+static struct ipc_future *future_take(struct ipc *ipc, uint32_t seq)
+{
+    struct ipc_future **pp, *f;
+    for (pp = &ipc->pending; *pp; pp = &(*pp)->next) {
+        f = *pp;
+        if (f->seq == seq) {
+            *pp = f->next;
+            f->next = NULL;
+            return f;
+        }
+    }
+    return NULL;
+}
+
+/* only for future with cb, others are owned by waiter once done is set */
+static void future_finish(struct ipc *ipc, struct ipc_future *f)
 {
-    char cmd_str[11];//0xFFFFFFFF
-    snprintf(cmd_str, sizeof(cmd_str), "0x%08X", func_id);
-    if (-1 == dict_add(ipc->async_cmd_list, cmd_str, cmd_str)) {
+    f->cb(ipc, f, f->arg);
+    free(f->obuf);
+    free(f);
+}
+
+static struct ipc_future *future_send(struct ipc *ipc, uint32_t func_id,
+                const void *in_arg, size_t in_len, ipc_future_cb cb, void *arg)
+{
+    uint8_t buf[MAX_IPC_MESSAGE_SIZE];
+    struct ipc_packet *pkt = (struct ipc_packet *)buf;
+    struct ipc_future *f;
+    uint32_t seq;
+
+    if (!ipc || ipc->role != IPC_CLIENT || !IS_IPC_MSG_NEED_RETURN(func_id)) {
+        printf("invalid parament!\n");
+        return NULL;
+    }
+    if (-1 == pack_msg(pkt, func_id, in_arg, in_len)) {
+        printf("pack_msg failed!\n");
+        return NULL;
+    }
+    f = calloc(1, sizeof(struct ipc_future));
+    if (!f) {
+        printf("malloc ipc_future failed!\n");
+        return NULL;
+    }
+    f->func_id = func_id;
+    f->cb = cb;
+    f->arg = arg;
+    /* fast backend may answer before send returns */
+    pthread_mutex_lock(&ipc->lock);
+    seq = f->seq = ++ipc->next_seq;
+    f->next = ipc->pending;
+    ipc->pending = f;
+    pthread_mutex_unlock(&ipc->lock);
+    /* f with cb may be freed by recv thread from now on */
+    pkt->header.seq = seq;
+    if (-1 == ipc->ops->send(ipc, pkt, sizeof(ipc_packet_t) + in_len)) {
+        printf("send msg failed!\n");
+        pthread_mutex_lock(&ipc->lock);
+        f = future_take(ipc, seq);
+        pthread_mutex_unlock(&ipc->lock);
+        /* NULL means it was failed by ipc_destroy already */
+        if (f) {
+            free(f);
+        }
+        return NULL;
+    }
+    return f;
+}
+
+struct ipc_future *ipc_call_async(struct ipc *ipc, uint32_t func_id,
+             const void *in_arg, size_t in_len)
+{
+    return future_send(ipc, func_id, in_arg, in_len, NULL, NULL);
+}
+
+int ipc_call_cb(struct ipc *ipc, uint32_t func_id,
+             const void *in_arg, size_t in_len, ipc_future_cb cb, void *arg)
+{
+    if (!cb) {
+        printf("invalid parament!\n");
         return -1;
     }
-    return 0;
+    return future_send(ipc, func_id, in_arg, in_len, cb, arg) ? 0 : -1;
 }
 
-static int pop_async_cmd(struct ipc *ipc, uint32_t func_id)
+int ipc_future_wait(struct ipc *ipc, struct ipc_future *f, int timeout_ms)
 {
     int ret = 0;
-    char *pair = NULL;
-    char cmd_str[11];//0xFFFFFFFF
-    snprintf(cmd_str, sizeof(cmd_str), "0x%08X", func_id);
-    pair = dict_get(ipc->async_cmd_list, cmd_str, cmd_str);
-    if (pair) {
-        if (-1 == dict_del(ipc->async_cmd_list, cmd_str)) {
-            ret = -1;
+    struct timeval now;
+    struct timespec abs_time;
+
+    if (!ipc || !f || f->cb) {
+        printf("invalid parament!\n");
+        return -1;
+    }
+    /* response never comes if request is still held */
+    if (ipc->batch && ipc->ops->flush) {
+        ipc->ops->flush(ipc);
+    }
+    gettimeofday(&now, NULL);
+    now.tv_usec += (timeout_ms % 1000) * 1000;
+    now.tv_sec += timeout_ms / 1000;
+    if (now.tv_usec >= 1000000) {
+        now.tv_usec -= 1000000;
+        now.tv_sec++;
+    }
+    abs_time.tv_sec = now.tv_sec;
+    abs_time.tv_nsec = now.tv_usec * 1000;
+    pthread_mutex_lock(&ipc->lock);
+    while (f->done == 0 && ret == 0) {
+        if (timeout_ms < 0) {
+            ret = pthread_cond_wait(&ipc->cond, &ipc->lock);
         } else {
-            ret = 0;
+            ret = pthread_cond_timedwait(&ipc->cond, &ipc->lock, &abs_time);
         }
-    } else {
-        ret = -1;
     }
+    ret = (f->done == 1) ? 0 : -1;
+    pthread_mutex_unlock(&ipc->lock);
     return ret;
 }
 
+void ipc_future_free(struct ipc *ipc, struct ipc_future *f)
+{
+    if (!ipc || !f) {
+        return;
+    }
+    pthread_mutex_lock(&ipc->lock);
+    if (f->done == 0) {
+        future_take(ipc, f->seq);
+    }
+    pthread_mutex_unlock(&ipc->lock);
+    free(f->obuf);
+    free(f);
+}
+
 int ipc_call(struct ipc *ipc, uint32_t func_id,
              const void *in_arg, size_t in_len,
              void *out_arg, size_t out_len)
 {
+    int ret = 0;
+    uint8_t buf[MAX_IPC_MESSAGE_SIZE];
+    struct ipc_packet *pkt = (struct ipc_packet *)buf;
+    struct ipc_future *f;
+
     if (!ipc) {
         printf("invalid parament!\n");
         return -1;
     }
-    if (-1 == pack_msg(_pkt_sbuf, func_id, in_arg, in_len)) {
-        printf("pack_msg failed!\n");
+    if (!IS_IPC_MSG_NEED_RETURN(func_id)) {
+        if (-1 == pack_msg(pkt, func_id, in_arg, in_len)) {
+            printf("pack_msg failed!\n");
+            return -1;
+        }
+        pkt->header.seq = 0;
+        if (-1 == ipc->ops->send(ipc, pkt, sizeof(ipc_packet_t) + in_len)) {
+            printf("send msg failed!\n");
+            return -1;
+        }
+        return 0;
+    }
+    f = ipc_call_async(ipc, func_id, in_arg, in_len);
+    if (!f) {
         return -1;
     }
-    if (-1 == ipc->ops->send(ipc, _pkt_sbuf, sizeof(ipc_packet_t) + in_len)) {
-        printf("send msg failed!\n");
+    if (0 != ipc_future_wait(ipc, f, 2000)) {
+        printf("response of 0x%08x failed\n", func_id);
+        ret = -1;
+    } else if (out_arg && out_len) {
+        memset(out_arg, 0, out_len);
+        memcpy(out_arg, f->obuf, MIN2(out_len, f->olen));
+    }
+    ipc_future_free(ipc, f);
+    return ret;
+}
+
+int ipc_batch_begin(struct ipc *ipc)
+{
+    if (!ipc) {
         return -1;
     }
-    if (IS_IPC_MSG_NEED_RETURN(func_id)) {
-        struct timeval now;
-        struct timespec abs_time;
-        uint32_t timeout = 2000;//msec
-        gettimeofday(&now, NULL);
-        now.tv_usec += (timeout % 1000) * 1000;
-        now.tv_sec += timeout / 1000;
-        if ( now.tv_usec >= 1000000 ) {
-            now.tv_usec -= 1000000;
-            now.tv_sec ++;
-        }
-        abs_time.tv_sec = now.tv_sec;
-        abs_time.tv_nsec = now.tv_usec * 1000;
-        if (-1 == push_async_cmd(ipc, func_id)) {
-            printf("push_async_cmd failed!\n");
-        }
-        if (-1 == sem_timedwait(&ipc->sem, &abs_time)) {
-            printf("response failed %d:%s\n", errno, strerror(errno));
-            return -1;
-        }
-        memcpy(out_arg, ipc->resp_buf, out_len);
-    } else {
+    ipc->batch = 1;
+    return 0;
+}
 
+int ipc_batch_end(struct ipc *ipc)
+{
+    if (!ipc) {
+        return -1;
+    }
+    ipc->batch = 0;
+    if (ipc->ops->flush) {
+        return ipc->ops->flush(ipc);
     }
     return 0;
 }
@@ -179,6 +339,7 @@ static int register_msg_proc(ipc_handler_t *handler)
     int msg_id_registered  = 0;
     int msg_slot = -1;
     uint32_t func_id;
+    ipc_handler_t *slot;
 
     if (!handler) {
         printf("Cannot register null msg proc \n");
@@ -186,6 +347,15 @@ static int register_msg_proc(ipc_handler_t *handler)
     }
 
     func_id = handler->func_id;
+    slot = &message_index[IPC_HANDLER_INDEX(func_id)];
+    if (!slot->cb || slot->func_id == func_id) {
+        if (slot->cb) {
+            printf("overwrite existing msg proc for func_id %d \n", func_id);
+        }
+        //if the handler registered is NULL, then just fill NULL handler
+        *slot = *handler;
+        return 0;
+    }
 
     for (i=0; i < message_map_registered; i++) {
         if (message_map[i].func_id == func_id) {
@@ -206,7 +376,6 @@ static int register_msg_proc(ipc_handler_t *handler)
         message_map_registered++;
     }
 
-    //if the handler registered is NULL, then just fill NULL handler
     message_map[msg_slot] = *handler;
     return 0;
 }
@@ -240,6 +409,13 @@ int ipc_register_map(ipc_handler_t *map, int num_entry)
 int find_ipc_handler(uint32_t func_id, ipc_handler_t *handler)
 {
     int i;
+    ipc_handler_t *slot = &message_index[IPC_HANDLER_INDEX(func_id)];
+    if (slot->cb && slot->func_id == func_id) {
+        if (handler) {
+            *handler = *slot;
+        }
+        return 0;
+    }
     for (i = 0; i < message_map_registered; i++) {
         if (message_map[i].func_id == func_id) {
             if (handler)  {
@@ -255,7 +431,7 @@ static int process_msg(struct ipc *ipc, void *buf, size_t len)
 {
     ipc_handler_t handler;
     uint32_t func_id = 0;
-    char out_arg[1024];
+    char out_arg[MAX_IPC_MESSAGE_SIZE];
     size_t out_len = 0;
     size_t ret_len = 0;
     struct ipc_packet *pkt = (struct ipc_packet *)buf;
@@ -281,23 +457,69 @@ static int process_msg(struct ipc *ipc, void *buf, size_t len)
 static int on_return(struct ipc *ipc, void *buf, size_t len)
 {
     uint32_t func_id;
-    size_t out_len;
+    size_t out_len = 0;
+    void *out;
+    struct ipc_future *f;
+    ipc_future_cb cb = NULL;
     struct ipc_packet *pkt = (struct ipc_packet *)buf;
-    memset(ipc->resp_buf, 0, MAX_IPC_RESP_BUF_LEN);
-    if (-1 == unpack_msg(pkt, &func_id, ipc->resp_buf, &out_len)) {
+
+    out = calloc(1, MAX_IPC_RESP_BUF_LEN);
+    if (!out) {
+        printf("malloc failed!\n");
+        return -1;
+    }
+    if (-1 == unpack_msg(pkt, &func_id, out, &out_len)) {
         printf("unpack_msg failed!\n");
+        free(out);
         return -1;
     }
-    if (-1 == pop_async_cmd(ipc, func_id)) {
-        printf("msg received is not the response of cmd_id!\n");
+    pthread_mutex_lock(&ipc->lock);
+    f = future_take(ipc, pkt->header.seq);
+    if (f) {
+        f->obuf = out;
+        f->olen = out_len;
+        f->done = 1;
+        out = NULL;
+        cb = f->cb;
+        pthread_cond_broadcast(&ipc->cond);
+    }
+    pthread_mutex_unlock(&ipc->lock);
+    if (!f) {
+        printf("msg 0x%08x seq %u is not the response of any call!\n",
+               func_id, pkt->header.seq);
+        free(out);
         return -1;
     }
-
-    ipc->resp_len = out_len;
-    sem_post(&ipc->sem);
+    if (cb) {
+        future_finish(ipc, f);
+    }
     return 0;
 }
 
+/* calls still in flight when client is destroyed fail */
+static void future_fail_all(struct ipc *ipc)
+{
+    struct ipc_future *f, *next, *cbs = NULL;
+    pthread_mutex_lock(&ipc->lock);
+    for (f = ipc->pending; f; f = next) {
+        next = f->next;
+        f->done = -1;
+        f->next = NULL;
+        if (f->cb) {
+            f->next = cbs;
+            cbs = f;
+        }
+    }
+    ipc->pending = NULL;
+    pthread_cond_broadcast(&ipc->cond);
+    pthread_mutex_unlock(&ipc->lock);
+    while (cbs) {
+        f = cbs;
+        cbs = cbs->next;
+        future_finish(ipc, f);
+    }
+}
+
 struct ipc *ipc_create(enum ipc_role role, uint16_t port)
 {
     struct ipc *ipc = calloc(1, sizeof(struct ipc));
@@ -306,7 +528,9 @@ struct ipc *ipc_create(enum ipc_role role, uint16_t port)
         return NULL;
     }
     ipc->role = role;
-    ipc->ops = ipc_ops[IPC_BACKEND_MQ_POSIX];
+    pthread_mutex_init(&ipc->lock, NULL);
+    pthread_cond_init(&ipc->cond, NULL);
+    ipc->ops = ipc_ops[ipc_backend_select()];
     ipc->ctx = ipc->ops->init(ipc, port, ipc->role);
     if (!ipc->ctx) {
         printf("init failed!\n");
@@ -316,19 +540,13 @@ struct ipc *ipc_create(enum ipc_role role, uint16_t port)
         _arg_buf = (struct ipc_packet *)calloc(1, MAX_IPC_MESSAGE_SIZE);
         ipc->ops->register_recv_cb(ipc, process_msg);
     } else if (ipc->role == IPC_CLIENT) {
-        ipc->async_cmd_list = dict_new();
-        if (!ipc->async_cmd_list) {
-            printf("create async_cmd_list failed!\n");
-            goto failed;
-        }
-        ipc->resp_buf = calloc(1, MAX_IPC_RESP_BUF_LEN);
-        _pkt_sbuf = (struct ipc_packet *)calloc(1, MAX_IPC_MESSAGE_SIZE);
         ipc->ops->register_recv_cb(ipc, on_return);
-        sem_init(&ipc->sem, 0, 0);
     }
     return ipc;
 failed:
     if (ipc) {
+        pthread_cond_destroy(&ipc->cond);
+        pthread_mutex_destroy(&ipc->lock);
         free(ipc);
     }
     return NULL;
@@ -339,12 +557,15 @@ void ipc_destroy(struct ipc *ipc)
     if (!ipc) {
         return;
     }
-    sem_destroy(&ipc->sem);
     ipc->ops->deinit(ipc);
 
-    if (_arg_buf) free(_arg_buf);
-    if (_pkt_sbuf) free(_pkt_sbuf);
-    if (ipc->resp_buf) free(ipc->resp_buf);
-    if (ipc->async_cmd_list) dict_free(ipc->async_cmd_list);
+    if (ipc->role == IPC_SERVER) {
+        free(_arg_buf);
+        _arg_buf = NULL;
+    } else {
+        future_fail_all(ipc);
+    }
+    pthread_cond_destroy(&ipc->cond);
+    pthread_mutex_destroy(&ipc->lock);
     free(ipc);
 }
@@ -38,8 +38,8 @@
 extern "C" {
 #endif
 
-#define MAX_IPC_RESP_BUF_LEN        (1024)
-#define MAX_IPC_MESSAGE_SIZE        (1024)
+#define MAX_IPC_RESP_BUF_LEN        GEAR_CONFIG_IPC_MESSAGE_SIZE
+#define MAX_IPC_MESSAGE_SIZE        GEAR_CONFIG_IPC_MESSAGE_SIZE
 #define MAX_MESSAGES_IN_MAP         (256)
 
 #define IPC_SERVER_PORT             (5555)
@@ -61,6 +61,7 @@ typedef struct ipc_handler {
 
 typedef struct ipc_header {
     uint32_t func_id;
+    uint32_t seq;       /* echoed back in response */
     uint64_t time_stamp;
     uint32_t payload_len;
 } ipc_header_t;
@@ -79,10 +80,27 @@ struct ipc_ops {
     int (*register_recv_cb)(struct ipc *i, ipc_recv_cb cb);
     int (*send)(struct ipc *i, const void *buf, size_t len);
     int (*recv)(struct ipc *i, void *buf, size_t len);
+    int (*flush)(struct ipc *i);    /* send messages held by batch, optional */
     int (*unicast)();//TODO
     int (*broadcast)();//TODO
 };
 
+struct ipc_future;
+
+/* called in recv thread of backend when response arrived or call failed */
+typedef void (*ipc_future_cb)(struct ipc *ipc, struct ipc_future *f, void *arg);
+
+struct ipc_future {
+    uint32_t seq;
+    uint32_t func_id;
+    int done;           /* 0 in flight, 1 response arrived, -1 failed */
+    void *obuf;
+    size_t olen;
+    ipc_future_cb cb;
+    void *arg;
+    struct ipc_future *next;
+};
+
 typedef struct ipc {
     void *ctx;
     int fd;
@@ -90,12 +108,13 @@ typedef struct ipc {
     enum ipc_role role;
     struct ipc_packet packet;
     const struct ipc_ops *ops;
-    sem_t sem;
-    void *resp_buf;//async response buffer;
-    int resp_len;
-    dict *async_cmd_list;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint32_t next_seq;
+    struct ipc_future *pending;
     pthread_t tid;
     struct gevent_base *evbase;
+    int batch;      /* sends are held by backend until ipc_batch_end */
 } ipc_t;
 
 struct ipc *ipc_create(enum ipc_role role, uint16_t port);
@@ -105,8 +124,31 @@ int ipc_call(struct ipc *i, uint32_t func_id,
              const void *in_arg, size_t in_len,
              void *out_arg, size_t out_len);
 
+/*
+ * non-blocking call, returns after request is sent, any number of calls
+ * can be outstanding and responses are matched by seq. ipc_call_async
+ * returns a future to wait with ipc_future_wait, release it with
+ * ipc_future_free even if wait failed. ipc_call_cb calls cb in recv thread
+ * instead, response buffer is freed after cb returns.
+ * func_id must be a need return msg id
+ */
+struct ipc_future *ipc_call_async(struct ipc *i, uint32_t func_id,
+             const void *in_arg, size_t in_len);
+int ipc_call_cb(struct ipc *i, uint32_t func_id,
+             const void *in_arg, size_t in_len, ipc_future_cb cb, void *arg);
+int ipc_future_wait(struct ipc *i, struct ipc_future *f, int timeout_ms);
+void ipc_future_free(struct ipc *i, struct ipc_future *f);
+
 void ipc_destroy(struct ipc *i);
 
+/*
+ * no return calls between begin and end are sent together, netlink packs
+ * them into one datagram, other backends send each at once. a call
+ * needing return flushes the held ones first
+ */
+int ipc_batch_begin(struct ipc *i);
+int ipc_batch_end(struct ipc *i);
+
 int ipc_register_map(ipc_handler_t *map, int num_entry);
 
 #define IPC_REGISTER_MAP(map_name)             \
@@ -129,6 +171,8 @@ int ipc_register_map(ipc_handler_t *map, int num_entry);
  * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
  * |                           message_id=32                       |
  * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ * |                           seq=32                              |
+ * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
  * |                                                               |
  * +-+-+-+-+-+-+-+-+-+-+-+-+-+ time_stamp=64 +-+-+-+-+-+-+-+-+-+-+-+
  * |                                                               |
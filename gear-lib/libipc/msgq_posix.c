@@ -42,7 +42,7 @@
  */
 
 #define MQ_MAXMSG       5
-#define MQ_MSGSIZE      1024
+#define MQ_MSGSIZE      MAX_IPC_MESSAGE_SIZE
 #define MQ_MSG_PRIO     10
 #define MAX_MQ_NAME     256
 
@@ -97,7 +97,7 @@ end:
 static void *server_thread(void *arg)
 {
     int cmd;
-    char buf[1024];
+    char buf[MAX_IPC_MESSAGE_SIZE];
     int size;
     struct mq_sysv_ctx *c = (struct mq_sysv_ctx *)arg;
     struct ipc *ipc = (struct ipc *)c->parent;
@@ -148,7 +148,7 @@ static void *server_thread(void *arg)
 
 static void *client_thread(void *arg)
 {
-    char buf[1024];
+    char buf[MAX_IPC_MESSAGE_SIZE];
     int size;
     int cmd;
     struct mq_sysv_ctx *c = (struct mq_sysv_ctx *)arg;
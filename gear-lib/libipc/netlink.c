@@ -50,6 +50,14 @@
 
 #define MAX_NAME    256
 
+/*
+ * many nlmsg are packed into one datagram: sender appends to tx buffer
+ * and flushes with one sendmsg, kernel proxy walks all of them and packs
+ * replies into one skb, receiver walks the datagram with NLMSG_NEXT
+ */
+#define NL_SOCK_BUF_SIZE    (1024 * 1024)
+#define NL_RX_BUF_SIZE      (64 * 1024)
+#define NL_TX_BUF_SIZE      (32 * 1024)
 
 struct nl_ctx {
     int fd;
@@ -57,7 +65,13 @@ struct nl_ctx {
     char rd_name[MAX_NAME];
     ipc_role role;
     int connected;
+    int in_recv;    /* replies sent from recv cb are held until datagram done */
     struct gevent_base *evbase;
+    pthread_mutex_t tx_lock;
+    size_t tx_len;
+    int tx_cnt;
+    uint8_t *tx;
+    uint8_t *rx;
 };
 
 static char *_nl_recv_buf = NULL;
@@ -74,6 +88,7 @@ static const char *nl_dir[] = {
         "CLIENT_TO_SERVER",
         "CLIENT_TO_CLIENT"};
 
+#ifdef NL_DEBUG
 #define nl_debug(ctx, nlhdr) \
     do { \
         printf("============================\n"); \
@@ -82,7 +97,34 @@ static const char *nl_dir[] = {
         printf("nl_msg sequence number: %d\n", nlhdr->nlmsg_seq); \
         printf("============================\n"); \
     } while (0);
+#else
+#define nl_debug(ctx, nlhdr) \
+    do { \
+        (void)nl_dir; \
+    } while (0);
+#endif
 
+/* root may go beyond rmem_max with FORCE, otherwise kernel caps it */
+static void nl_set_sock_buf(int fd)
+{
+    int size = NL_SOCK_BUF_SIZE;
+    if (-1 == setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) &&
+        -1 == setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size))) {
+        printf("set SO_RCVBUF failed: %d:%s\n", errno, strerror(errno));
+    }
+    if (-1 == setsockopt(fd, SOL_SOCKET, SO_SNDBUFFORCE, &size, sizeof(size)) &&
+        -1 == setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size))) {
+        printf("set SO_SNDBUF failed: %d:%s\n", errno, strerror(errno));
+    }
+}
+
+static void nl_ctx_free(struct nl_ctx *ctx)
+{
+    pthread_mutex_destroy(&ctx->tx_lock);
+    free(ctx->tx);
+    free(ctx->rx);
+    free(ctx);
+}
 
 static void *nl_init(struct ipc *ipc, uint16_t port, enum ipc_role role)
 {
@@ -109,146 +151,205 @@ static void *nl_init(struct ipc *ipc, uint16_t port, enum ipc_role role)
         if (errno == EPERM) {
             printf("using sudo to root\n");
         }
+        close(fd);
         return NULL;
     }
+    nl_set_sock_buf(fd);
     struct nl_ctx *ctx = calloc(1, sizeof(struct nl_ctx));
     if (!ctx) {
         printf("malloc failed!\n");
+        close(fd);
         return NULL;
     }
     ctx->fd = fd;
     ctx->role = role;
     ctx->connected = 0;
     strncpy(ctx->rd_name, name, sizeof(ctx->rd_name));
+    pthread_mutex_init(&ctx->tx_lock, NULL);
+    ctx->tx = calloc(1, NL_TX_BUF_SIZE);
+    ctx->rx = calloc(1, NL_RX_BUF_SIZE);
+    if (!ctx->tx || !ctx->rx) {
+        printf("malloc failed!\n");
+        close(fd);
+        nl_ctx_free(ctx);
+        return NULL;
+    }
     if (-1 == sem_init(&ctx->sem, 0, 0)) {
         printf("sem_init failed %d:%s\n", errno, strerror(errno));
-        free(ctx);
+        close(fd);
+        nl_ctx_free(ctx);
         return NULL;
     }
     ctx->evbase = gevent_base_create();
     if (!ctx->evbase) {
         printf("gevent_base_create failed!\n");
-        free(ctx);
+        close(fd);
+        nl_ctx_free(ctx);
         return NULL;
     }
     _nl_recv_buf = (char *)calloc(1, MAX_IPC_MESSAGE_SIZE);
     if (!_nl_recv_buf) {
         printf("malloc failed!\n");
-        free(ctx);
+        close(fd);
+        nl_ctx_free(ctx);
         return NULL;
     }
     return ctx;
 }
 
-static int nl_send(struct ipc *ipc, const void *buf, size_t len)
+/* send all nlmsg in tx buffer with one sendmsg, caller holds tx_lock */
+static int nl_tx_flush(struct nl_ctx *ctx)
 {
-    struct nl_ctx *ctx = (struct nl_ctx *)ipc->ctx;
     struct sockaddr_nl daddr;
     struct msghdr msg;
-    struct nlmsghdr *nlhdr = NULL;
     struct iovec iov;
     int ret;
 
+    if (ctx->tx_len == 0) {
+        return 0;
+    }
     memset(&daddr, 0, sizeof(daddr));
     daddr.nl_family = AF_NETLINK;
     daddr.nl_pid = 0;
+    daddr.nl_pad = 0;
     if (ctx->role == IPC_SERVER) {
         daddr.nl_groups = NETLINK_IPC_GROUP_CLIENT;
-    } else if (ctx->role == IPC_CLIENT) {
-        daddr.nl_groups = NETLINK_IPC_GROUP_SERVER;
     } else {
+        daddr.nl_groups = NETLINK_IPC_GROUP_SERVER;
     }
-    daddr.nl_pad = 0;
+    memset(&msg, 0, sizeof(struct msghdr));
+    iov.iov_base = ctx->tx;
+    iov.iov_len = ctx->tx_len;
+    msg.msg_name = (void *)&daddr;
+    msg.msg_namelen = sizeof(daddr);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    do {
+        ret = sendmsg(ctx->fd, &msg, 0);
+    } while (ret == -1 && errno == EINTR);
+    if (ret == -1) {
+        printf("sendmsg %d msgs failed: %d:%s\n", ctx->tx_cnt, errno, strerror(errno));
+    }
+    ctx->tx_len = 0;
+    ctx->tx_cnt = 0;
+    return ret == -1 ? -1 : 0;
+}
+
+static int nl_flush(struct ipc *ipc)
+{
+    int ret;
+    struct nl_ctx *ctx = (struct nl_ctx *)ipc->ctx;
+    pthread_mutex_lock(&ctx->tx_lock);
+    ret = nl_tx_flush(ctx);
+    pthread_mutex_unlock(&ctx->tx_lock);
+    return ret;
+}
+
+static int nl_send(struct ipc *ipc, const void *buf, size_t len)
+{
+    struct nl_ctx *ctx = (struct nl_ctx *)ipc->ctx;
+    struct nlmsghdr *nlhdr = NULL;
+    size_t total = NLMSG_SPACE(len + 1);
+    int ret = 0;
 
-    nlhdr = (struct nlmsghdr *)calloc(1, NLMSG_LENGTH(len+1));
+    if (total > NL_TX_BUF_SIZE) {
+        printf("nl_send len %zu is too large\n", len);
+        return -1;
+    }
+    pthread_mutex_lock(&ctx->tx_lock);
+    if (ctx->tx_len + total > NL_TX_BUF_SIZE) {
+        ret = nl_tx_flush(ctx);
+    }
+    nlhdr = (struct nlmsghdr *)(ctx->tx + ctx->tx_len);
+    memset(nlhdr, 0, total);
     nlhdr->nlmsg_pid = getpid();
     nlhdr->nlmsg_len = NLMSG_LENGTH(len+1);
     nlhdr->nlmsg_flags = 0;
     nlhdr->nlmsg_seq = nlmsg_seq++;
     if (ctx->role == IPC_SERVER) {
-        daddr.nl_groups = NETLINK_IPC_GROUP_CLIENT;
         if (ctx->connected) {
             nlhdr->nlmsg_type = SERVER_TO_CLIENT;
-            printf("SERVER_TO_CLIENT\n");
         } else {
             nlhdr->nlmsg_type = SERVER_TO_SERVER;
-            printf("SERVER_TO_SERVER\n");
         }
     } else if (ctx->role == IPC_CLIENT) {
-        daddr.nl_groups = NETLINK_IPC_GROUP_SERVER;
         if (ctx->connected) {
             nlhdr->nlmsg_type = CLIENT_TO_SERVER;
-            printf("CLIENT_TO_SERVER\n");
         } else {
             nlhdr->nlmsg_type = CLIENT_TO_CLIENT;
-            printf("CLIENT_TO_CLIENT\n");
         }
     } else {
     }
     memcpy(NLMSG_DATA(nlhdr), buf, len);
-
-    memset(&msg, 0, sizeof(struct msghdr));
-    iov.iov_base = (void *)nlhdr;
-    iov.iov_len = nlhdr->nlmsg_len;
-    msg.msg_name = (void *)&daddr;
-    msg.msg_namelen = sizeof(daddr);
-    msg.msg_iov = &iov;
-    msg.msg_iovlen = 1;
-
     nl_debug(ctx, nlhdr);
-    printf("nlmsg_pid=%d, nlmsg_len=%d\n", nlhdr->nlmsg_pid, nlhdr->nlmsg_len);
-    ret = sendmsg(ctx->fd, &msg, 0);
-    if (ret == -1) {
-        printf("sendmsg failed: %d:%s\n", errno, strerror(errno));
+    ctx->tx_len += total;
+    ctx->tx_cnt++;
+    /* held messages go out in one sendmsg at batch end or when full */
+    if (!ipc->batch && !__atomic_load_n(&ctx->in_recv, __ATOMIC_ACQUIRE)) {
+        ret = nl_tx_flush(ctx);
     }
-    free(nlhdr);
-    return ret;
+    pthread_mutex_unlock(&ctx->tx_lock);
+    return ret == -1 ? -1 : (int)len;
 }
 
-static int nl_recv(struct ipc *ipc, void *buf, size_t len)
+/* messages proxied back to ourselves are not for us */
+static bool nl_msg_ignored(struct nl_ctx *ctx, struct nlmsghdr *nlhdr)
+{
+    if (ctx->role == IPC_SERVER) {
+        return nlhdr->nlmsg_type == SERVER_TO_CLIENT ||
+               nlhdr->nlmsg_type == CLIENT_TO_CLIENT;
+    }
+    return nlhdr->nlmsg_type == CLIENT_TO_SERVER ||
+           nlhdr->nlmsg_type == SERVER_TO_SERVER;
+}
+
+static ssize_t nl_recv_datagram(struct nl_ctx *ctx, int flags)
 {
-    struct nl_ctx *ctx = (struct nl_ctx *)ipc->ctx;
     struct sockaddr_nl sa;
-    struct nlmsghdr *nlhdr = NULL;
     struct msghdr msg;
     struct iovec iov;
-    int ret;
-    char nlhdr_buf[MAX_IPC_MESSAGE_SIZE];
-
-    memset(nlhdr_buf, 0, sizeof(nlhdr_buf));
-    nlhdr = (struct nlmsghdr *)nlhdr_buf;
-    iov.iov_base = (void *)nlhdr;
-    iov.iov_len = MAX_IPC_MESSAGE_SIZE;
+    ssize_t ret;
 
+    iov.iov_base = ctx->rx;
+    iov.iov_len = NL_RX_BUF_SIZE;
     memset(&sa, 0, sizeof(sa));
     memset(&msg, 0, sizeof(msg));
     msg.msg_name = (void *)&(sa);
     msg.msg_namelen = sizeof(sa);
     msg.msg_iov = &iov;
     msg.msg_iovlen = 1;
+    do {
+        ret = recvmsg(ctx->fd, &msg, flags);
+    } while (ret == -1 && errno == EINTR);
+    if (ret > 0 && (msg.msg_flags & MSG_TRUNC)) {
+        printf("netlink datagram truncated to %d bytes\n", NL_RX_BUF_SIZE);
+    }
+    return ret;
+}
+
+/* return payload of first message of one datagram, used by handshake */
+static int nl_recv(struct ipc *ipc, void *buf, size_t len)
+{
+    struct nl_ctx *ctx = (struct nl_ctx *)ipc->ctx;
+    struct nlmsghdr *nlhdr = (struct nlmsghdr *)ctx->rx;
+    ssize_t ret;
 
-    ret = recvmsg(ctx->fd, &msg, 0);
+    ret = nl_recv_datagram(ctx, 0);
     if (ret == -1) {
         printf("recvmsg failed %d:%s\n", errno, strerror(errno));
-        return ret;
+        return -1;
     }
-    len = nlhdr->nlmsg_len - NLMSG_HDRLEN;
-    memcpy(buf, NLMSG_DATA(nlhdr), len);
-    nl_debug(ctx, nlhdr);
-    if (ctx->role == IPC_SERVER) {
-        if (nlhdr->nlmsg_type == SERVER_TO_CLIENT ||
-            nlhdr->nlmsg_type == CLIENT_TO_CLIENT) {
-            printf("ingore msg\n");
-            return 0;
-        }
+    if (!NLMSG_OK(nlhdr, (size_t)ret)) {
+        return 0;
     }
-    if (ctx->role == IPC_CLIENT) {
-        if (nlhdr->nlmsg_type == CLIENT_TO_SERVER ||
-            nlhdr->nlmsg_type == SERVER_TO_SERVER) {
-            printf("ingore msg\n");
-            return 0;
-        }
+    nl_debug(ctx, nlhdr);
+    if (nl_msg_ignored(ctx, nlhdr)) {
+        printf("ingore msg\n");
+        return 0;
     }
+    ret = MIN2(nlhdr->nlmsg_len - NLMSG_HDRLEN, len);
+    memcpy(buf, NLMSG_DATA(nlhdr), ret);
     return ret;
 }
 
@@ -260,18 +361,32 @@ static void on_error(int fd, void *arg)
 static void on_recv(int fd, void *arg)
 {
     struct ipc *ipc = (struct ipc *)arg;
-    int len;
-    len = nl_recv(ipc, _nl_recv_buf, MAX_IPC_MESSAGE_SIZE);
-    if (len == -1) {
-        printf("nl_recv failed!\n");
-        return;
-    } else if (len == 0) {
-        printf("nl_recv null msg!\n");
-        return;
+    struct nl_ctx *ctx = (struct nl_ctx *)ipc->ctx;
+    struct nlmsghdr *nlhdr;
+    ssize_t n;
+    size_t left;
+
+    /* edge triggered, drain all datagrams, each may hold many messages */
+    __atomic_store_n(&ctx->in_recv, 1, __ATOMIC_RELEASE);
+    while ((n = nl_recv_datagram(ctx, MSG_DONTWAIT)) > 0) {
+        left = n;
+        for (nlhdr = (struct nlmsghdr *)ctx->rx; NLMSG_OK(nlhdr, left);
+             nlhdr = NLMSG_NEXT(nlhdr, left)) {
+            nl_debug(ctx, nlhdr);
+            if (nl_msg_ignored(ctx, nlhdr)) {
+                continue;
+            }
+            if (_nl_recv_cb) {
+                _nl_recv_cb(ipc, NLMSG_DATA(nlhdr), nlhdr->nlmsg_len - NLMSG_HDRLEN);
+            }
+        }
     }
-    if (_nl_recv_cb) {
-        _nl_recv_cb(ipc, _nl_recv_buf, len);
+    if (n == -1 && errno != EAGAIN && errno != EWOULDBLOCK) {
+        printf("recvmsg failed %d:%s\n", errno, strerror(errno));
     }
+    __atomic_store_n(&ctx->in_recv, 0, __ATOMIC_RELEASE);
+    /* replies of the whole datagram go out together */
+    nl_flush(ipc);
 }
 
 static void on_conn_resp(int fd, void *arg)
@@ -397,8 +512,9 @@ static void nl_deinit(struct ipc *ipc)
     sem_destroy(&ctx->sem);
     if (_nl_recv_buf) {
         free(_nl_recv_buf);
+        _nl_recv_buf = NULL;
     }
-    free(ctx);
+    nl_ctx_free(ctx);
 }
 
 struct ipc_ops nlk_ops = {
@@ -409,4 +525,5 @@ struct ipc_ops nlk_ops = {
     .register_recv_cb = nl_set_recv_cb,
     .send             = nl_send,
     .recv             = nl_recv,
+    .flush            = nl_flush,
 };
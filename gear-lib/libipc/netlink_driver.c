@@ -57,27 +57,53 @@ static struct sock *nlfd;
 	printk("\n");                                           \
     } while (0)
 
-static int nl_send_msg(int pid, const u8 *data, int data_len, int dir)
+/*
+ * replies of one request skb are packed into one skb per destination pid,
+ * user space walks them with NLMSG_NEXT, so one wakeup carries many msgs
+ */
+struct nl_reply {
+	struct sk_buff *skb;
+	int pid;
+	int cnt;
+};
+
+static int nl_reply_flush(struct nl_reply *r)
 {
 	int ret;
+	if (!r->skb) {
+		return 0;
+	}
+	ret = netlink_unicast(nlfd, r->skb, r->pid, MSG_DONTWAIT);
+	if (ret < 0) {
+		printk("%s:%d netlink_unicast %d msgs failed %d, pid = %d\n",
+				__func__, __LINE__, r->cnt, ret, r->pid);
+	}
+	r->skb = NULL;
+	r->cnt = 0;
+	return ret < 0 ? ret : 0;
+}
+
+static int nl_send_msg(struct nl_reply *r, const u8 *data, int data_len, int dir)
+{
 	struct nlmsghdr *rep;
-	u8 *res;
-	struct sk_buff *skb;
 
-	skb = nlmsg_new(data_len, GFP_KERNEL);
-	if(!skb) {
-		printk("nlmsg_new failed!!!\n");
-		return -ENOMEM;
+	if (r->skb && skb_tailroom(r->skb) < nlmsg_total_size(data_len)) {
+		nl_reply_flush(r);
 	}
-
-	rep = __nlmsg_put(skb, pid, 0, dir, data_len, 0);
-	res = nlmsg_data(rep);
-	memcpy(res, data, data_len);
-	//print_buffer(rep, rep->nlmsg_len);
-	ret = netlink_unicast(nlfd, skb, pid, 0);
-	printk("%s:%d ret = %d, pid = %d, data_len = %d\n", __func__, __LINE__,
-			ret, pid, data_len);
-	//nlmsg_free(skb);
+	if (!r->skb) {
+		r->skb = nlmsg_new(max_t(size_t, data_len, NLMSG_DEFAULT_SIZE), GFP_KERNEL);
+		if (!r->skb) {
+			printk("nlmsg_new failed!!!\n");
+			return -ENOMEM;
+		}
+	}
+	rep = nlmsg_put(r->skb, r->pid, 0, dir, data_len, 0);
+	if (!rep) {
+		printk("nlmsg_put failed!!!\n");
+		return -EMSGSIZE;
+	}
+	memcpy(nlmsg_data(rep), data, data_len);
+	r->cnt++;
 	return 0;
 }
 
@@ -112,14 +138,14 @@ static int nl_broadcast_msg(int pid, int group, const u8 *data, int data_len)
 static int parse_msg(int type, char *msg, int len)
 {
     int dir;
-    printk("%s:%d msg = %s\n", __func__, __LINE__, msg);
+    pr_debug("%s:%d msg = %s\n", __func__, __LINE__, msg);
     if (!strncmp(msg, IPC_SERVER_PREFIX, strlen(IPC_SERVER_PREFIX))) {
         dir = SERVER_TO_SERVER;
     } else if (!strncmp(msg, IPC_CLIENT_PREFIX, strlen(IPC_CLIENT_PREFIX))) {
         dir = CLIENT_TO_CLIENT;
     } else {
         dir = type;
-        printk("%s:%d nlmsg_type %d\n", __func__, __LINE__, dir);
+        pr_debug("%s:%d nlmsg_type %d\n", __func__, __LINE__, dir);
     }
     return dir;
 }
@@ -131,9 +157,13 @@ static void nl_recv_msg_handler(struct sk_buff * skb)
 	int msg_len;
 	char *msg;
 	int towards;
+	struct nl_reply reply;
 
 	nlhdr = nlmsg_hdr(skb);
 	len = skb->len;
+	reply.skb = NULL;
+	reply.pid = NETLINK_CB(skb).portid;
+	reply.cnt = 0;
 
 	for(; NLMSG_OK(nlhdr, len); nlhdr = NLMSG_NEXT(nlhdr, len)) {
 		if (nlhdr->nlmsg_len < sizeof(struct nlmsghdr)) {
@@ -141,36 +171,36 @@ static void nl_recv_msg_handler(struct sk_buff * skb)
 			continue;
 		}
 		msg_len = nlhdr->nlmsg_len - NLMSG_LENGTH(0);
-		printk("%s:%d skb->len=%d,nlmsg_len=%d,msg_len=%d, buf=%s\n", __func__, __LINE__, skb->len, nlhdr->nlmsg_len, msg_len, (char *)NLMSG_DATA(nlhdr));
+		pr_debug("%s:%d skb->len=%d,nlmsg_len=%d,msg_len=%d, buf=%s\n", __func__, __LINE__, skb->len, nlhdr->nlmsg_len, msg_len, (char *)NLMSG_DATA(nlhdr));
 		msg = NLMSG_DATA(nlhdr);
 		//print_buffer(nlhdr, nlhdr->nlmsg_len);
 		towards = parse_msg(nlhdr->nlmsg_type, msg, msg_len);
 		switch (towards) {
 			case SERVER_TO_SERVER:
-				printk("%s:%d SERVER_TO_SERVER\n", __func__, __LINE__);
-				nl_send_msg(NETLINK_CB(skb).portid, NLMSG_DATA(nlhdr), msg_len, SERVER_TO_SERVER);
+				pr_debug("%s:%d SERVER_TO_SERVER\n", __func__, __LINE__);
+				nl_send_msg(&reply, NLMSG_DATA(nlhdr), msg_len, SERVER_TO_SERVER);
 				break;
 			case CLIENT_TO_CLIENT:
-				printk("%s:%d CLIENT_TO_CLIENT\n", __func__, __LINE__);
-				nl_send_msg(NETLINK_CB(skb).portid, NLMSG_DATA(nlhdr), msg_len, CLIENT_TO_CLIENT);
+				pr_debug("%s:%d CLIENT_TO_CLIENT\n", __func__, __LINE__);
+				nl_send_msg(&reply, NLMSG_DATA(nlhdr), msg_len, CLIENT_TO_CLIENT);
 				break;
 			case SERVER_TO_CLIENT:
-				printk("%s:%d SERVER_TO_CLIENT\n", __func__, __LINE__);
+				pr_debug("%s:%d SERVER_TO_CLIENT\n", __func__, __LINE__);
 				//nl_broadcast_msg(NETLINK_CB(skb).portid, NETLINK_IPC_GROUP_CLIENT, NLMSG_DATA(nlhdr), msg_len);
-				nl_send_msg(NETLINK_CB(skb).portid, NLMSG_DATA(nlhdr), msg_len, SERVER_TO_CLIENT);
+				nl_send_msg(&reply, NLMSG_DATA(nlhdr), msg_len, SERVER_TO_CLIENT);
 				break;
 			case CLIENT_TO_SERVER:
-				printk("%s:%d CLIENT_TO_SERVER\n", __func__, __LINE__);
+				pr_debug("%s:%d CLIENT_TO_SERVER\n", __func__, __LINE__);
 				//nl_broadcast_msg(NETLINK_CB(skb).portid, NETLINK_IPC_GROUP_SERVER, NLMSG_DATA(nlhdr), msg_len);
-				nl_send_msg(NETLINK_CB(skb).portid, NLMSG_DATA(nlhdr), msg_len, CLIENT_TO_SERVER);
+				nl_send_msg(&reply, NLMSG_DATA(nlhdr), msg_len, CLIENT_TO_SERVER);
 				break;
 			default:
-				printk("%s:%d to unknown\n", __func__, __LINE__);
+				pr_debug("%s:%d to unknown\n", __func__, __LINE__);
 				//nl_broadcast_msg(NETLINK_CB(skb).portid, NLMSG_DATA(nlhdr), msg_len);
 				break;
 		}
-		//nl_send_msg(NETLINK_CB(skb).portid, NLMSG_DATA(nlhdr), msg_len);
 	}
+	nl_reply_flush(&reply);
 }
 
 static int __init nlk_init(void)
@@ -23,44 +23,285 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sched.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#if defined (__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
 #include "libipc.h"
 
+/*
+ * share memory IPC, server creates /dev/shm/IPC_SHM.$port with two rings,
+ * client maps it. each ring is single producer single consumer, messages
+ * are length prefixed, reader sleeps on futex of ring seq when empty,
+ * writer only wakes it when it is sleeping, no syscall on busy path
+ */
 
-struct shm_ctx {
+#define IPC_SHM_NAME        "/IPC_SHM"
+#define IPC_SHM_MAGIC       (0x49504353) /* IPCS */
+#define IPC_SHM_RING_SIZE   (64 * 1024)
+#define IPC_SHM_WAIT_MS     (100)
+#define IPC_SHM_SEND_TIMEOUT (1000)
+
+#define SHM_LOAD(p)         __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define SHM_STORE(p, v)     __atomic_store_n(p, v, __ATOMIC_RELEASE)
 
+struct shm_ring {
+    uint64_t rd;            /* only stored by reader */
+    char pad0[56];
+    uint64_t wr;            /* only stored by writer */
+    uint32_t seq;           /* futex word, bumped by writer */
+    char pad1[52];
+    uint32_t sleeping;
+    char pad2[60];
+    uint8_t data[IPC_SHM_RING_SIZE];
 };
 
+struct shm_region {
+    uint32_t magic;
+    char pad[60];
+    struct shm_ring ring[2];    /* 0: client to server, 1: server to client */
+};
 
-static void *shm_init(struct ipc *ipc, uint16_t port, enum ipc_role role)
+struct shm_ctx {
+    char name[64];
+    uint8_t buf[MAX_IPC_MESSAGE_SIZE];  /* packet is parsed in place */
+    struct shm_region *region;
+    struct shm_ring *tx;
+    struct shm_ring *rx;
+    ipc_recv_cb *recv_cb;
+    pthread_t tid;
+    bool running;
+    bool stop;
+};
+
+static void futex_wait(uint32_t *addr, uint32_t val, int ms)
+{
+#if defined (__linux__)
+    struct timespec ts;
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (ms % 1000) * 1000 * 1000;
+    /* not private, waker is in another process */
+    syscall(SYS_futex, addr, FUTEX_WAIT, val, &ts, NULL, 0);
+#else
+    usleep(ms * 1000);
+#endif
+}
+
+static void futex_wake(uint32_t *addr)
 {
+#if defined (__linux__)
+    syscall(SYS_futex, addr, FUTEX_WAKE, 1, NULL, NULL, 0);
+#endif
+}
+
+static void ring_copy_in(struct shm_ring *r, uint64_t pos, const void *buf, size_t len)
+{
+    size_t off = pos % IPC_SHM_RING_SIZE;
+    size_t first = MIN2(len, IPC_SHM_RING_SIZE - off);
+    memcpy(r->data + off, buf, first);
+    memcpy(r->data, (const uint8_t *)buf + first, len - first);
+}
+
+static void ring_copy_out(struct shm_ring *r, uint64_t pos, void *buf, size_t len)
+{
+    size_t off = pos % IPC_SHM_RING_SIZE;
+    size_t first = MIN2(len, IPC_SHM_RING_SIZE - off);
+    memcpy(buf, r->data + off, first);
+    memcpy((uint8_t *)buf + first, r->data, len - first);
+}
+
+/* pop one message, 0 if ring is empty */
+static int ring_pop(struct shm_ring *r, void *buf, size_t len)
+{
+    uint32_t msg_len;
+    uint64_t rd = r->rd;
+    if (SHM_LOAD(&r->wr) == rd) {
+        return 0;
+    }
+    ring_copy_out(r, rd, &msg_len, sizeof(msg_len));
+    if (msg_len > len) {
+        printf("shm message %u too long, dropped\n", msg_len);
+        msg_len = 0;
+    } else {
+        ring_copy_out(r, rd + sizeof(msg_len), buf, msg_len);
+    }
+    SHM_STORE(&r->rd, rd + sizeof(uint32_t) + ((msg_len + 3) & ~3U));
+    return msg_len ? (int)msg_len : -1;
+}
+
+static int ring_push(struct shm_ring *r, const void *buf, size_t len)
+{
+    uint32_t msg_len = len;
+    uint64_t wr = r->wr;
+    size_t need = sizeof(msg_len) + ((len + 3) & ~3U);
+    int waited = 0;
+
+    while (IPC_SHM_RING_SIZE - (size_t)(wr - SHM_LOAD(&r->rd)) < need) {
+        if (waited++ > IPC_SHM_SEND_TIMEOUT) {
+            printf("shm ring full, reader is gone?\n");
+            return -1;
+        }
+        usleep(1000);
+    }
+    ring_copy_in(r, wr, &msg_len, sizeof(msg_len));
+    ring_copy_in(r, wr + sizeof(msg_len), buf, len);
+    SHM_STORE(&r->wr, wr + need);
+    __atomic_fetch_add(&r->seq, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&r->sleeping, __ATOMIC_SEQ_CST)) {
+        futex_wake(&r->seq);
+    }
+    return len;
+}
+
+static void *shm_recv_thread(void *arg)
+{
+    struct ipc *ipc = (struct ipc *)arg;
+    struct shm_ctx *c = (struct shm_ctx *)ipc->ctx;
+    struct shm_ring *r = c->rx;
+    uint32_t seq;
+    int len;
+
+    while (!SHM_LOAD(&c->stop)) {
+        len = ring_pop(r, c->buf, sizeof(c->buf));
+        if (len > 0) {
+            c->recv_cb(ipc, c->buf, len);
+            continue;
+        } else if (len < 0) {
+            continue;
+        }
+        /* seq is read before rechecking, a later write changes it */
+        seq = SHM_LOAD(&r->seq);
+        __atomic_store_n(&r->sleeping, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&r->wr, __ATOMIC_SEQ_CST) == r->rd && !SHM_LOAD(&c->stop)) {
+            futex_wait(&r->seq, seq, IPC_SHM_WAIT_MS);
+        }
+        SHM_STORE(&r->sleeping, 0);
+    }
     return NULL;
 }
 
+static void *shm_init(struct ipc *ipc, uint16_t port, enum ipc_role role)
+{
+    int fd;
+    void *addr;
+    struct shm_ctx *c = calloc(1, sizeof(struct shm_ctx));
+    if (!c) {
+        printf("malloc failed!\n");
+        return NULL;
+    }
+    snprintf(c->name, sizeof(c->name), "%s.%d", IPC_SHM_NAME, port);
+    if (role == IPC_SERVER) {
+        shm_unlink(c->name);
+        fd = shm_open(c->name, O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (fd != -1 && ftruncate(fd, sizeof(struct shm_region)) == -1) {
+            close(fd);
+            fd = -1;
+        }
+    } else {
+        fd = shm_open(c->name, O_RDWR, 0600);
+    }
+    if (fd == -1) {
+        printf("shm_open %s failed %d: %s\n", c->name, errno, strerror(errno));
+        goto failed;
+    }
+    addr = mmap(NULL, sizeof(struct shm_region), PROT_READ | PROT_WRITE,
+                MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        printf("mmap %s failed %d: %s\n", c->name, errno, strerror(errno));
+        goto failed;
+    }
+    c->region = (struct shm_region *)addr;
+    if (role == IPC_SERVER) {
+        SHM_STORE(&c->region->magic, IPC_SHM_MAGIC);
+        c->rx = &c->region->ring[0];
+        c->tx = &c->region->ring[1];
+    } else {
+        if (SHM_LOAD(&c->region->magic) != IPC_SHM_MAGIC) {
+            printf("shm %s is not ready!\n", c->name);
+            munmap(addr, sizeof(struct shm_region));
+            goto failed;
+        }
+        c->rx = &c->region->ring[1];
+        c->tx = &c->region->ring[0];
+    }
+    ipc->fd = -1;
+    return c;
+
+failed:
+    if (role == IPC_SERVER) {
+        shm_unlink(c->name);
+    }
+    free(c);
+    return NULL;
+}
 
 static void shm_deinit(struct ipc *ipc)
 {
-
+    struct shm_ctx *c = (struct shm_ctx *)ipc->ctx;
+    if (!c) {
+        return;
+    }
+    if (c->running) {
+        SHM_STORE(&c->stop, true);
+        __atomic_fetch_add(&c->rx->seq, 1, __ATOMIC_SEQ_CST);
+        futex_wake(&c->rx->seq);
+        pthread_join(c->tid, NULL);
+    }
+    if (ipc->role == IPC_SERVER) {
+        shm_unlink(c->name);
+    }
+    munmap(c->region, sizeof(struct shm_region));
+    free(c);
 }
 
+static int shm_set_recv_cb(struct ipc *ipc, ipc_recv_cb *cb)
+{
+    struct shm_ctx *c = (struct shm_ctx *)ipc->ctx;
+    c->recv_cb = cb;
+    if (c->running) {
+        return 0;
+    }
+    /* start reading only when there is somebody to take messages */
+    if (0 != pthread_create(&c->tid, NULL, shm_recv_thread, ipc)) {
+        printf("pthread_create failed!\n");
+        return -1;
+    }
+    c->running = true;
+    return 0;
+}
 
 static int shm_write(struct ipc *ipc, const void *buf, size_t len)
 {
-    return 0;
+    struct shm_ctx *c = (struct shm_ctx *)ipc->ctx;
+    if (len > MAX_IPC_MESSAGE_SIZE) {
+        printf("shm message %zu too long!\n", len);
+        return -1;
+    }
+    return ring_push(c->tx, buf, len);
 }
 
 static int shm_read(struct ipc *ipc, void *buf, size_t len)
 {
-    return 0;
+    struct shm_ctx *c = (struct shm_ctx *)ipc->ctx;
+    if (c->running) {
+        /* recv thread owns the ring */
+        return -1;
+    }
+    return ring_pop(c->rx, buf, len);
 }
 
-
 struct ipc_ops shm_ops = {
     .init             = shm_init,
     .deinit           = shm_deinit,
     .accept           = NULL,
     .connect          = NULL,
-    .register_recv_cb = NULL,
+    .register_recv_cb = shm_set_recv_cb,
     .send             = shm_write,
     .recv             = shm_read,
 };
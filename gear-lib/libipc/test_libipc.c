@@ -22,6 +22,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <stdint.h>
 #include "libipc.h"
 #include "libipc_stub.h"
 
@@ -77,8 +78,108 @@ int foo()
     return 0;
 }
 
+static int on_calc(struct ipc *ipc, void *in_arg, size_t in_len,
+                   void *out_arg, size_t *out_len)
+{
+    struct calc_args *calc = (struct calc_args *)in_arg;
+    *(int *)out_arg = calc->left + calc->right;
+    *out_len = sizeof(int);
+    return 0;
+}
+
+BEGIN_IPC_MAP(SHM_TEST)
+IPC_MAP(IPC_CALC, on_calc)
+END_IPC_MAP()
+
+#define SHM_TEST_CALLS  1000
+#define ASYNC_DEPTH     64
+
+static int g_cb_ok = 0;
+
+static void on_calc_done(struct ipc *ipc, struct ipc_future *f, void *arg)
+{
+    int in = (int)(intptr_t)arg;
+    if (f->done == 1 && f->olen == sizeof(int) && *(int *)f->obuf == in + 1) {
+        __sync_fetch_and_add(&g_cb_ok, 1);
+    }
+}
+
+/* all requests are outstanding before the first response is waited */
+static int async_test(struct ipc *client)
+{
+    int i, ok = 0;
+    struct calc_args calc[ASYNC_DEPTH];
+    struct ipc_future *f[ASYNC_DEPTH];
+
+    for (i = 0; i < ASYNC_DEPTH; i++) {
+        calc[i].left = i;
+        calc[i].right = 1;
+        calc[i].opcode = '+';
+        f[i] = ipc_call_async(client, IPC_CALC, &calc[i], sizeof(calc[i]));
+    }
+    for (i = ASYNC_DEPTH - 1; i >= 0; i--) {
+        if (f[i] && 0 == ipc_future_wait(client, f[i], 2000) &&
+            *(int *)f[i]->obuf == i + 1) {
+            ok++;
+        }
+        ipc_future_free(client, f[i]);
+    }
+    for (i = 0; i < ASYNC_DEPTH; i++) {
+        ipc_call_cb(client, IPC_CALC, &calc[i], sizeof(calc[i]), on_calc_done,
+                    (void *)(intptr_t)i);
+    }
+    for (i = 0; i < 200 && __sync_fetch_and_add(&g_cb_ok, 0) < ASYNC_DEPTH; i++) {
+        usleep(10 * 1000);
+    }
+    printf("ipc async: future ok %d/%d, callback ok %d/%d\n",
+           ok, ASYNC_DEPTH, g_cb_ok, ASYNC_DEPTH);
+    return (ok == ASYNC_DEPTH && g_cb_ok == ASYNC_DEPTH) ? 0 : -1;
+}
+
+/* server and client in one process over share memory backend */
+int shm_test()
+{
+    int i, ret, ok = 0;
+    struct calc_args calc;
+    struct ipc *server, *client;
+
+    setenv("LIBIPC_BACKEND", "shm", 1);
+    server = ipc_create(IPC_SERVER, IPC_SERVER_PORT);
+    if (!server) {
+        printf("ipc_create server failed!\n");
+        return -1;
+    }
+    IPC_REGISTER_MAP(SHM_TEST);
+    client = ipc_create(IPC_CLIENT, IPC_SERVER_PORT);
+    if (!client) {
+        printf("ipc_create client failed!\n");
+        ipc_destroy(server);
+        return -1;
+    }
+    for (i = 0; i < SHM_TEST_CALLS; i++) {
+        calc.left = i;
+        calc.right = 1;
+        calc.opcode = '+';
+        ret = 0;
+        if (0 == ipc_call(client, IPC_CALC, &calc, sizeof(calc), &ret, sizeof(ret)) &&
+            ret == i + 1) {
+            ok++;
+        }
+    }
+    printf("ipc shm: ok %d/%d\n", ok, SHM_TEST_CALLS);
+    if (0 != async_test(client)) {
+        ok = 0;
+    }
+    ipc_destroy(client);
+    ipc_destroy(server);
+    return (ok == SHM_TEST_CALLS) ? 0 : -1;
+}
+
 int main(int argc, char **argv)
 {
+    if (argc > 1 && !strcmp(argv[1], "-m")) {
+        return shm_test();
+    }
     //foo();
     shell_test();
 
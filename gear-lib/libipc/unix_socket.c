@@ -73,7 +73,7 @@ static int sk_recv(struct ipc *ipc, void *buf, size_t len)
 static void on_recv(int fd, void *arg)
 {
     struct ipc *ipc = (struct ipc *)arg;
-    char buf[1024];
+    char buf[MAX_IPC_MESSAGE_SIZE];
     int len = sk_recv(ipc, buf, sizeof(buf));
     if (sk_recv_cb) {
         sk_recv_cb(ipc, buf, len);
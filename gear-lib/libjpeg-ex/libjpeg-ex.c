@@ -13,8 +13,11 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <string.h>
+#include <pthread.h>
 #include <jpeglib.h>
 #include <liblog.h>
+#include <libworkq.h>
 #include "libjpeg-ex.h"
 
 #define COLOR_COMPONENTS    (3)
@@ -138,12 +141,22 @@ static void init_destination(j_compress_ptr cinfo)
     dest->pub.free_in_buffer = OUTPUT_BUF_SIZE;
 }
 
+/* bytes past outbuffer_size are counted but not copied */
+static void dest_copy(struct jpeg_args *dest, size_t len)
+{
+    size_t room;
+    if (*(dest->written) < dest->outbuffer_size) {
+        room = dest->outbuffer_size - *(dest->written);
+        memcpy(dest->outbuffer_cursor, dest->buffer, len < room ? len : room);
+    }
+    dest->outbuffer_cursor += len;
+    *(dest->written) += len;
+}
+
 static boolean empty_output_buffer(j_compress_ptr cinfo)
 {
     struct jpeg_args *dest = (struct jpeg_args *) cinfo->dest;
-    memcpy(dest->outbuffer_cursor, dest->buffer, OUTPUT_BUF_SIZE);
-    dest->outbuffer_cursor += OUTPUT_BUF_SIZE;
-    *(dest->written) += OUTPUT_BUF_SIZE;
+    dest_copy(dest, OUTPUT_BUF_SIZE);
     dest->pub.next_output_byte = dest->buffer;
     dest->pub.free_in_buffer = OUTPUT_BUF_SIZE;
     return TRUE;
@@ -153,9 +166,7 @@ static void term_destination(j_compress_ptr cinfo)
 {
     struct jpeg_args * dest = (struct jpeg_args *) cinfo->dest;
     size_t datacount = OUTPUT_BUF_SIZE - dest->pub.free_in_buffer;
-    memcpy(dest->outbuffer_cursor, dest->buffer, datacount);
-    dest->outbuffer_cursor += datacount;
-    *(dest->written) += datacount;
+    dest_copy(dest, datacount);
 }
 
 static void dest_buffer(j_compress_ptr cinfo, unsigned char *buffer, int size, int *written)
@@ -343,6 +354,8 @@ void je_jpeg_free(struct je_jpeg *jpeg)
     free(jpeg);
 }
 
+static void decode_error_exit(j_common_ptr cinfo);
+
 struct je_codec *je_codec_create()
 {
     struct je_codec *codec = CALLOC(1, struct je_codec);
@@ -355,9 +368,11 @@ struct je_codec *je_codec_create()
     jpeg_create_compress(&codec->encoder);
     jpeg_set_quality(&codec->encoder, DEFAULT_JPEG_QUALITY, 1);
 
-    //init decoder
-    //codec->decoder.err = jpeg_std_error(&codec->errmgr);
-    //jpeg_create_decompress(&codec->decoder);
+    //init decoder, errors longjmp back instead of exit
+    codec->decoder.err = jpeg_std_error(&codec->decode_errmgr);
+    codec->decode_errmgr.error_exit = decode_error_exit;
+    codec->decoder.client_data = codec;
+    jpeg_create_decompress(&codec->decoder);
 
     return codec;
 }
@@ -370,6 +385,7 @@ void je_codec_destroy(struct je_codec *codec)
     }
     jpeg_destroy_compress(&codec->encoder);
     jpeg_destroy_decompress(&codec->decoder);
+    free(codec->scratch);
     free(codec);
 }
 
@@ -419,23 +435,32 @@ err:
     return yuv;
 }
 
-int je_encode_yuv_to_jpeg(struct je_codec *codec, struct je_yuv *yuv, struct je_jpeg *jpeg)
+/*
+ * 4:2:0 planes to jpeg in out through jpeg_write_raw_data, luma rows are
+ * handed to libjpeg in place. nv12 chroma is split into u and v rows of one
+ * MCU row at a time, planar chroma is used in place too. rows past height
+ * repeat the last one, return -1 if out is too small
+ */
+struct raw_planes {
+    uint8_t *y;
+    uint8_t *u;     /* packed uv if nv12 */
+    uint8_t *v;
+    int y_stride;
+    int uv_stride;
+    int nv12;
+};
+
+static int encode_raw(struct je_codec *codec, struct raw_planes *in,
+                int width, int height, uint8_t *out, int size, int *written)
 {
-    if (!codec || !yuv || !jpeg) {
-        loge("invalid paraments!\n");
-        return -1;
-    }
-    uint8_t *output = jpeg->data.iov_base;
-    int quality = DEFAULT_JPEG_QUALITY;
     struct jpeg_compress_struct *encoder = &codec->encoder;
-
+    int quality = DEFAULT_JPEG_QUALITY;
+    int cw = (width + 1) / 2;
     int i = 0;
     int j = 0;
-    int written = 0;
-
-    uint32_t size = yuv->width * yuv->height;
-    uint32_t quarter_size = size / 4;
-    uint32_t row = 0;
+    int k = 0;
+    int row = 0;
+    uint8_t *uv;
 
     JSAMPROW y[16];
     JSAMPROW cb[16];
@@ -446,10 +471,22 @@ int je_encode_yuv_to_jpeg(struct je_codec *codec, struct je_yuv *yuv, struct je_
     planes[1] = cb;
     planes[2] = cr;
 
-    dest_buffer(encoder, output, yuv->width * yuv->height, &written);
+    if (in->nv12 && codec->scratch_size < cw * 16) {
+        free(codec->scratch);
+        codec->scratch_size = 0;
+        /* 8 rows of u and v, padded to a whole block */
+        codec->scratch = malloc((cw + 16) * 16);
+        if (!codec->scratch) {
+            loge("malloc chroma rows failed!\n");
+            return -1;
+        }
+        codec->scratch_size = (cw + 16) * 16;
+    }
+
+    dest_buffer(encoder, out, size, written);
 
-    encoder->image_width = yuv->width;	/* image width and height, in pixels */
-    encoder->image_height = yuv->height;
+    encoder->image_width = width;	/* image width and height, in pixels */
+    encoder->image_height = height;
     encoder->input_components = COLOR_COMPONENTS;	/* # of color components per pixel */
     encoder->in_color_space = JCS_YCbCr;       /* colorspace of input image */
 
@@ -465,24 +502,570 @@ int je_encode_yuv_to_jpeg(struct je_codec *codec, struct je_yuv *yuv, struct je_
     encoder->comp_info[2].v_samp_factor = 1;
 
     jpeg_set_quality(encoder, quality, TRUE /* limit to baseline-JPEG values */);
-    loge("xxx\n");
     jpeg_start_compress(encoder, TRUE);
-    loge("xxx\n");
 
-    for (j = 0; j < yuv->height; j += 16) {
+    for (j = 0; j < height; j += 16) {
         for (i = 0; i < 16; i++) {
-            row = yuv->width * (i + j);
-            y[i] = yuv->data.iov_base + row;
-            if (i % 2 == 0) {
-                cb[i/2] = yuv->data.iov_base + size + row/4;
-                cr[i/2] = yuv->data.iov_base + size + quarter_size + row/4;
+            row = (i + j < height) ? i + j : height - 1;
+            y[i] = in->y + in->y_stride * row;
+            if (i % 2) {
+                continue;
+            }
+            if (!in->nv12) {
+                cb[i/2] = in->u + in->uv_stride * (row / 2);
+                cr[i/2] = in->v + in->uv_stride * (row / 2);
+                continue;
+            }
+            uv = in->u + in->uv_stride * (row / 2);
+            cb[i/2] = codec->scratch + (cw + 16) * (i / 2);
+            cr[i/2] = codec->scratch + (cw + 16) * (8 + i / 2);
+            for (k = 0; k < cw; k++) {
+                cb[i/2][k] = uv[2 * k];
+                cr[i/2][k] = uv[2 * k + 1];
             }
         }
         jpeg_write_raw_data(encoder, planes, 16);
     }
-    loge("xxx\n");
     jpeg_finish_compress(encoder);
-    loge("xxx\n");
+    return *written > size ? -1 : 0;
+}
+
+static int encode_i420(struct je_codec *codec, uint8_t *ybase, uint8_t *ubase,
+                uint8_t *vbase, int width, int height, uint8_t *out, int size,
+                int *written)
+{
+    struct raw_planes in = {ybase, ubase, vbase, width, width / 2, 0};
+    return encode_raw(codec, &in, width, height, out, size, written);
+}
+
+int je_encode_yuv_to_jpeg(struct je_codec *codec, struct je_yuv *yuv, struct je_jpeg *jpeg)
+{
+    uint8_t *base;
+    int size, written = 0;
+
+    if (!codec || !yuv || !jpeg) {
+        loge("invalid paraments!\n");
+        return -1;
+    }
+    base = yuv->data.iov_base;
+    size = yuv->width * yuv->height;
+    /* out buffer is sized by je_jpeg_new */
+    if (0 != encode_i420(codec, base, base + size, base + size + size / 4,
+                         yuv->width, yuv->height, jpeg->data.iov_base,
+                         size * COLOR_COMPONENTS, &written)) {
+        loge("jpeg of %d bytes over the buffer!\n", written);
+        return -1;
+    }
     jpeg->data.iov_len = written;
     return 0;
 }
+
+int je_encode_frame_to_jpeg(struct je_codec *codec,
+                const struct video_frame *frame, struct je_jpeg *jpeg)
+{
+    struct raw_planes in;
+    int written = 0;
+
+    if (!codec || !frame || !jpeg) {
+        loge("invalid paraments!\n");
+        return -1;
+    }
+    memset(&in, 0, sizeof(in));
+    in.y = frame->data[0];
+    in.y_stride = frame->linesize[0];
+    in.u = frame->data[1];
+    in.uv_stride = frame->linesize[1];
+    switch (frame->format) {
+    case PIXEL_FORMAT_I420:
+        in.v = frame->data[2];
+        break;
+    case PIXEL_FORMAT_NV12:
+        in.nv12 = 1;
+        break;
+    default:
+        loge("unsupported pixel format %s!\n",
+             pixel_format_to_string(frame->format));
+        return -1;
+    }
+    if (0 != encode_raw(codec, &in, frame->width, frame->height,
+                        jpeg->data.iov_base, jpeg->data.iov_len, &written)) {
+        loge("jpeg of %d bytes over the buffer!\n", written);
+        return -1;
+    }
+    jpeg->data.iov_len = written;
+    jpeg->width = frame->width;
+    jpeg->height = frame->height;
+    return 0;
+}
+
+/* libjpeg exit()s on errors by default, a bad camera frame must not */
+static void decode_error_exit(j_common_ptr cinfo)
+{
+    struct je_codec *codec = (struct je_codec *)cinfo->client_data;
+    char msg[JMSG_LENGTH_MAX];
+
+    (*cinfo->err->format_message)(cinfo, msg);
+    loge("jpeg decode: %s\n", msg);
+    longjmp(codec->jmp, 1);
+}
+
+static int decode_header(struct je_codec *codec, struct je_jpeg *jpeg, int scale)
+{
+    struct jpeg_decompress_struct *decoder = &codec->decoder;
+
+    if (scale != 1 && scale != 2 && scale != 4 && scale != 8) {
+        loge("scale must be 1, 2, 4 or 8!\n");
+        return -1;
+    }
+    jpeg_mem_src(decoder, jpeg->data.iov_base, jpeg->data.iov_len);
+    if (JPEG_HEADER_OK != jpeg_read_header(decoder, TRUE)) {
+        return -1;
+    }
+    decoder->scale_num = 1;
+    decoder->scale_denom = scale;
+    decoder->dct_method = JDCT_IFAST;
+    decoder->do_fancy_upsampling = FALSE;
+    return 0;
+}
+
+int je_jpeg_get_size(struct je_codec *codec, struct je_jpeg *jpeg, int scale,
+                int *width, int *height)
+{
+    struct jpeg_decompress_struct *decoder;
+
+    if (!codec || !jpeg || !width || !height) {
+        loge("invalid paraments!\n");
+        return -1;
+    }
+    decoder = &codec->decoder;
+    if (setjmp(codec->jmp)) {
+        jpeg_abort_decompress(decoder);
+        return -1;
+    }
+    if (0 != decode_header(codec, jpeg, scale)) {
+        jpeg_abort_decompress(decoder);
+        return -1;
+    }
+    jpeg_calc_output_dimensions(decoder);
+    *width = decoder->output_width;
+    *height = decoder->output_height;
+    jpeg_abort_decompress(decoder);
+    return 0;
+}
+
+/*
+ * scanlines come out as YCbCr without chroma upsampling filter, luma is
+ * stored as is and chroma of even rows and columns makes the 4:2:0 planes
+ */
+int je_decode_jpeg_to_frame(struct je_codec *codec, struct je_jpeg *jpeg,
+                int scale, struct video_frame *frame)
+{
+    struct jpeg_decompress_struct *decoder;
+    uint8_t *y, *u, *v, *line;
+    int width, height, gray, row, i, uv_step;
+    JSAMPROW rows[1];
+
+    if (!codec || !jpeg || !frame || !frame->data[0]) {
+        loge("invalid paraments!\n");
+        return -1;
+    }
+    switch (frame->format) {
+    case PIXEL_FORMAT_I420:
+    case PIXEL_FORMAT_NV12:
+    case PIXEL_FORMAT_Y800:
+        break;
+    default:
+        loge("unsupported pixel format %s!\n",
+             pixel_format_to_string(frame->format));
+        return -1;
+    }
+    decoder = &codec->decoder;
+    if (setjmp(codec->jmp)) {
+        jpeg_abort_decompress(decoder);
+        return -1;
+    }
+    if (0 != decode_header(codec, jpeg, scale)) {
+        jpeg_abort_decompress(decoder);
+        return -1;
+    }
+    gray = (decoder->jpeg_color_space == JCS_GRAYSCALE ||
+            frame->format == PIXEL_FORMAT_Y800);
+    decoder->out_color_space = gray ? JCS_GRAYSCALE : JCS_YCbCr;
+    jpeg_calc_output_dimensions(decoder);
+    width = decoder->output_width;
+    height = decoder->output_height;
+    if (width > (int)frame->width || height > (int)frame->height) {
+        loge("frame %dx%d is smaller than jpeg %dx%d!\n",
+             frame->width, frame->height, width, height);
+        jpeg_abort_decompress(decoder);
+        return -1;
+    }
+    if (codec->scratch_size < width * COLOR_COMPONENTS) {
+        free(codec->scratch);
+        codec->scratch_size = 0;
+        codec->scratch = malloc(width * COLOR_COMPONENTS);
+        if (!codec->scratch) {
+            loge("malloc scanline failed!\n");
+            jpeg_abort_decompress(decoder);
+            return -1;
+        }
+        codec->scratch_size = width * COLOR_COMPONENTS;
+    }
+    jpeg_start_decompress(decoder);
+    uv_step = frame->format == PIXEL_FORMAT_NV12 ? 2 : 1;
+    while (decoder->output_scanline < decoder->output_height) {
+        row = decoder->output_scanline;
+        y = frame->data[0] + frame->linesize[0] * row;
+        rows[0] = gray ? y : codec->scratch;
+        jpeg_read_scanlines(decoder, rows, 1);
+        if (frame->format == PIXEL_FORMAT_Y800 || row % 2) {
+            if (!gray) {
+                for (i = 0, line = codec->scratch; i < width; i++, line += 3) {
+                    y[i] = line[0];
+                }
+            }
+            continue;
+        }
+        u = frame->data[1] + frame->linesize[1] * (row / 2);
+        v = frame->format == PIXEL_FORMAT_NV12 ? u + 1 :
+            frame->data[2] + frame->linesize[2] * (row / 2);
+        if (gray) {
+            for (i = 0; i < (width + 1) / 2; i++) {
+                u[i * uv_step] = 128;
+                v[i * uv_step] = 128;
+            }
+            continue;
+        }
+        for (i = 0, line = codec->scratch; i < width; i++, line += 3) {
+            y[i] = line[0];
+            if (i % 2 == 0) {
+                u[i / 2 * uv_step] = line[1];
+                v[i / 2 * uv_step] = line[2];
+            }
+        }
+    }
+    jpeg_finish_decompress(decoder);
+    frame->width = width;
+    frame->height = height;
+    return 0;
+}
+
+/*
+ * codec pool: a je_codec is used by one thread at a time, so every thread
+ * takes one from the pool on first use and keeps it in thread local slot,
+ * the codec goes back to the free list when the thread exits
+ */
+struct je_codec_pool {
+    pthread_key_t key;
+    pthread_mutex_t lock;
+    struct je_codec **codecs;   /* all codecs, freed with the pool */
+    int nb_codecs;
+    int max_codecs;
+    struct je_codec *free_list;
+    struct workq_pool *wq;
+    int own_wq;
+    int stripes;
+};
+
+static void codec_release(void *arg)
+{
+    struct je_codec *codec = (struct je_codec *)arg;
+    struct je_codec_pool *pool = codec->pool;
+
+    pthread_mutex_lock(&pool->lock);
+    codec->next = pool->free_list;
+    pool->free_list = codec;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+struct je_codec_pool *je_codec_pool_create(struct workq_pool *wq)
+{
+    struct je_codec_pool *pool = CALLOC(1, struct je_codec_pool);
+    if (!pool) {
+        loge("malloc codec pool failed!\n");
+        return NULL;
+    }
+    if (0 != pthread_key_create(&pool->key, codec_release)) {
+        loge("pthread_key_create failed!\n");
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pool->stripes = 1;
+    pool->wq = wq;
+    if (!pool->wq) {
+        pool->wq = workq_pool_create();
+        pool->own_wq = 1;
+    }
+    if (!pool->wq) {
+        loge("workq_pool_create failed!\n");
+        pthread_key_delete(pool->key);
+        free(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+/* workq must be idle, codecs still held by threads are freed too */
+void je_codec_pool_destroy(struct je_codec_pool *pool)
+{
+    int i;
+    if (!pool) {
+        return;
+    }
+    if (pool->own_wq) {
+        workq_pool_destroy(pool->wq);
+    }
+    pthread_key_delete(pool->key);
+    for (i = 0; i < pool->nb_codecs; i++) {
+        je_codec_destroy(pool->codecs[i]);
+    }
+    free(pool->codecs);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+}
+
+void je_codec_pool_set_stripes(struct je_codec_pool *pool, int stripes)
+{
+    if (pool) {
+        pool->stripes = stripes > 1 ? stripes : 1;
+    }
+}
+
+struct je_codec *je_codec_pool_get(struct je_codec_pool *pool)
+{
+    struct je_codec *codec, **codecs;
+    int max;
+
+    if (!pool) {
+        return NULL;
+    }
+    codec = (struct je_codec *)pthread_getspecific(pool->key);
+    if (codec) {
+        return codec;
+    }
+    pthread_mutex_lock(&pool->lock);
+    codec = pool->free_list;
+    if (codec) {
+        pool->free_list = codec->next;
+    } else if ((codec = je_codec_create())) {
+        if (pool->nb_codecs == pool->max_codecs) {
+            max = pool->max_codecs ? pool->max_codecs * 2 : 8;
+            codecs = realloc(pool->codecs, max * sizeof(struct je_codec *));
+            if (!codecs) {
+                pthread_mutex_unlock(&pool->lock);
+                je_codec_destroy(codec);
+                return NULL;
+            }
+            pool->codecs = codecs;
+            pool->max_codecs = max;
+        }
+        codec->pool = pool;
+        pool->codecs[pool->nb_codecs++] = codec;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    if (codec) {
+        pthread_setspecific(pool->key, codec);
+    }
+    return codec;
+}
+
+/*
+ * stripes: frame is cut into bands of whole MCU rows, each band is encoded
+ * as its own jpeg in parallel. the bands are joined as restart intervals of
+ * one jpeg: headers of the first band with the full height and a DRI of one
+ * band, then the entropy data of every band ended by RST0..7, since a
+ * restart resets DC prediction just as a new jpeg starts it from zero
+ */
+struct stripe_job {
+    struct je_codec_pool *pool;
+    struct je_yuv *yuv;
+    int rows;               /* luma rows of a band, whole MCU rows */
+    uint8_t *buf;           /* band i at buf + i * cap */
+    int cap;
+    int *written;
+    int failed;
+};
+
+static void stripe_encode(int i, void *arg)
+{
+    struct stripe_job *job = (struct stripe_job *)arg;
+    struct je_yuv *yuv = job->yuv;
+    struct je_codec *codec = je_codec_pool_get(job->pool);
+    uint8_t *base = yuv->data.iov_base;
+    int size = yuv->width * yuv->height;
+    int y0 = i * job->rows;
+    int h = yuv->height - y0 < job->rows ? yuv->height - y0 : job->rows;
+
+    if (!codec || 0 != encode_i420(codec, base + yuv->width * y0,
+                    base + size + yuv->width / 2 * (y0 / 2),
+                    base + size + size / 4 + yuv->width / 2 * (y0 / 2),
+                    yuv->width, h, job->buf + (size_t)i * job->cap, job->cap,
+                    &job->written[i])) {
+        __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/* offsets of SOF0 and SOS and end of SOS header, -1 if not found */
+static int stripe_headers(const uint8_t *p, int len, int *sof, int *sos, int *data)
+{
+    int pos = 2, seg;
+
+    *sof = -1;
+    if (len < 4 || p[0] != 0xFF || p[1] != 0xD8) {
+        return -1;
+    }
+    while (pos + 4 <= len && p[pos] == 0xFF) {
+        seg = p[pos + 2] << 8 | p[pos + 3];
+        if (p[pos + 1] == 0xC0) {
+            *sof = pos;
+        } else if (p[pos + 1] == 0xDA) {
+            *sos = pos;
+            *data = pos + 2 + seg;
+            return (*sof < 0 || *data > len - 2) ? -1 : 0;
+        }
+        pos += 2 + seg;
+    }
+    return -1;
+}
+
+static int stripe_join(struct stripe_job *job, int n, struct je_jpeg *jpeg)
+{
+    struct je_yuv *yuv = job->yuv;
+    uint8_t *out = jpeg->data.iov_base, *band;
+    size_t cap = (size_t)yuv->width * yuv->height * COLOR_COMPONENTS;
+    size_t len = 0, need;
+    int sof, sos, data, i;
+    int ri = (job->rows / 16) * ((yuv->width + 15) / 16);
+
+    band = job->buf;
+    if (0 != stripe_headers(band, job->written[0], &sof, &sos, &data)) {
+        return -1;
+    }
+    need = sos + 6 + (data - sos) + 2;
+    for (i = 0; i < n; i++) {
+        need += job->written[i] + 2;
+    }
+    if (need > cap) {
+        loge("jpeg of %zu bytes over the buffer!\n", need);
+        return -1;
+    }
+    memcpy(out, band, sos);
+    out[sof + 5] = (yuv->height >> 8) & 0xFF;
+    out[sof + 6] = yuv->height & 0xFF;
+    len = sos;
+    out[len++] = 0xFF;
+    out[len++] = 0xDD;
+    out[len++] = 0x00;
+    out[len++] = 0x04;
+    out[len++] = (ri >> 8) & 0xFF;
+    out[len++] = ri & 0xFF;
+    memcpy(out + len, band + sos, data - sos);
+    len += data - sos;
+    for (i = 0; i < n; i++) {
+        band = job->buf + (size_t)i * job->cap;
+        if (0 != stripe_headers(band, job->written[i], &sof, &sos, &data)) {
+            return -1;
+        }
+        /* entropy data without EOI */
+        memcpy(out + len, band + data, job->written[i] - 2 - data);
+        len += job->written[i] - 2 - data;
+        out[len++] = 0xFF;
+        out[len++] = i < n - 1 ? 0xD0 + (i % 8) : 0xD9;
+    }
+    jpeg->data.iov_len = len;
+    return 0;
+}
+
+static int encode_striped(struct je_codec_pool *pool, struct je_yuv *yuv,
+                struct je_jpeg *jpeg)
+{
+    struct stripe_job job;
+    int mcu_rows = (yuv->height + 15) / 16;
+    int n, ret = -1;
+
+    memset(&job, 0, sizeof(job));
+    job.pool = pool;
+    job.yuv = yuv;
+    job.rows = (mcu_rows + pool->stripes - 1) / pool->stripes * 16;
+    /* restart interval is 16 bits of MCUs */
+    while (job.rows > 16 && (job.rows / 16) * ((yuv->width + 15) / 16) > 0xFFFF) {
+        job.rows -= 16;
+    }
+    n = (yuv->height + job.rows - 1) / job.rows;
+    job.cap = yuv->width * job.rows * COLOR_COMPONENTS / 2 + OUTPUT_BUF_SIZE;
+    job.buf = malloc((size_t)job.cap * n);
+    job.written = calloc(n, sizeof(int));
+    if (!job.buf || !job.written) {
+        loge("malloc stripe buffers failed!\n");
+        goto exit;
+    }
+    workq_parallel_for(pool->wq, 0, n, 1, stripe_encode, &job);
+    if (job.failed) {
+        loge("stripe encode failed!\n");
+        goto exit;
+    }
+    ret = stripe_join(&job, n, jpeg);
+exit:
+    free(job.buf);
+    free(job.written);
+    return ret;
+}
+
+int je_encode_yuv_to_jpeg_pool(struct je_codec_pool *pool, struct je_yuv *yuv,
+                struct je_jpeg *jpeg)
+{
+    if (!pool || !yuv || !jpeg) {
+        loge("invalid paraments!\n");
+        return -1;
+    }
+    if (pool->stripes > 1 && yuv->height > 16 && yuv->width % 16 == 0) {
+        return encode_striped(pool, yuv, jpeg);
+    }
+    return je_encode_yuv_to_jpeg(je_codec_pool_get(pool), yuv, jpeg);
+}
+
+struct encode_task {
+    struct je_codec_pool *pool;
+    struct je_yuv *yuv;
+    struct je_jpeg *jpeg;
+    je_encode_cb cb;
+    void *arg;
+};
+
+static void encode_task_run(void *arg)
+{
+    struct encode_task *task = (struct encode_task *)arg;
+    int ret = je_encode_yuv_to_jpeg_pool(task->pool, task->yuv, task->jpeg);
+    if (task->cb) {
+        task->cb(task->jpeg, ret, task->arg);
+    }
+    free(task);
+}
+
+int je_encode_yuv_to_jpeg_async(struct je_codec_pool *pool, struct je_yuv *yuv,
+                struct je_jpeg *jpeg, je_encode_cb cb, void *arg)
+{
+    struct encode_task *task;
+
+    if (!pool || !yuv || !jpeg) {
+        loge("invalid paraments!\n");
+        return -1;
+    }
+    task = CALLOC(1, struct encode_task);
+    if (!task) {
+        loge("malloc encode task failed!\n");
+        return -1;
+    }
+    task->pool = pool;
+    task->yuv = yuv;
+    task->jpeg = jpeg;
+    task->cb = cb;
+    task->arg = arg;
+    if (0 != workq_pool_task_push(pool->wq, encode_task_run, task)) {
+        loge("workq_pool_task_push failed!\n");
+        free(task);
+        return -1;
+    }
+    return 0;
+}
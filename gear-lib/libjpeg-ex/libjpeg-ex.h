@@ -12,7 +12,10 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <stdint.h>
+#include <setjmp.h>
+#include <sys/uio.h>
 #include <jpeglib.h>
+#include <libmedia-io.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -61,10 +64,19 @@ struct je_yuv {
     int pitch;
 };
 
+struct je_codec_pool;
+struct workq_pool;
+
 struct je_codec {
     struct jpeg_compress_struct   encoder;
     struct jpeg_decompress_struct decoder;
     struct jpeg_error_mgr         errmgr;
+    struct jpeg_error_mgr         decode_errmgr;
+    jmp_buf                       jmp;      /* decode error return */
+    uint8_t                      *scratch;  /* chroma rows or scanline */
+    int                           scratch_size;
+    struct je_codec_pool         *pool;     /* owner, if from a pool */
+    struct je_codec              *next;     /* free list of pool */
 };
 
 
@@ -88,6 +100,39 @@ int je_get_yuv_from_mem();
 int je_encode_yuv_to_jpeg(struct je_codec *codec, struct je_yuv *in, struct je_jpeg *out);
 int je_decode_jpeg_to_yuv(struct je_codec *codec, struct je_jpeg *in, struct je_yuv *out);
 
+/*
+ * encode I420 or NV12 planes of frame as they are, honoring linesize, no
+ * repacking into je_yuv. rows are read in whole MCUs, so linesize should be
+ * padded to a multiple of 16
+ */
+int je_encode_frame_to_jpeg(struct je_codec *codec, const struct video_frame *frame, struct je_jpeg *out);
+
+/*
+ * decode with DCT scaling, scale is 1, 2, 4 or 8 for 1/scale of the size.
+ * frame is I420, NV12 or Y800 (luma only) with buffers of at least the size
+ * from je_jpeg_get_size, its width and height are set to the decoded size
+ */
+int je_jpeg_get_size(struct je_codec *codec, struct je_jpeg *in, int scale, int *width, int *height);
+int je_decode_jpeg_to_frame(struct je_codec *codec, struct je_jpeg *in, int scale, struct video_frame *frame);
+
+/*
+ * je_codec is not thread safe, a pool gives each thread its own codec,
+ * kept for all later calls of that thread. async encodes run on wq, or on
+ * a workq of the pool if wq is NULL
+ */
+struct je_codec_pool *je_codec_pool_create(struct workq_pool *wq);
+void je_codec_pool_destroy(struct je_codec_pool *pool);
+struct je_codec *je_codec_pool_get(struct je_codec_pool *pool);
+/* encode frames as n restart interval stripes in parallel, 1 disables */
+void je_codec_pool_set_stripes(struct je_codec_pool *pool, int stripes);
+
+typedef void (*je_encode_cb)(struct je_jpeg *out, int result, void *arg);
+/* thread safe, may be called from any thread at once */
+int je_encode_yuv_to_jpeg_pool(struct je_codec_pool *pool, struct je_yuv *in, struct je_jpeg *out);
+/* cb runs in a worker thread, in and out must stay valid until then */
+int je_encode_yuv_to_jpeg_async(struct je_codec_pool *pool, struct je_yuv *in,
+                struct je_jpeg *out, je_encode_cb cb, void *arg);
+
 
 
 #ifdef __cplusplus
@@ -33,7 +33,9 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <sched.h>
 #include <inttypes.h>
+#include <stddef.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/time.h>
@@ -61,6 +63,12 @@
 #define LOG_TAG_SIZE        (32)
 #define LOG_PNAME_SIZE      (32)
 #define LOG_TEXT_SIZE       (256)
+#define LOG_LINE_SIZE       (LOG_BUF_SIZE + 6 * LOG_TIME_SIZE + LOG_TEXT_SIZE)
+#define LOG_TAG_LEVEL_MAX   (32)
+#define LOG_ASYNC_SLOTS     (256) /* per thread, must be power of 2 */
+#define LOG_ASYNC_QUOTA     (64)
+#define LOG_ASYNC_BATCH     (64*1024)
+#define LOG_CACHELINE       (64)
 #define LOG_LEVEL_DEFAULT   LOG_INFO
 #define LOG_IO_OPS
 
@@ -177,7 +185,8 @@ static char _log_path[FILENAME_LEN];
 static char _log_name[FILENAME_LEN];
 static char _log_name_prefix[FILENAME_LEN];
 static char _log_name_time[FILENAME_LEN];
-static pthread_mutex_t _log_mutex;
+static pthread_mutex_t _log_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t _log_init_mutex = PTHREAD_MUTEX_INITIALIZER;
 static int _log_prefix = 0;
 static int _log_output = 0;
 static int _log_use_io = 0;
@@ -187,6 +196,7 @@ static int _log_type;
 static const char *_log_ident;
 
 static int _log_rotate = 0;
+static int _log_deferred = 0;
 
 
 static unsigned long long get_file_size(const char *path)
@@ -229,17 +239,15 @@ static pid_t gettid(void)
 }
 #endif
 
-static void log_get_time(char *str, int len, int flag_name)
+static void log_fmt_time(char *str, int len, const struct timeval *tv, int flag_name)
 {
     char date_fmt[20];
     char date_ms[32];
-    struct timeval tv;
     struct tm now_tm;
     int now_ms;
     time_t now_sec;
-    gettimeofday(&tv, NULL);
-    now_sec = tv.tv_sec;
-    now_ms = tv.tv_usec/1000;
+    now_sec = tv->tv_sec;
+    now_ms = tv->tv_usec/1000;
     localtime_r(&now_sec, &now_tm);
 
     if (flag_name == 0) {
@@ -253,6 +261,13 @@ static void log_get_time(char *str, int len, int flag_name)
     }
 }
 
+static void log_get_time(char *str, int len, int flag_name)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    log_fmt_time(str, len, &tv, flag_name);
+}
+
 static const char *get_dir(const char *path)
 {
     char *p = (char *)path + strlen(path);
@@ -477,106 +492,694 @@ static struct log_ops log_io_ops = {
 
 static struct log_ops *_log_handle = NULL;
 
+static size_t log_append(char *buf, size_t len, size_t n, const char *fmt, ...)
+{
+    int ret;
+    va_list ap;
+    if (n + 1 >= len) {
+        return n;
+    }
+    va_start(ap, fmt);
+    ret = vsnprintf(buf + n, len - n, fmt, ap);
+    va_end(ap);
+    if (ret < 0) {
+        return n;
+    }
+    return MIN2(n + ret, len - 1);
+}
+
+/* one log message, captured by caller, rendered later by writer */
+struct log_record {
+    int lvl;
+    int line;
+    int tid;
+    struct timeval tv;
+    const char *file;
+    const char *func;
+    const char *fmt;    /* set in deferred mode, msg holds packed args */
+    char tag[LOG_TAG_SIZE];
+    char msg[LOG_BUF_SIZE];
+};
+
+/*
+ * deferred format: caller only walks fmt and copies raw arguments into
+ * the record, printf work happens in writer thread. fmt must stay valid
+ * until written, it is a literal for the log macros. %s is copied.
+ * %n, positional args or args not fitting msg make caller format eagerly.
+ */
+enum log_arg_type {
+    LOG_ARG_INT,
+    LOG_ARG_LONG,
+    LOG_ARG_LLONG,
+    LOG_ARG_SIZE,
+    LOG_ARG_INTMAX,
+    LOG_ARG_PTRDIFF,
+    LOG_ARG_DOUBLE,
+    LOG_ARG_LDOUBLE,
+    LOG_ARG_PTR,
+    LOG_ARG_STR,
+    LOG_ARG_BAD,
+};
+
+struct log_spec {
+    const char *start;
+    const char *end;    /* one past conversion char */
+    int star;           /* number of '*' width/precision */
+    enum log_arg_type type;
+};
+
+/* parse one conversion at p (just after '%') */
+static void log_spec_parse(const char *p, struct log_spec *sp)
+{
+    int lng = 0;
+    sp->star = 0;
+    while (*p && strchr("-+ #0", *p)) p++;
+    if (*p == '*') {
+        sp->star++;
+        p++;
+    } else {
+        while (*p >= '0' && *p <= '9') p++;
+        if (*p == '$') {
+            sp->type = LOG_ARG_BAD;
+            sp->end = p;
+            return;
+        }
+    }
+    if (*p == '.') {
+        p++;
+        if (*p == '*') {
+            sp->star++;
+            p++;
+        } else {
+            while (*p >= '0' && *p <= '9') p++;
+        }
+    }
+    sp->type = LOG_ARG_INT;
+    switch (*p) {
+    case 'h': p++; if (*p == 'h') p++; break;
+    case 'l': p++; lng = 1; if (*p == 'l') { p++; lng = 2; } break;
+    case 'q': p++; lng = 2; break;
+    case 'j': p++; sp->type = LOG_ARG_INTMAX; break;
+    case 'z': p++; sp->type = LOG_ARG_SIZE; break;
+    case 't': p++; sp->type = LOG_ARG_PTRDIFF; break;
+    case 'L': p++; lng = 3; break;
+    }
+    switch (*p) {
+    case 'd': case 'i': case 'o': case 'u': case 'x': case 'X':
+        if (lng == 1) sp->type = LOG_ARG_LONG;
+        else if (lng >= 2) sp->type = LOG_ARG_LLONG;
+        break;
+    case 'c':
+        sp->type = (lng == 0) ? LOG_ARG_INT : LOG_ARG_BAD;
+        break;
+    case 'e': case 'E': case 'f': case 'F':
+    case 'g': case 'G': case 'a': case 'A':
+        sp->type = (lng == 3) ? LOG_ARG_LDOUBLE : LOG_ARG_DOUBLE;
+        break;
+    case 's':
+        sp->type = (lng == 0) ? LOG_ARG_STR : LOG_ARG_BAD;
+        break;
+    case 'p':
+        sp->type = LOG_ARG_PTR;
+        break;
+    default:
+        sp->type = LOG_ARG_BAD;
+        break;
+    }
+    sp->end = *p ? p + 1 : p;
+}
+
+#define LOG_PACK(type, val_type) \
+    do { \
+        val_type v = va_arg(ap, val_type); \
+        if (n + sizeof(v) > len) return -1; \
+        memcpy(buf + n, &v, sizeof(v)); \
+        n += sizeof(v); \
+    } while (0)
+
+static int log_defer_pack(struct log_record *r, const char *fmt, va_list ap)
+{
+    int i;
+    size_t n = 0, sl;
+    const char *p, *str;
+    struct log_spec sp;
+    char *buf = r->msg;
+    size_t len = sizeof(r->msg);
+
+    for (p = fmt; (p = strchr(p, '%')); p = sp.end) {
+        if (p[1] == '%') {
+            sp.end = p + 2;
+            continue;
+        }
+        log_spec_parse(p + 1, &sp);
+        for (i = 0; i < sp.star; i++) {
+            LOG_PACK(LOG_ARG_INT, int);
+        }
+        switch (sp.type) {
+        case LOG_ARG_INT:     LOG_PACK(sp.type, int); break;
+        case LOG_ARG_LONG:    LOG_PACK(sp.type, long); break;
+        case LOG_ARG_LLONG:   LOG_PACK(sp.type, long long); break;
+        case LOG_ARG_SIZE:    LOG_PACK(sp.type, size_t); break;
+        case LOG_ARG_INTMAX:  LOG_PACK(sp.type, intmax_t); break;
+        case LOG_ARG_PTRDIFF: LOG_PACK(sp.type, ptrdiff_t); break;
+        case LOG_ARG_DOUBLE:  LOG_PACK(sp.type, double); break;
+        case LOG_ARG_LDOUBLE: LOG_PACK(sp.type, long double); break;
+        case LOG_ARG_PTR:     LOG_PACK(sp.type, void *); break;
+        case LOG_ARG_STR:
+            str = va_arg(ap, const char *);
+            if (!str) {
+                str = "(null)";
+            }
+            sl = strlen(str) + 1;
+            if (n + sl > len) {
+                return -1;
+            }
+            memcpy(buf + n, str, sl);
+            n += sl;
+            break;
+        default:
+            return -1;
+        }
+    }
+    r->fmt = fmt;
+    return 0;
+}
+
+#define LOG_UNPACK(val_type) \
+    do { \
+        val_type v; \
+        memcpy(&v, args + n, sizeof(v)); \
+        n += sizeof(v); \
+        out = log_append(buf, len, out, spec, v); \
+    } while (0)
+
+/* format packed args of r into buf, one snprintf per conversion */
+static void log_defer_expand(const struct log_record *r, char *buf, size_t len)
+{
+    int i, star[2];
+    size_t n = 0, out = 0, sl;
+    const char *p, *q;
+    const char *args = r->msg;
+    char spec[64];
+    struct log_spec sp;
+
+    buf[0] = '\0';
+    for (p = r->fmt; *p; p = sp.end) {
+        q = strchr(p, '%');
+        if (!q) {
+            out = log_append(buf, len, out, "%s", p);
+            break;
+        }
+        if (q > p) {
+            out = log_append(buf, len, out, "%.*s", (int)(q - p), p);
+        }
+        if (q[1] == '%') {
+            out = log_append(buf, len, out, "%%");
+            sp.end = q + 2;
+            continue;
+        }
+        log_spec_parse(q + 1, &sp);
+        for (i = 0; i < sp.star; i++) {
+            memcpy(&star[i], args + n, sizeof(int));
+            n += sizeof(int);
+        }
+        /* rebuild spec with '*' replaced by captured value */
+        for (i = 0, sl = 0, p = q; p < sp.end && sl + 12 < sizeof(spec); p++) {
+            if (*p == '*') {
+                sl += snprintf(spec + sl, sizeof(spec) - sl, "%d", star[i++]);
+            } else {
+                spec[sl++] = *p;
+            }
+        }
+        spec[sl] = '\0';
+        switch (sp.type) {
+        case LOG_ARG_INT:     LOG_UNPACK(int); break;
+        case LOG_ARG_LONG:    LOG_UNPACK(long); break;
+        case LOG_ARG_LLONG:   LOG_UNPACK(long long); break;
+        case LOG_ARG_SIZE:    LOG_UNPACK(size_t); break;
+        case LOG_ARG_INTMAX:  LOG_UNPACK(intmax_t); break;
+        case LOG_ARG_PTRDIFF: LOG_UNPACK(ptrdiff_t); break;
+        case LOG_ARG_DOUBLE:  LOG_UNPACK(double); break;
+        case LOG_ARG_LDOUBLE: LOG_UNPACK(long double); break;
+        case LOG_ARG_PTR:     LOG_UNPACK(void *); break;
+        case LOG_ARG_STR:
+            out = log_append(buf, len, out, spec, args + n);
+            n += strlen(args + n) + 1;
+            break;
+        default:
+            return;
+        }
+    }
+}
+
 /*
  *time: level: process[pid]: [tid] tag: message
  *             [verbose          ]
+ * render whole line into buf, return its length
  */
-static int _log_print(int lvl, const char *tag,
-                      const char *file, int line,
-                      const char *func, const char *msg)
+static size_t _log_render(const struct log_record *r, char *buf, size_t len)
 {
-    int ret = 0, i = 0;
-    struct iovec vec[LOG_IOVEC_MAX];
+    size_t n = 0;
     char s_time[LOG_TIME_SIZE];
-    char s_lvl[LOG_LEVEL_SIZE];
-    char s_tag[LOG_TAG_SIZE];
-    //char s_pname[LOG_PNAME_SIZE*2];
-    char s_pid[LOG_PNAME_SIZE];
-    char s_tid[LOG_PNAME_SIZE];
-    char s_file[LOG_TEXT_SIZE];
     char s_msg[LOG_BUF_SIZE];
-
-    pthread_mutex_lock(&_log_mutex);
-    log_get_time(s_time, sizeof(s_time), 0);
+    const char *msg = r->msg;
+    const char *lvl_fmt = "[%7s]";
+    const char *msg_fmt = "%s";
 
     if (_log_fp == stderr || _log_fd == STDERR_FILENO) {
-        switch(lvl) {
+        switch(r->lvl) {
         case LOG_EMERG:
         case LOG_ALERT:
         case LOG_CRIT:
         case LOG_ERR:
-            snprintf(s_lvl, sizeof(s_lvl),
-                    B_RED("[%7s]"), _log_level_str[lvl]);
-            snprintf(s_msg, sizeof(s_msg), RED("%s"), msg);
+            lvl_fmt = B_RED("[%7s]");
+            msg_fmt = RED("%s");
             break;
         case LOG_WARNING:
-            snprintf(s_lvl, sizeof(s_lvl),
-                    B_YELLOW("[%7s]"), _log_level_str[lvl]);
-            snprintf(s_msg, sizeof(s_msg), YELLOW("%s"), msg);
+            lvl_fmt = B_YELLOW("[%7s]");
+            msg_fmt = YELLOW("%s");
             break;
         case LOG_INFO:
-            snprintf(s_lvl, sizeof(s_lvl),
-                    B_GREEN("[%7s]"), _log_level_str[lvl]);
-            snprintf(s_msg, sizeof(s_msg), GREEN("%s"), msg);
+            lvl_fmt = B_GREEN("[%7s]");
+            msg_fmt = GREEN("%s");
             break;
         case LOG_DEBUG:
-            snprintf(s_lvl, sizeof(s_lvl),
-                    B_WHITE("[%7s]"), _log_level_str[lvl]);
-            snprintf(s_msg, sizeof(s_msg), WHITE("%s"), msg);
+            lvl_fmt = B_WHITE("[%7s]");
+            msg_fmt = WHITE("%s");
             break;
         default:
-            snprintf(s_lvl, sizeof(s_lvl),
-                    "[%7s]", _log_level_str[lvl]);
-            snprintf(s_msg, sizeof(s_msg), "%s", msg);
             break;
         }
-    } else {
-        snprintf(s_lvl, sizeof(s_lvl),
-                "[%7s]", _log_level_str[lvl]);
-        snprintf(s_msg, sizeof(s_msg), "%s", msg);
+    }
+    if (CHECK_LOG_PREFIX(_log_prefix, LOG_TIMESTAMP_BIT)) {
+        log_fmt_time(s_time, sizeof(s_time), &r->tv, 0);
+        n = log_append(buf, len, n, "%s", s_time);
     }
     if (CHECK_LOG_PREFIX(_log_prefix, LOG_PID_BIT)) {
-        snprintf(s_pid, sizeof(s_pid), "[pid:%d]", getpid());
-        snprintf(s_tag, sizeof(s_tag), "[%s]", tag);
+        n = log_append(buf, len, n, "[pid:%d]", getpid());
     }
     if (CHECK_LOG_PREFIX(_log_prefix, LOG_TID_BIT)) {
-        snprintf(s_tid, sizeof(s_tid), "[tid:%d]", (int)gettid());
-        snprintf(s_tag, sizeof(s_tag), "[%s]", tag);
+        n = log_append(buf, len, n, "[tid:%d]", r->tid);
+    }
+    n = log_append(buf, len, n, lvl_fmt, _log_level_str[r->lvl]);
+    if (CHECK_LOG_PREFIX(_log_prefix, LOG_TAG_BIT)) {
+        n = log_append(buf, len, n, "[%s]", r->tag);
     }
     if (CHECK_LOG_PREFIX(_log_prefix, LOG_FUNCLINE_BIT)) {
-        snprintf(s_file, sizeof(s_file), "[%s:%3d: %s] ", file, line, func);
+        n = log_append(buf, len, n, "[%s:%3d: %s] ", r->file, r->line, r->func);
+    }
+    if (r->fmt) {
+        log_defer_expand(r, s_msg, sizeof(s_msg));
+        msg = s_msg;
+    }
+    n = log_append(buf, len, n, msg_fmt, msg);
+    return n;
+}
+
+static ssize_t _log_write_buf(char *buf, size_t len)
+{
+    struct iovec vec;
+    ssize_t ret = 0;
+    vec.iov_base = (void *)buf;
+    vec.iov_len = len;
+    pthread_mutex_lock(&_log_mutex);
+    if (UNLIKELY(!_log_syslog)) {
+        ret = _log_handle->write(&vec, 1);
     }
+    pthread_mutex_unlock(&_log_mutex);
+    return ret;
+}
 
-    i = -1;
+static int _log_print(const struct log_record *r)
+{
+    char line[LOG_LINE_SIZE];
+    size_t n = _log_render(r, line, sizeof(line));
+    return (int)_log_write_buf(line, n);
+}
+
+static void log_record_init(struct log_record *r, int lvl, const char *tag,
+                const char *file, int line, const char *func)
+{
+    r->lvl = lvl;
+    r->line = line;
+    r->file = file;
+    r->func = func;
+    r->tid = 0;
+    r->fmt = NULL;
+    if (CHECK_LOG_PREFIX(_log_prefix, LOG_TID_BIT)) {
+        r->tid = (int)gettid();
+    }
     if (CHECK_LOG_PREFIX(_log_prefix, LOG_TIMESTAMP_BIT)) {
-        vec[++i].iov_base = (void *)s_time;
-        vec[i].iov_len = strlen(s_time);
+        gettimeofday(&r->tv, NULL);
     }
-    if (CHECK_LOG_PREFIX(_log_prefix, LOG_PID_BIT)) {
-        vec[++i].iov_base = (void *)s_pid;
-        vec[i].iov_len = strlen(s_pid);
+    snprintf(r->tag, sizeof(r->tag), "%s", tag ? tag : "");
+}
+
+/*
+ * async mode, callers only format message into a ring slot and return,
+ * writer thread renders slots into a batch and writes it in one call.
+ * each thread gets its own spsc ring on first async message, so callers
+ * share no cacheline, writer drains the rings round robin. order is kept
+ * per thread only, ring of an exited thread is freed once drained.
+ * when full, LOG_ASYNC_BLOCK waits for the writer,
+ * LOG_ASYNC_DROP drops and counts the message, except errors which
+ * fallback to synchronous write.
+ */
+struct log_ring {
+    size_t head;        /* owner thread only */
+    int busy;           /* owner between claim and commit */
+    int dead;           /* owner exited */
+    char pad0[LOG_CACHELINE - sizeof(size_t) - 2 * sizeof(int)];
+    size_t tail;        /* writer thread only */
+    char pad1[LOG_CACHELINE - sizeof(size_t)];
+    struct log_ring *next;
+    struct log_record recs[LOG_ASYNC_SLOTS];
+};
+
+static struct log_async {
+    struct log_ring *rings;     /* pushed by owners, unlinked by writer, under lock */
+    uint64_t dropped;
+    unsigned int rounds;        /* writer passes that found every ring empty */
+    int enable;
+    int mode;
+    int running;
+    int sleeping;
+    pthread_t tid;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} _log_async = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
+static pthread_key_t _log_ring_key;
+static pthread_once_t _log_ring_once = PTHREAD_ONCE_INIT;
+
+static void log_ring_exit(void *arg)
+{
+    struct log_ring *ring = (struct log_ring *)arg;
+    __atomic_store_n(&ring->dead, 1, __ATOMIC_RELEASE);
+}
+
+static void log_ring_key_init(void)
+{
+    pthread_key_create(&_log_ring_key, log_ring_exit);
+}
+
+static struct log_ring *log_ring_self(void)
+{
+    struct log_ring *ring;
+
+    pthread_once(&_log_ring_once, log_ring_key_init);
+    ring = (struct log_ring *)pthread_getspecific(_log_ring_key);
+    if (LIKELY(ring != NULL)) {
+        return ring;
     }
-    if (CHECK_LOG_PREFIX(_log_prefix, LOG_TID_BIT)) {
-        vec[++i].iov_base = (void *)s_tid;
-        vec[i].iov_len = strlen(s_tid);
+    ring = CALLOC(1, struct log_ring);
+    if (!ring) {
+        return NULL;
     }
-    vec[++i].iov_base = (void *)s_lvl;
-    vec[i].iov_len = strlen(s_lvl);
-    if (CHECK_LOG_PREFIX(_log_prefix, LOG_TAG_BIT)) {
-        vec[++i].iov_base = (void *)s_tag;
-        vec[i].iov_len = strlen(s_tag);
+    pthread_mutex_lock(&_log_async.lock);
+    ring->next = _log_async.rings;
+    __atomic_store_n(&_log_async.rings, ring, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&_log_async.lock);
+    pthread_setspecific(_log_ring_key, ring);
+    return ring;
+}
+
+static struct log_record *log_async_claim(struct log_ring *ring)
+{
+    size_t head = ring->head;
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= LOG_ASYNC_SLOTS) {
+        return NULL;
     }
-    if (CHECK_LOG_PREFIX(_log_prefix, LOG_FUNCLINE_BIT)) {
-        vec[++i].iov_base = (void *)s_file;
-        vec[i].iov_len = strlen(s_file);
+    return &ring->recs[head & (LOG_ASYNC_SLOTS - 1)];
+}
+
+static void log_async_wakeup(void)
+{
+    /* pairs with writer setting sleeping then rechecking heads */
+    if (__atomic_load_n(&_log_async.sleeping, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&_log_async.lock);
+        pthread_cond_signal(&_log_async.cond);
+        pthread_mutex_unlock(&_log_async.lock);
     }
-    vec[++i].iov_base = (void *)s_msg;
-    vec[i].iov_len = strlen(s_msg);
+}
 
-    if (UNLIKELY(!_log_syslog)) {
-        ret = _log_handle->write(vec, i+1);
+static void log_async_commit(struct log_ring *ring)
+{
+    __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&ring->busy, 0, __ATOMIC_RELEASE);
+    log_async_wakeup();
+}
+
+/* render at most LOG_ASYNC_QUOTA records of one ring, then next ring */
+static size_t log_ring_drain(struct log_ring *ring, char *batch, size_t n)
+{
+    size_t tail = ring->tail;
+    size_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    int quota = LOG_ASYNC_QUOTA;
+
+    for (; tail != head && quota > 0 && n + LOG_LINE_SIZE <= LOG_ASYNC_BATCH;
+         tail++, quota--) {
+        n += _log_render(&ring->recs[tail & (LOG_ASYNC_SLOTS - 1)],
+                         batch + n, LOG_ASYNC_BATCH - n);
     }
-    pthread_mutex_unlock(&_log_mutex);
+    __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    return n;
+}
+
+static int log_ring_done(struct log_ring *ring)
+{
+    return __atomic_load_n(&ring->dead, __ATOMIC_ACQUIRE) &&
+           ring->tail == __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+}
+
+/* free drained rings of exited threads, only writer or free unlink */
+static void log_ring_reap(void)
+{
+    struct log_ring **link, *ring;
+
+    pthread_mutex_lock(&_log_async.lock);
+    for (link = &_log_async.rings; (ring = *link) != NULL;) {
+        if (log_ring_done(ring)) {
+            *link = ring->next;
+            free(ring);
+        } else {
+            link = &ring->next;
+        }
+    }
+    pthread_mutex_unlock(&_log_async.lock);
+}
+
+static int log_async_pending(void)
+{
+    struct log_ring *ring;
+    ring = __atomic_load_n(&_log_async.rings, __ATOMIC_ACQUIRE);
+    for (; ring; ring = ring->next) {
+        if (__atomic_load_n(&ring->head, __ATOMIC_SEQ_CST) != ring->tail) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int log_async_busy(void)
+{
+    struct log_ring *ring;
+    ring = __atomic_load_n(&_log_async.rings, __ATOMIC_ACQUIRE);
+    for (; ring; ring = ring->next) {
+        if (__atomic_load_n(&ring->busy, __ATOMIC_SEQ_CST)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void *log_async_loop(void *arg)
+{
+    size_t n;
+    int reap, stopping;
+    uint64_t dropped;
+    struct log_ring *ring;
+    char *batch = (char *)malloc(LOG_ASYNC_BATCH);
+
+    if (!batch) {
+        fprintf(stderr, "malloc log batch failed!\n");
+        return NULL;
+    }
+    for (;;) {
+        /* no caller can claim after stop once none is busy */
+        stopping = !__atomic_load_n(&_log_async.running, __ATOMIC_ACQUIRE) &&
+                   !log_async_busy();
+        n = 0;
+        reap = 0;
+        ring = __atomic_load_n(&_log_async.rings, __ATOMIC_ACQUIRE);
+        for (; ring; ring = ring->next) {
+            n = log_ring_drain(ring, batch, n);
+            reap |= log_ring_done(ring);
+        }
+        if (reap) {
+            log_ring_reap();
+        }
+        dropped = __atomic_exchange_n(&_log_async.dropped, 0, __ATOMIC_RELAXED);
+        if (dropped) {
+            n = log_append(batch, LOG_ASYNC_BATCH, n,
+                    "[liblog] async queue full, %" PRIu64 " messages dropped\n", dropped);
+        }
+        if (n > 0) {
+            _log_write_buf(batch, n);
+            continue;
+        }
+        __atomic_add_fetch(&_log_async.rounds, 1, __ATOMIC_SEQ_CST);
+        if (stopping) {
+            break;
+        }
+        if (!__atomic_load_n(&_log_async.running, __ATOMIC_ACQUIRE)) {
+            /* drain messages claimed before stop */
+            usleep(100);
+            continue;
+        }
+        pthread_mutex_lock(&_log_async.lock);
+        __atomic_store_n(&_log_async.sleeping, 1, __ATOMIC_SEQ_CST);
+        if (!log_async_pending() &&
+            __atomic_load_n(&_log_async.running, __ATOMIC_ACQUIRE)) {
+            pthread_cond_wait(&_log_async.cond, &_log_async.lock);
+        }
+        __atomic_store_n(&_log_async.sleeping, 0, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&_log_async.lock);
+    }
+    free(batch);
+    return NULL;
+}
+
+static int log_async_start(int mode)
+{
+    _log_async.mode = mode;
+    if (_log_async.enable) {
+        return 0;
+    }
+    _log_async.running = 1;
+    if (0 != pthread_create(&_log_async.tid, NULL, log_async_loop, NULL)) {
+        fprintf(stderr, "pthread_create log writer failed!\n");
+        _log_async.running = 0;
+        return -1;
+    }
+    __atomic_store_n(&_log_async.enable, 1, __ATOMIC_SEQ_CST);
+    return 0;
+}
+
+static void log_async_stop(void)
+{
+    if (!_log_async.enable) {
+        return;
+    }
+    /* pairs with caller setting busy then rechecking enable */
+    __atomic_store_n(&_log_async.enable, 0, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&_log_async.running, 0, __ATOMIC_RELEASE);
+    pthread_mutex_lock(&_log_async.lock);
+    pthread_cond_signal(&_log_async.cond);
+    pthread_mutex_unlock(&_log_async.lock);
+    pthread_join(_log_async.tid, NULL);
+}
+
+/* rings of live threads stay registered, they are empty after stop */
+static void log_async_free(void)
+{
+    log_ring_reap();
+    _log_async.dropped = 0;
+}
+
+/*
+ * per tag level overrides global level for messages with that tag.
+ * entries are only appended, tag text never changes once published,
+ * so log_print reads the table without lock
+ */
+static struct {
+    char tag[LOG_TAG_SIZE];
+    int level;
+} _log_tag_levels[LOG_TAG_LEVEL_MAX];
+static int _log_tag_count = 0;
+/* let everything through to first lookup, which runs log_init */
+int _log_level_gate = LOG_VERB;
+unsigned int _log_level_gen = 1;
+static pthread_mutex_t _log_tag_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* gate is max of all levels, one compare rejects most messages */
+static void log_update_gate(void)
+{
+    int i, gate = _log_level;
+    for (i = 0; i < _log_tag_count; i++) {
+        gate = MAX2(gate, _log_tag_levels[i].level);
+    }
+    __atomic_store_n(&_log_level_gate, gate, __ATOMIC_RELAXED);
+    /* call sites drop cached tag levels */
+    __atomic_add_fetch(&_log_level_gen, 1, __ATOMIC_RELEASE);
+}
+
+/* tags are stored truncated, compare the same way when set and looked up */
+static int log_tag_equal(const char *stored, const char *tag)
+{
+    return !strncmp(stored, tag, LOG_TAG_SIZE - 1);
+}
+
+static int log_level_of(const char *tag)
+{
+    int i, level;
+    int n = __atomic_load_n(&_log_tag_count, __ATOMIC_ACQUIRE);
+    if (tag) {
+        for (i = 0; i < n; i++) {
+            if (log_tag_equal(_log_tag_levels[i].tag, tag)) {
+                level = __atomic_load_n(&_log_tag_levels[i].level, __ATOMIC_RELAXED);
+                if (level >= 0) {
+                    return level;
+                }
+                break;
+            }
+        }
+    }
+    return _log_level;
+}
+
+int log_level_lookup(const char *tag)
+{
+    if (UNLIKELY(!_is_log_init)) {
+        log_init(0, NULL);
+    }
+    return log_level_of(tag);
+}
+
+int log_set_tag_level(const char *tag, int level)
+{
+    int i, ret = 0;
+    if (!tag || level > LOG_VERB) {
+        fprintf(stderr, "invalid tag level!\n");
+        return -1;
+    }
+    if (level < 0) {
+        level = -1;
+    }
+    pthread_mutex_lock(&_log_tag_mutex);
+    for (i = 0; i < _log_tag_count; i++) {
+        if (log_tag_equal(_log_tag_levels[i].tag, tag)) {
+            break;
+        }
+    }
+    if (i == _log_tag_count) {
+        if (i == LOG_TAG_LEVEL_MAX) {
+            fprintf(stderr, "too many tag levels!\n");
+            ret = -1;
+            goto out;
+        }
+        snprintf(_log_tag_levels[i].tag, LOG_TAG_SIZE, "%s", tag);
+        _log_tag_levels[i].level = level;
+        __atomic_store_n(&_log_tag_count, i + 1, __ATOMIC_RELEASE);
+    } else {
+        __atomic_store_n(&_log_tag_levels[i].level, level, __ATOMIC_RELAXED);
+    }
+    log_update_gate();
+out:
+    pthread_mutex_unlock(&_log_tag_mutex);
     return ret;
 }
 
@@ -594,57 +1197,222 @@ static int _log_print(int lvl, const char *tag,
 #define logv(...) __android_log_print(ANDROID_LOG_VERBOSE, LOG_TAG, __VA_ARGS__)
 
 #else
-int log_print(int lvl, const char *tag, const char *file,
+/* deferred is a constant at each caller, inline drops the dead path */
+static inline int log_vprint(int lvl, const char *tag, const char *file,
+              int line, const char *func, int deferred, const char *fmt, va_list ap)
+{
+    va_list aq;
+    struct log_ring *ring = NULL;
+    struct log_record rec, *r = NULL;
+    int n;
+
+    if (__atomic_load_n(&_log_async.enable, __ATOMIC_ACQUIRE) &&
+        (ring = log_ring_self()) != NULL) {
+        /* pairs with stop clearing enable then writer checking busy */
+        __atomic_store_n(&ring->busy, 1, __ATOMIC_SEQ_CST);
+        while (!(r = log_async_claim(ring)) && _log_async.mode == LOG_ASYNC_BLOCK &&
+               __atomic_load_n(&_log_async.enable, __ATOMIC_SEQ_CST)) {
+            log_async_wakeup();
+            sched_yield();
+        }
+        if (!__atomic_load_n(&_log_async.enable, __ATOMIC_SEQ_CST)) {
+            r = NULL;
+        }
+        if (!r) {
+            __atomic_store_n(&ring->busy, 0, __ATOMIC_RELEASE);
+            if (lvl > LOG_ERR && _log_async.mode == LOG_ASYNC_DROP &&
+                __atomic_load_n(&_log_async.enable, __ATOMIC_ACQUIRE)) {
+                __atomic_add_fetch(&_log_async.dropped, 1, __ATOMIC_RELAXED);
+                return -1;
+            }
+        }
+    }
+    if (!r) {
+        r = &rec;
+    }
+    log_record_init(r, lvl, tag, file, line, func);
+    if (r != &rec && deferred && !_log_syslog) {
+        va_copy(aq, ap);
+        n = log_defer_pack(r, fmt, aq);
+        va_end(aq);
+        if (n == 0) {
+            log_async_commit(ring);
+            return 0;
+        }
+    }
+    n = vsnprintf(r->msg, sizeof(r->msg), fmt, ap);
+    if (UNLIKELY(n < 0)) {
+        fprintf(stderr, "vsnprintf errno:%d\n", errno);
+        r->msg[0] = '\0';
+    }
+#ifdef USE_SYSLOG
+    if (UNLIKELY(_log_syslog)) {
+        syslog(lvl, "%s", r->msg);
+    }
+#endif
+    if (r != &rec) {
+        log_async_commit(ring);
+        return 0;
+    }
+    return _log_print(r);
+}
+
+int log_emit(int lvl, const char *tag, const char *file,
               int line, const char *func, const char *fmt, ...)
 {
     va_list ap;
-    char buf[LOG_BUF_SIZE] = {0};
-    int n, ret;
+    int ret;
 
     if (UNLIKELY(!_is_log_init)) {
         log_init(0, NULL);
     }
-
-    if (lvl > _log_level) {
-        return 0;
+    va_start(ap, fmt);
+    if (_log_deferred) {
+        ret = log_vprint(lvl, tag, file, line, func, 1, fmt, ap);
+    } else {
+        ret = log_vprint(lvl, tag, file, line, func, 0, fmt, ap);
     }
+    va_end(ap);
+    return ret;
+}
+
+int log_emit_deferred(int lvl, const char *tag, const char *file,
+              int line, const char *func, const char *fmt, ...)
+{
+    va_list ap;
+    int ret;
 
+    if (UNLIKELY(!_is_log_init)) {
+        log_init(0, NULL);
+    }
     va_start(ap, fmt);
-    n = vsnprintf(buf, sizeof(buf), fmt, ap);
+    ret = log_vprint(lvl, tag, file, line, func, 1, fmt, ap);
     va_end(ap);
-    if (UNLIKELY(n < 0)) {
-        fprintf(stderr, "vsnprintf errno:%d\n", errno);
-        return -1;
+    return ret;
+}
+
+int log_print(int lvl, const char *tag, const char *file,
+              int line, const char *func, const char *fmt, ...)
+{
+    va_list ap;
+    int ret;
+
+    if (UNLIKELY(!_is_log_init)) {
+        log_init(0, NULL);
     }
-#ifdef USE_SYSLOG
-    if (UNLIKELY(_log_syslog)) {
-        syslog(lvl, "%s", buf);
+    if (lvl > __atomic_load_n(&_log_level_gate, __ATOMIC_RELAXED)) {
+        return 0;
     }
-#endif
-    ret = _log_print(lvl, tag, file, line, func, buf);
-
+    if (lvl > log_level_of(tag)) {
+        return 0;
+    }
+    va_start(ap, fmt);
+    ret = log_vprint(lvl, tag, file, line, func, _log_deferred, fmt, ap);
+    va_end(ap);
     return ret;
 }
 #endif
 
+int log_set_async(int mode)
+{
+    if (UNLIKELY(!_is_log_init)) {
+        log_init(0, NULL);
+    }
+    if (mode == LOG_ASYNC_BLOCK || mode == LOG_ASYNC_DROP) {
+        return log_async_start(mode);
+    }
+    log_async_stop();
+    return 0;
+}
+
+void log_set_deferred(int enable)
+{
+    _log_deferred = enable;
+}
+
+void log_flush(void)
+{
+    unsigned int target;
+    if (!_log_async.enable) {
+        return;
+    }
+    /* second empty pass of the writer started after this point */
+    target = __atomic_load_n(&_log_async.rounds, __ATOMIC_SEQ_CST) + 2;
+    while ((int)(__atomic_load_n(&_log_async.rounds, __ATOMIC_ACQUIRE) - target) < 0 &&
+           __atomic_load_n(&_log_async.enable, __ATOMIC_ACQUIRE)) {
+        pthread_mutex_lock(&_log_async.lock);
+        pthread_cond_signal(&_log_async.cond);
+        pthread_mutex_unlock(&_log_async.lock);
+        usleep(1000);
+    }
+}
+
+static unsigned long long _log_suppressed = 0;
+
+static unsigned long long log_now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+int log_ratelimit(struct log_ratelimit *rs, int lvl, const char *tag,
+        const char *file, int line, const char *func)
+{
+    int missed;
+    unsigned long long now, begin;
+
+    if (!rs || rs->interval <= 0) {
+        return 1;
+    }
+    now = log_now_ms();
+    begin = __atomic_load_n(&rs->begin, __ATOMIC_RELAXED);
+    if (begin == 0 || now - begin >= (unsigned long long)rs->interval) {
+        /* only one caller opens the new window and reports */
+        if (__atomic_compare_exchange_n(&rs->begin, &begin, now, false,
+                    __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            __atomic_store_n(&rs->printed, 0, __ATOMIC_RELAXED);
+            missed = __atomic_exchange_n(&rs->missed, 0, __ATOMIC_RELAXED);
+            if (missed > 0) {
+                log_print(lvl, tag, file, line, func,
+                          "%d messages suppressed\n", missed);
+            }
+        }
+    }
+    if (__atomic_add_fetch(&rs->printed, 1, __ATOMIC_RELAXED) <= rs->burst) {
+        return 1;
+    }
+    __atomic_add_fetch(&rs->missed, 1, __ATOMIC_RELAXED);
+    log_add_suppressed(1);
+    return 0;
+}
+
+void log_add_suppressed(unsigned long long n)
+{
+    __atomic_add_fetch(&_log_suppressed, n, __ATOMIC_RELAXED);
+}
+
+unsigned long long log_get_suppressed(void)
+{
+    return __atomic_load_n(&_log_suppressed, __ATOMIC_RELAXED);
+}
+
 void log_set_level(int level)
 {
+    pthread_mutex_lock(&_log_tag_mutex);
     if (level > LOG_VERB || level < LOG_EMERG) {
         _log_level = LOG_LEVEL_DEFAULT;
     } else {
         _log_level = level;
     }
+    log_update_gate();
+    pthread_mutex_unlock(&_log_tag_mutex);
 }
 
-static void log_check_env(int *lvl, int *out)
+/* "3" or "error" style level string, def if not recognized */
+static int log_level_from_str(const char *levelstr, int def)
 {
-    const char *levelstr = level_str(getenv(LOG_LEVEL_ENV));
-    const char *outputstr = output_str(getenv(LOG_OUTPUT_ENV));
-    const char *timestr = time_str(getenv(LOG_TIMESTAMP_ENV));
     int level = atoi(levelstr);
-    int output = atoi(outputstr);
-    int timestamp = atoi(timestr);
-    *lvl = LOG_LEVEL_DEFAULT;
 
     switch (level) {
     case 1:
@@ -655,26 +1423,58 @@ static void log_check_env(int *lvl, int *out)
     case 6:
     case 7:
     case 8:
-        *lvl = level;
-        break;
+        return level;
     case 0:
         if (is_str_equal(levelstr, "error")) {
-            *lvl = LOG_ERR;
+            return LOG_ERR;
         } else if (is_str_equal(levelstr, "warn")) {
-            *lvl = LOG_WARNING;
+            return LOG_WARNING;
         } else if (is_str_equal(levelstr, "notice")) {
-            *lvl = LOG_NOTICE;
+            return LOG_NOTICE;
         } else if (is_str_equal(levelstr, "info")) {
-            *lvl = LOG_INFO;
+            return LOG_INFO;
         } else if (is_str_equal(levelstr, "debug")) {
-            *lvl = LOG_DEBUG;
+            return LOG_DEBUG;
         } else if (is_str_equal(levelstr, "verbose")) {
-            *lvl = LOG_VERB;
+            return LOG_VERB;
         }
         break;
     default:
         break;
     }
+    return def;
+}
+
+/* LIBLOG_TAG_LEVEL="net=debug,db=warn" */
+static void log_tag_level_env(void)
+{
+    char buf[256];
+    char *item, *eq, *save = NULL;
+    const char *env = getenv(LOG_TAG_LEVEL_ENV);
+
+    if (!env) {
+        return;
+    }
+    snprintf(buf, sizeof(buf), "%s", env);
+    for (item = strtok_r(buf, ",", &save); item; item = strtok_r(NULL, ",", &save)) {
+        eq = strchr(item, '=');
+        if (!eq) {
+            continue;
+        }
+        *eq = '\0';
+        log_set_tag_level(item, log_level_from_str(eq + 1, LOG_LEVEL_DEFAULT));
+    }
+}
+
+static void log_check_env(int *lvl, int *out)
+{
+    const char *levelstr = level_str(getenv(LOG_LEVEL_ENV));
+    const char *outputstr = output_str(getenv(LOG_OUTPUT_ENV));
+    const char *timestr = time_str(getenv(LOG_TIMESTAMP_ENV));
+    int output = atoi(outputstr);
+    int timestamp = atoi(timestr);
+    *lvl = log_level_from_str(levelstr, LOG_LEVEL_DEFAULT);
+
     switch (output) {
     case 1:
     case 2:
@@ -854,8 +1654,6 @@ static struct log_driver log_file_driver = {
 
 static struct log_driver *_log_driver = NULL;
 
-pthread_once_t thread_once = PTHREAD_ONCE_INIT;
-
 static void log_init_once(void)
 {
     int type = _log_type;
@@ -864,6 +1662,10 @@ static void log_init_once(void)
         return;
     }
     log_check_env(&_log_level, &_log_output);
+    log_tag_level_env();
+    pthread_mutex_lock(&_log_tag_mutex);
+    log_update_gate();
+    pthread_mutex_unlock(&_log_tag_mutex);
 #ifdef LOG_VERBOSE_ENABLE
     UPDATE_LOG_PREFIX(_log_prefix, LOG_VERBOSE_BIT);
 #endif
@@ -914,29 +1716,33 @@ static void log_init_once(void)
     }
     _log_driver->init(ident);
     _is_log_init = 1;
-    pthread_mutex_init(&_log_mutex, NULL);
     return;
 }
 
 int log_init(int type, const char *ident)
 {
+    /* not pthread_once, so log_init works again after log_deinit */
+    pthread_mutex_lock(&_log_init_mutex);
     _log_type = type;
     _log_ident = ident;
-    if (0 != pthread_once(&thread_once, log_init_once)) {
-        fprintf(stderr, "pthread_once failed\n");
-    }
+    log_init_once();
+    pthread_mutex_unlock(&_log_init_mutex);
     return 0;
 }
 
 void log_deinit(void)
 {
+    pthread_mutex_lock(&_log_init_mutex);
     if (!_is_log_init) {
+        pthread_mutex_unlock(&_log_init_mutex);
         return;
     }
+    log_async_stop();
+    log_async_free();
     if (_log_driver) {
         _log_driver->deinit();
         _log_driver = NULL;
     }
     _is_log_init = 0;
-    pthread_mutex_destroy(&_log_mutex);
+    pthread_mutex_unlock(&_log_init_mutex);
 }
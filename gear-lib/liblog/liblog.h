@@ -53,23 +53,171 @@ int log_init(int type, const char *ident);
 void log_deinit();
 
 void log_set_level(int level);
+
+/*
+ * messages with this tag use level instead of global level,
+ * level -1 removes the override. also set by env LIBLOG_TAG_LEVEL,
+ * e.g. LIBLOG_TAG_LEVEL="net=debug,db=warn"
+ */
+int log_set_tag_level(const char *tag, int level);
 void log_set_split_size(int size);
 void log_set_rotate(int enable);
 int log_set_path(const char *path);
+/*
+ * async mode: log_print only queues message to a lock free ring and returns,
+ * a writer thread formats and writes in batch. log_flush waits until all
+ * queued messages are written, log_deinit flushes too.
+ * when ring is full, LOG_ASYNC_BLOCK waits and LOG_ASYNC_DROP drops
+ * messages above LOG_ERR and reports the count later.
+ */
+enum log_async_mode {
+    LOG_ASYNC_OFF   = 0,
+    LOG_ASYNC_BLOCK = 1,
+    LOG_ASYNC_DROP  = 2,
+};
+
+int log_set_async(int mode);
+void log_flush(void);
+
+/*
+ * deferred format, only effective in async mode: log_print copies raw
+ * arguments instead of calling vsnprintf, writer thread does the printf.
+ * format string must stay valid until written (string literal).
+ * -DLOG_DEFERRED (or define before including liblog.h) sends the log
+ * macros straight to log_emit_deferred, log_set_deferred turns it on at
+ * runtime for the other callers
+ */
+void log_set_deferred(int enable);
 int log_print(int lvl, const char *tag, const char *file, int line,
         const char *func, const char *fmt, ...);
 
 #define LOG_LEVEL_ENV     "LIBLOG_LEVEL"
 #define LOG_OUTPUT_ENV    "LIBLOG_OUTPUT"
 #define LOG_TIMESTAMP_ENV "LIBLOG_TIMESTAMP"
+#define LOG_TAG_LEVEL_ENV "LIBLOG_TAG_LEVEL"
 
+/* define LOG_TAG before including liblog.h to tag a module */
+#ifndef LOG_TAG
 #define LOG_TAG "tag"
+#endif
+
+/*
+ * messages above LOG_COMPILE_LEVEL are removed at compile time,
+ * arguments are not evaluated, e.g. -DLOG_COMPILE_LEVEL=LOG_INFO
+ * drops logd and logv from release build
+ */
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_VERB
+#endif
+
+/*
+ * runtime level is checked in caller before arguments are evaluated:
+ * gate is the highest of global and tag levels, gen is bumped when any
+ * level changes, each call site caches level of its tag until then
+ */
+struct log_site {
+    unsigned int gen;
+    int level;
+};
+
+extern int _log_level_gate;
+extern unsigned int _log_level_gen;
+int log_level_lookup(const char *tag);
+
+/* log_print without level check, for callers which checked already */
+int log_emit(int lvl, const char *tag, const char *file, int line,
+        const char *func, const char *fmt, ...);
+/* log_emit with deferred format whatever log_set_deferred says */
+int log_emit_deferred(int lvl, const char *tag, const char *file, int line,
+        const char *func, const char *fmt, ...);
+
+#ifdef LOG_DEFERRED
+#define LOG_EMIT log_emit_deferred
+#else
+#define LOG_EMIT log_emit
+#endif
+
+static inline int log_site_enabled(struct log_site *s, int lvl, const char *tag)
+{
+    unsigned int gen;
+    if (lvl > __atomic_load_n(&_log_level_gate, __ATOMIC_RELAXED)) {
+        return 0;
+    }
+    gen = __atomic_load_n(&_log_level_gen, __ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&s->gen, __ATOMIC_ACQUIRE) != gen) {
+        __atomic_store_n(&s->level, log_level_lookup(tag), __ATOMIC_RELAXED);
+        __atomic_store_n(&s->gen, gen, __ATOMIC_RELEASE);
+    }
+    return lvl <= __atomic_load_n(&s->level, __ATOMIC_RELAXED);
+}
+
+#define LOG_ENABLED(lvl) \
+    (((lvl) <= LOG_COMPILE_LEVEL) && __extension__ ({ \
+        static struct log_site _log_site; \
+        log_site_enabled(&_log_site, lvl, LOG_TAG); }))
+
+#define log_lvl(lvl, ...) \
+    (LOG_ENABLED(lvl) ? \
+     LOG_EMIT(lvl, LOG_TAG, __FILE__, __LINE__, __func__, __VA_ARGS__) : 0)
+
+/*
+ * rate limit per call site: at most burst messages per interval ms,
+ * the rest are counted and reported as "N messages suppressed" when
+ * next window opens
+ */
+struct log_ratelimit {
+    int interval;
+    int burst;
+    int printed;
+    int missed;
+    unsigned long long begin;
+};
+
+#define LOG_RATELIMIT_INTERVAL  (5000)
+#define LOG_RATELIMIT_BURST     (10)
+#define LOG_RATELIMIT_INIT(interval_ms, burst) { interval_ms, burst, 0, 0, 0 }
+
+int log_ratelimit(struct log_ratelimit *rs, int lvl, const char *tag,
+        const char *file, int line, const char *func);
+/* total messages suppressed by rate limit or sampling */
+unsigned long long log_get_suppressed(void);
+void log_add_suppressed(unsigned long long n);
+
+#define log_lvl_ratelimited(lvl, interval_ms, burst, ...) \
+    do { \
+        static struct log_ratelimit _log_rs = LOG_RATELIMIT_INIT(interval_ms, burst); \
+        if (LOG_ENABLED(lvl) && \
+            log_ratelimit(&_log_rs, lvl, LOG_TAG, __FILE__, __LINE__, __func__)) { \
+            LOG_EMIT(lvl, LOG_TAG, __FILE__, __LINE__, __func__, __VA_ARGS__); \
+        } \
+    } while (0)
+
+/*
+ * sampling per call site: only 1st, n+1th, 2n+1th ... enabled call is
+ * logged, calls filtered by level do not advance the counter
+ */
+#define log_lvl_every_n(lvl, n, ...) \
+    do { \
+        static unsigned int _log_cnt = 0; \
+        if (LOG_ENABLED(lvl)) { \
+            if (__atomic_fetch_add(&_log_cnt, 1, __ATOMIC_RELAXED) % (n) == 0) { \
+                LOG_EMIT(lvl, LOG_TAG, __FILE__, __LINE__, __func__, __VA_ARGS__); \
+            } else { \
+                log_add_suppressed(1); \
+            } \
+        } \
+    } while (0)
+
+#define loge_ratelimited(...) log_lvl_ratelimited(LOG_ERR, LOG_RATELIMIT_INTERVAL, LOG_RATELIMIT_BURST, __VA_ARGS__)
+#define logw_ratelimited(...) log_lvl_ratelimited(LOG_WARNING, LOG_RATELIMIT_INTERVAL, LOG_RATELIMIT_BURST, __VA_ARGS__)
+#define logi_ratelimited(...) log_lvl_ratelimited(LOG_INFO, LOG_RATELIMIT_INTERVAL, LOG_RATELIMIT_BURST, __VA_ARGS__)
+#define logd_ratelimited(...) log_lvl_ratelimited(LOG_DEBUG, LOG_RATELIMIT_INTERVAL, LOG_RATELIMIT_BURST, __VA_ARGS__)
 
-#define loge(...) log_print(LOG_ERR, LOG_TAG, __FILE__, __LINE__, __func__, __VA_ARGS__)
-#define logw(...) log_print(LOG_WARNING, LOG_TAG, __FILE__, __LINE__, __func__, __VA_ARGS__)
-#define logi(...) log_print(LOG_INFO, LOG_TAG, __FILE__, __LINE__, __func__, __VA_ARGS__)
-#define logd(...) log_print(LOG_DEBUG, LOG_TAG, __FILE__, __LINE__, __func__, __VA_ARGS__)
-#define logv(...) log_print(LOG_VERB, LOG_TAG, __FILE__, __LINE__, __func__, __VA_ARGS__)
+#define loge(...) log_lvl(LOG_ERR, __VA_ARGS__)
+#define logw(...) log_lvl(LOG_WARNING, __VA_ARGS__)
+#define logi(...) log_lvl(LOG_INFO, __VA_ARGS__)
+#define logd(...) log_lvl(LOG_DEBUG, __VA_ARGS__)
+#define logv(...) log_lvl(LOG_VERB, __VA_ARGS__)
 
 #ifdef __cplusplus
 }
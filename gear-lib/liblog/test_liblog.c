@@ -23,7 +23,11 @@
 #include "liblog.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <pthread.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/time.h>
 
 static void test_no_init(void)
 {
@@ -103,11 +107,229 @@ static void *test(void *arg)
 
 static void test_thread_log(void)
 {
-    pthread_t pid;
-    pthread_create(&pid, NULL, test, "test1");
-    pthread_create(&pid, NULL, test, "test2");
-    pthread_create(&pid, NULL, test, "test3");
-    pthread_join(pid, NULL);
+    int i;
+    pthread_t pid[3];
+    pthread_create(&pid[0], NULL, test, "test1");
+    pthread_create(&pid[1], NULL, test, "test2");
+    pthread_create(&pid[2], NULL, test, "test3");
+    for (i = 0; i < 3; i++) {
+        pthread_join(pid[i], NULL);
+    }
+}
+
+#define ASYNC_THREADS   4
+#define ASYNC_LOOPS     5000
+
+static void *test_async_worker(void *arg)
+{
+    int i;
+    for (i = 0; i < ASYNC_LOOPS; i++) {
+        logi("async msg %s %d\n", (char *)arg, i);
+    }
+    return NULL;
+}
+
+static void test_async(void)
+{
+    int i, k, n, seq, written = 0, ordered = 1;
+    int next[ASYNC_THREADS] = {0};
+    char line[1024], path[8][300], *p;
+    FILE *fp;
+    DIR *dir;
+    struct dirent *ent;
+    struct timeval t0, t1;
+    pthread_t tid[ASYNC_THREADS];
+    char *name[ASYNC_THREADS] = {"a0", "a1", "a2", "a3"};
+
+    log_deinit();
+    log_init(LOG_FILE, "tmp/async.log");
+    log_set_async(LOG_ASYNC_BLOCK);
+    gettimeofday(&t0, NULL);
+    for (i = 0; i < ASYNC_THREADS; i++) {
+        pthread_create(&tid[i], NULL, test_async_worker, name[i]);
+    }
+    for (i = 0; i < ASYNC_THREADS; i++) {
+        pthread_join(tid[i], NULL);
+    }
+    gettimeofday(&t1, NULL);
+    log_flush();
+    printf("async log %d msgs, producer cost %ld us\n", ASYNC_THREADS * ASYNC_LOOPS,
+           (long)((t1.tv_sec - t0.tv_sec) * 1000000 + t1.tv_usec - t0.tv_usec));
+    log_set_async(LOG_ASYNC_OFF);
+    loge("sync again after async\n");
+    log_deinit();
+
+    /* every message written once, in order within its thread, split files first */
+    n = 0;
+    dir = opendir("tmp");
+    while (dir && n < 7 && (ent = readdir(dir))) {
+        if (!strncmp(ent->d_name, "async_", 6)) {
+            snprintf(path[n++], sizeof(path[0]), "tmp/%s", ent->d_name);
+        }
+    }
+    if (dir) {
+        closedir(dir);
+    }
+    qsort(path, n, sizeof(path[0]), (int (*)(const void *, const void *))strcmp);
+    snprintf(path[n++], sizeof(path[0]), "tmp/async.log");
+    for (i = 0; i < n; i++) {
+        fp = fopen(path[i], "r");
+        if (!fp) {
+            continue;
+        }
+        while (fgets(line, sizeof(line), fp)) {
+            p = strstr(line, "async msg a");
+            if (!p || sscanf(p, "async msg a%d %d", &k, &seq) != 2 ||
+                k < 0 || k >= ASYNC_THREADS) {
+                continue;
+            }
+            if (seq != next[k]++) {
+                ordered = 0;
+            }
+            written++;
+        }
+        fclose(fp);
+        remove(path[i]);
+    }
+    printf("async log %d written, %s\n", written, ordered ? "order ok" : "order FAILED");
+}
+
+static void test_deferred(void)
+{
+    int i, n = 0, found = 0;
+    char expect[8][128];
+    char line[1024];
+    FILE *fp;
+    char name[] = "deferred";
+    long long big = -1234567890123LL;
+
+    log_deinit();
+    log_init(LOG_FILE, "tmp/deferred.log");
+    log_set_async(LOG_ASYNC_BLOCK);
+    log_set_deferred(1);
+
+    logi("%d|%5u|%-4x|%%|%c\n", -42, 7u, 255, 'z');
+    snprintf(expect[n++], 128, "%d|%5u|%-4x|%%|%c\n", -42, 7u, 255, 'z');
+    logi("%s=%.3f|%e|%10.2Lf\n", name, 3.14159, 2.5e-8, (long double)1.5);
+    snprintf(expect[n++], 128, "%s=%.3f|%e|%10.2Lf\n", name, 3.14159, 2.5e-8, (long double)1.5);
+    logi("%lld|%lu|%zu|%hd|%hhu\n", big, 123456789UL, (size_t)42, (short)-3, (unsigned char)250);
+    snprintf(expect[n++], 128, "%lld|%lu|%zu|%hd|%hhu\n", big, 123456789UL, (size_t)42, (short)-3, (unsigned char)250);
+    logi("[%*d][%-*.*s]\n", 6, 99, 8, 3, "abcdef");
+    snprintf(expect[n++], 128, "[%*d][%-*.*s]\n", 6, 99, 8, 3, "abcdef");
+    /* what log macros call with -DLOG_DEFERRED, runtime switch off */
+    log_set_deferred(0);
+    log_emit_deferred(LOG_INFO, LOG_TAG, __FILE__, __LINE__, __func__,
+                      "static %s %u\n", name, 0xbeefu);
+    snprintf(expect[n++], 128, "static %s %u\n", name, 0xbeefu);
+
+    log_flush();
+    log_deinit();
+
+    fp = fopen("tmp/deferred.log", "r");
+    if (fp) {
+        while (fgets(line, sizeof(line), fp)) {
+            for (i = 0; i < n; i++) {
+                if (strstr(line, expect[i])) {
+                    found++;
+                }
+            }
+        }
+        fclose(fp);
+    }
+    printf("deferred format %s\n", found == n ? "ok" : "failed");
+    log_set_deferred(0);
+}
+
+static int g_evaluated;
+
+static int count_eval(void)
+{
+    return ++g_evaluated;
+}
+
+#define LONG_TAG "a_tag_longer_than_thirty_two_bytes_limit"
+
+static void test_tag_level(void)
+{
+    int found_net = 0, found_tag = 0, found_long = 0, found_eval = 0;
+    char line[1024];
+    FILE *fp;
+
+    log_deinit();
+    log_init(LOG_FILE, "tmp/tag.log");
+    log_set_level(LOG_WARNING);
+    log_set_tag_level("net", LOG_DEBUG);
+    log_print(LOG_DEBUG, "net", __FILE__, __LINE__, __func__, "net debug shown\n");
+    logd("default tag debug hidden\n");
+    /* filtered in caller, argument is not evaluated */
+    logd("eval %d\n", count_eval());
+    log_set_level(LOG_DEBUG);
+    logd("eval %d\n", count_eval());
+    log_set_level(LOG_WARNING);
+    log_set_tag_level(LONG_TAG, LOG_DEBUG);
+    log_print(LOG_DEBUG, LONG_TAG, __FILE__, __LINE__, __func__, "long tag debug shown\n");
+    log_set_tag_level("net", -1);
+    log_print(LOG_DEBUG, "net", __FILE__, __LINE__, __func__, "net debug hidden again\n");
+    log_set_level(LOG_INFO);
+    log_deinit();
+
+    fp = fopen("tmp/tag.log", "r");
+    if (fp) {
+        while (fgets(line, sizeof(line), fp)) {
+            found_net += !!strstr(line, "net debug");
+            found_tag += !!strstr(line, "default tag");
+            found_long += !!strstr(line, "long tag debug");
+            found_eval += !!strstr(line, "eval 1");
+        }
+        fclose(fp);
+    }
+    printf("tag level %s, long tag %s, caller gate %s\n",
+           (found_net == 1 && found_tag == 0) ? "ok" : "failed",
+           found_long == 1 ? "ok" : "failed",
+           (g_evaluated == 1 && found_eval == 1) ? "ok" : "failed");
+}
+
+static void test_ratelimit(void)
+{
+    int i, shown = 0, suppressed = 0, sampled = 0, evaluated;
+    char line[1024];
+    FILE *fp;
+    unsigned long long base;
+
+    log_deinit();
+    log_init(LOG_FILE, "tmp/ratelimit.log");
+    base = log_get_suppressed();
+    for (i = 0; i <= 100; i++) {
+        if (i == 100) {
+            usleep(250 * 1000);
+        }
+        log_lvl_ratelimited(LOG_WARNING, 200, 5, "flood %d\n", i);
+    }
+    for (i = 0; i < 100; i++) {
+        log_lvl_every_n(LOG_INFO, 10, "sample %d\n", i);
+    }
+    /* below runtime level: counter untouched, args not evaluated */
+    evaluated = g_evaluated;
+    for (i = 0; i < 100; i++) {
+        log_lvl_every_n(LOG_DEBUG, 10, "hidden %d\n", count_eval());
+    }
+    evaluated = g_evaluated - evaluated;
+    log_deinit();
+
+    fp = fopen("tmp/ratelimit.log", "r");
+    if (fp) {
+        while (fgets(line, sizeof(line), fp)) {
+            shown += !!strstr(line, "flood");
+            suppressed += !!strstr(line, "95 messages suppressed");
+            sampled += !!strstr(line, "sample");
+            sampled += !!strstr(line, "hidden") * 100;
+        }
+        fclose(fp);
+    }
+    printf("ratelimit %s, sampled %s, suppressed %llu\n",
+           (shown == 6 && suppressed == 1) ? "ok" : "failed",
+           (sampled == 10 && evaluated == 0) ? "ok" : "failed",
+           log_get_suppressed() - base);
 }
 
 int main(int argc, char **argv)
@@ -117,5 +339,9 @@ int main(int argc, char **argv)
     test_rsyslog();
     test_file_noname();
     test_thread_log();
+    test_async();
+    test_deferred();
+    test_tag_level();
+    test_ratelimit();
     return 0;
 }
@@ -0,0 +1,830 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#include "libmedia-graph.h"
+#include <libqueue.h>
+#include <libworkq.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <time.h>
+
+#define MEDIA_STAGE_BATCH       (16)    /* buffers per run, then requeue */
+#define MEDIA_STAGE_HEADROOM    (16)    /* ring slots above depth for fan-in */
+#define MEDIA_GRAPH_DESC_MAX    (1024)
+
+struct media_stage {
+    struct list_head entry;
+    char name[MEDIA_STAGE_NAME_MAX];
+    const struct media_stage_ops *ops;
+    void *conf;
+    void *priv;
+    struct media_graph *g;
+    struct queue *in;           /* ring of struct media_graph_buf * */
+    int depth;
+    enum media_stage_full full;
+    struct media_stage *out[MEDIA_STAGE_LINKS_MAX];
+    int nout;
+    struct media_stage *up[MEDIA_STAGE_LINKS_MAX];
+    int nup;
+    int queued;
+    int scheduled;              /* a run task is pushed or running */
+    int stalled;                /* stopped by full downstream, kicked by it */
+    struct media_stage_stats st;
+};
+
+struct media_graph {
+    struct list_head stages;
+    struct workq_pool *pool;
+    bool own_pool;
+    int running;
+    int closing;                /* runs drop their input */
+    int inflight;               /* run tasks pushed and not finished */
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static bool is_source(const struct media_stage *s)
+{
+    return s->ops->process == NULL;
+}
+
+/******************************************************************************
+ * buffer
+ ******************************************************************************/
+struct media_graph_buf *media_graph_buf_frame(const struct media_frame *frame)
+{
+    struct media_graph_buf *buf;
+
+    if (!frame || frame->type != MEDIA_TYPE_VIDEO) {
+        printf("%s only video frame supported!\n", __func__);
+        return NULL;
+    }
+    buf = (struct media_graph_buf *)calloc(1, sizeof(*buf));
+    if (!buf) {
+        return NULL;
+    }
+    buf->ref_cnt = 1;
+    buf->type = MEDIA_GRAPH_FRAME;
+    buf->frame.type = MEDIA_TYPE_VIDEO;
+    if (0 != video_frame_ref(&buf->frame.video, &frame->video)) {
+        free(buf);
+        return NULL;
+    }
+    return buf;
+}
+
+struct media_graph_buf *media_graph_buf_packet(const struct media_packet *packet)
+{
+    struct media_graph_buf *buf;
+
+    if (!packet) {
+        return NULL;
+    }
+    buf = (struct media_graph_buf *)calloc(1, sizeof(*buf));
+    if (!buf) {
+        return NULL;
+    }
+    buf->ref_cnt = 1;
+    buf->type = MEDIA_GRAPH_PACKET;
+    /* deep shares the media_buffer if there is one, copies otherwise */
+    buf->packet = media_packet_copy(packet, MEDIA_MEM_DEEP);
+    if (!buf->packet) {
+        free(buf);
+        return NULL;
+    }
+    return buf;
+}
+
+struct media_graph_buf *media_graph_buf_ref(struct media_graph_buf *buf)
+{
+    if (buf) {
+        __atomic_add_fetch(&buf->ref_cnt, 1, __ATOMIC_RELAXED);
+    }
+    return buf;
+}
+
+void media_graph_buf_unref(struct media_graph_buf *buf)
+{
+    if (!buf || __atomic_sub_fetch(&buf->ref_cnt, 1, __ATOMIC_ACQ_REL) > 0) {
+        return;
+    }
+    if (buf->type == MEDIA_GRAPH_FRAME) {
+        video_frame_deinit(&buf->frame.video);
+    } else {
+        media_packet_destroy(buf->packet);
+    }
+    free(buf);
+}
+
+/******************************************************************************
+ * scheduling
+ ******************************************************************************/
+static void stage_run(void *arg);
+
+static void stage_schedule(struct media_stage *s)
+{
+    struct media_graph *g = s->g;
+
+    if (__atomic_exchange_n(&s->scheduled, 1, __ATOMIC_ACQ_REL)) {
+        return;
+    }
+    __atomic_add_fetch(&g->inflight, 1, __ATOMIC_ACQ_REL);
+    if (0 != workq_pool_task_push(g->pool, stage_run, s)) {
+        /* left queued, the next push schedules again */
+        __atomic_add_fetch(&s->st.errors, 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&s->scheduled, 0, __ATOMIC_RELEASE);
+        __atomic_sub_fetch(&g->inflight, 1, __ATOMIC_ACQ_REL);
+    }
+}
+
+/* no blocking downstream is at its depth */
+static bool stage_has_room(const struct media_stage *s)
+{
+    int i;
+    const struct media_stage *o;
+
+    for (i = 0; i < s->nout; i++) {
+        o = s->out[i];
+        if (o->full == MEDIA_STAGE_FULL_BLOCK &&
+            __atomic_load_n(&o->queued, __ATOMIC_SEQ_CST) >= o->depth) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void kick_upstream(struct media_stage *s)
+{
+    int i;
+    struct media_stage *up;
+
+    for (i = 0; i < s->nup; i++) {
+        up = s->up[i];
+        if (__atomic_load_n(&up->stalled, __ATOMIC_SEQ_CST) &&
+            __atomic_exchange_n(&up->stalled, 0, __ATOMIC_SEQ_CST)) {
+            stage_schedule(up);
+        }
+    }
+}
+
+static struct media_graph_buf *input_pop(struct media_stage *s)
+{
+    struct queue_item *it;
+    struct media_graph_buf *buf;
+
+    it = queue_pop_wait(s->in, 0);
+    if (!it) {
+        return NULL;
+    }
+    memcpy(&buf, it->data.iov_base, sizeof(buf));
+    queue_item_free(s->in, it);
+    __atomic_sub_fetch(&s->queued, 1, __ATOMIC_SEQ_CST);
+    kick_upstream(s);
+    return buf;
+}
+
+static int input_push(struct media_stage *s, struct media_graph_buf *buf)
+{
+    struct queue_item *it;
+    struct media_graph_buf *old;
+
+    if (s->full == MEDIA_STAGE_FULL_DROP_OLDEST) {
+        while (__atomic_load_n(&s->queued, __ATOMIC_ACQUIRE) >= s->depth &&
+               (old = input_pop(s)) != NULL) {
+            media_graph_buf_unref(old);
+            __atomic_add_fetch(&s->st.dropped, 1, __ATOMIC_RELAXED);
+        }
+    }
+    /* the ring carries the pointer, items come from the queue pool */
+    it = queue_item_alloc(s->in, &buf, sizeof(buf), NULL);
+    if (!it) {
+        __atomic_add_fetch(&s->st.dropped, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+    media_graph_buf_ref(buf);
+    __atomic_add_fetch(&s->queued, 1, __ATOMIC_SEQ_CST);
+    if (0 != queue_push(s->in, it)) {
+        __atomic_sub_fetch(&s->queued, 1, __ATOMIC_SEQ_CST);
+        queue_item_free(s->in, it);
+        media_graph_buf_unref(buf);
+        __atomic_add_fetch(&s->st.dropped, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+    stage_schedule(s);
+    return 0;
+}
+
+static void stage_process(struct media_stage *s, struct media_graph_buf *buf)
+{
+    uint64_t t = now_ns();
+
+    if (0 != s->ops->process(s, buf)) {
+        __atomic_add_fetch(&s->st.errors, 1, __ATOMIC_RELAXED);
+    }
+    t = now_ns() - t;
+    __atomic_add_fetch(&s->st.in, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&s->st.busy_ns, t, __ATOMIC_RELAXED);
+    if (t > s->st.max_ns) {
+        __atomic_store_n(&s->st.max_ns, t, __ATOMIC_RELAXED);
+    }
+}
+
+/*
+ * workq task, one at a time per stage. it stops when a blocking downstream
+ * is full and sets stalled, the downstream clears it and schedules this
+ * stage again when it pops. stalled is set before the second check so
+ * either side sees the other
+ */
+static void stage_run(void *arg)
+{
+    struct media_stage *s = (struct media_stage *)arg;
+    struct media_graph *g = s->g;
+    struct media_graph_buf *buf;
+    int n;
+
+    for (n = 0; n < MEDIA_STAGE_BATCH; n++) {
+        if (__atomic_load_n(&g->closing, __ATOMIC_ACQUIRE)) {
+            while ((buf = input_pop(s)) != NULL) {
+                media_graph_buf_unref(buf);
+                __atomic_add_fetch(&s->st.dropped, 1, __ATOMIC_RELAXED);
+            }
+            break;
+        }
+        if (!stage_has_room(s)) {
+            __atomic_store_n(&s->stalled, 1, __ATOMIC_SEQ_CST);
+            if (!stage_has_room(s)) {
+                __atomic_add_fetch(&s->st.stalls, 1, __ATOMIC_RELAXED);
+                break;
+            }
+            __atomic_store_n(&s->stalled, 0, __ATOMIC_SEQ_CST);
+        }
+        buf = input_pop(s);
+        if (!buf) {
+            break;
+        }
+        stage_process(s, buf);
+        media_graph_buf_unref(buf);
+    }
+    __atomic_store_n(&s->scheduled, 0, __ATOMIC_SEQ_CST);
+    if (!__atomic_load_n(&s->stalled, __ATOMIC_SEQ_CST) &&
+        __atomic_load_n(&s->queued, __ATOMIC_SEQ_CST) > 0) {
+        stage_schedule(s);
+    }
+    __atomic_sub_fetch(&g->inflight, 1, __ATOMIC_ACQ_REL);
+}
+
+/******************************************************************************
+ * emit
+ ******************************************************************************/
+int media_stage_emit(struct media_stage *s, struct media_graph_buf *buf)
+{
+    int i, ret = 0;
+
+    if (!s || !buf) {
+        return -1;
+    }
+    if (is_source(s)) {
+        /* a source never waits, the buffer is lost here */
+        if (!__atomic_load_n(&s->g->running, __ATOMIC_ACQUIRE) || !stage_has_room(s)) {
+            __atomic_add_fetch(&s->st.dropped, 1, __ATOMIC_RELAXED);
+            return -1;
+        }
+        __atomic_add_fetch(&s->st.in, 1, __ATOMIC_RELAXED);
+    }
+    for (i = 0; i < s->nout; i++) {
+        if (0 != input_push(s->out[i], buf)) {
+            ret = -1;
+        }
+    }
+    __atomic_add_fetch(&s->st.out, 1, __ATOMIC_RELAXED);
+    return ret;
+}
+
+int media_stage_emit_frame(struct media_stage *s, const struct media_frame *frame)
+{
+    int ret;
+    struct media_graph_buf *buf;
+
+    if (!s || !frame) {
+        return -1;
+    }
+    /* check before the frame is referenced or copied */
+    if (is_source(s) && !stage_has_room(s)) {
+        __atomic_add_fetch(&s->st.dropped, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+    buf = media_graph_buf_frame(frame);
+    if (!buf) {
+        __atomic_add_fetch(&s->st.errors, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+    ret = media_stage_emit(s, buf);
+    media_graph_buf_unref(buf);
+    return ret;
+}
+
+int media_stage_emit_packet(struct media_stage *s, const struct media_packet *packet)
+{
+    int ret;
+    struct media_graph_buf *buf;
+
+    if (!s || !packet) {
+        return -1;
+    }
+    if (is_source(s) && !stage_has_room(s)) {
+        __atomic_add_fetch(&s->st.dropped, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+    buf = media_graph_buf_packet(packet);
+    if (!buf) {
+        __atomic_add_fetch(&s->st.errors, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+    ret = media_stage_emit(s, buf);
+    media_graph_buf_unref(buf);
+    return ret;
+}
+
+/******************************************************************************
+ * graph
+ ******************************************************************************/
+struct media_graph *media_graph_create(struct workq_pool *pool)
+{
+    struct media_graph *g = (struct media_graph *)calloc(1, sizeof(*g));
+    if (!g) {
+        return NULL;
+    }
+    INIT_LIST_HEAD(&g->stages);
+    g->pool = pool;
+    if (!g->pool) {
+        g->pool = workq_pool_create();
+        if (!g->pool) {
+            printf("workq_pool_create failed!\n");
+            free(g);
+            return NULL;
+        }
+        g->own_pool = true;
+    }
+    return g;
+}
+
+struct media_stage *media_graph_find(struct media_graph *g, const char *name)
+{
+    struct media_stage *s;
+
+    if (!g || !name) {
+        return NULL;
+    }
+    list_for_each_entry(s, &g->stages, entry) {
+        if (!strcmp(s->name, name)) {
+            return s;
+        }
+    }
+    return NULL;
+}
+
+struct media_stage *media_graph_add(struct media_graph *g, const char *name,
+                const struct media_stage_ops *ops, void *conf)
+{
+    struct media_stage *s;
+
+    if (!g || !name || !ops || g->running) {
+        printf("%s invalid paraments!\n", __func__);
+        return NULL;
+    }
+    if (strlen(name) >= MEDIA_STAGE_NAME_MAX || media_graph_find(g, name)) {
+        printf("%s stage name %s invalid or used!\n", __func__, name);
+        return NULL;
+    }
+    s = (struct media_stage *)calloc(1, sizeof(*s));
+    if (!s) {
+        return NULL;
+    }
+    snprintf(s->name, sizeof(s->name), "%s", name);
+    s->ops = ops;
+    s->conf = conf;
+    s->g = g;
+    s->depth = MEDIA_STAGE_DEPTH;
+    s->full = MEDIA_STAGE_FULL_BLOCK;
+    if (ops->init && 0 != ops->init(s, conf)) {
+        printf("stage %s init failed!\n", name);
+        free(s);
+        return NULL;
+    }
+    list_add_tail(&s->entry, &g->stages);
+    return s;
+}
+
+int media_stage_set_input(struct media_stage *s, int depth, enum media_stage_full full)
+{
+    if (!s || depth < 0 || s->in || is_source(s)) {
+        return -1;
+    }
+    if (depth > 0) {
+        s->depth = depth;
+    }
+    s->full = full;
+    return 0;
+}
+
+int media_graph_link(struct media_graph *g, const char *from, const char *to)
+{
+    int i;
+    struct media_stage *a = media_graph_find(g, from);
+    struct media_stage *b = media_graph_find(g, to);
+
+    if (!a || !b || a == b || g->running) {
+        printf("link %s -> %s invalid!\n", from, to);
+        return -1;
+    }
+    if (is_source(b)) {
+        printf("link %s -> %s, source has no input!\n", from, to);
+        return -1;
+    }
+    for (i = 0; i < a->nout; i++) {
+        if (a->out[i] == b) {
+            return 0;
+        }
+    }
+    if (a->nout == MEDIA_STAGE_LINKS_MAX || b->nup == MEDIA_STAGE_LINKS_MAX) {
+        printf("link %s -> %s, too many links!\n", from, to);
+        return -1;
+    }
+    a->out[a->nout++] = b;
+    b->up[b->nup++] = a;
+    return 0;
+}
+
+static char *trim(char *str)
+{
+    char *end;
+    while (*str == ' ' || *str == '\t') {
+        str++;
+    }
+    end = str + strlen(str);
+    while (end > str && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r')) {
+        *--end = '\0';
+    }
+    return str;
+}
+
+int media_graph_connect(struct media_graph *g, const char *desc)
+{
+    char buf[MEDIA_GRAPH_DESC_MAX];
+    char *chain, *save = NULL, *p, *arrow, *prev;
+
+    if (!g || !desc || strlen(desc) >= sizeof(buf)) {
+        return -1;
+    }
+    snprintf(buf, sizeof(buf), "%s", desc);
+    for (chain = strtok_r(buf, ",;\n", &save); chain;
+         chain = strtok_r(NULL, ",;\n", &save)) {
+        prev = NULL;
+        p = chain;
+        do {
+            arrow = strstr(p, "->");
+            if (arrow) {
+                *arrow = '\0';
+            }
+            p = trim(p);
+            if (*p == '\0') {
+                printf("%s empty stage in \"%s\"!\n", __func__, desc);
+                return -1;
+            }
+            if (prev && 0 != media_graph_link(g, prev, p)) {
+                return -1;
+            }
+            prev = p;
+            p = arrow ? arrow + 2 : NULL;
+        } while (p);
+    }
+    return 0;
+}
+
+static int stage_input_create(struct media_stage *s)
+{
+    int cap = s->depth * 2 + MEDIA_STAGE_HEADROOM;
+
+    s->in = queue_create_by(QUEUE_MPMC, cap);
+    if (!s->in) {
+        return -1;
+    }
+    if (0 != queue_set_pool(s->in, cap, sizeof(struct media_graph_buf *))) {
+        queue_destroy(s->in);
+        s->in = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+int media_graph_start(struct media_graph *g)
+{
+    struct media_stage *s;
+
+    if (!g || g->running) {
+        return -1;
+    }
+    list_for_each_entry(s, &g->stages, entry) {
+        if (is_source(s)) {
+            continue;
+        }
+        if (!s->nup) {
+            printf("stage %s has no input link\n", s->name);
+        }
+        if (!s->in && 0 != stage_input_create(s)) {
+            printf("stage %s input create failed!\n", s->name);
+            return -1;
+        }
+        if (s->ops->start && 0 != s->ops->start(s)) {
+            printf("stage %s start failed!\n", s->name);
+            return -1;
+        }
+    }
+    __atomic_store_n(&g->closing, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&g->running, 1, __ATOMIC_RELEASE);
+    list_for_each_entry(s, &g->stages, entry) {
+        if (is_source(s) && s->ops->start && 0 != s->ops->start(s)) {
+            printf("source %s start failed!\n", s->name);
+            media_graph_stop(g, 0);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static bool graph_idle(struct media_graph *g)
+{
+    struct media_stage *s;
+
+    if (__atomic_load_n(&g->inflight, __ATOMIC_ACQUIRE) > 0) {
+        return false;
+    }
+    list_for_each_entry(s, &g->stages, entry) {
+        if (__atomic_load_n(&s->queued, __ATOMIC_ACQUIRE) > 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int media_graph_stop(struct media_graph *g, int timeout_ms)
+{
+    int ret = 0;
+    uint64_t deadline;
+    struct media_stage *s;
+
+    if (!g || !g->running) {
+        return -1;
+    }
+    list_for_each_entry(s, &g->stages, entry) {
+        if (is_source(s) && s->ops->stop) {
+            s->ops->stop(s);
+        }
+    }
+    __atomic_store_n(&g->running, 0, __ATOMIC_RELEASE);
+    deadline = now_ns() + (uint64_t)(timeout_ms > 0 ? timeout_ms : 0) * 1000000ULL;
+    while (!graph_idle(g)) {
+        if (now_ns() >= deadline) {
+            ret = -1;
+            break;
+        }
+        usleep(1000);
+    }
+    /* what is left is dropped, runs in flight must end before stop */
+    __atomic_store_n(&g->closing, 1, __ATOMIC_RELEASE);
+    list_for_each_entry(s, &g->stages, entry) {
+        if (s->in && __atomic_load_n(&s->queued, __ATOMIC_ACQUIRE) > 0) {
+            __atomic_store_n(&s->stalled, 0, __ATOMIC_SEQ_CST);
+            stage_schedule(s);
+        }
+    }
+    while (__atomic_load_n(&g->inflight, __ATOMIC_ACQUIRE) > 0) {
+        usleep(1000);
+    }
+    list_for_each_entry(s, &g->stages, entry) {
+        if (!is_source(s) && s->ops->stop) {
+            s->ops->stop(s);
+        }
+    }
+    return ret;
+}
+
+void media_graph_destroy(struct media_graph *g)
+{
+    struct media_stage *s, *tmp;
+    struct media_graph_buf *buf;
+
+    if (!g) {
+        return;
+    }
+    if (g->running) {
+        media_graph_stop(g, 0);
+    }
+    list_for_each_entry_safe(s, tmp, &g->stages, entry) {
+        if (s->in) {
+            while ((buf = input_pop(s)) != NULL) {
+                media_graph_buf_unref(buf);
+            }
+            queue_destroy(s->in);
+        }
+        if (s->ops->deinit) {
+            s->ops->deinit(s);
+        }
+        list_del(&s->entry);
+        free(s);
+    }
+    if (g->own_pool) {
+        workq_pool_destroy(g->pool);
+    }
+    free(g);
+}
+
+/******************************************************************************
+ * stage accessors and stats
+ ******************************************************************************/
+const char *media_stage_name(const struct media_stage *s)
+{
+    return s ? s->name : NULL;
+}
+
+void *media_stage_conf(const struct media_stage *s)
+{
+    return s ? s->conf : NULL;
+}
+
+void media_stage_set_priv(struct media_stage *s, void *priv)
+{
+    if (s) {
+        s->priv = priv;
+    }
+}
+
+void *media_stage_priv(const struct media_stage *s)
+{
+    return s ? s->priv : NULL;
+}
+
+int media_stage_get_stats(struct media_stage *s, struct media_stage_stats *st)
+{
+    if (!s || !st) {
+        return -1;
+    }
+    st->in = __atomic_load_n(&s->st.in, __ATOMIC_RELAXED);
+    st->out = __atomic_load_n(&s->st.out, __ATOMIC_RELAXED);
+    st->dropped = __atomic_load_n(&s->st.dropped, __ATOMIC_RELAXED);
+    st->errors = __atomic_load_n(&s->st.errors, __ATOMIC_RELAXED);
+    st->stalls = __atomic_load_n(&s->st.stalls, __ATOMIC_RELAXED);
+    st->busy_ns = __atomic_load_n(&s->st.busy_ns, __ATOMIC_RELAXED);
+    st->max_ns = __atomic_load_n(&s->st.max_ns, __ATOMIC_RELAXED);
+    st->queued = __atomic_load_n(&s->queued, __ATOMIC_RELAXED);
+    return 0;
+}
+
+void media_graph_dump(struct media_graph *g, FILE *fp)
+{
+    struct media_stage *s;
+    struct media_stage_stats st;
+
+    if (!g || !fp) {
+        return;
+    }
+    fprintf(fp, "%-12s %-10s %10s %10s %8s %8s %8s %7s %9s %9s\n", "stage", "type",
+            "in", "out", "dropped", "errors", "stalls", "queued", "avg_us", "max_us");
+    list_for_each_entry(s, &g->stages, entry) {
+        media_stage_get_stats(s, &st);
+        fprintf(fp, "%-12s %-10s %10" PRIu64 " %10" PRIu64 " %8" PRIu64 " %8" PRIu64
+                " %8" PRIu64 " %3d/%-3d %9.1f %9.1f\n", s->name,
+                s->ops->type ? s->ops->type : "-", st.in, st.out, st.dropped,
+                st.errors, st.stalls, st.queued, is_source(s) ? 0 : s->depth,
+                (!is_source(s) && st.in) ? st.busy_ns / 1000.0 / st.in : 0,
+                st.max_ns / 1000.0);
+    }
+}
+
+/******************************************************************************
+ * built-in stages
+ ******************************************************************************/
+const struct media_stage_ops media_stage_source = {
+    .type = "source",
+};
+
+struct convert_ctx {
+    enum pixel_format format;
+    struct video_frame_pool *pool;
+};
+
+static int convert_init(struct media_stage *s, void *conf)
+{
+    struct media_stage_convert_conf *cc = (struct media_stage_convert_conf *)conf;
+    struct convert_ctx *c;
+
+    if (!cc) {
+        return -1;
+    }
+    c = (struct convert_ctx *)calloc(1, sizeof(*c));
+    if (!c) {
+        return -1;
+    }
+    c->format = cc->format;
+    c->pool = video_frame_pool_create(MEDIA_STAGE_DEPTH);
+    if (!c->pool) {
+        free(c);
+        return -1;
+    }
+    media_stage_set_priv(s, c);
+    return 0;
+}
+
+static void convert_deinit(struct media_stage *s)
+{
+    struct convert_ctx *c = (struct convert_ctx *)media_stage_priv(s);
+    video_frame_pool_destroy(c->pool);
+    free(c);
+}
+
+static int convert_process(struct media_stage *s, struct media_graph_buf *buf)
+{
+    int ret;
+    struct convert_ctx *c = (struct convert_ctx *)media_stage_priv(s);
+    const struct video_frame *src;
+    struct media_graph_buf *out;
+
+    if (buf->type != MEDIA_GRAPH_FRAME || buf->frame.video.format == c->format) {
+        return media_stage_emit(s, buf);
+    }
+    src = &buf->frame.video;
+    if (!video_frame_convert_supported(c->format, src->format)) {
+        return -1;
+    }
+    out = (struct media_graph_buf *)calloc(1, sizeof(*out));
+    if (!out) {
+        return -1;
+    }
+    out->ref_cnt = 1;
+    out->type = MEDIA_GRAPH_FRAME;
+    out->frame.type = MEDIA_TYPE_VIDEO;
+    if (0 != video_frame_pool_init(c->pool, &out->frame.video, c->format,
+                                   src->width, src->height)) {
+        free(out);
+        return -1;
+    }
+    out->frame.video.timestamp = src->timestamp;
+    out->frame.video.frame_id = src->frame_id;
+    ret = video_frame_convert(&out->frame.video, src);
+    if (ret == 0) {
+        ret = media_stage_emit(s, out);
+    }
+    media_graph_buf_unref(out);
+    return ret;
+}
+
+const struct media_stage_ops media_stage_convert = {
+    .type = "convert",
+    .init = convert_init,
+    .deinit = convert_deinit,
+    .process = convert_process,
+};
+
+static int callback_init(struct media_stage *s, void *conf)
+{
+    struct media_stage_cb_conf *cb = (struct media_stage_cb_conf *)conf;
+    return (cb && cb->fn) ? 0 : -1;
+}
+
+static int callback_process(struct media_stage *s, struct media_graph_buf *buf)
+{
+    struct media_stage_cb_conf *cb = (struct media_stage_cb_conf *)media_stage_conf(s);
+    return cb->fn(s, buf, cb->arg);
+}
+
+const struct media_stage_ops media_stage_callback = {
+    .type = "callback",
+    .init = callback_init,
+    .process = callback_process,
+};
@@ -0,0 +1,186 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#ifndef LIBMEDIA_GRAPH_H
+#define LIBMEDIA_GRAPH_H
+
+#include <libposix.h>
+#include <libmedia-io.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#define LIBMEDIA_GRAPH_VERSION "0.1.0"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * media pipeline as a graph of stages, e.g. one per camera:
+ *
+ *   cam -> conv -> enc -> rtmp
+ *                     \-> mp4
+ *
+ * a buffer between stages is a refcounted frame or packet, fan-out only
+ * takes references, the pixels are not copied. each stage but a source
+ * has an input ring (libqueue MPMC), a stage runs as a task on workq when
+ * its input is not empty and never on two threads at once.
+ *
+ * a full input either stalls the upstream stage (MEDIA_STAGE_FULL_BLOCK),
+ * so the pressure goes back stage by stage until the source drops, or
+ * drops its oldest buffer (MEDIA_STAGE_FULL_DROP_OLDEST), so a slow live
+ * output never holds back the others
+ */
+
+struct media_graph;
+struct media_stage;
+struct workq_pool;
+
+enum media_graph_buf_type {
+    MEDIA_GRAPH_FRAME = 0,
+    MEDIA_GRAPH_PACKET,
+};
+
+struct media_graph_buf {
+    int ref_cnt;
+    enum media_graph_buf_type type;
+    union {
+        struct media_frame frame;       /* video only, holds a buffer ref */
+        struct media_packet *packet;
+    };
+};
+
+/*
+ * wrap takes a reference of the media_buffer under frame or packet, data
+ * without one is copied once here. audio frames are not supported
+ */
+GEAR_API struct media_graph_buf *media_graph_buf_frame(const struct media_frame *frame);
+GEAR_API struct media_graph_buf *media_graph_buf_packet(const struct media_packet *packet);
+GEAR_API struct media_graph_buf *media_graph_buf_ref(struct media_graph_buf *buf);
+GEAR_API void media_graph_buf_unref(struct media_graph_buf *buf);
+
+enum media_stage_full {
+    MEDIA_STAGE_FULL_BLOCK = 0,
+    MEDIA_STAGE_FULL_DROP_OLDEST,
+};
+
+/*
+ * a source has no process, it emits from its own thread or callback,
+ * started after and stopped before the other stages. process is called
+ * with one input buffer, it is borrowed, and emits 0..n buffers
+ */
+struct media_stage_ops {
+    const char *type;
+    int (*init)(struct media_stage *s, void *conf);
+    void (*deinit)(struct media_stage *s);
+    int (*start)(struct media_stage *s);
+    void (*stop)(struct media_stage *s);
+    int (*process)(struct media_stage *s, struct media_graph_buf *buf);
+};
+
+struct media_stage_stats {
+    uint64_t in;        /* buffers processed */
+    uint64_t out;       /* buffers emitted */
+    uint64_t dropped;   /* source: no room downstream, others: at input */
+    uint64_t errors;    /* process failed */
+    uint64_t stalls;    /* runs stopped by a full downstream */
+    uint64_t busy_ns;   /* time in process */
+    uint64_t max_ns;
+    int queued;         /* buffers in input now */
+};
+
+#define MEDIA_STAGE_NAME_MAX    (32)
+#define MEDIA_STAGE_LINKS_MAX   (8)
+#define MEDIA_STAGE_DEPTH       (8)     /* default input depth */
+
+/* pool NULL creates one for the graph */
+GEAR_API struct media_graph *media_graph_create(struct workq_pool *pool);
+/* stops the graph if running, buffers still queued are dropped */
+GEAR_API void media_graph_destroy(struct media_graph *g);
+
+/* conf is passed to ops->init, it is owned by caller */
+GEAR_API struct media_stage *media_graph_add(struct media_graph *g, const char *name,
+                const struct media_stage_ops *ops, void *conf);
+GEAR_API struct media_stage *media_graph_find(struct media_graph *g, const char *name);
+/* input ring of a stage, before start, depth 0 keeps default */
+GEAR_API int media_stage_set_input(struct media_stage *s, int depth, enum media_stage_full full);
+
+GEAR_API int media_graph_link(struct media_graph *g, const char *from, const char *to);
+/*
+ * links in text, chains separated by ',' or ';' or new line:
+ *   "cam -> conv -> enc -> rtmp, enc -> mp4"
+ */
+GEAR_API int media_graph_connect(struct media_graph *g, const char *desc);
+
+GEAR_API int media_graph_start(struct media_graph *g);
+/* stops sources, then waits up to timeout_ms for queued buffers to drain */
+GEAR_API int media_graph_stop(struct media_graph *g, int timeout_ms);
+
+/*
+ * emit from process or from a source, the buffer is referenced for each
+ * downstream, caller keeps its own. a source returns -1 and counts a drop
+ * if a blocking downstream is full, it never waits
+ */
+GEAR_API int media_stage_emit(struct media_stage *s, struct media_graph_buf *buf);
+GEAR_API int media_stage_emit_frame(struct media_stage *s, const struct media_frame *frame);
+GEAR_API int media_stage_emit_packet(struct media_stage *s, const struct media_packet *packet);
+
+GEAR_API const char *media_stage_name(const struct media_stage *s);
+GEAR_API void *media_stage_conf(const struct media_stage *s);
+GEAR_API void media_stage_set_priv(struct media_stage *s, void *priv);
+GEAR_API void *media_stage_priv(const struct media_stage *s);
+
+GEAR_API int media_stage_get_stats(struct media_stage *s, struct media_stage_stats *st);
+GEAR_API void media_graph_dump(struct media_graph *g, FILE *fp);
+
+/*
+ * built-in stages
+ */
+
+/* external source, the caller emits with media_stage_emit_frame/packet */
+GEAR_API extern const struct media_stage_ops media_stage_source;
+
+/* video frames to format from a frame pool, other buffers pass through */
+struct media_stage_convert_conf {
+    enum pixel_format format;
+};
+GEAR_API extern const struct media_stage_ops media_stage_convert;
+
+/* filter, encoder or sink in user code, fn emits its outputs if any */
+struct media_stage_cb_conf {
+    int (*fn)(struct media_stage *s, struct media_graph_buf *buf, void *arg);
+    void *arg;
+};
+GEAR_API extern const struct media_stage_ops media_stage_callback;
+
+/*
+ * stages of other gear-lib modules, only in a lib built with ENABLE_AVCAP,
+ * ENABLE_RTMPC and ENABLE_MP4. conf is struct avcap_ctx *, struct rtmpc *
+ * and struct mp4_muxer *, opened by the caller and closed after the graph
+ */
+GEAR_API extern const struct media_stage_ops media_stage_avcap;
+GEAR_API extern const struct media_stage_ops media_stage_rtmpc;
+GEAR_API extern const struct media_stage_ops media_stage_mp4;
+
+#ifdef __cplusplus
+}
+#endif
+#endif
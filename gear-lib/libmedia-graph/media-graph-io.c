@@ -0,0 +1,91 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#include "libmedia-graph.h"
+#include <stdlib.h>
+
+/*
+ * adapters of other gear-lib modules. the device, stream or file is opened
+ * by the caller and handed in as conf, a stage only moves buffers
+ */
+
+#if defined (ENABLE_AVCAP)
+#include <libavcap.h>
+
+static int avcap_on_frame(struct avcap_ctx *avcap, struct media_frame *frame)
+{
+    /* dropped in emit when downstream is full, capture never waits */
+    media_stage_emit_frame((struct media_stage *)avcap->user, frame);
+    return 0;
+}
+
+static int avcap_stage_start(struct media_stage *s)
+{
+    struct avcap_ctx *avcap = (struct avcap_ctx *)media_stage_conf(s);
+    avcap->user = s;
+    return avcap_start_stream(avcap, avcap_on_frame);
+}
+
+static void avcap_stage_stop(struct media_stage *s)
+{
+    avcap_stop_stream((struct avcap_ctx *)media_stage_conf(s));
+}
+
+const struct media_stage_ops media_stage_avcap = {
+    .type = "avcap",
+    .start = avcap_stage_start,
+    .stop = avcap_stage_stop,
+};
+#endif
+
+#if defined (ENABLE_RTMPC)
+#include <librtmpc.h>
+
+static int rtmpc_stage_process(struct media_stage *s, struct media_graph_buf *buf)
+{
+    if (buf->type != MEDIA_GRAPH_PACKET) {
+        return -1;
+    }
+    return rtmpc_send_packet((struct rtmpc *)media_stage_conf(s), buf->packet);
+}
+
+const struct media_stage_ops media_stage_rtmpc = {
+    .type = "rtmpc",
+    .process = rtmpc_stage_process,
+};
+#endif
+
+#if defined (ENABLE_MP4)
+#include <libmp4.h>
+
+static int mp4_stage_process(struct media_stage *s, struct media_graph_buf *buf)
+{
+    if (buf->type != MEDIA_GRAPH_PACKET) {
+        return -1;
+    }
+    return mp4_muxer_write((struct mp4_muxer *)media_stage_conf(s), buf->packet);
+}
+
+const struct media_stage_ops media_stage_mp4 = {
+    .type = "mp4",
+    .process = mp4_stage_process,
+};
+#endif
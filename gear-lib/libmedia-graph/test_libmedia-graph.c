@@ -0,0 +1,122 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#include "libmedia-graph.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define FRAMES      200
+#define WIDTH       320
+#define HEIGHT      240
+
+/* stands in for an encoder, one packet per frame */
+static int fake_encode(struct media_stage *s, struct media_graph_buf *buf, void *arg)
+{
+    int ret;
+    uint8_t data[256];
+    struct media_packet *pkt;
+
+    if (buf->type != MEDIA_GRAPH_FRAME || buf->frame.video.format != PIXEL_FORMAT_I420) {
+        return -1;
+    }
+    memcpy(data, buf->frame.video.data[0], sizeof(data));
+    pkt = media_packet_create(MEDIA_TYPE_VIDEO, MEDIA_MEM_DEEP, data, sizeof(data));
+    if (!pkt) {
+        return -1;
+    }
+    pkt->video->pts = buf->frame.video.timestamp;
+    pkt->video->key_frame = (buf->frame.video.frame_id % 30) == 0;
+    ret = media_stage_emit_packet(s, pkt);
+    media_packet_destroy(pkt);
+    return ret;
+}
+
+static int fast_sink(struct media_stage *s, struct media_graph_buf *buf, void *arg)
+{
+    __atomic_add_fetch((int *)arg, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/* a network output that can not keep up, it loses old packets only */
+static int slow_sink(struct media_stage *s, struct media_graph_buf *buf, void *arg)
+{
+    usleep(5000);
+    __atomic_add_fetch((int *)arg, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int i, sent = 0, fast = 0, slow = 0;
+    struct media_graph *g;
+    struct media_stage *src, *slow_stage;
+    struct video_frame *vf;
+    struct media_frame frame;
+    struct media_stage_convert_conf conv = { PIXEL_FORMAT_I420 };
+    struct media_stage_cb_conf enc = { fake_encode, NULL };
+    struct media_stage_cb_conf fast_cb = { fast_sink, &fast };
+    struct media_stage_cb_conf slow_cb = { slow_sink, &slow };
+
+    g = media_graph_create(NULL);
+    if (!g) {
+        printf("media_graph_create failed!\n");
+        return -1;
+    }
+    src = media_graph_add(g, "cap", &media_stage_source, NULL);
+    media_graph_add(g, "conv", &media_stage_convert, &conv);
+    media_graph_add(g, "enc", &media_stage_callback, &enc);
+    media_graph_add(g, "file", &media_stage_callback, &fast_cb);
+    slow_stage = media_graph_add(g, "net", &media_stage_callback, &slow_cb);
+    media_stage_set_input(slow_stage, 4, MEDIA_STAGE_FULL_DROP_OLDEST);
+    if (0 != media_graph_connect(g, "cap -> conv -> enc -> file, enc -> net")) {
+        printf("media_graph_connect failed!\n");
+        media_graph_destroy(g);
+        return -1;
+    }
+    if (0 != media_graph_start(g)) {
+        printf("media_graph_start failed!\n");
+        media_graph_destroy(g);
+        return -1;
+    }
+
+    vf = video_frame_create(PIXEL_FORMAT_YUY2, WIDTH, HEIGHT, MEDIA_MEM_DEEP);
+    memset(&frame, 0, sizeof(frame));
+    frame.type = MEDIA_TYPE_VIDEO;
+    for (i = 0; i < FRAMES; i++) {
+        memset(vf->data[0], i, vf->linesize[0] * HEIGHT);
+        vf->timestamp = i * 33333ULL;
+        vf->frame_id = i;
+        memcpy(&frame.video, vf, sizeof(*vf));
+        if (0 == media_stage_emit_frame(src, &frame)) {
+            sent++;
+        }
+        usleep(1000);
+    }
+    media_graph_stop(g, 2000);
+    video_frame_destroy(vf);
+
+    printf("sent %d/%d, file got %d, net got %d\n", sent, FRAMES, fast, slow);
+    media_graph_dump(g, stdout);
+    media_graph_destroy(g);
+    return 0;
+}
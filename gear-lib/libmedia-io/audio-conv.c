@@ -0,0 +1,895 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#include "libmedia-io.h"
+#include "audio-conv.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#if defined (__SSE2__) || defined (_M_X64)
+#include <emmintrin.h>
+#define ACONV_SSE2
+#endif
+#if defined (ACONV_SSE2) && defined (__GNUC__)
+#include <immintrin.h>
+#define ACONV_AVX2
+#define ACONV_TARGET_AVX2   __attribute__((target("avx2")))
+#endif
+#if defined (__ARM_NEON) || defined (__ARM_NEON__)
+#include <arm_neon.h>
+#define ACONV_NEON
+#endif
+
+/* src frames per block, the float scratch of a block stays in L1 */
+#define CONV_BLOCK          256
+
+/* rates that reduce to more phases use the nearest of this many */
+#define RESAMPLE_MAX_PHASES 1024
+#define RESAMPLE_MAX_TAPS   512
+
+#define CONV_PI             3.14159265358979323846
+
+enum conv_type {
+    CONV_S16,
+    CONV_S32,
+    CONV_F32,
+};
+
+static const struct conv_format {
+    enum sample_format format;
+    enum conv_type     type;
+    int                size;
+    int                planar;
+} conv_fmt_tbl[] = {
+    {SAMPLE_FORMAT_PCM_S16LE,        CONV_S16, 2, 0},
+    {SAMPLE_FORMAT_PCM_S32LE,        CONV_S32, 4, 0},
+    {SAMPLE_FORMAT_PCM_F32LE,        CONV_F32, 4, 0},
+    {SAMPLE_FORMAT_PCM_S16LE_PLANAR, CONV_S16, 2, 1},
+    {SAMPLE_FORMAT_PCM_S32LE_PLANAR, CONV_S32, 4, 1},
+    {SAMPLE_FORMAT_PCM_F32LE_PLANAR, CONV_F32, 4, 1},
+};
+
+static const struct conv_format *conv_fmt_find(enum sample_format format)
+{
+    int i;
+    for (i = 0; i < (int)(sizeof(conv_fmt_tbl)/sizeof(conv_fmt_tbl[0])); i++) {
+        if (conv_fmt_tbl[i].format == format) {
+            return &conv_fmt_tbl[i];
+        }
+    }
+    return NULL;
+}
+
+static const struct resample_preset {
+    int    taps;        /* at 1:1, grows with the downsampling ratio */
+    double beta;        /* kaiser window */
+    double rolloff;     /* cutoff relative to the lower nyquist */
+} resample_presets[] = {
+    {16, 5.0, 0.80},
+    {32, 7.0, 0.86},
+    {64, 9.0, 0.91},
+};
+
+struct resampler {
+    int       taps;     /* multiple of 8 */
+    int       phases;
+    uint32_t  num;      /* dst_rate / gcd, phases of an exact ratio */
+    uint32_t  den;      /* src_rate / gcd */
+    uint32_t  step;     /* den / num, whole src frames per dst frame */
+    uint32_t  step_frac;
+    float    *coef;     /* taps weights of each phase */
+    float    *hist[AUDIO_MAX_CHANNELS];
+    int       filled;   /* frames in hist, the same on every channel */
+    int       pos;      /* first tap of the next output */
+    uint32_t  frac;     /* next output is frac / num past pos */
+};
+
+struct audio_conv {
+    struct audio_conv_conf    conf;
+    const struct conv_format *src;
+    const struct conv_format *dst;
+    float                     matrix[AUDIO_MAX_CHANNELS * AUDIO_MAX_CHANNELS];
+    int                       remix;
+    int                       remix_first;  /* downmix before resample */
+    int                       resample;
+    struct resampler          rs;
+    int                       out_cap;      /* most dst frames of a block */
+    float                    *a[AUDIO_MAX_CHANNELS];
+    float                    *b[AUDIO_MAX_CHANNELS];
+    float                    *r[AUDIO_MAX_CHANNELS];
+    float                    *t;            /* interleaved scratch */
+    float                    *scratch;
+    uint64_t                  in_total;
+    uint64_t                  out_total;
+};
+
+struct conv_kernels {
+    enum video_conv_simd simd;
+    void (*s16_to_f32)(const int16_t *s, float *d, int n);
+    void (*f32_to_s16)(const float *s, int16_t *d, int n);
+    void (*s32_to_f32)(const int32_t *s, float *d, int n);
+    void (*f32_to_s32)(const float *s, int32_t *d, int n);
+    void (*mac)(float *d, const float *s, float g, int n);
+    float (*dot)(const float *x, const float *h, int taps);
+};
+
+/******************************************************************************
+ * c kernels, the simd ones below convert to the same samples
+ ******************************************************************************/
+#define S16_SCALE       32768.0f
+#define S32_SCALE       2147483648.0f
+#define S32_MAX_F       2147483520.0f   /* largest float under 2^31 */
+
+static void s16_to_f32_c(const int16_t *s, float *d, int n)
+{
+    int i;
+    for (i = 0; i < n; i++) {
+        d[i] = s[i] * (1.0f / S16_SCALE);
+    }
+}
+
+static void f32_to_s16_c(const float *s, int16_t *d, int n)
+{
+    int i;
+    for (i = 0; i < n; i++) {
+        float v = s[i] * S16_SCALE;
+        v = v > 32767.0f ? 32767.0f : v;
+        v = v < -32768.0f ? -32768.0f : v;
+        d[i] = (int16_t)lrintf(v);
+    }
+}
+
+static void s32_to_f32_c(const int32_t *s, float *d, int n)
+{
+    int i;
+    for (i = 0; i < n; i++) {
+        d[i] = (float)s[i] * (1.0f / S32_SCALE);
+    }
+}
+
+static void f32_to_s32_c(const float *s, int32_t *d, int n)
+{
+    int i;
+    for (i = 0; i < n; i++) {
+        float v = s[i] * S32_SCALE;
+        v = v > S32_MAX_F ? S32_MAX_F : v;
+        v = v < -S32_SCALE ? -S32_SCALE : v;
+        d[i] = (int32_t)lrintf(v);
+    }
+}
+
+static void mac_c(float *d, const float *s, float g, int n)
+{
+    int i;
+    for (i = 0; i < n; i++) {
+        d[i] += g * s[i];
+    }
+}
+
+static float dot_c(const float *x, const float *h, int taps)
+{
+    float sum = 0.0f;
+    int i;
+    for (i = 0; i < taps; i++) {
+        sum += x[i] * h[i];
+    }
+    return sum;
+}
+
+static const struct conv_kernels kern_c = {
+    VIDEO_CONV_C, s16_to_f32_c, f32_to_s16_c, s32_to_f32_c, f32_to_s32_c, mac_c, dot_c,
+};
+
+/******************************************************************************
+ * sse2 kernels
+ ******************************************************************************/
+#if defined (ACONV_SSE2)
+static void s16_to_f32_sse2(const int16_t *s, float *d, int n)
+{
+    const __m128 k = _mm_set1_ps(1.0f / S16_SCALE);
+    int i;
+    for (i = 0; i + 8 <= n; i += 8) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(s + i));
+        __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+        __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+        _mm_storeu_ps(d + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), k));
+        _mm_storeu_ps(d + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), k));
+    }
+    s16_to_f32_c(s + i, d + i, n - i);
+}
+
+static void f32_to_s16_sse2(const float *s, int16_t *d, int n)
+{
+    const __m128 k = _mm_set1_ps(S16_SCALE);
+    const __m128 vmax = _mm_set1_ps(32767.0f);
+    const __m128 vmin = _mm_set1_ps(-32768.0f);
+    int i;
+    for (i = 0; i + 8 <= n; i += 8) {
+        __m128 lo = _mm_mul_ps(_mm_loadu_ps(s + i), k);
+        __m128 hi = _mm_mul_ps(_mm_loadu_ps(s + i + 4), k);
+        lo = _mm_max_ps(_mm_min_ps(lo, vmax), vmin);
+        hi = _mm_max_ps(_mm_min_ps(hi, vmax), vmin);
+        _mm_storeu_si128((__m128i *)(d + i),
+                _mm_packs_epi32(_mm_cvtps_epi32(lo), _mm_cvtps_epi32(hi)));
+    }
+    f32_to_s16_c(s + i, d + i, n - i);
+}
+
+static void s32_to_f32_sse2(const int32_t *s, float *d, int n)
+{
+    const __m128 k = _mm_set1_ps(1.0f / S32_SCALE);
+    int i;
+    for (i = 0; i + 4 <= n; i += 4) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(s + i));
+        _mm_storeu_ps(d + i, _mm_mul_ps(_mm_cvtepi32_ps(x), k));
+    }
+    s32_to_f32_c(s + i, d + i, n - i);
+}
+
+static void f32_to_s32_sse2(const float *s, int32_t *d, int n)
+{
+    const __m128 k = _mm_set1_ps(S32_SCALE);
+    const __m128 vmax = _mm_set1_ps(S32_MAX_F);
+    const __m128 vmin = _mm_set1_ps(-S32_SCALE);
+    int i;
+    for (i = 0; i + 4 <= n; i += 4) {
+        __m128 x = _mm_mul_ps(_mm_loadu_ps(s + i), k);
+        x = _mm_max_ps(_mm_min_ps(x, vmax), vmin);
+        _mm_storeu_si128((__m128i *)(d + i), _mm_cvtps_epi32(x));
+    }
+    f32_to_s32_c(s + i, d + i, n - i);
+}
+
+static void mac_sse2(float *d, const float *s, float g, int n)
+{
+    const __m128 vg = _mm_set1_ps(g);
+    int i;
+    for (i = 0; i + 4 <= n; i += 4) {
+        __m128 x = _mm_mul_ps(_mm_loadu_ps(s + i), vg);
+        _mm_storeu_ps(d + i, _mm_add_ps(_mm_loadu_ps(d + i), x));
+    }
+    mac_c(d + i, s + i, g, n - i);
+}
+
+static float dot_sse2(const float *x, const float *h, int taps)
+{
+    __m128 s0 = _mm_setzero_ps();
+    __m128 s1 = _mm_setzero_ps();
+    int i;
+    for (i = 0; i < taps; i += 8) {
+        s0 = _mm_add_ps(s0, _mm_mul_ps(_mm_loadu_ps(x + i), _mm_loadu_ps(h + i)));
+        s1 = _mm_add_ps(s1, _mm_mul_ps(_mm_loadu_ps(x + i + 4), _mm_loadu_ps(h + i + 4)));
+    }
+    s0 = _mm_add_ps(s0, s1);
+    s0 = _mm_add_ps(s0, _mm_movehl_ps(s0, s0));
+    s0 = _mm_add_ss(s0, _mm_shuffle_ps(s0, s0, 1));
+    return _mm_cvtss_f32(s0);
+}
+
+static const struct conv_kernels kern_sse2 = {
+    VIDEO_CONV_SSE2, s16_to_f32_sse2, f32_to_s16_sse2, s32_to_f32_sse2, f32_to_s32_sse2,
+    mac_sse2, dot_sse2,
+};
+#endif
+
+/******************************************************************************
+ * avx2 kernels, the conversions are load bound and stay sse2
+ ******************************************************************************/
+#if defined (ACONV_AVX2)
+ACONV_TARGET_AVX2
+static void mac_avx2(float *d, const float *s, float g, int n)
+{
+    const __m256 vg = _mm256_set1_ps(g);
+    int i;
+    for (i = 0; i + 8 <= n; i += 8) {
+        __m256 x = _mm256_mul_ps(_mm256_loadu_ps(s + i), vg);
+        _mm256_storeu_ps(d + i, _mm256_add_ps(_mm256_loadu_ps(d + i), x));
+    }
+    mac_c(d + i, s + i, g, n - i);
+}
+
+ACONV_TARGET_AVX2
+static float dot_avx2(const float *x, const float *h, int taps)
+{
+    __m256 s0 = _mm256_setzero_ps();
+    __m128 s;
+    int i;
+    for (i = 0; i < taps; i += 8) {
+        s0 = _mm256_add_ps(s0, _mm256_mul_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(h + i)));
+    }
+    s = _mm_add_ps(_mm256_castps256_ps128(s0), _mm256_extractf128_ps(s0, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+    return _mm_cvtss_f32(s);
+}
+
+static const struct conv_kernels kern_avx2 = {
+    VIDEO_CONV_AVX2, s16_to_f32_sse2, f32_to_s16_sse2, s32_to_f32_sse2, f32_to_s32_sse2,
+    mac_avx2, dot_avx2,
+};
+#endif
+
+/******************************************************************************
+ * neon kernels
+ ******************************************************************************/
+#if defined (ACONV_NEON)
+static void mac_neon(float *d, const float *s, float g, int n)
+{
+    int i;
+    for (i = 0; i + 4 <= n; i += 4) {
+        vst1q_f32(d + i, vmlaq_n_f32(vld1q_f32(d + i), vld1q_f32(s + i), g));
+    }
+    mac_c(d + i, s + i, g, n - i);
+}
+
+static float dot_neon(const float *x, const float *h, int taps)
+{
+    float32x4_t s0 = vdupq_n_f32(0.0f);
+    float32x4_t s1 = vdupq_n_f32(0.0f);
+    int i;
+    for (i = 0; i < taps; i += 8) {
+        s0 = vmlaq_f32(s0, vld1q_f32(x + i), vld1q_f32(h + i));
+        s1 = vmlaq_f32(s1, vld1q_f32(x + i + 4), vld1q_f32(h + i + 4));
+    }
+    s0 = vaddq_f32(s0, s1);
+    return (vgetq_lane_f32(s0, 0) + vgetq_lane_f32(s0, 2)) +
+           (vgetq_lane_f32(s0, 1) + vgetq_lane_f32(s0, 3));
+}
+
+static const struct conv_kernels kern_neon = {
+    VIDEO_CONV_NEON, s16_to_f32_c, f32_to_s16_c, s32_to_f32_c, f32_to_s32_c,
+    mac_neon, dot_neon,
+};
+#endif
+
+/* follows the level of video-conv, so video_conv_simd_limit covers both */
+static const struct conv_kernels *conv_kernels_get(void)
+{
+    enum video_conv_simd simd = video_conv_simd_get();
+#if defined (ACONV_NEON)
+    if (simd >= VIDEO_CONV_NEON) {
+        return &kern_neon;
+    }
+#endif
+#if defined (ACONV_AVX2)
+    if (simd >= VIDEO_CONV_AVX2) {
+        return &kern_avx2;
+    }
+#endif
+#if defined (ACONV_SSE2)
+    if (simd >= VIDEO_CONV_SSE2) {
+        return &kern_sse2;
+    }
+#endif
+    return &kern_c;
+}
+
+/******************************************************************************
+ * resampler filter
+ ******************************************************************************/
+static uint32_t gcd(uint32_t a, uint32_t b)
+{
+    while (b) {
+        uint32_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+/* modified bessel function of the first kind, order 0 */
+static double bessel_i0(double x)
+{
+    double sum = 1.0, term = 1.0, q = x * x / 4.0;
+    int k;
+    for (k = 1; k < 64 && term > sum * 1e-12; k++) {
+        term *= q / ((double)k * k);
+        sum += term;
+    }
+    return sum;
+}
+
+static int resampler_init(struct resampler *rs, const struct audio_conv_conf *conf, int channels)
+{
+    const struct resample_preset *q = &resample_presets[conf->quality];
+    uint32_t g = gcd(conf->src_rate, conf->dst_rate);
+    double ratio = (double)conf->dst_rate / conf->src_rate;
+    double cutoff, i0b;
+    int p, k, ch, half;
+
+    rs->num = conf->dst_rate / g;
+    rs->den = conf->src_rate / g;
+    rs->step = rs->den / rs->num;
+    rs->step_frac = rs->den % rs->num;
+    rs->phases = rs->num > RESAMPLE_MAX_PHASES ? RESAMPLE_MAX_PHASES : (int)rs->num;
+
+    /* keep the transition as wide in dst samples when downsampling */
+    cutoff = 0.5 * q->rolloff * (ratio < 1.0 ? ratio : 1.0);
+    rs->taps = ratio < 1.0 ? (int)(q->taps / ratio + 0.5) : q->taps;
+    rs->taps = (rs->taps + 7) & ~7;
+    if (rs->taps > RESAMPLE_MAX_TAPS) {
+        rs->taps = RESAMPLE_MAX_TAPS;
+    }
+    half = rs->taps / 2;
+
+    rs->coef = calloc((size_t)rs->phases * rs->taps, sizeof(float));
+    if (!rs->coef) {
+        return -1;
+    }
+    i0b = bessel_i0(q->beta);
+    for (p = 0; p < rs->phases; p++) {
+        float *h = rs->coef + (size_t)p * rs->taps;
+        double w[RESAMPLE_MAX_TAPS], sum = 0.0;
+        for (k = 0; k < rs->taps; k++) {
+            /* distance of tap k to the output, in src frames */
+            double d = (k - (half - 1)) - (double)p / rs->phases;
+            double x = d / half;
+            double s = d == 0.0 ? 1.0 : sin(2.0 * CONV_PI * cutoff * d) / (CONV_PI * d) / (2.0 * cutoff);
+            w[k] = x * x >= 1.0 ? 0.0 : s * bessel_i0(q->beta * sqrt(1.0 - x * x)) / i0b;
+            sum += w[k];
+        }
+        /* unity gain at dc in every phase */
+        for (k = 0; k < rs->taps; k++) {
+            h[k] = (float)(w[k] / sum);
+        }
+    }
+
+    for (ch = 0; ch < channels; ch++) {
+        rs->hist[ch] = calloc(rs->taps + CONV_BLOCK, sizeof(float));
+        if (!rs->hist[ch]) {
+            return -1;
+        }
+    }
+    /* half a window of silence puts src frame 0 under the first output */
+    rs->filled = half - 1;
+    rs->pos = 0;
+    rs->frac = 0;
+    return 0;
+}
+
+static void resampler_reset(struct resampler *rs, int channels)
+{
+    int ch;
+    for (ch = 0; ch < channels; ch++) {
+        memset(rs->hist[ch], 0, (rs->taps + CONV_BLOCK) * sizeof(float));
+    }
+    rs->filled = rs->taps / 2 - 1;
+    rs->pos = 0;
+    rs->frac = 0;
+}
+
+static void resampler_deinit(struct resampler *rs)
+{
+    int ch;
+    for (ch = 0; ch < AUDIO_MAX_CHANNELS; ch++) {
+        free(rs->hist[ch]);
+    }
+    free(rs->coef);
+}
+
+/* dst frames ready once n more src frames are in hist */
+static uint64_t resampler_avail(const struct resampler *rs, int n)
+{
+    int64_t last = (int64_t)rs->filled + n - rs->taps - rs->pos;
+    if (last < 0) {
+        return 0;
+    }
+    return (((uint64_t)last + 1) * rs->num - rs->frac + rs->den - 1) / rs->den;
+}
+
+/* appends n frames of every channel and filters out all ready outputs */
+static int resampler_run(const struct conv_kernels *k, struct resampler *rs, int channels,
+                float *const *in, int n, float *const *out)
+{
+    int ch, m = 0, pos = rs->pos;
+    uint32_t frac = rs->frac;
+
+    for (ch = 0; ch < channels; ch++) {
+        memcpy(rs->hist[ch] + rs->filled, in[ch], n * sizeof(float));
+    }
+    rs->filled += n;
+    for (ch = 0; ch < channels; ch++) {
+        const float *hist = rs->hist[ch];
+        float *o = out[ch];
+        m = 0;
+        pos = rs->pos;
+        frac = rs->frac;
+        while (pos + rs->taps <= rs->filled) {
+            uint32_t phase = (rs->phases == (int)rs->num) ? frac :
+                             (uint32_t)((uint64_t)frac * rs->phases / rs->num);
+            o[m++] = k->dot(hist + pos, rs->coef + (size_t)phase * rs->taps, rs->taps);
+            pos += rs->step;
+            frac += rs->step_frac;
+            if (frac >= rs->num) {
+                frac -= rs->num;
+                pos++;
+            }
+        }
+    }
+    /* drop the frames no later output reaches */
+    if (pos >= rs->filled) {
+        rs->pos = pos - rs->filled;
+        rs->filled = 0;
+    } else {
+        for (ch = 0; ch < channels; ch++) {
+            memmove(rs->hist[ch], rs->hist[ch] + pos, (rs->filled - pos) * sizeof(float));
+        }
+        rs->filled -= pos;
+        rs->pos = 0;
+    }
+    rs->frac = frac;
+    return m;
+}
+
+/******************************************************************************
+ * pipeline
+ ******************************************************************************/
+static void to_f32(const struct conv_kernels *k, enum conv_type type, const uint8_t *s, float *d, int n)
+{
+    switch (type) {
+    case CONV_S16:
+        k->s16_to_f32((const int16_t *)s, d, n);
+        break;
+    case CONV_S32:
+        k->s32_to_f32((const int32_t *)s, d, n);
+        break;
+    default:
+        memcpy(d, s, n * sizeof(float));
+        break;
+    }
+}
+
+static void from_f32(const struct conv_kernels *k, enum conv_type type, const float *s, uint8_t *d, int n)
+{
+    switch (type) {
+    case CONV_S16:
+        k->f32_to_s16(s, (int16_t *)d, n);
+        break;
+    case CONV_S32:
+        k->f32_to_s32(s, (int32_t *)d, n);
+        break;
+    default:
+        memcpy(d, s, n * sizeof(float));
+        break;
+    }
+}
+
+/* src frames [off, off + n) to float planes */
+static void unpack(const struct conv_kernels *k, struct audio_conv *c,
+                const uint8_t *const *src, int off, int n)
+{
+    const struct conv_format *f = c->src;
+    int ch, i, channels = c->conf.src_channels;
+    const float *t;
+
+    if (f->planar) {
+        for (ch = 0; ch < channels; ch++) {
+            to_f32(k, f->type, src[ch] + (size_t)off * f->size, c->a[ch], n);
+        }
+        return;
+    }
+    t = (const float *)(src[0] + (size_t)off * channels * f->size);
+    if (f->type != CONV_F32) {
+        to_f32(k, f->type, (const uint8_t *)t, c->t, n * channels);
+        t = c->t;
+    }
+    for (ch = 0; ch < channels; ch++) {
+        float *d = c->a[ch];
+        for (i = 0; i < n; i++) {
+            d[i] = t[i * channels + ch];
+        }
+    }
+}
+
+/* float planes to dst frames [off, off + n) */
+static void pack(const struct conv_kernels *k, struct audio_conv *c, float *const *in,
+                uint8_t *const *dst, int off, int n)
+{
+    const struct conv_format *f = c->dst;
+    int ch, i, channels = c->conf.dst_channels;
+    float *t;
+
+    if (f->planar) {
+        for (ch = 0; ch < channels; ch++) {
+            from_f32(k, f->type, in[ch], dst[ch] + (size_t)off * f->size, n);
+        }
+        return;
+    }
+    t = (f->type == CONV_F32) ? (float *)(dst[0] + (size_t)off * channels * f->size) : c->t;
+    for (ch = 0; ch < channels; ch++) {
+        const float *s = in[ch];
+        for (i = 0; i < n; i++) {
+            t[i * channels + ch] = s[i];
+        }
+    }
+    if (f->type != CONV_F32) {
+        from_f32(k, f->type, t, dst[0] + (size_t)off * channels * f->size, n * channels);
+    }
+}
+
+static void remix(const struct conv_kernels *k, struct audio_conv *c, float *const *in,
+                float *const *out, int n)
+{
+    int o, i, src_ch = c->conf.src_channels;
+
+    for (o = 0; o < c->conf.dst_channels; o++) {
+        const float *g = c->matrix + o * src_ch;
+        memset(out[o], 0, n * sizeof(float));
+        for (i = 0; i < src_ch; i++) {
+            if (g[i] != 0.0f) {
+                k->mac(out[o], in[i], g[i], n);
+            }
+        }
+    }
+}
+
+/* remix and resample n float frames in c->a, returns the frames in *out */
+static int convert_block(const struct conv_kernels *k, struct audio_conv *c, int n, float **out[])
+{
+    float **p = c->a;
+    int m = n;
+
+    if (c->remix && c->remix_first) {
+        remix(k, c, p, c->b, n);
+        p = c->b;
+    }
+    if (c->resample) {
+        m = resampler_run(k, &c->rs, c->remix_first ? c->conf.dst_channels : c->conf.src_channels,
+                          p, n, c->r);
+        p = c->r;
+    }
+    if (c->remix && !c->remix_first) {
+        remix(k, c, p, c->b, m);
+        p = c->b;
+    }
+    *out = p;
+    return m;
+}
+
+static void matrix_default(struct audio_conv *c)
+{
+    int o, i, src_ch = c->conf.src_channels, dst_ch = c->conf.dst_channels;
+
+    for (o = 0; o < dst_ch; o++) {
+        float *g = c->matrix + o * src_ch;
+        if (dst_ch == 1) {
+            for (i = 0; i < src_ch; i++) {
+                g[i] = 1.0f / src_ch;
+            }
+        } else if (src_ch == 1) {
+            /* mono goes to front left and right */
+            g[0] = o < 2 ? 1.0f : 0.0f;
+        } else if (o < src_ch) {
+            g[o] = 1.0f;
+        }
+    }
+}
+
+static int conf_check(const struct audio_conv_conf *c)
+{
+    if (!conv_fmt_find(c->src_format) || !conv_fmt_find(c->dst_format)) {
+        printf("%s:%d %s -> %s not supported\n", __func__, __LINE__,
+               sample_format_to_string(c->src_format), sample_format_to_string(c->dst_format));
+        return -1;
+    }
+    if (!c->src_rate || !c->dst_rate ||
+        c->src_channels < 1 || c->src_channels > AUDIO_MAX_CHANNELS ||
+        c->dst_channels < 1 || c->dst_channels > AUDIO_MAX_CHANNELS ||
+        (int)c->quality < 0 || c->quality > AUDIO_RESAMPLE_HIGH) {
+        printf("%s:%d %uHz %dch -> %uHz %dch not supported\n", __func__, __LINE__,
+               c->src_rate, c->src_channels, c->dst_rate, c->dst_channels);
+        return -1;
+    }
+    return 0;
+}
+
+struct audio_conv *audio_conv_create(const struct audio_conv_conf *conf)
+{
+    struct audio_conv *c;
+    int ch, len, max_ch;
+    float *p;
+
+    if (!conf) {
+        printf("%s:%d invalid paramenters!\n", __func__, __LINE__);
+        return NULL;
+    }
+    if (conf_check(conf) < 0) {
+        return NULL;
+    }
+    c = calloc(1, sizeof(struct audio_conv));
+    if (!c) {
+        printf("malloc audio conv failed!\n");
+        return NULL;
+    }
+    c->conf = *conf;
+    c->conf.matrix = NULL;
+    c->src = conv_fmt_find(conf->src_format);
+    c->dst = conv_fmt_find(conf->dst_format);
+    c->remix = conf->matrix || conf->src_channels != conf->dst_channels;
+    c->remix_first = conf->dst_channels <= conf->src_channels;
+    if (conf->matrix) {
+        memcpy(c->matrix, conf->matrix, conf->src_channels * conf->dst_channels * sizeof(float));
+    } else {
+        matrix_default(c);
+    }
+    c->out_cap = CONV_BLOCK;
+    c->resample = conf->src_rate != conf->dst_rate;
+    if (c->resample) {
+        if (resampler_init(&c->rs, conf, c->remix_first ? conf->dst_channels : conf->src_channels) < 0) {
+            goto fail;
+        }
+        c->out_cap = (int)(((uint64_t)(c->rs.taps + CONV_BLOCK) * c->rs.num) / c->rs.den + 2);
+        if (c->out_cap < CONV_BLOCK) {
+            c->out_cap = CONV_BLOCK;
+        }
+    }
+
+    /* a and b per src and dst channel, r per dst channel, t interleaved */
+    max_ch = conf->src_channels > conf->dst_channels ? conf->src_channels : conf->dst_channels;
+    len = c->out_cap * (max_ch * 3 + max_ch);
+    c->scratch = calloc(len, sizeof(float));
+    if (!c->scratch) {
+        goto fail;
+    }
+    p = c->scratch;
+    for (ch = 0; ch < max_ch; ch++) {
+        c->a[ch] = p;
+        c->b[ch] = p + c->out_cap;
+        c->r[ch] = p + c->out_cap * 2;
+        p += c->out_cap * 3;
+    }
+    c->t = p;
+    return c;
+
+fail:
+    printf("%s:%d alloc resampler failed!\n", __func__, __LINE__);
+    audio_conv_destroy(c);
+    return NULL;
+}
+
+void audio_conv_destroy(struct audio_conv *c)
+{
+    if (!c) {
+        return;
+    }
+    if (c->resample) {
+        resampler_deinit(&c->rs);
+    }
+    free(c->scratch);
+    free(c);
+}
+
+int audio_conv_out_frames(struct audio_conv *c, int src_frames)
+{
+    uint64_t n;
+
+    if (!c || src_frames < 0) {
+        return -1;
+    }
+    if (!c->resample) {
+        return src_frames;
+    }
+    if (src_frames == 0) {
+        /* what a flush writes */
+        n = (c->in_total * c->rs.num + c->rs.den - 1) / c->rs.den - c->out_total;
+    } else {
+        n = resampler_avail(&c->rs, src_frames);
+    }
+    return n > INT32_MAX ? INT32_MAX : (int)n;
+}
+
+int audio_conv_delay(struct audio_conv *c)
+{
+    if (!c) {
+        return -1;
+    }
+    return c->resample ? c->rs.taps / 2 : 0;
+}
+
+/* pads silence until every src frame has its dst frames, then starts over */
+static int conv_flush(const struct conv_kernels *k, struct audio_conv *c,
+                uint8_t *const *dst, int dst_frames)
+{
+    int ch, m, need, out = 0;
+    float **planes;
+
+    need = audio_conv_out_frames(c, 0);
+    if (dst_frames < need) {
+        printf("%s:%d dst holds %d of %d frames\n", __func__, __LINE__, dst_frames, need);
+        return -1;
+    }
+    while (out < need) {
+        for (ch = 0; ch < c->conf.src_channels; ch++) {
+            memset(c->a[ch], 0, CONV_BLOCK * sizeof(float));
+        }
+        m = convert_block(k, c, CONV_BLOCK, &planes);
+        m = m > need - out ? need - out : m;
+        pack(k, c, planes, dst, out, m);
+        out += m;
+    }
+    resampler_reset(&c->rs, c->remix_first ? c->conf.dst_channels : c->conf.src_channels);
+    c->in_total = 0;
+    c->out_total = 0;
+    return out;
+}
+
+int audio_conv_process(struct audio_conv *c, uint8_t *const *dst, int dst_frames,
+                const uint8_t *const *src, int src_frames)
+{
+    const struct conv_kernels *k = conv_kernels_get();
+    int off, n, m, out = 0;
+    float **planes;
+
+    if (!c || !dst || !dst[0] || src_frames < 0) {
+        printf("%s:%d invalid paramenters!\n", __func__, __LINE__);
+        return -1;
+    }
+    if (!src) {
+        return c->resample ? conv_flush(k, c, dst, dst_frames) : 0;
+    }
+    if (src_frames && dst_frames < audio_conv_out_frames(c, src_frames)) {
+        printf("%s:%d dst holds %d of %d frames\n", __func__, __LINE__,
+               dst_frames, audio_conv_out_frames(c, src_frames));
+        return -1;
+    }
+    for (off = 0; off < src_frames; off += n) {
+        n = src_frames - off > CONV_BLOCK ? CONV_BLOCK : src_frames - off;
+        unpack(k, c, src, off, n);
+        m = convert_block(k, c, n, &planes);
+        pack(k, c, planes, dst, out, m);
+        out += m;
+    }
+    c->in_total += src_frames;
+    c->out_total += out;
+    return out;
+}
+
+int audio_conv_frame(struct audio_conv *c, struct audio_frame *dst,
+                const struct audio_frame *src)
+{
+    int64_t shift;
+    int ret;
+
+    if (!c || !dst || !src) {
+        printf("%s:%d invalid paramenters!\n", __func__, __LINE__);
+        return -1;
+    }
+    if (src->format != c->conf.src_format || src->sample_rate != c->conf.src_rate) {
+        printf("%s:%d frame does not match the converter\n", __func__, __LINE__);
+        return -1;
+    }
+    /* the first dst frame lags the first src frame by the held back ones */
+    shift = (int64_t)(c->out_total * 1000000000ULL / c->conf.dst_rate) -
+            (int64_t)(c->in_total * 1000000000ULL / c->conf.src_rate);
+    ret = audio_conv_process(c, dst->data, dst->frames, (const uint8_t *const *)src->data, src->frames);
+    if (ret < 0) {
+        return -1;
+    }
+    dst->frames = ret;
+    dst->format = c->conf.dst_format;
+    dst->sample_rate = c->conf.dst_rate;
+    dst->timestamp = (shift < 0 && src->timestamp < (uint64_t)-shift) ? 0 : src->timestamp + shift;
+    dst->frame_id = src->frame_id;
+    dst->total_size = (uint64_t)ret * c->dst->size * c->conf.dst_channels;
+    return ret;
+}
@@ -0,0 +1,83 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#ifndef AUDIO_CONV_H
+#define AUDIO_CONV_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * streaming sample format conversion, channel remix and resampling.
+ * s16/s32/f32 interleaved or planar in and out, everything in between
+ * is float planar and runs in blocks of 256 src frames so the scratch
+ * stays in cache. the resampler is a polyphase windowed sinc that keeps
+ * its history across calls, so audio can be pushed in any chunk size
+ * and gives the same samples as one big call.
+ * a context is not thread safe, use one per stream
+ */
+enum audio_resample_quality {
+    AUDIO_RESAMPLE_FAST = 0,    /* 16 taps, for voice and low latency */
+    AUDIO_RESAMPLE_MEDIUM,      /* 32 taps */
+    AUDIO_RESAMPLE_HIGH,        /* 64 taps, for music */
+};
+
+struct audio_conv_conf {
+    enum sample_format          src_format;
+    uint32_t                    src_rate;
+    int                         src_channels;
+    enum sample_format          dst_format;
+    uint32_t                    dst_rate;
+    int                         dst_channels;
+    const float                *matrix;     /* dst_channels rows of src_channels gains, or NULL */
+    enum audio_resample_quality quality;
+};
+
+struct audio_conv;
+
+GEAR_API struct audio_conv *audio_conv_create(const struct audio_conv_conf *conf);
+GEAR_API void audio_conv_destroy(struct audio_conv *c);
+
+/* most dst frames the next src_frames may produce */
+GEAR_API int audio_conv_out_frames(struct audio_conv *c, int src_frames);
+
+/* src frames held back by the resampler, as a latency hint */
+GEAR_API int audio_conv_delay(struct audio_conv *c);
+
+/*
+ * converts all src_frames, returns the dst frames written or -1.
+ * dst_frames must hold audio_conv_out_frames(c, src_frames). a NULL src
+ * flushes the held back frames at the end of a stream
+ */
+GEAR_API int audio_conv_process(struct audio_conv *c, uint8_t *const *dst, int dst_frames,
+                const uint8_t *const *src, int src_frames);
+
+/* dst->data is caller owned, dst->frames is its capacity on entry */
+GEAR_API int audio_conv_frame(struct audio_conv *c, struct audio_frame *dst,
+                const struct audio_frame *src);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -49,6 +49,7 @@ static struct sample_format_name sample_fmt_tbl[] = {
     {SAMPLE_FORMAT_PCM_S16BE_PLANAR, "PCM_S16BE_PLANAR"},
     {SAMPLE_FORMAT_PCM_S24LE_PLANAR, "PCM_S24LE_PLANAR"},
     {SAMPLE_FORMAT_PCM_S32LE_PLANAR, "PCM_S32LE_PLANAR"},
+    {SAMPLE_FORMAT_PCM_F32LE_PLANAR, "PCM_F32LE_PLANAR"},
     {SAMPLE_FORMAT_PCM_MAX,          "SAMPLE_FORMAT_PCM_MAX"},
 };
 
@@ -87,7 +88,15 @@ struct audio_packet *audio_packet_create(enum media_mem_type type, void *data, s
     ap->mem_type = type;
     switch (type) {
     case MEDIA_MEM_DEEP:
-        ap->data = memdup(data, len);
+        if (data && len) {
+            ap->buf = media_buffer_alloc(len);
+            if (!ap->buf) {
+                free(ap);
+                return NULL;
+            }
+            memcpy(ap->buf->data, data, len);
+            ap->data = ap->buf->data;
+        }
         ap->size = len;
         break;
     case MEDIA_MEM_SHALLOW:
@@ -105,6 +114,7 @@ struct audio_packet *audio_packet_create(enum media_mem_type type, void *data, s
 void audio_packet_destroy(struct audio_packet *ap)
 {
     if (ap) {
+        media_buffer_unref(ap->buf);
 #if 0
         if (ap->data) {
             free(ap->data);
@@ -120,16 +130,29 @@ struct audio_packet *audio_packet_copy(struct audio_packet *dst, const struct au
         printf("%s invalid paramenters!\n", __func__);
         return NULL;
     }
-    switch (dst->mem_type) {
-    case MEDIA_MEM_SHALLOW:
+    if (src->buf) {
+        /* payload is refcounted, any copy type just takes a reference */
+        if (dst->buf != src->buf) {
+            media_buffer_unref(dst->buf);
+            dst->buf = media_buffer_ref(src->buf);
+        }
         dst->data = src->data;
-        break;
-    case MEDIA_MEM_DEEP:
-        if (!dst->data) {
-            dst->data = calloc(1, src->size);
+    } else {
+        switch (dst->mem_type) {
+        case MEDIA_MEM_SHALLOW:
+            dst->data = src->data;
+            break;
+        case MEDIA_MEM_DEEP:
+            if (!dst->data) {
+                dst->buf = media_buffer_alloc(src->size);
+                if (!dst->buf) {
+                    return NULL;
+                }
+                dst->data = dst->buf->data;
+            }
+            memcpy(dst->data, src->data, src->size);
+            break;
         }
-        memcpy(dst->data, src->data, src->size);
-        break;
     }
     dst->size = src->size;
     dst->pts  = src->pts;
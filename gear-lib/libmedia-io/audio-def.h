@@ -57,6 +57,7 @@ enum sample_format {
     SAMPLE_FORMAT_PCM_S16BE_PLANAR,
     SAMPLE_FORMAT_PCM_S24LE_PLANAR,
     SAMPLE_FORMAT_PCM_S32LE_PLANAR,
+    SAMPLE_FORMAT_PCM_F32LE_PLANAR,
 
     SAMPLE_FORMAT_PCM_MAX,       /**< Upper limit of valid sample types */
 };
@@ -127,6 +128,7 @@ struct audio_packet {
     uint64_t             dts;
     int                  track_idx;
     struct audio_encoder encoder;
+    struct media_buffer *buf;       /* refcounted owner of data, or NULL */
 };
 
 GEAR_API struct audio_packet *audio_packet_create(enum media_mem_type type, void *data, size_t len);
@@ -26,7 +26,7 @@
 
 struct media_packet *media_packet_create(enum media_type type, enum media_mem_type mem_type, void *data, size_t len)
 {
-    struct media_packet *mp = calloc(1, sizeof(struct media_packet));
+    struct media_packet *mp = gear_calloc(sizeof(struct media_packet));
     if (!mp) {
         return NULL;
     }
@@ -61,7 +61,7 @@ void media_packet_destroy(struct media_packet *mp)
         printf("unsupport destroy %d media packet\n", mp->type);
         break;
     }
-    free(mp);
+    gear_free(mp, sizeof(*mp));
 }
 
 struct media_packet *media_packet_copy(const struct media_packet *src, enum media_mem_type mem_type)
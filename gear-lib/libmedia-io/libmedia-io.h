@@ -45,15 +45,21 @@ enum media_type {
  * define media frame or packet memory copy type:
  * MEDIA_MEM_DEEP: data point to the memory alloc by uplayer
  * MEDIA_MEM_SHALLOW: data point to the addr which from hardware or prev stage
+ * when the source has a media_buffer, both copy types share it by reference
+ * and only a source without one is duplicated for MEDIA_MEM_DEEP
  */
 typedef enum media_mem_type {
     MEDIA_MEM_SHALLOW = 0,
     MEDIA_MEM_DEEP,
 } media_mem_type_t;
 
+#include "media-buffer.h"
 #include "audio-def.h"
 #include "video-def.h"
 #include "video-conv.h"
+#include "video-scale.h"
+#include "audio-conv.h"
+#include "media-clock.h"
 
 /*
  * +--------------+
@@ -0,0 +1,359 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#include "libmedia-io.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#if defined (__linux__)
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#define ALIGNMENT 32
+#define HUGE_PAGE_SIZE      (2 * 1024 * 1024)
+#define HUGE_MIN_SIZE       (1024 * 1024)
+#define ALIGN_SIZE(size, align) (((size) + (align - 1)) & (~(align - 1)))
+
+#if defined _ISOC11_SOURCE || __USE_ISOC11 || defined __USE_ISOCXX11 || __ISO_C_VISIBLE >= 2011
+/*
+ * void *aligned_alloc(size_t, size_t) defined in stdlib.h
+ */
+#define aligned_free    free
+#else
+static void *aligned_alloc(size_t alignment, size_t size)
+{
+    long diff;
+    void *ptr = malloc(size + alignment);
+    if (ptr) {
+        diff = ((~(long)ptr) & (alignment - 1)) + 1;
+        ptr = (char *)ptr + diff;
+        ((char *)ptr)[-1] = (char)diff;
+    }
+    return ptr;
+}
+
+static void aligned_free(void *ptr)
+{
+    if (ptr)
+        free((char *)ptr - ((char *)ptr)[-1]);
+}
+#endif
+
+struct media_buffer_pool {
+    pthread_mutex_t      lock;
+    size_t               size;
+    uint32_t             flags;
+    int                  max_free;
+    int                  nfree;
+    struct media_buffer *free_list;
+    bool                 closed;
+    int                  ref_cnt;   /* owner + every buffer out of pool */
+};
+
+static void buffer_default_free(void *opaque, uint8_t *data)
+{
+    aligned_free(data);
+}
+
+static void buffer_free(struct media_buffer *buf)
+{
+    if (buf->free_cb) {
+        buf->free_cb(buf->opaque, buf->data);
+    }
+    free(buf);
+}
+
+struct media_buffer *media_buffer_wrap(uint8_t *data, size_t size,
+                media_buffer_free_cb *free_cb, void *opaque)
+{
+    struct media_buffer *buf = calloc(1, sizeof(struct media_buffer));
+    if (!buf) {
+        printf("malloc media buffer failed!\n");
+        return NULL;
+    }
+    buf->data = data;
+    buf->size = size;
+    buf->ref_cnt = 1;
+    buf->free_cb = free_cb;
+    buf->opaque = opaque;
+    return buf;
+}
+
+struct media_buffer *media_buffer_alloc(size_t size)
+{
+    struct media_buffer *buf;
+    /* aligned_alloc wants a multiple of the alignment, and never 0 */
+    uint8_t *data = aligned_alloc(ALIGNMENT, ALIGN_SIZE(size ? size : 1, ALIGNMENT));
+    if (!data) {
+        printf("malloc media buffer data %zu failed!\n", size);
+        return NULL;
+    }
+    buf = media_buffer_wrap(data, size, buffer_default_free, NULL);
+    if (!buf) {
+        aligned_free(data);
+    }
+    return buf;
+}
+
+#if defined (__linux__)
+static void buffer_mmap_free(void *opaque, uint8_t *data)
+{
+    munmap(data, (size_t)(uintptr_t)opaque);
+}
+
+static uint8_t *buffer_mmap(size_t size, uint32_t flags, size_t *map_len)
+{
+    static bool mlock_warned = false;
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t len = ALIGN_SIZE(size ? size : 1, page);
+    int mflags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE;
+    uint8_t *data = MAP_FAILED;
+
+    if (size < HUGE_MIN_SIZE) {
+        flags &= ~(MEDIA_BUFFER_THP | MEDIA_BUFFER_HUGETLB);
+    }
+    if (flags & (MEDIA_BUFFER_THP | MEDIA_BUFFER_HUGETLB)) {
+        len = ALIGN_SIZE(size, HUGE_PAGE_SIZE);
+    }
+#ifdef MAP_HUGETLB
+    if (flags & MEDIA_BUFFER_HUGETLB) {
+        data = mmap(NULL, len, PROT_READ | PROT_WRITE, mflags | MAP_HUGETLB, -1, 0);
+    }
+#endif
+    if (data == MAP_FAILED && (flags & (MEDIA_BUFFER_THP | MEDIA_BUFFER_HUGETLB))) {
+        /* populate after madvise so the fault path takes huge pages */
+        data = mmap(NULL, len, PROT_READ | PROT_WRITE, mflags & ~MAP_POPULATE, -1, 0);
+        if (data != MAP_FAILED) {
+#ifdef MADV_HUGEPAGE
+            madvise(data, len, MADV_HUGEPAGE);
+#endif
+#ifdef MADV_POPULATE_WRITE
+            if (0 != madvise(data, len, MADV_POPULATE_WRITE))
+#endif
+            memset(data, 0, len);
+        }
+    }
+    if (data == MAP_FAILED) {
+        data = mmap(NULL, len, PROT_READ | PROT_WRITE, mflags, -1, 0);
+    }
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+    if ((flags & MEDIA_BUFFER_MLOCK) && 0 != mlock(data, len) && !mlock_warned) {
+        mlock_warned = true;
+        printf("mlock media buffer failed, check RLIMIT_MEMLOCK\n");
+    }
+    *map_len = len;
+    return data;
+}
+#endif
+
+struct media_buffer *media_buffer_alloc_flags(size_t size, uint32_t flags)
+{
+#if defined (__linux__)
+    struct media_buffer *buf;
+    size_t len;
+    uint8_t *data;
+
+    if (!flags) {
+        return media_buffer_alloc(size);
+    }
+    data = buffer_mmap(size, flags, &len);
+    if (!data) {
+        printf("mmap media buffer data %zu failed!\n", size);
+        return NULL;
+    }
+    buf = media_buffer_wrap(data, size, buffer_mmap_free, (void *)(uintptr_t)len);
+    if (!buf) {
+        munmap(data, len);
+    }
+    return buf;
+#else
+    return media_buffer_alloc(size);
+#endif
+}
+
+struct media_buffer *media_buffer_ref(struct media_buffer *buf)
+{
+    if (buf) {
+        __atomic_add_fetch(&buf->ref_cnt, 1, __ATOMIC_RELAXED);
+    }
+    return buf;
+}
+
+static void pool_unref(struct media_buffer_pool *pool)
+{
+    if (__atomic_sub_fetch(&pool->ref_cnt, 1, __ATOMIC_ACQ_REL) > 0) {
+        return;
+    }
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+}
+
+static void pool_put(struct media_buffer_pool *pool, struct media_buffer *buf)
+{
+    struct media_buffer *drop = NULL;
+
+    pthread_mutex_lock(&pool->lock);
+    if (!pool->closed && pool->nfree < pool->max_free) {
+        buf->next = pool->free_list;
+        pool->free_list = buf;
+        pool->nfree++;
+    } else {
+        drop = buf;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    if (drop) {
+        drop->pool = NULL;
+        buffer_free(drop);
+    }
+    pool_unref(pool);
+}
+
+void media_buffer_unref(struct media_buffer *buf)
+{
+    if (!buf) {
+        return;
+    }
+    if (__atomic_sub_fetch(&buf->ref_cnt, 1, __ATOMIC_ACQ_REL) > 0) {
+        return;
+    }
+    if (buf->pool) {
+        pool_put(buf->pool, buf);
+    } else {
+        buffer_free(buf);
+    }
+}
+
+int media_buffer_ref_count(const struct media_buffer *buf)
+{
+    return buf ? __atomic_load_n(&buf->ref_cnt, __ATOMIC_ACQUIRE) : 0;
+}
+
+bool media_buffer_is_writable(const struct media_buffer *buf)
+{
+    return media_buffer_ref_count(buf) == 1;
+}
+
+struct media_buffer_pool *media_buffer_pool_create(size_t size, int max_free)
+{
+    return media_buffer_pool_create_flags(size, max_free, 0);
+}
+
+struct media_buffer_pool *media_buffer_pool_create_flags(size_t size, int max_free,
+                uint32_t flags)
+{
+    struct media_buffer_pool *pool = calloc(1, sizeof(struct media_buffer_pool));
+    if (!pool) {
+        printf("malloc media buffer pool failed!\n");
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pool->size = size;
+    pool->flags = flags;
+    pool->max_free = max_free;
+    pool->ref_cnt = 1;
+    return pool;
+}
+
+void media_buffer_pool_destroy(struct media_buffer_pool *pool)
+{
+    struct media_buffer *buf, *next;
+
+    if (!pool) {
+        return;
+    }
+    pthread_mutex_lock(&pool->lock);
+    pool->closed = true;
+    buf = pool->free_list;
+    pool->free_list = NULL;
+    pool->nfree = 0;
+    pthread_mutex_unlock(&pool->lock);
+    for (; buf; buf = next) {
+        next = buf->next;
+        buffer_free(buf);
+    }
+    pool_unref(pool);
+}
+
+struct media_buffer *media_buffer_pool_get(struct media_buffer_pool *pool)
+{
+    struct media_buffer *buf;
+
+    if (!pool) {
+        return NULL;
+    }
+    pthread_mutex_lock(&pool->lock);
+    buf = pool->free_list;
+    if (buf) {
+        pool->free_list = buf->next;
+        pool->nfree--;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    if (!buf) {
+        buf = media_buffer_alloc_flags(pool->size, pool->flags);
+        if (!buf) {
+            return NULL;
+        }
+        buf->pool = pool;
+    }
+    buf->next = NULL;
+    buf->ref_cnt = 1;
+    __atomic_add_fetch(&pool->ref_cnt, 1, __ATOMIC_RELAXED);
+    return buf;
+}
+
+int media_buffer_pool_prealloc(struct media_buffer_pool *pool, int n)
+{
+    struct media_buffer *buf;
+    int added = 0;
+
+    if (!pool) {
+        return -1;
+    }
+    n = n < pool->max_free ? n : pool->max_free;
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        if (pool->closed || pool->nfree >= n) {
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+        pthread_mutex_unlock(&pool->lock);
+        buf = media_buffer_alloc_flags(pool->size, pool->flags);
+        if (!buf) {
+            return -1;
+        }
+        buf->pool = pool;
+        buf->ref_cnt = 1;
+        /* goes to the free list like a returned buffer */
+        __atomic_add_fetch(&pool->ref_cnt, 1, __ATOMIC_RELAXED);
+        media_buffer_unref(buf);
+        added++;
+    }
+    return added;
+}
+
+size_t media_buffer_pool_size(const struct media_buffer_pool *pool)
+{
+    return pool ? pool->size : 0;
+}
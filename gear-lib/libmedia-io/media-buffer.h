@@ -0,0 +1,97 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#ifndef MEDIA_BUFFER_H
+#define MEDIA_BUFFER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * refcounted memory under video_frame, video_packet and audio_packet.
+ * frames and packets sharing one buffer see the same bytes, the memory is
+ * released (or given back to its pool) when the last reference is dropped.
+ * a buffer with more than one reference is read only
+ */
+typedef void (media_buffer_free_cb)(void *opaque, uint8_t *data);
+
+struct media_buffer_pool;
+
+struct media_buffer {
+    uint8_t                  *data;
+    size_t                    size;
+    int                       ref_cnt;
+    media_buffer_free_cb     *free_cb;
+    void                     *opaque;
+    struct media_buffer_pool *pool;
+    struct media_buffer      *next;     /* free list of pool */
+};
+
+/*
+ * alloc owns 32 bytes aligned memory, wrap takes data from outside and
+ * calls free_cb(opaque, data) on last unref, free_cb NULL leaves data alone
+ */
+GEAR_API struct media_buffer *media_buffer_alloc(size_t size);
+
+/*
+ * memory options for large buffers (linux, ignored elsewhere), the memory
+ * is mmap-ed and prefaulted, so the first write on a hot path never faults.
+ * THP asks for transparent huge pages, HUGETLB takes reserved hugetlbfs
+ * pages and falls back to THP when none are left, both only for buffers of
+ * at least 1MB. MLOCK locks the pages so they never swap, a failed mlock
+ * (RLIMIT_MEMLOCK) is reported once and the buffer is kept unlocked
+ */
+#define MEDIA_BUFFER_THP        (1 << 0)
+#define MEDIA_BUFFER_HUGETLB    (1 << 1)
+#define MEDIA_BUFFER_MLOCK      (1 << 2)
+
+GEAR_API struct media_buffer *media_buffer_alloc_flags(size_t size, uint32_t flags);
+GEAR_API struct media_buffer *media_buffer_wrap(uint8_t *data, size_t size,
+                media_buffer_free_cb *free_cb, void *opaque);
+GEAR_API struct media_buffer *media_buffer_ref(struct media_buffer *buf);
+GEAR_API void media_buffer_unref(struct media_buffer *buf);
+GEAR_API int media_buffer_ref_count(const struct media_buffer *buf);
+GEAR_API bool media_buffer_is_writable(const struct media_buffer *buf);
+
+/*
+ * pool of same size buffers, unref of the last reference puts a buffer back
+ * on the free list, at most max_free are kept. destroy may be called while
+ * buffers are out, the pool is freed with the last of them
+ */
+GEAR_API struct media_buffer_pool *media_buffer_pool_create(size_t size, int max_free);
+/* buffers of the pool are allocated with MEDIA_BUFFER_* flags */
+GEAR_API struct media_buffer_pool *media_buffer_pool_create_flags(size_t size, int max_free,
+                uint32_t flags);
+/* fill the free list up to n buffers now, e.g. before capture starts */
+GEAR_API int media_buffer_pool_prealloc(struct media_buffer_pool *pool, int n);
+GEAR_API void media_buffer_pool_destroy(struct media_buffer_pool *pool);
+GEAR_API struct media_buffer *media_buffer_pool_get(struct media_buffer_pool *pool);
+GEAR_API size_t media_buffer_pool_size(const struct media_buffer_pool *pool);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,274 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#include "libmedia-io.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#define NSEC_PER_SEC        1000000000LL
+
+/* each packet moves the smoothed dts by 1/8 of its error */
+#define CLOCK_SMOOTH_SHIFT  3
+
+static const rational_t tb_ns = {1, NSEC_PER_SEC};
+
+struct clock_track {
+    struct media_clock_track_conf conf;
+    bool     started;
+    int64_t  dur_ns;        /* conf duration, or learned */
+    bool     learn;
+    int64_t  last_in;       /* last input dts, ns */
+    int64_t  next_in;       /* input dts expected next */
+    int64_t  offset;        /* sum of the jumps taken out */
+    int64_t  next;          /* output dts expected next, ns from epoch */
+    int64_t  last_dts;      /* out_timebase */
+    struct media_clock_stats stats;
+};
+
+struct media_clock {
+    pthread_mutex_t    lock;
+    uint64_t           max_gap_ns;
+    bool               started;
+    int64_t            epoch;
+    int                tracks;
+    struct clock_track track[MEDIA_CLOCK_TRACK_MAX];
+};
+
+int64_t media_ts_rescale(int64_t val, rational_t from, rational_t to)
+{
+    int64_t b = (int64_t)from.num * to.den;
+    int64_t c = (int64_t)from.den * to.num;
+
+    if (!c) {
+        return 0;
+    }
+    if (c < 0) {
+        b = -b;
+        c = -c;
+    }
+#if defined (__SIZEOF_INT128__)
+    {
+        __int128 p = (__int128)val * b;
+        p += p < 0 ? -(c / 2) : c / 2;
+        return (int64_t)(p / c);
+    }
+#else
+    {
+        long double p = (long double)val * b / c;
+        return (int64_t)(p < 0 ? p - 0.5 : p + 0.5);
+    }
+#endif
+}
+
+static bool rational_valid(rational_t r)
+{
+    return r.num > 0 && r.den > 0;
+}
+
+struct media_clock *media_clock_create(uint64_t max_gap_ns)
+{
+    struct media_clock *c = calloc(1, sizeof(struct media_clock));
+    if (!c) {
+        printf("malloc media_clock failed!\n");
+        return NULL;
+    }
+    c->max_gap_ns = max_gap_ns ? max_gap_ns : MEDIA_CLOCK_MAX_GAP_NS;
+    pthread_mutex_init(&c->lock, NULL);
+    return c;
+}
+
+void media_clock_destroy(struct media_clock *c)
+{
+    if (!c) {
+        return;
+    }
+    pthread_mutex_destroy(&c->lock);
+    free(c);
+}
+
+int media_clock_add_track(struct media_clock *c, const struct media_clock_track_conf *conf)
+{
+    struct clock_track *t;
+    int idx;
+
+    if (!c || !conf || !rational_valid(conf->in_timebase) || !rational_valid(conf->out_timebase)) {
+        printf("%s:%d invalid paramenters!\n", __func__, __LINE__);
+        return -1;
+    }
+    pthread_mutex_lock(&c->lock);
+    if (c->tracks >= MEDIA_CLOCK_TRACK_MAX) {
+        pthread_mutex_unlock(&c->lock);
+        printf("%s:%d too many tracks!\n", __func__, __LINE__);
+        return -1;
+    }
+    idx = c->tracks++;
+    t = &c->track[idx];
+    memset(t, 0, sizeof(*t));
+    t->conf = *conf;
+    t->learn = !rational_valid(conf->duration);
+    if (!t->learn) {
+        t->dur_ns = media_ts_rescale(1, conf->duration, tb_ns);
+    }
+    pthread_mutex_unlock(&c->lock);
+    return idx;
+}
+
+void media_clock_reset(struct media_clock *c)
+{
+    int i;
+
+    if (!c) {
+        return;
+    }
+    pthread_mutex_lock(&c->lock);
+    c->started = false;
+    for (i = 0; i < c->tracks; i++) {
+        c->track[i].started = false;
+        c->track[i].offset = 0;
+    }
+    pthread_mutex_unlock(&c->lock);
+}
+
+/* smoothed output dts in ns from the epoch */
+static int64_t track_advance(struct media_clock *c, struct clock_track *t, int64_t in, int64_t dur)
+{
+    int64_t step, out, err;
+
+    if (!t->started) {
+        t->started = true;
+        t->last_in = in;
+        t->next_in = in + dur;
+        t->next = in - c->epoch + dur;
+        return in - c->epoch;
+    }
+    step = in - t->last_in;
+    if (step < 0 || (uint64_t)step > c->max_gap_ns) {
+        /* the source clock jumped, carry on right after the last packet */
+        t->offset += t->next_in - in;
+        t->stats.discontinuities++;
+    } else if (t->learn && step > 0) {
+        t->dur_ns = t->dur_ns ? t->dur_ns + ((step - t->dur_ns) >> CLOCK_SMOOTH_SHIFT) : step;
+    }
+    t->last_in = in;
+    if (!dur) {
+        dur = t->dur_ns;
+    }
+    t->next_in = in + dur;
+
+    out = in + t->offset - c->epoch;
+    err = out - t->next;
+    /* jitter is smoothed, a gap of dropped packets is kept */
+    if (t->dur_ns && err <= t->dur_ns && err >= -t->dur_ns) {
+        out = t->next + err / (1 << CLOCK_SMOOTH_SHIFT);
+    }
+    t->stats.drift_ns = in + t->offset - c->epoch - out;
+    t->next = out + dur;
+    return out;
+}
+
+int media_clock_stamp(struct media_clock *c, int track, int64_t pts, int64_t dts,
+                int64_t duration, int64_t *out_pts, int64_t *out_dts)
+{
+    struct clock_track *t;
+    int64_t in, cto, dur, ns, odts, opts;
+
+    if (!c || track < 0 || track >= c->tracks || !out_pts || !out_dts) {
+        return -1;
+    }
+    t = &c->track[track];
+    in = media_ts_rescale(dts, t->conf.in_timebase, tb_ns);
+    cto = media_ts_rescale(pts - dts, t->conf.in_timebase, tb_ns);
+    dur = duration > 0 ? media_ts_rescale(duration, t->conf.in_timebase, tb_ns) : 0;
+
+    pthread_mutex_lock(&c->lock);
+    if (!c->started) {
+        c->started = true;
+        c->epoch = in;
+    }
+    if (!dur) {
+        dur = t->dur_ns;
+    }
+    ns = track_advance(c, t, in, dur);
+    odts = media_ts_rescale(ns, tb_ns, t->conf.out_timebase);
+    if (t->stats.packets && odts <= t->last_dts) {
+        odts = t->last_dts + 1;
+        t->stats.corrected++;
+    } else if (odts < 0) {
+        /* started before the epoch set by another track */
+        odts = 0;
+        t->stats.corrected++;
+    }
+    opts = odts + media_ts_rescale(cto, tb_ns, t->conf.out_timebase);
+    if (opts < odts) {
+        opts = odts;
+    }
+    t->last_dts = odts;
+    t->stats.packets++;
+    pthread_mutex_unlock(&c->lock);
+
+    *out_pts = opts;
+    *out_dts = odts;
+    return 0;
+}
+
+int media_clock_stamp_packet(struct media_clock *c, int track, struct media_packet *pkt)
+{
+    int64_t pts, dts;
+
+    if (!c || !pkt || track < 0 || track >= c->tracks) {
+        return -1;
+    }
+    switch (pkt->type) {
+    case MEDIA_TYPE_VIDEO:
+        if (media_clock_stamp(c, track, pkt->video->pts, pkt->video->dts, 0, &pts, &dts) < 0) {
+            return -1;
+        }
+        pkt->video->pts = pts;
+        pkt->video->dts = dts;
+        pkt->video->encoder.timebase = c->track[track].conf.out_timebase;
+        break;
+    case MEDIA_TYPE_AUDIO:
+        if (media_clock_stamp(c, track, pkt->audio->pts, pkt->audio->dts, 0, &pts, &dts) < 0) {
+            return -1;
+        }
+        pkt->audio->pts = pts;
+        pkt->audio->dts = dts;
+        pkt->audio->encoder.timebase = c->track[track].conf.out_timebase;
+        break;
+    default:
+        return -1;
+    }
+    return 0;
+}
+
+int media_clock_stats(struct media_clock *c, int track, struct media_clock_stats *stats)
+{
+    if (!c || !stats || track < 0 || track >= c->tracks) {
+        return -1;
+    }
+    pthread_mutex_lock(&c->lock);
+    *stats = c->track[track].stats;
+    pthread_mutex_unlock(&c->lock);
+    return 0;
+}
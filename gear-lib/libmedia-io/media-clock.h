@@ -0,0 +1,87 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#ifndef MEDIA_CLOCK_H
+#define MEDIA_CLOCK_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * timestamp normalization of the streams of one session. each track maps
+ * its pts/dts (capture ns, or ticks of an encoder timebase) onto its own
+ * output timebase, with zero at the first dts seen on any track, so audio
+ * and video keep their offset. per track:
+ *  - jitter within one packet duration of the expected dts is smoothed,
+ *    a real gap (dropped frames) is kept as is
+ *  - a dts going back or jumping over max_gap_ns is a discontinuity, the
+ *    track goes on one duration after its last packet
+ *  - output dts grows strictly and pts is never before dts
+ * stamp each packet once, before it fans out, muxers take it as is.
+ * all calls are thread safe, audio and video may stamp from own threads
+ */
+#define MEDIA_CLOCK_TRACK_MAX   8
+#define MEDIA_CLOCK_MAX_GAP_NS  1000000000ULL
+
+struct media_clock_track_conf {
+    rational_t in_timebase;     /* {1, 1000000000} for capture ns */
+    rational_t out_timebase;    /* {1, 1000} for flv, {1, 90000} for rtp */
+    rational_t duration;        /* seconds per packet, {0, 0} learns it */
+};
+
+struct media_clock_stats {
+    uint64_t packets;
+    uint64_t discontinuities;
+    uint64_t corrected;         /* dts bumped to stay monotonic */
+    int64_t  drift_ns;          /* last input minus smoothed output */
+};
+
+struct media_clock;
+struct media_packet;
+
+/* max_gap_ns 0 takes MEDIA_CLOCK_MAX_GAP_NS */
+GEAR_API struct media_clock *media_clock_create(uint64_t max_gap_ns);
+GEAR_API void media_clock_destroy(struct media_clock *c);
+GEAR_API int media_clock_add_track(struct media_clock *c, const struct media_clock_track_conf *conf);
+/* the next packet starts a new epoch on every track */
+GEAR_API void media_clock_reset(struct media_clock *c);
+
+/*
+ * pts and dts in the in_timebase of track, duration of this packet in the
+ * same units or 0 for the track default. returns 0 and the output pts/dts
+ */
+GEAR_API int media_clock_stamp(struct media_clock *c, int track, int64_t pts, int64_t dts,
+                int64_t duration, int64_t *out_pts, int64_t *out_dts);
+
+/* stamps pts/dts of the packet in place and sets its out_timebase */
+GEAR_API int media_clock_stamp_packet(struct media_clock *c, int track, struct media_packet *pkt);
+GEAR_API int media_clock_stats(struct media_clock *c, int track, struct media_clock_stats *stats);
+
+/* val * from / to rounded to nearest, without overflow of the product */
+GEAR_API int64_t media_ts_rescale(int64_t val, rational_t from, rational_t to);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
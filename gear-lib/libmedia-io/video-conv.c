@@ -1,34 +1,983 @@
-
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
 #include "libmedia-io.h"
 #include "video-conv.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#ifdef ENABLE_WORKQ
+#include <libworkq.h>
+#endif
+
+/*
+ * sse2 is baseline on x86_64, ssse3 and avx2 are picked at runtime with
+ * gcc/clang target attribute, neon when the compiler targets it
+ */
+#if defined (__SSE2__) || defined (_M_X64)
+#include <emmintrin.h>
+#define CONV_SSE2
+#endif
+#if defined (CONV_SSE2) && defined (__GNUC__)
+#include <tmmintrin.h>
+#include <immintrin.h>
+#define CONV_SSSE3
+#define CONV_AVX2
+#define CONV_TARGET_SSSE3   __attribute__((target("ssse3")))
+#define CONV_TARGET_AVX2    __attribute__((target("avx2")))
+#endif
+#if defined (__ARM_NEON) || defined (__ARM_NEON__)
+#include <arm_neon.h>
+#define CONV_NEON
+#endif
+
+/*
+ * bt.601 limited range. yuv -> rgb has 6 fraction bits in int16:
+ *   y' = (y - 16) * 75 + 32
+ *   r = (y' + 102 * v) >> 6
+ *   g = (y' - 25 * u - 52 * v) >> 6
+ *   b = (y' + 129 * u) >> 6, simd saturates the sum, still > 255
+ * rgb -> yuv has 8 fraction bits, chroma from the mean of 2x2 pixels
+ */
+#define YC  75
+#define RV  102
+#define GU  25
+#define GV  52
+#define BU  129
+
+struct conv_kernels {
+    enum video_conv_simd simd;
+    /* off is 0 for YUY2 and 1 for UYVY, the byte of Y in a pair */
+    void (*p422_y)(const uint8_t *s, uint8_t *y, int w, int off);
+    void (*p422_uv)(const uint8_t *s0, const uint8_t *s1, uint8_t *uv, int w, int off);
+    void (*p422_u_v)(const uint8_t *s0, const uint8_t *s1, uint8_t *u, uint8_t *v, int w, int off);
+    void (*split_uv)(const uint8_t *uv, uint8_t *u, uint8_t *v, int n);
+    void (*merge_uv)(const uint8_t *u, const uint8_t *v, uint8_t *uv, int n);
+    void (*yuv_rgba)(const uint8_t *y, const uint8_t *u, const uint8_t *v, uint8_t *d, int w, int bgra);
+    void (*rgb24_y)(const uint8_t *s, uint8_t *y, int w);
+    void (*rgb24_uv)(const uint8_t *s0, const uint8_t *s1, uint8_t *u, uint8_t *v, int w);
+};
+
+static inline uint8_t clamp255(int x)
+{
+    return x < 0 ? 0 : (x > 255 ? 255 : x);
+}
+
+/******************************************************************************
+ * c
+ ******************************************************************************/
+static void p422_y_c(const uint8_t *s, uint8_t *y, int w, int off)
+{
+    int i;
+    for (i = 0; i < w; i++) {
+        y[i] = s[2 * i + off];
+    }
+}
+
+static void p422_uv_c(const uint8_t *s0, const uint8_t *s1, uint8_t *uv, int w, int off)
+{
+    int i, c = 1 - off;
+    for (i = 0; i < w; i++) {
+        uv[i] = (s0[2 * i + c] + s1[2 * i + c] + 1) >> 1;
+    }
+}
+
+static void p422_u_v_c(const uint8_t *s0, const uint8_t *s1, uint8_t *u, uint8_t *v, int w, int off)
+{
+    int i, c = 1 - off;
+    for (i = 0; i < w / 2; i++) {
+        u[i] = (s0[4 * i + c] + s1[4 * i + c] + 1) >> 1;
+        v[i] = (s0[4 * i + 2 + c] + s1[4 * i + 2 + c] + 1) >> 1;
+    }
+}
+
+static void split_uv_c(const uint8_t *uv, uint8_t *u, uint8_t *v, int n)
+{
+    int i;
+    for (i = 0; i < n; i++) {
+        u[i] = uv[2 * i];
+        v[i] = uv[2 * i + 1];
+    }
+}
+
+static void merge_uv_c(const uint8_t *u, const uint8_t *v, uint8_t *uv, int n)
+{
+    int i;
+    for (i = 0; i < n; i++) {
+        uv[2 * i] = u[i];
+        uv[2 * i + 1] = v[i];
+    }
+}
+
+static void yuv_rgba_c(const uint8_t *y, const uint8_t *u, const uint8_t *v, uint8_t *d, int w, int bgra)
+{
+    int i, yy, uu, vv;
+    int r, b;
+    for (i = 0; i < w; i++) {
+        yy = (y[i] - 16) * YC + 32;
+        uu = u[i >> 1] - 128;
+        vv = v[i >> 1] - 128;
+        r = clamp255((yy + RV * vv) >> 6);
+        b = clamp255((yy + BU * uu) >> 6);
+        d[4 * i + 0] = bgra ? b : r;
+        d[4 * i + 1] = clamp255((yy - GU * uu - GV * vv) >> 6);
+        d[4 * i + 2] = bgra ? r : b;
+        d[4 * i + 3] = 0xff;
+    }
+}
+
+static void rgb24_y_c(const uint8_t *s, uint8_t *y, int w)
+{
+    int i;
+    for (i = 0; i < w; i++) {
+        y[i] = ((66 * s[3 * i] + 129 * s[3 * i + 1] + 25 * s[3 * i + 2] + 128) >> 8) + 16;
+    }
+}
+
+static void rgb24_uv_c(const uint8_t *s0, const uint8_t *s1, uint8_t *u, uint8_t *v, int w)
+{
+    int i, r, g, b;
+    for (i = 0; i < w / 2; i++) {
+        r = (s0[6 * i + 0] + s0[6 * i + 3] + s1[6 * i + 0] + s1[6 * i + 3] + 2) >> 2;
+        g = (s0[6 * i + 1] + s0[6 * i + 4] + s1[6 * i + 1] + s1[6 * i + 4] + 2) >> 2;
+        b = (s0[6 * i + 2] + s0[6 * i + 5] + s1[6 * i + 2] + s1[6 * i + 5] + 2) >> 2;
+        u[i] = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+        v[i] = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+    }
+}
+
+static const struct conv_kernels kern_c = {
+    VIDEO_CONV_C,
+    p422_y_c, p422_uv_c, p422_u_v_c, split_uv_c, merge_uv_c,
+    yuv_rgba_c, rgb24_y_c, rgb24_uv_c,
+};
+
+/******************************************************************************
+ * sse2
+ ******************************************************************************/
+#if defined (CONV_SSE2)
+/* low or high byte of each 16 bit lane */
+static inline __m128i sse2_byte(__m128i x, int high)
+{
+    return high ? _mm_srli_epi16(x, 8) : _mm_and_si128(x, _mm_set1_epi16(0x00ff));
+}
+
+static void p422_y_sse2(const uint8_t *s, uint8_t *y, int w, int off)
+{
+    __m128i a, b;
+    int i;
+    for (i = 0; i + 16 <= w; i += 16) {
+        a = _mm_loadu_si128((const __m128i *)(s + 2 * i));
+        b = _mm_loadu_si128((const __m128i *)(s + 2 * i + 16));
+        _mm_storeu_si128((__m128i *)(y + i),
+                         _mm_packus_epi16(sse2_byte(a, off), sse2_byte(b, off)));
+    }
+    p422_y_c(s + 2 * i, y + i, w - i, off);
+}
+
+static inline __m128i sse2_uv16(const uint8_t *s0, const uint8_t *s1, int c)
+{
+    __m128i a, b;
+    a = _mm_avg_epu8(_mm_loadu_si128((const __m128i *)s0),
+                     _mm_loadu_si128((const __m128i *)s1));
+    b = _mm_avg_epu8(_mm_loadu_si128((const __m128i *)(s0 + 16)),
+                     _mm_loadu_si128((const __m128i *)(s1 + 16)));
+    return _mm_packus_epi16(sse2_byte(a, c), sse2_byte(b, c));
+}
+
+static void p422_uv_sse2(const uint8_t *s0, const uint8_t *s1, uint8_t *uv, int w, int off)
+{
+    int i;
+    for (i = 0; i + 16 <= w; i += 16) {
+        _mm_storeu_si128((__m128i *)(uv + i), sse2_uv16(s0 + 2 * i, s1 + 2 * i, 1 - off));
+    }
+    p422_uv_c(s0 + 2 * i, s1 + 2 * i, uv + i, w - i, off);
+}
+
+static void p422_u_v_sse2(const uint8_t *s0, const uint8_t *s1, uint8_t *u, uint8_t *v, int w, int off)
+{
+    __m128i a, b;
+    int i;
+    for (i = 0; i + 32 <= w; i += 32) {
+        a = sse2_uv16(s0 + 2 * i, s1 + 2 * i, 1 - off);
+        b = sse2_uv16(s0 + 2 * i + 32, s1 + 2 * i + 32, 1 - off);
+        _mm_storeu_si128((__m128i *)(u + i / 2), _mm_packus_epi16(sse2_byte(a, 0), sse2_byte(b, 0)));
+        _mm_storeu_si128((__m128i *)(v + i / 2), _mm_packus_epi16(sse2_byte(a, 1), sse2_byte(b, 1)));
+    }
+    p422_u_v_c(s0 + 2 * i, s1 + 2 * i, u + i / 2, v + i / 2, w - i, off);
+}
+
+static void split_uv_sse2(const uint8_t *uv, uint8_t *u, uint8_t *v, int n)
+{
+    __m128i a, b;
+    int i;
+    for (i = 0; i + 16 <= n; i += 16) {
+        a = _mm_loadu_si128((const __m128i *)(uv + 2 * i));
+        b = _mm_loadu_si128((const __m128i *)(uv + 2 * i + 16));
+        _mm_storeu_si128((__m128i *)(u + i), _mm_packus_epi16(sse2_byte(a, 0), sse2_byte(b, 0)));
+        _mm_storeu_si128((__m128i *)(v + i), _mm_packus_epi16(sse2_byte(a, 1), sse2_byte(b, 1)));
+    }
+    split_uv_c(uv + 2 * i, u + i, v + i, n - i);
+}
+
+static void merge_uv_sse2(const uint8_t *u, const uint8_t *v, uint8_t *uv, int n)
+{
+    __m128i a, b;
+    int i;
+    for (i = 0; i + 16 <= n; i += 16) {
+        a = _mm_loadu_si128((const __m128i *)(u + i));
+        b = _mm_loadu_si128((const __m128i *)(v + i));
+        _mm_storeu_si128((__m128i *)(uv + 2 * i), _mm_unpacklo_epi8(a, b));
+        _mm_storeu_si128((__m128i *)(uv + 2 * i + 16), _mm_unpackhi_epi8(a, b));
+    }
+    merge_uv_c(u + i, v + i, uv + 2 * i, n - i);
+}
+
+/* 8 pixels, u and v already duplicated per pixel pair */
+static inline void sse2_rgb8(__m128i y, __m128i u, __m128i v, __m128i *r, __m128i *g, __m128i *b)
+{
+    y = _mm_add_epi16(_mm_mullo_epi16(_mm_sub_epi16(y, _mm_set1_epi16(16)),
+                                      _mm_set1_epi16(YC)), _mm_set1_epi16(32));
+    *r = _mm_srai_epi16(_mm_adds_epi16(y, _mm_mullo_epi16(v, _mm_set1_epi16(RV))), 6);
+    *g = _mm_srai_epi16(_mm_sub_epi16(_mm_sub_epi16(y, _mm_mullo_epi16(u, _mm_set1_epi16(GU))),
+                                      _mm_mullo_epi16(v, _mm_set1_epi16(GV))), 6);
+    *b = _mm_srai_epi16(_mm_adds_epi16(y, _mm_mullo_epi16(u, _mm_set1_epi16(BU))), 6);
+}
+
+static void yuv_rgba_sse2(const uint8_t *y, const uint8_t *u, const uint8_t *v, uint8_t *d, int w, int bgra)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i c128 = _mm_set1_epi16(128);
+    __m128i yv, uv, vv, ul, uh, vl, vh;
+    __m128i rl, gl, bl, rh, gh, bh, r, g, b, a, t, rg, ba;
+    int i;
+    a = _mm_set1_epi8((char)0xff);
+    for (i = 0; i + 16 <= w; i += 16) {
+        yv = _mm_loadu_si128((const __m128i *)(y + i));
+        uv = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(u + i / 2)), zero), c128);
+        vv = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(v + i / 2)), zero), c128);
+        ul = _mm_unpacklo_epi16(uv, uv);
+        uh = _mm_unpackhi_epi16(uv, uv);
+        vl = _mm_unpacklo_epi16(vv, vv);
+        vh = _mm_unpackhi_epi16(vv, vv);
+        sse2_rgb8(_mm_unpacklo_epi8(yv, zero), ul, vl, &rl, &gl, &bl);
+        sse2_rgb8(_mm_unpackhi_epi8(yv, zero), uh, vh, &rh, &gh, &bh);
+        r = _mm_packus_epi16(rl, rh);
+        g = _mm_packus_epi16(gl, gh);
+        b = _mm_packus_epi16(bl, bh);
+        if (bgra) {
+            t = r;
+            r = b;
+            b = t;
+        }
+        rg = _mm_unpacklo_epi8(r, g);
+        ba = _mm_unpacklo_epi8(b, a);
+        _mm_storeu_si128((__m128i *)(d + 4 * i), _mm_unpacklo_epi16(rg, ba));
+        _mm_storeu_si128((__m128i *)(d + 4 * i + 16), _mm_unpackhi_epi16(rg, ba));
+        rg = _mm_unpackhi_epi8(r, g);
+        ba = _mm_unpackhi_epi8(b, a);
+        _mm_storeu_si128((__m128i *)(d + 4 * i + 32), _mm_unpacklo_epi16(rg, ba));
+        _mm_storeu_si128((__m128i *)(d + 4 * i + 48), _mm_unpackhi_epi16(rg, ba));
+    }
+    yuv_rgba_c(y + i, u + i / 2, v + i / 2, d + 4 * i, w - i, bgra);
+}
+
+static const struct conv_kernels kern_sse2 = {
+    VIDEO_CONV_SSE2,
+    p422_y_sse2, p422_uv_sse2, p422_u_v_sse2, split_uv_sse2, merge_uv_sse2,
+    yuv_rgba_sse2, rgb24_y_c, rgb24_uv_c,
+};
+#endif
+
+/******************************************************************************
+ * ssse3, rgb24 needs pshufb to gather the channels
+ ******************************************************************************/
+#if defined (CONV_SSSE3)
+/* r, g and b of 16 pixels from 48 bytes */
+CONV_TARGET_SSSE3
+static inline void ssse3_rgb16(const uint8_t *s, __m128i *r, __m128i *g, __m128i *b)
+{
+    const __m128i a0 = _mm_loadu_si128((const __m128i *)s);
+    const __m128i a1 = _mm_loadu_si128((const __m128i *)(s + 16));
+    const __m128i a2 = _mm_loadu_si128((const __m128i *)(s + 32));
+    *r = _mm_or_si128(_mm_or_si128(
+         _mm_shuffle_epi8(a0, _mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+         _mm_shuffle_epi8(a1, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1))),
+         _mm_shuffle_epi8(a2, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13)));
+    *g = _mm_or_si128(_mm_or_si128(
+         _mm_shuffle_epi8(a0, _mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+         _mm_shuffle_epi8(a1, _mm_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1))),
+         _mm_shuffle_epi8(a2, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14)));
+    *b = _mm_or_si128(_mm_or_si128(
+         _mm_shuffle_epi8(a0, _mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+         _mm_shuffle_epi8(a1, _mm_setr_epi8(-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1))),
+         _mm_shuffle_epi8(a2, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15)));
+}
+
+/* sums fit uint16, wrapping mullo is exact */
+CONV_TARGET_SSSE3
+static inline __m128i ssse3_y8(__m128i r, __m128i g, __m128i b)
+{
+    __m128i y = _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(66)),
+                              _mm_mullo_epi16(g, _mm_set1_epi16(129)));
+    y = _mm_add_epi16(y, _mm_add_epi16(_mm_mullo_epi16(b, _mm_set1_epi16(25)), _mm_set1_epi16(128)));
+    return _mm_add_epi16(_mm_srli_epi16(y, 8), _mm_set1_epi16(16));
+}
+
+CONV_TARGET_SSSE3
+static void rgb24_y_ssse3(const uint8_t *s, uint8_t *y, int w)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i r, g, b, lo, hi;
+    int i;
+    for (i = 0; i + 16 <= w; i += 16) {
+        ssse3_rgb16(s + 3 * i, &r, &g, &b);
+        lo = ssse3_y8(_mm_unpacklo_epi8(r, zero), _mm_unpacklo_epi8(g, zero), _mm_unpacklo_epi8(b, zero));
+        hi = ssse3_y8(_mm_unpackhi_epi8(r, zero), _mm_unpackhi_epi8(g, zero), _mm_unpackhi_epi8(b, zero));
+        _mm_storeu_si128((__m128i *)(y + i), _mm_packus_epi16(lo, hi));
+    }
+    rgb24_y_c(s + 3 * i, y + i, w - i);
+}
+
+/* mean of 2x2 for 8 chroma pixels */
+CONV_TARGET_SSSE3
+static inline __m128i ssse3_mean4(__m128i x0, __m128i x1)
+{
+    const __m128i m = _mm_set1_epi16(0x00ff);
+    __m128i s = _mm_add_epi16(_mm_and_si128(x0, m), _mm_srli_epi16(x0, 8));
+    s = _mm_add_epi16(s, _mm_add_epi16(_mm_and_si128(x1, m), _mm_srli_epi16(x1, 8)));
+    return _mm_srli_epi16(_mm_add_epi16(s, _mm_set1_epi16(2)), 2);
+}
+
+CONV_TARGET_SSSE3
+static inline __m128i ssse3_chroma8(__m128i r, __m128i g, __m128i b, int cr, int cg, int cb)
+{
+    __m128i c = _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(cr)),
+                              _mm_mullo_epi16(g, _mm_set1_epi16(cg)));
+    c = _mm_add_epi16(c, _mm_add_epi16(_mm_mullo_epi16(b, _mm_set1_epi16(cb)), _mm_set1_epi16(128)));
+    c = _mm_add_epi16(_mm_srai_epi16(c, 8), _mm_set1_epi16(128));
+    return _mm_packus_epi16(c, c);
+}
+
+CONV_TARGET_SSSE3
+static void rgb24_uv_ssse3(const uint8_t *s0, const uint8_t *s1, uint8_t *u, uint8_t *v, int w)
+{
+    __m128i r0, g0, b0, r1, g1, b1, r, g, b;
+    int i;
+    for (i = 0; i + 16 <= w; i += 16) {
+        ssse3_rgb16(s0 + 3 * i, &r0, &g0, &b0);
+        ssse3_rgb16(s1 + 3 * i, &r1, &g1, &b1);
+        r = ssse3_mean4(r0, r1);
+        g = ssse3_mean4(g0, g1);
+        b = ssse3_mean4(b0, b1);
+        _mm_storel_epi64((__m128i *)(u + i / 2), ssse3_chroma8(r, g, b, -38, -74, 112));
+        _mm_storel_epi64((__m128i *)(v + i / 2), ssse3_chroma8(r, g, b, 112, -94, -18));
+    }
+    rgb24_uv_c(s0 + 3 * i, s1 + 3 * i, u + i / 2, v + i / 2, w - i);
+}
+
+static const struct conv_kernels kern_ssse3 = {
+    VIDEO_CONV_SSSE3,
+    p422_y_sse2, p422_uv_sse2, p422_u_v_sse2, split_uv_sse2, merge_uv_sse2,
+    yuv_rgba_sse2, rgb24_y_ssse3, rgb24_uv_ssse3,
+};
+#endif
+
+/******************************************************************************
+ * avx2, packs work per 128 bit lane, 0xd8 puts the 64 bit halves in order
+ ******************************************************************************/
+#if defined (CONV_AVX2)
+CONV_TARGET_AVX2
+static inline __m256i avx2_byte(__m256i x, int high)
+{
+    return high ? _mm256_srli_epi16(x, 8) : _mm256_and_si256(x, _mm256_set1_epi16(0x00ff));
+}
+
+CONV_TARGET_AVX2
+static inline __m256i avx2_pack(__m256i a, __m256i b)
+{
+    return _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xd8);
+}
+
+CONV_TARGET_AVX2
+static void p422_y_avx2(const uint8_t *s, uint8_t *y, int w, int off)
+{
+    __m256i a, b;
+    int i;
+    for (i = 0; i + 32 <= w; i += 32) {
+        a = _mm256_loadu_si256((const __m256i *)(s + 2 * i));
+        b = _mm256_loadu_si256((const __m256i *)(s + 2 * i + 32));
+        _mm256_storeu_si256((__m256i *)(y + i), avx2_pack(avx2_byte(a, off), avx2_byte(b, off)));
+    }
+    p422_y_sse2(s + 2 * i, y + i, w - i, off);
+}
+
+CONV_TARGET_AVX2
+static inline __m256i avx2_uv32(const uint8_t *s0, const uint8_t *s1, int c)
+{
+    __m256i a, b;
+    a = _mm256_avg_epu8(_mm256_loadu_si256((const __m256i *)s0),
+                        _mm256_loadu_si256((const __m256i *)s1));
+    b = _mm256_avg_epu8(_mm256_loadu_si256((const __m256i *)(s0 + 32)),
+                        _mm256_loadu_si256((const __m256i *)(s1 + 32)));
+    return avx2_pack(avx2_byte(a, c), avx2_byte(b, c));
+}
+
+CONV_TARGET_AVX2
+static void p422_uv_avx2(const uint8_t *s0, const uint8_t *s1, uint8_t *uv, int w, int off)
+{
+    int i;
+    for (i = 0; i + 32 <= w; i += 32) {
+        _mm256_storeu_si256((__m256i *)(uv + i), avx2_uv32(s0 + 2 * i, s1 + 2 * i, 1 - off));
+    }
+    p422_uv_sse2(s0 + 2 * i, s1 + 2 * i, uv + i, w - i, off);
+}
+
+CONV_TARGET_AVX2
+static void p422_u_v_avx2(const uint8_t *s0, const uint8_t *s1, uint8_t *u, uint8_t *v, int w, int off)
+{
+    __m256i a, b;
+    int i;
+    for (i = 0; i + 64 <= w; i += 64) {
+        a = avx2_uv32(s0 + 2 * i, s1 + 2 * i, 1 - off);
+        b = avx2_uv32(s0 + 2 * i + 64, s1 + 2 * i + 64, 1 - off);
+        _mm256_storeu_si256((__m256i *)(u + i / 2), avx2_pack(avx2_byte(a, 0), avx2_byte(b, 0)));
+        _mm256_storeu_si256((__m256i *)(v + i / 2), avx2_pack(avx2_byte(a, 1), avx2_byte(b, 1)));
+    }
+    p422_u_v_sse2(s0 + 2 * i, s1 + 2 * i, u + i / 2, v + i / 2, w - i, off);
+}
+
+CONV_TARGET_AVX2
+static void split_uv_avx2(const uint8_t *uv, uint8_t *u, uint8_t *v, int n)
+{
+    __m256i a, b;
+    int i;
+    for (i = 0; i + 32 <= n; i += 32) {
+        a = _mm256_loadu_si256((const __m256i *)(uv + 2 * i));
+        b = _mm256_loadu_si256((const __m256i *)(uv + 2 * i + 32));
+        _mm256_storeu_si256((__m256i *)(u + i), avx2_pack(avx2_byte(a, 0), avx2_byte(b, 0)));
+        _mm256_storeu_si256((__m256i *)(v + i), avx2_pack(avx2_byte(a, 1), avx2_byte(b, 1)));
+    }
+    split_uv_sse2(uv + 2 * i, u + i, v + i, n - i);
+}
+
+CONV_TARGET_AVX2
+static void merge_uv_avx2(const uint8_t *u, const uint8_t *v, uint8_t *uv, int n)
+{
+    __m256i a, b, lo, hi;
+    int i;
+    for (i = 0; i + 32 <= n; i += 32) {
+        a = _mm256_loadu_si256((const __m256i *)(u + i));
+        b = _mm256_loadu_si256((const __m256i *)(v + i));
+        lo = _mm256_unpacklo_epi8(a, b);
+        hi = _mm256_unpackhi_epi8(a, b);
+        _mm256_storeu_si256((__m256i *)(uv + 2 * i), _mm256_permute2x128_si256(lo, hi, 0x20));
+        _mm256_storeu_si256((__m256i *)(uv + 2 * i + 32), _mm256_permute2x128_si256(lo, hi, 0x31));
+    }
+    merge_uv_sse2(u + i, v + i, uv + 2 * i, n - i);
+}
+
+CONV_TARGET_AVX2
+static inline void avx2_rgb16(__m256i y, __m256i u, __m256i v, __m256i *r, __m256i *g, __m256i *b)
+{
+    y = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_sub_epi16(y, _mm256_set1_epi16(16)),
+                                            _mm256_set1_epi16(YC)), _mm256_set1_epi16(32));
+    *r = _mm256_srai_epi16(_mm256_adds_epi16(y, _mm256_mullo_epi16(v, _mm256_set1_epi16(RV))), 6);
+    *g = _mm256_srai_epi16(_mm256_sub_epi16(_mm256_sub_epi16(y, _mm256_mullo_epi16(u, _mm256_set1_epi16(GU))),
+                                            _mm256_mullo_epi16(v, _mm256_set1_epi16(GV))), 6);
+    *b = _mm256_srai_epi16(_mm256_adds_epi16(y, _mm256_mullo_epi16(u, _mm256_set1_epi16(BU))), 6);
+}
+
+/*
+ * the lo/hi unpacks of y give pixels 0-7,16-23 and 8-15,24-31, the per
+ * lane duplicates of u and v line up with them, packus restores the order
+ */
+CONV_TARGET_AVX2
+static void yuv_rgba_avx2(const uint8_t *y, const uint8_t *u, const uint8_t *v, uint8_t *d, int w, int bgra)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i c128 = _mm256_set1_epi16(128);
+    const __m256i a = _mm256_set1_epi8((char)0xff);
+    __m256i yv, uv, vv, rl, gl, bl, rh, gh, bh, r, g, b, t;
+    __m256i rg, ba, p0, p1, p2, p3;
+    int i;
+    for (i = 0; i + 32 <= w; i += 32) {
+        yv = _mm256_loadu_si256((const __m256i *)(y + i));
+        uv = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(u + i / 2))), c128);
+        vv = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(v + i / 2))), c128);
+        avx2_rgb16(_mm256_unpacklo_epi8(yv, zero), _mm256_unpacklo_epi16(uv, uv),
+                   _mm256_unpacklo_epi16(vv, vv), &rl, &gl, &bl);
+        avx2_rgb16(_mm256_unpackhi_epi8(yv, zero), _mm256_unpackhi_epi16(uv, uv),
+                   _mm256_unpackhi_epi16(vv, vv), &rh, &gh, &bh);
+        r = _mm256_packus_epi16(rl, rh);
+        g = _mm256_packus_epi16(gl, gh);
+        b = _mm256_packus_epi16(bl, bh);
+        if (bgra) {
+            t = r;
+            r = b;
+            b = t;
+        }
+        rg = _mm256_unpacklo_epi8(r, g);
+        ba = _mm256_unpacklo_epi8(b, a);
+        p0 = _mm256_unpacklo_epi16(rg, ba);
+        p1 = _mm256_unpackhi_epi16(rg, ba);
+        rg = _mm256_unpackhi_epi8(r, g);
+        ba = _mm256_unpackhi_epi8(b, a);
+        p2 = _mm256_unpacklo_epi16(rg, ba);
+        p3 = _mm256_unpackhi_epi16(rg, ba);
+        _mm256_storeu_si256((__m256i *)(d + 4 * i), _mm256_permute2x128_si256(p0, p1, 0x20));
+        _mm256_storeu_si256((__m256i *)(d + 4 * i + 32), _mm256_permute2x128_si256(p2, p3, 0x20));
+        _mm256_storeu_si256((__m256i *)(d + 4 * i + 64), _mm256_permute2x128_si256(p0, p1, 0x31));
+        _mm256_storeu_si256((__m256i *)(d + 4 * i + 96), _mm256_permute2x128_si256(p2, p3, 0x31));
+    }
+    yuv_rgba_sse2(y + i, u + i / 2, v + i / 2, d + 4 * i, w - i, bgra);
+}
 
+static const struct conv_kernels kern_avx2 = {
+    VIDEO_CONV_AVX2,
+    p422_y_avx2, p422_uv_avx2, p422_u_v_avx2, split_uv_avx2, merge_uv_avx2,
+    yuv_rgba_avx2, rgb24_y_ssse3, rgb24_uv_ssse3,
+};
+#endif
 
-#define YUYV2RGB_2(pyuv, prgb) { \
-    float r = 1.402f * ((pyuv)[3]-128); \
-    float g = -0.34414f * ((pyuv)[1]-128) - 0.71414f * ((pyuv)[3]-128); \
-    float b = 1.772f * ((pyuv)[1]-128); \
-    (prgb)[0] = sat(pyuv[0] + r); \
-    (prgb)[1] = sat(pyuv[0] + g); \
-    (prgb)[2] = sat(pyuv[0] + b); \
-    (prgb)[3] = sat(pyuv[2] + r); \
-    (prgb)[4] = sat(pyuv[2] + g); \
-    (prgb)[5] = sat(pyuv[2] + b); \
-    }
-#define IYUYV2RGB_2(pyuv, prgb) { \
-    int r = (22987 * ((pyuv)[3] - 128)) >> 14; \
-    int g = (-5636 * ((pyuv)[1] - 128) - 11698 * ((pyuv)[3] - 128)) >> 14; \
-    int b = (29049 * ((pyuv)[1] - 128)) >> 14; \
-    (prgb)[0] = sat(*(pyuv) + r); \
-    (prgb)[1] = sat(*(pyuv) + g); \
-    (prgb)[2] = sat(*(pyuv) + b); \
-    (prgb)[3] = sat((pyuv)[2] + r); \
-    (prgb)[4] = sat((pyuv)[2] + g); \
-    (prgb)[5] = sat((pyuv)[2] + b); \
-    }
-#define IYUYV2RGB_16(pyuv, prgb) IYUYV2RGB_8(pyuv, prgb); IYUYV2RGB_8(pyuv + 16, prgb + 24);
-#define IYUYV2RGB_8(pyuv, prgb) IYUYV2RGB_4(pyuv, prgb); IYUYV2RGB_4(pyuv + 8, prgb + 12);
-#define IYUYV2RGB_4(pyuv, prgb) IYUYV2RGB_2(pyuv, prgb); IYUYV2RGB_2(pyuv + 4, prgb + 6);
+/******************************************************************************
+ * neon, structured loads and stores do the (de)interleave
+ ******************************************************************************/
+#if defined (CONV_NEON)
+static void p422_y_neon(const uint8_t *s, uint8_t *y, int w, int off)
+{
+    uint8x16x2_t p;
+    int i;
+    for (i = 0; i + 16 <= w; i += 16) {
+        p = vld2q_u8(s + 2 * i);
+        vst1q_u8(y + i, off ? p.val[1] : p.val[0]);
+    }
+    p422_y_c(s + 2 * i, y + i, w - i, off);
+}
+
+static void p422_uv_neon(const uint8_t *s0, const uint8_t *s1, uint8_t *uv, int w, int off)
+{
+    uint8x16x2_t a, b;
+    int i, c = 1 - off;
+    for (i = 0; i + 16 <= w; i += 16) {
+        a = vld2q_u8(s0 + 2 * i);
+        b = vld2q_u8(s1 + 2 * i);
+        vst1q_u8(uv + i, vrhaddq_u8(a.val[c], b.val[c]));
+    }
+    p422_uv_c(s0 + 2 * i, s1 + 2 * i, uv + i, w - i, off);
+}
+
+static void p422_u_v_neon(const uint8_t *s0, const uint8_t *s1, uint8_t *u, uint8_t *v, int w, int off)
+{
+    uint8x16x4_t a, b;
+    int i, c = 1 - off;
+    for (i = 0; i + 32 <= w; i += 32) {
+        a = vld4q_u8(s0 + 2 * i);
+        b = vld4q_u8(s1 + 2 * i);
+        vst1q_u8(u + i / 2, vrhaddq_u8(a.val[c], b.val[c]));
+        vst1q_u8(v + i / 2, vrhaddq_u8(a.val[2 + c], b.val[2 + c]));
+    }
+    p422_u_v_c(s0 + 2 * i, s1 + 2 * i, u + i / 2, v + i / 2, w - i, off);
+}
+
+static void split_uv_neon(const uint8_t *uv, uint8_t *u, uint8_t *v, int n)
+{
+    uint8x16x2_t p;
+    int i;
+    for (i = 0; i + 16 <= n; i += 16) {
+        p = vld2q_u8(uv + 2 * i);
+        vst1q_u8(u + i, p.val[0]);
+        vst1q_u8(v + i, p.val[1]);
+    }
+    split_uv_c(uv + 2 * i, u + i, v + i, n - i);
+}
+
+static void merge_uv_neon(const uint8_t *u, const uint8_t *v, uint8_t *uv, int n)
+{
+    uint8x16x2_t p;
+    int i;
+    for (i = 0; i + 16 <= n; i += 16) {
+        p.val[0] = vld1q_u8(u + i);
+        p.val[1] = vld1q_u8(v + i);
+        vst2q_u8(uv + 2 * i, p);
+    }
+    merge_uv_c(u + i, v + i, uv + 2 * i, n - i);
+}
+
+static inline void neon_rgb8(uint8x8_t y8, int16x8_t u, int16x8_t v,
+                             uint8x8_t *r, uint8x8_t *g, uint8x8_t *b)
+{
+    int16x8_t y = vreinterpretq_s16_u16(vmovl_u8(y8));
+    y = vaddq_s16(vmulq_n_s16(vsubq_s16(y, vdupq_n_s16(16)), YC), vdupq_n_s16(32));
+    *r = vqmovun_s16(vshrq_n_s16(vqaddq_s16(y, vmulq_n_s16(v, RV)), 6));
+    *g = vqmovun_s16(vshrq_n_s16(vsubq_s16(vsubq_s16(y, vmulq_n_s16(u, GU)), vmulq_n_s16(v, GV)), 6));
+    *b = vqmovun_s16(vshrq_n_s16(vqaddq_s16(y, vmulq_n_s16(u, BU)), 6));
+}
+
+static void yuv_rgba_neon(const uint8_t *y, const uint8_t *u, const uint8_t *v, uint8_t *d, int w, int bgra)
+{
+    uint8x16_t yv;
+    int16x8_t uv, vv;
+    int16x8x2_t ud, vd;
+    uint8x8_t rl, gl, bl, rh, gh, bh;
+    uint8x16x4_t p;
+    int i;
+    p.val[3] = vdupq_n_u8(0xff);
+    for (i = 0; i + 16 <= w; i += 16) {
+        yv = vld1q_u8(y + i);
+        uv = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vld1_u8(u + i / 2))), vdupq_n_s16(128));
+        vv = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vld1_u8(v + i / 2))), vdupq_n_s16(128));
+        ud = vzipq_s16(uv, uv);
+        vd = vzipq_s16(vv, vv);
+        neon_rgb8(vget_low_u8(yv), ud.val[0], vd.val[0], &rl, &gl, &bl);
+        neon_rgb8(vget_high_u8(yv), ud.val[1], vd.val[1], &rh, &gh, &bh);
+        p.val[bgra ? 2 : 0] = vcombine_u8(rl, rh);
+        p.val[1] = vcombine_u8(gl, gh);
+        p.val[bgra ? 0 : 2] = vcombine_u8(bl, bh);
+        vst4q_u8(d + 4 * i, p);
+    }
+    yuv_rgba_c(y + i, u + i / 2, v + i / 2, d + 4 * i, w - i, bgra);
+}
+
+static inline uint8x8_t neon_y8(uint8x8_t r, uint8x8_t g, uint8x8_t b)
+{
+    uint16x8_t y = vmull_u8(r, vdup_n_u8(66));
+    y = vmlal_u8(y, g, vdup_n_u8(129));
+    y = vmlal_u8(y, b, vdup_n_u8(25));
+    return vadd_u8(vshrn_n_u16(vaddq_u16(y, vdupq_n_u16(128)), 8), vdup_n_u8(16));
+}
+
+static void rgb24_y_neon(const uint8_t *s, uint8_t *y, int w)
+{
+    uint8x16x3_t p;
+    int i;
+    for (i = 0; i + 16 <= w; i += 16) {
+        p = vld3q_u8(s + 3 * i);
+        vst1q_u8(y + i, vcombine_u8(
+                 neon_y8(vget_low_u8(p.val[0]), vget_low_u8(p.val[1]), vget_low_u8(p.val[2])),
+                 neon_y8(vget_high_u8(p.val[0]), vget_high_u8(p.val[1]), vget_high_u8(p.val[2]))));
+    }
+    rgb24_y_c(s + 3 * i, y + i, w - i);
+}
+
+static inline int16x8_t neon_mean4(uint8x16_t x0, uint8x16_t x1)
+{
+    uint16x8_t s = vpadalq_u8(vpaddlq_u8(x0), x1);
+    return vreinterpretq_s16_u16(vshrq_n_u16(vaddq_u16(s, vdupq_n_u16(2)), 2));
+}
 
+static inline uint8x8_t neon_chroma8(int16x8_t r, int16x8_t g, int16x8_t b, int cr, int cg, int cb)
+{
+    int16x8_t c = vaddq_s16(vmulq_n_s16(r, cr), vmulq_n_s16(g, cg));
+    c = vaddq_s16(c, vaddq_s16(vmulq_n_s16(b, cb), vdupq_n_s16(128)));
+    return vqmovun_s16(vaddq_s16(vshrq_n_s16(c, 8), vdupq_n_s16(128)));
+}
 
+static void rgb24_uv_neon(const uint8_t *s0, const uint8_t *s1, uint8_t *u, uint8_t *v, int w)
+{
+    uint8x16x3_t a, b;
+    int16x8_t r, g, bl;
+    int i;
+    for (i = 0; i + 16 <= w; i += 16) {
+        a = vld3q_u8(s0 + 3 * i);
+        b = vld3q_u8(s1 + 3 * i);
+        r = neon_mean4(a.val[0], b.val[0]);
+        g = neon_mean4(a.val[1], b.val[1]);
+        bl = neon_mean4(a.val[2], b.val[2]);
+        vst1_u8(u + i / 2, neon_chroma8(r, g, bl, -38, -74, 112));
+        vst1_u8(v + i / 2, neon_chroma8(r, g, bl, 112, -94, -18));
+    }
+    rgb24_uv_c(s0 + 3 * i, s1 + 3 * i, u + i / 2, v + i / 2, w - i);
+}
+
+static const struct conv_kernels kern_neon = {
+    VIDEO_CONV_NEON,
+    p422_y_neon, p422_uv_neon, p422_u_v_neon, split_uv_neon, merge_uv_neon,
+    yuv_rgba_neon, rgb24_y_neon, rgb24_uv_neon,
+};
+#endif
+
+/******************************************************************************
+ * dispatch
+ ******************************************************************************/
+static volatile int conv_simd_max = VIDEO_CONV_NEON;
+
+static const struct conv_kernels *conv_kernels_get(void)
+{
+    int max = conv_simd_max;
+#if defined (CONV_NEON)
+    if (max >= VIDEO_CONV_NEON) {
+        return &kern_neon;
+    }
+#endif
+#if defined (CONV_AVX2)
+    if (max >= VIDEO_CONV_AVX2 && __builtin_cpu_supports("avx2")) {
+        return &kern_avx2;
+    }
+#endif
+#if defined (CONV_SSSE3)
+    if (max >= VIDEO_CONV_SSSE3 && __builtin_cpu_supports("ssse3")) {
+        return &kern_ssse3;
+    }
+#endif
+#if defined (CONV_SSE2)
+    if (max >= VIDEO_CONV_SSE2) {
+        return &kern_sse2;
+    }
+#endif
+    return &kern_c;
+}
+
+enum video_conv_simd video_conv_simd_get(void)
+{
+    return conv_kernels_get()->simd;
+}
+
+void video_conv_simd_limit(enum video_conv_simd max)
+{
+    conv_simd_max = max;
+}
+
+const char *video_conv_simd_to_string(enum video_conv_simd simd)
+{
+    switch (simd) {
+    case VIDEO_CONV_SSE2:
+        return "sse2";
+    case VIDEO_CONV_SSSE3:
+        return "ssse3";
+    case VIDEO_CONV_AVX2:
+        return "avx2";
+    case VIDEO_CONV_NEON:
+        return "neon";
+    default:
+        return "c";
+    }
+}
+
+/******************************************************************************
+ * frame converters, rows [y0, y1) with y0 and y1 even
+ ******************************************************************************/
+#define ROW(f, p, y)    ((f)->data[p] + (size_t)(y) * (f)->linesize[p])
+
+typedef void (conv_rows_func)(const struct conv_kernels *k, struct video_frame *dst,
+                const struct video_frame *src, int y0, int y1, int arg);
+
+static void p422_to_i420(const struct conv_kernels *k, struct video_frame *dst,
+                const struct video_frame *src, int y0, int y1, int off)
+{
+    int w = src->width;
+    int y;
+    for (y = y0; y < y1; y += 2) {
+        k->p422_y(ROW(src, 0, y), ROW(dst, 0, y), w, off);
+        k->p422_y(ROW(src, 0, y + 1), ROW(dst, 0, y + 1), w, off);
+        k->p422_u_v(ROW(src, 0, y), ROW(src, 0, y + 1), ROW(dst, 1, y / 2), ROW(dst, 2, y / 2), w, off);
+    }
+}
+
+static void p422_to_nv12(const struct conv_kernels *k, struct video_frame *dst,
+                const struct video_frame *src, int y0, int y1, int off)
+{
+    int w = src->width;
+    int y;
+    for (y = y0; y < y1; y += 2) {
+        k->p422_y(ROW(src, 0, y), ROW(dst, 0, y), w, off);
+        k->p422_y(ROW(src, 0, y + 1), ROW(dst, 0, y + 1), w, off);
+        k->p422_uv(ROW(src, 0, y), ROW(src, 0, y + 1), ROW(dst, 1, y / 2), w, off);
+    }
+}
+
+static void copy_luma(struct video_frame *dst, const struct video_frame *src, int y0, int y1)
+{
+    int y;
+    for (y = y0; y < y1; y++) {
+        memcpy(ROW(dst, 0, y), ROW(src, 0, y), src->width);
+    }
+}
+
+static void nv12_to_i420(const struct conv_kernels *k, struct video_frame *dst,
+                const struct video_frame *src, int y0, int y1, int arg)
+{
+    int y;
+    copy_luma(dst, src, y0, y1);
+    for (y = y0 / 2; y < y1 / 2; y++) {
+        k->split_uv(ROW(src, 1, y), ROW(dst, 1, y), ROW(dst, 2, y), src->width / 2);
+    }
+}
+
+static void i420_to_nv12(const struct conv_kernels *k, struct video_frame *dst,
+                const struct video_frame *src, int y0, int y1, int arg)
+{
+    int y;
+    copy_luma(dst, src, y0, y1);
+    for (y = y0 / 2; y < y1 / 2; y++) {
+        k->merge_uv(ROW(src, 1, y), ROW(src, 2, y), ROW(dst, 1, y), src->width / 2);
+    }
+}
+
+static void i420_to_rgba(const struct conv_kernels *k, struct video_frame *dst,
+                const struct video_frame *src, int y0, int y1, int bgra)
+{
+    int y;
+    for (y = y0; y < y1; y++) {
+        k->yuv_rgba(ROW(src, 0, y), ROW(src, 1, y / 2), ROW(src, 2, y / 2),
+                    ROW(dst, 0, y), src->width, bgra);
+    }
+}
+
+static void rgb24_to_i420(const struct conv_kernels *k, struct video_frame *dst,
+                const struct video_frame *src, int y0, int y1, int arg)
+{
+    int w = src->width;
+    int y;
+    for (y = y0; y < y1; y += 2) {
+        k->rgb24_y(ROW(src, 0, y), ROW(dst, 0, y), w);
+        k->rgb24_y(ROW(src, 0, y + 1), ROW(dst, 0, y + 1), w);
+        k->rgb24_uv(ROW(src, 0, y), ROW(src, 0, y + 1), ROW(dst, 1, y / 2), ROW(dst, 2, y / 2), w);
+    }
+}
+
+static const struct conv_entry {
+    enum pixel_format src;
+    enum pixel_format dst;
+    conv_rows_func *func;
+    int arg;
+} conv_tbl[] = {
+    {PIXEL_FORMAT_YUY2,  PIXEL_FORMAT_I420, p422_to_i420,  0},
+    {PIXEL_FORMAT_UYVY,  PIXEL_FORMAT_I420, p422_to_i420,  1},
+    {PIXEL_FORMAT_YUY2,  PIXEL_FORMAT_NV12, p422_to_nv12,  0},
+    {PIXEL_FORMAT_UYVY,  PIXEL_FORMAT_NV12, p422_to_nv12,  1},
+    {PIXEL_FORMAT_NV12,  PIXEL_FORMAT_I420, nv12_to_i420,  0},
+    {PIXEL_FORMAT_I420,  PIXEL_FORMAT_NV12, i420_to_nv12,  0},
+    {PIXEL_FORMAT_I420,  PIXEL_FORMAT_RGBA, i420_to_rgba,  0},
+    {PIXEL_FORMAT_I420,  PIXEL_FORMAT_BGRA, i420_to_rgba,  1},
+    {PIXEL_FORMAT_I420,  PIXEL_FORMAT_BGRX, i420_to_rgba,  1},
+    {PIXEL_FORMAT_RGB24, PIXEL_FORMAT_I420, rgb24_to_i420, 0},
+};
+
+static const struct conv_entry *conv_find(enum pixel_format dst, enum pixel_format src)
+{
+    size_t i;
+    for (i = 0; i < sizeof(conv_tbl) / sizeof(conv_tbl[0]); i++) {
+        if (conv_tbl[i].src == src && conv_tbl[i].dst == dst) {
+            return &conv_tbl[i];
+        }
+    }
+    return NULL;
+}
+
+bool video_frame_convert_supported(enum pixel_format dst, enum pixel_format src)
+{
+    return conv_find(dst, src) != NULL;
+}
+
+static const struct conv_entry *conv_check(struct video_frame *dst, const struct video_frame *src)
+{
+    const struct conv_entry *e;
+
+    if (!dst || !src || !dst->data[0] || !src->data[0]) {
+        printf("%s:%d invalid paramenters!\n", __func__, __LINE__);
+        return NULL;
+    }
+    if (dst->width != src->width || dst->height != src->height ||
+        (src->width & 1) || (src->height & 1)) {
+        printf("%s:%d size %ux%u -> %ux%u not supported\n", __func__, __LINE__,
+               src->width, src->height, dst->width, dst->height);
+        return NULL;
+    }
+    e = conv_find(dst->format, src->format);
+    if (!e) {
+        printf("%s:%d %s -> %s not supported\n", __func__, __LINE__,
+               pixel_format_to_string(src->format), pixel_format_to_string(dst->format));
+    }
+    return e;
+}
+
+int video_frame_convert(struct video_frame *dst, const struct video_frame *src)
+{
+    const struct conv_entry *e = conv_check(dst, src);
+    if (!e) {
+        return -1;
+    }
+    e->func(conv_kernels_get(), dst, src, 0, src->height, e->arg);
+    dst->timestamp = src->timestamp;
+    dst->frame_id = src->frame_id;
+    return 0;
+}
+
+#ifdef ENABLE_WORKQ
+/* a slice is a band of row pairs, a few per worker so the fast ones steal */
+#define CONV_SLICE_PER_THREAD   4
+#define CONV_SLICE_MIN_PIXELS   (64 * 1024)
+
+struct conv_job {
+    const struct conv_entry *e;
+    const struct conv_kernels *k;
+    struct video_frame *dst;
+    const struct video_frame *src;
+    int pairs;
+    int slices;
+};
+
+static void conv_slice(int i, void *arg)
+{
+    struct conv_job *j = (struct conv_job *)arg;
+    int y0 = (int)((int64_t)j->pairs * i / j->slices) * 2;
+    int y1 = (int)((int64_t)j->pairs * (i + 1) / j->slices) * 2;
+    j->e->func(j->k, j->dst, j->src, y0, y1, j->e->arg);
+}
+#endif
+
+int video_frame_convert_mt(struct workq_pool *pool, struct video_frame *dst,
+                const struct video_frame *src)
+{
+#ifdef ENABLE_WORKQ
+    const struct conv_entry *e;
+    struct conv_job job;
+    int max;
+
+    if (!pool) {
+        return video_frame_convert(dst, src);
+    }
+    e = conv_check(dst, src);
+    if (!e) {
+        return -1;
+    }
+    job.e = e;
+    job.k = conv_kernels_get();
+    job.dst = dst;
+    job.src = src;
+    job.pairs = src->height / 2;
+    /* small frames are not worth the wakeups */
+    max = (int)((uint64_t)src->width * src->height / CONV_SLICE_MIN_PIXELS);
+    job.slices = workq_pool_threads(pool) * CONV_SLICE_PER_THREAD;
+    job.slices = job.slices > max ? max : job.slices;
+    job.slices = job.slices > job.pairs ? job.pairs : job.slices;
+    if (job.slices <= 1) {
+        return video_frame_convert(dst, src);
+    }
+    workq_parallel_for(pool, 0, job.slices, 1, conv_slice, &job);
+    dst->timestamp = src->timestamp;
+    dst->frame_id = src->frame_id;
+    return 0;
+#else
+    return video_frame_convert(dst, src);
+#endif
+}
@@ -22,24 +22,49 @@
 #ifndef VIDEO_CONV_H
 #define VIDEO_CONV_H
 
-#if 0
 #include <stdint.h>
-#include <video-def.h>
+#include <stdbool.h>
 
-int video_yuyv2rgb(struct video_frame *in, struct video_frame *out);
-int uvc_uyvy2rgb(uvc_frame_t *in, uvc_frame_t *out);
-int uvc_any2rgb(uvc_frame_t *in, uvc_frame_t *out);
+#ifdef __cplusplus
+extern "C" {
+#endif
 
-int uvc_yuyv2bgr(uvc_frame_t *in, uvc_frame_t *out);
-int uvc_uyvy2bgr(uvc_frame_t *in, uvc_frame_t *out);
-int uvc_any2bgr(uvc_frame_t *in, uvc_frame_t *out);
+/*
+ * pixel format conversion, bt.601 limited range:
+ *   YUY2/UYVY -> I420/NV12
+ *   NV12 <-> I420
+ *   I420 -> RGBA/BGRA/BGRX
+ *   RGB24 -> I420
+ * dst and src are initialized by video_frame_init with the same even
+ * width and height. rows are done by simd kernels picked at runtime,
+ * every kernel gives the same bytes as the c one
+ */
+enum video_conv_simd {
+    VIDEO_CONV_C = 0,
+    VIDEO_CONV_SSE2,
+    VIDEO_CONV_SSSE3,
+    VIDEO_CONV_AVX2,
+    VIDEO_CONV_NEON,
+};
 
-int uvc_yuyv2y(uvc_frame_t *in, uvc_frame_t *out);
-int uvc_yuyv2uv(uvc_frame_t *in, uvc_frame_t *out);
+struct workq_pool;
 
-#ifdef LIBUVC_HAS_JPEG
-int uvc_mjpeg2rgb(uvc_frame_t *in, uvc_frame_t *out);
-#endif
-#endif
+GEAR_API bool video_frame_convert_supported(enum pixel_format dst, enum pixel_format src);
+GEAR_API int video_frame_convert(struct video_frame *dst, const struct video_frame *src);
 
+/*
+ * same, rows are sliced on pool by workq_parallel_for. without
+ * ENABLE_WORKQ at build time or with pool NULL, the caller thread does all
+ */
+GEAR_API int video_frame_convert_mt(struct workq_pool *pool, struct video_frame *dst,
+                const struct video_frame *src);
+
+/* simd level in use, limit it for test and benchmark */
+GEAR_API enum video_conv_simd video_conv_simd_get(void);
+GEAR_API void video_conv_simd_limit(enum video_conv_simd max);
+GEAR_API const char *video_conv_simd_to_string(enum video_conv_simd simd);
+
+#ifdef __cplusplus
+}
+#endif
 #endif
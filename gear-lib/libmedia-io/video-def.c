@@ -23,6 +23,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 #include <malloc.h>
 #define __STDC_FORMAT_MACROS
 #include <inttypes.h>
@@ -30,31 +31,6 @@
 #define ALIGNMENT 32
 #define ALIGN_SIZE(size, align) (((size) + (align - 1)) & (~(align - 1)))
 
-#if defined _ISOC11_SOURCE || __USE_ISOC11 || defined __USE_ISOCXX11 || __ISO_C_VISIBLE >= 2011
-/*
- * void *aligned_alloc(size_t, size_t) defined in stdlib.h
- */
-#define aligned_free    free
-#else
-static void *aligned_alloc(size_t alignment, size_t size)
-{
-    long diff;
-    void *ptr = malloc(size + alignment);
-    if (ptr) {
-        diff = ((~(long)ptr) & (alignment - 1)) + 1;
-        ptr = (char *)ptr + diff;
-        ((char *)ptr)[-1] = (char)diff;
-    }
-    return ptr;
-}
-
-static void aligned_free(void *ptr)
-{
-	if (ptr)
-		free((char *)ptr - ((char *)ptr)[-1]);
-}
-#endif
-
 struct pixel_format_name {
     enum pixel_format format;
     char name[32];
@@ -93,6 +69,7 @@ static struct video_codec_type_name video_codec_tbl[] = {
     {VIDEO_CODEC_NONE, "VIDEO_CODEC_NONE"},
     {VIDEO_CODEC_H264, "H264"},
     {VIDEO_CODEC_H265, "H265"},
+    {VIDEO_CODEC_AV1, "AV1"},
     {VIDEO_CODEC_MAX, "VIDEO_CODEC_MAX"},
 };
 
@@ -136,6 +113,17 @@ const char *video_codec_type_to_string(enum video_codec_type type)
     return video_codec_tbl[type].name;
 }
 
+static void frame_attach(struct video_frame *frame, struct media_buffer *buf)
+{
+    int i;
+    frame->buf = buf;
+    frame->mem_type = MEDIA_MEM_DEEP;
+    frame->data[0] = buf->data;
+    for (i = 1; i < frame->planes; i++) {
+        frame->data[i] = buf->data + frame->plane_offsets[i];
+    }
+}
+
 int video_frame_init(struct video_frame *frame, enum pixel_format format,
                 uint32_t width, uint32_t height, media_mem_type_t mem_type)
 {
@@ -163,11 +151,6 @@ int video_frame_init(struct video_frame *frame, enum pixel_format format,
         size += (width / 2) * (height / 2);
         size = ALIGN_SIZE(size, ALIGNMENT);
         frame->total_size = size;
-        if (mem_type == MEDIA_MEM_DEEP) {
-           frame->data[0] = (uint8_t *)aligned_alloc(ALIGNMENT, size);
-           frame->data[1] = (uint8_t *)frame->data[0] + frame->plane_offsets[1];
-           frame->data[2] = (uint8_t *)frame->data[0] + frame->plane_offsets[2];
-        }
         frame->linesize[0] = width;
         frame->linesize[1] = width / 2;
         frame->linesize[2] = width / 2;
@@ -180,10 +163,6 @@ int video_frame_init(struct video_frame *frame, enum pixel_format format,
         size += (width / 2) * (height / 2) * 2;
         size = ALIGN_SIZE(size, ALIGNMENT);
         frame->total_size = size;
-        if (mem_type == MEDIA_MEM_DEEP) {
-            frame->data[0] = aligned_alloc(ALIGNMENT, size);
-            frame->data[1] = (uint8_t *)frame->data[0] + frame->plane_offsets[1];
-        }
         frame->linesize[0] = width;
         frame->linesize[1] = width;
         frame->planes = 2;
@@ -192,9 +171,6 @@ int video_frame_init(struct video_frame *frame, enum pixel_format format,
         size = width * height;
         size = ALIGN_SIZE(size, ALIGNMENT);
         frame->total_size = size;
-        if (mem_type == MEDIA_MEM_DEEP) {
-            frame->data[0] = aligned_alloc(ALIGNMENT, size);
-        }
         frame->linesize[0] = width;
         frame->planes = 1;
         break;
@@ -204,9 +180,6 @@ int video_frame_init(struct video_frame *frame, enum pixel_format format,
         size = width * height * 2;
         size = ALIGN_SIZE(size, ALIGNMENT);
         frame->total_size = size;
-        if (mem_type == MEDIA_MEM_DEEP) {
-            frame->data[0] = aligned_alloc(ALIGNMENT, size);
-        }
         frame->linesize[0] = width * 2;
         frame->planes = 1;
         break;
@@ -217,34 +190,26 @@ int video_frame_init(struct video_frame *frame, enum pixel_format format,
         size = width * height * 4;
         size = ALIGN_SIZE(size, ALIGNMENT);
         frame->total_size = size;
-        if (mem_type == MEDIA_MEM_DEEP) {
-            frame->data[0] = aligned_alloc(ALIGNMENT, size);
-        }
         frame->linesize[0] = width * 4;
         frame->planes = 1;
         break;
     case PIXEL_FORMAT_I444:
         size = width * height;
         size = ALIGN_SIZE(size, ALIGNMENT);
-        frame->total_size = size;
-        if (mem_type == MEDIA_MEM_DEEP) {
-            frame->data[0] = aligned_alloc(ALIGNMENT, size * 3);
-            frame->data[1] = (uint8_t *)frame->data[0] + size;
-            frame->data[2] = (uint8_t *)frame->data[1] + size;
-        }
+        frame->plane_offsets[1] = size;
+        frame->plane_offsets[2] = size * 2;
+        frame->total_size = size * 3;
         frame->linesize[0] = width;
         frame->linesize[1] = width;
         frame->linesize[2] = width;
         frame->planes = 3;
         break;
+    case PIXEL_FORMAT_RGB24:
     case PIXEL_FORMAT_RGB3:
     case PIXEL_FORMAT_BGR3:
         size = width * height * 3;
         size = ALIGN_SIZE(size, ALIGNMENT);
         frame->total_size = size;
-        if (mem_type == MEDIA_MEM_DEEP) {
-            frame->data[0] = aligned_alloc(ALIGNMENT, size);
-        }
         frame->linesize[0] = width * 3;
         frame->planes = 1;
         break;
@@ -258,11 +223,6 @@ int video_frame_init(struct video_frame *frame, enum pixel_format format,
         size += (width / 2) * height;
         size = ALIGN_SIZE(size, ALIGNMENT);
         frame->total_size = size;
-        if (mem_type == MEDIA_MEM_DEEP) {
-            frame->data[0] = aligned_alloc(ALIGNMENT, size);
-            frame->data[1] = (uint8_t *)frame->data[0] + frame->plane_offsets[1];
-            frame->data[2] = (uint8_t *)frame->data[0] + frame->plane_offsets[2];
-        }
         frame->linesize[0] = width;
         frame->linesize[1] = width / 2;
         frame->linesize[2] = width / 2;
@@ -281,12 +241,6 @@ int video_frame_init(struct video_frame *frame, enum pixel_format format,
         size += width * height;
         size = ALIGN_SIZE(size, ALIGNMENT);
         frame->total_size = size;
-        if (mem_type == MEDIA_MEM_DEEP) {
-            frame->data[0] = aligned_alloc(ALIGNMENT, size);
-            frame->data[1] = (uint8_t *)frame->data[0] + frame->plane_offsets[1];
-            frame->data[2] = (uint8_t *)frame->data[0] + frame->plane_offsets[2];
-            frame->data[3] = (uint8_t *)frame->data[0] + frame->plane_offsets[3];
-        }
         frame->linesize[0] = width;
         frame->linesize[1] = width / 2;
         frame->linesize[2] = width / 2;
@@ -306,12 +260,6 @@ int video_frame_init(struct video_frame *frame, enum pixel_format format,
         size += width * height;
         size = ALIGN_SIZE(size, ALIGNMENT);
         frame->total_size = size;
-        if (mem_type == MEDIA_MEM_DEEP) {
-            frame->data[0] = aligned_alloc(ALIGNMENT, size);
-            frame->data[1] = (uint8_t *)frame->data[0] + frame->plane_offsets[1];
-            frame->data[2] = (uint8_t *)frame->data[0] + frame->plane_offsets[2];
-            frame->data[3] = (uint8_t *)frame->data[0] + frame->plane_offsets[3];
-        }
         frame->linesize[0] = width;
         frame->linesize[1] = width / 2;
         frame->linesize[2] = width / 2;
@@ -331,12 +279,6 @@ int video_frame_init(struct video_frame *frame, enum pixel_format format,
         size += width * height;
         size = ALIGN_SIZE(size, ALIGNMENT);
         frame->total_size = size;
-        if (mem_type == MEDIA_MEM_DEEP) {
-            frame->data[0] = aligned_alloc(ALIGNMENT, size);
-            frame->data[1] = (uint8_t *)frame->data[0] + frame->plane_offsets[1];
-            frame->data[2] = (uint8_t *)frame->data[0] + frame->plane_offsets[2];
-            frame->data[3] = (uint8_t *)frame->data[0] + frame->plane_offsets[3];
-        }
         frame->linesize[0] = width;
         frame->linesize[1] = width;
         frame->linesize[2] = width;
@@ -348,9 +290,6 @@ int video_frame_init(struct video_frame *frame, enum pixel_format format,
         size = width * height;
         size = ALIGN_SIZE(size, ALIGNMENT);
         frame->total_size = size;
-        if (mem_type == MEDIA_MEM_DEEP) {
-            frame->data[0] = aligned_alloc(ALIGNMENT, size);
-        }
         frame->linesize[0] = width;
         frame->planes = 1;
         break;
@@ -358,15 +297,22 @@ int video_frame_init(struct video_frame *frame, enum pixel_format format,
         printf("unsupport video format %d\n", format);
         break;
     }
+    if (mem_type == MEDIA_MEM_DEEP && frame->planes) {
+        struct media_buffer *buf = media_buffer_alloc(frame->total_size);
+        if (!buf) {
+            printf("%s: alloc %" PRIu64 " bytes failed!\n", __func__, frame->total_size);
+            return -1;
+        }
+        frame_attach(frame, buf);
+    }
     return 0;
 }
 
 void video_frame_deinit(struct video_frame *frame)
 {
     if (frame) {
-        if (frame->mem_type == MEDIA_MEM_DEEP) {
-            aligned_free(frame->data[0]);
-        }
+        media_buffer_unref(frame->buf);
+        frame->buf = NULL;
     }
 }
 
@@ -427,6 +373,7 @@ struct video_frame *video_frame_copy(struct video_frame *dst, const struct video
     case PIXEL_FORMAT_RGBA:
     case PIXEL_FORMAT_BGRA:
     case PIXEL_FORMAT_BGRX:
+    case PIXEL_FORMAT_RGB24:
     case PIXEL_FORMAT_RGB3:
     case PIXEL_FORMAT_BGR3:
     case PIXEL_FORMAT_AYUV:
@@ -460,6 +407,202 @@ struct video_frame *video_frame_copy(struct video_frame *dst, const struct video
     return dst;
 }
 
+int video_frame_ref(struct video_frame *dst, const struct video_frame *src)
+{
+    if (!dst || !src) {
+        printf("%s invalid paramenters!\n", __func__);
+        return -1;
+    }
+    if (src->buf) {
+        *dst = *src;
+        dst->buf = media_buffer_ref(src->buf);
+        return 0;
+    }
+    /* nobody keeps hardware or caller memory alive for us */
+    if (0 != video_frame_init(dst, src->format, src->width, src->height, MEDIA_MEM_DEEP)) {
+        return -1;
+    }
+    if (!video_frame_copy(dst, src)) {
+        video_frame_deinit(dst);
+        return -1;
+    }
+    return 0;
+}
+
+struct video_frame *video_frame_clone(const struct video_frame *src)
+{
+    struct video_frame *frame = calloc(1, sizeof(struct video_frame));
+    if (!frame) {
+        printf("malloc video frame failed!\n");
+        return NULL;
+    }
+    if (0 != video_frame_ref(frame, src)) {
+        free(frame);
+        return NULL;
+    }
+    return frame;
+}
+
+int video_frame_make_writable(struct video_frame *frame)
+{
+    struct video_frame tmp;
+
+    if (!frame) {
+        return -1;
+    }
+    if (media_buffer_is_writable(frame->buf)) {
+        return 0;
+    }
+    if (0 != video_frame_init(&tmp, frame->format, frame->width, frame->height, MEDIA_MEM_DEEP)) {
+        return -1;
+    }
+    if (!video_frame_copy(&tmp, frame)) {
+        video_frame_deinit(&tmp);
+        return -1;
+    }
+    video_frame_deinit(frame);
+    *frame = tmp;
+    return 0;
+}
+
+struct frame_pool_entry {
+    enum pixel_format          format;
+    uint32_t                   width;
+    uint32_t                   height;
+    struct media_buffer_pool  *pool;
+    struct frame_pool_entry   *next;
+};
+
+struct video_frame_pool {
+    pthread_mutex_t            lock;
+    int                        max_free;
+    uint32_t                   flags;
+    int                        count;
+    struct frame_pool_entry   *head;    /* most recently used first */
+};
+
+struct video_frame_pool *video_frame_pool_create(int max_free)
+{
+    return video_frame_pool_create_flags(max_free, 0);
+}
+
+struct video_frame_pool *video_frame_pool_create_flags(int max_free, uint32_t flags)
+{
+    struct video_frame_pool *pool = calloc(1, sizeof(struct video_frame_pool));
+    if (!pool) {
+        printf("malloc video frame pool failed!\n");
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pool->max_free = max_free;
+    pool->flags = flags;
+    return pool;
+}
+
+void video_frame_pool_destroy(struct video_frame_pool *pool)
+{
+    struct frame_pool_entry *e, *next;
+
+    if (!pool) {
+        return;
+    }
+    for (e = pool->head; e; e = next) {
+        next = e->next;
+        media_buffer_pool_destroy(e->pool);
+        free(e);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+}
+
+static struct media_buffer *frame_pool_get(struct video_frame_pool *pool,
+                const struct video_frame *frame)
+{
+    struct frame_pool_entry *e, *prev = NULL, *evict = NULL;
+    struct media_buffer *buf;
+
+    pthread_mutex_lock(&pool->lock);
+    for (e = pool->head; e; prev = e, e = e->next) {
+        if (e->format == frame->format && e->width == frame->width &&
+            e->height == frame->height) {
+            break;
+        }
+    }
+    if (e && prev) {
+        prev->next = e->next;
+        e->next = pool->head;
+        pool->head = e;
+    } else if (!e) {
+        e = calloc(1, sizeof(struct frame_pool_entry));
+        if (e) {
+            e->pool = media_buffer_pool_create_flags(frame->total_size, pool->max_free,
+                                                     pool->flags);
+        }
+        if (!e || !e->pool) {
+            pthread_mutex_unlock(&pool->lock);
+            free(e);
+            return NULL;
+        }
+        e->format = frame->format;
+        e->width = frame->width;
+        e->height = frame->height;
+        e->next = pool->head;
+        pool->head = e;
+        if (++pool->count > VIDEO_FRAME_POOL_KEYS) {
+            /* resolution or format changed, drop the least recently used */
+            for (prev = e; prev->next->next; prev = prev->next);
+            evict = prev->next;
+            prev->next = NULL;
+            pool->count--;
+        }
+    }
+    buf = media_buffer_pool_get(e->pool);
+    pthread_mutex_unlock(&pool->lock);
+    if (evict) {
+        media_buffer_pool_destroy(evict->pool);
+        free(evict);
+    }
+    return buf;
+}
+
+int video_frame_pool_init(struct video_frame_pool *pool, struct video_frame *frame,
+                enum pixel_format format, uint32_t width, uint32_t height)
+{
+    struct media_buffer *buf;
+
+    if (!pool || !frame) {
+        printf("%s invalid paramenters!\n", __func__);
+        return -1;
+    }
+    if (0 != video_frame_init(frame, format, width, height, MEDIA_MEM_SHALLOW)) {
+        return -1;
+    }
+    if (!frame->planes) {
+        return -1;
+    }
+    buf = frame_pool_get(pool, frame);
+    if (!buf) {
+        return -1;
+    }
+    frame_attach(frame, buf);
+    return 0;
+}
+
+struct video_frame *video_frame_pool_get(struct video_frame_pool *pool,
+                enum pixel_format format, uint32_t width, uint32_t height)
+{
+    struct video_frame *frame = calloc(1, sizeof(struct video_frame));
+    if (!frame) {
+        printf("malloc video frame failed!\n");
+        return NULL;
+    }
+    if (0 != video_frame_pool_init(pool, frame, format, width, height)) {
+        free(frame);
+        return NULL;
+    }
+    return frame;
+}
+
 void video_producer_dump(struct video_producer *vs)
 {
     if (!vs) {
@@ -481,7 +624,15 @@ struct video_packet *video_packet_create(media_mem_type_t type, void *data, size
     vp->mem_type = type;
     switch (type) {
     case MEDIA_MEM_DEEP:
-        vp->data = memdup(data, len);
+        if (data && len) {
+            vp->buf = media_buffer_alloc(len);
+            if (!vp->buf) {
+                free(vp);
+                return NULL;
+            }
+            memcpy(vp->buf->data, data, len);
+            vp->data = vp->buf->data;
+        }
         vp->size = len;
         break;
     case MEDIA_MEM_SHALLOW:
@@ -500,6 +651,11 @@ void video_packet_destroy(struct video_packet *vp)
 {
     if (!vp)
         return;
+    if (vp->buf) {
+        media_buffer_unref(vp->buf);
+        free(vp);
+        return;
+    }
     switch (vp->mem_type) {
     case MEDIA_MEM_DEEP:
         if (vp->data) {
@@ -522,16 +678,33 @@ struct video_packet *video_packet_copy(struct video_packet *dst, const struct vi
         printf("%s invalid paramenters!\n", __func__);
         return NULL;
     }
-    switch (dst->mem_type) {
-    case MEDIA_MEM_SHALLOW:
+    if (src->buf) {
+        /* payload is refcounted, any copy type just takes a reference */
+        if (dst->buf != src->buf) {
+            if (dst->buf) {
+                media_buffer_unref(dst->buf);
+            } else if (dst->mem_type == MEDIA_MEM_DEEP) {
+                free(dst->data);
+            }
+            dst->buf = media_buffer_ref(src->buf);
+        }
         dst->data = src->data;
-        break;
-    case MEDIA_MEM_DEEP:
-        if (!dst->data) {
-            dst->data = calloc(1, src->size);
+    } else {
+        switch (dst->mem_type) {
+        case MEDIA_MEM_SHALLOW:
+            dst->data = src->data;
+            break;
+        case MEDIA_MEM_DEEP:
+            if (!dst->data) {
+                dst->buf = media_buffer_alloc(src->size);
+                if (!dst->buf) {
+                    return NULL;
+                }
+                dst->data = dst->buf->data;
+            }
+            memcpy(dst->data, src->data, src->size);
+            break;
         }
-        memcpy(dst->data, src->data, src->size);
-        break;
     }
     dst->size = src->size;
     dst->type = src->type;
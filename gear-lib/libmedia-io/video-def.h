@@ -114,6 +114,7 @@ struct video_frame {
     uint64_t          timestamp;//ns
     uint64_t          frame_id;
     media_mem_type_t  mem_type;
+    struct media_buffer *buf;       /* refcounted owner of data, or NULL */
 };
 
 const char *pixel_format_to_string(enum pixel_format fmt);
@@ -129,6 +130,34 @@ GEAR_API void video_frame_destroy(struct video_frame *frame);
 GEAR_API struct video_frame *video_frame_copy(struct video_frame *dst,
                 const struct video_frame *src);
 
+/*
+ * video_frame_ref makes dst a shallow copy of src sharing its buffer, a src
+ * without buffer (hardware or caller memory) is copied into a new one.
+ * video_frame_make_writable gives the frame its own buffer if it is shared
+ */
+GEAR_API int video_frame_ref(struct video_frame *dst, const struct video_frame *src);
+GEAR_API struct video_frame *video_frame_clone(const struct video_frame *src);
+GEAR_API int video_frame_make_writable(struct video_frame *frame);
+
+/*
+ * frame pool keeps a buffer pool per (format, width, height), the most
+ * recently used VIDEO_FRAME_POOL_KEYS of them, each with up to max_free
+ * idle buffers. frames from the pool are MEDIA_MEM_DEEP, deinit or destroy
+ * gives the buffer back once the last reference is gone
+ */
+#define VIDEO_FRAME_POOL_KEYS   8
+
+struct video_frame_pool;
+
+GEAR_API struct video_frame_pool *video_frame_pool_create(int max_free);
+/* buffer pools of the frame pool allocate with MEDIA_BUFFER_* flags */
+GEAR_API struct video_frame_pool *video_frame_pool_create_flags(int max_free, uint32_t flags);
+GEAR_API void video_frame_pool_destroy(struct video_frame_pool *pool);
+GEAR_API int video_frame_pool_init(struct video_frame_pool *pool, struct video_frame *frame,
+                enum pixel_format format, uint32_t width, uint32_t height);
+GEAR_API struct video_frame *video_frame_pool_get(struct video_frame_pool *pool,
+                enum pixel_format format, uint32_t width, uint32_t height);
+
 void video_producer_dump(struct video_producer *vp);
 
 /******************************************************************************
@@ -140,6 +169,7 @@ enum video_codec_type {
     VIDEO_CODEC_AVC = VIDEO_CODEC_H264,
     VIDEO_CODEC_H265,
     VIDEO_CODEC_HEVC = VIDEO_CODEC_H265,
+    VIDEO_CODEC_AV1,
     VIDEO_CODEC_MAX,
 };
 
@@ -202,6 +232,7 @@ struct video_packet {
     uint64_t               dts;
     bool                   key_frame;
     struct video_encoder   encoder;
+    struct media_buffer   *buf;     /* refcounted owner of data, or NULL */
 };
 
 GEAR_API struct video_packet *video_packet_create(media_mem_type_t type, void *data, size_t len);
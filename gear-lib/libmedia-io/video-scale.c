@@ -0,0 +1,788 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#include "libmedia-io.h"
+#include "video-scale.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined (__SSE2__) || defined (_M_X64)
+#include <emmintrin.h>
+#define SCALE_SSE2
+#endif
+#if defined (SCALE_SSE2) && defined (__GNUC__)
+#include <immintrin.h>
+#define SCALE_AVX2
+#define SCALE_TARGET_AVX2   __attribute__((target("avx2")))
+#endif
+#if defined (__ARM_NEON) || defined (__ARM_NEON__)
+#include <arm_neon.h>
+#define SCALE_NEON
+#endif
+
+/*
+ * weights are Q14 and sum to exactly 1 << 14. the vertical pass keeps
+ * 7 fraction bits in int16 (255 << 7 still fits), the horizontal pass
+ * rounds the Q21 sum back to 8 bits. every kernel gives the same bytes
+ */
+#define COEF_BITS       14
+#define COEF_ONE        (1 << COEF_BITS)
+#define VERT_SHIFT      (COEF_BITS - 7)
+#define HORZ_SHIFT      (7 + COEF_BITS)
+
+/* rows per band of a fused convert, even, small enough to stay in cache */
+#define SCALE_BAND_ROWS 16
+
+struct scale_filter {
+    int      taps;
+    int     *pos;       /* first src index of each dst index */
+    int16_t *coef;      /* taps weights of each dst index */
+    int      pairs;     /* taps rounded up to pairs */
+    int16_t *coef_t;    /* pairs of weights of 8 dst indices side by side */
+};
+
+/* weights k and k + 1 of dst index j, k even, as one dword */
+#define COEF_T(f, j, k) \
+    ((f)->coef_t + ((size_t)((j) >> 3) * (f)->pairs + ((k) >> 1)) * 16 + ((j) & 7) * 2)
+
+/* the simd horizontal pass reads a few int16 past the filtered row */
+#define TMP_SLACK       16
+
+struct scale_plane {
+    int                 c;      /* interleaved channels */
+    int                 sx;     /* log2 subsampling to luma */
+    int                 sy;
+    int                 src_x;  /* crop in plane pixels */
+    int                 src_y;
+    int                 src_w;
+    int                 src_h;
+    int                 dst_w;
+    int                 dst_h;
+    struct scale_filter h;
+    struct scale_filter v;
+};
+
+struct video_scale {
+    struct video_scale_conf conf;
+    int                     planes;
+    struct scale_plane      plane[VIDEO_MAX_PLANES];
+    int16_t                *tmp;        /* one vertically filtered row */
+    const uint8_t         **rows;
+    int16_t                *wv;
+    bool                    convert;
+    struct video_frame      band;       /* src format at dst width */
+};
+
+struct scale_kernels {
+    enum video_conv_simd simd;
+    void (*vfilter)(const uint8_t *const *rows, const int16_t *w, int taps, int16_t *out, int n);
+    void (*hfilter)(const int16_t *s, uint8_t *d, const struct scale_filter *f, int c, int n);
+};
+
+/******************************************************************************
+ * layout of the formats that can be scaled
+ ******************************************************************************/
+static const struct scale_format {
+    enum pixel_format format;
+    int planes;
+    int c[3];
+    int sx;     /* chroma subsampling */
+    int sy;
+} scale_fmt_tbl[] = {
+    {PIXEL_FORMAT_I420,  3, {1, 1, 1}, 1, 1},
+    {PIXEL_FORMAT_NV12,  2, {1, 2, 0}, 1, 1},
+    {PIXEL_FORMAT_I422,  3, {1, 1, 1}, 1, 0},
+    {PIXEL_FORMAT_I444,  3, {1, 1, 1}, 0, 0},
+    {PIXEL_FORMAT_Y800,  1, {1, 0, 0}, 0, 0},
+    {PIXEL_FORMAT_RGBA,  1, {4, 0, 0}, 0, 0},
+    {PIXEL_FORMAT_BGRA,  1, {4, 0, 0}, 0, 0},
+    {PIXEL_FORMAT_BGRX,  1, {4, 0, 0}, 0, 0},
+    {PIXEL_FORMAT_RGB24, 1, {3, 0, 0}, 0, 0},
+    {PIXEL_FORMAT_RGB3,  1, {3, 0, 0}, 0, 0},
+    {PIXEL_FORMAT_BGR3,  1, {3, 0, 0}, 0, 0},
+};
+
+static const struct scale_format *scale_fmt_find(enum pixel_format format)
+{
+    size_t i;
+    for (i = 0; i < sizeof(scale_fmt_tbl) / sizeof(scale_fmt_tbl[0]); i++) {
+        if (scale_fmt_tbl[i].format == format) {
+            return &scale_fmt_tbl[i];
+        }
+    }
+    return NULL;
+}
+
+/******************************************************************************
+ * c
+ ******************************************************************************/
+/* rows [i, n), the simd kernels finish their tail here */
+static void vfilter_tail(const uint8_t *const *rows, const int16_t *w, int taps,
+                int16_t *out, int i, int n)
+{
+    int k, sum;
+    for (; i < n; i++) {
+        sum = 1 << (VERT_SHIFT - 1);
+        for (k = 0; k < taps; k++) {
+            sum += w[k] * rows[k][i];
+        }
+        out[i] = sum >> VERT_SHIFT;
+    }
+}
+
+static void vfilter_c(const uint8_t *const *rows, const int16_t *w, int taps, int16_t *out, int n)
+{
+    vfilter_tail(rows, w, taps, out, 0, n);
+}
+
+/* dst indices [j, n), the simd kernels finish their tail here */
+static void hfilter_tail(const int16_t *s, uint8_t *d, const struct scale_filter *f,
+                int c, int j, int n)
+{
+    const int16_t *w = f->coef + (size_t)j * f->taps;
+    const int16_t *p;
+    int k, ch, sum;
+
+    d += (size_t)j * c;
+    if (c == 1) {
+        for (; j < n; j++, w += f->taps) {
+            p = s + f->pos[j];
+            sum = 1 << (HORZ_SHIFT - 1);
+            for (k = 0; k < f->taps; k++) {
+                sum += w[k] * p[k];
+            }
+            *d++ = sum >> HORZ_SHIFT;
+        }
+        return;
+    }
+    for (; j < n; j++, w += f->taps) {
+        p = s + f->pos[j] * c;
+        for (ch = 0; ch < c; ch++) {
+            sum = 1 << (HORZ_SHIFT - 1);
+            for (k = 0; k < f->taps; k++) {
+                sum += w[k] * p[k * c + ch];
+            }
+            *d++ = sum >> HORZ_SHIFT;
+        }
+    }
+}
+
+static void hfilter_c(const int16_t *s, uint8_t *d, const struct scale_filter *f, int c, int n)
+{
+    hfilter_tail(s, d, f, c, 0, n);
+}
+
+static const struct scale_kernels kern_c = {
+    VIDEO_CONV_C, vfilter_c, hfilter_c,
+};
+
+/******************************************************************************
+ * sse2, taps are taken in pairs and summed by pmaddwd
+ ******************************************************************************/
+#if defined (SCALE_SSE2)
+static void vfilter_sse2(const uint8_t *const *rows, const int16_t *w, int taps, int16_t *out, int n)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i rnd = _mm_set1_epi32(1 << (VERT_SHIFT - 1));
+    __m128i a0, a1, a2, a3, r0, r1, wk, lo, hi;
+    int i = 0, k;
+
+    for (; i + 16 <= n; i += 16) {
+        a0 = a1 = a2 = a3 = rnd;
+        for (k = 0; k < taps; k += 2) {
+            r0 = _mm_loadu_si128((const __m128i *)(rows[k] + i));
+            if (k + 1 < taps) {
+                r1 = _mm_loadu_si128((const __m128i *)(rows[k + 1] + i));
+                wk = _mm_set1_epi32((uint16_t)w[k] | ((uint32_t)(uint16_t)w[k + 1] << 16));
+            } else {
+                r1 = zero;
+                wk = _mm_set1_epi32((uint16_t)w[k]);
+            }
+            lo = _mm_unpacklo_epi8(r0, r1);
+            hi = _mm_unpackhi_epi8(r0, r1);
+            a0 = _mm_add_epi32(a0, _mm_madd_epi16(_mm_unpacklo_epi8(lo, zero), wk));
+            a1 = _mm_add_epi32(a1, _mm_madd_epi16(_mm_unpackhi_epi8(lo, zero), wk));
+            a2 = _mm_add_epi32(a2, _mm_madd_epi16(_mm_unpacklo_epi8(hi, zero), wk));
+            a3 = _mm_add_epi32(a3, _mm_madd_epi16(_mm_unpackhi_epi8(hi, zero), wk));
+        }
+        a0 = _mm_packs_epi32(_mm_srai_epi32(a0, VERT_SHIFT), _mm_srai_epi32(a1, VERT_SHIFT));
+        a2 = _mm_packs_epi32(_mm_srai_epi32(a2, VERT_SHIFT), _mm_srai_epi32(a3, VERT_SHIFT));
+        _mm_storeu_si128((__m128i *)(out + i), a0);
+        _mm_storeu_si128((__m128i *)(out + i + 8), a2);
+    }
+    vfilter_tail(rows, w, taps, out, i, n);
+}
+
+static inline __m128i sse2_ld32(const int16_t *p)
+{
+    int32_t v;
+    memcpy(&v, p, sizeof(v));
+    return _mm_cvtsi32_si128(v);
+}
+
+static inline __m128i sse2_gather4(const int16_t *s, const int *pos, int k)
+{
+    __m128i a = _mm_unpacklo_epi32(sse2_ld32(s + pos[0] + k), sse2_ld32(s + pos[1] + k));
+    __m128i b = _mm_unpacklo_epi32(sse2_ld32(s + pos[2] + k), sse2_ld32(s + pos[3] + k));
+    return _mm_unpacklo_epi64(a, b);
+}
+
+/* one channel, 8 dst per step, src pairs k and k + 1 meet their weights in pmaddwd */
+static int hfilter1_sse2(const int16_t *s, uint8_t *d, const struct scale_filter *f, int n)
+{
+    const __m128i rnd = _mm_set1_epi32(1 << (HORZ_SHIFT - 1));
+    __m128i a0, a1;
+    const int16_t *w;
+    int j, k;
+
+    for (j = 0; j + 8 <= n; j += 8) {
+        a0 = a1 = rnd;
+        for (k = 0; k < f->taps; k += 2) {
+            w = COEF_T(f, j, k);
+            a0 = _mm_add_epi32(a0, _mm_madd_epi16(sse2_gather4(s, f->pos + j, k),
+                               _mm_loadu_si128((const __m128i *)w)));
+            a1 = _mm_add_epi32(a1, _mm_madd_epi16(sse2_gather4(s, f->pos + j + 4, k),
+                               _mm_loadu_si128((const __m128i *)(w + 8))));
+        }
+        a0 = _mm_packs_epi32(_mm_srai_epi32(a0, HORZ_SHIFT), _mm_srai_epi32(a1, HORZ_SHIFT));
+        _mm_storel_epi64((__m128i *)(d + j), _mm_packus_epi16(a0, a0));
+    }
+    return j;
+}
+
+/*
+ * interleaved channels, one dst per step. the channels of src k and k + 1
+ * are shuffled side by side, so pmaddwd sums two taps of each channel
+ */
+static int hfilterc_sse2(const int16_t *s, uint8_t *d, const struct scale_filter *f, int c, int n)
+{
+    const __m128i rnd = _mm_set1_epi32(1 << (HORZ_SHIFT - 1));
+    __m128i a, x, w;
+    int32_t v;
+    int j, k;
+
+    for (j = 0; j < n; j++, d += c) {
+        a = rnd;
+        for (k = 0; k < f->taps; k += 2) {
+            w = _mm_shuffle_epi32(sse2_ld32(COEF_T(f, j, k)), 0);
+            if (c == 2) {
+                x = _mm_loadl_epi64((const __m128i *)(s + (f->pos[j] + k) * 2));
+                x = _mm_shufflelo_epi16(x, _MM_SHUFFLE(3, 1, 2, 0));
+            } else {
+                x = _mm_loadu_si128((const __m128i *)(s + (f->pos[j] + k) * c));
+                x = _mm_unpacklo_epi16(x, c == 4 ? _mm_srli_si128(x, 8) : _mm_srli_si128(x, 6));
+            }
+            a = _mm_add_epi32(a, _mm_madd_epi16(x, w));
+        }
+        a = _mm_packs_epi32(_mm_srai_epi32(a, HORZ_SHIFT), a);
+        v = _mm_cvtsi128_si32(_mm_packus_epi16(a, a));
+        memcpy(d, &v, c);
+    }
+    return j;
+}
+
+static void hfilter_sse2(const int16_t *s, uint8_t *d, const struct scale_filter *f, int c, int n)
+{
+    int j;
+    if (c == 1) {
+        j = hfilter1_sse2(s, d, f, n);
+    } else if (c <= 4) {
+        j = hfilterc_sse2(s, d, f, c, n);
+    } else {
+        j = 0;
+    }
+    hfilter_tail(s, d, f, c, j, n);
+}
+
+static const struct scale_kernels kern_sse2 = {
+    VIDEO_CONV_SSE2, vfilter_sse2, hfilter_sse2,
+};
+#endif
+
+/******************************************************************************
+ * avx2, 32 bytes of a row per step
+ ******************************************************************************/
+#if defined (SCALE_AVX2)
+SCALE_TARGET_AVX2
+static void vfilter_avx2(const uint8_t *const *rows, const int16_t *w, int taps, int16_t *out, int n)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i rnd = _mm256_set1_epi32(1 << (VERT_SHIFT - 1));
+    __m256i a0, a1, a2, a3, l0, h0, l1, h1, wk;
+    int i = 0, k;
+
+    for (; i + 32 <= n; i += 32) {
+        a0 = a1 = a2 = a3 = rnd;
+        for (k = 0; k < taps; k += 2) {
+            l0 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(rows[k] + i)));
+            h0 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(rows[k] + i + 16)));
+            if (k + 1 < taps) {
+                l1 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(rows[k + 1] + i)));
+                h1 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(rows[k + 1] + i + 16)));
+                wk = _mm256_set1_epi32((uint16_t)w[k] | ((uint32_t)(uint16_t)w[k + 1] << 16));
+            } else {
+                l1 = h1 = zero;
+                wk = _mm256_set1_epi32((uint16_t)w[k]);
+            }
+            /* unpack and pack work per lane, so the order comes back */
+            a0 = _mm256_add_epi32(a0, _mm256_madd_epi16(_mm256_unpacklo_epi16(l0, l1), wk));
+            a1 = _mm256_add_epi32(a1, _mm256_madd_epi16(_mm256_unpackhi_epi16(l0, l1), wk));
+            a2 = _mm256_add_epi32(a2, _mm256_madd_epi16(_mm256_unpacklo_epi16(h0, h1), wk));
+            a3 = _mm256_add_epi32(a3, _mm256_madd_epi16(_mm256_unpackhi_epi16(h0, h1), wk));
+        }
+        a0 = _mm256_packs_epi32(_mm256_srai_epi32(a0, VERT_SHIFT), _mm256_srai_epi32(a1, VERT_SHIFT));
+        a2 = _mm256_packs_epi32(_mm256_srai_epi32(a2, VERT_SHIFT), _mm256_srai_epi32(a3, VERT_SHIFT));
+        _mm256_storeu_si256((__m256i *)(out + i), a0);
+        _mm256_storeu_si256((__m256i *)(out + i + 16), a2);
+    }
+    vfilter_tail(rows, w, taps, out, i, n);
+}
+
+/* one channel, 8 dst per step, the pairs of src come in one gather */
+SCALE_TARGET_AVX2
+static void hfilter_avx2(const int16_t *s, uint8_t *d, const struct scale_filter *f, int c, int n)
+{
+    const __m256i rnd = _mm256_set1_epi32(1 << (HORZ_SHIFT - 1));
+    __m256i a, idx;
+    __m128i r;
+    int j = 0, k;
+
+    if (c != 1) {
+        hfilter_sse2(s, d, f, c, n);
+        return;
+    }
+    for (; j + 8 <= n; j += 8) {
+        a = rnd;
+        idx = _mm256_loadu_si256((const __m256i *)(f->pos + j));
+        for (k = 0; k < f->taps; k += 2) {
+            a = _mm256_add_epi32(a, _mm256_madd_epi16(
+                        _mm256_i32gather_epi32((const int *)(s + k), idx, 2),
+                        _mm256_loadu_si256((const __m256i *)COEF_T(f, j, k))));
+        }
+        a = _mm256_srai_epi32(a, HORZ_SHIFT);
+        a = _mm256_permute4x64_epi64(_mm256_packs_epi32(a, a), 0x08);
+        r = _mm256_castsi256_si128(a);
+        _mm_storel_epi64((__m128i *)(d + j), _mm_packus_epi16(r, r));
+    }
+    hfilter_tail(s, d, f, c, j, n);
+}
+
+static const struct scale_kernels kern_avx2 = {
+    VIDEO_CONV_AVX2, vfilter_avx2, hfilter_avx2,
+};
+#endif
+
+/******************************************************************************
+ * neon
+ ******************************************************************************/
+#if defined (SCALE_NEON)
+static void vfilter_neon(const uint8_t *const *rows, const int16_t *w, int taps, int16_t *out, int n)
+{
+    int32x4_t a0, a1, a2, a3;
+    uint8x16_t r;
+    int16x8_t l, h;
+    int i = 0, k;
+
+    for (; i + 16 <= n; i += 16) {
+        a0 = a1 = a2 = a3 = vdupq_n_s32(0);
+        for (k = 0; k < taps; k++) {
+            r = vld1q_u8(rows[k] + i);
+            l = vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(r)));
+            h = vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(r)));
+            a0 = vmlal_n_s16(a0, vget_low_s16(l), w[k]);
+            a1 = vmlal_n_s16(a1, vget_high_s16(l), w[k]);
+            a2 = vmlal_n_s16(a2, vget_low_s16(h), w[k]);
+            a3 = vmlal_n_s16(a3, vget_high_s16(h), w[k]);
+        }
+        vst1q_s16(out + i, vcombine_s16(vrshrn_n_s32(a0, VERT_SHIFT), vrshrn_n_s32(a1, VERT_SHIFT)));
+        vst1q_s16(out + i + 8, vcombine_s16(vrshrn_n_s32(a2, VERT_SHIFT), vrshrn_n_s32(a3, VERT_SHIFT)));
+    }
+    vfilter_tail(rows, w, taps, out, i, n);
+}
+
+static const struct scale_kernels kern_neon = {
+    VIDEO_CONV_NEON, vfilter_neon, hfilter_c,
+};
+#endif
+
+/* follows the level of video-conv, so video_conv_simd_limit covers both */
+static const struct scale_kernels *scale_kernels_get(void)
+{
+    enum video_conv_simd simd = video_conv_simd_get();
+#if defined (SCALE_NEON)
+    if (simd >= VIDEO_CONV_NEON) {
+        return &kern_neon;
+    }
+#endif
+#if defined (SCALE_AVX2)
+    if (simd >= VIDEO_CONV_AVX2) {
+        return &kern_avx2;
+    }
+#endif
+#if defined (SCALE_SSE2)
+    if (simd >= VIDEO_CONV_SSE2) {
+        return &kern_sse2;
+    }
+#endif
+    return &kern_c;
+}
+
+/******************************************************************************
+ * filter coefficients
+ ******************************************************************************/
+static int ifloor(double x)
+{
+    int i = (int)x;
+    return i > x ? i - 1 : i;
+}
+
+static void filter_deinit(struct scale_filter *f)
+{
+    free(f->pos);
+    free(f->coef);
+    free(f->coef_t);
+    f->pos = NULL;
+    f->coef = NULL;
+    f->coef_t = NULL;
+}
+
+/*
+ * weights of dst index j over src [0, src_len), indices out of the src are
+ * clamped to its edge. bilinear samples around the mapped center, area
+ * integrates the footprint [j * scale, (j + 1) * scale), upscale by area
+ * falls back to bilinear
+ */
+static int filter_init(struct scale_filter *f, int src_len, int dst_len,
+                enum video_scale_filter type)
+{
+    double scale = (double)src_len / dst_len;
+    int area = (type == VIDEO_SCALE_AREA && src_len > dst_len);
+    int taps = area ? -ifloor(-scale) + 1 : 2;
+    int span = 0;
+    int *idx = NULL;
+    double *wt = NULL;
+    int j, k, n, lo, hi, first, last, sum, big;
+
+    if (taps > src_len) {
+        taps = src_len;
+    }
+    f->taps = taps;
+    f->pos = calloc(dst_len, sizeof(int));
+    f->coef = calloc((size_t)dst_len * taps, sizeof(int16_t));
+    idx = calloc(taps + 2, sizeof(int));
+    wt = calloc(taps + 2, sizeof(double));
+    if (!f->pos || !f->coef || !idx || !wt) {
+        goto fail;
+    }
+    for (j = 0; j < dst_len; j++) {
+        int16_t *c = f->coef + (size_t)j * taps;
+        n = 0;
+        if (area) {
+            double a = j * scale, b = (j + 1) * scale;
+            for (k = ifloor(a); k < b && n < taps + 2; k++) {
+                double ov = (k + 1 < b ? k + 1 : b) - (k > a ? k : a);
+                if (ov > 0) {
+                    idx[n] = k;
+                    wt[n++] = ov / scale;
+                }
+            }
+        } else {
+            double center = (j + 0.5) * scale - 0.5;
+            k = ifloor(center);
+            idx[0] = k;
+            wt[0] = 1.0 - (center - k);
+            idx[1] = k + 1;
+            wt[1] = center - k;
+            n = 2;
+        }
+        first = src_len;
+        last = 0;
+        for (k = 0; k < n; k++) {
+            idx[k] = idx[k] < 0 ? 0 : (idx[k] >= src_len ? src_len - 1 : idx[k]);
+            first = idx[k] < first ? idx[k] : first;
+            last = idx[k] > last ? idx[k] : last;
+        }
+        f->pos[j] = first < src_len - taps ? first : src_len - taps;
+        sum = 0;
+        for (k = 0; k < n; k++) {
+            c[idx[k] - f->pos[j]] += (int16_t)(wt[k] * COEF_ONE + 0.5);
+        }
+        /* rounding may miss one, the biggest weight takes the rest */
+        big = 0;
+        for (k = 0; k < taps; k++) {
+            sum += c[k];
+            big = c[k] > c[big] ? k : big;
+        }
+        c[big] += COEF_ONE - sum;
+    }
+    /* drop the taps which are zero for every dst index, like 3 of 4 on 1/3 */
+    for (j = 0; j < dst_len; j++) {
+        int16_t *c = f->coef + (size_t)j * taps;
+        for (first = 0; first < taps && !c[first]; first++);
+        for (last = taps - 1; last > first && !c[last]; last--);
+        span = last - first + 1 > span ? last - first + 1 : span;
+    }
+    if (span < taps) {
+        for (j = 0; j < dst_len; j++) {
+            int16_t *c = f->coef + (size_t)j * taps;
+            int16_t *d = f->coef + (size_t)j * span;
+            for (first = 0; first < taps && !c[first]; first++);
+            lo = f->pos[j] + first;
+            hi = src_len - span;
+            lo = lo < hi ? lo : hi;
+            for (k = 0; k < span; k++) {
+                d[k] = lo - f->pos[j] + k < taps ? c[lo - f->pos[j] + k] : 0;
+            }
+            f->pos[j] = lo;
+        }
+        f->taps = span;
+    }
+    /* zero weight for the odd tap, its data is read but adds nothing */
+    f->pairs = (f->taps + 1) / 2;
+    f->coef_t = calloc((size_t)(dst_len + 7) / 8 * f->pairs * 16, sizeof(int16_t));
+    if (!f->coef_t) {
+        goto fail;
+    }
+    for (j = 0; j < dst_len; j++) {
+        for (k = 0; k < f->taps; k++) {
+            COEF_T(f, j, k & ~1)[k & 1] = f->coef[(size_t)j * f->taps + k];
+        }
+    }
+    free(idx);
+    free(wt);
+    return 0;
+
+fail:
+    free(idx);
+    free(wt);
+    filter_deinit(f);
+    return -1;
+}
+
+/******************************************************************************
+ * frame scaler
+ ******************************************************************************/
+#define ROW(f, p, y)    ((f)->data[p] + (size_t)(y) * (f)->linesize[p])
+
+/* dst rows [j0, j1) of plane p, d points to row j0 */
+static void scale_rows(const struct scale_kernels *k, struct video_scale *s, int p,
+                const struct video_frame *src, uint8_t *d, int d_stride, int j0, int j1)
+{
+    const struct scale_plane *sp = &s->plane[p];
+    const uint8_t *base = ROW(src, p, sp->src_y) + (size_t)sp->src_x * sp->c;
+    const int16_t *w;
+    int j, t, n;
+
+    if (sp->src_w == sp->dst_w && sp->src_h == sp->dst_h) {
+        for (j = j0; j < j1; j++, d += d_stride) {
+            memcpy(d, base + (size_t)j * src->linesize[p], (size_t)sp->dst_w * sp->c);
+        }
+        return;
+    }
+    for (j = j0; j < j1; j++, d += d_stride) {
+        w = sp->v.coef + (size_t)j * sp->v.taps;
+        /* zero weights cost a row read, leave them out */
+        for (t = 0, n = 0; t < sp->v.taps; t++) {
+            if (w[t]) {
+                s->rows[n] = base + (size_t)(sp->v.pos[j] + t) * src->linesize[p];
+                s->wv[n++] = w[t];
+            }
+        }
+        k->vfilter(s->rows, s->wv, n, s->tmp, sp->src_w * sp->c);
+        k->hfilter(s->tmp, d, &sp->h, sp->c, sp->dst_w);
+    }
+}
+
+static int plane_init(struct scale_plane *sp, const struct video_scale_conf *conf,
+                const struct scale_format *fmt, int p)
+{
+    sp->c = fmt->c[p];
+    sp->sx = p ? fmt->sx : 0;
+    sp->sy = p ? fmt->sy : 0;
+    sp->src_x = conf->crop_x >> sp->sx;
+    sp->src_y = conf->crop_y >> sp->sy;
+    sp->src_w = conf->crop_width >> sp->sx;
+    sp->src_h = conf->crop_height >> sp->sy;
+    sp->dst_w = conf->dst_width >> sp->sx;
+    sp->dst_h = conf->dst_height >> sp->sy;
+    if (filter_init(&sp->h, sp->src_w, sp->dst_w, conf->filter) < 0 ||
+        filter_init(&sp->v, sp->src_h, sp->dst_h, conf->filter) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+static int conf_check(const struct video_scale_conf *c, const struct scale_format *fmt)
+{
+    uint32_t mx, my;
+
+    if (!fmt) {
+        printf("%s:%d %s can not be scaled\n", __func__, __LINE__,
+               pixel_format_to_string(c->src_format));
+        return -1;
+    }
+    if (c->dst_format != c->src_format &&
+        !video_frame_convert_supported(c->dst_format, c->src_format)) {
+        printf("%s:%d %s -> %s not supported\n", __func__, __LINE__,
+               pixel_format_to_string(c->src_format), pixel_format_to_string(c->dst_format));
+        return -1;
+    }
+    mx = (1 << fmt->sx) - 1;
+    my = (1 << fmt->sy) - 1;
+    if (c->dst_format != c->src_format) {
+        /* video_frame_convert works on row pairs of even width */
+        mx |= 1;
+        my |= 1;
+    }
+    if (!c->crop_width || !c->crop_height || !c->dst_width || !c->dst_height ||
+        c->crop_x + c->crop_width > c->src_width ||
+        c->crop_y + c->crop_height > c->src_height ||
+        ((c->crop_x | c->crop_width) & ((1 << fmt->sx) - 1)) ||
+        ((c->crop_y | c->crop_height) & ((1 << fmt->sy) - 1)) ||
+        (c->dst_width & mx) || (c->dst_height & my)) {
+        printf("%s:%d crop %u,%u %ux%u of %ux%u -> %ux%u not supported\n", __func__, __LINE__,
+               c->crop_x, c->crop_y, c->crop_width, c->crop_height,
+               c->src_width, c->src_height, c->dst_width, c->dst_height);
+        return -1;
+    }
+    return 0;
+}
+
+struct video_scale *video_scale_create(const struct video_scale_conf *conf)
+{
+    const struct scale_format *fmt;
+    struct video_scale *s;
+    int p, taps = 0, width = 0;
+
+    if (!conf) {
+        printf("%s:%d invalid paramenters!\n", __func__, __LINE__);
+        return NULL;
+    }
+    s = calloc(1, sizeof(struct video_scale));
+    if (!s) {
+        printf("malloc video scale failed!\n");
+        return NULL;
+    }
+    s->conf = *conf;
+    if (!s->conf.crop_width || !s->conf.crop_height) {
+        s->conf.crop_x = 0;
+        s->conf.crop_y = 0;
+        s->conf.crop_width = conf->src_width;
+        s->conf.crop_height = conf->src_height;
+    }
+    fmt = scale_fmt_find(conf->src_format);
+    if (conf_check(&s->conf, fmt) < 0) {
+        free(s);
+        return NULL;
+    }
+    s->planes = fmt->planes;
+    for (p = 0; p < s->planes; p++) {
+        if (plane_init(&s->plane[p], &s->conf, fmt, p) < 0) {
+            goto fail;
+        }
+        taps = s->plane[p].v.taps > taps ? s->plane[p].v.taps : taps;
+        width = s->plane[p].src_w * s->plane[p].c > width ? s->plane[p].src_w * s->plane[p].c : width;
+    }
+    s->rows = calloc(taps, sizeof(*s->rows));
+    s->wv = calloc(taps, sizeof(*s->wv));
+    s->tmp = calloc(width + TMP_SLACK, sizeof(*s->tmp));
+    if (!s->rows || !s->wv || !s->tmp) {
+        goto fail;
+    }
+    s->convert = (conf->dst_format != conf->src_format);
+    if (s->convert && video_frame_init(&s->band, conf->src_format, conf->dst_width,
+                    SCALE_BAND_ROWS, MEDIA_MEM_DEEP) < 0) {
+        goto fail;
+    }
+    return s;
+
+fail:
+    printf("%s:%d alloc filters failed!\n", __func__, __LINE__);
+    video_scale_destroy(s);
+    return NULL;
+}
+
+void video_scale_destroy(struct video_scale *s)
+{
+    int p;
+
+    if (!s) {
+        return;
+    }
+    for (p = 0; p < s->planes; p++) {
+        filter_deinit(&s->plane[p].h);
+        filter_deinit(&s->plane[p].v);
+    }
+    video_frame_deinit(&s->band);
+    free(s->rows);
+    free(s->wv);
+    free(s->tmp);
+    free(s);
+}
+
+int video_scale_frame(struct video_scale *s, struct video_frame *dst,
+                const struct video_frame *src)
+{
+    const struct scale_kernels *k = scale_kernels_get();
+    struct video_frame bv, dv;
+    int p, y0, y1;
+
+    if (!s || !dst || !src || !dst->data[0] || !src->data[0]) {
+        printf("%s:%d invalid paramenters!\n", __func__, __LINE__);
+        return -1;
+    }
+    if (src->format != s->conf.src_format || src->width != s->conf.src_width ||
+        src->height != s->conf.src_height || dst->format != s->conf.dst_format ||
+        dst->width != s->conf.dst_width || dst->height != s->conf.dst_height) {
+        printf("%s:%d frames do not match the scaler\n", __func__, __LINE__);
+        return -1;
+    }
+    if (!s->convert) {
+        for (p = 0; p < s->planes; p++) {
+            scale_rows(k, s, p, src, dst->data[p], dst->linesize[p], 0, s->plane[p].dst_h);
+        }
+    } else {
+        /* scale a band in the src format, convert it while it is in cache */
+        for (y0 = 0; y0 < (int)s->conf.dst_height; y0 = y1) {
+            y1 = y0 + SCALE_BAND_ROWS;
+            y1 = y1 < (int)s->conf.dst_height ? y1 : (int)s->conf.dst_height;
+            bv = s->band;
+            bv.height = y1 - y0;
+            for (p = 0; p < s->planes; p++) {
+                const struct scale_plane *sp = &s->plane[p];
+                scale_rows(k, s, p, src, bv.data[p], bv.linesize[p], y0 >> sp->sy, y1 >> sp->sy);
+            }
+            dv = *dst;
+            dv.height = y1 - y0;
+            for (p = 0; p < dst->planes; p++) {
+                /* every yuv dst is 4:2:0, chroma rows are halved */
+                dv.data[p] = ROW(dst, p, p ? y0 / 2 : y0);
+            }
+            if (video_frame_convert(&dv, &bv) < 0) {
+                return -1;
+            }
+        }
+    }
+    dst->timestamp = src->timestamp;
+    dst->frame_id = src->frame_id;
+    return 0;
+}
@@ -0,0 +1,68 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#ifndef VIDEO_SCALE_H
+#define VIDEO_SCALE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * crop and scale of I420/NV12/I422/I444/Y800 and packed RGBA/BGRA/BGRX/
+ * RGB24, optionally fused with a video_frame_convert from the src format.
+ * the filter of each plane and direction is computed once at create, rows
+ * go through a vertical simd pass and a horizontal table pass.
+ * a context is not thread safe, use one per thread
+ */
+enum video_scale_filter {
+    VIDEO_SCALE_BILINEAR = 0,   /* 2 taps, fast, aliases under 1/2 */
+    VIDEO_SCALE_AREA,           /* box average of the src footprint */
+};
+
+struct video_scale_conf {
+    enum pixel_format       src_format;
+    uint32_t                src_width;
+    uint32_t                src_height;
+    uint32_t                crop_x;         /* crop_width 0 takes whole src */
+    uint32_t                crop_y;
+    uint32_t                crop_width;
+    uint32_t                crop_height;
+    enum pixel_format       dst_format;
+    uint32_t                dst_width;
+    uint32_t                dst_height;
+    enum video_scale_filter filter;
+};
+
+struct video_scale;
+
+GEAR_API struct video_scale *video_scale_create(const struct video_scale_conf *conf);
+GEAR_API void video_scale_destroy(struct video_scale *s);
+GEAR_API int video_scale_frame(struct video_scale *s, struct video_frame *dst,
+                const struct video_frame *src);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,707 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#include "libmempool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#define MEMPOOL_ALIGN           16
+#define ALIGN_UP(x, a)          (((x) + ((a) - 1)) & ~((size_t)(a) - 1))
+#define ARENA_DEFAULT_BLOCK     (4096)
+#define MEMPOOL_CACHE_DEFAULT   (64)
+#define MEMPOOL_LIVE_BATCH      (16)
+
+/******************************************************************************
+ * arena APIs
+ ******************************************************************************/
+struct arena_block {
+    struct arena_block *next;
+    size_t size;
+    size_t used;
+};
+
+#define BLOCK_HDR       ALIGN_UP(sizeof(struct arena_block), MEMPOOL_ALIGN)
+#define BLOCK_DATA(b)   ((uint8_t *)(b) + BLOCK_HDR)
+
+struct arena {
+    size_t block_size;
+    size_t used;
+    size_t reserved;
+    struct arena_block *head;   /* current block, older blocks follow */
+};
+
+static struct arena_block *arena_block_new(struct arena *a, size_t size)
+{
+    struct arena_block *b;
+    b = (struct arena_block *)malloc(BLOCK_HDR + size);
+    if (!b) {
+        printf("malloc arena_block failed!\n");
+        return NULL;
+    }
+    b->next = NULL;
+    b->size = size;
+    b->used = 0;
+    a->reserved += size;
+    return b;
+}
+
+struct arena *arena_create(size_t block_size)
+{
+    struct arena *a = CALLOC(1, struct arena);
+    if (!a) {
+        printf("malloc arena failed!\n");
+        return NULL;
+    }
+    a->block_size = block_size ? block_size : ARENA_DEFAULT_BLOCK;
+    a->head = arena_block_new(a, a->block_size);
+    if (!a->head) {
+        free(a);
+        return NULL;
+    }
+    return a;
+}
+
+void arena_destroy(struct arena *a)
+{
+    struct arena_block *b, *next;
+    if (!a) {
+        return;
+    }
+    for (b = a->head; b; b = next) {
+        next = b->next;
+        free(b);
+    }
+    free(a);
+}
+
+void *arena_alloc_align(struct arena *a, size_t size, size_t align)
+{
+    size_t off;
+    uintptr_t base;
+    struct arena_block *b;
+
+    if (!a || !size || (align & (align - 1))) {
+        return NULL;
+    }
+    if (align < sizeof(void *)) {
+        align = sizeof(void *);
+    }
+    b = a->head;
+    base = (uintptr_t)BLOCK_DATA(b);
+    off = ALIGN_UP(base + b->used, align) - base;
+    if (off + size > b->size) {
+        if (size + align > a->block_size / 4) {
+            /* big object gets its own block behind head, keep head usable */
+            b = arena_block_new(a, size + align);
+            if (!b) {
+                return NULL;
+            }
+            b->next = a->head->next;
+            a->head->next = b;
+        } else {
+            b = arena_block_new(a, a->block_size);
+            if (!b) {
+                return NULL;
+            }
+            b->next = a->head;
+            a->head = b;
+        }
+        base = (uintptr_t)BLOCK_DATA(b);
+        off = ALIGN_UP(base + b->used, align) - base;
+    }
+    b->used = off + size;
+    a->used += size;
+    return BLOCK_DATA(b) + off;
+}
+
+void *arena_alloc(struct arena *a, size_t size)
+{
+    return arena_alloc_align(a, size, MEMPOOL_ALIGN);
+}
+
+void *arena_calloc(struct arena *a, size_t n, size_t size)
+{
+    void *p;
+    if (size && n > SIZE_MAX / size) {
+        return NULL;
+    }
+    p = arena_alloc(a, n * size);
+    if (p) {
+        memset(p, 0, n * size);
+    }
+    return p;
+}
+
+void *arena_memdup(struct arena *a, const void *src, size_t size)
+{
+    void *p = arena_alloc_align(a, size, 1);
+    if (p) {
+        memcpy(p, src, size);
+    }
+    return p;
+}
+
+char *arena_strndup(struct arena *a, const char *s, size_t n)
+{
+    char *p;
+    if (!s) {
+        return NULL;
+    }
+    n = strnlen(s, n);
+    p = (char *)arena_alloc_align(a, n + 1, 1);
+    if (p) {
+        memcpy(p, s, n);
+        p[n] = '\0';
+    }
+    return p;
+}
+
+char *arena_strdup(struct arena *a, const char *s)
+{
+    return s ? arena_strndup(a, s, strlen(s)) : NULL;
+}
+
+void arena_reset(struct arena *a)
+{
+    struct arena_block *b, *next, *keep = NULL;
+    if (!a) {
+        return;
+    }
+    for (b = a->head; b; b = next) {
+        next = b->next;
+        if (!keep && b->size == a->block_size) {
+            keep = b;
+            continue;
+        }
+        free(b);
+    }
+    keep->next = NULL;
+    keep->used = 0;
+    a->head = keep;
+    a->used = 0;
+    a->reserved = a->block_size;
+}
+
+size_t arena_used(struct arena *a)
+{
+    return a ? a->used : 0;
+}
+
+size_t arena_reserved(struct arena *a)
+{
+    return a ? a->reserved : 0;
+}
+
+/******************************************************************************
+ * mempool APIs
+ ******************************************************************************/
+struct mempool_obj {
+    struct mempool_obj *next;
+};
+
+struct mempool_chunk {
+    struct mempool_chunk *next;
+};
+
+/*
+ * per thread object cache, only owner thread touches head/count,
+ * alloc/free counters are read by mempool_get_stats of other threads
+ */
+struct mempool_cache {
+    struct mempool *pool;
+    struct mempool_obj *head;
+    int count;
+    int live_delta;             /* alloc - free not yet added to pool live */
+    uint64_t alloc;
+    uint64_t free;
+    struct list_head entry;
+};
+
+struct mempool {
+    pthread_mutex_t lock;
+    size_t obj_size;
+    int nobjs;
+    int cache_max;
+    pthread_key_t key;
+    struct mempool_obj *free_list;
+    struct mempool_obj *remote;     /* lock-free stack of freed objects */
+    struct mempool_chunk *chunks;
+    struct list_head caches;
+    size_t total;
+    size_t chunk_nr;
+    uint64_t alloc;
+    uint64_t free;
+    int64_t live;
+    int64_t peak;
+    uint64_t remote_free;
+};
+
+static void live_add(struct mempool *p, int64_t n)
+{
+    int64_t now = __atomic_add_fetch(&p->live, n, __ATOMIC_RELAXED);
+    int64_t peak = __atomic_load_n(&p->peak, __ATOMIC_RELAXED);
+    while (now > peak &&
+           !__atomic_compare_exchange_n(&p->peak, &peak, now, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+/* batch live counting of a cache, one shared atomic per 16 ops */
+static inline void cache_live(struct mempool_cache *c, int n)
+{
+    c->live_delta += n;
+    if (c->live_delta >= MEMPOOL_LIVE_BATCH ||
+        c->live_delta <= -MEMPOOL_LIVE_BATCH) {
+        live_add(c->pool, c->live_delta);
+        c->live_delta = 0;
+    }
+}
+
+static int mempool_grow(struct mempool *p)
+{
+    int i;
+    uint8_t *obj;
+    struct mempool_obj *o;
+    size_t hdr = ALIGN_UP(sizeof(struct mempool_chunk), MEMPOOL_ALIGN);
+    struct mempool_chunk *c;
+
+    c = (struct mempool_chunk *)malloc(hdr + p->obj_size * p->nobjs);
+    if (!c) {
+        printf("malloc mempool chunk failed!\n");
+        return -1;
+    }
+    c->next = p->chunks;
+    p->chunks = c;
+    obj = (uint8_t *)c + hdr;
+    /* link backward so objects are handed out in address order */
+    for (i = p->nobjs - 1; i >= 0; i--) {
+        o = (struct mempool_obj *)(obj + i * p->obj_size);
+        o->next = p->free_list;
+        p->free_list = o;
+    }
+    p->total += p->nobjs;
+    p->chunk_nr++;
+    return 0;
+}
+
+/* push chain head..tail to remote stack, safe from any thread */
+static void remote_push(struct mempool *p, struct mempool_obj *head,
+                struct mempool_obj *tail)
+{
+    struct mempool_obj *old = __atomic_load_n(&p->remote, __ATOMIC_RELAXED);
+    do {
+        tail->next = old;
+    } while (!__atomic_compare_exchange_n(&p->remote, &old, head, true,
+                __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/* move remote stack to free list, pop all at once so no ABA */
+static void remote_drain(struct mempool *p)
+{
+    struct mempool_obj *o, *next;
+    o = __atomic_exchange_n(&p->remote, NULL, __ATOMIC_ACQUIRE);
+    for (; o; o = next) {
+        next = o->next;
+        o->next = p->free_list;
+        p->free_list = o;
+    }
+}
+
+static void cache_flush(struct mempool_cache *c, int keep)
+{
+    int n = c->count - keep;
+    struct mempool_obj *head, *tail;
+    if (n <= 0) {
+        return;
+    }
+    head = tail = c->head;
+    while (--n > 0) {
+        tail = tail->next;
+    }
+    c->head = tail->next;
+    __atomic_add_fetch(&c->pool->remote_free, c->count - keep, __ATOMIC_RELAXED);
+    c->count = keep;
+    remote_push(c->pool, head, tail);
+}
+
+static void cache_release(void *arg)
+{
+    struct mempool_cache *c = (struct mempool_cache *)arg;
+    struct mempool *p = c->pool;
+    cache_flush(c, 0);
+    live_add(p, c->live_delta);
+    pthread_mutex_lock(&p->lock);
+    list_del(&c->entry);
+    p->alloc += c->alloc;
+    p->free += c->free;
+    pthread_mutex_unlock(&p->lock);
+    free(c);
+}
+
+static struct mempool_cache *cache_get(struct mempool *p)
+{
+    struct mempool_cache *c;
+    c = (struct mempool_cache *)pthread_getspecific(p->key);
+    if (__atomic_load_n(&p->cache_max, __ATOMIC_RELAXED) <= 0) {
+        /* cache disabled at runtime, give back what is left */
+        if (c && c->count) {
+            cache_flush(c, 0);
+        }
+        if (c && c->live_delta) {
+            live_add(p, c->live_delta);
+            c->live_delta = 0;
+        }
+        return NULL;
+    }
+    if (c) {
+        return c;
+    }
+    c = CALLOC(1, struct mempool_cache);
+    if (!c) {
+        return NULL;
+    }
+    c->pool = p;
+    pthread_mutex_lock(&p->lock);
+    list_add_tail(&c->entry, &p->caches);
+    pthread_mutex_unlock(&p->lock);
+    pthread_setspecific(p->key, c);
+    return c;
+}
+
+/* take up to n objects from global list into cache, return taken */
+static int cache_refill(struct mempool *p, struct mempool_cache *c, int n)
+{
+    int i;
+    struct mempool_obj *o;
+    pthread_mutex_lock(&p->lock);
+    if (!p->free_list) {
+        remote_drain(p);
+    }
+    if (!p->free_list && 0 != mempool_grow(p)) {
+        pthread_mutex_unlock(&p->lock);
+        return 0;
+    }
+    for (i = 0; i < n && p->free_list; i++) {
+        o = p->free_list;
+        p->free_list = o->next;
+        o->next = c->head;
+        c->head = o;
+    }
+    pthread_mutex_unlock(&p->lock);
+    c->count += i;
+    return i;
+}
+
+struct mempool *mempool_create(size_t obj_size, int nobjs)
+{
+    struct mempool *p;
+    if (obj_size == 0 || nobjs <= 0) {
+        printf("%s:%d paraments is invalid\n", __func__, __LINE__);
+        return NULL;
+    }
+    p = CALLOC(1, struct mempool);
+    if (!p) {
+        printf("malloc mempool failed!\n");
+        return NULL;
+    }
+    if (obj_size < sizeof(struct mempool_obj)) {
+        obj_size = sizeof(struct mempool_obj);
+    }
+    p->obj_size = ALIGN_UP(obj_size, MEMPOOL_ALIGN);
+    p->nobjs = nobjs;
+    p->cache_max = MEMPOOL_CACHE_DEFAULT;
+    INIT_LIST_HEAD(&p->caches);
+    if (0 != pthread_key_create(&p->key, cache_release)) {
+        printf("pthread_key_create failed!\n");
+        free(p);
+        return NULL;
+    }
+    pthread_mutex_init(&p->lock, NULL);
+    if (0 != mempool_grow(p)) {
+        pthread_key_delete(p->key);
+        pthread_mutex_destroy(&p->lock);
+        free(p);
+        return NULL;
+    }
+    return p;
+}
+
+void mempool_destroy(struct mempool *p)
+{
+    struct mempool_chunk *c, *next;
+    struct mempool_cache *pc, *pnext;
+    struct mempool_stats st;
+    if (!p) {
+        return;
+    }
+    mempool_get_stats(p, &st);
+    if (st.in_use) {
+        printf("mempool destroy with %zu objects in use\n", st.in_use);
+    }
+    /* destructor is not called after key delete, free caches of all threads */
+    pthread_key_delete(p->key);
+    list_for_each_entry_safe(pc, pnext, &p->caches, entry) {
+        list_del(&pc->entry);
+        free(pc);
+    }
+    for (c = p->chunks; c; c = next) {
+        next = c->next;
+        free(c);
+    }
+    pthread_mutex_destroy(&p->lock);
+    free(p);
+}
+
+int mempool_set_thread_cache(struct mempool *p, int nobjs)
+{
+    if (!p || nobjs < 0) {
+        return -1;
+    }
+    __atomic_store_n(&p->cache_max, nobjs, __ATOMIC_RELAXED);
+    return 0;
+}
+
+void *mempool_alloc(struct mempool *p)
+{
+    struct mempool_obj *o;
+    struct mempool_cache *c;
+    if (!p) {
+        return NULL;
+    }
+    c = cache_get(p);
+    if (c) {
+        if (!c->head && 0 == cache_refill(p, c,
+                        MAX2(__atomic_load_n(&p->cache_max, __ATOMIC_RELAXED) / 2, 1))) {
+            return NULL;
+        }
+        o = c->head;
+        c->head = o->next;
+        c->count--;
+        __atomic_store_n(&c->alloc, c->alloc + 1, __ATOMIC_RELAXED);
+        cache_live(c, 1);
+        return o;
+    }
+    pthread_mutex_lock(&p->lock);
+    if (!p->free_list) {
+        remote_drain(p);
+    }
+    if (!p->free_list && 0 != mempool_grow(p)) {
+        pthread_mutex_unlock(&p->lock);
+        return NULL;
+    }
+    o = p->free_list;
+    p->free_list = o->next;
+    p->alloc++;
+    pthread_mutex_unlock(&p->lock);
+    live_add(p, 1);
+    return o;
+}
+
+void *mempool_calloc(struct mempool *p)
+{
+    void *o = mempool_alloc(p);
+    if (o) {
+        memset(o, 0, p->obj_size);
+    }
+    return o;
+}
+
+void mempool_free(struct mempool *p, void *obj)
+{
+    int max;
+    struct mempool_obj *o = (struct mempool_obj *)obj;
+    struct mempool_cache *c;
+    if (!p || !o) {
+        return;
+    }
+    c = cache_get(p);
+    if (c) {
+        o->next = c->head;
+        c->head = o;
+        c->count++;
+        __atomic_store_n(&c->free, c->free + 1, __ATOMIC_RELAXED);
+        cache_live(c, -1);
+        max = __atomic_load_n(&p->cache_max, __ATOMIC_RELAXED);
+        if (c->count > max) {
+            cache_flush(c, max / 2);
+        }
+        return;
+    }
+    /* no cache, object may come from any thread, free without lock */
+    remote_push(p, o, o);
+    __atomic_add_fetch(&p->free, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&p->remote_free, 1, __ATOMIC_RELAXED);
+    live_add(p, -1);
+}
+
+int mempool_get_stats(struct mempool *p, struct mempool_stats *st)
+{
+    int64_t peak;
+    struct mempool_cache *c;
+    if (!p || !st) {
+        return -1;
+    }
+    memset(st, 0, sizeof(*st));
+    pthread_mutex_lock(&p->lock);
+    st->obj_size = p->obj_size;
+    st->total = p->total;
+    st->chunks = p->chunk_nr;
+    st->alloc = p->alloc;
+    st->free = __atomic_load_n(&p->free, __ATOMIC_RELAXED);
+    list_for_each_entry(c, &p->caches, entry) {
+        st->alloc += __atomic_load_n(&c->alloc, __ATOMIC_RELAXED);
+        st->free += __atomic_load_n(&c->free, __ATOMIC_RELAXED);
+        st->caches++;
+    }
+    pthread_mutex_unlock(&p->lock);
+    st->in_use = st->alloc > st->free ? (size_t)(st->alloc - st->free) : 0;
+    peak = __atomic_load_n(&p->peak, __ATOMIC_RELAXED);
+    st->peak = MAX2(peak > 0 ? (size_t)peak : 0, st->in_use);
+    st->remote_free = __atomic_load_n(&p->remote_free, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/******************************************************************************
+ * size class APIs
+ ******************************************************************************/
+#define SC_MIN_SHIFT    4
+#define SC_NUM          9   /* 16 .. 4096 */
+
+struct mempool_sc {
+    int nobjs;
+    struct mempool *pools[SC_NUM];
+};
+
+static int sc_index(size_t size)
+{
+    int i = 0;
+    size_t cls = (size_t)1 << SC_MIN_SHIFT;
+    while (cls < size) {
+        cls <<= 1;
+        i++;
+    }
+    return i;
+}
+
+static struct mempool *sc_pool(struct mempool_sc *sc, int i)
+{
+    struct mempool *p, *old = NULL;
+    p = __atomic_load_n(&sc->pools[i], __ATOMIC_ACQUIRE);
+    if (LIKELY(p != NULL)) {
+        return p;
+    }
+    p = mempool_create((size_t)1 << (i + SC_MIN_SHIFT), sc->nobjs);
+    if (!p) {
+        return NULL;
+    }
+    if (!__atomic_compare_exchange_n(&sc->pools[i], &old, p, false,
+                __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        /* another thread created it first */
+        mempool_destroy(p);
+        p = old;
+    }
+    return p;
+}
+
+struct mempool_sc *mempool_sc_create(int nobjs)
+{
+    struct mempool_sc *sc;
+    if (nobjs <= 0) {
+        printf("%s:%d paraments is invalid\n", __func__, __LINE__);
+        return NULL;
+    }
+    sc = CALLOC(1, struct mempool_sc);
+    if (!sc) {
+        printf("malloc mempool_sc failed!\n");
+        return NULL;
+    }
+    sc->nobjs = nobjs;
+    return sc;
+}
+
+void mempool_sc_destroy(struct mempool_sc *sc)
+{
+    int i;
+    if (!sc) {
+        return;
+    }
+    for (i = 0; i < SC_NUM; i++) {
+        mempool_destroy(sc->pools[i]);
+    }
+    free(sc);
+}
+
+void *mempool_sc_alloc(struct mempool_sc *sc, size_t size)
+{
+    struct mempool *p;
+    if (!sc) {
+        return NULL;
+    }
+    if (size > MEMPOOL_SC_MAX) {
+        return malloc(size);
+    }
+    p = sc_pool(sc, sc_index(size));
+    return p ? mempool_alloc(p) : NULL;
+}
+
+void mempool_sc_free(struct mempool_sc *sc, void *ptr, size_t size)
+{
+    if (!sc || !ptr) {
+        return;
+    }
+    if (size > MEMPOOL_SC_MAX) {
+        free(ptr);
+        return;
+    }
+    mempool_free(sc->pools[sc_index(size)], ptr);
+}
+
+int mempool_sc_get_stats(struct mempool_sc *sc, size_t size,
+        struct mempool_stats *st)
+{
+    if (!sc || size > MEMPOOL_SC_MAX) {
+        return -1;
+    }
+    return mempool_get_stats(
+            __atomic_load_n(&sc->pools[sc_index(size)], __ATOMIC_ACQUIRE), st);
+}
+
+static void *sc_hook_alloc(size_t size, void *arg)
+{
+    return mempool_sc_alloc((struct mempool_sc *)arg, size);
+}
+
+static void sc_hook_free(void *ptr, size_t size, void *arg)
+{
+    mempool_sc_free((struct mempool_sc *)arg, ptr, size);
+}
+
+void mempool_sc_allocator(struct mempool_sc *sc, struct gear_allocator *a)
+{
+    if (!a) {
+        return;
+    }
+    a->alloc = sc_hook_alloc;
+    a->free = sc_hook_free;
+    a->arg = sc;
+}
@@ -0,0 +1,122 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#ifndef LIBMEMPOOL_H
+#define LIBMEMPOOL_H
+
+#include <libposix.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define LIBMEMPOOL_VERSION "0.1.0"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * arena is a bump allocator for objects sharing one lifetime, such as a
+ * parsed request or config tree. alloc is a pointer increment, there is
+ * no free of single object, arena_reset or arena_destroy frees all.
+ * not thread safe.
+ */
+struct arena;
+
+GEAR_API struct arena *arena_create(size_t block_size);
+GEAR_API void arena_destroy(struct arena *a);
+GEAR_API void *arena_alloc(struct arena *a, size_t size);
+GEAR_API void *arena_alloc_align(struct arena *a, size_t size, size_t align);
+GEAR_API void *arena_calloc(struct arena *a, size_t n, size_t size);
+GEAR_API void *arena_memdup(struct arena *a, const void *src, size_t size);
+GEAR_API char *arena_strdup(struct arena *a, const char *s);
+GEAR_API char *arena_strndup(struct arena *a, const char *s, size_t n);
+
+/* free all objects but keep the first block for reuse */
+GEAR_API void arena_reset(struct arena *a);
+
+/* bytes handed out and bytes reserved from system */
+GEAR_API size_t arena_used(struct arena *a);
+GEAR_API size_t arena_reserved(struct arena *a);
+
+/*
+ * mempool is a thread safe pool of fixed size objects, objects are carved
+ * from chunks of nobjs and kept in free list after mempool_free, memory
+ * is only returned to system on mempool_destroy.
+ *
+ * each thread keeps a small cache of free objects, alloc and free hit the
+ * cache without lock, cache refills half from global list under lock and
+ * overflow is pushed back by a lock-free stack, so object allocated in one
+ * thread and freed in another never takes the lock on free path.
+ */
+struct mempool;
+
+struct mempool_stats {
+    size_t obj_size;
+    size_t total;       /* objects carved from chunks */
+    size_t in_use;
+    size_t chunks;
+    size_t caches;      /* live thread caches */
+    uint64_t alloc;
+    uint64_t free;
+    size_t peak;        /* high-water mark of in_use */
+    uint64_t remote_free;   /* objects returned by the lock-free stack */
+};
+
+GEAR_API struct mempool *mempool_create(size_t obj_size, int nobjs);
+GEAR_API void mempool_destroy(struct mempool *p);
+
+/* max objects cached per thread, default 64, 0 disables thread cache */
+GEAR_API int mempool_set_thread_cache(struct mempool *p, int nobjs);
+GEAR_API void *mempool_alloc(struct mempool *p);
+GEAR_API void *mempool_calloc(struct mempool *p);
+GEAR_API void mempool_free(struct mempool *p, void *obj);
+/*
+ * peak is synced from thread caches every 16 alloc/free, it may lag the
+ * exact high-water mark by that many objects per thread. remote_free
+ * counts frees which went to the lock-free stack, freed by a thread whose
+ * cache overflowed or which has none, i.e. mostly cross thread frees
+ */
+GEAR_API int mempool_get_stats(struct mempool *p, struct mempool_stats *st);
+
+/*
+ * size class front end, one mempool per power of two class from 16 to
+ * MEMPOOL_SC_MAX bytes, created on first use, bigger sizes go to malloc.
+ * free takes the size passed to alloc, objects carry no header.
+ * mempool_sc_allocator fills a gear_allocator for gear_set_allocator, so
+ * modules allocating by gear_alloc are served by the classes.
+ */
+#define MEMPOOL_SC_MAX      (4096)
+
+struct mempool_sc;
+
+GEAR_API struct mempool_sc *mempool_sc_create(int nobjs);
+GEAR_API void mempool_sc_destroy(struct mempool_sc *sc);
+GEAR_API void *mempool_sc_alloc(struct mempool_sc *sc, size_t size);
+GEAR_API void mempool_sc_free(struct mempool_sc *sc, void *ptr, size_t size);
+/* stats of class serving size, -1 if it's not created yet or too big */
+GEAR_API int mempool_sc_get_stats(struct mempool_sc *sc, size_t size,
+                struct mempool_stats *st);
+GEAR_API void mempool_sc_allocator(struct mempool_sc *sc, struct gear_allocator *a);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
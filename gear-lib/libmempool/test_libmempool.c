@@ -0,0 +1,195 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include "libmempool.h"
+
+struct node {
+    int id;
+    char *name;
+    struct node *next;
+};
+
+static int foo_arena(void)
+{
+    int i;
+    char buf[32];
+    struct node *head = NULL, *n;
+    struct arena *a = arena_create(1024);
+    if (!a) {
+        printf("arena_create failed!\n");
+        return -1;
+    }
+    for (i = 0; i < 100; i++) {
+        n = (struct node *)arena_calloc(a, 1, sizeof(struct node));
+        snprintf(buf, sizeof(buf), "node-%d", i);
+        n->id = i;
+        n->name = arena_strdup(a, buf);
+        n->next = head;
+        head = n;
+    }
+    /* big object goes to its own block */
+    arena_alloc(a, 8192);
+    printf("arena used=%zu reserved=%zu head=%s\n",
+           arena_used(a), arena_reserved(a), head->name);
+    arena_reset(a);
+    printf("arena reset used=%zu reserved=%zu\n", arena_used(a), arena_reserved(a));
+    arena_destroy(a);
+    return 0;
+}
+
+#define POOL_THREADS    4
+#define POOL_LOOPS      100000
+
+static void *pool_worker(void *arg)
+{
+    int i, j;
+    void *objs[16];
+    struct mempool *p = (struct mempool *)arg;
+    for (i = 0; i < POOL_LOOPS; i++) {
+        for (j = 0; j < 16; j++) {
+            objs[j] = mempool_alloc(p);
+            memset(objs[j], j, sizeof(struct node));
+        }
+        for (j = 0; j < 16; j++) {
+            mempool_free(p, objs[j]);
+        }
+    }
+    return NULL;
+}
+
+static int foo_mempool(void)
+{
+    int i;
+    pthread_t tid[POOL_THREADS];
+    struct mempool_stats st;
+    struct mempool *p = mempool_create(sizeof(struct node), 32);
+    if (!p) {
+        printf("mempool_create failed!\n");
+        return -1;
+    }
+    for (i = 0; i < POOL_THREADS; i++) {
+        pthread_create(&tid[i], NULL, pool_worker, p);
+    }
+    for (i = 0; i < POOL_THREADS; i++) {
+        pthread_join(tid[i], NULL);
+    }
+    mempool_get_stats(p, &st);
+    printf("mempool obj_size=%zu total=%zu in_use=%zu chunks=%zu "
+           "alloc=%" PRIu64 " free=%" PRIu64 "\n", st.obj_size, st.total,
+           st.in_use, st.chunks, st.alloc, st.free);
+    mempool_destroy(p);
+    return 0;
+}
+
+#define XFER_OBJS       1000
+
+/* objects allocated in one thread and freed in another */
+static void *xfer_alloc(void *arg)
+{
+    int i;
+    void **objs = (void **)arg;
+    struct mempool *p = (struct mempool *)objs[XFER_OBJS];
+    for (i = 0; i < XFER_OBJS; i++) {
+        objs[i] = mempool_alloc(p);
+    }
+    return NULL;
+}
+
+static void *xfer_free(void *arg)
+{
+    int i;
+    void **objs = (void **)arg;
+    struct mempool *p = (struct mempool *)objs[XFER_OBJS];
+    for (i = 0; i < XFER_OBJS; i++) {
+        mempool_free(p, objs[i]);
+    }
+    return NULL;
+}
+
+static int foo_xfer(void)
+{
+    int i;
+    pthread_t tid;
+    struct mempool_stats st;
+    void *objs[XFER_OBJS + 1];
+    struct mempool *p = mempool_create(64, 256);
+    if (!p) {
+        printf("mempool_create failed!\n");
+        return -1;
+    }
+    objs[XFER_OBJS] = p;
+    for (i = 0; i < 100; i++) {
+        pthread_create(&tid, NULL, xfer_alloc, objs);
+        pthread_join(tid, NULL);
+        pthread_create(&tid, NULL, xfer_free, objs);
+        pthread_join(tid, NULL);
+    }
+    mempool_get_stats(p, &st);
+    printf("xfer total=%zu in_use=%zu peak=%zu remote_free=%" PRIu64
+           " chunks=%zu caches=%zu\n", st.total, st.in_use, st.peak,
+           st.remote_free, st.chunks, st.caches);
+    mempool_destroy(p);
+    return 0;
+}
+
+static int foo_sc(void)
+{
+    int i;
+    void *objs[64];
+    size_t sizes[4] = {24, 100, 1000, 10000};
+    struct mempool_stats st;
+    struct gear_allocator a;
+    struct mempool_sc *sc = mempool_sc_create(32);
+    if (!sc) {
+        printf("mempool_sc_create failed!\n");
+        return -1;
+    }
+    mempool_sc_allocator(sc, &a);
+    gear_set_allocator(&a);
+    for (i = 0; i < 64; i++) {
+        objs[i] = gear_calloc(sizes[i % 4]);
+    }
+    mempool_sc_get_stats(sc, 100, &st);
+    printf("sc class %zu in_use=%zu\n", st.obj_size, st.in_use);
+    for (i = 0; i < 64; i++) {
+        gear_free(objs[i], sizes[i % 4]);
+    }
+    mempool_sc_get_stats(sc, 100, &st);
+    printf("sc class %zu in_use=%zu, 10000 bytes pooled %d\n", st.obj_size,
+           st.in_use, mempool_sc_get_stats(sc, 10000, &st) == 0);
+    gear_set_allocator(NULL);
+    mempool_sc_destroy(sc);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    foo_arena();
+    foo_mempool();
+    foo_xfer();
+    foo_sc();
+    return 0;
+}
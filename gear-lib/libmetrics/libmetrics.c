@@ -0,0 +1,590 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#include "libmetrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <inttypes.h>
+#include <pthread.h>
+
+#define METRICS_CACHELINE       (64)
+#define METRICS_LINE_CELLS      (METRICS_CACHELINE / sizeof(uint64_t))
+#define METRICS_HIST_DEFAULT    (20)
+#define METRICS_RENDER_INIT     (4096)
+
+struct metric_family;
+
+/*
+ * one series. cells hold METRICS_SLOTS rows of stride uint64 each, a row
+ * starts on its own cache line. a counter row is one cell, a histogram row
+ * is nbounds + 1 buckets then sum and count. a gauge has one row
+ */
+struct metric {
+    struct metric *next;
+    struct metric_family *fam;
+    char *labels;
+    int stride;
+    uint64_t *cells;
+};
+
+struct metric_family {
+    struct metric_family *next;
+    char name[METRICS_NAME_MAX];
+    char *help;
+    enum metric_type type;
+    int nbounds;
+    uint64_t bounds[METRICS_BUCKETS_MAX];
+    struct metric *series;
+    struct metric **tail;
+};
+
+struct metrics_collector {
+    metrics_collect_cb cb;
+    void *arg;
+};
+
+struct metrics {
+    pthread_mutex_t lock;
+    struct metric_family *fams;
+    struct metric_family **tail;
+    struct metrics_collector *collectors;
+    int ncollector;
+};
+
+struct metrics_writer {
+    char *buf;
+    size_t len;
+    size_t cap;
+    bool oom;
+    char last[METRICS_NAME_MAX];
+};
+
+static __thread int _metrics_slot = -1;
+static int _metrics_next_slot;
+
+static inline int metrics_slot(void)
+{
+    if (_metrics_slot < 0) {
+        _metrics_slot = __atomic_fetch_add(&_metrics_next_slot, 1, __ATOMIC_RELAXED) % METRICS_SLOTS;
+    }
+    return _metrics_slot;
+}
+
+/******************************************************************************
+ * registry
+ ******************************************************************************/
+struct metrics *metrics_create(void)
+{
+    struct metrics *m = calloc(1, sizeof(struct metrics));
+    if (!m) {
+        printf("malloc metrics failed!\n");
+        return NULL;
+    }
+    pthread_mutex_init(&m->lock, NULL);
+    m->tail = &m->fams;
+    return m;
+}
+
+void metrics_destroy(struct metrics *m)
+{
+    struct metric_family *f, *fn;
+    struct metric *s, *sn;
+
+    if (!m) {
+        return;
+    }
+    for (f = m->fams; f; f = fn) {
+        fn = f->next;
+        for (s = f->series; s; s = sn) {
+            sn = s->next;
+            free(s->labels);
+            free(s->cells);
+            free(s);
+        }
+        free(f->help);
+        free(f);
+    }
+    free(m->collectors);
+    pthread_mutex_destroy(&m->lock);
+    free(m);
+}
+
+static bool name_valid(const char *name)
+{
+    const char *p = name;
+
+    if (!name || !*name || strlen(name) >= METRICS_NAME_MAX) {
+        return false;
+    }
+    if (*p >= '0' && *p <= '9') {
+        return false;
+    }
+    for (; *p; p++) {
+        if (!((*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z') ||
+              (*p >= '0' && *p <= '9') || *p == '_' || *p == ':')) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static struct metric_family *family_get(struct metrics *m, const char *name,
+                const char *help, enum metric_type type,
+                const uint64_t *bounds, int nbounds)
+{
+    struct metric_family *f;
+    int i;
+
+    for (f = m->fams; f; f = f->next) {
+        if (!strcmp(f->name, name)) {
+            return f->type == type ? f : NULL;
+        }
+    }
+    f = calloc(1, sizeof(struct metric_family));
+    if (!f) {
+        return NULL;
+    }
+    strcpy(f->name, name);
+    f->help = strdup(help ? help : "");
+    if (!f->help) {
+        free(f);
+        return NULL;
+    }
+    f->type = type;
+    if (type == METRIC_HISTOGRAM) {
+        if (bounds) {
+            f->nbounds = nbounds;
+            memcpy(f->bounds, bounds, nbounds * sizeof(uint64_t));
+        } else {
+            f->nbounds = METRICS_HIST_DEFAULT;
+            for (i = 0; i < f->nbounds; i++) {
+                f->bounds[i] = 1ULL << i;
+            }
+        }
+    }
+    f->tail = &f->series;
+    *m->tail = f;
+    m->tail = &f->next;
+    return f;
+}
+
+static struct metric *series_get(struct metrics *m, const char *name,
+                const char *labels, const char *help, enum metric_type type,
+                const uint64_t *bounds, int nbounds)
+{
+    struct metric_family *f;
+    struct metric *s = NULL;
+    int ncell, rows;
+
+    if (!m || !name_valid(name)) {
+        return NULL;
+    }
+    if (!labels) {
+        labels = "";
+    }
+    if (strlen(labels) >= METRICS_LABELS_MAX) {
+        return NULL;
+    }
+    if (type == METRIC_HISTOGRAM && bounds) {
+        if (nbounds <= 0 || nbounds > METRICS_BUCKETS_MAX) {
+            return NULL;
+        }
+        for (ncell = 1; ncell < nbounds; ncell++) {
+            if (bounds[ncell] <= bounds[ncell - 1]) {
+                return NULL;
+            }
+        }
+    }
+    pthread_mutex_lock(&m->lock);
+    f = family_get(m, name, help, type, bounds, nbounds);
+    if (!f) {
+        goto out;
+    }
+    for (s = f->series; s; s = s->next) {
+        if (!strcmp(s->labels, labels)) {
+            goto out;
+        }
+    }
+    s = calloc(1, sizeof(struct metric));
+    if (!s) {
+        goto out;
+    }
+    ncell = type == METRIC_HISTOGRAM ? f->nbounds + 3 : 1;
+    rows = type == METRIC_GAUGE ? 1 : METRICS_SLOTS;
+    s->stride = (ncell + METRICS_LINE_CELLS - 1) / METRICS_LINE_CELLS * METRICS_LINE_CELLS;
+    s->labels = strdup(labels);
+    if (!s->labels || 0 != posix_memalign((void **)&s->cells, METRICS_CACHELINE,
+                                          rows * s->stride * sizeof(uint64_t))) {
+        free(s->labels);
+        free(s);
+        s = NULL;
+        goto out;
+    }
+    memset(s->cells, 0, rows * s->stride * sizeof(uint64_t));
+    s->fam = f;
+    *f->tail = s;
+    f->tail = &s->next;
+out:
+    pthread_mutex_unlock(&m->lock);
+    return s;
+}
+
+struct metric *metrics_counter(struct metrics *m, const char *name,
+                const char *labels, const char *help)
+{
+    return series_get(m, name, labels, help, METRIC_COUNTER, NULL, 0);
+}
+
+struct metric *metrics_gauge(struct metrics *m, const char *name,
+                const char *labels, const char *help)
+{
+    return series_get(m, name, labels, help, METRIC_GAUGE, NULL, 0);
+}
+
+struct metric *metrics_histogram(struct metrics *m, const char *name,
+                const char *labels, const char *help,
+                const uint64_t *bounds, int nbounds)
+{
+    return series_get(m, name, labels, help, METRIC_HISTOGRAM, bounds, nbounds);
+}
+
+/******************************************************************************
+ * update and pull
+ ******************************************************************************/
+void metric_add(struct metric *c, int64_t n)
+{
+    uint64_t *row;
+
+    if (!c) {
+        return;
+    }
+    row = c->fam->type == METRIC_GAUGE ? c->cells : c->cells + metrics_slot() * c->stride;
+    __atomic_fetch_add(row, (uint64_t)n, __ATOMIC_RELAXED);
+}
+
+void metric_inc(struct metric *c)
+{
+    metric_add(c, 1);
+}
+
+void metric_set(struct metric *g, int64_t v)
+{
+    if (!g || g->fam->type != METRIC_GAUGE) {
+        return;
+    }
+    __atomic_store_n(g->cells, (uint64_t)v, __ATOMIC_RELAXED);
+}
+
+void metric_observe(struct metric *h, uint64_t v)
+{
+    const struct metric_family *f;
+    uint64_t *row;
+    int lo, hi, mid;
+
+    if (!h || h->fam->type != METRIC_HISTOGRAM) {
+        return;
+    }
+    f = h->fam;
+    /* first bound >= v */
+    lo = 0;
+    hi = f->nbounds;
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (f->bounds[mid] < v) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    row = h->cells + metrics_slot() * h->stride;
+    __atomic_fetch_add(&row[lo], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&row[f->nbounds + 1], v, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&row[f->nbounds + 2], 1, __ATOMIC_RELAXED);
+}
+
+int64_t metric_value(struct metric *c)
+{
+    uint64_t v = 0;
+    int i;
+
+    if (!c || c->fam->type == METRIC_HISTOGRAM) {
+        return 0;
+    }
+    if (c->fam->type == METRIC_GAUGE) {
+        return (int64_t)__atomic_load_n(c->cells, __ATOMIC_RELAXED);
+    }
+    for (i = 0; i < METRICS_SLOTS; i++) {
+        v += __atomic_load_n(&c->cells[i * c->stride], __ATOMIC_RELAXED);
+    }
+    return (int64_t)v;
+}
+
+int metric_hist(struct metric *h, struct metrics_hist *out)
+{
+    const struct metric_family *f;
+    const uint64_t *row;
+    int i, j;
+
+    if (!h || !out || h->fam->type != METRIC_HISTOGRAM) {
+        return -1;
+    }
+    f = h->fam;
+    memset(out, 0, sizeof(*out));
+    out->nbounds = f->nbounds;
+    memcpy(out->bounds, f->bounds, f->nbounds * sizeof(uint64_t));
+    /* slots are summed one by one, a concurrent observe may be half seen */
+    for (i = 0; i < METRICS_SLOTS; i++) {
+        row = h->cells + i * h->stride;
+        for (j = 0; j <= f->nbounds; j++) {
+            out->counts[j] += __atomic_load_n(&row[j], __ATOMIC_RELAXED);
+        }
+        out->sum += __atomic_load_n(&row[f->nbounds + 1], __ATOMIC_RELAXED);
+        out->count += __atomic_load_n(&row[f->nbounds + 2], __ATOMIC_RELAXED);
+    }
+    return 0;
+}
+
+/******************************************************************************
+ * collectors
+ ******************************************************************************/
+int metrics_collector_add(struct metrics *m, metrics_collect_cb cb, void *arg)
+{
+    struct metrics_collector *c;
+
+    if (!m || !cb) {
+        return -1;
+    }
+    pthread_mutex_lock(&m->lock);
+    c = realloc(m->collectors, (m->ncollector + 1) * sizeof(*c));
+    if (!c) {
+        pthread_mutex_unlock(&m->lock);
+        return -1;
+    }
+    c[m->ncollector].cb = cb;
+    c[m->ncollector].arg = arg;
+    m->collectors = c;
+    m->ncollector++;
+    pthread_mutex_unlock(&m->lock);
+    return 0;
+}
+
+int metrics_collector_del(struct metrics *m, metrics_collect_cb cb, void *arg)
+{
+    int i, ret = -1;
+
+    if (!m) {
+        return -1;
+    }
+    pthread_mutex_lock(&m->lock);
+    for (i = 0; i < m->ncollector; i++) {
+        if (m->collectors[i].cb == cb && m->collectors[i].arg == arg) {
+            memmove(&m->collectors[i], &m->collectors[i + 1],
+                    (m->ncollector - i - 1) * sizeof(*m->collectors));
+            m->ncollector--;
+            ret = 0;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&m->lock);
+    return ret;
+}
+
+/******************************************************************************
+ * text exposition
+ ******************************************************************************/
+static void w_printf(struct metrics_writer *w, const char *fmt, ...)
+{
+    va_list ap;
+    size_t cap;
+    char *buf;
+    int n;
+
+    if (w->oom) {
+        return;
+    }
+    while (true) {
+        va_start(ap, fmt);
+        n = vsnprintf(w->buf + w->len, w->cap - w->len, fmt, ap);
+        va_end(ap);
+        if (n < 0) {
+            w->oom = true;
+            return;
+        }
+        if ((size_t)n < w->cap - w->len) {
+            w->len += n;
+            return;
+        }
+        cap = w->cap * 2 + n;
+        buf = realloc(w->buf, cap);
+        if (!buf) {
+            w->oom = true;
+            return;
+        }
+        w->buf = buf;
+        w->cap = cap;
+    }
+}
+
+static void w_family(struct metrics_writer *w, const char *name,
+                const char *help, const char *type)
+{
+    const char *p;
+
+    if (!strcmp(w->last, name)) {
+        return;
+    }
+    snprintf(w->last, sizeof(w->last), "%s", name);
+    if (help && *help) {
+        w_printf(w, "# HELP %s ", name);
+        /* help escapes backslash and newline */
+        for (p = help; *p; p++) {
+            if (*p == '\\') {
+                w_printf(w, "\\\\");
+            } else if (*p == '\n') {
+                w_printf(w, "\\n");
+            } else {
+                w_printf(w, "%c", *p);
+            }
+        }
+        w_printf(w, "\n");
+    }
+    w_printf(w, "# TYPE %s %s\n", name, type);
+}
+
+static void w_labels(struct metrics_writer *w, const char *labels, const char *le)
+{
+    bool has = labels && *labels;
+
+    if (!has && !le) {
+        return;
+    }
+    w_printf(w, "{%s%s", has ? labels : "", has && le ? "," : "");
+    if (le) {
+        w_printf(w, "le=\"%s\"", le);
+    }
+    w_printf(w, "}");
+}
+
+void metrics_write_counter(struct metrics_writer *w, const char *name,
+                const char *labels, const char *help, uint64_t v)
+{
+    if (!w || !name) {
+        return;
+    }
+    w_family(w, name, help, "counter");
+    w_printf(w, "%s", name);
+    w_labels(w, labels, NULL);
+    w_printf(w, " %" PRIu64 "\n", v);
+}
+
+void metrics_write_gauge(struct metrics_writer *w, const char *name,
+                const char *labels, const char *help, int64_t v)
+{
+    if (!w || !name) {
+        return;
+    }
+    w_family(w, name, help, "gauge");
+    w_printf(w, "%s", name);
+    w_labels(w, labels, NULL);
+    w_printf(w, " %" PRId64 "\n", v);
+}
+
+void metrics_write_hist(struct metrics_writer *w, const char *name,
+                const char *labels, const char *help, const struct metrics_hist *h)
+{
+    char le[24];
+    uint64_t acc = 0;
+    int i;
+
+    if (!w || !name || !h || h->nbounds < 0 || h->nbounds > METRICS_BUCKETS_MAX) {
+        return;
+    }
+    w_family(w, name, help, "histogram");
+    for (i = 0; i <= h->nbounds; i++) {
+        acc += h->counts[i];
+        if (i < h->nbounds) {
+            snprintf(le, sizeof(le), "%" PRIu64, h->bounds[i]);
+        } else {
+            strcpy(le, "+Inf");
+        }
+        w_printf(w, "%s_bucket", name);
+        w_labels(w, labels, le);
+        w_printf(w, " %" PRIu64 "\n", acc);
+    }
+    w_printf(w, "%s_sum", name);
+    w_labels(w, labels, NULL);
+    w_printf(w, " %" PRIu64 "\n", h->sum);
+    w_printf(w, "%s_count", name);
+    w_labels(w, labels, NULL);
+    /* +Inf bucket and count come from one read so they agree */
+    w_printf(w, " %" PRIu64 "\n", acc);
+}
+
+char *metrics_render(struct metrics *m, size_t *len)
+{
+    struct metrics_writer w;
+    struct metric_family *f;
+    struct metric *s;
+    struct metrics_hist h;
+    int i;
+
+    if (!m) {
+        return NULL;
+    }
+    memset(&w, 0, sizeof(w));
+    w.cap = METRICS_RENDER_INIT;
+    w.buf = malloc(w.cap);
+    if (!w.buf) {
+        return NULL;
+    }
+    w.buf[0] = '\0';
+    pthread_mutex_lock(&m->lock);
+    for (f = m->fams; f; f = f->next) {
+        for (s = f->series; s; s = s->next) {
+            switch (f->type) {
+            case METRIC_COUNTER:
+                metrics_write_counter(&w, f->name, s->labels, f->help, metric_value(s));
+                break;
+            case METRIC_GAUGE:
+                metrics_write_gauge(&w, f->name, s->labels, f->help, metric_value(s));
+                break;
+            case METRIC_HISTOGRAM:
+                metric_hist(s, &h);
+                metrics_write_hist(&w, f->name, s->labels, f->help, &h);
+                break;
+            }
+        }
+    }
+    for (i = 0; i < m->ncollector; i++) {
+        m->collectors[i].cb(&w, m->collectors[i].arg);
+    }
+    pthread_mutex_unlock(&m->lock);
+    if (w.oom) {
+        free(w.buf);
+        return NULL;
+    }
+    if (len) {
+        *len = w.len;
+    }
+    return w.buf;
+}
@@ -0,0 +1,137 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#ifndef LIBMETRICS_H
+#define LIBMETRICS_H
+
+#include <libposix.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define LIBMETRICS_VERSION "0.1.0"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * metrics registry with prometheus text output.
+ *
+ * counters and histograms keep one cache line per thread slot, an update
+ * is a relaxed atomic add on the slot of the calling thread, no lock and
+ * no shared cache line between threads. slots are merged when read.
+ * gauges are a single value, last set wins.
+ *
+ * stats that already live in other libs (gevent_stats, queue_stats,
+ * lock_stats, rtcp_stats, ...) are pulled by collectors at read time
+ * instead of being copied on every update.
+ */
+
+#define METRICS_SLOTS           (32)    /* threads beyond share slots */
+#define METRICS_BUCKETS_MAX     (32)
+#define METRICS_NAME_MAX        (128)
+#define METRICS_LABELS_MAX      (256)
+
+enum metric_type {
+    METRIC_COUNTER,
+    METRIC_GAUGE,
+    METRIC_HISTOGRAM,
+};
+
+struct metrics;
+struct metric;
+struct metrics_writer;
+
+/*
+ * merged histogram, counts[i] are values <= bounds[i] and above
+ * bounds[i-1], counts[nbounds] is above the last bound
+ */
+struct metrics_hist {
+    int nbounds;
+    uint64_t bounds[METRICS_BUCKETS_MAX];
+    uint64_t counts[METRICS_BUCKETS_MAX + 1];
+    uint64_t sum;
+    uint64_t count;
+};
+
+GEAR_API struct metrics *metrics_create(void);
+GEAR_API void metrics_destroy(struct metrics *m);
+
+/*
+ * get or create the series name{labels}, the same name and labels return
+ * the same metric. labels is prometheus label text without braces, e.g.
+ * "shard=\"0\",method=\"GET\"", NULL or "" for none. help, type and
+ * bounds are taken from the first series of a name, a later one with
+ * another type fails. histogram bounds are ascending upper bounds, NULL
+ * for powers of 2 from 1 to 2^19. metrics stay valid until
+ * metrics_destroy
+ */
+GEAR_API struct metric *metrics_counter(struct metrics *m, const char *name,
+                const char *labels, const char *help);
+GEAR_API struct metric *metrics_gauge(struct metrics *m, const char *name,
+                const char *labels, const char *help);
+GEAR_API struct metric *metrics_histogram(struct metrics *m, const char *name,
+                const char *labels, const char *help,
+                const uint64_t *bounds, int nbounds);
+
+/*
+ * update, safe from any thread. add on gauge adds a signed delta
+ */
+GEAR_API void metric_add(struct metric *c, int64_t n);
+GEAR_API void metric_inc(struct metric *c);
+GEAR_API void metric_set(struct metric *g, int64_t v);
+GEAR_API void metric_observe(struct metric *h, uint64_t v);
+
+/*
+ * pull API, value of a counter or gauge, merged histogram
+ */
+GEAR_API int64_t metric_value(struct metric *c);
+GEAR_API int metric_hist(struct metric *h, struct metrics_hist *out);
+
+/*
+ * collector runs on every read and emits samples with metrics_write_*,
+ * lines of one name must be written together. it runs in the reading
+ * thread under the registry lock, so it must not create metrics, and the
+ * data it reads must outlive metrics_collector_del
+ */
+typedef void (*metrics_collect_cb)(struct metrics_writer *w, void *arg);
+
+GEAR_API int metrics_collector_add(struct metrics *m, metrics_collect_cb cb, void *arg);
+GEAR_API int metrics_collector_del(struct metrics *m, metrics_collect_cb cb, void *arg);
+
+GEAR_API void metrics_write_counter(struct metrics_writer *w, const char *name,
+                const char *labels, const char *help, uint64_t v);
+GEAR_API void metrics_write_gauge(struct metrics_writer *w, const char *name,
+                const char *labels, const char *help, int64_t v);
+/* counts are per bucket as struct metrics_hist, not cumulative */
+GEAR_API void metrics_write_hist(struct metrics_writer *w, const char *name,
+                const char *labels, const char *help, const struct metrics_hist *h);
+
+/*
+ * prometheus text exposition format 0.0.4 of all metrics and collectors,
+ * malloc'ed and nul terminated, free by caller
+ */
+GEAR_API char *metrics_render(struct metrics *m, size_t *len);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,102 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include "libmetrics.h"
+
+#define WORKER_THREADS  4
+#define WORKER_LOOPS    1000000
+
+struct worker {
+    struct metric *reqs;
+    struct metric *latency;
+};
+
+static void *worker(void *arg)
+{
+    struct worker *w = (struct worker *)arg;
+    int i;
+    for (i = 0; i < WORKER_LOOPS; i++) {
+        metric_inc(w->reqs);
+        metric_observe(w->latency, i % 1000);
+    }
+    return NULL;
+}
+
+/* stats kept by some other lib, pulled when read */
+struct pool_stats {
+    uint64_t alloc;
+    int in_use;
+};
+
+static void pool_collect(struct metrics_writer *w, void *arg)
+{
+    struct pool_stats *st = (struct pool_stats *)arg;
+    metrics_write_counter(w, "pool_alloc_total", "pool=\"demo\"", "objects allocated", st->alloc);
+    metrics_write_gauge(w, "pool_in_use", "pool=\"demo\"", "objects in use", st->in_use);
+}
+
+int main(int argc, char **argv)
+{
+    int i;
+    pthread_t tid[WORKER_THREADS];
+    struct worker w;
+    struct metrics_hist h;
+    struct pool_stats st = {1234, 56};
+    struct metric *conns;
+    char *text;
+    size_t len;
+    static const uint64_t bounds[] = {10, 100, 500};
+    struct metrics *m = metrics_create();
+    if (!m) {
+        printf("metrics_create failed!\n");
+        return -1;
+    }
+    w.reqs = metrics_counter(m, "demo_requests_total", "method=\"GET\"", "requests handled");
+    w.latency = metrics_histogram(m, "demo_latency_us", NULL, "request latency", bounds, 3);
+    conns = metrics_gauge(m, "demo_connections", NULL, "open connections");
+    metric_set(conns, 10);
+    metric_add(conns, -3);
+    metrics_collector_add(m, pool_collect, &st);
+
+    for (i = 0; i < WORKER_THREADS; i++) {
+        pthread_create(&tid[i], NULL, worker, &w);
+    }
+    for (i = 0; i < WORKER_THREADS; i++) {
+        pthread_join(tid[i], NULL);
+    }
+    metric_hist(w.latency, &h);
+    printf("requests=%" PRId64 " (want %d) latency count=%" PRIu64 " sum=%" PRIu64 "\n",
+           metric_value(w.reqs), WORKER_THREADS * WORKER_LOOPS, h.count, h.sum);
+
+    text = metrics_render(m, &len);
+    if (text) {
+        printf("%s", text);
+        free(text);
+    }
+    metrics_collector_del(m, pool_collect, &st);
+    metrics_destroy(m);
+    return 0;
+}
@@ -0,0 +1,1047 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#include "fmp4muxer.h"
+#include <libserializer.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FMP4_VIDEO_TIMESCALE    90000
+#define FMP4_FRAGMENT_MS        1000
+#define FMP4_AAC_FRAME          1024
+
+/* sample_depends_on 2, or sample_depends_on 1 and sample_is_non_sync */
+#define FMP4_SAMPLE_SYNC        0x02000000
+#define FMP4_SAMPLE_NON_SYNC    0x01010000
+
+/* trun data-offset, duration, size, flags and composition time offset */
+#define FMP4_TRUN_AUDIO         0x000301
+#define FMP4_TRUN_VIDEO         0x000f01
+
+enum {
+    FMP4_HEVC_NAL_IRAP_MIN  = 16,
+    FMP4_HEVC_NAL_IRAP_MAX  = 23,
+    FMP4_HEVC_NAL_VPS       = 32,
+    FMP4_HEVC_NAL_SPS       = 33,
+    FMP4_HEVC_NAL_PPS       = 34,
+    FMP4_HEVC_NAL_AUD       = 35,
+};
+
+struct fmp4_sample {
+    uint32_t size;
+    uint32_t duration;
+    uint32_t flags;
+    int32_t  cto;
+};
+
+struct fmp4_track {
+    uint32_t id;
+    uint32_t timescale;
+    enum media_type type;
+    enum video_codec_type codec;
+    uint32_t width;
+    uint32_t height;
+    int channels;
+    uint8_t *config;            /* avcC, hvcC or AudioSpecificConfig */
+    size_t config_size;
+    struct serializer data;     /* mdat payload of the open fragment */
+    struct fmp4_sample *samples;
+    int nb_samples;
+    int max_samples;
+    int64_t base_dts;           /* first dts of the open fragment */
+    int64_t last_dts;
+    uint32_t last_duration;
+};
+
+static const rational_t timebase_us = {1, 1000000};
+
+static const uint32_t aac_sample_rates[] = {
+    96000, 88200, 64000, 48000, 44100, 32000,
+    24000, 22050, 16000, 12000, 11025, 8000, 7350,
+};
+
+static void put_wb32(uint8_t *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static size_t box_begin(struct serializer *s, const char *type)
+{
+    size_t pos = s_getpos(s);
+    s_wb32(s, 0);
+    s_write(s, type, 4);
+    return pos;
+}
+
+static size_t full_box_begin(struct serializer *s, const char *type,
+                uint8_t version, uint32_t flags)
+{
+    size_t pos = box_begin(s, type);
+    s_wb32(s, (uint32_t)version << 24 | flags);
+    return pos;
+}
+
+static void box_end(struct serializer *s, size_t pos)
+{
+    uint8_t *data;
+    size_t size;
+
+    serializer_array_get_data(s, &data, &size);
+    put_wb32(data + pos, (uint32_t)(size - pos));
+}
+
+static void s_zero(struct serializer *s, size_t n)
+{
+    static const uint8_t zero[32];
+    s_write(s, zero, n);
+}
+
+static bool has_start_code(const uint8_t *data, size_t size)
+{
+    if (size < 4 || data[0] != 0 || data[1] != 0)
+        return false;
+
+    return data[2] == 1 || (data[2] == 0 && data[3] == 1);
+}
+
+/* next annexb nal from *p, start code and trailing zeros left out */
+static const uint8_t *nal_next(const uint8_t **p, const uint8_t *end, size_t *size)
+{
+    const uint8_t *q = *p, *nal;
+
+    for (; q + 3 <= end; q++) {
+        if (q[0] == 0 && q[1] == 0 && q[2] == 1)
+            break;
+    }
+    if (q + 3 > end)
+        return NULL;
+    nal = q + 3;
+    for (q = nal; q + 3 <= end; q++) {
+        if (q[0] == 0 && q[1] == 0 && q[2] == 1)
+            break;
+    }
+    if (q + 3 > end)
+        q = end;
+    *p = q;
+    while (q > nal && !q[-1])
+        q--;
+    *size = q - nal;
+    return nal;
+}
+
+static int nal_type(enum video_codec_type codec, const uint8_t *nal)
+{
+    return codec == VIDEO_CODEC_H265 ? (nal[0] >> 1) & 0x3f : nal[0] & 0x1f;
+}
+
+/* parameter sets live in avcC/hvcC, access unit delimiters are not needed */
+static bool nal_skipped(enum video_codec_type codec, int type)
+{
+    if (codec == VIDEO_CODEC_H265)
+        return type >= FMP4_HEVC_NAL_VPS && type <= FMP4_HEVC_NAL_AUD;
+    return type == H264_NAL_SPS || type == H264_NAL_PPS || type == H264_NAL_AUD;
+}
+
+static bool nal_is_key(enum video_codec_type codec, int type)
+{
+    if (codec == VIDEO_CODEC_H265)
+        return type >= FMP4_HEVC_NAL_IRAP_MIN && type <= FMP4_HEVC_NAL_IRAP_MAX;
+    return type == H264_NAL_IDR_SLICE;
+}
+
+static bool video_key_frame(enum video_codec_type codec, const struct video_packet *vp)
+{
+    const uint8_t *p = vp->data, *end = vp->data + vp->size, *nal;
+    size_t len;
+
+    if (vp->key_frame || vp->type == H26X_FRAME_IDR || vp->type == H26X_FRAME_I)
+        return true;
+    if (!has_start_code(vp->data, vp->size))
+        return false;
+    while ((nal = nal_next(&p, end, &len))) {
+        if (len && nal_is_key(codec, nal_type(codec, nal)))
+            return true;
+    }
+    return false;
+}
+
+/* avcC (ISO/IEC 14496-15 5.3.3) from annexb sps and pps */
+static int avc_config(struct fmp4_track *t, const uint8_t *data, size_t size)
+{
+    const uint8_t *p = data, *end = data + size, *nal;
+    const uint8_t *sps = NULL, *pps = NULL;
+    size_t len, sps_size = 0, pps_size = 0;
+    struct serializer s;
+    uint8_t *out;
+
+    while ((nal = nal_next(&p, end, &len))) {
+        if (!len)
+            continue;
+        if (!sps && nal_type(VIDEO_CODEC_H264, nal) == H264_NAL_SPS) {
+            sps = nal;
+            sps_size = len;
+        } else if (!pps && nal_type(VIDEO_CODEC_H264, nal) == H264_NAL_PPS) {
+            pps = nal;
+            pps_size = len;
+        }
+    }
+    if (!sps || !pps || sps_size < 4)
+        return -1;
+
+    serializer_array_init(&s);
+    s_w8(&s, 0x01);
+    s_write(&s, sps + 1, 3);
+    s_w8(&s, 0xff);
+    s_w8(&s, 0xe1);
+    s_wb16(&s, (uint16_t)sps_size);
+    s_write(&s, sps, sps_size);
+    s_w8(&s, 0x01);
+    s_wb16(&s, (uint16_t)pps_size);
+    s_write(&s, pps, pps_size);
+    serializer_array_get_data(&s, &out, &len);
+    t->config = memdup(out, len);
+    t->config_size = len;
+    serializer_array_deinit(&s);
+    return t->config ? 0 : -1;
+}
+
+/*
+ * hvcC (ISO/IEC 14496-15 8.3.3) from annexb vps, sps and pps. profile, tier
+ * and level come from the sps, chroma and bit depth are guessed from the
+ * profile, decoders take the real ones from the sps in the arrays
+ */
+static int hevc_config(struct fmp4_track *t, const uint8_t *data, size_t size)
+{
+    const uint8_t *p = data, *end = data + size, *nal;
+    const uint8_t *ps[3] = {NULL, NULL, NULL};
+    size_t ps_size[3] = {0, 0, 0};
+    uint8_t rbsp[16];
+    size_t len, i, n, zeros;
+    struct serializer s;
+    uint8_t *out;
+    int type, depth;
+
+    while ((nal = nal_next(&p, end, &len))) {
+        if (!len)
+            continue;
+        type = nal_type(VIDEO_CODEC_H265, nal);
+        if (type >= FMP4_HEVC_NAL_VPS && type <= FMP4_HEVC_NAL_PPS &&
+            !ps[type - FMP4_HEVC_NAL_VPS]) {
+            ps[type - FMP4_HEVC_NAL_VPS] = nal;
+            ps_size[type - FMP4_HEVC_NAL_VPS] = len;
+        }
+    }
+    if (!ps[0] || !ps[1] || !ps[2])
+        return -1;
+
+    /* nal header, sub layer fields and general profile_tier_level */
+    for (i = 0, n = 0, zeros = 0; i < ps_size[1] && n < sizeof(rbsp); i++) {
+        if (zeros >= 2 && ps[1][i] == 3) {
+            zeros = 0;
+            continue;
+        }
+        zeros = ps[1][i] ? 0 : zeros + 1;
+        rbsp[n++] = ps[1][i];
+    }
+    if (n < 15)
+        return -1;
+    depth = (rbsp[3] & 0x1f) == 2 ? 2 : 0;  /* main 10 */
+
+    serializer_array_init(&s);
+    s_w8(&s, 0x01);
+    s_write(&s, rbsp + 3, 12);
+    s_wb16(&s, 0xf000);     /* min_spatial_segmentation_idc */
+    s_w8(&s, 0xfc);         /* parallelismType */
+    s_w8(&s, 0xfc | 1);     /* 4:2:0 */
+    s_w8(&s, 0xf8 | depth);
+    s_w8(&s, 0xf8 | depth);
+    s_wb16(&s, 0);          /* avgFrameRate */
+    s_w8(&s, (((rbsp[2] >> 1) & 0x07) + 1) << 3 | (rbsp[2] & 0x01) << 2 | 0x03);
+    s_w8(&s, 3);            /* numOfArrays */
+    for (i = 0; i < 3; i++) {
+        s_w8(&s, 0x80 | (FMP4_HEVC_NAL_VPS + i));
+        s_wb16(&s, 1);
+        s_wb16(&s, (uint16_t)ps_size[i]);
+        s_write(&s, ps[i], ps_size[i]);
+    }
+    serializer_array_get_data(&s, &out, &len);
+    t->config = memdup(out, len);
+    t->config_size = len;
+    serializer_array_deinit(&s);
+    return t->config ? 0 : -1;
+}
+
+/* encoder extra_data as avcC/hvcC or annexb, else the parameter sets in band */
+static int video_config(struct fmp4_track *t, const struct video_packet *vp)
+{
+    const struct video_encoder *enc = &vp->encoder;
+    int (*build)(struct fmp4_track *t, const uint8_t *data, size_t size);
+
+    build = t->codec == VIDEO_CODEC_H265 ? hevc_config : avc_config;
+    if (enc->extra_data && enc->extra_size > 6) {
+        if (!has_start_code(enc->extra_data, enc->extra_size)) {
+            t->config = memdup(enc->extra_data, enc->extra_size);
+            t->config_size = enc->extra_size;
+            return t->config ? 0 : -1;
+        }
+        if (0 == build(t, enc->extra_data, enc->extra_size))
+            return 0;
+    }
+    if (has_start_code(vp->data, vp->size))
+        return build(t, vp->data, vp->size);
+    return -1;
+}
+
+static bool adts_header(const uint8_t *data, size_t size, size_t *hdr_len)
+{
+    if (size < 7 || data[0] != 0xff || (data[1] & 0xf6) != 0xf0)
+        return false;
+    *hdr_len = (data[1] & 0x01) ? 7 : 9;
+    return size > *hdr_len;
+}
+
+/* AudioSpecificConfig from extra_data, an adts header or the encoder */
+static int audio_config(struct fmp4_track *t, const struct audio_packet *ap)
+{
+    const struct audio_encoder *enc = &ap->encoder;
+    uint8_t asc[2];
+    uint32_t rate;
+    size_t hdr_len, i;
+    int object, index, channels;
+
+    if (enc->extra_data && enc->extra_size >= 2) {
+        t->config = memdup(enc->extra_data, enc->extra_size);
+        t->config_size = enc->extra_size;
+    } else {
+        if (adts_header(ap->data, ap->size, &hdr_len)) {
+            object = (ap->data[2] >> 6) + 1;
+            index = (ap->data[2] >> 2) & 0x0f;
+            channels = (ap->data[2] & 0x01) << 2 | ap->data[3] >> 6;
+        } else {
+            for (i = 0; i < ARRAY_SIZE(aac_sample_rates); i++) {
+                if (aac_sample_rates[i] == enc->sample_rate)
+                    break;
+            }
+            if (i == ARRAY_SIZE(aac_sample_rates)) {
+                printf("%s:%d no aac config for %u Hz\n", __func__, __LINE__, enc->sample_rate);
+                return -1;
+            }
+            object = 2;     /* aac lc */
+            index = i;
+            channels = enc->channels;
+        }
+        asc[0] = object << 3 | index >> 1;
+        asc[1] = (index & 0x01) << 7 | channels << 3;
+        t->config = memdup(asc, sizeof(asc));
+        t->config_size = sizeof(asc);
+    }
+    if (!t->config)
+        return -1;
+
+    index = (t->config[0] & 0x07) << 1 | t->config[1] >> 7;
+    rate = index < (int)ARRAY_SIZE(aac_sample_rates) ? aac_sample_rates[index] : enc->sample_rate;
+    if (!rate) {
+        printf("%s:%d unknown sample rate\n", __func__, __LINE__);
+        return -1;
+    }
+    t->timescale = rate;
+    t->channels = (t->config[1] >> 3) & 0x0f;
+    t->last_duration = FMP4_AAC_FRAME;
+    return 0;
+}
+
+static void write_ftyp(struct serializer *s)
+{
+    size_t pos = box_begin(s, "ftyp");
+    s_write(s, "iso6", 4);
+    s_wb32(s, 0);
+    s_write(s, "iso6cmfcisommp41", 16);
+    box_end(s, pos);
+}
+
+static void write_matrix(struct serializer *s)
+{
+    s_wb32(s, 0x00010000);
+    s_zero(s, 12);
+    s_wb32(s, 0x00010000);
+    s_zero(s, 12);
+    s_wb32(s, 0x40000000);
+}
+
+static void write_mvhd(struct serializer *s, uint32_t next_track_id)
+{
+    size_t pos = full_box_begin(s, "mvhd", 0, 0);
+    s_zero(s, 8);           /* creation and modification time */
+    s_wb32(s, 1000);        /* timescale */
+    s_wb32(s, 0);           /* duration is in the fragments */
+    s_wb32(s, 0x00010000);  /* rate */
+    s_wb16(s, 0x0100);      /* volume */
+    s_zero(s, 10);
+    write_matrix(s);
+    s_zero(s, 24);          /* pre_defined */
+    s_wb32(s, next_track_id);
+    box_end(s, pos);
+}
+
+static void write_tkhd(struct serializer *s, struct fmp4_track *t)
+{
+    size_t pos = full_box_begin(s, "tkhd", 0, 0x000003);  /* enabled, in movie */
+    s_zero(s, 8);
+    s_wb32(s, t->id);
+    s_wb32(s, 0);
+    s_wb32(s, 0);           /* duration */
+    s_zero(s, 8);
+    s_wb16(s, 0);           /* layer */
+    s_wb16(s, 0);           /* alternate_group */
+    s_wb16(s, t->type == MEDIA_TYPE_AUDIO ? 0x0100 : 0);
+    s_wb16(s, 0);
+    write_matrix(s);
+    s_wb32(s, t->width << 16);
+    s_wb32(s, t->height << 16);
+    box_end(s, pos);
+}
+
+static void write_mdhd(struct serializer *s, struct fmp4_track *t)
+{
+    size_t pos = full_box_begin(s, "mdhd", 0, 0);
+    s_zero(s, 8);
+    s_wb32(s, t->timescale);
+    s_wb32(s, 0);
+    s_wb16(s, 0x55c4);      /* und */
+    s_wb16(s, 0);
+    box_end(s, pos);
+}
+
+static void write_hdlr(struct serializer *s, struct fmp4_track *t)
+{
+    const char *name = t->type == MEDIA_TYPE_AUDIO ? "SoundHandler" : "VideoHandler";
+    size_t pos = full_box_begin(s, "hdlr", 0, 0);
+    s_wb32(s, 0);
+    s_write(s, t->type == MEDIA_TYPE_AUDIO ? "soun" : "vide", 4);
+    s_zero(s, 12);
+    s_write(s, name, strlen(name) + 1);
+    box_end(s, pos);
+}
+
+static void write_dinf(struct serializer *s)
+{
+    size_t dinf = box_begin(s, "dinf");
+    size_t dref = full_box_begin(s, "dref", 0, 0);
+    size_t url;
+
+    s_wb32(s, 1);
+    url = full_box_begin(s, "url ", 0, 0x000001);  /* data in this file */
+    box_end(s, url);
+    box_end(s, dref);
+    box_end(s, dinf);
+}
+
+static void write_video_entry(struct serializer *s, struct fmp4_track *t)
+{
+    bool hevc = t->codec == VIDEO_CODEC_H265;
+    size_t pos = box_begin(s, hevc ? "hvc1" : "avc1");
+    size_t cfg;
+
+    s_zero(s, 6);
+    s_wb16(s, 1);           /* data_reference_index */
+    s_zero(s, 16);
+    s_wb16(s, t->width);
+    s_wb16(s, t->height);
+    s_wb32(s, 0x00480000);  /* 72 dpi */
+    s_wb32(s, 0x00480000);
+    s_wb32(s, 0);
+    s_wb16(s, 1);           /* frame_count */
+    s_zero(s, 32);          /* compressorname */
+    s_wb16(s, 0x0018);      /* depth */
+    s_wb16(s, 0xffff);
+    cfg = box_begin(s, hevc ? "hvcC" : "avcC");
+    s_write(s, t->config, t->config_size);
+    box_end(s, cfg);
+    box_end(s, pos);
+}
+
+/* esds (ISO/IEC 14496-1 7.2.6.5) with one byte descriptor sizes */
+static void write_audio_entry(struct serializer *s, struct fmp4_track *t)
+{
+    size_t pos = box_begin(s, "mp4a");
+    size_t esds;
+    uint8_t dsi = (uint8_t)t->config_size;
+
+    s_zero(s, 6);
+    s_wb16(s, 1);
+    s_zero(s, 8);
+    s_wb16(s, t->channels ? t->channels : 2);
+    s_wb16(s, 16);          /* samplesize */
+    s_zero(s, 4);
+    s_wb32(s, t->timescale < 0x10000 ? t->timescale << 16 : 0);
+
+    esds = full_box_begin(s, "esds", 0, 0);
+    s_w8(s, 0x03);          /* ES_Descriptor */
+    s_w8(s, 3 + 2 + 13 + 2 + dsi + 3);
+    s_wb16(s, t->id);
+    s_w8(s, 0);
+    s_w8(s, 0x04);          /* DecoderConfigDescriptor */
+    s_w8(s, 13 + 2 + dsi);
+    s_w8(s, 0x40);          /* mpeg-4 audio */
+    s_w8(s, 0x15);          /* audio stream */
+    s_wb24(s, 0);
+    s_wb32(s, 0);
+    s_wb32(s, 0);
+    s_w8(s, 0x05);          /* DecoderSpecificInfo */
+    s_w8(s, dsi);
+    s_write(s, t->config, dsi);
+    s_w8(s, 0x06);          /* SLConfigDescriptor */
+    s_w8(s, 1);
+    s_w8(s, 0x02);
+    box_end(s, esds);
+    box_end(s, pos);
+}
+
+static void write_stbl(struct serializer *s, struct fmp4_track *t)
+{
+    size_t stbl = box_begin(s, "stbl");
+    size_t pos;
+
+    pos = full_box_begin(s, "stsd", 0, 0);
+    s_wb32(s, 1);
+    if (t->type == MEDIA_TYPE_AUDIO)
+        write_audio_entry(s, t);
+    else
+        write_video_entry(s, t);
+    box_end(s, pos);
+
+    /* samples are described by the fragments */
+    pos = full_box_begin(s, "stts", 0, 0);
+    s_wb32(s, 0);
+    box_end(s, pos);
+    pos = full_box_begin(s, "stsc", 0, 0);
+    s_wb32(s, 0);
+    box_end(s, pos);
+    pos = full_box_begin(s, "stsz", 0, 0);
+    s_wb32(s, 0);
+    s_wb32(s, 0);
+    box_end(s, pos);
+    pos = full_box_begin(s, "stco", 0, 0);
+    s_wb32(s, 0);
+    box_end(s, pos);
+    box_end(s, stbl);
+}
+
+static void write_trak(struct serializer *s, struct fmp4_track *t)
+{
+    size_t trak = box_begin(s, "trak");
+    size_t mdia, minf, pos;
+
+    write_tkhd(s, t);
+    mdia = box_begin(s, "mdia");
+    write_mdhd(s, t);
+    write_hdlr(s, t);
+    minf = box_begin(s, "minf");
+    if (t->type == MEDIA_TYPE_AUDIO) {
+        pos = full_box_begin(s, "smhd", 0, 0);
+        s_wb32(s, 0);
+    } else {
+        pos = full_box_begin(s, "vmhd", 0, 0x000001);
+        s_zero(s, 8);
+    }
+    box_end(s, pos);
+    write_dinf(s);
+    write_stbl(s, t);
+    box_end(s, minf);
+    box_end(s, mdia);
+    box_end(s, trak);
+}
+
+static void write_trex(struct serializer *s, struct fmp4_track *t)
+{
+    size_t pos = full_box_begin(s, "trex", 0, 0);
+    s_wb32(s, t->id);
+    s_wb32(s, 1);           /* default_sample_description_index */
+    s_zero(s, 12);
+    box_end(s, pos);
+}
+
+static void track_free(struct fmp4_track *t)
+{
+    if (!t)
+        return;
+    serializer_array_deinit(&t->data);
+    free(t->samples);
+    free(t->config);
+    free(t);
+}
+
+static int file_output_write(void *arg, const void *data, size_t size)
+{
+    if (1 != fwrite(data, size, 1, (FILE *)arg)) {
+        printf("%s:%d fwrite failed!\n", __func__, __LINE__);
+        return -1;
+    }
+    return 0;
+}
+
+static int write_buf(struct fmp4_muxer *c, const uint8_t *data, size_t size)
+{
+    if (size && 0 != c->out.write(c->out.arg, data, size)) {
+        return -1;
+    }
+    return 0;
+}
+
+/* a new segment starts with a fragment, never inside one */
+static int write_segment(struct fmp4_muxer *c, struct fmp4_track *t)
+{
+    int64_t us = media_ts_rescale(t->base_dts, (rational_t){1, (int)t->timescale},
+                    timebase_us);
+
+    if (c->got_init && c->conf.segment_ms && c->out.segment &&
+        us - c->segment_us >= (int64_t)c->conf.segment_ms * 1000) {
+        if (0 != c->out.segment(c->out.arg)) {
+            printf("%s:%d new segment failed!\n", __func__, __LINE__);
+            return -1;
+        }
+        c->got_init = false;
+    }
+    if (!c->got_init) {
+        c->segment_us = us;
+    }
+    return 0;
+}
+
+/* ftyp and moov, a declared track that got no packet so far is left out */
+static int write_init(struct fmp4_muxer *c)
+{
+    struct fmp4_track **tracks[2] = {&c->video, &c->audio};
+    struct serializer s;
+    uint32_t id = 1;
+    size_t moov, mvex;
+    uint8_t *data;
+    size_t size;
+    int i, ret;
+
+    for (i = 0; i < 2; i++) {
+        if (*tracks[i] && !(*tracks[i])->config) {
+            printf("%s:%d %s track not ready, left out\n", __func__, __LINE__,
+                   i ? "audio" : "video");
+            track_free(*tracks[i]);
+            *tracks[i] = NULL;
+        }
+        if (*tracks[i])
+            (*tracks[i])->id = id++;
+    }
+
+    serializer_array_init(&s);
+    write_ftyp(&s);
+    moov = box_begin(&s, "moov");
+    write_mvhd(&s, id);
+    for (i = 0; i < 2; i++) {
+        if (*tracks[i])
+            write_trak(&s, *tracks[i]);
+    }
+    mvex = box_begin(&s, "mvex");
+    for (i = 0; i < 2; i++) {
+        if (*tracks[i])
+            write_trex(&s, *tracks[i]);
+    }
+    box_end(&s, mvex);
+    box_end(&s, moov);
+    serializer_array_get_data(&s, &data, &size);
+    ret = write_buf(c, data, size);
+    serializer_array_deinit(&s);
+    c->got_init = true;
+    return ret;
+}
+
+static int fragment_notify(struct fmp4_muxer *c, struct fmp4_track *t)
+{
+    int64_t duration = 0;
+    int i;
+
+    for (i = 0; i < t->nb_samples; i++)
+        duration += t->samples[i].duration ? t->samples[i].duration : t->last_duration;
+    return c->out.fragment(c->out.arg,
+                    t->type != MEDIA_TYPE_VIDEO || t->samples[0].flags == FMP4_SAMPLE_SYNC,
+                    media_ts_rescale(duration, (rational_t){1, (int)t->timescale},
+                                     timebase_us));
+}
+
+/* one moof and mdat with the open samples of every track */
+static int write_fragment(struct fmp4_muxer *c)
+{
+    struct fmp4_track *tracks[2];
+    struct fmp4_track *t;
+    struct fmp4_sample *sm;
+    size_t offset_pos[2] = {0, 0};
+    size_t moof, traf, pos, size, data_size, offset;
+    struct serializer s;
+    uint8_t *data;
+    uint32_t flags;
+    int i, j, ret = 0;
+
+    t = c->video && c->video->nb_samples ? c->video : c->audio;
+    if (t && 0 != write_segment(c, t))
+        return -1;
+    if (!c->got_init && 0 != write_init(c))
+        return -1;
+    if (t && c->out.fragment && 0 != fragment_notify(c, t))
+        return -1;
+    /* write_init drops tracks that never got a packet */
+    tracks[0] = c->video;
+    tracks[1] = c->audio;
+
+    serializer_array_init(&s);
+    moof = box_begin(&s, "moof");
+    pos = full_box_begin(&s, "mfhd", 0, 0);
+    s_wb32(&s, ++c->sequence);
+    box_end(&s, pos);
+    for (i = 0; i < 2; i++) {
+        t = tracks[i];
+        if (!t || !t->nb_samples)
+            continue;
+        sm = &t->samples[t->nb_samples - 1];
+        if (!sm->duration)
+            sm->duration = t->last_duration;
+        traf = box_begin(&s, "traf");
+        pos = full_box_begin(&s, "tfhd", 0, 0x020000);     /* default-base-is-moof */
+        s_wb32(&s, t->id);
+        box_end(&s, pos);
+        pos = full_box_begin(&s, "tfdt", 1, 0);
+        s_wb64(&s, (uint64_t)t->base_dts);
+        box_end(&s, pos);
+        flags = t->type == MEDIA_TYPE_AUDIO ? FMP4_TRUN_AUDIO : FMP4_TRUN_VIDEO;
+        pos = full_box_begin(&s, "trun", 1, flags);
+        s_wb32(&s, t->nb_samples);
+        offset_pos[i] = s_getpos(&s);
+        s_wb32(&s, 0);
+        for (j = 0; j < t->nb_samples; j++) {
+            sm = &t->samples[j];
+            s_wb32(&s, sm->duration);
+            s_wb32(&s, sm->size);
+            if (flags == FMP4_TRUN_VIDEO) {
+                s_wb32(&s, sm->flags);
+                s_wb32(&s, (uint32_t)sm->cto);
+            }
+        }
+        box_end(&s, pos);
+        box_end(&s, traf);
+    }
+    box_end(&s, moof);
+
+    serializer_array_get_data(&s, &data, &size);
+    offset = size + 8;
+    data_size = 0;
+    for (i = 0; i < 2; i++) {
+        t = tracks[i];
+        if (!t || !t->nb_samples)
+            continue;
+        put_wb32(data + offset_pos[i], (uint32_t)offset);
+        offset += s_getpos(&t->data);
+        data_size += s_getpos(&t->data);
+    }
+    s_wb32(&s, (uint32_t)(data_size + 8));
+    s_write(&s, "mdat", 4);
+    serializer_array_get_data(&s, &data, &size);
+    ret = write_buf(c, data, size);
+    serializer_array_deinit(&s);
+
+    for (i = 0; i < 2; i++) {
+        t = tracks[i];
+        if (!t || !t->nb_samples)
+            continue;
+        serializer_array_get_data(&t->data, &data, &size);
+        if (ret == 0)
+            ret = write_buf(c, data, size);
+        serializer_array_reset(&t->data);
+        t->nb_samples = 0;
+    }
+    if (c->fp)
+        fflush(c->fp);
+    return ret;
+}
+
+/* dts in the track timescale from the first packet on */
+static int track_time(struct fmp4_muxer *c, struct fmp4_track *t, rational_t tb,
+                uint64_t ts, int64_t *out)
+{
+    rational_t to = {1, t->timescale};
+
+    if (tb.num <= 0)
+        tb.num = 1;
+    if (tb.den <= 0) {
+        printf("%s:%d invalid packet timebase\n", __func__, __LINE__);
+        return -1;
+    }
+    if (!c->got_origin) {
+        c->origin_us = media_ts_rescale(ts, tb, timebase_us);
+        c->got_origin = true;
+    }
+    *out = media_ts_rescale(ts, tb, to) - media_ts_rescale(c->origin_us, timebase_us, to);
+    return 0;
+}
+
+/* sets the duration of the last sample, false if dts goes backwards */
+static bool track_advance(struct fmp4_track *t, int64_t dts)
+{
+    if (!t->nb_samples)
+        return true;
+    if (dts <= t->last_dts) {
+        printf("%s:%d dts %" PRId64 " not after %" PRId64 ", dropped\n",
+               __func__, __LINE__, dts, t->last_dts);
+        return false;
+    }
+    t->last_duration = (uint32_t)(dts - t->last_dts);
+    t->samples[t->nb_samples - 1].duration = t->last_duration;
+    return true;
+}
+
+static int track_push(struct fmp4_track *t, int64_t dts, int64_t pts, uint32_t size,
+                uint32_t flags)
+{
+    struct fmp4_sample *sm;
+    int max;
+
+    if (t->nb_samples == t->max_samples) {
+        max = t->max_samples ? t->max_samples * 2 : 64;
+        sm = realloc(t->samples, max * sizeof(struct fmp4_sample));
+        if (!sm) {
+            printf("%s:%d realloc samples failed!\n", __func__, __LINE__);
+            return -1;
+        }
+        t->samples = sm;
+        t->max_samples = max;
+    }
+    if (!t->nb_samples)
+        t->base_dts = dts;
+    sm = &t->samples[t->nb_samples++];
+    sm->size = size;
+    sm->duration = 0;
+    sm->flags = flags;
+    sm->cto = (int32_t)(pts - dts);
+    t->last_dts = dts;
+    return 0;
+}
+
+/* annexb to 4 byte length prefixed nals, length prefixed input as is */
+static uint32_t write_nals(struct fmp4_track *t, const uint8_t *data, size_t size)
+{
+    const uint8_t *p = data, *end = data + size, *nal;
+    uint32_t total = 0;
+    size_t len;
+
+    if (!has_start_code(data, size)) {
+        s_write(&t->data, data, size);
+        return (uint32_t)size;
+    }
+    while ((nal = nal_next(&p, end, &len))) {
+        if (!len || nal_skipped(t->codec, nal_type(t->codec, nal)))
+            continue;
+        s_wb32(&t->data, (uint32_t)len);
+        s_write(&t->data, nal, len);
+        total += 4 + len;
+    }
+    return total;
+}
+
+static int write_video(struct fmp4_muxer *c, struct video_packet *vp)
+{
+    struct fmp4_track *t = c->video;
+    const struct video_encoder *enc = &vp->encoder;
+    int64_t dts, pts;
+    uint32_t size;
+    bool key;
+
+    if (!t)
+        return 0;
+    if (!t->config) {
+        if (enc->type != VIDEO_CODEC_H264 && enc->type != VIDEO_CODEC_H265) {
+            printf("%s:%d %s is not supported\n", __func__, __LINE__,
+                   video_codec_type_to_string(enc->type));
+            return -1;
+        }
+        t->codec = enc->type;
+    }
+    key = video_key_frame(t->codec, vp);
+    if (!c->got_origin && !key)
+        return 0;
+    if (!t->config) {
+        if (0 != video_config(t, vp)) {
+            printf("%s:%d no %s parameter sets\n", __func__, __LINE__,
+                   video_codec_type_to_string(t->codec));
+            return -1;
+        }
+        t->width = enc->width;
+        t->height = enc->height;
+        if (enc->framerate.num > 0 && enc->framerate.den > 0)
+            t->last_duration = (uint32_t)(FMP4_VIDEO_TIMESCALE *
+                            (uint64_t)enc->framerate.den / enc->framerate.num);
+    }
+    /* dts is not set by every producer, pts then stands for both */
+    if (0 != track_time(c, t, enc->timebase, vp->dts ? vp->dts : vp->pts, &dts) ||
+        0 != track_time(c, t, enc->timebase, vp->pts, &pts))
+        return -1;
+    if (!track_advance(t, dts))
+        return -1;
+    /* a part never runs past part_ms, unless one frame does */
+    if (t->nb_samples && (key || (c->conf.part_ms &&
+        dts + t->last_duration - t->base_dts > (int64_t)c->conf.part_ms * t->timescale / 1000)) &&
+        0 != write_fragment(c))
+        return -1;
+    size = write_nals(t, vp->data, vp->size);
+    return track_push(t, dts, pts, size, key ? FMP4_SAMPLE_SYNC : FMP4_SAMPLE_NON_SYNC);
+}
+
+static int write_audio(struct fmp4_muxer *c, struct audio_packet *ap)
+{
+    struct fmp4_track *t = c->audio;
+    const uint8_t *data = ap->data;
+    size_t size = ap->size, hdr_len;
+    int64_t dts;
+
+    if (!t || (c->conf.video && !c->got_origin))
+        return 0;
+    if (!t->config) {
+        if (ap->encoder.format != AUDIO_CODEC_AAC) {
+            printf("%s:%d only aac audio is supported\n", __func__, __LINE__);
+            return -1;
+        }
+        if (0 != audio_config(t, ap))
+            return -1;
+    }
+    if (0 != track_time(c, t, ap->encoder.timebase, ap->dts ? ap->dts : ap->pts, &dts))
+        return -1;
+    if (dts < 0)
+        return 0;
+    if (!track_advance(t, dts))
+        return -1;
+    if (!c->video && t->nb_samples &&
+        dts - t->base_dts >= (int64_t)c->conf.fragment_ms * t->timescale / 1000 &&
+        0 != write_fragment(c))
+        return -1;
+    if (adts_header(data, size, &hdr_len)) {
+        data += hdr_len;
+        size -= hdr_len;
+    }
+    s_write(&t->data, data, size);
+    return track_push(t, dts, dts, (uint32_t)size, FMP4_SAMPLE_SYNC);
+}
+
+static struct fmp4_track *track_create(enum media_type type)
+{
+    struct fmp4_track *t = calloc(1, sizeof(struct fmp4_track));
+    if (!t) {
+        printf("malloc fmp4_track failed!\n");
+        return NULL;
+    }
+    t->type = type;
+    t->timescale = FMP4_VIDEO_TIMESCALE;
+    serializer_array_init(&t->data);
+    return t;
+}
+
+struct fmp4_muxer *fmp4_muxer_open_output(struct fmp4_config *conf,
+                const struct fmp4_output *out)
+{
+    struct fmp4_muxer *c;
+
+    if (!conf || !out || !out->write || (!conf->video && !conf->audio)) {
+        printf("%s:%d invalid paraments!\n", __func__, __LINE__);
+        return NULL;
+    }
+    c = calloc(1, sizeof(struct fmp4_muxer));
+    if (!c) {
+        printf("malloc fmp4_muxer failed!\n");
+        return NULL;
+    }
+    memcpy(&c->conf, conf, sizeof(struct fmp4_config));
+    if (!c->conf.fragment_ms)
+        c->conf.fragment_ms = FMP4_FRAGMENT_MS;
+    if ((conf->video && !(c->video = track_create(MEDIA_TYPE_VIDEO))) ||
+        (conf->audio && !(c->audio = track_create(MEDIA_TYPE_AUDIO))))
+        goto failed;
+    c->out = *out;
+    return c;
+
+failed:
+    track_free(c->video);
+    track_free(c->audio);
+    free(c);
+    return NULL;
+}
+
+struct fmp4_muxer *fmp4_muxer_open(const char *file, struct fmp4_config *conf)
+{
+    struct fmp4_output out = {file_output_write, NULL, NULL, NULL};
+    struct fmp4_muxer *c;
+    FILE *fp;
+
+    if (!file) {
+        printf("%s:%d invalid paraments!\n", __func__, __LINE__);
+        return NULL;
+    }
+    fp = fopen(file, "wb");
+    if (!fp) {
+        printf("%s:%d open %s failed!\n", __func__, __LINE__, file);
+        return NULL;
+    }
+    out.arg = fp;
+    c = fmp4_muxer_open_output(conf, &out);
+    if (!c) {
+        fclose(fp);
+        return NULL;
+    }
+    c->fp = fp;
+    return c;
+}
+
+int fmp4_muxer_write(struct fmp4_muxer *c, struct media_packet *pkt)
+{
+    if (!c || !pkt)
+        return -1;
+
+    switch (pkt->type) {
+    case MEDIA_TYPE_VIDEO:
+        return write_video(c, pkt->video);
+    case MEDIA_TYPE_AUDIO:
+        return write_audio(c, pkt->audio);
+    default:
+        printf("%s:%d unknown media type\n", __func__, __LINE__);
+        break;
+    }
+    return -1;
+}
+
+void fmp4_muxer_close(struct fmp4_muxer *c)
+{
+    if (!c)
+        return;
+
+    if ((c->video && c->video->nb_samples) || (c->audio && c->audio->nb_samples))
+        write_fragment(c);
+    if (c->fp)
+        fclose(c->fp);
+    track_free(c->video);
+    track_free(c->audio);
+    free(c);
+}
@@ -0,0 +1,93 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#ifndef FMP4MUXER_H
+#define FMP4MUXER_H
+
+#include <libposix.h>
+#include <libmedia-io.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * native fragmented mp4 (cmaf) muxer, no ffmpeg needed.
+ * ftyp+moov are written once, then one moof+mdat per video gop, so only
+ * the open fragment is held in memory however long the recording runs
+ */
+struct fmp4_config {
+    bool video;
+    bool audio;
+    uint32_t fragment_ms;   /* audio only fragment length, 0 means 1000 */
+    /*
+     * a fragment starting segment_ms or more after the current segment
+     * begins a new one: output segment is called and ftyp+moov are written
+     * again, so each segment plays alone. 0 never cuts
+     */
+    uint32_t segment_ms;
+    /*
+     * a video fragment also closes before it would span more than part_ms,
+     * so a gop goes out as several, e.g. ll-hls partial segments. 0 cuts at
+     * keyframes only
+     */
+    uint32_t part_ms;
+};
+
+/*
+ * where muxed bytes go instead of a file, write returns -1 on error.
+ * fragment is called before the bytes of each moof+mdat, independent if
+ * it starts with a video keyframe (or has no video), duration of its
+ * samples in us
+ */
+struct fmp4_output {
+    int (*write)(void *arg, const void *data, size_t len);
+    int (*segment)(void *arg);
+    void *arg;
+    int (*fragment)(void *arg, bool independent, int64_t duration_us);
+};
+
+struct fmp4_track;
+
+struct fmp4_muxer {
+    struct fmp4_config conf;
+    struct fmp4_output out;
+    FILE *fp;
+    struct fmp4_track *video;
+    struct fmp4_track *audio;
+    uint32_t sequence;
+    bool got_init;
+    bool got_origin;
+    int64_t origin_us;
+    int64_t segment_us;     /* start of the current segment */
+};
+
+GEAR_API struct fmp4_muxer *fmp4_muxer_open(const char *file, struct fmp4_config *conf);
+GEAR_API struct fmp4_muxer *fmp4_muxer_open_output(struct fmp4_config *conf,
+                const struct fmp4_output *out);
+GEAR_API int fmp4_muxer_write(struct fmp4_muxer *c, struct media_packet *pkt);
+GEAR_API void fmp4_muxer_close(struct fmp4_muxer *c);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
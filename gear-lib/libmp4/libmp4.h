@@ -25,6 +25,8 @@
 #include <libposix.h>
 #include <libmedia-io.h>
 #include <stdlib.h>
+#include "fmp4muxer.h"
+#include "mp4recorder.h"
 
 #define LIBMP4_VERSION "0.1.0"
 
@@ -44,8 +46,7 @@ struct mp4_muxer_media {
     AVStream *av_stream;
     AVCodec *av_codec;
     const AVBitStreamFilter *av_bsf;
-    uint64_t first_pts;
-    uint64_t last_pts;
+    int clock_track;
 };
 
 struct mp4_config {
@@ -60,6 +61,7 @@ struct mp4_muxer {
     struct mp4_muxer_media video;
     struct mp4_config conf;
     AVFormatContext *av_format;
+    struct media_clock *clock;
     bool got_video;
 };
 
@@ -68,18 +70,81 @@ GEAR_API int mp4_muxer_write(struct mp4_muxer *c, struct media_packet *frame);
 GEAR_API void mp4_muxer_close(struct mp4_muxer *c);
 
 
+/* 24 bytes per sample, times in the timescale of its track */
+struct mp4_sample {
+    uint64_t offset;
+    uint64_t dts;
+    uint32_t size;
+    int32_t  cto : 31;      /* pts - dts */
+    uint32_t key : 1;
+};
+
+struct mp4_track {
+    uint32_t id;
+    uint32_t timescale;
+    enum media_type type;
+    enum video_codec_type codec;
+    uint32_t width;
+    uint32_t height;
+    uint32_t sample_rate;
+    int channels;
+    const uint8_t *config;  /* avcC, hvcC or AudioSpecificConfig in the mapping */
+    size_t config_size;
+    int nal_length;
+    uint8_t *ps;            /* annexb parameter sets put before keyframes */
+    size_t ps_size;
+    struct mp4_sample *samples;
+    uint32_t nb_samples;
+    uint32_t *sync;         /* indexes of the sync samples */
+    uint32_t nb_sync;
+    uint32_t cursor;        /* next sample of mp4_read_packet */
+};
+
 struct mp4_parser {
     void *opaque_stream;
     void *opaque_root;
+    const uint8_t *map;     /* lazy mode: the file mapped read only */
+    size_t map_size;
+    struct mp4_track *tracks;
+    int nb_tracks;
+    bool indexed;
+    uint8_t *scratch;
+    size_t scratch_size;
 };
 
 
 GEAR_API struct mp4_parser *mp4_parser_create(const char *file);
+/*
+ * maps the file and reads nothing up front, every query walks the box
+ * headers it needs and decodes only the box it answers from
+ */
+GEAR_API struct mp4_parser *mp4_parser_create_lazy(const char *file);
 GEAR_API int mp4_get_duration(struct mp4_parser *mp, uint64_t *duration);
 GEAR_API int mp4_get_creation(struct mp4_parser *mp, uint64_t *time);
 GEAR_API int mp4_get_resolution(struct mp4_parser *mp, uint32_t *width, uint32_t *height);
 GEAR_API void mp4_parser_destroy(struct mp4_parser *mp);
 
+/*
+ * sample index of the h264, h265 and aac tracks, from stbl and from moof of
+ * fragmented files, built on first use. needs mp4_parser_create_lazy
+ */
+GEAR_API int mp4_get_tracks(struct mp4_parser *mp, const struct mp4_track **tracks);
+/* moves to the sync sample at or before ts ms, its time in ms out */
+GEAR_API int mp4_seek(struct mp4_parser *mp, uint64_t ts, uint64_t *sync_ts);
+/* next sample of all tracks in dts order, annexb video, NULL at the end */
+GEAR_API struct media_packet *mp4_read_packet(struct mp4_parser *mp);
+/*
+ * same without allocation, data is annexb video in a scratch buffer of the
+ * parser or audio in the mapping, valid until the next read, -1 at the end
+ */
+GEAR_API int mp4_read_sample(struct mp4_parser *mp, const struct mp4_track **track,
+                const struct mp4_sample **sample, const uint8_t **data, size_t *len);
+/* fill timing and encoder fields of a packet for a sample */
+GEAR_API void mp4_sample_video(const struct mp4_track *t, const struct mp4_sample *sm,
+                struct video_packet *vp);
+GEAR_API void mp4_sample_audio(const struct mp4_track *t, const struct mp4_sample *sm,
+                struct audio_packet *ap);
+
 
 #ifdef __cplusplus
 }
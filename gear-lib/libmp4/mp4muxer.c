@@ -30,8 +30,7 @@ static int muxer_add_stream(struct mp4_muxer *muxer, struct mp4_muxer_media *med
         printf("Could not find encoder for '%s'\n", avcodec_get_name(codec_id));
         return -1;
     }
-    media->first_pts = 0;
-    media->last_pts = 0;
+    media->clock_track = -1;
 
     media->av_stream = avformat_new_stream(muxer->av_format, media->av_codec);
     if (!media->av_stream) {
@@ -81,6 +80,20 @@ static int muxer_add_stream(struct mp4_muxer *muxer, struct mp4_muxer_media *med
     return 0;
 }
 
+/* packets carry ms, the stream takes the timebase set by write_header */
+static int muxer_add_clock(struct mp4_muxer *c, struct mp4_muxer_media *media, rational_t duration)
+{
+    struct media_clock_track_conf conf;
+
+    conf.in_timebase.num = 1;
+    conf.in_timebase.den = 1000;
+    conf.out_timebase.num = media->av_stream->time_base.num;
+    conf.out_timebase.den = media->av_stream->time_base.den;
+    conf.duration = duration;
+    media->clock_track = media_clock_add_track(c->clock, &conf);
+    return media->clock_track < 0 ? -1 : 0;
+}
+
 struct mp4_muxer *mp4_muxer_open(const char *file, struct mp4_config *conf)
 {
     int ret;
@@ -127,43 +140,23 @@ struct mp4_muxer *mp4_muxer_open(const char *file, struct mp4_config *conf)
         avio_closep(&c->av_format->pb);
         goto failed;
     }
+    c->clock = media_clock_create(0);
+    if (!c->clock || (c->video.av_stream &&
+        0 != muxer_add_clock(c, &c->video, (rational_t){c->conf.fps.den, c->conf.fps.num}))) {
+        printf("media_clock for video failed!\n");
+        avio_closep(&c->av_format->pb);
+        goto failed;
+    }
     c->got_video = false;
     return c;
 failed:
     if (c) {
+        media_clock_destroy(c->clock);
         free(c);
     }
     return NULL;
 }
 
-static int64_t update_video_timestamp(struct mp4_muxer *c, uint64_t pts)
-{
-    if (c->video.first_pts == 0) {
-        c->video.first_pts = pts;
-    }
-    if (pts < c->video.last_pts) {
-        c->video.last_pts = c->video.last_pts + 1;
-    } else {
-        c->video.last_pts = pts - c->video.first_pts;
-    }
-    return av_rescale_q(c->video.last_pts, (AVRational){1, 1000}, (AVRational){1, 12500});//fps=25/2
-}
-
-#if 0
-int64_t update_audio_timestamp(struct mp4_muxer_ctx *c, uint64_t pts)
-{
-    if (c->audio.first_pts == 0) {
-        c->audio.first_pts = pts;
-    }
-    if (pts < c->audio.last_pts) {
-        c->audio.last_pts = c->audio.last_pts + 1;
-    } else {
-        c->audio.last_pts = pts - c->audio.first_pts;
-    }
-    return av_rescale_q(c->audio.last_pts, (AVRational){1, 1000}, c->audio.av_stream->time_base);
-}
-#endif
-
 int mp4_muxer_write(struct mp4_muxer *c, struct media_packet *mp)
 {
     int ret;
@@ -179,7 +172,7 @@ int mp4_muxer_write(struct mp4_muxer *c, struct media_packet *mp)
         pkt.data = mp->audio->data;
         pkt.size = mp->audio->size;
         //pkt.pos = -1;
-        //pkt.pts = update_audio_timestamp(c, mp->pts);
+        //media_clock_stamp(c->clock, c->audio.clock_track, ...);
         //av_bitstream_filter_filter(c->audio.av_bsf, c->audio.av_stream->codec, NULL, &pkt.data, &pkt.size, pkt.data, pkt.size, 0);
         break;
     case MEDIA_TYPE_VIDEO:
@@ -204,8 +197,11 @@ int mp4_muxer_write(struct mp4_muxer *c, struct media_packet *mp)
         pkt.data = mp->video->data;
         pkt.size = mp->video->size;
         pkt.pos = -1;
-        pkt.pts = update_video_timestamp(c, mp->video->pts);
-        pkt.dts = pkt.pts;
+        /* dts is not set by every producer, as before pts stands for both */
+        if (0 != media_clock_stamp(c->clock, c->video.clock_track, mp->video->pts,
+                        mp->video->pts, 0, &pkt.pts, &pkt.dts)) {
+            goto exit;
+        }
         break;
     default:
         printf("unknown mp type\n");
@@ -235,5 +231,6 @@ void mp4_muxer_close(struct mp4_muxer *c)
         avio_closep(&c->av_format->pb);
     }
     avformat_free_context(c->av_format);
+    media_clock_destroy(c->clock);
     free(c);
 }
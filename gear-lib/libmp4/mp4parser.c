@@ -22,10 +22,123 @@
 #include "mp4parser_inner.h"
 #include "patch.h"
 #include "libmp4.h"
+#if defined (OS_LINUX) || defined (OS_APPLE)
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
 
 /* seconds from 1904-01-01 00:00:00 UTC to 1969-12-31 24:00:00 UTC */
 #define TIME_OFFSET    2082844800ULL
 
+static uint32_t rb32(const uint8_t *p)
+{
+    return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+static uint64_t rb64(const uint8_t *p)
+{
+    return (uint64_t)rb32(p) << 32 | rb32(p + 4);
+}
+
+/*
+ * next box header in [*p, end), payload and payload size out, *p moves to
+ * the box after it. size 1 means a 64 bit largesize, 0 up to the end
+ */
+static bool lazy_box_next(const uint8_t **p, const uint8_t *end, const uint8_t **type,
+                const uint8_t **payload, uint64_t *payload_size)
+{
+    const uint8_t *b = *p;
+    uint64_t size, hdr = 8;
+
+    if (end - b < 8)
+        return false;
+    size = rb32(b);
+    if (size == 1) {
+        if (end - b < 16)
+            return false;
+        size = rb64(b + 8);
+        hdr = 16;
+    } else if (size == 0) {
+        size = end - b;
+    }
+    if (size < hdr || size > (uint64_t)(end - b))
+        return false;
+    *type = b + 4;
+    *payload = b + hdr;
+    *payload_size = size - hdr;
+    *p = b + size;
+    return true;
+}
+
+/* payload of the first box on a path like "moov/trak/tkhd", headers only */
+static const uint8_t *lazy_path(const uint8_t *p, uint64_t len, const char *path, uint64_t *size)
+{
+    const uint8_t *end = p + len;
+    const uint8_t *type, *payload;
+    uint64_t payload_size;
+
+    while (lazy_box_next(&p, end, &type, &payload, &payload_size)) {
+        if (memcmp(type, path, 4))
+            continue;
+        if (path[4] == '\0') {
+            *size = payload_size;
+            return payload;
+        }
+        path += 5;
+        p = payload;
+        end = payload + payload_size;
+    }
+    return NULL;
+}
+
+static const uint8_t *lazy_find(struct mp4_parser *mp, const char *path, uint64_t *size)
+{
+    return lazy_path(mp->map, mp->map_size, path, size);
+}
+
+struct mp4_parser *mp4_parser_create_lazy(const char *file)
+{
+#if defined (OS_LINUX) || defined (OS_APPLE)
+    struct mp4_parser *mp;
+    struct stat st;
+    void *map;
+    int fd;
+
+    fd = open(file, O_RDONLY);
+    if (fd < 0) {
+        printf("open %s failed:%d %s\n", file, errno, strerror(errno));
+        return NULL;
+    }
+    if (fstat(fd, &st) < 0 || st.st_size < 8) {
+        printf("%s is not a mp4 file\n", file);
+        close(fd);
+        return NULL;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        printf("mmap %s failed:%d %s\n", file, errno, strerror(errno));
+        return NULL;
+    }
+    /* only a few headers are touched, no readahead of sample data */
+    madvise(map, st.st_size, MADV_RANDOM);
+    mp = (struct mp4_parser *)calloc(1, sizeof(struct mp4_parser));
+    if (!mp) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    mp->map = (const uint8_t *)map;
+    mp->map_size = st.st_size;
+    return mp;
+#else
+    return mp4_parser_create(file);
+#endif
+}
+
 struct mp4_parser *mp4_parser_create(const char *file)
 {
     stream_t *stream = create_file_stream(file);
@@ -39,8 +152,18 @@ struct mp4_parser *mp4_parser_create(const char *file)
     return mp;
 }
 
+static void index_free(struct mp4_parser *mp);
+
 void mp4_parser_destroy(struct mp4_parser *mp)
 {
+#if defined (OS_LINUX) || defined (OS_APPLE)
+    if (mp && mp->map) {
+        index_free(mp);
+        munmap((void *)mp->map, mp->map_size);
+        free(mp);
+        return;
+    }
+#endif
     if (!mp || !mp->opaque_root || !mp->opaque_stream) {
         return;
     }
@@ -53,6 +176,22 @@ void mp4_parser_destroy(struct mp4_parser *mp)
 
 int mp4_get_duration(struct mp4_parser *mp, uint64_t *duration)
 {
+    const uint8_t *p;
+    uint64_t size;
+
+    if (mp->map) {
+        /* version 1 has 64 bit times and duration */
+        p = lazy_find(mp, "moov/mvhd", &size);
+        if (!p || size < (p[0] ? 32 : 20)) {
+            return -1;
+        }
+        if (p[0]) {
+            *duration = rb32(p + 20) ? rb64(p + 24) / rb32(p + 20) : 0;
+        } else {
+            *duration = rb32(p + 12) ? rb32(p + 16) / rb32(p + 12) : 0;
+        }
+        return 0;
+    }
     MP4_Box_t *root = (MP4_Box_t *)mp->opaque_root;
     MP4_Box_t *p_box = MP4_BoxGet(root, "moov/mvhd");
     if (!p_box) {
@@ -64,6 +203,17 @@ int mp4_get_duration(struct mp4_parser *mp, uint64_t *duration)
 
 int mp4_get_creation(struct mp4_parser *mp, uint64_t *time)
 {
+    const uint8_t *p;
+    uint64_t size;
+
+    if (mp->map) {
+        p = lazy_find(mp, "moov/mvhd", &size);
+        if (!p || size < (p[0] ? 12 : 8)) {
+            return -1;
+        }
+        *time = (p[0] ? rb64(p + 4) : rb32(p + 4)) - TIME_OFFSET;
+        return 0;
+    }
     MP4_Box_t *root = (MP4_Box_t *)mp->opaque_root;
     MP4_Box_t *p_box = MP4_BoxGet(root, "moov/mvhd");
     if (!p_box) {
@@ -75,6 +225,23 @@ int mp4_get_creation(struct mp4_parser *mp, uint64_t *time)
 
 int mp4_get_resolution(struct mp4_parser *mp, uint32_t *width, uint32_t *height)
 {
+    const uint8_t *p;
+    uint64_t size, off;
+
+    if (mp->map) {
+        /* width and height are 16.16 fixed point at the end of tkhd */
+        p = lazy_find(mp, "moov/trak/tkhd", &size);
+        if (!p) {
+            return -1;
+        }
+        off = p[0] ? 88 : 76;
+        if (size < off + 8) {
+            return -1;
+        }
+        *width = rb32(p + off) >> 16;
+        *height = rb32(p + off + 4) >> 16;
+        return 0;
+    }
     MP4_Box_t *root = (MP4_Box_t *)mp->opaque_root;
     MP4_Box_t *p_box = MP4_BoxGet(root, "moov/trak/tkhd");
     if (!p_box) {
@@ -84,3 +251,742 @@ int mp4_get_resolution(struct mp4_parser *mp, uint32_t *width, uint32_t *height)
     *height = (uint32_t)(p_box->data.p_tkhd->i_height/BLOCK16x16);
     return 0;
 }
+
+/* sample_is_non_sync_sample of the trun/trex sample flags */
+#define SAMPLE_NON_SYNC     0x00010000
+
+static const rational_t timebase_us = {1, 1000000};
+static const rational_t timebase_ms = {1, 1000};
+
+static const uint32_t aac_rates[] = {
+    96000, 88200, 64000, 48000, 44100, 32000,
+    24000, 22050, 16000, 12000, 11025, 8000, 7350,
+};
+
+/* per track state while the index is built */
+struct index_build {
+    uint32_t max;           /* samples allocated */
+    uint64_t next_dts;      /* dts after the last sample */
+    uint32_t duration;      /* trex defaults */
+    uint32_t size;
+    uint32_t flags;
+};
+
+/* full box table: count at skip, then count entries of entry bytes */
+static const uint8_t *index_table(const uint8_t *p, uint64_t size, uint64_t skip,
+                uint32_t entry, uint32_t *count)
+{
+    if (!p || size < skip + 4)
+        return NULL;
+    *count = rb32(p + skip);
+    if (entry && (size - skip - 4) / entry < *count)
+        return NULL;
+    return p + skip + 4;
+}
+
+static int index_push(struct mp4_track *t, struct index_build *b, uint64_t offset,
+                uint64_t dts, uint32_t size, int32_t cto, bool key)
+{
+    struct mp4_sample *sm;
+    uint32_t n;
+
+    if (t->nb_samples == b->max) {
+        n = b->max ? b->max * 2 : 1024;
+        sm = (struct mp4_sample *)realloc(t->samples, n * sizeof(struct mp4_sample));
+        if (!sm) {
+            printf("%s:%d realloc samples failed!\n", __func__, __LINE__);
+            return -1;
+        }
+        t->samples = sm;
+        b->max = n;
+    }
+    sm = &t->samples[t->nb_samples++];
+    sm->offset = offset;
+    sm->dts = dts;
+    sm->size = size;
+    sm->cto = cto;
+    sm->key = key;
+    return 0;
+}
+
+/* avcC/hvcC parameter sets as annexb, and the nal length size */
+static int index_video_config(struct mp4_track *t)
+{
+    const uint8_t *p = t->config, *end = t->config + t->config_size;
+    uint32_t arrays, nalus, len, i, j;
+    size_t n = 0;
+
+    if (t->codec == VIDEO_CODEC_H265) {
+        if (t->config_size < 23)
+            return -1;
+        t->nal_length = (p[21] & 0x03) + 1;
+        arrays = p[22];
+        p += 23;
+    } else {
+        if (t->config_size < 6)
+            return -1;
+        t->nal_length = (p[4] & 0x03) + 1;
+        arrays = 2;     /* sps, then pps, each with its count */
+        p += 5;
+    }
+    /* a 2 byte length becomes a 4 byte start code */
+    t->ps = (uint8_t *)malloc(t->config_size * 2);
+    if (!t->ps)
+        return -1;
+    for (i = 0; i < arrays; i++) {
+        if (t->codec == VIDEO_CODEC_H265) {
+            if (end - p < 3)
+                break;
+            nalus = p[1] << 8 | p[2];
+            p += 3;
+        } else {
+            if (end - p < 1)
+                break;
+            nalus = i ? p[0] : p[0] & 0x1f;
+            p += 1;
+        }
+        for (j = 0; j < nalus && end - p >= 2; j++) {
+            len = p[0] << 8 | p[1];
+            p += 2;
+            if ((uint32_t)(end - p) < len)
+                break;
+            memcpy(t->ps + n, "\0\0\0\1", 4);
+            memcpy(t->ps + n + 4, p, len);
+            n += 4 + len;
+            p += len;
+        }
+    }
+    t->ps_size = n;
+    return 0;
+}
+
+/* AudioSpecificConfig in esds (ISO/IEC 14496-1 7.2.6), 1 to 4 byte sizes */
+static int index_esds(struct mp4_track *t, const uint8_t *p, uint64_t size)
+{
+    const uint8_t *end = p + size;
+    uint32_t len;
+    uint8_t tag, flags;
+    int i;
+
+    p += 4;
+    while (p < end) {
+        tag = *p++;
+        for (i = 0, len = 0; i < 4 && p < end; i++) {
+            len = len << 7 | (*p & 0x7f);
+            if (!(*p++ & 0x80))
+                break;
+        }
+        switch (tag) {
+        case 0x03:      /* ES_Descriptor */
+            if (end - p < 3)
+                return -1;
+            flags = p[2];
+            p += 3;
+            p += (flags & 0x80) ? 2 : 0;
+            if ((flags & 0x40) && p < end)
+                p += 1 + *p;
+            p += (flags & 0x20) ? 2 : 0;
+            break;
+        case 0x04:      /* DecoderConfigDescriptor, mpeg-4 audio only */
+            if (end - p < 13 || p[0] != 0x40)
+                return -1;
+            p += 13;
+            break;
+        case 0x05:      /* DecoderSpecificInfo */
+            if ((uint32_t)(end - p) < len || len < 2)
+                return -1;
+            t->config = p;
+            t->config_size = len;
+            return 0;
+        default:
+            p += len;
+            break;
+        }
+    }
+    return -1;
+}
+
+static int index_sample_entry(struct mp4_track *t, const uint8_t *stsd, uint64_t size)
+{
+    const uint8_t *p = stsd + 8, *end = stsd + size;
+    const uint8_t *type, *entry, *cfg;
+    uint64_t entry_size, cfg_size = 0;
+    uint32_t idx;
+
+    if (size < 8 || !lazy_box_next(&p, end, &type, &entry, &entry_size))
+        return -1;
+    if (!memcmp(type, "avc1", 4) || !memcmp(type, "avc3", 4) ||
+        !memcmp(type, "hvc1", 4) || !memcmp(type, "hev1", 4)) {
+        /* children follow the 78 bytes of VisualSampleEntry */
+        if (entry_size < 78)
+            return -1;
+        t->codec = type[0] == 'a' ? VIDEO_CODEC_H264 : VIDEO_CODEC_H265;
+        cfg = lazy_path(entry + 78, entry_size - 78,
+                        t->codec == VIDEO_CODEC_H264 ? "avcC" : "hvcC", &cfg_size);
+        if (!cfg)
+            return -1;
+        t->config = cfg;
+        t->config_size = cfg_size;
+        if (!t->width) {
+            t->width = entry[24] << 8 | entry[25];
+            t->height = entry[26] << 8 | entry[27];
+        }
+        return index_video_config(t);
+    }
+    if (!memcmp(type, "mp4a", 4)) {
+        /* and the 28 bytes of AudioSampleEntry */
+        if (entry_size < 28)
+            return -1;
+        cfg = lazy_path(entry + 28, entry_size - 28, "esds", &cfg_size);
+        if (!cfg || cfg_size < 4 || 0 != index_esds(t, cfg, cfg_size))
+            return -1;
+        idx = (t->config[0] & 0x07) << 1 | t->config[1] >> 7;
+        t->sample_rate = idx < ARRAY_SIZE(aac_rates) ? aac_rates[idx] : rb32(entry + 24) >> 16;
+        t->channels = (t->config[1] >> 3) & 0x0f;
+        return 0;
+    }
+    printf("%s:%d sample entry %.4s is not supported\n", __func__, __LINE__, type);
+    return -1;
+}
+
+/* stts, ctts, stss, stsz, stsc and stco/co64 into the packed samples */
+static int index_stbl(struct mp4_track *t, struct index_build *b, const uint8_t *stbl,
+                uint64_t stbl_size)
+{
+    const uint8_t *stts, *ctts = NULL, *stss = NULL, *stsz = NULL, *stsc, *stco, *p;
+    uint32_t nb_stts = 0, nb_ctts = 0, nb_stss = 0, nb_stsz = 0, nb_stsc = 0, nb_stco = 0;
+    uint32_t fixed = 0, chunk, sc, per_chunk, n, k, size;
+    uint32_t si = 0, stts_left, ci = 0, ctts_left, ki = 0;
+    uint64_t len = 0, offset, dts = 0;
+    bool co64 = false, bad = false;
+
+    p = lazy_path(stbl, stbl_size, "stts", &len);
+    stts = index_table(p, len, 4, 8, &nb_stts);
+    p = lazy_path(stbl, stbl_size, "ctts", &len);
+    if (p && !(ctts = index_table(p, len, 4, 8, &nb_ctts)))
+        bad = true;
+    p = lazy_path(stbl, stbl_size, "stss", &len);
+    if (p && !(stss = index_table(p, len, 4, 4, &nb_stss)))
+        bad = true;
+    p = lazy_path(stbl, stbl_size, "stsz", &len);
+    if (p && len >= 12) {
+        fixed = rb32(p + 4);
+        stsz = index_table(p, len, 8, fixed ? 0 : 4, &nb_stsz);
+    }
+    p = lazy_path(stbl, stbl_size, "stsc", &len);
+    stsc = index_table(p, len, 4, 12, &nb_stsc);
+    p = lazy_path(stbl, stbl_size, "stco", &len);
+    if (!p) {
+        p = lazy_path(stbl, stbl_size, "co64", &len);
+        co64 = true;
+    }
+    stco = index_table(p, len, 4, co64 ? 8 : 4, &nb_stco);
+    if (bad || !stts || !stsz || !stsc || !stco) {
+        printf("%s:%d invalid sample tables\n", __func__, __LINE__);
+        return -1;
+    }
+
+    stts_left = nb_stts ? rb32(stts) : 0;
+    ctts_left = nb_ctts ? rb32(ctts) : 0;
+    for (chunk = 0, sc = 0, n = 0; chunk < nb_stco && n < nb_stsz && nb_stsc; chunk++) {
+        while (sc + 1 < nb_stsc && rb32(stsc + (sc + 1) * 12) <= chunk + 1)
+            sc++;
+        per_chunk = rb32(stsc + sc * 12 + 4);
+        offset = co64 ? rb64(stco + chunk * 8) : rb32(stco + chunk * 4);
+        for (k = 0; k < per_chunk && n < nb_stsz; k++, n++) {
+            while (!stts_left && si + 1 < nb_stts)
+                stts_left = rb32(stts + ++si * 8);
+            while (!ctts_left && ci + 1 < nb_ctts)
+                ctts_left = rb32(ctts + ++ci * 8);
+            while (ki < nb_stss && rb32(stss + ki * 4) < n + 1)
+                ki++;
+            size = fixed ? fixed : rb32(stsz + n * 4);
+            if (0 != index_push(t, b, offset, dts, size,
+                            nb_ctts ? (int32_t)rb32(ctts + ci * 8 + 4) : 0,
+                            !stss || (ki < nb_stss && rb32(stss + ki * 4) == n + 1)))
+                return -1;
+            offset += size;
+            dts += nb_stts ? rb32(stts + si * 8 + 4) : 0;
+            stts_left -= stts_left ? 1 : 0;
+            ctts_left -= ctts_left ? 1 : 0;
+        }
+    }
+    b->next_dts = dts;
+    return 0;
+}
+
+/* 1 for a track that is not h264, h265 or aac */
+static int index_trak(struct mp4_track *t, struct index_build *b, const uint8_t *trak,
+                uint64_t size)
+{
+    const uint8_t *p, *stbl, *stsd;
+    uint64_t len = 0, stbl_size = 0, stsd_size = 0;
+
+    p = lazy_path(trak, size, "tkhd", &len);
+    if (!p || len < (p[0] ? 96 : 84))
+        return -1;
+    t->id = rb32(p + (p[0] ? 20 : 12));
+    t->width = rb32(p + (p[0] ? 88 : 76)) >> 16;
+    t->height = rb32(p + (p[0] ? 92 : 80)) >> 16;
+    p = lazy_path(trak, size, "mdia/mdhd", &len);
+    if (!p || len < (p[0] ? 24 : 16))
+        return -1;
+    t->timescale = rb32(p + (p[0] ? 20 : 12));
+    p = lazy_path(trak, size, "mdia/hdlr", &len);
+    if (!p || len < 12 || !t->timescale)
+        return -1;
+    if (!memcmp(p + 8, "vide", 4)) {
+        t->type = MEDIA_TYPE_VIDEO;
+    } else if (!memcmp(p + 8, "soun", 4)) {
+        t->type = MEDIA_TYPE_AUDIO;
+    } else {
+        return 1;
+    }
+    stbl = lazy_path(trak, size, "mdia/minf/stbl", &stbl_size);
+    stsd = stbl ? lazy_path(stbl, stbl_size, "stsd", &stsd_size) : NULL;
+    if (!stsd || 0 != index_sample_entry(t, stsd, stsd_size))
+        return 1;
+    return index_stbl(t, b, stbl, stbl_size);
+}
+
+static int index_track_by_id(struct mp4_parser *mp, uint32_t id)
+{
+    int i;
+
+    for (i = 0; i < mp->nb_tracks; i++) {
+        if (mp->tracks[i].id == id)
+            return i;
+    }
+    return -1;
+}
+
+/* samples of one traf, defaults from tfhd or else trex */
+static int index_traf(struct mp4_parser *mp, struct index_build *builds, const uint8_t *moof,
+                const uint8_t *traf, uint64_t traf_size)
+{
+    const uint8_t *tfhd, *tfdt, *p, *end, *type, *run;
+    uint32_t tf_flags, flags, count, entry, first = 0, i;
+    uint32_t def_duration, def_size, def_flags, duration, size, sflags;
+    uint64_t len = 0, run_size, base, offset, dts;
+    struct index_build *b;
+    struct mp4_track *t;
+    int32_t cto;
+    int idx;
+
+    tfhd = lazy_path(traf, traf_size, "tfhd", &len);
+    if (!tfhd || len < 8)
+        return -1;
+    idx = index_track_by_id(mp, rb32(tfhd + 4));
+    if (idx < 0)
+        return 0;
+    t = &mp->tracks[idx];
+    b = &builds[idx];
+    tf_flags = rb32(tfhd) & 0xffffff;
+    if (len < 8 + ((tf_flags & 0x01) ? 8 : 0) + 4 * !!(tf_flags & 0x02) +
+              4 * !!(tf_flags & 0x08) + 4 * !!(tf_flags & 0x10) + 4 * !!(tf_flags & 0x20))
+        return -1;
+    def_duration = b->duration;
+    def_size = b->size;
+    def_flags = b->flags;
+    base = moof - mp->map;
+    p = tfhd + 8;
+    if (tf_flags & 0x01) {
+        base = rb64(p);
+        p += 8;
+    }
+    p += (tf_flags & 0x02) ? 4 : 0;
+    if (tf_flags & 0x08) {
+        def_duration = rb32(p);
+        p += 4;
+    }
+    if (tf_flags & 0x10) {
+        def_size = rb32(p);
+        p += 4;
+    }
+    if (tf_flags & 0x20)
+        def_flags = rb32(p);
+
+    dts = b->next_dts;
+    tfdt = lazy_path(traf, traf_size, "tfdt", &len);
+    if (tfdt && len >= (tfdt[0] ? 12 : 8))
+        dts = tfdt[0] ? rb64(tfdt + 4) : rb32(tfdt + 4);
+
+    offset = base;
+    p = traf;
+    end = traf + traf_size;
+    while (lazy_box_next(&p, end, &type, &run, &run_size)) {
+        if (memcmp(type, "trun", 4))
+            continue;
+        if (run_size < 8)
+            return -1;
+        flags = rb32(run) & 0xffffff;
+        count = rb32(run + 4);
+        run += 8;
+        run_size -= 8;
+        entry = 4 * (!!(flags & 0x100) + !!(flags & 0x200) + !!(flags & 0x400) + !!(flags & 0x800));
+        if (run_size < 4 * (!!(flags & 0x01) + !!(flags & 0x04)))
+            return -1;
+        run_size -= 4 * (!!(flags & 0x01) + !!(flags & 0x04));
+        if (entry && run_size / entry < count)
+            return -1;
+        if (flags & 0x01) {
+            offset = base + (int32_t)rb32(run);
+            run += 4;
+        }
+        if (flags & 0x04) {
+            first = rb32(run);
+            run += 4;
+        }
+        for (i = 0; i < count; i++) {
+            duration = def_duration;
+            size = def_size;
+            sflags = (i == 0 && (flags & 0x04)) ? first : def_flags;
+            cto = 0;
+            if (flags & 0x100) {
+                duration = rb32(run);
+                run += 4;
+            }
+            if (flags & 0x200) {
+                size = rb32(run);
+                run += 4;
+            }
+            if (flags & 0x400) {
+                sflags = rb32(run);
+                run += 4;
+            }
+            if (flags & 0x800) {
+                cto = (int32_t)rb32(run);
+                run += 4;
+            }
+            if (0 != index_push(t, b, offset, dts, size, cto, !(sflags & SAMPLE_NON_SYNC)))
+                return -1;
+            offset += size;
+            dts += duration;
+        }
+    }
+    b->next_dts = dts;
+    return 0;
+}
+
+static void index_track_free(struct mp4_track *t)
+{
+    free(t->samples);
+    free(t->sync);
+    free(t->ps);
+    memset(t, 0, sizeof(struct mp4_track));
+}
+
+static void index_free(struct mp4_parser *mp)
+{
+    int i;
+
+    for (i = 0; i < mp->nb_tracks; i++) {
+        index_track_free(&mp->tracks[i]);
+    }
+    free(mp->tracks);
+    free(mp->scratch);
+    mp->tracks = NULL;
+    mp->nb_tracks = 0;
+    mp->scratch = NULL;
+}
+
+static int index_build(struct mp4_parser *mp)
+{
+    const uint8_t *moov, *mvex, *moof, *p, *end, *type, *payload, *q, *qend, *ctype, *cpayload;
+    uint64_t moov_size, mvex_size = 0, len, clen;
+    struct index_build *builds;
+    struct mp4_track *t;
+    uint32_t i, n;
+    int idx, ret;
+
+    if (mp->indexed)
+        return mp->nb_tracks > 0 ? 0 : -1;
+    mp->indexed = true;
+    if (!mp->map) {
+        printf("%s:%d sample index needs mp4_parser_create_lazy\n", __func__, __LINE__);
+        return -1;
+    }
+    moov = lazy_find(mp, "moov", &moov_size);
+    if (!moov)
+        return -1;
+    for (n = 0, p = moov, end = moov + moov_size; lazy_box_next(&p, end, &type, &payload, &len);) {
+        n += !memcmp(type, "trak", 4);
+    }
+    mp->tracks = (struct mp4_track *)calloc(n ? n : 1, sizeof(struct mp4_track));
+    builds = (struct index_build *)calloc(n ? n : 1, sizeof(struct index_build));
+    if (!mp->tracks || !builds) {
+        free(builds);
+        return -1;
+    }
+    for (p = moov; lazy_box_next(&p, end, &type, &payload, &len);) {
+        if (memcmp(type, "trak", 4))
+            continue;
+        t = &mp->tracks[mp->nb_tracks];
+        ret = index_trak(t, &builds[mp->nb_tracks], payload, len);
+        if (ret == 0) {
+            mp->nb_tracks++;
+        } else {
+            index_track_free(t);
+            memset(&builds[mp->nb_tracks], 0, sizeof(struct index_build));
+        }
+    }
+
+    /* fragmented: trex defaults, then the moof boxes after moov */
+    mvex = lazy_path(moov, moov_size, "mvex", &mvex_size);
+    for (p = mvex, end = mvex + mvex_size; mvex && lazy_box_next(&p, end, &type, &payload, &len);) {
+        if (memcmp(type, "trex", 4) || len < 24)
+            continue;
+        idx = index_track_by_id(mp, rb32(payload + 4));
+        if (idx >= 0) {
+            builds[idx].duration = rb32(payload + 12);
+            builds[idx].size = rb32(payload + 16);
+            builds[idx].flags = rb32(payload + 20);
+        }
+    }
+    for (p = mp->map, end = mp->map + mp->map_size; mvex;) {
+        moof = p;
+        if (!lazy_box_next(&p, end, &type, &payload, &len))
+            break;
+        if (memcmp(type, "moof", 4))
+            continue;
+        for (q = payload, qend = payload + len; lazy_box_next(&q, qend, &ctype, &cpayload, &clen);) {
+            if (!memcmp(ctype, "traf", 4) && 0 != index_traf(mp, builds, moof, cpayload, clen)) {
+                printf("%s:%d invalid fragment at %zu\n", __func__, __LINE__,
+                       (size_t)(moof - mp->map));
+                break;
+            }
+        }
+    }
+    free(builds);
+
+    for (idx = 0; idx < mp->nb_tracks; idx++) {
+        t = &mp->tracks[idx];
+        for (i = 0, n = 0; i < t->nb_samples; i++) {
+            n += t->samples[i].key;
+        }
+        t->sync = (uint32_t *)malloc((n ? n : 1) * sizeof(uint32_t));
+        if (!t->sync)
+            return -1;
+        for (i = 0, n = 0; i < t->nb_samples; i++) {
+            if (t->samples[i].key)
+                t->sync[n++] = i;
+        }
+        t->nb_sync = n;
+    }
+    return mp->nb_tracks > 0 ? 0 : -1;
+}
+
+static int64_t index_time_us(const struct mp4_track *t, uint64_t dts)
+{
+    return media_ts_rescale(dts, (rational_t){1, (int)t->timescale}, timebase_us);
+}
+
+/* first sample at or after us */
+static uint32_t index_lower_bound(const struct mp4_track *t, int64_t us)
+{
+    uint64_t dts = media_ts_rescale(us, timebase_us, (rational_t){1, (int)t->timescale});
+    uint32_t lo = 0, hi = t->nb_samples, mid;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (t->samples[mid].dts < dts)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+int mp4_get_tracks(struct mp4_parser *mp, const struct mp4_track **tracks)
+{
+    if (!mp || !tracks || 0 != index_build(mp)) {
+        return -1;
+    }
+    *tracks = mp->tracks;
+    return mp->nb_tracks;
+}
+
+int mp4_seek(struct mp4_parser *mp, uint64_t ts, uint64_t *sync_ts)
+{
+    struct mp4_track *ref = NULL, *t;
+    uint32_t lo, hi, mid;
+    uint64_t target;
+    int64_t us;
+    int i;
+
+    if (!mp || 0 != index_build(mp)) {
+        return -1;
+    }
+    /* video decides, the other tracks follow its sync sample */
+    for (i = 0; i < mp->nb_tracks; i++) {
+        t = &mp->tracks[i];
+        if (t->nb_sync && (!ref || (t->type == MEDIA_TYPE_VIDEO && ref->type != MEDIA_TYPE_VIDEO))) {
+            ref = t;
+        }
+    }
+    if (!ref) {
+        return -1;
+    }
+    target = media_ts_rescale(ts, timebase_ms, (rational_t){1, (int)ref->timescale});
+    for (lo = 0, hi = ref->nb_sync; hi - lo > 1;) {
+        mid = lo + (hi - lo) / 2;
+        if (ref->samples[ref->sync[mid]].dts <= target)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    ref->cursor = ref->sync[lo];
+    us = index_time_us(ref, ref->samples[ref->cursor].dts);
+    for (i = 0; i < mp->nb_tracks; i++) {
+        t = &mp->tracks[i];
+        if (t != ref) {
+            t->cursor = index_lower_bound(t, us);
+        }
+    }
+    if (sync_ts) {
+        *sync_ts = us / 1000;
+    }
+    return 0;
+}
+
+/* length prefixed nals to annexb, parameter sets before a keyframe */
+static int index_annexb(struct mp4_parser *mp, const struct mp4_track *t,
+                const struct mp4_sample *sm, size_t *out)
+{
+    const uint8_t *p = mp->map + sm->offset, *end = p + sm->size;
+    size_t need = t->ps_size + (size_t)sm->size * 4, n = 0;
+    uint32_t len;
+    uint8_t *buf;
+    int k;
+
+    if (mp->scratch_size < need) {
+        buf = (uint8_t *)realloc(mp->scratch, need);
+        if (!buf) {
+            printf("%s:%d realloc %zu failed!\n", __func__, __LINE__, need);
+            return -1;
+        }
+        mp->scratch = buf;
+        mp->scratch_size = need;
+    }
+    if (sm->key && t->ps_size) {
+        memcpy(mp->scratch, t->ps, t->ps_size);
+        n = t->ps_size;
+    }
+    while (end - p >= t->nal_length) {
+        for (k = 0, len = 0; k < t->nal_length; k++) {
+            len = len << 8 | *p++;
+        }
+        if ((uint32_t)(end - p) < len) {
+            printf("%s:%d nal length %u over the sample\n", __func__, __LINE__, len);
+            break;
+        }
+        memcpy(mp->scratch + n, "\0\0\0\1", 4);
+        memcpy(mp->scratch + n + 4, p, len);
+        n += 4 + len;
+        p += len;
+    }
+    *out = n;
+    return 0;
+}
+
+void mp4_sample_video(const struct mp4_track *t, const struct mp4_sample *sm,
+                struct video_packet *vp)
+{
+    vp->dts = sm->dts;
+    vp->pts = (int64_t)sm->dts + sm->cto > 0 ? sm->dts + sm->cto : 0;
+    vp->key_frame = sm->key;
+    vp->type = sm->key ? H26X_FRAME_I : H26X_FRAME_P;
+    vp->encoder.type = t->codec;
+    vp->encoder.width = t->width;
+    vp->encoder.height = t->height;
+    vp->encoder.timebase = (rational_t){1, (int)t->timescale};
+    vp->encoder.extra_data = (uint8_t *)t->config;
+    vp->encoder.extra_size = t->config_size;
+}
+
+void mp4_sample_audio(const struct mp4_track *t, const struct mp4_sample *sm,
+                struct audio_packet *ap)
+{
+    ap->pts = ap->dts = sm->dts;
+    ap->encoder.format = AUDIO_CODEC_AAC;
+    ap->encoder.sample_rate = t->sample_rate;
+    ap->encoder.channels = t->channels;
+    ap->encoder.timebase = (rational_t){1, (int)t->timescale};
+    ap->encoder.extra_data = (uint8_t *)t->config;
+    ap->encoder.extra_size = t->config_size;
+}
+
+int mp4_read_sample(struct mp4_parser *mp, const struct mp4_track **track,
+                const struct mp4_sample **sample, const uint8_t **data, size_t *len)
+{
+    struct mp4_track *t = NULL;
+    struct mp4_sample *sm;
+    int64_t us, best = 0;
+    int i;
+
+    if (!mp || 0 != index_build(mp)) {
+        return -1;
+    }
+    for (;;) {
+        t = NULL;
+        for (i = 0; i < mp->nb_tracks; i++) {
+            if (mp->tracks[i].cursor >= mp->tracks[i].nb_samples)
+                continue;
+            us = index_time_us(&mp->tracks[i], mp->tracks[i].samples[mp->tracks[i].cursor].dts);
+            if (!t || us < best) {
+                t = &mp->tracks[i];
+                best = us;
+            }
+        }
+        if (!t) {
+            return -1;
+        }
+        sm = &t->samples[t->cursor++];
+        if (sm->offset <= mp->map_size && sm->size <= mp->map_size - sm->offset) {
+            break;
+        }
+        /* a recording cut short, the rest of this track is gone */
+        t->cursor = t->nb_samples;
+    }
+    if (t->type == MEDIA_TYPE_VIDEO) {
+        if (0 != index_annexb(mp, t, sm, len)) {
+            return -1;
+        }
+        *data = mp->scratch;
+    } else {
+        *data = mp->map + sm->offset;
+        *len = sm->size;
+    }
+    *track = t;
+    *sample = sm;
+    return 0;
+}
+
+struct media_packet *mp4_read_packet(struct mp4_parser *mp)
+{
+    struct media_packet *pkt;
+    const struct mp4_track *t;
+    const struct mp4_sample *sm;
+    const uint8_t *data;
+    size_t len;
+
+    if (0 != mp4_read_sample(mp, &t, &sm, &data, &len)) {
+        return NULL;
+    }
+    if (t->type == MEDIA_TYPE_VIDEO) {
+        pkt = media_packet_create(MEDIA_TYPE_VIDEO, MEDIA_MEM_DEEP, (void *)data, len);
+        if (!pkt || !pkt->video) {
+            media_packet_destroy(pkt);
+            return NULL;
+        }
+        mp4_sample_video(t, sm, pkt->video);
+    } else {
+        pkt = media_packet_create(MEDIA_TYPE_AUDIO, MEDIA_MEM_DEEP, (void *)data, len);
+        if (!pkt || !pkt->audio) {
+            media_packet_destroy(pkt);
+            return NULL;
+        }
+        mp4_sample_audio(t, sm, pkt->audio);
+    }
+    return pkt;
+}
@@ -0,0 +1,314 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#include "mp4recorder.h"
+#include "fmp4muxer.h"
+#include <libfile.h>
+#include <libqueue.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MP4_RECORDER_SEGMENT_MS     (60 * 1000)
+#define MP4_RECORDER_PREALLOC       (64ULL * 1024 * 1024)
+#define MP4_RECORDER_QUEUE_BYTES    (64 * 1024 * 1024)
+#define MP4_RECORDER_QUEUE_DEPTH    (64 * 1024)
+#define MP4_RECORDER_POLL_MS        100
+
+struct recorder_segment {
+    char *path;
+    uint64_t size;
+};
+
+struct mp4_recorder {
+    struct mp4_recorder_config conf;
+    char *prefix;
+    struct fmp4_muxer *mux;
+    struct file_segment *seg;
+    struct queue *q;
+    pthread_t tid;
+    bool run;
+    /* closed segments oldest first, for retention */
+    struct recorder_segment *closed;
+    int nb_closed;
+    int max_closed;
+    uint64_t closed_bytes;
+    struct mp4_recorder_stats stats;
+};
+
+static void *item_alloc_hook(void *data, size_t len, void *arg)
+{
+    return media_packet_copy((struct media_packet *)arg, MEDIA_MEM_DEEP);
+}
+
+static void item_free_hook(void *data)
+{
+    media_packet_destroy((struct media_packet *)data);
+}
+
+static void retention_apply(struct mp4_recorder *r)
+{
+    struct recorder_segment *old;
+
+    while (r->nb_closed > 0 &&
+           ((r->conf.max_segments && r->nb_closed > r->conf.max_segments) ||
+            (r->conf.max_bytes && r->closed_bytes > r->conf.max_bytes))) {
+        old = &r->closed[0];
+        if (0 != file_delete(old->path)) {
+            printf("%s:%d delete %s failed!\n", __func__, __LINE__, old->path);
+        } else {
+            __atomic_add_fetch(&r->stats.deleted, 1, __ATOMIC_RELAXED);
+        }
+        r->closed_bytes -= old->size;
+        free(old->path);
+        memmove(&r->closed[0], &r->closed[1], --r->nb_closed * sizeof(*old));
+    }
+}
+
+/* called by file_segment in the writer thread when a segment is done */
+static void on_segment_close(const char *path, uint64_t size, void *arg)
+{
+    struct mp4_recorder *r = (struct mp4_recorder *)arg;
+    struct recorder_segment *closed;
+    int max;
+
+    __atomic_add_fetch(&r->stats.segments, 1, __ATOMIC_RELAXED);
+    if (r->conf.on_segment) {
+        r->conf.on_segment(path, size, r->conf.arg);
+    }
+    if (!r->conf.max_segments && !r->conf.max_bytes) {
+        return;
+    }
+    if (r->nb_closed == r->max_closed) {
+        max = r->max_closed ? r->max_closed * 2 : 16;
+        closed = realloc(r->closed, max * sizeof(struct recorder_segment));
+        if (!closed) {
+            printf("%s:%d realloc failed, %s is not retained\n", __func__, __LINE__, path);
+            return;
+        }
+        r->closed = closed;
+        r->max_closed = max;
+    }
+    r->closed[r->nb_closed].path = strdup(path);
+    r->closed[r->nb_closed].size = size;
+    if (!r->closed[r->nb_closed].path) {
+        return;
+    }
+    r->nb_closed++;
+    r->closed_bytes += size;
+    retention_apply(r);
+}
+
+static int output_write(void *arg, const void *data, size_t len)
+{
+    struct mp4_recorder *r = (struct mp4_recorder *)arg;
+    if (file_segment_write(r->seg, data, len) != (ssize_t)len) {
+        return -1;
+    }
+    __atomic_add_fetch(&r->stats.bytes, len, __ATOMIC_RELAXED);
+    return 0;
+}
+
+static int output_segment(void *arg)
+{
+    struct mp4_recorder *r = (struct mp4_recorder *)arg;
+    return file_segment_rotate(r->seg);
+}
+
+static void recorder_mux(struct mp4_recorder *r, struct queue_item *it)
+{
+    struct media_packet *pkt = (struct media_packet *)it->opaque.iov_base;
+
+    /* a bad packet or a full disk loses that packet, not the recording */
+    if (pkt && 0 != fmp4_muxer_write(r->mux, pkt)) {
+        printf("%s:%d fmp4_muxer_write failed!\n", __func__, __LINE__);
+    }
+    __atomic_add_fetch(&r->stats.packets, 1, __ATOMIC_RELAXED);
+    queue_item_free(r->q, it);
+}
+
+static void *recorder_thread(void *arg)
+{
+    struct mp4_recorder *r = (struct mp4_recorder *)arg;
+    struct queue_item *it;
+
+    while (__atomic_load_n(&r->run, __ATOMIC_ACQUIRE)) {
+        it = queue_pop_wait(r->q, MP4_RECORDER_POLL_MS);
+        if (it) {
+            recorder_mux(r, it);
+        }
+    }
+    while ((it = queue_pop_wait(r->q, 0))) {
+        recorder_mux(r, it);
+    }
+    return NULL;
+}
+
+struct mp4_recorder *mp4_recorder_create(const struct mp4_recorder_config *conf)
+{
+    struct mp4_recorder *r;
+    struct fmp4_config fconf;
+    struct fmp4_output out;
+    struct file_segment_param param;
+
+    if (!conf || !conf->prefix || (!conf->video && !conf->audio)) {
+        printf("%s:%d invalid paraments!\n", __func__, __LINE__);
+        return NULL;
+    }
+    r = calloc(1, sizeof(struct mp4_recorder));
+    if (!r) {
+        printf("malloc mp4_recorder failed!\n");
+        return NULL;
+    }
+    r->conf = *conf;
+    r->prefix = strdup(conf->prefix);
+    r->conf.prefix = r->prefix;
+    if (!r->conf.segment_ms)
+        r->conf.segment_ms = MP4_RECORDER_SEGMENT_MS;
+    if (!r->conf.prealloc_size)
+        r->conf.prealloc_size = MP4_RECORDER_PREALLOC;
+    if (!r->conf.queue_bytes)
+        r->conf.queue_bytes = MP4_RECORDER_QUEUE_BYTES;
+
+    r->q = queue_create();
+    if (!r->q) {
+        printf("%s:%d queue_create failed!\n", __func__, __LINE__);
+        goto failed;
+    }
+    queue_set_hook(r->q, item_alloc_hook, item_free_hook);
+    queue_set_depth(r->q, MP4_RECORDER_QUEUE_DEPTH);
+    queue_set_bytes(r->q, r->conf.queue_bytes);
+    queue_set_mode(r->q, QUEUE_FULL_DROP_NEW);
+
+    /* size never rotates, the muxer cuts on fragment boundaries */
+    memset(&param, 0, sizeof(param));
+    param.prefix = r->prefix;
+    param.suffix = ".mp4";
+    param.start_index = r->conf.start_index;
+    param.prealloc_size = r->conf.prealloc_size;
+    param.on_close = on_segment_close;
+    param.arg = r;
+    r->seg = file_segment_open(&param);
+    if (!r->seg) {
+        printf("%s:%d file_segment_open %s failed!\n", __func__, __LINE__, r->prefix);
+        goto failed;
+    }
+
+    memset(&fconf, 0, sizeof(fconf));
+    memset(&out, 0, sizeof(out));
+    fconf.video = r->conf.video;
+    fconf.audio = r->conf.audio;
+    fconf.segment_ms = r->conf.segment_ms;
+    out.write = output_write;
+    out.segment = output_segment;
+    out.arg = r;
+    r->mux = fmp4_muxer_open_output(&fconf, &out);
+    if (!r->mux) {
+        printf("%s:%d fmp4_muxer_open_output failed!\n", __func__, __LINE__);
+        goto failed;
+    }
+
+    r->run = true;
+    if (0 != pthread_create(&r->tid, NULL, recorder_thread, r)) {
+        printf("%s:%d pthread_create failed!\n", __func__, __LINE__);
+        goto failed;
+    }
+    return r;
+
+failed:
+    fmp4_muxer_close(r->mux);
+    if (r->seg) {
+        file_segment_close(r->seg);
+    }
+    if (r->q) {
+        queue_destroy(r->q);
+    }
+    free(r->prefix);
+    free(r);
+    return NULL;
+}
+
+int mp4_recorder_write(struct mp4_recorder *r, struct media_packet *pkt)
+{
+    struct queue_item *it;
+    void *data;
+    size_t len;
+
+    if (!r || !pkt) {
+        return -1;
+    }
+    switch (pkt->type) {
+    case MEDIA_TYPE_VIDEO:
+        data = pkt->video->data;
+        len = pkt->video->size;
+        break;
+    case MEDIA_TYPE_AUDIO:
+        data = pkt->audio->data;
+        len = pkt->audio->size;
+        break;
+    default:
+        return -1;
+    }
+    it = queue_item_alloc(r->q, data, len, pkt);
+    if (!it) {
+        return -1;
+    }
+    if (!it->opaque.iov_base || 0 != queue_push(r->q, it)) {
+        queue_item_free(r->q, it);
+        __atomic_add_fetch(&r->stats.rejected, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+    return 0;
+}
+
+int mp4_recorder_get_stats(struct mp4_recorder *r, struct mp4_recorder_stats *st)
+{
+    if (!r || !st) {
+        return -1;
+    }
+    st->packets = __atomic_load_n(&r->stats.packets, __ATOMIC_RELAXED);
+    st->bytes = __atomic_load_n(&r->stats.bytes, __ATOMIC_RELAXED);
+    st->rejected = __atomic_load_n(&r->stats.rejected, __ATOMIC_RELAXED);
+    st->segments = __atomic_load_n(&r->stats.segments, __ATOMIC_RELAXED);
+    st->deleted = __atomic_load_n(&r->stats.deleted, __ATOMIC_RELAXED);
+    return 0;
+}
+
+void mp4_recorder_destroy(struct mp4_recorder *r)
+{
+    int i;
+
+    if (!r) {
+        return;
+    }
+    __atomic_store_n(&r->run, false, __ATOMIC_RELEASE);
+    pthread_join(r->tid, NULL);
+    fmp4_muxer_close(r->mux);
+    file_segment_close(r->seg);
+    queue_destroy(r->q);
+    for (i = 0; i < r->nb_closed; i++) {
+        free(r->closed[i].path);
+    }
+    free(r->closed);
+    free(r->prefix);
+    free(r);
+}
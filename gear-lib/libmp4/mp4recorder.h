@@ -0,0 +1,78 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#ifndef MP4RECORDER_H
+#define MP4RECORDER_H
+
+#include <libposix.h>
+#include <libmedia-io.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * segmented recorder: packets are queued by reference and a writer thread
+ * muxes them as fmp4 into prefix_000001.mp4, prefix_000002.mp4 ... through
+ * the preallocated libfile segment writer. a segment ends at the first
+ * keyframe after segment_ms, it needs no moov rewrite, so the cut costs
+ * nothing and no frame is lost at the boundary
+ */
+struct mp4_recorder_config {
+    const char *prefix;
+    int start_index;        /* index of the first segment, 0 means 1 */
+    bool video;
+    bool audio;
+    uint32_t segment_ms;    /* target segment length, 0 means 60s */
+    uint64_t prealloc_size; /* fallocate per segment, 0 means 64MB */
+    /* retention of closed segments, oldest are deleted, 0 keeps all */
+    int max_segments;
+    uint64_t max_bytes;
+    size_t queue_bytes;     /* backlog of the writer thread, 0 means 64MB */
+    /* a segment is closed, runs in the writer thread */
+    void (*on_segment)(const char *path, uint64_t size, void *arg);
+    void *arg;
+};
+
+struct mp4_recorder_stats {
+    uint64_t packets;       /* written to the muxer */
+    uint64_t bytes;         /* written to segments */
+    uint64_t rejected;      /* backlog full, not queued */
+    uint32_t segments;      /* closed so far */
+    uint32_t deleted;       /* by retention */
+};
+
+struct mp4_recorder;
+
+GEAR_API struct mp4_recorder *mp4_recorder_create(const struct mp4_recorder_config *conf);
+/*
+ * never blocks on disk: the packet is referenced if it has a media_buffer
+ * and copied if not. returns -1 if the backlog of the writer is full
+ */
+GEAR_API int mp4_recorder_write(struct mp4_recorder *r, struct media_packet *pkt);
+GEAR_API int mp4_recorder_get_stats(struct mp4_recorder *r, struct mp4_recorder_stats *st);
+/* writes all queued packets and closes the last segment */
+GEAR_API void mp4_recorder_destroy(struct mp4_recorder *r);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -27,6 +27,14 @@
 #include <netdb.h>
 #include <unistd.h>
 #include <errno.h>
+#include <sys/uio.h>
+#if defined(MQTT_ASYNC)
+#include <fcntl.h>
+#include <time.h>
+#include <netinet/tcp.h>
+#include <libgevent.h>
+#include <libthread.h>
+#endif
 
 #define SOCK_API    0
 
@@ -994,20 +1002,19 @@ static int mqtt_serialize_publishLength(int qos, mqtt_string topicName, int payl
 }
 
 /**
-  * Serializes the supplied publish data into the supplied buffer, ready for sending
-  * @param buf the buffer into which the packet will be serialized
+  * Serializes the publish header, everything but the payload, into the supplied buffer
+  * @param buf the buffer into which the header will be serialized
   * @param buflen the length in bytes of the supplied buffer
   * @param dup integer - the MQTT dup flag
   * @param qos integer - the MQTT QoS value
   * @param retained integer - the MQTT retained flag
   * @param packetid integer - the MQTT packet identifier
   * @param topicName mqtt_string - the MQTT topic in the publish
-  * @param payload byte buffer - the MQTT publish payload
-  * @param payloadlen integer - the length of the MQTT payload
-  * @return the length of the serialized data.  <= 0 indicates error
+  * @param payloadlen integer - the length of the MQTT payload which follows
+  * @return the length of the header.  <= 0 indicates error
   */
-static int mqtt_serialize_publish(unsigned char* buf, int buflen, unsigned char dup, int qos, unsigned char retained, unsigned short packetid,
-                mqtt_string topicName, unsigned char* payload, int payloadlen)
+static int mqtt_serialize_publishHeader(unsigned char* buf, int buflen, unsigned char dup, int qos, unsigned char retained,
+                unsigned short packetid, mqtt_string topicName, int payloadlen)
 {
     unsigned char *ptr = buf;
     mqtt_header header = {0};
@@ -1015,7 +1022,8 @@ static int mqtt_serialize_publish(unsigned char* buf, int buflen, unsigned char
     int rc = 0;
 
     FUNC_ENTRY;
-    if (mqtt_pkt_len(rem_len = mqtt_serialize_publishLength(qos, topicName, payloadlen)) > buflen) {
+    rem_len = mqtt_serialize_publishLength(qos, topicName, payloadlen);
+    if (mqtt_pkt_len(rem_len) - payloadlen > buflen) {
         rc = MQTTPACKET_BUFFER_TOO_SHORT;
         goto exit;
     }
@@ -1033,8 +1041,6 @@ static int mqtt_serialize_publish(unsigned char* buf, int buflen, unsigned char
     if (qos > 0)
         writeInt(&ptr, packetid);
 
-    memcpy(ptr, payload, payloadlen);
-    ptr += payloadlen;
     rc = ptr - buf;
 
 exit:
@@ -1042,6 +1048,40 @@ exit:
     return rc;
 }
 
+/**
+  * Serializes the supplied publish data into the supplied buffer, ready for sending
+  * @param buf the buffer into which the packet will be serialized
+  * @param buflen the length in bytes of the supplied buffer
+  * @param dup integer - the MQTT dup flag
+  * @param qos integer - the MQTT QoS value
+  * @param retained integer - the MQTT retained flag
+  * @param packetid integer - the MQTT packet identifier
+  * @param topicName mqtt_string - the MQTT topic in the publish
+  * @param payload byte buffer - the MQTT publish payload
+  * @param payloadlen integer - the length of the MQTT payload
+  * @return the length of the serialized data.  <= 0 indicates error
+  */
+static int mqtt_serialize_publish(unsigned char* buf, int buflen, unsigned char dup, int qos, unsigned char retained, unsigned short packetid,
+                mqtt_string topicName, unsigned char* payload, int payloadlen)
+{
+    int rc = 0;
+
+    FUNC_ENTRY;
+    if (mqtt_pkt_len(mqtt_serialize_publishLength(qos, topicName, payloadlen)) > buflen) {
+        rc = MQTTPACKET_BUFFER_TOO_SHORT;
+        goto exit;
+    }
+    rc = mqtt_serialize_publishHeader(buf, buflen, dup, qos, retained, packetid, topicName, payloadlen);
+    if (rc <= 0)
+        goto exit;
+    memcpy(buf + rc, payload, payloadlen);
+    rc += payloadlen;
+
+exit:
+    FUNC_EXIT_RC(rc);
+    return rc;
+}
+
 /**
   * Serializes the ack packet into the supplied buffer.
   * @param buf the buffer into which the packet will be serialized
@@ -1187,6 +1227,54 @@ static int sendPacket(mqtt_client* c, int length, Timer* timer)
     }
     return rc;
 }
+/* header in c->buf and payload by pointer, no copy into c->buf */
+static int sendPacketv(mqtt_client* c, int length, const void* payload, int payloadlen, Timer* timer)
+{
+    int rc = MQTT_FAILURE;
+#if SOCK_API
+    rc = sendPacket(c, length, timer);
+    if (rc == MQTT_SUCCESS && payloadlen > 0 &&
+        c->ops->write(c, payload, payloadlen) != payloadlen)
+        rc = MQTT_FAILURE;
+#else
+    struct iovec iov[2];
+    struct timeval tv;
+    int cnt = 2;
+    ssize_t n;
+
+    iov[0].iov_base = c->buf;
+    iov[0].iov_len = length;
+    iov[1].iov_base = (void*)payload;
+    iov[1].iov_len = payloadlen;
+    while (cnt > 0 && !TimerIsExpired(timer)) {
+        int left = TimerLeftMS(timer);
+        tv.tv_sec = left / 1000;
+        tv.tv_usec = (left % 1000) * 1000;
+        setsockopt(c->ipstack.my_socket, SOL_SOCKET, SO_SNDTIMEO, (char *)&tv, sizeof(struct timeval));
+        n = writev(c->ipstack.my_socket, &iov[2 - cnt], cnt);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            printf("%s:%d writev failed: %s\n", __func__, __LINE__, strerror(errno));
+            break;
+        }
+        while (cnt > 0 && (size_t)n >= iov[2 - cnt].iov_len) {
+            n -= iov[2 - cnt].iov_len;
+            cnt--;
+        }
+        if (cnt > 0) {
+            iov[2 - cnt].iov_base = (char*)iov[2 - cnt].iov_base + n;
+            iov[2 - cnt].iov_len -= n;
+        }
+    }
+    if (cnt == 0) {
+        TimerCountdown(&c->last_sent, c->keepAliveInterval);
+        rc = MQTT_SUCCESS;
+    }
+#endif
+    return rc;
+}
+
 static int readPacket(mqtt_client* c, Timer* timer)
 {
     mqtt_header header = {0};
@@ -1256,7 +1344,6 @@ exit:
 
 int mqtt_client_init(mqtt_client* c, const char *host, int port)
 {
-    int i;
     int command_timeout_ms = 1000;
     int type = SOCK_STREAM;
     sa_family_t family = AF_INET;
@@ -1279,8 +1366,7 @@ int mqtt_client_init(mqtt_client* c, const char *host, int port)
     c->ipstack.read = linux_read;
     c->ipstack.write = linux_write;
 
-    for (i = 0; i < MAX_MESSAGE_HANDLERS; ++i)
-        c->messageHandlers[i].topicFilter = 0;
+    c->subs = NULL;
     c->command_timeout_ms = command_timeout_ms;
     c->buf = calloc(1, sendlen);
     c->buf_size = sendlen;
@@ -1299,61 +1385,220 @@ int mqtt_client_init(mqtt_client* c, const char *host, int port)
     return 0;
 }
 
-// assume topic filter and name is in correct format
-// # can only be at end
-// + and # can only be next to separator
-static char isTopicMatched(char* topicFilter, mqtt_string* topicName)
+/*
+ * subscriptions are kept in a trie with one node per topic level, children
+ * hashed by level name, so matching costs O(topic levels) instead of
+ * O(subscriptions). '+' has its own child, a trailing '#' is kept as a
+ * second handler on the node it hangs from
+ */
+struct mqtt_topic_node {
+    struct mqtt_topic_node *parent;
+    struct mqtt_topic_node *next;       /* bucket chain */
+    struct mqtt_topic_node **buckets;
+    unsigned int nbuckets;
+    unsigned int nchild;
+    struct mqtt_topic_node *plus;       /* '+' child */
+    messageHandler fp;                  /* filter ends here */
+    messageHandler multi_fp;            /* filter ends here with '/#' */
+    unsigned int hash;
+    int len;
+    char level[];
+};
+
+static unsigned int topic_level_hash(const char *s, int len)
 {
-    char* curf = topicFilter;
-    char* curn = topicName->lenstring.data;
-    char* curn_end = curn + topicName->lenstring.len;
+    unsigned int hash = 2166136261u;
+    int i;
 
-    while (*curf && curn < curn_end)
-    {
-        if (*curn == '/' && *curf != '/')
-            break;
-        if (*curf != '+' && *curf != '#' && *curf != *curn)
-            break;
-        if (*curf == '+')
-        {   // skip until we meet the next separator, or end of string
-            char* nextpos = curn + 1;
-            while (nextpos < curn_end && *nextpos != '/')
-                nextpos = ++curn + 1;
+    for (i = 0; i < len; i++)
+        hash = (hash ^ (unsigned char)s[i]) * 16777619u;
+    return hash;
+}
+
+static struct mqtt_topic_node *topic_node_new(struct mqtt_topic_node *parent,
+                const char *level, int len, unsigned int hash)
+{
+    struct mqtt_topic_node *n = calloc(1, sizeof(*n) + len + 1);
+
+    if (!n)
+        return NULL;
+    n->parent = parent;
+    n->hash = hash;
+    n->len = len;
+    memcpy(n->level, level, len);
+    return n;
+}
+
+static struct mqtt_topic_node *topic_node_child(struct mqtt_topic_node *n,
+                const char *level, int len, unsigned int hash)
+{
+    struct mqtt_topic_node *ch;
+
+    if (!n->nbuckets)
+        return NULL;
+    for (ch = n->buckets[hash & (n->nbuckets - 1)]; ch; ch = ch->next) {
+        if (ch->hash == hash && ch->len == len && !memcmp(ch->level, level, len))
+            return ch;
+    }
+    return NULL;
+}
+
+static int topic_node_grow(struct mqtt_topic_node *n)
+{
+    unsigned int i, nb = n->nbuckets ? n->nbuckets * 2 : 4;
+    struct mqtt_topic_node **b = calloc(nb, sizeof(*b));
+    struct mqtt_topic_node *ch, *next;
+
+    if (!b)
+        return -1;
+    for (i = 0; i < n->nbuckets; i++) {
+        for (ch = n->buckets[i]; ch; ch = next) {
+            next = ch->next;
+            ch->next = b[ch->hash & (nb - 1)];
+            b[ch->hash & (nb - 1)] = ch;
         }
-        else if (*curf == '#')
-            curn = curn_end - 1;    // skip until end of string
-        curf++;
-        curn++;
-    };
+    }
+    free(n->buckets);
+    n->buckets = b;
+    n->nbuckets = nb;
+    return 0;
+}
+
+static struct mqtt_topic_node *topic_node_add(struct mqtt_topic_node *n,
+                const char *level, int len)
+{
+    unsigned int hash = topic_level_hash(level, len);
+    struct mqtt_topic_node *ch = topic_node_child(n, level, len, hash);
 
-    return (curn == curn_end) && (*curf == '\0');
+    if (ch)
+        return ch;
+    if (n->nchild >= n->nbuckets && topic_node_grow(n) < 0)
+        return NULL;
+    if (!(ch = topic_node_new(n, level, len, hash)))
+        return NULL;
+    ch->next = n->buckets[hash & (n->nbuckets - 1)];
+    n->buckets[hash & (n->nbuckets - 1)] = ch;
+    n->nchild++;
+    return ch;
 }
 
-static int deliverMessage(mqtt_client* c, mqtt_string* topicName, mqtt_msg* message)
+static void topic_node_free(struct mqtt_topic_node *n)
 {
-    int i;
-    int rc = MQTT_FAILURE;
+    struct mqtt_topic_node *ch, *next;
+    unsigned int i;
 
-    // we have to find the right message handler - indexed by topic
-    for (i = 0; i < MAX_MESSAGE_HANDLERS; ++i)
-    {
-        if (c->messageHandlers[i].topicFilter != 0 && (mqtt_pkt_equals(topicName, (char*)c->messageHandlers[i].topicFilter) ||
-                isTopicMatched((char*)c->messageHandlers[i].topicFilter, topicName)))
-        {
-            if (c->messageHandlers[i].fp != NULL)
-            {
-                MessageData md;
-                NewMessageData(&md, topicName, message);
-                c->messageHandlers[i].fp(&md);
-                rc = MQTT_SUCCESS;
+    if (!n)
+        return;
+    for (i = 0; i < n->nbuckets; i++) {
+        for (ch = n->buckets[i]; ch; ch = next) {
+            next = ch->next;
+            topic_node_free(ch);
+        }
+    }
+    topic_node_free(n->plus);
+    free(n->buckets);
+    free(n);
+}
+
+/* unlink nodes left without handlers or children, up to the root */
+static void topic_node_prune(struct mqtt_topic_node *n)
+{
+    struct mqtt_topic_node *parent, **pp;
+
+    while ((parent = n->parent) && !n->fp && !n->multi_fp && !n->plus && !n->nchild) {
+        if (parent->plus == n) {
+            parent->plus = NULL;
+        } else {
+            for (pp = &parent->buckets[n->hash & (parent->nbuckets - 1)]; *pp != n; pp = &(*pp)->next)
+                ;
+            *pp = n->next;
+            parent->nchild--;
+        }
+        free(n->buckets);
+        free(n);
+        n = parent;
+    }
+}
+
+/*
+ * walk the levels of a filter, creating nodes if add is set. returns the
+ * node the filter ends on, and whether it ends with '#'
+ */
+static struct mqtt_topic_node *topic_filter_walk(struct mqtt_topic_node *n,
+                const char *filter, int add, int *multi)
+{
+    const char *s = filter, *e;
+
+    *multi = 0;
+    for (;;) {
+        e = strchr(s, '/');
+        if (!e)
+            e = s + strlen(s);
+        if (e - s == 1 && *s == '#' && !*e) {
+            *multi = 1;
+            return n;
+        }
+        if (e - s == 1 && *s == '+') {
+            if (!n->plus && add) {
+                if (!(n->plus = topic_node_new(n, s, 1, 0)))
+                    return NULL;
             }
+            n = n->plus;
+        } else if (add) {
+            n = topic_node_add(n, s, e - s);
+        } else {
+            n = topic_node_child(n, s, e - s, topic_level_hash(s, e - s));
         }
+        if (!n || !*e)
+            return n;
+        s = e + 1;
     }
+}
+
+/* call every handler whose filter matches the remaining levels [s, end) */
+static int topic_node_match(struct mqtt_topic_node *n, const char *s, const char *end,
+                int more, MessageData *md)
+{
+    struct mqtt_topic_node *ch;
+    const char *e;
+    int hits = 0;
+    /* wildcards on the first level do not match $SYS style topics */
+    int wild = n->parent || s == end || *s != '$';
+
+    if (n->multi_fp && wild) {
+        n->multi_fp(md);
+        hits++;
+    }
+    if (!more) {
+        if (n->fp) {
+            n->fp(md);
+            hits++;
+        }
+        return hits;
+    }
+    for (e = s; e < end && *e != '/'; e++)
+        ;
+    ch = topic_node_child(n, s, e - s, topic_level_hash(s, e - s));
+    if (ch)
+        hits += topic_node_match(ch, e + 1, end, e < end, md);
+    if (n->plus && wild)
+        hits += topic_node_match(n->plus, e + 1, end, e < end, md);
+    return hits;
+}
+
+static int deliverMessage(mqtt_client* c, mqtt_string* topicName, mqtt_msg* message)
+{
+    int rc = MQTT_FAILURE;
+    MessageData md;
+    const char *s = topicName->lenstring.data;
+    int len = topicName->lenstring.len;
+
+    NewMessageData(&md, topicName, message);
+    if (c->subs && topic_node_match(c->subs, s, s + len, 1, &md))
+        rc = MQTT_SUCCESS;
 
     if (rc == MQTT_FAILURE && c->defaultMessageHandler != NULL)
     {
-        MessageData md;
-        NewMessageData(&md, topicName, message);
         c->defaultMessageHandler(&md);
         rc = MQTT_SUCCESS;
     }
@@ -1363,10 +1608,8 @@ static int deliverMessage(mqtt_client* c, mqtt_string* topicName, mqtt_msg* mess
 
 static void MQTTCleanSession(mqtt_client* c)
 {
-    int i = 0;
-
-    for (i = 0; i < MAX_MESSAGE_HANDLERS; ++i)
-        c->messageHandlers[i].topicFilter = NULL;
+    topic_node_free(c->subs);
+    c->subs = NULL;
 }
 
 static void MQTTCloseSession(mqtt_client* c)
@@ -1379,43 +1622,31 @@ static void MQTTCloseSession(mqtt_client* c)
 
 static int mqtt_set_msg_handler(mqtt_client* c, const char* topicFilter, messageHandler messageHandler)
 {
-    int rc = MQTT_FAILURE;
-    int i = -1;
+    struct mqtt_topic_node *n;
+    int multi;
 
-    /* first check for an existing matching slot */
-    for (i = 0; i < MAX_MESSAGE_HANDLERS; ++i)
-    {
-        if (c->messageHandlers[i].topicFilter != NULL && strcmp(c->messageHandlers[i].topicFilter, topicFilter) == 0)
-        {
-            if (messageHandler == NULL) /* remove existing */
-            {
-                c->messageHandlers[i].topicFilter = NULL;
-                c->messageHandlers[i].fp = NULL;
-            }
-            rc = MQTT_SUCCESS; /* return i when adding new subscription */
-            break;
-        }
+    if (!c->subs) {
+        if (messageHandler == NULL)
+            return MQTT_FAILURE;
+        if (!(c->subs = topic_node_new(NULL, "", 0, 0)))
+            return MQTT_FAILURE;
     }
-    /* if no existing, look for empty slot (unless we are removing) */
-    if (messageHandler != NULL) {
-        if (rc == MQTT_FAILURE)
-        {
-            for (i = 0; i < MAX_MESSAGE_HANDLERS; ++i)
-            {
-                if (c->messageHandlers[i].topicFilter == NULL)
-                {
-                    rc = MQTT_SUCCESS;
-                    break;
-                }
-            }
-        }
-        if (i < MAX_MESSAGE_HANDLERS)
-        {
-            c->messageHandlers[i].topicFilter = topicFilter;
-            c->messageHandlers[i].fp = messageHandler;
-        }
+    n = topic_filter_walk(c->subs, topicFilter, messageHandler != NULL, &multi);
+    if (!n)
+        return MQTT_FAILURE;
+    if (messageHandler == NULL) { /* remove existing */
+        if (multi)
+            n->multi_fp = NULL;
+        else
+            n->fp = NULL;
+        topic_node_prune(n);
+        return MQTT_SUCCESS;
     }
-    return rc;
+    if (multi)
+        n->multi_fp = messageHandler;
+    else
+        n->fp = messageHandler;
+    return MQTT_SUCCESS;
 }
 
 /**
@@ -1454,6 +1685,8 @@ static int mqtt_serialize_connectLength(mqtt_pkt_conn_data* options)
         len = 12; /* variable depending on MQTT or MQIsdp */
     else if (options->mqtt_version == 4)
         len = 10;
+    else if (options->mqtt_version == 5)
+        len = 11 + (options->willFlag ? 1 : 0); /* empty properties */
 
     len += mqtt_strlen(options->clientID)+2;
     if (options->willFlag)
@@ -1494,9 +1727,9 @@ static int mqtt_serialize_connect(unsigned char* buf, int buflen, mqtt_pkt_conn_
 
     ptr += mqtt_pkt_encode(ptr, len); /* write remaining length */
 
-    if (options->mqtt_version == 4) {
+    if (options->mqtt_version == 4 || options->mqtt_version == 5) {
         writeCString(&ptr, "MQTT");
-        writeChar(&ptr, (char) 4);
+        writeChar(&ptr, (char) options->mqtt_version);
     } else {
         writeCString(&ptr, "MQIsdp");
         writeChar(&ptr, (char) 3);
@@ -1517,8 +1750,12 @@ static int mqtt_serialize_connect(unsigned char* buf, int buflen, mqtt_pkt_conn_
 
     writeChar(&ptr, flags.all);
     writeInt(&ptr, options->keepAliveInterval);
+    if (options->mqtt_version == 5)
+        writeChar(&ptr, 0); /* properties length */
     writemqtt_string(&ptr, options->clientID);
     if (options->willFlag) {
+        if (options->mqtt_version == 5)
+            writeChar(&ptr, 0); /* will properties length */
         writemqtt_string(&ptr, options->will.topicName);
         writemqtt_string(&ptr, options->will.message);
     }
@@ -2107,13 +2344,14 @@ int mqtt_publish(mqtt_client* c, const char* topicName, mqtt_msg* message)
     if (message->qos == MQTT_QOS1 || message->qos == MQTT_QOS2)
         message->id = getNextPacketId(c);
 
-    len = mqtt_serialize_publish(c->buf, c->buf_size, 0, message->qos, message->retained, message->id,
-              topic, (unsigned char*)message->payload, message->payloadlen);
+    /* only the header goes into c->buf, payload of any size is sent in place */
+    len = mqtt_serialize_publishHeader(c->buf, c->buf_size, 0, message->qos, message->retained, message->id,
+              topic, message->payloadlen);
     if (len <= 0) {
-        printf("mqtt_serialize_publish failed!\n");
+        printf("mqtt_serialize_publishHeader failed!\n");
         goto exit;
     }
-    if ((rc = sendPacket(c, len, &timer)) != MQTT_SUCCESS) {// send the subscribe packet
+    if ((rc = sendPacketv(c, len, message->payload, message->payloadlen, &timer)) != MQTT_SUCCESS) {
         printf("sendPacket failed!\n");
         goto exit; // there was a problem
     }
@@ -2320,5 +2558,1084 @@ void mqtt_client_deinit(mqtt_client* c)
         free(c->buf);
         free(c->readbuf);
         free(c->host);
+        MQTTCleanSession(c);
+    }
+}
+
+#if defined(MQTT_ASYNC)
+/*
+ * event-driven client: packets are queued by the caller thread, loop
+ * thread moves them into the in-flight list while the window has room,
+ * builds their wire headers for the current connection and writes a batch
+ * with one writev, headers and payloads as separate pieces
+ */
+#define MQTT_ASYNC_INFLIGHT     16
+#define MQTT_ASYNC_QUEUED       1024
+#define MQTT_ASYNC_TIMEOUT_MS   10000
+#define MQTT_ASYNC_ALIASES      16
+#define MQTT_ASYNC_BATCH        64
+
+/* MQTT 5 properties used by the client */
+#define MQTT_PROP_RECEIVE_MAXIMUM       0x21
+#define MQTT_PROP_TOPIC_ALIAS_MAXIMUM   0x22
+#define MQTT_PROP_TOPIC_ALIAS           0x23
+
+/* fixed header, remaining length, topic, id, properties, subscribe options */
+#define ASYNC_HDR_MAX(topic_len)    ((topic_len) + 16)
+
+enum mqtt_async_state {
+    MQTT_ASYNC_IDLE = 0,
+    MQTT_ASYNC_CONNECTING,          /* CONNECT sent, wait CONNACK */
+    MQTT_ASYNC_CONNECTED,
+    MQTT_ASYNC_DISCONNECTING,       /* DISCONNECT sent, close when flushed */
+};
+
+struct mqtt_async_pkt {
+    struct list_head entry;
+    unsigned short id;
+    unsigned char type;             /* PUBLISH, SUBSCRIBE or UNSUBSCRIBE */
+    unsigned char qos;
+    unsigned char retained;
+    unsigned char wait;             /* ack expected */
+    int hdr_len;                    /* wire header in data, built per send */
+    int topic_len;
+    char *topic;
+    const void *payload;            /* copy in data, or buffer of caller */
+    size_t payload_len;
+    void (*release)(void *payload, void *arg);
+    void *release_arg;
+    unsigned char data[0];          /* header, topic, payload copy */
+};
+
+struct mqtt_async_alias {
+    uint32_t hash;
+    int len;
+    char *topic;
+};
+
+struct mqtt_async {
+    struct gevent_base *eb;
+    struct gevent_conn *conn;
+    struct mqtt_async_cbs cbs;
+    void *arg;
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+    enum mqtt_async_state state;
+    int max_inflight;
+    int max_queued;
+    unsigned int timeout_ms;
+    unsigned int keepalive_ms;
+    int cleansession;
+    int v5;
+    int window;                     /* max_inflight, or broker receive maximum */
+    int err;                        /* close is deferred to timer */
+    int connack_rc;
+    int in_cb;
+    struct gevent_wtimer timer;     /* connect timeout, then keepalive */
+    uint64_t last_tx_ms;
+    uint64_t ping_ms;               /* PINGREQ outstanding since */
+    struct list_head inflight;      /* loop thread only, in send order */
+    struct mqtt_async_alias *aliases;   /* topic aliases of this connection */
+    int naliases;
+    int max_aliases;
+    int alias_limit;                /* min of max_aliases and broker maximum */
+    unsigned char qos2_rx[8192];    /* incoming QoS2 ids between PUBREC and PUBREL */
+
+    mutex_lock_t lock;              /* protects below */
+    struct list_head queue;
+    int nqueued;
+    int ninflight;
+    int posted;
+    int dead;
+    unsigned short next_id;
+    unsigned char ids[8192];        /* packet ids queued or in flight */
+};
+
+static uint64_t async_now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void async_pkt_free(struct mqtt_async_pkt *p)
+{
+    if (p->release) {
+        p->release((void *)p->payload, p->release_arg);
+    }
+    free(p);
+}
+
+static void async_alias_reset(struct mqtt_async *c)
+{
+    int i;
+    for (i = 0; i < c->naliases; i++) {
+        free(c->aliases[i].topic);
+    }
+    c->naliases = 0;
+    c->alias_limit = 0;
+}
+
+/*
+ * alias of topic on this connection, 0 if none. *known is set if broker
+ * has seen topic with it, then the topic itself can be left out
+ */
+static int async_alias(struct mqtt_async *c, const char *topic, int len, int *known)
+{
+    uint32_t hash = 2166136261u;
+    int i;
+
+    for (i = 0; i < len; i++) {
+        hash = (hash ^ (unsigned char)topic[i]) * 16777619u;
+    }
+    for (i = 0; i < c->naliases; i++) {
+        if (c->aliases[i].hash == hash && c->aliases[i].len == len &&
+            !memcmp(c->aliases[i].topic, topic, len)) {
+            *known = 1;
+            return i + 1;
+        }
+    }
+    *known = 0;
+    /* no eviction, topics past the limit are sent in full */
+    if (c->naliases >= c->alias_limit) {
+        return 0;
+    }
+    c->aliases[i].topic = malloc(len);
+    if (!c->aliases[i].topic) {
+        return 0;
+    }
+    memcpy(c->aliases[i].topic, topic, len);
+    c->aliases[i].hash = hash;
+    c->aliases[i].len = len;
+    return ++c->naliases;
+}
+
+/* build wire header of p into p->data for current connection */
+static void async_build(struct mqtt_async *c, struct mqtt_async_pkt *p, int dup)
+{
+    unsigned char *ptr = p->data;
+    mqtt_header header = {0};
+    int rem, topic_len = p->topic_len, alias = 0, known = 0;
+
+    header.bits.type = p->type;
+    if (p->type == PUBLISH) {
+        header.bits.dup = dup;
+        header.bits.qos = p->qos;
+        header.bits.retain = p->retained;
+        if (c->v5 && c->alias_limit > 0) {
+            alias = async_alias(c, p->topic, p->topic_len, &known);
+            if (known) {
+                topic_len = 0;
+            }
+        }
+        rem = 2 + topic_len + (p->qos ? 2 : 0) + p->payload_len;
+        if (c->v5) {
+            rem += alias ? 4 : 1;
+        }
+    } else {
+        header.bits.qos = 1;
+        rem = 2 + (c->v5 ? 1 : 0) + 2 + topic_len + (p->type == SUBSCRIBE ? 1 : 0);
+    }
+    writeChar(&ptr, header.byte);
+    ptr += mqtt_pkt_encode(ptr, rem);
+    if (p->type == PUBLISH) {
+        writeInt(&ptr, topic_len);
+        memcpy(ptr, p->topic, topic_len);
+        ptr += topic_len;
+        if (p->qos) {
+            writeInt(&ptr, p->id);
+        }
+        if (c->v5 && alias) {
+            writeChar(&ptr, 3);
+            writeChar(&ptr, MQTT_PROP_TOPIC_ALIAS);
+            writeInt(&ptr, alias);
+        } else if (c->v5) {
+            writeChar(&ptr, 0);
+        }
+    } else {
+        writeInt(&ptr, p->id);
+        if (c->v5) {
+            writeChar(&ptr, 0);
+        }
+        writeInt(&ptr, topic_len);
+        memcpy(ptr, p->topic, topic_len);
+        ptr += topic_len;
+        if (p->type == SUBSCRIBE) {
+            writeChar(&ptr, p->qos);
+        }
+    }
+    p->hdr_len = ptr - p->data;
+}
+
+/* iov pieces of p, header and payload */
+static int async_iov(struct mqtt_async_pkt *p, struct iovec *iov)
+{
+    iov[0].iov_base = p->data;
+    iov[0].iov_len = p->hdr_len;
+    if (!p->payload_len) {
+        return 1;
+    }
+    iov[1].iov_base = (void *)p->payload;
+    iov[1].iov_len = p->payload_len;
+    return 2;
+}
+
+static void async_free(struct mqtt_async *c)
+{
+    struct mqtt_async_pkt *p, *n;
+
+    list_for_each_entry_safe(p, n, &c->queue, entry) {
+        list_del(&p->entry);
+        async_pkt_free(p);
+    }
+    list_for_each_entry_safe(p, n, &c->inflight, entry) {
+        list_del(&p->entry);
+        async_pkt_free(p);
+    }
+    async_alias_reset(c);
+    free(c->aliases);
+    mutex_lock_deinit(&c->lock);
+    free(c);
+}
+
+/* leave a callback, free if destroyed inside it */
+static void async_leave(struct mqtt_async *c)
+{
+    int posted;
+
+    if (--c->in_cb > 0 || !c->dead) {
+        return;
+    }
+    mutex_lock(&c->lock);
+    posted = c->posted;
+    mutex_unlock(&c->lock);
+    if (!posted) {
+        async_free(c);
+    }
+}
+
+/* close from a write error is deferred, callbacks are only called on top */
+static void async_fail(struct mqtt_async *c, int err)
+{
+    if (c->dead) {
+        return;
+    }
+    if (!c->err) {
+        c->err = err;
+    }
+    gevent_wtimer_add(c->eb, &c->timer, 1, TIMER_ONESHOT);
+}
+
+static int async_writev(struct mqtt_async *c, const struct iovec *iov, int cnt)
+{
+    if (0 != gevent_conn_writev(c->conn, iov, cnt)) {
+        async_fail(c, errno ? errno : EIO);
+        return -1;
+    }
+    c->last_tx_ms = async_now_ms();
+    return 0;
+}
+
+static int async_write(struct mqtt_async *c, const void *buf, int len)
+{
+    struct iovec iov;
+    iov.iov_base = (void *)buf;
+    iov.iov_len = len;
+    return async_writev(c, &iov, 1);
+}
+
+static void async_send_ack(struct mqtt_async *c, unsigned char type, unsigned short id)
+{
+    unsigned char buf[4];
+    int len = mqtt_serialize_ack(buf, sizeof(buf), type, 0, id);
+    if (len > 0) {
+        async_write(c, buf, len);
+    }
+}
+
+/* with lock held, 0 if all ids are in use */
+static unsigned short async_id_alloc(struct mqtt_async *c)
+{
+    int i;
+    unsigned short id;
+
+    for (i = 0; i < MAX_PACKET_ID; i++) {
+        id = ++c->next_id;
+        if (id == 0) {
+            id = c->next_id = 1;
+        }
+        if (!(c->ids[id >> 3] & (1 << (id & 7)))) {
+            c->ids[id >> 3] |= 1 << (id & 7);
+            return id;
+        }
+    }
+    return 0;
+}
+
+static void async_on_post(void *arg);
+
+/* any thread: take a packet id if needed and append p to the queue */
+static int async_submit(struct mqtt_async *c, struct mqtt_async_pkt *p, int need_id)
+{
+    int post = 0, id = 0;
+
+    mutex_lock(&c->lock);
+    if (c->dead || c->nqueued >= c->max_queued) {
+        mutex_unlock(&c->lock);
+        free(p);
+        return MQTT_BUFFER_OVERFLOW;
+    }
+    if (need_id) {
+        id = p->id = async_id_alloc(c);
+        if (!id) {
+            mutex_unlock(&c->lock);
+            free(p);
+            return MQTT_BUFFER_OVERFLOW;
+        }
+    }
+    list_add_tail(&p->entry, &c->queue);
+    c->nqueued++;
+    if (!c->posted) {
+        c->posted = post = 1;
+    }
+    mutex_unlock(&c->lock);
+    if (post && 0 != gevent_base_post(c->eb, async_on_post, c)) {
+        /* flushed on next event of this client */
+        mutex_lock(&c->lock);
+        c->posted = 0;
+        mutex_unlock(&c->lock);
     }
+    return id;
 }
+
+/* loop thread: send queued packets while window has room */
+static void async_flush(struct mqtt_async *c)
+{
+    struct mqtt_async_pkt *p, *batch[MQTT_ASYNC_BATCH];
+    struct iovec iov[2 * MQTT_ASYNC_BATCH];
+    int i, n, cnt, ret;
+
+    while (c->conn && c->state == MQTT_ASYNC_CONNECTED && !c->err) {
+        n = 0;
+        mutex_lock(&c->lock);
+        while (n < MQTT_ASYNC_BATCH && !list_empty(&c->queue)) {
+            p = list_first_entry(&c->queue, struct mqtt_async_pkt, entry);
+            if (p->type == PUBLISH && p->qos > 0) {
+                if (c->ninflight >= c->window) {
+                    break;
+                }
+                c->ninflight++;
+            }
+            list_del(&p->entry);
+            c->nqueued--;
+            batch[n++] = p;
+        }
+        mutex_unlock(&c->lock);
+        if (n == 0) {
+            break;
+        }
+        for (i = 0, cnt = 0; i < n; i++) {
+            async_build(c, batch[i], 0);
+            cnt += async_iov(batch[i], &iov[cnt]);
+        }
+        ret = async_writev(c, iov, cnt);
+        /* written or copied into conn buffer, QoS0 payload is done */
+        for (i = 0; i < n; i++) {
+            p = batch[i];
+            if (p->type == PUBLISH && p->qos == 0) {
+                async_pkt_free(p);
+            } else {
+                list_add_tail(&p->entry, &c->inflight);
+            }
+        }
+        if (ret != 0) {
+            break;
+        }
+    }
+}
+
+static void async_on_post(void *arg)
+{
+    struct mqtt_async *c = (struct mqtt_async *)arg;
+    int dead;
+
+    mutex_lock(&c->lock);
+    c->posted = 0;
+    dead = c->dead;
+    mutex_unlock(&c->lock);
+    if (dead) {
+        if (!c->in_cb) {
+            async_free(c);
+        }
+        return;
+    }
+    c->in_cb++;
+    async_flush(c);
+    async_leave(c);
+}
+
+static void async_complete(struct mqtt_async *c, struct mqtt_async_pkt *p, int rc)
+{
+    list_del(&p->entry);
+    mutex_lock(&c->lock);
+    c->ids[p->id >> 3] &= ~(1 << (p->id & 7));
+    if (p->type == PUBLISH) {
+        c->ninflight--;
+    }
+    mutex_unlock(&c->lock);
+    if (p->type == PUBLISH) {
+        if (c->cbs.on_publish) {
+            c->cbs.on_publish(c, p->id, rc, c->arg);
+        }
+    } else if (c->cbs.on_suback) {
+        c->cbs.on_suback(c, p->id, rc, c->arg);
+    }
+    async_pkt_free(p);
+}
+
+/* acks mostly come in send order, so this stops at the head */
+static struct mqtt_async_pkt *async_find(struct mqtt_async *c, unsigned short id, unsigned char wait)
+{
+    struct mqtt_async_pkt *p;
+    list_for_each_entry(p, &c->inflight, entry) {
+        if (p->id == id && p->wait == wait) {
+            return p;
+        }
+    }
+    return NULL;
+}
+
+static void async_close(struct mqtt_async *c, int err)
+{
+    struct mqtt_async_pkt *p, *n;
+    enum mqtt_async_state state = c->state;
+
+    gevent_wtimer_del(c->eb, &c->timer);
+    if (c->conn) {
+        gevent_conn_destroy(c->conn);
+        c->conn = NULL;
+    }
+    c->state = MQTT_ASYNC_IDLE;
+    c->err = 0;
+    c->ping_ms = 0;
+    async_alias_reset(c);
+    if (c->cleansession) {
+        list_for_each_entry_safe(p, n, &c->inflight, entry) {
+            async_complete(c, p, MQTT_FAILURE);
+            if (c->dead) {
+                return;
+            }
+        }
+    }
+    if (state == MQTT_ASYNC_CONNECTING) {
+        if (c->cbs.on_connect) {
+            c->cbs.on_connect(c, c->connack_rc ? c->connack_rc : -err, 0, c->arg);
+        }
+    } else if (c->cbs.on_close) {
+        c->cbs.on_close(c, state == MQTT_ASYNC_DISCONNECTING ? 0 : err, c->arg);
+    }
+}
+
+/* resend in-flight packets of last session with DUP */
+static void async_resend(struct mqtt_async *c)
+{
+    struct mqtt_async_pkt *p;
+    struct iovec iov[2];
+
+    list_for_each_entry(p, &c->inflight, entry) {
+        if (p->wait == PUBCOMP) {
+            async_send_ack(c, PUBREL, p->id);
+            continue;
+        }
+        async_build(c, p, p->type == PUBLISH);
+        if (0 != async_writev(c, iov, async_iov(p, iov))) {
+            break;
+        }
+    }
+}
+
+static int async_varint(const unsigned char **ptr, const unsigned char *end, unsigned int *val)
+{
+    unsigned int v = 0, mult = 1;
+    int i;
+
+    for (i = 0; i < MAX_NO_OF_REMAINING_LENGTH_BYTES && *ptr < end; i++) {
+        v += (**ptr & 127) * mult;
+        mult *= 128;
+        if (!(*(*ptr)++ & 128)) {
+            *val = v;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/*
+ * skip MQTT 5 properties at *ptr, picking up receive maximum and topic
+ * alias maximum of CONNACK
+ */
+static int async_props(const unsigned char **ptr, const unsigned char *end,
+                unsigned int *recv_max, unsigned int *alias_max)
+{
+    const unsigned char *p, *stop;
+    unsigned int len, v;
+    int i;
+
+    if (0 != async_varint(ptr, end, &len) || len > (unsigned int)(end - *ptr)) {
+        return -1;
+    }
+    p = *ptr;
+    stop = p + len;
+    *ptr = stop;
+    while (p < stop) {
+        switch (*p++) {
+        case 0x01: case 0x17: case 0x19: case 0x24:
+        case 0x25: case 0x28: case 0x29: case 0x2A:
+            p += 1;
+            break;
+        case 0x13: case MQTT_PROP_RECEIVE_MAXIMUM:
+        case MQTT_PROP_TOPIC_ALIAS_MAXIMUM: case MQTT_PROP_TOPIC_ALIAS:
+            if (stop - p < 2) {
+                return -1;
+            }
+            v = p[0] << 8 | p[1];
+            if (p[-1] == MQTT_PROP_RECEIVE_MAXIMUM && recv_max) {
+                *recv_max = v;
+            } else if (p[-1] == MQTT_PROP_TOPIC_ALIAS_MAXIMUM && alias_max) {
+                *alias_max = v;
+            }
+            p += 2;
+            break;
+        case 0x02: case 0x11: case 0x18: case 0x27:
+            p += 4;
+            break;
+        case 0x0B:
+            if (0 != async_varint(&p, stop, &v)) {
+                return -1;
+            }
+            break;
+        case 0x26:  /* user property, string pair */
+            for (i = 0; i < 2; i++) {
+                if (stop - p < 2) {
+                    return -1;
+                }
+                p += 2 + (p[0] << 8 | p[1]);
+            }
+            break;
+        case 0x03: case 0x08: case 0x09: case 0x12: case 0x15:
+        case 0x16: case 0x1A: case 0x1C: case 0x1F:
+            if (stop - p < 2) {
+                return -1;
+            }
+            p += 2 + (p[0] << 8 | p[1]);
+            break;
+        default:
+            return -1;
+        }
+    }
+    return p == stop ? 0 : -1;
+}
+
+static void async_on_connack(struct mqtt_async *c, unsigned char *buf, int hlen, int len)
+{
+    const unsigned char *ptr = buf + hlen + 2;
+    unsigned char present = 0, rc = 0;
+    unsigned int recv_max = 0, alias_max = 0;
+
+    if (c->state != MQTT_ASYNC_CONNECTING ||
+        mqtt_deserialize_connack(&present, &rc, buf, len) != 1 ||
+        (c->v5 && rc == 0 && 0 != async_props(&ptr, buf + len, &recv_max, &alias_max))) {
+        async_fail(c, EPROTO);
+        return;
+    }
+    if (rc != MQTT_CONNECTION_ACCEPTED) {
+        c->connack_rc = rc;
+        async_fail(c, ECONNREFUSED);
+        return;
+    }
+    c->state = MQTT_ASYNC_CONNECTED;
+    c->window = c->max_inflight;
+    if (recv_max && (int)recv_max < c->window) {
+        c->window = recv_max;
+    }
+    c->alias_limit = MIN2((int)alias_max, c->max_aliases);
+    gevent_wtimer_del(c->eb, &c->timer);
+    if (c->keepalive_ms) {
+        gevent_wtimer_add(c->eb, &c->timer, c->keepalive_ms / 2, TIMER_PERSIST);
+    }
+    async_resend(c);
+    if (c->cbs.on_connect) {
+        c->cbs.on_connect(c, 0, present, c->arg);
+    }
+}
+
+static void async_on_publish(struct mqtt_async *c, unsigned char *buf, int len)
+{
+    const unsigned char *ptr;
+    mqtt_string topic;
+    mqtt_msg msg;
+    int qos, deliver = 1;
+
+    msg.payloadlen = 0;
+    if (mqtt_deserialize_publish(&msg.dup, &qos, &msg.retained, &msg.id, &topic,
+            (unsigned char **)&msg.payload, (int *)&msg.payloadlen, buf, len) != 1) {
+        async_fail(c, EPROTO);
+        return;
+    }
+    if (c->v5) {
+        ptr = msg.payload;
+        if (0 != async_props(&ptr, buf + len, NULL, NULL)) {
+            async_fail(c, EPROTO);
+            return;
+        }
+        msg.payloadlen = buf + len - ptr;
+        msg.payload = (void *)ptr;
+    }
+    msg.qos = (enum mqtt_qos)qos;
+    if (msg.qos == MQTT_QOS2) {
+        /* delivered on first PUBLISH, dup before PUBREL is dropped */
+        if (c->qos2_rx[msg.id >> 3] & (1 << (msg.id & 7))) {
+            deliver = 0;
+        }
+        c->qos2_rx[msg.id >> 3] |= 1 << (msg.id & 7);
+        async_send_ack(c, PUBREC, msg.id);
+    } else if (msg.qos == MQTT_QOS1) {
+        async_send_ack(c, PUBACK, msg.id);
+    }
+    if (deliver && c->cbs.on_message) {
+        c->cbs.on_message(c, &topic, &msg, c->arg);
+    }
+}
+
+static void async_on_packet(struct mqtt_async *c, unsigned char *buf, int hlen, int len)
+{
+    struct mqtt_async_pkt *p;
+    const unsigned char *ptr;
+    mqtt_header header;
+    unsigned short id = 0;
+    unsigned char type, dup, reason = 0;
+    int rc;
+
+    header.byte = buf[0];
+    type = header.bits.type;
+    switch (type) {
+    case CONNACK:
+        async_on_connack(c, buf, hlen, len);
+        break;
+    case PUBLISH:
+        async_on_publish(c, buf, len);
+        break;
+    case PUBACK:
+    case PUBREC:
+    case PUBREL:
+    case PUBCOMP:
+    case UNSUBACK:
+        if (mqtt_deserialize_ack(&type, &dup, &id, buf, len) != 1) {
+            async_fail(c, EPROTO);
+            break;
+        }
+        /* MQTT 5 reason code, 0x80 and above is failure */
+        if (c->v5 && type != UNSUBACK && len > hlen + 2) {
+            reason = buf[hlen + 2];
+        }
+        rc = (reason >= 0x80) ? MQTT_FAILURE : 0;
+        if (type == PUBREL) {
+            c->qos2_rx[id >> 3] &= ~(1 << (id & 7));
+            async_send_ack(c, PUBCOMP, id);
+            break;
+        }
+        p = async_find(c, id, type);
+        if (type == PUBREC && rc == 0) {
+            /* PUBREL anyway, so that broker can release an id we forgot */
+            if (p) {
+                p->wait = PUBCOMP;
+            }
+            async_send_ack(c, PUBREL, id);
+        } else if (p) {
+            async_complete(c, p, rc);
+        }
+        break;
+    case SUBACK:
+        ptr = buf + hlen + 2;
+        if (len < hlen + 3 ||
+            (c->v5 && 0 != async_props(&ptr, buf + len, NULL, NULL)) ||
+            ptr >= buf + len) {
+            async_fail(c, EPROTO);
+            break;
+        }
+        id = buf[hlen] << 8 | buf[hlen + 1];
+        p = async_find(c, id, SUBACK);
+        if (p) {
+            async_complete(c, p, (*ptr >= 0x80) ? MQTT_SUBFAIL : *ptr);
+        }
+        break;
+    case PINGRESP:
+        c->ping_ms = 0;
+        break;
+    case DISCONNECT:
+        /* MQTT 5 broker closing with a reason */
+        async_fail(c, ECONNRESET);
+        break;
+    default:
+        async_fail(c, EPROTO);
+        break;
+    }
+}
+
+static void async_on_read(struct gevent_conn *conn, void *arg)
+{
+    struct mqtt_async *c = (struct mqtt_async *)arg;
+    unsigned char *buf;
+    size_t len, hlen, rem, mult;
+
+    c->in_cb++;
+    while (c->conn == conn && !c->err) {
+        buf = (unsigned char *)gevent_conn_peek(conn, &len);
+        if (!buf || len < 2) {
+            break;
+        }
+        /* fixed header, remaining length in 1 to 4 bytes */
+        rem = 0;
+        mult = 1;
+        hlen = 1;
+        do {
+            if (hlen > MAX_NO_OF_REMAINING_LENGTH_BYTES) {
+                async_fail(c, EPROTO);
+                goto out;
+            }
+            if (hlen >= len) {
+                goto out;
+            }
+            rem += (buf[hlen] & 127) * mult;
+            mult *= 128;
+        } while (buf[hlen++] & 128);
+        if (len < hlen + rem) {
+            break;
+        }
+        async_on_packet(c, buf, hlen, hlen + rem);
+        if (c->conn != conn) {
+            break;
+        }
+        gevent_conn_consume(conn, hlen + rem);
+    }
+    async_flush(c);
+out:
+    async_leave(c);
+}
+
+static void async_on_drain(struct gevent_conn *conn, void *arg)
+{
+    struct mqtt_async *c = (struct mqtt_async *)arg;
+
+    if (c->state == MQTT_ASYNC_DISCONNECTING) {
+        c->in_cb++;
+        async_close(c, 0);
+        async_leave(c);
+    }
+}
+
+static void async_on_close(struct gevent_conn *conn, int err, void *arg)
+{
+    struct mqtt_async *c = (struct mqtt_async *)arg;
+    socklen_t len = sizeof(int);
+    int so_err = 0;
+
+    /* epoll only tells hangup, socket knows why connect failed */
+    if (c->state == MQTT_ASYNC_CONNECTING &&
+        0 == getsockopt(gevent_conn_fd(conn), SOL_SOCKET, SO_ERROR, &so_err, &len) && so_err) {
+        err = so_err;
+    }
+    c->in_cb++;
+    async_close(c, c->err ? c->err : (err ? err : ECONNRESET));
+    async_leave(c);
+}
+
+static void async_on_timer(struct gevent_wtimer *t, void *arg)
+{
+    struct mqtt_async *c = (struct mqtt_async *)arg;
+    unsigned char buf[2];
+    uint64_t now = async_now_ms();
+    int len;
+
+    c->in_cb++;
+    if (c->state == MQTT_ASYNC_DISCONNECTING) {
+        async_close(c, 0);
+    } else if (c->err) {
+        async_close(c, c->err);
+    } else if (c->state == MQTT_ASYNC_CONNECTING) {
+        async_close(c, ETIMEDOUT);
+    } else if (c->state == MQTT_ASYNC_CONNECTED) {
+        if (c->ping_ms && now - c->ping_ms >= c->timeout_ms) {
+            async_close(c, ETIMEDOUT);
+        } else if (!c->ping_ms && now - c->last_tx_ms >= c->keepalive_ms / 2) {
+            len = mqtt_serialize_pingreq(buf, sizeof(buf));
+            if (len > 0 && 0 == async_write(c, buf, len)) {
+                c->ping_ms = now;
+            }
+        }
+    }
+    async_leave(c);
+}
+
+struct mqtt_async *mqtt_async_create(struct gevent_base *eb, const struct mqtt_async_config *conf)
+{
+    struct mqtt_async *c;
+    struct addrinfo hints, *res = NULL;
+    char port[16];
+
+    if (!eb || !conf || !conf->host) {
+        printf("%s invalid paraments!\n", __func__);
+        return NULL;
+    }
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    snprintf(port, sizeof(port), "%d", conf->port);
+    if (0 != getaddrinfo(conf->host, port, &hints, &res) || !res) {
+        printf("getaddrinfo %s failed!\n", conf->host);
+        return NULL;
+    }
+    c = calloc(1, sizeof(struct mqtt_async));
+    if (!c) {
+        printf("malloc mqtt_async failed!\n");
+        freeaddrinfo(res);
+        return NULL;
+    }
+    memcpy(&c->addr, res->ai_addr, res->ai_addrlen);
+    c->addrlen = res->ai_addrlen;
+    freeaddrinfo(res);
+    c->eb = eb;
+    c->cbs = conf->cbs;
+    c->arg = conf->arg;
+    c->max_inflight = conf->max_inflight > 0 ? conf->max_inflight : MQTT_ASYNC_INFLIGHT;
+    c->max_queued = conf->max_queued > 0 ? conf->max_queued : MQTT_ASYNC_QUEUED;
+    c->timeout_ms = conf->timeout_ms ? conf->timeout_ms : MQTT_ASYNC_TIMEOUT_MS;
+    c->max_aliases = conf->max_aliases > 0 ? MIN2(conf->max_aliases, 65535) : MQTT_ASYNC_ALIASES;
+    c->aliases = calloc(c->max_aliases, sizeof(struct mqtt_async_alias));
+    if (!c->aliases) {
+        free(c);
+        return NULL;
+    }
+    c->window = c->max_inflight;
+    c->cleansession = 1;
+    INIT_LIST_HEAD(&c->inflight);
+    INIT_LIST_HEAD(&c->queue);
+    mutex_lock_init(&c->lock);
+    gevent_wtimer_init(&c->timer, async_on_timer, c);
+    return c;
+}
+
+void mqtt_async_destroy(struct mqtt_async *c)
+{
+    int posted;
+
+    if (!c || c->dead) {
+        return;
+    }
+    gevent_wtimer_del(c->eb, &c->timer);
+    if (c->conn) {
+        gevent_conn_destroy(c->conn);
+        c->conn = NULL;
+    }
+    c->state = MQTT_ASYNC_IDLE;
+    mutex_lock(&c->lock);
+    c->dead = 1;
+    posted = c->posted;
+    mutex_unlock(&c->lock);
+    /* a pending post or the callback on stack frees it */
+    if (!posted && !c->in_cb) {
+        async_free(c);
+    }
+}
+
+int mqtt_async_connect(struct mqtt_async *c, mqtt_pkt_conn_data *options)
+{
+    mqtt_pkt_conn_data def = mqtt_pkt_conn_data_initializer;
+    struct gevent_conn_cbs cbs = {async_on_read, async_on_drain, async_on_close};
+    unsigned char *buf;
+    int fd, len, on = 1;
+
+    if (!c || c->dead || c->state != MQTT_ASYNC_IDLE) {
+        return MQTT_FAILURE;
+    }
+    if (!options) {
+        options = &def;
+    }
+    len = mqtt_pkt_len(mqtt_serialize_connectLength(options));
+    buf = malloc(len);
+    if (!buf) {
+        return MQTT_FAILURE;
+    }
+    if (mqtt_serialize_connect(buf, len, options) <= 0) {
+        free(buf);
+        return MQTT_FAILURE;
+    }
+    fd = socket(c->addr.ss_family, SOCK_STREAM, IPPROTO_TCP);
+    if (fd == -1) {
+        printf("socket failed: %s\n", strerror(errno));
+        free(buf);
+        return MQTT_FAILURE;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    if (0 != connect(fd, (struct sockaddr *)&c->addr, c->addrlen) &&
+        errno != EINPROGRESS) {
+        printf("connect failed: %s\n", strerror(errno));
+        close(fd);
+        free(buf);
+        return MQTT_FAILURE;
+    }
+    c->conn = gevent_conn_create(c->eb, fd, &cbs, c);
+    if (!c->conn) {
+        close(fd);
+        free(buf);
+        return MQTT_FAILURE;
+    }
+    c->err = 0;
+    c->connack_rc = 0;
+    c->ping_ms = 0;
+    c->keepalive_ms = options->keepAliveInterval * 1000;
+    c->cleansession = options->cleansession;
+    c->v5 = (options->mqtt_version == 5);
+    if (c->cleansession) {
+        memset(c->qos2_rx, 0, sizeof(c->qos2_rx));
+    }
+    c->state = MQTT_ASYNC_CONNECTING;
+    gevent_wtimer_add(c->eb, &c->timer, c->timeout_ms, TIMER_ONESHOT);
+    /* buffered until tcp connect completes, a refused one fails in on_connect */
+    async_write(c, buf, len);
+    free(buf);
+    return MQTT_SUCCESS;
+}
+
+int mqtt_async_disconnect(struct mqtt_async *c)
+{
+    unsigned char buf[2];
+    int len;
+
+    if (!c || !c->conn || c->state == MQTT_ASYNC_DISCONNECTING) {
+        return MQTT_FAILURE;
+    }
+    if (c->state != MQTT_ASYNC_CONNECTED) {
+        async_fail(c, ECANCELED);
+        return MQTT_SUCCESS;
+    }
+    c->state = MQTT_ASYNC_DISCONNECTING;
+    len = mqtt_serialize_disconnect(buf, sizeof(buf));
+    if (len <= 0 || 0 != gevent_conn_write(c->conn, buf, len) ||
+        gevent_conn_pending(c->conn) == 0) {
+        /* nothing left to flush, close in timer */
+        gevent_wtimer_add(c->eb, &c->timer, 1, TIMER_ONESHOT);
+    } else {
+        gevent_wtimer_add(c->eb, &c->timer, c->timeout_ms, TIMER_ONESHOT);
+    }
+    return MQTT_SUCCESS;
+}
+
+static struct mqtt_async_pkt *async_pkt_alloc(unsigned char type, const char *topic, size_t extra)
+{
+    struct mqtt_async_pkt *p;
+    size_t topic_len = strlen(topic);
+
+    if (topic_len > 65535) {
+        return NULL;
+    }
+    p = calloc(1, sizeof(struct mqtt_async_pkt) + ASYNC_HDR_MAX(topic_len) + topic_len + 1 + extra);
+    if (!p) {
+        return NULL;
+    }
+    p->type = type;
+    p->topic_len = topic_len;
+    p->topic = (char *)p->data + ASYNC_HDR_MAX(topic_len);
+    memcpy(p->topic, topic, topic_len);
+    return p;
+}
+
+static int async_publish(struct mqtt_async *c, const char *topic, const mqtt_msg *msg,
+                int copy, void (*release)(void *payload, void *arg), void *arg)
+{
+    struct mqtt_async_pkt *p;
+
+    /* remaining length is at most 268435455 */
+    if (!c || !topic || !msg || msg->qos > MQTT_QOS2 ||
+        (msg->payloadlen && !msg->payload) || msg->payloadlen > 0xfff0000) {
+        return MQTT_FAILURE;
+    }
+    p = async_pkt_alloc(PUBLISH, topic, copy ? msg->payloadlen : 0);
+    if (!p) {
+        return MQTT_FAILURE;
+    }
+    p->qos = msg->qos;
+    p->retained = msg->retained;
+    p->payload_len = msg->payloadlen;
+    if (copy) {
+        p->payload = p->topic + p->topic_len + 1;
+        if (msg->payloadlen) {
+            memcpy((void *)p->payload, msg->payload, msg->payloadlen);
+        }
+    } else {
+        p->payload = msg->payload;
+        p->release = release;
+        p->release_arg = arg;
+    }
+    if (p->qos) {
+        p->wait = (p->qos == MQTT_QOS1) ? PUBACK : PUBREC;
+    }
+    return async_submit(c, p, p->qos > 0);
+}
+
+int mqtt_async_publish(struct mqtt_async *c, const char *topic, const mqtt_msg *msg)
+{
+    return async_publish(c, topic, msg, 1, NULL, NULL);
+}
+
+int mqtt_async_publish_ref(struct mqtt_async *c, const char *topic, const mqtt_msg *msg,
+                void (*release)(void *payload, void *arg), void *arg)
+{
+    return async_publish(c, topic, msg, 0, release, arg);
+}
+
+int mqtt_async_subscribe(struct mqtt_async *c, const char *topic_filter, enum mqtt_qos qos)
+{
+    struct mqtt_async_pkt *p;
+
+    if (!c || !topic_filter || qos > MQTT_QOS2) {
+        return MQTT_FAILURE;
+    }
+    p = async_pkt_alloc(SUBSCRIBE, topic_filter, 0);
+    if (!p) {
+        return MQTT_FAILURE;
+    }
+    p->qos = qos;
+    p->wait = SUBACK;
+    return async_submit(c, p, 1);
+}
+
+int mqtt_async_unsubscribe(struct mqtt_async *c, const char *topic_filter)
+{
+    struct mqtt_async_pkt *p;
+
+    if (!c || !topic_filter) {
+        return MQTT_FAILURE;
+    }
+    p = async_pkt_alloc(UNSUBSCRIBE, topic_filter, 0);
+    if (!p) {
+        return MQTT_FAILURE;
+    }
+    p->wait = UNSUBACK;
+    return async_submit(c, p, 1);
+}
+
+int mqtt_async_inflight(struct mqtt_async *c)
+{
+    int n;
+
+    if (!c) {
+        return MQTT_FAILURE;
+    }
+    mutex_lock(&c->lock);
+    n = c->ninflight;
+    mutex_unlock(&c->lock);
+    return n;
+}
+#endif
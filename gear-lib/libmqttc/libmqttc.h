@@ -163,7 +163,7 @@ typedef struct
     char struct_id[4];
     /** The version number of this structure.  Must be 0 */
     int struct_version;
-    /** Version of MQTT to be used.  3 = 3.1 4 = 3.1.1
+    /** Version of MQTT to be used.  3 = 3.1 4 = 3.1.1 5 = 5.0 (async client only)
      */
     unsigned char mqtt_version;
     mqtt_string clientID;
@@ -204,10 +204,6 @@ typedef struct {
     char state;
 } mqtt_transport;
 
-#if !defined(MAX_MESSAGE_HANDLERS)
-#define MAX_MESSAGE_HANDLERS 5 /* redefinable - how many subscriptions do you want? */
-#endif
-
 enum mqtt_qos { MQTT_QOS0, MQTT_QOS1, MQTT_QOS2, MQTT_SUBFAIL=0x80 };
 
 /* all failure return codes must be negative */
@@ -242,6 +238,8 @@ typedef struct mqtt_suback_data
 
 typedef void (*messageHandler)(MessageData*);
 
+struct mqtt_topic_node;
+
 typedef struct mqtt_client
 {
     const struct mqttc_ops *ops;
@@ -259,10 +257,7 @@ typedef struct mqtt_client
     int isconnected;
     int cleansession;
 
-    struct MessageHandlers {
-        const char* topicFilter;
-        void (*fp) (MessageData*);
-    } messageHandlers[MAX_MESSAGE_HANDLERS];      /* Message handlers are indexed by subscription topic */
+    struct mqtt_topic_node *subs;   /* message handlers, trie of subscription topic levels */
 
     void (*defaultMessageHandler) (MessageData*);
 
@@ -341,6 +336,71 @@ int mqtt_is_connected(mqtt_client* client);
 int mqtt_start_task(mqtt_client* client);
 #endif
 
+#if defined(MQTT_ASYNC)
+/*
+ * event-driven client on a shared gevent_base, nothing blocks:
+ * connect, publish, subscribe queue packets and return, completions come
+ * back in callbacks in the loop thread. QoS1/2 publishes take a packet id
+ * and stay in an in-flight window of max_inflight until PUBACK or PUBCOMP,
+ * later ones wait in order in the queue, up to max_queued.
+ * publish/subscribe/unsubscribe are safe to call from any thread, others
+ * must be called in loop thread or before loop start.
+ * with cleansession = 0, in-flight packets survive a close and are resent
+ * with DUP on next connect, otherwise they fail with MQTT_FAILURE.
+ * queued packets are kept until next connect in both cases.
+ * with mqtt_version 5, a topic gets an alias the first time it's sent on
+ * a connection, later publishes carry the 2 byte alias instead of topic.
+ */
+struct gevent_base;
+struct mqtt_async;
+
+struct mqtt_async_cbs {
+    /* rc is CONNACK return code, or -errno if tcp connect failed */
+    void (*on_connect)(struct mqtt_async *c, int rc, int session_present, void *arg);
+    /* QoS1/2 publish done, rc 0 if acked, MQTT_FAILURE if dropped */
+    void (*on_publish)(struct mqtt_async *c, unsigned short id, int rc, void *arg);
+    /* SUBACK granted qos or MQTT_SUBFAIL, 0 for UNSUBACK */
+    void (*on_suback)(struct mqtt_async *c, unsigned short id, int rc, void *arg);
+    void (*on_message)(struct mqtt_async *c, mqtt_string *topic, mqtt_msg *msg, void *arg);
+    /* err is 0 after mqtt_async_disconnect */
+    void (*on_close)(struct mqtt_async *c, int err, void *arg);
+};
+
+struct mqtt_async_config {
+    const char *host;
+    int port;
+    int max_inflight;               /* 0: 16 */
+    int max_queued;                 /* 0: 1024 */
+    unsigned int timeout_ms;        /* connect and PINGRESP, 0: 10000 */
+    int max_aliases;                /* MQTT 5 topic aliases, 0: 16 */
+    struct mqtt_async_cbs cbs;
+    void *arg;
+};
+
+struct mqtt_async *mqtt_async_create(struct gevent_base *eb, const struct mqtt_async_config *conf);
+/* mqtt_async_destroy is safe to be called in its own callbacks */
+void mqtt_async_destroy(struct mqtt_async *c);
+int mqtt_async_connect(struct mqtt_async *c, mqtt_pkt_conn_data *options);
+/* send DISCONNECT and close when flushed, on_close is called with 0 */
+int mqtt_async_disconnect(struct mqtt_async *c);
+/*
+ * return packet id for QoS1/2, 0 for QoS0, MQTT_BUFFER_OVERFLOW if queue
+ * is full. payload is copied
+ */
+int mqtt_async_publish(struct mqtt_async *c, const char *topic, const mqtt_msg *msg);
+/*
+ * payload is not copied, it's written in place and release is called in
+ * loop thread once it's no longer needed: after written for QoS0, after
+ * completed or dropped for QoS1/2. not called if it returns error
+ */
+int mqtt_async_publish_ref(struct mqtt_async *c, const char *topic, const mqtt_msg *msg,
+                void (*release)(void *payload, void *arg), void *arg);
+int mqtt_async_subscribe(struct mqtt_async *c, const char *topic_filter, enum mqtt_qos qos);
+int mqtt_async_unsubscribe(struct mqtt_async *c, const char *topic_filter);
+/* QoS1/2 publishes sent and not completed */
+int mqtt_async_inflight(struct mqtt_async *c);
+#endif
+
 #ifdef __cplusplus
 }
 #endif
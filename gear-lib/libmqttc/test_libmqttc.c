@@ -333,6 +333,123 @@ exit:
 }
 
 
+#if defined(MQTT_ASYNC)
+#include <libgevent.h>
+#include <unistd.h>
+
+/*********************************************************************
+
+Test async: event-driven client, publishes pipelined in in-flight window
+
+*********************************************************************/
+#define ASYNC_MSGS 100
+
+static volatile int async_connected;
+static volatile int async_done;
+static volatile int async_closed;
+static volatile int async_arrived;
+static volatile int async_released;
+
+static void async_release(void *payload, void *arg)
+{
+    async_released++;
+}
+
+static void async_on_connect(struct mqtt_async *c, int rc, int session_present, void *arg)
+{
+    async_connected = (rc == 0) ? 1 : -1;
+}
+
+static void async_on_publish(struct mqtt_async *c, unsigned short id, int rc, void *arg)
+{
+    assert("Good rc from async publish", rc == MQTT_SUCCESS, "rc was %d", rc);
+    if (++async_done == 2 * ASYNC_MSGS) {
+        mqtt_async_disconnect(c);
+    }
+}
+
+static void async_on_message(struct mqtt_async *c, mqtt_string *topic, mqtt_msg *m, void *arg)
+{
+    async_arrived++;
+}
+
+static void async_on_close(struct mqtt_async *c, int err, void *arg)
+{
+    async_closed = 1;
+}
+
+int testasync(struct Options options)
+{
+    struct gevent_base *eb;
+    struct mqtt_async *c;
+    struct mqtt_async_config conf;
+    mqtt_pkt_conn_data data = mqtt_pkt_conn_data_initializer;
+    char* test_topic = "C client test async";
+    int i, rc, wait_ms = 10000;
+
+    fprintf(xml, "<testcase classname=\"testasync\" name=\"event-driven client\"");
+    gettimeofday(&g_start_time, NULL);
+    failures = 0;
+    MyLog(LOGA_INFO, "Starting test async - event-driven client");
+
+    memset(&conf, 0, sizeof(conf));
+    conf.host = options.host;
+    conf.port = options.port;
+    conf.max_inflight = 32;
+    conf.cbs.on_connect = async_on_connect;
+    conf.cbs.on_publish = async_on_publish;
+    conf.cbs.on_message = async_on_message;
+    conf.cbs.on_close = async_on_close;
+
+    eb = gevent_base_create();
+    c = mqtt_async_create(eb, &conf);
+    assert("Good async client", c != NULL, "c was %p", c);
+    if (!c)
+        goto exit;
+
+    data.mqtt_version = options.mqtt_version;
+    data.clientID.cstring = "async-test";
+    data.username.cstring = "testuser";
+    data.password.cstring = "testpassword";
+    rc = mqtt_async_connect(c, &data);
+    assert("Good rc from async connect", rc == MQTT_SUCCESS, "rc was %d", rc);
+    rc = mqtt_async_subscribe(c, test_topic, MQTT_QOS2);
+    assert("Good id from async subscribe", rc > 0, "rc was %d", rc);
+    gevent_base_loop_start(eb);
+
+    /* publish from this thread, none of them waits for an ack */
+    memset(&pubmsg, '\0', sizeof(pubmsg));
+    pubmsg.payload = "async payload";
+    pubmsg.payloadlen = 13;
+    for (i = 0; i < 2 * ASYNC_MSGS; ++i) {
+        pubmsg.qos = (i < ASYNC_MSGS) ? MQTT_QOS1 : MQTT_QOS2;
+        if (i % 2)
+            rc = mqtt_async_publish_ref(c, test_topic, &pubmsg, async_release, NULL);
+        else
+            rc = mqtt_async_publish(c, test_topic, &pubmsg);
+        assert("Good id from async publish", rc > 0, "rc was %d", rc);
+    }
+    while (!async_closed && wait_ms > 0) {
+        usleep(10000);
+        wait_ms -= 10;
+    }
+    assert("Async connected", async_connected == 1, "connected was %d", async_connected);
+    assert("All publishes completed", async_done == 2 * ASYNC_MSGS, "done was %d", async_done);
+    assert("Disconnected", async_closed == 1, "closed was %d", async_closed);
+    assert("All payloads released", async_released == ASYNC_MSGS, "released was %d", async_released);
+    MyLog(LOGA_INFO, "%d messages arrived", async_arrived);
+
+    gevent_base_loop_stop(eb);
+    mqtt_async_destroy(c);
+exit:
+    gevent_base_destroy(eb);
+    MyLog(LOGA_INFO, "TESTASYNC: test %s. %d tests run, %d failures.",
+                    (failures == 0) ? "passed" : "failed", tests, failures);
+    write_test_result();
+    return failures;
+}
+#endif
+
 /*********************************************************************
 
 Test 2: connack return data
@@ -909,7 +1026,11 @@ exit:
 int main(int argc, char** argv)
 {
     int rc = 0;
-    int (*tests[])() = {NULL, test1/*, test2, test3*/};
+    int (*tests[])() = {NULL, test1/*, test2, test3*/
+#if defined(MQTT_ASYNC)
+        , testasync
+#endif
+    };
     int i;
 
     xml = fopen("TEST-test1.xml", "w");
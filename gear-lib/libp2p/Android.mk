@@ -20,7 +20,7 @@ LOCAL_C_INCLUDES := $(LOCAL_PATH) \
 		    $(LIBGEVENT_INC)
 
 # Add your application source files here...
-LOCAL_SRC_FILES := libp2p.c
+LOCAL_SRC_FILES := libp2p.c p2p_xfer.c
 
 LOCAL_SHARED_LIBRARIES :=  \
 			   libsock \
@@ -48,6 +48,7 @@ int _p2p_connect(struct p2p *p2p, char *ip, uint16_t port);
 void *tmp_thread(void *arg);
 
 #define MAX_UUID_LEN                (21)
+#define P2P_STUN_CACHE              "/tmp/libp2p_stun.cache"
 
 static int on_get_connect_list_resp(struct rpc_session *r, void *arg, size_t len, void **obuf, size_t *olen)
 {
@@ -153,6 +154,16 @@ int p2p_recv(struct p2p *p2p, void *buf, int len)
     return ptcp_recv(p2p->ptcp, buf, len, 0);
 }
 
+int p2p_send_file(struct p2p *p2p, const char *path)
+{
+    return p2p_xfer_send(&p2p->ptcp, 1, path, NULL);
+}
+
+int p2p_recv_file(struct p2p *p2p, const char *path)
+{
+    return p2p_xfer_recv(&p2p->ptcp, 1, path, NULL);
+}
+
 int _p2p_connect(struct p2p *p2p, char *ip, uint16_t port)
 {
     struct sockaddr_in si;
@@ -313,6 +324,7 @@ struct p2p *p2p_init(const char *rpc_srv, const char *stun_srv)
     //printf("_local_port = %d\n", _local_port);
 
     stun_init(&p2p->stun, stun_srv);
+    stun_set_cache(&p2p->stun, P2P_STUN_CACHE, STUN_CACHE_TTL);
     p2p->nat.type = stun_nat_type(&p2p->stun);
     printf("%s:%d xxxx\n", __func__, __LINE__);
     p2p->nat.uuid = p2p->rpc->uuid;
@@ -63,6 +63,32 @@ int p2p_send(struct p2p *p2p, void *buf, int len);
 int p2p_recv(struct p2p *p2p, void *buf, int len);
 void p2p_deinit(struct p2p *p);
 
+/*
+ * file transfer over one or more connected ptcp streams, e.g. one per
+ * candidate path. the file is cut in chunks with a crc each, chunks are
+ * spread over all streams and pipelined without waiting for acks.
+ * the receiver keeps "<path>.xfer" with the bitmap of chunks on disk,
+ * calling p2p_xfer_recv again after a failure only fetches the rest.
+ * both sides must pass the same number of streams in the same order.
+ * return 0 once the receiver has every chunk, -1 on error
+ */
+#define P2P_XFER_CHUNK_SIZE (256 * 1024)
+
+struct p2p_xfer_stat {
+    uint64_t size;
+    uint64_t bytes;         /* payload moved by this call */
+    uint32_t chunks;
+    uint32_t resumed;       /* chunks the receiver already had */
+    uint32_t retransmits;   /* chunks sent again after crc mismatch */
+};
+
+int p2p_xfer_send(ptcp_socket_t *streams, int nstreams, const char *path,
+                struct p2p_xfer_stat *stat);
+int p2p_xfer_recv(ptcp_socket_t *streams, int nstreams, const char *path,
+                struct p2p_xfer_stat *stat);
+int p2p_send_file(struct p2p *p2p, const char *path);
+int p2p_recv_file(struct p2p *p2p, const char *path);
+
 
 #ifdef __cplusplus
 }
@@ -39,6 +39,7 @@
 #include <arpa/nameser.h>
 #include <netinet/in.h>
 #include <net/if.h>
+#include <libgevent.h>
 #include "libstun.h"
 
 
@@ -46,6 +47,11 @@
 #define STUN_MAX_STRING             (256)
 #define STUN_MAX_UNKNOWN_ATTRIBUTES (8)
 #define STUN_MAX_MESSAGE_SIZE       (2048)
+#define STUN_MAGIC_COOKIE           (0x2112A442)    /* rfc 5389 */
+#define STUN_RTO_MS                 (100)   /* first retransmit, then doubled */
+#define STUN_RC                     (3)     /* transmissions at 0,100,300ms */
+#define STUN_TIMEOUT_MS             (800)   /* give up, from first transmission */
+#define STUN_TICK_MS                (20)
 
 static const int INVALID_SOCKET = -1;
 static const int SOCKET_ERROR = -1;
@@ -72,6 +78,8 @@ static const uint32_t ChangePortFlag = 0x02;
 #define UnknownAttribute    0x000A
 #define ReflectedFrom       0x000B
 #define XorMappedAddress    0x8020
+#define XorMappedAddress5389 0x0020
+#define OtherAddress        0x802C // rfc 5780 ChangedAddress
 #define XorOnly             0x0021
 #define ServerName          0x8022
 #define SecondaryAddress    0x8050 // Non standard extention
@@ -233,53 +241,6 @@ static int openPort(unsigned short port, unsigned int interfaceIp)
     return fd;
 }
 
-static int getMessage(int fd, char *buf, int *len, unsigned int *srcIp,
-                unsigned short *srcPort)
-{
-    int originalSize = *len;
-    struct sockaddr_in from;
-    int fromLen = sizeof(from);
-//    int flag = MSG_DONTWAIT;
-    int flag = 0;
-
-    *len = recvfrom(fd, buf, originalSize, flag,
-                    (struct sockaddr *)&from, (socklen_t *)&fromLen);
-    if (*len == SOCKET_ERROR) {
-        int err = errno;
-        switch (err) {
-        case ENOTSOCK:
-            fprintf(stderr, "Error fd not a socket\n");
-            break;
-        case ECONNRESET:
-            fprintf(stderr, "Error connection reset - host not reachable\n");
-            break;
-        default:
-            fprintf(stderr, "socket Error=%d\n", err);
-        }
-        return 0;
-    }
-
-    if (*len < 0) {
-        fprintf(stderr, "socket closed? negative len\n");
-        return 0;
-    }
-
-    if (*len == 0) {
-        fprintf(stderr, "socket closed? zero len\n");
-        return 0;
-    }
-
-    *srcPort = ntohs(from.sin_port);
-    *srcIp = ntohl(from.sin_addr.s_addr);
-
-    if ((*len) + 1 >= originalSize) {
-        return 0;
-    }
-    buf[*len] = 0;
-
-    return 1;
-}
-
 static int sendMessage(int fd, char *buf, int l, unsigned int dstIp,
                 unsigned short dstPort)
 {
@@ -421,10 +382,6 @@ static int stunParseAtrString(char *body, unsigned int hdrLen,
         fprintf(stderr, "String is too large\n");
         return 0;
     } else {
-        if (hdrLen % 4 != 0) {
-            fprintf(stderr, "Bad length string %d\n", hdrLen);
-            return 0;
-        }
         result->sizeValue = hdrLen;
         memcpy(&result->value, body, hdrLen);
         result->value[hdrLen] = 0;
@@ -472,9 +429,10 @@ static int stunParseMessage(char *buf, unsigned int bufLen, StunMessage *msg)
         StunAtrHdr *attr = (StunAtrHdr *)body;
 
         unsigned int attrLen = ntohs(attr->length);
+        unsigned int padLen = (attrLen + 3) & ~3;   // rfc 5389 pads to 4
         int atrType = ntohs(attr->type);
 
-        if (attrLen + 4 > size) {
+        if (padLen + 4 > size) {
             printf("claims attribute is larger than size of"
                             " message \"(attribute type= %d \")\n", atrType);
             return 0;
@@ -579,6 +537,22 @@ static int stunParseMessage(char *buf, unsigned int bufLen, StunMessage *msg)
                 return 0;
             }
             break;
+        case XorMappedAddress5389:
+            msg->hasXorMappedAddress = 1;
+            if (stunParseAtrAddr(body, attrLen, &msg->xorMappedAddress) == 0) {
+                fprintf(stderr, "problem parsing XorMappedAddress\n");
+                return 0;
+            }
+            msg->xorMappedAddress.ipv4.port ^= STUN_MAGIC_COOKIE >> 16;
+            msg->xorMappedAddress.ipv4.addr ^= STUN_MAGIC_COOKIE;
+            break;
+        case OtherAddress:
+            msg->hasChangedAddress = 1;
+            if (stunParseAtrAddr(body, attrLen, &msg->changedAddress) == 0) {
+                fprintf(stderr, "problem parsing OtherAddress\n");
+                return 0;
+            }
+            break;
         case XorOnly:
             msg->xorOnly = 1;
             break;
@@ -604,8 +578,8 @@ static int stunParseMessage(char *buf, unsigned int bufLen, StunMessage *msg)
             break;
         }
 
-        body += attrLen;
-        size -= attrLen;
+        body += padLen;
+        size -= padLen;
     }
 
     return 1;
@@ -863,16 +837,18 @@ static int stunParseHostName(char *peerName, uint32_t *ip, uint16_t *portVal)
     return 0;
 }
 
-static void stunBuildReqSimple(StunMessage * msg,
-                   const StunAtrString *username,
-                   int changePort, int changeIp, unsigned int id)
+/*
+ * rfc 5389 transaction id: magic cookie then 96 random bits. responses are
+ * matched on the whole id, a late answer to an older request is dropped
+ */
+static void stunBuildReqSimple(StunMessage * msg, int changePort, int changeIp)
 {
     int i;
     memset(msg, 0, sizeof(*msg));
 
     msg->msgHdr.msgType = BindRequestMsg;
-
-    for (i = 0; i < 16; i += 4) {
+    encode32((char *)msg->msgHdr.id.octet, STUN_MAGIC_COOKIE);
+    for (i = 4; i < 16; i += 4) {
         int r = stunRand();
         msg->msgHdr.id.octet[i + 0] = r >> 0;
         msg->msgHdr.id.octet[i + 1] = r >> 8;
@@ -880,312 +856,371 @@ static void stunBuildReqSimple(StunMessage * msg,
         msg->msgHdr.id.octet[i + 3] = r >> 24;
     }
 
-    if (id != 0) {
-        msg->msgHdr.id.octet[0] = id;
-    }
-
     msg->hasChangeRequest = 1;
     msg->changeRequest.value = (changeIp ? ChangeIpFlag : 0) |
         (changePort ? ChangePortFlag : 0);
-
-    if (username->sizeValue > 0) {
-        msg->hasUsername = 1;
-        msg->username = *username;
-    }
 }
 
-static void stunSendTest(int myFd, stun_addr *dest,
-             const StunAtrString *username, const StunAtrString *password,
-             int testNum)
+static uint64_t stun_now_ms(void)
 {
-    int changePort = 0;
-    int changeIP = 0;
-    //int discard = 0;
-
-    switch (testNum) {
-    case 1:
-    case 10:
-    case 11:
-        break;
-    case 2:
-        //changePort=1;
-        changeIP = 1;
-        break;
-    case 3:
-        changePort = 1;
-        break;
-    case 4:
-        changeIP = 1;
-        break;
-    case 5:
-        //discard = 1;
-        break;
-    default:
-        fprintf(stderr, "Test %d is unkown\n", testNum);
-        assert(0);
-        break;
-    }
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
 
+/*
+ * every binding request of a probe is in flight at once on one gevent
+ * loop, retransmitted from a tick timer, and the loop breaks as soon as
+ * the answers decide the result instead of after a fixed wait.
+ */
+enum stun_test {
+    STUN_TEST_I,        /* fd1 to each server, mapped address */
+    STUN_TEST_II,       /* fd2, change ip and port */
+    STUN_TEST_III,      /* fd2, change port */
+    STUN_TEST_I2,       /* fd1 to the changed address, mapping behaviour */
+};
+
+enum stun_trans_state {
+    STUN_TRANS_IDLE,
+    STUN_TRANS_PENDING,
+    STUN_TRANS_ANSWERED,
+    STUN_TRANS_TIMEOUT,
+};
+
+struct stun_trans {
+    enum stun_test test;
+    enum stun_trans_state state;
+    int fd;
+    stun_addr dest;
+    uint128_t id;
+    char buf[STUN_MAX_MESSAGE_SIZE];
+    int len;
+    int sent;
+    uint64_t start;
+    uint64_t next;
+    stun_addr mapped;
+    stun_addr changed;
+};
+
+#define STUN_MAX_TRANS  (STUN_MAX_SERVERS + 3)
+
+struct stun_probe {
+    struct gevent_base *evbase;
+    struct gevent_wtimer tick;
+    struct stun_trans trans[STUN_MAX_TRANS];
+    int ntrans;
+    int fd1;
+    int fd2;
+    int nat;            /* -1 not known yet */
+    stun_nat_type_t type;
+    int (*decide)(struct stun_probe *p);
+};
+
+static struct stun_trans *stun_trans_add(struct stun_probe *p, enum stun_test test,
+                int fd, stun_addr *dest, int changePort, int changeIp)
+{
+    struct stun_trans *t = &p->trans[p->ntrans++];
     StunMessage req;
-    memset(&req, 0, sizeof(StunMessage));
+    StunAtrString password;
 
-    stunBuildReqSimple(&req, username, changePort, changeIP, testNum);
-    char buf[STUN_MAX_MESSAGE_SIZE];
-    int len = STUN_MAX_MESSAGE_SIZE;
-    len = stunEncodeMessage(&req, buf, len, password);
-    sendMessage(myFd, buf, len, dest->addr, dest->port);
+    memset(t, 0, sizeof(*t));
+    password.sizeValue = 0;
+    stunBuildReqSimple(&req, changePort, changeIp);
+    t->test = test;
+    t->fd = fd;
+    t->dest = *dest;
+    t->id = req.msgHdr.id;
+    t->len = stunEncodeMessage(&req, t->buf, sizeof(t->buf), &password);
+    t->state = STUN_TRANS_PENDING;
+    t->start = t->next = stun_now_ms();
+    return t;
+}
 
-    // add some delay so the packets don't get sent too quickly
-    //usleep(10 * 1000);
+/* transmissions at 0, 1, 3, 7... RTO from start */
+static void stun_trans_send(struct stun_trans *t)
+{
+    sendMessage(t->fd, t->buf, t->len, t->dest.addr, t->dest.port);
+    t->next = t->start + (STUN_RTO_MS << t->sent) * 2 - STUN_RTO_MS;
+    t->sent++;
 }
 
-static stun_nat_type_t stun_get_nat_type(stun_addr *dest,
-    int * preservePort, // if set, is return for if NAT preservers ports or not
-    int * hairpin, // if set, is the return for if NAT will hairpin packets
-    int port,   // port to use for the test, 0 to choose random port
-    stun_addr * sAddr    // NIC to use
-    )
+static struct stun_trans *stun_trans_find(struct stun_probe *p, enum stun_test test, int answered)
 {
     int i;
-    if (hairpin) {
-        *hairpin = 0;
+    for (i = 0; i < p->ntrans; i++) {
+        if (p->trans[i].test == test &&
+            (!answered || p->trans[i].state == STUN_TRANS_ANSWERED)) {
+            return &p->trans[i];
+        }
     }
+    return NULL;
+}
 
-    if (port == 0) {
-        port = stunRandomPort();
-    }
-    uint32_t interfaceIp = 0;
-    if (sAddr) {
-        interfaceIp = sAddr->addr;
+/* all requests of a test have timed out, or it never started */
+static int stun_test_failed(struct stun_probe *p, enum stun_test test)
+{
+    int i;
+    for (i = 0; i < p->ntrans; i++) {
+        if (p->trans[i].test == test && p->trans[i].state != STUN_TRANS_TIMEOUT) {
+            return 0;
+        }
     }
-    int myFd1 = openPort(port, interfaceIp);
-    int myFd2 = openPort(port + 1, interfaceIp);
+    return 1;
+}
 
-    if ((myFd1 == INVALID_SOCKET) || (myFd2 == INVALID_SOCKET)) {
-        fprintf(stderr, "Some problem opening port/interface to send on\n");
-        return STUN_NAT_TYPE_Failure;
-    }
+static int stun_same_addr(stun_addr *a, stun_addr *b)
+{
+    return a->addr == b->addr && a->port == b->port;
+}
 
-    assert(myFd1 != INVALID_SOCKET);
-    assert(myFd2 != INVALID_SOCKET);
+/* answers to test I from different servers, -1 if less than two */
+static int stun_mapping_same(struct stun_probe *p, struct stun_trans *t1)
+{
+    int i, ret = -1;
+    for (i = 0; i < p->ntrans; i++) {
+        struct stun_trans *t = &p->trans[i];
+        if (t != t1 && t->test == STUN_TEST_I && t->state == STUN_TRANS_ANSWERED) {
+            if (!stun_same_addr(&t->mapped, &t1->mapped)) {
+                return 0;
+            }
+            ret = 1;
+        }
+    }
+    return ret;
+}
 
-    int respTestI = 0;
-    int isNat = 1;
-    //stun_addr testIchangedAddr;
-    stun_addr testImappedAddr;
-    int respTestI2 = 0;
-    int mappedIpSame = 1;
-    stun_addr testI2mappedAddr;
-    stun_addr testI2dest = *dest;
-    int respTestII = 0;
-    int respTestIII = 0;
+/* logic flow chart of rfc 3489, return 1 once the type is known */
+static int stun_nat_decide(struct stun_probe *p)
+{
+    struct stun_trans *t1 = stun_trans_find(p, STUN_TEST_I, 1);
+    struct stun_trans *t2 = stun_trans_find(p, STUN_TEST_II, 0);
+    struct stun_trans *t3 = stun_trans_find(p, STUN_TEST_III, 0);
+    struct stun_trans *ti2 = stun_trans_find(p, STUN_TEST_I2, 0);
+    int same;
+
+    if (!t1) {
+        if (stun_test_failed(p, STUN_TEST_I)) {
+            p->type = STUN_NAT_TYPE_Blocked;
+            return 1;
+        }
+        return 0;
+    }
+    if (p->nat < 0) {
+        /* see if we can bind to this address */
+        int s = openPort(0 /*use ephemeral */ , t1->mapped.addr);
+        if (s != INVALID_SOCKET) {
+            close(s);
+            p->nat = 0;
+        } else {
+            p->nat = 1;
+        }
+    }
+    if (!p->nat) {
+        if (t2->state == STUN_TRANS_ANSWERED) {
+            p->type = STUN_NAT_TYPE_Open;
+        } else if (t2->state == STUN_TRANS_TIMEOUT) {
+            p->type = STUN_NAT_TYPE_SymFirewall;
+        } else {
+            return 0;
+        }
+        return 1;
+    }
+    if (t2->state == STUN_TRANS_ANSWERED) {
+        p->type = STUN_NAT_TYPE_ConeNat;
+        return 1;
+    }
+    if (t2->state != STUN_TRANS_TIMEOUT) {
+        return 0;
+    }
+    same = stun_mapping_same(p, t1);
+    if (ti2 && ti2->state == STUN_TRANS_ANSWERED) {
+        same = (same != 0) && stun_same_addr(&ti2->mapped, &t1->mapped);
+    } else if (ti2 && ti2->state == STUN_TRANS_PENDING && same != 0) {
+        return 0;
+    }
+    if (same == 0) {
+        p->type = STUN_NAT_TYPE_SymNat;
+        return 1;
+    }
+    if (t3->state == STUN_TRANS_ANSWERED) {
+        p->type = STUN_NAT_TYPE_RestrictedNat;
+    } else if (t3->state == STUN_TRANS_TIMEOUT) {
+        p->type = STUN_NAT_TYPE_PortRestrictedNat;
+    } else {
+        return 0;
+    }
+    return 1;
+}
 
-    int respTestHairpin = 0;
-    int respTestPreservePort = 0;
+/* only the mapped address is wanted, first answer wins */
+static int stun_map_decide(struct stun_probe *p)
+{
+    return stun_trans_find(p, STUN_TEST_I, 1) || stun_test_failed(p, STUN_TEST_I);
+}
 
-    memset(&testImappedAddr, 0, sizeof(testImappedAddr));
+static void stun_probe_check(struct stun_probe *p)
+{
+    if (p->decide(p)) {
+        gevent_base_loop_break(p->evbase);
+    }
+}
 
-    StunAtrString username;
-    StunAtrString password;
+static void stun_probe_answer(struct stun_probe *p, struct stun_trans *t, StunMessage *resp)
+{
+    stun_addr dest;
+
+    t->state = STUN_TRANS_ANSWERED;
+    t->mapped = resp->hasXorMappedAddress ? resp->xorMappedAddress.ipv4 :
+                resp->mappedAddress.ipv4;
+    t->changed = resp->changedAddress.ipv4;
+    if (t->test != STUN_TEST_I || p->fd2 == INVALID_SOCKET ||
+        stun_trans_find(p, STUN_TEST_I2, 0)) {
+        return;
+    }
+    /* test I2 goes to the other ip of the server that answered first */
+    if (resp->hasChangedAddress && t->changed.addr != 0) {
+        dest.addr = t->changed.addr;
+        dest.port = t->dest.port;
+        stun_trans_send(stun_trans_add(p, STUN_TEST_I2, p->fd1, &dest, 0, 0));
+    }
+}
 
-    username.sizeValue = 0;
-    password.sizeValue = 0;
+static void stun_probe_on_recv(int fd, void *arg)
+{
+    struct stun_probe *p = (struct stun_probe *)arg;
+    struct sockaddr_in from;
+    socklen_t fromLen;
+    char msg[STUN_MAX_MESSAGE_SIZE];
+    StunMessage resp;
+    int i, len;
 
-    int count = 0;
-    while (count < 7) {
-        struct timeval tv;
-        fd_set fdSet;
-
-        int fdSetSize;
-        FD_ZERO(&fdSet);
-        fdSetSize = 0;
-        FD_SET(myFd1, &fdSet);
-        fdSetSize = (myFd1 + 1 > fdSetSize) ? myFd1 + 1 : fdSetSize;
-        FD_SET(myFd2, &fdSet);
-        fdSetSize = (myFd2 + 1 > fdSetSize) ? myFd2 + 1 : fdSetSize;
-        tv.tv_sec = 0;
-        tv.tv_usec = 150 * 1000;    // 150 ms
-        if (count == 0)
-            tv.tv_usec = 0;
-
-        int err = select(fdSetSize, &fdSet, NULL, NULL, &tv);
-        int e = errno;
-        if (err == SOCKET_ERROR) {
-            // error occured
-            fprintf(stderr, "Error %d %s in select\n", e, strerror(e));
-            return STUN_NAT_TYPE_Failure;
-        } else if (err == 0) {
-            // timeout occured
-            count++;
-
-            if (!respTestI) {
-                stunSendTest(myFd1, dest, &username, &password, 1);
+    while (1) {
+        fromLen = sizeof(from);
+        len = recvfrom(fd, msg, sizeof(msg), MSG_DONTWAIT,
+                       (struct sockaddr *)&from, &fromLen);
+        if (len <= 0) {
+            break;
+        }
+        if (!stunParseMessage(msg, len, &resp) ||
+            resp.msgHdr.msgType != BindResponseMsg) {
+            continue;
+        }
+        for (i = 0; i < p->ntrans; i++) {
+            struct stun_trans *t = &p->trans[i];
+            if (t->fd == fd && t->state == STUN_TRANS_PENDING &&
+                !memcmp(&t->id, &resp.msgHdr.id, sizeof(t->id))) {
+                stun_probe_answer(p, t, &resp);
+                break;
             }
+        }
+    }
+    stun_probe_check(p);
+}
 
-            if ((!respTestI2) && respTestI) {
-                // check the address to send to if valid
-                if ((testI2dest.addr != 0) && (testI2dest.port != 0)) {
-                    stunSendTest(myFd1, &testI2dest, &username, &password, 10);
-                }
-            }
+static void stun_probe_on_tick(struct gevent_wtimer *tick, void *arg)
+{
+    struct stun_probe *p = (struct stun_probe *)arg;
+    uint64_t now = stun_now_ms();
+    int i;
 
-            if (!respTestII) {
-                stunSendTest(myFd2, dest, &username, &password, 2);
-            }
+    for (i = 0; i < p->ntrans; i++) {
+        struct stun_trans *t = &p->trans[i];
+        if (t->state != STUN_TRANS_PENDING) {
+            continue;
+        }
+        if (now >= t->start + STUN_TIMEOUT_MS) {
+            t->state = STUN_TRANS_TIMEOUT;
+        } else if (now >= t->next && t->sent < STUN_RC) {
+            stun_trans_send(t);
+        }
+    }
+    stun_probe_check(p);
+}
 
-            if (!respTestIII) {
-                stunSendTest(myFd2, dest, &username, &password, 3);
-            }
+static int stun_probe_run(struct stun_probe *p)
+{
+    struct gevent *e1 = NULL, *e2 = NULL;
+    int ret = -1;
 
-            if (respTestI && (!respTestHairpin)) {
-                if ((testImappedAddr.addr != 0)
-                                && (testImappedAddr.port != 0)) {
-                    stunSendTest(myFd1, &testImappedAddr,
-                                    &username, &password, 11);
-                }
-            }
-        } else {
-            assert(err > 0);
-            // data is avialbe on some fd
-
-            for (i = 0; i < 2; i++) {
-                int myFd;
-                if (i == 0) {
-                    myFd = myFd1;
-                } else {
-                    myFd = myFd2;
-                }
-
-                if (myFd != INVALID_SOCKET) {
-                    if (FD_ISSET(myFd, &fdSet)) {
-                        char msg[STUN_MAX_MESSAGE_SIZE];
-                        int msgLen = sizeof(msg);
-
-                        stun_addr from;
-
-                        getMessage(myFd,
-                                   msg,
-                                   &msgLen, &from.addr, &from.port);
-
-                        StunMessage resp;
-                        memset(&resp, 0, sizeof(StunMessage));
-
-                        stunParseMessage(msg, msgLen, &resp);
-
-                        switch (resp.msgHdr.id.octet[0]) {
-                        case 1:
-                            if (!respTestI) {
-
-                                //testIchangedAddr.addr =
-                                //    resp.changedAddress.ipv4.addr;
-                                //testIchangedAddr.port =
-                                //    resp.changedAddress.ipv4.port;
-                                testImappedAddr.addr =
-                                    resp.mappedAddress.ipv4.addr;
-                                testImappedAddr.port =
-                                    resp.mappedAddress.ipv4.port;
-
-                                respTestPreservePort =
-                                    (testImappedAddr.port == port);
-                                if (preservePort) {
-                                    *preservePort = respTestPreservePort;
-                                }
-
-                                testI2dest.addr =
-                                    resp.changedAddress.ipv4.addr;
-
-                                if (sAddr) {
-                                    sAddr->port = testImappedAddr.port;
-                                    sAddr->addr = testImappedAddr.addr;
-                                }
-
-                                count = 0;
-                            }
-                            respTestI = 1;
-                            break;
-                        case 2:
-                            respTestII = 1;
-                            break;
-                        case 3:
-                            respTestIII = 1;
-                            break;
-                        case 10:
-                            if (!respTestI2) {
-                                testI2mappedAddr.addr =
-                                    resp.mappedAddress.ipv4.addr;
-                                testI2mappedAddr.port =
-                                    resp.mappedAddress.ipv4.port;
-
-                                mappedIpSame = 0;
-                                if ((testI2mappedAddr.addr ==
-                                     testImappedAddr.addr)
-                                    && (testI2mappedAddr.port ==
-                                        testImappedAddr.port)) {
-                                    mappedIpSame = 1;
-                                }
-
-                            }
-                            respTestI2 = 1;
-                            break;
-                        case 11:
-                            if (hairpin) {
-                                *hairpin = 1;
-                            }
-                            respTestHairpin = 1;
-                            break;
-                        }
-                    }
-                }
-            }
+    p->evbase = gevent_base_create();
+    if (!p->evbase) {
+        return -1;
+    }
+    e1 = gevent_create(p->fd1, stun_probe_on_recv, NULL, NULL, p);
+    if (!e1 || -1 == gevent_add(p->evbase, &e1)) {
+        goto out;
+    }
+    if (p->fd2 != INVALID_SOCKET) {
+        e2 = gevent_create(p->fd2, stun_probe_on_recv, NULL, NULL, p);
+        if (!e2 || -1 == gevent_add(p->evbase, &e2)) {
+            goto out;
         }
     }
+    gevent_wtimer_init(&p->tick, stun_probe_on_tick, p);
+    gevent_wtimer_add(p->evbase, &p->tick, STUN_TICK_MS, TIMER_PERSIST);
+    /* first transmission of every request, right now */
+    stun_probe_on_tick(&p->tick, p);
+    if (!p->decide(p)) {
+        gevent_base_loop(p->evbase);
+    }
+    gevent_wtimer_del(p->evbase, &p->tick);
+    ret = 0;
+out:
+    gevent_base_destroy(p->evbase);
+    return ret;
+}
 
-    // see if we can bind to this address
-    int s = openPort(0 /*use ephemeral */ , testImappedAddr.addr);
-    if (s != INVALID_SOCKET) {
-        close(s);
-        isNat = 0;
-    } else {
-        isNat = 1;
-    }
-
-    // implement logic flow chart from draft RFC
-    if (respTestI) {
-        if (isNat) {
-            if (respTestII) {
-                return STUN_NAT_TYPE_ConeNat;
-            } else {
-                if (mappedIpSame) {
-                    if (respTestIII) {
-                        return STUN_NAT_TYPE_RestrictedNat;
-                    } else {
-                        return STUN_NAT_TYPE_PortRestrictedNat;
-                    }
-                } else {
-                    return STUN_NAT_TYPE_SymNat;
-                }
-            }
-        } else {
-            if (respTestII) {
-                return STUN_NAT_TYPE_Open;
-            } else {
-                return STUN_NAT_TYPE_SymFirewall;
-            }
+static void stun_probe_init(struct stun_probe *p, int fd1, int fd2)
+{
+    memset(p, 0, sizeof(*p));
+    p->fd1 = fd1;
+    p->fd2 = fd2;
+    p->nat = -1;
+    p->type = STUN_NAT_TYPE_Unknown;
+}
+
+static stun_nat_type_t stun_get_nat_type(struct stun_t *stun, stun_addr *mapped)
+{
+    struct stun_probe p;
+    struct stun_trans *t1;
+    int i, port = stunRandomPort();
+    int myFd1 = openPort(port, 0);
+    int myFd2 = openPort(port + 1, 0);
+
+    if ((myFd1 == INVALID_SOCKET) || (myFd2 == INVALID_SOCKET)) {
+        fprintf(stderr, "Some problem opening port/interface to send on\n");
+        if (myFd1 != INVALID_SOCKET) {
+            close(myFd1);
         }
-    } else {
-        return STUN_NAT_TYPE_Blocked;
+        if (myFd2 != INVALID_SOCKET) {
+            close(myFd2);
+        }
+        return STUN_NAT_TYPE_Failure;
+    }
+    stun_probe_init(&p, myFd1, myFd2);
+    p.decide = stun_nat_decide;
+    for (i = 0; i < stun->nservers; i++) {
+        stun_trans_add(&p, STUN_TEST_I, myFd1, &stun->servers[i], 0, 0);
     }
-    return STUN_NAT_TYPE_Unknown;
+    stun_trans_add(&p, STUN_TEST_II, myFd2, &stun->servers[0], 1, 1);
+    stun_trans_add(&p, STUN_TEST_III, myFd2, &stun->servers[0], 1, 0);
+    if (stun_probe_run(&p) < 0) {
+        p.type = STUN_NAT_TYPE_Failure;
+    }
+    if ((t1 = stun_trans_find(&p, STUN_TEST_I, 1))) {
+        *mapped = t1->mapped;
+    }
+    close(myFd1);
+    close(myFd2);
+    return p.type;
 }
 
-static int stunOpenSocket(stun_addr *dest, stun_addr * mapAddr,
+static int stunOpenSocket(struct stun_t *stun, stun_addr * mapAddr,
                int port, stun_addr * srcAddr)
 {
-    stun_addr from;
-    int err;
-    int fdSetSize;
-    struct timeval tv;
-    fd_set fdSet;
+    struct stun_probe p;
+    struct stun_trans *t1;
+    int i;
 
     if (port == 0) {
         port = stunRandomPort();
@@ -1200,56 +1235,114 @@ static int stunOpenSocket(stun_addr *dest, stun_addr * mapAddr,
         return myFd;
     }
 
-    char msg[STUN_MAX_MESSAGE_SIZE];
-    int msgLen = sizeof(msg);
+    stun_probe_init(&p, myFd, INVALID_SOCKET);
+    p.decide = stun_map_decide;
+    for (i = 0; i < stun->nservers; i++) {
+        stun_trans_add(&p, STUN_TEST_I, myFd, &stun->servers[i], 0, 0);
+    }
+    if (stun_probe_run(&p) < 0 || !(t1 = stun_trans_find(&p, STUN_TEST_I, 1))) {
+        fprintf(stderr, "no data to recv\n");
+        close(myFd);
+        return -1;
+    }
+    *mapAddr = t1->mapped;
+    return myFd;
+}
 
-    StunAtrString username;
-    StunAtrString password;
+/* local address used to reach the first server, no packet is sent */
+static uint32_t stun_local_ip(struct stun_t *stun)
+{
+    struct sockaddr_in si;
+    socklen_t len = sizeof(si);
+    uint32_t ip = 0;
+    int fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
 
-    username.sizeValue = 0;
-    password.sizeValue = 0;
+    if (fd == INVALID_SOCKET) {
+        return 0;
+    }
+    memset(&si, 0, sizeof(si));
+    si.sin_family = AF_INET;
+    si.sin_addr.s_addr = htonl(stun->addr.addr);
+    si.sin_port = htons(stun->addr.port);
+    if (0 == connect(fd, (struct sockaddr *)&si, sizeof(si)) &&
+        0 == getsockname(fd, (struct sockaddr *)&si, &len)) {
+        ip = ntohl(si.sin_addr.s_addr);
+    }
+    close(fd);
+    return ip;
+}
 
-    stunSendTest(myFd, dest, &username, &password, 1);
+/*
+ * cache line: servers local_ip nat_type mapped_ip mapped_port expire
+ * valid only for the same servers seen from the same local address
+ */
+static void stun_cache_load(struct stun_t *stun, uint32_t local)
+{
+    char line[STUN_MAX_STRING + 64], servers[STUN_MAX_STRING];
+    unsigned int ip, type, maddr, mport;
+    long expire;
+    FILE *fp;
 
-    while (1) {
-        FD_ZERO(&fdSet);
-        FD_SET(myFd,&fdSet);
-        tv.tv_sec=0;
-        tv.tv_usec=2000*1000;
-        fdSetSize = (myFd+1>fdSetSize) ? myFd+1 : fdSetSize;
-
-        err = select(fdSetSize, &fdSet, NULL, NULL, &tv);
-        if (-1 == err) {
-            perror("select");
-        } else if (0 == err) {
-            fprintf(stderr, "no data to recv\n");
-            return -1;
-        } else {
-            break;
-        }
+    if (!stun->cache[0] || !(fp = fopen(stun->cache, "r"))) {
+        return;
     }
+    if (fgets(line, sizeof(line), fp) &&
+        6 == sscanf(line, "%255s %u %u %u %u %ld", servers, &ip, &type,
+                    &maddr, &mport, &expire) &&
+        !strcmp(servers, stun->names) && ip == local && expire > time(NULL)) {
+        stun->nat_type = type;
+        stun->mapped.addr = maddr;
+        stun->mapped.port = mport;
+        stun->expire = expire;
+    }
+    fclose(fp);
+}
 
-    getMessage(myFd, msg, &msgLen, &from.addr, &from.port);
+static void stun_cache_save(struct stun_t *stun, uint32_t local)
+{
+    FILE *fp;
 
-    StunMessage resp;
-    memset(&resp, 0, sizeof(StunMessage));
+    if (!stun->cache[0] || !(fp = fopen(stun->cache, "w"))) {
+        return;
+    }
+    fprintf(fp, "%s %u %u %u %u %ld\n", stun->names, local, stun->nat_type,
+            stun->mapped.addr, stun->mapped.port, (long)stun->expire);
+    fclose(fp);
+}
 
-    int ok = stunParseMessage(msg, msgLen, &resp);
-    if (!ok) {
+int stun_init(struct stun_t *stun, const char *ip)
+{
+    char names[STUN_MAX_STRING], *name, *save = NULL;
+
+    memset(stun, 0, sizeof(*stun));
+    stun->ttl = STUN_CACHE_TTL;
+    strncpy(stun->names, ip, sizeof(stun->names) - 1);
+    strncpy(names, ip, sizeof(names) - 1);
+    names[sizeof(names) - 1] = '\0';
+    for (name = strtok_r(names, ",", &save);
+         name && stun->nservers < STUN_MAX_SERVERS;
+         name = strtok_r(NULL, ",", &save)) {
+        if (0 != stunParseHostName(name, &stun->servers[stun->nservers].addr,
+                                   &stun->servers[stun->nservers].port)) {
+            continue;
+        }
+        stun->nservers++;
+    }
+    if (stun->nservers == 0) {
         return -1;
     }
-
-    stun_addr mappedAddr = resp.mappedAddress.ipv4;
-    //stun_addr changedAddr = resp.changedAddress.ipv4;
-
-    *mapAddr = mappedAddr;
-
-    return myFd;
+    stun->addr = stun->servers[0];
+    return 0;
 }
 
-int stun_init(struct stun_t *stun, const char *ip)
+void stun_set_cache(struct stun_t *stun, const char *path, int ttl)
 {
-    return stunParseHostName((char *)ip, &stun->addr.addr, &stun->addr.port);
+    stun->cache[0] = '\0';
+    if (path) {
+        strncpy(stun->cache, path, sizeof(stun->cache) - 1);
+    }
+    stun->ttl = ttl;
+    stun->expire = 0;
 }
 
 int stun_socket(struct stun_t *stun, const char *ip, uint16_t port, stun_addr *map)
@@ -1257,10 +1350,15 @@ int stun_socket(struct stun_t *stun, const char *ip, uint16_t port, stun_addr *m
     int fd;
     stun_addr src;
     if (ip == NULL) {
-        fd = stunOpenSocket(&stun->addr, map, port, NULL);
+        fd = stunOpenSocket(stun, map, port, NULL);
     } else {
-        stunParseHostName((char *)ip, &stun->addr.addr, &stun->addr.port);
-        fd = stunOpenSocket(&stun->addr, map, port, &src);
+        /* ip is the local interface to bind, not the server */
+        src.addr = ntohl(inet_addr(ip));
+        src.port = port;
+        fd = stunOpenSocket(stun, map, port, &src);
+    }
+    if (fd != -1) {
+        stun->mapped = *map;
     }
 
     return fd;
@@ -1268,14 +1366,19 @@ int stun_socket(struct stun_t *stun, const char *ip, uint16_t port, stun_addr *m
 
 stun_nat_type_t stun_nat_type(struct stun_t *stun)
 {
-    int presPort = 0;
-    int hairpin = 0;
+    stun_addr mapped;
+    uint32_t local = stun_local_ip(stun);
+    stun_nat_type_t stype;
 
-    stun_addr sAddr;
-    sAddr.port = 0;
-    sAddr.addr = 0;
+    if (stun->ttl > 0 && stun->expire == 0) {
+        stun_cache_load(stun, local);
+    }
+    if (stun->ttl > 0 && stun->expire > time(NULL)) {
+        return stun->nat_type;
+    }
 
-    stun_nat_type_t stype = stun_get_nat_type(&stun->addr, &presPort, &hairpin, 0, &sAddr);
+    memset(&mapped, 0, sizeof(mapped));
+    stype = stun_get_nat_type(stun, &mapped);
     switch (stype) {
     case STUN_NAT_TYPE_Open:
         printf("No NAT detected - P2P should work\n");
@@ -1292,6 +1395,9 @@ stun_nat_type_t stun_nat_type(struct stun_t *stun)
     case STUN_NAT_TYPE_SymNat:
         printf("NAT type: Symetric - P2P will NOT work\n");
         break;
+    case STUN_NAT_TYPE_SymFirewall:
+        printf("Symmetric UDP firewall - P2P may not work\n");
+        break;
     case STUN_NAT_TYPE_Blocked:
         printf("Could not reach stun server - check server name is correct\n");
         break;
@@ -1302,6 +1408,14 @@ stun_nat_type_t stun_nat_type(struct stun_t *stun)
         printf("Unkown NAT type\n");
         break;
     }
+    /* failures are not cached, the next call probes again */
+    if (stype != STUN_NAT_TYPE_Blocked && stype != STUN_NAT_TYPE_Failure &&
+        stype != STUN_NAT_TYPE_Unknown && stun->ttl > 0) {
+        stun->nat_type = stype;
+        stun->mapped = mapped;
+        stun->expire = time(NULL) + stun->ttl;
+        stun_cache_save(stun, local);
+    }
     return stype;
 }
 
@@ -22,6 +22,9 @@
 #ifndef LIBSTUN_H
 #define LIBSTUN_H
 
+#include <stdint.h>
+#include <time.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -43,11 +46,33 @@ typedef struct {
     uint32_t addr;
 } stun_addr;
 
+#define STUN_MAX_SERVERS    4
+#define STUN_CACHE_TTL      600     /* seconds */
+
 struct stun_t {
-    stun_addr addr;
+    stun_addr addr;                     /* first server */
+    stun_addr servers[STUN_MAX_SERVERS];
+    int nservers;
+    char names[256];
+    stun_nat_type_t nat_type;           /* cached by stun_nat_type */
+    stun_addr mapped;                   /* last mapped address seen */
+    time_t expire;                      /* cache valid until, 0 for none */
+    int ttl;
+    char cache[128];                    /* cache file, empty for memory only */
 };
 
+/*
+ * ip is "host[:port]", or up to STUN_MAX_SERVERS of them separated by ','.
+ * binding requests go to all servers at once and the first answer is used
+ */
 int stun_init(struct stun_t *stun, const char *ip);
+/*
+ * keep the nat type and mapped address for ttl seconds, in path too if not
+ * NULL so later processes skip the probe. ttl 0 disables the cache.
+ * the cache is ignored if the servers or the local address changed
+ */
+void stun_set_cache(struct stun_t *stun, const char *path, int ttl);
+/* ip and port are the local address to bind, NULL and 0 for any */
 int stun_socket(struct stun_t *stun, const char *ip, uint16_t port, stun_addr *map);
 stun_nat_type_t stun_nat_type(struct stun_t *stun);
 void stun_keep_alive(struct stun_t *stun, int fd);
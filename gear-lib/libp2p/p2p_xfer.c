@@ -0,0 +1,798 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#include "libp2p.h"
+#include <libbitmap.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+
+/*
+ * every message is a xfer_hdr in network order followed by len bytes:
+ *
+ *   OFFER  sender -> receiver, stream 0, index = chunk size, 8 bytes size
+ *   HAVE   receiver -> sender, stream 0, index = chunks, resume bitmap
+ *   DATA   sender -> receiver, any stream, chunk index and crc of payload
+ *   NACK   receiver -> sender, same stream, chunk failed crc, send again
+ *   DONE   receiver -> sender, any stream, every chunk is on disk
+ */
+#define XFER_MAGIC          0x50325846  /* P2XF */
+#define XFER_SYNC_CHUNKS    64          /* fdatasync and save bitmap */
+#define XFER_POLL_MS        100
+#define XFER_MAX_CHUNK      (64 * 1024 * 1024)
+#define XFER_SUFFIX         ".xfer"
+#define XFER_WORDS(n)       (((n) + 31) / 32)   /* bitmap as u32 array */
+
+enum xfer_type {
+    XFER_OFFER = 1,
+    XFER_HAVE,
+    XFER_DATA,
+    XFER_NACK,
+    XFER_DONE,
+};
+
+struct xfer_hdr {
+    uint32_t magic;
+    uint32_t type;
+    uint32_t index;
+    uint32_t len;
+    uint32_t crc;
+};
+
+enum xfer_state {
+    XFER_ERROR = -1,
+    XFER_INIT,
+    XFER_RUNNING,
+    XFER_FINISHED,
+};
+
+struct xfer {
+    ptcp_socket_t *streams;
+    int nstreams;
+    int fd;
+    uint64_t size;
+    uint32_t chunk;
+    uint32_t nchunks;
+    unsigned long *map;         /* sender: queued or sent, receiver: on disk */
+    uint32_t count;             /* set bits in map */
+    uint32_t next;              /* sender: scan cursor */
+    uint32_t unsynced;          /* receiver: chunks since last bitmap save */
+    char *bitmap_path;
+    pthread_mutex_t lock;
+    pthread_mutex_t sync_lock;
+    pthread_cond_t cond;
+    enum xfer_state state;
+    struct p2p_xfer_stat *stat;
+};
+
+struct xfer_worker {
+    struct xfer *x;
+    int id;
+    pthread_t tid;
+    void *buf;
+};
+
+/* crc32 (ieee 802.3), slicing by 8 */
+static uint32_t crc_table[8][256];
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+static void crc32_init(void)
+{
+    uint32_t i, j, c;
+
+    for (i = 0; i < 256; i++) {
+        for (c = i, j = 0; j < 8; j++) {
+            c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+        }
+        crc_table[0][i] = c;
+    }
+    for (i = 0; i < 256; i++) {
+        for (j = 1; j < 8; j++) {
+            crc_table[j][i] = (crc_table[j-1][i] >> 8) ^
+                              crc_table[0][crc_table[j-1][i] & 0xFF];
+        }
+    }
+}
+
+static uint32_t crc32(const void *buf, size_t len)
+{
+    const uint8_t *p = buf;
+    uint32_t c = 0xFFFFFFFF, lo, hi;
+
+    pthread_once(&crc_once, crc32_init);
+    for (; len >= 8; p += 8, len -= 8) {
+        lo = c ^ (p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24);
+        hi = p[4] | p[5] << 8 | p[6] << 16 | (uint32_t)p[7] << 24;
+        c = crc_table[7][lo & 0xFF] ^ crc_table[6][(lo >> 8) & 0xFF] ^
+            crc_table[5][(lo >> 16) & 0xFF] ^ crc_table[4][lo >> 24] ^
+            crc_table[3][hi & 0xFF] ^ crc_table[2][(hi >> 8) & 0xFF] ^
+            crc_table[1][(hi >> 16) & 0xFF] ^ crc_table[0][hi >> 24];
+    }
+    while (len--) {
+        c = crc_table[0][(c ^ *p++) & 0xFF] ^ (c >> 8);
+    }
+    return ~c;
+}
+
+static enum xfer_state xfer_get_state(struct xfer *x)
+{
+    enum xfer_state state;
+
+    pthread_mutex_lock(&x->lock);
+    state = x->state;
+    pthread_mutex_unlock(&x->lock);
+    return state;
+}
+
+static void xfer_set_state(struct xfer *x, enum xfer_state state)
+{
+    pthread_mutex_lock(&x->lock);
+    if (x->state != XFER_ERROR && x->state != XFER_FINISHED) {
+        x->state = state;
+    }
+    pthread_cond_broadcast(&x->cond);
+    pthread_mutex_unlock(&x->lock);
+}
+
+static uint32_t xfer_chunk_len(struct xfer *x, uint32_t index)
+{
+    uint64_t off = (uint64_t)index * x->chunk;
+    return x->size - off < x->chunk ? (uint32_t)(x->size - off) : x->chunk;
+}
+
+static int stream_write(struct xfer *x, ptcp_socket_t ps, const void *buf, size_t len)
+{
+    const char *p = buf;
+    ssize_t ret;
+
+    while (len > 0) {
+        ret = ptcp_send(ps, p, len, 0);
+        if (ret > 0) {
+            p += ret;
+            len -= ret;
+            continue;
+        }
+        if (ret == -1 && errno != EWOULDBLOCK && errno != EAGAIN) {
+            return -1;
+        }
+        if (ptcp_poll(ps, PTCP_POLLOUT, XFER_POLL_MS) < 0 ||
+            xfer_get_state(x) == XFER_ERROR) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * read exactly len bytes. with wait == 0 return 1 at once if nothing has
+ * arrived yet, otherwise keep waiting until the transfer leaves running
+ */
+static int stream_read(struct xfer *x, ptcp_socket_t ps, void *buf, size_t len, int wait)
+{
+    char *p = buf;
+    size_t got = 0;
+    ssize_t ret;
+
+    while (got < len) {
+        ret = ptcp_recv(ps, p + got, len - got, 0);
+        if (ret > 0) {
+            got += ret;
+            continue;
+        }
+        if (ret == 0 || (errno != EWOULDBLOCK && errno != EAGAIN)) {
+            return -1;
+        }
+        if (!wait && got == 0) {
+            return 1;
+        }
+        if (ptcp_poll(ps, PTCP_POLLIN, XFER_POLL_MS) < 0) {
+            return -1;
+        }
+        if (got == 0 && xfer_get_state(x) > XFER_RUNNING) {
+            return 1;
+        }
+        if (xfer_get_state(x) == XFER_ERROR) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int send_msg(struct xfer *x, ptcp_socket_t ps, uint32_t type, uint32_t index,
+                const void *buf, uint32_t len, uint32_t crc)
+{
+    struct xfer_hdr hdr;
+
+    hdr.magic = htonl(XFER_MAGIC);
+    hdr.type = htonl(type);
+    hdr.index = htonl(index);
+    hdr.len = htonl(len);
+    hdr.crc = htonl(crc);
+    if (stream_write(x, ps, &hdr, sizeof(hdr)) < 0) {
+        return -1;
+    }
+    return len ? stream_write(x, ps, buf, len) : 0;
+}
+
+static int recv_hdr(struct xfer *x, ptcp_socket_t ps, struct xfer_hdr *hdr, int wait)
+{
+    int ret = stream_read(x, ps, hdr, sizeof(*hdr), wait);
+
+    if (ret) {
+        return ret;
+    }
+    hdr->magic = ntohl(hdr->magic);
+    hdr->type = ntohl(hdr->type);
+    hdr->index = ntohl(hdr->index);
+    hdr->len = ntohl(hdr->len);
+    hdr->crc = ntohl(hdr->crc);
+    if (hdr->magic != XFER_MAGIC) {
+        printf("%s: bad magic 0x%08x\n", __func__, hdr->magic);
+        return -1;
+    }
+    return 0;
+}
+
+static void bitmap_pack(uint32_t *buf, const unsigned long *map, uint32_t nbits)
+{
+    uint32_t i;
+
+    bitmap_to_arr32(buf, map, nbits);
+    for (i = 0; i < XFER_WORDS(nbits); i++) {
+        buf[i] = htonl(buf[i]);
+    }
+}
+
+static void bitmap_unpack(unsigned long *map, uint32_t *buf, uint32_t nbits)
+{
+    uint32_t i;
+
+    for (i = 0; i < XFER_WORDS(nbits); i++) {
+        buf[i] = ntohl(buf[i]);
+    }
+    bitmap_from_arr32(map, buf, nbits);
+}
+
+static struct xfer *xfer_create(ptcp_socket_t *streams, int nstreams,
+                struct p2p_xfer_stat *stat)
+{
+    struct xfer *x = calloc(1, sizeof(struct xfer));
+    if (!x) {
+        return NULL;
+    }
+    x->streams = streams;
+    x->nstreams = nstreams;
+    x->fd = -1;
+    x->stat = stat;
+    x->state = XFER_INIT;
+    pthread_mutex_init(&x->lock, NULL);
+    pthread_mutex_init(&x->sync_lock, NULL);
+    pthread_cond_init(&x->cond, NULL);
+    if (stat) {
+        memset(stat, 0, sizeof(*stat));
+    }
+    return x;
+}
+
+static void xfer_destroy(struct xfer *x)
+{
+    if (x->fd != -1) {
+        close(x->fd);
+    }
+    if (x->map) {
+        bitmap_free(x->map);
+    }
+    free(x->bitmap_path);
+    pthread_cond_destroy(&x->cond);
+    pthread_mutex_destroy(&x->sync_lock);
+    pthread_mutex_destroy(&x->lock);
+    free(x);
+}
+
+static int xfer_run(struct xfer *x, void *(*routine)(void *), size_t bufsize)
+{
+    struct xfer_worker *w = calloc(x->nstreams, sizeof(struct xfer_worker));
+    int i, started = 0;
+
+    if (!w) {
+        return -1;
+    }
+    for (i = 0; i < x->nstreams; i++) {
+        w[i].x = x;
+        w[i].id = i;
+        if (bufsize && !(w[i].buf = malloc(bufsize))) {
+            xfer_set_state(x, XFER_ERROR);
+            break;
+        }
+        if (pthread_create(&w[i].tid, NULL, routine, &w[i])) {
+            xfer_set_state(x, XFER_ERROR);
+            break;
+        }
+        started++;
+    }
+    for (i = 0; i < started; i++) {
+        pthread_join(w[i].tid, NULL);
+    }
+    for (i = 0; i < x->nstreams; i++) {
+        free(w[i].buf);
+    }
+    free(w);
+    return x->state == XFER_FINISHED ? 0 : -1;
+}
+
+/*
+ * sender. each stream thread takes the next chunk not yet sent, so fast
+ * paths carry more chunks, and writes it straight from a mapping of the
+ * file. nothing waits for the chunk to be acked, the ptcp send buffer
+ * keeps the pipe full.
+ */
+static int sender_control(struct xfer *x, ptcp_socket_t ps, struct xfer_hdr *hdr)
+{
+    switch (hdr->type) {
+    case XFER_NACK:
+        if (hdr->index >= x->nchunks) {
+            return -1;
+        }
+        pthread_mutex_lock(&x->lock);
+        if (test_bit(hdr->index, x->map)) {
+            clear_bit(hdr->index, x->map);
+            x->count--;
+        }
+        if (hdr->index < x->next) {
+            x->next = hdr->index;
+        }
+        if (x->stat) {
+            x->stat->retransmits++;
+        }
+        pthread_mutex_unlock(&x->lock);
+        return 0;
+    case XFER_DONE:
+        xfer_set_state(x, XFER_FINISHED);
+        return 0;
+    default:
+        printf("%s: unexpected message %u\n", __func__, hdr->type);
+        return -1;
+    }
+}
+
+static int64_t sender_next_chunk(struct xfer *x)
+{
+    uint32_t index;
+
+    pthread_mutex_lock(&x->lock);
+    index = find_next_zero_bit(x->map, x->nchunks, x->next);
+    if (index >= x->nchunks) {
+        pthread_mutex_unlock(&x->lock);
+        return -1;
+    }
+    set_bit(index, x->map);
+    x->count++;
+    x->next = index + 1;
+    pthread_mutex_unlock(&x->lock);
+    return index;
+}
+
+static int sender_chunk(struct xfer *x, ptcp_socket_t ps, uint32_t index)
+{
+    off_t off = (off_t)index * x->chunk;
+    uint32_t len = xfer_chunk_len(x, index);
+    void *addr;
+    int ret;
+
+    addr = mmap(NULL, len, PROT_READ, MAP_SHARED, x->fd, off);
+    if (addr == MAP_FAILED) {
+        printf("mmap chunk %u failed: %s\n", index, strerror(errno));
+        return -1;
+    }
+    /* the next chunk is likely ours too, start reading it from disk */
+    if (index + 1 < x->nchunks) {
+        posix_fadvise(x->fd, off + x->chunk, xfer_chunk_len(x, index + 1),
+                      POSIX_FADV_WILLNEED);
+    }
+    ret = send_msg(x, ps, XFER_DATA, index, addr, len, crc32(addr, len));
+    munmap(addr, len);
+    if (ret == 0 && x->stat) {
+        pthread_mutex_lock(&x->lock);
+        x->stat->bytes += len;
+        pthread_mutex_unlock(&x->lock);
+    }
+    return ret;
+}
+
+static void *sender_routine(void *arg)
+{
+    struct xfer_worker *w = arg;
+    struct xfer *x = w->x;
+    ptcp_socket_t ps = x->streams[w->id];
+    struct xfer_hdr hdr;
+    int64_t index;
+    int ret;
+
+    pthread_mutex_lock(&x->lock);
+    while (x->state == XFER_INIT) {
+        pthread_cond_wait(&x->cond, &x->lock);
+    }
+    pthread_mutex_unlock(&x->lock);
+
+    while (xfer_get_state(x) == XFER_RUNNING) {
+        /* NACK and DONE interleave with data, take them between chunks */
+        while (0 == (ret = recv_hdr(x, ps, &hdr, 0))) {
+            if (sender_control(x, ps, &hdr) < 0) {
+                goto err;
+            }
+        }
+        if (ret < 0) {
+            goto err;
+        }
+        if ((index = sender_next_chunk(x)) >= 0) {
+            if (sender_chunk(x, ps, index) < 0) {
+                goto err;
+            }
+            continue;
+        }
+        /* all sent, wait for NACK or DONE */
+        if (ptcp_poll(ps, PTCP_POLLIN, XFER_POLL_MS) < 0) {
+            goto err;
+        }
+    }
+    return NULL;
+
+err:
+    if (xfer_get_state(x) == XFER_RUNNING) {
+        printf("%s: stream %d failed\n", __func__, w->id);
+        xfer_set_state(x, XFER_ERROR);
+    }
+    return NULL;
+}
+
+static int sender_handshake(struct xfer *x)
+{
+    ptcp_socket_t ps = x->streams[0];
+    struct xfer_hdr hdr;
+    uint32_t size[2], *buf;
+    int ret;
+
+    size[0] = htonl((uint32_t)(x->size >> 32));
+    size[1] = htonl((uint32_t)x->size);
+    if (send_msg(x, ps, XFER_OFFER, x->chunk, size, sizeof(size),
+                 crc32(size, sizeof(size))) < 0) {
+        return -1;
+    }
+    if (recv_hdr(x, ps, &hdr, 1)) {
+        return -1;
+    }
+    if (hdr.type != XFER_HAVE || hdr.index != x->nchunks ||
+        hdr.len != XFER_WORDS(x->nchunks) * sizeof(uint32_t)) {
+        printf("%s: bad answer to offer\n", __func__);
+        return -1;
+    }
+    if (hdr.len == 0) {
+        return 0;
+    }
+    if (!(buf = malloc(hdr.len))) {
+        return -1;
+    }
+    ret = stream_read(x, ps, buf, hdr.len, 1);
+    if (ret || crc32(buf, hdr.len) != hdr.crc) {
+        free(buf);
+        return -1;
+    }
+    bitmap_unpack(x->map, buf, x->nchunks);
+    free(buf);
+    x->count = bitmap_weight(x->map, x->nchunks);
+    if (x->stat) {
+        x->stat->resumed = x->count;
+    }
+    return 0;
+}
+
+int p2p_xfer_send(ptcp_socket_t *streams, int nstreams, const char *path,
+                struct p2p_xfer_stat *stat)
+{
+    struct xfer *x;
+    struct stat st;
+    int ret = -1;
+
+    if (!streams || nstreams <= 0 || !path) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (!(x = xfer_create(streams, nstreams, stat))) {
+        return -1;
+    }
+    if (-1 == (x->fd = open(path, O_RDONLY)) || -1 == fstat(x->fd, &st)) {
+        printf("open %s failed: %s\n", path, strerror(errno));
+        goto out;
+    }
+    x->size = st.st_size;
+    x->chunk = P2P_XFER_CHUNK_SIZE;
+    x->nchunks = (x->size + x->chunk - 1) / x->chunk;
+    if (!(x->map = bitmap_zalloc(x->nchunks ? x->nchunks : 1))) {
+        goto out;
+    }
+    if (stat) {
+        stat->size = x->size;
+        stat->chunks = x->nchunks;
+    }
+    posix_fadvise(x->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    if (sender_handshake(x) < 0) {
+        goto out;
+    }
+    xfer_set_state(x, XFER_RUNNING);
+    ret = xfer_run(x, sender_routine, 0);
+out:
+    xfer_destroy(x);
+    return ret;
+}
+
+/*
+ * receiver. chunks land with pwrite at their offset whatever stream they
+ * came on. the bitmap of chunks on disk is saved next to the file after a
+ * fdatasync, so a restarted transfer only asks for what is missing.
+ */
+static int bitmap_save(struct xfer *x)
+{
+    size_t words = XFER_WORDS(x->nchunks);
+    uint32_t *buf = malloc((words + 4) * sizeof(uint32_t));
+    char *tmp = malloc(strlen(x->bitmap_path) + sizeof(".tmp"));
+    int fd, ret = -1;
+
+    if (!buf || !tmp) {
+        free(buf);
+        free(tmp);
+        return -1;
+    }
+    sprintf(tmp, "%s.tmp", x->bitmap_path);
+    buf[0] = htonl(XFER_MAGIC);
+    buf[1] = htonl(x->chunk);
+    buf[2] = htonl((uint32_t)(x->size >> 32));
+    buf[3] = htonl((uint32_t)x->size);
+    pthread_mutex_lock(&x->lock);
+    bitmap_pack(buf + 4, x->map, x->nchunks);
+    pthread_mutex_unlock(&x->lock);
+
+    /* chunks in this copy were written before their bit was set */
+    pthread_mutex_lock(&x->sync_lock);
+    fdatasync(x->fd);
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd != -1) {
+        if ((ssize_t)((words + 4) * sizeof(uint32_t)) ==
+            write(fd, buf, (words + 4) * sizeof(uint32_t)) &&
+            0 == fdatasync(fd)) {
+            ret = rename(tmp, x->bitmap_path);
+        }
+        close(fd);
+    }
+    pthread_mutex_unlock(&x->sync_lock);
+    if (ret) {
+        unlink(tmp);
+    }
+    free(tmp);
+    free(buf);
+    return ret;
+}
+
+static void bitmap_load(struct xfer *x)
+{
+    size_t words = XFER_WORDS(x->nchunks);
+    size_t len = (words + 4) * sizeof(uint32_t);
+    uint32_t *buf = malloc(len);
+    int fd = open(x->bitmap_path, O_RDONLY);
+
+    if (fd != -1 && buf && (ssize_t)len == read(fd, buf, len) &&
+        ntohl(buf[0]) == XFER_MAGIC && ntohl(buf[1]) == x->chunk &&
+        ntohl(buf[2]) == (uint32_t)(x->size >> 32) &&
+        ntohl(buf[3]) == (uint32_t)x->size) {
+        bitmap_unpack(x->map, buf + 4, x->nchunks);
+        x->count = bitmap_weight(x->map, x->nchunks);
+    }
+    if (fd != -1) {
+        close(fd);
+    }
+    free(buf);
+}
+
+static int receiver_finish(struct xfer *x, ptcp_socket_t ps)
+{
+    pthread_mutex_lock(&x->sync_lock);
+    fsync(x->fd);
+    unlink(x->bitmap_path);
+    pthread_mutex_unlock(&x->sync_lock);
+    if (send_msg(x, ps, XFER_DONE, 0, NULL, 0, 0) < 0) {
+        return -1;
+    }
+    xfer_set_state(x, XFER_FINISHED);
+    return 0;
+}
+
+static int receiver_chunk(struct xfer *x, ptcp_socket_t ps, struct xfer_hdr *hdr, void *buf)
+{
+    int done, sync;
+
+    if (hdr->index >= x->nchunks || hdr->len != xfer_chunk_len(x, hdr->index)) {
+        printf("%s: bad chunk %u len %u\n", __func__, hdr->index, hdr->len);
+        return -1;
+    }
+    if (stream_read(x, ps, buf, hdr->len, 1)) {
+        return -1;
+    }
+    if (crc32(buf, hdr->len) != hdr->crc) {
+        printf("%s: chunk %u crc mismatch\n", __func__, hdr->index);
+        if (x->stat) {
+            pthread_mutex_lock(&x->lock);
+            x->stat->retransmits++;
+            pthread_mutex_unlock(&x->lock);
+        }
+        return send_msg(x, ps, XFER_NACK, hdr->index, NULL, 0, 0);
+    }
+    if ((ssize_t)hdr->len != pwrite(x->fd, buf, hdr->len, (off_t)hdr->index * x->chunk)) {
+        printf("%s: pwrite chunk %u failed: %s\n", __func__, hdr->index, strerror(errno));
+        return -1;
+    }
+    pthread_mutex_lock(&x->lock);
+    if (!test_bit(hdr->index, x->map)) {
+        set_bit(hdr->index, x->map);
+        x->count++;
+        x->unsynced++;
+        if (x->stat) {
+            x->stat->bytes += hdr->len;
+        }
+    }
+    done = (x->count == x->nchunks);
+    sync = !done && x->unsynced >= XFER_SYNC_CHUNKS;
+    if (sync) {
+        x->unsynced = 0;
+    }
+    pthread_mutex_unlock(&x->lock);
+    if (done) {
+        return receiver_finish(x, ps);
+    }
+    if (sync) {
+        bitmap_save(x);
+    }
+    return 0;
+}
+
+static void *receiver_routine(void *arg)
+{
+    struct xfer_worker *w = arg;
+    struct xfer *x = w->x;
+    ptcp_socket_t ps = x->streams[w->id];
+    struct xfer_hdr hdr;
+    int ret;
+
+    while (xfer_get_state(x) == XFER_RUNNING) {
+        ret = recv_hdr(x, ps, &hdr, 1);
+        if (ret > 0) {
+            break;
+        }
+        if (ret < 0 || hdr.type != XFER_DATA ||
+            receiver_chunk(x, ps, &hdr, w->buf) < 0) {
+            goto err;
+        }
+    }
+    return NULL;
+
+err:
+    if (xfer_get_state(x) == XFER_RUNNING) {
+        printf("%s: stream %d failed\n", __func__, w->id);
+        xfer_set_state(x, XFER_ERROR);
+    }
+    return NULL;
+}
+
+static int receiver_handshake(struct xfer *x, const char *path)
+{
+    ptcp_socket_t ps = x->streams[0];
+    struct xfer_hdr hdr;
+    uint32_t size[2], *buf;
+    size_t words;
+    int ret;
+
+    ret = recv_hdr(x, ps, &hdr, 1);
+    if (!ret) {
+        ret = (hdr.type != XFER_OFFER || hdr.len != sizeof(size) ||
+               stream_read(x, ps, size, sizeof(size), 1) ||
+               crc32(size, sizeof(size)) != hdr.crc);
+    }
+    if (ret || hdr.index == 0 || hdr.index > XFER_MAX_CHUNK) {
+        printf("%s: bad offer\n", __func__);
+        return -1;
+    }
+    x->chunk = hdr.index;
+    x->size = (uint64_t)ntohl(size[0]) << 32 | ntohl(size[1]);
+    if ((x->size + x->chunk - 1) / x->chunk > UINT32_MAX) {
+        return -1;
+    }
+    x->nchunks = (x->size + x->chunk - 1) / x->chunk;
+    if (!(x->map = bitmap_zalloc(x->nchunks ? x->nchunks : 1))) {
+        return -1;
+    }
+    if (!(x->bitmap_path = malloc(strlen(path) + sizeof(XFER_SUFFIX)))) {
+        return -1;
+    }
+    sprintf(x->bitmap_path, "%s%s", path, XFER_SUFFIX);
+    if (-1 == (x->fd = open(path, O_RDWR | O_CREAT, 0644))) {
+        printf("open %s failed: %s\n", path, strerror(errno));
+        return -1;
+    }
+    bitmap_load(x);
+    if (-1 == ftruncate(x->fd, x->size)) {
+        printf("ftruncate %s failed: %s\n", path, strerror(errno));
+        return -1;
+    }
+    if (x->stat) {
+        x->stat->size = x->size;
+        x->stat->chunks = x->nchunks;
+        x->stat->resumed = x->count;
+    }
+
+    words = XFER_WORDS(x->nchunks);
+    if (!(buf = calloc(words ? words : 1, sizeof(uint32_t)))) {
+        return -1;
+    }
+    bitmap_pack(buf, x->map, x->nchunks);
+    x->state = XFER_RUNNING;
+    ret = send_msg(x, ps, XFER_HAVE, x->nchunks, buf, words * sizeof(uint32_t),
+                   crc32(buf, words * sizeof(uint32_t)));
+    free(buf);
+    if (ret == 0 && x->count == x->nchunks) {
+        ret = receiver_finish(x, ps);
+    }
+    return ret;
+}
+
+int p2p_xfer_recv(ptcp_socket_t *streams, int nstreams, const char *path,
+                struct p2p_xfer_stat *stat)
+{
+    struct xfer *x;
+    int ret = -1;
+
+    if (!streams || nstreams <= 0 || !path) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (!(x = xfer_create(streams, nstreams, stat))) {
+        return -1;
+    }
+    if (receiver_handshake(x, path) < 0) {
+        goto out;
+    }
+    if (x->state == XFER_FINISHED) {
+        ret = 0;
+        goto out;
+    }
+    ret = xfer_run(x, receiver_routine, x->chunk);
+    if (ret < 0) {
+        bitmap_save(x);
+    }
+out:
+    xfer_destroy(x);
+    return ret;
+}
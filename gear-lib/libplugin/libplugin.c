@@ -23,8 +23,172 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <pthread.h>
 #include <dlfcn.h>
 
+#define PLUGIN_HASH_SIZE    64
+#define PLUGIN_SYM_SIZE     64      /* resolved symbols per module, power of 2 */
+
+struct plugin_sym {
+    char *name;                     /* published last, NULL means empty */
+    void *func;
+};
+
+/* one loaded module, replaced as a whole on reload */
+struct plugin_impl {
+    void *handle;
+    struct plugin *desc;
+    pthread_mutex_t lock;           /* serialize symbol table inserts */
+    struct plugin_sym syms[PLUGIN_SYM_SIZE];
+};
+
+struct plugin_slot {
+    char *name;
+    char *path;
+    struct plugin_impl *impl;       /* swapped atomically by reload */
+    struct plugin_slot *next;       /* hash chain, read lock free */
+    struct list_head entry;
+};
+
+struct plugin_manager {
+    pthread_mutex_t lock;           /* serialize load/unload/reload */
+    struct plugin_slot *table[PLUGIN_HASH_SIZE];
+    struct list_head plugins;
+    int rcu_idx;
+    long readers[2];
+};
+
+static uint32_t plugin_hash(const char *s)
+{
+    uint32_t h = 2166136261u;
+    while (*s) {
+        h = (h ^ (uint8_t)*s++) * 16777619u;
+    }
+    return h;
+}
+
+int plugin_read_lock(struct plugin_manager *pm)
+{
+    int idx = __atomic_load_n(&pm->rcu_idx, __ATOMIC_SEQ_CST) & 1;
+    __atomic_fetch_add(&pm->readers[idx], 1, __ATOMIC_SEQ_CST);
+    return idx;
+}
+
+void plugin_read_unlock(struct plugin_manager *pm, int idx)
+{
+    __atomic_fetch_sub(&pm->readers[idx & 1], 1, __ATOMIC_SEQ_CST);
+}
+
+/*
+ * wait for a grace period, called with pm->lock held after unpublishing.
+ * flip twice like srcu, a reader that fetched the old index before the
+ * first flip is drained by the second wait
+ */
+static void plugin_synchronize(struct plugin_manager *pm)
+{
+    int i, idx = __atomic_load_n(&pm->rcu_idx, __ATOMIC_SEQ_CST) & 1;
+    for (i = 0; i < 2; i++) {
+        __atomic_store_n(&pm->rcu_idx, idx ^ 1, __ATOMIC_SEQ_CST);
+        while (__atomic_load_n(&pm->readers[idx], __ATOMIC_SEQ_CST) != 0) {
+            usleep(100);
+        }
+        idx ^= 1;
+    }
+}
+
+static struct plugin_impl *plugin_impl_open(const char *path, const char *name)
+{
+    struct plugin_impl *impl;
+    struct plugin *desc;
+    void *handle = dlopen(path, RTLD_LAZY);
+    if (!handle) {
+        printf("dlopen failed: %s\n", dlerror());
+        return NULL;
+    }
+    desc = dlsym(handle, name);
+    if (!desc) {
+        printf("incompatible plugin, dlsym failed: %s\n", dlerror());
+        dlclose(handle);
+        return NULL;
+    }
+    impl = CALLOC(1, struct plugin_impl);
+    if (!impl) {
+        dlclose(handle);
+        return NULL;
+    }
+    impl->handle = handle;
+    impl->desc = desc;
+    pthread_mutex_init(&impl->lock, NULL);
+    return impl;
+}
+
+static void plugin_impl_close(struct plugin_impl *impl)
+{
+    int i;
+    if (!impl) {
+        return;
+    }
+    for (i = 0; i < PLUGIN_SYM_SIZE; i++) {
+        free(impl->syms[i].name);
+    }
+    pthread_mutex_destroy(&impl->lock);
+    dlclose(impl->handle);
+    free(impl);
+}
+
+static void *plugin_impl_sym(struct plugin_impl *impl, const char *sym)
+{
+    uint32_t i, h = plugin_hash(sym) & (PLUGIN_SYM_SIZE - 1);
+    struct plugin_sym *s;
+    char *n;
+    void *func;
+
+    for (i = 0; i < PLUGIN_SYM_SIZE; i++) {
+        s = &impl->syms[(h + i) & (PLUGIN_SYM_SIZE - 1)];
+        n = __atomic_load_n(&s->name, __ATOMIC_ACQUIRE);
+        if (!n) {
+            break;
+        }
+        if (0 == strcmp(n, sym)) {
+            return s->func;
+        }
+    }
+
+    pthread_mutex_lock(&impl->lock);
+    for (i = 0; i < PLUGIN_SYM_SIZE; i++) {
+        s = &impl->syms[(h + i) & (PLUGIN_SYM_SIZE - 1)];
+        if (!s->name || 0 == strcmp(s->name, sym)) {
+            break;
+        }
+    }
+    if (i < PLUGIN_SYM_SIZE && s->name) {
+        pthread_mutex_unlock(&impl->lock);
+        return s->func;
+    }
+    func = dlsym(impl->handle, sym);
+    if (!func) {
+        printf("dlsym failed:%s\n", dlerror());
+    } else if (i < PLUGIN_SYM_SIZE && (n = strdup(sym))) {
+        s->func = func;
+        __atomic_store_n(&s->name, n, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&impl->lock);
+    return func;
+}
+
+static struct plugin_slot *plugin_slot_find(struct plugin_manager *pm, const char *name)
+{
+    struct plugin_slot *s;
+    s = __atomic_load_n(&pm->table[plugin_hash(name) & (PLUGIN_HASH_SIZE - 1)], __ATOMIC_ACQUIRE);
+    for (; s; s = __atomic_load_n(&s->next, __ATOMIC_ACQUIRE)) {
+        if (0 == strcmp(s->name, name)) {
+            return s;
+        }
+    }
+    return NULL;
+}
+
 struct plugin_manager *plugin_manager_create()
 {
     struct plugin_manager *pm = CALLOC(1, struct plugin_manager);
@@ -32,103 +196,159 @@ struct plugin_manager *plugin_manager_create()
         printf("malloc failed!\n");
         return NULL;
     }
+    pthread_mutex_init(&pm->lock, NULL);
     INIT_LIST_HEAD(&pm->plugins);
     return pm;
 }
 
 void plugin_manager_destroy(struct plugin_manager *pm)
 {
+    struct plugin_slot *s, *tmp;
     if (!pm) {
         return;
     }
+    list_for_each_entry_safe(s, tmp, &pm->plugins, entry) {
+        plugin_unload(pm, s->name);
+    }
+    pthread_mutex_destroy(&pm->lock);
+    free(pm);
 }
 
-static void *plugin_get_func(struct plugin *p, const char *name)
+struct plugin *plugin_lookup(struct plugin_manager *pm, const char *name)
 {
-    if (!p || !name) {
+    struct plugin_slot *s;
+    if (!pm || !name)
         return NULL;
-    }
-    struct plugin *q = dlsym(p->handle, name);
-    if (!q) {
-        printf("dlsym failed:%s\n", dlerror());
+
+    s = plugin_slot_find(pm, name);
+    if (!s) {
         return NULL;
     }
-    return q;
+    return __atomic_load_n(&s->impl, __ATOMIC_ACQUIRE)->desc;
 }
 
-
-struct plugin *plugin_lookup(struct plugin_manager *pm, const char *name)
+void *plugin_symbol(struct plugin_manager *pm, const char *name, const char *sym)
 {
-    if (!pm || !name)
+    struct plugin_slot *s;
+    if (!pm || !name || !sym)
         return NULL;
 
-    struct list_head* head = NULL;
-    struct plugin* p = NULL;
-
-    list_for_each(head, &pm->plugins) {
-        p = list_entry(head, struct plugin, entry);
-        if (0 == strcmp(p->name, name)) {
-            return plugin_get_func(p, name);
-        }
+    s = plugin_slot_find(pm, name);
+    if (!s) {
+        return NULL;
     }
-
-    return NULL;
+    return plugin_impl_sym(__atomic_load_n(&s->impl, __ATOMIC_ACQUIRE), sym);
 }
 
 struct plugin *plugin_load(struct plugin_manager *pm, const char *path, const char *name)
 {
-    struct plugin *sym = NULL;
-    struct plugin *p = NULL;
-    p = plugin_lookup(pm, name);
-    if (p) {
+    struct plugin_slot *s = NULL;
+    struct plugin_impl *impl = NULL;
+    uint32_t h;
+
+    if (!pm || !path || !name)
+        return NULL;
+
+    pthread_mutex_lock(&pm->lock);
+    s = plugin_slot_find(pm, name);
+    if (s) {
         printf("plugin %s has already loaded!\n", name);
-        return p;
+        pthread_mutex_unlock(&pm->lock);
+        return s->impl->desc;
     }
-    void *handle = dlopen(path, RTLD_LAZY);
-    if (!handle) {
-        printf("dlopen failed: %s\n", dlerror());
+    impl = plugin_impl_open(path, name);
+    if (!impl) {
         goto failed;
     }
-    sym = dlsym(handle, name);
-    if (!sym) {
-        printf("incompatible plugin, dlsym failed: %s\n", dlerror());
+    s = CALLOC(1, struct plugin_slot);
+    if (!s) {
         goto failed;
     }
-    p = CALLOC(1, struct plugin);
-    if (!p) {
+    s->name = strdup(name);
+    s->path = strdup(path);
+    if (!s->name || !s->path) {
         goto failed;
     }
-    p->handle = handle;
-    p->name = strdup(name);
-    p->path = strdup(path);
-    list_add(&p->entry, &pm->plugins);
-    return p;
+    s->impl = impl;
+    h = plugin_hash(name) & (PLUGIN_HASH_SIZE - 1);
+    s->next = pm->table[h];
+    __atomic_store_n(&pm->table[h], s, __ATOMIC_RELEASE);
+    list_add(&s->entry, &pm->plugins);
+    pthread_mutex_unlock(&pm->lock);
+    return impl->desc;
 
 failed:
-    if (handle) dlclose(handle);
-    if (p) {
-        free(p->name);
-        free(p->path);
-        free(p);
+    pthread_mutex_unlock(&pm->lock);
+    plugin_impl_close(impl);
+    if (s) {
+        free(s->name);
+        free(s->path);
+        free(s);
     }
     return NULL;
 }
 
 void plugin_unload(struct plugin_manager *pm, const char *name)
 {
-    struct plugin *p, *tmp;
-    list_for_each_entry_safe(p, tmp, &pm->plugins, entry) {
-        dlclose(p->handle);
-        list_del(&p->entry);
-        free(p->name);
-        free(p->path);
-        free(p);
+    struct plugin_slot **pp, *s = NULL;
+
+    if (!pm || !name)
+        return;
+
+    pthread_mutex_lock(&pm->lock);
+    pp = &pm->table[plugin_hash(name) & (PLUGIN_HASH_SIZE - 1)];
+    for (; *pp; pp = &(*pp)->next) {
+        if (0 == strcmp((*pp)->name, name)) {
+            s = *pp;
+            __atomic_store_n(pp, s->next, __ATOMIC_RELEASE);
+            break;
+        }
+    }
+    if (!s) {
+        pthread_mutex_unlock(&pm->lock);
+        return;
     }
+    list_del(&s->entry);
+    plugin_synchronize(pm);
+    pthread_mutex_unlock(&pm->lock);
+
+    plugin_impl_close(s->impl);
+    free(s->name);
+    free(s->path);
+    free(s);
 }
 
 struct plugin *plugin_reload(struct plugin_manager *pm, const char *path, const char *name)
 {
-    plugin_unload(pm, name);
-    return plugin_load(pm, path, name);
-}
+    struct plugin_slot *s;
+    struct plugin_impl *impl, *old;
+
+    if (!pm || !path || !name)
+        return NULL;
+
+    pthread_mutex_lock(&pm->lock);
+    s = plugin_slot_find(pm, name);
+    if (!s) {
+        pthread_mutex_unlock(&pm->lock);
+        return plugin_load(pm, path, name);
+    }
+    /* the old module keeps serving until the new one is published */
+    impl = plugin_impl_open(path, name);
+    if (!impl) {
+        pthread_mutex_unlock(&pm->lock);
+        return NULL;
+    }
+    if (strcmp(s->path, path)) {
+        char *p = strdup(path);
+        if (p) {
+            free(s->path);
+            s->path = p;
+        }
+    }
+    old = __atomic_exchange_n(&s->impl, impl, __ATOMIC_ACQ_REL);
+    plugin_synchronize(pm);
+    pthread_mutex_unlock(&pm->lock);
 
+    plugin_impl_close(old);
+    return impl->desc;
+}
@@ -50,9 +50,13 @@ struct plugin {
     struct list_head entry;
 };
 
-struct plugin_manager {
-    struct list_head plugins;
-};
+/*
+ * plugin_manager keeps plugins in a hash table by name, each plugin has a
+ * table of resolved symbols. lookups are lock free, load/unload/reload
+ * are serialized and reclaim the replaced module RCU style: the old one
+ * stays mapped until every reader that might see it has left
+ */
+struct plugin_manager;
 
 GEAR_API struct plugin_manager *plugin_manager_create();
 GEAR_API void plugin_manager_destroy(struct plugin_manager *);
@@ -62,13 +66,35 @@ GEAR_API struct plugin *plugin_load(struct plugin_manager *pm, const char *path,
 GEAR_API void plugin_unload(struct plugin_manager *pm, const char *name);
 GEAR_API struct plugin *plugin_reload(struct plugin_manager *pm, const char *path, const char *name);
 
+/*
+ * resolve sym of plugin name, dlsym runs once per symbol per loaded module,
+ * later calls are a hash probe in the plugin's symbol table
+ */
+GEAR_API void *plugin_symbol(struct plugin_manager *pm, const char *name, const char *sym);
+
+/*
+ * pointers from plugin_lookup/plugin_symbol stay valid until
+ * plugin_read_unlock even if the plugin is reloaded or unloaded meanwhile,
+ * without read lock they are valid until the next reload/unload. readers
+ * never block, nesting is fine, pass back the returned index
+ */
+GEAR_API int plugin_read_lock(struct plugin_manager *pm);
+GEAR_API void plugin_read_unlock(struct plugin_manager *pm, int idx);
+
 /*
  * using HOOK_CALL(func, args...), prev/post functions can be hook into func
+ * the next symbol is resolved once per call site
  */
 #define HOOK_CALL(fn, ...)                                \
     ({                                                    \
+        static __typeof__(fn) *__sym;                     \
+        __typeof__(fn) *sym =                             \
+            __atomic_load_n(&__sym, __ATOMIC_ACQUIRE);    \
+        if (!sym) {                                       \
+            sym = (__typeof__(fn) *)dlsym(RTLD_NEXT, #fn);\
+            __atomic_store_n(&__sym, sym, __ATOMIC_RELEASE);\
+        }                                                 \
         fn##_prev(__VA_ARGS__);                           \
-        __typeof__(fn) *sym =  dlsym(RTLD_NEXT, #fn);     \
         if (!sym) {return NULL;}                          \
         sym(__VA_ARGS__);                                 \
         fn##_post(__VA_ARGS__);                           \
@@ -78,9 +104,16 @@ GEAR_API struct plugin *plugin_reload(struct plugin_manager *pm, const char *pat
  * using CALL(fn, args...), you need override api
  */
 #define CALL(fn, ...)                                     \
-    ({__typeof__(fn) *sym = (__typeof__(fn) *)            \
-                            dlsym(RTLD_NEXT, #fn);        \
-     sym(__VA_ARGS__);})
+    ({                                                    \
+        static __typeof__(fn) *__sym;                     \
+        __typeof__(fn) *sym =                             \
+            __atomic_load_n(&__sym, __ATOMIC_ACQUIRE);    \
+        if (!sym) {                                       \
+            sym = (__typeof__(fn) *)dlsym(RTLD_NEXT, #fn);\
+            __atomic_store_n(&__sym, sym, __ATOMIC_RELEASE);\
+        }                                                 \
+        sym(__VA_ARGS__);                                 \
+    })
 
 
 #ifdef __cplusplus
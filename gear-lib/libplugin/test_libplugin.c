@@ -22,6 +22,7 @@
 #include "libplugin.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <pthread.h>
 
 struct plugin_info {
     char *path;
@@ -75,10 +76,45 @@ void foo()
     printf("name=%s, version=%d,%d,%d\n", p->name, p->version.major, p->version.minor, p->version.patch);
 }
 
+static int running = 1;
+
+static void *reader(void *arg)
+{
+    long calls = 0;
+    while (__atomic_load_n(&running, __ATOMIC_ACQUIRE)) {
+        int idx = plugin_read_lock(pm);
+        struct plugin *p = plugin_lookup(pm, "plugin_log");
+        if (p && !plugin_symbol(pm, "plugin_log", "plugin_log")) {
+            printf("plugin_symbol failed!\n");
+        }
+        plugin_read_unlock(pm, idx);
+        calls++;
+    }
+    printf("reader done %ld calls\n", calls);
+    return NULL;
+}
+
+void reload()
+{
+    pthread_t tid;
+    int i;
+    pthread_create(&tid, NULL, reader, NULL);
+    for (i = 0; i < 100; i++) {
+        if (!plugin_reload(pm, p_info[0].path, p_info[0].name)) {
+            printf("plugin_reload failed!\n");
+            break;
+        }
+    }
+    __atomic_store_n(&running, 0, __ATOMIC_RELEASE);
+    pthread_join(tid, NULL);
+    printf("reload %d times\n", i);
+}
+
 int main(int argc, char **argv)
 {
     init();
     foo();
+    reload();
     deinit();
     return 0;
 }
@@ -0,0 +1,86 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#ifndef GEAR_CONFIG_H
+#define GEAR_CONFIG_H
+
+/*
+ * compile time sizes of fixed buffers, set by Kconfig (rtconfig.h on
+ * RT-Thread, sdkconfig.h with CONFIG_ prefix on ESP-IDF) or by -D on the
+ * command line. GEAR_CONFIG_LOW_MEMORY picks the small defaults for
+ * MCU builds, any single size can still be overridden
+ */
+
+#if defined (OS_RTTHREAD)
+#include <rtconfig.h>
+#elif defined (ESP_PLATFORM)
+#include "sdkconfig.h"
+#endif
+
+#if defined (CONFIG_GEAR_CONFIG_LOW_MEMORY) && !defined (GEAR_CONFIG_LOW_MEMORY)
+#define GEAR_CONFIG_LOW_MEMORY
+#endif
+#if defined (CONFIG_GEAR_CONFIG_SDP_LEN_MAX) && !defined (GEAR_CONFIG_SDP_LEN_MAX)
+#define GEAR_CONFIG_SDP_LEN_MAX         CONFIG_GEAR_CONFIG_SDP_LEN_MAX
+#endif
+#if defined (CONFIG_GEAR_CONFIG_RECV_BUF_SIZE) && !defined (GEAR_CONFIG_RECV_BUF_SIZE)
+#define GEAR_CONFIG_RECV_BUF_SIZE       CONFIG_GEAR_CONFIG_RECV_BUF_SIZE
+#endif
+#if defined (CONFIG_GEAR_CONFIG_IPC_MESSAGE_SIZE) && !defined (GEAR_CONFIG_IPC_MESSAGE_SIZE)
+#define GEAR_CONFIG_IPC_MESSAGE_SIZE    CONFIG_GEAR_CONFIG_IPC_MESSAGE_SIZE
+#endif
+#if defined (CONFIG_GEAR_CONFIG_PORTS_MAX) && !defined (GEAR_CONFIG_PORTS_MAX)
+#define GEAR_CONFIG_PORTS_MAX           CONFIG_GEAR_CONFIG_PORTS_MAX
+#endif
+
+#if defined (GEAR_CONFIG_LOW_MEMORY)
+#define GEAR_CONFIG_SDP_LEN_DEFAULT     (1024)
+#define GEAR_CONFIG_RECV_BUF_DEFAULT    (512)
+#define GEAR_CONFIG_IPC_MSG_DEFAULT     (256)
+#define GEAR_CONFIG_PORTS_DEFAULT       (256)
+#else
+#define GEAR_CONFIG_SDP_LEN_DEFAULT     (8192)
+#define GEAR_CONFIG_RECV_BUF_DEFAULT    (2048)
+#define GEAR_CONFIG_IPC_MSG_DEFAULT     (1024)
+#define GEAR_CONFIG_PORTS_DEFAULT       (8192)
+#endif
+
+/* librtsp: generated sdp of one media source, on stack in DESCRIBE */
+#ifndef GEAR_CONFIG_SDP_LEN_MAX
+#define GEAR_CONFIG_SDP_LEN_MAX         GEAR_CONFIG_SDP_LEN_DEFAULT
+#endif
+
+/* libsock, librtsp: stack buffer of each on_recv callback */
+#ifndef GEAR_CONFIG_RECV_BUF_SIZE
+#define GEAR_CONFIG_RECV_BUF_SIZE       GEAR_CONFIG_RECV_BUF_DEFAULT
+#endif
+
+/* libipc: largest message, header included */
+#ifndef GEAR_CONFIG_IPC_MESSAGE_SIZE
+#define GEAR_CONFIG_IPC_MESSAGE_SIZE    GEAR_CONFIG_IPC_MSG_DEFAULT
+#endif
+
+/* libhal: ports returned per protocol by network_get_port_occupied */
+#ifndef GEAR_CONFIG_PORTS_MAX
+#define GEAR_CONFIG_PORTS_MAX           GEAR_CONFIG_PORTS_DEFAULT
+#endif
+
+#endif
@@ -24,6 +24,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 #include <wchar.h>
 
 void *memdup(const void *src, size_t len)
@@ -231,3 +232,112 @@ size_t mbs_to_utf8_ptr(const char *str, size_t len, char **pstr)
     return out_len;
 }
 
+static void *libc_alloc(size_t size, void *arg)
+{
+    return malloc(size);
+}
+
+static void libc_free(void *ptr, size_t size, void *arg)
+{
+    free(ptr);
+}
+
+static struct gear_allocator gear_allocator = {libc_alloc, libc_free, NULL};
+
+void gear_set_allocator(const struct gear_allocator *a)
+{
+    if (a && a->alloc && a->free) {
+        gear_allocator = *a;
+    } else {
+        gear_allocator.alloc = libc_alloc;
+        gear_allocator.free = libc_free;
+        gear_allocator.arg = NULL;
+    }
+}
+
+void *gear_alloc(size_t size)
+{
+    return gear_allocator.alloc(size, gear_allocator.arg);
+}
+
+void *gear_calloc(size_t size)
+{
+    void *p = gear_allocator.alloc(size, gear_allocator.arg);
+    if (p) {
+        memset(p, 0, size);
+    }
+    return p;
+}
+
+void gear_free(void *ptr, size_t size)
+{
+    if (ptr) {
+        gear_allocator.free(ptr, size, gear_allocator.arg);
+    }
+}
+
+static struct mem_account *mem_accounts = NULL;
+
+void mem_account_charge(struct mem_account *a, int64_t bytes, int64_t objects)
+{
+    int64_t now, peak;
+    int zero = 0;
+
+    if (!a) {
+        return;
+    }
+    if (!__atomic_load_n(&a->linked, __ATOMIC_ACQUIRE) &&
+        __atomic_compare_exchange_n(&a->linked, &zero, 1, false,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        a->next = __atomic_load_n(&mem_accounts, __ATOMIC_ACQUIRE);
+        while (!__atomic_compare_exchange_n(&mem_accounts, &a->next, a, true,
+                                            __ATOMIC_RELEASE, __ATOMIC_ACQUIRE)) {
+        }
+    }
+    __atomic_add_fetch(&a->objects, objects, __ATOMIC_RELAXED);
+    now = __atomic_add_fetch(&a->bytes, bytes, __ATOMIC_RELAXED);
+    peak = __atomic_load_n(&a->peak, __ATOMIC_RELAXED);
+    while (now > peak &&
+           !__atomic_compare_exchange_n(&a->peak, &peak, now, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+static void mem_account_snap(const struct mem_account *a, struct mem_account *snap)
+{
+    memset(snap, 0, sizeof(*snap));
+    snap->name = a->name;
+    snap->bytes = __atomic_load_n(&a->bytes, __ATOMIC_RELAXED);
+    snap->peak = __atomic_load_n(&a->peak, __ATOMIC_RELAXED);
+    snap->objects = __atomic_load_n(&a->objects, __ATOMIC_RELAXED);
+    snap->linked = 1;
+}
+
+void mem_account_foreach(void (*cb)(const struct mem_account *a, void *arg), void *arg)
+{
+    struct mem_account snap, *a;
+
+    if (!cb) {
+        return;
+    }
+    for (a = __atomic_load_n(&mem_accounts, __ATOMIC_ACQUIRE); a; a = a->next) {
+        mem_account_snap(a, &snap);
+        cb(&snap, arg);
+    }
+}
+
+int mem_account_get(const char *name, struct mem_account *snap)
+{
+    struct mem_account *a;
+
+    if (!name || !snap) {
+        return -1;
+    }
+    for (a = __atomic_load_n(&mem_accounts, __ATOMIC_ACQUIRE); a; a = a->next) {
+        if (!strcmp(a->name, name)) {
+            mem_account_snap(a, snap);
+            return 0;
+        }
+    }
+    return -1;
+}
@@ -80,6 +80,8 @@ extern "C" {
 #error "OS_UNDEFINED"
 #endif
 
+#include "gear_config.h"
+
 
 /******************************************************************************
  * BASIC MACRO DEFINES
@@ -263,6 +265,44 @@ GEAR_API size_t wcs_to_utf8_ptr(const wchar_t *str, size_t len, char **pstr);
 GEAR_API size_t utf8_to_mbs_ptr(const char *str, size_t len, char **pstr);
 GEAR_API size_t mbs_to_utf8_ptr(const char *str, size_t len, char **pstr);
 
+/*
+ * per module memory accounting, a module keeps a static mem_account and
+ * charges what it allocates per connection or session, negative to give
+ * back. first charge links the account into a global list, lock free
+ */
+struct mem_account {
+    const char *name;
+    int64_t bytes;
+    int64_t peak;
+    int64_t objects;
+    int linked;
+    struct mem_account *next;
+};
+#define MEM_ACCOUNT_INIT(n)     {(n), 0, 0, 0, 0, NULL}
+
+GEAR_API void mem_account_charge(struct mem_account *a, int64_t bytes, int64_t objects);
+/* calls cb with a snapshot of every account charged so far */
+GEAR_API void mem_account_foreach(void (*cb)(const struct mem_account *a, void *arg), void *arg);
+GEAR_API int mem_account_get(const char *name, struct mem_account *snap);
+
+/*
+ * pluggable allocator for hot path objects of gear-lib modules, default is
+ * libc. install it once at startup before modules allocate, objects must
+ * be freed by the allocator they came from. free is given the size passed
+ * to alloc, so a size class allocator needs no per object header
+ */
+struct gear_allocator {
+    void *(*alloc)(size_t size, void *arg);
+    void (*free)(void *ptr, size_t size, void *arg);
+    void *arg;
+};
+
+/* NULL restores libc */
+GEAR_API void gear_set_allocator(const struct gear_allocator *a);
+GEAR_API void *gear_alloc(size_t size);
+GEAR_API void *gear_calloc(size_t size);
+GEAR_API void gear_free(void *ptr, size_t size);
+
 /*
  * simple reflection c version realization
  */
@@ -22,26 +22,25 @@
 #include "libptcp.h"
 #include <stdio.h>
 #include <stdlib.h>
-#include <signal.h>
 #include <errno.h>
 #include <string.h>
-#include <time.h>
 #include <unistd.h>
+#include <time.h>
 #include <pthread.h>
 #include <semaphore.h>
 #include <sys/types.h>
 #include <sys/socket.h>
-#include <sys/epoll.h>
 #include <arpa/inet.h>
+#include <libgevent.h>
 
 #define __STDC_FORMAT_MACROS
 #include <inttypes.h>
 
 #include "pseudotcp.h"
 
-#define MAX_EPOLL_EVENT 16
-
 #define DEFAULT_TCP_MTU 1400 /* Use 1400 because of VPNs and we assume IEE 802.3 */
+#define DEFAULT_BUF_SIZE (1024 * 1024)
+#define RECV_BUF_LEN (64 * 1024)
 
 #ifndef container_of
 #define container_of(ptr, type, member) ({			\
@@ -56,7 +55,12 @@ typedef struct _ptcp_socket_t {
     int                 fd;
     struct sockaddr     sa;
     socklen_t           sa_len;
-    timer_t             timer_id;
+    struct gevent_base  *evbase;    /* own loop thread, started by listen/connect */
+    struct gevent       *ev;
+    struct gevent_wtimer clock;
+    uint64_t            clock_at;   /* armed deadline in monotonic ms, 0 if none */
+    pthread_mutex_t     lock;       /* sock is used by loop and caller thread */
+    pthread_cond_t      cond;       /* broadcast after input and timers, for ptcp_poll */
     sem_t               sem;
 } ptcp_t;
 
@@ -93,121 +97,121 @@ static void _ptcp_on_closed(PseudoTcpSocket *tcp, guint32 error, gpointer data)
     //printf("%s:%d xxxx\n", __func__, __LINE__);
 }
 
-static timer_t timeout_add(uint64_t msec, void (*func)(union sigval sv), void *data)
+/*
+ * arm the wheel timer for the next deadline of pseudotcp, called with lock
+ * held after each batch of input or output. a timer armed earlier is kept,
+ * it may fire early and re-arm itself, so the many packets that only move
+ * the deadline later cost no timer update
+ */
+static void adjust_clock(ptcp_t *ptcp)
 {
-    timer_t timerid = (timer_t)-1;
-    struct sigevent sev;
-
-    memset(&sev, 0, sizeof(struct sigevent));
-
-    sev.sigev_notify = SIGEV_THREAD;
-    sev.sigev_notify_function = func;
-    sev.sigev_value.sival_ptr = data;
+    guint64 timeout = 0;
+    uint64_t now;
 
-    if (timer_create(CLOCK_REALTIME, &sev, &timerid) == -1) {
-        perror("timer_create");
+    if (!pseudo_tcp_socket_get_next_clock(ptcp->sock, &timeout)) {
+        gevent_wtimer_del(ptcp->evbase, &ptcp->clock);
+        ptcp->clock_at = 0;
+        return;
     }
-
-    return timerid;
+    if (ptcp->clock_at && ptcp->clock_at <= timeout) {
+        return;
+    }
+    now = g_get_monotonic_time() / 1000;
+    ptcp->clock_at = timeout;
+    gevent_wtimer_add(ptcp->evbase, &ptcp->clock,
+                    timeout > now ? timeout - now : 0, TIMER_ONESHOT);
 }
 
-static int timeout_del(timer_t tid)
+static void notify_clock(struct gevent_wtimer *t, void *arg)
 {
-    return timer_delete(tid);
+    ptcp_t *ptcp = (ptcp_t *)arg;
+
+    pthread_mutex_lock(&ptcp->lock);
+    ptcp->clock_at = 0;
+    pseudo_tcp_socket_notify_clock(ptcp->sock);
+    adjust_clock(ptcp);
+    pthread_cond_broadcast(&ptcp->cond);
+    pthread_mutex_unlock(&ptcp->lock);
 }
 
-static void clock_reset(ptcp_t *ptcp, uint64_t timeout)
+static PseudoTcpWriteResult _ptcp_write_packet(PseudoTcpSocket *sock,
+                            const char *buffer, uint32_t len, void *user_data)
 {
-    struct itimerspec its;
+    ptcp_t *ptcp = user_data;
+    ssize_t res;
 
-    its.it_value.tv_sec = timeout / 1000; 
-    its.it_value.tv_nsec = timeout % 1000 * 1000000;
-    its.it_interval.tv_sec = 0; 
-    its.it_interval.tv_nsec = 0; 
-    if (timer_settime(ptcp->timer_id, 0, &its, NULL) < 0) {
-        perror("timer_settime");
-        printf("time = %ld s, %ld ns\n", 
-                    its.it_value.tv_sec, its.it_value.tv_nsec );
+    if (pseudo_tcp_socket_is_closed(ptcp->sock)) {
+        printf("Stream: pseudo TCP socket got destroyed.");
+        return WR_FAIL;
     }
+    res = sendto(ptcp->fd, buffer, len, 0, &ptcp->sa, sizeof(struct sockaddr));
+    if (res < (ssize_t)len) {
+        printf("sendto len=%d, res=%d: %s\n", (int)len, (int)res, strerror(errno));
+        return WR_FAIL;
+    }
+    return WR_SUCCESS;
 }
 
-static void adjust_clock(ptcp_t *ptcp)
+/* drain all queued datagrams, then update the clock once */
+static void ptcp_on_recv(int fd, void *arg)
 {
-    PseudoTcpSocket *sock = ptcp->sock;
-    guint64 timeout = 0;
+    ptcp_t *ptcp = (ptcp_t *)arg;
+    char buf[RECV_BUF_LEN];
+    struct sockaddr sa;
+    socklen_t sa_len;
+    ssize_t res;
 
-    if (pseudo_tcp_socket_get_next_clock (sock, &timeout)) {
-        timeout -= g_get_monotonic_time () / 1000;
-        //printf("Socket %p: Adjusting clock to %" PRIu64 " ms\n", sock, timeout);
-        clock_reset(ptcp, timeout);
-#if 0
-        if (left_clock != 0)
-                g_source_remove (left_clock);
-        left_clock = g_timeout_add (timeout, notify_clock, sock);
-#endif
-    } else {
-            g_debug ("Socket %p should be destroyed, it's done", sock);
+    pthread_mutex_lock(&ptcp->lock);
+    while (1) {
+        sa_len = sizeof(sa);
+        res = recvfrom(fd, buf, sizeof(buf), MSG_DONTWAIT, &sa, &sa_len);
+        if (res == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                printf("recvfrom error: %s\n", strerror(errno));
+            }
+            break;
+        }
+        memcpy(&ptcp->sa, &sa, sa_len);
+        ptcp->sa_len = sa_len;
+        pseudo_tcp_socket_notify_packet(ptcp->sock, buf, res);
     }
+    adjust_clock(ptcp);
+    pthread_cond_broadcast(&ptcp->cond);
+    pthread_mutex_unlock(&ptcp->lock);
 }
 
-static PseudoTcpWriteResult _ptcp_write_packet(PseudoTcpSocket *sock,
-                            const char *buffer, uint32_t len, void *user_data)
+static void ptcp_on_error(int fd, void *arg)
 {
-    ptcp_t *ptcp = user_data;
-    if (pseudo_tcp_socket_is_closed(ptcp->sock)) {
-        printf("Stream: pseudo TCP socket got destroyed.");
-    } else {
-        ssize_t res;
-        res = sendto(ptcp->fd, buffer, len, 0, &ptcp->sa, sizeof(struct sockaddr));
-        if (-1 == res) {
-            printf("sendto error: %s\n", strerror(errno));
-        }
-        struct sockaddr_in *si = (struct sockaddr_in *)&ptcp->sa;
-        char ip[16];
-        sock_addr_ntop(ip, sizeof(ip), si->sin_addr.s_addr);
-        //printf("%s:%d sendto res=%zu, ip=%s, port=%d\n", __func__, __LINE__, res, ip, ntohs(si->sin_port));
-        adjust_clock(ptcp);
-        if (res < len) {
-            printf("sendto len=%d, res=%d\n", (int)len, (int)res);
-            return WR_FAIL;
-        }
-        return WR_SUCCESS;
-    }
-    return WR_FAIL;
+    printf("%s:%d fd=%d error\n", __func__, __LINE__, fd);
 }
 
-static PseudoTcpWriteResult ptcp_read(ptcp_t *ptcp, void *buf, size_t len)
+static int ptcp_loop_start(ptcp_t *ptcp)
 {
-    ssize_t res;
-#define RECV_BUF_LEN (64*1024)
-    char rbuf[RECV_BUF_LEN] = {0};
-    ptcp->sa_len = sizeof(struct sockaddr);
-    res = recvfrom(ptcp->fd, rbuf, sizeof(rbuf), MSG_DONTWAIT, &ptcp->sa, &ptcp->sa_len);
-    if (-1 == res) {
-        printf("recvfrom error: %s\n", strerror(errno));
-        return WR_FAIL;
+    if (ptcp->ev) {
+        return 0;
     }
-    struct sockaddr_in *si = (struct sockaddr_in *)&ptcp->sa;
-    char ip[16];
-    sock_addr_ntop(ip, sizeof(ip), si->sin_addr.s_addr);
-    //printf("%s:%d recvfrom res=%zu, ip=%s, port=%d\n", __func__, __LINE__, res, ip, ntohs(si->sin_port));
-    if (TRUE == pseudo_tcp_socket_notify_packet(ptcp->sock, rbuf, res)) {
-        adjust_clock(ptcp);
-        return WR_SUCCESS;
+    ptcp->ev = gevent_create(ptcp->fd, ptcp_on_recv, NULL, ptcp_on_error, ptcp);
+    if (!ptcp->ev || -1 == gevent_add(ptcp->evbase, &ptcp->ev)) {
+        printf("gevent_add failed!\n");
+        return -1;
     }
-    return WR_FAIL;
+    return gevent_base_loop_start(ptcp->evbase);
 }
 
-static void notify_clock(union sigval sv)
+static void ptcp_set_udp_buffer(int fd, int optname, int size)
 {
-    void *data = (void *)sv.sival_ptr;
-    ptcp_t *ptcp = (ptcp_t *)data;
-    pseudo_tcp_socket_notify_clock(ptcp->sock);
-    adjust_clock(ptcp);
+    if (-1 == setsockopt(fd, SOL_SOCKET, optname, &size, sizeof(size))) {
+        printf("setsockopt %d failed: %s\n", optname, strerror(errno));
+    }
 }
 
 ptcp_socket_t ptcp_socket_by_fd(int fd)
 {
+    pthread_condattr_t attr;
+
     if (fd <= 0) {
         printf("%s fd invalid!\n", __func__);
         return NULL;
@@ -229,13 +233,29 @@ ptcp_socket_t ptcp_socket_by_fd(int fd)
     PseudoTcpSocket *sock = pseudo_tcp_socket_new(1, &pseudo_tcp_callbacks);
     if (!sock) {
         printf("pseudo_tcp_socket_new failed!\n");
+        free(ptcp);
+        return NULL;
+    }
+    ptcp->evbase = gevent_base_create();
+    if (!ptcp->evbase) {
+        printf("gevent_base_create failed!\n");
+        pseudo_tcp_socket_delete(sock);
+        free(ptcp);
         return NULL;
     }
     pseudo_tcp_socket_notify_mtu(sock, DEFAULT_TCP_MTU);
+    pseudo_tcp_socket_set_buffers(sock, DEFAULT_BUF_SIZE, DEFAULT_BUF_SIZE);
+    ptcp_set_udp_buffer(fd, SO_SNDBUF, DEFAULT_BUF_SIZE);
+    ptcp_set_udp_buffer(fd, SO_RCVBUF, DEFAULT_BUF_SIZE);
     ptcp->sock = sock;
     ptcp->fd = fd;
+    pthread_mutex_init(&ptcp->lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&ptcp->cond, &attr);
+    pthread_condattr_destroy(&attr);
     sem_init(&ptcp->sem, 0, 0);
-    ptcp->timer_id = timeout_add(0, notify_clock, ptcp);
+    gevent_wtimer_init(&ptcp->clock, notify_clock, ptcp);
     printf("%s:%d ptcp_socket success ptcp=%p, fd = %d\n", __func__, __LINE__, ptcp, ptcp->fd);
     return &ptcp->fd;
 }
@@ -255,6 +275,51 @@ int ptcp_get_socket_fd(ptcp_socket_t sock)
     return ptcp->fd;
 }
 
+int ptcp_setsockopt(ptcp_socket_t sock, int level, int optname,
+                const void *optval, socklen_t optlen)
+{
+    ptcp_t *ptcp = container_of(sock, ptcp_t, fd);
+    const PseudoTcpCongestionOps *ops;
+    char name[16];
+    gboolean ok;
+    int size;
+
+    if (level == IPPROTO_TCP && optname == TCP_CONGESTION) {
+        if (!optval || optlen == 0) {
+            errno = EINVAL;
+            return -1;
+        }
+        snprintf(name, sizeof(name), "%.*s", (int)optlen, (const char *)optval);
+        if (!(ops = pseudo_tcp_congestion_control_find(name))) {
+            errno = ENOENT;
+            return -1;
+        }
+        pthread_mutex_lock(&ptcp->lock);
+        pseudo_tcp_socket_set_congestion_control(ptcp->sock, ops);
+        pthread_mutex_unlock(&ptcp->lock);
+        return 0;
+    }
+    if (level != SOL_SOCKET || (optname != SO_SNDBUF && optname != SO_RCVBUF) ||
+        !optval || optlen < sizeof(int) || (size = *(const int *)optval) <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    pthread_mutex_lock(&ptcp->lock);
+    if (optname == SO_SNDBUF) {
+        ok = pseudo_tcp_socket_set_buffers(ptcp->sock, size, 0);
+    } else {
+        ok = pseudo_tcp_socket_set_buffers(ptcp->sock, 0, size);
+    }
+    pthread_mutex_unlock(&ptcp->lock);
+    if (!ok) {
+        errno = EISCONN;
+        return -1;
+    }
+    /* let the kernel queue a window of datagrams too */
+    ptcp_set_udp_buffer(ptcp->fd, optname, size);
+    return 0;
+}
+
 int ptcp_bind(ptcp_socket_t sock, const struct sockaddr *sa, socklen_t addrlen)
 {
     ptcp_t *ptcp = container_of(sock, ptcp_t, fd);
@@ -269,79 +334,20 @@ int ptcp_bind(ptcp_socket_t sock, const struct sockaddr *sa, socklen_t addrlen)
     return 0;
 }
 
-static void ptcp_event_read(void *arg)
-{
-    char buf[10240] = {0};
-    ptcp_t *ptcp = (ptcp_t *)arg;
-    if (WR_SUCCESS == ptcp_read(ptcp, buf, sizeof(buf))) {
-    }
-}
-
-static void *ptcp_event_loop(void *arg)
-{
-    ptcp_t *ptcp = (ptcp_t *)arg;
-    int epfd;
-    int ret, i;
-    struct epoll_event evbuf[MAX_EPOLL_EVENT];
-    struct epoll_event event;
-
-    int fd = ptcp->fd;
-    epfd = epoll_create(1);
-    if (epfd == -1) {
-        perror("epoll_create");
-        return NULL;
-    }
-
-    memset(&event, 0, sizeof(event));
-    event.data.ptr = ptcp;
-    event.events = EPOLLIN | EPOLLET;
-
-    if (-1 == epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &event)) {
-        perror("epoll_ctl");
-        close(epfd);
-        return NULL;
-    }
-
-    while (1) {
-        ret = epoll_wait(epfd, evbuf, MAX_EPOLL_EVENT, -1);
-        if (ret == -1) {
-            perror("epoll_wait");
-            continue;
-        }
-        for (i = 0; i < ret; i++) {
-            if (evbuf[i].data.fd == -1)
-                continue;
-            if (evbuf[i].events & (EPOLLERR | EPOLLHUP)) {
-                perror("epoll error");
-            }
-            if (evbuf[i].events & EPOLLOUT) {
-                perror("epoll out");
-            }
-            if (evbuf[i].events & EPOLLIN) {
-                ptcp_event_read(evbuf[i].data.ptr);
-            }
-        }
-    }
-    return NULL;
-}
-
 int ptcp_listen(ptcp_socket_t sock, int backlog)
 {
     ptcp_t *ptcp = container_of(sock, ptcp_t, fd);
-    pthread_t tid;
-    pthread_create(&tid, NULL, ptcp_event_loop, ptcp);
-    return 0;
+    return ptcp_loop_start(ptcp);
 }
 
 int ptcp_accept(ptcp_socket_t sock, struct sockaddr *addr, socklen_t *addrlen)
 {
     ptcp_t *ptcp = container_of(sock, ptcp_t, fd);
     sem_wait(&ptcp->sem);
+    pthread_mutex_lock(&ptcp->lock);
     *addrlen = ptcp->sa_len;
     memcpy(addr, &ptcp->sa, *addrlen);
-    struct sockaddr_in *si = (struct sockaddr_in *)&ptcp->sa;
-    char ip[16];
-    sock_addr_ntop(ip, sizeof(ip), si->sin_addr.s_addr);
+    pthread_mutex_unlock(&ptcp->lock);
     return ptcp->fd;
 }
 
@@ -352,10 +358,18 @@ int ptcp_close_by_fd(ptcp_socket_t sock, int fd)
         printf("invalid paraments\n");
         return -1;
     }
+    pthread_mutex_lock(&ptcp->lock);
     pseudo_tcp_socket_close(ptcp->sock, true);
+    pthread_mutex_unlock(&ptcp->lock);
+    if (ptcp->evbase->thread) {
+        gevent_base_loop_stop(ptcp->evbase);
+    }
+    gevent_wtimer_del(ptcp->evbase, &ptcp->clock);
+    gevent_base_destroy(ptcp->evbase);
     pseudo_tcp_socket_delete(ptcp->sock);
     sem_destroy(&ptcp->sem);
-    timeout_del(ptcp->timer_id);
+    pthread_cond_destroy(&ptcp->cond);
+    pthread_mutex_destroy(&ptcp->lock);
     free(ptcp);
     return 0;
 }
@@ -371,17 +385,21 @@ int ptcp_close(ptcp_socket_t sock)
 int ptcp_connect(ptcp_socket_t sock, const struct sockaddr *sa, socklen_t addrlen)
 {
     ptcp_t *ptcp = container_of(sock, ptcp_t, fd);
-    pthread_t tid;
     if (-1 == connect(ptcp->fd, sa, addrlen)) {
         printf("connect fd=%d error: %s\n", ptcp->fd, strerror(errno));
         return -1;
     }
     memcpy(&ptcp->sa, sa, addrlen);
 
-    pthread_create(&tid, NULL, ptcp_event_loop, ptcp);
+    if (ptcp_loop_start(ptcp) < 0) {
+        return -1;
+    }
+    pthread_mutex_lock(&ptcp->lock);
     if (FALSE == pseudo_tcp_socket_connect(ptcp->sock)) {
         printf("pseudo_tcp_socket_connect failed!\n");
     }
+    adjust_clock(ptcp);
+    pthread_mutex_unlock(&ptcp->lock);
     sem_wait(&ptcp->sem);
     return 0;
 }
@@ -389,11 +407,80 @@ int ptcp_connect(ptcp_socket_t sock, const struct sockaddr *sa, socklen_t addrle
 ssize_t ptcp_recv(ptcp_socket_t sock, void *buf, size_t len, int flags)
 {
     ptcp_t *ptcp = container_of(sock, ptcp_t, fd);
-    return pseudo_tcp_socket_recv(ptcp->sock, buf, len);
+    ssize_t ret;
+
+    pthread_mutex_lock(&ptcp->lock);
+    ret = pseudo_tcp_socket_recv(ptcp->sock, buf, len);
+    if (ret == -1) {
+        errno = pseudo_tcp_socket_get_error(ptcp->sock);
+    }
+    /* reading may reopen the window and send an ack */
+    adjust_clock(ptcp);
+    pthread_mutex_unlock(&ptcp->lock);
+    return ret;
 }
 
 ssize_t ptcp_send(ptcp_socket_t sock, const void *buf, size_t len, int flags)
 {
     ptcp_t *ptcp = container_of(sock, ptcp_t, fd);
-    return pseudo_tcp_socket_send(ptcp->sock, buf, len);
+    ssize_t ret;
+
+    pthread_mutex_lock(&ptcp->lock);
+    ret = pseudo_tcp_socket_send(ptcp->sock, buf, len);
+    if (ret == -1) {
+        errno = pseudo_tcp_socket_get_error(ptcp->sock);
+    }
+    adjust_clock(ptcp);
+    pthread_mutex_unlock(&ptcp->lock);
+    return ret;
+}
+
+static int ptcp_poll_ready(ptcp_t *ptcp, int events)
+{
+    int ready = 0;
+
+    if (pseudo_tcp_socket_is_closed(ptcp->sock)) {
+        return -1;
+    }
+    if ((events & PTCP_POLLIN) &&
+        (pseudo_tcp_socket_get_available_bytes(ptcp->sock) > 0 ||
+         pseudo_tcp_socket_is_closed_remotely(ptcp->sock))) {
+        ready |= PTCP_POLLIN;
+    }
+    if ((events & PTCP_POLLOUT) &&
+        pseudo_tcp_socket_get_available_send_space(ptcp->sock) > 0) {
+        ready |= PTCP_POLLOUT;
+    }
+    return ready;
+}
+
+int ptcp_poll(ptcp_socket_t sock, int events, int timeout_ms)
+{
+    ptcp_t *ptcp = container_of(sock, ptcp_t, fd);
+    struct timespec ts;
+    int ready;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    if (timeout_ms > 0) {
+        ts.tv_sec += timeout_ms / 1000;
+        ts.tv_nsec += (timeout_ms % 1000) * 1000000L;
+        if (ts.tv_nsec >= 1000000000L) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000L;
+        }
+    }
+    pthread_mutex_lock(&ptcp->lock);
+    while (!(ready = ptcp_poll_ready(ptcp, events)) && timeout_ms != 0) {
+        if (timeout_ms < 0) {
+            pthread_cond_wait(&ptcp->cond, &ptcp->lock);
+        } else if (ETIMEDOUT == pthread_cond_timedwait(&ptcp->cond, &ptcp->lock, &ts)) {
+            ready = ptcp_poll_ready(ptcp, events);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&ptcp->lock);
+    if (ready < 0) {
+        errno = ENOTCONN;
+    }
+    return ready;
 }
@@ -25,6 +25,11 @@
 #include <stdio.h>
 #include <arpa/inet.h>
 
+/* same value as linux netinet/tcp.h, which clashes with pseudotcp.h */
+#ifndef TCP_CONGESTION
+#define TCP_CONGESTION  13
+#endif
+
 #define LIBPTCP_VERSION "0.0.1"
 
 #ifdef __cplusplus
@@ -38,6 +43,14 @@ ptcp_socket_t ptcp_socket_by_fd(int fd);
 int ptcp_get_socket_fd(ptcp_socket_t sock);
 int ptcp_close(ptcp_socket_t sock);
 int ptcp_close_by_fd(ptcp_socket_t sock, int fd);
+/*
+ * SOL_SOCKET SO_SNDBUF/SO_RCVBUF before listen/connect, default 1MB.
+ * a receive buffer over 64KB is advertised with window scaling.
+ * IPPROTO_TCP TCP_CONGESTION at any time: "cubic" (default), "reno" or
+ * "bbr-lite", ENOENT for others
+ */
+int ptcp_setsockopt(ptcp_socket_t sock, int level, int optname,
+                const void *optval, socklen_t optlen);
 int ptcp_bind(ptcp_socket_t sock, const struct sockaddr *sa, socklen_t addrlen);
 int ptcp_listen(ptcp_socket_t sock, int backlog);
 int ptcp_accept(ptcp_socket_t sock, struct sockaddr *addr, socklen_t *addrlen);
@@ -45,6 +58,15 @@ int ptcp_connect(ptcp_socket_t sock, const struct sockaddr *sa, socklen_t addrle
 ssize_t ptcp_send(ptcp_socket_t sock, const void *buf, size_t len, int flags);
 ssize_t ptcp_recv(ptcp_socket_t sock, void *buf, size_t len, int flags);
 
+#define PTCP_POLLIN     0x01    /* data to read, or closed by peer */
+#define PTCP_POLLOUT    0x04    /* send buffer has space */
+/*
+ * wait until send/recv would not return EWOULDBLOCK, timeout_ms < 0 waits
+ * forever and 0 only checks. return ready events, 0 on timeout, or -1 with
+ * errno ENOTCONN once the socket is closed
+ */
+int ptcp_poll(ptcp_socket_t sock, int events, int timeout_ms);
+
 #ifdef __cplusplus
 }
 #endif
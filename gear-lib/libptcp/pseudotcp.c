@@ -76,8 +76,8 @@
 #  include <arpa/inet.h>
 #endif
 
-#include "glist.h"
-#include "gqueue.h"
+#include <libposix.h>
+#include <librbtree.h>
 #include "gfake.h"
 
 #include "pseudotcp.h"
@@ -143,7 +143,7 @@ const guint16 PACKET_MAXIMUMS[] = {
 //  8 |                     Acknowledgment Number                     |
 //    +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
 //    |               |   |U|A|P|R|S|F|                               |
-// 12 |    Control    |   |R|C|S|S|Y|I|            Window             |
+// 12 |  SACK blocks  |   |R|C|S|S|Y|I|            Window             |
 //    |               |   |G|K|H|T|N|N|                               |
 //    +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
 // 16 |                       Timestamp sending                       |
@@ -153,10 +153,15 @@ const guint16 PACKET_MAXIMUMS[] = {
 // 24 |                             data                              |
 //    +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
 //
+// Once both ends sent TCP_OPT_SACK, a pure ACK may carry up to
+// MAX_SACK_BLOCKS [left, right) sequence pairs of out of order data ahead
+// of its (empty) payload; their number goes in the first header byte, which
+// older peers always send as 0.
 //////////////////////////////////////////////////////////////////////
 
 #define MAX_SEQ 0xFFFFFFFF
 #define HEADER_SIZE 24
+#define MAX_SACK_BLOCKS 4
 
 #define PACKET_OVERHEAD (HEADER_SIZE + UDP_HEADER_SIZE + \
       IP_HEADER_SIZE + JINGLE_HEADER_SIZE)
@@ -170,6 +175,8 @@ const guint16 PACKET_MAXIMUMS[] = {
 
 #define DEFAULT_RCV_BUF_SIZE (60 * 1024)
 #define DEFAULT_SND_BUF_SIZE (90 * 1024)
+/* in-flight data must stay below the limit asserted in transmit() */
+#define MAX_BUF_SIZE (64 * 1024 * 1024)
 
 /* NOTE: This must fit in 8 bits. This is used on the wire. */
 typedef enum {
@@ -178,6 +185,7 @@ typedef enum {
   TCP_OPT_NOOP = 1,  /* no-op */
   TCP_OPT_MSS = 2,  /* maximum segment size */
   TCP_OPT_WND_SCALE = 3,  /* window scale factor */
+  TCP_OPT_SACK = 4,  /* SACK permitted (RFC 2018) */
   /* libnice extensions: */
   TCP_OPT_FIN_ACK = 254,  /* FIN-ACK support */
 } TcpOption;
@@ -435,16 +443,23 @@ typedef struct {
   const gchar * data;
   guint32 len;
   guint32 tsval, tsecr;
+  guint8 nsack;
+  guint32 sack[2 * MAX_SACK_BLOCKS];
 } Segment;
 
 typedef struct {
   guint32 seq, len;
   guint8 xmit;
   TcpFlags flags;
+  gboolean sacked;          /* covered by a SACK block from the peer */
+  guint32 recovery;         /* recovery episode it was last resent in */
+  struct list_head entry;   /* in slist until acked */
+  struct list_head unsent;  /* in unsent_slist while xmit == 0 */
 } SSegment;
 
+/* a merged range of out of order data, [start, last] relative to rcv_base */
 typedef struct {
-  guint32 seq, len;
+  struct interval_tree_node it;
 } RSegment;
 
 /**
@@ -477,14 +492,16 @@ struct _PseudoTcpSocketPrivate {
   guint32 last_traffic;
 
   // Incoming data
-  GList *rlist;
+  struct rb_root_cached rtree;  /* out of order ranges, disjoint */
+  guint32 rcv_base;
+  RSegment *rlatest;  /* range holding the latest out of order segment */
   guint32 rbuf_len, rcv_nxt, rcv_wnd, lastrecv;
   guint8 rwnd_scale; // Window scale factor
   PseudoTcpFifo rbuf;
 
   // Outgoing data
-  GQueue slist;
-  GQueue unsent_slist;
+  struct list_head slist;
+  struct list_head unsent_slist;
   guint32 sbuf_len, snd_nxt, snd_wnd, lastsend;
   guint32 snd_una;  /* oldest unacknowledged sequence number */
   guint8 swnd_scale; // Window scale factor
@@ -502,9 +519,18 @@ struct _PseudoTcpSocketPrivate {
   guint32 rx_rttvar, rx_srtt, rx_rto;
 
   // Congestion avoidance, Fast retransmit/recovery, Delayed ACKs
-  guint32 ssthresh, cwnd;
+  PseudoTcpCongestion cc;
+  const PseudoTcpCongestionOps *cc_ops;
   guint8 dup_acks;
   guint32 recover;
+
+  // SACK scoreboard, only used if sack_ok
+  guint32 sacked_bytes;  /* in flight but sacked */
+  guint32 high_sacked;   /* right edge of the highest sacked segment */
+  guint32 rtx_bytes;     /* resent in this recovery and not yet sacked */
+  guint32 recovery;      /* recovery episode counter */
+  SSegment *sack_hint;   /* where the last SACK block ended */
+  SSegment *rtx_hint;    /* last hole resent in this recovery */
   guint32 t_ack;  /* time a delayed ack was scheduled; 0 if no acks scheduled */
 
   gboolean use_nagling;
@@ -522,6 +548,10 @@ struct _PseudoTcpSocketPrivate {
    * option) to enable correct FIN-ACK connection termination. Defaults to
    * TRUE unless no compatible option is received. */
   gboolean support_fin_ack;
+
+  /* Selective acknowledgements: offered, and agreed with the peer. */
+  gboolean support_sack;
+  gboolean sack_ok;
 };
 
 #define LARGER(a,b) (((a) - (b) - 1) < (G_MAXUINT32 >> 1))
@@ -562,6 +592,7 @@ static gboolean parse (PseudoTcpSocket *self,
 static gboolean process(PseudoTcpSocket *self, Segment *seg);
 static gboolean transmit(PseudoTcpSocket *self, SSegment *sseg, guint32 now);
 static void attempt_send(PseudoTcpSocket *self, SendFlags sflags);
+static PseudoTcpCongestion *cc_update (PseudoTcpSocket *self);
 static void closedown (PseudoTcpSocket *self, guint32 err,
     ClosedownSource source);
 static void adjustMTU(PseudoTcpSocket *self);
@@ -773,21 +804,22 @@ pseudo_tcp_socket_finalize (GObject *object)
 {
   PseudoTcpSocket *self = PSEUDO_TCP_SOCKET (object);
   PseudoTcpSocketPrivate *priv = self->priv;
-  GList *i;
-  SSegment *sseg;
+  SSegment *sseg, *snext;
+  RSegment *rseg, *rnext;
+  struct rb_root *rroot;
 
   if (priv == NULL)
     return;
 
-  while ((sseg = g_queue_pop_head (&priv->slist)))
+  list_for_each_entry_safe (sseg, snext, &priv->slist, entry) {
+    list_del (&sseg->entry);
     g_slice_free (SSegment, sseg);
-  g_queue_clear (&priv->unsent_slist);
-  for (i = priv->rlist; i; i = i->next) {
-    RSegment *rseg = i->data;
+  }
+  INIT_LIST_HEAD (&priv->unsent_slist);
+  rroot = &priv->rtree.rb_root;
+  rbtree_postorder_for_each_entry_safe (rseg, rnext, rroot, it.rb) {
     g_slice_free (RSegment, rseg);
   }
-  g_list_free (priv->rlist);
-  priv->rlist = NULL;
 
   pseudo_tcp_fifo_clear (&priv->rbuf);
   pseudo_tcp_fifo_clear (&priv->sbuf);
@@ -822,8 +854,9 @@ pseudo_tcp_socket_init (PseudoTcpSocket *obj)
 
   priv->state = TCP_LISTEN;
   priv->conv = 0;
-  g_queue_init (&priv->slist);
-  g_queue_init (&priv->unsent_slist);
+  INIT_LIST_HEAD (&priv->slist);
+  INIT_LIST_HEAD (&priv->unsent_slist);
+  priv->rtree = RB_ROOT_CACHED;
   priv->rcv_wnd = priv->rbuf_len;
   priv->rwnd_scale = priv->swnd_scale = 0;
   priv->snd_nxt = 0;
@@ -840,8 +873,11 @@ pseudo_tcp_socket_init (PseudoTcpSocket *obj)
 
   priv->rto_base = 0;
 
-  priv->cwnd = 2 * priv->mss;
-  priv->ssthresh = priv->rbuf_len;
+  priv->cc.cwnd = 2 * priv->mss;
+  priv->cc.ssthresh = priv->rbuf_len;
+  priv->cc.mss = priv->mss;
+  priv->cc_ops = &pseudo_tcp_congestion_cubic;
+  priv->cc_ops->init (&priv->cc, 0);
   priv->lastrecv = priv->lastsend = priv->last_traffic = 0;
   priv->bOutgoing = FALSE;
 
@@ -858,6 +894,7 @@ pseudo_tcp_socket_init (PseudoTcpSocket *obj)
 
   priv->support_wnd_scale = TRUE;
   priv->support_fin_ack = TRUE;
+  priv->support_sack = TRUE;
 }
 
 PseudoTcpSocket *pseudo_tcp_socket_new (guint32 conversation,
@@ -893,7 +930,7 @@ static void
 queue_connect_message (PseudoTcpSocket *self)
 {
   PseudoTcpSocketPrivate *priv = self->priv;
-  guint8 buf[8];
+  guint8 buf[16];
   gsize size = 0;
 
   buf[size++] = CTL_CONNECT;
@@ -910,6 +947,12 @@ queue_connect_message (PseudoTcpSocket *self)
     buf[size++] = 0;  /* currently unused */
   }
 
+  if (priv->support_sack) {
+    buf[size++] = TCP_OPT_SACK;
+    buf[size++] = 1;
+    buf[size++] = 0;  /* currently unused */
+  }
+
   priv->snd_wnd = size;
 
   queue (self, (char *) buf, size, FLAG_CTL);
@@ -961,6 +1004,49 @@ pseudo_tcp_socket_notify_mtu(PseudoTcpSocket *self, guint16 mtu)
   }
 }
 
+gboolean
+pseudo_tcp_socket_set_buffers(PseudoTcpSocket *self, guint32 snd_buf,
+    guint32 rcv_buf)
+{
+  PseudoTcpSocketPrivate *priv = self->priv;
+
+  if (priv->state != TCP_LISTEN) {
+    priv->error = EISCONN;
+    return FALSE;
+  }
+  if (snd_buf)
+    resize_send_buffer (self, min (snd_buf, MAX_BUF_SIZE));
+  if (rcv_buf)
+    resize_receive_buffer (self, min (rcv_buf, MAX_BUF_SIZE));
+
+  return TRUE;
+}
+
+void
+pseudo_tcp_socket_set_congestion_control(PseudoTcpSocket *self,
+    const PseudoTcpCongestionOps *ops)
+{
+  PseudoTcpSocketPrivate *priv = self->priv;
+
+  priv->cc_ops = ops;
+  memset (priv->cc.state, 0, sizeof(priv->cc.state));
+  ops->init (cc_update (self), get_current_time (self));
+}
+
+gboolean
+pseudo_tcp_socket_set_sack(PseudoTcpSocket *self, gboolean enabled)
+{
+  PseudoTcpSocketPrivate *priv = self->priv;
+
+  if (priv->state != TCP_LISTEN) {
+    priv->error = EISCONN;
+    return FALSE;
+  }
+  priv->support_sack = enabled;
+
+  return TRUE;
+}
+
 void
 pseudo_tcp_socket_notify_clock(PseudoTcpSocket *self)
 {
@@ -993,27 +1079,23 @@ pseudo_tcp_socket_notify_clock(PseudoTcpSocket *self)
   // Check if it's time to retransmit a segment
   if (priv->rto_base &&
       (time_diff(priv->rto_base + priv->rx_rto, now) <= 0)) {
-    if (g_queue_get_length (&priv->slist) == 0) {
+    if (list_empty (&priv->slist)) {
       g_assert_not_reached ();
     } else {
       // Note: (priv->slist.front().xmit == 0)) {
       // retransmit segments
-      guint32 nInFlight;
       guint32 rto_limit;
 
       DEBUG (PSEUDO_TCP_DEBUG_NORMAL, "timeout retransmit (rto: %u) "
           "(rto_base: %u) (now: %u) (dup_acks: %u)",
           priv->rx_rto, priv->rto_base, now, (guint) priv->dup_acks);
 
-      if (!transmit(self, g_queue_peek_head (&priv->slist), now)) {
+      if (!transmit(self, list_first_entry (&priv->slist, SSegment, entry), now)) {
         closedown (self, ECONNABORTED, CLOSEDOWN_LOCAL);
         return;
       }
 
-      nInFlight = priv->snd_nxt - priv->snd_una;
-      priv->ssthresh = max(nInFlight / 2, 2 * priv->mss);
-      //LOG(LS_INFO) << "priv->ssthresh: " << priv->ssthresh << "  nInFlight: " << nInFlight << "  priv->mss: " << priv->mss;
-      priv->cwnd = priv->mss;
+      priv->cc_ops->on_timeout (cc_update (self), now);
 
       // Back off retransmit timer.  Note: the limit is lower when connecting.
       rto_limit = (priv->state < TCP_ESTABLISHED) ? DEF_RTO : MAX_RTO;
@@ -1374,11 +1456,224 @@ pseudo_tcp_socket_get_error(PseudoTcpSocket *self)
 // Internal Implementation
 //
 
+//
+// Out of order ranges, merged in an interval tree
+//
+
+static unsigned long
+rtree_key (PseudoTcpSocketPrivate *priv, guint32 seq)
+{
+  return (guint32) (seq - priv->rcv_base);
+}
+
+/* Slide rcv_base up to rcv_nxt so keys stay small, shifting the stored
+ * ranges by the same amount; they all lie ahead of rcv_nxt. */
+static void
+rtree_rebase (PseudoTcpSocketPrivate *priv)
+{
+  unsigned long delta = rtree_key (priv, priv->rcv_nxt);
+  struct rb_node *first = rb_first_cached (&priv->rtree);
+  RSegment *rseg, *next;
+
+  if (first && (delta < (1UL << 30) ||
+      rb_entry (first, RSegment, it.rb)->it.start < delta))
+    return;
+  rbtree_postorder_for_each_entry_safe (rseg, next, &priv->rtree.rb_root,
+      it.rb) {
+    rseg->it.start -= delta;
+    rseg->it.last -= delta;
+    rseg->it.__subtree_last -= delta;
+  }
+  priv->rcv_base = priv->rcv_nxt;
+}
+
+static void
+rtree_remove (PseudoTcpSocketPrivate *priv, RSegment *rseg)
+{
+  interval_tree_remove (&rseg->it, &priv->rtree);
+  if (priv->rlatest == rseg)
+    priv->rlatest = NULL;
+  g_slice_free (RSegment, rseg);
+}
+
+static void
+rtree_insert (PseudoTcpSocketPrivate *priv, guint32 seq, guint32 len)
+{
+  struct interval_tree_node *it;
+  RSegment *rseg;
+  unsigned long start, last;
+
+  rtree_rebase (priv);
+  start = rtree_key (priv, seq);
+  last = start + len - 1;
+
+  // Absorb every range it overlaps or touches
+  while ((it = interval_tree_iter_first (&priv->rtree,
+      start ? start - 1 : 0, last + 1))) {
+    start = min(start, it->start);
+    last = max(last, it->last);
+    rtree_remove (priv, container_of (it, RSegment, it));
+  }
+
+  rseg = g_slice_new0 (RSegment);
+  rseg->it.start = start;
+  rseg->it.last = last;
+  interval_tree_insert (&rseg->it, &priv->rtree);
+  priv->rlatest = rseg;
+}
+
+/* Fill @out with SACK blocks: the range that changed last first, as in
+ * RFC 2018, then the lowest ones, which hold up rcv_nxt. */
+static guint8
+sack_blocks (PseudoTcpSocketPrivate *priv, guint32 *out)
+{
+  struct rb_node *node;
+  RSegment *rseg = priv->rlatest;
+  guint8 n = 0;
+
+  if (rseg) {
+    out[2 * n] = htonl (priv->rcv_base + rseg->it.start);
+    out[2 * n + 1] = htonl (priv->rcv_base + rseg->it.last + 1);
+    n++;
+  }
+  for (node = rb_first_cached (&priv->rtree);
+       node && n < MAX_SACK_BLOCKS; node = rb_next (node)) {
+    rseg = rb_entry (node, RSegment, it.rb);
+    if (rseg == priv->rlatest)
+      continue;
+    out[2 * n] = htonl (priv->rcv_base + rseg->it.start);
+    out[2 * n + 1] = htonl (priv->rcv_base + rseg->it.last + 1);
+    n++;
+  }
+  return n;
+}
+
+//
+// SACK scoreboard and loss recovery
+//
+
+static PseudoTcpCongestion *
+cc_update (PseudoTcpSocket *self)
+{
+  PseudoTcpSocketPrivate *priv = self->priv;
+
+  priv->cc.mss = priv->mss;
+  priv->cc.srtt = priv->rx_srtt;
+  priv->cc.in_flight = priv->snd_nxt - priv->snd_una;
+  return &priv->cc;
+}
+
+/* @len bytes of @sseg are no longer in flight, acked or sacked */
+static void
+sack_release (PseudoTcpSocketPrivate *priv, SSegment *sseg, guint32 len)
+{
+  if (sseg->sacked)
+    priv->sacked_bytes -= len;
+  else if (sseg->recovery == priv->recovery)
+    priv->rtx_bytes -= min(len, priv->rtx_bytes);
+}
+
+static void
+sack_update (PseudoTcpSocket *self, Segment *seg)
+{
+  PseudoTcpSocketPrivate *priv = self->priv;
+  SSegment *sseg;
+  guint8 i;
+
+  if (!priv->sack_ok)
+    return;
+
+  for (i = 0; i < seg->nsack; i++) {
+    guint32 left = seg->sack[2 * i];
+    guint32 right = seg->sack[2 * i + 1];
+
+    // Ignore stale or bogus blocks
+    if (!LARGER (right, left) || !LARGER (left, priv->snd_una) ||
+        LARGER (right, priv->snd_nxt))
+      continue;
+
+    sseg = priv->sack_hint;
+    if (!sseg || LARGER (sseg->seq, left))
+      sseg = list_first_entry (&priv->slist, SSegment, entry);
+    list_for_each_entry_from (sseg, &priv->slist, entry) {
+      if (sseg->xmit == 0 || LARGER_OR_EQUAL (sseg->seq, right))
+        break;
+      if (SMALLER (sseg->seq, left) || sseg->sacked)
+        continue;
+      // Only whole segments, a partly covered one stays in flight
+      if (LARGER (sseg->seq + sseg->len, right))
+        break;
+      sack_release (priv, sseg, sseg->len);
+      sseg->sacked = TRUE;
+      priv->sacked_bytes += sseg->len;
+      if (priv->sacked_bytes == sseg->len ||
+          LARGER (sseg->seq + sseg->len, priv->high_sacked))
+        priv->high_sacked = sseg->seq + sseg->len;
+      priv->sack_hint = sseg;
+    }
+  }
+}
+
+/* The next segment presumed lost and not resent in this recovery: the one
+ * at snd_una, or any unsacked one below the highest sacked segment. */
+static SSegment *
+sack_next_hole (PseudoTcpSocketPrivate *priv)
+{
+  SSegment *sseg = priv->rtx_hint;
+
+  if (!sseg)
+    sseg = list_first_entry (&priv->slist, SSegment, entry);
+  list_for_each_entry_from (sseg, &priv->slist, entry) {
+    if (sseg->xmit == 0)
+      break;
+    if (sseg->sacked || sseg->recovery == priv->recovery)
+      continue;
+    if (sseg->seq != priv->snd_una && (priv->sacked_bytes == 0 ||
+        !SMALLER (sseg->seq, priv->high_sacked)))
+      break;
+    priv->rtx_hint = sseg;
+    return sseg;
+  }
+  return NULL;
+}
+
+static gboolean
+enter_recovery (PseudoTcpSocket *self, guint32 now)
+{
+  PseudoTcpSocketPrivate *priv = self->priv;
+  SSegment *sseg;
+
+  DEBUG (PSEUDO_TCP_DEBUG_NORMAL, "enter recovery");
+  priv->dup_acks = max(priv->dup_acks, 3);
+  priv->recover = priv->snd_nxt;
+  priv->recovery++;
+  priv->rtx_bytes = 0;
+  priv->rtx_hint = NULL;
+  priv->cc_ops->on_loss (cc_update (self), now);
+
+  // The segment at snd_una goes out whatever the pipe (RFC 6675, 4.3)
+  sseg = list_first_entry (&priv->slist, SSegment, entry);
+  DEBUG (PSEUDO_TCP_DEBUG_NORMAL, "recovery retransmit %u", sseg->seq);
+  if (!transmit(self, sseg, now))
+    return FALSE;
+
+  // With SACK, attempt_send() resends the other holes as the pipe drains
+  if (priv->sack_ok) {
+    sseg->recovery = priv->recovery;
+    priv->rtx_bytes += sseg->len;
+    priv->rtx_hint = sseg;
+  } else {
+    priv->cc.cwnd = priv->cc.ssthresh + 3 * priv->mss;
+  }
+  return TRUE;
+}
+
 static guint32
 queue (PseudoTcpSocket *self, const gchar * data, guint32 len, TcpFlags flags)
 {
   PseudoTcpSocketPrivate *priv = self->priv;
   gsize available_space;
+  SSegment *tail;
 
   available_space = pseudo_tcp_fifo_get_write_remaining (&priv->sbuf);
   if (len > available_space) {
@@ -1388,10 +1683,9 @@ queue (PseudoTcpSocket *self, const gchar * data, guint32 len, TcpFlags flags)
 
   // We can concatenate data if the last segment is the same type
   // (control v. regular data), and has not been transmitted yet
-  if (g_queue_get_length (&priv->slist) &&
-      (((SSegment *)g_queue_peek_tail (&priv->slist))->flags == flags) &&
-      (((SSegment *)g_queue_peek_tail (&priv->slist))->xmit == 0)) {
-    ((SSegment *)g_queue_peek_tail (&priv->slist))->len += len;
+  tail = list_last_entry_or_null (&priv->slist, SSegment, entry);
+  if (tail && tail->flags == flags && tail->xmit == 0) {
+    tail->len += len;
   } else {
     SSegment *sseg = g_slice_new0 (SSegment);
     gsize snd_buffered = pseudo_tcp_fifo_get_buffered (&priv->sbuf);
@@ -1399,8 +1693,8 @@ queue (PseudoTcpSocket *self, const gchar * data, guint32 len, TcpFlags flags)
     sseg->seq = priv->snd_una + snd_buffered;
     sseg->len = len;
     sseg->flags = flags;
-    g_queue_push_tail (&priv->slist, sseg);
-    g_queue_push_tail (&priv->unsent_slist, sseg);
+    list_add_tail (&sseg->entry, &priv->slist);
+    list_add_tail (&sseg->unsent, &priv->unsent_slist);
   }
 
   //LOG(LS_INFO) << "PseudoTcp::queue - priv->slen = " << priv->slen;
@@ -1427,13 +1721,17 @@ packet(PseudoTcpSocket *self, guint32 seq, TcpFlags flags,
     guint32 u32[MAX_PACKET / 4];
   } buffer;
   PseudoTcpWriteResult wres = WR_SUCCESS;
+  guint8 nsack = 0;
 
   g_assert(HEADER_SIZE + len <= MAX_PACKET);
 
   *buffer.u32 = htonl(priv->conv);
   *(buffer.u32 + 1) = htonl(seq);
   *(buffer.u32 + 2) = htonl(priv->rcv_nxt);
-  buffer.u8[12] = 0;
+  // Only pure ACKs carry SACK blocks, so data packets keep the MSS
+  if (len == 0 && priv->sack_ok)
+    nsack = sack_blocks (priv, buffer.u32 + HEADER_SIZE / 4);
+  buffer.u8[12] = nsack;
   buffer.u8[13] = flags;
   *(buffer.u16 + 7) = htons((guint16)(priv->rcv_wnd >> priv->rwnd_scale));
 
@@ -1455,8 +1753,8 @@ packet(PseudoTcpSocket *self, guint32 seq, TcpFlags flags,
       priv->conv, (unsigned)flags, seq, seq + len, priv->rcv_nxt, priv->rcv_wnd,
       now % 10000, priv->ts_recent % 10000, len);
 
-  wres = priv->callbacks.WritePacket(self, (gchar *) buffer.u8, len + HEADER_SIZE,
-                                     priv->callbacks.user_data);
+  wres = priv->callbacks.WritePacket(self, (gchar *) buffer.u8,
+      len + HEADER_SIZE + nsack * 8, priv->callbacks.user_data);
   /* Note: When len is 0, this is an ACK packet.  We don't read the
      return value for those, and thus we won't retry.  So go ahead and treat
      the packet as a success (basically simulate as if it were dropped),
@@ -1479,6 +1777,7 @@ parse (PseudoTcpSocket *self, const guint8 *_header_buf, gsize header_buf_len,
     const guint8 *data_buf, gsize data_buf_len)
 {
   Segment seg;
+  guint8 i;
 
   union {
     const guint8 *u8;
@@ -1500,8 +1799,15 @@ parse (PseudoTcpSocket *self, const guint8 *_header_buf, gsize header_buf_len,
   seg.tsval = ntohl(*(header_buf.u32 + 4));
   seg.tsecr = ntohl(*(header_buf.u32 + 5));
 
-  seg.data = (const gchar *) data_buf;
-  seg.len = data_buf_len;
+  seg.nsack = header_buf.u8[12];
+  if (seg.nsack > MAX_SACK_BLOCKS || data_buf_len < seg.nsack * 8u)
+    return FALSE;
+  memcpy (seg.sack, data_buf, seg.nsack * 8);
+  for (i = 0; i < 2 * seg.nsack; i++)
+    seg.sack[i] = ntohl (seg.sack[i]);
+
+  seg.data = (const gchar *) data_buf + seg.nsack * 8;
+  seg.len = data_buf_len - seg.nsack * 8;
 
   DEBUG (PSEUDO_TCP_DEBUG_VERBOSE, "--> <CONV=%u><FLG=%u><SEQ=%u:%u><ACK=%u>"
       "<WND=%u><TS=%u><TSR=%u><LEN=%u>",
@@ -1572,6 +1878,7 @@ process(PseudoTcpSocket *self, Segment *seg)
   gsize available_space;
   guint32 kIdealRefillSize;
   gboolean is_valuable_ack, is_duplicate_ack, is_fin_ack = FALSE;
+  long rtt = -1;
 
   /* If this is the wrong conversation, send a reset!?!
      (with the correct conversation?) */
@@ -1643,7 +1950,7 @@ process(PseudoTcpSocket *self, Segment *seg)
 
     // Calculate round-trip time
     if (seg->tsecr) {
-      long rtt = time_diff(now, seg->tsecr);
+      rtt = time_diff(now, seg->tsecr);
       if (rtt >= 0) {
         if (priv->rx_srtt == 0) {
           priv->rx_srtt = rtt;
@@ -1685,10 +1992,11 @@ process(PseudoTcpSocket *self, Segment *seg)
     for (nFree = nAcked; nFree > 0; ) {
       SSegment *data;
 
-      g_assert(g_queue_get_length (&priv->slist) != 0);
-      data = (SSegment *) g_queue_peek_head (&priv->slist);
+      g_assert(!list_empty (&priv->slist));
+      data = list_first_entry (&priv->slist, SSegment, entry);
 
       if (nFree < data->len) {
+        sack_release (priv, data, nFree);
         data->len -= nFree;
         data->seq += nFree;
         nFree = 0;
@@ -1697,34 +2005,37 @@ process(PseudoTcpSocket *self, Segment *seg)
           priv->largest = data->len;
         }
         nFree -= data->len;
+        sack_release (priv, data, data->len);
+        if (priv->sack_hint == data)
+          priv->sack_hint = NULL;
+        if (priv->rtx_hint == data)
+          priv->rtx_hint = NULL;
+        list_del (&data->entry);
         g_slice_free (SSegment, data);
-        g_queue_pop_head (&priv->slist);
       }
     }
 
+    sack_update (self, seg);
+
     if (priv->dup_acks >= 3) {
       if (LARGER_OR_EQUAL (priv->snd_una, priv->recover)) { // NewReno
-        guint32 nInFlight = priv->snd_nxt - priv->snd_una;
+        guint32 nInFlight = priv->snd_nxt - priv->snd_una - priv->sacked_bytes;
         // (Fast Retransmit)
-        priv->cwnd = min(priv->ssthresh, nInFlight + priv->mss);
+        priv->cc.cwnd = min(priv->cc.ssthresh, nInFlight + priv->mss);
         DEBUG (PSEUDO_TCP_DEBUG_NORMAL, "exit recovery");
         priv->dup_acks = 0;
-      } else {
+        priv->rtx_bytes = 0;
+      } else if (!priv->sack_ok) {
         DEBUG (PSEUDO_TCP_DEBUG_NORMAL, "recovery retransmit");
-        if (!transmit(self, g_queue_peek_head (&priv->slist), now)) {
+        if (!transmit(self, list_first_entry (&priv->slist, SSegment, entry), now)) {
           closedown (self, ECONNABORTED, CLOSEDOWN_LOCAL);
           return FALSE;
         }
-        priv->cwnd += priv->mss - min(nAcked, priv->cwnd);
+        priv->cc.cwnd += priv->mss - min(nAcked, priv->cc.cwnd);
       }
     } else {
       priv->dup_acks = 0;
-      // Slow start, congestion avoidance
-      if (priv->cwnd < priv->ssthresh) {
-        priv->cwnd += priv->mss;
-      } else {
-        priv->cwnd += max(1LU, priv->mss * priv->mss / priv->cwnd);
-      }
+      priv->cc_ops->on_ack (cc_update (self), nAcked, rtt, now);
     }
   } else if (is_duplicate_ack) {
     /* !?! Note, tcp says don't do this... but otherwise how does a
@@ -1735,23 +2046,18 @@ process(PseudoTcpSocket *self, Segment *seg)
     if (seg->len > 0) {
       // it's a dup ack, but with a data payload, so don't modify priv->dup_acks
     } else if (priv->snd_una != priv->snd_nxt) {
-      guint32 nInFlight;
-
-      priv->dup_acks += 1;
-      if (priv->dup_acks == 3) { // (Fast Retransmit)
-        DEBUG (PSEUDO_TCP_DEBUG_NORMAL, "enter recovery");
-        DEBUG (PSEUDO_TCP_DEBUG_NORMAL, "recovery retransmit");
-        if (!transmit(self, g_queue_peek_head (&priv->slist), now)) {
+      sack_update (self, seg);
+      if (priv->dup_acks < UINT8_MAX)
+        priv->dup_acks += 1;
+      // (Fast Retransmit), or earlier if three segments were sacked
+      if (priv->dup_acks == 3 || (priv->dup_acks < 3 && priv->sack_ok &&
+          priv->sacked_bytes >= 3 * priv->mss)) {
+        if (!enter_recovery (self, now)) {
           closedown (self, ECONNABORTED, CLOSEDOWN_LOCAL);
           return FALSE;
         }
-        priv->recover = priv->snd_nxt;
-        nInFlight = priv->snd_nxt - priv->snd_una;
-        priv->ssthresh = max(nInFlight / 2, 2 * priv->mss);
-        //LOG(LS_INFO) << "priv->ssthresh: " << priv->ssthresh << "  nInFlight: " << nInFlight << "  priv->mss: " << priv->mss;
-        priv->cwnd = priv->ssthresh + 3 * priv->mss;
-      } else if (priv->dup_acks > 3) {
-        priv->cwnd += priv->mss;
+      } else if (priv->dup_acks > 3 && !priv->sack_ok) {
+        priv->cc.cwnd += priv->mss;
       }
     } else {
       priv->dup_acks = 0;
@@ -1931,19 +2237,22 @@ process(PseudoTcpSocket *self, Segment *seg)
       g_assert (res == seg->len);
 
       if (seg->seq == priv->rcv_nxt) {
-        GList *iter = NULL;
+        struct rb_node *node;
 
         pseudo_tcp_fifo_consume_write_buffer (&priv->rbuf, seg->len);
         priv->rcv_nxt += seg->len;
         priv->rcv_wnd -= seg->len;
         bNewData = TRUE;
 
-        iter = priv->rlist;
-        while (iter &&
-            SMALLER_OR_EQUAL(((RSegment *)iter->data)->seq, priv->rcv_nxt)) {
-          RSegment *data = (RSegment *)(iter->data);
-          if (LARGER (data->seq + data->len, priv->rcv_nxt)) {
-            guint32 nAdjust = (data->seq + data->len) - priv->rcv_nxt;
+        while ((node = rb_first_cached (&priv->rtree))) {
+          RSegment *data = rb_entry (node, RSegment, it.rb);
+          guint32 data_seq = priv->rcv_base + data->it.start;
+          guint32 data_end = priv->rcv_base + data->it.last + 1;
+
+          if (!SMALLER_OR_EQUAL(data_seq, priv->rcv_nxt))
+            break;
+          if (LARGER (data_end, priv->rcv_nxt)) {
+            guint32 nAdjust = data_end - priv->rcv_nxt;
             sflags = sfImmediateAck; // (Fast Recovery)
             DEBUG (PSEUDO_TCP_DEBUG_NORMAL, "Recovered %u bytes (%u -> %u)",
                 nAdjust, priv->rcv_nxt, priv->rcv_nxt + nAdjust);
@@ -1951,23 +2260,12 @@ process(PseudoTcpSocket *self, Segment *seg)
             priv->rcv_nxt += nAdjust;
             priv->rcv_wnd -= nAdjust;
           }
-          g_slice_free (RSegment, priv->rlist->data);
-          priv->rlist = g_list_delete_link (priv->rlist, priv->rlist);
-          iter = priv->rlist;
+          rtree_remove (priv, data);
         }
       } else {
-        GList *iter = NULL;
-        RSegment *rseg = g_slice_new0 (RSegment);
-
         DEBUG (PSEUDO_TCP_DEBUG_NORMAL, "Saving %u bytes (%u -> %u)",
             seg->len, seg->seq, seg->seq + seg->len);
-        rseg->seq = seg->seq;
-        rseg->len = seg->len;
-        iter = priv->rlist;
-        while (iter && SMALLER (((RSegment*)iter->data)->seq, rseg->seq)) {
-          iter = g_list_next (iter);
-        }
-        priv->rlist = g_list_insert_before(priv->rlist, iter, rseg);
+        rtree_insert (priv, seg->seq, seg->len);
       }
     }
   }
@@ -2030,7 +2328,7 @@ transmit(PseudoTcpSocket *self, SSegment *segment, guint32 now)
 
       priv->mss = PACKET_MAXIMUMS[++priv->msslevel] - PACKET_OVERHEAD;
       // I added this... haven't researched actual formula
-      priv->cwnd = 2 * priv->mss;
+      priv->cc.cwnd = 2 * priv->mss;
 
       if (priv->mss < nTransmit) {
         nTransmit = priv->mss;
@@ -2050,16 +2348,14 @@ transmit(PseudoTcpSocket *self, SSegment *segment, guint32 now)
     DEBUG (PSEUDO_TCP_DEBUG_NORMAL, "mss reduced to %u", priv->mss);
 
     segment->len = nTransmit;
-    g_queue_insert_after (&priv->slist,
-        g_queue_find (&priv->slist, segment), subseg);
+    list_add (&subseg->entry, &segment->entry);
     if (subseg->xmit == 0)
-      g_queue_insert_after (&priv->unsent_slist,
-          g_queue_find (&priv->unsent_slist, segment), subseg);
+      list_add (&subseg->unsent, &segment->unsent);
   }
 
   if (segment->xmit == 0) {
-    g_assert (g_queue_peek_head (&priv->unsent_slist) == segment);
-    g_queue_pop_head (&priv->unsent_slist);
+    g_assert (list_first_entry (&priv->unsent_slist, SSegment, unsent) == segment);
+    list_del_init (&segment->unsent);
     priv->snd_nxt += segment->len;
 
     /* FIN flags require acknowledgement. */
@@ -2083,7 +2379,7 @@ attempt_send(PseudoTcpSocket *self, SendFlags sflags)
   gboolean bFirst = TRUE;
 
   if (time_diff(now, priv->lastsend) > (long) priv->rx_rto) {
-    priv->cwnd = priv->mss;
+    priv->cc.cwnd = priv->mss;
   }
 
 
@@ -2094,15 +2390,34 @@ attempt_send(PseudoTcpSocket *self, SendFlags sflags)
     guint32 nUseable;
     guint32 nAvailable;
     gsize snd_buffered;
-    GList *iter;
     SSegment *sseg;
 
-    cwnd = priv->cwnd;
+    cwnd = priv->cc.cwnd;
     if ((priv->dup_acks == 1) || (priv->dup_acks == 2)) { // Limited Transmit
       cwnd += priv->dup_acks * priv->mss;
     }
     nWindow = min(priv->snd_wnd, cwnd);
     nInFlight = priv->snd_nxt - priv->snd_una;
+    if (priv->sack_ok) {
+      // The pipe: sacked data left the network, resent holes are back in it
+      nInFlight = nInFlight - priv->sacked_bytes + priv->rtx_bytes;
+
+      if (priv->dup_acks >= 3 && nInFlight < nWindow) {
+        SSegment *hole = sack_next_hole (priv);
+        if (hole) {
+          DEBUG (PSEUDO_TCP_DEBUG_NORMAL, "recovery retransmit %u", hole->seq);
+          if (!transmit(self, hole, now)) {
+            DEBUG (PSEUDO_TCP_DEBUG_NORMAL, "transmit failed");
+            return;
+          }
+          hole->recovery = priv->recovery;
+          priv->rtx_bytes += hole->len;
+          if (sflags == sfImmediateAck || sflags == sfDelayedAck)
+            sflags = sfNone;
+          continue;
+        }
+      }
+    }
     nUseable = (nInFlight < nWindow) ? (nWindow - nInFlight) : 0;
     snd_buffered = pseudo_tcp_fifo_get_buffered (&priv->sbuf);
     if (snd_buffered < nInFlight)  /* iff a FIN has been sent */
@@ -2125,8 +2440,8 @@ attempt_send(PseudoTcpSocket *self, SendFlags sflags)
       DEBUG (PSEUDO_TCP_DEBUG_VERBOSE, "[cwnd: %u  nWindow: %u  nInFlight: %u "
           "nAvailable: %u nQueued: %" G_GSIZE_FORMAT " nEmpty: %" G_GSIZE_FORMAT
           "  ssthresh: %u]",
-          priv->cwnd, nWindow, nInFlight, nAvailable, snd_buffered,
-          available_space, priv->ssthresh);
+          priv->cc.cwnd, nWindow, nInFlight, nAvailable, snd_buffered,
+          available_space, priv->cc.ssthresh);
     }
 
     if (nAvailable == 0 && sflags != sfFin && sflags != sfRst) {
@@ -2153,10 +2468,9 @@ attempt_send(PseudoTcpSocket *self, SendFlags sflags)
     }
 
     // Find the next segment to transmit
-    iter = g_queue_peek_head_link (&priv->unsent_slist);
-    if (iter == NULL)
+    if (list_empty (&priv->unsent_slist))
       return;
-    sseg = iter->data;
+    sseg = list_first_entry (&priv->unsent_slist, SSegment, unsent);
 
     // If the segment is too large, break it into two
     if (sseg->len > nAvailable && sflags != sfFin && sflags != sfRst) {
@@ -2166,9 +2480,8 @@ attempt_send(PseudoTcpSocket *self, SendFlags sflags)
       subseg->flags = sseg->flags;
 
       sseg->len = nAvailable;
-      g_queue_insert_after (&priv->unsent_slist, iter, subseg);
-      g_queue_insert_after (&priv->slist, g_queue_find (&priv->slist, sseg),
-          subseg);
+      list_add (&subseg->unsent, &sseg->unsent);
+      list_add (&subseg->entry, &sseg->entry);
     }
 
     if (!transmit(self, sseg, now)) {
@@ -2244,8 +2557,8 @@ adjustMTU(PseudoTcpSocket *self)
   // !?! Should we reset priv->largest here?
   DEBUG (PSEUDO_TCP_DEBUG_NORMAL, "Adjusting mss to %u bytes", priv->mss);
   // Enforce minimums on ssthresh and cwnd
-  priv->ssthresh = max(priv->ssthresh, 2 * priv->mss);
-  priv->cwnd = max(priv->cwnd, priv->mss);
+  priv->cc.ssthresh = max(priv->cc.ssthresh, 2 * priv->mss);
+  priv->cc.cwnd = max(priv->cc.cwnd, priv->mss);
 }
 
 static void
@@ -2288,6 +2601,13 @@ apply_option (PseudoTcpSocket *self, guint8 kind, const guint8 *data,
     DEBUG (PSEUDO_TCP_DEBUG_NORMAL, "FIN-ACK support enabled.");
     apply_fin_ack_option (self);
     break;
+  case TCP_OPT_SACK:
+    // Selective acknowledgements, used if we offered them too.
+    // http://www.ietf.org/rfc/rfc2018.txt
+    self->priv->sack_ok = self->priv->support_sack;
+    DEBUG (PSEUDO_TCP_DEBUG_NORMAL, "SACK %s.",
+        self->priv->sack_ok ? "enabled" : "offered by peer only");
+    break;
   case TCP_OPT_EOL:
   case TCP_OPT_NOOP:
     /* Nothing to do. */
@@ -2407,7 +2727,7 @@ resize_receive_buffer (PseudoTcpSocket *self, guint32 new_size)
   g_assert(result);
   priv->rbuf_len = new_size;
   priv->rwnd_scale = scale_factor;
-  priv->ssthresh = new_size;
+  priv->cc.ssthresh = new_size;
 
   available_space = pseudo_tcp_fifo_get_write_remaining (&priv->rbuf);
   priv->rcv_wnd = available_space;
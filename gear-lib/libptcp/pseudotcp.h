@@ -462,6 +462,107 @@ void pseudo_tcp_socket_notify_clock(PseudoTcpSocket *self);
 void pseudo_tcp_socket_notify_mtu(PseudoTcpSocket *self, guint16 mtu);
 
 
+/**
+ * pseudo_tcp_socket_set_buffers:
+ * @self: The #PseudoTcpSocket object.
+ * @snd_buf: The send buffer size in bytes, 0 to keep the current one
+ * @rcv_buf: The receive buffer size in bytes, 0 to keep the current one
+ *
+ * Set the buffer sizes, capped at 64MB. A receive buffer over 64KB is
+ * advertised with the window scale option, so the peer can keep that much
+ * data in flight. Only allowed before connecting, in %TCP_LISTEN state.
+ *
+ * Returns: %TRUE on success, %FALSE if the socket is not in %TCP_LISTEN state
+ */
+gboolean pseudo_tcp_socket_set_buffers(PseudoTcpSocket *self, guint32 snd_buf,
+    guint32 rcv_buf);
+
+
+/**
+ * PseudoTcpCongestion:
+ * @cwnd: Congestion window in bytes, owned by the algorithm
+ * @ssthresh: Slow start threshold in bytes, owned by the algorithm
+ * @mss: Current maximum segment size
+ * @srtt: Smoothed round trip time in milliseconds, 0 before the first sample
+ * @in_flight: Bytes sent and not yet cumulatively acknowledged (RFC 5681
+ * FlightSize)
+ * @state: Scratch space for the algorithm, zeroed before init()
+ *
+ * Congestion state shared between the socket and its congestion control
+ * algorithm. The socket refreshes @mss, @srtt and @in_flight before each
+ * callback.
+ */
+typedef struct {
+  guint32 cwnd;
+  guint32 ssthresh;
+  guint32 mss;
+  guint32 srtt;
+  guint32 in_flight;
+  guint64 state[8];
+} PseudoTcpCongestion;
+
+/**
+ * PseudoTcpCongestionOps:
+ * @name: Name used by pseudo_tcp_congestion_control_find()
+ * @init: Reset the algorithm state, @cwnd and @ssthresh are already set
+ * @on_ack: New data acknowledged outside of loss recovery; @rtt is the
+ * sample taken from this ack in milliseconds, or -1
+ * @on_loss: Loss detected by duplicate or selective acks, entering recovery;
+ * set @ssthresh and @cwnd
+ * @on_timeout: Retransmission timeout; set @ssthresh and @cwnd
+ *
+ * A congestion control algorithm. All times are in milliseconds.
+ */
+typedef struct {
+  const gchar *name;
+  void (*init) (PseudoTcpCongestion *cc, guint32 now);
+  void (*on_ack) (PseudoTcpCongestion *cc, guint32 acked, long rtt,
+      guint32 now);
+  void (*on_loss) (PseudoTcpCongestion *cc, guint32 now);
+  void (*on_timeout) (PseudoTcpCongestion *cc, guint32 now);
+} PseudoTcpCongestionOps;
+
+/* loss based AIMD, as in RFC 5681 */
+extern const PseudoTcpCongestionOps pseudo_tcp_congestion_reno;
+/* RFC 8312, the default */
+extern const PseudoTcpCongestionOps pseudo_tcp_congestion_cubic;
+/* delay based, sizes cwnd from measured bandwidth and min rtt, random loss
+ * does not shrink the window */
+extern const PseudoTcpCongestionOps pseudo_tcp_congestion_bbr_lite;
+
+/**
+ * pseudo_tcp_congestion_control_find:
+ * @name: "reno", "cubic" or "bbr-lite"
+ *
+ * Returns: The built-in algorithm called @name, or %NULL
+ */
+const PseudoTcpCongestionOps *pseudo_tcp_congestion_control_find(
+    const gchar *name);
+
+/**
+ * pseudo_tcp_socket_set_congestion_control:
+ * @self: The #PseudoTcpSocket object.
+ * @ops: The algorithm, which must outlive the socket
+ *
+ * Switch congestion control algorithm. Allowed at any time, the current
+ * window is kept and the algorithm state is reset.
+ */
+void pseudo_tcp_socket_set_congestion_control(PseudoTcpSocket *self,
+    const PseudoTcpCongestionOps *ops);
+
+/**
+ * pseudo_tcp_socket_set_sack:
+ * @self: The #PseudoTcpSocket object.
+ * @enabled: Whether to offer selective acknowledgements
+ *
+ * SACK is offered by default and used only if both peers offer it.
+ * Only allowed before connecting, in %TCP_LISTEN state.
+ *
+ * Returns: %TRUE on success, %FALSE if the socket is not in %TCP_LISTEN state
+ */
+gboolean pseudo_tcp_socket_set_sack(PseudoTcpSocket *self, gboolean enabled);
+
+
 /**
  * pseudo_tcp_socket_notify_packet:
  * @self: The #PseudoTcpSocket object.
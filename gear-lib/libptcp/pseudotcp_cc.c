@@ -0,0 +1,303 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#include <string.h>
+#include <libposix.h>
+#include "gfake.h"
+
+#include "pseudotcp.h"
+
+#ifndef G_OS_WIN32
+#  define min(first, second) ((first) < (second) ? (first) : (second))
+#  define max(first, second) ((first) > (second) ? (first) : (second))
+#endif
+
+//////////////////////////////////////////////////////////////////////
+// Reno (RFC 5681)
+//////////////////////////////////////////////////////////////////////
+
+static void
+reno_init (PseudoTcpCongestion *cc, guint32 now)
+{
+}
+
+static void
+reno_on_ack (PseudoTcpCongestion *cc, guint32 acked, long rtt, guint32 now)
+{
+  // Slow start, congestion avoidance
+  if (cc->cwnd < cc->ssthresh) {
+    cc->cwnd += cc->mss;
+  } else {
+    cc->cwnd += max(1LU, cc->mss * cc->mss / cc->cwnd);
+  }
+}
+
+static void
+reno_on_loss (PseudoTcpCongestion *cc, guint32 now)
+{
+  cc->ssthresh = max(cc->in_flight / 2, 2 * cc->mss);
+  cc->cwnd = cc->ssthresh;
+}
+
+static void
+reno_on_timeout (PseudoTcpCongestion *cc, guint32 now)
+{
+  cc->ssthresh = max(cc->in_flight / 2, 2 * cc->mss);
+  cc->cwnd = cc->mss;
+}
+
+const PseudoTcpCongestionOps pseudo_tcp_congestion_reno = {
+  "reno", reno_init, reno_on_ack, reno_on_loss, reno_on_timeout,
+};
+
+//////////////////////////////////////////////////////////////////////
+// CUBIC (RFC 8312), window in segments, time in seconds
+//////////////////////////////////////////////////////////////////////
+
+#define CUBIC_C     0.4
+#define CUBIC_BETA  0.7
+
+struct cubic {
+  double w_max;       /* window before the last reduction */
+  double w_last_max;  /* for fast convergence */
+  double k;           /* time to grow back to w_max */
+  guint32 epoch_start;  /* start of the current avoidance epoch, 0 if none */
+};
+
+static double
+cubic_root (double x)
+{
+  double r = 1;
+  int i;
+
+  if (x <= 0)
+    return 0;
+  while (r * r * r < x)
+    r *= 2;
+  for (i = 0; i < 8; i++)
+    r = (2 * r + x / (r * r)) / 3;
+  return r;
+}
+
+static void
+cubic_init (PseudoTcpCongestion *cc, guint32 now)
+{
+  memset (cc->state, 0, sizeof(struct cubic));
+}
+
+static void
+cubic_on_ack (PseudoTcpCongestion *cc, guint32 acked, long rtt, guint32 now)
+{
+  struct cubic *c = (struct cubic *) cc->state;
+  double w, t, target, w_est;
+
+  if (cc->cwnd < cc->ssthresh) {
+    cc->cwnd += min(acked, cc->mss);
+    return;
+  }
+
+  w = (double) cc->cwnd / cc->mss;
+  if (c->epoch_start == 0) {
+    c->epoch_start = now ? now : 1;
+    if (w < c->w_max) {
+      c->k = cubic_root ((c->w_max - w) / CUBIC_C);
+    } else {
+      c->k = 0;
+      c->w_max = w;
+    }
+  }
+
+  /* the window one rtt from now */
+  t = (double) (now - c->epoch_start + cc->srtt) / 1000;
+  target = CUBIC_C * (t - c->k) * (t - c->k) * (t - c->k) + c->w_max;
+
+  /* never grow slower than reno would */
+  if (cc->srtt) {
+    w_est = c->w_max * CUBIC_BETA + 3 * (1 - CUBIC_BETA) / (1 + CUBIC_BETA) *
+        (now - c->epoch_start) / cc->srtt;
+    if (target < w_est)
+      target = w_est;
+  }
+  target = min(target, 1.5 * w);
+
+  if (target > w)
+    cc->cwnd += max(1LU, (guint32) ((target - w) * acked / w));
+}
+
+static void
+cubic_reduce (PseudoTcpCongestion *cc)
+{
+  struct cubic *c = (struct cubic *) cc->state;
+  double w = (double) cc->cwnd / cc->mss;
+
+  c->epoch_start = 0;
+  if (w < c->w_last_max) {
+    /* fast convergence: release bandwidth to newer flows */
+    c->w_last_max = w;
+    c->w_max = w * (1 + CUBIC_BETA) / 2;
+  } else {
+    c->w_last_max = c->w_max = w;
+  }
+  cc->ssthresh = max((guint32) (cc->cwnd * CUBIC_BETA), 2 * cc->mss);
+}
+
+static void
+cubic_on_loss (PseudoTcpCongestion *cc, guint32 now)
+{
+  cubic_reduce (cc);
+  cc->cwnd = cc->ssthresh;
+}
+
+static void
+cubic_on_timeout (PseudoTcpCongestion *cc, guint32 now)
+{
+  cubic_reduce (cc);
+  cc->cwnd = cc->mss;
+}
+
+const PseudoTcpCongestionOps pseudo_tcp_congestion_cubic = {
+  "cubic", cubic_init, cubic_on_ack, cubic_on_loss, cubic_on_timeout,
+};
+
+//////////////////////////////////////////////////////////////////////
+// BBR-lite
+//
+// Delay based: the window is twice the bandwidth-delay product, from the
+// max delivery rate over the last rounds and the min rtt over the last 10
+// seconds. Random loss does not shrink the window, which keeps lossy
+// wireless links busy. There is no pacing, so no probe cycles either.
+//////////////////////////////////////////////////////////////////////
+
+#define BBR_BW_ROUNDS     10
+#define BBR_MIN_RTT_WIN   10000
+#define BBR_CWND_GAIN     2
+#define BBR_MAX_CWND      (1 << 30)
+
+struct bbr_lite {
+  guint32 bw[BBR_BW_ROUNDS];  /* delivery rate per round, bytes/ms */
+  guint32 min_rtt;            /* 0 until the first sample */
+  guint32 min_rtt_stamp;
+  guint32 round_start;
+  guint32 delivered;          /* bytes acked in this round */
+  guint32 full_bw;
+  guint8 round;
+  guint8 full_bw_cnt;
+  guint8 filled_pipe;         /* startup ended, bw stopped growing */
+};
+
+static void
+bbr_lite_init (PseudoTcpCongestion *cc, guint32 now)
+{
+  memset (cc->state, 0, sizeof(struct bbr_lite));
+}
+
+static guint32
+bbr_lite_max_bw (struct bbr_lite *b)
+{
+  guint32 bw = 0;
+  int i;
+
+  for (i = 0; i < BBR_BW_ROUNDS; i++)
+    bw = max(bw, b->bw[i]);
+  return bw;
+}
+
+static void
+bbr_lite_on_ack (PseudoTcpCongestion *cc, guint32 acked, long rtt,
+    guint32 now)
+{
+  struct bbr_lite *b = (struct bbr_lite *) cc->state;
+
+  if (rtt >= 0 && (b->min_rtt == 0 || (guint32) rtt < b->min_rtt ||
+      now - b->min_rtt_stamp > BBR_MIN_RTT_WIN)) {
+    b->min_rtt = max(rtt, 1);
+    b->min_rtt_stamp = now;
+  }
+
+  b->delivered += acked;
+  if (b->round_start == 0)
+    b->round_start = now ? now : 1;
+  if (b->min_rtt && now - b->round_start >= b->min_rtt) {
+    b->bw[b->round++ % BBR_BW_ROUNDS] = b->delivered / (now - b->round_start);
+    b->delivered = 0;
+    b->round_start = now;
+
+    if (!b->filled_pipe) {
+      guint32 bw = bbr_lite_max_bw (b);
+      if (bw >= b->full_bw + b->full_bw / 4) {
+        b->full_bw = bw;
+        b->full_bw_cnt = 0;
+      } else if (++b->full_bw_cnt >= 3) {
+        b->filled_pipe = 1;
+      }
+    }
+  }
+
+  if (!b->filled_pipe) {
+    /* startup, double every round */
+    cc->cwnd = min(cc->cwnd + acked, BBR_MAX_CWND);
+  } else {
+    guint64 bdp = (guint64) bbr_lite_max_bw (b) * b->min_rtt;
+    cc->cwnd = max(min(BBR_CWND_GAIN * bdp, BBR_MAX_CWND), 4 * cc->mss);
+  }
+  cc->ssthresh = max(cc->ssthresh, cc->cwnd);
+}
+
+static void
+bbr_lite_on_loss (PseudoTcpCongestion *cc, guint32 now)
+{
+  /* the window follows the bandwidth estimate, not losses */
+  cc->ssthresh = cc->cwnd;
+}
+
+static void
+bbr_lite_on_timeout (PseudoTcpCongestion *cc, guint32 now)
+{
+  struct bbr_lite *b = (struct bbr_lite *) cc->state;
+
+  /* the next ack restores the window from the estimate */
+  b->round_start = 0;
+  b->delivered = 0;
+  cc->ssthresh = cc->cwnd;
+  cc->cwnd = cc->mss;
+}
+
+const PseudoTcpCongestionOps pseudo_tcp_congestion_bbr_lite = {
+  "bbr-lite", bbr_lite_init, bbr_lite_on_ack, bbr_lite_on_loss,
+  bbr_lite_on_timeout,
+};
+
+const PseudoTcpCongestionOps *
+pseudo_tcp_congestion_control_find (const gchar *name)
+{
+  static const PseudoTcpCongestionOps *all[] = {
+    &pseudo_tcp_congestion_reno,
+    &pseudo_tcp_congestion_cubic,
+    &pseudo_tcp_congestion_bbr_lite,
+  };
+  size_t i;
+
+  for (i = 0; name && i < sizeof(all) / sizeof(all[0]); i++) {
+    if (!strcmp (all[i]->name, name))
+      return all[i];
+  }
+  return NULL;
+}
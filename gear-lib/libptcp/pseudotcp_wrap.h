@@ -127,29 +127,6 @@ typedef struct _GObjectClass             GObjectClass;
 
 #define G_MAXUINT32	((guint32) 0xffffffff)
 
-typedef struct {
-    void *data;
-    struct list_head entry;
-} GList;
-
-typedef struct {
-    GList member;
-    guint length;
-} GQueue;
-
-void g_queue_init(GQueue *q);
-void g_queue_clear(GQueue *q);
-guint g_queue_get_length(GQueue *q);
-gpointer g_queue_pop_head(GQueue *q);
-gpointer g_queue_peek_head(GQueue *q);
-gpointer g_queue_peek_tail(GQueue *q);
-void g_queue_push_tail(GQueue *q, gpointer data);
-GList *g_queue_find(GQueue *q, const void *data);
-void g_queue_insert_after(GQueue *q, GList *sibling, gpointer data);
-GList *g_queue_peek_head_link(GQueue *q);
-GList *g_queue_peek_tail_link(GQueue *q);
-
-
 #ifndef TRUE
 #define TRUE (1 == 1)
 #endif
@@ -30,8 +30,382 @@
 #if defined (OS_LINUX) || defined (OS_APPLE)
 #include <sys/eventfd.h>
 #endif
+#if defined (ENABLE_TRACE)
+#include <libtrace.h>
+#else
+#define TRACE_SCOPE(cat, name)
+#endif
 
 #define QUEUE_MAX_DEPTH 200
+#define CACHELINE_SIZE  64
+
+/*
+ * prod and cons are free running positions, kept in separate cache lines.
+ * MPMC uses per slot sequence (Dmitry Vyukov's bounded queue),
+ * SPSC only needs acquire/release on positions and caches the peer one
+ */
+struct queue_ring_slot {
+    uint64_t seq;
+    struct queue_item *item;
+};
+
+struct queue_ring {
+    uint64_t mask;
+    struct queue_ring_slot *slots;
+    char pad0[CACHELINE_SIZE];
+    uint64_t prod;
+    uint64_t cons_cache;            /* producer's copy of cons, SPSC */
+    char pad1[CACHELINE_SIZE];
+    uint64_t cons;
+    uint64_t prod_cache;            /* consumer's copy of prod, SPSC */
+    char pad2[CACHELINE_SIZE];
+};
+
+static uint64_t queue_now_us(void)
+{
+#if defined (OS_LINUX)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#else
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+#endif
+}
+
+static int lat_bucket(uint64_t lat)
+{
+    int b = lat ? 63 - __builtin_clzll(lat) : 0;
+    return b < QUEUE_LAT_BUCKETS ? b : QUEUE_LAT_BUCKETS - 1;
+}
+
+/* queue lock held, or atomic for ring popped by many consumers */
+static void stats_latency(struct queue *q, struct queue_counter *c,
+                struct queue_item *item, bool atomic)
+{
+    uint64_t lat, max;
+    if (!q->latency || !item->ts) {
+        return;
+    }
+    lat = queue_now_us() - item->ts;
+    if (!atomic) {
+        c->lat_sum_us += lat;
+        c->lat_cnt++;
+        c->lat_hist[lat_bucket(lat)]++;
+        if (lat > c->lat_max_us) {
+            c->lat_max_us = lat;
+        }
+        return;
+    }
+    __atomic_add_fetch(&c->lat_sum_us, lat, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&c->lat_cnt, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&c->lat_hist[lat_bucket(lat)], 1, __ATOMIC_RELAXED);
+    max = __atomic_load_n(&c->lat_max_us, __ATOMIC_RELAXED);
+    while (lat > max && !__atomic_compare_exchange_n(&c->lat_max_us, &max,
+                lat, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+static void stats_drop(struct queue_counter *c, enum queue_drop_reason why)
+{
+    c->drop++;
+    c->drop_by[why]++;
+}
+
+/* ring type, producers and consumers race on counters */
+static void stats_drop_atomic(struct queue_counter *c, enum queue_drop_reason why)
+{
+    __atomic_add_fetch(&c->drop, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&c->drop_by[why], 1, __ATOMIC_RELAXED);
+}
+
+static void stats_push(struct queue_counter *c, int depth)
+{
+    c->push++;
+    if (depth > c->depth_max) {
+        c->depth_max = depth;
+    }
+}
+
+static struct queue_ring *ring_create(int depth)
+{
+    uint64_t i, size = 1;
+    struct queue_ring *r;
+    while (size < (uint64_t)depth) {
+        size <<= 1;
+    }
+    r = CALLOC(1, struct queue_ring);
+    if (!r) {
+        printf("malloc queue_ring failed!\n");
+        return NULL;
+    }
+    r->slots = CALLOC(size, struct queue_ring_slot);
+    if (!r->slots) {
+        printf("malloc queue_ring slots failed!\n");
+        free(r);
+        return NULL;
+    }
+    for (i = 0; i < size; i++) {
+        r->slots[i].seq = i;
+    }
+    r->mask = size - 1;
+    return r;
+}
+
+static void ring_destroy(struct queue_ring *r)
+{
+    if (r) {
+        free(r->slots);
+        free(r);
+    }
+}
+
+static int spsc_push(struct queue_ring *r, struct queue_item *item)
+{
+    uint64_t prod = __atomic_load_n(&r->prod, __ATOMIC_RELAXED);
+    if (prod - r->cons_cache > r->mask) {
+        r->cons_cache = __atomic_load_n(&r->cons, __ATOMIC_ACQUIRE);
+        if (prod - r->cons_cache > r->mask) {
+            return -1;
+        }
+    }
+    r->slots[prod & r->mask].item = item;
+    __atomic_store_n(&r->prod, prod + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+static struct queue_item *spsc_pop(struct queue_ring *r)
+{
+    struct queue_item *item;
+    uint64_t cons = __atomic_load_n(&r->cons, __ATOMIC_RELAXED);
+    if (cons == r->prod_cache) {
+        r->prod_cache = __atomic_load_n(&r->prod, __ATOMIC_ACQUIRE);
+        if (cons == r->prod_cache) {
+            return NULL;
+        }
+    }
+    item = r->slots[cons & r->mask].item;
+    __atomic_store_n(&r->cons, cons + 1, __ATOMIC_RELEASE);
+    return item;
+}
+
+static int mpmc_push(struct queue_ring *r, struct queue_item *item)
+{
+    struct queue_ring_slot *slot;
+    uint64_t seq, pos = __atomic_load_n(&r->prod, __ATOMIC_RELAXED);
+    int64_t dif;
+    while (1) {
+        slot = &r->slots[pos & r->mask];
+        seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        dif = (int64_t)seq - (int64_t)pos;
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n(&r->prod, &pos, pos + 1, true,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (dif < 0) {
+            return -1;
+        } else {
+            pos = __atomic_load_n(&r->prod, __ATOMIC_RELAXED);
+        }
+    }
+    slot->item = item;
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+static struct queue_item *mpmc_pop(struct queue_ring *r)
+{
+    struct queue_ring_slot *slot;
+    struct queue_item *item;
+    uint64_t seq, pos = __atomic_load_n(&r->cons, __ATOMIC_RELAXED);
+    int64_t dif;
+    while (1) {
+        slot = &r->slots[pos & r->mask];
+        seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        dif = (int64_t)seq - (int64_t)(pos + 1);
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n(&r->cons, &pos, pos + 1, true,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (dif < 0) {
+            return NULL;
+        } else {
+            pos = __atomic_load_n(&r->cons, __ATOMIC_RELAXED);
+        }
+    }
+    item = slot->item;
+    __atomic_store_n(&slot->seq, pos + r->mask + 1, __ATOMIC_RELEASE);
+    return item;
+}
+
+static int ring_depth(struct queue_ring *r)
+{
+    uint64_t cons = __atomic_load_n(&r->cons, __ATOMIC_ACQUIRE);
+    uint64_t prod = __atomic_load_n(&r->prod, __ATOMIC_ACQUIRE);
+    return (prod > cons) ? (int)(prod - cons) : 0;
+}
+
+/*
+ * push/pop count of ring is derived from positions, only rare drop and
+ * reject are counted atomically, to keep producers off shared counters
+ */
+static int ring_push(struct queue *q, struct queue_item *item)
+{
+    if (q->latency) {
+        item->ts = queue_now_us();
+    }
+    if (q->type == QUEUE_SPSC) {
+        if (0 != spsc_push(q->ring, item)) {
+            __atomic_add_fetch(&q->cnt.reject, 1, __ATOMIC_RELAXED);
+            return -1;
+        }
+        return 0;
+    }
+    while (mpmc_push(q->ring, item) != 0) {
+        struct queue_item *old;
+        if (q->mode != QUEUE_FULL_RING) {
+            __atomic_add_fetch(&q->cnt.reject, 1, __ATOMIC_RELAXED);
+            return -1;
+        }
+        old = mpmc_pop(q->ring);
+        if (old) {
+            stats_drop_atomic(&q->cnt, QUEUE_DROP_OLDEST);
+            queue_item_free(q, old);
+        }
+    }
+    return 0;
+}
+
+static struct queue_item *ring_pop(struct queue *q)
+{
+    if (q->type == QUEUE_SPSC) {
+        return spsc_pop(q->ring);
+    }
+    return mpmc_pop(q->ring);
+}
+
+/*
+ * lock-free ring doesn't block, consumer sleeps on cond after registering
+ * in ring_waiters, producer only takes lock to signal if anyone waits
+ */
+static void ring_wakeup(struct queue *q)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&q->ring_waiters, __ATOMIC_RELAXED) > 0) {
+        pthread_mutex_lock(&q->lock);
+        pthread_cond_broadcast(&q->cond);
+        pthread_mutex_unlock(&q->lock);
+    }
+}
+
+/*
+ * slab of fixed size blocks, each block is queue_item followed by payload,
+ * free blocks are linked by item entry, chunks are freed on destroy only
+ */
+struct queue_pool {
+    pthread_mutex_t lock;
+    size_t max_payload;
+    size_t block_size;
+    int nitems;
+    struct list_head free_list;
+    struct list_head chunks;
+};
+
+#define POOL_ALIGN(x) (((x) + 15) & ~((size_t)15))
+
+static int pool_grow(struct queue_pool *p)
+{
+    int i;
+    uint8_t *blk;
+    struct list_head *chunk;
+    size_t hdr = POOL_ALIGN(sizeof(struct list_head));
+
+    chunk = (struct list_head *)malloc(hdr + p->block_size * p->nitems);
+    if (!chunk) {
+        printf("malloc queue_pool chunk failed!\n");
+        return -1;
+    }
+    list_add_tail(chunk, &p->chunks);
+    blk = (uint8_t *)chunk + hdr;
+    for (i = 0; i < p->nitems; i++) {
+        struct queue_item *item = (struct queue_item *)(blk + i * p->block_size);
+        list_add_tail(&item->entry, &p->free_list);
+    }
+    return 0;
+}
+
+static struct queue_pool *pool_create(int nitems, size_t max_payload)
+{
+    struct queue_pool *p = CALLOC(1, struct queue_pool);
+    if (!p) {
+        printf("malloc queue_pool failed!\n");
+        return NULL;
+    }
+    p->nitems = nitems;
+    p->max_payload = max_payload;
+    p->block_size = POOL_ALIGN(sizeof(struct queue_item) + max_payload);
+    INIT_LIST_HEAD(&p->free_list);
+    INIT_LIST_HEAD(&p->chunks);
+    pthread_mutex_init(&p->lock, NULL);
+    if (0 != pool_grow(p)) {
+        pthread_mutex_destroy(&p->lock);
+        free(p);
+        return NULL;
+    }
+    return p;
+}
+
+static void pool_destroy(struct queue_pool *p)
+{
+    struct list_head *chunk, *next;
+    if (!p) {
+        return;
+    }
+    for (chunk = p->chunks.next; chunk != &p->chunks; chunk = next) {
+        next = chunk->next;
+        free(chunk);
+    }
+    pthread_mutex_destroy(&p->lock);
+    free(p);
+}
+
+static struct queue_item *pool_get(struct queue_pool *p)
+{
+    struct queue_item *item = NULL;
+    pthread_mutex_lock(&p->lock);
+    if (list_empty(&p->free_list) && 0 != pool_grow(p)) {
+        pthread_mutex_unlock(&p->lock);
+        return NULL;
+    }
+    item = list_first_entry(&p->free_list, struct queue_item, entry);
+    list_del(&item->entry);
+    pthread_mutex_unlock(&p->lock);
+    return item;
+}
+
+static void pool_put(struct queue_pool *p, struct queue_item *item)
+{
+    pthread_mutex_lock(&p->lock);
+    list_add(&item->entry, &p->free_list);
+    pthread_mutex_unlock(&p->lock);
+}
+
+static bool pool_owned(struct queue_item *item)
+{
+    /* payload inline right after item means it's from pool */
+    return item->data.iov_base == (void *)(item + 1);
+}
+
+int queue_set_pool(struct queue *q, int nitems, size_t max_payload)
+{
+    if (!q || nitems <= 0 || q->pool) {
+        return -1;
+    }
+    q->pool = pool_create(nitems, max_payload);
+    return q->pool ? 0 : -1;
+}
 
 struct queue_item *queue_item_alloc(struct queue *q, void *data, size_t len, void *arg)
 {
@@ -39,7 +413,22 @@ struct queue_item *queue_item_alloc(struct queue *q, void *data, size_t len, voi
     if (!q || !data || len == 0) {
         return NULL;
     }
-    item = CALLOC(1, struct queue_item);
+    if (q->pool && !q->alloc_hook && len <= q->pool->max_payload) {
+        item = pool_get(q->pool);
+        if (item) {
+            memset(item, 0, sizeof(*item));
+            item->data.iov_base = (void *)(item + 1);
+            item->data.iov_len = len;
+            memcpy(item->data.iov_base, data, len);
+            item->arg = arg;
+            item->ref_cnt = 1;
+            if (q->classify) {
+                item->flags = q->classify(data, len, arg);
+            }
+            return item;
+        }
+    }
+    item = (struct queue_item *)gear_calloc(sizeof(struct queue_item));
     if (!item) {
         printf("malloc failed!\n");
         return NULL;
@@ -52,7 +441,18 @@ struct queue_item *queue_item_alloc(struct queue *q, void *data, size_t len, voi
         item->data.iov_len = len;
     }
     item->arg = arg;
-    item->ref_cnt = q->branch_cnt;
+    item->ref_cnt = 1;
+    if (q->classify) {
+        item->flags = q->classify(data, len, arg);
+    }
+    return item;
+}
+
+struct queue_item *queue_item_get(struct queue_item *item)
+{
+    if (item) {
+        __atomic_add_fetch(&item->ref_cnt, 1, __ATOMIC_RELAXED);
+    }
     return item;
 }
 
@@ -61,13 +461,21 @@ void queue_item_free(struct queue *q, struct queue_item *item)
     if (!q || !item) {
         return;
     }
+    if (__atomic_sub_fetch(&item->ref_cnt, 1, __ATOMIC_ACQ_REL) > 0) {
+        /* still referenced by other branch */
+        return;
+    }
+    if (q->pool && pool_owned(item)) {
+        pool_put(q->pool, item);
+        return;
+    }
     if (q->free_hook) {
         (q->free_hook)(item->opaque.iov_base);
         item->opaque.iov_len = 0;
     } else {
         free(item->data.iov_base);
     }
-    free(item);
+    gear_free(item, sizeof(*item));
 }
 
 struct iovec *queue_item_get_data(struct queue *q, struct queue_item *it)
@@ -88,6 +496,16 @@ int queue_set_mode(struct queue *q, enum queue_mode mode)
         return -1;
     }
     q->mode = mode;
+    q->skip_to_key = false;
+    return 0;
+}
+
+int queue_set_classify(struct queue *q, queue_classify_hook *cb)
+{
+    if (!q) {
+        return -1;
+    }
+    q->classify = cb;
     return 0;
 }
 
@@ -110,14 +528,184 @@ int queue_set_depth(struct queue *q, int depth)
     return 0;
 }
 
+int queue_set_bytes(struct queue *q, size_t max_bytes)
+{
+    if (!q) {
+        return -1;
+    }
+    pthread_mutex_lock(&q->lock);
+    q->max_bytes = max_bytes;
+    pthread_cond_broadcast(&q->not_full);
+    pthread_mutex_unlock(&q->lock);
+    return 0;
+}
+
+size_t queue_get_bytes(struct queue *q)
+{
+    size_t bytes;
+    if (!q) {
+        return 0;
+    }
+    pthread_mutex_lock(&q->lock);
+    bytes = q->bytes;
+    pthread_mutex_unlock(&q->lock);
+    return bytes;
+}
+
 int queue_get_depth(struct queue *q)
 {
     if (!q) {
         return -1;
     }
+    if (q->ring) {
+        return ring_depth(q->ring);
+    }
     return q->depth;
 }
 
+/*
+ * each branch holds its own ring of item references, protected by q->lock,
+ * payload is shared and freed when the last branch releases it
+ */
+static void branch_notify(struct queue_branch *qb)
+{
+#if !(defined (OS_WINDOWS) || defined (OS_RTOS))
+    uint64_t notify = 1;
+    if (write(qb->evfd, &notify, sizeof(notify)) != sizeof(uint64_t)) {
+        printf("write eventfd failed: %s\n", strerror(errno));
+    }
+#endif
+}
+
+static void branch_clear_notify(struct queue_branch *qb)
+{
+#if !(defined (OS_WINDOWS) || defined (OS_RTOS))
+    uint64_t notify;
+    if (read(qb->evfd, &notify, sizeof(notify)) != sizeof(uint64_t)) {
+        /* EAGAIN, already cleared */
+    }
+#endif
+}
+
+static struct queue_item *branch_take(struct queue_branch *qb)
+{
+    struct queue_item *item;
+    if (qb->count == 0) {
+        return NULL;
+    }
+    item = qb->slots[qb->head];
+    qb->head = (qb->head + 1) % qb->cap;
+    qb->count--;
+    if (qb->count == 0) {
+        branch_clear_notify(qb);
+    }
+    return item;
+}
+
+static void branch_flush(struct queue *q, struct queue_branch *qb,
+                enum queue_drop_reason why)
+{
+    struct queue_item *item;
+    while ((item = branch_take(qb)) != NULL) {
+        stats_drop(&qb->cnt, why);
+        queue_item_free(q, item);
+    }
+}
+
+static bool branch_reject(struct queue *q, struct queue_branch *qb)
+{
+    if (qb->count == qb->cap && q->mode == QUEUE_FULL_DROP_NEW) {
+        qb->cnt.reject++;
+        return true;
+    }
+    return false;
+}
+
+static void branch_put(struct queue *q, struct queue_branch *qb,
+                struct queue_item *item)
+{
+    if (qb->count == qb->cap) {
+        /*
+         * slow branch only drops its own references,
+         * never block producer for one branch
+         */
+        if (q->mode == QUEUE_FULL_FLUSH) {
+            branch_flush(q, qb, QUEUE_DROP_FLUSH);
+        } else {
+            stats_drop(&qb->cnt, QUEUE_DROP_OLDEST);
+            queue_item_free(q, branch_take(qb));
+        }
+    }
+    qb->slots[(qb->head + qb->count) % qb->cap] = item;
+    qb->count++;
+    stats_push(&qb->cnt, qb->count);
+    if (qb->count == 1) {
+        branch_notify(qb);
+    }
+}
+
+/* return -1 if no branch accepts item, item is untouched then */
+static int branch_fanout(struct queue *q, struct queue_item *item)
+{
+    int refs = 0;
+    struct queue_branch *qb, *next;
+#if defined (OS_LINUX) || defined (OS_RTOS) || defined (OS_RTTHREAD) || defined (OS_APPLE)
+    list_for_each_entry_safe(qb, next, &q->branch, hook) {
+#elif defined (OS_WINDOWS)
+    list_for_each_entry_safe(qb, struct queue_branch, next, struct queue_branch, &q->branch, hook) {
+#endif
+        if (!branch_reject(q, qb)) {
+            refs++;
+        }
+    }
+    if (refs == 0) {
+        q->cnt.reject++;
+        return -1;
+    }
+    /* producer ref goes to first branch, refs taken before push are kept */
+    __atomic_add_fetch(&item->ref_cnt, refs - 1, __ATOMIC_RELEASE);
+    if (q->latency) {
+        item->ts = queue_now_us();
+    }
+    q->cnt.push++;
+#if defined (OS_LINUX) || defined (OS_RTOS) || defined (OS_RTTHREAD) || defined (OS_APPLE)
+    list_for_each_entry_safe(qb, next, &q->branch, hook) {
+#elif defined (OS_WINDOWS)
+    list_for_each_entry_safe(qb, struct queue_branch, next, struct queue_branch, &q->branch, hook) {
+#endif
+        if (!(qb->count == qb->cap && q->mode == QUEUE_FULL_DROP_NEW)) {
+            branch_put(q, qb, item);
+        }
+    }
+    return 0;
+}
+
+static struct queue_branch *branch_find(struct queue *q, const char *name)
+{
+    struct queue_branch *qb, *next;
+#if defined (OS_LINUX) || defined (OS_RTOS) || defined (OS_RTTHREAD) || defined (OS_APPLE)
+    list_for_each_entry_safe(qb, next, &q->branch, hook) {
+#elif defined (OS_WINDOWS)
+    list_for_each_entry_safe(qb, struct queue_branch, next, struct queue_branch, &q->branch, hook) {
+#endif
+        if (!strcmp(qb->name, name)) {
+            return qb;
+        }
+    }
+    return NULL;
+}
+
+static void branch_free(struct queue *q, struct queue_branch *qb)
+{
+    branch_flush(q, qb, QUEUE_DROP_CLEAR);
+#if !(defined (OS_WINDOWS) || defined (OS_RTOS))
+    close(qb->evfd);
+#endif
+    free(qb->slots);
+    free(qb->name);
+    free(qb);
+}
+
 struct queue *queue_create()
 {
     struct queue *q = CALLOC(1, struct queue);
@@ -128,23 +716,66 @@ struct queue *queue_create()
     INIT_LIST_HEAD(&q->head);
     INIT_LIST_HEAD(&q->branch);
     pthread_mutex_init(&q->lock, NULL);
+#if defined (OS_LINUX)
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&q->cond, &attr);
+    pthread_cond_init(&q->not_full, &attr);
+    pthread_condattr_destroy(&attr);
+#else
     pthread_cond_init(&q->cond, NULL);
+    pthread_cond_init(&q->not_full, NULL);
+#endif
     q->depth = 0;
     q->max_depth = QUEUE_MAX_DEPTH;
     q->mode = QUEUE_FULL_FLUSH;
     q->alloc_hook = NULL;
     q->free_hook = NULL;
     q->branch_cnt = 0;
+    q->type = QUEUE_LIST;
     return q;
 }
 
-int queue_flush(struct queue *q)
+struct queue *queue_create_by(enum queue_type type, int depth)
 {
-    struct queue_item *item, *next;
+    struct queue *q;
+    if (depth <= 0) {
+        depth = QUEUE_MAX_DEPTH;
+    }
+    q = queue_create();
     if (!q) {
-        return -1;
+        return NULL;
     }
-    pthread_mutex_lock(&q->lock);
+    q->max_depth = depth;
+    q->type = type;
+    if (type == QUEUE_SPSC || type == QUEUE_MPMC) {
+        q->ring = ring_create(depth);
+        if (!q->ring) {
+            queue_destroy(q);
+            return NULL;
+        }
+    }
+    return q;
+}
+
+static size_t item_size(struct queue *q, struct queue_item *item)
+{
+    return q->alloc_hook ? item->opaque.iov_len : item->data.iov_len;
+}
+
+static bool list_full(struct queue *q, size_t len)
+{
+    if (q->depth >= q->max_depth) {
+        return true;
+    }
+    /* one item larger than budget is still accepted by empty queue */
+    return q->max_bytes && q->depth > 0 && q->bytes + len > q->max_bytes;
+}
+
+static void list_flush(struct queue *q, enum queue_drop_reason why)
+{
+    struct queue_item *item, *next;
 #if defined (OS_LINUX) || defined (OS_RTOS) || defined (OS_RTTHREAD) || defined (OS_APPLE)
     list_for_each_entry_safe(item, next, &q->head, entry) {
 #elif defined (OS_WINDOWS)
@@ -153,10 +784,39 @@ int queue_flush(struct queue *q)
         list_del(&item->entry);
         queue_item_free(q, item);
         q->depth--;
+        stats_drop(&q->cnt, why);
     }
     if (q->depth != 0) {
         printf("queue_flush still dirty!\n");
     }
+    q->bytes = 0;
+    pthread_cond_broadcast(&q->not_full);
+}
+
+int queue_flush(struct queue *q)
+{
+    struct queue_item *item;
+    struct queue_branch *qb, *nqb;
+    if (!q) {
+        return -1;
+    }
+    if (q->ring) {
+        /* consumer side only */
+        while ((item = ring_pop(q)) != NULL) {
+            stats_drop_atomic(&q->cnt, QUEUE_DROP_CLEAR);
+            queue_item_free(q, item);
+        }
+        return 0;
+    }
+    pthread_mutex_lock(&q->lock);
+    list_flush(q, QUEUE_DROP_CLEAR);
+#if defined (OS_LINUX) || defined (OS_RTOS) || defined (OS_RTTHREAD) || defined (OS_APPLE)
+    list_for_each_entry_safe(qb, nqb, &q->branch, hook) {
+#elif defined (OS_WINDOWS)
+    list_for_each_entry_safe(qb, struct queue_branch, nqb, struct queue_branch, &q->branch, hook) {
+#endif
+        branch_flush(q, qb, QUEUE_DROP_CLEAR);
+    }
     pthread_cond_signal(&q->cond);
     pthread_mutex_unlock(&q->lock);
     return 0;
@@ -164,164 +824,412 @@ int queue_flush(struct queue *q)
 
 void queue_destroy(struct queue *q)
 {
+    struct queue_branch *qb, *next;
     if (!q) {
         return;
     }
     queue_flush(q);
+#if defined (OS_LINUX) || defined (OS_RTOS) || defined (OS_RTTHREAD) || defined (OS_APPLE)
+    list_for_each_entry_safe(qb, next, &q->branch, hook) {
+#elif defined (OS_WINDOWS)
+    list_for_each_entry_safe(qb, struct queue_branch, next, struct queue_branch, &q->branch, hook) {
+#endif
+        list_del(&qb->hook);
+        branch_free(q, qb);
+    }
+    ring_destroy(q->ring);
+    pool_destroy(q->pool);
     pthread_mutex_destroy(&q->lock);
     pthread_cond_destroy(&q->cond);
+    pthread_cond_destroy(&q->not_full);
     free(q);
 }
 
-static void queue_pop_free(struct queue *q)
+static struct queue_item *list_take(struct queue *q);
+static void deadline_get(struct timespec *ts, int timeout_ms);
+
+static void list_drop(struct queue *q, struct queue_item *item)
+{
+    list_del(&item->entry);
+    --(q->depth);
+    q->bytes -= item_size(q, item);
+    stats_drop(&q->cnt, QUEUE_DROP_GROUP);
+    queue_item_free(q, item);
+}
+
+/*
+ * drop a group of non-KEEP items by key mode, return count dropped.
+ * DROP_NONKEY drops from the first non-key item to the next key item,
+ * SKIP_TO_KEY drops from the head to the next key item after it. a group
+ * running to the end of queue makes push drop non-key items until a key
+ */
+static int list_drop_group(struct queue *q)
 {
-    struct queue_item *tmp = queue_pop(q);
-    if (tmp) {
-        queue_item_free(q, tmp);
+    int n = 0;
+    bool started = false;
+    struct queue_item *item, *next;
+#if defined (OS_LINUX) || defined (OS_RTOS) || defined (OS_RTTHREAD) || defined (OS_APPLE)
+    list_for_each_entry_safe(item, next, &q->head, entry) {
+#elif defined (OS_WINDOWS)
+    list_for_each_entry_safe(item, struct queue_item, next, struct queue_item, &q->head, entry) {
+#endif
+        if (!started) {
+            if ((item->flags & QUEUE_ITEM_KEEP) ||
+                (q->mode == QUEUE_FULL_DROP_NONKEY && (item->flags & QUEUE_ITEM_KEY))) {
+                continue;
+            }
+            started = true;
+        } else if (item->flags & QUEUE_ITEM_KEY) {
+            return n;
+        }
+        if (!(item->flags & QUEUE_ITEM_KEEP)) {
+            list_drop(q, item);
+            n++;
+        }
+    }
+    if (n > 0) {
+        q->skip_to_key = true;
     }
+    pthread_cond_broadcast(&q->not_full);
+    return n;
 }
 
-int queue_push(struct queue *q, struct queue_item *item)
+/* non-key item after a group dropped to the end is accepted and discarded */
+static bool list_skip(struct queue *q, struct queue_item *item)
 {
+    if (!q->skip_to_key) {
+        return false;
+    }
+    if (item->flags & QUEUE_ITEM_KEY) {
+        q->skip_to_key = false;
+        return false;
+    }
+    if (item->flags & QUEUE_ITEM_KEEP) {
+        return false;
+    }
+    stats_drop(&q->cnt, QUEUE_DROP_SKIP);
+    queue_item_free(q, item);
+    return true;
+}
+
+int queue_push_timeout(struct queue *q, struct queue_item *item, int timeout_ms)
+{
+    int ret;
+    size_t len;
+    struct timespec deadline;
+    TRACE_SCOPE("queue", "push");
     if (!q || !item) {
         printf("invalid paraments!\n");
         return -1;
     }
-    if (q->depth >= q->max_depth) {
-        if (q->mode == QUEUE_FULL_FLUSH) {
-            queue_flush(q);
-        } else if (q->mode == QUEUE_FULL_RING) {
-            queue_pop_free(q);
+    if (q->ring) {
+        if (0 != ring_push(q, item)) {
+            return -1;
         }
+        ring_wakeup(q);
+        return 0;
+    }
+    len = item_size(q, item);
+    if (q->mode == QUEUE_FULL_BLOCK && timeout_ms > 0) {
+        deadline_get(&deadline, timeout_ms);
     }
     pthread_mutex_lock(&q->lock);
+    if (q->branch_cnt > 0) {
+        ret = branch_fanout(q, item);
+        pthread_mutex_unlock(&q->lock);
+        return ret;
+    }
+    if (list_skip(q, item)) {
+        pthread_mutex_unlock(&q->lock);
+        return 0;
+    }
+    while (list_full(q, len)) {
+        switch (q->mode) {
+        case QUEUE_FULL_FLUSH:
+            list_flush(q, QUEUE_DROP_FLUSH);
+            break;
+        case QUEUE_FULL_RING:
+            stats_drop(&q->cnt, QUEUE_DROP_OLDEST);
+            queue_item_free(q, list_take(q));
+            break;
+        case QUEUE_FULL_DROP_NONKEY:
+        case QUEUE_FULL_SKIP_TO_KEY:
+            if (0 == list_drop_group(q)) {
+                /* only key or keep items queued, fall back to oldest */
+                stats_drop(&q->cnt, QUEUE_DROP_OLDEST);
+                queue_item_free(q, list_take(q));
+            } else if (list_skip(q, item)) {
+                /* new item belongs to the group just dropped */
+                pthread_mutex_unlock(&q->lock);
+                return 0;
+            }
+            break;
+        case QUEUE_FULL_DROP_NEW:
+            q->cnt.reject++;
+            pthread_mutex_unlock(&q->lock);
+            return -1;
+        case QUEUE_FULL_BLOCK:
+            if (timeout_ms == 0) {
+                ret = ETIMEDOUT;
+            } else if (timeout_ms < 0) {
+                ret = pthread_cond_wait(&q->not_full, &q->lock);
+            } else {
+                ret = pthread_cond_timedwait(&q->not_full, &q->lock, &deadline);
+            }
+            if (ret == ETIMEDOUT) {
+                q->cnt.reject++;
+                pthread_mutex_unlock(&q->lock);
+                return -1;
+            }
+            break;
+        }
+    }
+    if (q->latency) {
+        item->ts = queue_now_us();
+    }
     list_add_tail(&item->entry, &q->head);
     ++(q->depth);
-    queue_branch_notify(q);
+    q->bytes += len;
+    stats_push(&q->cnt, q->depth);
+    if (q->bytes > q->cnt.bytes_max) {
+        q->cnt.bytes_max = q->bytes;
+    }
     pthread_cond_signal(&q->cond);
     pthread_mutex_unlock(&q->lock);
-    if (q->depth > q->max_depth) {
-        printf("queue depth reach max depth %d\n", q->depth);
-    }
     return 0;
 }
 
-struct queue_item *queue_pop(struct queue *q)
+int queue_push(struct queue *q, struct queue_item *item)
 {
+    return queue_push_timeout(q, item, -1);
+}
+
+static void deadline_get(struct timespec *ts, int timeout_ms)
+{
+#if defined (OS_LINUX)
+    clock_gettime(CLOCK_MONOTONIC, ts);
+#else
     struct timeval now;
-    struct timespec outtime;
+    gettimeofday(&now, NULL);
+    ts->tv_sec = now.tv_sec;
+    ts->tv_nsec = now.tv_usec * 1000;
+#endif
+    ts->tv_sec += timeout_ms / 1000;
+    ts->tv_nsec += (timeout_ms % 1000) * 1000000L;
+    if (ts->tv_nsec >= 1000000000L) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000L;
+    }
+}
+
+/*
+ * wait cond until deadline, timeout_ms < 0 waits by 1s slice forever,
+ * return 0 if signaled, ETIMEDOUT if deadline reached
+ */
+static int cond_wait_until(struct queue *q, int timeout_ms, struct timespec *deadline)
+{
     int ret;
-    struct queue_item *item = NULL;
-    if (!q) {
-        printf("invalid parament!\n");
-        return NULL;
+    struct timespec outtime;
+    if (timeout_ms < 0) {
+        deadline_get(&outtime, 1000);
+    } else {
+        outtime = *deadline;
+    }
+    ret = pthread_cond_timedwait(&q->cond, &q->lock, &outtime);
+    switch (ret) {
+    case 0:
+        break;
+    case ETIMEDOUT:
+        //printf("the condition variable was not signaled "
+        //       "until the timeout specified by abstime.\n");
+        break;
+    case EINTR:
+        printf("pthread_cond_timedwait was interrupted by a signal.\n");
+        break;
+    default:
+        printf("pthread_cond_timedwait error:%s.\n", strerror(ret));
+        break;
+    }
+    return ret;
+}
+
+static struct queue_item *list_take(struct queue *q)
+{
+    struct queue_item *item;
+    item = list_first_entry_or_null(&q->head, struct queue_item, entry);
+    if (item) {
+        list_del(&item->entry);
+        --(q->depth);
+        q->bytes -= item_size(q, item);
+        pthread_cond_signal(&q->not_full);
     }
+    return item;
+}
 
+static void ring_pop_account(struct queue *q, struct queue_item **items, int n)
+{
+    int i;
+    if (q->latency) {
+        for (i = 0; i < n; i++) {
+            stats_latency(q, &q->cnt, items[i], true);
+        }
+    }
+}
+
+static int ring_pop_batch(struct queue *q, struct queue_item **items, int max,
+                int timeout_ms)
+{
+    int n = 0, ret = 0;
+    struct timespec deadline;
+
+    while (n < max && (items[n] = ring_pop(q)) != NULL) {
+        n++;
+    }
+    if (n > 0 || timeout_ms == 0) {
+        ring_pop_account(q, items, n);
+        return n;
+    }
+    if (timeout_ms > 0) {
+        deadline_get(&deadline, timeout_ms);
+    }
     pthread_mutex_lock(&q->lock);
-    while (list_empty(&q->head)) {
-        gettimeofday(&now, NULL);
-        outtime.tv_sec = now.tv_sec + 1;
-        outtime.tv_nsec = now.tv_usec * 1000;
-        ret = pthread_cond_timedwait(&q->cond, &q->lock, &outtime);
-        if (ret == 0) {
-            break;
+    __atomic_fetch_add(&q->ring_waiters, 1, __ATOMIC_SEQ_CST);
+    while (1) {
+        while (n < max && (items[n] = ring_pop(q)) != NULL) {
+            n++;
         }
-        switch (ret) {
-        case ETIMEDOUT:
-            //printf("the condition variable was not signaled "
-            //       "until the timeout specified by abstime.\n");
-            break;
-        case EINTR:
-            printf("pthread_cond_timedwait was interrupted by a signal.\n");
-            break;
-        default:
-            printf("pthread_cond_timedwait error:%s.\n", strerror(ret));
+        if (n > 0 || ret == ETIMEDOUT) {
             break;
         }
+        ret = cond_wait_until(q, timeout_ms, &deadline);
+        if (ret == ETIMEDOUT && timeout_ms < 0) {
+            ret = 0;
+        }
     }
+    __atomic_fetch_sub(&q->ring_waiters, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&q->lock);
+    ring_pop_account(q, items, n);
+    return n;
+}
 
-    item = list_first_entry_or_null(&q->head, struct queue_item, entry);
-    if (item) {
-        --item->ref_cnt;
-        if (item->ref_cnt <= 0) {
-            list_del(&item->entry);
-            --(q->depth);
+int queue_pop_batch(struct queue *q, struct queue_item **items, int max,
+                int timeout_ms)
+{
+    int n = 0, ret = 0;
+    struct timespec deadline;
+
+    TRACE_SCOPE("queue", "pop");
+    if (!q || !items || max <= 0) {
+        printf("invalid parament!\n");
+        return -1;
+    }
+    if (q->ring) {
+        return ring_pop_batch(q, items, max, timeout_ms);
+    }
+    if (timeout_ms > 0) {
+        deadline_get(&deadline, timeout_ms);
+    }
+    pthread_mutex_lock(&q->lock);
+    while (list_empty(&q->head) && timeout_ms != 0) {
+        ret = cond_wait_until(q, timeout_ms, &deadline);
+        if (ret == 0 || (ret == ETIMEDOUT && timeout_ms > 0)) {
+            break;
         }
     }
+    while (n < max && (items[n] = list_take(q)) != NULL) {
+        stats_latency(q, &q->cnt, items[n], false);
+        n++;
+    }
+    q->cnt.pop += n;
     pthread_mutex_unlock(&q->lock);
+    return n;
+}
+
+struct queue_item *queue_pop_wait(struct queue *q, int timeout_ms)
+{
+    struct queue_item *item = NULL;
+    if (1 != queue_pop_batch(q, &item, 1, timeout_ms)) {
+        return NULL;
+    }
     return item;
 }
 
+struct queue_item *queue_pop(struct queue *q)
+{
+    return queue_pop_wait(q, -1);
+}
+
 struct queue_branch *queue_branch_new(struct queue *q, const char *name)
 {
     struct queue_branch *qb;
     if (!q || !name) {
         return NULL;
     }
+    if (q->ring) {
+        printf("branch is not supported by ring queue!\n");
+        return NULL;
+    }
     qb = CALLOC(1, struct queue_branch);
     if (!qb) {
         return NULL;
     }
+    qb->cap = q->max_depth;
+    qb->slots = CALLOC(qb->cap, struct queue_item *);
+    if (!qb->slots) {
+        printf("malloc branch slots failed!\n");
+        free(qb);
+        return NULL;
+    }
 #if !(defined (OS_WINDOWS) || defined (OS_RTOS))
-    if (-1 == (qb->evfd = eventfd(0, 0))) {
+    if (-1 == (qb->evfd = eventfd(0, EFD_NONBLOCK))) {
         printf("eventfd failed: %s\n", strerror(errno));
+        free(qb->slots);
+        free(qb);
         return NULL;
     }
 #endif
     qb->name = strdup(name);
+    pthread_mutex_lock(&q->lock);
     list_add_tail(&qb->hook, &q->branch);
     q->branch_cnt++;
+    pthread_mutex_unlock(&q->lock);
     return qb;
 }
 
 int queue_branch_del(struct queue *q, const char *name)
 {
-    struct queue_branch *qb, *next;
+    struct queue_branch *qb;
     if (!q || !name) {
         return -1;
     }
-#if defined (OS_LINUX) || defined (OS_RTOS) || defined (OS_RTTHREAD) || defined (OS_APPLE)
-    list_for_each_entry_safe(qb, next, &q->branch, hook) {
-#elif defined (OS_WINDOWS)
-    list_for_each_entry_safe(qb, struct queue_branch, next, struct queue_branch, &q->branch, hook) {
-#endif
-        if (!strcmp(qb->name, name)) {
-            list_del(&qb->hook);
-#if !defined (OS_WINDOWS)
-            close(qb->evfd);
-#endif
-            free(qb->name);
-            free(qb);
-            q->branch_cnt--;
-            return 0;
-        }
+    pthread_mutex_lock(&q->lock);
+    qb = branch_find(q, name);
+    if (!qb) {
+        pthread_mutex_unlock(&q->lock);
+        return -1;
     }
-    return -1;
+    list_del(&qb->hook);
+    q->branch_cnt--;
+    branch_free(q, qb);
+    pthread_mutex_unlock(&q->lock);
+    return 0;
 }
 
 struct queue_branch *queue_branch_get(struct queue *q, const char *name)
 {
-    struct queue_branch *qb, *next;
+    struct queue_branch *qb;
     if (!q || !name) {
         return NULL;
     }
-
-#if defined (OS_LINUX) || defined (OS_RTOS) || defined (OS_RTTHREAD) || defined (OS_APPLE)
-    list_for_each_entry_safe(qb, next, &q->branch, hook) {
-#elif defined (OS_WINDOWS)
-    list_for_each_entry_safe(qb, struct queue_branch, next, struct queue_branch, &q->branch, hook) {
-#endif
-        if (!strcmp(qb->name, name)) {
-            return qb;
-        }
-    }
-    return NULL;
+    pthread_mutex_lock(&q->lock);
+    qb = branch_find(q, name);
+    pthread_mutex_unlock(&q->lock);
+    return qb;
 }
 
 int queue_branch_notify(struct queue *q)
 {
     struct queue_branch *qb, *next;
-    uint64_t notify = '1';
     if (!q) {
         return -1;
     }
@@ -331,38 +1239,125 @@ int queue_branch_notify(struct queue *q)
 #elif defined (OS_WINDOWS)
     list_for_each_entry_safe(qb, struct queue_branch, next, struct queue_branch, &q->branch, hook) {
 #endif
-
-#if !defined (OS_WINDOWS)
-        if (write(qb->evfd, &notify, sizeof(notify)) != sizeof(uint64_t)) {
-            printf("write eventfd failed: %s\n", strerror(errno));
-        }
-#endif
+        branch_notify(qb);
     }
     return 0;
 }
 
 struct queue_item *queue_branch_pop(struct queue *q, const char *name)
 {
-    struct queue_branch *qb, *next;
-    uint64_t notify = '1';
+    struct queue_branch *qb;
+    struct queue_item *item = NULL;
 
     if (!q || !name) {
         return NULL;
     }
+    pthread_mutex_lock(&q->lock);
+    qb = branch_find(q, name);
+    if (qb) {
+        item = branch_take(qb);
+        if (item) {
+            qb->cnt.pop++;
+            stats_latency(q, &qb->cnt, item, false);
+        }
+    }
+    pthread_mutex_unlock(&q->lock);
+    return item;
+}
+
+static void stats_fill(struct queue_stats *st, struct queue_counter *c)
+{
+    st->push = c->push;
+    st->pop = c->pop;
+    st->drop = c->drop;
+    st->reject = c->reject;
+    memcpy(st->drop_by, c->drop_by, sizeof(st->drop_by));
+    st->depth_max = c->depth_max;
+    st->bytes_max = c->bytes_max;
+    st->latency_avg_us = c->lat_cnt ? c->lat_sum_us / c->lat_cnt : 0;
+    st->latency_max_us = c->lat_max_us;
+    memcpy(st->latency_hist, c->lat_hist, sizeof(st->latency_hist));
+}
+
+int queue_set_latency(struct queue *q, bool enable)
+{
+    if (!q) {
+        return -1;
+    }
+    q->latency = enable;
+    return 0;
+}
+
+int queue_get_stats(struct queue *q, struct queue_stats *st)
+{
+    int i;
+    struct queue_counter c;
+    if (!q || !st) {
+        return -1;
+    }
+    memset(st, 0, sizeof(*st));
+    if (q->ring) {
+        c.push = __atomic_load_n(&q->cnt.push, __ATOMIC_RELAXED);
+        c.drop = __atomic_load_n(&q->cnt.drop, __ATOMIC_RELAXED);
+        c.reject = __atomic_load_n(&q->cnt.reject, __ATOMIC_RELAXED);
+        c.lat_sum_us = __atomic_load_n(&q->cnt.lat_sum_us, __ATOMIC_RELAXED);
+        c.lat_cnt = __atomic_load_n(&q->cnt.lat_cnt, __ATOMIC_RELAXED);
+        c.lat_max_us = __atomic_load_n(&q->cnt.lat_max_us, __ATOMIC_RELAXED);
+        for (i = 0; i < QUEUE_DROP_REASON_MAX; i++) {
+            c.drop_by[i] = __atomic_load_n(&q->cnt.drop_by[i], __ATOMIC_RELAXED);
+        }
+        for (i = 0; i < QUEUE_LAT_BUCKETS; i++) {
+            c.lat_hist[i] = __atomic_load_n(&q->cnt.lat_hist[i], __ATOMIC_RELAXED);
+        }
+        c.depth_max = 0;
+        c.bytes_max = 0;
+        stats_fill(st, &c);
+        st->depth = ring_depth(q->ring);
+        st->push = __atomic_load_n(&q->ring->prod, __ATOMIC_RELAXED);
+        st->pop = __atomic_load_n(&q->ring->cons, __ATOMIC_RELAXED) - st->drop;
+        return 0;
+    }
+    pthread_mutex_lock(&q->lock);
+    stats_fill(st, &q->cnt);
+    st->depth = q->depth;
+    st->bytes = q->bytes;
+    pthread_mutex_unlock(&q->lock);
+    return 0;
+}
+
+int queue_branch_get_stats(struct queue *q, const char *name, struct queue_stats *st)
+{
+    struct queue_branch *qb;
+    if (!q || !name || !st) {
+        return -1;
+    }
+    memset(st, 0, sizeof(*st));
+    pthread_mutex_lock(&q->lock);
+    qb = branch_find(q, name);
+    if (qb) {
+        stats_fill(st, &qb->cnt);
+        st->depth = qb->count;
+    }
+    pthread_mutex_unlock(&q->lock);
+    return qb ? 0 : -1;
+}
+
+void queue_reset_stats(struct queue *q)
+{
+    struct queue_branch *qb, *next;
+    if (!q) {
+        return;
+    }
+    pthread_mutex_lock(&q->lock);
+    if (!q->ring) {
+        memset(&q->cnt, 0, sizeof(q->cnt));
+    }
 #if defined (OS_LINUX) || defined (OS_RTOS) || defined (OS_RTTHREAD) || defined (OS_APPLE)
     list_for_each_entry_safe(qb, next, &q->branch, hook) {
 #elif defined (OS_WINDOWS)
     list_for_each_entry_safe(qb, struct queue_branch, next, struct queue_branch, &q->branch, hook) {
 #endif
-
-        if (!strcmp(qb->name, name)) {
-#if !defined (OS_WINDOWS)
-            if (read(qb->evfd, &notify, sizeof(notify)) != sizeof(uint64_t)) {
-                printf("read eventfd failed: %s\n", strerror(errno));
-            }
-#endif
-            return queue_pop(q);
-        }
+        memset(&qb->cnt, 0, sizeof(qb->cnt));
     }
-    return NULL;
+    pthread_mutex_unlock(&q->lock);
 }
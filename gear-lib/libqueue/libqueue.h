@@ -33,6 +33,15 @@
  *                 |-->branch1
  * t1-->t2-->...-->tN
  *                 |-->branch2
+ *
+ * when branch exists, pushed item is fanned out to every branch without
+ * copy, each branch keeps its own ring of item references with depth of
+ * queue, item is freed after all branches queue_item_free it.
+ * a full branch drops its own oldest (QUEUE_FULL_RING) or all references,
+ * so slow branch doesn't block others
+ *
+ * QUEUE_SPSC/QUEUE_MPMC queue is lock-free bounded ring of queue_item
+ * pointers, no branch supported
  */
 
 
@@ -40,9 +49,34 @@
 extern "C" {
 #endif
 
+/*
+ * policy when queue reaches max depth or max bytes
+ * branch never blocks producer, BLOCK and the key modes work as RING for
+ * branch. key modes use item flags (see QUEUE_ITEM_KEY) to keep what is
+ * queued decodable: after dropping a group up to the end of queue, new
+ * non-key items are dropped too until the next key item is pushed
+ */
 enum queue_mode {
-    QUEUE_FULL_FLUSH = 0,
-    QUEUE_FULL_RING,
+    QUEUE_FULL_FLUSH = 0,   /* drop all queued items */
+    QUEUE_FULL_RING,        /* drop oldest item */
+    QUEUE_FULL_DROP_NEW,    /* reject new item, push return -1 */
+    QUEUE_FULL_BLOCK,       /* producer waits for room */
+    QUEUE_FULL_DROP_NONKEY, /* drop non-key items of oldest group, key stays */
+    QUEUE_FULL_SKIP_TO_KEY, /* drop oldest group up to the next key item */
+};
+
+/*
+ * queue_item flags, set by classify hook at queue_item_alloc or by
+ * caller before push. KEY starts a group decodable on its own, e.g. IDR
+ * frame, KEEP is never dropped by key modes, e.g. audio or parameter sets
+ */
+#define QUEUE_ITEM_KEY      (1 << 0)
+#define QUEUE_ITEM_KEEP     (1 << 1)
+
+enum queue_type {
+    QUEUE_LIST = 0,     /* mutex protected list, default */
+    QUEUE_SPSC,         /* lock-free ring, single producer single consumer */
+    QUEUE_MPMC,         /* lock-free ring, multi producer multi consumer */
 };
 
 
@@ -52,17 +86,76 @@ struct queue_item {
     struct iovec     opaque;
     void            *arg;
     int              ref_cnt;
+    uint32_t         flags;         /* QUEUE_ITEM_* */
+    uint64_t         ts;            /* push time in us, if latency enabled */
+};
+
+/* why an accepted item was discarded, index of queue_stats.drop_by */
+enum queue_drop_reason {
+    QUEUE_DROP_CLEAR = 0,   /* queue_flush or queue_destroy */
+    QUEUE_DROP_FLUSH,       /* QUEUE_FULL_FLUSH emptied the queue */
+    QUEUE_DROP_OLDEST,      /* QUEUE_FULL_RING, or key mode with no group */
+    QUEUE_DROP_GROUP,       /* key mode dropped a group */
+    QUEUE_DROP_SKIP,        /* non-key item pushed while waiting for key */
+    QUEUE_DROP_REASON_MAX,
+};
+
+/* latency_hist[i] counts delays in [2^i, 2^(i+1)) us, 0 goes to first, last is open */
+#define QUEUE_LAT_BUCKETS   24
+
+/*
+ * snapshot of counters, drop is item accepted then discarded by full
+ * policy or flush, split by reason in drop_by, reject is push refused.
+ * latency is queueing delay from push to pop, only recorded after
+ * queue_set_latency(q, true). bytes_max is only tracked for list type,
+ * depth_max is not tracked and reset_stats is not applied for ring type
+ */
+struct queue_stats {
+    uint64_t         push;
+    uint64_t         pop;
+    uint64_t         drop;
+    uint64_t         reject;
+    uint64_t         drop_by[QUEUE_DROP_REASON_MAX];
+    int              depth;
+    int              depth_max;
+    size_t           bytes;
+    size_t           bytes_max;
+    uint64_t         latency_avg_us;
+    uint64_t         latency_max_us;
+    uint64_t         latency_hist[QUEUE_LAT_BUCKETS];
+};
+
+struct queue_counter {
+    uint64_t         push;
+    uint64_t         pop;
+    uint64_t         drop;
+    uint64_t         reject;
+    uint64_t         drop_by[QUEUE_DROP_REASON_MAX];
+    int              depth_max;
+    size_t           bytes_max;
+    uint64_t         lat_sum_us;
+    uint64_t         lat_cnt;
+    uint64_t         lat_max_us;
+    uint64_t         lat_hist[QUEUE_LAT_BUCKETS];
 };
 
 struct queue;
+struct queue_ring;
+struct queue_pool;
 
 typedef void *(queue_alloc_hook)(void *data, size_t len, void *arg);
 typedef void (queue_free_hook)(void *data);
+typedef uint32_t (queue_classify_hook)(void *data, size_t len, void *arg);
 
 struct queue_branch {
     char             *name;
-    int              evfd;
+    int              evfd;          /* readable while branch is not empty */
     struct list_head hook;
+    struct queue_item **slots;
+    int              head;
+    int              count;
+    int              cap;
+    struct queue_counter cnt;
 };
 
 struct queue {
@@ -71,34 +164,85 @@ struct queue {
     int               max_depth;
     pthread_mutex_t   lock;
     pthread_cond_t    cond;
+    pthread_cond_t    not_full;     /* for QUEUE_FULL_BLOCK producer */
+    size_t            bytes;        /* payload bytes queued in list */
+    size_t            max_bytes;    /* 0: no byte budget */
     enum queue_mode   mode;
     queue_alloc_hook *alloc_hook;
     queue_free_hook  *free_hook;
     struct list_head  branch;
     int               branch_cnt;
     struct iovec      opaque;
+    enum queue_type   type;
+    struct queue_ring *ring;        /* only for SPSC/MPMC type */
+    struct queue_pool *pool;        /* item and payload cache */
+    int               ring_waiters; /* consumers sleeping on empty ring */
+    bool              latency;
+    bool              skip_to_key;  /* group dropped to end, wait key */
+    queue_classify_hook *classify;
+    struct queue_counter cnt;
 };
 
 GEAR_API struct queue_item *queue_item_alloc(struct queue *q, void *data, size_t len, void *arg);
+/* queue_item_free drops one reference, queue_item_get takes one more */
 GEAR_API void queue_item_free(struct queue *q, struct queue_item *item);
+GEAR_API struct queue_item *queue_item_get(struct queue_item *item);
 GEAR_API struct iovec *queue_item_get_data(struct queue *q, struct queue_item *it);
 
 GEAR_API struct queue *queue_create();
+/*
+ * create queue of type, depth is rounded up to power of 2 for ring types.
+ * ring in QUEUE_FULL_FLUSH mode rejects push when full, QUEUE_FULL_RING
+ * mode drops oldest item, which is only allowed for QUEUE_MPMC, other
+ * modes reject like FLUSH
+ */
+GEAR_API struct queue *queue_create_by(enum queue_type type, int depth);
 GEAR_API void queue_destroy(struct queue *q);
 GEAR_API int queue_set_depth(struct queue *q, int depth);
 GEAR_API int queue_get_depth(struct queue *q);
+/* byte budget of payload queued, only for QUEUE_LIST, 0 disables it */
+GEAR_API int queue_set_bytes(struct queue *q, size_t max_bytes);
+GEAR_API size_t queue_get_bytes(struct queue *q);
 GEAR_API int queue_set_mode(struct queue *q, enum queue_mode mode);
+/*
+ * cache queue_item with inline payload of up to max_payload bytes in slab,
+ * nitems are preallocated and pool grows by nitems when exhausted.
+ * item_alloc of larger payload or with alloc_hook falls back to malloc.
+ * must be set before any item allocated
+ */
+GEAR_API int queue_set_pool(struct queue *q, int nitems, size_t max_payload);
 GEAR_API int queue_set_hook(struct queue *q, queue_alloc_hook *alloc_cb, queue_free_hook *free_cb);
+/* cb returns QUEUE_ITEM_* flags of payload, called by queue_item_alloc */
+GEAR_API int queue_set_classify(struct queue *q, queue_classify_hook *cb);
 GEAR_API struct queue_item *queue_pop(struct queue *q);
+/*
+ * timeout_ms: 0 nonblock, < 0 wait forever, may return NULL when queue
+ * flushed. pop_batch takes up to max items under one lock,
+ * return count of items
+ */
+GEAR_API struct queue_item *queue_pop_wait(struct queue *q, int timeout_ms);
+GEAR_API int queue_pop_batch(struct queue *q, struct queue_item **items, int max,
+                int timeout_ms);
+/*
+ * push return -1 if item is rejected or timeout, caller still owns item.
+ * timeout_ms only matters in QUEUE_FULL_BLOCK mode, < 0 waits forever
+ */
 GEAR_API int queue_push(struct queue *q, struct queue_item *item);
+GEAR_API int queue_push_timeout(struct queue *q, struct queue_item *item, int timeout_ms);
 GEAR_API int queue_flush(struct queue *q);
 
 GEAR_API struct queue_branch *queue_branch_new(struct queue *q, const char *name);
 GEAR_API int queue_branch_del(struct queue *q, const char *name);
 GEAR_API int queue_branch_notify(struct queue *q);
+/* nonblock, poll branch evfd to wait */
 GEAR_API struct queue_item *queue_branch_pop(struct queue *q, const char *name);
 GEAR_API struct queue_branch *queue_branch_get(struct queue *q, const char *name);
 
+GEAR_API int queue_set_latency(struct queue *q, bool enable);
+GEAR_API int queue_get_stats(struct queue *q, struct queue_stats *st);
+GEAR_API int queue_branch_get_stats(struct queue *q, const char *name, struct queue_stats *st);
+GEAR_API void queue_reset_stats(struct queue *q);
+
 #ifdef __cplusplus
 }
 #endif
@@ -21,9 +21,156 @@
  ******************************************************************************/
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
 #include "libqueue.h"
 
+static int foo_ring(void)
+{
+    int i;
+    struct queue_item *item;
+    struct queue *q = queue_create_by(QUEUE_SPSC, 4);
+    if (!q) {
+        printf("queue_create_by failed!\n");
+        return -1;
+    }
+    queue_set_pool(q, 8, sizeof(int));
+    for (i = 0; i < 5; i++) {
+        item = queue_item_alloc(q, &i, sizeof(i), NULL);
+        if (0 != queue_push(q, item)) {
+            printf("ring full, push %d failed\n", i);
+            queue_item_free(q, item);
+        }
+    }
+    while ((item = queue_pop_wait(q, 0)) != NULL) {
+        printf("pop %d\n", *(int *)queue_item_get_data(q, item)->iov_base);
+        queue_item_free(q, item);
+    }
+    queue_destroy(q);
+    return 0;
+}
+
+static void stats_dump(const char *name, struct queue_stats *st)
+{
+    int i;
+    printf("%s: push=%" PRIu64 " pop=%" PRIu64 " drop=%" PRIu64 " reject=%" PRIu64
+           " depth=%d/%d bytes_max=%zu latency avg=%" PRIu64 "us max=%" PRIu64 "us\n",
+           name, st->push, st->pop, st->drop, st->reject, st->depth,
+           st->depth_max, st->bytes_max, st->latency_avg_us, st->latency_max_us);
+    printf("%s: drop clear=%" PRIu64 " flush=%" PRIu64 " oldest=%" PRIu64
+           " group=%" PRIu64 " skip=%" PRIu64 "\n", name,
+           st->drop_by[QUEUE_DROP_CLEAR], st->drop_by[QUEUE_DROP_FLUSH],
+           st->drop_by[QUEUE_DROP_OLDEST], st->drop_by[QUEUE_DROP_GROUP],
+           st->drop_by[QUEUE_DROP_SKIP]);
+    for (i = 0; i < QUEUE_LAT_BUCKETS; i++) {
+        if (st->latency_hist[i]) {
+            printf("%s: latency [%u, %u)us %" PRIu64 "\n", name,
+                   1u << i, 2u << i, st->latency_hist[i]);
+        }
+    }
+}
+
+static int foo_branch(void)
+{
+    int i;
+    const char *names[2] = {"video", "record"};
+    struct queue_item *item, *held;
+    struct queue_stats st;
+    struct queue *q = queue_create();
+    if (!q) {
+        printf("queue_create failed!\n");
+        return -1;
+    }
+    queue_set_latency(q, true);
+    queue_branch_new(q, names[0]);
+    queue_branch_new(q, names[1]);
+    for (i = 0; i < 3; i++) {
+        item = queue_item_alloc(q, &i, sizeof(i), NULL);
+        if (i == 0) {
+            /* producer keeps first item alive after both branches free it */
+            held = queue_item_get(item);
+        }
+        queue_push(q, item);
+    }
+    for (i = 0; i < 2; i++) {
+        while ((item = queue_branch_pop(q, names[i])) != NULL) {
+            printf("branch %s pop %d\n", names[i],
+                   *(int *)queue_item_get_data(q, item)->iov_base);
+            queue_item_free(q, item);
+        }
+        queue_branch_get_stats(q, names[i], &st);
+        stats_dump(names[i], &st);
+    }
+    printf("held item %d\n", *(int *)queue_item_get_data(q, held)->iov_base);
+    queue_item_free(q, held);
+    queue_destroy(q);
+    return 0;
+}
+
+/* 'I' key frame, 'P' delta frame, 'A' audio */
+static uint32_t frame_classify(void *data, size_t len, void *arg)
+{
+    switch (*(char *)data) {
+    case 'I':
+        return QUEUE_ITEM_KEY;
+    case 'A':
+        return QUEUE_ITEM_KEEP;
+    default:
+        return 0;
+    }
+}
+
+static int foo_key(enum queue_mode mode, const char *expect)
+{
+    int i, n = 0;
+    char out[32];
+    uint64_t lat_cnt = 0;
+    const char *frames = "IPAPPIPPPAPIP";
+    struct queue_item *item;
+    struct queue_stats st;
+    struct queue *q = queue_create();
+    if (!q) {
+        printf("queue_create failed!\n");
+        return -1;
+    }
+    queue_set_depth(q, 6);
+    queue_set_latency(q, true);
+    queue_set_mode(q, mode);
+    queue_set_classify(q, frame_classify);
+    for (i = 0; frames[i]; i++) {
+        item = queue_item_alloc(q, (void *)&frames[i], 1, NULL);
+        queue_push(q, item);
+    }
+    while ((item = queue_pop_wait(q, 0)) != NULL) {
+        out[n++] = *(char *)item->data.iov_base;
+        queue_item_free(q, item);
+    }
+    out[n] = '\0';
+    printf("%s: pushed %s, popped %s\n",
+           mode == QUEUE_FULL_DROP_NONKEY ? "drop_nonkey" : "skip_to_key", frames, out);
+    queue_get_stats(q, &st);
+    stats_dump("key", &st);
+    queue_destroy(q);
+    for (i = 0; i < QUEUE_LAT_BUCKETS; i++) {
+        lat_cnt += st.latency_hist[i];
+    }
+    if (st.drop != st.drop_by[QUEUE_DROP_GROUP] + st.drop_by[QUEUE_DROP_SKIP] +
+                   st.drop_by[QUEUE_DROP_OLDEST] ||
+        st.drop + (uint64_t)n != strlen(frames) || st.bytes_max != 6 ||
+        lat_cnt != (uint64_t)n) {
+        return -1;
+    }
+    return strcmp(out, expect) ? -1 : 0;
+}
+
 int main(int argc, char **argv)
 {
+    foo_ring();
+    foo_branch();
+    if (0 != foo_key(QUEUE_FULL_DROP_NONKEY, "IAIAIP") ||
+        0 != foo_key(QUEUE_FULL_SKIP_TO_KEY, "AAIP")) {
+        printf("key mode check failed!\n");
+        return -1;
+    }
     return 0;
 }
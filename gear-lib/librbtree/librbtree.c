@@ -413,12 +413,6 @@ static inline void dummy_propagate(struct rb_node *node, struct rb_node *stop) {
 static inline void dummy_copy(struct rb_node *old, struct rb_node *_new) {}
 static inline void dummy_rotate(struct rb_node *old, struct rb_node *_new) {}
 
-struct rb_augment_callbacks {
-    void (*propagate)(struct rb_node *node, struct rb_node *stop);
-    void (*copy)(struct rb_node *old, struct rb_node *_new);
-    void (*rotate)(struct rb_node *old, struct rb_node *_new);
-};
-
 static const struct rb_augment_callbacks dummy_callbacks = {
     dummy_propagate, dummy_copy, dummy_rotate
 };
@@ -536,6 +530,27 @@ void rb_erase(struct rb_node *node, struct rb_root *root)
         ____rb_erase_color(rebalance, root, dummy_rotate);
 }
 
+/*
+ * Augmented rbtree manipulation functions.
+ *
+ * This instantiates the same __always_inline functions as in the
+ * non-augmented case, but this time with user-defined callbacks.
+ */
+void __rb_insert_augmented(struct rb_node *node, struct rb_root *root,
+    void (*augment_rotate)(struct rb_node *old, struct rb_node *_new))
+{
+    __rb_insert(node, root, augment_rotate);
+}
+
+void rb_erase_augmented(struct rb_node *node, struct rb_root *root,
+                const struct rb_augment_callbacks *augment)
+{
+    struct rb_node *rebalance;
+    rebalance = __rb_erase_augmented(node, root, augment);
+    if (rebalance)
+        ____rb_erase_color(rebalance, root, augment->rotate);
+}
+
 /*
  * This function returns the first node (in sort order) of the tree.
  */
@@ -675,3 +690,244 @@ struct rb_node *rb_first_postorder(const struct rb_root *root)
 
     return rb_left_deepest_node(root->rb_node);
 }
+
+/*
+ * interval tree, same as linux kernel interval_tree_generic.h
+ */
+static inline unsigned long itree_compute_last(struct interval_tree_node *node)
+{
+    unsigned long max = node->last, subtree_last;
+    if (node->rb.rb_left) {
+        subtree_last = rb_entry(node->rb.rb_left,
+                        struct interval_tree_node, rb)->__subtree_last;
+        if (max < subtree_last)
+            max = subtree_last;
+    }
+    if (node->rb.rb_right) {
+        subtree_last = rb_entry(node->rb.rb_right,
+                        struct interval_tree_node, rb)->__subtree_last;
+        if (max < subtree_last)
+            max = subtree_last;
+    }
+    return max;
+}
+
+RB_DECLARE_CALLBACKS(static, itree_augment, struct interval_tree_node, rb,
+                     unsigned long, __subtree_last, itree_compute_last)
+
+void interval_tree_insert(struct interval_tree_node *node,
+                struct rb_root_cached *root)
+{
+    struct rb_node **link = &root->rb_root.rb_node, *rb_parent = NULL;
+    unsigned long start = node->start, last = node->last;
+    struct interval_tree_node *parent;
+    bool leftmost = true;
+
+    while (*link) {
+        rb_parent = *link;
+        parent = rb_entry(rb_parent, struct interval_tree_node, rb);
+        if (parent->__subtree_last < last)
+            parent->__subtree_last = last;
+        if (start < parent->start)
+            link = &parent->rb.rb_left;
+        else {
+            link = &parent->rb.rb_right;
+            leftmost = false;
+        }
+    }
+
+    node->__subtree_last = last;
+    rb_link_node(&node->rb, rb_parent, link);
+    rb_insert_augmented_cached(&node->rb, root, leftmost, &itree_augment);
+}
+
+void interval_tree_remove(struct interval_tree_node *node,
+                struct rb_root_cached *root)
+{
+    rb_erase_augmented_cached(&node->rb, root, &itree_augment);
+}
+
+/*
+ * Iterate over intervals intersecting [start;last]
+ *
+ * Note that a node's interval intersects [start;last] iff:
+ *   Cond1: node->start <= last
+ * and
+ *   Cond2: start <= node->last
+ */
+static struct interval_tree_node *
+itree_subtree_search(struct interval_tree_node *node,
+                unsigned long start, unsigned long last)
+{
+    while (true) {
+        /*
+         * Loop invariant: start <= node->__subtree_last
+         * (Cond2 is satisfied by one of the subtree nodes)
+         */
+        if (node->rb.rb_left) {
+            struct interval_tree_node *left = rb_entry(node->rb.rb_left,
+                            struct interval_tree_node, rb);
+            if (start <= left->__subtree_last) {
+                /*
+                 * Some nodes in left subtree satisfy Cond2.
+                 * Iterate to find the leftmost such node N.
+                 * If it also satisfies Cond1, that's the
+                 * match we are looking for. Otherwise, there
+                 * is no matching interval as nodes to the
+                 * right of N can't satisfy Cond1 either.
+                 */
+                node = left;
+                continue;
+            }
+        }
+        if (node->start <= last) {          /* Cond1 */
+            if (start <= node->last)        /* Cond2 */
+                return node;                /* node is leftmost match */
+            if (node->rb.rb_right) {
+                node = rb_entry(node->rb.rb_right,
+                                struct interval_tree_node, rb);
+                if (start <= node->__subtree_last)
+                    continue;
+            }
+        }
+        return NULL;    /* No match */
+    }
+}
+
+struct interval_tree_node *interval_tree_iter_first(struct rb_root_cached *root,
+                unsigned long start, unsigned long last)
+{
+    struct interval_tree_node *node, *leftmost;
+
+    if (!root->rb_root.rb_node)
+        return NULL;
+
+    /*
+     * Fastpath range intersection/overlap between A: [a0, a1] and
+     * B: [b0, b1] is given by:
+     *
+     *         a0 <= b1 && b0 <= a1
+     *
+     *  ... where A holds the lock range and B holds the smallest
+     * 'start' and largest 'last' in the tree. For the later, we
+     * rely on the root node, which by augmented interval tree
+     * property, holds the largest value in its last-in-subtree.
+     * This allows mitigating some of the tree walk overhead for
+     * for non-intersecting ranges, maintained and consulted in O(1).
+     */
+    node = rb_entry(root->rb_root.rb_node, struct interval_tree_node, rb);
+    if (node->__subtree_last < start)
+        return NULL;
+
+    leftmost = rb_entry(root->rb_leftmost, struct interval_tree_node, rb);
+    if (leftmost->start > last)
+        return NULL;
+
+    return itree_subtree_search(node, start, last);
+}
+
+struct interval_tree_node *interval_tree_iter_next(struct interval_tree_node *node,
+                unsigned long start, unsigned long last)
+{
+    struct rb_node *rb = node->rb.rb_right, *prev;
+
+    while (true) {
+        /*
+         * Loop invariants:
+         *   Cond1: node->start <= last
+         *   rb == node->rb.rb_right
+         *
+         * First, search right subtree if suitable
+         */
+        if (rb) {
+            struct interval_tree_node *right = rb_entry(rb,
+                            struct interval_tree_node, rb);
+            if (start <= right->__subtree_last)
+                return itree_subtree_search(right, start, last);
+        }
+
+        /* Move up the tree until we come from a node's left child */
+        do {
+            rb = rb_parent(&node->rb);
+            if (!rb)
+                return NULL;
+            prev = &node->rb;
+            node = rb_entry(rb, struct interval_tree_node, rb);
+            rb = node->rb.rb_right;
+        } while (prev == rb);
+
+        /* Check if the node intersects [start;last] */
+        if (last < node->start)             /* !Cond1 */
+            return NULL;
+        else if (start <= node->last)       /* Cond2 */
+            return node;
+    }
+}
+
+/*
+ * order statistic tree, subtree size as augmented data
+ */
+static inline unsigned long rb_os_size(const struct rb_node *rb)
+{
+    return rb ? rb_entry(rb, struct rb_os_node, rb)->size : 0;
+}
+
+static inline unsigned long rb_os_compute(struct rb_os_node *node)
+{
+    return 1 + rb_os_size(node->rb.rb_left) + rb_os_size(node->rb.rb_right);
+}
+
+RB_DECLARE_CALLBACKS(static, rb_os_augment, struct rb_os_node, rb,
+                     unsigned long, size, rb_os_compute)
+
+void rb_os_insert(struct rb_os_node *node, struct rb_root *root)
+{
+    struct rb_node *p;
+    /* node is linked as leaf, every ancestor subtree grows by one */
+    node->size = 1;
+    for (p = rb_parent(&node->rb); p; p = rb_parent(p))
+        rb_entry(p, struct rb_os_node, rb)->size++;
+    rb_insert_augmented(&node->rb, root, &rb_os_augment);
+}
+
+void rb_os_erase(struct rb_os_node *node, struct rb_root *root)
+{
+    rb_erase_augmented(&node->rb, root, &rb_os_augment);
+}
+
+struct rb_os_node *rb_os_select(const struct rb_root *root, unsigned long k)
+{
+    struct rb_node *rb = root->rb_node;
+    unsigned long left;
+
+    while (rb) {
+        left = rb_os_size(rb->rb_left);
+        if (k < left) {
+            rb = rb->rb_left;
+        } else if (k == left) {
+            return rb_entry(rb, struct rb_os_node, rb);
+        } else {
+            k -= left + 1;
+            rb = rb->rb_right;
+        }
+    }
+    return NULL;
+}
+
+unsigned long rb_os_rank(const struct rb_os_node *node)
+{
+    const struct rb_node *rb = &node->rb, *parent;
+    unsigned long rank = rb_os_size(rb->rb_left);
+
+    while ((parent = rb_parent(rb))) {
+        if (rb == parent->rb_right)
+            rank += rb_os_size(parent->rb_left) + 1;
+        rb = parent;
+    }
+    return rank;
+}
+
+unsigned long rb_os_count(const struct rb_root *root)
+{
+    return rb_os_size(root->rb_node);
+}
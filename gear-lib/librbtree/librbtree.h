@@ -79,6 +79,164 @@ static inline void rb_link_node(struct rb_node * node, struct rb_node * parent,
     *rb_link = node;
 }
 
+/*
+ * cached rbtree keeps the leftmost node, so rb_first_cached is O(1),
+ * useful when tree is used as a priority queue (timers, schedulers)
+ */
+struct rb_root_cached {
+    struct rb_root rb_root;
+    struct rb_node *rb_leftmost;
+};
+
+#define RB_ROOT_CACHED (struct rb_root_cached) { {NULL, }, NULL }
+
+#define rb_first_cached(root) (root)->rb_leftmost
+
+static inline void rb_insert_color_cached(struct rb_node *node,
+                struct rb_root_cached *root, bool leftmost)
+{
+    if (leftmost)
+        root->rb_leftmost = node;
+    rb_insert_color(node, &root->rb_root);
+}
+
+static inline void rb_erase_cached(struct rb_node *node,
+                struct rb_root_cached *root)
+{
+    if (root->rb_leftmost == node)
+        root->rb_leftmost = rb_next(node);
+    rb_erase(node, &root->rb_root);
+}
+
+static inline void rb_replace_node_cached(struct rb_node *victim,
+                struct rb_node *_new, struct rb_root_cached *root)
+{
+    if (root->rb_leftmost == victim)
+        root->rb_leftmost = _new;
+    rb_replace_node(victim, _new, &root->rb_root);
+}
+
+/*
+ * augmented rbtree keeps extra per node data computed from the node and
+ * its subtree, callbacks are called to keep it right on rebalance:
+ * propagate: update from node up to stop
+ * copy:      copy augmented data from old to new node (erase)
+ * rotate:    fix augmented data of old and new after rotation
+ */
+struct rb_augment_callbacks {
+    void (*propagate)(struct rb_node *node, struct rb_node *stop);
+    void (*copy)(struct rb_node *old, struct rb_node *_new);
+    void (*rotate)(struct rb_node *old, struct rb_node *_new);
+};
+
+void __rb_insert_augmented(struct rb_node *node, struct rb_root *root,
+                void (*augment_rotate)(struct rb_node *old, struct rb_node *_new));
+void rb_erase_augmented(struct rb_node *node, struct rb_root *root,
+                const struct rb_augment_callbacks *augment);
+
+/*
+ * caller must update augmented data along the path to the insertion
+ * point before calling (like rb_link_node), then rebalance here
+ */
+static inline void rb_insert_augmented(struct rb_node *node, struct rb_root *root,
+                const struct rb_augment_callbacks *augment)
+{
+    __rb_insert_augmented(node, root, augment->rotate);
+}
+
+static inline void rb_insert_augmented_cached(struct rb_node *node,
+                struct rb_root_cached *root, bool newleft,
+                const struct rb_augment_callbacks *augment)
+{
+    if (newleft)
+        root->rb_leftmost = node;
+    rb_insert_augmented(node, &root->rb_root, augment);
+}
+
+static inline void rb_erase_augmented_cached(struct rb_node *node,
+                struct rb_root_cached *root,
+                const struct rb_augment_callbacks *augment)
+{
+    if (root->rb_leftmost == node)
+        root->rb_leftmost = rb_next(node);
+    rb_erase_augmented(node, &root->rb_root, augment);
+}
+
+/*
+ * declare callbacks for augmented field rbaugmented of type rbtype in
+ * rbstruct, rbcompute(node) returns its value from node and children
+ */
+#define RB_DECLARE_CALLBACKS(rbstatic, rbname, rbstruct, rbfield,         \
+                             rbtype, rbaugmented, rbcompute)              \
+static inline void                                                        \
+rbname ## _propagate(struct rb_node *rb, struct rb_node *stop)            \
+{                                                                         \
+    while (rb != stop) {                                                  \
+        rbstruct *node = rb_entry(rb, rbstruct, rbfield);                 \
+        rbtype augmented = rbcompute(node);                               \
+        if (node->rbaugmented == augmented)                               \
+            break;                                                        \
+        node->rbaugmented = augmented;                                    \
+        rb = rb_parent(&node->rbfield);                                   \
+    }                                                                     \
+}                                                                         \
+static inline void                                                        \
+rbname ## _copy(struct rb_node *rb_old, struct rb_node *rb_new)           \
+{                                                                         \
+    rbstruct *old = rb_entry(rb_old, rbstruct, rbfield);                  \
+    rbstruct *_new = rb_entry(rb_new, rbstruct, rbfield);                 \
+    _new->rbaugmented = old->rbaugmented;                                 \
+}                                                                         \
+static void                                                               \
+rbname ## _rotate(struct rb_node *rb_old, struct rb_node *rb_new)         \
+{                                                                         \
+    rbstruct *old = rb_entry(rb_old, rbstruct, rbfield);                  \
+    rbstruct *_new = rb_entry(rb_new, rbstruct, rbfield);                 \
+    _new->rbaugmented = old->rbaugmented;                                 \
+    old->rbaugmented = rbcompute(old);                                    \
+}                                                                         \
+rbstatic const struct rb_augment_callbacks rbname = {                     \
+    rbname ## _propagate, rbname ## _copy, rbname ## _rotate              \
+};
+
+/*
+ * interval tree of closed intervals [start, last], sorted by start and
+ * augmented with max last of subtree, query all overlapping intervals
+ * in O(log n + k)
+ */
+struct interval_tree_node {
+    struct rb_node rb;
+    unsigned long start;
+    unsigned long last;
+    unsigned long __subtree_last;
+};
+
+void interval_tree_insert(struct interval_tree_node *node,
+                struct rb_root_cached *root);
+void interval_tree_remove(struct interval_tree_node *node,
+                struct rb_root_cached *root);
+struct interval_tree_node *interval_tree_iter_first(struct rb_root_cached *root,
+                unsigned long start, unsigned long last);
+struct interval_tree_node *interval_tree_iter_next(struct interval_tree_node *node,
+                unsigned long start, unsigned long last);
+
+/*
+ * order statistic tree, augmented with subtree size: find k-th smallest
+ * node and rank of a node in O(log n). link node with rb_link_node as
+ * usual, then call rb_os_insert instead of rb_insert_color
+ */
+struct rb_os_node {
+    struct rb_node rb;
+    unsigned long size;
+};
+
+void rb_os_insert(struct rb_os_node *node, struct rb_root *root);
+void rb_os_erase(struct rb_os_node *node, struct rb_root *root);
+/* k is 0 based, NULL if k >= tree size */
+struct rb_os_node *rb_os_select(const struct rb_root *root, unsigned long k);
+unsigned long rb_os_rank(const struct rb_os_node *node);
+unsigned long rb_os_count(const struct rb_root *root);
+
 #define rb_entry_safe(ptr, type, member) \
         ({ typeof(ptr) ____ptr = (ptr); \
          ____ptr ? rb_entry(____ptr, type, member) : NULL; \
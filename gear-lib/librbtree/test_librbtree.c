@@ -143,6 +143,97 @@ static void test(struct rb_root *mytree, int *input, size_t len)
     }
 }
 
+struct my_osnode {
+    struct rb_os_node os;
+    int key;
+};
+
+static void os_insert(struct rb_root *root, struct my_osnode *data)
+{
+    struct rb_node **_new = &(root->rb_node), *parent = NULL;
+    while (*_new) {
+        struct my_osnode *_this = container_of(*_new, struct my_osnode, os.rb);
+        parent = *_new;
+        if (data->key < _this->key)
+            _new = &((*_new)->rb_left);
+        else
+            _new = &((*_new)->rb_right);
+    }
+    rb_link_node(&data->os.rb, parent, _new);
+    rb_os_insert(&data->os, root);
+}
+
+#define AUG_N   2000
+
+static void foo_augmented(void)
+{
+    int i, k, err = 0;
+    unsigned long j, cnt, brute;
+    struct rb_root ostree = RB_ROOT;
+    struct rb_root_cached itree = RB_ROOT_CACHED;
+    struct my_osnode *osn = (struct my_osnode *)calloc(AUG_N, sizeof(*osn));
+    struct interval_tree_node *itn = (struct interval_tree_node *)
+                    calloc(AUG_N, sizeof(*itn));
+    struct interval_tree_node *it;
+
+    /* order statistic: key 2*i inserted in shuffled order */
+    for (i = 0; i < AUG_N; i++) {
+        osn[i].key = ((i * 7919) % AUG_N) * 2;
+        os_insert(&ostree, &osn[i]);
+    }
+    for (i = 0; i < AUG_N; i += 2) {
+        rb_os_erase(&osn[i].os, &ostree);
+    }
+    for (j = 0; j < rb_os_count(&ostree); j++) {
+        struct rb_os_node *n = rb_os_select(&ostree, j);
+        if (!n || rb_os_rank(n) != j) {
+            err++;
+        }
+        if (j > 0 && container_of(rb_os_select(&ostree, j - 1),
+                    struct my_osnode, os)->key >
+                    container_of(n, struct my_osnode, os)->key) {
+            err++;
+        }
+    }
+    if (rb_os_count(&ostree) != AUG_N / 2 || rb_os_select(&ostree, AUG_N / 2)) {
+        err++;
+    }
+    printf("order statistic: %lu nodes, %d error\n", rb_os_count(&ostree), err);
+
+    /* interval tree: compare overlap query with brute force */
+    err = 0;
+    for (i = 0; i < AUG_N; i++) {
+        itn[i].start = (i * 7919) % 10000;
+        itn[i].last = itn[i].start + (i % 50);
+        interval_tree_insert(&itn[i], &itree);
+    }
+    for (i = 0; i < AUG_N; i += 3) {
+        interval_tree_remove(&itn[i], &itree);
+    }
+    if (rb_first_cached(&itree) != rb_first(&itree.rb_root)) {
+        err++;
+    }
+    for (k = 0; k < 10000; k += 97) {
+        cnt = brute = 0;
+        for (it = interval_tree_iter_first(&itree, k, k + 20); it;
+             it = interval_tree_iter_next(it, k, k + 20)) {
+            cnt++;
+        }
+        for (i = 0; i < AUG_N; i++) {
+            if (i % 3 && itn[i].start <= (unsigned long)k + 20 &&
+                (unsigned long)k <= itn[i].last) {
+                brute++;
+            }
+        }
+        if (cnt != brute) {
+            err++;
+        }
+    }
+    printf("interval tree: %d queries, %d error\n", 10000 / 97 + 1, err);
+    free(osn);
+    free(itn);
+}
+
 int main(int argc, char **argv)
 {
     printf("input 1=====================\n");
@@ -156,5 +247,7 @@ int main(int argc, char **argv)
 
     printf("input 4=====================\n");
     test(&mytree_uk, input4, (sizeof(input4)/sizeof(input4[0])));
+
+    foo_augmented();
     return 0;
 }
@@ -21,23 +21,55 @@
  ******************************************************************************/
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
+#include <unistd.h>
 #include "libringbuffer.h"
+#if defined (__linux__)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
 
 #define MIN(a, b)           ((a) > (b) ? (b) : (a))
 #define MAX(a, b)           ((a) > (b) ? (a) : (b))
 #define CALLOC(size, type)  (type *)calloc(size, sizeof(type))
 
+/*
+ * single producer single consumer safe without lock: producer only stores
+ * end, consumer only stores start, each publishes with release and loads
+ * the other side with acquire, so data copied before store is visible
+ * to the peer after it loads the index
+ */
+#define RB_LOAD(p)          __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define RB_STORE(p, v)      __atomic_store_n(p, v, __ATOMIC_RELEASE)
+
+/*
+ * length is power of 2, start and end run freely and are masked into
+ * buffer on access, so used space is one subtraction and no byte is kept
+ * empty to tell full from empty
+ */
+#define RB_OFF(rb, i)       ((i) & ((size_t)(rb)->length - 1))
+
+static size_t rb_pow2(size_t n)
+{
+    size_t p = 1;
+    while (p < n) {
+        p <<= 1;
+    }
+    return p;
+}
+
+static size_t rb_used(struct ringbuffer *rb, size_t start, size_t end)
+{
+    return end - start;
+}
+
 size_t rb_get_space_free(struct ringbuffer *rb)
 {
     if (!rb) {
         return -1;
     }
-    if (rb->end >= rb->start) {
-        return rb->length - (rb->end - rb->start)-1;
-    } else {
-        return rb->start - rb->end-1;
-    }
+    return rb->length - rb_used(rb, RB_LOAD(&rb->start), RB_LOAD(&rb->end));
 }
 
 size_t rb_get_space_used(struct ringbuffer *rb)
@@ -45,11 +77,7 @@ size_t rb_get_space_used(struct ringbuffer *rb)
     if (!rb) {
         return -1;
     }
-    if (rb->end >= rb->start) {
-        return rb->end - rb->start;
-    } else {
-        return rb->length - (rb->start - rb->end);
-    }
+    return rb_used(rb, RB_LOAD(&rb->start), RB_LOAD(&rb->end));
 }
 
 struct ringbuffer *rb_create(int len)
@@ -59,7 +87,7 @@ struct ringbuffer *rb_create(int len)
         printf("malloc ringbuffer failed!\n");
         return NULL;
     }
-    rb->length = len + 1;
+    rb->length = rb_pow2(len);
     rb->start = 0;
     rb->end = 0;
     rb->buffer = calloc(1, rb->length);
@@ -71,74 +99,189 @@ struct ringbuffer *rb_create(int len)
     return rb;
 }
 
+#if defined (__linux__)
+#define RB_HUGE_PAGE    (2 * 1024 * 1024)
+#ifndef MFD_HUGETLB
+#define MFD_HUGETLB     0x0004U
+#endif
+
+static int rb_mirror_map(struct ringbuffer *rb, size_t size, unsigned int mfd_flags)
+{
+    int fd;
+    uint8_t *resv, *addr;
+    size_t align = (mfd_flags & MFD_HUGETLB) ? RB_HUGE_PAGE : 0;
+
+    fd = syscall(SYS_memfd_create, "ringbuffer", mfd_flags);
+    if (fd == -1) {
+        if (!mfd_flags) {
+            printf("memfd_create failed!\n");
+        }
+        return -1;
+    }
+    if (ftruncate(fd, size) == -1) {
+        printf("ftruncate %zu failed!\n", size);
+        close(fd);
+        return -1;
+    }
+    /* reserve 2x address space, then map the file twice into it,
+     * hugetlb mappings need the reservation huge page aligned */
+    resv = mmap(NULL, size * 2 + align, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (resv == MAP_FAILED) {
+        printf("mmap reserve %zu failed!\n", size * 2);
+        close(fd);
+        return -1;
+    }
+    addr = resv;
+    if (align) {
+        addr = (uint8_t *)(((uintptr_t)resv + align - 1) & ~(uintptr_t)(align - 1));
+        if (addr > resv) {
+            munmap(resv, addr - resv);
+        }
+        if (addr + size * 2 < resv + size * 2 + align) {
+            munmap(addr + size * 2, resv + size * 2 + align - (addr + size * 2));
+        }
+    }
+    if (mmap(addr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+             fd, 0) == MAP_FAILED ||
+        mmap(addr + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+             fd, 0) == MAP_FAILED) {
+        if (!mfd_flags) {
+            printf("mmap mirror failed!\n");
+        }
+        munmap(addr, size * 2);
+        close(fd);
+        return -1;
+    }
+    close(fd);
+    rb->buffer = addr;
+    rb->length = size;
+    rb->mirror = 1;
+    return 0;
+}
+
+static void rb_mirror_prepare(struct ringbuffer *rb, int flags)
+{
+    static int mlock_warned = 0;
+#ifdef MADV_HUGEPAGE
+    /* shmem THP also depends on shmem_enabled, a hint only */
+    if (flags & RB_MEM_HUGE) {
+        madvise(rb->buffer, rb->length, MADV_HUGEPAGE);
+    }
+#endif
+    /* touch every page once, so the hot path never faults */
+    memset(rb->buffer, 0, rb->length);
+    if ((flags & RB_MEM_LOCK) &&
+        0 != mlock(rb->buffer, rb->length * 2) && !mlock_warned) {
+        mlock_warned = 1;
+        printf("mlock ringbuffer failed, check RLIMIT_MEMLOCK\n");
+    }
+}
+#endif
+
+struct ringbuffer *rb_create_mirror(size_t len)
+{
+    return rb_create_mirror_flags(len, 0);
+}
+
+struct ringbuffer *rb_create_mirror_flags(size_t len, int flags)
+{
+#if defined (__linux__)
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t size = MAX(rb_pow2(len), page);
+    struct ringbuffer *rb = CALLOC(1, struct ringbuffer);
+    if (!rb) {
+        printf("malloc ringbuffer failed!\n");
+        return NULL;
+    }
+    if (flags & RB_MEM_HUGE) {
+        size_t hsize = MAX(rb_pow2(len), RB_HUGE_PAGE);
+        if (0 == rb_mirror_map(rb, hsize, MFD_HUGETLB)) {
+            rb_mirror_prepare(rb, flags & ~RB_MEM_HUGE);
+            return rb;
+        }
+    }
+    if (0 == rb_mirror_map(rb, size, 0)) {
+        if (flags) {
+            rb_mirror_prepare(rb, flags);
+        }
+        return rb;
+    }
+    free(rb);
+#endif
+    return rb_create(len);
+}
+
 void rb_destroy(struct ringbuffer *rb)
 {
     if (!rb) {
         return;
     }
+#if defined (__linux__)
+    if (rb->mirror) {
+        munmap(rb->buffer, rb->length * 2);
+        free(rb);
+        return;
+    }
+#endif
     free(rb->buffer);
     free(rb);
 }
 
 void *rb_end_ptr(struct ringbuffer *rb)
 {
-    return (void *)((char *)rb->buffer + rb->end);
+    return (void *)((char *)rb->buffer + RB_OFF(rb, rb->end));
 }
 
 void *rb_start_ptr(struct ringbuffer *rb)
 {
-    return (void *)((char *)rb->buffer + rb->start);
+    return (void *)((char *)rb->buffer + RB_OFF(rb, rb->start));
 }
 
 ssize_t rb_write(struct ringbuffer *rb, const void *buf, size_t len)
 {
+    size_t end, off, left;
     if (!rb) {
         return -1;
     }
-    size_t left = rb_get_space_free(rb);
+    end = rb->end;
+    left = rb->length - rb_used(rb, RB_LOAD(&rb->start), end);
     if (len > left) {
         printf("Not enough space: %zu request, %zu available\n", len, left);
         return -1;
     }
 
-    if ((rb->length - rb->end) < len) {
-        int half_tail = rb->length - rb->end;
-        memcpy(rb_end_ptr(rb), buf, half_tail);
-        rb->end = (rb->end + half_tail) % rb->length;
-
-        int half_head = len - half_tail;
-        memcpy(rb_end_ptr(rb), buf+half_tail, half_head);
-        rb->end = (rb->end + half_head) % rb->length;
+    off = RB_OFF(rb, end);
+    if (rb->mirror || (rb->length - off) >= len) {
+        memcpy((char *)rb->buffer + off, buf, len);
     } else {
-        memcpy(rb_end_ptr(rb), buf, len);
-        rb->end = (rb->end + len) % rb->length;
+        size_t half_tail = rb->length - off;
+        memcpy((char *)rb->buffer + off, buf, half_tail);
+        memcpy(rb->buffer, (const char *)buf + half_tail, len - half_tail);
     }
+    RB_STORE(&rb->end, end + len);
     return len;
 }
 
 ssize_t rb_read(struct ringbuffer *rb, void *buf, size_t len)
 {
+    size_t start, off, used, rlen;
     if (!rb) {
         return -1;
     }
-    size_t rlen = MIN(len, rb_get_space_used(rb));
+    start = rb->start;
+    /* load end once, MIN evaluates argument twice */
+    used = rb_used(rb, start, RB_LOAD(&rb->end));
+    rlen = MIN(len, used);
 
-    if ((rb->length - rb->start) < rlen) {
-        int half_tail = rb->length - rb->start;
-        memcpy(buf, rb_start_ptr(rb), half_tail);
-        rb->start = (rb->start + half_tail) % rb->length;
-
-        int half_head = rlen - half_tail;
-        memcpy(buf+half_tail, rb_start_ptr(rb), half_head);
-        rb->start = (rb->start + half_head) % rb->length;
+    off = RB_OFF(rb, start);
+    if (rb->mirror || (rb->length - off) >= rlen) {
+        memcpy(buf, (char *)rb->buffer + off, rlen);
     } else {
-        memcpy(buf, rb_start_ptr(rb), rlen);
-        rb->start = (rb->start + rlen) % rb->length;
-    }
-
-    if ((rb->start == rb->end) || (rb_get_space_used(rb) == 0)) {
-        rb->start = rb->end = 0;
+        size_t half_tail = rb->length - off;
+        memcpy(buf, (char *)rb->buffer + off, half_tail);
+        memcpy((char *)buf + half_tail, rb->buffer, rlen - half_tail);
     }
+    RB_STORE(&rb->start, start + rlen);
     return rlen;
 }
 
@@ -148,7 +291,9 @@ void *rb_dump(struct ringbuffer *rb, size_t *blen)
         return NULL;
     }
     void *buf = NULL;
-    size_t len = rb_get_space_used(rb);
+    size_t start = RB_LOAD(&rb->start);
+    size_t len = rb_used(rb, start, RB_LOAD(&rb->end));
+    start = RB_OFF(rb, start);
     if (len <= 0) {
         return NULL;
     }
@@ -159,14 +304,12 @@ void *rb_dump(struct ringbuffer *rb, size_t *blen)
     }
     *blen = len;
 
-    if ((rb->length - rb->start) < len) {
-        int half_tail = rb->length - rb->start;
-        memcpy(buf, rb_start_ptr(rb), half_tail);
-
-        int half_head = len - half_tail;
-        memcpy(buf+half_tail, rb->buffer, half_head);
+    if (!rb->mirror && (rb->length - start) < len) {
+        size_t half_tail = rb->length - start;
+        memcpy(buf, (char *)rb->buffer + start, half_tail);
+        memcpy((char *)buf + half_tail, rb->buffer, len - half_tail);
     } else {
-        memcpy(buf, rb_start_ptr(rb), len);
+        memcpy(buf, (char *)rb->buffer + start, len);
     }
     return buf;
 }
@@ -176,5 +319,66 @@ void rb_cleanup(struct ringbuffer *rb)
     if (!rb) {
         return;
     }
-    rb->start = rb->end = 0;
+    RB_STORE(&rb->start, 0);
+    RB_STORE(&rb->end, 0);
+}
+
+void *rb_write_reserve(struct ringbuffer *rb, size_t *len)
+{
+    size_t start, end, avail;
+    if (!rb || !len) {
+        return NULL;
+    }
+    start = RB_LOAD(&rb->start);
+    end = rb->end;
+    avail = rb->length - rb_used(rb, start, end);
+    if (!rb->mirror) {
+        avail = MIN(avail, rb->length - RB_OFF(rb, end));
+    }
+    *len = avail;
+    return avail ? (char *)rb->buffer + RB_OFF(rb, end) : NULL;
+}
+
+int rb_write_commit(struct ringbuffer *rb, size_t len)
+{
+    size_t end;
+    if (!rb) {
+        return -1;
+    }
+    end = rb->end;
+    if (len > rb->length - rb_used(rb, RB_LOAD(&rb->start), end)) {
+        return -1;
+    }
+    RB_STORE(&rb->end, end + len);
+    return 0;
+}
+
+void *rb_read_peek(struct ringbuffer *rb, size_t *len)
+{
+    size_t start, end, avail;
+    if (!rb || !len) {
+        return NULL;
+    }
+    start = rb->start;
+    end = RB_LOAD(&rb->end);
+    avail = rb_used(rb, start, end);
+    if (!rb->mirror) {
+        avail = MIN(avail, rb->length - RB_OFF(rb, start));
+    }
+    *len = avail;
+    return avail ? (char *)rb->buffer + RB_OFF(rb, start) : NULL;
+}
+
+int rb_read_consume(struct ringbuffer *rb, size_t len)
+{
+    size_t start;
+    if (!rb) {
+        return -1;
+    }
+    start = rb->start;
+    if (len > rb_used(rb, start, RB_LOAD(&rb->end))) {
+        return -1;
+    }
+    RB_STORE(&rb->start, start + len);
+    return 0;
 }
@@ -30,11 +30,21 @@
 extern "C" {
 #endif
 
+/*
+ * ringbuffer is safe for one writer thread and one reader thread without
+ * lock, start and end are in separate cache lines. rb_cleanup is not
+ * safe when both are running. length is rounded up to power of 2 and
+ * all of it can be used, start and end run freely and are masked
+ */
 typedef struct ringbuffer {
     void *buffer;
     int length;
-    size_t start;
-    size_t end;
+    int mirror;         /* buffer is mapped twice back to back */
+    char pad0[64];
+    size_t start;       /* only stored by reader */
+    char pad1[64];
+    size_t end;         /* only stored by writer */
+    char pad2[64];
 } ringbuffer;
 
 struct ringbuffer *rb_create(int len);
@@ -46,6 +56,34 @@ void rb_cleanup(struct ringbuffer *rb);
 size_t rb_get_space_free(struct ringbuffer *rb);
 size_t rb_get_space_used(struct ringbuffer *rb);
 
+/*
+ * mirrored ringbuffer maps the same pages twice in a row, so any free or
+ * used region is contiguous in memory, no split copy and zero-copy
+ * reserve/peek can return the whole region. len is rounded up to power
+ * of 2, at least page size, fall back to normal ringbuffer if mmap trick is not supported
+ */
+struct ringbuffer *rb_create_mirror(size_t len);
+
+/*
+ * memory options of mirrored ringbuffer (linux). RB_MEM_HUGE backs it with
+ * hugetlbfs pages (len at least 2MB) and falls back to shmem THP hint,
+ * RB_MEM_LOCK mlocks it. with any flag the pages are prefaulted at create
+ */
+#define RB_MEM_HUGE     (1 << 0)
+#define RB_MEM_LOCK     (1 << 1)
+
+struct ringbuffer *rb_create_mirror_flags(size_t len, int flags);
+
+/*
+ * zero-copy access, reserve returns pointer to contiguous free space and
+ * its length, commit makes len bytes written into it visible.
+ * peek returns contiguous readable data, consume releases len bytes
+ */
+void *rb_write_reserve(struct ringbuffer *rb, size_t *len);
+int rb_write_commit(struct ringbuffer *rb, size_t len);
+void *rb_read_peek(struct ringbuffer *rb, size_t *len);
+int rb_read_consume(struct ringbuffer *rb, size_t len);
+
 #ifdef __cplusplus
 }
 #endif
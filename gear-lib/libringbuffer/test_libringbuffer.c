@@ -38,7 +38,9 @@ int foo()
             break;
         }
     }
-    printf("dump = %s\n", (char *)rb_dump(rb, &len));
+    char *dump = rb_dump(rb, &len);
+    printf("dump = %.*s\n", (int)len, dump);
+    free(dump);
     printf("rb_write len=%zu\n", len);
     char tmp2[9];
     memset(tmp2, 0, sizeof(tmp2));
@@ -47,11 +49,60 @@ int foo()
     memset(tmp2, 0, sizeof(tmp2));
     rb_read(rb, tmp2, sizeof(tmp2)-1);
     printf("rb_read str=%s\n", tmp2);
+    rb_destroy(rb);
+    return 0;
+}
+
+int foo_mirror()
+{
+    size_t len;
+    char *p;
+    struct ringbuffer *rb = rb_create_mirror(4096);
+    if (!rb) {
+        return -1;
+    }
+    p = rb_write_reserve(rb, &len);
+    printf("mirror=%d reserve %zu\n", rb->mirror, len);
+    len = snprintf(p, len, "hello mirror");
+    rb_write_commit(rb, len);
+    p = rb_read_peek(rb, &len);
+    printf("peek %.*s\n", (int)len, p);
+    rb_read_consume(rb, len);
+    rb_destroy(rb);
+    return 0;
+}
+
+int foo_pow2()
+{
+    char in[300], out[300];
+    int i, j;
+    struct ringbuffer *rb = rb_create(1000);
+    if (!rb) {
+        return -1;
+    }
+    printf("length=%d free=%zu\n", rb->length, rb_get_space_free(rb));
+    /* wrap around many times with odd sized chunks */
+    for (i = 0; i < 100; i++) {
+        for (j = 0; j < (int)sizeof(in); j++) {
+            in[j] = i + j;
+        }
+        if (rb_write(rb, in, 257 + i % 40) < 0 ||
+            rb_read(rb, out, 257 + i % 40) != 257 + i % 40 ||
+            memcmp(in, out, 257 + i % 40)) {
+            printf("pow2 ringbuffer mismatch at %d\n", i);
+            rb_destroy(rb);
+            return -1;
+        }
+    }
+    printf("pow2 wrap ok, used=%zu\n", rb_get_space_used(rb));
+    rb_destroy(rb);
     return 0;
 }
 
 int main(int argc, char **argv)
 {
     foo();
+    foo_mirror();
+    foo_pow2();
     return 0;
 }
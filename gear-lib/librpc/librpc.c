@@ -54,6 +54,7 @@ static struct rpc_backend rpc_backend_list[] = {
 #define MAX_MSG_ID_STRLEN           (11)
 
 struct wq_arg {
+    struct list_head entry;
     msg_handler_t handler;
     struct rpc_session session;
     void *ibuf;
@@ -63,6 +64,31 @@ struct wq_arg {
     struct rpcs *rpcs;
 };
 
+/*
+ * messages of one session run one by one in arrival order on any worker,
+ * only the session own lock is taken, different sessions run in parallel.
+ * dead is set when session is gone, the last drain frees the strand
+ */
+struct rpc_strand {
+    mutex_lock_t lock;
+    struct list_head list;
+    struct workq_pool *pool;
+    bool running;
+    bool dead;
+};
+
+/* messages run in one drain before yielding worker to other sessions */
+#define RPC_STRAND_BUDGET   (16)
+
+/*
+ * handlers are indexed directly by group and cmd id of msg_id, msg_ids
+ * only differ in other bits share the slot, later ones go to hash map
+ */
+#define RPC_HANDLER_SLOTS   ((RPC_GROUP_MASK + 1) * (RPC_CMD_MASK + 1))
+#define RPC_HANDLER_INDEX(msg_id) \
+    ((GET_RPC_MSG_GROUP(msg_id) * (RPC_CMD_MASK + 1)) + ((msg_id) & RPC_CMD_MASK))
+
+static msg_handler_t *_msg_map_index[RPC_HANDLER_SLOTS];
 static struct hash *_msg_map_registered = NULL;
 
 static void dump_buffer(void *buf, int len)
@@ -139,11 +165,25 @@ static int rpc_base_init(struct rpc_base *base)
     return 0;
 }
 
+/* stop dispatch thread before backend is released under it */
+static void rpc_base_stop(struct rpc_base *base)
+{
+    gevent_base_loop_break(base->evbase);
+    if (base->dispatch_thread &&
+        !pthread_equal(pthread_self(), base->dispatch_thread->tid)) {
+        thread_join(base->dispatch_thread);
+    }
+}
+
 static void rpc_base_deinit(struct rpc_base *base)
 {
+    free(base->rbuf);
+    base->rbuf = NULL;
+    base->rbuf_cap = 0;
     gevent_base_loop_break(base->evbase);
     gevent_base_destroy(base->evbase);
     thread_destroy(base->dispatch_thread);
+    da_free(base->ev_list);
     base->ops = NULL;
 }
 
@@ -158,6 +198,7 @@ size_t pack_msg(struct rpc_packet *pkt, uint32_t uuid_dst, uint32_t uuid_src,
     hdr->uuid_dst = uuid_dst;
     hdr->uuid_src = uuid_src;
     hdr->msg_id = msg_id;
+    hdr->seq = 0;
     time_now_info(&ti);
     hdr->timestamp = ti.utc_msec;
 
@@ -172,29 +213,12 @@ size_t pack_msg(struct rpc_packet *pkt, uint32_t uuid_dst, uint32_t uuid_src,
     return pkt_len;
 }
 
-static size_t unpack_msg(struct rpc_packet *pkt, uint32_t *msg_id,
-                void *out_arg, size_t *out_len)
-{
-    size_t pkt_len;
-    struct rpc_header *hdr;
-    if (!pkt || !out_arg || !out_len) {
-        printf("invalid paraments!\n");
-        return -1;
-    }
-    hdr = &(pkt->header);
-    *msg_id = hdr->msg_id;
-    *out_len = hdr->payload_len;
-    memcpy(out_arg, pkt->payload, *out_len);
-    free(pkt->payload);
-    pkt_len = sizeof(struct rpc_packet) + hdr->payload_len;
-    return pkt_len;
-}
-
 int rpc_send(struct rpc_base *base, struct rpc_packet *pkt)
 {
     int ret, head_size;
     void *buf = NULL;
     int len;
+    struct iovec iov[2];
 
     head_size = sizeof(rpc_header_t);
 
@@ -205,27 +229,35 @@ int rpc_send(struct rpc_base *base, struct rpc_packet *pkt)
     print_packet(pkt);
 #endif
     len = head_size + pkt->header.payload_len;
-    buf = calloc(1, len);
-    if (!buf) {
-        printf("%s:%d alloc buf failed!\n", __func__, __LINE__);
-        return -1;
+    if (base->ops->sendv) {
+        /* header and payload go out in one sendmsg, payload is not copied */
+        iov[0].iov_base = (void *)&pkt->header;
+        iov[0].iov_len = head_size;
+        iov[1].iov_base = pkt->payload;
+        iov[1].iov_len = pkt->header.payload_len;
+        ret = base->ops->sendv(base, iov, pkt->header.payload_len ? 2 : 1);
+    } else {
+        buf = calloc(1, len);
+        if (!buf) {
+            printf("%s:%d alloc buf failed!\n", __func__, __LINE__);
+            return -1;
+        }
+        memcpy(buf, (void *)&pkt->header, head_size);
+        memcpy(buf+head_size, pkt->payload, pkt->header.payload_len);
+        ret = base->ops->send(base, buf, len);
+        free(buf);
     }
-    memcpy(buf, (void *)&pkt->header, head_size);
-    memcpy(buf+head_size, pkt->payload, pkt->header.payload_len);
-
-    ret = base->ops->send(base, buf, len);
     if (ret < 0) {
         printf("%s:%d send failed!\n", __func__, __LINE__);
         ret = -1;
-    } if (ret != len) {
+    } else if (ret != len) {
         printf("%s:%d send len %d not matched %d failed!\n", __func__, __LINE__, ret, len);
         ret = -1;
     }
-    free(buf);
     return ret;
 }
 
-static int rpc_recv(struct rpc_base *base, struct rpc_packet *pkt)
+static int rpc_recv_header(struct rpc_base *base, struct rpc_packet *pkt)
 {
     int ret;
     int head_size = sizeof(rpc_header_t);
@@ -241,15 +273,55 @@ static int rpc_recv(struct rpc_base *base, struct rpc_packet *pkt)
         printf("recv failed, head_size = %d, ret = %d\n", head_size, ret);
         return -1;
     }
-    if (pkt->header.payload_len == 0)
-        return ret;
+    return ret;
+}
 
-    pkt->payload = calloc(1, pkt->header.payload_len);
+/*
+ * reuse: read into base->rbuf, which is valid until next recv, otherwise
+ * payload is malloced and owned by caller
+ */
+static int rpc_recv_payload(struct rpc_base *base, struct rpc_packet *pkt, bool reuse)
+{
+    int ret;
+    size_t cap;
+    void *p;
 
+    pkt->payload = NULL;
+    if (pkt->header.payload_len == 0) {
+        return sizeof(rpc_header_t);
+    }
+    if (reuse) {
+        if (base->rbuf_cap < pkt->header.payload_len) {
+            cap = base->rbuf_cap ? base->rbuf_cap : 4096;
+            while (cap < pkt->header.payload_len) {
+                cap *= 2;
+            }
+            p = realloc(base->rbuf, cap);
+            if (!p) {
+                printf("%s:%d alloc buf failed!\n", __func__, __LINE__);
+                return -1;
+            }
+            base->rbuf = p;
+            base->rbuf_cap = cap;
+        }
+        pkt->payload = base->rbuf;
+    } else {
+        pkt->payload = malloc(pkt->header.payload_len);
+        if (!pkt->payload) {
+            printf("%s:%d alloc buf failed!\n", __func__, __LINE__);
+            return -1;
+        }
+    }
     ret = base->ops->recv(base, pkt->payload, pkt->header.payload_len);
-    if (ret == 0) {
-        printf("peer connect closed\n");
-        return 0;
+    if (ret <= 0) {
+        if (ret == 0) {
+            printf("peer connect closed\n");
+        }
+        if (!reuse) {
+            free(pkt->payload);
+        }
+        pkt->payload = NULL;
+        return ret;
     }
 #if ENABLE_DEBUG
     printf("rpc_recv <<<<\n");
@@ -260,10 +332,29 @@ static int rpc_recv(struct rpc_base *base, struct rpc_packet *pkt)
     return ret;
 }
 
+static int rpc_recv(struct rpc_base *base, struct rpc_packet *pkt)
+{
+    int ret = rpc_recv_header(base, pkt);
+    if (ret <= 0) {
+        pkt->payload = NULL;
+        return ret;
+    }
+    return rpc_recv_payload(base, pkt, false);
+}
+
 static msg_handler_t *find_msg_handler(uint32_t msg_id)
 {
     char msg_id_str[MAX_MSG_ID_STRLEN];
     msg_handler_t *handler;
+    /* messages of a stream are handled by handler of the opening cmd */
+    msg_id = SET_RPC_MSG_STREAM(msg_id, _RPC_STREAM_NONE);
+    handler = _msg_map_index[RPC_HANDLER_INDEX(msg_id)];
+    if (handler && handler->msg_id == msg_id) {
+        return handler;
+    }
+    if (!_msg_map_registered) {
+        return NULL;
+    }
     snprintf(msg_id_str, sizeof(msg_id_str), "0x%08x", msg_id);
     msg_id_str[10] = '\0';
     handler = (msg_handler_t *)hash_get(_msg_map_registered, msg_id_str);
@@ -272,6 +363,7 @@ static msg_handler_t *find_msg_handler(uint32_t msg_id)
 
 static int register_msg_proc(msg_handler_t *handler)
 {
+    msg_handler_t **slot;
     uint32_t msg_id;
     char msg_id_str[MAX_MSG_ID_STRLEN];
     char *msg_proc;
@@ -281,6 +373,11 @@ static int register_msg_proc(msg_handler_t *handler)
         return -1;
     }
     msg_id = handler->msg_id;
+    slot = &_msg_map_index[RPC_HANDLER_INDEX(msg_id)];
+    if (!*slot || (*slot)->msg_id == msg_id) {
+        *slot = handler;//force update
+        return 0;
+    }
     snprintf(msg_id_str, sizeof(msg_id_str), "0x%08x", msg_id);
     msg_id_str[10] = '\0';
     if (!_msg_map_registered) {
@@ -331,48 +428,524 @@ int register_msg_map(msg_handler_t *map, int num_entry)
 /******************************************************************************
  * client API
  ******************************************************************************/
-int rpc_call(struct rpc *rpc, uint32_t msg_id,
-             const void *in_arg, size_t in_len, void *out_arg, size_t out_len)
+#define RPC_INFLIGHT_BUCKETS    (64)
+
+static void future_complete(struct rpc *rpc, struct rpc_future *f,
+                int done, void *obuf, size_t olen)
+{
+    if (f->cb) {
+        gevent_wtimer_del(rpc->session.base.evbase, &f->deadline);
+        f->obuf = obuf;
+        f->olen = olen;
+        f->done = done;
+        f->cb(rpc, f, f->arg);
+        free(f->obuf);
+        gear_free(f, sizeof(*f));
+        return;
+    }
+    mutex_lock(&rpc->lock);
+    f->obuf = obuf;
+    f->olen = olen;
+    f->done = done;
+    mutex_cond_signal_all(&rpc->cond);
+    mutex_unlock(&rpc->lock);
+}
+
+/* unlink in flight future of seq, NULL if it was not sent by us */
+static struct rpc_future *future_take(struct rpc *rpc, uint32_t seq)
+{
+    struct rpc_future *f;
+    mutex_lock(&rpc->lock);
+    f = (struct rpc_future *)hash_get32(rpc->inflight, seq);
+    if (f) {
+        hash_del32(rpc->inflight, seq);
+        rpc->ninflight--;
+    }
+    mutex_unlock(&rpc->lock);
+    return f;
+}
+
+static void future_fail_all(struct rpc *rpc)
+{
+    const char *key;
+    void *val;
+    struct hash_iter it;
+    struct rpc_future *f, *next, *list = NULL;
+    mutex_lock(&rpc->lock);
+    hash_for_each(rpc->inflight, it, key, val) {
+        f = (struct rpc_future *)val;
+        f->next = list;
+        list = f;
+        hash_iter_del(&it);
+    }
+    rpc->ninflight = 0;
+    mutex_unlock(&rpc->lock);
+    (void)key;
+    for (f = list; f; f = next) {
+        next = f->next;
+        f->next = NULL;
+        f->err = EPIPE;
+        future_complete(rpc, f, -1, NULL, 0);
+    }
+}
+
+/* in dispatch thread, same as the response path, so only one of them takes f */
+static void on_future_deadline(struct gevent_wtimer *t, void *arg)
+{
+    struct rpc_future *f = (struct rpc_future *)arg;
+    struct rpc *rpc = f->rpc;
+    if (future_take(rpc, f->seq) != f) {
+        return;
+    }
+    f->err = ETIMEDOUT;
+    future_complete(rpc, f, -1, NULL, 0);
+}
+
+static struct rpc_stream *stream_find(struct rpc *rpc, uint32_t seq, bool unlink)
+{
+    struct rpc_stream **ps, *st = NULL;
+    mutex_lock(&rpc->lock);
+    for (ps = &rpc->streams; *ps; ps = &(*ps)->next) {
+        if ((*ps)->seq == seq) {
+            st = *ps;
+            if (unlink) {
+                *ps = st->next;
+                st->next = NULL;
+            }
+            break;
+        }
+    }
+    mutex_unlock(&rpc->lock);
+    return st;
+}
+
+/* last call of stream, st is freed after it */
+static void stream_finish(struct rpc *rpc, struct rpc_stream *st, int status)
+{
+    st->status = status;
+    st->cb(rpc, st, NULL, 0, st->arg);
+    free(st);
+}
+
+static void stream_fail_all(struct rpc *rpc)
+{
+    struct rpc_stream *st, *next;
+    mutex_lock(&rpc->lock);
+    st = rpc->streams;
+    rpc->streams = NULL;
+    mutex_unlock(&rpc->lock);
+    for (; st; st = next) {
+        next = st->next;
+        stream_finish(rpc, st, -1);
+    }
+}
+
+/* called in dispatch thread for message of an open stream */
+static void stream_deliver(struct rpc *rpc, struct rpc_stream *st,
+                struct rpc_packet *pkt)
+{
+    if (pkt->header.payload_len > 0) {
+        st->cb(rpc, st, pkt->payload, pkt->header.payload_len, st->arg);
+    }
+    if (GET_RPC_MSG_STREAM(pkt->header.msg_id) == _RPC_STREAM_END &&
+        stream_find(rpc, st->seq, true)) {
+        stream_finish(rpc, st, 1);
+    }
+}
+
+static int batch_flush_locked(struct rpc *rpc)
+{
+    int ret = 0;
+    struct rpc_base *base = &rpc->session.base;
+    if (rpc->batch_len == 0) {
+        return 0;
+    }
+    if (rpc->batch_delay_ms > 0) {
+        gevent_wtimer_del(base->evbase, &rpc->batch_timer);
+    }
+    ret = base->ops->send(base, rpc->batch_buf, rpc->batch_len);
+    if (ret != (int)rpc->batch_len) {
+        printf("%s:%d send batch of %zu failed!\n", __func__, __LINE__, rpc->batch_len);
+        ret = -1;
+    } else {
+        ret = 0;
+    }
+    rpc->batch_len = 0;
+    return ret;
+}
+
+/* queue packet if batching, otherwise send it at once */
+static int client_send(struct rpc *rpc, struct rpc_packet *pkt)
+{
+    int ret = 0;
+    size_t head_size = sizeof(rpc_header_t);
+    size_t len = head_size + pkt->header.payload_len;
+    size_t cap;
+    uint8_t *p;
+
+    if (!__atomic_load_n(&rpc->batching, __ATOMIC_ACQUIRE)) {
+        return rpc_send(&rpc->session.base, pkt) == -1 ? -1 : 0;
+    }
+    mutex_lock(&rpc->batch_lock);
+    if (rpc->batch_len + len > rpc->batch_max ||
+        !__atomic_load_n(&rpc->batching, __ATOMIC_ACQUIRE)) {
+        ret = batch_flush_locked(rpc);
+    }
+    if (len > rpc->batch_max || !__atomic_load_n(&rpc->batching, __ATOMIC_ACQUIRE)) {
+        /* too big to be queued, keep order after queued ones */
+        mutex_unlock(&rpc->batch_lock);
+        if (ret == 0 && -1 == rpc_send(&rpc->session.base, pkt)) {
+            ret = -1;
+        }
+        return ret;
+    }
+    if (rpc->batch_cap < rpc->batch_len + len) {
+        cap = rpc->batch_cap ? rpc->batch_cap : 4096;
+        while (cap < rpc->batch_len + len) {
+            cap *= 2;
+        }
+        p = realloc(rpc->batch_buf, cap);
+        if (!p) {
+            printf("%s:%d alloc buf failed!\n", __func__, __LINE__);
+            mutex_unlock(&rpc->batch_lock);
+            return -1;
+        }
+        rpc->batch_buf = p;
+        rpc->batch_cap = cap;
+    }
+    memcpy(rpc->batch_buf + rpc->batch_len, &pkt->header, head_size);
+    if (pkt->header.payload_len) {
+        memcpy(rpc->batch_buf + rpc->batch_len + head_size, pkt->payload,
+               pkt->header.payload_len);
+    }
+    if (rpc->batch_len == 0 && rpc->batch_delay_ms > 0) {
+        gevent_wtimer_add(rpc->session.base.evbase, &rpc->batch_timer,
+                          rpc->batch_delay_ms, TIMER_ONESHOT);
+        /* dispatch loop may sleep without timeout, let it pick the timer */
+        gevent_base_signal(rpc->session.base.evbase);
+    }
+    rpc->batch_len += len;
+    mutex_unlock(&rpc->batch_lock);
+    return ret;
+}
+
+/* dispatch loop, oldest queued call waited delay_ms */
+static void on_batch_timer(struct gevent_wtimer *t, void *arg)
+{
+    struct rpc *rpc = (struct rpc *)arg;
+    mutex_lock(&rpc->batch_lock);
+    batch_flush_locked(rpc);
+    mutex_unlock(&rpc->batch_lock);
+}
+
+int rpc_batch_set(struct rpc *rpc, size_t max_bytes, int delay_ms)
+{
+    if (!rpc) {
+        return -1;
+    }
+    mutex_lock(&rpc->batch_lock);
+    rpc->batch_max = max_bytes ? max_bytes : RPC_BATCH_MAX;
+    rpc->batch_delay_ms = delay_ms > 0 ? delay_ms : 0;
+    if (rpc->batch_delay_ms == 0) {
+        gevent_wtimer_del(rpc->session.base.evbase, &rpc->batch_timer);
+    }
+    mutex_unlock(&rpc->batch_lock);
+    return 0;
+}
+
+void rpc_batch_begin(struct rpc *rpc)
+{
+    if (rpc) {
+        __atomic_store_n(&rpc->batching, 1, __ATOMIC_RELEASE);
+    }
+}
+
+int rpc_batch_flush(struct rpc *rpc)
 {
     int ret;
-    struct rpc_session *ss = &rpc->session;
-    struct rpc_packet send_pkt, recv_pkt;
     if (!rpc) {
-        printf("invalid parament!\n");
         return -1;
     }
-    size_t pkt_len = pack_msg(&send_pkt, ss->uuid_dst, ss->uuid_src, msg_id, in_arg, in_len);
-    if (pkt_len == 0) {
-        printf("pack_msg failed!\n");
+    mutex_lock(&rpc->batch_lock);
+    ret = batch_flush_locked(rpc);
+    mutex_unlock(&rpc->batch_lock);
+    return ret;
+}
+
+int rpc_batch_end(struct rpc *rpc)
+{
+    if (!rpc) {
         return -1;
     }
-    ret = rpc_send(&ss->base, &send_pkt);
-    if (-1 == ret) {
-        printf("rpc_send failed\n");
+    /* senders recheck under batch_lock, nothing is queued after this flush */
+    __atomic_store_n(&rpc->batching, 0, __ATOMIC_RELEASE);
+    return rpc_batch_flush(rpc);
+}
+
+static int call_async(struct rpc *rpc, uint32_t msg_id, const void *in_arg,
+                size_t in_len, int timeout_ms, rpc_future_cb cb, void *arg,
+                struct rpc_future **out)
+{
+    struct rpc_session *ss = &rpc->session;
+    struct gevent_base *evbase = ss->base.evbase;
+    struct rpc_packet pkt;
+    struct rpc_future *f;
+    uint32_t seq;
+    int ret;
+    if (rpc->state == rpc_disconnect) {
+        printf("rpc is disconnected!\n");
         return -1;
     }
-    if (IS_RPC_MSG_NEED_RETURN(msg_id)) {
-        thread_lock(ss->base.dispatch_thread);
-        rpc->state = rpc_send_syn;
-        if (thread_wait(ss->base.dispatch_thread, 2000) == -1) {
-            printf("%s wait response failed %d:%s\n", __func__, errno, strerror(errno));
+    f = gear_calloc(sizeof(struct rpc_future));
+    if (!f) {
+        printf("malloc rpc_future failed!\n");
+        return -1;
+    }
+    f->msg_id = msg_id;
+    f->cb = cb;
+    f->arg = arg;
+    f->rpc = rpc;
+    gevent_wtimer_init(&f->deadline, on_future_deadline, f);
+    if (out) {
+        *out = f;
+    }
+    pack_msg(&pkt, ss->uuid_dst, ss->uuid_src, msg_id, in_arg, in_len);
+    if (!IS_RPC_MSG_NEED_RETURN(msg_id)) {
+        if (-1 == client_send(rpc, &pkt)) {
+            printf("rpc_send failed\n");
+            gear_free(f, sizeof(*f));
             return -1;
         }
-        thread_unlock(ss->base.dispatch_thread);
-        rpc->state = rpc_connected;
-        memset(&recv_pkt, 0, sizeof(recv_pkt));
-        if (-1 == rpc_recv(&ss->base, &recv_pkt)) {
-            printf("rpc_recv failed!\n");
-            return -1;
+        future_complete(rpc, f, 1, NULL, 0);
+        return 0;
+    }
+    /*
+     * link and arm before send, response or deadline may complete and free
+     * a callback future before rpc_send returns, don't touch f after unlock
+     */
+    mutex_lock(&rpc->lock);
+    if (++rpc->next_seq == 0) {
+        ++rpc->next_seq;
+    }
+    seq = rpc->next_seq;
+    f->seq = seq;
+    ret = hash_set32(rpc->inflight, seq, f);
+    if (ret == 0) {
+        rpc->ninflight++;
+        if (cb && timeout_ms > 0) {
+            gevent_wtimer_add(evbase, &f->deadline, timeout_ms, TIMER_ONESHOT);
+        }
+    }
+    mutex_unlock(&rpc->lock);
+    if (ret != 0) {
+        printf("link rpc_future failed!\n");
+        gear_free(f, sizeof(*f));
+        return -1;
+    }
+    if (cb && timeout_ms > 0) {
+        /* dispatch loop may sleep without timeout, let it pick the timer */
+        gevent_base_signal(evbase);
+    }
+    pkt.header.seq = seq;
+    if (-1 == client_send(rpc, &pkt)) {
+        printf("rpc_send failed\n");
+        /* peer may have closed and failed it already */
+        if (future_take(rpc, seq)) {
+            gevent_wtimer_del(evbase, &f->deadline);
+            gear_free(f, sizeof(*f));
+        } else if (!cb) {
+            return 0;
         }
-        unpack_msg(&recv_pkt, &msg_id, out_arg, &out_len);
+        return -1;
     }
     return 0;
 }
 
+struct rpc_future *rpc_call_async(struct rpc *rpc, uint32_t msg_id,
+             const void *in_arg, size_t in_len)
+{
+    struct rpc_future *f = NULL;
+    if (!rpc) {
+        printf("invalid parament!\n");
+        return NULL;
+    }
+    if (0 != call_async(rpc, msg_id, in_arg, in_len, 0, NULL, NULL, &f)) {
+        return NULL;
+    }
+    return f;
+}
+
+int rpc_call_cb(struct rpc *rpc, uint32_t msg_id, const void *in_arg,
+             size_t in_len, rpc_future_cb cb, void *arg)
+{
+    if (!rpc || !cb) {
+        printf("invalid parament!\n");
+        return -1;
+    }
+    return call_async(rpc, msg_id, in_arg, in_len, 0, cb, arg, NULL);
+}
+
+int rpc_call_cb_timeout(struct rpc *rpc, uint32_t msg_id, const void *in_arg,
+             size_t in_len, int timeout_ms, rpc_future_cb cb, void *arg)
+{
+    if (!rpc || !cb) {
+        printf("invalid parament!\n");
+        return -1;
+    }
+    return call_async(rpc, msg_id, in_arg, in_len, timeout_ms, cb, arg, NULL);
+}
+
+int rpc_future_wait(struct rpc *rpc, struct rpc_future *f, int timeout_ms)
+{
+    int ret = 0;
+    uint64_t now, deadline;
+    if (!rpc || !f || f->cb) {
+        return -1;
+    }
+    /* request may still be queued, never wait for it */
+    rpc_batch_flush(rpc);
+    deadline = time_now_msec() + timeout_ms;
+    mutex_lock(&rpc->lock);
+    while (f->done == 0) {
+        now = time_now_msec();
+        if (timeout_ms > 0 && now >= deadline) {
+            ret = -1;
+            break;
+        }
+        mutex_cond_wait(&rpc->lock, &rpc->cond,
+                        timeout_ms > 0 ? (int64_t)(deadline - now) : 0);
+    }
+    if (f->done < 0) {
+        ret = -1;
+    }
+    mutex_unlock(&rpc->lock);
+    return ret;
+}
+
+void rpc_future_free(struct rpc *rpc, struct rpc_future *f)
+{
+    if (!rpc || !f) {
+        return;
+    }
+    /* still in flight after timeout, late response is dropped */
+    if (f->seq && !future_take(rpc, f->seq)) {
+        /* already taken by dispatch thread, wait until it is done with f */
+        mutex_lock(&rpc->lock);
+        while (f->done == 0) {
+            mutex_cond_wait(&rpc->lock, &rpc->cond, 0);
+        }
+        mutex_unlock(&rpc->lock);
+    }
+    free(f->obuf);
+    gear_free(f, sizeof(*f));
+}
+
+struct rpc_stream *rpc_stream_open(struct rpc *rpc, uint32_t msg_id,
+             const void *in_arg, size_t in_len, rpc_stream_cb cb, void *arg)
+{
+    struct rpc_session *ss;
+    struct rpc_packet pkt;
+    struct rpc_stream *st;
+    if (!rpc || !cb) {
+        printf("invalid parament!\n");
+        return NULL;
+    }
+    ss = &rpc->session;
+    if (rpc->state == rpc_disconnect) {
+        printf("rpc is disconnected!\n");
+        return NULL;
+    }
+    st = calloc(1, sizeof(struct rpc_stream));
+    if (!st) {
+        printf("malloc rpc_stream failed!\n");
+        return NULL;
+    }
+    st->msg_id = SET_RPC_MSG_STREAM(msg_id, _RPC_STREAM_NONE);
+    st->cb = cb;
+    st->arg = arg;
+    /* stream id shares seq space with calls */
+    mutex_lock(&rpc->lock);
+    if (++rpc->next_seq == 0) {
+        ++rpc->next_seq;
+    }
+    st->seq = rpc->next_seq;
+    st->next = rpc->streams;
+    rpc->streams = st;
+    mutex_unlock(&rpc->lock);
+    pack_msg(&pkt, ss->uuid_dst, ss->uuid_src,
+             SET_RPC_MSG_STREAM(msg_id, _RPC_STREAM_OPEN), in_arg, in_len);
+    pkt.header.seq = st->seq;
+    if (-1 == client_send(rpc, &pkt)) {
+        printf("rpc_send failed\n");
+        /* peer may have closed and failed it already */
+        if (stream_find(rpc, pkt.header.seq, true)) {
+            free(st);
+        }
+        return NULL;
+    }
+    return st;
+}
+
+static int stream_client_send(struct rpc *rpc, struct rpc_stream *st,
+                int flag, const void *buf, size_t len)
+{
+    struct rpc_session *ss = &rpc->session;
+    struct rpc_packet pkt;
+    pack_msg(&pkt, ss->uuid_dst, ss->uuid_src,
+             SET_RPC_MSG_STREAM(st->msg_id, flag), buf, len);
+    pkt.header.seq = st->seq;
+    return client_send(rpc, &pkt);
+}
+
+int rpc_stream_send(struct rpc *rpc, struct rpc_stream *st,
+             const void *buf, size_t len)
+{
+    if (!rpc || !st) {
+        printf("invalid parament!\n");
+        return -1;
+    }
+    return stream_client_send(rpc, st, _RPC_STREAM_DATA, buf, len);
+}
+
+int rpc_stream_close(struct rpc *rpc, struct rpc_stream *st)
+{
+    if (!rpc || !st) {
+        printf("invalid parament!\n");
+        return -1;
+    }
+    return stream_client_send(rpc, st, _RPC_STREAM_END, NULL, 0);
+}
+
+int rpc_call(struct rpc *rpc, uint32_t msg_id,
+             const void *in_arg, size_t in_len, void *out_arg, size_t out_len)
+{
+    int ret = 0;
+    struct rpc_future *f;
+    if (!rpc) {
+        printf("invalid parament!\n");
+        return -1;
+    }
+    f = rpc_call_async(rpc, msg_id, in_arg, in_len);
+    if (!f) {
+        printf("rpc_call_async failed\n");
+        return -1;
+    }
+    if (-1 == rpc_future_wait(rpc, f, 2000)) {
+        printf("%s wait response of 0x%08x failed\n", __func__, msg_id);
+        ret = -1;
+    } else if (out_arg && f->obuf) {
+        memcpy(out_arg, f->obuf, MIN2(out_len, f->olen));
+    }
+    rpc_future_free(rpc, f);
+    return ret;
+}
+
 static int on_connect_to_server(struct rpc *rpc)
 {
+    int ret;
     struct rpc_packet pkt;
+    struct rpc_future *f = NULL;
+    struct rpc_stream *st = NULL;
     msg_handler_t *msg_handler;
     struct rpc_session *ss = &rpc->session;
 
@@ -401,10 +974,44 @@ static int on_connect_to_server(struct rpc *rpc)
 #endif
     } else if (rpc->state == rpc_connected) {
         memset(&pkt, 0, sizeof(pkt));
-        if (-1 == rpc_recv(&ss->base, &pkt)) {
-            printf("rpc_recv failed!\n");
+        ret = rpc_recv_header(&ss->base, &pkt);
+        if (ret > 0) {
+            /*
+             * response is read straight into buffer handed to the future,
+             * other messages are read into reused buffer of connection
+             */
+            if (GET_RPC_MSG_STREAM(pkt.header.msg_id) != _RPC_STREAM_NONE) {
+                st = stream_find(rpc, pkt.header.seq, false);
+            } else if (pkt.header.seq) {
+                f = future_take(rpc, pkt.header.seq);
+            }
+            ret = rpc_recv_payload(&ss->base, &pkt, f == NULL);
+            if (f) {
+                future_complete(rpc, f, ret > 0 ? 1 : -1,
+                                pkt.payload, pkt.header.payload_len);
+            }
+        }
+        if (ret <= 0) {
+            rpc->state = rpc_disconnect;
+            future_fail_all(rpc);
+            stream_fail_all(rpc);
             return -1;
         }
+        if (f) {
+            return 0;
+        }
+        if (st) {
+            stream_deliver(rpc, st, &pkt);
+            return 0;
+        }
+        if (GET_RPC_MSG_STREAM(pkt.header.msg_id) != _RPC_STREAM_NONE) {
+            /* late message of a stream already finished */
+            return 0;
+        }
+        if (pkt.header.seq) {
+            /* response of a call which timed out or was freed */
+            return 0;
+        }
         msg_handler = find_msg_handler(pkt.header.msg_id);
         if (msg_handler) {
             msg_handler->cb(ss, pkt.payload, pkt.header.payload_len, NULL, NULL);
@@ -412,12 +1019,7 @@ static int on_connect_to_server(struct rpc *rpc)
 #if ENABLE_DEBUG
         printf("rpc state: rpc_connected -> rpc_connected\n");
 #endif
-    } else if (rpc->state == rpc_send_syn) {
-        thread_lock(ss->base.dispatch_thread);
-        thread_signal(ss->base.dispatch_thread);
-        thread_unlock(ss->base.dispatch_thread);
-        printf("rpc state: ... -> rpc_send_syn\n");
-    } else if (rpc->state == rpc_send_ack) {
+    } else if (rpc->state == rpc_disconnect) {
     } else {
         printf("rpc state is invalid!\n");
     }
@@ -437,6 +1039,16 @@ struct rpc *rpc_client_create(const char *host, uint16_t port)
     }
     rpc->on_connect_server = on_connect_to_server;
     rpc->state = rpc_inited;
+    mutex_lock_init(&rpc->lock);
+    mutex_cond_init(&rpc->cond);
+    mutex_lock_init(&rpc->batch_lock);
+    rpc->batch_max = RPC_BATCH_MAX;
+    gevent_wtimer_init(&rpc->batch_timer, on_batch_timer, rpc);
+    rpc->inflight = hash_create(RPC_INFLIGHT_BUCKETS);
+    if (!rpc->inflight) {
+        printf("hash_create failed!\n");
+        goto failed;
+    }
     if (rpc->session.base.ops->init_client(&rpc->session.base, host, port) < 0) {
         printf("init_client failed!\n");
         goto failed;
@@ -446,6 +1058,9 @@ struct rpc *rpc_client_create(const char *host, uint16_t port)
     return rpc;
 
 failed:
+    if (rpc->inflight) {
+        hash_destroy(rpc->inflight);
+    }
     free(rpc);
     return NULL;
 }
@@ -460,8 +1075,18 @@ void rpc_client_destroy(struct rpc *rpc)
     if (!rpc) {
         return;
     }
+    rpc_base_stop(&rpc->session.base);
+    /* deadline timers live in evbase, fail calls before it goes away */
+    future_fail_all(rpc);
+    stream_fail_all(rpc);
+    gevent_wtimer_del(rpc->session.base.evbase, &rpc->batch_timer);
     rpc->session.base.ops->deinit(&rpc->session.base);
     rpc_base_deinit(&rpc->session.base);
+    hash_destroy(rpc->inflight);
+    free(rpc->batch_buf);
+    mutex_lock_deinit(&rpc->batch_lock);
+    mutex_cond_deinit(&rpc->cond);
+    mutex_lock_deinit(&rpc->lock);
     free(rpc);
 }
 
@@ -479,6 +1104,123 @@ void rpc_client_dump_info(struct rpc *rpc)
 /******************************************************************************
  * server API
  ******************************************************************************/
+static void process_wq(void *arg);
+
+static struct rpc_strand *rpc_strand_create(struct workq_pool *pool)
+{
+    struct rpc_strand *st = calloc(1, sizeof(struct rpc_strand));
+    if (!st) {
+        printf("malloc rpc_strand failed!\n");
+        return NULL;
+    }
+    mutex_lock_init(&st->lock);
+    INIT_LIST_HEAD(&st->list);
+    st->pool = pool;
+    return st;
+}
+
+static void rpc_strand_free(struct rpc_strand *st)
+{
+    struct wq_arg *wq, *next;
+    list_for_each_entry_safe(wq, next, &st->list, entry) {
+        list_del(&wq->entry);
+        free(wq->ibuf);
+        free(wq);
+    }
+    mutex_lock_deinit(&st->lock);
+    free(st);
+}
+
+static void rpc_strand_run(void *arg)
+{
+    int i;
+    bool dead;
+    struct wq_arg *wq;
+    struct rpc_strand *st = (struct rpc_strand *)arg;
+
+    for (i = 0; i < RPC_STRAND_BUDGET; i++) {
+        mutex_lock(&st->lock);
+        if (list_empty(&st->list)) {
+            st->running = false;
+            dead = st->dead;
+            mutex_unlock(&st->lock);
+            if (dead) {
+                rpc_strand_free(st);
+            }
+            return;
+        }
+        wq = list_first_entry(&st->list, struct wq_arg, entry);
+        list_del(&wq->entry);
+        mutex_unlock(&st->lock);
+        process_wq(wq);
+    }
+    /* still running, requeue at tail so a busy session can not starve others */
+    if (0 != workq_pool_task_push(st->pool, rpc_strand_run, st)) {
+        mutex_lock(&st->lock);
+        st->running = false;
+        dead = st->dead;
+        mutex_unlock(&st->lock);
+        if (dead) {
+            rpc_strand_free(st);
+        }
+    }
+}
+
+static int rpc_strand_push(struct rpc_strand *st, struct wq_arg *wq)
+{
+    bool kick = false;
+    mutex_lock(&st->lock);
+    list_add_tail(&wq->entry, &st->list);
+    if (!st->running) {
+        st->running = true;
+        kick = true;
+    }
+    mutex_unlock(&st->lock);
+    if (kick && 0 != workq_pool_task_push(st->pool, rpc_strand_run, st)) {
+        mutex_lock(&st->lock);
+        list_del(&wq->entry);
+        st->running = false;
+        mutex_unlock(&st->lock);
+        return -1;
+    }
+    return 0;
+}
+
+/* queued messages still run after session is gone, their replies fail */
+static void rpc_strand_release(struct rpc_strand *st)
+{
+    bool running;
+    if (!st) {
+        return;
+    }
+    mutex_lock(&st->lock);
+    st->dead = true;
+    running = st->running;
+    mutex_unlock(&st->lock);
+    if (!running) {
+        rpc_strand_free(st);
+    }
+}
+
+static struct mem_account session_mem = MEM_ACCOUNT_INIT("rpc_session");
+
+static void rpc_session_free(void *arg)
+{
+    struct rpc_session *session = (struct rpc_session *)arg;
+    rpc_strand_release(session->strand);
+    free(session);
+    mem_account_charge(&session_mem, -(int64_t)sizeof(struct rpc_session), -1);
+}
+
+/* workers are stopped, drain queued on them will never run */
+static void rpc_session_drop(void *arg)
+{
+    struct rpc_session *session = (struct rpc_session *)arg;
+    rpc_strand_free(session->strand);
+    free(session);
+    mem_account_charge(&session_mem, -(int64_t)sizeof(struct rpc_session), -1);
+}
+
 static struct rpc_session *rpc_session_create(struct rpcs *s, int fd, uint32_t uuid)
 {
     struct rpc_session *session;
@@ -498,9 +1240,17 @@ static struct rpc_session *rpc_session_create(struct rpcs *s, int fd, uint32_t u
     }
     memcpy(&session->base, &s->base, sizeof(struct rpc_base));
     session->base.fd = fd;
+    session->base.rbuf = NULL;
+    session->base.rbuf_cap = 0;
     session->uuid_src = uuid;
     session->cseq = 0;
+    session->strand = rpc_strand_create(s->wq_pool);
+    if (!session->strand) {
+        free(session);
+        return NULL;
+    }
     hash_set32(s->hash_session, uuid, session);
+    mem_account_charge(&session_mem, sizeof(struct rpc_session), 1);
 
     memset(&pkt, 0, sizeof(pkt));
     pkt.header.uuid_src = uuid;
@@ -526,8 +1276,8 @@ static void rpc_session_destroy(struct rpcs *s, uint32_t uuid)
         printf("rpc session %d does not exist!\n", uuid);
         return;
     }
-    free(session);
     hash_del32(s->hash_session, uuid);
+    rpc_session_free(session);
     printf("rpc_session_destroy: uuid:0x%08x\n", uuid);
 }
 
@@ -536,13 +1286,18 @@ static void process_wq(void *arg)
     struct wq_arg *wq = (struct wq_arg *)arg;
     struct rpc_session *session = &wq->session;
     struct rpc_packet pkt;
-    if (&wq->handler) {
+    if (wq->handler.cb) {
         wq->handler.cb(session, wq->ibuf, wq->ilen, &wq->obuf, &wq->olen);
-        if (IS_RPC_MSG_NEED_RETURN(wq->handler.msg_id)) {
+        if (IS_RPC_MSG_NEED_RETURN(wq->handler.msg_id) &&
+            session->stream == _RPC_STREAM_NONE) {
             pack_msg(&pkt, 0, session->uuid_src, wq->handler.msg_id, wq->obuf, wq->olen);
+            pkt.header.seq = (uint32_t)session->cseq;
             rpc_send(&session->base, &pkt);
         }
     }
+    free(wq->ibuf);
+    free(wq->obuf);
+    free(wq);
 }
 
 struct rpcs *rpc_server_get_handle(struct rpc_session *ss)
@@ -551,6 +1306,29 @@ struct rpcs *rpc_server_get_handle(struct rpc_session *ss)
     return wq_arg->rpcs;
 }
 
+static int stream_send(struct rpc_session *ss, int flag, const void *buf, size_t len)
+{
+    struct rpc_packet pkt;
+    if (!ss || !ss->cseq) {
+        printf("%s:%d session is not of a stream\n", __func__, __LINE__);
+        return -1;
+    }
+    pack_msg(&pkt, ss->uuid_dst, ss->uuid_src,
+             SET_RPC_MSG_STREAM(ss->msg_id, flag), buf, len);
+    pkt.header.seq = (uint32_t)ss->cseq;
+    return rpc_send(&ss->base, &pkt) == -1 ? -1 : 0;
+}
+
+int rpc_stream_push(struct rpc_session *ss, const void *buf, size_t len)
+{
+    return stream_send(ss, _RPC_STREAM_DATA, buf, len);
+}
+
+int rpc_stream_end(struct rpc_session *ss)
+{
+    return stream_send(ss, _RPC_STREAM_END, NULL, 0);
+}
+
 static int process_msg(struct rpcs *s, struct rpc_session *session, struct rpc_packet *pkt)
 {
     int ret = 0;
@@ -566,11 +1344,24 @@ static int process_msg(struct rpcs *s, struct rpc_session *session, struct rpc_p
         memcpy(&arg->session, session, sizeof(struct rpc_session));
         ss->uuid_dst = pkt->header.uuid_dst;
         ss->timestamp = pkt->header.timestamp;
-        ss->msg_id = pkt->header.msg_id;
-        arg->ibuf = memdup(pkt->payload, h->payload_len);
+        ss->msg_id = SET_RPC_MSG_STREAM(pkt->header.msg_id, _RPC_STREAM_NONE);
+        ss->stream = GET_RPC_MSG_STREAM(pkt->header.msg_id);
+        ss->cseq = pkt->header.seq;
+        /* worker owns the payload, no copy */
+        arg->ibuf = pkt->payload;
         arg->ilen = h->payload_len;
+        pkt->payload = NULL;
 
-        workq_pool_task_push(s->wq_pool, process_wq, arg);
+        if (session->strand) {
+            ret = rpc_strand_push(session->strand, arg);
+        } else {
+            ret = workq_pool_task_push(s->wq_pool, process_wq, arg);
+        }
+        if (ret != 0) {
+            printf("%s: queue msg 0x%08x failed\n", __func__, h->msg_id);
+            free(arg->ibuf);
+            free(arg);
+        }
     } else {
         printf("no callback for this MSG ID(%d) in process_msg\n", h->msg_id);
     }
@@ -582,15 +1373,18 @@ static int on_message_from_client(struct rpcs *s, struct rpc_session *session)
     int ret;
     struct rpc_packet pkt;
 
+    memset(&pkt, 0, sizeof(pkt));
     ret = rpc_recv(&session->base, &pkt);
     if (ret == 0) {
         printf("del connect: uuid:0x%08x\n", session->uuid_src);
+        hash_del32(s->hash_fd2session, session->base.fd);
         rpc_session_destroy(s, session->uuid_src);
     } else if (ret == -1) {
         printf("rpc_recv failed\n");
     } else {
         ret = process_msg(s, session, &pkt);
     }
+    free(pkt.payload);
     return ret;
 }
 
@@ -635,8 +1429,12 @@ void rpc_server_destroy(struct rpcs *s)
     if (!s) {
         return;
     }
-    s->base.ops->deinit(&s->base);
+    rpc_base_stop(&s->base);
     workq_pool_destroy(s->wq_pool);
+    s->base.ops->deinit(&s->base);
     rpc_base_deinit(&s->base);
+    hash_set_destory(s->hash_session, rpc_session_drop);
+    hash_destroy(s->hash_session);
+    hash_destroy(s->hash_fd2session);
     free(s);
 }
@@ -26,10 +26,13 @@
 #include <libhash.h>
 #include <libdarray.h>
 #include <libworkq.h>
+#include <libthread.h>
+#include <libgevent.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <semaphore.h>
+#include <sys/uio.h>
 
 #define LIBRPC_VERSION "0.1.1"
 
@@ -51,6 +54,8 @@ extern "C" {
  * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
  * |                         message_id=32                         |
  * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ * |                            seq=32                             |
+ * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
  * |                                                               |
  * +-+-+-+-+-+-+-+-+-+-+-+-+ timestamp=64 -+-+-+-+-+-+-+-+-+-+-+-+-+
  * |                                                               |
@@ -75,16 +80,23 @@ extern "C" {
  *
  * destination_uuid is message send to
  * source_uuid is message send from
+ * seq is call sequence set by client, echoed in response to match the
+ * request when many calls are in flight, 0 for messages not from rpc_call
  *
  * message_id define
  * +=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+
  * |7 6 5 4 3 2 1 0|7 6 5 4 3 2 1 0|7 6 5 4 3 2 1 0|7 6 5 4 3 2 1 0|
  * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
- * |  group_id=7 |unused=5 |R|D|P=2|         cmd_id=16             |
+ * |  group_id=7 |unused=3|S=2|R|D|P=2|        cmd_id=16           |
  * +=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+
  *  [31~25]: group id
  *         - max support 128 group, can be used to service group
- *  [24~20]: unused
+ *  [24~22]: unused
+ *  [21~20]: stream, seq is the stream id, not part of handler id
+ *         - 0 not stream
+ *         - 1 open stream
+ *         - 2 stream data
+ *         - 3 end of stream
  *  [   19]: return indicator
  *         - 0: no need return
  *         - 1: need return
@@ -117,6 +129,7 @@ typedef struct rpc_header {
     uint32_t uuid_dst;
     uint32_t uuid_src;
     uint32_t msg_id;
+    uint32_t seq;
     uint64_t timestamp;
     uint32_t payload_len;
     uint32_t checksum;
@@ -133,6 +146,8 @@ struct rpc_ops {
     void (*deinit)(struct rpc_base *r);
     int (*send)(struct rpc_base *r, const void *buf, size_t len);
     int (*recv)(struct rpc_base *r, void *buf, size_t len);
+    /* optional, send header and payload without joining them */
+    int (*sendv)(struct rpc_base *r, const struct iovec *iov, int iovcnt);
 };
 
 struct rpc_base {
@@ -142,8 +157,13 @@ struct rpc_base {
     struct gevent_base *evbase;
     DARRAY(struct gevent*) ev_list;
     struct thread *dispatch_thread;
+    /* payload buffer reused by messages handled in dispatch thread */
+    void *rbuf;
+    size_t rbuf_cap;
 };
 
+struct rpc_strand;
+
 struct rpc_session {
     struct rpc_base base;
     uint32_t uuid_src;
@@ -151,6 +171,8 @@ struct rpc_session {
     uint32_t msg_id;
     uint64_t timestamp;
     uint64_t cseq;
+    uint32_t stream;    /* stream flag of the message in handler */
+    struct rpc_strand *strand;  /* serial queue of server session */
 };
 
 typedef int (*rpc_callback)(struct rpc_session *session,
@@ -191,10 +213,64 @@ typedef enum rpc_state {
     rpc_disconnect,
 } rpc_state;
 
+struct rpc;
+struct rpc_future;
+
+/* called in dispatch thread when response arrived or call failed */
+typedef void (*rpc_future_cb)(struct rpc *r, struct rpc_future *f, void *arg);
+
+struct rpc_future {
+    uint32_t seq;
+    uint32_t msg_id;
+    int done;           /* 0 in flight, 1 response arrived, -1 failed */
+    int err;            /* ETIMEDOUT if deadline passed, EPIPE if conn lost */
+    void *obuf;
+    size_t olen;
+    rpc_future_cb cb;
+    void *arg;
+    struct rpc *rpc;
+    struct gevent_wtimer deadline;
+    struct rpc_future *next;
+};
+
+struct rpc_stream;
+
+/*
+ * called in dispatch thread for each message of stream, buf is NULL at end
+ * of stream, st->status tells if it was ended by server or failed, stream
+ * is freed after this last call
+ */
+typedef void (*rpc_stream_cb)(struct rpc *r, struct rpc_stream *st,
+                void *buf, size_t len, void *arg);
+
+struct rpc_stream {
+    uint32_t seq;
+    uint32_t msg_id;
+    int status;         /* 0 open, 1 ended by server, -1 failed */
+    rpc_stream_cb cb;
+    void *arg;
+    struct rpc_stream *next;
+};
+
 struct rpc {
     struct rpc_session session;
     enum rpc_state state;
     int (*on_connect_server)(struct rpc *rpc);
+    mutex_lock_t lock;
+    mutex_cond_t cond;
+    uint32_t next_seq;
+    int ninflight;
+    struct hash *inflight;      /* seq -> rpc_future */
+    struct rpc_stream *streams;
+    /* packets queued between rpc_batch_begin and rpc_batch_end */
+    mutex_lock_t batch_lock;
+    int batching;               /* atomic, senders read it without lock */
+    uint8_t *batch_buf;
+    size_t batch_len;
+    size_t batch_cap;
+    size_t batch_max;           /* flush threshold in bytes */
+    int batch_delay_ms;         /* flush timer, 0 is none */
+    struct gevent_wtimer batch_timer;
 };
 
 GEAR_API struct rpc *rpc_client_create(const char *host, uint16_t port);
@@ -206,6 +282,53 @@ GEAR_API void rpc_client_dump_info(struct rpc *r);
 GEAR_API int rpc_call(struct rpc *r, uint32_t cmd_id,
             const void *in_arg, size_t in_len, void *out_arg, size_t out_len);
 
+/*
+ * pipelined call, returns after request is sent, many calls can be in
+ * flight on one connection and responses may come back in any order.
+ * rpc_call_async returns a future to wait with rpc_future_wait, release it
+ * with rpc_future_free even if wait failed. rpc_call_cb calls cb in
+ * dispatch thread instead, response buffer is freed after cb returns.
+ * rpc_call_cb_timeout also fails the call with err ETIMEDOUT once
+ * timeout_ms passed, a late response is dropped.
+ */
+GEAR_API struct rpc_future *rpc_call_async(struct rpc *r, uint32_t cmd_id,
+            const void *in_arg, size_t in_len);
+GEAR_API int rpc_call_cb(struct rpc *r, uint32_t cmd_id,
+            const void *in_arg, size_t in_len, rpc_future_cb cb, void *arg);
+GEAR_API int rpc_call_cb_timeout(struct rpc *r, uint32_t cmd_id,
+            const void *in_arg, size_t in_len, int timeout_ms,
+            rpc_future_cb cb, void *arg);
+GEAR_API int rpc_future_wait(struct rpc *r, struct rpc_future *f, int timeout_ms);
+GEAR_API void rpc_future_free(struct rpc *r, struct rpc_future *f);
+
+/*
+ * batching, calls between begin and end are queued and written together,
+ * queue is flushed when it reaches max_bytes (RPC_BATCH_MAX by default),
+ * delay_ms after the first queued call if set, on rpc_batch_flush,
+ * rpc_batch_end, or before rpc_future_wait blocks. the timer runs in the
+ * dispatch loop, its resolution is the 1ms wheel tick. latency sensitive
+ * calls go out at once while batching is not begun
+ */
+#define RPC_BATCH_MAX   (64 * 1024)
+GEAR_API int rpc_batch_set(struct rpc *r, size_t max_bytes, int delay_ms);
+GEAR_API void rpc_batch_begin(struct rpc *r);
+GEAR_API int rpc_batch_flush(struct rpc *r);
+GEAR_API int rpc_batch_end(struct rpc *r);
+
+/*
+ * streaming call, server handler of cmd_id is called once with
+ * session->stream = _RPC_STREAM_OPEN and then for each rpc_stream_send of
+ * client with _RPC_STREAM_DATA, and _RPC_STREAM_END for rpc_stream_close.
+ * server pushes any number of messages back with rpc_stream_push on a
+ * copy of the session, and stops the stream with rpc_stream_end.
+ * cmd_id should be a no return msg id, there is no single response
+ */
+GEAR_API struct rpc_stream *rpc_stream_open(struct rpc *r, uint32_t cmd_id,
+            const void *in_arg, size_t in_len, rpc_stream_cb cb, void *arg);
+GEAR_API int rpc_stream_send(struct rpc *r, struct rpc_stream *st,
+            const void *buf, size_t len);
+GEAR_API int rpc_stream_close(struct rpc *r, struct rpc_stream *st);
+
 /******************************************************************************
  * server API
  ******************************************************************************/
@@ -222,6 +345,8 @@ GEAR_API struct rpcs *rpc_server_create(const char *host, uint16_t port);
 GEAR_API void rpc_server_destroy(struct rpcs *s);
 GEAR_API int rpc_server_dispatch(struct rpcs *s);
 GEAR_API struct rpcs *rpc_server_get_handle(struct rpc_session *r);
+GEAR_API int rpc_stream_push(struct rpc_session *r, const void *buf, size_t len);
+GEAR_API int rpc_stream_end(struct rpc_session *r);
 
 
 #define RPC_MSG_ID_MASK             0xFFFFFFFF
@@ -229,6 +354,9 @@ GEAR_API struct rpcs *rpc_server_get_handle(struct rpc_session *r);
 #define RPC_GROUP_BIT               (25)
 #define RPC_GROUP_MASK              0x07
 
+#define RPC_STREAM_BIT              (20)
+#define RPC_STREAM_MASK             0x03
+
 #define RPC_RET_BIT                 (19)
 #define RPC_RET_MASK                0x01
 
@@ -260,6 +388,13 @@ GEAR_API struct rpcs *rpc_server_get_handle(struct rpc_session *r);
 #define GET_RPC_MSG_PARSE(cmd) \
         (((cmd & RPC_MSG_ID_MASK)>>RPC_PARSE_BIT) & RPC_PARSE_MASK)
 
+#define GET_RPC_MSG_STREAM(cmd) \
+        (((cmd & RPC_MSG_ID_MASK)>>RPC_STREAM_BIT) & RPC_STREAM_MASK)
+
+#define SET_RPC_MSG_STREAM(cmd, stream) \
+        (((cmd) & ~((uint32_t)RPC_STREAM_MASK << RPC_STREAM_BIT)) | \
+         ((((uint32_t)stream) & RPC_STREAM_MASK) << RPC_STREAM_BIT))
+
 
 enum rpc_direction {
     _RPC_DIR_UP = 0,
@@ -276,6 +411,13 @@ enum rpc_return {
     _RPC_NEED_RETURN = 1,
 };
 
+enum rpc_stream_flag {
+    _RPC_STREAM_NONE = 0,
+    _RPC_STREAM_OPEN = 1,
+    _RPC_STREAM_DATA = 2,
+    _RPC_STREAM_END = 3,
+};
+
 enum rpc_cmd_inner {
     _RPC_INNER_0    = 0,
     _RPC_INNER_1    = 1,
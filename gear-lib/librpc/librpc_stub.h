@@ -33,6 +33,8 @@ enum rpc_cmd {
     _RPC_SHELL_HELP,
     _RPC_HELLO,
     _RPC_CALC,
+    _RPC_ECHO,
+    _RPC_STREAM,
     _RPC_USER_MAX   = 255
 };
 
@@ -64,5 +66,11 @@ enum rpc_group {
 #define RPC_CALC \
     BUILD_RPC_MSG_ID(_RPC_GROUP_0, _RPC_NEED_RETURN, _RPC_DIR_UP, _RPC_PARSE_JSON, _RPC_CALC)
 
+#define RPC_ECHO \
+    BUILD_RPC_MSG_ID(_RPC_GROUP_0, _RPC_NEED_RETURN, _RPC_DIR_UP, _RPC_PARSE_JSON, _RPC_ECHO)
+
+#define RPC_STREAM \
+    BUILD_RPC_MSG_ID(_RPC_GROUP_0, _RPC_NO_RETURN, _RPC_DIR_UP, _RPC_PARSE_JSON, _RPC_STREAM)
+
 
 #endif
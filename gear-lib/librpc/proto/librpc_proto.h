@@ -0,0 +1,98 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#ifndef LIBRPC_PROTO_H
+#define LIBRPC_PROTO_H
+
+#include <stdlib.h>
+#include <google/protobuf/arena.h>
+#include <google/protobuf/message_lite.h>
+#include "../librpc.h"
+
+/*
+ * protobuf parse path of librpc, messages are parsed straight from the
+ * payload buffer with ParseFromArray (no std::string copy) into an arena,
+ * arena of the thread is reset after each message instead of freeing
+ * every field, first block is kept so steady state does no malloc
+ */
+#define RPC_PROTO_ARENA_BLOCK   (16 * 1024)
+
+class rpc_proto_arena {
+public:
+    rpc_proto_arena() : arena_(options()) {}
+
+    /* arena of calling thread, reused by every message of handler */
+    static rpc_proto_arena &local()
+    {
+        static thread_local rpc_proto_arena a;
+        return a;
+    }
+
+    template <typename T> T *parse(const void *buf, size_t len)
+    {
+        T *msg = google::protobuf::Arena::CreateMessage<T>(&arena_);
+        if (!msg->ParseFromArray(buf, (int)len)) {
+            return NULL;
+        }
+        return msg;
+    }
+
+    template <typename T> T *create()
+    {
+        return google::protobuf::Arena::CreateMessage<T>(&arena_);
+    }
+
+    /* all messages from this arena are invalid after reset */
+    void reset() { arena_.Reset(); }
+    size_t used() { return arena_.SpaceUsed(); }
+
+private:
+    google::protobuf::ArenaOptions options()
+    {
+        google::protobuf::ArenaOptions opt;
+        opt.initial_block = block_;
+        opt.initial_block_size = sizeof(block_);
+        return opt;
+    }
+    /* must be constructed before arena_ */
+    char block_[RPC_PROTO_ARENA_BLOCK];
+    google::protobuf::Arena arena_;
+};
+
+/* serialize into malloc buffer, for obuf of rpc_callback or rpc_call */
+static inline int rpc_proto_pack(const google::protobuf::MessageLite &msg,
+                void **buf, size_t *len)
+{
+    size_t size = msg.ByteSizeLong();
+    void *p = malloc(size ? size : 1);
+    if (!p) {
+        return -1;
+    }
+    if (!msg.SerializeToArray(p, (int)size)) {
+        free(p);
+        return -1;
+    }
+    *buf = p;
+    *len = size;
+    return 0;
+}
+
+#endif
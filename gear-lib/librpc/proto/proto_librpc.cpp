@@ -8,115 +8,110 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
-#include <string.h>
 #include <errno.h>
 #include <unistd.h>
-#include <pthread.h>
-#include <arpa/inet.h>
-#include <sys/socket.h>
 #include <iostream>
 #include "../librpc_stub.h"
+#include "librpc_proto.h"
 #include "librpc.pb.h"
 #include "hello.pb.h"
 
 using namespace std;
 
-static int on_calc_resp(struct rpc *r, void *arg, int len)
-{
-    string reqbuf((const char *)arg, len);
-    hello::request req;
-    if (!req.ParseFromString(reqbuf)) {
-        fprintf(stderr, "parse message failed!\n");
-    }
-    cout << "request:>>>>>>>>\n" << req.DebugString() << ">>>>>>>>>>>>>>>\n" << endl;
-    //printf("recv len = %d, buf = %s\n", buf->len, buf->addr);
-    //dump_buffer(buf->addr, buf->len);
-    return 0;
-}
-
+#define HELLO_CALLS     1000
 
-static int on_hello_resp(struct rpc *r, void *arg, int len)
+/* server side, request and reply live in arena of worker thread */
+static int on_hello(struct rpc_session *r, void *ibuf, size_t ilen, void **obuf, size_t *olen)
 {
-    string reqbuf((const char *)arg, len);
-    hello::request req;
-    if (!req.ParseFromString(reqbuf)) {
+    int ret = 0;
+    rpc_proto_arena &arena = rpc_proto_arena::local();
+    hello::request *req = arena.parse<hello::request>(ibuf, ilen);
+    hello::reply *rep = arena.create<hello::reply>();
+    if (!req) {
         fprintf(stderr, "parse message failed!\n");
+        rep->set_ret(ERROR);
+    } else {
+        rep->set_ret(SUCCESS);
+        rep->set_uint32_arg(req->uint32_arg() + 1);
+        rep->set_string_arg(req->string_arg());
     }
-    cout << "request:>>>>>>>>\n" << req.DebugString() << ">>>>>>>>>>>>>>>\n" << endl;
-    //printf("recv len = %d, buf = %s\n", buf->len, buf->addr);
-    //dump_buffer(buf->addr, buf->len);
-    return 0;
-}
-
-void on_write(int fd, void *arg)
-{
-    printf("on_write fd= %d\n", fd);
+    if (0 != rpc_proto_pack(*rep, obuf, olen)) {
+        ret = -1;
+    }
+    arena.reset();
+    return ret;
 }
 
-void on_error(int fd, void *arg)
-{
-    printf("on_error fd= %d\n", fd);
-}
+BEGIN_RPC_MAP(BASIC_RPC_API)
+RPC_MAP(RPC_HELLO, on_hello)
+END_RPC_MAP()
 
 void usage()
 {
-    fprintf(stderr, "./test_libskt <ip> <port>\n");
+    fprintf(stderr, "./test_proto <port>\n");
 }
 
-int rpc_hello(struct rpc *r)
+/* client side, reply is parsed in place from response buffer */
+int rpc_hello(struct rpc *r, uint32_t arg)
 {
-
-    hello::request req;
+    int ret = -1;
     string wbuf;
+    hello::request req;
+    hello::reply *rep;
+    struct rpc_future *f;
+    rpc_proto_arena &arena = rpc_proto_arena::local();
+
     req.set_id(HELLO);
-    req.set_uint32_arg(1234);
+    req.set_uint32_arg(arg);
     req.set_string_arg("hello");
-
     if (!req.SerializeToString(&wbuf)) {
         fprintf(stderr, "serialize to string failed!\n");
         return -1;
     }
-
-    cout << "request:>>>>>>>>\n" << req.DebugString() << ">>>>>>>>>>>>>>>\n" << endl;
-
-    rpc_call(r, RPC_HELLO, wbuf.data(), wbuf.length(), NULL, 0);
-    return 0;
-}
-
-void *raw_data_thread(void *arg)
-{
-    struct rpc *r = (struct rpc *)arg;
-    rpc_hello(r);
-    return NULL;
+    f = rpc_call_async(r, RPC_HELLO, wbuf.data(), wbuf.length());
+    if (f && 0 == rpc_future_wait(r, f, 2000)) {
+        rep = arena.parse<hello::reply>(f->obuf, f->olen);
+        if (rep && rep->ret() == SUCCESS && rep->uint32_arg() == arg + 1 &&
+            rep->string_arg() == "hello") {
+            ret = 0;
+        }
+    }
+    rpc_future_free(r, f);
+    arena.reset();
+    return ret;
 }
 
-BEGIN_RPC_MAP(BASIC_RPC_API_RESP)
-RPC_MAP(RPC_HELLO, on_hello_resp)
-RPC_MAP(RPC_CALC, on_calc_resp)
-END_RPC_MAP()
-
-
 int main(int argc, char **argv)
 {
     uint16_t port;
-    char *ip;
-    pthread_t tid;
-    if (argc < 3) {
+    int i, ok = 0;
+    struct rpcs *s;
+    struct rpc *r;
+    if (argc < 2) {
         usage();
         exit(0);
     }
-    ip = argv[1];
-    port = atoi(argv[2]);
-    struct rpc *r = rpc_create(ip, port);
+    port = atoi(argv[1]);
+    s = rpc_server_create(NULL, port);
+    if (!s) {
+        printf("rpc_server_create failed\n");
+        return -1;
+    }
+    RPC_REGISTER_MSG_MAP(BASIC_RPC_API);
+    r = rpc_client_create("127.0.0.1", port);
     if (!r) {
-        printf("rpc_create failed\n");
+        printf("rpc_client_create failed\n");
+        rpc_server_destroy(s);
         return -1;
     }
-    RPC_REGISTER_MSG_MAP(BASIC_RPC_API_RESP);
-    pthread_create(&tid, NULL, raw_data_thread, r);
-    while (1) {
-        sleep(1);
+    for (i = 0; i < HELLO_CALLS; i++) {
+        if (0 == rpc_hello(r, i)) {
+            ok++;
+        }
     }
-    return 0;
+    printf("rpc proto hello: ok %d/%d\n", ok, HELLO_CALLS);
+    rpc_client_destroy(r);
+    rpc_server_destroy(s);
+    google::protobuf::ShutdownProtobufLibrary();
+    return (ok == HELLO_CALLS) ? 0 : -1;
 }
-
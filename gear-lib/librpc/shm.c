@@ -0,0 +1,254 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#include "shm.h"
+#include <libposix.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define RPC_SHM_MAGIC       (0x52504353) /* RPCS */
+#define SHM_LOAD(p)         __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define SHM_STORE(p, v)     __atomic_store_n(p, v, __ATOMIC_RELEASE)
+
+/*
+ * single producer single consumer in shared memory: rd and wr are free
+ * running counters in separate cache lines, ring size is power of 2
+ */
+struct shm_ring {
+    uint64_t rd;            /* only stored by reader */
+    char pad0[56];
+    uint64_t wr;            /* only stored by writer */
+    char pad1[56];
+    uint32_t sleeping;      /* reader waits for doorbell */
+    char pad2[60];
+    uint8_t data[0];
+};
+
+struct shm_region {
+    uint32_t magic;
+    uint32_t ring_size;
+    char pad[56];
+};
+
+struct rpc_shm {
+    char name[64];
+    void *addr;
+    size_t map_len;
+    size_t size;
+    bool owner;
+    struct shm_ring *tx;
+    struct shm_ring *rx;
+};
+
+static size_t region_len(size_t ring_size)
+{
+    return sizeof(struct shm_region) + 2 * (sizeof(struct shm_ring) + ring_size);
+}
+
+static struct shm_ring *region_ring(void *addr, size_t ring_size, int idx)
+{
+    return (struct shm_ring *)((uint8_t *)addr + sizeof(struct shm_region) +
+                               idx * (sizeof(struct shm_ring) + ring_size));
+}
+
+static struct rpc_shm *shm_map(const char *name, int fd, size_t len, bool owner)
+{
+    void *addr;
+    struct rpc_shm *shm = calloc(1, sizeof(struct rpc_shm));
+    if (!shm) {
+        printf("malloc rpc_shm failed!\n");
+        return NULL;
+    }
+    addr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        printf("mmap %s failed %d: %s\n", name, errno, strerror(errno));
+        free(shm);
+        return NULL;
+    }
+    snprintf(shm->name, sizeof(shm->name), "%s", name);
+    shm->addr = addr;
+    shm->map_len = len;
+    shm->owner = owner;
+    return shm;
+}
+
+struct rpc_shm *rpc_shm_create(const char *name, size_t ring_size)
+{
+    int fd;
+    size_t len;
+    struct rpc_shm *shm;
+    struct shm_region *region;
+
+    if (!name || ring_size == 0 || (ring_size & (ring_size - 1))) {
+        printf("%s:%d paraments is invalid\n", __func__, __LINE__);
+        return NULL;
+    }
+    /* name left by a crashed server of the same port pair */
+    shm_unlink(name);
+    fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd == -1) {
+        printf("shm_open %s failed %d: %s\n", name, errno, strerror(errno));
+        return NULL;
+    }
+    len = region_len(ring_size);
+    if (ftruncate(fd, len) == -1) {
+        printf("ftruncate %s failed %d: %s\n", name, errno, strerror(errno));
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+    shm = shm_map(name, fd, len, true);
+    close(fd);
+    if (!shm) {
+        shm_unlink(name);
+        return NULL;
+    }
+    shm->size = ring_size;
+    shm->rx = region_ring(shm->addr, ring_size, 0);
+    shm->tx = region_ring(shm->addr, ring_size, 1);
+    /* nobody reads yet, first write of each side rings the doorbell */
+    shm->rx->sleeping = 1;
+    shm->tx->sleeping = 1;
+    region = (struct shm_region *)shm->addr;
+    region->ring_size = ring_size;
+    SHM_STORE(&region->magic, RPC_SHM_MAGIC);
+    return shm;
+}
+
+struct rpc_shm *rpc_shm_attach(const char *name)
+{
+    int fd;
+    struct stat st;
+    struct rpc_shm *shm;
+    struct shm_region *region;
+
+    fd = shm_open(name, O_RDWR, 0600);
+    if (fd == -1) {
+        /* peer does not offer shared memory */
+        return NULL;
+    }
+    if (fstat(fd, &st) == -1 || st.st_size < (off_t)region_len(0)) {
+        close(fd);
+        return NULL;
+    }
+    shm = shm_map(name, fd, st.st_size, false);
+    close(fd);
+    if (!shm) {
+        return NULL;
+    }
+    region = (struct shm_region *)shm->addr;
+    if (SHM_LOAD(&region->magic) != RPC_SHM_MAGIC ||
+        region_len(region->ring_size) != shm->map_len) {
+        printf("shm %s is invalid!\n", name);
+        rpc_shm_destroy(shm);
+        return NULL;
+    }
+    /* both sides mapped, name is not needed any more */
+    shm_unlink(name);
+    shm->size = region->ring_size;
+    shm->tx = region_ring(shm->addr, shm->size, 0);
+    shm->rx = region_ring(shm->addr, shm->size, 1);
+    return shm;
+}
+
+void rpc_shm_destroy(struct rpc_shm *shm)
+{
+    if (!shm) {
+        return;
+    }
+    if (shm->owner) {
+        /* peer may have never attached */
+        shm_unlink(shm->name);
+    }
+    munmap(shm->addr, shm->map_len);
+    free(shm);
+}
+
+size_t rpc_shm_write(struct rpc_shm *shm, const void *buf, size_t len)
+{
+    struct shm_ring *ring = shm->tx;
+    uint64_t wr = ring->wr;
+    size_t off, n, first;
+
+    n = MIN2(len, shm->size - (size_t)(wr - SHM_LOAD(&ring->rd)));
+    if (n == 0) {
+        return 0;
+    }
+    off = wr & (shm->size - 1);
+    first = MIN2(n, shm->size - off);
+    memcpy(ring->data + off, buf, first);
+    memcpy(ring->data, (const uint8_t *)buf + first, n - first);
+    SHM_STORE(&ring->wr, wr + n);
+    return n;
+}
+
+size_t rpc_shm_read(struct rpc_shm *shm, void *buf, size_t len)
+{
+    struct shm_ring *ring = shm->rx;
+    uint64_t rd = ring->rd;
+    size_t off, n, first;
+
+    n = MIN2(len, (size_t)(SHM_LOAD(&ring->wr) - rd));
+    if (n == 0) {
+        return 0;
+    }
+    off = rd & (shm->size - 1);
+    first = MIN2(n, shm->size - off);
+    memcpy(buf, ring->data + off, first);
+    memcpy((uint8_t *)buf + first, ring->data, n - first);
+    SHM_STORE(&ring->rd, rd + n);
+    return n;
+}
+
+size_t rpc_shm_readable(struct rpc_shm *shm)
+{
+    return SHM_LOAD(&shm->rx->wr) - shm->rx->rd;
+}
+
+/*
+ * sleeping flag and ring counters are ordered by full fences on both
+ * sides, so either reader sees the new data or writer sees it sleeping
+ */
+bool rpc_shm_sleep(struct rpc_shm *shm)
+{
+    SHM_STORE(&shm->rx->sleeping, 1);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (rpc_shm_readable(shm) > 0) {
+        SHM_STORE(&shm->rx->sleeping, 0);
+        return false;
+    }
+    return true;
+}
+
+bool rpc_shm_need_wakeup(struct rpc_shm *shm)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (SHM_LOAD(&shm->tx->sleeping) == 0) {
+        return false;
+    }
+    return __atomic_exchange_n(&shm->tx->sleeping, 0, __ATOMIC_SEQ_CST) == 1;
+}
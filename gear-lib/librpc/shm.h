@@ -0,0 +1,64 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#ifndef RPC_SHM_H
+#define RPC_SHM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * shared memory ring of one loopback connection, created by server and
+ * attached by client, one byte stream ring for each direction. the socket
+ * of the connection is kept only as doorbell and to detect close.
+ * large payloads go through the ring in pieces, not by offset into a
+ * side area, since the reader copies into its own buffer either way
+ */
+#define RPC_SHM_RING_SIZE   (1024 * 1024)
+
+struct rpc_shm;
+
+struct rpc_shm *rpc_shm_create(const char *name, size_t ring_size);
+struct rpc_shm *rpc_shm_attach(const char *name);
+void rpc_shm_destroy(struct rpc_shm *shm);
+
+/* non blocking, return bytes copied */
+size_t rpc_shm_write(struct rpc_shm *shm, const void *buf, size_t len);
+size_t rpc_shm_read(struct rpc_shm *shm, void *buf, size_t len);
+size_t rpc_shm_readable(struct rpc_shm *shm);
+
+/*
+ * reader marks itself sleeping before waiting on doorbell, returns false
+ * and stays awake if data came in meanwhile. writer calls need_wakeup
+ * after write, true means doorbell must be rung
+ */
+bool rpc_shm_sleep(struct rpc_shm *shm);
+bool rpc_shm_need_wakeup(struct rpc_shm *shm);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
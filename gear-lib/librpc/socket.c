@@ -20,17 +20,24 @@
  * SOFTWARE.
  ******************************************************************************/
 #include "librpc.h"
+#include "shm.h"
 #include <libgevent.h>
 #include <libthread.h>
 #include <libsock.h>
+#include <libtime.h>
 #include <libposix.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <netinet/in.h>
 
 #define MAX_UUID_LEN                (21)
+#define RPC_SHM_ENV                 "LIBRPC_SHM"
+#define RPC_SHM_SEND_TIMEOUT        (2000)
 
 struct socket_ctx {
     /* fd:
@@ -40,11 +47,132 @@ struct socket_ctx {
     int fd;
     struct hash *hash_fd2conn;
     struct sock_connection *connect;
+    mutex_lock_t lock;
+    struct socket_conn *conns;
 };
 
-static struct sock_connection *find_connection(struct socket_ctx *c, int fd)
+/*
+ * output queue of one connection. the first sender writes directly, packets
+ * sent meanwhile by other threads are appended to buf and written together
+ * by one flush in dispatch thread, so a burst of responses costs one write
+ */
+struct socket_conn {
+    struct sock_connection *conn;
+    struct gevent_base *evbase;
+    mutex_lock_t lock;
+    bool sending;
+    bool posted;
+    uint8_t *buf;
+    size_t len;
+    size_t cap;
+    /* loopback peer, data goes through shared memory ring instead */
+    struct rpc_shm *shm;
+    bool shm_probed;
+    struct socket_conn *next;
+};
+
+static struct socket_conn *socket_conn_add(struct socket_ctx *c,
+                struct rpc_base *r, struct sock_connection *conn)
+{
+    struct socket_conn *sc = calloc(1, sizeof(struct socket_conn));
+    if (!sc) {
+        printf("malloc socket_conn failed!\n");
+        return NULL;
+    }
+    sc->conn = conn;
+    sc->evbase = r->evbase;
+    mutex_lock_init(&sc->lock);
+    mutex_lock(&c->lock);
+    hash_set32(c->hash_fd2conn, conn->fd, sc);
+    sc->next = c->conns;
+    c->conns = sc;
+    mutex_unlock(&c->lock);
+    return sc;
+}
+
+static struct socket_conn *find_connection(struct socket_ctx *c, int fd)
+{
+    struct socket_conn *sc;
+    mutex_lock(&c->lock);
+    sc = hash_get32(c->hash_fd2conn, fd);
+    mutex_unlock(&c->lock);
+    return sc;
+}
+
+static void socket_conn_flush(void *arg);
+
+/* called with sc->lock held */
+static void socket_conn_post(struct socket_conn *sc)
+{
+    if (sc->len == 0 || sc->posted) {
+        return;
+    }
+    sc->posted = true;
+    if (0 != gevent_base_post(sc->evbase, socket_conn_flush, sc)) {
+        sc->posted = false;
+    }
+}
+
+static int socket_conn_write(struct socket_conn *sc, uint8_t *buf, size_t len)
+{
+    int ret = sock_send(sc->conn->fd, buf, len);
+    if (ret != (int)len) {
+        printf("send %zu failed: %d\n", len, errno);
+        return -1;
+    }
+    return ret;
+}
+
+static void socket_conn_flush(void *arg)
+{
+    struct socket_conn *sc = (struct socket_conn *)arg;
+    uint8_t *buf;
+    size_t len, cap;
+
+    mutex_lock(&sc->lock);
+    sc->posted = false;
+    if (sc->sending || sc->len == 0) {
+        /* direct sender will post again when it is done */
+        mutex_unlock(&sc->lock);
+        return;
+    }
+    buf = sc->buf;
+    len = sc->len;
+    cap = sc->cap;
+    sc->buf = NULL;
+    sc->len = sc->cap = 0;
+    sc->sending = true;
+    mutex_unlock(&sc->lock);
+
+    socket_conn_write(sc, buf, len);
+
+    mutex_lock(&sc->lock);
+    sc->sending = false;
+    if (!sc->buf) {
+        /* keep the buffer for next round */
+        sc->buf = buf;
+        sc->cap = cap;
+        buf = NULL;
+    }
+    socket_conn_post(sc);
+    mutex_unlock(&sc->lock);
+    free(buf);
+}
+
+static void socket_conn_free(struct socket_ctx *c, struct socket_conn *sc)
 {
-    return hash_get32(c->hash_fd2conn, fd);
+    /* dispatch thread is stopped, flush what is left */
+    if (sc->len) {
+        socket_conn_write(sc, sc->buf, sc->len);
+    }
+    rpc_shm_destroy(sc->shm);
+    if (sc->conn->fd != c->fd) {
+        sock_close(sc->conn->fd);
+    }
+    free(sc->conn);
+    mutex_lock_deinit(&sc->lock);
+    free(sc->buf);
+    free(sc);
 }
 
 static void on_error(int fd, void *arg)
@@ -59,12 +187,190 @@ static uint32_t create_uuid(int fd, uint32_t ip, uint16_t port)
     return hash_gen32(uuid, sizeof(uuid));
 }
 
+/* edge triggered, pipelined packets may already be queued after this one */
+static bool has_pending_data(int fd)
+{
+    char c;
+    return recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT) > 0;
+}
+
+/*
+ * name of shared memory of a loopback connection, both ends derive it from
+ * server and client port, -1 if peer is not on this host
+ */
+static int shm_conn_name(int fd, bool server, char *name, size_t len)
+{
+    struct sockaddr_in local, peer;
+    socklen_t llen = sizeof(local), plen = sizeof(peer);
+    uint16_t sport, cport;
+
+    if (getsockname(fd, (struct sockaddr *)&local, &llen) == -1 ||
+        getpeername(fd, (struct sockaddr *)&peer, &plen) == -1 ||
+        peer.sin_family != AF_INET ||
+        (ntohl(peer.sin_addr.s_addr) >> 24) != 127) {
+        return -1;
+    }
+    sport = ntohs(server ? local.sin_port : peer.sin_port);
+    cport = ntohs(server ? peer.sin_port : local.sin_port);
+    snprintf(name, len, "/librpc.%u.%u", sport, cport);
+    return 0;
+}
+
+/* server side, before anything is sent on the new connection */
+static void socket_conn_offer_shm(struct socket_conn *sc)
+{
+    char name[64];
+    const char *env = getenv(RPC_SHM_ENV);
+    if (0 != shm_conn_name(sc->conn->fd, true, name, sizeof(name))) {
+        return;
+    }
+    if (env && !strcmp(env, "0")) {
+        /* stale name must not make client attach a dead ring */
+        shm_unlink(name);
+        return;
+    }
+    sc->shm = rpc_shm_create(name, RPC_SHM_RING_SIZE);
+}
+
+/* client side, on first data from server */
+static void socket_conn_probe_shm(struct socket_conn *sc)
+{
+    char name[64];
+    sc->shm_probed = true;
+    if (0 != shm_conn_name(sc->conn->fd, false, name, sizeof(name))) {
+        return;
+    }
+    sc->shm = rpc_shm_attach(name);
+    if (sc->shm) {
+        printf("connection fd=%d uses shared memory ring\n", sc->conn->fd);
+    }
+}
+
+static bool socket_peer_closed(int fd)
+{
+    char c;
+    return recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT) == 0;
+}
+
+/* read doorbell bytes away, return true if peer closed */
+static bool socket_shm_drain(struct socket_conn *sc)
+{
+    char buf[64];
+    ssize_t n;
+    while (1) {
+        n = recv(sc->conn->fd, buf, sizeof(buf), MSG_DONTWAIT);
+        if (n > 0) {
+            continue;
+        }
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        return n == 0 ||
+               (n == -1 && errno != EAGAIN && errno != EWOULDBLOCK);
+    }
+}
+
+static void socket_shm_ring(struct socket_conn *sc)
+{
+    if (rpc_shm_need_wakeup(sc->shm)) {
+        /* socket full of doorbells already wakes reader */
+        send(sc->conn->fd, "", 1, MSG_NOSIGNAL | MSG_DONTWAIT);
+    }
+}
+
+/* connection still has packets to handle in this round */
+static bool socket_conn_pending(struct socket_conn *sc, int fd)
+{
+    if (!sc || !sc->shm) {
+        return has_pending_data(fd);
+    }
+    if (rpc_shm_readable(sc->shm) > 0) {
+        return true;
+    }
+    return !rpc_shm_sleep(sc->shm);
+}
+
+static int socket_shm_sendv(struct socket_conn *sc, const struct iovec *iov,
+                int iovcnt)
+{
+    int i, ret = 0;
+    size_t n, off;
+    uint64_t deadline = time_now_msec() + RPC_SHM_SEND_TIMEOUT;
+
+    mutex_lock(&sc->lock);
+    for (i = 0; i < iovcnt; i++) {
+        for (off = 0; off < iov[i].iov_len; off += n) {
+            n = rpc_shm_write(sc->shm, (uint8_t *)iov[i].iov_base + off,
+                              iov[i].iov_len - off);
+            if (n > 0) {
+                continue;
+            }
+            /* ring full, let reader drain it */
+            socket_shm_ring(sc);
+            if (time_now_msec() > deadline ||
+                socket_peer_closed(sc->conn->fd)) {
+                printf("shm send fd=%d failed!\n", sc->conn->fd);
+                ret = -1;
+                goto out;
+            }
+            sched_yield();
+        }
+        ret += iov[i].iov_len;
+    }
+out:
+    socket_shm_ring(sc);
+    mutex_unlock(&sc->lock);
+    return ret;
+}
+
+static int socket_shm_recv(struct socket_conn *sc, void *buf, size_t len)
+{
+    size_t n, got = 0;
+    while (got < len) {
+        n = rpc_shm_read(sc->shm, (char *)buf + got, len - got);
+        if (n > 0) {
+            got += n;
+            continue;
+        }
+        /* rest of packet is still being written */
+        if (socket_peer_closed(sc->conn->fd)) {
+            return got ? -1 : 0;
+        }
+        sched_yield();
+    }
+    return got;
+}
+
 static void on_recv(int fd, void *arg)
 {
     struct rpcs *s = (struct rpcs *)arg;
-    struct rpc_session *session = hash_get32(s->hash_fd2session, fd);
-    session->base.fd = fd;
-    s->on_message(s, session);
+    struct socket_conn *sc = find_connection(s->base.ctx, fd);
+    struct rpc_session *session;
+    bool closed = false;
+    if (sc && sc->shm) {
+        closed = socket_shm_drain(sc);
+        if (!closed && !socket_conn_pending(sc, fd)) {
+            return;
+        }
+    }
+    do {
+        session = hash_get32(s->hash_fd2session, fd);
+        if (!session) {
+            break;
+        }
+        session->base.fd = fd;
+        if (0 != s->on_message(s, session)) {
+            break;
+        }
+    } while (socket_conn_pending(sc, fd));
+    if (closed) {
+        /* ring is drained, let the session see the close */
+        session = hash_get32(s->hash_fd2session, fd);
+        if (session) {
+            session->base.fd = fd;
+            s->on_message(s, session);
+        }
+    }
 }
 
 static void on_xxx(int fd, void *arg)
@@ -78,7 +384,7 @@ static void on_connect_of_server(int fd, void *arg)
     struct socket_ctx *c = (struct socket_ctx *)r->ctx;
     struct rpcs *s = container_of(r, struct rpcs, base);
     struct rpc_session *session;
-    struct sock_connection *conn;
+    struct socket_conn *conn;
     struct gevent *e;
     uint32_t uuid;
     char ip_str[SOCK_ADDR_LEN];
@@ -88,12 +394,18 @@ static void on_connect_of_server(int fd, void *arg)
         return;
     }
 
-    conn = hash_get32(c->hash_fd2conn, c->connect->fd);
+    conn = find_connection(c, c->connect->fd);
     if (conn) {
         printf("connection of fd=%d seems already exist!\n", c->connect->fd);
         return;
     }
-    hash_set32(c->hash_fd2conn, c->connect->fd, c->connect);
+    conn = socket_conn_add(c, r, c->connect);
+    if (!conn) {
+        sock_close(c->connect->fd);
+        free(c->connect);
+        return;
+    }
+    socket_conn_offer_shm(conn);
 
     e = gevent_create(c->connect->fd, on_recv, on_xxx, on_error, s);
     if (-1 == gevent_add(s->base.evbase, &e)) {
@@ -120,6 +432,7 @@ static int socket_init_server(struct rpc_base *r, const char *host, uint16_t por
         goto failed;
     }
     c->hash_fd2conn = hash_create(1024);
+    mutex_lock_init(&c->lock);
     c->fd = sock_tcp_bind_listen(NULL, port);
     if (c->fd == -1) {
         printf("sock_tcp_bind_listen port:%d failed!\n", port);
@@ -148,7 +461,25 @@ static void on_connect_of_client(int fd, void *arg)
     struct rpc_base *r = (struct rpc_base *)arg;
     struct rpc_session *ss = container_of(r, struct rpc_session, base);
     struct rpc *rpc = container_of(ss, struct rpc, session);
-    rpc->on_connect_server(rpc);
+    struct socket_conn *sc = find_connection(r->ctx, fd);
+    bool closed = false;
+    if (sc && !sc->shm_probed) {
+        socket_conn_probe_shm(sc);
+    }
+    if (sc && sc->shm) {
+        closed = socket_shm_drain(sc);
+        if (!closed && !socket_conn_pending(sc, fd)) {
+            return;
+        }
+    }
+    do {
+        if (0 != rpc->on_connect_server(rpc)) {
+            break;
+        }
+    } while (socket_conn_pending(sc, fd));
+    if (closed) {
+        rpc->on_connect_server(rpc);
+    }
 }
 
 static int socket_init_client(struct rpc_base *r, const char *host, uint16_t port)
@@ -160,24 +491,29 @@ static int socket_init_client(struct rpc_base *r, const char *host, uint16_t por
         goto failed;
     }
     c->hash_fd2conn = hash_create(1024);
+    mutex_lock_init(&c->lock);
     c->connect = sock_tcp_connect(host, port);
     if (!c->connect) {
         printf("connect %s:%d failed!\n", host, port);
         goto failed;
     }
     c->fd = c->connect->fd;
-    hash_set32(c->hash_fd2conn, c->connect->fd, c->connect);
+    if (!socket_conn_add(c, r, c->connect)) {
+        goto failed;
+    }
     if (-1 == sock_set_block(c->fd)) {
         printf("sock_set_block failed!\n");
     }
     r->fd = c->fd;
     r->ctx = c;
     e = gevent_create(r->fd, on_connect_of_client, on_xxx, on_error, r);
+    /* hold lock before response can be handled, or its signal is lost */
+    thread_lock(r->dispatch_thread);
     if (-1 == gevent_add(r->evbase, &e)) {
         printf("event_add failed!\n");
+        thread_unlock(r->dispatch_thread);
         goto failed;
     }
-    thread_lock(r->dispatch_thread);
     if (thread_wait(r->dispatch_thread, 2000) == -1) {
         printf("%s wait response failed %d:%s\n", __func__, errno, strerror(errno));
     }
@@ -195,41 +531,112 @@ failed:
 
 static void socket_deinit(struct rpc_base *r)
 {
+    struct socket_conn *sc, *next;
     struct socket_ctx *c = (struct socket_ctx *)r->ctx;
+    for (sc = c->conns; sc; sc = next) {
+        next = sc->next;
+        socket_conn_free(c, sc);
+    }
     close(c->fd);
+    hash_destroy(c->hash_fd2conn);
+    mutex_lock_deinit(&c->lock);
     free(c);
 }
 
-static int socket_send(struct rpc_base *r, const void *buf, size_t len)
+static size_t iov_len(const struct iovec *iov, int iovcnt)
 {
-    int ret;
+    int i;
+    size_t len = 0;
+    for (i = 0; i < iovcnt; i++) {
+        len += iov[i].iov_len;
+    }
+    return len;
+}
+
+static int socket_sendv(struct rpc_base *r, const struct iovec *iov, int iovcnt)
+{
+    int i, ret;
+    size_t len = iov_len(iov, iovcnt), cap;
+    uint8_t *p;
     struct socket_ctx *c = (struct socket_ctx *)r->ctx;
-    struct sock_connection *conn = find_connection(c, r->fd);
-    if (!conn) {
+    struct socket_conn *sc = find_connection(c, r->fd);
+    if (!sc) {
         printf("find connection fd=%d failed!\n", r->fd);
         return -1;
     }
-    ret = sock_send(conn->fd, buf, len);
-    if (ret == -1) {
-        printf("send failed: %d\n", errno);
+    if (sc->shm) {
+        return socket_shm_sendv(sc, iov, iovcnt);
     }
-    return ret;
+    mutex_lock(&sc->lock);
+    if (!sc->sending && sc->len == 0) {
+        /* idle connection, write at once without copy */
+        sc->sending = true;
+        mutex_unlock(&sc->lock);
+        ret = sock_sendv(sc->conn->fd, iov, iovcnt);
+        if (ret == -1) {
+            printf("sendv failed: %d\n", errno);
+        }
+        mutex_lock(&sc->lock);
+        sc->sending = false;
+        socket_conn_post(sc);
+        mutex_unlock(&sc->lock);
+        return ret;
+    }
+    if (sc->cap < sc->len + len) {
+        cap = sc->cap ? sc->cap : 4096;
+        while (cap < sc->len + len) {
+            cap *= 2;
+        }
+        p = realloc(sc->buf, cap);
+        if (!p) {
+            printf("%s:%d alloc buf failed!\n", __func__, __LINE__);
+            mutex_unlock(&sc->lock);
+            return -1;
+        }
+        sc->buf = p;
+        sc->cap = cap;
+    }
+    for (i = 0; i < iovcnt; i++) {
+        memcpy(sc->buf + sc->len, iov[i].iov_base, iov[i].iov_len);
+        sc->len += iov[i].iov_len;
+    }
+    socket_conn_post(sc);
+    mutex_unlock(&sc->lock);
+    return len;
+}
+
+static int socket_send(struct rpc_base *r, const void *buf, size_t len)
+{
+    struct iovec iov;
+    iov.iov_base = (void *)buf;
+    iov.iov_len = len;
+    return socket_sendv(r, &iov, 1);
 }
 
 static int socket_recv(struct rpc_base *r, void *buf, size_t len)
 {
     int ret;
+    size_t got;
     struct socket_ctx *c = (struct socket_ctx *)r->ctx;
-    struct sock_connection *conn = find_connection(c, r->fd);
-    if (!conn) {
+    struct socket_conn *sc = find_connection(c, r->fd);
+    if (!sc) {
         printf("find connection fd=%d failed!\n", r->fd);
         return -1;
     }
-    ret = sock_recv(conn->fd, buf, len);
-    if (ret == -1) {
-        printf("recv failed fd=%d, rpc_base=%p: %d\n", c->fd, r, errno);
+    if (sc->shm) {
+        return socket_shm_recv(sc, buf, len);
     }
-    return ret;
+    /* sock_recv may return part of buf, packet must be read whole */
+    for (got = 0; got < len; got += ret) {
+        ret = sock_recv(sc->conn->fd, (char *)buf + got, len - got);
+        if (ret == 0) {
+            return 0;
+        } else if (ret == -1) {
+            printf("recv failed fd=%d, rpc_base=%p: %d\n", c->fd, r, errno);
+            return -1;
+        }
+    }
+    return got;
 }
 
 struct rpc_ops socket_ops = {
@@ -238,4 +645,5 @@ struct rpc_ops socket_ops = {
     .deinit           = socket_deinit,
     .send             = socket_send,
     .recv             = socket_recv,
+    .sendv            = socket_sendv,
 };
@@ -27,6 +27,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <unistd.h>
 
 static struct thread *g_rpc_thread;
@@ -159,6 +160,53 @@ static int on_shell_help_resp(struct rpc_session *r, void *ibuf, size_t ilen, vo
 }
 
 
+static int on_calc(struct rpc_session *r, void *ibuf, size_t ilen, void **obuf, size_t *olen)
+{
+    int *res = calloc(1, sizeof(int));
+    if (*(int *)ibuf < 0) {
+        /* slow call, outlives the deadline of client */
+        usleep(300 * 1000);
+    }
+    *res = *(int *)ibuf * 2;
+    *obuf = res;
+    *olen = sizeof(int);
+    return 0;
+}
+
+static int on_echo(struct rpc_session *r, void *ibuf, size_t ilen, void **obuf, size_t *olen)
+{
+    *obuf = memdup(ibuf, ilen);
+    *olen = ilen;
+    return 0;
+}
+
+/* open with n pushes n values, open with 0 echoes client data doubled */
+static int on_stream(struct rpc_session *r, void *ibuf, size_t ilen, void **obuf, size_t *olen)
+{
+    int i, n;
+    switch (r->stream) {
+    case _RPC_STREAM_OPEN:
+        n = *(int *)ibuf;
+        for (i = 0; i < n; i++) {
+            rpc_stream_push(r, &i, sizeof(i));
+        }
+        if (n > 0) {
+            rpc_stream_end(r);
+        }
+        break;
+    case _RPC_STREAM_DATA:
+        n = *(int *)ibuf * 2;
+        rpc_stream_push(r, &n, sizeof(n));
+        break;
+    case _RPC_STREAM_END:
+        rpc_stream_end(r);
+        break;
+    default:
+        break;
+    }
+    return 0;
+}
+
 BEGIN_RPC_MAP(RPC_CLIENT_API)
 RPC_MAP(RPC_TEST, on_test_resp)
 RPC_MAP(RPC_PEER_POST_MSG, on_peer_post_msg_resp)
@@ -171,6 +219,9 @@ RPC_MAP(RPC_GET_CONNECT_CNT, on_get_connect_cnt)
 RPC_MAP(RPC_GET_CONNECT_LIST, on_get_connect_list)
 RPC_MAP(RPC_PEER_POST_MSG, on_peer_post_msg)
 RPC_MAP(RPC_SHELL_HELP, on_shell_help)
+RPC_MAP(RPC_CALC, on_calc)
+RPC_MAP(RPC_ECHO, on_echo)
+RPC_MAP(RPC_STREAM, on_stream)
 END_RPC_MAP()
 
 static int rpc_get_connect_list(struct rpc *r, int cnt)
@@ -214,6 +265,7 @@ static void usage(void)
 {
     fprintf(stderr, "./test_libskt -s <port>\n");
     fprintf(stderr, "./test_libskt -c <ip> <port>\n");
+    fprintf(stderr, "./test_libskt -p <port> (pipelined call test)\n");
     fprintf(stderr, "e.g. ./test_libskt -s 127.0.0.1 12345\n");
 }
 
@@ -351,6 +403,237 @@ static int rpc_server_test(uint16_t port)
     return 0;
 }
 
+#define PIPELINE_DEPTH  64
+#define ECHO_LEN        (4 * 1024 * 1024)
+
+static int g_cb_ok = 0;
+
+static void on_calc_done(struct rpc *r, struct rpc_future *f, void *arg)
+{
+    int in = (int)(intptr_t)arg;
+    if (f->done == 1 && f->olen == sizeof(int) && *(int *)f->obuf == in * 2) {
+        __sync_fetch_and_add(&g_cb_ok, 1);
+    }
+}
+
+static int g_deadline_err = 0;
+
+static void on_calc_deadline(struct rpc *r, struct rpc_future *f, void *arg)
+{
+    __sync_lock_test_and_set(&g_deadline_err, f->done == -1 ? f->err : -1);
+}
+
+#define STREAM_LEN      100
+
+struct stream_stat {
+    int count;
+    int sum;
+    int step;       /* value of n-th message should be n * step */
+    int disorder;
+    int status;
+};
+
+static void on_stream_msg(struct rpc *r, struct rpc_stream *st, void *buf, size_t len, void *arg)
+{
+    struct stream_stat *stat = (struct stream_stat *)arg;
+    if (!buf) {
+        __sync_lock_test_and_set(&stat->status, st->status);
+        return;
+    }
+    __sync_fetch_and_add(&stat->sum, *(int *)buf);
+    /* messages of one session are handled in order on server */
+    if (*(int *)buf != __sync_fetch_and_add(&stat->count, 1) * stat->step) {
+        __sync_fetch_and_add(&stat->disorder, 1);
+    }
+}
+
+static void stream_wait(struct stream_stat *stat, int count)
+{
+    int i;
+    for (i = 0; i < 200; i++) {
+        if (__sync_fetch_and_add(&stat->status, 0) != 0 ||
+            (count && __sync_fetch_and_add(&stat->count, 0) >= count)) {
+            break;
+        }
+        usleep(10 * 1000);
+    }
+}
+
+static int rpc_stream_test(struct rpc *rpc)
+{
+    int i, n, ok = 0;
+    struct stream_stat stat;
+    struct rpc_stream *st;
+
+    /* server push */
+    memset(&stat, 0, sizeof(stat));
+    stat.step = 1;
+    n = STREAM_LEN;
+    if (rpc_stream_open(rpc, RPC_STREAM, &n, sizeof(n), on_stream_msg, &stat)) {
+        stream_wait(&stat, 0);
+    }
+    if (stat.status == 1 && stat.count == STREAM_LEN && !stat.disorder &&
+        stat.sum == STREAM_LEN * (STREAM_LEN - 1) / 2) {
+        ok++;
+    }
+    printf("rpc stream push: %d messages, %d disorder, status %d\n",
+           stat.count, stat.disorder, stat.status);
+
+    /* bidirectional, close after all echoes came back */
+    memset(&stat, 0, sizeof(stat));
+    stat.step = 2;
+    n = 0;
+    st = rpc_stream_open(rpc, RPC_STREAM, &n, sizeof(n), on_stream_msg, &stat);
+    if (st) {
+        for (i = 0; i < STREAM_LEN; i++) {
+            rpc_stream_send(rpc, st, &i, sizeof(i));
+        }
+        stream_wait(&stat, STREAM_LEN);
+        rpc_stream_close(rpc, st);
+        stream_wait(&stat, 0);
+    }
+    if (stat.status == 1 && stat.count == STREAM_LEN && !stat.disorder &&
+        stat.sum == STREAM_LEN * (STREAM_LEN - 1)) {
+        ok++;
+    }
+    printf("rpc stream bidi: %d messages, %d disorder, status %d\n",
+           stat.count, stat.disorder, stat.status);
+    return ok == 2 ? 0 : -1;
+}
+
+static int rpc_pipeline_test(uint16_t port)
+{
+    int i, n, ok = 0;
+    int in[PIPELINE_DEPTH];
+    uint8_t *echo;
+    struct rpc_future *f[PIPELINE_DEPTH];
+    struct rpcs *rpcs;
+    struct rpc *rpc;
+
+    rpcs = rpc_server_create(NULL, port);
+    if (!rpcs) {
+        printf("rpc_server_create failed!\n");
+        return -1;
+    }
+    RPC_REGISTER_MSG_MAP(RPC_SERVER_API);
+    rpc = rpc_client_create("127.0.0.1", port);
+    if (!rpc) {
+        printf("rpc_client_create failed\n");
+        rpc_server_destroy(rpcs);
+        return -1;
+    }
+    /* all requests are on the wire before the first response is read */
+    for (i = 0; i < PIPELINE_DEPTH; i++) {
+        in[i] = i;
+        f[i] = rpc_call_async(rpc, RPC_CALC, &in[i], sizeof(int));
+    }
+    for (i = 0; i < PIPELINE_DEPTH; i++) {
+        if (f[i] && 0 == rpc_future_wait(rpc, f[i], 2000) &&
+            *(int *)f[i]->obuf == in[i] * 2) {
+            ok++;
+        }
+        rpc_future_free(rpc, f[i]);
+    }
+    for (i = 0; i < PIPELINE_DEPTH; i++) {
+        rpc_call_cb(rpc, RPC_CALC, &in[i], sizeof(int), on_calc_done,
+                    (void *)(intptr_t)in[i]);
+    }
+    for (i = 0; i < 200 && g_cb_ok < PIPELINE_DEPTH; i++) {
+        usleep(10 * 1000);
+    }
+    printf("rpc pipeline: future ok %d/%d, callback ok %d/%d\n",
+           ok, PIPELINE_DEPTH, g_cb_ok, PIPELINE_DEPTH);
+    if (ok != PIPELINE_DEPTH || g_cb_ok != PIPELINE_DEPTH) {
+        return -1;
+    }
+
+    /* same calls written to socket in one batch */
+    ok = 0;
+    rpc_batch_begin(rpc);
+    for (i = 0; i < PIPELINE_DEPTH; i++) {
+        f[i] = rpc_call_async(rpc, RPC_CALC, &in[i], sizeof(int));
+    }
+    rpc_batch_end(rpc);
+    for (i = 0; i < PIPELINE_DEPTH; i++) {
+        if (f[i] && 0 == rpc_future_wait(rpc, f[i], 2000) &&
+            *(int *)f[i]->obuf == in[i] * 2) {
+            ok++;
+        }
+        rpc_future_free(rpc, f[i]);
+    }
+    printf("rpc batch: ok %d/%d\n", ok, PIPELINE_DEPTH);
+    if (ok != PIPELINE_DEPTH) {
+        return -1;
+    }
+
+    /* no explicit flush, queue goes out by delay timer or byte threshold */
+    g_cb_ok = 0;
+    rpc_batch_set(rpc, 0, 20);
+    rpc_batch_begin(rpc);
+    for (i = 0; i < PIPELINE_DEPTH; i++) {
+        rpc_call_cb(rpc, RPC_CALC, &in[i], sizeof(int), on_calc_done,
+                    (void *)(intptr_t)in[i]);
+    }
+    for (i = 0; i < 200 && g_cb_ok < PIPELINE_DEPTH; i++) {
+        usleep(10 * 1000);
+    }
+    n = g_cb_ok;
+    g_cb_ok = 0;
+    rpc_batch_set(rpc, 256, 0);
+    for (i = 0; i < PIPELINE_DEPTH; i++) {
+        rpc_call_cb(rpc, RPC_CALC, &in[i], sizeof(int), on_calc_done,
+                    (void *)(intptr_t)in[i]);
+    }
+    for (i = 0; i < 50 && g_cb_ok == 0; i++) {
+        usleep(10 * 1000);
+    }
+    ok = g_cb_ok;
+    rpc_batch_end(rpc);
+    rpc_batch_set(rpc, 0, 0);
+    for (i = 0; i < 200 && g_cb_ok < PIPELINE_DEPTH; i++) {
+        usleep(10 * 1000);
+    }
+    printf("rpc batch timer: %d/%d, threshold: %d before end, %d/%d after\n",
+           n, PIPELINE_DEPTH, ok, g_cb_ok, PIPELINE_DEPTH);
+    if (n != PIPELINE_DEPTH || ok == 0 || ok == PIPELINE_DEPTH ||
+        g_cb_ok != PIPELINE_DEPTH) {
+        return -1;
+    }
+
+    /* larger than shared memory ring, goes through in pieces */
+    ok = 0;
+    echo = malloc(ECHO_LEN);
+    for (i = 0; i < ECHO_LEN; i++) {
+        echo[i] = i * 7;
+    }
+    f[0] = rpc_call_async(rpc, RPC_ECHO, echo, ECHO_LEN);
+    if (f[0] && 0 == rpc_future_wait(rpc, f[0], 5000) &&
+        f[0]->olen == ECHO_LEN && !memcmp(f[0]->obuf, echo, ECHO_LEN)) {
+        ok = 1;
+    }
+    rpc_future_free(rpc, f[0]);
+    free(echo);
+    printf("rpc echo %d bytes: %s\n", ECHO_LEN, ok ? "ok" : "failed");
+    if (ok && 0 != rpc_stream_test(rpc)) {
+        ok = 0;
+    }
+
+    /* deadline passes first, the late response is dropped */
+    in[0] = -1;
+    rpc_call_cb_timeout(rpc, RPC_CALC, &in[0], sizeof(int), 50, on_calc_deadline, NULL);
+    for (i = 0; i < 200 && !__sync_fetch_and_add(&g_deadline_err, 0); i++) {
+        usleep(10 * 1000);
+    }
+    usleep(400 * 1000);
+    printf("rpc call deadline: err %d, inflight %d\n", g_deadline_err, rpc->ninflight);
+    if (g_deadline_err != ETIMEDOUT || rpc->ninflight != 0) {
+        ok = 0;
+    }
+    rpc_client_destroy(rpc);
+    rpc_server_destroy(rpcs);
+    return ok ? 0 : -1;
+}
+
 int main(int argc, char **argv)
 {
     uint16_t port;
@@ -362,6 +645,9 @@ int main(int argc, char **argv)
     if (!strcmp(argv[1], "-s") && argc > 2) {
         port = atoi(argv[2]);
         rpc_server_test(port);
+    } else if (!strcmp(argv[1], "-p") && argc > 2) {
+        port = atoi(argv[2]);
+        return rpc_pipeline_test(port);
     } else if (!strcmp(argv[1], "-c") && argc > 3) {
         ip = argv[2];
         port = atoi(argv[3]);
@@ -56,7 +56,7 @@ AMF_DecodeInt32(const char *data)
 {
     unsigned char *c = (unsigned char *)data;
     unsigned int val;
-    val = (c[0] << 24) | (c[1] << 16) | (c[2] << 8) | c[3];
+    val = ((unsigned int)c[0] << 24) | (c[1] << 16) | (c[2] << 8) | c[3];
     return val;
 }
 
@@ -1316,3 +1316,647 @@ AMF3CD_GetProp(AMF3ClassDef *cd, int nIndex)
         return (AVal *)&AV_empty;
     return &cd->cd_props[nIndex];
 }
+
+/* AMF walker, no allocation, strings point into the walked buffer */
+
+#define AMF_WALK_DEPTH		16
+#define AMF3_STRING_REFS	64
+#define AMF3_TRAITS_REFS	16
+#define AMF3_SEALED_NAMES	64
+
+typedef struct AMF3Traits
+{
+    AVal t_class;
+    int t_dynamic;
+    int t_count;		/* sealed member names */
+    int t_first;		/* in w_sealed */
+} AMF3Traits;
+
+typedef struct AMFWalk
+{
+    const char *w_end;
+    AMFVisitor *w_cb;
+    void *w_ctx;
+    int w_stop;
+    AVal w_strings[AMF3_STRING_REFS];
+    int w_nstrings;
+    AMF3Traits w_traits[AMF3_TRAITS_REFS];
+    int w_ntraits;
+    AVal w_sealed[AMF3_SEALED_NAMES];
+    int w_nsealed;
+} AMFWalk;
+
+static int
+AMFWalk_Emit(AMFWalk *w, AMFItem *item)
+{
+    if (!w->w_stop && w->w_cb(w->w_ctx, item))
+        w->w_stop = 1;
+    return w->w_stop;
+}
+
+/* U29, returns bytes used or -1 */
+static int
+AMF3Walk_U29(AMFWalk *w, const char *p, int32_t *valp)
+{
+    const unsigned char *c = (const unsigned char *)p;
+    int32_t val = 0;
+    int i;
+
+    for (i = 0; i < 3; i++)
+    {
+        if (p + i >= w->w_end)
+            return -1;
+        if (!(c[i] & 0x80))
+        {
+            *valp = (val << 7) | c[i];
+            return i + 1;
+        }
+        val = (val << 7) | (c[i] & 0x7f);
+    }
+    if (p + 3 >= w->w_end)
+        return -1;
+    *valp = (val << 8) | c[3];
+    return 4;
+}
+
+static int
+AMF3Walk_String(AMFWalk *w, const char *p, AVal *str)
+{
+    int32_t ref;
+    int n = AMF3Walk_U29(w, p, &ref);
+
+    if (n < 0)
+        return -1;
+    if (!(ref & 1))
+    {
+        if ((ref >> 1) >= w->w_nstrings)
+            return -1;
+        *str = w->w_strings[ref >> 1];
+        return n;
+    }
+    ref >>= 1;
+    if (ref > w->w_end - p - n)
+        return -1;
+    str->av_val = ref ? (char *)p + n : NULL;
+    str->av_len = ref;
+    /* empty strings are never referenced, the table only has to be long enough */
+    if (ref && w->w_nstrings < AMF3_STRING_REFS)
+        w->w_strings[w->w_nstrings++] = *str;
+    return n + ref;
+}
+
+static int AMF3Walk_Value(AMFWalk *w, const char *p, const AVal *name,
+                          int depth, int index);
+
+static int
+AMF3Walk_Object(AMFWalk *w, const char *p, AMFItem *item, int32_t ref, int depth)
+{
+    const char *start = p;
+    AMF3Traits *t, tmp;
+    AVal name;
+    int i, n;
+
+    if (!(ref & 2))
+    {
+        if ((ref >> 2) >= w->w_ntraits)
+            return -1;
+        t = &w->w_traits[ref >> 2];
+    }
+    else
+    {
+        /* externalizable objects carry data only their class can read */
+        if (ref & 4)
+            return -1;
+        t = w->w_ntraits < AMF3_TRAITS_REFS ? &w->w_traits[w->w_ntraits] : &tmp;
+        t->t_dynamic = (ref & 8) != 0;
+        t->t_count = ref >> 4;
+        t->t_first = w->w_nsealed;
+        n = AMF3Walk_String(w, p, &t->t_class);
+        if (n < 0 || t->t_count > AMF3_SEALED_NAMES - w->w_nsealed)
+            return -1;
+        p += n;
+        for (i = 0; i < t->t_count; i++)
+        {
+            n = AMF3Walk_String(w, p, &w->w_sealed[w->w_nsealed++]);
+            if (n < 0)
+                return -1;
+            p += n;
+        }
+        if (t != &tmp)
+            w->w_ntraits++;
+    }
+    item->i_type = t->t_class.av_len ? AMF_TYPED_OBJECT : AMF_OBJECT;
+    item->i_vu.i_aval = t->t_class;
+    if (AMFWalk_Emit(w, item))
+        return p - start;
+    for (i = 0; i < t->t_count; i++)
+    {
+        n = AMF3Walk_Value(w, p, &w->w_sealed[t->t_first + i], depth + 1, i);
+        if (n < 0)
+            return -1;
+        p += n;
+    }
+    for (i = t->t_count; t->t_dynamic; i++)
+    {
+        n = AMF3Walk_String(w, p, &name);
+        if (n < 0)
+            return -1;
+        p += n;
+        if (!name.av_len)
+            break;
+        n = AMF3Walk_Value(w, p, &name, depth + 1, i);
+        if (n < 0)
+            return -1;
+        p += n;
+    }
+    return p - start;
+}
+
+static int
+AMF3Walk_Value(AMFWalk *w, const char *p, const AVal *name, int depth, int index)
+{
+    const char *start = p;
+    AMFItem item = {{0, 0}};
+    int32_t ref = 0, i;
+    AVal key;
+    int n;
+
+    if (depth > AMF_WALK_DEPTH || p >= w->w_end)
+        return -1;
+    if (name)
+        item.i_name = *name;
+    item.i_depth = depth;
+    item.i_index = index;
+    switch (*p++)
+    {
+    case AMF3_UNDEFINED:
+        item.i_type = AMF_UNDEFINED;
+        break;
+    case AMF3_NULL:
+        item.i_type = AMF_NULL;
+        break;
+    case AMF3_FALSE:
+    case AMF3_TRUE:
+        item.i_type = AMF_BOOLEAN;
+        item.i_vu.i_number = p[-1] == AMF3_TRUE;
+        break;
+    case AMF3_INTEGER:
+        n = AMF3Walk_U29(w, p, &ref);
+        if (n < 0)
+            return -1;
+        p += n;
+        /* sign extend 29 bits */
+        item.i_type = AMF_NUMBER;
+        item.i_vu.i_number = (ref & 0x10000000) ? ref - (1 << 29) : ref;
+        break;
+    case AMF3_DOUBLE:
+        if (w->w_end - p < 8)
+            return -1;
+        item.i_type = AMF_NUMBER;
+        item.i_vu.i_number = AMF_DecodeNumber(p);
+        p += 8;
+        break;
+    case AMF3_STRING:
+        n = AMF3Walk_String(w, p, &item.i_vu.i_aval);
+        if (n < 0)
+            return -1;
+        p += n;
+        item.i_type = AMF_STRING;
+        break;
+    case AMF3_XML_DOC:
+    case AMF3_XML:
+    case AMF3_BYTE_ARRAY:
+    case AMF3_DATE:
+    case AMF3_ARRAY:
+    case AMF3_OBJECT:
+        n = AMF3Walk_U29(w, p, &ref);
+        if (n < 0)
+            return -1;
+        p += n;
+        if (!(ref & 1))
+        {
+            /* objects are not kept, only their index is told */
+            item.i_type = AMF_REFERENCE;
+            item.i_vu.i_number = ref >> 1;
+            break;
+        }
+        switch (p[-1 - n])
+        {
+        case AMF3_DATE:
+            if (w->w_end - p < 8)
+                return -1;
+            item.i_type = AMF_DATE;
+            item.i_vu.i_number = AMF_DecodeNumber(p);
+            p += 8;
+            break;
+        case AMF3_ARRAY:
+            item.i_type = AMF_STRICT_ARRAY;
+            item.i_vu.i_count = ref >> 1;
+            /* associative part first, up to an empty name */
+            for (i = 0; ; i++)
+            {
+                n = AMF3Walk_String(w, p, &key);
+                if (n < 0)
+                    return -1;
+                p += n;
+                if (!key.av_len)
+                    break;
+                if (i == 0)
+                {
+                    item.i_type = AMF_ECMA_ARRAY;
+                    if (AMFWalk_Emit(w, &item))
+                        return p - start;
+                }
+                n = AMF3Walk_Value(w, p, &key, depth + 1, i);
+                if (n < 0)
+                    return -1;
+                p += n;
+            }
+            if (item.i_type == AMF_STRICT_ARRAY && AMFWalk_Emit(w, &item))
+                return p - start;
+            for (i = 0; i < item.i_vu.i_count; i++)
+            {
+                n = AMF3Walk_Value(w, p, NULL, depth + 1, i);
+                if (n < 0)
+                    return -1;
+                p += n;
+            }
+            goto end;
+        case AMF3_OBJECT:
+            n = AMF3Walk_Object(w, p, &item, ref, depth);
+            if (n < 0)
+                return -1;
+            p += n;
+            goto end;
+        default:
+            /* xml and byte arrays are handed out as raw bytes */
+            ref >>= 1;
+            if (ref > w->w_end - p)
+                return -1;
+            item.i_type = p[-1 - n] == AMF3_BYTE_ARRAY ? AMF_UNSUPPORTED : AMF_XML_DOC;
+            item.i_vu.i_aval.av_val = (char *)p;
+            item.i_vu.i_aval.av_len = ref;
+            p += ref;
+            break;
+        }
+        break;
+    default:
+        return -1;
+    }
+    AMFWalk_Emit(w, &item);
+    return p - start;
+
+end:
+    if (w->w_stop)
+        return p - start;
+    memset(&item, 0, sizeof(item));
+    item.i_type = AMF_OBJECT_END;
+    item.i_depth = depth;
+    AMFWalk_Emit(w, &item);
+    return p - start;
+}
+
+static int AMFWalk_Value(AMFWalk *w, const char *p, const AVal *name,
+                         int depth, int index);
+
+/* named members up to the 00 00 09 end marker */
+static int
+AMFWalk_Members(AMFWalk *w, const char *p, int depth)
+{
+    const char *start = p;
+    AVal name;
+    int i, n;
+
+    for (i = 0; ; i++)
+    {
+        if (w->w_end - p < 3)
+            return -1;
+        if (!p[0] && !p[1] && p[2] == AMF_OBJECT_END)
+        {
+            p += 3;
+            break;
+        }
+        AMF_DecodeString(p, &name);
+        p += 2;
+        if (name.av_len > w->w_end - p)
+            return -1;
+        p += name.av_len;
+        n = AMFWalk_Value(w, p, &name, depth + 1, i);
+        if (n < 0)
+            return -1;
+        p += n;
+        if (w->w_stop)
+            return p - start;
+    }
+    return p - start;
+}
+
+static int
+AMFWalk_Value(AMFWalk *w, const char *p, const AVal *name, int depth, int index)
+{
+    const char *start = p;
+    AMFItem item = {{0, 0}};
+    unsigned int i;
+    int n;
+
+    if (depth > AMF_WALK_DEPTH || p >= w->w_end)
+        return -1;
+    if (name)
+        item.i_name = *name;
+    item.i_depth = depth;
+    item.i_index = index;
+    item.i_type = (AMFDataType)(unsigned char)*p++;
+    switch (item.i_type)
+    {
+    case AMF_NUMBER:
+        if (w->w_end - p < 8)
+            return -1;
+        item.i_vu.i_number = AMF_DecodeNumber(p);
+        p += 8;
+        break;
+    case AMF_BOOLEAN:
+        if (w->w_end - p < 1)
+            return -1;
+        item.i_vu.i_number = AMF_DecodeBoolean(p);
+        p += 1;
+        break;
+    case AMF_STRING:
+        if (w->w_end - p < 2)
+            return -1;
+        AMF_DecodeString(p, &item.i_vu.i_aval);
+        p += 2;
+        if (item.i_vu.i_aval.av_len > w->w_end - p)
+            return -1;
+        p += item.i_vu.i_aval.av_len;
+        break;
+    case AMF_LONG_STRING:
+    case AMF_XML_DOC:
+        if (w->w_end - p < 4)
+            return -1;
+        AMF_DecodeLongString(p, &item.i_vu.i_aval);
+        p += 4;
+        if ((unsigned int)item.i_vu.i_aval.av_len > (unsigned int)(w->w_end - p))
+            return -1;
+        p += item.i_vu.i_aval.av_len;
+        break;
+    case AMF_NULL:
+    case AMF_UNDEFINED:
+    case AMF_UNSUPPORTED:
+        break;
+    case AMF_REFERENCE:
+        if (w->w_end - p < 2)
+            return -1;
+        item.i_vu.i_number = AMF_DecodeInt16(p);
+        p += 2;
+        break;
+    case AMF_DATE:
+        if (w->w_end - p < 10)
+            return -1;
+        item.i_vu.i_number = AMF_DecodeNumber(p);
+        item.i_UTCoffset = AMF_DecodeInt16(p + 8);
+        p += 10;
+        break;
+    case AMF_TYPED_OBJECT:
+        if (w->w_end - p < 2)
+            return -1;
+        AMF_DecodeString(p, &item.i_vu.i_aval);
+        p += 2;
+        if (item.i_vu.i_aval.av_len > w->w_end - p)
+            return -1;
+        p += item.i_vu.i_aval.av_len;
+        /* fall through */
+    case AMF_OBJECT:
+    case AMF_ECMA_ARRAY:
+        if (item.i_type == AMF_ECMA_ARRAY)
+        {
+            if (w->w_end - p < 4)
+                return -1;
+            /* count is only a hint, members end with the marker as objects do */
+            item.i_vu.i_count = AMF_DecodeInt32(p);
+            p += 4;
+        }
+        if (AMFWalk_Emit(w, &item))
+            return p - start;
+        n = AMFWalk_Members(w, p, depth);
+        if (n < 0)
+            return -1;
+        p += n;
+        goto end;
+    case AMF_STRICT_ARRAY:
+        if (w->w_end - p < 4)
+            return -1;
+        item.i_vu.i_count = AMF_DecodeInt32(p);
+        p += 4;
+        if (AMFWalk_Emit(w, &item))
+            return p - start;
+        for (i = 0; i < (unsigned int)item.i_vu.i_count; i++)
+        {
+            n = AMFWalk_Value(w, p, NULL, depth + 1, i);
+            if (n < 0)
+                return -1;
+            p += n;
+            if (w->w_stop)
+                return p - start;
+        }
+        goto end;
+    case AMF_AVMPLUS:
+        /* each switch to AMF3 starts with empty reference tables */
+        w->w_nstrings = 0;
+        w->w_ntraits = 0;
+        w->w_nsealed = 0;
+        n = AMF3Walk_Value(w, p, name, depth, index);
+        if (n < 0)
+            return -1;
+        return p + n - start;
+    default:
+        RTMP_Log(RTMP_LOGDEBUG, "%s, unsupported AMF type 0x%02x", __FUNCTION__,
+                 item.i_type);
+        return -1;
+    }
+    AMFWalk_Emit(w, &item);
+    return p - start;
+
+end:
+    if (w->w_stop)
+        return p - start;
+    memset(&item, 0, sizeof(item));
+    item.i_type = AMF_OBJECT_END;
+    item.i_depth = depth;
+    AMFWalk_Emit(w, &item);
+    return p - start;
+}
+
+int
+AMF_Walk(const char *pBuffer, int nSize, AMFVisitor *cb, void *ctx)
+{
+    AMFWalk w;
+    int n, i, nOriginalSize = nSize;
+
+    if (!pBuffer || nSize < 0 || !cb)
+        return -1;
+    w.w_end = pBuffer + nSize;
+    w.w_cb = cb;
+    w.w_ctx = ctx;
+    w.w_stop = 0;
+    w.w_nstrings = 0;
+    w.w_ntraits = 0;
+    w.w_nsealed = 0;
+    for (i = 0; nSize > 0 && !w.w_stop; i++)
+    {
+        n = AMFWalk_Value(&w, pBuffer, NULL, 0, i);
+        if (n < 0)
+            return -1;
+        pBuffer += n;
+        nSize -= n;
+    }
+    return nOriginalSize - nSize;
+}
+
+/* AMF writer, one bounds check per value, overflow is sticky */
+
+void
+AMFW_Init(AMFWriter *w, char *buf, int size)
+{
+    w->w_buf = buf;
+    w->w_ptr = buf;
+    w->w_end = buf + size;
+    w->w_err = 0;
+}
+
+static char *
+AMFW_Reserve(AMFWriter *w, int len)
+{
+    char *p = w->w_ptr;
+
+    if (w->w_err || len > w->w_end - p)
+    {
+        w->w_err = 1;
+        return NULL;
+    }
+    w->w_ptr += len;
+    return p;
+}
+
+int
+AMFW_Len(AMFWriter *w)
+{
+    return w->w_err ? -1 : (int)(w->w_ptr - w->w_buf);
+}
+
+void
+AMFW_Number(AMFWriter *w, double dVal)
+{
+    char *p = AMFW_Reserve(w, 9);
+
+    if (p)
+        AMF_EncodeNumber(p, p + 9, dVal);
+}
+
+void
+AMFW_Boolean(AMFWriter *w, int bVal)
+{
+    char *p = AMFW_Reserve(w, 2);
+
+    if (p)
+    {
+        p[0] = AMF_BOOLEAN;
+        p[1] = bVal ? 0x01 : 0x00;
+    }
+}
+
+void
+AMFW_String(AMFWriter *w, const AVal *str)
+{
+    int hdr = str->av_len < 65536 ? 3 : 5;
+    char *p = AMFW_Reserve(w, hdr + str->av_len);
+
+    if (!p)
+        return;
+    if (hdr == 3)
+    {
+        *p = AMF_STRING;
+        AMF_EncodeInt16(p + 1, p + 3, str->av_len);
+    }
+    else
+    {
+        *p = AMF_LONG_STRING;
+        AMF_EncodeInt32(p + 1, p + 5, str->av_len);
+    }
+    memcpy(p + hdr, str->av_val, str->av_len);
+}
+
+void
+AMFW_Null(AMFWriter *w)
+{
+    char *p = AMFW_Reserve(w, 1);
+
+    if (p)
+        *p = AMF_NULL;
+}
+
+void
+AMFW_Name(AMFWriter *w, const AVal *name)
+{
+    char *p = AMFW_Reserve(w, 2 + name->av_len);
+
+    if (p)
+    {
+        AMF_EncodeInt16(p, p + 2, name->av_len);
+        memcpy(p + 2, name->av_val, name->av_len);
+    }
+}
+
+void
+AMFW_ObjectStart(AMFWriter *w)
+{
+    char *p = AMFW_Reserve(w, 1);
+
+    if (p)
+        *p = AMF_OBJECT;
+}
+
+void
+AMFW_EcmaArrayStart(AMFWriter *w, int count)
+{
+    char *p = AMFW_Reserve(w, 5);
+
+    if (p)
+    {
+        *p = AMF_ECMA_ARRAY;
+        AMF_EncodeInt32(p + 1, p + 5, count);
+    }
+}
+
+void
+AMFW_ObjectEnd(AMFWriter *w)
+{
+    char *p = AMFW_Reserve(w, 3);
+
+    if (p)
+    {
+        p[0] = 0;
+        p[1] = 0;
+        p[2] = AMF_OBJECT_END;
+    }
+}
+
+void
+AMFW_NamedString(AMFWriter *w, const AVal *name, const AVal *str)
+{
+    AMFW_Name(w, name);
+    AMFW_String(w, str);
+}
+
+void
+AMFW_NamedNumber(AMFWriter *w, const AVal *name, double dVal)
+{
+    AMFW_Name(w, name);
+    AMFW_Number(w, dVal);
+}
+
+void
+AMFW_NamedBoolean(AMFWriter *w, const AVal *name, int bVal)
+{
+    AMFW_Name(w, name);
+    AMFW_Boolean(w, bVal);
+}
@@ -158,6 +158,61 @@ extern "C"
     void AMF3CD_AddProp(AMF3ClassDef * cd, AVal * prop);
     AVal *AMF3CD_GetProp(AMF3ClassDef * cd, int idx);
 
+    /*
+     * AMF_Walk reads AMF0 values, and AMF3 ones behind an AVM+ marker,
+     * without building AMFObjects. cb sees every value in order: names
+     * and strings point into pBuffer, an object or array is told before
+     * its members (at depth + 1) and followed by an AMF_OBJECT_END item.
+     * AMF3 values are told as the AMF0 type closest to them, references
+     * as AMF_REFERENCE with their index, byte arrays as AMF_UNSUPPORTED
+     * with the bytes in i_aval. Returns bytes walked, fewer if cb returned
+     * non-zero to stop, -1 if the data is malformed or nested too deep
+     */
+    typedef struct AMFItem
+    {
+        AVal i_name;		/* empty if not a member */
+        AMFDataType i_type;
+        int i_depth;
+        int i_index;		/* position among its siblings */
+        union
+        {
+            double i_number;	/* also boolean, date and reference */
+            AVal i_aval;	/* string, class of a typed object */
+            int i_count;	/* array length */
+        } i_vu;
+        int16_t i_UTCoffset;
+    } AMFItem;
+
+    typedef int (AMFVisitor)(void *ctx, const AMFItem * item);
+
+    int AMF_Walk(const char *pBuffer, int nSize, AMFVisitor * cb, void *ctx);
+
+    /*
+     * AMFWriter encodes AMF0 straight into a caller buffer. calls after
+     * an overflow do nothing, AMFW_Len returns -1 then
+     */
+    typedef struct AMFWriter
+    {
+        char *w_buf;
+        char *w_ptr;
+        char *w_end;
+        int w_err;
+    } AMFWriter;
+
+    void AMFW_Init(AMFWriter * w, char *buf, int size);
+    int AMFW_Len(AMFWriter * w);
+    void AMFW_Number(AMFWriter * w, double dVal);
+    void AMFW_Boolean(AMFWriter * w, int bVal);
+    void AMFW_String(AMFWriter * w, const AVal * str);
+    void AMFW_Null(AMFWriter * w);
+    void AMFW_Name(AMFWriter * w, const AVal * name);
+    void AMFW_ObjectStart(AMFWriter * w);
+    void AMFW_EcmaArrayStart(AMFWriter * w, int count);
+    void AMFW_ObjectEnd(AMFWriter * w);
+    void AMFW_NamedString(AMFWriter * w, const AVal * name, const AVal * str);
+    void AMFW_NamedNumber(AMFWriter * w, const AVal * name, double dVal);
+    void AMFW_NamedBoolean(AMFWriter * w, const AVal * name, int bVal);
+
 #ifdef __cplusplus
 }
 #endif
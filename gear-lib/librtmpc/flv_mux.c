@@ -23,6 +23,7 @@
 #include <libserializer.h>
 #include <libposix.h>
 #include "flv_mux.h"
+#include "amf.h"
 //#define __STDC_FORMAT_MACROS
 //#include <inttypes.h>
 
@@ -104,18 +105,107 @@ enum {
     FLV_FRAME_DISP_INTER = 3 << FLV_VIDEO_FRAMETYPE_OFFSET,
 };
 
-uint64_t dbl2int(double value)
+/* enhanced rtmp: IsExHeader bit, PacketType in the low nibble, then FourCC */
+#define FLV_VIDEO_EX_HEADER 0x80
+#define FLV_FOURCC(a, b, c, d) \
+    ((uint32_t)(a) << 24 | (uint32_t)(b) << 16 | (uint32_t)(c) << 8 | (uint32_t)(d))
+#define FLV_FOURCC_HEVC FLV_FOURCC('h', 'v', 'c', '1')
+#define FLV_FOURCC_AV1  FLV_FOURCC('a', 'v', '0', '1')
+
+enum {
+    FLV_PACKET_SEQUENCE_START  = 0,
+    FLV_PACKET_CODED_FRAMES    = 1,
+    FLV_PACKET_SEQUENCE_END    = 2,
+    FLV_PACKET_CODED_FRAMES_X  = 3, /* coded frames, composition time is 0 */
+};
+
+enum {
+    HEVC_NAL_BLA_W_LP   = 16,
+    HEVC_NAL_CRA_NUT    = 21,
+    HEVC_NAL_VPS        = 32,
+    HEVC_NAL_SPS        = 33,
+    HEVC_NAL_PPS        = 34,
+};
+
+enum {
+    AV1_OBU_SEQUENCE_HEADER     = 1,
+    AV1_OBU_TEMPORAL_DELIMITER  = 2,
+};
+
+static uint32_t video_fourcc(enum video_codec_type type)
+{
+    switch (type) {
+    case VIDEO_CODEC_H265:
+        return FLV_FOURCC_HEVC;
+    case VIDEO_CODEC_AV1:
+        return FLV_FOURCC_AV1;
+    default:
+        return 0;
+    }
+}
+
+/*
+ * video tag header, legacy avc or enhanced with FourCC. avc and hevc coded
+ * frames carry the composition time, hevc drops it with CodedFramesX when
+ * it is 0 and av1 never has it. return length, at most FLV_VIDEO_TAG_HDR_MAX
+ */
+static int video_tag_header(uint8_t *h, enum video_codec_type type, bool key,
+                            bool is_hdr, int32_t cts)
 {
-    union tmp{double f; unsigned long long i;} u;
-    u.f = value;
-    return u.i;
+    uint32_t fourcc = video_fourcc(type);
+    uint8_t frame = key ? FLV_FRAME_KEY : FLV_FRAME_INTER;
+    int pkt_type;
+    int len;
+
+    if (!fourcc) {
+        h[0] = frame | FLV_CODECID_H264;
+        h[1] = is_hdr ? 0 : 1;
+        h[2] = cts >> 16;
+        h[3] = cts >> 8;
+        h[4] = cts;
+        return 5;
+    }
+    if (is_hdr) {
+        pkt_type = FLV_PACKET_SEQUENCE_START;
+    } else if (type == VIDEO_CODEC_H265 && cts) {
+        pkt_type = FLV_PACKET_CODED_FRAMES;
+    } else if (type == VIDEO_CODEC_H265) {
+        pkt_type = FLV_PACKET_CODED_FRAMES_X;
+    } else {
+        pkt_type = FLV_PACKET_CODED_FRAMES;
+    }
+    h[0] = FLV_VIDEO_EX_HEADER | frame | pkt_type;
+    h[1] = fourcc >> 24;
+    h[2] = fourcc >> 16;
+    h[3] = fourcc >> 8;
+    h[4] = fourcc;
+    len = 5;
+    if (pkt_type == FLV_PACKET_CODED_FRAMES && type == VIDEO_CODEC_H265) {
+        h[5] = cts >> 16;
+        h[6] = cts >> 8;
+        h[7] = cts;
+        len = 8;
+    }
+    return len;
 }
 
-#define AMF_END_OF_OBJECT         0x09
+#define MILLISECOND_DEN 1000
+
+static const rational_t timebase_ms = {1, MILLISECOND_DEN};
+
+/* producers that only set the den of a timebase mean 1/den */
+static rational_t packet_timebase(rational_t tb)
+{
+    if (tb.num <= 0) {
+        tb.num = 1;
+    }
+    return tb;
+}
 
 struct flv_muxer *flv_mux_create(flv_mux_output_cb *cb, void *cb_ctx)
 {
     struct flv_muxer *flv = calloc(1, sizeof(struct flv_muxer));
+    int i;
     if (!flv) {
         printf("malloc flv_muxer failed!\n");
         return NULL;
@@ -125,6 +215,10 @@ struct flv_muxer *flv_mux_create(flv_mux_output_cb *cb, void *cb_ctx)
     serializer_array_init(&flv->s);
     flv->is_keyframe_got = false;
     flv->is_header = true;
+    flv->clock = media_clock_create(0);
+    for (i = 0; i < MEDIA_TYPE_MAX; i++) {
+        flv->clock_track[i] = -1;
+    }
     return flv;
 }
 
@@ -134,6 +228,7 @@ void flv_mux_destroy(struct flv_muxer *flv)
         return;
     }
     serializer_array_deinit(&flv->s);
+    media_clock_destroy(flv->clock);
     if (flv->audio)
         free(flv->audio);
     if (flv->video)
@@ -143,6 +238,8 @@ void flv_mux_destroy(struct flv_muxer *flv)
 
 int flv_mux_add_media(struct flv_muxer *flv, struct media_packet *mp)
 {
+    struct media_clock_track_conf conf;
+
     switch (mp->type) {
     case MEDIA_TYPE_AUDIO:
         if (flv->audio) {
@@ -151,6 +248,10 @@ int flv_mux_add_media(struct flv_muxer *flv, struct media_packet *mp)
         }
         flv->audio = calloc(1, sizeof(struct audio_encoder));
         memcpy(flv->audio, &mp->audio->encoder, sizeof(struct audio_encoder));
+        /* an aac frame is 1024 samples */
+        conf.in_timebase = packet_timebase(flv->audio->timebase);
+        conf.duration.num = flv->audio->sample_rate ? 1024 : 0;
+        conf.duration.den = flv->audio->sample_rate;
         break;
     case MEDIA_TYPE_VIDEO:
         if (flv->video) {
@@ -159,45 +260,61 @@ int flv_mux_add_media(struct flv_muxer *flv, struct media_packet *mp)
         }
         flv->video = calloc(1, sizeof(struct video_encoder));
         memcpy(flv->video, &mp->video->encoder, sizeof(struct video_encoder));
+        conf.in_timebase = packet_timebase(flv->video->timebase);
+        conf.duration.num = flv->video->framerate.den;
+        conf.duration.den = flv->video->framerate.num;
         break;
     default:
         printf("unsupport type!\n");
-        break;
+        return 0;
     }
+    conf.out_timebase = timebase_ms;
+    flv->clock_track[mp->type] = media_clock_add_track(flv->clock, &conf);
     return 0;
 }
 
-#define MILLISECOND_DEN 1000
+int flv_mux_stamp(struct flv_muxer *flv, struct media_packet *pkt)
+{
+    if (!flv || !pkt || pkt->type >= MEDIA_TYPE_MAX || flv->clock_track[pkt->type] < 0) {
+        return -1;
+    }
+    return media_clock_stamp_packet(flv->clock, flv->clock_track[pkt->type], pkt);
+}
 
 static int32_t get_ms_time_v(struct video_packet *packet, int64_t val)
 {
-    return (int32_t)(val * MILLISECOND_DEN / packet->encoder.timebase.den);
+    return (int32_t)media_ts_rescale(val, packet_timebase(packet->encoder.timebase), timebase_ms);
 }
 
 static int32_t get_ms_time_a(struct audio_packet *packet, int64_t val)
 {
-    return (int32_t)(val * MILLISECOND_DEN / packet->encoder.timebase.den);
+    return (int32_t)media_ts_rescale(val, packet_timebase(packet->encoder.timebase), timebase_ms);
 }
 
-static int write_video(struct serializer *s, struct video_packet *vp, int32_t dts_offset, bool is_hdr)
+static int write_video(struct serializer *s, struct video_packet *vp, enum video_codec_type type,
+                       int32_t dts_offset, bool is_hdr)
 {
     uint8_t *data;
     size_t size;
+    uint8_t hdr[FLV_VIDEO_TAG_HDR_MAX];
     int64_t offset = vp->pts - vp->dts;
     int32_t time_ms = get_ms_time_v(vp, vp->dts) - dts_offset;
+    int hdr_len;
+    uint32_t start_pos = s_getpos(s);
+
+    hdr_len = video_tag_header(hdr, type, vp->key_frame, is_hdr, get_ms_time_v(vp, offset));
 
     s_w8(s, FLV_TAG_TYPE_VIDEO);
 
-    s_wb24(s, vp->size + 5);
+    s_wb24(s, vp->size + hdr_len);
     s_wb24(s, time_ms);
     s_w8(s, (time_ms >> 24) & 0x7f);
     s_wb24(s, 0);
-    s_w8(s, (vp->key_frame?FLV_FRAME_KEY:FLV_FRAME_INTER) | FLV_CODECID_H264);
-    s_w8(s, is_hdr ? 0 : 1);
-    s_wb24(s, get_ms_time_v(vp, offset));
+    s_write(s, hdr, hdr_len);
 
     s_write(s, vp->data, vp->size);
-    s_wb32(s, s_getpos(s) - 1);
+    /* PreviousTagSize is the whole tag with its 11 byte header */
+    s_wb32(s, (uint32_t)s_getpos(s) - start_pos);
 
     serializer_array_get_data(s, &data, &size);
 
@@ -207,6 +324,7 @@ static int write_video(struct serializer *s, struct video_packet *vp, int32_t dt
 static int write_audio(struct serializer *s, struct audio_packet *ap, int32_t dts_offset, bool is_hdr)
 {
     int32_t time_ms = get_ms_time_a(ap, ap->dts) - dts_offset;
+    uint32_t start_pos = s_getpos(s);
 
     s_w8(s, FLV_TAG_TYPE_AUDIO);
     s_wb24(s, ap->size + 2);
@@ -216,71 +334,35 @@ static int write_audio(struct serializer *s, struct audio_packet *ap, int32_t dt
     s_w8(s, FLV_CODECID_AAC|FLV_SAMPLERATE_44100HZ|FLV_SAMPLESSIZE_16BIT|FLV_STEREO);
     s_w8(s, is_hdr ? 0 : 1);
     s_write(s, ap->data, ap->size);
-    s_wb32(s, s_getpos(s) - 1);
+    s_wb32(s, (uint32_t)s_getpos(s) - start_pos);
 
     return 0;
 }
 
-static void s_amf_string(struct serializer *s, const char *str)
-{
-    size_t len = strlen(str);
-    s_wb16(s, len);
-    s_write(s, str, len);
-}
-
-static void s_amf_double(struct serializer *s, double d)
-{
-    s_w8(s, AMF_DATA_TYPE_NUMBER);
-    s_wb64(s, dbl2int(d));
-}
-
-static int build_meta_data(struct flv_muxer *flv, uint8_t **output, size_t *size)
+#define FLV_META_SIZE   512
+#define FLV_AVC(x)      static const AVal av_##x = AVC(#x)
+
+FLV_AVC(onMetaData);
+FLV_AVC(duration);
+FLV_AVC(width);
+FLV_AVC(height);
+FLV_AVC(videodatarate);
+FLV_AVC(framerate);
+FLV_AVC(videocodecid);
+FLV_AVC(audiodatarate);
+FLV_AVC(audiosamplerate);
+FLV_AVC(audiosamplesize);
+FLV_AVC(stereo);
+FLV_AVC(audiocodecid);
+FLV_AVC(filesize);
+
+/* onMetaData into buf, returns its length or -1 */
+static int build_meta_data(struct flv_muxer *flv, char *buf, int size)
 {
-    struct serializer *s, ss;
-    uint8_t *data;
-    unsigned int codec_id = 0xffffffff;
-
-    s = &ss;
-    serializer_array_init(&ss);
-
-    s_w8(s, AMF_DATA_TYPE_STRING);
-    s_amf_string(s, "onMetaData"); // 12 bytes
-
-    /* mixed array (hash) with size and string/type/data tuples */
-    s_w8(s, AMF_DATA_TYPE_MIXEDARRAY);
-    s_wb32(s, 5*!!flv->video + 5*!!flv->audio + 2); // +2 for duration and file size
-
-    s_amf_string(s, "duration");
-    s_amf_double(s, 0.0);
-
-    if (flv->video) {
-        s_amf_string(s, "width");
-        s_amf_double(s, flv->video->width);
-
-        s_amf_string(s, "height");
-        s_amf_double(s, flv->video->height);
-        s_amf_string(s, "videodatarate");
-        s_amf_double(s, flv->video->bitrate/1024.0);
-        s_amf_string(s, "framerate");
-        s_amf_double(s, flv->video->framerate.num/flv->video->framerate.den);
-
-        s_amf_string(s, "videocodecid");
-        s_amf_double(s, FLV_CODECID_H264);
-    }
+    AMFWriter w;
+    int codec_id = -1;
 
     if (flv->audio) {
-        s_amf_string(s, "audiodatarate");
-        s_amf_double(s, flv->audio->bitrate /1024.0);
-        s_amf_string(s, "audiosamplerate");
-        s_amf_double(s, flv->audio->sample_rate);
-        s_amf_string(s, "audiosamplesize");
-        s_amf_double(s, flv->audio->sample_size);
-        s_amf_string(s, "stereo");
-        s_w8(s, AMF_DATA_TYPE_BOOL);
-        s_w8(s, (flv->audio->channels == 2));
-
-        s_amf_string(s, "audiocodecid");
-
         switch (flv->audio->format) {
         case AUDIO_CODEC_AAC:
             codec_id = 10;
@@ -294,19 +376,33 @@ static int build_meta_data(struct flv_muxer *flv, uint8_t **output, size_t *size
         default:
             break;
         }
-        if (codec_id != 0xffffffff){
-            s_amf_double(s, codec_id);
+    }
+    AMFW_Init(&w, buf, size);
+    AMFW_String(&w, &av_onMetaData);
+    /* +2 for duration and file size */
+    AMFW_EcmaArrayStart(&w, 5*!!flv->video + (4 + (codec_id >= 0))*!!flv->audio + 2);
+    AMFW_NamedNumber(&w, &av_duration, 0.0);
+    if (flv->video) {
+        AMFW_NamedNumber(&w, &av_width, flv->video->width);
+        AMFW_NamedNumber(&w, &av_height, flv->video->height);
+        AMFW_NamedNumber(&w, &av_videodatarate, flv->video->bitrate/1024.0);
+        AMFW_NamedNumber(&w, &av_framerate, flv->video->framerate.num/flv->video->framerate.den);
+        /* enhanced rtmp puts the FourCC here */
+        AMFW_NamedNumber(&w, &av_videocodecid, video_fourcc(flv->video->type) ?
+                         video_fourcc(flv->video->type) : FLV_CODECID_H264);
+    }
+    if (flv->audio) {
+        AMFW_NamedNumber(&w, &av_audiodatarate, flv->audio->bitrate/1024.0);
+        AMFW_NamedNumber(&w, &av_audiosamplerate, flv->audio->sample_rate);
+        AMFW_NamedNumber(&w, &av_audiosamplesize, flv->audio->sample_size);
+        AMFW_NamedBoolean(&w, &av_stereo, flv->audio->channels == 2);
+        if (codec_id >= 0) {
+            AMFW_NamedNumber(&w, &av_audiocodecid, codec_id);
         }
     }
-    s_amf_string(s, "filesize");
-    s_amf_double(s, 0); // delayed write
-
-    s_amf_string(s, "");
-    s_w8(s, AMF_END_OF_OBJECT);
-    serializer_array_get_data(s, &data, size);
-    *output = memdup(data, *size);
-    serializer_array_deinit(s);
-    return 0;
+    AMFW_NamedNumber(&w, &av_filesize, 0); // delayed write
+    AMFW_ObjectEnd(&w);
+    return AMFW_Len(&w);
 }
 
 static int write_header(struct serializer *s, bool has_audio, bool has_video)
@@ -323,10 +419,14 @@ static int write_header(struct serializer *s, bool has_audio, bool has_video)
 
 static int write_meta(struct serializer *s, struct flv_muxer *flv)
 {
-    uint8_t *meta = NULL;
-    size_t meta_size;
+    char meta[FLV_META_SIZE];
+    int meta_size;
     uint32_t start_pos;
-    build_meta_data(flv, &meta, &meta_size);
+
+    meta_size = build_meta_data(flv, meta, sizeof(meta));
+    if (meta_size < 0) {
+        return -1;
+    }
 
     start_pos = s_getpos(s);
 
@@ -336,9 +436,6 @@ static int write_meta(struct serializer *s, struct flv_muxer *flv)
     s_wb32(s, 0); /* reserved */
     s_write(s, meta, meta_size);
     s_wb32(s, (uint32_t)s_getpos(s) - start_pos);
-
-    if (meta)
-        free(meta);
     return 0;
 }
 
@@ -434,7 +531,6 @@ static size_t parse_avc_header(const struct video_packet *src, struct video_pack
 
     const uint8_t *extra_data = src->encoder.extra_data;
     size_t extra_size = src->encoder.extra_size;
-    serializer_array_init(&s);
 
     if (extra_size <= 6) {
         printf("%s:%d extra_size=%zu\n", __func__, __LINE__, extra_size);
@@ -443,6 +539,7 @@ static size_t parse_avc_header(const struct video_packet *src, struct video_pack
 
     if (!has_start_code(extra_data)) {
         dst->data = memdup(extra_data, extra_size);
+        dst->size = extra_size;
         return extra_size;
     }
 
@@ -450,6 +547,7 @@ static size_t parse_avc_header(const struct video_packet *src, struct video_pack
     if (!sps || !pps || sps_size < 4) {
         return 0;
     }
+    serializer_array_init(&s);
 
     s_w8(&s, 0x01);
     s_write(&s, sps + 1, 3);
@@ -470,10 +568,74 @@ static size_t parse_avc_header(const struct video_packet *src, struct video_pack
     return extra_size;
 }
 
+struct bit_reader {
+    const uint8_t *p;
+    size_t bits;
+    size_t pos;
+};
+
+/* reading past the end gives zeros, check pos against bits afterwards */
+static uint32_t br_read(struct bit_reader *br, int n)
+{
+    uint32_t v = 0;
+
+    while (n--) {
+        v <<= 1;
+        if (br->pos < br->bits) {
+            v |= (br->p[br->pos >> 3] >> (7 - (br->pos & 7))) & 1;
+        }
+        br->pos++;
+    }
+    return v;
+}
+
+/* exp-golomb, also av1 uvlc */
+static uint32_t br_read_ue(struct bit_reader *br)
+{
+    int zeros = 0;
 
+    while (zeros < 31 && br->pos < br->bits && !br_read(br, 1)) {
+        zeros++;
+    }
+    return ((1u << zeros) - 1) + br_read(br, zeros);
+}
 
-static void serialize_avc_data(struct serializer *s, const uint8_t *data,
-                size_t size, bool *is_keyframe)
+static size_t nal_to_rbsp(const uint8_t *nal, size_t size, uint8_t *rbsp, size_t max)
+{
+    size_t i, n = 0;
+    int zeros = 0;
+
+    for (i = 0; i < size && n < max; i++) {
+        if (zeros >= 2 && nal[i] == 3) {
+            zeros = 0;
+            continue;
+        }
+        zeros = nal[i] ? 0 : zeros + 1;
+        rbsp[n++] = nal[i];
+    }
+    return n;
+}
+
+/* 1 key slice, 0 other slice, -1 not a slice */
+static int nal_slice_type(enum video_codec_type type, const uint8_t *nal)
+{
+    int t;
+
+    if (type == VIDEO_CODEC_H265) {
+        t = (nal[0] >> 1) & 0x3f;
+        if (t >= HEVC_NAL_VPS) {
+            return -1;
+        }
+        return t >= HEVC_NAL_BLA_W_LP && t <= HEVC_NAL_CRA_NUT;
+    }
+    t = nal[0] & 0x1F;
+    if (t == H264_NAL_IDR_SLICE) {
+        return 1;
+    }
+    return t == H264_NAL_SLICE ? 0 : -1;
+}
+
+static void get_hevc_ps(const uint8_t *data, size_t size, const uint8_t **ps, size_t *ps_size)
 {
     const uint8_t *nal_start, *nal_end;
     const uint8_t *end = data + size;
@@ -485,10 +647,338 @@ static void serialize_avc_data(struct serializer *s, const uint8_t *data,
             ;
         if (nal_start == end)
             break;
-        type = nal_start[0] & 0x1F;
-        if (type == H264_NAL_IDR_SLICE || type == H264_NAL_SLICE) {
+        nal_end = avc_find_startcode(nal_start, end);
+        type = (nal_start[0] >> 1) & 0x3f;
+        if (type >= HEVC_NAL_VPS && type <= HEVC_NAL_PPS && !ps[type - HEVC_NAL_VPS]) {
+            ps[type - HEVC_NAL_VPS] = nal_start;
+            ps_size[type - HEVC_NAL_VPS] = nal_end - nal_start;
+        }
+        nal_start = nal_end;
+    }
+}
+
+/* hvcC (ISO/IEC 14496-15 8.3.3) from annexb vps, sps and pps */
+static size_t parse_hevc_header(const uint8_t *data, size_t size, struct video_packet *dst)
+{
+    const uint8_t *ps[3] = {NULL, NULL, NULL};
+    size_t ps_size[3] = {0, 0, 0};
+    uint8_t rbsp[256];
+    uint8_t sub_layer[8];
+    struct bit_reader br;
+    struct serializer s;
+    uint32_t max_sub_layers, nesting, chroma, luma_depth, chroma_depth;
+    uint8_t *hvcc;
+    size_t len;
+    uint32_t i;
+
+    if (size < 4 || !has_start_code(data)) {
+        return 0;
+    }
+    get_hevc_ps(data, size, ps, ps_size);
+    if (!ps[0] || !ps[1] || !ps[2]) {
+        return 0;
+    }
+    len = nal_to_rbsp(ps[1], ps_size[1], rbsp, sizeof(rbsp));
+    if (len < 15) {
+        return 0;
+    }
+    br.p = rbsp;
+    br.bits = len * 8;
+    br.pos = 16 + 4; /* nal header, sps_video_parameter_set_id */
+    max_sub_layers = br_read(&br, 3) + 1;
+    nesting = br_read(&br, 1);
+    /* general profile, tier and level: 12 bytes, copied to hvcC as is */
+    br.pos += 96;
+    for (i = 1; i < max_sub_layers; i++) {
+        sub_layer[i] = br_read(&br, 2);
+    }
+    if (max_sub_layers > 1) {
+        br.pos += 2 * (9 - max_sub_layers);
+    }
+    for (i = 1; i < max_sub_layers; i++) {
+        br.pos += (sub_layer[i] & 2) ? 88 : 0;
+        br.pos += (sub_layer[i] & 1) ? 8 : 0;
+    }
+    br_read_ue(&br); /* sps_seq_parameter_set_id */
+    chroma = br_read_ue(&br);
+    if (chroma == 3) {
+        br_read(&br, 1);
+    }
+    br_read_ue(&br); /* pic_width_in_luma_samples */
+    br_read_ue(&br); /* pic_height_in_luma_samples */
+    if (br_read(&br, 1)) {
+        for (i = 0; i < 4; i++) {
+            br_read_ue(&br); /* conformance window offsets */
+        }
+    }
+    luma_depth = br_read_ue(&br);
+    chroma_depth = br_read_ue(&br);
+    if (br.pos > br.bits || chroma > 3 || luma_depth > 7 || chroma_depth > 7) {
+        printf("%s:%d invalid sps\n", __func__, __LINE__);
+        return 0;
+    }
+
+    serializer_array_init(&s);
+    s_w8(&s, 0x01);
+    s_write(&s, rbsp + 3, 12);
+    s_wb16(&s, 0xf000);     /* min_spatial_segmentation_idc */
+    s_w8(&s, 0xfc);         /* parallelismType */
+    s_w8(&s, 0xfc | chroma);
+    s_w8(&s, 0xf8 | luma_depth);
+    s_w8(&s, 0xf8 | chroma_depth);
+    s_wb16(&s, 0);          /* avgFrameRate */
+    s_w8(&s, max_sub_layers << 3 | nesting << 2 | 0x03);
+    s_w8(&s, 3);            /* numOfArrays */
+    for (i = 0; i < 3; i++) {
+        s_w8(&s, 0x80 | (HEVC_NAL_VPS + i));
+        s_wb16(&s, 1);
+        s_wb16(&s, (uint16_t)ps_size[i]);
+        s_write(&s, ps[i], ps_size[i]);
+    }
+    serializer_array_get_data(&s, &hvcc, &len);
+    dst->data = memdup(hvcc, len);
+    dst->size = len;
+    serializer_array_deinit(&s);
+    return len;
+}
+
+/*
+ * one low overhead format obu, return its size and the size of its header,
+ * 0 if malformed. an obu without size field runs to the end
+ */
+static size_t av1_obu(const uint8_t *p, const uint8_t *end, int *type, size_t *hdr_len)
+{
+    uint64_t payload = 0;
+    size_t n = 1;
+    int i;
+
+    if (p >= end || (p[0] & 0x80)) {
+        return 0;
+    }
+    *type = (p[0] >> 3) & 0x0f;
+    if (p[0] & 0x04) {
+        n++;
+    }
+    if (!(p[0] & 0x02)) {
+        if (p + n > end) {
+            return 0;
+        }
+        *hdr_len = n;
+        return end - p;
+    }
+    for (i = 0; i < 8; i++) {
+        if (p + n >= end) {
+            return 0;
+        }
+        payload |= (uint64_t)(p[n] & 0x7f) << (7 * i);
+        if (!(p[n++] & 0x80)) {
+            break;
+        }
+    }
+    if (i == 8 || payload > (uint64_t)(end - p - n)) {
+        return 0;
+    }
+    *hdr_len = n;
+    return n + (size_t)payload;
+}
+
+/* first 4 bytes of av1C (AV1 ISOBMFF 2.3) from a sequence header obu payload */
+static int av1_config(const uint8_t *p, size_t size, uint8_t *cfg)
+{
+    struct bit_reader br = {p, size * 8, 0};
+    uint32_t profile, reduced, level = 0, tier = 0;
+    uint32_t decoder_model = 0, delay_len = 0, initial_delay, cnt, lv, t, i;
+    uint32_t order_hint, screen_tools;
+    uint32_t hbd, twelve = 0, mono = 0, cp = 2, tc = 2, mc = 2;
+    uint32_t ssx = 1, ssy = 1, csp = 0;
+
+    profile = br_read(&br, 3);
+    br_read(&br, 1); /* still_picture */
+    reduced = br_read(&br, 1);
+    if (reduced) {
+        level = br_read(&br, 5);
+    } else {
+        if (br_read(&br, 1)) { /* timing_info */
+            br.pos += 64;
+            if (br_read(&br, 1)) {
+                br_read_ue(&br);
+            }
+            decoder_model = br_read(&br, 1);
+            if (decoder_model) {
+                delay_len = br_read(&br, 5) + 1;
+                br.pos += 32 + 5 + 5;
+            }
+        }
+        initial_delay = br_read(&br, 1);
+        cnt = br_read(&br, 5) + 1;
+        for (i = 0; i < cnt; i++) {
+            br.pos += 12; /* operating_point_idc */
+            lv = br_read(&br, 5);
+            t = lv > 7 ? br_read(&br, 1) : 0;
+            if (decoder_model && br_read(&br, 1)) {
+                br.pos += 2 * delay_len + 1;
+            }
+            if (initial_delay && br_read(&br, 1)) {
+                br.pos += 4;
+            }
+            if (i == 0) {
+                level = lv;
+                tier = t;
+            }
+        }
+    }
+    t = br_read(&br, 4) + 1;
+    lv = br_read(&br, 4) + 1;
+    br.pos += t + lv; /* max_frame_width/height */
+    if (!reduced && br_read(&br, 1)) {
+        br.pos += 7; /* frame id lengths */
+    }
+    br.pos += 3; /* 128x128 superblock, filter intra, intra edge filter */
+    if (!reduced) {
+        br.pos += 4; /* interintra, masked compound, warped motion, dual filter */
+        order_hint = br_read(&br, 1);
+        if (order_hint) {
+            br.pos += 2;
+        }
+        screen_tools = br_read(&br, 1) ? 2 : br_read(&br, 1);
+        if (screen_tools && !br_read(&br, 1)) {
+            br.pos += 1; /* seq_force_integer_mv */
+        }
+        if (order_hint) {
+            br.pos += 3;
+        }
+    }
+    br.pos += 3; /* superres, cdef, restoration */
+
+    hbd = br_read(&br, 1);
+    if (profile == 2 && hbd) {
+        twelve = br_read(&br, 1);
+    }
+    if (profile != 1) {
+        mono = br_read(&br, 1);
+    }
+    if (br_read(&br, 1)) {
+        cp = br_read(&br, 8);
+        tc = br_read(&br, 8);
+        mc = br_read(&br, 8);
+    }
+    if (mono) {
+        br.pos += 1; /* color_range */
+    } else if (cp == 1 && tc == 13 && mc == 0) {
+        ssx = ssy = 0;
+    } else {
+        br.pos += 1; /* color_range */
+        if (profile == 1) {
+            ssx = ssy = 0;
+        } else if (profile == 2) {
+            if (twelve) {
+                ssx = br_read(&br, 1);
+                ssy = ssx ? br_read(&br, 1) : 0;
+            } else {
+                ssy = 0;
+            }
+        }
+        if (ssx && ssy) {
+            csp = br_read(&br, 2);
+        }
+    }
+    if (br.pos > br.bits) {
+        return -1;
+    }
+    cfg[0] = 0x81; /* marker, version 1 */
+    cfg[1] = profile << 5 | level;
+    cfg[2] = tier << 7 | hbd << 6 | twelve << 5 | mono << 4 | ssx << 3 | ssy << 2 | csp;
+    cfg[3] = 0;
+    return 0;
+}
+
+/* av1C from the sequence header obu of a temporal unit */
+static size_t parse_av1_header(const uint8_t *data, size_t size, struct video_packet *dst)
+{
+    const uint8_t *p = data, *end = data + size;
+    size_t n, hdr_len;
+    int type;
+
+    while ((n = av1_obu(p, end, &type, &hdr_len)) > 0) {
+        if (type == AV1_OBU_SEQUENCE_HEADER) {
+            dst->data = malloc(4 + n);
+            if (!dst->data) {
+                return 0;
+            }
+            if (av1_config(p + hdr_len, n - hdr_len, dst->data) < 0) {
+                printf("%s:%d invalid sequence header\n", __func__, __LINE__);
+                free(dst->data);
+                dst->data = NULL;
+                return 0;
+            }
+            memcpy(dst->data + 4, p, n);
+            dst->size = 4 + n;
+            return dst->size;
+        }
+        p += n;
+    }
+    return 0;
+}
+
+/* sequence header of the codec: avcC, hvcC or av1C */
+static size_t parse_video_header(enum video_codec_type type, const struct video_packet *src,
+                                 struct video_packet *dst)
+{
+    const uint8_t *extra_data = src->encoder.extra_data;
+    size_t extra_size = src->encoder.extra_size;
+    size_t size = 0;
+
+    switch (type) {
+    case VIDEO_CODEC_H265:
+        if (extra_size > 6 && extra_data[0] == 0x01) {
+            dst->data = memdup(extra_data, extra_size);
+            size = dst->size = extra_size;
+            break;
+        }
+        size = parse_hevc_header(extra_data, extra_size, dst);
+        if (!size) { /* parameter sets in band */
+            size = parse_hevc_header(src->data, src->size, dst);
+        }
+        break;
+    case VIDEO_CODEC_AV1:
+        if (extra_size > 4 && extra_data[0] == 0x81) {
+            dst->data = memdup(extra_data, extra_size);
+            size = dst->size = extra_size;
+            break;
+        }
+        size = parse_av1_header(extra_data, extra_size, dst);
+        if (!size) {
+            size = parse_av1_header(src->data, src->size, dst);
+        }
+        break;
+    default:
+        return parse_avc_header(src, dst);
+    }
+    if (!size) {
+        printf("%s:%d no %s sequence header\n", __func__, __LINE__,
+               video_codec_type_to_string(type));
+    }
+    memcpy(&dst->encoder, &src->encoder, sizeof(struct video_encoder));
+    return size;
+}
+
+static void serialize_avc_data(struct serializer *s, enum video_codec_type codec,
+                const uint8_t *data, size_t size, bool *is_keyframe)
+{
+    const uint8_t *nal_start, *nal_end;
+    const uint8_t *end = data + size;
+    int type;
+
+    nal_start = avc_find_startcode(data, end);
+    while (true) {
+        while (nal_start < end && !*(nal_start++))
+            ;
+        if (nal_start == end)
+            break;
+        type = nal_slice_type(codec, nal_start);
+        if (type >= 0) {
             if (is_keyframe)
-                *is_keyframe = (type == H264_NAL_IDR_SLICE);
+                *is_keyframe = type;
         }
         nal_end = avc_find_startcode(nal_start, end);
         s_wb32(s, (uint32_t)(nal_end - nal_start));
@@ -498,7 +988,23 @@ static void serialize_avc_data(struct serializer *s, const uint8_t *data,
 
 }
 
-static void parse_avc_packet(const struct video_packet *src, struct video_packet *dst)
+/* temporal delimiters are left out of flv, like the av1 isobmff binding does */
+static void serialize_av1_data(struct serializer *s, const uint8_t *data, size_t size)
+{
+    const uint8_t *p = data, *end = data + size;
+    size_t n, hdr_len;
+    int type;
+
+    while ((n = av1_obu(p, end, &type, &hdr_len)) > 0) {
+        if (type != AV1_OBU_TEMPORAL_DELIMITER) {
+            s_write(s, p, n);
+        }
+        p += n;
+    }
+}
+
+static void parse_video_packet(enum video_codec_type type, const struct video_packet *src,
+                               struct video_packet *dst)
 {
     uint8_t *data;
     size_t size;
@@ -506,7 +1012,12 @@ static void parse_avc_packet(const struct video_packet *src, struct video_packet
 
     serializer_array_init(&s);
 
-    serialize_avc_data(&s, src->data, src->size, &dst->key_frame);
+    if (type == VIDEO_CODEC_AV1) {
+        serialize_av1_data(&s, src->data, src->size);
+        dst->key_frame = src->key_frame;
+    } else {
+        serialize_avc_data(&s, type, src->data, src->size, &dst->key_frame);
+    }
     serializer_array_get_data(&s, &data, &size);
 
     dst->data = memdup(data, size);
@@ -515,6 +1026,124 @@ static void parse_avc_packet(const struct video_packet *src, struct video_packet
     memcpy(&dst->encoder, &src->encoder, sizeof(struct video_encoder));
 }
 
+static int av1_tag_iov(struct video_packet *vp, struct iovec *iov, int max_iov)
+{
+    const uint8_t *p = vp->data, *end = vp->data + vp->size;
+    size_t n, hdr_len;
+    int type;
+    int cnt = 1;
+
+    while (p < end) {
+        n = av1_obu(p, end, &type, &hdr_len);
+        if (!n) {
+            return -1;
+        }
+        if (type == AV1_OBU_TEMPORAL_DELIMITER) {
+            p += n;
+            continue;
+        }
+        /* adjacent obus go out as one piece */
+        if (cnt > 1 && (uint8_t *)iov[cnt - 1].iov_base + iov[cnt - 1].iov_len == p) {
+            iov[cnt - 1].iov_len += n;
+        } else if (cnt < max_iov) {
+            iov[cnt].iov_base = (void *)p;
+            iov[cnt++].iov_len = n;
+        } else {
+            return -1;
+        }
+        p += n;
+    }
+    return cnt;
+}
+
+int flv_video_tag_iov(struct flv_muxer *flv, struct video_packet *vp, uint32_t *timestamp,
+                      uint8_t *hdr, size_t hdr_len, struct iovec *iov, int max_iov)
+{
+    const uint8_t *nal_start, *nal_end, *end;
+    enum video_codec_type type;
+    uint8_t *h;
+    bool is_keyframe = false;
+    bool overflow = false;
+    int32_t cts;
+    uint32_t len;
+    int cnt = 1;
+
+    if (!flv || !vp || !flv->video || flv->is_header || vp->size < 4 ||
+        hdr_len < FLV_VIDEO_TAG_HDR_MAX || max_iov < 1) {
+        return -1;
+    }
+    type = flv->video->type;
+    cts = get_ms_time_v(vp, vp->pts - vp->dts);
+    /* the real key flag is or'ed into hdr[0] below, only the length matters here */
+    h = hdr + video_tag_header(hdr, type, false, false, cts);
+    if (type == VIDEO_CODEC_AV1) {
+        is_keyframe = vp->key_frame;
+        cnt = av1_tag_iov(vp, iov, max_iov);
+        overflow = cnt < 0;
+        goto out;
+    }
+    if (!has_start_code(vp->data)) {
+        return -1;
+    }
+    end = vp->data + vp->size;
+    nal_start = avc_find_startcode(vp->data, end);
+    while (true) {
+        while (nal_start < end && !*(nal_start++))
+            ;
+        if (nal_start == end)
+            break;
+        nal_end = avc_find_startcode(nal_start, end);
+        if (nal_slice_type(type, nal_start) == 1) {
+            is_keyframe = true;
+        }
+        /* keep scanning, the timeline must start at the first key frame */
+        if (overflow || cnt + 2 > max_iov || h + 4 > hdr + hdr_len) {
+            overflow = true;
+            nal_start = nal_end;
+            continue;
+        }
+        len = (uint32_t)(nal_end - nal_start);
+        h[0] = len >> 24;
+        h[1] = len >> 16;
+        h[2] = len >> 8;
+        h[3] = len;
+        iov[cnt].iov_base = h;
+        iov[cnt++].iov_len = 4;
+        iov[cnt].iov_base = (void *)nal_start;
+        iov[cnt++].iov_len = len;
+        h += 4;
+        nal_start = nal_end;
+    }
+out:
+    if (!flv->is_keyframe_got && is_keyframe) {
+        flv->video->start_dts_offset = get_ms_time_v(vp, vp->dts);
+        flv->is_keyframe_got = true;
+    }
+    if (overflow || cnt == 1) {
+        return -1;
+    }
+    iov[0].iov_base = hdr;
+    iov[0].iov_len = video_tag_header(hdr, type, is_keyframe, false, cts);
+    *timestamp = (uint32_t)(get_ms_time_v(vp, vp->dts) - flv->video->start_dts_offset);
+    return cnt;
+}
+
+int flv_audio_tag_iov(struct flv_muxer *flv, struct audio_packet *ap, uint32_t *timestamp,
+                      uint8_t *hdr, size_t hdr_len, struct iovec *iov, int max_iov)
+{
+    if (!flv || !ap || !ap->size || flv->is_header || hdr_len < 2 || max_iov < 2) {
+        return -1;
+    }
+    hdr[0] = FLV_CODECID_AAC|FLV_SAMPLERATE_44100HZ|FLV_SAMPLESSIZE_16BIT|FLV_STEREO;
+    hdr[1] = 1;
+    iov[0].iov_base = hdr;
+    iov[0].iov_len = 2;
+    iov[1].iov_base = ap->data;
+    iov[1].iov_len = ap->size;
+    *timestamp = (uint32_t)(get_ms_time_a(ap, ap->dts) - ap->encoder.start_dts_offset);
+    return 2;
+}
+
 int flv_write_packet(struct flv_muxer *flv, struct media_packet *pkt)
 {
     uint8_t *data;
@@ -538,13 +1167,19 @@ int flv_write_packet(struct flv_muxer *flv, struct media_packet *pkt)
 
         if (has_video) {
             struct video_packet *vpkt = video_packet_create(MEDIA_MEM_DEEP, NULL, 0);
-            parse_avc_header(pkt->video, vpkt);
+            parse_video_header(flv->video->type, pkt->video, vpkt);
             vpkt->key_frame = true;
-            write_video(s, vpkt, 0, true);
+            write_video(s, vpkt, flv->video->type, 0, true);
             video_packet_destroy(vpkt);
         }
-        if (has_audio) {
-            write_audio(s, pkt->audio, 0, true);
+        if (has_audio && flv->audio->extra_size) {
+            /* AudioSpecificConfig, pkt may be video here */
+            struct audio_packet apkt;
+            memset(&apkt, 0, sizeof(apkt));
+            apkt.data = flv->audio->extra_data;
+            apkt.size = flv->audio->extra_size;
+            apkt.encoder = *flv->audio;
+            write_audio(s, &apkt, 0, true);
         }
         flv->is_header = false;
     }
@@ -556,14 +1191,14 @@ int flv_write_packet(struct flv_muxer *flv, struct media_packet *pkt)
         vpkt->key_frame = true;
         vpkt->dts = pkt->video->dts;
         vpkt->pts = pkt->video->pts;
-        parse_avc_packet(pkt->video, vpkt);
+        parse_video_packet(flv->video->type, pkt->video, vpkt);
         if (!flv->is_keyframe_got) {
             if (vpkt->key_frame) {
                 flv->video->start_dts_offset = get_ms_time_v(pkt->video, pkt->video->dts);
                 flv->is_keyframe_got = true;
             }
         }
-        write_video(s, vpkt, flv->video->start_dts_offset, false);
+        write_video(s, vpkt, flv->video->type, flv->video->start_dts_offset, false);
         video_packet_destroy(vpkt);
         break;
     case MEDIA_TYPE_AUDIO:
@@ -39,6 +39,8 @@ struct flv_muxer {
     struct serializer    s;
     bool                 is_header;
     bool                 is_keyframe_got;
+    struct media_clock  *clock;
+    int                  clock_track[MEDIA_TYPE_MAX];
 };
 
 struct flv_muxer *flv_mux_create(flv_mux_output_cb *cb, void *cb_ctx);
@@ -47,6 +49,30 @@ void flv_mux_destroy(struct flv_muxer *flv);
 
 int flv_write_packet(struct flv_muxer *flv, struct media_packet *pkt);
 
+/*
+ * puts pts/dts of pkt on the clock of the muxer, in ms: jitter smoothed,
+ * discontinuities taken out, monotonic. call once per packet before it
+ * is queued, packets of a track that wasn't added are left alone
+ */
+int flv_mux_stamp(struct flv_muxer *flv, struct media_packet *pkt);
+
+/* longest video tag header: enhanced rtmp byte, FourCC, composition time */
+#define FLV_VIDEO_TAG_HDR_MAX   8
+
+/*
+ * for senders that chunk by themselves: after flv_write_packet sent the
+ * headers, describe the body of the video tag of an annexb h264/h265
+ * packet or an av1 temporal unit. the tag header and nal lengths are
+ * written to hdr, nal units and obus are referenced in vp->data, not
+ * copied. return count of iov filled, -1 if vp can't be described this
+ * way and needs flv_write_packet
+ */
+int flv_video_tag_iov(struct flv_muxer *flv, struct video_packet *vp, uint32_t *timestamp,
+                      uint8_t *hdr, size_t hdr_len, struct iovec *iov, int max_iov);
+/* same for audio, hdr needs 2 bytes and iov 2 entries */
+int flv_audio_tag_iov(struct flv_muxer *flv, struct audio_packet *ap, uint32_t *timestamp,
+                      uint8_t *hdr, size_t hdr_len, struct iovec *iov, int max_iov);
+
 #ifdef __cplusplus
 }
 #endif
@@ -20,23 +20,54 @@
  * SOFTWARE.
  ******************************************************************************/
 #include "librtmpc.h"
+#include "rtmpc_conn.h"
+#include "rtmpc_congest.h"
 #include "rtmp.h"
 #include "log.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#if defined (ENABLE_TRACE)
+#include <libtrace.h>
+#else
+#define TRACE_SCOPE(cat, name)
+#define TRACE_FLOW_STEP(cat, name, id)
+#define TRACE_FLOW_END(cat, name, id)
+#endif
+
+#define RTMPC_BRANCH        "rtmpc"
+#define RTMPC_QUEUE_DEPTH   256
+#define RTMPC_POP_WAIT_MS   100
+#define RTMPC_CHUNK_SIZE    65536   /* announced by connect, fewer chunk headers */
+#define RTMPC_CSID_TAG      6       /* zero copy tags, librtmp never uses it */
+#define RTMPC_NAL_MAX       32
+#define RTMPC_RETRY_MIN_MS  500
+#define RTMPC_RETRY_MAX_MS  30000
+#define RTMPC_REPLAY_BYTES  (4*1024*1024)
+#define RTMPC_REPLAY_MAX    512     /* packets */
 
 void rtmpc_destroy(struct rtmpc *rtmpc)
 {
     if (!rtmpc) {
         return;
     }
+    if (rtmpc->evbase) {
+        if (rtmpc->is_start) {
+            rtmpc_stream_stop(rtmpc);
+        }
+        rtmpc_conn_destroy(rtmpc->conn);
+        sem_lock_deinit(&rtmpc->sem);
+        free(rtmpc->replay);
+    }
     RTMP_Close(rtmpc->base);
     RTMP_Free(rtmpc->base);
+    free(rtmpc->tcurl);
     rtmpc->base = NULL;
     queue_destroy(rtmpc->q);
     flv_mux_destroy(rtmpc->flv);
+    rtmpc_congest_destroy(rtmpc->congest);
+    free(rtmpc->url);
     free(rtmpc);
 }
 
@@ -52,6 +83,29 @@ static void *item_alloc_hook(void *data, size_t len, void *arg)
     return new_pkt;
 }
 
+/* packets are sent from the queue by reference, so the queue owns the data */
+static void *item_alloc_hook_deep(void *data, size_t len, void *arg)
+{
+    struct media_packet *pkt = (struct media_packet *)arg;
+    if (!pkt) {
+        return NULL;
+    }
+    return media_packet_copy(pkt, MEDIA_MEM_DEEP);
+}
+
+/* a full queue drops up to the next key frame, audio is kept */
+static uint32_t item_classify(void *data, size_t len, void *arg)
+{
+    struct media_packet *pkt = (struct media_packet *)arg;
+    if (pkt->type == MEDIA_TYPE_AUDIO) {
+        return QUEUE_ITEM_KEEP;
+    }
+    if (pkt->type == MEDIA_TYPE_VIDEO && pkt->video->key_frame) {
+        return QUEUE_ITEM_KEY;
+    }
+    return 0;
+}
+
 static void item_free_hook(void *data)
 {
     struct media_packet *pkt = (struct media_packet *)data;
@@ -80,6 +134,7 @@ struct rtmpc *rtmpc_create(const char *url)
     }
     RTMP_Init(base);
     RTMP_LogSetLevel(RTMP_LOGINFO);
+    base->m_outChunkSize = RTMPC_CHUNK_SIZE;
 
     if (!RTMP_SetupURL(base, (char *)url)) {
         printf("RTMP_SetupURL failed!\n");
@@ -107,6 +162,10 @@ struct rtmpc *rtmpc_create(const char *url)
         goto failed;
     }
     queue_set_hook(rtmpc->q, item_alloc_hook, item_free_hook);
+    rtmpc->congest = rtmpc_congest_create();
+    if (!rtmpc->congest) {
+        goto failed;
+    }
     rtmpc->base = base;
     rtmpc->is_run = false;
     rtmpc->is_start = false;
@@ -143,6 +202,7 @@ struct rtmpc *rtmpc_create2(struct rtmp_url *url)
     }
     RTMP_Init(base);
     RTMP_LogSetLevel(RTMP_LOGINFO);
+    base->m_outChunkSize = RTMPC_CHUNK_SIZE;
 
     if (!RTMP_SetupURL(base, url->addr)) {
         printf("RTMP_SetupURL failed!\n");
@@ -179,6 +239,10 @@ struct rtmpc *rtmpc_create2(struct rtmp_url *url)
         goto failed;
     }
     queue_set_hook(rtmpc->q, item_alloc_hook, item_free_hook);
+    rtmpc->congest = rtmpc_congest_create();
+    if (!rtmpc->congest) {
+        goto failed;
+    }
     rtmpc->base = base;
     rtmpc->is_run = false;
     rtmpc->is_start = false;
@@ -194,24 +258,179 @@ failed:
     return NULL;
 }
 
-int rtmpc_stream_add(struct rtmpc *rtmpc, struct media_packet *pkt)
+static void release_item(void *ctx, void *ref)
 {
-    return flv_mux_add_media(rtmpc->flv, pkt);
+    queue_item_free((struct queue *)ctx, (struct queue_item *)ref);
 }
 
-int rtmpc_send_packet(struct rtmpc *rtmpc, struct media_packet *pkt)
+static void on_conn_state(struct rtmpc_conn *c, void *ctx);
+static void on_retry(struct gevent_wtimer *t, void *arg);
+
+struct rtmpc *rtmpc_create_async(struct gevent_base *evbase, const char *url)
 {
-    struct queue_item *item = NULL;
-    if (!rtmpc || !pkt) {
+    RTMP *base = NULL;
+    struct rtmpc *rtmpc;
+
+    if (!evbase || !url) {
         printf("%s invalid parament!\n", __func__);
+        return NULL;
+    }
+    rtmpc = (struct rtmpc *)calloc(1, sizeof(struct rtmpc));
+    if (!rtmpc) {
+        printf("malloc rtmpc failed!\n");
+        return NULL;
+    }
+    base = RTMP_Alloc();
+    if (!base) {
+        printf("RTMP_Alloc failed!\n");
+        goto failed;
+    }
+    RTMP_Init(base);
+    RTMP_LogSetLevel(RTMP_LOGINFO);
+    base->m_outChunkSize = RTMPC_CHUNK_SIZE;
+
+    /* link is used long after return, keep our own copy of url */
+    rtmpc->url = strdup(url);
+    if (!rtmpc->url || !RTMP_SetupURL(base, rtmpc->url)) {
+        printf("RTMP_SetupURL failed!\n");
+        goto failed;
+    }
+    /* RTMP_Close frees a tcUrl it built, a reconnect needs it again */
+    if (base->Link.lFlags & RTMP_LF_FTCU) {
+        rtmpc->tcurl = base->Link.tcUrl.av_val;
+        base->Link.lFlags &= ~RTMP_LF_FTCU;
+    }
+    RTMP_EnableWrite(base);
+    RTMP_AddStream(base, NULL);
+
+    /* only resolve here, connect is started by rtmpc_stream_start */
+    rtmpc->conn = rtmpc_conn_create(evbase, base);
+    if (!rtmpc->conn) {
+        printf("rtmpc_conn_create failed!\n");
+        goto failed;
+    }
+    rtmpc->flv = flv_mux_create(flv_mux_output, base);
+    if (!rtmpc->flv) {
+        goto failed;
+    }
+    rtmpc->q = queue_create();
+    if (!rtmpc->q) {
+        printf("queue_create failed!\n");
+        goto failed;
+    }
+    queue_set_depth(rtmpc->q, RTMPC_QUEUE_DEPTH);
+    queue_set_mode(rtmpc->q, QUEUE_FULL_SKIP_TO_KEY);
+    queue_set_classify(rtmpc->q, item_classify);
+    queue_set_hook(rtmpc->q, item_alloc_hook_deep, item_free_hook);
+    rtmpc_conn_set_release(rtmpc->conn, release_item, rtmpc->q);
+    rtmpc_conn_set_state_cb(rtmpc->conn, on_conn_state, rtmpc);
+    rtmpc->congest = rtmpc_congest_create();
+    if (!rtmpc->congest) {
+        goto failed;
+    }
+    gevent_wtimer_init(&rtmpc->retry, on_retry, rtmpc);
+    rtmpc->retry_ms = RTMPC_RETRY_MIN_MS;
+    rtmpc->retry_max_ms = RTMPC_RETRY_MAX_MS;
+    rtmpc->replay_max_bytes = RTMPC_REPLAY_BYTES;
+    sem_lock_init(&rtmpc->sem);
+    rtmpc->base = base;
+    rtmpc->evbase = evbase;
+    rtmpc->is_run = false;
+    rtmpc->is_start = false;
+    return rtmpc;
+
+failed:
+    rtmpc_conn_destroy(rtmpc->conn);
+    flv_mux_destroy(rtmpc->flv);
+    queue_destroy(rtmpc->q);
+    if (base) {
+        RTMP_Free(base);
+    }
+    free(rtmpc->url);
+    free(rtmpc->tcurl);
+    free(rtmpc);
+    return NULL;
+}
+
+int rtmpc_set_queue_bytes(struct rtmpc *rtmpc, size_t max_bytes)
+{
+    if (!rtmpc || !rtmpc->congest || !max_bytes) {
         return -1;
     }
+    rtmpc->congest->max_bytes = max_bytes;
+    return 0;
+}
+
+int rtmpc_set_bitrate_cb(struct rtmpc *rtmpc, rtmpc_bitrate_cb *cb, void *arg)
+{
+    if (!rtmpc) {
+        return -1;
+    }
+    rtmpc->bitrate_cb = cb;
+    rtmpc->bitrate_arg = arg;
+    return 0;
+}
+
+int rtmpc_set_reconnect(struct rtmpc *rtmpc, uint32_t max_ms)
+{
+    if (!rtmpc || !rtmpc->evbase) {
+        return -1;
+    }
+    rtmpc->retry_max_ms = max_ms ? MAX2(max_ms, RTMPC_RETRY_MIN_MS) : 0;
+    return 0;
+}
+
+int rtmpc_set_replay_bytes(struct rtmpc *rtmpc, size_t max_bytes)
+{
+    if (!rtmpc || !rtmpc->evbase || rtmpc->is_start) {
+        return -1;
+    }
+    rtmpc->replay_max_bytes = max_bytes;
+    return 0;
+}
+
+/* sent is what the kernel took, minus its unsent part is what left */
+static void report_bitrate(struct rtmpc *rtmpc, uint64_t sent, int fd)
+{
+    size_t notsent = rtmpc_sock_notsent(fd);
+    uint32_t kbps;
+
+    kbps = rtmpc_congest_update(rtmpc->congest, sent > notsent ? sent - notsent : 0);
+    if (kbps && rtmpc->bitrate_cb) {
+        rtmpc->bitrate_cb(rtmpc, kbps, rtmpc->bitrate_arg);
+    }
+}
+
+int rtmpc_stream_add(struct rtmpc *rtmpc, struct media_packet *pkt)
+{
+    return flv_mux_add_media(rtmpc->flv, pkt);
+}
+
+/*
+ * the packet is stamped on the clock of flv once here, before it fans out.
+ * a shallow view of it is stamped and copied, the caller's stays as it was
+ */
+static int push_packet(struct queue *q, struct flv_muxer *flv, struct media_packet *pkt)
+{
+    struct queue_item *item = NULL;
+    struct media_packet view = *pkt;
+    struct audio_packet ap;
+    struct video_packet vp;
+
+    TRACE_SCOPE("rtmpc", "push_packet");
     switch (pkt->type) {
     case MEDIA_TYPE_AUDIO:
-        item = queue_item_alloc(rtmpc->q, pkt->audio->data, pkt->audio->size, pkt);
+        ap = *pkt->audio;
+        view.audio = &ap;
+        flv_mux_stamp(flv, &view);
+        item = queue_item_alloc(q, ap.data, ap.size, &view);
         break;
     case MEDIA_TYPE_VIDEO:
-        item = queue_item_alloc(rtmpc->q, pkt->video->data, pkt->video->size, pkt);
+        vp = *pkt->video;
+        view.video = &vp;
+        flv_mux_stamp(flv, &view);
+        item = queue_item_alloc(q, vp.data, vp.size, &view);
+        TRACE_FLOW_STEP("packet", "packet", vp.pts);
         break;
     default:
         break;
@@ -220,34 +439,362 @@ int rtmpc_send_packet(struct rtmpc *rtmpc, struct media_packet *pkt)
         printf("item_alloc packet type %d failed!\n", pkt->type);
         return -1;
     }
-    if (0 != queue_push(rtmpc->q, item)) {
+    if (0 != queue_push(q, item)) {
         printf("queue_push failed!\n");
+        queue_item_free(q, item);
         return -1;
     }
     return 0;
 }
 
+int rtmpc_send_packet(struct rtmpc *rtmpc, struct media_packet *pkt)
+{
+    if (!rtmpc || !pkt) {
+        printf("%s invalid parament!\n", __func__);
+        return -1;
+    }
+    return push_packet(rtmpc->q, rtmpc->flv, pkt);
+}
+
 static void *rtmpc_stream_thread(struct thread *t, void *arg)
 {
     struct media_packet *pkt;
     struct rtmpc *rtmpc = (struct rtmpc *)arg;
+    RTMP *base = (RTMP *)rtmpc->base;
+    size_t backlog;
     queue_flush(rtmpc->q);
+    rtmpc_congest_reset(rtmpc->congest, !!rtmpc->flv->video);
     rtmpc->is_run = true;
     while (rtmpc->is_run) {
-        struct queue_item *it = queue_pop(rtmpc->q);
+        /* wakes on push at once, the timeout only bounds noticing stop */
+        struct queue_item *it = queue_pop_wait(rtmpc->q, RTMPC_POP_WAIT_MS);
         if (!it) {
-            usleep(200000);
             continue;
         }
         pkt = (struct media_packet *)it->opaque.iov_base;
-        flv_write_packet(rtmpc->flv, pkt);
+        /* RTMP_Write blocks, so the backlog piles up in q */
+        backlog = queue_get_bytes(rtmpc->q) + rtmpc_sock_notsent(base->m_sb.sb_socket);
+        if (!rtmpc_congest_drop(rtmpc->congest, pkt, backlog)) {
+            flv_write_packet(rtmpc->flv, pkt);
+            rtmpc->bytes_sent += media_packet_get_size(pkt);
+        }
         queue_item_free(rtmpc->q, it);
+        report_bitrate(rtmpc, rtmpc->bytes_sent, base->m_sb.sb_socket);
     }
     return NULL;
 }
 
+/*
+ * flv tag body of a packet, described once and chunked by reference into
+ * the write queue of each conn it goes to. cnt is -1 if the packet has to
+ * be muxed and copied by flv_write_packet
+ */
+struct rtmpc_tag {
+    uint8_t type;
+    uint32_t ts;
+    int cnt;
+    uint8_t hdr[FLV_VIDEO_TAG_HDR_MAX + 4 * RTMPC_NAL_MAX];
+    struct iovec iov[1 + 2 * RTMPC_NAL_MAX];
+};
+
+static void tag_describe(struct flv_muxer *flv, struct media_packet *pkt, struct rtmpc_tag *tag)
+{
+    switch (pkt->type) {
+    case MEDIA_TYPE_VIDEO:
+        tag->type = RTMP_PACKET_TYPE_VIDEO;
+        tag->cnt = flv_video_tag_iov(flv, pkt->video, &tag->ts, tag->hdr,
+                                     sizeof(tag->hdr), tag->iov, ARRAY_SIZE(tag->iov));
+        break;
+    case MEDIA_TYPE_AUDIO:
+        tag->type = RTMP_PACKET_TYPE_AUDIO;
+        tag->cnt = flv_audio_tag_iov(flv, pkt->audio, &tag->ts, tag->hdr,
+                                     sizeof(tag->hdr), tag->iov, ARRAY_SIZE(tag->iov));
+        break;
+    default:
+        tag->cnt = -1;
+        break;
+    }
+}
+
+/*
+ * called in loop thread, the packet held by it goes to the write queue of
+ * conn, which is flushed once for all of them. once the headers are out
+ * only tag and chunk headers are written, the payload is referenced and
+ * it is held until the socket took the message
+ */
+static void async_write_packet(struct rtmpc *rtmpc, struct queue *q, struct queue_item *it,
+                               struct rtmpc_tag *tag, size_t notsent)
+{
+    struct rtmpc_conn *c = rtmpc->conn;
+    struct media_packet *pkt = (struct media_packet *)it->opaque.iov_base;
+    RTMP *base = (RTMP *)rtmpc->base;
+
+    TRACE_SCOPE("rtmpc", "write_packet");
+    if (!rtmpc_conn_ready(c)) {
+        return;
+    }
+    if (pkt->type == MEDIA_TYPE_VIDEO) {
+        TRACE_FLOW_END("packet", "packet", pkt->video->pts);
+    }
+    if (rtmpc_congest_drop(rtmpc->congest, pkt, rtmpc_conn_pending(c) + notsent)) {
+        return;
+    }
+    if (tag->cnt > 0 && !rtmpc->flv->is_header) {
+        if (0 == rtmpc_conn_sendv(c, RTMPC_CSID_TAG, tag->type, tag->ts,
+                                  base->Link.streams[0].id, tag->iov, tag->cnt,
+                                  queue_item_get(it))) {
+            return;
+        }
+        queue_item_free(q, it);
+    }
+    flv_write_packet(rtmpc->flv, pkt);
+    rtmpc_conn_commit(c);
+}
+
+static void async_flush(struct rtmpc *rtmpc)
+{
+    struct rtmpc_conn *c = rtmpc->conn;
+
+    rtmpc_conn_flush(c);
+    if (rtmpc_conn_ready(c)) {
+        report_bitrate(rtmpc, c->bytes_sent, c->fd);
+    }
+}
+
+/* a new connection starts over with headers at a key frame */
+static void async_reset(struct rtmpc *rtmpc)
+{
+    rtmpc->flv->is_header = true;
+    rtmpc->flv->is_keyframe_got = false;
+    rtmpc_congest_reset(rtmpc->congest, !!rtmpc->flv->video);
+}
+
+static int async_open(struct rtmpc *rtmpc)
+{
+    RTMP *base = (RTMP *)rtmpc->base;
+
+    async_reset(rtmpc);
+    /* RTMP_Close may drop the streams, createStream starts over at the first */
+    if (!base->Link.nStreams) {
+        RTMP_AddStream(base, NULL);
+    }
+    base->Link.curStreamIdx = 0;
+    return rtmpc_conn_open(rtmpc->conn);
+}
+
+/* queue the packets of rtmpc come from */
+static struct queue *source_queue(struct rtmpc *rtmpc)
+{
+    return rtmpc->group ? rtmpc->group->q : rtmpc->q;
+}
+
+static void replay_clear(struct rtmpc *rtmpc)
+{
+    struct queue *q = source_queue(rtmpc);
+    int i;
+
+    for (i = 0; i < rtmpc->replay_cnt; i++) {
+        queue_item_free(q, rtmpc->replay[i]);
+    }
+    rtmpc->replay_cnt = 0;
+    rtmpc->replay_bytes = 0;
+}
+
+/*
+ * keep a reference to every packet popped, sent or not. with video the
+ * buffer starts over at each key frame and is given up when the GOP
+ * outgrows it, without video the oldest packets make room
+ */
+static void replay_keep(struct rtmpc *rtmpc, struct queue_item *it)
+{
+    struct queue *q = source_queue(rtmpc);
+    struct media_packet *pkt = (struct media_packet *)it->opaque.iov_base;
+    size_t size = media_packet_get_size(pkt);
+    struct queue_item *old;
+
+    if (!rtmpc->replay_max_bytes) {
+        return;
+    }
+    if (!rtmpc->replay) {
+        rtmpc->replay = (struct queue_item **)calloc(RTMPC_REPLAY_MAX, sizeof(struct queue_item *));
+        if (!rtmpc->replay) {
+            return;
+        }
+    }
+    if (rtmpc->flv->video) {
+        if (pkt->type == MEDIA_TYPE_VIDEO && pkt->video->key_frame) {
+            replay_clear(rtmpc);
+        } else if (!rtmpc->replay_cnt) {
+            return;
+        }
+        if (rtmpc->replay_cnt == RTMPC_REPLAY_MAX ||
+            rtmpc->replay_bytes + size > rtmpc->replay_max_bytes) {
+            replay_clear(rtmpc);
+            return;
+        }
+    } else {
+        while (rtmpc->replay_cnt && (rtmpc->replay_cnt == RTMPC_REPLAY_MAX ||
+               rtmpc->replay_bytes + size > rtmpc->replay_max_bytes)) {
+            old = rtmpc->replay[0];
+            rtmpc->replay_bytes -= media_packet_get_size((struct media_packet *)old->opaque.iov_base);
+            queue_item_free(q, old);
+            rtmpc->replay_cnt--;
+            memmove(rtmpc->replay, rtmpc->replay + 1, rtmpc->replay_cnt * sizeof(struct queue_item *));
+        }
+        if (size > rtmpc->replay_max_bytes) {
+            return;
+        }
+    }
+    rtmpc->replay[rtmpc->replay_cnt++] = queue_item_get(it);
+    rtmpc->replay_bytes += size;
+}
+
+static void group_sync_timeline(struct rtmpc_group *g, struct rtmpc *rtmpc);
+
+/* publish started, the kept packets go first, led by the headers */
+static void replay_send(struct rtmpc *rtmpc)
+{
+    struct flv_muxer *flv = rtmpc->group ? rtmpc->group->flv : rtmpc->flv;
+    struct rtmpc_tag tag;
+    int i;
+
+    for (i = 0; i < rtmpc->replay_cnt; i++) {
+        tag_describe(flv, (struct media_packet *)rtmpc->replay[i]->opaque.iov_base, &tag);
+        if (rtmpc->group) {
+            group_sync_timeline(rtmpc->group, rtmpc);
+        }
+        async_write_packet(rtmpc, source_queue(rtmpc), rtmpc->replay[i], &tag, 0);
+    }
+}
+
+static void retry_schedule(struct rtmpc *rtmpc)
+{
+    if (!rtmpc->retry_max_ms) {
+        return;
+    }
+    printf("rtmpc %s reconnect in %ums\n", rtmpc->url, rtmpc->retry_ms);
+    gevent_wtimer_add(rtmpc->evbase, &rtmpc->retry, rtmpc->retry_ms, TIMER_ONESHOT);
+    rtmpc->retry_ms = MIN2(rtmpc->retry_ms * 2, rtmpc->retry_max_ms);
+}
+
+static void on_retry(struct gevent_wtimer *t, void *arg)
+{
+    struct rtmpc *rtmpc = (struct rtmpc *)arg;
+
+    if (0 != async_open(rtmpc)) {
+        retry_schedule(rtmpc);
+    }
+}
+
+/* never called for rtmpc_conn_close, so not on stop */
+static void on_conn_state(struct rtmpc_conn *c, void *ctx)
+{
+    struct rtmpc *rtmpc = (struct rtmpc *)ctx;
+
+    if (rtmpc_conn_ready(c)) {
+        rtmpc->retry_ms = RTMPC_RETRY_MIN_MS;
+        replay_send(rtmpc);
+    } else {
+        retry_schedule(rtmpc);
+    }
+}
+
+static void on_packet(int fd, void *arg)
+{
+    struct rtmpc *rtmpc = (struct rtmpc *)arg;
+    struct rtmpc_tag tag;
+    struct queue_item *it;
+    /* nothing is written until flush, notsent can only shrink meanwhile */
+    size_t notsent = rtmpc_sock_notsent(rtmpc->conn->fd);
+
+    while ((it = queue_branch_pop(rtmpc->q, RTMPC_BRANCH)) != NULL) {
+        replay_keep(rtmpc, it);
+        tag_describe(rtmpc->flv, (struct media_packet *)it->opaque.iov_base, &tag);
+        async_write_packet(rtmpc, rtmpc->q, it, &tag, notsent);
+        queue_item_free(rtmpc->q, it);
+    }
+    async_flush(rtmpc);
+}
+
+static void async_start(void *arg)
+{
+    struct rtmpc *rtmpc = (struct rtmpc *)arg;
+
+    rtmpc->retry_ms = RTMPC_RETRY_MIN_MS;
+    rtmpc->is_run = false;
+    if (0 != async_open(rtmpc)) {
+        printf("rtmpc_conn_open failed!\n");
+        goto out;
+    }
+    rtmpc->ev_packet = gevent_create(rtmpc->qb->evfd, on_packet, NULL, NULL, rtmpc);
+    if (!rtmpc->ev_packet || 0 != gevent_add(rtmpc->evbase, &rtmpc->ev_packet)) {
+        printf("gevent_add failed!\n");
+        gevent_destroy(rtmpc->ev_packet);
+        rtmpc->ev_packet = NULL;
+        rtmpc_conn_close(rtmpc->conn);
+        goto out;
+    }
+    rtmpc->is_run = true;
+out:
+    sem_lock_signal(&rtmpc->sem);
+}
+
+static void async_stop(void *arg)
+{
+    struct rtmpc *rtmpc = (struct rtmpc *)arg;
+
+    if (rtmpc->ev_packet) {
+        gevent_del(rtmpc->evbase, &rtmpc->ev_packet);
+        gevent_destroy(rtmpc->ev_packet);
+        rtmpc->ev_packet = NULL;
+    }
+    gevent_wtimer_del(rtmpc->evbase, &rtmpc->retry);
+    rtmpc_conn_close(rtmpc->conn);
+    replay_clear(rtmpc);
+    rtmpc->is_run = false;
+    sem_lock_signal(&rtmpc->sem);
+}
+
+static int rtmpc_stream_start_async(struct rtmpc *rtmpc)
+{
+    rtmpc->qb = queue_branch_new(rtmpc->q, RTMPC_BRANCH);
+    if (!rtmpc->qb) {
+        printf("queue_branch_new failed!\n");
+        return -1;
+    }
+    if (0 != gevent_base_post(rtmpc->evbase, async_start, rtmpc)) {
+        queue_branch_del(rtmpc->q, RTMPC_BRANCH);
+        rtmpc->qb = NULL;
+        return -1;
+    }
+    sem_lock_wait(&rtmpc->sem, -1);
+    if (!rtmpc->is_run) {
+        queue_branch_del(rtmpc->q, RTMPC_BRANCH);
+        rtmpc->qb = NULL;
+        return -1;
+    }
+    rtmpc->is_start = true;
+    return 0;
+}
+
+static void rtmpc_stream_stop_async(struct rtmpc *rtmpc)
+{
+    if (0 == gevent_base_post(rtmpc->evbase, async_stop, rtmpc)) {
+        sem_lock_wait(&rtmpc->sem, -1);
+    }
+    queue_branch_del(rtmpc->q, RTMPC_BRANCH);
+    rtmpc->qb = NULL;
+    rtmpc->is_start = false;
+}
+
 void rtmpc_stream_stop(struct rtmpc *rtmpc)
 {
+    if (rtmpc && rtmpc->evbase) {
+        if (rtmpc->is_start) {
+            rtmpc_stream_stop_async(rtmpc);
+        }
+        return;
+    }
     rtmpc->is_run = false;
     if (rtmpc) {
         queue_flush(rtmpc->q);
@@ -267,6 +814,9 @@ int rtmpc_stream_start(struct rtmpc *rtmpc)
         printf("rtmpc stream already start!\n");
         return -1;
     }
+    if (rtmpc->evbase) {
+        return rtmpc_stream_start_async(rtmpc);
+    }
     rtmpc->thread = thread_create(rtmpc_stream_thread, rtmpc);
     if (!rtmpc->thread) {
         rtmpc->is_start = false;
@@ -277,3 +827,235 @@ int rtmpc_stream_start(struct rtmpc *rtmpc)
     rtmpc->is_start = true;
     return 0;
 }
+
+struct rtmpc_group *rtmpc_group_create(struct gevent_base *evbase)
+{
+    struct rtmpc_group *g;
+
+    if (!evbase) {
+        printf("%s invalid parament!\n", __func__);
+        return NULL;
+    }
+    g = (struct rtmpc_group *)calloc(1, sizeof(struct rtmpc_group));
+    if (!g) {
+        printf("malloc rtmpc_group failed!\n");
+        return NULL;
+    }
+    g->flv = flv_mux_create(NULL, NULL);
+    if (!g->flv) {
+        goto failed;
+    }
+    /* only describes tags, headers are written per destination */
+    g->flv->is_header = false;
+    g->q = queue_create();
+    if (!g->q) {
+        printf("queue_create failed!\n");
+        goto failed;
+    }
+    queue_set_depth(g->q, RTMPC_QUEUE_DEPTH);
+    queue_set_mode(g->q, QUEUE_FULL_SKIP_TO_KEY);
+    queue_set_classify(g->q, item_classify);
+    queue_set_hook(g->q, item_alloc_hook_deep, item_free_hook);
+    sem_lock_init(&g->sem);
+    g->evbase = evbase;
+    return g;
+
+failed:
+    flv_mux_destroy(g->flv);
+    free(g);
+    return NULL;
+}
+
+void rtmpc_group_destroy(struct rtmpc_group *g)
+{
+    int i;
+
+    if (!g) {
+        return;
+    }
+    if (g->is_start) {
+        rtmpc_group_stop(g);
+    }
+    /* conns hold items of g->q until closed */
+    for (i = 0; i < g->ndst; i++) {
+        rtmpc_destroy(g->dst[i]);
+    }
+    queue_destroy(g->q);
+    flv_mux_destroy(g->flv);
+    sem_lock_deinit(&g->sem);
+    free(g);
+}
+
+struct rtmpc *rtmpc_group_add(struct rtmpc_group *g, const char *url)
+{
+    struct rtmpc *rtmpc;
+
+    if (!g || !url || g->is_start || g->ndst == RTMPC_GROUP_MAX) {
+        printf("%s invalid parament!\n", __func__);
+        return NULL;
+    }
+    rtmpc = rtmpc_create_async(g->evbase, url);
+    if (!rtmpc) {
+        return NULL;
+    }
+    /* payload is referenced from the queue of the group */
+    rtmpc_conn_set_release(rtmpc->conn, release_item, g->q);
+    rtmpc->group = g;
+    g->dst[g->ndst++] = rtmpc;
+    return rtmpc;
+}
+
+int rtmpc_group_stream_add(struct rtmpc_group *g, struct media_packet *pkt)
+{
+    int i;
+
+    if (!g || !pkt) {
+        return -1;
+    }
+    if (0 != flv_mux_add_media(g->flv, pkt)) {
+        return -1;
+    }
+    for (i = 0; i < g->ndst; i++) {
+        if (0 != flv_mux_add_media(g->dst[i]->flv, pkt)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int rtmpc_group_send_packet(struct rtmpc_group *g, struct media_packet *pkt)
+{
+    if (!g || !pkt) {
+        printf("%s invalid parament!\n", __func__);
+        return -1;
+    }
+    return push_packet(g->q, g->flv, pkt);
+}
+
+/*
+ * shared tags are stamped on the timeline of g->flv, a destination writing
+ * its headers must start its own muxer on the same one
+ */
+static void group_sync_timeline(struct rtmpc_group *g, struct rtmpc *rtmpc)
+{
+    if (!rtmpc->flv->is_header || !g->flv->is_keyframe_got) {
+        return;
+    }
+    if (g->flv->video && rtmpc->flv->video) {
+        rtmpc->flv->video->start_dts_offset = g->flv->video->start_dts_offset;
+        rtmpc->flv->is_keyframe_got = true;
+    }
+}
+
+static void on_group_packet(int fd, void *arg)
+{
+    struct rtmpc_group *g = (struct rtmpc_group *)arg;
+    size_t notsent[RTMPC_GROUP_MAX];
+    struct rtmpc_tag tag;
+    struct queue_item *it;
+    int i;
+
+    for (i = 0; i < g->ndst; i++) {
+        notsent[i] = rtmpc_sock_notsent(g->dst[i]->conn->fd);
+    }
+    while ((it = queue_branch_pop(g->q, RTMPC_BRANCH)) != NULL) {
+        /* mux once, every destination sends the same payload */
+        tag_describe(g->flv, (struct media_packet *)it->opaque.iov_base, &tag);
+        for (i = 0; i < g->ndst; i++) {
+            replay_keep(g->dst[i], it);
+            group_sync_timeline(g, g->dst[i]);
+            async_write_packet(g->dst[i], g->q, it, &tag, notsent[i]);
+        }
+        queue_item_free(g->q, it);
+    }
+    for (i = 0; i < g->ndst; i++) {
+        async_flush(g->dst[i]);
+    }
+}
+
+static void group_start(void *arg)
+{
+    struct rtmpc_group *g = (struct rtmpc_group *)arg;
+    int i;
+
+    g->flv->is_keyframe_got = false;
+    /* a destination that can't connect doesn't hold back the others */
+    for (i = 0; i < g->ndst; i++) {
+        g->dst[i]->retry_ms = RTMPC_RETRY_MIN_MS;
+        if (0 != async_open(g->dst[i])) {
+            printf("rtmpc_conn_open %s failed!\n", g->dst[i]->url);
+            retry_schedule(g->dst[i]);
+        }
+    }
+    g->ev_packet = gevent_create(g->qb->evfd, on_group_packet, NULL, NULL, g);
+    if (!g->ev_packet || 0 != gevent_add(g->evbase, &g->ev_packet)) {
+        printf("gevent_add failed!\n");
+        gevent_destroy(g->ev_packet);
+        g->ev_packet = NULL;
+        for (i = 0; i < g->ndst; i++) {
+            gevent_wtimer_del(g->evbase, &g->dst[i]->retry);
+            rtmpc_conn_close(g->dst[i]->conn);
+        }
+        g->is_run = false;
+    } else {
+        g->is_run = true;
+    }
+    sem_lock_signal(&g->sem);
+}
+
+static void group_stop(void *arg)
+{
+    struct rtmpc_group *g = (struct rtmpc_group *)arg;
+    int i;
+
+    if (g->ev_packet) {
+        gevent_del(g->evbase, &g->ev_packet);
+        gevent_destroy(g->ev_packet);
+        g->ev_packet = NULL;
+    }
+    for (i = 0; i < g->ndst; i++) {
+        gevent_wtimer_del(g->evbase, &g->dst[i]->retry);
+        rtmpc_conn_close(g->dst[i]->conn);
+        replay_clear(g->dst[i]);
+    }
+    g->is_run = false;
+    sem_lock_signal(&g->sem);
+}
+
+int rtmpc_group_start(struct rtmpc_group *g)
+{
+    if (!g || g->is_start || !g->ndst) {
+        return -1;
+    }
+    g->qb = queue_branch_new(g->q, RTMPC_BRANCH);
+    if (!g->qb) {
+        printf("queue_branch_new failed!\n");
+        return -1;
+    }
+    if (0 != gevent_base_post(g->evbase, group_start, g)) {
+        queue_branch_del(g->q, RTMPC_BRANCH);
+        g->qb = NULL;
+        return -1;
+    }
+    sem_lock_wait(&g->sem, -1);
+    if (!g->is_run) {
+        queue_branch_del(g->q, RTMPC_BRANCH);
+        g->qb = NULL;
+        return -1;
+    }
+    g->is_start = true;
+    return 0;
+}
+
+void rtmpc_group_stop(struct rtmpc_group *g)
+{
+    if (!g || !g->is_start) {
+        return;
+    }
+    if (0 == gevent_base_post(g->evbase, group_stop, g)) {
+        sem_lock_wait(&g->sem, -1);
+    }
+    queue_branch_del(g->q, RTMPC_BRANCH);
+    g->qb = NULL;
+    g->is_start = false;
+}
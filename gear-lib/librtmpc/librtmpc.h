@@ -26,6 +26,7 @@
 #include <libqueue.h>
 #include <libthread.h>
 #include <libmedia-io.h>
+#include <libgevent.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdbool.h>
@@ -46,14 +47,41 @@ struct rtmp_url {
 
 };
 
+struct rtmpc;
+struct rtmpc_conn;
+struct rtmpc_congest;
+struct rtmpc_group;
+
+/* suggested encoder bitrate, called in the thread sending packets */
+typedef void (rtmpc_bitrate_cb)(struct rtmpc *rtmpc, uint32_t kbps, void *arg);
+
 struct rtmpc {
     void *base;
     struct flv_muxer *flv;
     struct queue *q;
     struct thread *thread;
+    struct gevent_base *evbase;     /* event-driven mode if not NULL */
+    char *url;                      /* RTMP_SetupURL points into it */
+    char *tcurl;                    /* built by RTMP_SetupURL, kept across close */
+    struct rtmpc_conn *conn;
+    struct queue_branch *qb;
+    struct gevent *ev_packet;
+    sem_lock_t sem;
     bool is_run;
     bool is_start;
     bool sent_headers;
+    struct rtmpc_congest *congest;
+    rtmpc_bitrate_cb *bitrate_cb;
+    void *bitrate_arg;
+    uint64_t bytes_sent;            /* thread mode, payload written */
+    struct rtmpc_group *group;      /* set on a destination of a group */
+    struct gevent_wtimer retry;
+    uint32_t retry_ms;              /* delay of the next reconnect */
+    uint32_t retry_max_ms;          /* 0 never reconnects */
+    struct queue_item **replay;     /* packets since the last key frame */
+    int replay_cnt;
+    size_t replay_bytes;
+    size_t replay_max_bytes;        /* 0 keeps nothing */
 };
 
 GEAR_API struct rtmpc *rtmpc_create(const char *push_url);
@@ -64,6 +92,64 @@ GEAR_API void rtmpc_stream_stop(struct rtmpc *rtmpc);
 GEAR_API int rtmpc_send_packet(struct rtmpc *rtmpc, struct media_packet *pkt);
 GEAR_API void rtmpc_destroy(struct rtmpc *rtmpc);
 
+/*
+ * event-driven publisher: no thread per rtmpc, connect, handshake and
+ * publish run nonblocking in the loop thread of evbase, which can be
+ * shared by many rtmpc. rtmpc_send_packet only queues the packet.
+ * start/stop/destroy wait for the loop, don't call them in loop thread
+ */
+GEAR_API struct rtmpc *rtmpc_create_async(struct gevent_base *evbase, const char *push_url);
+/*
+ * budget of bytes waiting to leave, queued and unsent by tcp. past 1/4 of
+ * it B frames are dropped, past 1/2 P frames until the next IDR, past all
+ * of it audio as well
+ */
+GEAR_API int rtmpc_set_queue_bytes(struct rtmpc *rtmpc, size_t max_bytes);
+/* cb is told a target bitrate when the uplink is congested or recovers */
+GEAR_API int rtmpc_set_bitrate_cb(struct rtmpc *rtmpc, rtmpc_bitrate_cb *cb, void *arg);
+/*
+ * a lost connection is opened again after 500ms, doubling up to max_ms
+ * while it keeps failing, 0 disables it. packets from the last key frame
+ * are kept, up to max_bytes, and sent first with the headers once publish
+ * starts again, 0 keeps none and waits for the next key frame instead
+ */
+GEAR_API int rtmpc_set_reconnect(struct rtmpc *rtmpc, uint32_t max_ms);
+GEAR_API int rtmpc_set_replay_bytes(struct rtmpc *rtmpc, size_t max_bytes);
+
+#define RTMPC_GROUP_MAX     8
+
+/*
+ * one packet stream published to many destinations. packets are queued
+ * once and their flv tags described once, each destination chunks the
+ * same payload by reference. a destination is an event-driven rtmpc with
+ * its own connection, drop policy and bitrate callback, a slow or dead
+ * one only drops its own frames
+ */
+struct rtmpc_group {
+    struct gevent_base *evbase;
+    struct flv_muxer *flv;          /* describes tags, never writes */
+    struct queue *q;
+    struct queue_branch *qb;
+    struct gevent *ev_packet;
+    struct rtmpc *dst[RTMPC_GROUP_MAX];
+    int ndst;
+    sem_lock_t sem;
+    bool is_run;
+    bool is_start;
+};
+
+GEAR_API struct rtmpc_group *rtmpc_group_create(struct gevent_base *evbase);
+/*
+ * add destinations before rtmpc_group_stream_add and start. the returned
+ * rtmpc takes per destination settings, don't start or send on it
+ */
+GEAR_API struct rtmpc *rtmpc_group_add(struct rtmpc_group *g, const char *push_url);
+GEAR_API int rtmpc_group_stream_add(struct rtmpc_group *g, struct media_packet *pkt);
+GEAR_API int rtmpc_group_start(struct rtmpc_group *g);
+GEAR_API void rtmpc_group_stop(struct rtmpc_group *g);
+GEAR_API int rtmpc_group_send_packet(struct rtmpc_group *g, struct media_packet *pkt);
+GEAR_API void rtmpc_group_destroy(struct rtmpc_group *g);
+
 
 #ifdef __cplusplus
 }
@@ -1203,6 +1203,33 @@ RTMP_Connect(RTMP *r, RTMPPacket *cp)
     return RTMP_Connect1(r, cp);
 }
 
+/* resolve server address only, for callers driving a nonblocking socket */
+int
+RTMP_ResolveAddr(RTMP *r, struct sockaddr_storage *service, socklen_t *addrlen)
+{
+    int socket_error = 0;
+
+    if (!r->Link.hostname.av_len)
+        return FALSE;
+
+    memset(service, 0, sizeof(*service));
+    if (!add_addr_info(service, addrlen, &r->Link.hostname, r->Link.port,
+                       r->m_bindIP.addrLen, &socket_error))
+    {
+        r->last_error_code = socket_error;
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/* connect invoke without handshake, socket must be handshaked by caller */
+int
+RTMP_SendConnect(RTMP *r, RTMPPacket *cp)
+{
+    r->m_bSendCounter = TRUE;
+    return SendConnectPacket(r, cp);
+}
+
 static int
 SocksNegotiate(RTMP *r)
 {
@@ -1742,6 +1769,7 @@ SendConnectPacket(RTMP *r, RTMPPacket *cp)
     RTMPPacket packet;
     char pbuf[4096], *pend = pbuf + sizeof(pbuf);
     char *enc;
+    AMFWriter w;
 
     if (cp)
         return RTMP_SendPacket(r, cp, TRUE);
@@ -1772,85 +1800,45 @@ SendConnectPacket(RTMP *r, RTMPPacket *cp)
     packet.m_hasAbsTimestamp = 0;
     packet.m_body = pbuf + RTMP_MAX_HEADER_SIZE;
 
-    enc = packet.m_body;
-    enc = AMF_EncodeString(enc, pend, &av_connect);
-    enc = AMF_EncodeNumber(enc, pend, ++r->m_numInvokes);
-    *enc++ = AMF_OBJECT;
-
-    enc = AMF_EncodeNamedString(enc, pend, &av_app, &r->Link.app);
-    if (!enc)
-        return FALSE;
+    AMFW_Init(&w, packet.m_body, pend - packet.m_body);
+    AMFW_String(&w, &av_connect);
+    AMFW_Number(&w, ++r->m_numInvokes);
+    AMFW_ObjectStart(&w);
+    AMFW_NamedString(&w, &av_app, &r->Link.app);
     if (r->Link.protocol & RTMP_FEATURE_WRITE)
-    {
-        enc = AMF_EncodeNamedString(enc, pend, &av_type, &av_nonprivate);
-        if (!enc)
-            return FALSE;
-    }
+        AMFW_NamedString(&w, &av_type, &av_nonprivate);
     if (r->Link.flashVer.av_len)
-    {
-        enc = AMF_EncodeNamedString(enc, pend, &av_flashVer, &r->Link.flashVer);
-        if (!enc)
-            return FALSE;
-    }
+        AMFW_NamedString(&w, &av_flashVer, &r->Link.flashVer);
     if (r->Link.swfUrl.av_len)
-    {
-        enc = AMF_EncodeNamedString(enc, pend, &av_swfUrl, &r->Link.swfUrl);
-        if (!enc)
-            return FALSE;
-    }
+        AMFW_NamedString(&w, &av_swfUrl, &r->Link.swfUrl);
     if (r->Link.tcUrl.av_len)
-    {
-        enc = AMF_EncodeNamedString(enc, pend, &av_tcUrl, &r->Link.tcUrl);
-        if (!enc)
-            return FALSE;
-    }
+        AMFW_NamedString(&w, &av_tcUrl, &r->Link.tcUrl);
     if (!(r->Link.protocol & RTMP_FEATURE_WRITE))
     {
-        enc = AMF_EncodeNamedBoolean(enc, pend, &av_fpad, FALSE);
-        if (!enc)
-            return FALSE;
-        enc = AMF_EncodeNamedNumber(enc, pend, &av_capabilities, 15.0);
-        if (!enc)
-            return FALSE;
-        enc = AMF_EncodeNamedNumber(enc, pend, &av_audioCodecs, r->m_fAudioCodecs);
-        if (!enc)
-            return FALSE;
-        enc = AMF_EncodeNamedNumber(enc, pend, &av_videoCodecs, r->m_fVideoCodecs);
-        if (!enc)
-            return FALSE;
-        enc = AMF_EncodeNamedNumber(enc, pend, &av_videoFunction, 1.0);
-        if (!enc)
-            return FALSE;
+        AMFW_NamedBoolean(&w, &av_fpad, FALSE);
+        AMFW_NamedNumber(&w, &av_capabilities, 15.0);
+        AMFW_NamedNumber(&w, &av_audioCodecs, r->m_fAudioCodecs);
+        AMFW_NamedNumber(&w, &av_videoCodecs, r->m_fVideoCodecs);
+        AMFW_NamedNumber(&w, &av_videoFunction, 1.0);
         if (r->Link.pageUrl.av_len)
-        {
-            enc = AMF_EncodeNamedString(enc, pend, &av_pageUrl, &r->Link.pageUrl);
-            if (!enc)
-                return FALSE;
-        }
+            AMFW_NamedString(&w, &av_pageUrl, &r->Link.pageUrl);
     }
     if (r->m_fEncoding != 0.0 || r->m_bSendEncoding)
     {
         /* AMF0, AMF3 not fully supported yet */
-        enc = AMF_EncodeNamedNumber(enc, pend, &av_objectEncoding, r->m_fEncoding);
-        if (!enc)
-            return FALSE;
+        AMFW_NamedNumber(&w, &av_objectEncoding, r->m_fEncoding);
     }
-    if (enc + 3 >= pend)
-        return FALSE;
-    *enc++ = 0;
-    *enc++ = 0;			/* end of object - 0x00 0x00 0x09 */
-    *enc++ = AMF_OBJECT_END;
+    AMFW_ObjectEnd(&w);
 
     /* add auth string */
     if (r->Link.auth.av_len)
     {
-        enc = AMF_EncodeBoolean(enc, pend, r->Link.lFlags & RTMP_LF_AUTH);
-        if (!enc)
-            return FALSE;
-        enc = AMF_EncodeString(enc, pend, &r->Link.auth);
-        if (!enc)
-            return FALSE;
+        AMFW_Boolean(&w, r->Link.lFlags & RTMP_LF_AUTH);
+        AMFW_String(&w, &r->Link.auth);
     }
+    if (AMFW_Len(&w) < 0)
+        return FALSE;
+    enc = w.w_ptr;
     if (r->Link.extras.o_num)
     {
         int i;
@@ -2279,6 +2267,12 @@ SendBytesReceived(RTMP *r)
     return RTMP_SendPacket(r, &packet, FALSE);
 }
 
+int
+RTMP_SendBytesReceived(RTMP *r)
+{
+    return SendBytesReceived(r);
+}
+
 SAVC(_checkbw);
 
 static int
@@ -3173,14 +3167,60 @@ static const AVal av_NetStream_Publish_Start = AVC("NetStream.Publish.Start");
 static const AVal av_NetStream_Publish_Rejected = AVC("NetStream.Publish.Rejected");
 static const AVal av_NetStream_Publish_Denied = AVC("NetStream.Publish.Denied");
 
+/* what HandleInvoke looks at, strings point into the packet body */
+typedef struct InvokeInfo
+{
+    AVal method;
+    double txn;
+    double arg;			/* number 4th value, createStream result */
+    int top;			/* index of the last top level value */
+    AVal code, level, description;	/* of an info object as 4th value */
+    const AVal *want;		/* string property to find at any depth */
+    AVal found;
+} InvokeInfo;
+
+static int
+InvokeVisit(void *ctx, const AMFItem *item)
+{
+    InvokeInfo *info = ctx;
+
+    if (item->i_depth == 0)
+    {
+        if (item->i_type == AMF_OBJECT_END)
+            return 0;
+        info->top = item->i_index;
+        if (item->i_index == 0 && item->i_type == AMF_STRING)
+            info->method = item->i_vu.i_aval;
+        else if (item->i_index == 1 && item->i_type == AMF_NUMBER)
+            info->txn = item->i_vu.i_number;
+        else if (item->i_index == 3 && item->i_type == AMF_NUMBER)
+            info->arg = item->i_vu.i_number;
+        return 0;
+    }
+    if (item->i_type != AMF_STRING)
+        return 0;
+    if (info->want && !info->found.av_val && AVMATCH(&item->i_name, info->want))
+        info->found = item->i_vu.i_aval;
+    if (item->i_depth == 1 && info->top == 3)
+    {
+        if (AVMATCH(&item->i_name, &av_code))
+            info->code = item->i_vu.i_aval;
+        else if (AVMATCH(&item->i_name, &av_level))
+            info->level = item->i_vu.i_aval;
+        else if (AVMATCH(&item->i_name, &av_description))
+            info->description = item->i_vu.i_aval;
+    }
+    return 0;
+}
+
 /* Returns 0 for OK/Failed/error, 1 for 'Stop or Complete' */
 static int
 HandleInvoke(RTMP *r, const char *body, unsigned int nBodySize)
 {
-    AMFObject obj;
+    InvokeInfo info = {{0, 0}};
     AVal method;
     double txn;
-    int ret = 0, nRes;
+    int ret = 0;
     if (body[0] != 0x02)		/* make sure it is a string method name we start with */
     {
         RTMP_Log(RTMP_LOGWARNING, "%s, Sanity failed. no string method in invoke packet",
@@ -3188,17 +3228,25 @@ HandleInvoke(RTMP *r, const char *body, unsigned int nBodySize)
         return 0;
     }
 
-    nRes = AMF_Decode(&obj, body, nBodySize, FALSE);
-    if (nRes < 0)
+    /* walked in place, an AMFObject is only built to dump it */
+    if (r->Link.token.av_len)
+        info.want = &av_secureToken;
+    if (AMF_Walk(body, nBodySize, InvokeVisit, &info) < 0)
     {
         RTMP_Log(RTMP_LOGERROR, "%s, error decoding invoke packet", __FUNCTION__);
         return 0;
     }
-
-    AMF_Dump(&obj);
-    AMFProp_GetString(AMF_GetProp(&obj, NULL, 0), &method);
-    txn = AMFProp_GetNumber(AMF_GetProp(&obj, NULL, 1));
-    RTMP_Log(RTMP_LOGDEBUG, "%s, server invoking <%s>", __FUNCTION__, method.av_val);
+    if (RTMP_debuglevel >= RTMP_LOGDEBUG)
+    {
+        AMFObject obj;
+        if (AMF_Decode(&obj, body, nBodySize, FALSE) >= 0)
+            AMF_Dump(&obj);
+        AMF_Reset(&obj);
+    }
+    method = info.method;
+    txn = info.txn;
+    RTMP_Log(RTMP_LOGDEBUG, "%s, server invoking <%.*s>", __FUNCTION__,
+             method.av_len, method.av_val);
 
     if (AVMATCH(&method, &av__result))
     {
@@ -3226,14 +3274,10 @@ HandleInvoke(RTMP *r, const char *body, unsigned int nBodySize)
 
         if (AVMATCH(&methodInvoked, &av_connect))
         {
-            if (r->Link.token.av_len)
+            if (r->Link.token.av_len && info.found.av_val)
             {
-                AMFObjectProperty p;
-                if (RTMP_FindFirstMatchingProperty(&obj, &av_secureToken, &p))
-                {
-                    DecodeTEA(&r->Link.token, &p.p_vu.p_aval);
-                    SendSecureTokenResponse(r, &p.p_vu.p_aval);
-                }
+                DecodeTEA(&r->Link.token, &info.found);
+                SendSecureTokenResponse(r, &info.found);
             }
             if (r->Link.protocol & RTMP_FEATURE_WRITE)
             {
@@ -3268,7 +3312,7 @@ HandleInvoke(RTMP *r, const char *body, unsigned int nBodySize)
         }
         else if (AVMATCH(&methodInvoked, &av_createStream))
         {
-            int id = (int)AMFProp_GetNumber(AMF_GetProp(&obj, NULL, 3));
+            int id = (int)info.arg;
             r->Link.streams[r->Link.curStreamIdx].id = id;
 
             if (r->Link.protocol & RTMP_FEATURE_WRITE)
@@ -3352,13 +3396,9 @@ HandleInvoke(RTMP *r, const char *body, unsigned int nBodySize)
 
             if (AVMATCH(&methodInvoked, &av_connect))
             {
-                AMFObject obj2;
-                AVal code, level, description;
-                AMFProp_GetObject(AMF_GetProp(&obj, NULL, 3), &obj2);
-                AMFProp_GetString(AMF_GetProp(&obj2, &av_code, -1), &code);
-                AMFProp_GetString(AMF_GetProp(&obj2, &av_level, -1), &level);
-                AMFProp_GetString(AMF_GetProp(&obj2, &av_description, -1), &description);
-                RTMP_Log(RTMP_LOGDEBUG, "%s, error description: %s", __FUNCTION__, description.av_val);
+                AVal description = info.description;
+                RTMP_Log(RTMP_LOGDEBUG, "%s, error description: %.*s", __FUNCTION__,
+                         description.av_len, description.av_val);
                 /* if PublisherAuth returns 1, then reconnect */
                 if (PublisherAuth(r, &description) == 1)
                 {
@@ -3409,14 +3449,9 @@ HandleInvoke(RTMP *r, const char *body, unsigned int nBodySize)
     }
     else if (AVMATCH(&method, &av_onStatus))
     {
-        AMFObject obj2;
-        AVal code, level, description;
-        AMFProp_GetObject(AMF_GetProp(&obj, NULL, 3), &obj2);
-        AMFProp_GetString(AMF_GetProp(&obj2, &av_code, -1), &code);
-        AMFProp_GetString(AMF_GetProp(&obj2, &av_level, -1), &level);
-        AMFProp_GetString(AMF_GetProp(&obj2, &av_description, -1), &description);
+        AVal code = info.code, description = info.description;
 
-        RTMP_Log(RTMP_LOGDEBUG, "%s, onStatus: %s", __FUNCTION__, code.av_val);
+        RTMP_Log(RTMP_LOGDEBUG, "%s, onStatus: %.*s", __FUNCTION__, code.av_len, code.av_val);
         if (AVMATCH(&code, &av_NetStream_Failed)
                 || AVMATCH(&code, &av_NetStream_Play_Failed)
                 || AVMATCH(&code, &av_NetStream_Play_StreamNotFound)
@@ -3428,9 +3463,10 @@ HandleInvoke(RTMP *r, const char *body, unsigned int nBodySize)
             RTMP_Close(r);
 
             if (description.av_len)
-                RTMP_Log(RTMP_LOGERROR, "%s:\n%s (%s)", r->Link.tcUrl.av_val, code.av_val, description.av_val);
+                RTMP_Log(RTMP_LOGERROR, "%s:\n%.*s (%.*s)", r->Link.tcUrl.av_val,
+                         code.av_len, code.av_val, description.av_len, description.av_val);
             else
-                RTMP_Log(RTMP_LOGERROR, "%s:\n%s", r->Link.tcUrl.av_val, code.av_val);
+                RTMP_Log(RTMP_LOGERROR, "%s:\n%.*s", r->Link.tcUrl.av_val, code.av_len, code.av_val);
         }
 
         else if (AVMATCH(&code, &av_NetStream_Play_Start)
@@ -3502,7 +3538,6 @@ HandleInvoke(RTMP *r, const char *body, unsigned int nBodySize)
 
     }
 leave:
-    AMF_Reset(&obj);
     return ret;
 }
 
@@ -4458,7 +4493,9 @@ RTMP_Close(RTMP *r)
             r->m_clientID.av_val = NULL;
             r->m_clientID.av_len = 0;
         }
-        RTMPSockBuf_Close(&r->m_sb);
+        /* with custom send the socket belongs to whoever installed it */
+        if (!r->m_bCustomSend)
+            RTMPSockBuf_Close(&r->m_sb);
     }
 
     for (idx = 0; idx < r->Link.nStreams; idx++)
@@ -360,6 +360,10 @@ extern "C"
     struct sockaddr;
     int RTMP_Connect0(RTMP *r, struct sockaddr *svc, socklen_t addrlen);
     int RTMP_Connect1(RTMP *r, RTMPPacket *cp);
+    int RTMP_ResolveAddr(RTMP *r, struct sockaddr_storage *service,
+                         socklen_t *addrlen);
+    int RTMP_SendConnect(RTMP *r, RTMPPacket *cp);
+    int RTMP_SendBytesReceived(RTMP *r);
     int RTMP_Serve(RTMP *r);
     int RTMP_TLS_Accept(RTMP *r, void *ctx);
 
@@ -0,0 +1,317 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#include "rtmpc_congest.h"
+#include <libposix.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined (OS_LINUX)
+#include <sys/ioctl.h>
+#include <linux/sockios.h>
+#endif
+
+static uint64_t now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* exp-golomb ue(v) at bit offset *pos, -1 if it runs past the end */
+static int read_ue(const uint8_t *p, size_t size, size_t *pos)
+{
+    size_t bits = size * 8;
+    uint32_t val = 0;
+    int zeros = 0;
+    int i;
+
+    while (*pos < bits && !(p[*pos >> 3] & (0x80 >> (*pos & 7)))) {
+        if (++zeros > 24) {
+            return -1;
+        }
+        (*pos)++;
+    }
+    if (*pos + zeros >= bits) {
+        return -1;
+    }
+    (*pos)++;
+    for (i = 0; i < zeros; i++, (*pos)++) {
+        val = (val << 1) | !!(p[*pos >> 3] & (0x80 >> (*pos & 7)));
+    }
+    return (int)((1u << zeros) - 1 + val);
+}
+
+/*
+ * type of the first slice of an annexb h264 access unit. a B frame is only
+ * reported when nal_ref_idc is 0, a referenced B is as costly to lose as a
+ * P. emulation prevention bytes are ignored, they can't occur within the
+ * first two fields of a slice header
+ */
+static enum video_packet_type avc_frame_type(const uint8_t *data, size_t size)
+{
+    const uint8_t *p = data, *end = data + size;
+    size_t pos;
+    int first_mb, slice_type;
+
+    while (p + 3 < end) {
+        if (p[0] || p[1] || p[2] != 1) {
+            p++;
+            continue;
+        }
+        p += 3;
+        switch (p[0] & 0x1F) {
+        case H264_NAL_IDR_SLICE:
+            return H26X_FRAME_IDR;
+        case H264_NAL_SLICE:
+            pos = 8;
+            first_mb = read_ue(p, end - p, &pos);
+            slice_type = read_ue(p, end - p, &pos);
+            if (first_mb < 0 || slice_type < 0) {
+                return H26X_FRAME_UNKNOWN;
+            }
+            switch (slice_type % 5) {
+            case 1:
+                return (p[0] & 0x60) ? H26X_FRAME_P : H26X_FRAME_B;
+            case 2:
+            case 4:
+                return H26X_FRAME_I;
+            default:
+                return H26X_FRAME_P;
+            }
+        default:
+            break;
+        }
+    }
+    return H26X_FRAME_UNKNOWN;
+}
+
+static enum video_packet_type frame_type(struct video_packet *vp)
+{
+    enum video_packet_type type;
+
+    if (vp->key_frame) {
+        return H26X_FRAME_IDR;
+    }
+    type = avc_frame_type(vp->data, vp->size);
+    if (type == H26X_FRAME_UNKNOWN) {
+        type = vp->type;
+    }
+    /* not a key frame whatever the encoder says */
+    return type == H26X_FRAME_IDR ? H26X_FRAME_I : type;
+}
+
+struct rtmpc_congest *rtmpc_congest_create(void)
+{
+    struct rtmpc_congest *cg = CALLOC(1, struct rtmpc_congest);
+    if (!cg) {
+        printf("malloc rtmpc_congest failed!\n");
+        return NULL;
+    }
+    cg->max_bytes = RTMPC_CONGEST_BYTES;
+    return cg;
+}
+
+void rtmpc_congest_destroy(struct rtmpc_congest *cg)
+{
+    free(cg);
+}
+
+void rtmpc_congest_reset(struct rtmpc_congest *cg, bool has_video)
+{
+    size_t max_bytes = cg->max_bytes;
+
+    memset(cg, 0, sizeof(*cg));
+    cg->max_bytes = max_bytes;
+    cg->has_video = has_video;
+}
+
+static enum rtmpc_congest_level congest_level(struct rtmpc_congest *cg, size_t backlog)
+{
+    if (backlog >= cg->max_bytes) {
+        return RTMPC_CONGEST_FULL;
+    } else if (backlog >= cg->max_bytes / 2) {
+        return RTMPC_CONGEST_HEAVY;
+    } else if (backlog >= cg->max_bytes / 4) {
+        return RTMPC_CONGEST_LIGHT;
+    }
+    return RTMPC_CONGEST_NONE;
+}
+
+static bool drop_audio(struct rtmpc_congest *cg)
+{
+    if (!cg->started) {
+        /* with video the flv headers are built from the first key frame */
+        if (cg->has_video) {
+            return true;
+        }
+        cg->started = true;
+    }
+    if (cg->level == RTMPC_CONGEST_FULL) {
+        cg->dropped_audio++;
+        return true;
+    }
+    return false;
+}
+
+static bool drop_video(struct rtmpc_congest *cg, struct video_packet *vp)
+{
+    enum video_packet_type type = frame_type(vp);
+
+    if (type == H26X_FRAME_IDR) {
+        if (cg->level == RTMPC_CONGEST_FULL) {
+            cg->wait_key = true;
+            cg->dropped_p++;
+            return true;
+        }
+        cg->started = true;
+        cg->wait_key = false;
+        return false;
+    }
+    if (!cg->started) {
+        return true;
+    }
+    if (!cg->wait_key) {
+        switch (cg->level) {
+        case RTMPC_CONGEST_FULL:
+        case RTMPC_CONGEST_HEAVY:
+            /* frames after a dropped one miss their reference */
+            cg->wait_key = true;
+            break;
+        case RTMPC_CONGEST_LIGHT:
+            if (type != H26X_FRAME_B) {
+                return false;
+            }
+            cg->dropped_b++;
+            return true;
+        default:
+            return false;
+        }
+    }
+    if (type == H26X_FRAME_B) {
+        cg->dropped_b++;
+    } else {
+        cg->dropped_p++;
+    }
+    return true;
+}
+
+bool rtmpc_congest_drop(struct rtmpc_congest *cg, struct media_packet *pkt, size_t backlog)
+{
+    bool drop;
+
+    cg->level = congest_level(cg, backlog);
+    switch (pkt->type) {
+    case MEDIA_TYPE_AUDIO:
+        cg->bytes_in += pkt->audio->size;
+        drop = drop_audio(cg);
+        break;
+    case MEDIA_TYPE_VIDEO:
+        cg->bytes_in += pkt->video->size;
+        drop = drop_video(cg, pkt->video);
+        break;
+    default:
+        return true;
+    }
+    if (drop) {
+        cg->dropped++;
+    }
+    return drop;
+}
+
+uint32_t rtmpc_congest_update(struct rtmpc_congest *cg, uint64_t delivered)
+{
+    uint64_t now = now_ms();
+    uint64_t dt, out_kbps, in_kbps, cap;
+    uint32_t target, diff;
+    bool congested;
+
+    if (!cg->win_start || delivered < cg->win_delivered) {
+        goto next_window;
+    }
+    dt = now - cg->win_start;
+    if (dt < RTMPC_CONGEST_WINDOW_MS) {
+        return 0;
+    }
+    /* bytes per ms * 8 is kbps */
+    out_kbps = (delivered - cg->win_delivered) * 8 / dt;
+    in_kbps = (cg->bytes_in - cg->win_in) * 8 / dt;
+    congested = cg->level != RTMPC_CONGEST_NONE || cg->dropped != cg->win_dropped;
+
+    if (congested) {
+        /* what the link carried, with headroom to drain the backlog */
+        target = out_kbps * 85 / 100;
+        if (in_kbps && target > in_kbps) {
+            target = in_kbps;
+        }
+        if (target < RTMPC_CONGEST_MIN_KBPS) {
+            target = RTMPC_CONGEST_MIN_KBPS;
+        }
+    } else if (cg->target_kbps) {
+        /*
+         * probe upward slowly, but not far above what the encoder makes
+         * now, a static scene under target says nothing about the link
+         */
+        target = cg->target_kbps;
+        cap = in_kbps * 125 / 100;
+        if (target < cap) {
+            target = target * 105 / 100 + 1;
+            if (target > cap) {
+                target = cap;
+            }
+        }
+    } else {
+        /* never congested, nothing to suggest */
+        goto next_window;
+    }
+    cg->target_kbps = target;
+
+next_window:
+    cg->win_start = now;
+    cg->win_delivered = delivered;
+    cg->win_in = cg->bytes_in;
+    cg->win_dropped = cg->dropped;
+
+    target = cg->target_kbps;
+    if (!target) {
+        return 0;
+    }
+    diff = target > cg->reported_kbps ? target - cg->reported_kbps
+                                      : cg->reported_kbps - target;
+    /* 5% steps are enough, don't make the encoder reconfigure each window */
+    if (cg->reported_kbps && diff * 20 < cg->reported_kbps) {
+        return 0;
+    }
+    cg->reported_kbps = target;
+    return target;
+}
+
+size_t rtmpc_sock_notsent(int fd)
+{
+#if defined (OS_LINUX) && defined (SIOCOUTQNSD)
+    int n = 0;
+    if (fd >= 0 && 0 == ioctl(fd, SIOCOUTQNSD, &n) && n > 0) {
+        return (size_t)n;
+    }
+#endif
+    return 0;
+}
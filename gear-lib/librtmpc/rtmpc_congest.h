@@ -0,0 +1,95 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#ifndef RTMPC_CONGEST_H
+#define RTMPC_CONGEST_H
+
+#include <libmedia-io.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * rtmpc_congest decides which frames to drop when the uplink can't keep
+ * up, and estimates a bitrate the encoder should switch to. backlog is
+ * the bytes waiting to leave: queued in rtmpc plus not yet sent by tcp.
+ * the deeper the backlog, the more is dropped:
+ *   light: B frames, nothing references them
+ *   heavy: P frames too, video waits for the next IDR
+ *   full:  audio too, audio is dropped last
+ */
+
+#define RTMPC_CONGEST_BYTES         (1024*1024)     /* default budget */
+#define RTMPC_CONGEST_WINDOW_MS     1000
+#define RTMPC_CONGEST_MIN_KBPS      64
+
+enum rtmpc_congest_level {
+    RTMPC_CONGEST_NONE = 0,
+    RTMPC_CONGEST_LIGHT,            /* backlog over 1/4 budget */
+    RTMPC_CONGEST_HEAVY,            /* backlog over 1/2 budget */
+    RTMPC_CONGEST_FULL,             /* backlog over budget */
+};
+
+struct rtmpc_congest {
+    size_t max_bytes;
+    enum rtmpc_congest_level level;
+    bool has_video;
+    bool started;                   /* first packet must be a key frame */
+    bool wait_key;                  /* drop video until next IDR */
+
+    uint64_t bytes_in;              /* payload offered, dropped or not */
+    uint64_t dropped;
+    uint64_t dropped_b;
+    uint64_t dropped_p;             /* any non B video */
+    uint64_t dropped_audio;
+
+    /* bitrate estimation, one window per RTMPC_CONGEST_WINDOW_MS */
+    uint64_t win_start;
+    uint64_t win_delivered;
+    uint64_t win_in;
+    uint64_t win_dropped;
+    uint32_t target_kbps;
+    uint32_t reported_kbps;
+};
+
+struct rtmpc_congest *rtmpc_congest_create(void);
+void rtmpc_congest_destroy(struct rtmpc_congest *cg);
+/* before the first packet of a stream */
+void rtmpc_congest_reset(struct rtmpc_congest *cg, bool has_video);
+/* return true if pkt should be dropped */
+bool rtmpc_congest_drop(struct rtmpc_congest *cg, struct media_packet *pkt, size_t backlog);
+/*
+ * delivered is the total bytes tcp has sent to the peer so far. return the
+ * new target kbps once it moved enough to be worth telling the encoder,
+ * 0 otherwise
+ */
+uint32_t rtmpc_congest_update(struct rtmpc_congest *cg, uint64_t delivered);
+
+/* bytes in socket send buffer not yet sent, 0 if unknown */
+size_t rtmpc_sock_notsent(int fd);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
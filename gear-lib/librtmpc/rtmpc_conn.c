@@ -0,0 +1,839 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#include "rtmpc_conn.h"
+#include <libsock.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#define RTMPC_CONN_READ_CHUNK   (16*1024)
+#define RTMPC_CONN_STAGE_MIN    4096
+
+static const int chunk_hdr_size[4] = {11, 7, 3, 0};
+
+static void conn_fail(struct rtmpc_conn *c, int err, const char *why)
+{
+    if (c->state == RTMPC_CONN_CLOSED) {
+        return;
+    }
+    printf("rtmpc_conn fd=%d %s failed: %s\n", c->fd, why, strerror(err));
+    c->err = err;
+    rtmpc_conn_close(c);
+    if (c->on_state) {
+        c->on_state(c, c->state_ctx);
+    }
+}
+
+static int conn_update_events(struct rtmpc_conn *c)
+{
+    enum gevent_flags flags = c->ev->flags;
+    if (c->state == RTMPC_CONN_CONNECTING || !list_empty(&c->wq)) {
+        flags |= EVENT_WRITE;
+    } else {
+        flags &= ~EVENT_WRITE;
+    }
+    if (flags == c->ev->flags) {
+        return 0;
+    }
+    c->ev->flags = flags;
+    return gevent_mod(c->evbase, &c->ev);
+}
+
+static int stage_append(struct rtmpc_conn *c, const void *buf, size_t len)
+{
+    uint8_t *p;
+    size_t cap = c->stage_cap ? c->stage_cap : RTMPC_CONN_STAGE_MIN;
+
+    while (cap - c->stage_len < len) {
+        cap *= 2;
+    }
+    if (cap != c->stage_cap) {
+        p = (uint8_t *)realloc(c->stage, cap);
+        if (!p) {
+            printf("realloc stage failed!\n");
+            return -1;
+        }
+        c->stage = p;
+        c->stage_cap = cap;
+    }
+    memcpy(c->stage + c->stage_len, buf, len);
+    c->stage_len += len;
+    return 0;
+}
+
+/* custom send of RTMP, WriteN never touches the socket by itself */
+static int conn_send(RTMPSockBuf *sb, const char *buf, int len, void *arg)
+{
+    struct rtmpc_conn *c = (struct rtmpc_conn *)arg;
+    if (0 != stage_append(c, buf, len)) {
+        return -1;
+    }
+    return len;
+}
+
+static void msg_free(struct rtmpc_conn *c, struct rtmpc_msg *m)
+{
+    list_del(&m->entry);
+    if (m->ref && c->release) {
+        c->release(c->release_ctx, m->ref);
+    }
+    free(m->data);
+    free(m);
+}
+
+static void wq_clear(struct rtmpc_conn *c)
+{
+    struct rtmpc_msg *m, *next;
+    list_for_each_entry_safe(m, next, &c->wq, entry) {
+        msg_free(c, m);
+    }
+    c->wq_bytes = 0;
+}
+
+int rtmpc_conn_commit(struct rtmpc_conn *c)
+{
+    struct rtmpc_msg *m;
+    if (!c || !c->stage_len) {
+        return 0;
+    }
+    m = CALLOC(1, struct rtmpc_msg);
+    if (!m) {
+        printf("malloc rtmpc_msg failed!\n");
+        return -1;
+    }
+    /* hand the stage buffer over, no copy */
+    m->data = c->stage;
+    m->one.iov_base = c->stage;
+    m->one.iov_len = c->stage_len;
+    m->iov = &m->one;
+    m->iovcnt = 1;
+    list_add_tail(&m->entry, &c->wq);
+    c->wq_bytes += c->stage_len;
+    c->stage = NULL;
+    c->stage_len = 0;
+    c->stage_cap = 0;
+    return 0;
+}
+
+/* fmt 0 or fmt 3 chunk header, return its size */
+static size_t chunk_header(uint8_t *p, int fmt, int csid, uint8_t type,
+                           uint32_t ts, uint32_t len, uint32_t stream_id)
+{
+    uint8_t *start = p;
+    uint32_t t = ts >= 0xffffff ? 0xffffff : ts;
+
+    if (csid < 64) {
+        *p++ = (fmt << 6) | csid;
+    } else if (csid < 320) {
+        *p++ = fmt << 6;
+        *p++ = csid - 64;
+    } else {
+        *p++ = (fmt << 6) | 1;
+        *p++ = (csid - 64) & 0xff;
+        *p++ = (csid - 64) >> 8;
+    }
+    if (fmt == 0) {
+        *p++ = t >> 16;
+        *p++ = t >> 8;
+        *p++ = t;
+        *p++ = len >> 16;
+        *p++ = len >> 8;
+        *p++ = len;
+        *p++ = type;
+        /* message stream id is little endian */
+        *p++ = stream_id;
+        *p++ = stream_id >> 8;
+        *p++ = stream_id >> 16;
+        *p++ = stream_id >> 24;
+    }
+    /* extended timestamp is repeated in fmt 3 chunks too */
+    if (ts >= 0xffffff) {
+        *p++ = ts >> 24;
+        *p++ = ts >> 16;
+        *p++ = ts >> 8;
+        *p++ = ts;
+    }
+    return p - start;
+}
+
+/* copy into scratch at *w, merged with the previous piece if adjacent */
+static void msg_copy(struct rtmpc_msg *m, uint8_t **w, const void *buf, size_t len)
+{
+    struct iovec *last = m->iovcnt ? &m->iov[m->iovcnt - 1] : NULL;
+
+    memcpy(*w, buf, len);
+    if (last && (uint8_t *)last->iov_base + last->iov_len == *w) {
+        last->iov_len += len;
+    } else {
+        m->iov[m->iovcnt].iov_base = *w;
+        m->iov[m->iovcnt].iov_len = len;
+        m->iovcnt++;
+    }
+    *w += len;
+}
+
+static void msg_ref(struct rtmpc_msg *m, const void *buf, size_t len)
+{
+    m->iov[m->iovcnt].iov_base = (void *)buf;
+    m->iov[m->iovcnt].iov_len = len;
+    m->iovcnt++;
+}
+
+int rtmpc_conn_sendv(struct rtmpc_conn *c, int csid, uint8_t type, uint32_t ts,
+                     uint32_t stream_id, const struct iovec *iov, int cnt, void *ref)
+{
+    uint8_t hdr[RTMP_MAX_HEADER_SIZE];
+    struct rtmpc_msg *m;
+    const uint8_t *p;
+    uint8_t *w;
+    size_t chunk, total = 0, copy = 0, nchunk, room, len, n;
+    int i, max_iov;
+
+    if (!c || !iov || cnt <= 0 || c->state == RTMPC_CONN_CLOSED) {
+        return -1;
+    }
+    for (i = 0; i < cnt; i++) {
+        total += iov[i].iov_len;
+        if (iov[i].iov_len <= RTMPC_CONN_COPY_MAX) {
+            copy += iov[i].iov_len;
+        }
+    }
+    if (!total || total > 0xffffff) {
+        return -1;
+    }
+    /* what RTMP_SendPacket staged so far goes out first */
+    if (0 != rtmpc_conn_commit(c)) {
+        return -1;
+    }
+    chunk = c->base->m_outChunkSize;
+    nchunk = (total + chunk - 1) / chunk;
+    /* each chunk after the first adds a header and may split a piece */
+    max_iov = cnt + 2 * nchunk;
+    m = (struct rtmpc_msg *)calloc(1, sizeof(*m) + max_iov * sizeof(struct iovec) +
+                                   RTMP_MAX_HEADER_SIZE + (nchunk - 1) * 7 + copy);
+    if (!m) {
+        printf("malloc rtmpc_msg failed!\n");
+        return -1;
+    }
+    m->iov = (struct iovec *)(m + 1);
+    w = (uint8_t *)(m->iov + max_iov);
+
+    n = chunk_header(hdr, 0, csid, type, ts, total, stream_id);
+    msg_copy(m, &w, hdr, n);
+    room = chunk;
+    for (i = 0; i < cnt; i++) {
+        p = (const uint8_t *)iov[i].iov_base;
+        len = iov[i].iov_len;
+        while (len) {
+            if (!room) {
+                n = chunk_header(hdr, 3, csid, type, ts, 0, 0);
+                msg_copy(m, &w, hdr, n);
+                room = chunk;
+            }
+            n = len < room ? len : room;
+            if (iov[i].iov_len <= RTMPC_CONN_COPY_MAX) {
+                msg_copy(m, &w, p, n);
+            } else {
+                msg_ref(m, p, n);
+            }
+            p += n;
+            len -= n;
+            room -= n;
+        }
+    }
+    for (i = 0; i < m->iovcnt; i++) {
+        c->wq_bytes += m->iov[i].iov_len;
+    }
+    m->ref = ref;
+    list_add_tail(&m->entry, &c->wq);
+    return 0;
+}
+
+int rtmpc_conn_set_release(struct rtmpc_conn *c, rtmpc_conn_release_cb *cb, void *ctx)
+{
+    if (!c) {
+        return -1;
+    }
+    c->release = cb;
+    c->release_ctx = ctx;
+    return 0;
+}
+
+int rtmpc_conn_set_state_cb(struct rtmpc_conn *c, rtmpc_conn_state_cb *cb, void *ctx)
+{
+    if (!c) {
+        return -1;
+    }
+    c->on_state = cb;
+    c->state_ctx = ctx;
+    return 0;
+}
+
+/* gathered write of queued messages until EAGAIN, return 0 or errno */
+static int wq_write(struct rtmpc_conn *c)
+{
+    struct iovec iov[RTMPC_CONN_IOV_MAX];
+    struct msghdr msg;
+    struct rtmpc_msg *m, *next;
+    struct iovec *v;
+    ssize_t n;
+    int cnt, i;
+
+    while (!list_empty(&c->wq)) {
+        cnt = 0;
+        list_for_each_entry(m, &c->wq, entry) {
+            for (i = m->idx; i < m->iovcnt && cnt < RTMPC_CONN_IOV_MAX; i++) {
+                iov[cnt++] = m->iov[i];
+            }
+            if (cnt == RTMPC_CONN_IOV_MAX) {
+                break;
+            }
+        }
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = cnt;
+        /* writev without SIGPIPE */
+        n = sendmsg(c->fd, &msg, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            return errno;
+        }
+        c->wq_bytes -= n;
+        c->bytes_sent += n;
+        list_for_each_entry_safe(m, next, &c->wq, entry) {
+            for (; m->idx < m->iovcnt; m->idx++) {
+                v = &m->iov[m->idx];
+                if ((size_t)n < v->iov_len) {
+                    v->iov_base = (uint8_t *)v->iov_base + n;
+                    v->iov_len -= n;
+                    n = 0;
+                    break;
+                }
+                n -= v->iov_len;
+            }
+            if (m->idx < m->iovcnt) {
+                break;
+            }
+            msg_free(c, m);
+        }
+    }
+    return 0;
+}
+
+int rtmpc_conn_flush(struct rtmpc_conn *c)
+{
+    int err;
+
+    if (!c) {
+        return -1;
+    }
+    if (0 != rtmpc_conn_commit(c)) {
+        return -1;
+    }
+    if (c->state == RTMPC_CONN_CLOSED) {
+        return -1;
+    }
+    if (c->state <= RTMPC_CONN_CONNECTING) {
+        return 0;
+    }
+    err = wq_write(c);
+    if (err) {
+        conn_fail(c, err, "send");
+        return -1;
+    }
+    return conn_update_events(c);
+}
+
+size_t rtmpc_conn_pending(struct rtmpc_conn *c)
+{
+    return c ? c->wq_bytes + c->stage_len : 0;
+}
+
+bool rtmpc_conn_ready(struct rtmpc_conn *c)
+{
+    return c && c->state == RTMPC_CONN_PUBLISHED;
+}
+
+static void conn_dispatch(struct rtmpc_conn *c, int csid, struct rtmpc_chunk_in *ci)
+{
+    RTMPPacket pkt;
+
+    memset(&pkt, 0, sizeof(pkt));
+    pkt.m_packetType = ci->type;
+    pkt.m_nChannel = csid;
+    pkt.m_nTimeStamp = ci->ts;
+    pkt.m_nInfoField2 = ci->stream_id;
+    pkt.m_nBodySize = ci->len;
+    pkt.m_nBytesRead = ci->len;
+    pkt.m_body = ci->body;
+    RTMP_ClientPacket(c->base, &pkt);
+}
+
+/*
+ * parse one chunk at p, return bytes consumed, 0 if the chunk is not
+ * complete yet, -1 on protocol error. a complete message is handed to
+ * RTMP_ClientPacket, which answers through custom send
+ */
+static int conn_chunk_parse(struct rtmpc_conn *c, const uint8_t *p, size_t len)
+{
+    struct rtmpc_chunk_in *ci;
+    uint32_t csid, ts = 0, mlen, sid, n;
+    uint8_t type;
+    size_t pos = 1;
+    bool ext;
+    int fmt;
+
+    if (len < 1) {
+        return 0;
+    }
+    fmt = p[0] >> 6;
+    csid = p[0] & 0x3f;
+    if (csid == 0) {
+        if (len < 2) {
+            return 0;
+        }
+        csid = 64 + p[1];
+        pos = 2;
+    } else if (csid == 1) {
+        if (len < 3) {
+            return 0;
+        }
+        csid = 64 + p[1] + (p[2] << 8);
+        pos = 3;
+    }
+    if (csid >= RTMPC_CONN_CSID_MAX) {
+        printf("rtmpc_conn chunk stream %u not supported\n", csid);
+        return -1;
+    }
+    ci = &c->in[csid];
+    if (len < pos + chunk_hdr_size[fmt]) {
+        return 0;
+    }
+    mlen = ci->len;
+    type = ci->type;
+    sid = ci->stream_id;
+    ext = ci->ext;
+    if (fmt < 3) {
+        ts = AMF_DecodeInt24((const char *)p + pos);
+        ext = (ts == 0xffffff);
+    }
+    if (fmt < 2) {
+        mlen = AMF_DecodeInt24((const char *)p + pos + 3);
+        type = p[pos + 6];
+    }
+    if (fmt == 0) {
+        sid = p[pos + 7] | (p[pos + 8] << 8) | (p[pos + 9] << 16) |
+              ((uint32_t)p[pos + 10] << 24);
+    }
+    pos += chunk_hdr_size[fmt];
+    if (ext) {
+        if (len < pos + 4) {
+            return 0;
+        }
+        if (fmt < 3) {
+            ts = AMF_DecodeInt32((const char *)p + pos);
+        }
+        pos += 4;
+    }
+    if (mlen > RTMPC_CONN_MSG_MAX) {
+        printf("rtmpc_conn message of %u bytes too large\n", mlen);
+        return -1;
+    }
+    if (fmt < 3 && ci->got) {
+        /* new header in the middle of a message, drop the partial one */
+        free(ci->body);
+        ci->body = NULL;
+        ci->got = 0;
+    }
+    n = MIN2(mlen - ci->got, (uint32_t)c->base->m_inChunkSize);
+    if (len < pos + n) {
+        return 0;
+    }
+
+    if (ci->got == 0) {
+        if (fmt == 0) {
+            ci->ts = ts;
+            ci->delta = ts;
+        } else if (fmt < 3) {
+            ci->delta = ts;
+            ci->ts += ts;
+        } else {
+            ci->ts += ci->delta;
+        }
+        ci->len = mlen;
+        ci->type = type;
+        ci->stream_id = sid;
+        ci->ext = ext;
+        ci->body = (char *)malloc(mlen ? mlen : 1);
+        if (!ci->body) {
+            printf("malloc chunk body failed!\n");
+            return -1;
+        }
+    }
+    memcpy(ci->body + ci->got, p + pos, n);
+    ci->got += n;
+    pos += n;
+    if (ci->got == ci->len) {
+        conn_dispatch(c, csid, ci);
+        free(ci->body);
+        ci->body = NULL;
+        ci->got = 0;
+    }
+    return (int)pos;
+}
+
+static void conn_handle_chunks(struct rtmpc_conn *c)
+{
+    RTMP *r = c->base;
+    size_t pos = 0;
+    int n;
+
+    while (c->state != RTMPC_CONN_CLOSED && pos < c->rlen) {
+        n = conn_chunk_parse(c, c->rbuf + pos, c->rlen - pos);
+        if (n < 0) {
+            conn_fail(c, EPROTO, "chunk");
+            return;
+        }
+        if (n == 0) {
+            break;
+        }
+        pos += n;
+        r->m_nBytesIn += n;
+        if (r->m_bSendCounter &&
+            r->m_nBytesIn > (r->m_nBytesInSent + r->m_nClientBW / 10)) {
+            RTMP_SendBytesReceived(r);
+        }
+        if (!RTMP_IsConnected(r)) {
+            /* server sent close or stream failed */
+            conn_fail(c, ECONNRESET, "publish");
+            return;
+        }
+        if (c->state == RTMPC_CONN_PUBLISHING && r->m_bPlaying) {
+            c->state = RTMPC_CONN_PUBLISHED;
+            gevent_wtimer_del(c->evbase, &c->timeout);
+            printf("rtmpc_conn fd=%d publish started\n", c->fd);
+            if (c->on_state) {
+                c->on_state(c, c->state_ctx);
+            }
+        }
+    }
+    if (pos > 0) {
+        memmove(c->rbuf, c->rbuf + pos, c->rlen - pos);
+        c->rlen -= pos;
+    }
+}
+
+static void conn_handle_handshake(struct rtmpc_conn *c)
+{
+    const size_t need = 1 + 2 * RTMPC_CONN_SIG_SIZE;
+    const uint8_t *s1 = c->rbuf + 1;
+
+    if (c->rlen < need) {
+        return;
+    }
+    if (c->rbuf[0] != 0x03) {
+        printf("rtmpc_conn handshake version %d\n", c->rbuf[0]);
+    }
+    /* c2 echoes s1, s2 is not checked, same as HandShake */
+    if (0 != stage_append(c, s1, RTMPC_CONN_SIG_SIZE)) {
+        conn_fail(c, ENOMEM, "handshake");
+        return;
+    }
+    memmove(c->rbuf, c->rbuf + need, c->rlen - need);
+    c->rlen -= need;
+    c->state = RTMPC_CONN_PUBLISHING;
+    if (!RTMP_SendConnect(c->base, NULL)) {
+        conn_fail(c, EPROTO, "connect");
+        return;
+    }
+}
+
+static int conn_start_handshake(struct rtmpc_conn *c)
+{
+    uint8_t c0 = 0x03;
+    uint32_t uptime = htonl(RTMP_GetTime());
+    int i;
+
+    memcpy(c->c1, &uptime, 4);
+    memset(c->c1 + 4, 0, 4);
+    for (i = 8; i < RTMPC_CONN_SIG_SIZE; i++) {
+        c->c1[i] = (uint8_t)(rand() % 256);
+    }
+    if (0 != stage_append(c, &c0, 1) ||
+        0 != stage_append(c, c->c1, RTMPC_CONN_SIG_SIZE)) {
+        return -1;
+    }
+    c->state = RTMPC_CONN_HANDSHAKE;
+    return 0;
+}
+
+static int rbuf_reserve(struct rtmpc_conn *c, size_t len)
+{
+    uint8_t *p;
+    size_t cap = c->rcap ? c->rcap : RTMPC_CONN_READ_CHUNK;
+
+    while (cap - c->rlen < len) {
+        cap *= 2;
+    }
+    if (cap == c->rcap) {
+        return 0;
+    }
+    p = (uint8_t *)realloc(c->rbuf, cap);
+    if (!p) {
+        printf("realloc rbuf failed!\n");
+        return -1;
+    }
+    c->rbuf = p;
+    c->rcap = cap;
+    return 0;
+}
+
+static void on_conn_in(int fd, void *arg)
+{
+    struct rtmpc_conn *c = (struct rtmpc_conn *)arg;
+    bool eof = false;
+    ssize_t n;
+
+    if (c->state == RTMPC_CONN_CLOSED || c->state == RTMPC_CONN_CONNECTING) {
+        return;
+    }
+    /* edge triggered, read until EAGAIN */
+    while (1) {
+        if (0 != rbuf_reserve(c, RTMPC_CONN_READ_CHUNK)) {
+            conn_fail(c, ENOMEM, "recv");
+            return;
+        }
+        n = recv(fd, c->rbuf + c->rlen, c->rcap - c->rlen, 0);
+        if (n > 0) {
+            c->rlen += n;
+            continue;
+        }
+        if (n == 0) {
+            eof = true;
+        } else if (errno == EINTR) {
+            continue;
+        } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            conn_fail(c, errno, "recv");
+            return;
+        }
+        break;
+    }
+    if (c->state == RTMPC_CONN_HANDSHAKE) {
+        conn_handle_handshake(c);
+    }
+    if (c->state == RTMPC_CONN_PUBLISHING || c->state == RTMPC_CONN_PUBLISHED) {
+        conn_handle_chunks(c);
+    }
+    if (eof) {
+        conn_fail(c, ECONNRESET, "recv");
+        return;
+    }
+    rtmpc_conn_flush(c);
+}
+
+static void on_conn_out(int fd, void *arg)
+{
+    struct rtmpc_conn *c = (struct rtmpc_conn *)arg;
+    socklen_t len = sizeof(int);
+    int err = 0;
+
+    if (c->state == RTMPC_CONN_CLOSED) {
+        return;
+    }
+    if (c->state == RTMPC_CONN_CONNECTING) {
+        if (0 != getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len)) {
+            err = errno;
+        }
+        if (err) {
+            conn_fail(c, err, "connect");
+            return;
+        }
+        if (0 != conn_start_handshake(c)) {
+            conn_fail(c, ENOMEM, "handshake");
+            return;
+        }
+    }
+    rtmpc_conn_flush(c);
+}
+
+static void on_conn_err(int fd, void *arg)
+{
+    struct rtmpc_conn *c = (struct rtmpc_conn *)arg;
+    int err = 0;
+    socklen_t len = sizeof(int);
+    getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len);
+    conn_fail(c, err ? err : ECONNRESET, "socket");
+}
+
+static void on_conn_timeout(struct gevent_wtimer *t, void *arg)
+{
+    struct rtmpc_conn *c = (struct rtmpc_conn *)arg;
+    if (c->state != RTMPC_CONN_PUBLISHED) {
+        conn_fail(c, ETIMEDOUT, "publish");
+    }
+}
+
+struct rtmpc_conn *rtmpc_conn_create(struct gevent_base *evbase, RTMP *base)
+{
+    struct rtmpc_conn *c;
+
+    if (!evbase || !base) {
+        printf("%s invalid parament!\n", __func__);
+        return NULL;
+    }
+    c = CALLOC(1, struct rtmpc_conn);
+    if (!c) {
+        printf("malloc rtmpc_conn failed!\n");
+        return NULL;
+    }
+    if (!RTMP_ResolveAddr(base, &c->addr, &c->addrlen)) {
+        printf("RTMP_ResolveAddr failed!\n");
+        free(c);
+        return NULL;
+    }
+    c->base = base;
+    c->evbase = evbase;
+    c->fd = -1;
+    INIT_LIST_HEAD(&c->wq);
+    gevent_wtimer_init(&c->timeout, on_conn_timeout, c);
+    return c;
+}
+
+/* called in loop thread */
+int rtmpc_conn_open(struct rtmpc_conn *c)
+{
+    if (!c || c->fd != -1) {
+        return -1;
+    }
+    c->err = 0;
+    c->rlen = 0;
+    /* reopen, the last one was deleted in an earlier dispatch round */
+    if (c->ev) {
+        gevent_destroy(c->ev);
+        c->ev = NULL;
+    }
+    c->fd = socket(c->addr.ss_family, SOCK_STREAM, IPPROTO_TCP);
+    if (c->fd == -1) {
+        printf("socket failed: %s\n", strerror(errno));
+        return -1;
+    }
+    fcntl(c->fd, F_SETFL, fcntl(c->fd, F_GETFL, 0) | O_NONBLOCK);
+    /* nodelay, unsent queue kept short and bbr if the kernel has it */
+    if (!c->base->m_bUseNagle) {
+        sock_set_tcp_profile(c->fd, SOCK_TCP_MEDIA, 0);
+    }
+    if (0 != connect(c->fd, (struct sockaddr *)&c->addr, c->addrlen) &&
+        errno != EINPROGRESS) {
+        printf("connect failed: %s\n", strerror(errno));
+        close(c->fd);
+        c->fd = -1;
+        return -1;
+    }
+    c->state = RTMPC_CONN_CONNECTING;
+
+    /* RTMP_Close sees a connected socket and leaves closing it to us */
+    c->base->m_sb.sb_socket = c->fd;
+    c->base->m_bCustomSend = 1;
+    c->base->m_customSendFunc = conn_send;
+    c->base->m_customSendParam = c;
+
+    c->ev = gevent_create(c->fd, on_conn_in, on_conn_out, on_conn_err, c);
+    if (!c->ev || 0 != gevent_add(c->evbase, &c->ev)) {
+        printf("gevent_add failed!\n");
+        gevent_destroy(c->ev);
+        c->ev = NULL;
+        rtmpc_conn_close(c);
+        return -1;
+    }
+    if (c->base->Link.timeout > 0) {
+        gevent_wtimer_add(c->evbase, &c->timeout, c->base->Link.timeout * 1000,
+                          TIMER_ONESHOT);
+    }
+    return 0;
+}
+
+/*
+ * called in loop thread, also from fd callbacks. gevent memory is only
+ * freed in rtmpc_conn_destroy, after the dispatch round is over
+ */
+void rtmpc_conn_close(struct rtmpc_conn *c)
+{
+    int i;
+
+    bool published;
+
+    if (!c || c->state == RTMPC_CONN_CLOSED) {
+        return;
+    }
+    published = (c->state == RTMPC_CONN_PUBLISHED);
+    c->state = RTMPC_CONN_CLOSED;
+    gevent_wtimer_del(c->evbase, &c->timeout);
+    if (c->ev) {
+        gevent_del(c->evbase, &c->ev);
+    }
+    /* FCUnpublish and deleteStream go to the stage, flush best effort */
+    RTMP_Close(c->base);
+    if (published && 0 == rtmpc_conn_commit(c)) {
+        wq_write(c);
+    }
+    if (c->fd != -1) {
+        close(c->fd);
+        c->fd = -1;
+    }
+    c->base->m_bCustomSend = 0;
+    c->base->m_customSendFunc = NULL;
+    c->base->m_customSendParam = NULL;
+    c->base->m_sb.sb_socket = -1;
+    wq_clear(c);
+    free(c->stage);
+    c->stage = NULL;
+    c->stage_len = 0;
+    c->stage_cap = 0;
+    for (i = 0; i < RTMPC_CONN_CSID_MAX; i++) {
+        free(c->in[i].body);
+        c->in[i].body = NULL;
+        c->in[i].got = 0;
+    }
+}
+
+void rtmpc_conn_destroy(struct rtmpc_conn *c)
+{
+    if (!c) {
+        return;
+    }
+    rtmpc_conn_close(c);
+    gevent_destroy(c->ev);
+    free(c->rbuf);
+    free(c);
+}
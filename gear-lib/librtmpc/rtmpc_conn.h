@@ -0,0 +1,147 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#ifndef RTMPC_CONN_H
+#define RTMPC_CONN_H
+
+#include <libposix.h>
+#include <libgevent.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "rtmp.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct rtmpc_conn;
+
+/*
+ * rtmpc_conn is a nonblocking rtmp publish connection on gevent_base.
+ * connect, handshake and connect/createStream/publish are driven by fd
+ * events, all RTMP_* calls on base must happen in the loop thread.
+ * RTMP_SendPacket output is captured by custom send into one message per
+ * commit, messages are queued and written with one gathered write.
+ */
+
+#define RTMPC_CONN_SIG_SIZE     1536
+#define RTMPC_CONN_IOV_MAX      64
+#define RTMPC_CONN_CSID_MAX     64              /* inbound chunk streams */
+#define RTMPC_CONN_MSG_MAX      (1024*1024)     /* largest inbound message */
+#define RTMPC_CONN_COPY_MAX     64              /* sendv copies smaller pieces */
+
+enum rtmpc_conn_state {
+    RTMPC_CONN_IDLE = 0,
+    RTMPC_CONN_CONNECTING,      /* tcp connect in progress */
+    RTMPC_CONN_HANDSHAKE,       /* c0c1 sent, waiting s0s1s2 */
+    RTMPC_CONN_PUBLISHING,      /* connect/createStream/publish in flight */
+    RTMPC_CONN_PUBLISHED,       /* media can be sent */
+    RTMPC_CONN_CLOSED,
+};
+
+/*
+ * chunked bytes of one or more rtmp messages. iov points to the pieces,
+ * either one owned buffer in data or, for sendv, chunk headers in a
+ * scratch area after the msg and body referenced in place until written
+ */
+struct rtmpc_msg {
+    struct list_head entry;
+    struct iovec *iov;
+    int iovcnt;
+    int idx;                    /* first piece not fully written */
+    uint8_t *data;
+    void *ref;                  /* given to release when msg is freed */
+    struct iovec one;
+};
+
+/* ref of a sendv message is no longer used */
+typedef void (rtmpc_conn_release_cb)(void *ctx, void *ref);
+/* publish started, or conn was closed by an error, not by rtmpc_conn_close */
+typedef void (rtmpc_conn_state_cb)(struct rtmpc_conn *c, void *ctx);
+
+/* reassembly state of one inbound chunk stream */
+struct rtmpc_chunk_in {
+    uint8_t type;
+    bool ext;
+    uint32_t ts;
+    uint32_t delta;
+    uint32_t len;
+    uint32_t stream_id;
+    uint32_t got;
+    char *body;
+};
+
+struct rtmpc_conn {
+    RTMP *base;
+    int fd;
+    int err;
+    enum rtmpc_conn_state state;
+    struct gevent_base *evbase;
+    struct gevent *ev;
+    struct gevent_wtimer timeout;
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+    uint8_t c1[RTMPC_CONN_SIG_SIZE];
+
+    uint8_t *rbuf;
+    size_t rlen;
+    size_t rcap;
+    struct rtmpc_chunk_in in[RTMPC_CONN_CSID_MAX];
+
+    uint8_t *stage;             /* custom send output not committed yet */
+    size_t stage_len;
+    size_t stage_cap;
+    struct list_head wq;
+    size_t wq_bytes;
+    uint64_t bytes_sent;        /* taken by the kernel */
+    rtmpc_conn_release_cb *release;
+    void *release_ctx;
+    rtmpc_conn_state_cb *on_state;
+    void *state_ctx;
+};
+
+/* resolve address in caller thread, the rest runs in loop thread */
+struct rtmpc_conn *rtmpc_conn_create(struct gevent_base *evbase, RTMP *base);
+void rtmpc_conn_destroy(struct rtmpc_conn *c);
+int rtmpc_conn_open(struct rtmpc_conn *c);
+void rtmpc_conn_close(struct rtmpc_conn *c);
+
+/* move output captured since last commit to write queue as one message */
+int rtmpc_conn_commit(struct rtmpc_conn *c);
+int rtmpc_conn_flush(struct rtmpc_conn *c);
+/*
+ * queue one rtmp message of type on csid, body is the pieces in iov in
+ * order. pieces up to RTMPC_CONN_COPY_MAX bytes are copied next to the
+ * chunk headers, larger ones are referenced and must stay valid until
+ * release(release_ctx, ref)
+ */
+int rtmpc_conn_sendv(struct rtmpc_conn *c, int csid, uint8_t type, uint32_t ts,
+                     uint32_t stream_id, const struct iovec *iov, int cnt, void *ref);
+int rtmpc_conn_set_release(struct rtmpc_conn *c, rtmpc_conn_release_cb *cb, void *ctx);
+/* cb must not destroy or reopen c, it may send on a published one */
+int rtmpc_conn_set_state_cb(struct rtmpc_conn *c, rtmpc_conn_state_cb *cb, void *ctx);
+size_t rtmpc_conn_pending(struct rtmpc_conn *c);
+bool rtmpc_conn_ready(struct rtmpc_conn *c);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
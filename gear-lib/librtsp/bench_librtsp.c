@@ -0,0 +1,444 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+
+/*
+ * load test of an rtsp server: n clients connect at once, run OPTIONS,
+ * DESCRIBE, SETUP and PLAY over udp or interleaved tcp, receive rtp for
+ * some seconds and check it, then report setup latency, throughput, loss
+ * and cpu of the server per stream
+ *
+ *   ./test_librtsp 4 &
+ *   ./bench_librtsp -n 200 -t -d 10 -P $!
+ */
+#include <libsock.h>
+#include <libthread.h>
+#include <libtime.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <poll.h>
+#include <getopt.h>
+#include <sys/socket.h>
+
+#define BENCH_BUF_LEN       (64 * 1024)
+#define BENCH_TIMEOUT_MS    (5000)
+#define BENCH_SESSION_LEN   (128)
+
+struct bench_client {
+    int id;
+    int fd;
+    int rtp_fd;
+    int rtcp_fd;
+    uint16_t rtp_port;
+    int cseq;
+    char session[BENCH_SESSION_LEN];
+    char buf[BENCH_BUF_LEN];
+    size_t len;
+    bool ok;
+    uint64_t setup_us;
+    uint64_t bytes;
+    uint64_t packets;
+    uint64_t lost;
+    uint64_t invalid;
+    bool seq_init;
+    uint16_t seq_next;
+    uint32_t ssrc;
+    struct thread *thread;
+};
+
+static struct {
+    const char *host;
+    uint16_t port;
+    const char *stream;
+    int nclient;
+    bool tcp;
+    int duration;
+    int server_pid;
+} g_bench = {"127.0.0.1", 8554, "H264", 10, false, 10, 0};
+
+static uint64_t bench_now_us(void)
+{
+    return time_now_usec(NULL);
+}
+
+/* one rtp packet, seq gaps are counted as loss */
+static void bench_rtp(struct bench_client *c, const uint8_t *p, size_t n)
+{
+    uint16_t seq, gap;
+
+    if (n < 12 || (p[0] >> 6) != 2) {
+        c->invalid++;
+        return;
+    }
+    seq = (p[2] << 8) | p[3];
+    c->packets++;
+    c->bytes += n;
+    if (!c->seq_init) {
+        c->seq_init = true;
+        c->ssrc = (p[8] << 24) | (p[9] << 16) | (p[10] << 8) | p[11];
+        c->seq_next = seq + 1;
+        return;
+    }
+    gap = seq - c->seq_next;
+    if (gap < 0x8000) {
+        c->lost += gap;
+        c->seq_next = seq + 1;
+    }
+}
+
+static int bench_fill(struct bench_client *c, int timeout_ms)
+{
+    struct pollfd pfd = {c->fd, POLLIN, 0};
+    ssize_t n;
+
+    if (c->len == sizeof(c->buf)) {
+        c->invalid++;
+        c->len = 0;
+    }
+    if (poll(&pfd, 1, timeout_ms) <= 0) {
+        return 0;
+    }
+    n = recv(c->fd, c->buf + c->len, sizeof(c->buf) - c->len, 0);
+    if (n <= 0) {
+        return -1;
+    }
+    c->len += n;
+    return (int)n;
+}
+
+static void bench_consume(struct bench_client *c, size_t n)
+{
+    memmove(c->buf, c->buf + n, c->len - n);
+    c->len -= n;
+}
+
+/* '$' frames in front of buf, rtp on even channels, false if incomplete */
+static bool bench_interleaved(struct bench_client *c)
+{
+    size_t n;
+    while (c->len >= 4 && c->buf[0] == '$') {
+        n = ((uint8_t)c->buf[2] << 8) | (uint8_t)c->buf[3];
+        if (c->len < 4 + n) {
+            return false;
+        }
+        if (((uint8_t)c->buf[1] & 1) == 0) {
+            bench_rtp(c, (uint8_t *)c->buf + 4, n);
+        }
+        bench_consume(c, 4 + n);
+    }
+    return true;
+}
+
+static int bench_header(const char *hdr, const char *end, const char *name, char *val, size_t len)
+{
+    const char *p, *e;
+    size_t n = strlen(name);
+
+    for (p = hdr; p && p < end; p = strstr(p, "\r\n")) {
+        p += (p == hdr) ? 0 : 2;
+        if (strncasecmp(p, name, n) == 0 && p[n] == ':') {
+            for (p += n + 1; *p == ' '; p++) {}
+            for (e = p; e < end && *e != '\r' && *e != ';'; e++) {}
+            if ((size_t)(e - p) >= len) {
+                return -1;
+            }
+            memcpy(val, p, e - p);
+            val[e - p] = '\0';
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/* returns status code of the response, -1 on error or timeout */
+static int bench_request(struct bench_client *c, const char *method, const char *extra)
+{
+    char req[1024], val[32];
+    char *end;
+    size_t hlen, clen;
+    int n, code;
+    uint64_t deadline = time_now_msec() + BENCH_TIMEOUT_MS;
+
+    n = snprintf(req, sizeof(req),
+                 "%s rtsp://%s:%d/%s RTSP/1.0\r\n"
+                 "CSeq: %d\r\n"
+                 "User-Agent: bench_librtsp\r\n"
+                 "%s%s%s%s\r\n",
+                 method, g_bench.host, g_bench.port, g_bench.stream, ++c->cseq,
+                 c->session[0] ? "Session: " : "", c->session, c->session[0] ? "\r\n" : "",
+                 extra ? extra : "");
+    if (send(c->fd, req, n, MSG_NOSIGNAL) != n) {
+        return -1;
+    }
+    while (1) {
+        /* rtp of a playing tcp session may come before the response */
+        if (bench_interleaved(c) && c->len > 0 && c->buf[0] != '$') {
+            c->buf[c->len < sizeof(c->buf) ? c->len : sizeof(c->buf) - 1] = '\0';
+            end = strstr(c->buf, "\r\n\r\n");
+            if (end) {
+                hlen = end + 4 - c->buf;
+                clen = 0;
+                if (0 == bench_header(c->buf, end, "Content-Length", val, sizeof(val))) {
+                    clen = strtoul(val, NULL, 10);
+                }
+                if (c->len >= hlen + clen) {
+                    if (1 != sscanf(c->buf, "RTSP/1.0 %d", &code)) {
+                        code = -1;
+                    }
+                    bench_header(c->buf, end, "Session", c->session, sizeof(c->session));
+                    bench_consume(c, hlen + clen);
+                    return code;
+                }
+            }
+        }
+        if (time_now_msec() > deadline || bench_fill(c, 100) < 0) {
+            return -1;
+        }
+    }
+}
+
+static int bench_udp_open(struct bench_client *c)
+{
+    int i;
+    uint16_t port;
+    for (i = 0; i < 100; i++) {
+        port = 40000 + (rand() % 10000) * 2;
+        c->rtp_fd = sock_udp_bind(NULL, port);
+        if (c->rtp_fd == -1) {
+            continue;
+        }
+        c->rtcp_fd = sock_udp_bind(NULL, port + 1);
+        if (c->rtcp_fd == -1) {
+            sock_close(c->rtp_fd);
+            continue;
+        }
+        c->rtp_port = port;
+        return 0;
+    }
+    return -1;
+}
+
+static void bench_receive(struct bench_client *c, uint64_t deadline_ms)
+{
+    uint8_t pkt[2048];
+    struct pollfd pfd;
+    ssize_t n;
+
+    if (g_bench.tcp) {
+        while (time_now_msec() < deadline_ms && bench_fill(c, 100) >= 0) {
+            bench_interleaved(c);
+            if (c->len > 0 && c->buf[0] != '$') {
+                /* lost '$' framing, resync on next frame */
+                c->invalid++;
+                bench_consume(c, 1);
+            }
+        }
+        return;
+    }
+    pfd.fd = c->rtp_fd;
+    pfd.events = POLLIN;
+    while (time_now_msec() < deadline_ms) {
+        if (poll(&pfd, 1, 100) <= 0) {
+            continue;
+        }
+        while ((n = recv(c->rtp_fd, pkt, sizeof(pkt), MSG_DONTWAIT)) > 0) {
+            bench_rtp(c, pkt, n);
+        }
+    }
+}
+
+static void *bench_client_run(struct thread *t, void *arg)
+{
+    struct bench_client *c = (struct bench_client *)arg;
+    struct sock_connection *conn;
+    char transport[128];
+    uint64_t start = bench_now_us();
+
+    c->fd = c->rtp_fd = c->rtcp_fd = -1;
+    conn = sock_tcp_connect(g_bench.host, g_bench.port);
+    if (!conn) {
+        fprintf(stderr, "client %d connect failed\n", c->id);
+        return NULL;
+    }
+    c->fd = conn->fd;
+    free(conn);
+    if (g_bench.tcp) {
+        snprintf(transport, sizeof(transport),
+                 "Transport: RTP/AVP/TCP;unicast;interleaved=0-1\r\n");
+    } else {
+        if (-1 == bench_udp_open(c)) {
+            fprintf(stderr, "client %d udp bind failed\n", c->id);
+            goto out;
+        }
+        snprintf(transport, sizeof(transport),
+                 "Transport: RTP/AVP;unicast;client_port=%d-%d\r\n",
+                 c->rtp_port, c->rtp_port + 1);
+    }
+    if (200 != bench_request(c, "OPTIONS", NULL) ||
+        200 != bench_request(c, "DESCRIBE", "Accept: application/sdp\r\n") ||
+        200 != bench_request(c, "SETUP", transport) ||
+        200 != bench_request(c, "PLAY", "Range: npt=0.000-\r\n")) {
+        fprintf(stderr, "client %d handshake failed\n", c->id);
+        goto out;
+    }
+    c->setup_us = bench_now_us() - start;
+    c->ok = true;
+    bench_receive(c, time_now_msec() + g_bench.duration * 1000);
+    bench_request(c, "TEARDOWN", NULL);
+
+out:
+    if (c->rtp_fd != -1) {
+        sock_close(c->rtp_fd);
+        sock_close(c->rtcp_fd);
+    }
+    sock_close(c->fd);
+    return NULL;
+}
+
+/* utime plus stime of a process, in clock ticks */
+static uint64_t bench_cpu_ticks(int pid)
+{
+    char path[64], buf[1024], *p;
+    unsigned long utime = 0, stime = 0;
+    FILE *fp;
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    fp = fopen(path, "r");
+    if (!fp) {
+        return 0;
+    }
+    if (!fgets(buf, sizeof(buf), fp)) {
+        buf[0] = '\0';
+    }
+    fclose(fp);
+    /* comm may hold spaces, fields count from the closing paren */
+    p = strrchr(buf, ')');
+    if (!p || 2 != sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+                          &utime, &stime)) {
+        return 0;
+    }
+    return utime + stime;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void bench_report(struct bench_client *c, uint64_t cpu_ticks, double cpu_secs)
+{
+    int i, ok = 0;
+    uint64_t *lat = calloc(g_bench.nclient, sizeof(uint64_t));
+    uint64_t packets = 0, lost = 0, invalid = 0, lat_sum = 0;
+    double kbps, kbps_min = -1, kbps_max = 0, kbps_sum = 0;
+
+    for (i = 0; i < g_bench.nclient; i++) {
+        packets += c[i].packets;
+        lost += c[i].lost;
+        invalid += c[i].invalid;
+        if (!c[i].ok) {
+            continue;
+        }
+        lat[ok++] = c[i].setup_us;
+        lat_sum += c[i].setup_us;
+        kbps = c[i].bytes * 8.0 / g_bench.duration / 1000;
+        kbps_sum += kbps;
+        kbps_min = (kbps_min < 0 || kbps < kbps_min) ? kbps : kbps_min;
+        kbps_max = kbps > kbps_max ? kbps : kbps_max;
+    }
+    printf("clients:    %d %s, %d ok, %d failed\n", g_bench.nclient,
+           g_bench.tcp ? "tcp" : "udp", ok, g_bench.nclient - ok);
+    if (ok > 0) {
+        qsort(lat, ok, sizeof(uint64_t), cmp_u64);
+        printf("setup ms:   min %.2f avg %.2f p50 %.2f p99 %.2f max %.2f\n",
+               lat[0] / 1000.0, lat_sum / 1000.0 / ok, lat[ok / 2] / 1000.0,
+               lat[(ok * 99) / 100] / 1000.0, lat[ok - 1] / 1000.0);
+        printf("kbps:       min %.1f avg %.1f max %.1f\n",
+               kbps_min, kbps_sum / ok, kbps_max);
+    }
+    printf("packets:    %"PRIu64" received, %"PRIu64" lost (%.3f%%), %"PRIu64" invalid\n",
+           packets, lost, packets + lost ? lost * 100.0 / (packets + lost) : 0.0, invalid);
+    if (g_bench.server_pid > 0 && ok > 0) {
+        printf("server cpu: %.2f%% total, %.3f%% per stream\n",
+               cpu_ticks * 100.0 / sysconf(_SC_CLK_TCK) / cpu_secs,
+               cpu_ticks * 100.0 / sysconf(_SC_CLK_TCK) / cpu_secs / ok);
+    }
+    free(lat);
+}
+
+static void usage(const char *name)
+{
+    printf("usage: %s [-h host] [-p port] [-s stream] [-n clients] [-t] "
+           "[-d seconds] [-P server_pid]\n", name);
+}
+
+int main(int argc, char **argv)
+{
+    int i, opt;
+    uint64_t cpu0, cpu1, t0, t1;
+    struct bench_client *clients;
+
+    while ((opt = getopt(argc, argv, "h:p:s:n:td:P:")) != -1) {
+        switch (opt) {
+        case 'h': g_bench.host = optarg; break;
+        case 'p': g_bench.port = atoi(optarg); break;
+        case 's': g_bench.stream = optarg; break;
+        case 'n': g_bench.nclient = atoi(optarg); break;
+        case 't': g_bench.tcp = true; break;
+        case 'd': g_bench.duration = atoi(optarg); break;
+        case 'P': g_bench.server_pid = atoi(optarg); break;
+        default: usage(argv[0]); return -1;
+        }
+    }
+    if (g_bench.nclient <= 0 || g_bench.duration <= 0) {
+        usage(argv[0]);
+        return -1;
+    }
+    clients = calloc(g_bench.nclient, sizeof(struct bench_client));
+    if (!clients) {
+        return -1;
+    }
+    srand(getpid());
+    cpu0 = bench_cpu_ticks(g_bench.server_pid);
+    t0 = bench_now_us();
+    for (i = 0; i < g_bench.nclient; i++) {
+        clients[i].id = i;
+        clients[i].thread = thread_create(bench_client_run, &clients[i]);
+    }
+    for (i = 0; i < g_bench.nclient; i++) {
+        if (clients[i].thread) {
+            thread_join(clients[i].thread);
+            thread_destroy(clients[i].thread);
+        }
+    }
+    t1 = bench_now_us();
+    cpu1 = bench_cpu_ticks(g_bench.server_pid);
+    bench_report(clients, cpu1 - cpu0, (t1 - t0) / 1000000.0);
+    free(clients);
+    return 0;
+}
@@ -24,6 +24,7 @@
 
 #include "librtsp_server.h"
 #include "media_source.h"
+#include "rtsp_client.h"
 
 #define LIBRTSP_VERSION "0.1.1"
 
@@ -30,6 +30,7 @@
 #include <ctype.h>
 #include <time.h>
 #include <errno.h>
+#include <unistd.h>
 #include <sys/time.h>
 
 #include "media_source.h"
@@ -39,37 +40,93 @@
 
 #define LOCAL_HOST          ((const char *)"127.0.0.1")
 
-#define RTSP_REQUEST_LEN_MAX	(1024)
+/* connection buffer, holds pipelined requests and partial reads */
+#define RTSP_REQUEST_LEN_MAX	(4096)
 
-static void rtsp_connect_create(struct rtsp_server *rtsp, int fd, uint32_t ip, uint16_t port);
-static void rtsp_connect_destroy(struct rtsp_server *rtsp, int fd);
+static void rtsp_connect_create(struct rtsp_shard *shard, int fd, uint32_t ip, uint16_t port);
+static void rtsp_connect_destroy(struct rtsp_shard *shard, int fd);
 
+/* rtcp of interleaved sessions comes back on odd channels */
+static void on_interleaved(struct rtsp_request *req, uint8_t channel, struct strref *payload)
+{
+    struct transport_session *ts;
+
+    if (!(channel & 1) || req->session.id[0] == '\0') {
+        logd("interleaved channel %d, %zu bytes ignored\n", channel, payload->len);
+        return;
+    }
+    ts = transport_session_lookup(req->shard->transport_session_pool, req->session.id);
+    if (ts && ts->started) {
+        rtcp_parse(ts->rtp, (char *)payload->array, payload->len);
+    }
+}
+
+/*
+ * reads are appended to the connection buffer. every complete request and
+ * interleaved '$' frame in it is handled in place, pipelined or not, and a
+ * partial one stays at the front until the rest arrives
+ */
 static void on_recv(int fd, void *arg)
 {
-    int rlen, res;
+    int rlen, n;
+    uint8_t channel;
+    struct strref payload;
     struct rtsp_request *req = (struct rtsp_request *)arg;
-    memset(req->raw->iov_base, 0, RTSP_REQUEST_LEN_MAX);
-    rlen = sock_recv(fd, req->raw->iov_base, RTSP_REQUEST_LEN_MAX);
-    if (rlen > 0) {
-        req->raw->iov_len = rlen;
-        res = parse_rtsp_request(req);
-        if (res == -1) {
-            loge("parse_rtsp_request failed\n");
-            return;
-        }
-        res = handle_rtsp_request(req);
-        if (res == -1) {
-            loge("handle_rtsp_request failed\n");
-            return;
-        }
-    } else if (rlen == 0) {
+    char *buf = (char *)req->raw->iov_base;
+    size_t off = 0, len = req->raw->iov_len;
+
+    if (len + 1 >= req->raw_cap) {
+        loge("request larger than %zu bytes, dropped\n", req->raw_cap);
+        len = 0;
+        req->msg.scanned = 0;
+    }
+    rlen = sock_recv(fd, buf + len, req->raw_cap - 1 - len);
+    if (rlen == 0) {
         loge("peer connect shutdown\n");
+        buf[0] = '\0';
+        req->raw->iov_len = 0;
+        strref_set(&req->msg.raw, buf, 0);
         strcpy(req->cmd, "teardown");
         handle_rtsp_request(req);
-        rtsp_connect_destroy(req->rtsp_server, fd);
-    } else {
+        rtsp_connect_destroy(req->shard, fd);
+        return;
+    } else if (rlen < 0) {
         loge("something error\n");
+        return;
     }
+    len += rlen;
+    buf[len] = '\0';
+    while (off < len) {
+        if (buf[off] == '$') {
+            n = rtsp_interleaved_parse(buf + off, len - off, &channel, &payload);
+            if (n == 0) {
+                break;
+            }
+            on_interleaved(req, channel, &payload);
+            off += n;
+            continue;
+        }
+        n = rtsp_message_parse(&req->msg, buf + off, len - off);
+        if (n == 0) {
+            break;
+        } else if (n == -1) {
+            loge("malformed request, %zu bytes dropped\n", len - off);
+            req->msg.scanned = 0;
+            off = len;
+            break;
+        }
+        if (-1 == parse_rtsp_request(req)) {
+            loge("parse_rtsp_request failed\n");
+        } else if (-1 == handle_rtsp_request(req)) {
+            loge("handle_rtsp_request failed\n");
+        }
+        off += n;
+    }
+    if (off > 0) {
+        memmove(buf, buf + off, len - off + 1);
+        len -= off;
+    }
+    req->raw->iov_len = len;
 }
 
 static void on_error(int fd, void *arg)
@@ -77,7 +134,10 @@ static void on_error(int fd, void *arg)
     loge("error: %d\n", errno);
 }
 
-static void rtsp_connect_create(struct rtsp_server *rtsp, int fd, uint32_t ip, uint16_t port)
+/* request struct and its raw buffer per connection */
+static struct mem_account connect_mem = MEM_ACCOUNT_INIT("rtsp_connect");
+
+static void rtsp_connect_create(struct rtsp_shard *shard, int fd, uint32_t ip, uint16_t port)
 {
     char key[9];
     struct rtsp_request *req = calloc(1, sizeof(struct rtsp_request));
@@ -88,32 +148,51 @@ static void rtsp_connect_create(struct rtsp_server *rtsp, int fd, uint32_t ip, u
     req->fd = fd;
     req->client.ip = ip;
     req->client.port = port;
-    req->rtsp_server = rtsp;
+    req->rtsp_server = shard->server;
+    req->shard = shard;
     req->raw = iovec_create(RTSP_REQUEST_LEN_MAX);
+    if (!req->raw) {
+        loge("iovec_create failed!\n");
+        free(req);
+        return;
+    }
+    req->raw_cap = req->raw->iov_len;
+    req->raw->iov_len = 0;
     sock_set_noblk(fd, 1);
     req->event = gevent_create(fd, on_recv, NULL, on_error, req);
-    if (-1 == gevent_add(rtsp->evbase, &req->event)) {
+    if (-1 == gevent_add(shard->evbase, &req->event)) {
         loge("event_add failed!\n");
     }
     req->transport.fd = fd;
     snprintf(key, sizeof(key), "%d", fd);
-    dict_add(rtsp->connect_pool, key, (char *)req);
+    dict_add(shard->connect_pool, key, (char *)req);
+    mem_account_charge(&connect_mem, sizeof(struct rtsp_request) + req->raw_cap, 1);
     logi("fd = %d, req=%p\n", fd, req);
 }
 
-static void rtsp_connect_destroy(struct rtsp_server *rtsp, int fd)
+static void rtsp_request_release(void *arg)
+{
+    struct rtsp_request *req = (struct rtsp_request *)arg;
+    gevent_destroy(req->event);
+    mem_account_charge(&connect_mem, -(int64_t)(sizeof(struct rtsp_request) + req->raw_cap), -1);
+    iovec_destroy(req->raw);
+    sock_close(req->fd);
+    free(req);
+}
+
+static void rtsp_connect_destroy(struct rtsp_shard *shard, int fd)
 {
     char key[9];
     struct rtsp_request *req;
     snprintf(key, sizeof(key), "%d", fd);
-    req = (struct rtsp_request *)dict_get(rtsp->connect_pool, key, NULL);
+    req = (struct rtsp_request *)dict_get(shard->connect_pool, key, NULL);
     logi("fd = %d, req=%p\n", fd, req);
-    dict_del(rtsp->connect_pool, key);
-    gevent_del(rtsp->evbase, &req->event);
-    gevent_destroy(req->event);
-    iovec_destroy(req->raw);
-    sock_close(fd);
-    free(req);
+    dict_del(shard->connect_pool, key);
+    gevent_del(shard->evbase, &req->event);
+    /* called from callback of req->event, free it after this dispatch round */
+    if (0 != gevent_base_post(shard->evbase, rtsp_request_release, req)) {
+        rtsp_request_release(req);
+    }
 }
 
 static void on_connect(int fd, void *arg)
@@ -121,21 +200,28 @@ static void on_connect(int fd, void *arg)
     int afd;
     uint32_t ip;
     uint16_t port;
-    struct rtsp_server *rtsp = (struct rtsp_server *)arg;
+    struct rtsp_shard *shard = (struct rtsp_shard *)arg;
 
-    afd = sock_accept(fd, &ip, &port);
-    if (afd == -1) {
-        loge("sock_accept failed: %d\n", errno);
-        return;
+    /* listen fd is nonblock and edge triggered, accept until EAGAIN */
+    while (1) {
+        afd = sock_accept(fd, &ip, &port);
+        if (afd == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                loge("sock_accept failed: %d\n", errno);
+            }
+            return;
+        }
+        logd("connect fd = %d, accept fd = %d\n", fd, afd);
+        /* rtsp replies are small and latency bound, never wait for nagle */
+        sock_set_tcp_profile(afd, SOCK_TCP_LOWLAT, 0);
+        rtsp_connect_create(shard, afd, ip, port);
     }
-    logd("connect fd = %d, accept fd = %d\n", fd, afd);
-    rtsp_connect_create(rtsp, afd, ip, port);
 }
 
 static void *rtsp_thread_event(struct thread *t, void *arg)
 {
-    struct rtsp_server *rc = (struct rtsp_server *)arg;
-    gevent_base_loop(rc->evbase);
+    struct rtsp_shard *shard = (struct rtsp_shard *)arg;
+    gevent_base_loop(shard->evbase);
     return NULL;
 }
 
@@ -158,60 +244,136 @@ void connect_pool_destroy(void *pool)
     dict_free((dict *)pool);
 }
 
-static int master_thread_create(struct rtsp_server *c)
+static void shard_destroy(struct rtsp_shard *shard)
+{
+    if (shard->thread) {
+        gevent_base_loop_break(shard->evbase);
+        thread_join(shard->thread);
+        thread_destroy(shard->thread);
+        shard->thread = NULL;
+    }
+    if (shard->ev_connect) {
+        gevent_del(shard->evbase, &shard->ev_connect);
+        gevent_destroy(shard->ev_connect);
+        shard->ev_connect = NULL;
+    }
+    if (shard->evbase) {
+        gevent_base_destroy(shard->evbase);
+        shard->evbase = NULL;
+    }
+    if (shard->connect_pool) {
+        connect_pool_destroy(shard->connect_pool);
+        shard->connect_pool = NULL;
+    }
+    if (shard->transport_session_pool) {
+        transport_session_pool_destroy(shard->transport_session_pool);
+        shard->transport_session_pool = NULL;
+    }
+    if (shard->listen_fd != -1) {
+        sock_close(shard->listen_fd);
+        shard->listen_fd = -1;
+    }
+}
+
+static int shard_create(struct rtsp_server *c, struct rtsp_shard *shard)
 {
-    int fd = sock_tcp_bind_listen(c->host.ip_str, c->host.port);
-    if (fd == -1) {
+    shard->server = c;
+    shard->listen_fd = sock_tcp_bind_listen(c->host.ip_str, c->host.port);
+    if (shard->listen_fd == -1) {
         goto failed;
     }
-    media_source_register_all();
-    c->transport_session_pool = transport_session_pool_create();
-    c->connect_pool = connect_pool_create();
-    c->listen_fd = fd;
-    c->evbase = gevent_base_create();
-    if (!c->evbase) {
+    sock_set_noblk(shard->listen_fd, 1);
+    shard->transport_session_pool = transport_session_pool_create();
+    shard->connect_pool = connect_pool_create();
+    shard->evbase = gevent_base_create();
+    if (!shard->evbase) {
         goto failed;
     }
-    c->ev_connect = gevent_create(fd, on_connect, NULL, on_error, (void *)c);
-    if (-1 == gevent_add(c->evbase, &c->ev_connect)) {
+    shard->ev_connect = gevent_create(shard->listen_fd, on_connect, NULL, on_error, (void *)shard);
+    if (-1 == gevent_add(shard->evbase, &shard->ev_connect)) {
         loge("event_add failed!\n");
-        gevent_destroy(c->ev_connect);
+        goto failed;
     }
-    c->master_thread = thread_create(rtsp_thread_event, c);
-    if (!c->master_thread) {
+    shard->thread = thread_create(rtsp_thread_event, shard);
+    if (!shard->thread) {
         loge("thread_create failed!\n");
         goto failed;
     }
     return 0;
 
 failed:
-    if (c->ev_connect) {
-        gevent_destroy(c->ev_connect);
+    shard_destroy(shard);
+    return -1;
+}
+
+static int master_thread_create(struct rtsp_server *c)
+{
+    int i;
+    struct sock_addr addr;
+
+    for (i = 0; i < c->nshard; i++) {
+        if (-1 == shard_create(c, &c->shards[i])) {
+            loge("rtsp shard %d create failed!\n", i);
+            goto failed;
+        }
+        /* shards of random port must share the port of shard 0 */
+        if (c->host.port == 0 &&
+            0 == sock_getaddr_by_fd(c->shards[i].listen_fd, &addr)) {
+            c->host.port = addr.port;
+        }
     }
-    if (fd != -1) {
-        sock_close(fd);
+    c->listen_fd = c->shards[0].listen_fd;
+    c->evbase = c->shards[0].evbase;
+    c->ev_connect = c->shards[0].ev_connect;
+    c->connect_pool = c->shards[0].connect_pool;
+    c->transport_session_pool = c->shards[0].transport_session_pool;
+    c->master_thread = c->shards[0].thread;
+    return 0;
+
+failed:
+    while (--i >= 0) {
+        shard_destroy(&c->shards[i]);
     }
     return -1;
 }
 
 static void master_thread_destroy(struct rtsp_server *c)
 {
-    gevent_del(c->evbase, &c->ev_connect);
-    gevent_base_loop_break(c->evbase);
-    thread_join(c->master_thread);
-    thread_destroy(c->master_thread);
-    gevent_base_destroy(c->evbase);
-    connect_pool_destroy(c->connect_pool);
-    transport_session_pool_destroy(c->transport_session_pool);
+    int i;
+    for (i = 0; i < c->nshard; i++) {
+        shard_destroy(&c->shards[i]);
+    }
 }
 
 struct rtsp_server *rtsp_server_init(const char *ip, uint16_t port)
 {
+    return rtsp_server_init_sharded(ip, port, 1);
+}
+
+struct rtsp_server *rtsp_server_init_sharded(const char *ip, uint16_t port, int nshard)
+{
+    int i;
     struct rtsp_server *c = calloc(1, sizeof(struct rtsp_server));
     if (!c) {
         loge("malloc rtsp_server failed!\n");
         return NULL;
     }
+    if (nshard <= 0) {
+        nshard = sysconf(_SC_NPROCESSORS_ONLN);
+        if (nshard <= 0) {
+            nshard = 1;
+        }
+    }
+    c->shards = calloc(nshard, sizeof(struct rtsp_shard));
+    if (!c->shards) {
+        loge("malloc rtsp_shard failed!\n");
+        free(c);
+        return NULL;
+    }
+    c->nshard = nshard;
+    for (i = 0; i < nshard; i++) {
+        c->shards[i].listen_fd = -1;
+    }
     if (ip) {
         strcpy(c->host.ip_str, ip);
     }
@@ -219,6 +381,23 @@ struct rtsp_server *rtsp_server_init(const char *ip, uint16_t port)
     return c;
 }
 
+int rtsp_server_set_multicast(struct rtsp_server *c, const char *group, uint16_t port, uint8_t ttl)
+{
+    if (!c) {
+        return -1;
+    }
+    return transport_mcast_config(group, port, ttl);
+}
+
+int rtsp_server_set_pacing(struct rtsp_server *c, bool enable, uint32_t bitrate)
+{
+    if (!c) {
+        return -1;
+    }
+    transport_session_pacing(enable, bitrate / 8);
+    return 0;
+}
+
 int rtsp_server_dispatch(struct rtsp_server *c)
 {
     return master_thread_create(c);
@@ -227,5 +406,6 @@ int rtsp_server_dispatch(struct rtsp_server *c)
 void rtsp_server_deinit(struct rtsp_server *c)
 {
     master_thread_destroy(c);
+    free(c->shards);
     free(c);
 }
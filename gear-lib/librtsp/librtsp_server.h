@@ -31,6 +31,20 @@
 extern "C" {
 #endif
 
+/*
+ * one listener per shard bound with SO_REUSEPORT, each shard has own loop
+ * thread and own connect and session pool, so shards share nothing
+ */
+struct rtsp_shard {
+    int listen_fd;
+    struct gevent_base *evbase;
+    struct gevent *ev_connect;
+    void *connect_pool;
+    void *transport_session_pool;
+    struct thread *thread;
+    struct rtsp_server *server;
+};
+
 struct rtsp_server {
     int listen_fd;
     struct sock_addr host;
@@ -42,9 +56,25 @@ struct rtsp_server {
     struct protocol_ctx *rtp_ctx;
     struct thread *master_thread;
     struct thread *worker_thread;
+    int nshard;
+    struct rtsp_shard *shards;
 };
 
 struct rtsp_server *rtsp_server_init(const char *host, uint16_t port);
+/*
+ * nshard <= 0 means one shard per cpu, fields of rtsp_server are from shard 0
+ */
+struct rtsp_server *rtsp_server_init_sharded(const char *host, uint16_t port, int nshard);
+/*
+ * serve sources to multicast groups numbered up from group, e.g. 239.0.0.1,
+ * with rtp on port and rtcp on port+1, called before dispatch
+ */
+int rtsp_server_set_multicast(struct rtsp_server *c, const char *group, uint16_t port, uint8_t ttl);
+/*
+ * udp rtp is sent through a token bucket at bitrate bits per second, frames
+ * are spread over their interval, bitrate 0 estimates from frame sizes
+ */
+int rtsp_server_set_pacing(struct rtsp_server *c, bool enable, uint32_t bitrate);
 int rtsp_server_dispatch(struct rtsp_server *c);
 void rtsp_server_deinit(struct rtsp_server *c);
 
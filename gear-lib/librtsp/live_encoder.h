@@ -0,0 +1,66 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#ifndef LIVE_ENCODER_H
+#define LIVE_ENCODER_H
+
+#include <libavcap.h>
+#include <stdbool.h>
+#include "media_source.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * h264 encoder of the live source. frames come in with timestamp in ticks
+ * of encoder timebase (1/fps). encode returns packet size, 0 when encoder
+ * has no packet yet, -1 on error. the packet is valid until next encode,
+ * its encoder field carries sps/pps in extra_data once known
+ */
+struct live_encoder {
+    const struct live_encoder_ops *ops;
+    struct video_encoder encoder;
+    void *priv;
+};
+
+struct live_encoder_ops {
+    const char *name;
+    bool dmabuf;        /* prefers capture buffers by dmabuf, see encode */
+    bool (*probe)(const struct videocap_config *conf);
+    /* ec has no zero fields left, backends ignore what they can not do */
+    int (*open)(struct live_encoder *e, const struct videocap_config *conf,
+                const struct live_encoder_conf *ec);
+    /* dmabuf of frm or NULL, frm may be held by encoder with video_frame_ref */
+    int (*encode)(struct live_encoder *e, struct video_frame *frm,
+                  const struct video_dmabuf *dmabuf, struct video_packet *pkt);
+    void (*close)(struct live_encoder *e);
+};
+
+extern const struct live_encoder_ops live_encoder_x264;
+#if defined (ENABLE_V4L2M2M)
+extern const struct live_encoder_ops live_encoder_v4l2m2m;
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,721 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#include "live_encoder.h"
+#include <liblog.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <linux/videodev2.h>
+#if defined (ENABLE_TRACE)
+#include <libtrace.h>
+#else
+#define TRACE_SCOPE(cat, name)
+#endif
+
+/*
+ * stateful V4L2 mem2mem h264 encoder (bcm2835-codec, hantro, venus, ...),
+ * multi-planar api only. raw frames go to OUTPUT queue, either imported
+ * from the capture buffer by dmabuf without touching pixels or copied into
+ * mmap buffers when the capture has no dmabuf or a different layout. the
+ * layout is fixed by the first frame. coded data of CAPTURE queue is
+ * copied once into a media_buffer, the few driver buffers are requeued at
+ * once and can not be held by the gop cache of live source
+ */
+
+#define M2M_DEV_MAX         (64)
+#define M2M_OUT_BUFS        (4)
+#define M2M_CAP_BUFS        (4)
+#define M2M_TIMEOUT_MS      (100)
+
+struct m2m_out {
+    void *mem[VIDEO_MAX_PLANES];
+    size_t len[VIDEO_MAX_PLANES];
+    struct video_frame held;            /* imported frame until dequeued */
+    bool busy;
+};
+
+struct m2m_cap {
+    void *mem;
+    size_t len;
+};
+
+struct m2m_ctx {
+    int fd;
+    uint32_t fourcc;
+    uint32_t width;
+    uint32_t height;
+    int planes;                         /* memory planes of raw format */
+    uint32_t bytesperline[VIDEO_MAX_PLANES];
+    uint32_t sizeimage[VIDEO_MAX_PLANES];
+    enum v4l2_memory out_memory;
+    bool out_ready;
+    struct m2m_out out[M2M_OUT_BUFS];
+    int out_cnt;
+    struct m2m_cap cap[M2M_CAP_BUFS];
+    int cap_cnt;
+};
+
+static int xioctl(int fd, unsigned long req, void *arg)
+{
+    int ret;
+    do {
+        ret = ioctl(fd, req, arg);
+    } while (ret == -1 && errno == EINTR);
+    return ret;
+}
+
+static uint32_t pixel_format_to_fourcc(enum pixel_format fmt)
+{
+    switch (fmt) {
+    case PIXEL_FORMAT_NV12:
+        return V4L2_PIX_FMT_NV12;
+    case PIXEL_FORMAT_I420:
+        return V4L2_PIX_FMT_YUV420;
+    case PIXEL_FORMAT_YUY2:
+        return V4L2_PIX_FMT_YUYV;
+    case PIXEL_FORMAT_UYVY:
+        return V4L2_PIX_FMT_UYVY;
+    default:
+        return 0;
+    }
+}
+
+static bool m2m_has_format(int fd, enum v4l2_buf_type type, uint32_t fourcc)
+{
+    struct v4l2_fmtdesc desc;
+
+    memset(&desc, 0, sizeof(desc));
+    desc.type = type;
+    for (desc.index = 0; xioctl(fd, VIDIOC_ENUM_FMT, &desc) == 0; desc.index++) {
+        if (desc.pixelformat == fourcc) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* first mem2mem device taking fourcc in and giving h264 out */
+static int m2m_find(uint32_t fourcc)
+{
+    char path[32];
+    struct v4l2_capability cap;
+    uint32_t caps;
+    int i, fd;
+
+    for (i = 0; i < M2M_DEV_MAX; i++) {
+        snprintf(path, sizeof(path), "/dev/video%d", i);
+        fd = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+        if (fd == -1) {
+            continue;
+        }
+        memset(&cap, 0, sizeof(cap));
+        if (xioctl(fd, VIDIOC_QUERYCAP, &cap) == 0) {
+            caps = (cap.capabilities & V4L2_CAP_DEVICE_CAPS) ?
+                    cap.device_caps : cap.capabilities;
+            if ((caps & V4L2_CAP_VIDEO_M2M_MPLANE) &&
+                m2m_has_format(fd, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, V4L2_PIX_FMT_H264) &&
+                m2m_has_format(fd, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, fourcc)) {
+                logi("h264 encoder %s (%s)\n", path, cap.card);
+                return fd;
+            }
+        }
+        close(fd);
+    }
+    return -1;
+}
+
+static bool m2m_probe(const struct videocap_config *conf)
+{
+    uint32_t fourcc = pixel_format_to_fourcc(conf->format);
+    int fd;
+
+    if (!fourcc) {
+        return false;
+    }
+    fd = m2m_find(fourcc);
+    if (fd == -1) {
+        return false;
+    }
+    close(fd);
+    return true;
+}
+
+static void m2m_set_ctrl(int fd, uint32_t id, int32_t value, const char *name)
+{
+    struct v4l2_control ctrl = { .id = id, .value = value };
+    if (xioctl(fd, VIDIOC_S_CTRL, &ctrl) == -1) {
+        logw("v4l2m2m %s not supported: %d\n", name, errno);
+    }
+}
+
+static int m2m_set_formats(struct m2m_ctx *c, const struct videocap_config *conf,
+                const struct live_encoder_conf *ec)
+{
+    struct v4l2_format fmt;
+    struct v4l2_streamparm parm;
+    int i;
+
+    memset(&fmt, 0, sizeof(fmt));
+    fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    fmt.fmt.pix_mp.width = conf->width;
+    fmt.fmt.pix_mp.height = conf->height;
+    fmt.fmt.pix_mp.pixelformat = V4L2_PIX_FMT_H264;
+    fmt.fmt.pix_mp.num_planes = 1;
+    fmt.fmt.pix_mp.plane_fmt[0].sizeimage = conf->width * conf->height;
+    if (xioctl(c->fd, VIDIOC_S_FMT, &fmt) == -1) {
+        loge("v4l2m2m set h264 format failed: %d\n", errno);
+        return -1;
+    }
+
+    memset(&fmt, 0, sizeof(fmt));
+    fmt.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+    fmt.fmt.pix_mp.width = conf->width;
+    fmt.fmt.pix_mp.height = conf->height;
+    fmt.fmt.pix_mp.pixelformat = c->fourcc;
+    fmt.fmt.pix_mp.field = V4L2_FIELD_NONE;
+    if (xioctl(c->fd, VIDIOC_S_FMT, &fmt) == -1) {
+        loge("v4l2m2m set raw format failed: %d\n", errno);
+        return -1;
+    }
+    if (fmt.fmt.pix_mp.width != conf->width || fmt.fmt.pix_mp.height != conf->height) {
+        loge("v4l2m2m does not take %ux%u, got %ux%u\n", conf->width, conf->height,
+             fmt.fmt.pix_mp.width, fmt.fmt.pix_mp.height);
+        return -1;
+    }
+    c->planes = fmt.fmt.pix_mp.num_planes;
+    for (i = 0; i < c->planes; i++) {
+        c->bytesperline[i] = fmt.fmt.pix_mp.plane_fmt[i].bytesperline;
+        c->sizeimage[i] = fmt.fmt.pix_mp.plane_fmt[i].sizeimage;
+    }
+
+    memset(&parm, 0, sizeof(parm));
+    parm.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+    parm.parm.output.timeperframe.numerator = conf->fps.den;
+    parm.parm.output.timeperframe.denominator = conf->fps.num;
+    if (xioctl(c->fd, VIDIOC_S_PARM, &parm) == -1) {
+        logw("v4l2m2m set framerate failed: %d\n", errno);
+    }
+
+    m2m_set_ctrl(c->fd, V4L2_CID_MPEG_VIDEO_BITRATE, ec->bitrate * 1000, "bitrate");
+    m2m_set_ctrl(c->fd, V4L2_CID_MPEG_VIDEO_BITRATE_PEAK, ec->vbv_max_bitrate * 1000, "peak bitrate");
+    /* gop cache lets late joiners start at once, no need of all intra */
+    m2m_set_ctrl(c->fd, V4L2_CID_MPEG_VIDEO_GOP_SIZE, ec->keyint, "gop size");
+    m2m_set_ctrl(c->fd, V4L2_CID_MPEG_VIDEO_H264_I_PERIOD, ec->keyint, "i period");
+    if (ec->intra_refresh) {
+        m2m_set_ctrl(c->fd, V4L2_CID_MPEG_VIDEO_INTRA_REFRESH_PERIOD_TYPE,
+                     V4L2_CID_MPEG_VIDEO_INTRA_REFRESH_PERIOD_TYPE_CYCLIC, "intra refresh type");
+        m2m_set_ctrl(c->fd, V4L2_CID_MPEG_VIDEO_INTRA_REFRESH_PERIOD, ec->keyint, "intra refresh");
+    }
+    m2m_set_ctrl(c->fd, V4L2_CID_MPEG_VIDEO_REPEAT_SEQ_HEADER, 1, "repeat sps");
+    m2m_set_ctrl(c->fd, V4L2_CID_MPEG_VIDEO_H264_PROFILE,
+                 V4L2_MPEG_VIDEO_H264_PROFILE_MAIN, "profile");
+    return 0;
+}
+
+static int m2m_qbuf_cap(struct m2m_ctx *c, int index)
+{
+    struct v4l2_buffer buf;
+    struct v4l2_plane planes[VIDEO_MAX_PLANES];
+
+    memset(&buf, 0, sizeof(buf));
+    memset(planes, 0, sizeof(planes));
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    buf.index = index;
+    buf.m.planes = planes;
+    buf.length = 1;
+    if (xioctl(c->fd, VIDIOC_QBUF, &buf) == -1) {
+        loge("v4l2m2m qbuf capture %d failed: %d\n", index, errno);
+        return -1;
+    }
+    return 0;
+}
+
+static int m2m_reqbufs(struct m2m_ctx *c, enum v4l2_buf_type type,
+                enum v4l2_memory memory, int count)
+{
+    struct v4l2_requestbuffers req;
+
+    memset(&req, 0, sizeof(req));
+    req.type = type;
+    req.memory = memory;
+    req.count = count;
+    if (xioctl(c->fd, VIDIOC_REQBUFS, &req) == -1) {
+        loge("v4l2m2m reqbufs %d failed: %d\n", type, errno);
+        return -1;
+    }
+    return req.count;
+}
+
+static int m2m_map(struct m2m_ctx *c, enum v4l2_buf_type type, int index,
+                void **mem, size_t *len, int nplanes)
+{
+    struct v4l2_buffer buf;
+    struct v4l2_plane planes[VIDEO_MAX_PLANES];
+    int p;
+
+    memset(&buf, 0, sizeof(buf));
+    memset(planes, 0, sizeof(planes));
+    buf.type = type;
+    buf.memory = V4L2_MEMORY_MMAP;
+    buf.index = index;
+    buf.m.planes = planes;
+    buf.length = nplanes;
+    if (xioctl(c->fd, VIDIOC_QUERYBUF, &buf) == -1) {
+        loge("v4l2m2m querybuf failed: %d\n", errno);
+        return -1;
+    }
+    for (p = 0; p < nplanes; p++) {
+        len[p] = planes[p].length;
+        mem[p] = mmap(NULL, len[p], PROT_READ | PROT_WRITE, MAP_SHARED,
+                      c->fd, planes[p].m.mem_offset);
+        if (mem[p] == MAP_FAILED) {
+            mem[p] = NULL;
+            loge("v4l2m2m mmap failed: %d\n", errno);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int m2m_cap_setup(struct m2m_ctx *c)
+{
+    int i, type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+
+    c->cap_cnt = m2m_reqbufs(c, type, V4L2_MEMORY_MMAP, M2M_CAP_BUFS);
+    if (c->cap_cnt <= 0) {
+        c->cap_cnt = 0;
+        return -1;
+    }
+    if (c->cap_cnt > M2M_CAP_BUFS) {
+        c->cap_cnt = M2M_CAP_BUFS;
+    }
+    for (i = 0; i < c->cap_cnt; i++) {
+        if (m2m_map(c, type, i, &c->cap[i].mem, &c->cap[i].len, 1) ||
+            m2m_qbuf_cap(c, i)) {
+            return -1;
+        }
+    }
+    if (xioctl(c->fd, VIDIOC_STREAMON, &type) == -1) {
+        loge("v4l2m2m streamon capture failed: %d\n", errno);
+        return -1;
+    }
+    return 0;
+}
+
+/* the first frame decides between dmabuf import and copy */
+static int m2m_out_setup(struct m2m_ctx *c, const struct video_frame *frm,
+                const struct video_dmabuf *dmabuf)
+{
+    int i, type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+
+    c->out_memory = V4L2_MEMORY_MMAP;
+    if (dmabuf && dmabuf->planes == c->planes &&
+        frm->linesize[0] == c->bytesperline[0]) {
+        c->out_memory = V4L2_MEMORY_DMABUF;
+    }
+    c->out_cnt = m2m_reqbufs(c, type, c->out_memory, M2M_OUT_BUFS);
+    if (c->out_cnt <= 0 && c->out_memory == V4L2_MEMORY_DMABUF) {
+        logw("v4l2m2m dmabuf import not supported, copy frames\n");
+        c->out_memory = V4L2_MEMORY_MMAP;
+        c->out_cnt = m2m_reqbufs(c, type, c->out_memory, M2M_OUT_BUFS);
+    }
+    if (c->out_cnt <= 0) {
+        c->out_cnt = 0;
+        return -1;
+    }
+    if (c->out_cnt > M2M_OUT_BUFS) {
+        c->out_cnt = M2M_OUT_BUFS;
+    }
+    if (c->out_memory == V4L2_MEMORY_MMAP) {
+        for (i = 0; i < c->out_cnt; i++) {
+            if (m2m_map(c, type, i, c->out[i].mem, c->out[i].len, c->planes)) {
+                return -1;
+            }
+        }
+    }
+    if (xioctl(c->fd, VIDIOC_STREAMON, &type) == -1) {
+        loge("v4l2m2m streamon output failed: %d\n", errno);
+        return -1;
+    }
+    logi("v4l2m2m %s input, stride %u\n",
+         c->out_memory == V4L2_MEMORY_DMABUF ? "dmabuf" : "copied", c->bytesperline[0]);
+    c->out_ready = true;
+    return 0;
+}
+
+/* give back output buffers the encoder has consumed */
+static void m2m_reclaim(struct m2m_ctx *c)
+{
+    struct v4l2_buffer buf;
+    struct v4l2_plane planes[VIDEO_MAX_PLANES];
+
+    for (;;) {
+        memset(&buf, 0, sizeof(buf));
+        memset(planes, 0, sizeof(planes));
+        buf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+        buf.memory = c->out_memory;
+        buf.m.planes = planes;
+        buf.length = c->planes;
+        if (xioctl(c->fd, VIDIOC_DQBUF, &buf) == -1) {
+            break;
+        }
+        if (buf.index < (uint32_t)c->out_cnt) {
+            video_frame_deinit(&c->out[buf.index].held);
+            c->out[buf.index].busy = false;
+        }
+    }
+}
+
+static int m2m_free_slot(struct m2m_ctx *c)
+{
+    struct pollfd pfd = { .fd = c->fd, .events = POLLOUT };
+    int i, round;
+
+    for (round = 0; round < 2; round++) {
+        m2m_reclaim(c);
+        for (i = 0; i < c->out_cnt; i++) {
+            if (!c->out[i].busy) {
+                return i;
+            }
+        }
+        poll(&pfd, 1, M2M_TIMEOUT_MS);
+    }
+    return -1;
+}
+
+/* frame planes into one mmap buffer per memory plane, rows at driver stride */
+static void m2m_copy_frame(struct m2m_ctx *c, struct m2m_out *o,
+                const struct video_frame *frm, struct v4l2_plane *planes)
+{
+    uint8_t *dst;
+    uint32_t dst_stride, h, len, y;
+    int i, mp;
+
+    for (i = 0; i < frm->planes; i++) {
+        mp = c->planes > 1 ? i : 0;
+        dst_stride = c->bytesperline[mp];
+        h = frm->height;
+        dst = (uint8_t *)o->mem[mp];
+        if (mp == 0 && i > 0) {
+            /* chroma after luma in the same buffer */
+            dst += c->bytesperline[0] * frm->height;
+            if (i == 2) {
+                dst += c->bytesperline[0] / 2 * frm->height / 2;
+            }
+        }
+        if (i > 0 && (frm->format == PIXEL_FORMAT_I420 || frm->format == PIXEL_FORMAT_NV12)) {
+            h /= 2;
+            if (frm->format == PIXEL_FORMAT_I420) {
+                dst_stride /= 2;
+            }
+        }
+        len = frm->linesize[i] < dst_stride ? frm->linesize[i] : dst_stride;
+        for (y = 0; y < h; y++) {
+            memcpy(dst + y * dst_stride, frm->data[i] + y * frm->linesize[i], len);
+        }
+    }
+    for (mp = 0; mp < c->planes; mp++) {
+        planes[mp].bytesused = c->sizeimage[mp];
+        planes[mp].length = o->len[mp];
+    }
+}
+
+static int m2m_queue_frame(struct m2m_ctx *c, struct video_frame *frm,
+                const struct video_dmabuf *dmabuf)
+{
+    struct v4l2_buffer buf;
+    struct v4l2_plane planes[VIDEO_MAX_PLANES];
+    struct m2m_out *o;
+    int idx, p;
+
+    idx = m2m_free_slot(c);
+    if (idx < 0) {
+        loge("v4l2m2m no free input buffer\n");
+        return -1;
+    }
+    o = &c->out[idx];
+    memset(&buf, 0, sizeof(buf));
+    memset(planes, 0, sizeof(planes));
+    buf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+    buf.memory = c->out_memory;
+    buf.index = idx;
+    buf.m.planes = planes;
+    buf.length = c->planes;
+    buf.field = V4L2_FIELD_NONE;
+    /* pts rides through the encoder in timestamp */
+    buf.timestamp.tv_sec = frm->timestamp / 1000000;
+    buf.timestamp.tv_usec = frm->timestamp % 1000000;
+    if (c->out_memory == V4L2_MEMORY_DMABUF) {
+        if (!dmabuf || dmabuf->planes != c->planes) {
+            loge("v4l2m2m frame has no dmabuf\n");
+            return -1;
+        }
+        for (p = 0; p < c->planes; p++) {
+            planes[p].m.fd = dmabuf->fd[p];
+            planes[p].bytesused = dmabuf->size[p];
+            planes[p].length = dmabuf->size[p];
+        }
+        /* capture buffer stays with the encoder until dequeued */
+        if (video_frame_ref(&o->held, frm)) {
+            return -1;
+        }
+    } else {
+        if (!frm->data[0]) {
+            loge("v4l2m2m frame has no cpu mapping\n");
+            return -1;
+        }
+        m2m_copy_frame(c, o, frm, planes);
+    }
+    if (xioctl(c->fd, VIDIOC_QBUF, &buf) == -1) {
+        loge("v4l2m2m qbuf output failed: %d\n", errno);
+        video_frame_deinit(&o->held);
+        return -1;
+    }
+    o->busy = true;
+    return 0;
+}
+
+static bool h264_has_slice(const uint8_t *p, size_t len)
+{
+    size_t i;
+    uint8_t type;
+
+    for (i = 0; i + 3 < len; i++) {
+        if (p[i] == 0 && p[i+1] == 0 && p[i+2] == 1) {
+            type = p[i+3] & 0x1f;
+            if (type >= 1 && type <= 5) {
+                return true;
+            }
+            i += 2;
+        }
+    }
+    return false;
+}
+
+/* sps and pps with start codes, up to the first other nal */
+static void h264_save_extra(struct live_encoder *e, const uint8_t *p, size_t len)
+{
+    size_t i, end = len;
+    uint8_t type;
+    uint8_t *extra;
+
+    for (i = 0; i + 3 < len; i++) {
+        if (p[i] == 0 && p[i+1] == 0 && p[i+2] == 1) {
+            type = p[i+3] & 0x1f;
+            if (type != 7 && type != 8) {
+                end = (i > 0 && p[i-1] == 0) ? i - 1 : i;
+                break;
+            }
+            i += 2;
+        }
+    }
+    if (end == 0) {
+        return;
+    }
+    extra = (uint8_t *)malloc(end);
+    if (!extra) {
+        return;
+    }
+    memcpy(extra, p, end);
+    free(e->encoder.extra_data);
+    e->encoder.extra_data = extra;
+    e->encoder.extra_size = end;
+    logi("v4l2m2m extra_size=%zu\n", end);
+}
+
+static int m2m_dequeue_packet(struct live_encoder *e, struct video_packet *pkt)
+{
+    struct m2m_ctx *c = (struct m2m_ctx *)e->priv;
+    struct pollfd pfd = { .fd = c->fd, .events = POLLIN };
+    struct v4l2_buffer buf;
+    struct v4l2_plane planes[VIDEO_MAX_PLANES];
+    const uint8_t *data;
+    size_t size;
+
+    for (;;) {
+        memset(&buf, 0, sizeof(buf));
+        memset(planes, 0, sizeof(planes));
+        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+        buf.memory = V4L2_MEMORY_MMAP;
+        buf.m.planes = planes;
+        buf.length = 1;
+        if (xioctl(c->fd, VIDIOC_DQBUF, &buf) == -1) {
+            if (errno != EAGAIN) {
+                loge("v4l2m2m dqbuf capture failed: %d\n", errno);
+                return -1;
+            }
+            if (poll(&pfd, 1, M2M_TIMEOUT_MS) <= 0 || !(pfd.revents & POLLIN)) {
+                return 0;
+            }
+            continue;
+        }
+        if (buf.index >= (uint32_t)c->cap_cnt) {
+            continue;
+        }
+        data = (const uint8_t *)c->cap[buf.index].mem + planes[0].data_offset;
+        size = planes[0].bytesused - planes[0].data_offset;
+        if (size > 0 && !h264_has_slice(data, size)) {
+            /* header only buffer of separate header mode */
+            h264_save_extra(e, data, size);
+            m2m_qbuf_cap(c, buf.index);
+            continue;
+        }
+        if (size == 0) {
+            m2m_qbuf_cap(c, buf.index);
+            continue;
+        }
+        if (!e->encoder.extra_data && (buf.flags & V4L2_BUF_FLAG_KEYFRAME)) {
+            h264_save_extra(e, data, size);
+        }
+        pkt->buf = media_buffer_alloc(size);
+        if (!pkt->buf) {
+            m2m_qbuf_cap(c, buf.index);
+            return -1;
+        }
+        memcpy(pkt->buf->data, data, size);
+        m2m_qbuf_cap(c, buf.index);
+        pkt->data = pkt->buf->data;
+        pkt->size = size;
+        pkt->pts = (uint64_t)buf.timestamp.tv_sec * 1000000 + buf.timestamp.tv_usec;
+        pkt->dts = pkt->pts;
+        pkt->key_frame = (buf.flags & V4L2_BUF_FLAG_KEYFRAME) != 0;
+        pkt->type = pkt->key_frame ? H26X_FRAME_I : H26X_FRAME_P;
+        memcpy(&pkt->encoder, &e->encoder, sizeof(struct video_encoder));
+        return size;
+    }
+}
+
+static void m2m_release(struct m2m_ctx *c)
+{
+    int i, p, type;
+
+    if (c->fd != -1) {
+        type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+        xioctl(c->fd, VIDIOC_STREAMOFF, &type);
+        type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+        xioctl(c->fd, VIDIOC_STREAMOFF, &type);
+    }
+    for (i = 0; i < M2M_OUT_BUFS; i++) {
+        video_frame_deinit(&c->out[i].held);
+        for (p = 0; p < VIDEO_MAX_PLANES; p++) {
+            if (c->out[i].mem[p]) {
+                munmap(c->out[i].mem[p], c->out[i].len[p]);
+            }
+        }
+    }
+    for (i = 0; i < M2M_CAP_BUFS; i++) {
+        if (c->cap[i].mem) {
+            munmap(c->cap[i].mem, c->cap[i].len);
+        }
+    }
+    if (c->fd != -1) {
+        close(c->fd);
+    }
+    free(c);
+}
+
+static int m2m_open(struct live_encoder *e, const struct videocap_config *conf,
+                const struct live_encoder_conf *ec)
+{
+    struct m2m_ctx *c = calloc(1, sizeof(struct m2m_ctx));
+    if (!c) {
+        loge("malloc m2m_ctx failed!\n");
+        return -1;
+    }
+    c->fourcc = pixel_format_to_fourcc(conf->format);
+    c->width = conf->width;
+    c->height = conf->height;
+    c->fd = c->fourcc ? m2m_find(c->fourcc) : -1;
+    if (c->fd == -1) {
+        loge("no v4l2m2m h264 encoder for %s\n", pixel_format_to_string(conf->format));
+        goto failed;
+    }
+    if (m2m_set_formats(c, conf, ec) || m2m_cap_setup(c)) {
+        goto failed;
+    }
+
+    e->encoder.type = VIDEO_CODEC_H264;
+    e->encoder.format = conf->format;
+    e->encoder.width = conf->width;
+    e->encoder.height = conf->height;
+    e->encoder.bitrate = ec->bitrate;
+    e->encoder.framerate.num = conf->fps.num;
+    e->encoder.framerate.den = conf->fps.den;
+    e->encoder.timebase.num = conf->fps.den;
+    e->encoder.timebase.den = conf->fps.num;
+    e->priv = c;
+    return 0;
+
+failed:
+    m2m_release(c);
+    return -1;
+}
+
+static int m2m_encode(struct live_encoder *e, struct video_frame *frm,
+                const struct video_dmabuf *dmabuf, struct video_packet *pkt)
+{
+    struct m2m_ctx *c = (struct m2m_ctx *)e->priv;
+
+    TRACE_SCOPE("rtsp", "v4l2m2m_encode");
+    if (pkt->buf) {
+        media_buffer_unref(pkt->buf);
+        pkt->buf = NULL;
+        pkt->data = NULL;
+        pkt->size = 0;
+    }
+    if (frm->width != c->width || frm->height != c->height) {
+        loge("v4l2m2m frame %ux%u, encoder %ux%u\n", frm->width, frm->height,
+             c->width, c->height);
+        return -1;
+    }
+    if (!c->out_ready && m2m_out_setup(c, frm, dmabuf)) {
+        return -1;
+    }
+    if (m2m_queue_frame(c, frm, dmabuf)) {
+        return -1;
+    }
+    return m2m_dequeue_packet(e, pkt);
+}
+
+static void m2m_close(struct live_encoder *e)
+{
+    m2m_release((struct m2m_ctx *)e->priv);
+    free(e->encoder.extra_data);
+    e->encoder.extra_data = NULL;
+    e->encoder.extra_size = 0;
+    e->priv = NULL;
+}
+
+const struct live_encoder_ops live_encoder_v4l2m2m = {
+    .name   = "v4l2m2m",
+    .dmabuf = true,
+    .probe  = m2m_probe,
+    .open   = m2m_open,
+    .encode = m2m_encode,
+    .close  = m2m_close,
+};
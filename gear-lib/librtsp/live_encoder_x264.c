@@ -0,0 +1,296 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#include "live_encoder.h"
+#include <liblog.h>
+#include <libdarray.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined (ENABLE_TRACE)
+#include <libtrace.h>
+#else
+#define TRACE_SCOPE(cat, name)
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <x264.h>
+
+#ifdef __cplusplus
+}
+#endif
+
+struct x264_ctx {
+    enum pixel_format input_format;
+    struct iovec sei;
+    DARRAY(uint8_t) packet_data;
+    x264_param_t param;
+    x264_t *handle;
+};
+
+static int pixel_format_to_x264_csp(enum pixel_format fmt)
+{
+    switch (fmt) {
+#if X264_BUILD >= 149
+    case PIXEL_FORMAT_UYVY:
+        return X264_CSP_UYVY;
+#endif
+#if X264_BUILD >= 152
+    case PIXEL_FORMAT_YUY2:
+        return X264_CSP_YUYV;
+#endif
+    case PIXEL_FORMAT_NV12:
+        return X264_CSP_NV12;
+    case PIXEL_FORMAT_I420:
+        return X264_CSP_I420;
+    case PIXEL_FORMAT_I444:
+        return X264_CSP_I444;
+    case PIXEL_FORMAT_I422:
+        return X264_CSP_I422;
+    default:
+        loge("invalid pixel_format %d\n", fmt);
+        return X264_CSP_NONE;
+    }
+}
+
+static int init_header(struct live_encoder *e, struct x264_ctx *c)
+{
+    x264_nal_t *nals;
+    int nal_cnt, nal_bytes, i;
+
+    DARRAY(uint8_t) extra;
+    DARRAY(uint8_t) sei;
+
+    da_init(extra);
+    da_init(sei);
+
+    nal_bytes = x264_encoder_headers(c->handle, &nals, &nal_cnt);
+    if (nal_bytes < 0) {
+        loge("x264_encoder_headers failed!\n");
+        return -1;
+    }
+
+    for (i = 0; i < nal_cnt; i++) {
+        x264_nal_t *nal = nals + i;
+        if (nal->i_type == NAL_SEI) {
+            da_push_back_array(sei, nal->p_payload, nal->i_payload);
+        } else {
+            da_push_back_array(extra, nal->p_payload, nal->i_payload);
+        }
+    }
+
+    e->encoder.extra_data = extra.array;
+    e->encoder.extra_size = extra.num;
+    c->sei.iov_base = sei.array;
+    c->sei.iov_len = sei.num;
+    logd("encoder.extra_data=%p, encoder.extra_size=%d\n",
+          e->encoder.extra_data, e->encoder.extra_size);
+
+    return 0;
+}
+
+static int x264_open(struct live_encoder *e, const struct videocap_config *conf,
+                     const struct live_encoder_conf *ec)
+{
+    struct x264_ctx *c = calloc(1, sizeof(struct x264_ctx));
+    if (!c) {
+        loge("malloc x264_ctx failed!\n");
+        return -1;
+    }
+    if (ec->preset == LIVE_PRESET_THROUGHPUT) {
+        x264_param_default_preset(&c->param, "veryfast", NULL);
+    } else {
+        x264_param_default_preset(&c->param, "ultrafast", "zerolatency");
+    }
+    c->input_format = conf->format;
+
+    c->param.i_threads = ec->threads ? ec->threads : X264_THREADS_AUTO;
+    c->param.b_sliced_threads = ec->sliced_threads;
+    c->param.rc.i_vbv_max_bitrate = ec->vbv_max_bitrate;
+    c->param.rc.i_vbv_buffer_size = ec->vbv_buffer;
+    c->param.rc.i_bitrate = ec->bitrate;
+    c->param.rc.i_rc_method = X264_RC_ABR;
+    c->param.rc.b_filler = true;
+    /* gop cache lets late joiners start at once, no need of all intra */
+    c->param.i_keyint_max = ec->keyint;
+    /* refresh start is marked keyframe, gop cache still starts there */
+    c->param.b_intra_refresh = ec->intra_refresh;
+    c->param.b_repeat_headers = 1;
+    c->param.b_vfr_input = 0;
+    c->param.i_log_level = X264_LOG_INFO;
+    c->param.i_csp = pixel_format_to_x264_csp(c->input_format);
+
+    c->param.i_width = conf->width;
+    c->param.i_height = conf->height;
+    c->param.i_fps_num = conf->fps.num;
+    c->param.i_fps_den = conf->fps.den;
+
+    x264_param_apply_profile(&c->param, NULL);
+
+    c->handle = x264_encoder_open(&c->param);
+    if (c->handle == 0) {
+        loge("x264_encoder_open failed!\n");
+        goto failed;
+    }
+
+    if (init_header(e, c)) {
+        loge("init_header failed!\n");
+        goto failed;
+    }
+
+    e->encoder.type = VIDEO_CODEC_H264;
+    e->encoder.format = conf->format;
+    e->encoder.width = conf->width;
+    e->encoder.height = conf->height;
+    e->encoder.bitrate = ec->bitrate;
+    e->encoder.framerate.num = conf->fps.num;
+    e->encoder.framerate.den = conf->fps.den;
+    e->encoder.timebase.num = c->param.i_fps_den;
+    e->encoder.timebase.den = c->param.i_fps_num;
+    logi("width=%d, height=%d, timebase=%d/%d\n", e->encoder.width, e->encoder.height, e->encoder.timebase.num, e->encoder.timebase.den);
+    logi("x264 %s, threads=%d%s, bitrate=%u vbv=%u/%u, keyint=%u%s\n",
+         ec->preset == LIVE_PRESET_THROUGHPUT ? "throughput" : "latency",
+         c->param.i_threads, ec->sliced_threads ? " sliced" : "", ec->bitrate,
+         ec->vbv_max_bitrate, ec->vbv_buffer, ec->keyint,
+         ec->intra_refresh ? " intra-refresh" : "");
+
+    e->priv = c;
+    return 0;
+
+failed:
+    if (c->handle) {
+        x264_encoder_close(c->handle);
+        c->handle = 0;
+    }
+    free(c);
+    return -1;
+}
+
+static int init_pic_data(struct x264_ctx *c, x264_picture_t *pic,
+                struct video_frame *frame)
+{
+    int i;
+    x264_picture_init(pic);
+    pic->i_pts = frame->timestamp;
+    pic->img.i_csp = c->param.i_csp;
+
+    switch (c->param.i_csp) {
+#if X264_BUILD >= 149
+    case X264_CSP_YUYV:
+        pic->img.i_plane = 1;
+        break;
+#endif
+    case X264_CSP_NV12:
+        pic->img.i_plane = 2;
+        break;
+    case X264_CSP_I420:
+    case X264_CSP_I444:
+    case X264_CSP_I422:
+        pic->img.i_plane = 3;
+        break;
+    default:
+        loge("unsupport colorspace type %d\n", c->param.i_csp);
+        break;
+    }
+    if (pic->img.i_plane != frame->planes) {
+        loge("video frame planes mismatch: pic->img.i_plane=%d, frame->planes=%d\n",
+pic->img.i_plane, frame->planes);
+        return -1;
+    }
+
+    for (i = 0; i < pic->img.i_plane; i++) {
+        pic->img.i_stride[i] = (int)frame->linesize[i];
+        pic->img.plane[i] = frame->data[i];
+    }
+    return 0;
+}
+
+static int fill_packet(struct live_encoder *e, struct x264_ctx *c, struct video_packet *pkt,
+                       x264_nal_t *nals, int nal_cnt, x264_picture_t *pic_out)
+{
+    int i;
+    if (!nal_cnt)
+        return 0;
+
+    da_free(c->packet_data);
+
+    for (i = 0; i < nal_cnt; i++) {
+        x264_nal_t *nal = nals + i;
+        da_push_back_array(c->packet_data, nal->p_payload, nal->i_payload);
+    }
+
+    pkt->data = c->packet_data.array;
+    pkt->size = c->packet_data.num;
+    pkt->pts = pic_out->i_pts;
+    pkt->dts = pic_out->i_dts;
+    pkt->key_frame = pic_out->b_keyframe != 0;
+    pkt->type = pkt->key_frame ? H26X_FRAME_I : H26X_FRAME_P;
+
+    memcpy(&pkt->encoder, &e->encoder, sizeof(struct video_encoder));
+    logd("pkt->dts=%d, pkt->encoder.extra_size = %d\n", pkt->dts, pkt->encoder.extra_size);
+    return pkt->size;
+}
+
+static int x264_encode(struct live_encoder *e, struct video_frame *frm,
+                       const struct video_dmabuf *dmabuf, struct video_packet *pkt)
+{
+    x264_picture_t pic_in, pic_out;
+    x264_nal_t *nal;
+    int nal_cnt = 0;
+    int nal_bytes = 0;
+    struct x264_ctx *c = (struct x264_ctx *)e->priv;
+
+    TRACE_SCOPE("rtsp", "x264_encode");
+    if (init_pic_data(c, &pic_in, frm)) {
+        return -1;
+    }
+
+    nal_bytes = x264_encoder_encode(c->handle, &nal, &nal_cnt, &pic_in,
+                    &pic_out);
+    if (nal_bytes < 0) {
+        loge("x264_encoder_encode failed!\n");
+        return -1;
+    }
+    return fill_packet(e, c, pkt, nal, nal_cnt, &pic_out);
+}
+
+static void x264_close(struct live_encoder *e)
+{
+    struct x264_ctx *c = (struct x264_ctx *)e->priv;
+    //x264_encoder_close(c->handle);//XXX cause segfault
+    da_free(c->packet_data);
+    free(c->sei.iov_base);
+    free(e->encoder.extra_data);
+    e->encoder.extra_data = NULL;
+    e->encoder.extra_size = 0;
+    free(c);
+    e->priv = NULL;
+}
+
+const struct live_encoder_ops live_encoder_x264 = {
+    .name   = "x264",
+    .dmabuf = false,
+    .open   = x264_open,
+    .encode = x264_encode,
+    .close  = x264_close,
+};
@@ -23,8 +23,11 @@
 #include "media_source.h"
 #include "sdp.h"
 #include <libdict.h>
-#include <libatomic.h>
-#include <strings.h>
+#include <liblog.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
 
 #define REGISTER_MEDIA_SOURCE(x)                                               \
     {                                                                          \
@@ -32,39 +35,75 @@
             rtsp_media_source_register(&media_source_##x);                     \
     }
 
-static struct media_source *first_media_source = NULL;
-static struct media_source **last_media_source = &first_media_source;
-static int registered = 0;
+/*
+ * registry is hashed by lowercased name, looked up by every DESCRIBE, SETUP
+ * and PLAY of all shards, written only by register
+ */
+static struct {
+    dict *sources;
+    pthread_rwlock_t lock;
+} g_registry = {NULL, PTHREAD_RWLOCK_INITIALIZER};
+static pthread_once_t registered = PTHREAD_ONCE_INIT;
 
-void rtsp_media_source_register(struct media_source *ms)
+static void media_source_key(char *key, size_t len, const char *name)
 {
-    struct media_source **p = last_media_source;
-    ms->next = NULL;
-    while (*p || atomic_ptr_cas((void * volatile *)p, NULL, ms))
-        p = &(*p)->next;
-    last_media_source = &ms->next;
+    size_t i;
+    for (i = 0; i < len - 1 && name[i]; i++) {
+        key[i] = tolower((unsigned char)name[i]);
+    }
+    key[i] = '\0';
 }
 
-void media_source_register_all(void)
+int rtsp_media_source_register(struct media_source *ms)
 {
-    if (registered)
-        return;
-    registered = 1;
+    char key[STREAM_NAME_LEN];
+    int ret = 0;
+
+    media_source_key(key, sizeof(key), ms->name);
+    pthread_mutex_init(&ms->sdp_lock, NULL);
+    pthread_rwlock_wrlock(&g_registry.lock);
+    if (!g_registry.sources) {
+        g_registry.sources = dict_new();
+    }
+    if (!g_registry.sources || dict_get(g_registry.sources, key, NULL)) {
+        loge("media_source %s register failed!\n", ms->name);
+        ret = -1;
+    } else {
+        dict_add(g_registry.sources, key, (char *)ms);
+    }
+    pthread_rwlock_unlock(&g_registry.lock);
+    return ret;
+}
 
+static void register_builtin(void)
+{
     REGISTER_MEDIA_SOURCE(h264);
+    REGISTER_MEDIA_SOURCE(h265);
 #ifdef ENABLE_LIVEVIEW
     REGISTER_MEDIA_SOURCE(uvc);
 #endif
+#ifdef ENABLE_MP4
+    REGISTER_MEDIA_SOURCE(mp4);
+#endif
+}
+
+/* also done on first lookup, so startup does not pay for it */
+void media_source_register_all(void)
+{
+    pthread_once(&registered, register_builtin);
 }
 
 struct media_source *rtsp_media_source_lookup(char *name)
 {
-    struct media_source *p;
-    for (p = first_media_source; p != NULL; p = p->next) {
-        if (!strcasecmp(name, p->name))
-            break;
-    }
-    return p;
+    char key[STREAM_NAME_LEN];
+    struct media_source *ms;
+
+    media_source_register_all();
+    media_source_key(key, sizeof(key), name);
+    pthread_rwlock_rdlock(&g_registry.lock);
+    ms = (struct media_source *)dict_get(g_registry.sources, key, NULL);
+    pthread_rwlock_unlock(&g_registry.lock);
+    return ms;
 }
 
 bool rtsp_media_source_alive(struct media_source *ms)
@@ -74,3 +113,37 @@ bool rtsp_media_source_alive(struct media_source *ms)
     }
     return ms->is_active;
 }
+
+int media_source_sdp(struct media_source *ms, char *buf, size_t len)
+{
+    char tmp[SDP_LEN_MAX];
+    int n;
+
+    pthread_mutex_lock(&ms->sdp_lock);
+    if (!ms->sdp) {
+        n = ms->sdp_generate(ms, tmp, sizeof(tmp));
+        if (n < 0 || n >= (int)sizeof(tmp) || !(ms->sdp = strdup(tmp))) {
+            pthread_mutex_unlock(&ms->sdp_lock);
+            loge("media_source %s sdp_generate failed!\n", ms->name);
+            return -1;
+        }
+        ms->sdp_len = n;
+    }
+    if (ms->sdp_len >= len) {
+        pthread_mutex_unlock(&ms->sdp_lock);
+        return -1;
+    }
+    memcpy(buf, ms->sdp, ms->sdp_len + 1);
+    n = (int)ms->sdp_len;
+    pthread_mutex_unlock(&ms->sdp_lock);
+    return n;
+}
+
+void media_source_sdp_invalidate(struct media_source *ms)
+{
+    pthread_mutex_lock(&ms->sdp_lock);
+    free(ms->sdp);
+    ms->sdp = NULL;
+    ms->sdp_len = 0;
+    pthread_mutex_unlock(&ms->sdp_lock);
+}
@@ -21,37 +21,96 @@
  ******************************************************************************/
 #ifndef MEDIA_SOURCE_H
 #define MEDIA_SOURCE_H
+#include <libposix.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <pthread.h>
 #include <sys/time.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+struct queue_item;
+
 #define STREAM_NAME_LEN     (128)
 #define DESCRIPTION_LEN     (128)
-#define SDP_LEN_MAX         8192
+#define SDP_LEN_MAX         GEAR_CONFIG_SDP_LEN_MAX
 
 typedef struct media_source {
     char name[STREAM_NAME_LEN];
     char info[DESCRIPTION_LEN];
-    char sdp[SDP_LEN_MAX];
+    const char *file;   /* played by file sources, NULL for live */
     struct timeval tm_create;
-    int (*sdp_generate)(struct media_source *ms);
+    /* writes sdp into buf, returns its length or -1 */
+    int (*sdp_generate)(struct media_source *ms, char *buf, size_t len);
     int (*_open)(struct media_source *ms, const char *uri);
     int (*_read)(struct media_source *ms, void **data, size_t *len);
     int (*_write)(struct media_source *ms, void *data, size_t len);
     void (*_close)(struct media_source *ms);
+    /*
+     * optional fan-out: one producer serves all sessions, subscribe returns
+     * an evfd readable while branch of name has packets, pop is nonblock
+     * and each item popped is given back with release, payload is a
+     * media_packet in item->opaque.iov_base shared by all subscribers
+     */
+    int (*_subscribe)(struct media_source *ms, const char *name);
+    void (*_unsubscribe)(struct media_source *ms, const char *name);
+    struct queue_item *(*_pop)(struct media_source *ms, const char *name);
+    void (*_release)(struct media_source *ms, struct queue_item *it);
+    /*
+     * optional pacing: a source with tick_ms is read every tick_ms until
+     * _read returns 1, which means the next packet is not due yet
+     */
+    uint32_t tick_ms;
+    /* optional, move to the sync point at or before ts ms, play at scale
+     * times the recorded speed, returns the time moved to in ms or -1 */
+    int64_t (*_seek)(struct media_source *ms, uint64_t ts, double scale);
     int (*get_frame)();
     void *opaque;
     bool is_active;
-    struct media_source *next;
+    /* generated on first DESCRIBE, kept until invalidated */
+    char *sdp;
+    size_t sdp_len;
+    pthread_mutex_t sdp_lock;
 } media_source_t;
 
 void media_source_register_all();
 bool media_alive(struct media_source *ms);
+/* copy of cached sdp into buf, returns its length or -1 */
+int media_source_sdp(struct media_source *ms, char *buf, size_t len);
+/* encoder extradata changed, next DESCRIBE generates sdp again */
+void media_source_sdp_invalidate(struct media_source *ms);
+
+/*
+ * encoder of the live source (ENABLE_LIVEVIEW). latency preset is x264
+ * ultrafast/zerolatency, throughput is veryfast with lookahead and frame
+ * threads, more delay for less cpu per frame. sliced threads split each
+ * frame over threads instead of pipelining frames, no added latency.
+ * intra refresh replaces the periodic IDR by a column of intra blocks
+ * moving over keyint frames, the bitrate stays flat and a player recovers
+ * within keyint frames. zero fields take the defaults below. set applies
+ * when the camera is opened next, after the last session closed it
+ */
+enum live_encoder_preset {
+    LIVE_PRESET_LATENCY,
+    LIVE_PRESET_THROUGHPUT,
+};
+
+struct live_encoder_conf {
+    enum live_encoder_preset preset;
+    int threads;                /* 0 for one per core */
+    bool sliced_threads;        /* default true */
+    uint32_t bitrate;           /* kbps, default 2500 */
+    uint32_t vbv_max_bitrate;   /* kbps, default bitrate */
+    uint32_t vbv_buffer;        /* kbit, default one second of bitrate */
+    uint32_t keyint;            /* frames, default one second */
+    bool intra_refresh;
+};
+
+void media_source_live_get_encoder(struct live_encoder_conf *conf);
+int media_source_live_set_encoder(const struct live_encoder_conf *conf);
 
 #ifdef __cplusplus
 }
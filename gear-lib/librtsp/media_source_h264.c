@@ -25,15 +25,20 @@
 #include <libmedia-io.h>
 #include "sdp.h"
 #include "media_source.h"
+#include "rtp.h"
+#include "transport_session.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #define __STDC_FORMAT_MACROS
 #include <inttypes.h>
 
+/* annex-b file source, H.264 and H.265 differ only in codec and sdp */
 struct h264_source_ctx {
     const char name[32];
+    enum video_codec_type codec;
     struct queue *q;
+    struct iovec *data;     /* whole file, queued packets point into it */
     int sps_cnt;
     int duration;
 };
@@ -81,6 +86,7 @@ static int h264_parser_frame(struct h264_source_ctx *c, const char *name)
         loge("file_dump %s failed!\n", name);
         return -1;
     }
+    c->data = data;
     start = data->iov_base;
     end = start + data->iov_len;
     nalu = h264_find_start_code(start, end);
@@ -89,14 +95,17 @@ static int h264_parser_frame(struct h264_source_ctx *c, const char *name)
         nalu2 = h264_find_start_code(nalu + 4, end);
         bytes = nalu2 - nalu;
         pkt = media_packet_create(MEDIA_TYPE_VIDEO, MEDIA_MEM_SHALLOW, (uint8_t *)nalu, bytes);
-        pkt->video->pts = 90000 * count++;
-        pkt->video->dts = 90000 * count++;
-        pkt->video->encoder.timebase.num = 30;
-        pkt->video->encoder.timebase.den = 1;
+        /* one nalu goes out per session tick */
+        pkt->video->pts = TRANSPORT_FRAME_INTERVAL_MS * count;
+        pkt->video->dts = TRANSPORT_FRAME_INTERVAL_MS * count++;
+        pkt->video->encoder.timebase.num = 1;
+        pkt->video->encoder.timebase.den = 1000;
+        pkt->video->encoder.type = c->codec;
 
         it = queue_item_alloc(c->q, pkt->video->data, pkt->video->size, pkt);
+        media_packet_destroy(pkt);
         if (!it) {
-            loge("item_alloc packet type %d failed!\n", pkt->type);
+            loge("item_alloc packet failed!\n");
             ret = -1;
             goto exit;
         }
@@ -110,17 +119,18 @@ static int h264_parser_frame(struct h264_source_ctx *c, const char *name)
     c->duration = 40 * count;
 
 exit:
-    free(data->iov_base);
     return ret;
 }
 
-static int h264_file_open(struct media_source *ms, const char *name)
+static int h26x_file_open(struct media_source *ms, const char *name,
+                enum video_codec_type codec)
 {
     struct h264_source_ctx *c = calloc(1, sizeof(struct h264_source_ctx));
     if (!c) {
         loge("calloc h264_source_ctx failed!\n");
         return -1;
     }
+    c->codec = codec;
 
     c->q = queue_create();
     if (!c->q) {
@@ -133,17 +143,37 @@ static int h264_file_open(struct media_source *ms, const char *name)
     return 0;
 }
 
+static int h264_file_open(struct media_source *ms, const char *name)
+{
+    return h26x_file_open(ms, name, VIDEO_CODEC_H264);
+}
+
+static int h265_file_open(struct media_source *ms, const char *name)
+{
+    return h26x_file_open(ms, name, VIDEO_CODEC_H265);
+}
+
 static void h264_file_close(struct media_source *ms)
 {
     struct h264_source_ctx *c = (struct h264_source_ctx *)ms->opaque;
     queue_destroy(c->q);
+    if (c->data) {
+        free(c->data->iov_base);
+        free(c->data);
+    }
     free(c);
 }
 
 static int h264_file_read_frame(struct media_source *ms, void **data, size_t *len)
 {
     struct h264_source_ctx *c = (struct h264_source_ctx *)ms->opaque;
-    struct queue_item *it = queue_pop(c->q);
+    /* called in loop thread, never wait, empty queue is end of file */
+    struct queue_item *it = queue_pop_wait(c->q, 0);
+    if (!it) {
+        *data = NULL;
+        *len = 0;
+        return -1;
+    }
     *data = (struct media_packet *)it->opaque.iov_base;
     *len = it->opaque.iov_len;
     logd("queue_pop ptr=%p, data=%p, len=%d\n", it->opaque.iov_base, *data, it->opaque.iov_len);
@@ -171,40 +201,76 @@ static int is_auth()
     return 0;
 }
 
-static int sdp_generate(struct media_source *ms)
+static int sdp_prefix(struct media_source *ms, char *p, size_t len)
 {
     int n = 0;
-    char p[SDP_LEN_MAX];
     uint32_t session_id = get_random_number();
     gettimeofday(&ms->tm_create, NULL);
-    n += snprintf(p+n, sizeof(p)-n, "v=0\n");
-    n += snprintf(p+n, sizeof(p)-n, "o=%s %"PRIu32" %"PRIu32" IN IP4 %s\n", is_auth()?"username":"-", session_id, 1, "0.0.0.0");
-    n += snprintf(p+n, sizeof(p)-n, "s=%s\n", ms->name);
-    n += snprintf(p+n, sizeof(p)-n, "i=%s\n", ms->info);
-    n += snprintf(p+n, sizeof(p)-n, "c=IN IP4 0.0.0.0\n");
-    n += snprintf(p+n, sizeof(p)-n, "t=0 0\n");
-    n += snprintf(p+n, sizeof(p)-n, "a=range:npt=0-\n");
-    n += snprintf(p+n, sizeof(p)-n, "a=sendonly\n");
-    n += snprintf(p+n, sizeof(p)-n, "a=control:*\n");
-    n += snprintf(p+n, sizeof(p)-n, "a=source-filter: incl IN IP4 * %s\r\n", "0.0.0.0");
-    n += snprintf(p+n, sizeof(p)-n, "a=rtcp-unicast: reflection\r\n");
-    n += snprintf(p+n, sizeof(p)-n, "a=x-qt-text-nam:%s\r\n", ms->name);
-    n += snprintf(p+n, sizeof(p)-n, "a=x-qt-text-inf:%s\r\n", ms->info);
-
-    n += snprintf(p+n, sizeof(p)-n, "m=video 0 RTP/AVP 96\r\n");
-    n += snprintf(p+n, sizeof(p)-n, "a=rtpmap:96 H264/90000\r\n");
-    n += snprintf(p+n, sizeof(p)-n, "a=fmtp:96 packetization-mode=1; profile-level-id=4D4028; sprop-parameter-sets=Z01AKJpkA8ARPy4C3AQEBQAAAwPoAADqYOhgBGMAAF9eC7y40MAIxgAAvrwXeXCg,aO44gA==;\r\n");
-    n += snprintf(p+n, sizeof(p)-n, "a=cliprect:0,0,240,320\r\n");
-
-    strcpy(ms->sdp, p);
-    return 0;
+    n += snprintf(p+n, len-n, "v=0\n");
+    n += snprintf(p+n, len-n, "o=%s %"PRIu32" %"PRIu32" IN IP4 %s\n", is_auth()?"username":"-", session_id, 1, "0.0.0.0");
+    n += snprintf(p+n, len-n, "s=%s\n", ms->name);
+    n += snprintf(p+n, len-n, "i=%s\n", ms->info);
+    n += snprintf(p+n, len-n, "c=IN IP4 0.0.0.0\n");
+    n += snprintf(p+n, len-n, "t=0 0\n");
+    n += snprintf(p+n, len-n, "a=range:npt=0-\n");
+    n += snprintf(p+n, len-n, "a=sendonly\n");
+    n += snprintf(p+n, len-n, "a=control:*\n");
+    n += snprintf(p+n, len-n, "a=source-filter: incl IN IP4 * %s\r\n", "0.0.0.0");
+    n += snprintf(p+n, len-n, "a=rtcp-unicast: reflection\r\n");
+    n += snprintf(p+n, len-n, "a=x-qt-text-nam:%s\r\n", ms->name);
+    n += snprintf(p+n, len-n, "a=x-qt-text-inf:%s\r\n", ms->info);
+    return n;
+}
+
+static int sdp_generate(struct media_source *ms, char *p, size_t len)
+{
+    int n = 0;
+    n += sdp_prefix(ms, p, len);
+
+    n += snprintf(p+n, len-n, "m=video 0 RTP/AVP 96\r\n");
+    n += snprintf(p+n, len-n, "a=rtpmap:96 H264/90000\r\n");
+    n += snprintf(p+n, len-n, "a=rtcp-fb:96 nack\r\n");
+    n += snprintf(p+n, len-n, "a=fmtp:96 packetization-mode=1; profile-level-id=4D4028; sprop-parameter-sets=Z01AKJpkA8ARPy4C3AQEBQAAAwPoAADqYOhgBGMAAF9eC7y40MAIxgAAvrwXeXCg,aO44gA==;\r\n");
+    n += snprintf(p+n, len-n, "a=cliprect:0,0,240,320\r\n");
+    return n;
+}
+
+/* sprop parameter sets come from the file, scanned once as sdp is cached */
+static int h265_sdp_generate(struct media_source *ms, char *p, size_t len)
+{
+    int n = 0, ret;
+    struct iovec *data = file_dump(ms->file);
+    if (!data) {
+        loge("file_dump %s failed!\n", ms->file);
+        return -1;
+    }
+    n += sdp_prefix(ms, p, len);
+    ret = sdp_h265_media(p+n, len-n, RTP_PT_H265, data->iov_base, data->iov_len);
+    free(data->iov_base);
+    free(data);
+    if (ret < 0) {
+        loge("sdp_h265_media failed!\n");
+        return -1;
+    }
+    return n + ret;
 }
 
 struct media_source media_source_h264 = {
     .name         = "H264",
+    .file         = "sample.264",
     .sdp_generate = sdp_generate,
     ._open         = h264_file_open,
     ._read         = h264_file_read_frame,
     ._write        = h264_file_write,
     ._close        = h264_file_close,
 };
+
+struct media_source media_source_h265 = {
+    .name         = "H265",
+    .file         = "sample.265",
+    .sdp_generate = h265_sdp_generate,
+    ._open         = h265_file_open,
+    ._read         = h264_file_read_frame,
+    ._write        = h264_file_write,
+    ._close        = h264_file_close,
+};
@@ -23,37 +23,40 @@
 #include <liblog.h>
 #include <libdarray.h>
 #include <libtime.h>
+#include <libthread.h>
+#include <libqueue.h>
 #include "sdp.h"
 #include "media_source.h"
+#include "live_encoder.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
 #define __STDC_FORMAT_MACROS
 #include <inttypes.h>
-
-#ifdef __cplusplus
-extern "C" {
+#if defined (ENABLE_TRACE)
+#include <libtrace.h>
+#else
+#define TRACE_SCOPE(cat, name)
+#define TRACE_FLOW_BEGIN(cat, name, id)
+#define TRACE_FLOW_END(cat, name, id)
 #endif
-#include <x264.h>
 
-#ifdef __cplusplus
-}
-#endif
 
-struct x264_ctx {
-    enum pixel_format input_format;
-    struct iovec sei;
-    DARRAY(uint8_t) packet_data;
-    x264_param_t param;
-    x264_t *handle;
-    bool first_frame;
-    bool append_extra;
-    uint64_t cur_pts;
-    uint32_t timebase_num;
-    uint32_t timebase_den;
-    struct video_encoder encoder;
-    void *parent;
+/* packets a slow subscriber may lag behind before its oldest are dropped */
+#define LIVE_FANOUT_DEPTH   (32)
+/* longest gop kept for instant start, longer ones are not cached */
+#define LIVE_GOP_MAX        (64)
+/* capture frames waiting for a dmabuf encoder, each holds a driver buffer */
+#define LIVE_RING_DEPTH     (2)
+
+/* hardware first, x264 is the fallback, NULL terminated */
+static const struct live_encoder_ops *live_encoders[] = {
+#if defined (ENABLE_V4L2M2M)
+    &live_encoder_v4l2m2m,
+#endif
+    &live_encoder_x264,
+    NULL,
 };
 
 struct live_source_ctx {
@@ -61,389 +64,532 @@ struct live_source_ctx {
     struct avcap_config conf;
     struct avcap_ctx *uvc;
     bool uvc_opened;
-    struct x264_ctx *x264;
-    struct iovec extradata;
+    bool dmabuf;                    /* frames popped from ring with dmabuf */
+    struct live_encoder enc;
+    struct live_encoder_conf enc_conf;
+    struct media_clock *clock;      /* capture ns to ticks of the timebase */
+    int clock_track;
     struct media_frame frm;
     struct media_packet *pkt;
     void *priv;
+    /* one capture and encode thread fans packets out to all sessions */
+    pthread_mutex_t lock;
+    int users;
+    int subs;
+    struct queue *q;
+    struct thread *thread;
+    /* refs of packets since last keyframe, replayed to new subscriber */
+    pthread_mutex_t gop_lock;
+    struct queue_item *gop[LIVE_GOP_MAX];
+    int gop_cnt;
+    struct live_sub *backlog;
+};
+
+/* gop snapshot a new subscriber pops before its live branch */
+struct live_sub {
+    char name[32];
+    struct queue_item *items[LIVE_GOP_MAX];
+    int cnt;
+    int idx;
+    struct live_sub *next;
 };
 
-static struct live_source_ctx g_live;
+static struct live_source_ctx g_live = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .gop_lock = PTHREAD_MUTEX_INITIALIZER,
+    .enc_conf = {
+        .preset = LIVE_PRESET_LATENCY,
+        .sliced_threads = true,
+        .bitrate = 2500,
+    },
+};
 
-static int pixel_format_to_x264_csp(enum pixel_format fmt)
+void media_source_live_get_encoder(struct live_encoder_conf *conf)
 {
-    switch (fmt) {
-#if X264_BUILD >= 149
-    case PIXEL_FORMAT_UYVY:
-        return X264_CSP_UYVY;
-#endif
-#if X264_BUILD >= 152
-    case PIXEL_FORMAT_YUY2:
-        return X264_CSP_YUYV;
-#endif
-    case PIXEL_FORMAT_NV12:
-        return X264_CSP_NV12;
-    case PIXEL_FORMAT_I420:
-        return X264_CSP_I420;
-    case PIXEL_FORMAT_I444:
-        return X264_CSP_I444;
-    case PIXEL_FORMAT_I422:
-        return X264_CSP_I422;
-    default:
-        loge("invalid pixel_format %d\n", fmt);
-        return X264_CSP_NONE;
-    }
+    struct live_source_ctx *c = &g_live;
+    pthread_mutex_lock(&c->lock);
+    *conf = c->enc_conf;
+    pthread_mutex_unlock(&c->lock);
 }
 
-static int init_header(struct x264_ctx *c)
+int media_source_live_set_encoder(const struct live_encoder_conf *conf)
 {
-    x264_nal_t *nals;
-    int nal_cnt, nal_bytes, i;
-
-    DARRAY(uint8_t) extra;
-    DARRAY(uint8_t) sei;
-
-    da_init(extra);
-    da_init(sei);
-
-    nal_bytes = x264_encoder_headers(c->handle, &nals, &nal_cnt);
-    if (nal_bytes < 0) {
-        loge("x264_encoder_headers failed!\n");
+    struct live_source_ctx *c = &g_live;
+    if (!conf || conf->threads < 0 ||
+        (conf->preset != LIVE_PRESET_LATENCY && conf->preset != LIVE_PRESET_THROUGHPUT)) {
         return -1;
     }
+    pthread_mutex_lock(&c->lock);
+    c->enc_conf = *conf;
+    pthread_mutex_unlock(&c->lock);
+    return 0;
+}
 
-    for (i = 0; i < nal_cnt; i++) {
-        x264_nal_t *nal = nals + i;
-        if (nal->i_type == NAL_SEI) {
-            da_push_back_array(sei, nal->p_payload, nal->i_payload);
-        } else {
-            da_push_back_array(extra, nal->p_payload, nal->i_payload);
-        }
+/* zero fields of the user conf to defaults of the opened camera */
+static void live_encoder_conf_fill(struct live_encoder_conf *ec, const struct videocap_config *vc)
+{
+    uint32_t fps = vc->fps.den ? vc->fps.num / vc->fps.den : 0;
+    if (!ec->bitrate) {
+        ec->bitrate = 2500;
     }
+    if (!ec->vbv_max_bitrate) {
+        ec->vbv_max_bitrate = ec->bitrate;
+    }
+    if (!ec->vbv_buffer) {
+        ec->vbv_buffer = ec->vbv_max_bitrate;
+    }
+    if (!ec->keyint) {
+        ec->keyint = fps ? fps : 30;
+    }
+}
 
-    c->encoder.extra_data = extra.array;
-    c->encoder.extra_size = extra.num;
-    c->sei.iov_base = sei.array;
-    c->sei.iov_len = sei.num;
-    //DUMP_BUFFER(c->encoder.extra_data, c->encoder.extra_size);
-    logd("encoder.extra_data=%p, encoder.extra_size=%d\n",
-          c->encoder.extra_data, c->encoder.extra_size);
-
+static int is_auth()
+{
     return 0;
 }
 
-static struct x264_ctx *x264_open(struct live_source_ctx *cc)
+static uint32_t get_random_number()
 {
-    struct x264_ctx *c = calloc(1, sizeof(struct x264_ctx));
-    if (!c) {
-        loge("malloc x264_ctx failed!\n");
-        return NULL;
-    }
-    x264_param_default_preset(&c->param, "ultrafast" , "zerolatency");
-    c->input_format = cc->uvc->conf.video.format;
-
-    c->param.rc.i_vbv_max_bitrate = 2500;
-    c->param.rc.i_vbv_buffer_size = 2500;
-    c->param.rc.i_bitrate = 2500;
-    c->param.rc.i_rc_method = X264_RC_ABR;
-    c->param.rc.b_filler = true;
-    c->param.i_keyint_max = 1;
-    c->param.b_repeat_headers = 1;
-    c->param.b_vfr_input = 0;
-    c->param.i_log_level = X264_LOG_INFO;
-    c->param.i_csp = pixel_format_to_x264_csp(c->input_format);
-
-    c->param.i_width = cc->uvc->conf.video.width;
-    c->param.i_height = cc->uvc->conf.video.height;
-    c->param.i_fps_num = cc->uvc->conf.video.fps.num;
-    c->param.i_fps_den = cc->uvc->conf.video.fps.den;
-
-    x264_param_apply_profile(&c->param, NULL);
-
-    c->handle = x264_encoder_open(&c->param);
-    if (c->handle == 0) {
-        loge("x264_encoder_open failed!\n");
-        goto failed;
-    }
+    struct timeval now = {0};
+    gettimeofday(&now, NULL);
+    srand(now.tv_usec);
+    return (rand() % ((uint32_t)-1));
+}
 
-    c->first_frame = true;
-    c->append_extra = false;
+static void *item_alloc_hook(void *data, size_t len, void *arg)
+{
+    return media_packet_copy((struct media_packet *)arg, MEDIA_MEM_DEEP);
+}
 
-    c->timebase_num = c->param.i_fps_den;
-    c->timebase_den = c->param.i_fps_num;
+static void item_free_hook(void *data)
+{
+    media_packet_destroy((struct media_packet *)data);
+}
 
-    if (init_header(c)) {
-        loge("init_header failed!\n");
-        goto failed;
+static int live_query_frame(struct live_source_ctx *c, struct video_dmabuf *dmabuf)
+{
+    if (!c->dmabuf) {
+        return avcap_query_frame(c->uvc, &c->frm) < 0 ? -1 : 0;
     }
-
-    c->encoder.format = VIDEO_CODEC_H264;
-    c->encoder.width = cc->uvc->conf.video.width;
-    c->encoder.height = cc->uvc->conf.video.height;
-    c->encoder.bitrate = 2500;
-    c->encoder.framerate.num = cc->uvc->conf.video.fps.num;
-    c->encoder.framerate.den = cc->uvc->conf.video.fps.den;
-    c->encoder.timebase.num = c->param.i_fps_den;
-    c->encoder.timebase.den = c->param.i_fps_num;
-    logi("width=%d, height=%d, timebase=%d/%d\n", c->encoder.width, c->encoder.height, c->encoder.timebase.num, c->encoder.timebase.den);
-
-    c->parent = cc;
-    cc->priv = c;
-    return c;
-
-failed:
-    if (c->handle) {
-        x264_encoder_close(c->handle);
-        c->handle = 0;
+    if (avcap_pop_frame(c->uvc, &c->frm, 1000)) {
+        return -1;
     }
-    if (c) {
-        free(c);
+    memset(dmabuf, 0, sizeof(*dmabuf));
+    dmabuf->frame = &c->frm.video;
+    if (avcap_ioctl(c->uvc, VIDCAP_GET_DMABUF, dmabuf)) {
+        dmabuf->planes = 0;
     }
-    return NULL;
+    return 0;
 }
 
-static int init_pic_data(struct x264_ctx *c, x264_picture_t *pic,
-                struct video_frame *frame)
+static int live_encode(struct live_source_ctx *c, void **data, size_t *len)
 {
-    int i;
-    x264_picture_init(pic);
-    pic->i_pts = frame->timestamp;
-    pic->img.i_csp = c->param.i_csp;
-
-    switch (c->param.i_csp) {
-#if X264_BUILD >= 149
-    case X264_CSP_YUYV:
-        pic->img.i_plane = 1;
-        break;
-#endif
-    case X264_CSP_NV12:
-        pic->img.i_plane = 2;
-        break;
-    case X264_CSP_I420:
-    case X264_CSP_I444:
-    case X264_CSP_I422:
-        pic->img.i_plane = 3;
-        break;
-    default:
-        loge("unsupport colorspace type %d\n", c->param.i_csp);
-        break;
-    }
-    if (pic->img.i_plane != frame->planes) {
-        loge("video frame planes mismatch: pic->img.i_plane=%d, frame->planes=%d\n",
-pic->img.i_plane, frame->planes);
+    int ret;
+    uint64_t ms_pre, ms_post;
+    int64_t pts, dts;
+    struct video_dmabuf dmabuf;
+    struct video_frame *frm = &c->frm.video;
+    TRACE_SCOPE("rtsp", "live_encode");
+    ms_pre = time_now_msec();
+    if (live_query_frame(c, &dmabuf)) {
+        loge("avcap_query_frame failed!\n");
         return -1;
     }
-
-    for (i = 0; i < pic->img.i_plane; i++) {
-        pic->img.i_stride[i] = (int)frame->linesize[i];
-        pic->img.plane[i] = frame->data[i];
+    ms_post = time_now_msec();
+    logd("avcap_query_frame cost %" PRIu64 "ms\n", ms_post - ms_pre);
+    TRACE_FLOW_END("frame", "frame", frm->frame_id);
+    /* encoders want strictly growing pts in their timebase */
+    media_clock_stamp(c->clock, c->clock_track, frm->timestamp, frm->timestamp, 0, &pts, &dts);
+    frm->timestamp = pts;
+    ms_pre = time_now_msec();
+    ret = c->enc.ops->encode(&c->enc, frm, (c->dmabuf && dmabuf.planes) ? &dmabuf : NULL,
+                             c->pkt->video);
+    if (c->dmabuf) {
+        video_frame_deinit(frm);
+    }
+    if (ret < 0) {
+        loge("%s encode failed\n", c->enc.ops->name);
+        return -1;
+    }
+    ms_post = time_now_msec();
+    if (ret > 0) {
+        TRACE_FLOW_BEGIN("packet", "packet", c->pkt->video->pts);
     }
+    *data = c->pkt;
+    *len = ret;
+    logd("%s encode len=%d, cost %" PRIu64 "ms\n", c->enc.ops->name, *len, ms_post - ms_pre);
     return 0;
 }
 
-static int fill_packet(struct x264_ctx *c, struct video_packet *pkt,
-                       x264_nal_t *nals, int nal_cnt, x264_picture_t *pic_out)
+static void live_gop_clear(struct live_source_ctx *c)
 {
     int i;
-    if (!nal_cnt)
-        return -1;
-
-    da_free(c->packet_data);
-
-    if (!c->append_extra) {
-        pkt->encoder.extra_data = c->encoder.extra_data;
-        pkt->encoder.extra_size = c->encoder.extra_size;
-        c->append_extra = true;
+    for (i = 0; i < c->gop_cnt; i++) {
+        queue_item_free(c->q, c->gop[i]);
     }
-    for (i = 0; i < nal_cnt; i++) {
-        x264_nal_t *nal = nals + i;
-        da_push_back_array(c->packet_data, nal->p_payload, nal->i_payload);
-    }
-
-    pkt->data = c->packet_data.array;
-    pkt->size = c->packet_data.num;
-    pkt->pts = pic_out->i_pts;
-    pkt->dts = pic_out->i_dts;
-    pkt->encoder.timebase.num = c->param.i_fps_den;
-    pkt->encoder.timebase.den = c->param.i_fps_num;
-    logd("pkt->dts=%d, pkt->encoder.timebase = %d/%d\n",
-          pkt->dts, pkt->encoder.timebase.num, pkt->encoder.timebase.den);
-
-    pkt->key_frame = pic_out->b_keyframe != 0;
-    pkt->type = pkt->key_frame ? H26X_FRAME_I : H26X_FRAME_P;
-
-    memcpy(&pkt->encoder, &c->encoder, sizeof(struct video_encoder));
-    logd("pkt->encoder.extra_size = %d\n", pkt->encoder.extra_size);
-    return pkt->size;
+    c->gop_cnt = 0;
 }
 
-static int x264_encode(struct x264_ctx *c, struct iovec *in, struct iovec *out)
+/*
+ * cache refs from the last keyframe on, a gop longer than LIVE_GOP_MAX is
+ * dropped and caching restarts at next keyframe
+ */
+static void live_gop_update(struct live_source_ctx *c, struct queue_item *it,
+                bool key_frame)
 {
-    x264_picture_t pic_in, pic_out;
-    x264_nal_t *nal;
-    int nal_cnt = 0;
-    int ret = 0;
-    int nal_bytes = 0;
-    struct video_frame *frm = in->iov_base;
-    struct media_packet *mpkt = out->iov_base;
-    struct video_packet *pkt = mpkt->video;
-    if (c->first_frame) {
-        c->cur_pts = 0;
-        c->first_frame = false;
-    }
-    frm->timestamp = c->cur_pts;
-
-    init_pic_data(c, &pic_in, frm);
-
-    nal_bytes = x264_encoder_encode(c->handle, &nal, &nal_cnt, &pic_in,
-                    &pic_out);
-    if (nal_bytes < 0) {
-        loge("x264_encoder_encode failed!\n");
-        return -1;
+    if (key_frame) {
+        live_gop_clear(c);
+    } else if (c->gop_cnt == 0) {
+        return;
     }
-    ret = fill_packet(c, pkt, nal, nal_cnt, &pic_out);
-    if (ret < 0) {
-        loge("fill_packet failed!\n");
-        return -1;
+    if (c->gop_cnt == LIVE_GOP_MAX) {
+        live_gop_clear(c);
+        return;
     }
-
-    logd("frame info: <id=%d, pts=%zu>; packet info: <pts=%zu, dts=%zu, keyframe=%d, size=%zu>\n",
-        frm->frame_id, frm->timestamp, pkt->pts, pkt->dts, pkt->key_frame, pkt->size);
-    c->cur_pts += c->timebase_num;
-    out->iov_len = ret;
-    logd("encode size=%d\n", out->iov_len);
-    return ret;
+    c->gop[c->gop_cnt++] = queue_item_get(it);
 }
 
-static void x264_close(struct x264_ctx *c)
+/* camera paces the loop, each packet is copied once for all branches */
+static void *live_encode_thread(struct thread *t, void *arg)
 {
-    struct live_source_ctx *cc = (struct live_source_ctx *)c->parent;
-    if (c->handle) {
-        //x264_encoder_close(c->handle);//XXX cause segfault
-
-        free(cc->extradata.iov_base);
-        cc->extradata.iov_len = 0;
+    struct live_source_ctx *c = (struct live_source_ctx *)arg;
+    struct media_packet *mpkt;
+    struct queue_item *it;
+    void *data;
+    size_t len;
+
+    while (t->run) {
+        if (-1 == live_encode(c, &data, &len) || len == 0) {
+            continue;
+        }
+        it = queue_item_alloc(c->q, data, len, data);
+        if (!it) {
+            loge("queue_item_alloc failed!\n");
+            continue;
+        }
+        mpkt = (struct media_packet *)it->opaque.iov_base;
+        /* push and cache together, so subscribe sees each packet once */
+        pthread_mutex_lock(&c->gop_lock);
+        live_gop_update(c, it, mpkt->video->key_frame);
+        if (__atomic_load_n(&c->subs, __ATOMIC_ACQUIRE) == 0 ||
+            0 != queue_push(c->q, it)) {
+            queue_item_free(c->q, it);
+        }
+        pthread_mutex_unlock(&c->gop_lock);
     }
-    free(c->sei.iov_base);
-    free(c);
+    return NULL;
 }
-static int is_auth()
+
+static const struct live_encoder_ops **live_encoder_pick(const struct videocap_config *conf)
 {
-    return 0;
+    size_t i;
+    /* the last one takes anything */
+    for (i = 0; live_encoders[i + 1]; i++) {
+        if (!live_encoders[i]->probe || live_encoders[i]->probe(conf)) {
+            break;
+        }
+    }
+    return &live_encoders[i];
 }
 
-static uint32_t get_random_number()
+/* picked encoder or the ones after it, x264 last */
+static int live_encoder_open(struct live_source_ctx *c, const struct live_encoder_ops **ops)
 {
-    struct timeval now = {0};
-    gettimeofday(&now, NULL);
-    srand(now.tv_usec);
-    return (rand() % ((uint32_t)-1));
+    struct live_encoder_conf ec = c->enc_conf;
+
+    live_encoder_conf_fill(&ec, &c->uvc->conf.video);
+    for (; *ops; ops++) {
+        memset(&c->enc, 0, sizeof(c->enc));
+        c->enc.ops = *ops;
+        if ((*ops)->open(&c->enc, &c->uvc->conf.video, &ec) == 0) {
+            logi("live source encoder %s\n", (*ops)->name);
+            return 0;
+        }
+        logw("encoder %s open failed, try next\n", (*ops)->name);
+    }
+    return -1;
 }
 
-static int live_open(struct media_source *ms, const char *name)
+static int live_clock_open(struct live_source_ctx *c)
 {
-    struct live_source_ctx *c = &g_live;
-    g_live.uvc_opened = false;
-    if (c->uvc_opened) {
-        logi("uvc already opened!\n");
-        return 0;
+    struct media_clock_track_conf clock_conf = {{1, 1000000000}};
+    clock_conf.out_timebase = c->enc.encoder.timebase;
+    clock_conf.duration = clock_conf.out_timebase;
+    c->clock = media_clock_create(0);
+    c->clock_track = media_clock_add_track(c->clock, &clock_conf);
+    if (c->clock_track < 0) {
+        loge("media_clock_add_track failed!\n");
+        media_clock_destroy(c->clock);
+        c->clock = NULL;
+        return -1;
     }
+    return 0;
+}
+
+static int live_device_open(struct live_source_ctx *c)
+{
+    const struct live_encoder_ops **ops;
+    int ret;
+
     c->conf.video.width = 640;
     c->conf.video.height = 480;
     c->conf.video.fps.num = 30;
     c->conf.video.fps.den = 1;
     c->conf.video.format = PIXEL_FORMAT_YUY2,
+    ops = live_encoder_pick(&c->conf.video);
+    /* a dmabuf encoder imports capture buffers, frames come from the ring */
+    c->conf.video.export_dmabuf = (*ops)->dmabuf;
     c->uvc = avcap_open("/dev/video0", &c->conf);
+    if (!c->uvc && c->conf.video.export_dmabuf) {
+        logw("uvc can not export dmabuf, frames are copied\n");
+        c->conf.video.export_dmabuf = false;
+        c->uvc = avcap_open("/dev/video0", &c->conf);
+    }
     if (!c->uvc) {
         loge("uvc open failed!\n");
         return -1;
     }
+    c->dmabuf = c->conf.video.export_dmabuf;
     video_frame_init(&c->frm.video, c->uvc->conf.video.format, c->uvc->conf.video.width, c->uvc->conf.video.height, MEDIA_MEM_SHALLOW);
     c->pkt = media_packet_create(MEDIA_TYPE_VIDEO, MEDIA_MEM_SHALLOW, NULL, 0);
-    if (avcap_start_stream(c->uvc, NULL)) {
+    if (c->dmabuf) {
+        ret = avcap_start_stream_ring(c->uvc, LIVE_RING_DEPTH);
+    } else {
+        ret = avcap_start_stream(c->uvc, NULL);
+    }
+    if (ret) {
         loge("uvc start stream failed!\n");
+        avcap_close(c->uvc);
+        media_packet_destroy(c->pkt);
         return -1;
     }
     c->uvc_opened = true;
-    ms->opaque = c;
-    c->x264 = x264_open(c);
-    if (!c->x264) {
-        loge("x264_open failed!\n");
-        return -1;
+    if (live_encoder_open(c, ops)) {
+        loge("live_encoder_open failed!\n");
+        goto failed;
+    }
+    if (live_clock_open(c)) {
+        c->enc.ops->close(&c->enc);
+        goto failed;
+    }
+    c->q = queue_create();
+    if (!c->q) {
+        loge("queue_create failed!\n");
+        goto failed_encoder;
     }
+    queue_set_depth(c->q, LIVE_FANOUT_DEPTH);
+    queue_set_mode(c->q, QUEUE_FULL_RING);
+    queue_set_hook(c->q, item_alloc_hook, item_free_hook);
+    c->thread = thread_create(live_encode_thread, c);
+    if (!c->thread) {
+        loge("thread_create failed!\n");
+        queue_destroy(c->q);
+        goto failed_encoder;
+    }
+    thread_set_name(c->thread, "live_encode");
     return 0;
+
+failed_encoder:
+    c->enc.ops->close(&c->enc);
+    media_clock_destroy(c->clock);
+failed:
+    avcap_stop_stream(c->uvc);
+    avcap_close(c->uvc);
+    media_packet_destroy(c->pkt);
+    c->uvc_opened = false;
+    return -1;
 }
 
-static void live_close(struct media_source *ms)
+static void live_device_close(struct live_source_ctx *c)
 {
-    struct live_source_ctx *c = (struct live_source_ctx *)ms->opaque;
+    c->thread->run = false;
+    thread_join(c->thread);
+    thread_destroy(c->thread);
+    c->thread = NULL;
+    pthread_mutex_lock(&c->gop_lock);
+    live_gop_clear(c);
+    pthread_mutex_unlock(&c->gop_lock);
+    queue_destroy(c->q);
+    c->q = NULL;
     avcap_stop_stream(c->uvc);
-    x264_close(c->x264);
+    /* frames held by encoder go back before the device is closed */
+    c->enc.ops->close(&c->enc);
+    media_clock_destroy(c->clock);
     avcap_close(c->uvc);
+    media_packet_destroy(c->pkt);
     c->uvc_opened = false;
 }
 
-static int sdp_generate(struct media_source *ms)
+/* device and encoder are opened by first session and closed by last one */
+static int live_open(struct media_source *ms, const char *name)
 {
-    int n = 0;
-    char p[SDP_LEN_MAX];
-    uint32_t session_id = get_random_number();
-    gettimeofday(&ms->tm_create, NULL);
-    n += snprintf(p+n, sizeof(p)-n, "v=0\n");
-    n += snprintf(p+n, sizeof(p)-n, "o=%s %"PRIu32" %"PRIu32" IN IP4 %s\n", is_auth()?"username":"-", session_id, 1, "0.0.0.0");
-    n += snprintf(p+n, sizeof(p)-n, "s=%s\n", ms->name);
-    n += snprintf(p+n, sizeof(p)-n, "i=%s\n", ms->info);
-    n += snprintf(p+n, sizeof(p)-n, "c=IN IP4 0.0.0.0\n");
-    n += snprintf(p+n, sizeof(p)-n, "t=0 0\n");
-    n += snprintf(p+n, sizeof(p)-n, "a=range:npt=0-\n");
-    n += snprintf(p+n, sizeof(p)-n, "a=sendonly\n");
-    n += snprintf(p+n, sizeof(p)-n, "a=control:*\n");
-    n += snprintf(p+n, sizeof(p)-n, "a=source-filter: incl IN IP4 * %s\r\n", "0.0.0.0");
-    n += snprintf(p+n, sizeof(p)-n, "a=rtcp-unicast: reflection\r\n");
-    n += snprintf(p+n, sizeof(p)-n, "a=x-qt-text-nam:%s\r\n", ms->name);
-    n += snprintf(p+n, sizeof(p)-n, "a=x-qt-text-inf:%s\r\n", ms->info);
-
-    n += snprintf(p+n, sizeof(p)-n, "m=video 0 RTP/AVP 96\r\n");
-    n += snprintf(p+n, sizeof(p)-n, "a=rtpmap:96 H264/90000\r\n");
-    n += snprintf(p+n, sizeof(p)-n, "a=fmtp:96 packetization-mode=1; profile-level-id=4D4028; sprop-parameter-sets=Z01AKJpkA8ARPy4C3AQEBQAAAwPoAADqYOhgBGMAAF9eC7y40MAIxgAAvrwXeXCg,aO44gA==;\r\n");
-    n += snprintf(p+n, sizeof(p)-n, "a=cliprect:0,0,240,320\r\n");
-    strcpy(ms->sdp, p);
-    return 0;
+    int ret = 0;
+    struct live_source_ctx *c = &g_live;
+    pthread_mutex_lock(&c->lock);
+    if (c->users == 0) {
+        ret = live_device_open(c);
+        if (ret == 0) {
+            /* new encoder, sps and pps may differ from cached sdp */
+            media_source_sdp_invalidate(ms);
+        }
+    }
+    if (ret == 0) {
+        c->users++;
+        ms->opaque = c;
+    }
+    pthread_mutex_unlock(&c->lock);
+    return ret;
 }
 
-static int live_read(struct media_source *ms, void **data, size_t *len)
+static void live_close(struct media_source *ms)
 {
-    int ret;
-    uint64_t ms_pre, ms_post;
-    struct iovec in, out;
     struct live_source_ctx *c = (struct live_source_ctx *)ms->opaque;
-    int size;
-    ms_pre = time_now_msec();
-    size = avcap_query_frame(c->uvc, &c->frm);
-    if (size < 0) {
-        loge("avcap_query_frame failed!\n");
+    pthread_mutex_lock(&c->lock);
+    if (c->users > 0 && --c->users == 0) {
+        live_device_close(c);
     }
-    ms_post = time_now_msec();
-    logd("avcap_query_frame cost %" PRIu64 "ms\n", ms_post - ms_pre);
-    in.iov_base = &c->frm.video;
-    in.iov_len = size;
-    out.iov_base = c->pkt;
-    ms_pre = time_now_msec();
-    ret = x264_encode(c->x264, &in, &out);
-    if (ret < 0) {
-        loge("x264_encode failed\n");
+    pthread_mutex_unlock(&c->lock);
+}
+
+static struct live_sub *live_sub_take(struct live_source_ctx *c, const char *name)
+{
+    struct live_sub **pp, *sub;
+    for (pp = &c->backlog; *pp; pp = &(*pp)->next) {
+        if (!strcmp((*pp)->name, name)) {
+            sub = *pp;
+            *pp = sub->next;
+            return sub;
+        }
     }
-    ms_post = time_now_msec();
-    *data = out.iov_base;
-    *len = out.iov_len;
-    logd("x264_encode len=%d, cost %" PRIu64 "ms\n", *len, ms_post - ms_pre);
-    return 0;
+    return NULL;
+}
+
+static void live_sub_free(struct live_source_ctx *c, struct live_sub *sub)
+{
+    while (sub->idx < sub->cnt) {
+        queue_item_free(c->q, sub->items[sub->idx++]);
+    }
+    free(sub);
+}
+
+/*
+ * branch and gop snapshot are taken under gop_lock, every packet is either
+ * in the snapshot or in the branch, never both
+ */
+static int live_subscribe(struct media_source *ms, const char *name)
+{
+    int i;
+    struct live_sub *sub;
+    struct queue_branch *qb;
+    struct live_source_ctx *c = (struct live_source_ctx *)ms->opaque;
+
+    pthread_mutex_lock(&c->gop_lock);
+    qb = queue_branch_new(c->q, name);
+    if (!qb) {
+        pthread_mutex_unlock(&c->gop_lock);
+        loge("queue_branch_new %s failed!\n", name);
+        return -1;
+    }
+    if (c->gop_cnt > 0) {
+        sub = CALLOC(1, struct live_sub);
+        if (sub) {
+            snprintf(sub->name, sizeof(sub->name), "%s", name);
+            for (i = 0; i < c->gop_cnt; i++) {
+                sub->items[i] = queue_item_get(c->gop[i]);
+            }
+            sub->cnt = c->gop_cnt;
+            sub->next = c->backlog;
+            c->backlog = sub;
+        } else {
+            loge("malloc live_sub failed, %s waits for next keyframe\n", name);
+        }
+    }
+    __atomic_add_fetch(&c->subs, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&c->gop_lock);
+    return qb->evfd;
+}
+
+static void live_unsubscribe(struct media_source *ms, const char *name)
+{
+    struct live_sub *sub;
+    struct live_source_ctx *c = (struct live_source_ctx *)ms->opaque;
+    pthread_mutex_lock(&c->gop_lock);
+    sub = live_sub_take(c, name);
+    if (sub) {
+        live_sub_free(c, sub);
+    }
+    pthread_mutex_unlock(&c->gop_lock);
+    if (0 == queue_branch_del(c->q, name)) {
+        __atomic_sub_fetch(&c->subs, 1, __ATOMIC_RELEASE);
+    }
+}
+
+/* cached gop first, then live packets of the branch */
+static struct queue_item *live_pop(struct media_source *ms, const char *name)
+{
+    struct live_sub *sub;
+    struct queue_item *it = NULL;
+    struct live_source_ctx *c = (struct live_source_ctx *)ms->opaque;
+    if (__atomic_load_n(&c->backlog, __ATOMIC_ACQUIRE)) {
+        pthread_mutex_lock(&c->gop_lock);
+        sub = live_sub_take(c, name);
+        if (sub) {
+            it = sub->items[sub->idx++];
+            if (sub->idx < sub->cnt) {
+                sub->next = c->backlog;
+                c->backlog = sub;
+            } else {
+                free(sub);
+            }
+        }
+        pthread_mutex_unlock(&c->gop_lock);
+        if (it) {
+            return it;
+        }
+    }
+    return queue_branch_pop(c->q, name);
+}
+
+static void live_release(struct media_source *ms, struct queue_item *it)
+{
+    struct live_source_ctx *c = (struct live_source_ctx *)ms->opaque;
+    queue_item_free(c->q, it);
+}
+
+static int sdp_generate(struct media_source *ms, char *p, size_t len)
+{
+    int n = 0;
+    uint32_t session_id = get_random_number();
+    gettimeofday(&ms->tm_create, NULL);
+    n += snprintf(p+n, len-n, "v=0\n");
+    n += snprintf(p+n, len-n, "o=%s %"PRIu32" %"PRIu32" IN IP4 %s\n", is_auth()?"username":"-", session_id, 1, "0.0.0.0");
+    n += snprintf(p+n, len-n, "s=%s\n", ms->name);
+    n += snprintf(p+n, len-n, "i=%s\n", ms->info);
+    n += snprintf(p+n, len-n, "c=IN IP4 0.0.0.0\n");
+    n += snprintf(p+n, len-n, "t=0 0\n");
+    n += snprintf(p+n, len-n, "a=range:npt=0-\n");
+    n += snprintf(p+n, len-n, "a=sendonly\n");
+    n += snprintf(p+n, len-n, "a=control:*\n");
+    n += snprintf(p+n, len-n, "a=source-filter: incl IN IP4 * %s\r\n", "0.0.0.0");
+    n += snprintf(p+n, len-n, "a=rtcp-unicast: reflection\r\n");
+    n += snprintf(p+n, len-n, "a=x-qt-text-nam:%s\r\n", ms->name);
+    n += snprintf(p+n, len-n, "a=x-qt-text-inf:%s\r\n", ms->info);
+
+    n += snprintf(p+n, len-n, "m=video 0 RTP/AVP 96\r\n");
+    n += snprintf(p+n, len-n, "a=rtpmap:96 H264/90000\r\n");
+    n += snprintf(p+n, len-n, "a=rtcp-fb:96 nack\r\n");
+    n += snprintf(p+n, len-n, "a=fmtp:96 packetization-mode=1; profile-level-id=4D4028; sprop-parameter-sets=Z01AKJpkA8ARPy4C3AQEBQAAAwPoAADqYOhgBGMAAF9eC7y40MAIxgAAvrwXeXCg,aO44gA==;\r\n");
+    n += snprintf(p+n, len-n, "a=cliprect:0,0,240,320\r\n");
+    return n;
 }
 
 struct media_source media_source_uvc = {
     .name         = "uvc",
     .sdp_generate = sdp_generate,
     ._open         = live_open,
-    ._read         = live_read,
     ._close        = live_close,
+    ._subscribe    = live_subscribe,
+    ._unsubscribe  = live_unsubscribe,
+    ._pop          = live_pop,
+    ._release      = live_release,
 };
@@ -0,0 +1,248 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#include <liblog.h>
+#include <libtime.h>
+#include <libmp4.h>
+#include <libmedia-io.h>
+#include "sdp.h"
+#include "media_source.h"
+#include "rtp.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#define __STDC_FORMAT_MACROS
+#include <inttypes.h>
+
+#define MP4_SOURCE_TICK_MS  10
+
+/*
+ * recorded mp4 played from the sample index of libmp4, the video track is
+ * sent at its own dts. one packet and the scratch buffer of the parser are
+ * reused for every sample, nothing is allocated per frame
+ */
+struct mp4_source_ctx {
+    struct mp4_parser *mp;
+    const struct mp4_track *track;
+    struct media_packet pkt;
+    struct video_packet video;
+    bool pending;           /* read from the index, not due yet */
+    bool started;
+    int64_t due_ms;         /* pending sample after start, at scale */
+    uint64_t clock_ms;      /* monotonic time of the first sample */
+    int64_t media_ms;       /* its dts */
+    double scale;
+};
+
+static uint64_t mp4_source_clock()
+{
+    return time_bootup_nsec() / 1000000;
+}
+
+static const struct mp4_track *mp4_video_track(struct mp4_parser *mp)
+{
+    const struct mp4_track *tracks;
+    int i, n = mp4_get_tracks(mp, &tracks);
+
+    for (i = 0; i < n; i++) {
+        if (tracks[i].type == MEDIA_TYPE_VIDEO) {
+            return &tracks[i];
+        }
+    }
+    return NULL;
+}
+
+static int mp4_file_open(struct media_source *ms, const char *name)
+{
+    struct mp4_source_ctx *c = calloc(1, sizeof(struct mp4_source_ctx));
+    if (!c) {
+        loge("calloc mp4_source_ctx failed!\n");
+        return -1;
+    }
+    c->mp = mp4_parser_create_lazy(name);
+    if (!c->mp) {
+        loge("mp4_parser_create_lazy %s failed!\n", name);
+        free(c);
+        return -1;
+    }
+    c->track = mp4_video_track(c->mp);
+    if (!c->track) {
+        loge("%s has no h264 or h265 track!\n", name);
+        mp4_parser_destroy(c->mp);
+        free(c);
+        return -1;
+    }
+    c->pkt.type = MEDIA_TYPE_VIDEO;
+    c->pkt.video = &c->video;
+    c->scale = 1.0;
+    ms->opaque = c;
+    return 0;
+}
+
+static void mp4_file_close(struct media_source *ms)
+{
+    struct mp4_source_ctx *c = (struct mp4_source_ctx *)ms->opaque;
+    if (!c) {
+        return;
+    }
+    mp4_parser_destroy(c->mp);
+    free(c);
+    ms->opaque = NULL;
+}
+
+/* next video sample into the reused packet, timestamps in ms at scale */
+static int mp4_source_next(struct mp4_source_ctx *c)
+{
+    const struct mp4_track *t;
+    const struct mp4_sample *sm;
+    const uint8_t *data;
+    size_t len;
+    rational_t ms = {1, 1000};
+    int64_t dts, cto;
+
+    do {
+        if (0 != mp4_read_sample(c->mp, &t, &sm, &data, &len)) {
+            return -1;
+        }
+    } while (t != c->track);
+
+    mp4_sample_video(t, sm, &c->video);
+    c->video.data = (uint8_t *)data;
+    c->video.size = len;
+    c->video.mem_type = MEDIA_MEM_SHALLOW;
+    c->video.buf = NULL;
+
+    dts = media_ts_rescale(sm->dts, c->video.encoder.timebase, ms);
+    cto = media_ts_rescale(c->video.pts, c->video.encoder.timebase, ms) - dts;
+    if (!c->started) {
+        c->started = true;
+        c->clock_ms = mp4_source_clock();
+        c->media_ms = dts;
+    }
+    c->due_ms = (int64_t)((dts - c->media_ms) / c->scale);
+    c->video.encoder.timebase = ms;
+    c->video.dts = c->media_ms + c->due_ms;
+    c->video.pts = c->video.dts + (int64_t)(cto / c->scale);
+    c->pending = true;
+    return 0;
+}
+
+static int mp4_file_read(struct media_source *ms, void **data, size_t *len)
+{
+    struct mp4_source_ctx *c = (struct mp4_source_ctx *)ms->opaque;
+
+    *data = NULL;
+    *len = 0;
+    if (!c->pending && 0 != mp4_source_next(c)) {
+        return -1;
+    }
+    if ((int64_t)(mp4_source_clock() - c->clock_ms) < c->due_ms) {
+        return 1;
+    }
+    c->pending = false;
+    *data = &c->pkt;
+    *len = c->video.size;
+    return 0;
+}
+
+static int64_t mp4_file_seek(struct media_source *ms, uint64_t ts, double scale)
+{
+    struct mp4_source_ctx *c = (struct mp4_source_ctx *)ms->opaque;
+    uint64_t sync_ts;
+
+    if (0 != mp4_seek(c->mp, ts, &sync_ts)) {
+        loge("mp4_seek %" PRIu64 " failed!\n", ts);
+        return -1;
+    }
+    /* the clock starts again at the sync sample */
+    c->pending = false;
+    c->started = false;
+    c->scale = scale > 0 ? scale : 1.0;
+    return sync_ts;
+}
+
+static int mp4_file_write(struct media_source *ms, void *data, size_t len)
+{
+    return 0;
+}
+
+/* sprop come from the sample entry, the file is indexed once as sdp is cached */
+static int mp4_sdp_generate(struct media_source *ms, char *p, size_t len)
+{
+    const struct mp4_track *t;
+    struct mp4_parser *mp;
+    uint64_t duration = 0;
+    int n = 0, ret = -1;
+
+    mp = mp4_parser_create_lazy(ms->file);
+    if (!mp) {
+        loge("mp4_parser_create_lazy %s failed!\n", ms->file);
+        return -1;
+    }
+    t = mp4_video_track(mp);
+    if (!t) {
+        loge("%s has no h264 or h265 track!\n", ms->file);
+        goto exit;
+    }
+    mp4_get_duration(mp, &duration);
+    gettimeofday(&ms->tm_create, NULL);
+    n += snprintf(p+n, len-n, "v=0\r\n");
+    n += snprintf(p+n, len-n, "o=- %ld 1 IN IP4 0.0.0.0\r\n", (long)ms->tm_create.tv_sec);
+    n += snprintf(p+n, len-n, "s=%s\r\n", ms->name);
+    n += snprintf(p+n, len-n, "i=%s\r\n", ms->info);
+    n += snprintf(p+n, len-n, "c=IN IP4 0.0.0.0\r\n");
+    n += snprintf(p+n, len-n, "t=0 0\r\n");
+    if (duration) {
+        n += snprintf(p+n, len-n, "a=range:npt=0-%" PRIu64 "\r\n", duration);
+    } else {
+        n += snprintf(p+n, len-n, "a=range:npt=0-\r\n");
+    }
+    n += snprintf(p+n, len-n, "a=sendonly\r\n");
+    n += snprintf(p+n, len-n, "a=control:*\r\n");
+    if (n >= (int)len) {
+        goto exit;
+    }
+    if (t->codec == VIDEO_CODEC_H265) {
+        ret = sdp_h265_media(p+n, len-n, RTP_PT_H265, t->ps, t->ps_size);
+    } else {
+        ret = sdp_h264_media(p+n, len-n, RTP_PT_H264, t->ps, t->ps_size);
+    }
+    if (ret < 0) {
+        loge("sdp media of %s failed!\n", ms->file);
+        goto exit;
+    }
+    ret += n;
+exit:
+    mp4_parser_destroy(mp);
+    return ret;
+}
+
+struct media_source media_source_mp4 = {
+    .name         = "MP4",
+    .file         = "sample.mp4",
+    .tick_ms      = MP4_SOURCE_TICK_MS,
+    .sdp_generate = mp4_sdp_generate,
+    ._open        = mp4_file_open,
+    ._read        = mp4_file_read,
+    ._write       = mp4_file_write,
+    ._close       = mp4_file_close,
+    ._seek        = mp4_file_seek,
+};
@@ -91,14 +91,14 @@ int handle_rtsp_response(struct rtsp_request *req, int code, const char *msg)
 
 static int on_teardown(struct rtsp_request *req, char *url)
 {
-    struct rtsp_server *rc;
+    struct rtsp_shard *rc;
     struct transport_session *ts;
     //int len = sock_send(req->fd, resp, strlen(resp));
-    if (-1 == parse_range(&req->range, (char *)req->raw->iov_base, req->raw->iov_len)) {
+    if (-1 == parse_range(&req->range, (char *)req->msg.raw.array, req->msg.raw.len)) {
         loge("parse_range failed!\n");
         return -1;
     }
-    rc = req->rtsp_server;
+    rc = req->shard;
     ts = transport_session_lookup(rc->transport_session_pool, req->session.id);
     if (!ts) {
         loge("transport_session is NULL\n");
@@ -138,16 +138,29 @@ static int on_options(struct rtsp_request *req, char *url)
 static int on_describe(struct rtsp_request *req, char *url)
 {
     char buf[RTSP_RESPONSE_LEN_MAX];
+    char sdp[SDP_LEN_MAX];
+    int len;
     struct media_source *ms = rtsp_media_source_lookup(url);
     if (!ms) {
         loge("media_source %s not found\n", url);
         return handle_rtsp_response(req, 404, NULL);
     }
-    ms->sdp_generate(ms);
+    len = media_source_sdp(ms, sdp, sizeof(sdp));
+    if (len < 0) {
+        return handle_rtsp_response(req, 500, NULL);
+    }
+    if (transport_mcast_enabled()) {
+        /* announce group of source, clients setup multicast from it */
+        struct transport_mcast *m = transport_mcast_get(ms);
+        if (m && -1 == sdp_set_multicast(sdp, sizeof(sdp), m->group, m->port, m->ttl)) {
+            loge("sdp_set_multicast failed!\n");
+        }
+        len = strlen(sdp);
+    }
     snprintf(buf, sizeof(buf), RESP_DESCRIBE_FMT,
                  req->url_origin,
-                 (uint32_t)strlen(ms->sdp),
-                 ms->sdp);//XXX: sdp line can't using "\r\n" as ending!!!
+                 (uint32_t)len,
+                 sdp);//XXX: sdp line can't using "\r\n" as ending!!!
     return handle_rtsp_response(req, 200, buf);
 }
 
@@ -156,14 +169,13 @@ static int on_setup(struct rtsp_request *req, char *url)
     char buf[RTSP_RESPONSE_LEN_MAX];
     char transport[128];
     struct transport_session *ts;
-    struct rtsp_server *rc = req->rtsp_server;
+    struct transport_mcast *mcast = NULL;
+    struct media_source *ms;
+    struct rtsp_shard *rc = req->shard;
 
-    if (-1 == parse_transport(&req->transport, (char *)req->raw->iov_base, req->raw->iov_len)) {
+    if (-1 == parse_transport(&req->transport, (char *)req->msg.raw.array, req->msg.raw.len)) {
         return handle_rtsp_response(req, 461, NULL);
     }
-    if (-1 == parse_session(&req->session, (char *)req->raw->iov_base, req->raw->iov_len)) {
-        loge("parse_session failed!\n");
-    }
     if (0 == strlen(req->transport.source)) {
         //set local ipaddr to source
         struct sock_addr addr;
@@ -174,6 +186,21 @@ static int on_setup(struct rtsp_request *req, char *url)
         sock_addr_ntop(req->transport.destination, req->client.ip);
     }
 
+    if (req->transport.multicast) {
+        if (req->transport.mode != RTP_UDP || !transport_mcast_enabled()) {
+            return handle_rtsp_response(req, 461, NULL);
+        }
+        ms = rtsp_media_source_lookup(url);
+        if (!ms) {
+            loge("media_source %s not found\n", url);
+            return handle_rtsp_response(req, 404, NULL);
+        }
+        mcast = transport_mcast_get(ms);
+        if (!mcast) {
+            return handle_rtsp_response(req, 500, NULL);
+        }
+    }
+
     ts = transport_session_lookup(rc->transport_session_pool, req->session.id);
     if (!ts) {
         ts = transport_session_create(rc->transport_session_pool, &req->transport);
@@ -181,6 +208,7 @@ static int on_setup(struct rtsp_request *req, char *url)
             loge("transport_session_create failed\n");
             return handle_rtsp_response(req, 500, NULL);
         }
+        ts->mcast = mcast;
     }
 
     switch (req->transport.mode) {
@@ -188,8 +216,12 @@ static int on_setup(struct rtsp_request *req, char *url)
         snprintf(transport, sizeof(transport), "RTP/AVP/TCP;unicast;interleaved=%d-%d", req->transport.interleaved1, req->transport.interleaved2);
         break;
     case RTP_UDP:
-        if (req->transport.multicast) {
-            return handle_rtsp_response(req, 461, NULL);
+        if (ts->mcast) {
+            /* group of source is fixed, requested destination is ignored */
+            snprintf(transport, sizeof(transport),
+                     "RTP/AVP;multicast;destination=%s;port=%hu-%hu;ttl=%d",
+                     ts->mcast->group, ts->mcast->port, ts->mcast->port + 1,
+                     ts->mcast->ttl);
         } else {
             snprintf(transport, sizeof(transport), 
                      "RTP/AVP;unicast;client_port=%hu-%hu;server_port=%hu-%hu%s%s", 
@@ -213,15 +245,17 @@ static int on_play(struct rtsp_request *req, char *url)
 {
     int n = 0;
     char buf[RTSP_RESPONSE_LEN_MAX];
-    struct rtsp_server *rc;
+    struct rtsp_shard *rc;
     struct transport_session *ts;
     struct media_source *ms;
+    int64_t from;
 
-    if (-1 == parse_range(&req->range, (char *)req->raw->iov_base, req->raw->iov_len)) {
+    memset(&req->range, 0, sizeof(req->range));
+    if (-1 == parse_range(&req->range, (char *)req->msg.raw.array, req->msg.raw.len)) {
         loge("parse_range failed!\n");
         return -1;
     }
-    rc = req->rtsp_server;
+    rc = req->shard;
     ts = transport_session_lookup(rc->transport_session_pool, req->session.id);
     if (!ts) {
         handle_rtsp_response(req, 454, NULL);
@@ -229,6 +263,18 @@ static int on_play(struct rtsp_request *req, char *url)
     }
     ms = rtsp_media_source_lookup(url);
 
+    /* nothing is sent before this returns, tick runs in the same loop */
+    transport_session_start(ts, ms, rc->evbase);
+    if (req->scale <= 0) {
+        req->scale = 1.0; /* reverse play is not supported */
+    }
+    if (rtsp_message_header(&req->msg, "Range") || req->scale != 1.0) {
+        from = transport_session_seek(ts, req->range.from, req->scale);
+        if (from >= 0) {
+            req->range.from = from;
+            n += snprintf(buf+n, sizeof(buf)-n, "Scale: %.2f\r\n", req->scale);
+        }
+    }
     if (req->range.to > 0) {
         n += snprintf(buf+n, sizeof(buf)-n, "Range: npt=%.3f-%.3f\r\n", (float)(req->range.from / 1000.0f), (float)(req->range.to / 1000.0f));
     } else {
@@ -239,7 +285,6 @@ static int on_play(struct rtsp_request *req, char *url)
     n += snprintf(buf+n, sizeof(buf)-n, "RTP-Info: url=%s;seq=%s;rtptime=%u\r\n\r\n", req->url_origin, req->cseq, get_timestamp());//XXX
 
     handle_rtsp_response(req, 200, buf);
-    transport_session_start(ts, ms);
     return 0;
 }
 
@@ -253,8 +298,8 @@ int handle_rtsp_request(struct rtsp_request *req)
     char url[2*RTSP_PARAM_STRING_MAX];
     strcat_url(url, req->url_prefix, req->url_suffix);
 
-    logi("rtsp request[%d]:\n==== C >>>> S ====\n%s\n==== C >>>> S ====\n",
-          req->raw->iov_len, req->raw->iov_base);
+    logi("rtsp request[%zu]:\n==== C >>>> S ====\n%.*s\n==== C >>>> S ====\n",
+          req->msg.raw.len, (int)req->msg.raw.len, req->msg.raw.array);
     switch (req->cmd[0]) {
     case 'o':
     case 'O':
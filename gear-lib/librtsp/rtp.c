@@ -20,6 +20,7 @@
  * SOFTWARE.
  ******************************************************************************/
 #include "rtp.h"
+#include "rtp_pacer.h"
 #include <liblog.h>
 #include <libsock.h>
 #include <stdio.h>
@@ -28,6 +29,8 @@
 #include <string.h>
 #include <errno.h>
 #include <time.h>
+#include <sys/time.h>
+#include <arpa/inet.h>
 
 #define RTP_V(v)    ((v >> 30) & 0x03)   /* protocol version */
 #define RTP_P(v)    ((v >> 29) & 0x01)   /* padding flag */
@@ -224,7 +227,7 @@ int rtp_packet_deserialize(struct rtp_packet *pkt, const void* data, int bytes)
 
 struct rtp_packet *rtp_packet_create(uint8_t pt, int size, uint16_t seq, uint32_t ssrc)
 {
-    struct rtp_packet *pkt = calloc(1, sizeof(struct rtp_packet));
+    struct rtp_packet *pkt = gear_calloc(sizeof(struct rtp_packet));
     if (!pkt) return NULL;
 
     pkt->header.v = RTP_VERSION;
@@ -237,8 +240,7 @@ struct rtp_packet *rtp_packet_create(uint8_t pt, int size, uint16_t seq, uint32_
 
 void rtp_packet_destroy(struct rtp_packet *pkt)
 {
-    if (pkt)
-        free(pkt);
+    gear_free(pkt, sizeof(*pkt));
 }
 
 int rtp_packet_get_info(struct rtp_packet *pkt, uint16_t* seq, uint32_t* timestamp)
@@ -254,7 +256,8 @@ int rtp_packet_get_info(struct rtp_packet *pkt, uint16_t* seq, uint32_t* timesta
 int rtp_packet_pack(struct rtp_socket *sock, struct rtp_packet *pkt, const void* data, int bytes, uint32_t timestamp)
 {
     int n, ret;
-    uint8_t *rtp;
+    uint8_t hdr[RTP_HEADER_MAX];
+    struct iovec iov[2];
     const uint8_t *ptr;
     if (!pkt || pkt->header.timestamp == timestamp || pkt->payload == NULL) {
         return -1;
@@ -268,21 +271,18 @@ int rtp_packet_pack(struct rtp_socket *sock, struct rtp_packet *pkt, const void*
         ptr += pkt->payloadlen;
         bytes -= pkt->payloadlen;
 
-        n = RTP_FIXED_HEADER + pkt->payloadlen;
-        rtp = (uint8_t*)calloc(1, n);
-        if (!rtp) return ENOMEM;
-
-        n = rtp_packet_serialize(pkt, rtp, n);
-        if (n != RTP_FIXED_HEADER + pkt->payloadlen) {
-            free(rtp);
+        n = rtp_packet_serialize_header(pkt, hdr, sizeof(hdr));
+        if (n < RTP_FIXED_HEADER) {
             return -1;
         }
-
-        loge("send len=%d\n", n);
-        ret = rtp_sendto(sock, NULL, 0, rtp, n);//XXX
-        free(rtp);
+        /* payload is sent from caller buffer, no copy */
+        iov[0].iov_base = hdr;
+        iov[0].iov_len = n;
+        iov[1].iov_base = (void *)pkt->payload;
+        iov[1].iov_len = pkt->payloadlen;
+        ret = rtp_sendv(sock, NULL, 0, iov, 2);//XXX
         if (ret < 0) {
-            loge("rtp_sendto ret=%d\n", ret);
+            loge("rtp_sendv ret=%d\n", ret);
         }
     }
 
@@ -311,6 +311,8 @@ struct rtp_socket *rtp_socket_create(enum rtp_mode mode, int tcp_fd, const char*
     switch (mode) {
     case RTP_TCP:
         s->rtp_fd = tcp_fd;
+        /* interleaved rtp shares rtsp connection, tune it for media now */
+        sock_set_tcp_profile(tcp_fd, SOCK_TCP_MEDIA, 0);
         break;
     case RTP_UDP:
         srand((unsigned int)time(NULL));
@@ -347,42 +349,457 @@ struct rtp_socket *rtp_socket_create(enum rtp_mode mode, int tcp_fd, const char*
     return s;
 }
 
+int rtp_socket_set_multicast(struct rtp_socket *s, const char *group, uint16_t port, uint8_t ttl)
+{
+    if (!s || s->mode != RTP_UDP || !group) {
+        return -1;
+    }
+    if (-1 == sock_set_mcast_ttl(s->rtp_fd, ttl) ||
+        -1 == sock_set_mcast_ttl(s->rtcp_fd, ttl)) {
+        loge("sock_set_mcast_ttl %d failed!\n", ttl);
+        return -1;
+    }
+    snprintf(s->dst_ip, sizeof(s->dst_ip), "%s", group);
+    s->rtp_dst_port = port;
+    s->rtcp_dst_port = port + 1;
+    logi("rtp multicast %s:%d-%d ttl=%d\n", group, port, port + 1, ttl);
+    return 0;
+}
+
 void rtp_socket_destroy(struct rtp_socket *s)
 {
     if (s) {
+        free(s->history);
+        if (s->batch) {
+            free(s->batch->pending);
+            free(s->batch);
+        }
+        free(s->udp_batch);
         free(s);
     }
 }
 
-ssize_t rtp_sendto(struct rtp_socket *s, const char *ip, uint16_t port, const void *buf, size_t len)
+int rtp_history_enable(struct rtp_socket *s, bool enable)
+{
+    if (!s || s->mode != RTP_UDP) {
+        return -1;
+    }
+    if (!enable) {
+        free(s->history);
+        s->history = NULL;
+        return 0;
+    }
+    if (!s->history) {
+        s->history = calloc(1, sizeof(struct rtp_history));
+        if (!s->history) {
+            loge("calloc rtp_history failed!\n");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void rtp_history_store(struct rtp_history *h, const struct iovec *iov, int iovcnt, size_t len)
+{
+    const uint8_t *hdr = (const uint8_t *)iov[0].iov_base;
+    uint16_t seq;
+    size_t off = 0;
+    int i;
+
+    if (iov[0].iov_len < RTP_FIXED_HEADER || len > RTP_PACKET_MAX) {
+        return;
+    }
+    seq = nbo_r16(hdr + 2);
+    h->slots[seq % RTP_HISTORY_SLOTS].seq = seq;
+    h->slots[seq % RTP_HISTORY_SLOTS].len = len;
+    for (i = 0; i < iovcnt; i++) {
+        memcpy(h->slots[seq % RTP_HISTORY_SLOTS].data + off, iov[i].iov_base, iov[i].iov_len);
+        off += iov[i].iov_len;
+    }
+}
+
+/* resent as is, same ssrc and seq, bypassing pacer */
+int rtp_history_resend(struct rtp_socket *s, uint16_t seq)
+{
+    struct iovec iov;
+    if (!s->history || s->history->slots[seq % RTP_HISTORY_SLOTS].len == 0 ||
+        s->history->slots[seq % RTP_HISTORY_SLOTS].seq != seq) {
+        return -1;
+    }
+    iov.iov_base = s->history->slots[seq % RTP_HISTORY_SLOTS].data;
+    iov.iov_len = s->history->slots[seq % RTP_HISTORY_SLOTS].len;
+    return sock_sendtov(s->rtp_fd, s->dst_ip, s->rtp_dst_port, &iov, 1) < 0 ? -1 : 0;
+}
+
+int rtp_tcp_batch_enable(struct rtp_socket *s, bool enable)
+{
+    if (!s || s->mode != RTP_TCP) {
+        return -1;
+    }
+    if (!enable) {
+        if (s->batch) {
+            free(s->batch->pending);
+            free(s->batch);
+            s->batch = NULL;
+        }
+        return 0;
+    }
+    if (!s->batch) {
+        s->batch = calloc(1, sizeof(struct rtp_tcp_batch));
+        if (!s->batch) {
+            loge("calloc rtp_tcp_batch failed!\n");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* bytes of iov after skip are kept behind what is already pending */
+static int rtp_tcp_pending_append(struct rtp_tcp_batch *b, const struct iovec *iov, int iovcnt, size_t skip)
 {
-    uint8_t m_packet[4 + (1 << 16)];
+    size_t need = 0, n;
+    uint8_t *p;
+    int i;
+
+    for (i = 0; i < iovcnt; i++) {
+        need += iov[i].iov_len;
+    }
+    if (need <= skip) {
+        return 0;
+    }
+    need -= skip;
+    if (b->pending_off > 0) {
+        memmove(b->pending, b->pending + b->pending_off, b->pending_len);
+        b->pending_off = 0;
+    }
+    if (b->pending_len + need > b->pending_cap) {
+        p = realloc(b->pending, b->pending_len + need);
+        if (!p) {
+            loge("realloc pending %zu failed!\n", b->pending_len + need);
+            return -1;
+        }
+        b->pending = p;
+        b->pending_cap = b->pending_len + need;
+    }
+    for (i = 0; i < iovcnt; i++) {
+        n = iov[i].iov_len;
+        if (skip >= n) {
+            skip -= n;
+            continue;
+        }
+        memcpy(b->pending + b->pending_len, (uint8_t *)iov[i].iov_base + skip, n - skip);
+        b->pending_len += n - skip;
+        skip = 0;
+    }
+    return 0;
+}
+
+static int rtp_tcp_pending_flush(struct rtp_socket *s)
+{
+    struct rtp_tcp_batch *b = s->batch;
+    struct iovec iov;
+    int ret;
+
+    if (b->pending_len == 0) {
+        return 0;
+    }
+    iov.iov_base = b->pending + b->pending_off;
+    iov.iov_len = b->pending_len;
+    ret = sock_sendv(s->rtp_fd, &iov, 1);
+    if (ret < 0) {
+        return -1;
+    }
+    b->pending_off += ret;
+    b->pending_len -= ret;
+    if (b->pending_len == 0) {
+        b->pending_off = 0;
+    }
+    return 0;
+}
+
+/* one writev of gathered pieces, what the kernel does not take is kept */
+static int rtp_tcp_batch_flush(struct rtp_socket *s)
+{
+    struct rtp_tcp_batch *b = s->batch;
     int ret;
 
+    if (b->iovcnt == 0) {
+        return 0;
+    }
+    if (-1 == rtp_tcp_pending_flush(s)) {
+        ret = -1;
+    } else if (b->pending_len > 0) {
+        ret = rtp_tcp_pending_append(b, b->iov, b->iovcnt, 0);
+    } else {
+        ret = sock_sendv(s->rtp_fd, b->iov, b->iovcnt);
+        if (ret >= 0) {
+            ret = rtp_tcp_pending_append(b, b->iov, b->iovcnt, ret);
+        }
+    }
+    b->iovcnt = 0;
+    b->scratch_len = 0;
+    return ret;
+}
+
+/*
+ * '$' header and rtp header live on stack of the packetizer and are always
+ * copied, so are other small pieces. larger pieces are slices of the frame,
+ * which stays valid until rtp_tcp_frame_end
+ */
+static int rtp_tcp_batch_add(struct rtp_socket *s, const struct iovec *iov, int iovcnt)
+{
+    struct rtp_tcp_batch *b = s->batch;
+    struct iovec *last;
+    size_t copy = 0;
+    uint8_t *p;
+    int i;
+
+    for (i = 0; i < iovcnt; i++) {
+        if (i < 2 || iov[i].iov_len <= RTP_TCP_COPY_MAX) {
+            copy += iov[i].iov_len;
+        }
+    }
+    if (copy > RTP_TCP_BATCH_SCRATCH) {
+        loge("rtp pieces %zu too large to batch!\n", copy);
+        return -1;
+    }
+    if (b->iovcnt + iovcnt > RTP_TCP_BATCH_IOV ||
+        b->scratch_len + copy > RTP_TCP_BATCH_SCRATCH) {
+        if (-1 == rtp_tcp_batch_flush(s)) {
+            return -1;
+        }
+    }
+    for (i = 0; i < iovcnt; i++) {
+        if (i < 2 || iov[i].iov_len <= RTP_TCP_COPY_MAX) {
+            p = b->scratch + b->scratch_len;
+            memcpy(p, iov[i].iov_base, iov[i].iov_len);
+            last = b->iovcnt > 0 ? &b->iov[b->iovcnt - 1] : NULL;
+            b->scratch_len += iov[i].iov_len;
+            /* adjacent copies in scratch are one piece */
+            if (last && p > b->scratch && (uint8_t *)last->iov_base + last->iov_len == p) {
+                last->iov_len += iov[i].iov_len;
+                continue;
+            }
+            b->iov[b->iovcnt].iov_base = p;
+        } else {
+            b->iov[b->iovcnt].iov_base = iov[i].iov_base;
+        }
+        b->iov[b->iovcnt].iov_len = iov[i].iov_len;
+        b->iovcnt++;
+    }
+    return 0;
+}
+
+int rtp_tcp_frame_begin(struct rtp_socket *s)
+{
+    struct rtp_tcp_batch *b;
+
+    if (!s || !s->batch) {
+        return 0;
+    }
+    b = s->batch;
+    b->in_frame = false;
+    if (-1 == rtp_tcp_pending_flush(s)) {
+        return -1;
+    }
+    if (b->pending_len > 0) {
+        b->frames_dropped++;
+        return -1;
+    }
+    b->in_frame = true;
+    return 0;
+}
+
+int rtp_tcp_frame_end(struct rtp_socket *s)
+{
+    if (!s || !s->batch || !s->batch->in_frame) {
+        return 0;
+    }
+    s->batch->in_frame = false;
+    return rtp_tcp_batch_flush(s);
+}
+
+int rtp_udp_batch_enable(struct rtp_socket *s, bool enable)
+{
+    if (!s || s->mode != RTP_UDP) {
+        return -1;
+    }
+    if (!enable) {
+        free(s->udp_batch);
+        s->udp_batch = NULL;
+        return 0;
+    }
+    if (!s->udp_batch) {
+        s->udp_batch = calloc(1, sizeof(struct rtp_udp_batch));
+        if (!s->udp_batch) {
+            loge("calloc rtp_udp_batch failed!\n");
+            return -1;
+        }
+        /* socket level gso off, only messages with cmsg are segmented */
+        s->udp_batch->gso = (0 == sock_set_udp_gso(s->rtp_fd, 0));
+    }
+    return 0;
+}
+
+/* datagrams the kernel does not take now are dropped, as sendto would */
+static int rtp_udp_batch_flush(struct rtp_socket *s)
+{
+    struct rtp_udp_batch *b = s->udp_batch;
+    int ret = 0;
+
+    if (b->nmsgs > 0) {
+        ret = sock_sendmmsg(s->rtp_fd, b->msgs, b->nmsgs);
+        if (ret == -1 && b->gso) {
+            /* gso refused by route or device, plain datagrams from now */
+            loge("sendmmsg with gso failed, disable gso\n");
+            b->gso = false;
+        } else if (ret >= 0 && ret < b->nmsgs) {
+            b->frames_short++;
+        }
+    }
+    b->nmsgs = 0;
+    b->used = 0;
+    b->open = false;
+    return ret < 0 ? -1 : 0;
+}
+
+static int rtp_udp_batch_add(struct rtp_socket *s, const char *ip, uint16_t port, const struct iovec *iov, int iovcnt, size_t len)
+{
+    struct rtp_udp_batch *b = s->udp_batch;
+    struct sock_msg *m;
+    uint32_t addr = ip ? inet_addr(ip) : 0;
+    bool join;
+    uint8_t *p;
+    int i;
+
+    if (len > RTP_PACKET_MAX) {
+        return -1;
+    }
+    m = b->nmsgs > 0 ? &b->msgs[b->nmsgs - 1] : NULL;
+    if (m && (m->ip != addr || m->port != port)) {
+        if (-1 == rtp_udp_batch_flush(s)) {
+            return -1;
+        }
+        m = NULL;
+    }
+    /* next segment of the run, a shorter one ends it */
+    join = m && b->open && len <= m->segment && b->segs < RTP_UDP_GSO_SEGS &&
+           m->len + len <= RTP_UDP_GSO_BYTES;
+    if (b->used + len > sizeof(b->buf) || (!join && b->nmsgs == RTP_UDP_BATCH_PKTS)) {
+        if (-1 == rtp_udp_batch_flush(s)) {
+            return -1;
+        }
+        join = false;
+    }
+    p = b->buf + b->used;
+    for (i = 0; i < iovcnt; i++) {
+        memcpy(p, iov[i].iov_base, iov[i].iov_len);
+        p += iov[i].iov_len;
+    }
+    if (join) {
+        m->len += len;
+        b->segs++;
+        b->open = (len == m->segment);
+    } else {
+        m = &b->msgs[b->nmsgs++];
+        m->buf = b->buf + b->used;
+        m->len = len;
+        m->ip = addr;
+        m->port = port;
+        m->segment = (uint16_t)len;
+        b->segs = 1;
+        b->open = b->gso;
+    }
+    b->used += len;
+    return 0;
+}
+
+int rtp_udp_frame_begin(struct rtp_socket *s)
+{
+    if (!s || !s->udp_batch) {
+        return 0;
+    }
+    s->udp_batch->in_frame = true;
+    return 0;
+}
+
+int rtp_udp_frame_end(struct rtp_socket *s)
+{
+    if (!s || !s->udp_batch || !s->udp_batch->in_frame) {
+        return 0;
+    }
+    s->udp_batch->in_frame = false;
+    return rtp_udp_batch_flush(s);
+}
+
+ssize_t rtp_sendv(struct rtp_socket *s, const char *ip, uint16_t port, const struct iovec *iov, int iovcnt)
+{
+    uint8_t m_packet[4];
+    struct iovec tcp_iov[RTP_IOV_MAX + 1];
+    size_t len = 0;
+    int i, ret = -1;
+
+    if (iovcnt <= 0 || iovcnt > RTP_IOV_MAX) {
+        return -1;
+    }
+    for (i = 0; i < iovcnt; i++) {
+        len += iov[i].iov_len;
+    }
     switch (s->mode) {
     case RTP_TCP:
-        if (len >= (1 << 16))
-            return E2BIG;
+        /* 16 bit length in '$' header */
+        if (len >= (1 << 16)) {
+            loge("rtp packet %zu too large for interleaved!\n", len);
+            return -1;
+        }
 
+        /* interleaved header goes in front of rtp pieces, one sendmsg */
         m_packet[0] = '$';
         m_packet[1] = 0;//rtcp ? m_rtcp : m_rtp;
         m_packet[2] = (len >> 8) & 0xFF;
         m_packet[3] = len & 0xff;
-        memcpy(m_packet + 4, buf, len);
-        ret = sock_sendto(s->rtp_fd, ip, port, m_packet, len+4);
+        tcp_iov[0].iov_base = m_packet;
+        tcp_iov[0].iov_len = sizeof(m_packet);
+        memcpy(&tcp_iov[1], iov, iovcnt * sizeof(struct iovec));
+        if (s->batch && s->batch->in_frame) {
+            ret = rtp_tcp_batch_add(s, tcp_iov, iovcnt + 1) ? -1 : (ssize_t)(len + sizeof(m_packet));
+        } else {
+            ret = sock_sendv(s->rtp_fd, tcp_iov, iovcnt + 1);
+        }
         break;
     case RTP_UDP:
-        ret = sock_sendto(s->rtp_fd, ip, port, buf, len);
+        if (s->history) {
+            rtp_history_store(s->history, iov, iovcnt, len);
+        }
+        if (s->pacer) {
+            ret = rtp_pacer_sendv(s->pacer, ip, port, iov, iovcnt);
+        } else if (s->udp_batch && s->udp_batch->in_frame) {
+            ret = rtp_udp_batch_add(s, ip, port, iov, iovcnt, len) ? -1 : (ssize_t)len;
+        } else {
+            ret = sock_sendtov(s->rtp_fd, ip, port, iov, iovcnt);
+        }
         break;
     case RAW_UDP:
         break;
     default:
         break;
     }
-    logi("sock_sendto[%d] %s:%d ret=%d\n", s->rtp_fd, ip, port, ret);
+    if (ret > 0 && len > RTP_FIXED_HEADER) {
+        s->packets_sent++;
+        s->octets_sent += len - RTP_FIXED_HEADER;
+    }
+    logd("rtp_sendv[%d] %s:%d ret=%d\n", s->rtp_fd, ip, port, ret);
     return ret;
 }
 
+ssize_t rtp_sendto(struct rtp_socket *s, const char *ip, uint16_t port, const void *buf, size_t len)
+{
+    struct iovec iov;
+    iov.iov_base = (void *)buf;
+    iov.iov_len = len;
+    return rtp_sendv(s, ip, port, &iov, 1);
+}
+
 ssize_t rtp_recvfrom(struct rtp_socket *s, uint32_t *ip, uint16_t *port, void *buf, size_t len)
 {
     return sock_recvfrom(s->rtp_fd, ip, port, buf, len);
@@ -627,124 +1044,194 @@ int rtp_payload_find(int payload, const char* encoding, struct rtp_payload_deleg
 	return 0;
 }
 
-void rtcp_rr_unpack(rtcp_header_t *header, const uint8_t* ptr)
+/* middle 32 bits of ntp time, unit of lsr and dlsr, 1/65536 second */
+static uint32_t rtcp_ntp_middle(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint32_t)(((uint64_t)tv.tv_sec + 2208988800ULL) << 16) |
+           (uint32_t)(((uint64_t)tv.tv_usec << 16) / 1000000);
+}
+
+static void rtcp_rb_unpack(struct rtp_context *ctx, const uint8_t *ptr)
 {
-    uint32_t i;
     rtcp_rb_t rb;
+    uint32_t now, rtt;
+
+    rb.ssrc = nbo_r32(ptr);
+    rb.fraction = ptr[4];
+    rb.cumulative = (((uint32_t)ptr[5])<<16) | (((uint32_t)ptr[6])<<8)| ptr[7];
+    rb.exthsn = nbo_r32(ptr+8);
+    rb.jitter = nbo_r32(ptr+12);
+    rb.lsr = nbo_r32(ptr+16);
+    rb.dlsr = nbo_r32(ptr+20);
+    logd("rb of source %08X: lost %u/256 total %u, seq %u, jitter %u\n",
+         rb.ssrc, rb.fraction, rb.cumulative, rb.exthsn, rb.jitter);
+    if (rb.ssrc != ctx->ssrc) {
+        return;
+    }
+    ctx->stats.fraction_lost = rb.fraction;
+    ctx->stats.cumulative_lost = rb.cumulative;
+    ctx->stats.exthsn = rb.exthsn;
+    ctx->stats.jitter = rb.jitter;
+    ctx->stats.reports++;
+    /* rtt = arrival - lsr - dlsr, no sr was received by peer if lsr is 0 */
+    if (rb.lsr != 0 && rb.lsr == ctx->stats.last_sr) {
+        now = rtcp_ntp_middle();
+        rtt = now - rb.lsr - rb.dlsr;
+        if ((int32_t)rtt >= 0) {
+            ctx->stats.rtt_ms = (uint32_t)(((uint64_t)rtt * 1000) >> 16);
+        }
+    }
+}
+
+static void rtcp_rr_unpack(struct rtp_context *ctx, rtcp_header_t *header, const uint8_t* ptr)
+{
+    uint32_t i;
 
     if (header->length * 4 < sizeof(rtcp_rr_t) + header->rc * sizeof(rtcp_rb_t)) {
-        loge("error occur\n");
+        loge("rr length %d of %d blocks invalid\n", header->length, header->rc);
         return;
     }
-
+    ctx->stats.ssrc = nbo_r32(ptr);
     ptr += sizeof(rtcp_rr_t);
     for (i = 0; i < header->rc; i++, ptr += sizeof(rtcp_rb_t)) {
-        rb.ssrc = nbo_r32(ptr);
-        rb.fraction = ptr[4];
-        rb.cumulative = (((uint32_t)ptr[5])<<16) | (((uint32_t)ptr[6])<<8)| ptr[7];
-        rb.exthsn = nbo_r32(ptr+8);
-        rb.jitter = nbo_r32(ptr+12);
-        rb.lsr = nbo_r32(ptr+16);
-        rb.dlsr = nbo_r32(ptr+20);
-        logi("\n      Received RR of source: %08X"
-             "\n              Fraction Lost: %hhu"
-             "\n         Total Packets Lost: %d"
-             "\nReceived Packets Seq Number: %u"
-             "\n        Interarrival Jitter: %u"
-             "\n                    Last SR: %u"
-             "\n        Delay Since Last SR: %u\n",
-             rb.ssrc, rb.fraction, rb.cumulative,
-             rb.exthsn, rb.jitter, rb.lsr, rb.dlsr);
-    }
-}
-
-void rtcp_sr_unpack(rtcp_header_t *header, const uint8_t* ptr)
+        rtcp_rb_unpack(ctx, ptr);
+    }
+}
+
+static void rtcp_sr_unpack(struct rtp_context *ctx, rtcp_header_t *header, const uint8_t* ptr)
 {
     uint32_t i;
-    rtcp_sr_t sr;
-    rtcp_rb_t rb;
 
     if (header->length * 4 < sizeof(rtcp_sr_t) + header->rc * sizeof(rtcp_rb_t)) {
-        loge("error occur\n");
+        loge("sr length %d of %d blocks invalid\n", header->length, header->rc);
         return;
     }
-    sr.ssrc = nbo_r32(ptr);
-    sr.ntpmsw = nbo_r32(ptr + 4);
-    sr.ntplsw = nbo_r32(ptr + 8);
-    sr.rtpts = nbo_r32(ptr + 12);
-    sr.spc = nbo_r32(ptr + 16);
-    sr.soc = nbo_r32(ptr + 20);
-
-    logi("\nReceived SR sender info of SSRC %08X:"
-         "\n           NTP  Timestamp MSW: %u"
-         "\n           NTP  Timestamp LSW: %u"
-         "\n                RTP Timestamp: %u"
-         "\n        Sender's packet count: %u"
-         "\n         Sender's octet count: %u",
-         sr.ssrc, sr.ntpmsw, sr.ntplsw, sr.rtpts, sr.spc, sr.soc);
+    logd("sr of %08X, packets %u, octets %u\n",
+         nbo_r32(ptr), nbo_r32(ptr + 16), nbo_r32(ptr + 20));
     ptr += sizeof(rtcp_sr_t);
-    for (i = 0; i < header->rc; i++, ptr+=sizeof(rtcp_rb_t)) {
-        rb.ssrc = nbo_r32(ptr);
-        rb.fraction = ptr[4];
-        rb.cumulative = (((uint32_t)ptr[5])<<16) | (((uint32_t)ptr[6])<<8)| ptr[7];
-        rb.exthsn = nbo_r32(ptr+8);
-        rb.jitter = nbo_r32(ptr+12);
-        rb.lsr = nbo_r32(ptr+16);
-        rb.dlsr = nbo_r32(ptr+20);
-        logi("\n      Received SR of source: %08X"
-             "\n              Fraction Lost: %hhu"
-             "\n         Total Packets Lost: %d"
-             "\nReceived Packets Seq Number: %u"
-             "\n        Interarrival Jitter: %u"
-             "\n                    Last SR: %u"
-             "\n        Delay Since Last SR: %u\n",
-             rb.ssrc, rb.fraction, rb.cumulative,
-             rb.exthsn, rb.jitter, rb.lsr, rb.dlsr);
-    }
-}
-int rtcp_parse(char* data, size_t bytes)
-{
-    rtcp_header_t header;
-    uint32_t rtcphd = nbo_r32((uint8_t *)data);
-    header.v = RTCP_V(rtcphd);
-    header.p = RTCP_P(rtcphd);
-    header.rc = RTCP_RC(rtcphd);
-    header.pt = RTCP_PT(rtcphd);
-    header.length = RTCP_LEN(rtcphd);
-
-    if (header.length * 4 + 4 > bytes) {
-        loge("xxx\n");
-        return -1;
+    for (i = 0; i < header->rc; i++, ptr += sizeof(rtcp_rb_t)) {
+        rtcp_rb_unpack(ctx, ptr);
     }
+}
+
+/*
+ * Generic NACK (RFC 4585 6.2.1), sender ssrc, media ssrc, then FCI of
+ * PID, the lost seq, and BLP, bitmask of lost seq PID+1 to PID+16
+ */
+static void rtcp_nack_unpack(struct rtp_context *ctx, rtcp_header_t *header, const uint8_t* ptr)
+{
+    uint32_t i;
+    uint16_t pid, blp;
+    int bit;
 
-    if (1 == header.p) {
-        header.length -= *(data + header.length - 1) * 4;
-        loge("xxx\n");
+    if (header->rc != RTCP_RTPFB_NACK || header->length < 3) {
+        return;
     }
+    if (nbo_r32(ptr + 4) != ctx->ssrc) {
+        return;
+    }
+    ptr += 8;
+    for (i = 2; i < header->length; i++, ptr += 4) {
+        pid = nbo_r16(ptr);
+        blp = nbo_r16(ptr + 2);
+        for (bit = -1; bit < 16; bit++) {
+            if (bit >= 0 && !(blp & (1 << bit))) {
+                continue;
+            }
+            ctx->stats.nacks++;
+            if (0 == rtp_history_resend(ctx->sock, (uint16_t)(pid + bit + 1))) {
+                ctx->stats.retransmitted++;
+            } else {
+                ctx->stats.missed++;
+            }
+        }
+    }
+}
 
-    switch (header.pt) {
-    case RTCP_SR:
-        rtcp_sr_unpack(&header, (uint8_t *)data+4);
-        break;
-    case RTCP_RR:
-        rtcp_rr_unpack(&header, (uint8_t *)data+4);
-        break;
-    case RTCP_SDES:
-        loge("RTCP_SDES\n");
-        //rtcp_sdes_unpack(ctx, &header, data+4);
-        break;
-    case RTCP_BYE:
-        loge("RTCP_BYE\n");
-        //rtcp_bye_unpack(ctx, &header, data+4);
-        break;
-    case RTCP_APP:
-        loge("RTCP_APP\n");
-        //rtcp_app_unpack(ctx, &header, data+4);
-        break;
-    default:
-        loge("xxxx\n");
-        break;
+int rtcp_sr_pack(struct rtp_context *ctx, uint32_t rtpts, void *buf, size_t len)
+{
+    static const char cname[] = "gear-lib";
+    struct timeval tv;
+    uint8_t *ptr = (uint8_t *)buf;
+    uint32_t frac;
+    size_t sdes_len, n;
+
+    /* sr of 28 bytes, sdes chunk of ssrc, cname item and end padded to 4 */
+    sdes_len = (4 + 2 + sizeof(cname) - 1 + 1 + 3) / 4 * 4;
+    if (!ctx || !ctx->sock || len < 28 + 4 + sdes_len) {
+        return -1;
     }
+    gettimeofday(&tv, NULL);
+    frac = (uint32_t)(((uint64_t)tv.tv_usec << 32) / 1000000);
+
+    nbo_w32(ptr, (RTP_VERSION << 30) | (RTCP_SR << 16) | (28 / 4 - 1));
+    nbo_w32(ptr + 4, ctx->ssrc);
+    nbo_w32(ptr + 8, (uint32_t)(tv.tv_sec + 2208988800ULL));
+    nbo_w32(ptr + 12, frac);
+    nbo_w32(ptr + 16, rtpts);
+    nbo_w32(ptr + 20, ctx->sock->packets_sent);
+    nbo_w32(ptr + 24, ctx->sock->octets_sent);
+    ctx->stats.last_sr = (uint32_t)((tv.tv_sec + 2208988800ULL) << 16) | (frac >> 16);
+    n = 28;
+
+    nbo_w32(ptr + n, (RTP_VERSION << 30) | (1 << 24) | (RTCP_SDES << 16) | (sdes_len / 4));
+    nbo_w32(ptr + n + 4, ctx->ssrc);
+    ptr[n + 8] = RTCP_SDES_CNAME;
+    ptr[n + 9] = sizeof(cname) - 1;
+    memcpy(ptr + n + 10, cname, sizeof(cname) - 1);
+    memset(ptr + n + 10 + sizeof(cname) - 1, 0, 4 + sdes_len - (6 + sizeof(cname) - 1));
+    return (int)(n + 4 + sdes_len);
+}
 
+int rtcp_parse(struct rtp_context *ctx, char* data, size_t bytes)
+{
+    rtcp_header_t header;
+    uint32_t rtcphd;
+    const uint8_t *ptr = (const uint8_t *)data;
+    size_t len;
+
+    /* compound packet, each one is 4 * (length + 1) bytes */
+    while (bytes >= 4) {
+        rtcphd = nbo_r32(ptr);
+        header.v = RTCP_V(rtcphd);
+        header.p = RTCP_P(rtcphd);
+        header.rc = RTCP_RC(rtcphd);
+        header.pt = RTCP_PT(rtcphd);
+        header.length = RTCP_LEN(rtcphd);
+        len = (size_t)header.length * 4 + 4;
+        if (header.v != RTP_VERSION || len > bytes) {
+            loge("rtcp packet invalid, v=%d len=%zu bytes=%zu\n", header.v, len, bytes);
+            return -1;
+        }
+        if (1 == header.p) {
+            /* last octet is count of padding octets, only in last packet */
+            header.length -= ptr[len - 1] / 4;
+        }
+
+        switch (header.pt) {
+        case RTCP_SR:
+            rtcp_sr_unpack(ctx, &header, ptr + 4);
+            break;
+        case RTCP_RR:
+            rtcp_rr_unpack(ctx, &header, ptr + 4);
+            break;
+        case RTCP_RTPFB:
+            rtcp_nack_unpack(ctx, &header, ptr + 4);
+            break;
+        case RTCP_SDES:
+        case RTCP_BYE:
+        case RTCP_APP:
+        case RTCP_PSFB:
+            logd("rtcp %d ignored\n", header.pt);
+            break;
+        default:
+            loge("rtcp %d unknown\n", header.pt);
+            break;
+        }
+        ptr += len;
+        bytes -= len;
+    }
     return 0;
 }
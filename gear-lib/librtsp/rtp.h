@@ -23,7 +23,9 @@
 #define LIBRTP_H
 
 #include <libposix.h>
+#include <libsock.h>
 #include <stdint.h>
+#include <stdbool.h>
 #if defined (OS_LINUX)
 #include <netinet/in.h>
 #endif
@@ -120,8 +122,13 @@ enum {
     RTCP_SDES = 202,
     RTCP_BYE  = 203,
     RTCP_APP  = 204,
+    RTCP_RTPFB = 205, /* transport layer feedback, RFC 4585 */
+    RTCP_PSFB = 206,
 };
 
+/* FMT of RTPFB, FCI is one or more 16-bit PID and 16-bit BLP pairs */
+#define RTCP_RTPFB_NACK  1
+
 enum {
     RTCP_SDES_END     = 0,
     RTCP_SDES_CNAME   = 1,
@@ -136,6 +143,13 @@ enum {
 
 #define RTP_VERSION      2
 #define RTP_FIXED_HEADER 12
+/* fixed header, 15 csrc and a small extension, enough for a stack buffer */
+#define RTP_HEADER_MAX   (RTP_FIXED_HEADER + 15 * 4 + 4 + 64)
+/* largest rtp packet over udp, header included */
+#define RTP_PACKET_MAX   (1472)
+/* pieces of one rtp packet passed to rtp_sendv, aggregation packets take
+ * a header and a size and nalu piece per unit */
+#define RTP_IOV_MAX      (1 + 2 * 16)
 struct rtp_packet
 {
     struct rtp_header header;
@@ -154,6 +168,61 @@ enum rtp_mode {
     RAW_UDP,
 };
 
+struct rtp_pacer;
+
+/* sent rtp packets kept for nack, slot is seq modulo RTP_HISTORY_SLOTS */
+#define RTP_HISTORY_SLOTS (256)
+struct rtp_history {
+    struct {
+        uint16_t seq;
+        uint16_t len;
+        uint8_t data[RTP_PACKET_MAX];
+    } slots[RTP_HISTORY_SLOTS];
+};
+
+/*
+ * interleaved packets of one frame gathered for one writev, rtp and '$'
+ * headers are copied into scratch, payload pieces point into the frame.
+ * the tail the kernel does not take is copied into pending, and frames
+ * are dropped whole until it is written, so framing never breaks
+ */
+#define RTP_TCP_BATCH_IOV     (1024)
+#define RTP_TCP_BATCH_SCRATCH (32 * 1024)
+#define RTP_TCP_COPY_MAX      (64)
+struct rtp_tcp_batch {
+    bool in_frame;
+    int iovcnt;
+    size_t scratch_len;
+    uint8_t *pending;
+    size_t pending_off;
+    size_t pending_len;
+    size_t pending_cap;
+    uint32_t frames_dropped;
+    struct iovec iov[RTP_TCP_BATCH_IOV];
+    uint8_t scratch[RTP_TCP_BATCH_SCRATCH];
+};
+
+/*
+ * udp packets of one frame copied back to back into buf and sent with one
+ * sock_sendmmsg. a run of equal size packets, the fu-a fragments of a nalu,
+ * plus a shorter last one goes as one UDP_SEGMENT message when the kernel
+ * has gso, so the stack is walked once per run. paced sockets queue instead
+ */
+#define RTP_UDP_BATCH_PKTS    (128)
+#define RTP_UDP_GSO_SEGS      (64)
+#define RTP_UDP_GSO_BYTES     (60 * 1024)
+struct rtp_udp_batch {
+    bool in_frame;
+    bool gso;
+    bool open;                  /* last message takes more segments */
+    int segs;                   /* segments in last message */
+    int nmsgs;
+    size_t used;
+    uint32_t frames_short;      /* frames the kernel did not take whole */
+    struct sock_msg msgs[RTP_UDP_BATCH_PKTS];
+    uint8_t buf[RTP_UDP_BATCH_PKTS * RTP_PACKET_MAX];
+};
+
 struct rtp_socket {
     enum rtp_mode mode;
     uint16_t rtp_src_port;
@@ -164,6 +233,12 @@ struct rtp_socket {
     char dst_ip[INET_ADDRSTRLEN];
     int rtp_fd;
     int rtcp_fd;
+    struct rtp_pacer *pacer;    /* udp only, NULL sends at once */
+    struct rtp_history *history;/* udp only, NULL no retransmission */
+    struct rtp_tcp_batch *batch;/* tcp only, NULL writes each packet */
+    struct rtp_udp_batch *udp_batch;/* udp only, NULL sends each packet */
+    uint32_t packets_sent;
+    uint32_t octets_sent;       /* payload octets, for sender report */
 };
 
 int rtp_ssrc(void);
@@ -180,8 +255,24 @@ int rtp_packet_getsize();
 
 struct rtp_socket *rtp_socket_create(enum rtp_mode mode, int tcp_fd, const char* src_ip, const char *dst_ip);
 void rtp_socket_destroy(struct rtp_socket *s);
+/* copies of sent packets are kept, so nacked ones can be resent */
+int rtp_history_enable(struct rtp_socket *s, bool enable);
+int rtp_history_resend(struct rtp_socket *s, uint16_t seq);
+/* rtp_sendv between begin and end of frame is gathered and written once,
+ * begin returns -1 while the previous frame is not written, drop it whole */
+int rtp_tcp_batch_enable(struct rtp_socket *s, bool enable);
+int rtp_tcp_frame_begin(struct rtp_socket *s);
+int rtp_tcp_frame_end(struct rtp_socket *s);
+/* udp counterpart, packets between begin and end go out in one sendmmsg */
+int rtp_udp_batch_enable(struct rtp_socket *s, bool enable);
+int rtp_udp_frame_begin(struct rtp_socket *s);
+int rtp_udp_frame_end(struct rtp_socket *s);
+/* udp socket sends to multicast group, rtp on port and rtcp on port+1 */
+int rtp_socket_set_multicast(struct rtp_socket *s, const char *group, uint16_t port, uint8_t ttl);
 
 ssize_t rtp_sendto(struct rtp_socket *s, const char *ip, uint16_t port, const void *buf, size_t len);
+/* one rtp packet from header and payload pieces, payload is not copied */
+ssize_t rtp_sendv(struct rtp_socket *s, const char *ip, uint16_t port, const struct iovec *iov, int iovcnt);
 ssize_t rtp_recvfrom(struct rtp_socket *s, uint32_t *ip, uint16_t *port, void *buf, size_t len);
 
 ssize_t rtcp_sendto(struct rtp_socket *s, const char *ip, uint16_t port, const void *buf, size_t len);
@@ -258,8 +349,27 @@ struct rtp_payload_delegate_t
 
 int rtp_payload_find(int payload, const char* encoding, struct rtp_payload_delegate_t* codec);
 
+/*
+ * reception quality of the session from rtcp of the receiver, loss and
+ * jitter as last reported in its rr, rtt from lsr and dlsr of that rr
+ */
+struct rtcp_stats {
+    uint32_t ssrc;              /* of receiver */
+    uint8_t fraction_lost;      /* of 256, since previous report */
+    uint32_t cumulative_lost;
+    uint32_t exthsn;            /* extended highest sequence received */
+    uint32_t jitter;            /* in timestamp units */
+    uint32_t rtt_ms;
+    uint32_t reports;
+    uint32_t nacks;             /* lost packets requested by nack */
+    uint32_t retransmitted;
+    uint32_t missed;            /* nacked but no longer in history */
+    uint32_t last_sr;           /* middle 32 bits of ntp time of last sr */
+};
+
 struct rtp_context
 {
+    struct rtcp_stats stats;
     uint32_t ssrc;
     // RTP/RTCP
     int avg_rtcp_size;
@@ -274,8 +384,13 @@ struct rtp_context
 struct rtp_context *rtp_create(int frequence, int boundwidth);
 
 int rtp_payload_h264_encode(struct rtp_socket *sock, struct rtp_packet *pkt, const void* h264, int bytes, uint32_t timestamp);
+/* RFC 7798, single nal unit, aggregation and fragmentation unit packets */
+int rtp_payload_h265_encode(struct rtp_socket *sock, struct rtp_packet *pkt, const void* h265, int bytes, uint32_t timestamp);
 
-int rtcp_parse(/*struct rtp_context *ctx, */char* data, size_t bytes);
+/* compound sr and sdes cname of ctx->sock, return length or -1 */
+int rtcp_sr_pack(struct rtp_context *ctx, uint32_t rtpts, void *buf, size_t len);
+/* compound rtcp from receiver, updates ctx->stats and resends nacked packets */
+int rtcp_parse(struct rtp_context *ctx, char* data, size_t bytes);
 
 enum rtp_payload_type_value {
     RTP_PT_PCMU  = 0,
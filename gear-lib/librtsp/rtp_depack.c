@@ -0,0 +1,518 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#include "rtp_depack.h"
+#include "rtp.h"
+#include <liblog.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RTP_DEPACK_SLOT_MASK    (RTP_DEPACK_SLOTS - 1)
+#define RTP_DEPACK_POOL_FREE    (4)
+
+struct rtp_view {
+    bool marker;
+    uint8_t pt;
+    uint16_t seq;
+    uint32_t ts;
+    const uint8_t *payload;
+    size_t len;
+};
+
+struct rtp_slot {
+    bool used;
+    struct media_buffer *buf;
+    const uint8_t *data;
+    size_t len;
+    uint64_t arrival;
+};
+
+struct rtp_depack {
+    struct rtp_depack_conf conf;
+    struct media_buffer_pool *pool;
+    struct rtp_slot slots[RTP_DEPACK_SLOTS];
+    int held;
+    bool started;
+    uint16_t next_seq;
+    bool gap;                       /* packets were given up since last one */
+    bool prev_marker;
+    bool need_key;
+    /* frame being assembled */
+    bool frame_open;
+    struct media_buffer *frame;
+    size_t flen;
+    uint32_t fts;
+    bool fkey;
+    bool fparam;                    /* has parameter sets, passed to decoder */
+    bool fbroken;
+    bool fu_open;
+    /* 64 bit timestamp of emitted frames */
+    bool ts_started;
+    uint32_t last_ts;
+    uint64_t ts_ext;
+    struct rtp_depack_stats stats;
+};
+
+static const uint8_t start_code[4] = {0, 0, 0, 1};
+
+static int rtp_parse(const uint8_t *p, size_t len, struct rtp_view *v)
+{
+    size_t off, pad;
+
+    if (len < RTP_FIXED_HEADER || (p[0] >> 6) != RTP_VERSION) {
+        return -1;
+    }
+    off = RTP_FIXED_HEADER + (p[0] & 0x0f) * 4;
+    if ((p[0] & 0x10) && off + 4 <= len) {
+        off += 4 + (((size_t)p[off + 2] << 8) | p[off + 3]) * 4;
+    }
+    if (off > len) {
+        return -1;
+    }
+    if (p[0] & 0x20) {
+        pad = p[len - 1];
+        if (pad > len - off) {
+            return -1;
+        }
+        len -= pad;
+    }
+    v->marker = p[1] >> 7;
+    v->pt = p[1] & 0x7f;
+    v->seq = ((uint16_t)p[2] << 8) | p[3];
+    v->ts = ((uint32_t)p[4] << 24) | ((uint32_t)p[5] << 16) |
+            ((uint32_t)p[6] << 8) | p[7];
+    v->payload = p + off;
+    v->len = len - off;
+    return 0;
+}
+
+static int frame_append(struct rtp_depack *d, const void *p, size_t n)
+{
+    if (d->fbroken) {
+        return -1;
+    }
+    if (d->flen + n > d->frame->size) {
+        d->stats.oversize++;
+        d->fbroken = true;
+        return -1;
+    }
+    memcpy(d->frame->data + d->flen, p, n);
+    d->flen += n;
+    return 0;
+}
+
+static void frame_nalu(struct rtp_depack *d, const uint8_t *nal, size_t n)
+{
+    if (0 == frame_append(d, start_code, sizeof(start_code))) {
+        frame_append(d, nal, n);
+    }
+}
+
+static bool nalu_is_key(struct rtp_depack *d, uint8_t type)
+{
+    if (d->conf.codec == VIDEO_CODEC_H265) {
+        if (type >= 32 && type <= 34) {
+            d->fparam = true;       /* VPS, SPS and PPS */
+        }
+        return type >= 16 && type <= 21;   /* BLA, IDR and CRA */
+    }
+    if (type == 7 || type == 8) {
+        d->fparam = true;
+    }
+    return type == 5;
+}
+
+/* STAP-A and AP, 16 bit size before each nalu */
+static void depack_aggregate(struct rtp_depack *d, const uint8_t *p, size_t len)
+{
+    size_t n;
+    uint8_t type;
+
+    while (len >= 2 && !d->fbroken) {
+        n = ((size_t)p[0] << 8) | p[1];
+        p += 2;
+        len -= 2;
+        if (n == 0 || n > len) {
+            d->fbroken = true;
+            break;
+        }
+        type = d->conf.codec == VIDEO_CODEC_H265 ? (p[0] >> 1) & 0x3f : p[0] & 0x1f;
+        if (nalu_is_key(d, type)) {
+            d->fkey = true;
+        }
+        frame_nalu(d, p, n);
+        p += n;
+        len -= n;
+    }
+}
+
+/* FU-A and FU, header of the nalu is rebuilt from the fu header on start */
+static void depack_fragment(struct rtp_depack *d, const uint8_t *hdr, size_t hlen,
+                uint8_t type, uint8_t fu, const uint8_t *p, size_t len)
+{
+    if (fu & 0x80) {
+        if (d->fu_open) {
+            d->fbroken = true;      /* end of previous fragment is lost */
+            return;
+        }
+        d->fu_open = true;
+        if (nalu_is_key(d, type)) {
+            d->fkey = true;
+        }
+        if (0 != frame_append(d, start_code, sizeof(start_code)) ||
+            0 != frame_append(d, hdr, hlen)) {
+            return;
+        }
+    } else if (!d->fu_open) {
+        d->fbroken = true;          /* start of fragment is lost */
+        return;
+    }
+    frame_append(d, p, len);
+    if (fu & 0x40) {
+        d->fu_open = false;
+    }
+}
+
+static void depack_h264(struct rtp_depack *d, const uint8_t *p, size_t len)
+{
+    uint8_t type, hdr;
+
+    if (len < 1) {
+        return;
+    }
+    type = p[0] & 0x1f;
+    if (type >= 1 && type <= 23) {
+        if (nalu_is_key(d, type)) {
+            d->fkey = true;
+        }
+        frame_nalu(d, p, len);
+    } else if (type == 24) {
+        depack_aggregate(d, p + 1, len - 1);
+    } else if (type == 28 && len >= 2) {
+        hdr = (p[0] & 0xe0) | (p[1] & 0x1f);
+        depack_fragment(d, &hdr, 1, p[1] & 0x1f, p[1], p + 2, len - 2);
+    } else {
+        /* STAP-B, MTAP and FU-B are for interleaved mode only */
+        d->fbroken = true;
+    }
+}
+
+static void depack_h265(struct rtp_depack *d, const uint8_t *p, size_t len)
+{
+    uint8_t type, hdr[2];
+
+    if (len < 2) {
+        return;
+    }
+    type = (p[0] >> 1) & 0x3f;
+    if (type < 48) {
+        if (nalu_is_key(d, type)) {
+            d->fkey = true;
+        }
+        frame_nalu(d, p, len);
+    } else if (type == 48) {
+        depack_aggregate(d, p + 2, len - 2);
+    } else if (type == 49 && len >= 3) {
+        hdr[0] = (p[0] & 0x81) | ((p[2] & 0x3f) << 1);
+        hdr[1] = p[1];
+        depack_fragment(d, hdr, 2, p[2] & 0x3f, p[2], p + 3, len - 3);
+    } else {
+        d->fbroken = true;          /* PACI or DONL is not supported */
+    }
+}
+
+static uint64_t rtp_ts_extend(struct rtp_depack *d, uint32_t ts)
+{
+    if (!d->ts_started) {
+        d->ts_started = true;
+        d->ts_ext = ts;
+    } else {
+        d->ts_ext += (int32_t)(ts - d->last_ts);
+    }
+    d->last_ts = ts;
+    return d->ts_ext;
+}
+
+static void frame_emit(struct rtp_depack *d)
+{
+    struct video_packet pkt;
+
+    d->frame_open = false;
+    if (d->fu_open) {
+        d->fbroken = true;
+    }
+    if (d->fbroken || d->flen == 0 || (d->need_key && !d->fkey && !d->fparam)) {
+        d->stats.frames_dropped++;
+        goto out;
+    }
+    if (d->fkey) {
+        d->need_key = false;
+    }
+    memset(&pkt, 0, sizeof(pkt));
+    pkt.data = d->frame->data;
+    pkt.size = d->flen;
+    pkt.type = d->fkey ? H26X_FRAME_IDR : H26X_FRAME_UNKNOWN;
+    pkt.mem_type = MEDIA_MEM_SHALLOW;
+    pkt.pts = pkt.dts = rtp_ts_extend(d, d->fts);
+    pkt.key_frame = d->fkey;
+    pkt.encoder.type = d->conf.codec;
+    pkt.encoder.timebase.num = 1;
+    pkt.encoder.timebase.den = 90000;
+    pkt.buf = d->frame;
+    d->stats.frames++;
+    d->conf.cb(&pkt, d->conf.arg);
+out:
+    media_buffer_unref(d->frame);
+    d->frame = NULL;
+}
+
+static void frame_begin(struct rtp_depack *d, uint32_t ts)
+{
+    d->frame_open = true;
+    d->fts = ts;
+    d->flen = 0;
+    d->fkey = false;
+    d->fparam = false;
+    d->fbroken = false;
+    d->fu_open = false;
+    d->frame = media_buffer_pool_get(d->pool);
+    if (!d->frame) {
+        loge("media_buffer_pool_get failed!\n");
+        d->fbroken = true;
+    }
+}
+
+static void depack_packet(struct rtp_depack *d, const struct rtp_view *v)
+{
+    if (d->frame_open && v->ts != d->fts) {
+        frame_emit(d);              /* marker of previous frame is lost */
+    }
+    if (!d->frame_open) {
+        frame_begin(d, v->ts);
+    }
+    if (d->gap) {
+        /* start of this frame may be in the hole */
+        if (!d->prev_marker) {
+            d->fbroken = true;
+        }
+        d->gap = false;
+    }
+    if (!d->fbroken) {
+        if (d->conf.codec == VIDEO_CODEC_H265) {
+            depack_h265(d, v->payload, v->len);
+        } else {
+            depack_h264(d, v->payload, v->len);
+        }
+    }
+    d->prev_marker = v->marker;
+    if (v->marker) {
+        frame_emit(d);
+    }
+}
+
+static void slot_release(struct rtp_slot *s)
+{
+    media_buffer_unref(s->buf);
+    memset(s, 0, sizeof(*s));
+}
+
+static void depack_loss(struct rtp_depack *d, uint16_t n)
+{
+    d->stats.lost += n;
+    d->next_seq += n;
+    d->gap = true;
+    d->need_key = true;
+    if (d->frame_open) {
+        d->fbroken = true;
+    }
+}
+
+static void depack_drain(struct rtp_depack *d, uint64_t now_ms)
+{
+    struct rtp_slot *s;
+    struct rtp_view v;
+    int i;
+
+    while (d->held > 0) {
+        s = &d->slots[d->next_seq & RTP_DEPACK_SLOT_MASK];
+        if (s->used) {
+            if (0 == rtp_parse(s->data, s->len, &v)) {
+                depack_packet(d, &v);
+            }
+            slot_release(s);
+            d->held--;
+            d->next_seq++;
+            continue;
+        }
+        /* hole, first held packet after it waited for the longest */
+        for (i = 1; i < RTP_DEPACK_SLOTS; i++) {
+            s = &d->slots[(d->next_seq + i) & RTP_DEPACK_SLOT_MASK];
+            if (s->used) {
+                break;
+            }
+        }
+        if (now_ms - s->arrival < d->conf.latency_ms) {
+            break;
+        }
+        depack_loss(d, i);
+    }
+}
+
+/* sequence restarted or jumped beyond the window */
+static void depack_reset(struct rtp_depack *d, uint16_t seq)
+{
+    int i;
+    for (i = 0; i < RTP_DEPACK_SLOTS; i++) {
+        if (d->slots[i].used) {
+            slot_release(&d->slots[i]);
+        }
+    }
+    d->held = 0;
+    d->next_seq = seq;
+    d->gap = true;
+    d->need_key = true;
+    if (d->frame_open) {
+        d->fbroken = true;
+    }
+}
+
+int rtp_depack_input(struct rtp_depack *d, struct media_buffer *buf,
+                const uint8_t *data, size_t len, uint64_t now_ms)
+{
+    struct rtp_view v;
+    struct rtp_slot *s;
+    int16_t diff;
+
+    if (!d || !data || 0 != rtp_parse(data, len, &v)) {
+        return -1;
+    }
+    if (d->conf.payload_type && v.pt != d->conf.payload_type) {
+        return 0;
+    }
+    d->stats.packets++;
+    d->stats.bytes += len;
+    if (!d->started) {
+        d->started = true;
+        d->next_seq = v.seq;
+    }
+    diff = (int16_t)(v.seq - d->next_seq);
+    if (diff < 0 && diff > -RTP_DEPACK_SLOTS) {
+        d->stats.late++;
+        return 0;
+    }
+    if (diff < 0 || diff >= RTP_DEPACK_SLOTS) {
+        logd("rtp seq jump %u -> %u\n", d->next_seq, v.seq);
+        depack_reset(d, v.seq);
+        diff = 0;
+    }
+    if (diff == 0) {
+        /* in sequence, depacketized where it was received */
+        depack_packet(d, &v);
+        d->next_seq++;
+        depack_drain(d, now_ms);
+        return 0;
+    }
+    s = &d->slots[v.seq & RTP_DEPACK_SLOT_MASK];
+    if (s->used) {
+        d->stats.duplicate++;
+        return 0;
+    }
+    if (buf) {
+        s->buf = media_buffer_ref(buf);
+        s->data = data;
+    } else {
+        s->buf = media_buffer_alloc(len);
+        if (!s->buf) {
+            return 0;
+        }
+        memcpy(s->buf->data, data, len);
+        s->data = s->buf->data;
+        d->stats.copied++;
+    }
+    s->used = true;
+    s->len = len;
+    s->arrival = now_ms;
+    d->held++;
+    d->stats.reordered++;
+    depack_drain(d, now_ms);
+    return 0;
+}
+
+void rtp_depack_poll(struct rtp_depack *d, uint64_t now_ms)
+{
+    if (d) {
+        depack_drain(d, now_ms);
+    }
+}
+
+void rtp_depack_get_stats(struct rtp_depack *d, struct rtp_depack_stats *stats)
+{
+    if (d && stats) {
+        memcpy(stats, &d->stats, sizeof(*stats));
+    }
+}
+
+struct rtp_depack *rtp_depack_create(const struct rtp_depack_conf *conf)
+{
+    struct rtp_depack *d;
+
+    if (!conf || !conf->cb) {
+        loge("invalid paraments!\n");
+        return NULL;
+    }
+    d = calloc(1, sizeof(struct rtp_depack));
+    if (!d) {
+        loge("malloc rtp_depack failed!\n");
+        return NULL;
+    }
+    memcpy(&d->conf, conf, sizeof(*conf));
+    if (d->conf.latency_ms == 0) {
+        d->conf.latency_ms = RTP_DEPACK_LATENCY_MS;
+    }
+    if (d->conf.frame_max == 0) {
+        d->conf.frame_max = RTP_DEPACK_FRAME_MAX;
+    }
+    d->pool = media_buffer_pool_create(d->conf.frame_max, RTP_DEPACK_POOL_FREE);
+    if (!d->pool) {
+        loge("media_buffer_pool_create failed!\n");
+        free(d);
+        return NULL;
+    }
+    d->need_key = true;
+    return d;
+}
+
+void rtp_depack_destroy(struct rtp_depack *d)
+{
+    int i;
+    if (!d) {
+        return;
+    }
+    for (i = 0; i < RTP_DEPACK_SLOTS; i++) {
+        if (d->slots[i].used) {
+            slot_release(&d->slots[i]);
+        }
+    }
+    media_buffer_unref(d->frame);
+    media_buffer_pool_destroy(d->pool);
+    free(d);
+}
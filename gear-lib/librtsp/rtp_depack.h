@@ -0,0 +1,89 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#ifndef RTP_DEPACK_H
+#define RTP_DEPACK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <libmedia-io.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * receive side of rtp video, packets are reordered in a jitter buffer and
+ * nalus of single, STAP-A/AP and FU-A/FU payloads are written in annex-b
+ * into a pooled frame buffer, which is the only copy of payload.
+ * a packet in sequence with nothing held is depacketized from where it
+ * was received, only a packet held for reordering keeps a reference of
+ * its buffer, or is copied if it came without one.
+ * a hole older than latency_ms is given up, the frame is dropped and
+ * frames but parameter sets are dropped until next keyframe
+ */
+#define RTP_DEPACK_SLOTS        (512)
+#define RTP_DEPACK_LATENCY_MS   (100)
+#define RTP_DEPACK_FRAME_MAX    (1024 * 1024)
+
+struct rtp_depack;
+
+/* pkt->buf is the frame, take a reference by video_packet_copy to keep it */
+typedef void (rtp_depack_cb)(struct video_packet *pkt, void *arg);
+
+struct rtp_depack_conf {
+    enum video_codec_type codec;    /* VIDEO_CODEC_H264 or VIDEO_CODEC_H265 */
+    uint8_t payload_type;
+    uint32_t latency_ms;            /* 0 takes RTP_DEPACK_LATENCY_MS */
+    size_t frame_max;               /* 0 takes RTP_DEPACK_FRAME_MAX */
+    rtp_depack_cb *cb;
+    void *arg;
+};
+
+struct rtp_depack_stats {
+    uint64_t packets;
+    uint64_t bytes;
+    uint64_t lost;                  /* sequence numbers given up */
+    uint64_t late;                  /* arrived after its hole was given up */
+    uint64_t duplicate;
+    uint64_t reordered;             /* held before it could be depacketized */
+    uint64_t copied;                /* held without a buffer */
+    uint64_t frames;
+    uint64_t frames_dropped;
+    uint64_t oversize;              /* frames larger than frame_max */
+};
+
+struct rtp_depack *rtp_depack_create(const struct rtp_depack_conf *conf);
+void rtp_depack_destroy(struct rtp_depack *d);
+/*
+ * one rtp packet, buf owns data or is NULL if data is only valid during
+ * the call, now_ms is a monotonic clock. return -1 if it is not rtp
+ */
+int rtp_depack_input(struct rtp_depack *d, struct media_buffer *buf,
+                const uint8_t *data, size_t len, uint64_t now_ms);
+/* give up holes older than latency, called from a timer when input stops */
+void rtp_depack_poll(struct rtp_depack *d, uint64_t now_ms);
+void rtp_depack_get_stats(struct rtp_depack *d, struct rtp_depack_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -81,6 +81,8 @@ typedef struct h264_fu_header H264_FU_HEADER;
 #define FU_START    0x80
 #define FU_END      0x40
 #define N_FU_HEADER 2
+#define N_STAP_HEADER 1
+#define N_STAP_NALU_MAX ((RTP_IOV_MAX - 1) / 2)
 
 static const uint8_t* h264_nalu_find(const uint8_t* p, const uint8_t* end)
 {
@@ -95,28 +97,32 @@ static const uint8_t* h264_nalu_find(const uint8_t* p, const uint8_t* end)
     return end;
 }
 
+/*
+ * rtp header is built on stack and sent with payload slice of the nalu in
+ * one rtp_sendv, the frame buffer is never copied or allocated per packet
+ */
 static int rtp_h264_pack_nalu(struct rtp_socket *sock, struct rtp_packet *pkt, const uint8_t* nalu, int bytes)
 {
     int n, ret;
-    uint8_t *rtp;
+    uint8_t hdr[RTP_HEADER_MAX];
+    struct iovec iov[2];
 
     pkt->payload = nalu;
     pkt->payloadlen = bytes;
-    n = RTP_FIXED_HEADER + pkt->payloadlen;
-    rtp = (uint8_t*)calloc(1, n);
-    if (!rtp) return -1;
 
     pkt->header.m = (*nalu & 0x1f) <= 5 ? 1 : 0; // VCL only
-    n = rtp_packet_serialize(pkt, rtp, n);
-    if (n != RTP_FIXED_HEADER + pkt->payloadlen) {
+    n = rtp_packet_serialize_header(pkt, hdr, sizeof(hdr));
+    if (n < RTP_FIXED_HEADER) {
         return -1;
     }
 
     ++pkt->header.seq;
-    //DUMP_BUFFER(rtp, n);
-    ret = rtp_sendto(sock, sock->dst_ip, sock->rtp_dst_port, rtp, n);
-    free(rtp);
-    logd("rtp_sendto %s:%d len=%d, ret=%d\n", sock->dst_ip, sock->rtp_dst_port, n, ret);
+    iov[0].iov_base = hdr;
+    iov[0].iov_len = n;
+    iov[1].iov_base = (void *)nalu;
+    iov[1].iov_len = bytes;
+    ret = rtp_sendv(sock, sock->dst_ip, sock->rtp_dst_port, iov, 2);
+    logd("rtp_sendv %s:%d len=%d, ret=%d\n", sock->dst_ip, sock->rtp_dst_port, n + bytes, ret);
     if (ret == -1)
         return -1;
     return 0;
@@ -125,7 +131,8 @@ static int rtp_h264_pack_nalu(struct rtp_socket *sock, struct rtp_packet *pkt, c
 static int rtp_h264_pack_fu_a(struct rtp_socket *sock, struct rtp_packet *pkt, const uint8_t* nalu, int bytes)
 {
     int n, ret;
-    unsigned char *rtp;
+    uint8_t hdr[RTP_HEADER_MAX + N_FU_HEADER];
+    struct iovec iov[2];
 
     uint8_t fu_indicator = (*nalu & 0xE0) | 28; // FU-A
     uint8_t fu_header = *nalu & 0x1F;
@@ -145,23 +152,22 @@ static int rtp_h264_pack_fu_a(struct rtp_socket *sock, struct rtp_packet *pkt, c
             pkt->payloadlen = /*pkt->size*/MTU - RTP_FIXED_HEADER - N_FU_HEADER;
         }
         pkt->payload = nalu;
-        n = RTP_FIXED_HEADER + N_FU_HEADER + pkt->payloadlen;
-        rtp = (uint8_t*)calloc(1, n);
-        if (!rtp) return -1;
 
         pkt->header.m = (FU_END & fu_header) ? 1 : 0; // set marker flag
-        n = rtp_packet_serialize_header(pkt, rtp, n);
+        n = rtp_packet_serialize_header(pkt, hdr, RTP_HEADER_MAX);
         if (n != RTP_FIXED_HEADER) {
             return -1;
         }
 
         /*fu_indicator + fu_header*/
-        rtp[n + 0] = fu_indicator;
-        rtp[n + 1] = fu_header;
-        memcpy(rtp + n + N_FU_HEADER, pkt->payload, pkt->payloadlen);
-        ret = rtp_sendto(sock, sock->dst_ip, sock->rtp_dst_port, rtp, n + N_FU_HEADER + pkt->payloadlen);
-        free(rtp);
-        logd("rtp_sendto %s:%d len=%d, ret=%d\n", sock->dst_ip, sock->rtp_dst_port, n + N_FU_HEADER + pkt->payloadlen, ret);
+        hdr[n + 0] = fu_indicator;
+        hdr[n + 1] = fu_header;
+        iov[0].iov_base = hdr;
+        iov[0].iov_len = n + N_FU_HEADER;
+        iov[1].iov_base = (void *)pkt->payload;
+        iov[1].iov_len = pkt->payloadlen;
+        ret = rtp_sendv(sock, sock->dst_ip, sock->rtp_dst_port, iov, 2);
+        logd("rtp_sendv %s:%d len=%d, ret=%d\n", sock->dst_ip, sock->rtp_dst_port, n + N_FU_HEADER + pkt->payloadlen, ret);
         if (ret == -1)
             return -1;
 
@@ -173,10 +179,72 @@ static int rtp_h264_pack_fu_a(struct rtp_socket *sock, struct rtp_packet *pkt, c
     return 0;
 }
 
+/*
+ * STAP-A (RFC 6184 5.7.1), one header byte of type 24 followed by 16-bit
+ * size and nalu for each unit, F is or-ed and NRI is the highest of units
+ */
+static int rtp_h264_pack_stap_a(struct rtp_socket *sock, struct rtp_packet *pkt, const uint8_t **nalus, const int *sizes, int cnt)
+{
+    int i, n, ret, total = N_STAP_HEADER;
+    uint8_t hdr[RTP_HEADER_MAX + N_STAP_HEADER];
+    uint8_t len[N_STAP_NALU_MAX][2];
+    struct iovec iov[RTP_IOV_MAX];
+    uint8_t f = 0, nri = 0;
+
+    pkt->header.m = 0;
+    for (i = 0; i < cnt; i++) {
+        f |= *nalus[i] & 0x80;
+        if ((*nalus[i] & 0x60) > nri)
+            nri = *nalus[i] & 0x60;
+        if ((*nalus[i] & 0x1f) <= 5)
+            pkt->header.m = 1; // VCL only
+        len[i][0] = (uint8_t)(sizes[i] >> 8);
+        len[i][1] = (uint8_t)sizes[i];
+        iov[1 + 2 * i].iov_base = len[i];
+        iov[1 + 2 * i].iov_len = 2;
+        iov[2 + 2 * i].iov_base = (void *)nalus[i];
+        iov[2 + 2 * i].iov_len = sizes[i];
+        total += 2 + sizes[i];
+    }
+    pkt->payload = nalus[0];
+    pkt->payloadlen = total;
+
+    n = rtp_packet_serialize_header(pkt, hdr, RTP_HEADER_MAX);
+    if (n != RTP_FIXED_HEADER) {
+        return -1;
+    }
+    hdr[n] = f | nri | 24; // STAP-A
+
+    ++pkt->header.seq;
+    iov[0].iov_base = hdr;
+    iov[0].iov_len = n + N_STAP_HEADER;
+    ret = rtp_sendv(sock, sock->dst_ip, sock->rtp_dst_port, iov, 1 + 2 * cnt);
+    logd("rtp_sendv %s:%d len=%d, ret=%d\n", sock->dst_ip, sock->rtp_dst_port, n + total, ret);
+    if (ret == -1)
+        return -1;
+    return 0;
+}
+
+/* send pending small nalus, a lone one goes as single nal unit packet */
+static int rtp_h264_flush_stap_a(struct rtp_socket *sock, struct rtp_packet *pkt, const uint8_t **nalus, const int *sizes, int *cnt)
+{
+    int r = 0;
+    if (*cnt == 1) {
+        r = rtp_h264_pack_nalu(sock, pkt, nalus[0], sizes[0]);
+    } else if (*cnt > 1) {
+        r = rtp_h264_pack_stap_a(sock, pkt, nalus, sizes, *cnt);
+    }
+    *cnt = 0;
+    return r;
+}
+
 int rtp_payload_h264_encode(struct rtp_socket *sock, struct rtp_packet *pkt, const void* h264, int bytes, uint32_t timestamp)
 {
     int r = 0;
     const uint8_t *p1, *p2, *pend;
+    const uint8_t *stap_nalus[N_STAP_NALU_MAX];
+    int stap_sizes[N_STAP_NALU_MAX];
+    int stap_cnt = 0, stap_len = RTP_FIXED_HEADER + N_STAP_HEADER;
     pkt->header.timestamp = timestamp;
 
     pend = (const uint8_t*)h264 + bytes;
@@ -189,13 +257,30 @@ int rtp_payload_h264_encode(struct rtp_socket *sock, struct rtp_packet *pkt, con
 
         // filter suffix '00' bytes
         if (p2 != pend) --nalu_size;
-        while(0 == p1[nalu_size-1]) --nalu_size;
+        while(nalu_size > 0 && 0 == p1[nalu_size-1]) --nalu_size;
+        if (nalu_size == 0) {
+            continue;
+        }
 
-        if (nalu_size + RTP_FIXED_HEADER <= MTU) {
+        // sps, pps, sei and small slices share the timestamp, aggregate them
+        if (stap_cnt == N_STAP_NALU_MAX || stap_len + 2 + (int)nalu_size > MTU) {
+            r = rtp_h264_flush_stap_a(sock, pkt, stap_nalus, stap_sizes, &stap_cnt);
+            stap_len = RTP_FIXED_HEADER + N_STAP_HEADER;
+            if (r != 0)
+                break;
+        }
+        if (stap_len + 2 + (int)nalu_size <= MTU) {
+            stap_nalus[stap_cnt] = p1;
+            stap_sizes[stap_cnt++] = nalu_size;
+            stap_len += 2 + nalu_size;
+        } else if (nalu_size + RTP_FIXED_HEADER <= MTU) {
             r = rtp_h264_pack_nalu(sock, pkt, p1, nalu_size);
         } else {
             r = rtp_h264_pack_fu_a(sock, pkt, p1, nalu_size);
         }
     }
+    if (r == 0) {
+        r = rtp_h264_flush_stap_a(sock, pkt, stap_nalus, stap_sizes, &stap_cnt);
+    }
     return r;
 }
@@ -0,0 +1,252 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#include "rtp.h"
+#include <liblog.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+/* H.265 NAL unit header (RFC 7798 1.1.4)
+ * +---------------+---------------+
+ * |0|1|2|3|4|5|6|7|0|1|2|3|4|5|6|7|
+ * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ * |F|   Type    |  LayerId  | TID |
+ * +-------------+-----------------+
+ */
+#define H265_NAL_TYPE(b0)   (((b0) >> 1) & 0x3F)
+#define H265_NAL_AP         48
+#define H265_NAL_FU         49
+#define H265_NAL_VCL_MAX    31
+
+/*  FU header
+ * +---------------+
+ * |0|1|2|3|4|5|6|7|
+ * +-+-+-+-+-+-+-+-+
+ * |S|E|  FuType   |
+ * +---------------+
+ */
+#define FU_START    0x80
+#define FU_END      0x40
+#define N_NAL_HEADER 2
+#define N_FU_HEADER 3
+#define N_AP_NALU_MAX ((RTP_IOV_MAX - 1) / 2)
+
+#define MTU 1448
+
+static const uint8_t* h265_nalu_find(const uint8_t* p, const uint8_t* end)
+{
+    for (p += 2; p + 1 < end; p++) {
+        if (0x01 == *p && 0x00 == *(p - 1) && 0x00 == *(p - 2)) {
+            return p + 1;
+        }
+    }
+    return end;
+}
+
+static int rtp_h265_pack_nalu(struct rtp_socket *sock, struct rtp_packet *pkt, const uint8_t* nalu, int bytes)
+{
+    int n, ret;
+    uint8_t hdr[RTP_HEADER_MAX];
+    struct iovec iov[2];
+
+    pkt->payload = nalu;
+    pkt->payloadlen = bytes;
+
+    pkt->header.m = H265_NAL_TYPE(nalu[0]) <= H265_NAL_VCL_MAX ? 1 : 0; // VCL only
+    n = rtp_packet_serialize_header(pkt, hdr, sizeof(hdr));
+    if (n < RTP_FIXED_HEADER) {
+        return -1;
+    }
+
+    ++pkt->header.seq;
+    iov[0].iov_base = hdr;
+    iov[0].iov_len = n;
+    iov[1].iov_base = (void *)nalu;
+    iov[1].iov_len = bytes;
+    ret = rtp_sendv(sock, sock->dst_ip, sock->rtp_dst_port, iov, 2);
+    logd("rtp_sendv %s:%d len=%d, ret=%d\n", sock->dst_ip, sock->rtp_dst_port, n + bytes, ret);
+    if (ret == -1)
+        return -1;
+    return 0;
+}
+
+/* payload header keeps F, LayerId and TID of nalu, type is replaced by 49 */
+static int rtp_h265_pack_fu(struct rtp_socket *sock, struct rtp_packet *pkt, const uint8_t* nalu, int bytes)
+{
+    int n, ret;
+    uint8_t hdr[RTP_HEADER_MAX + N_FU_HEADER];
+    struct iovec iov[2];
+
+    uint8_t ph0 = (nalu[0] & 0x81) | (H265_NAL_FU << 1);
+    uint8_t ph1 = nalu[1];
+    uint8_t fu_header = H265_NAL_TYPE(nalu[0]);
+
+    nalu += N_NAL_HEADER; // skip NAL Unit header
+    bytes -= N_NAL_HEADER;
+
+    for (fu_header |= FU_START; bytes > 0; ++pkt->header.seq) {
+        if (bytes + RTP_FIXED_HEADER <= MTU - N_FU_HEADER) {
+            if (0 != (fu_header & FU_START)) {
+                return -1;
+            }
+            fu_header = FU_END | (fu_header & 0x3F);
+            pkt->payloadlen = bytes;
+        } else {
+            pkt->payloadlen = MTU - RTP_FIXED_HEADER - N_FU_HEADER;
+        }
+        pkt->payload = nalu;
+
+        pkt->header.m = (FU_END & fu_header) ? 1 : 0; // set marker flag
+        n = rtp_packet_serialize_header(pkt, hdr, RTP_HEADER_MAX);
+        if (n != RTP_FIXED_HEADER) {
+            return -1;
+        }
+
+        hdr[n + 0] = ph0;
+        hdr[n + 1] = ph1;
+        hdr[n + 2] = fu_header;
+        iov[0].iov_base = hdr;
+        iov[0].iov_len = n + N_FU_HEADER;
+        iov[1].iov_base = (void *)pkt->payload;
+        iov[1].iov_len = pkt->payloadlen;
+        ret = rtp_sendv(sock, sock->dst_ip, sock->rtp_dst_port, iov, 2);
+        logd("rtp_sendv %s:%d len=%d, ret=%d\n", sock->dst_ip, sock->rtp_dst_port, n + N_FU_HEADER + pkt->payloadlen, ret);
+        if (ret == -1)
+            return -1;
+
+        bytes -= pkt->payloadlen;
+        nalu += pkt->payloadlen;
+        fu_header &= 0x3F; // clear flags
+    }
+
+    return 0;
+}
+
+/*
+ * aggregation packet (RFC 7798 4.4.2), payload header type 48 followed by
+ * 16-bit size and nalu for each unit, F is or-ed and LayerId/TID are the
+ * lowest of the aggregated units
+ */
+static int rtp_h265_pack_ap(struct rtp_socket *sock, struct rtp_packet *pkt, const uint8_t **nalus, const int *sizes, int cnt)
+{
+    int i, n, ret, total = N_NAL_HEADER;
+    uint8_t hdr[RTP_HEADER_MAX + N_NAL_HEADER];
+    uint8_t len[N_AP_NALU_MAX][2];
+    struct iovec iov[RTP_IOV_MAX];
+    uint8_t f = 0, layer = 0x3F, tid = 0x07;
+
+    pkt->header.m = 0;
+    for (i = 0; i < cnt; i++) {
+        f |= nalus[i][0] & 0x80;
+        if (((nalus[i][0] & 0x01) << 5 | nalus[i][1] >> 3) < layer)
+            layer = (nalus[i][0] & 0x01) << 5 | nalus[i][1] >> 3;
+        if ((nalus[i][1] & 0x07) < tid)
+            tid = nalus[i][1] & 0x07;
+        if (H265_NAL_TYPE(nalus[i][0]) <= H265_NAL_VCL_MAX)
+            pkt->header.m = 1; // VCL only
+        len[i][0] = (uint8_t)(sizes[i] >> 8);
+        len[i][1] = (uint8_t)sizes[i];
+        iov[1 + 2 * i].iov_base = len[i];
+        iov[1 + 2 * i].iov_len = 2;
+        iov[2 + 2 * i].iov_base = (void *)nalus[i];
+        iov[2 + 2 * i].iov_len = sizes[i];
+        total += 2 + sizes[i];
+    }
+    pkt->payload = nalus[0];
+    pkt->payloadlen = total;
+
+    n = rtp_packet_serialize_header(pkt, hdr, RTP_HEADER_MAX);
+    if (n != RTP_FIXED_HEADER) {
+        return -1;
+    }
+    hdr[n + 0] = f | (H265_NAL_AP << 1) | (layer >> 5);
+    hdr[n + 1] = (uint8_t)((layer << 3) | tid);
+
+    ++pkt->header.seq;
+    iov[0].iov_base = hdr;
+    iov[0].iov_len = n + N_NAL_HEADER;
+    ret = rtp_sendv(sock, sock->dst_ip, sock->rtp_dst_port, iov, 1 + 2 * cnt);
+    logd("rtp_sendv %s:%d len=%d, ret=%d\n", sock->dst_ip, sock->rtp_dst_port, n + total, ret);
+    if (ret == -1)
+        return -1;
+    return 0;
+}
+
+/* send pending small nalus, a lone one goes as single nal unit packet */
+static int rtp_h265_flush_ap(struct rtp_socket *sock, struct rtp_packet *pkt, const uint8_t **nalus, const int *sizes, int *cnt)
+{
+    int r = 0;
+    if (*cnt == 1) {
+        r = rtp_h265_pack_nalu(sock, pkt, nalus[0], sizes[0]);
+    } else if (*cnt > 1) {
+        r = rtp_h265_pack_ap(sock, pkt, nalus, sizes, *cnt);
+    }
+    *cnt = 0;
+    return r;
+}
+
+int rtp_payload_h265_encode(struct rtp_socket *sock, struct rtp_packet *pkt, const void* h265, int bytes, uint32_t timestamp)
+{
+    int r = 0;
+    const uint8_t *p1, *p2, *pend;
+    const uint8_t *ap_nalus[N_AP_NALU_MAX];
+    int ap_sizes[N_AP_NALU_MAX];
+    int ap_cnt = 0, ap_len = RTP_FIXED_HEADER + N_NAL_HEADER;
+    pkt->header.timestamp = timestamp;
+
+    pend = (const uint8_t*)h265 + bytes;
+
+    for (p1 = h265_nalu_find((const uint8_t*)h265, pend); p1 < pend && 0 == r; p1 = p2) {
+        size_t nalu_size;
+
+        p2 = h265_nalu_find(p1 + 1, pend);
+        nalu_size = p2 - p1;
+
+        // filter suffix '00' bytes
+        if (p2 != pend) --nalu_size;
+        while (nalu_size > 0 && 0 == p1[nalu_size-1]) --nalu_size;
+        if (nalu_size < N_NAL_HEADER) {
+            continue;
+        }
+
+        // small nalus of one access unit share the timestamp, aggregate them
+        if (ap_cnt == N_AP_NALU_MAX || ap_len + 2 + (int)nalu_size > MTU) {
+            r = rtp_h265_flush_ap(sock, pkt, ap_nalus, ap_sizes, &ap_cnt);
+            ap_len = RTP_FIXED_HEADER + N_NAL_HEADER;
+            if (r != 0)
+                break;
+        }
+        if (ap_len + 2 + (int)nalu_size <= MTU) {
+            ap_nalus[ap_cnt] = p1;
+            ap_sizes[ap_cnt++] = nalu_size;
+            ap_len += 2 + nalu_size;
+        } else if (nalu_size + RTP_FIXED_HEADER <= MTU) {
+            r = rtp_h265_pack_nalu(sock, pkt, p1, nalu_size);
+        } else {
+            r = rtp_h265_pack_fu(sock, pkt, p1, nalu_size);
+        }
+    }
+    if (r == 0) {
+        r = rtp_h265_flush_ap(sock, pkt, ap_nalus, ap_sizes, &ap_cnt);
+    }
+    return r;
+}
@@ -0,0 +1,175 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#include "rtp_pacer.h"
+#include <liblog.h>
+#include <libsock.h>
+#include <libtime.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+/* bucket holds a few packets, so a lone small packet is never delayed */
+#define RTP_PACER_BURST     (4 * RTP_PACER_PKT_MAX)
+
+static uint64_t rtp_pacer_now_us(void)
+{
+    return time_bootup_nsec() / 1000;
+}
+
+static void rtp_pacer_refill(struct rtp_pacer *p)
+{
+    uint64_t now = rtp_pacer_now_us();
+    p->tokens += (int64_t)((now - p->last_us) * p->rate / 1000000);
+    if (p->tokens > RTP_PACER_BURST) {
+        p->tokens = RTP_PACER_BURST;
+    }
+    p->last_us = now;
+}
+
+/* packets due in this tick go out with one sendmmsg */
+static void rtp_pacer_drain(struct rtp_pacer *p, bool all)
+{
+    struct rtp_pacer_slot *s;
+    struct sock_msg msgs[RTP_PACER_MMSG];
+    int n;
+
+    while (p->count > 0 && (all || p->tokens > 0)) {
+        for (n = 0; n < RTP_PACER_MMSG && (uint32_t)n < p->count && (all || p->tokens > 0); n++) {
+            s = &p->slots[(p->head + n) % RTP_PACER_SLOTS];
+            memset(&msgs[n], 0, sizeof(msgs[n]));
+            msgs[n].buf = s->data;
+            msgs[n].len = s->len;
+            msgs[n].ip = s->ip[0] ? inet_addr(s->ip) : 0;
+            msgs[n].port = s->port;
+            p->tokens -= s->len;
+            p->queued_bytes -= s->len;
+        }
+        if (sock_sendmmsg(p->sock->rtp_fd, msgs, n) < n) {
+            logd("paced send of %d packets was short\n", n);
+        }
+        p->head = (p->head + n) % RTP_PACER_SLOTS;
+        p->count -= n;
+    }
+}
+
+static void on_pacer_tick(struct gevent_wtimer *t, void *arg)
+{
+    struct rtp_pacer *p = (struct rtp_pacer *)arg;
+
+    rtp_pacer_refill(p);
+    rtp_pacer_drain(p, false);
+    if (p->count == 0) {
+        gevent_wtimer_del(p->evbase, t);
+    }
+}
+
+struct rtp_pacer *rtp_pacer_create(struct rtp_socket *sock, struct gevent_base *evbase, uint32_t rate)
+{
+    struct rtp_pacer *p;
+    if (!sock || sock->mode != RTP_UDP || !evbase) {
+        return NULL;
+    }
+    p = calloc(1, sizeof(struct rtp_pacer));
+    if (!p) {
+        loge("calloc rtp_pacer failed!\n");
+        return NULL;
+    }
+    p->slots = calloc(RTP_PACER_SLOTS, sizeof(struct rtp_pacer_slot));
+    if (!p->slots) {
+        loge("calloc rtp_pacer slots failed!\n");
+        free(p);
+        return NULL;
+    }
+    p->sock = sock;
+    p->evbase = evbase;
+    p->rate_min = rate;
+    p->rate = rate;
+    p->tokens = RTP_PACER_BURST;
+    p->last_us = rtp_pacer_now_us();
+    gevent_wtimer_init(&p->timer, on_pacer_tick, p);
+    return p;
+}
+
+void rtp_pacer_destroy(struct rtp_pacer *p)
+{
+    if (!p) {
+        return;
+    }
+    gevent_wtimer_del(p->evbase, &p->timer);
+    if (p->count > 0) {
+        logi("pacer drops %u queued packets\n", p->count);
+    }
+    free(p->slots);
+    free(p);
+}
+
+void rtp_pacer_frame(struct rtp_pacer *p, size_t bytes, uint32_t interval_ms)
+{
+    uint64_t rate;
+    if (!p || interval_ms == 0) {
+        return;
+    }
+    rate = (p->queued_bytes + bytes) * 1000 / interval_ms;
+    if (rate < p->rate_min) {
+        rate = p->rate_min;
+    }
+    rtp_pacer_refill(p);
+    p->rate = rate > UINT32_MAX ? UINT32_MAX : (uint32_t)rate;
+}
+
+ssize_t rtp_pacer_sendv(struct rtp_pacer *p, const char *ip, uint16_t port, const struct iovec *iov, int iovcnt)
+{
+    struct rtp_pacer_slot *s;
+    size_t len = 0;
+    int i;
+
+    for (i = 0; i < iovcnt; i++) {
+        len += iov[i].iov_len;
+    }
+    rtp_pacer_refill(p);
+    if (p->rate == 0 || (p->count == 0 && p->tokens > 0)) {
+        p->tokens -= len;
+        return sock_sendtov(p->sock->rtp_fd, ip, port, iov, iovcnt);
+    }
+    if (p->count == RTP_PACER_SLOTS || len > RTP_PACER_PKT_MAX) {
+        /* never drop or reorder, a burst is better than a hole in frame */
+        p->overflows++;
+        rtp_pacer_drain(p, true);
+        p->tokens -= len;
+        return sock_sendtov(p->sock->rtp_fd, ip, port, iov, iovcnt);
+    }
+    s = &p->slots[(p->head + p->count) % RTP_PACER_SLOTS];
+    for (s->len = 0, i = 0; i < iovcnt; i++) {
+        memcpy(s->data + s->len, iov[i].iov_base, iov[i].iov_len);
+        s->len += iov[i].iov_len;
+    }
+    s->port = port;
+    snprintf(s->ip, sizeof(s->ip), "%s", ip ? ip : "");
+    p->count++;
+    p->queued_bytes += len;
+    if (!gevent_wtimer_pending(&p->timer) &&
+        -1 == gevent_wtimer_add(p->evbase, &p->timer, RTP_PACER_TICK_MS, TIMER_PERSIST)) {
+        loge("gevent_wtimer_add failed!\n");
+    }
+    return len;
+}
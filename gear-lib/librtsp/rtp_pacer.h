@@ -0,0 +1,80 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#ifndef RTP_PACER_H
+#define RTP_PACER_H
+
+#include <libgevent.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "rtp.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* packets held by one pacer, about 370KB, enough for a large i-frame */
+#define RTP_PACER_SLOTS     (256)
+#define RTP_PACER_PKT_MAX   (RTP_PACKET_MAX)
+/* queued packets sent per sendmmsg when draining */
+#define RTP_PACER_MMSG      (32)
+/* wheel timer interval the queue is drained with */
+#define RTP_PACER_TICK_MS   (1)
+
+struct rtp_pacer_slot {
+    uint16_t len;
+    uint16_t port;
+    char ip[INET_ADDRSTRLEN];
+    uint8_t data[RTP_PACER_PKT_MAX];
+};
+
+/*
+ * token bucket in front of a udp rtp socket, packets over the budget are
+ * copied into a ring and sent from a wheel timer in the loop of evbase.
+ * rate is the configured one or the one which sends queued bytes and the
+ * next frame within a frame interval, whichever is higher
+ */
+struct rtp_pacer {
+    struct rtp_socket *sock;
+    struct gevent_base *evbase;
+    struct gevent_wtimer timer;
+    uint32_t rate_min;          /* configured, bytes per second, 0 estimate */
+    uint32_t rate;              /* current, bytes per second */
+    int64_t tokens;             /* bytes, may be negative after a burst */
+    uint64_t last_us;
+    uint32_t head;
+    uint32_t count;
+    uint64_t queued_bytes;
+    uint64_t overflows;         /* ring was full, queue flushed at once */
+    struct rtp_pacer_slot *slots;
+};
+
+struct rtp_pacer *rtp_pacer_create(struct rtp_socket *sock, struct gevent_base *evbase, uint32_t rate);
+/* called in loop of evbase, packets still queued are dropped */
+void rtp_pacer_destroy(struct rtp_pacer *p);
+/* called before packets of a frame are sent, spreads them over interval */
+void rtp_pacer_frame(struct rtp_pacer *p, size_t bytes, uint32_t interval_ms);
+ssize_t rtp_pacer_sendv(struct rtp_pacer *p, const char *ip, uint16_t port, const struct iovec *iov, int iovcnt);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
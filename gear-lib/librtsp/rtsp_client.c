@@ -0,0 +1,924 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#include "rtsp_client.h"
+#include "rtsp_parser.h"
+#include "rtp_depack.h"
+#include "uri_parse.h"
+#include <libgevent.h>
+#include <libsock.h>
+#include <libtime.h>
+#include <liblog.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define RTSP_CLIENT_PORT            (554)
+#define RTSP_CLIENT_REQ_MAX         (2048)
+#define RTSP_CLIENT_SDP_MAX         (16 * 1024)
+#define RTSP_CLIENT_TIMEOUT_MS      (10000)     /* each request, and rtp */
+#define RTSP_CLIENT_TICK_MS         (20)        /* jitter buffer poll */
+#define RTSP_CLIENT_BATCH           (32)        /* datagrams per recvmmsg */
+#define RTSP_CLIENT_PKT_SIZE        (2048)
+#define RTSP_CLIENT_RCVBUF          (1024 * 1024)
+#define RTSP_CLIENT_PORT_RETRY      (16)
+
+enum client_stage {
+    STAGE_IDLE = 0,
+    STAGE_CONNECT,
+    STAGE_DESCRIBE,
+    STAGE_SETUP,
+    STAGE_PLAY,
+    STAGE_PLAYING,
+};
+
+struct rtsp_client_group {
+    struct gevent_base_group *loops;
+};
+
+/* released by a post, the dispatch round may still hold the events */
+struct client_io {
+    struct gevent *ev[3];
+    int fd[3];
+};
+
+struct rtsp_client {
+    struct rtsp_client_conf conf;
+    char url[RTSP_CLIENT_URL_MAX];
+    char control[RTSP_CLIENT_URL_MAX];
+    struct sockaddr_in addr;
+    struct gevent_base *eb;
+    enum client_stage stage;
+    bool closing;
+    /* rtsp connection */
+    int connect_fd;
+    struct gevent *ev_connect;
+    bool connect_watched;
+    struct gevent_conn *conn;
+    struct rtsp_message msg;
+    uint32_t cseq;
+    char session[128];
+    int timeout_ms;
+    /* video track */
+    enum video_codec_type codec;
+    uint8_t pt;
+    uint8_t channel;
+    int rtp_fd;
+    int rtcp_fd;
+    uint16_t rtp_port;
+    struct gevent *ev_rtp;
+    struct gevent *ev_rtcp;
+    struct media_buffer_pool *pool;
+    struct rtp_depack *depack;
+    struct rtp_depack_stats depack_stats;   /* of previous sessions */
+    uint64_t last_rtp_ms;
+    struct gevent_wtimer timer;             /* request timeout or keepalive */
+    struct gevent_wtimer tick;
+    struct gevent_wtimer retry;
+    uint64_t recv_calls;
+    uint64_t reconnects;
+    struct rtsp_client_stats stats;         /* snapshot for other threads */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool released;
+};
+
+static void client_fail(struct rtsp_client *c, int err);
+
+static uint64_t client_now_ms()
+{
+    return time_fast_nsec() / 1000000;
+}
+
+static void client_io_free(void *arg)
+{
+    struct client_io *io = (struct client_io *)arg;
+    int i;
+    for (i = 0; i < 3; i++) {
+        if (io->ev[i]) {
+            gevent_destroy(io->ev[i]);
+        }
+        if (io->fd[i] != -1) {
+            close(io->fd[i]);
+        }
+    }
+    free(io);
+}
+
+static void stats_add(struct rtp_depack_stats *dst, const struct rtp_depack_stats *s)
+{
+    dst->packets += s->packets;
+    dst->bytes += s->bytes;
+    dst->lost += s->lost;
+    dst->late += s->late;
+    dst->reordered += s->reordered;
+    dst->frames += s->frames;
+    dst->frames_dropped += s->frames_dropped;
+}
+
+/* depack lives in loop thread, other threads read this snapshot */
+static void client_stats_update(struct rtsp_client *c)
+{
+    struct rtsp_client_stats st;
+    struct rtp_depack_stats s = c->depack_stats;
+
+    if (c->depack) {
+        struct rtp_depack_stats cur;
+        rtp_depack_get_stats(c->depack, &cur);
+        stats_add(&s, &cur);
+    }
+    st.packets = s.packets;
+    st.bytes = s.bytes;
+    st.recv_calls = c->recv_calls;
+    st.lost = s.lost;
+    st.late = s.late;
+    st.reordered = s.reordered;
+    st.frames = s.frames;
+    st.frames_dropped = s.frames_dropped;
+    st.reconnects = c->reconnects;
+    pthread_mutex_lock(&c->lock);
+    c->stats = st;
+    pthread_mutex_unlock(&c->lock);
+}
+
+static void client_depack_release(struct rtsp_client *c)
+{
+    struct rtp_depack_stats s;
+    if (!c->depack) {
+        return;
+    }
+    rtp_depack_get_stats(c->depack, &s);
+    stats_add(&c->depack_stats, &s);
+    rtp_depack_destroy(c->depack);
+    c->depack = NULL;
+    client_stats_update(c);
+}
+
+/* drop connection and sockets of a session, safe in any of their callbacks */
+static void client_reset(struct rtsp_client *c)
+{
+    struct client_io *io;
+
+    gevent_wtimer_del(c->eb, &c->timer);
+    gevent_wtimer_del(c->eb, &c->tick);
+    if (c->conn) {
+        gevent_conn_destroy(c->conn);
+        c->conn = NULL;
+    }
+    if (c->connect_watched) {
+        gevent_del(c->eb, &c->ev_connect);
+        c->connect_watched = false;
+    }
+    if (c->ev_rtp) {
+        gevent_del(c->eb, &c->ev_rtp);
+    }
+    if (c->ev_rtcp) {
+        gevent_del(c->eb, &c->ev_rtcp);
+    }
+    io = calloc(1, sizeof(struct client_io));
+    if (!io) {
+        loge("malloc client_io failed!\n");
+    } else {
+        io->ev[0] = c->ev_connect;
+        io->ev[1] = c->ev_rtp;
+        io->ev[2] = c->ev_rtcp;
+        io->fd[0] = c->connect_fd;
+        io->fd[1] = c->rtp_fd;
+        io->fd[2] = c->rtcp_fd;
+        if (0 != gevent_base_post(c->eb, client_io_free, io)) {
+            client_io_free(io);
+        }
+    }
+    c->ev_connect = c->ev_rtp = c->ev_rtcp = NULL;
+    c->connect_fd = c->rtp_fd = c->rtcp_fd = -1;
+    client_depack_release(c);
+    memset(&c->msg, 0, sizeof(c->msg));
+    c->session[0] = '\0';
+    c->control[0] = '\0';
+    c->stage = STAGE_IDLE;
+}
+
+static int client_request(struct rtsp_client *c, const char *method,
+                const char *url, const char *headers)
+{
+    char buf[RTSP_CLIENT_REQ_MAX];
+    int n;
+
+    n = snprintf(buf, sizeof(buf),
+                 "%s %s RTSP/1.0\r\n"
+                 "CSeq: %u\r\n"
+                 "User-Agent: gear-lib/librtsp\r\n"
+                 "%s%s%s"
+                 "%s\r\n",
+                 method, url, ++c->cseq,
+                 c->session[0] ? "Session: " : "",
+                 c->session,
+                 c->session[0] ? "\r\n" : "",
+                 headers ? headers : "");
+    if (n < 0 || n >= (int)sizeof(buf)) {
+        loge("rtsp request too long!\n");
+        return -1;
+    }
+    logd("rtsp request:\n==== C >>>> S ====\n%s==== C >>>> S ====\n", buf);
+    return gevent_conn_write(c->conn, buf, n);
+}
+
+static void client_on_packet(struct video_packet *pkt, void *arg)
+{
+    struct rtsp_client *c = (struct rtsp_client *)arg;
+    struct media_packet mp;
+
+    memset(&mp, 0, sizeof(mp));
+    mp.type = MEDIA_TYPE_VIDEO;
+    mp.video = pkt;
+    c->conf.on_packet(c, &mp, c->conf.arg);
+}
+
+static void client_on_rtp(int fd, void *arg)
+{
+    struct rtsp_client *c = (struct rtsp_client *)arg;
+    struct media_buffer *bufs[RTSP_CLIENT_BATCH] = {NULL};
+    struct sock_msg msgs[RTSP_CLIENT_BATCH];
+    uint64_t now;
+    int i, n, cnt;
+
+    /* edge triggered, read batches until EAGAIN */
+    while (c->depack) {
+        for (cnt = 0; cnt < RTSP_CLIENT_BATCH; cnt++) {
+            if (!bufs[cnt]) {
+                bufs[cnt] = media_buffer_pool_get(c->pool);
+                if (!bufs[cnt]) {
+                    break;
+                }
+            }
+            msgs[cnt].buf = bufs[cnt]->data;
+            msgs[cnt].len = bufs[cnt]->size;
+        }
+        if (cnt == 0) {
+            break;
+        }
+        n = sock_recvmmsg(fd, msgs, cnt, 1);
+        if (n <= 0) {
+            break;
+        }
+        c->recv_calls++;
+        now = client_now_ms();
+        c->last_rtp_ms = now;
+        for (i = 0; i < n; i++) {
+            if (!msgs[i].truncated) {
+                /* held packets take their own reference */
+                rtp_depack_input(c->depack, bufs[i], bufs[i]->data, msgs[i].len, now);
+            }
+            media_buffer_unref(bufs[i]);
+            bufs[i] = NULL;
+        }
+        if (n < cnt) {
+            break;
+        }
+    }
+    for (i = 0; i < RTSP_CLIENT_BATCH; i++) {
+        media_buffer_unref(bufs[i]);
+    }
+}
+
+static void client_on_rtcp(int fd, void *arg)
+{
+    uint8_t buf[RTSP_CLIENT_PKT_SIZE];
+    /* sender reports are not used, drain them */
+    gevent_read_drain(fd, buf, sizeof(buf), NULL, NULL, NULL);
+}
+
+static int client_udp_socket(uint16_t port)
+{
+    struct sockaddr_in si;
+    int fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (fd == -1) {
+        return -1;
+    }
+    memset(&si, 0, sizeof(si));
+    si.sin_family = AF_INET;
+    si.sin_addr.s_addr = INADDR_ANY;
+    si.sin_port = htons(port);
+    /* no SO_REUSEADDR, the pair must not be shared with anyone */
+    if (-1 == bind(fd, (struct sockaddr *)&si, sizeof(si))) {
+        close(fd);
+        return -1;
+    }
+    sock_set_noblk(fd, 1);
+    return fd;
+}
+
+/* rtp on an even port and rtcp on the next one */
+static int client_udp_open(struct rtsp_client *c)
+{
+    struct sock_addr addr;
+    int i, rtp, rtcp;
+
+    for (i = 0; i < RTSP_CLIENT_PORT_RETRY; i++) {
+        rtp = client_udp_socket(0);
+        if (rtp == -1) {
+            break;
+        }
+        if (-1 == sock_getaddr_by_fd(rtp, &addr) || (addr.port & 1)) {
+            close(rtp);
+            continue;
+        }
+        rtcp = client_udp_socket(addr.port + 1);
+        if (rtcp == -1) {
+            close(rtp);
+            continue;
+        }
+        sock_set_buflen(rtp, RTSP_CLIENT_RCVBUF);
+        c->rtp_fd = rtp;
+        c->rtcp_fd = rtcp;
+        c->rtp_port = addr.port;
+        c->ev_rtp = gevent_create(rtp, client_on_rtp, NULL, NULL, c);
+        c->ev_rtcp = gevent_create(rtcp, client_on_rtcp, NULL, NULL, c);
+        if (!c->ev_rtp || !c->ev_rtcp ||
+            0 != gevent_add(c->eb, &c->ev_rtp) ||
+            0 != gevent_add(c->eb, &c->ev_rtcp)) {
+            loge("gevent_add rtp failed!\n");
+            return -1;
+        }
+        return 0;
+    }
+    loge("no udp port pair for rtp!\n");
+    return -1;
+}
+
+static void client_resolve_control(struct rtsp_client *c, const struct strref *base,
+                const char *control)
+{
+    int n;
+    if (strncasecmp(control, "rtsp://", 7) == 0) {
+        snprintf(c->control, sizeof(c->control), "%s", control);
+        return;
+    }
+    n = snprintf(c->control, sizeof(c->control), "%.*s", (int)base->len, base->array);
+    if (control[0] == '\0' || strcmp(control, "*") == 0) {
+        return;
+    }
+    if (n > 0 && n < (int)sizeof(c->control) && c->control[n - 1] != '/') {
+        snprintf(c->control + n, sizeof(c->control) - n, "/%s", control);
+    } else if (n > 0 && n < (int)sizeof(c->control)) {
+        snprintf(c->control + n, sizeof(c->control) - n, "%s", control);
+    }
+}
+
+/* first video section with H.264 or H.265 rtpmap */
+static int client_parse_sdp(struct rtsp_client *c, const struct strref *body,
+                char *control, size_t size)
+{
+    char sdp[RTSP_CLIENT_SDP_MAX];
+    char session_control[RTSP_CLIENT_URL_MAX] = "";
+    char media_control[RTSP_CLIENT_URL_MAX] = "";
+    char name[32];
+    char *line, *save = NULL;
+    bool in_video = false, in_media = false;
+    int pt = -1, map_pt;
+    enum video_codec_type codec = VIDEO_CODEC_NONE;
+
+    if (body->len >= sizeof(sdp)) {
+        loge("sdp is too long!\n");
+        return -1;
+    }
+    memcpy(sdp, body->array, body->len);
+    sdp[body->len] = '\0';
+    for (line = strtok_r(sdp, "\r\n", &save); line; line = strtok_r(NULL, "\r\n", &save)) {
+        if (strncmp(line, "m=", 2) == 0) {
+            if (in_video && codec != VIDEO_CODEC_NONE) {
+                break;
+            }
+            in_media = true;
+            in_video = (strncmp(line, "m=video ", 8) == 0 &&
+                        1 == sscanf(line, "m=video %*d %*s %d", &pt));
+            codec = VIDEO_CODEC_NONE;
+            media_control[0] = '\0';
+        } else if (strncmp(line, "a=control:", 10) == 0) {
+            snprintf(in_media ? media_control : session_control,
+                     RTSP_CLIENT_URL_MAX, "%s", line + 10);
+        } else if (in_video && 2 == sscanf(line, "a=rtpmap:%d %31[^/]", &map_pt, name) &&
+                   map_pt == pt) {
+            if (strcasecmp(name, "H264") == 0) {
+                codec = VIDEO_CODEC_H264;
+            } else if (strcasecmp(name, "H265") == 0) {
+                codec = VIDEO_CODEC_H265;
+            }
+        }
+    }
+    if (!in_video || codec == VIDEO_CODEC_NONE) {
+        loge("no H.264 or H.265 video in sdp!\n");
+        return -1;
+    }
+    c->codec = codec;
+    c->pt = (uint8_t)pt;
+    snprintf(control, size, "%s", media_control[0] ? media_control : session_control);
+    return 0;
+}
+
+static int client_on_describe(struct rtsp_client *c)
+{
+    struct rtp_depack_conf conf;
+    const struct strref *base;
+    struct strref url;
+    char control[RTSP_CLIENT_URL_MAX];
+    char transport[128];
+
+    if (0 != client_parse_sdp(c, &c->msg.body, control, sizeof(control))) {
+        return -1;
+    }
+    base = rtsp_message_header(&c->msg, "Content-Base");
+    if (!base) {
+        base = rtsp_message_header(&c->msg, "Content-Location");
+    }
+    if (!base) {
+        strref_set(&url, c->url, strlen(c->url));
+        base = &url;
+    }
+    client_resolve_control(c, base, control);
+
+    memset(&conf, 0, sizeof(conf));
+    conf.codec = c->codec;
+    conf.payload_type = c->pt;
+    conf.latency_ms = c->conf.latency_ms;
+    conf.frame_max = c->conf.frame_max;
+    conf.cb = client_on_packet;
+    conf.arg = c;
+    c->depack = rtp_depack_create(&conf);
+    if (!c->depack) {
+        return -1;
+    }
+    if (c->conf.transport == RTSP_CLIENT_TCP) {
+        c->channel = 0;
+        snprintf(transport, sizeof(transport),
+                 "Transport: RTP/AVP/TCP;unicast;interleaved=0-1\r\n");
+    } else {
+        if (0 != client_udp_open(c)) {
+            return -1;
+        }
+        snprintf(transport, sizeof(transport),
+                 "Transport: RTP/AVP;unicast;client_port=%hu-%hu\r\n",
+                 c->rtp_port, (uint16_t)(c->rtp_port + 1));
+    }
+    c->stage = STAGE_SETUP;
+    return client_request(c, "SETUP", c->control, transport);
+}
+
+static int client_on_setup(struct rtsp_client *c)
+{
+    const struct strref *h;
+    const char *semi, *p;
+    char val[256];
+    unsigned int ch1, ch2;
+
+    h = rtsp_message_header(&c->msg, "Session");
+    if (!h) {
+        loge("no Session in SETUP response!\n");
+        return -1;
+    }
+    semi = memchr(h->array, ';', h->len);
+    snprintf(c->session, sizeof(c->session), "%.*s",
+             (int)(semi ? semi - h->array : h->len), h->array);
+    c->timeout_ms = 60000;
+    if (semi && (size_t)(h->array + h->len - semi) < sizeof(val)) {
+        snprintf(val, sizeof(val), "%.*s", (int)(h->array + h->len - semi), semi);
+        p = strstr(val, "timeout=");
+        if (p && atoi(p + 8) > 0) {
+            c->timeout_ms = atoi(p + 8) * 1000;
+        }
+    }
+    h = rtsp_message_header(&c->msg, "Transport");
+    if (h && c->conf.transport == RTSP_CLIENT_TCP && h->len < sizeof(val)) {
+        snprintf(val, sizeof(val), "%.*s", (int)h->len, h->array);
+        p = strstr(val, "interleaved=");
+        if (p && 2 == sscanf(p, "interleaved=%u-%u", &ch1, &ch2)) {
+            c->channel = (uint8_t)ch1;
+        }
+    }
+    c->stage = STAGE_PLAY;
+    return client_request(c, "PLAY", c->url, "Range: npt=0.000-\r\n");
+}
+
+static int client_on_play(struct rtsp_client *c)
+{
+    c->stage = STAGE_PLAYING;
+    c->last_rtp_ms = client_now_ms();
+    /* keepalive at half of session timeout */
+    gevent_wtimer_add(c->eb, &c->timer, c->timeout_ms / 2, TIMER_PERSIST);
+    gevent_wtimer_add(c->eb, &c->tick, RTSP_CLIENT_TICK_MS, TIMER_PERSIST);
+    if (c->conf.on_state) {
+        c->conf.on_state(c, RTSP_CLIENT_PLAYING, 0, c->conf.arg);
+    }
+    return 0;
+}
+
+static int client_on_response(struct rtsp_client *c)
+{
+    struct rtsp_message *m = &c->msg;
+    int status;
+
+    if (m->method.len < 5 || strncmp(m->method.array, "RTSP/", 5) != 0) {
+        return 0;                   /* request from server, not answered */
+    }
+    logd("rtsp response:\n==== S >>>> C ====\n%.*s==== S >>>> C ====\n",
+         (int)m->raw.len, m->raw.array);
+    status = atoi(m->uri.array);
+    if (c->stage == STAGE_PLAYING) {
+        return 0;                   /* keepalive */
+    }
+    if (status != 200) {
+        loge("rtsp %s: %d %.*s\n", c->url, status, (int)m->version.len, m->version.array);
+        return -1;
+    }
+    /* request timeout restarts for next one */
+    gevent_wtimer_add(c->eb, &c->timer, RTSP_CLIENT_TIMEOUT_MS, TIMER_ONESHOT);
+    switch (c->stage) {
+    case STAGE_DESCRIBE:
+        return client_on_describe(c);
+    case STAGE_SETUP:
+        return client_on_setup(c);
+    case STAGE_PLAY:
+        return client_on_play(c);
+    default:
+        break;
+    }
+    return 0;
+}
+
+static void client_on_read(struct gevent_conn *conn, void *arg)
+{
+    struct rtsp_client *c = (struct rtsp_client *)arg;
+    struct strref payload;
+    const char *p;
+    size_t len;
+    uint8_t channel;
+    int n;
+
+    while (c->conn == conn) {
+        p = gevent_conn_peek(conn, &len);
+        if (!p || len == 0) {
+            break;
+        }
+        if (p[0] == '$') {
+            n = rtsp_interleaved_parse(p, len, &channel, &payload);
+            if (n == 0) {
+                break;
+            }
+            if (channel == c->channel && c->depack) {
+                /* depacketized in place, copied only if held for reordering */
+                c->recv_calls++;
+                c->last_rtp_ms = client_now_ms();
+                rtp_depack_input(c->depack, NULL, (const uint8_t *)payload.array,
+                                 payload.len, c->last_rtp_ms);
+            }
+            gevent_conn_consume(conn, n);
+            continue;
+        }
+        n = rtsp_message_parse(&c->msg, p, len);
+        if (n == 0) {
+            break;
+        }
+        if (n < 0 || 0 != client_on_response(c)) {
+            client_fail(c, EPROTO);
+            return;
+        }
+        memset(&c->msg, 0, sizeof(c->msg));
+        gevent_conn_consume(conn, n);
+    }
+}
+
+static void client_on_close(struct gevent_conn *conn, int err, void *arg)
+{
+    struct rtsp_client *c = (struct rtsp_client *)arg;
+    client_fail(c, err ? err : ECONNRESET);
+}
+
+static void client_connected(struct rtsp_client *c)
+{
+    struct gevent_conn_cbs cbs = {
+        .on_read = client_on_read,
+        .on_drain = NULL,
+        .on_close = client_on_close,
+    };
+    int fd = c->connect_fd;
+
+    c->connect_fd = -1;             /* owned by conn from now on */
+    c->conn = gevent_conn_create(c->eb, fd, &cbs, c);
+    if (!c->conn) {
+        close(fd);
+        client_fail(c, ENOMEM);
+        return;
+    }
+    sock_set_tcp_nodelay(fd, 1);
+    c->stage = STAGE_DESCRIBE;
+    if (0 != client_request(c, "DESCRIBE", c->url, "Accept: application/sdp\r\n")) {
+        client_fail(c, EIO);
+    }
+}
+
+static void client_on_connect(int fd, void *arg)
+{
+    struct rtsp_client *c = (struct rtsp_client *)arg;
+    socklen_t len = sizeof(int);
+    int err = 0;
+
+    if (c->stage != STAGE_CONNECT) {
+        return;
+    }
+    if (-1 == getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len)) {
+        err = errno;
+    }
+    /* the event is freed with the session, it may be in this dispatch */
+    gevent_del(c->eb, &c->ev_connect);
+    c->connect_watched = false;
+    if (err) {
+        client_fail(c, err);
+        return;
+    }
+    client_connected(c);
+}
+
+static void client_on_connect_err(int fd, void *arg)
+{
+    struct rtsp_client *c = (struct rtsp_client *)arg;
+    if (c->stage == STAGE_CONNECT) {
+        client_fail(c, ECONNREFUSED);
+    }
+}
+
+static void client_start(void *arg)
+{
+    struct rtsp_client *c = (struct rtsp_client *)arg;
+    int fd;
+
+    if (c->closing || c->stage != STAGE_IDLE) {
+        return;
+    }
+    c->stage = STAGE_CONNECT;
+    c->cseq = 0;
+    if (c->conf.on_state) {
+        c->conf.on_state(c, RTSP_CLIENT_CONNECTING, 0, c->conf.arg);
+    }
+    fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (fd == -1) {
+        client_fail(c, errno);
+        return;
+    }
+    sock_set_noblk(fd, 1);
+    c->connect_fd = fd;
+    gevent_wtimer_add(c->eb, &c->timer, RTSP_CLIENT_TIMEOUT_MS, TIMER_ONESHOT);
+    if (0 == connect(fd, (struct sockaddr *)&c->addr, sizeof(c->addr))) {
+        client_connected(c);
+        return;
+    }
+    if (errno != EINPROGRESS) {
+        client_fail(c, errno);
+        return;
+    }
+    c->ev_connect = gevent_create(fd, NULL, client_on_connect, client_on_connect_err, c);
+    if (!c->ev_connect || 0 != gevent_add(c->eb, &c->ev_connect)) {
+        client_fail(c, ENOMEM);
+        return;
+    }
+    c->connect_watched = true;
+}
+
+static void client_on_retry(struct gevent_wtimer *t, void *arg)
+{
+    struct rtsp_client *c = (struct rtsp_client *)arg;
+    c->reconnects++;
+    client_stats_update(c);
+    client_start(c);
+}
+
+static void client_fail(struct rtsp_client *c, int err)
+{
+    if (c->stage == STAGE_IDLE) {
+        return;
+    }
+    loge("rtsp client %s closed: %s\n", c->url, strerror(err));
+    client_reset(c);
+    if (c->conf.on_state) {
+        c->conf.on_state(c, RTSP_CLIENT_CLOSED, err, c->conf.arg);
+    }
+    if (c->conf.reconnect_ms && !c->closing) {
+        gevent_wtimer_add(c->eb, &c->retry, c->conf.reconnect_ms, TIMER_ONESHOT);
+    }
+}
+
+static void client_on_timer(struct gevent_wtimer *t, void *arg)
+{
+    struct rtsp_client *c = (struct rtsp_client *)arg;
+    if (c->stage == STAGE_PLAYING) {
+        if (0 != client_request(c, "OPTIONS", c->url, NULL)) {
+            client_fail(c, EIO);
+        }
+        return;
+    }
+    client_fail(c, ETIMEDOUT);
+}
+
+static void client_on_tick(struct gevent_wtimer *t, void *arg)
+{
+    struct rtsp_client *c = (struct rtsp_client *)arg;
+    uint64_t now = client_now_ms();
+
+    if (now - c->last_rtp_ms > RTSP_CLIENT_TIMEOUT_MS) {
+        client_fail(c, ETIMEDOUT);
+        return;
+    }
+    rtp_depack_poll(c->depack, now);
+    client_stats_update(c);
+}
+
+static void client_released(void *arg)
+{
+    struct rtsp_client *c = (struct rtsp_client *)arg;
+    pthread_mutex_lock(&c->lock);
+    c->released = true;
+    pthread_cond_signal(&c->cond);
+    pthread_mutex_unlock(&c->lock);
+}
+
+static void client_stop(void *arg)
+{
+    struct rtsp_client *c = (struct rtsp_client *)arg;
+
+    c->closing = true;
+    gevent_wtimer_del(c->eb, &c->retry);
+    if (c->stage == STAGE_PLAYING) {
+        client_request(c, "TEARDOWN", c->url, NULL);
+    }
+    client_reset(c);
+    /* after the io release posted by reset */
+    if (0 != gevent_base_post(c->eb, client_released, c)) {
+        client_released(c);
+    }
+}
+
+static int client_parse_url(struct rtsp_client *c)
+{
+    struct uri_t *uri;
+    struct sock_addr_list *list = NULL, *next;
+    char port[8];
+    size_t len = strlen(c->url);
+    int ret = -1;
+
+    uri = calloc(1, sizeof(struct uri_t) + len + 8);
+    if (!uri) {
+        return -1;
+    }
+    if (0 != uri_parse(uri, c->url, len) || !uri->scheme || !uri->host ||
+        strcasecmp(uri->scheme, "rtsp") != 0) {
+        loge("invalid rtsp url %s\n", c->url);
+        goto out;
+    }
+    if (uri->userinfo) {
+        logw("authentication is not supported, %s\n", c->url);
+    }
+    snprintf(port, sizeof(port), "%d", uri->port > 0 ? uri->port : RTSP_CLIENT_PORT);
+    /* resolved in the caller, it may block */
+    if (0 != sock_getaddrinfo(&list, uri->host, port) || !list) {
+        loge("resolve %s failed!\n", uri->host);
+        goto out;
+    }
+    memset(&c->addr, 0, sizeof(c->addr));
+    c->addr.sin_family = AF_INET;
+    c->addr.sin_addr.s_addr = list->addr.ip;
+    c->addr.sin_port = htons(uri->port > 0 ? uri->port : RTSP_CLIENT_PORT);
+    ret = 0;
+out:
+    for (; list; list = next) {
+        next = list->next;
+        free(list);
+    }
+    free(uri);
+    return ret;
+}
+
+struct rtsp_client *rtsp_client_open(struct rtsp_client_group *g,
+                const struct rtsp_client_conf *conf)
+{
+    struct rtsp_client *c;
+
+    if (!g || !conf || !conf->url || !conf->on_packet ||
+        strlen(conf->url) >= RTSP_CLIENT_URL_MAX) {
+        loge("invalid paraments!\n");
+        return NULL;
+    }
+    c = calloc(1, sizeof(struct rtsp_client));
+    if (!c) {
+        loge("malloc rtsp_client failed!\n");
+        return NULL;
+    }
+    memcpy(&c->conf, conf, sizeof(*conf));
+    snprintf(c->url, sizeof(c->url), "%s", conf->url);
+    c->conf.url = c->url;
+    c->connect_fd = c->rtp_fd = c->rtcp_fd = -1;
+    if (0 != client_parse_url(c)) {
+        free(c);
+        return NULL;
+    }
+    c->pool = media_buffer_pool_create(RTSP_CLIENT_PKT_SIZE, RTSP_CLIENT_BATCH);
+    if (!c->pool) {
+        free(c);
+        return NULL;
+    }
+    pthread_mutex_init(&c->lock, NULL);
+    pthread_cond_init(&c->cond, NULL);
+    gevent_wtimer_init(&c->timer, client_on_timer, c);
+    gevent_wtimer_init(&c->tick, client_on_tick, c);
+    gevent_wtimer_init(&c->retry, client_on_retry, c);
+    c->eb = gevent_base_group_pick(g->loops, -1);
+    if (!c->eb || 0 != gevent_base_post(c->eb, client_start, c)) {
+        loge("gevent_base_post failed!\n");
+        media_buffer_pool_destroy(c->pool);
+        free(c);
+        return NULL;
+    }
+    return c;
+}
+
+void rtsp_client_close(struct rtsp_client *c)
+{
+    if (!c) {
+        return;
+    }
+    if (0 == gevent_base_post(c->eb, client_stop, c)) {
+        pthread_mutex_lock(&c->lock);
+        while (!c->released) {
+            pthread_cond_wait(&c->cond, &c->lock);
+        }
+        pthread_mutex_unlock(&c->lock);
+    }
+    pthread_mutex_destroy(&c->lock);
+    pthread_cond_destroy(&c->cond);
+    media_buffer_pool_destroy(c->pool);
+    free(c);
+}
+
+int rtsp_client_get_stats(struct rtsp_client *c, struct rtsp_client_stats *stats)
+{
+    if (!c || !stats) {
+        return -1;
+    }
+    pthread_mutex_lock(&c->lock);
+    *stats = c->stats;
+    pthread_mutex_unlock(&c->lock);
+    return 0;
+}
+
+struct rtsp_client_group *rtsp_client_group_create(int nloop)
+{
+    struct rtsp_client_group *g = calloc(1, sizeof(struct rtsp_client_group));
+    if (!g) {
+        loge("malloc rtsp_client_group failed!\n");
+        return NULL;
+    }
+    time_clock_init();
+    g->loops = gevent_base_group_create(nloop, GEVENT_GROUP_ROUND_ROBIN);
+    if (!g->loops) {
+        free(g);
+        return NULL;
+    }
+    if (0 != gevent_base_group_loop_start(g->loops, false)) {
+        gevent_base_group_destroy(g->loops);
+        free(g);
+        return NULL;
+    }
+    return g;
+}
+
+void rtsp_client_group_destroy(struct rtsp_client_group *g)
+{
+    if (!g) {
+        return;
+    }
+    gevent_base_group_loop_stop(g->loops);
+    gevent_base_group_destroy(g->loops);
+    free(g);
+}
@@ -0,0 +1,95 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#ifndef RTSP_CLIENT_H
+#define RTSP_CLIENT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <libmedia-io.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * rtsp client pulling the first H.264 or H.265 video track of a url.
+ * clients share the loops of a group, one loop thread serves hundreds of
+ * clients, all callbacks of a client are called in its loop thread.
+ * udp rtp is read by recvmmsg in batches into pooled buffers, interleaved
+ * rtp is depacketized from the connection buffer, frames are reordered
+ * by a jitter buffer of latency_ms and delivered in annex-b
+ */
+#define RTSP_CLIENT_URL_MAX     (256)
+
+enum rtsp_client_transport {
+    RTSP_CLIENT_UDP = 0,
+    RTSP_CLIENT_TCP,                /* interleaved in the rtsp connection */
+};
+
+enum rtsp_client_state {
+    RTSP_CLIENT_CONNECTING = 0,
+    RTSP_CLIENT_PLAYING,
+    RTSP_CLIENT_CLOSED,             /* err tells why, reconnect follows if set */
+};
+
+struct rtsp_client;
+struct rtsp_client_group;
+
+struct rtsp_client_conf {
+    const char *url;                /* rtsp://host[:port]/path */
+    enum rtsp_client_transport transport;
+    uint32_t latency_ms;            /* jitter buffer, 0 takes default */
+    size_t frame_max;               /* largest frame, 0 takes default */
+    uint32_t reconnect_ms;          /* 0 stays closed after failure */
+    /* pkt is valid during the call, media_packet_copy keeps it, no copy */
+    void (*on_packet)(struct rtsp_client *c, struct media_packet *pkt, void *arg);
+    void (*on_state)(struct rtsp_client *c, enum rtsp_client_state state, int err, void *arg);
+    void *arg;
+};
+
+struct rtsp_client_stats {
+    uint64_t packets;
+    uint64_t bytes;
+    uint64_t recv_calls;            /* recvmmsg batches or interleaved packets */
+    uint64_t lost;
+    uint64_t late;
+    uint64_t reordered;
+    uint64_t frames;
+    uint64_t frames_dropped;
+    uint64_t reconnects;
+};
+
+/* nloop <= 0 means one loop per cpu core */
+struct rtsp_client_group *rtsp_client_group_create(int nloop);
+void rtsp_client_group_destroy(struct rtsp_client_group *g);
+
+struct rtsp_client *rtsp_client_open(struct rtsp_client_group *g,
+                const struct rtsp_client_conf *conf);
+/* teardown and wait for the loop to release it, not from its callbacks */
+void rtsp_client_close(struct rtsp_client *c);
+/* snapshot refreshed by the loop every few tens of ms */
+int rtsp_client_get_stats(struct rtsp_client *c, struct rtsp_client_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -30,6 +30,9 @@
 #include <time.h>
 #include <assert.h>
 
+/* content-length is bounded before it is added to offsets */
+#define RTSP_BODY_MAX           (64 * 1024)
+
 static void url_decode(char* url)
 {
     // Replace (in place) any %<hex><hex> sequences with the appropriate 8-bit character.
@@ -53,182 +56,269 @@ static void url_decode(char* url)
     *url = '\0';
 }
 
-int parse_rtsp_request(struct rtsp_request *req)
+static bool strref_equal_nocase(const struct strref *s, const char *str)
 {
-    char *str = (char *)req->raw->iov_base;
-    int len = req->raw->iov_len;
-    int cmd_len = sizeof(req->cmd);
-    int url_prefix_len = sizeof(req->url_prefix);
-    int url_suffix_len = sizeof(req->url_suffix);
-    int cseq_len = sizeof(req->cseq);
-    int session_id_len = sizeof(req->session.id);
-    int cur;
-    char c;
-    char *p;
-    const char *rtsp_prefix = "rtsp://";
-    int rtsp_prefix_len = sizeof(rtsp_prefix);
-    int parse_succeed = 0;
-    int i, j, k, k1, k2, n;
-    int num, org = 0;
-
-    logi("rtsp request[%d]:\n==== C >>>> S ====\n%s==== C >>>> S ====\n", len, str);
-
-    // "Be liberal in what you accept": Skip over any whitespace at the start of the request:
-    for (cur = 0; cur < len; ++cur) {
-        c = str[cur];
-        if (!(c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\0')) {
-            break;
+    size_t n = strlen(str);
+    return s->len == n && strncasecmp(s->array, str, n) == 0;
+}
+
+/* bounded copy for fields handlers use as c strings */
+static int strref_to_str(char *dst, size_t size, const struct strref *s)
+{
+    if (s->len >= size) {
+        return -1;
+    }
+    memcpy(dst, s->array, s->len);
+    dst[s->len] = '\0';
+    return 0;
+}
+
+static const char *rtsp_line_end(const char *p, const char *end)
+{
+    const char *eol = memchr(p, '\n', end - p);
+    return eol ? eol : end;
+}
+
+static struct strref rtsp_trim(const char *p, const char *end)
+{
+    struct strref s;
+    while (p < end && (*p == ' ' || *p == '\t')) {
+        ++p;
+    }
+    while (end > p && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r')) {
+        --end;
+    }
+    strref_set(&s, p, end - p);
+    return s;
+}
+
+static int rtsp_content_length(const struct rtsp_message *m, size_t *clen)
+{
+    const struct strref *h = rtsp_message_header(m, "Content-Length");
+    size_t i, n = 0;
+
+    *clen = 0;
+    if (!h) {
+        return 0;
+    }
+    for (i = 0; i < h->len; i++) {
+        if (!isdigit((unsigned char)h->array[i]) || n > RTSP_BODY_MAX) {
+            return -1;
         }
+        n = n * 10 + (h->array[i] - '0');
     }
-    if (cur == len) {
-        loge("request consisted of nothing but whitespace!\n");
+    if (n > RTSP_BODY_MAX) {
         return -1;
     }
+    *clen = n;
+    return 0;
+}
 
-    // Then read everything up to the next space (or tab) as the command name:
+int rtsp_message_parse(struct rtsp_message *m, const char *buf, size_t len)
+{
+    const char *start = buf, *end, *p, *eol, *sp;
+    size_t i, hdr, clen;
+    struct rtsp_header *h;
+    struct strref fold;
 
-    for (i = 0; i < cmd_len - 1 && i < len; ++cur, ++i) {
-        c = str[cur];
-        if (c == ' ' || c == '\t') {
-            parse_succeed = 1;
+    /* be liberal, skip line breaks left between pipelined requests */
+    while (start < buf + len && (*start == '\r' || *start == '\n')) {
+        ++start;
+    }
+    if (start == buf + len) {
+        m->scanned = 0;
+        return 0;
+    }
+    /* end of headers is an empty line, only new bytes are searched */
+    hdr = 0;
+    for (i = m->scanned > (size_t)(start - buf) ? m->scanned : (size_t)(start - buf); i < len; i++) {
+        if (buf[i] != '\n') {
+            continue;
+        }
+        if (i + 1 < len && buf[i + 1] == '\n') {
+            hdr = i + 2;
+            break;
+        }
+        if (i + 2 < len && buf[i + 1] == '\r' && buf[i + 2] == '\n') {
+            hdr = i + 3;
+            break;
+        }
+        if (i + 2 >= len) {
             break;
         }
-        req->cmd[i] = c;
     }
-    req->cmd[i] = '\0';
-    if (!parse_succeed) {
-        loge("can't find request command name\n");
-        return -1;
+    if (hdr == 0) {
+        m->scanned = i;
+        return 0;
     }
+    m->scanned = i;
 
-    // Skip over the prefix of any "rtsp://" or "rtsp:/" URL that follows:
-    j = cur+1;
-    while (j < len && (str[j] == ' ' || str[j] == '\t')) {
-        ++j; // skip over any additional white space
-    }
-    for (; j < (len - rtsp_prefix_len); ++j) {
-        if ((str[j] == 'r' || str[j] == 'R') &&
-            (str[j+1] == 't' || str[j+1] == 'T') &&
-            (str[j+2] == 's' || str[j+2] == 'S') &&
-            (str[j+3] == 'p' || str[j+3] == 'P') &&
-             str[j+4] == ':' && str[j+5] == '/') {
-            j += 6;
-            if (str[j] == '/') {
-                // This is a "rtsp://" URL; skip over the host:port part that follows:
-                ++j;
-                while (j < len && str[j] != '/' && str[j] != ' ') ++j;
-            } else {
-                // This is a "rtsp:/" URL; back up to the "/":
-                --j;
-            }
-            cur = j;
-            break;
+    end = buf + hdr;
+    eol = rtsp_line_end(start, end);
+    p = start;
+    sp = memchr(p, ' ', eol - p);
+    if (!sp) {
+        return -1;
+    }
+    strref_set(&m->method, p, sp - p);
+    p = sp + 1;
+    while (p < eol && *p == ' ') {
+        ++p;
+    }
+    if (m->method.len >= 5 && strncmp(m->method.array, "RTSP/", 5) == 0) {
+        /* status line, reason phrase may be empty */
+        sp = memchr(p, ' ', eol - p);
+        m->uri = rtsp_trim(p, sp ? sp : eol);
+        m->version = sp ? rtsp_trim(sp + 1, eol) : rtsp_trim(eol, eol);
+        if (m->uri.len != 3) {
+            return -1;
+        }
+    } else {
+        sp = memchr(p, ' ', eol - p);
+        if (!sp) {
+            return -1;
+        }
+        strref_set(&m->uri, p, sp - p);
+        m->version = rtsp_trim(sp + 1, eol);
+        if (m->method.len == 0 || m->uri.len == 0 || m->version.len < 5 ||
+            strncmp(m->version.array, "RTSP/", 5) != 0) {
+            return -1;
         }
     }
 
-    // Look for the URL suffix (before the following "RTSP/"):
-    parse_succeed = 0;
-    for (k = cur+1; k < (len-5); ++k) {
-        if (str[k] == 'R' && str[k+1] == 'T' &&
-            str[k+2] == 'S' && str[k+3] == 'P' && str[k+4] == '/') {
-            while (--k >= cur && str[k] == ' ') {} // go back over all spaces before "RTSP/"
-            k1 = k;
-            while (k1 > cur && str[k1] != '/') --k1;
-            // ASSERT: At this point
-            //   cur: first space or slash after "host" or "host:port"
-            //   k: last non-space before "RTSP/"
-            //   k1: last slash in the range [cur,k]
-            // The URL suffix comes from [k1+1,k]
-            // Copy "url_suffix":
-            n = 0;
-            k2 = k1+1;
-            if (k2 <= k) {
-                if (k - k1 + 1 > url_suffix_len) return -1; // there's no room
-                while (k2 <= k) req->url_suffix[n++] = str[k2++];
-            }
-            req->url_suffix[n] = '\0';
-            // The URL 'pre-suffix' comes from [cur+1,k1-1]
-            // Copy "url_prefix":
-            n = 0; k2 = cur+1;
-            if (k2+1 <= k1) {
-                if (k1 - cur > url_prefix_len) return -1; // there's no room
-                while (k2 <= k1-1) req->url_prefix[n++] = str[k2++];
-            }
-            req->url_prefix[n] = '\0';
-            url_decode(req->url_prefix);
-            cur = k + 7; // to go past " RTSP/"
-            parse_succeed = 1;
+    m->nheader = 0;
+    for (p = eol + 1; p < end; p = eol + 1) {
+        eol = rtsp_line_end(p, end);
+        if (*p == '\r' || *p == '\n') {
             break;
         }
+        if ((*p == ' ' || *p == '\t') && m->nheader > 0) {
+            /* folded line continues value of previous header */
+            h = &m->headers[m->nheader - 1];
+            fold = rtsp_trim(p, eol);
+            h->value.len = fold.array + fold.len - h->value.array;
+            continue;
+        }
+        sp = memchr(p, ':', eol - p);
+        if (!sp) {
+            return -1;
+        }
+        if (m->nheader == RTSP_HEADER_MAX) {
+            loge("more than %d headers, ignored\n", RTSP_HEADER_MAX);
+            continue;
+        }
+        h = &m->headers[m->nheader++];
+        h->name = rtsp_trim(p, sp);
+        h->value = rtsp_trim(sp + 1, eol);
     }
-    if (!parse_succeed) {
+
+    if (-1 == rtsp_content_length(m, &clen)) {
         return -1;
     }
-    org = 0;
-    for (org = 0; org < k-7; org++) {
-        req->url_origin[org] = str[i+org+1];
+    if (hdr + clen > len) {
+        /* headers are complete, resume right at the empty line */
+        return 0;
     }
+    strref_set(&m->body, buf + hdr, clen);
+    strref_set(&m->raw, start, hdr + clen - (start - buf));
+    m->scanned = 0;
+    return (int)(hdr + clen);
+}
 
-    // Look for "CSeq:" (mandatory, case insensitive), skip whitespace,
-    // then read everything up to the next \r or \n as 'CSeq':
-    parse_succeed = 0;
-
-    for (j = cur; j < (len-5); ++j) {
-        if (strncasecmp("CSeq:", &str[j], 5) == 0) {
-            j += 5;
-            while (j < len && (str[j] ==  ' ' || str[j] == '\t')) ++j;
-            for (n = 0; n < cseq_len - 1 && j < len; ++n,++j) {
-                c = str[j];
-                if (c == '\r' || c == '\n') {
-                  parse_succeed = 1;
-                  break;
-                }
-                req->cseq[n] = c;
-            }
-            req->cseq[n] = '\0';
-            break;
+const struct strref *rtsp_message_header(const struct rtsp_message *m, const char *name)
+{
+    int i;
+    for (i = 0; i < m->nheader; i++) {
+        if (strref_equal_nocase(&m->headers[i].name, name)) {
+            return &m->headers[i].value;
         }
     }
-    if (!parse_succeed) {
+    return NULL;
+}
+
+int rtsp_interleaved_parse(const char *buf, size_t len, uint8_t *channel, struct strref *payload)
+{
+    size_t n;
+    if (len < 4) {
+        return 0;
+    }
+    n = ((uint8_t)buf[2] << 8) | (uint8_t)buf[3];
+    if (len < 4 + n) {
+        return 0;
+    }
+    *channel = (uint8_t)buf[1];
+    strref_set(payload, buf + 4, n);
+    return (int)(4 + n);
+}
+
+int parse_rtsp_request(struct rtsp_request *req)
+{
+    struct rtsp_message *m = &req->msg;
+    const struct strref *h;
+    struct strref prefix, suffix, id;
+    const char *p, *end, *slash;
+
+    logi("rtsp request[%zu]:\n==== C >>>> S ====\n%.*s==== C >>>> S ====\n",
+          m->raw.len, (int)m->raw.len, m->raw.array);
+    if (-1 == strref_to_str(req->cmd, sizeof(req->cmd), &m->method) ||
+        -1 == strref_to_str(req->url_origin, sizeof(req->url_origin), &m->uri)) {
+        loge("request line too long!\n");
         return -1;
     }
 
-    // Look for "Session:" (optional, case insensitive), skip whitespace,
-    // then read everything up to the next \r or \n as 'Session':
-    req->session.id[0] = '\0'; // default value (empty string)
-    for (j = cur; j < (len-8); ++j) {
-        if (strncasecmp("Session:", &str[j], 8) == 0) {
-            j += 8;
-            while (j < len && (str[j] ==  ' ' || str[j] == '\t')) ++j;
-            for (n = 0; n < session_id_len - 1 && j < len; ++n,++j) {
-                c = str[j];
-                if (c == '\r' || c == '\n') {
-                    break;
-                }
-                req->session.id[n] = c;
-            }
-            req->session.id[n] = '\0';
-            req->session.timeout = 60000;
-            p = strchr(&str[j], ';');
-            if (p && 0 == strncmp("timeout=", p+1, 8)) {
-                req->session.timeout = (int)(atof(p+9) * 1000);
+    // Skip over "rtsp://host:port" or "rtsp:" of the url, the rest is
+    // url_prefix up to the last slash and url_suffix after it
+    p = m->uri.array;
+    end = p + m->uri.len;
+    if (m->uri.len >= 5 && strncasecmp(p, "rtsp:", 5) == 0) {
+        p += 5;
+        if (end - p >= 2 && p[0] == '/' && p[1] == '/') {
+            p += 2;
+            while (p < end && *p != '/') {
+                ++p;
             }
-            break;
         }
     }
+    if (p < end && *p == '/') {
+        ++p;
+    }
+    for (slash = end; slash > p && slash[-1] != '/'; --slash) {}
+    strref_set(&suffix, slash, end - slash);
+    strref_set(&prefix, p, slash > p ? slash - 1 - p : 0);
+    if (-1 == strref_to_str(req->url_suffix, sizeof(req->url_suffix), &suffix) ||
+        -1 == strref_to_str(req->url_prefix, sizeof(req->url_prefix), &prefix)) {
+        return -1; // there's no room
+    }
+    url_decode(req->url_prefix);
 
-    // Also: Look for "Content-Length:" (optional, case insensitive)
-    req->content_len = 0; // default value
-    for (j = cur; (int)j < (int)(len-15); ++j) {
-        if (strncasecmp("Content-Length:", &(str[j]), 15) == 0) {
-            j += 15;
-            while (j < len && (str[j] ==  ' ' || str[j] == '\t')) ++j;
+    // "CSeq" is mandatory
+    h = rtsp_message_header(m, "CSeq");
+    if (!h || -1 == strref_to_str(req->cseq, sizeof(req->cseq), h)) {
+        return -1;
+    }
 
-            if (sscanf(&str[j], "%u", &num) == 1) {
-                req->content_len = num;
-            }
+    // "Session" is optional, "id;timeout=n"
+    req->session.id[0] = '\0';
+    h = rtsp_message_header(m, "Session");
+    if (h) {
+        p = memchr(h->array, ';', h->len);
+        strref_set(&id, h->array, p ? (size_t)(p - h->array) : h->len);
+        if (-1 == strref_to_str(req->session.id, sizeof(req->session.id), &id)) {
+            return -1;
+        }
+        req->session.timeout = 60000;
+        if (p && h->array + h->len - p > 9 && 0 == strncmp("timeout=", p+1, 8)) {
+            req->session.timeout = (int)(atof(p+9) * 1000);
         }
     }
+
+    // "Scale" is optional, speed of PLAY, value ends at the line break
+    req->scale = 1.0;
+    h = rtsp_message_header(m, "Scale");
+    if (h && h->len > 0) {
+        req->scale = atof(h->array);
+    }
+    req->content_len = m->body.len;
     return 0;
 }
 
@@ -706,10 +796,13 @@ static const char* rtsp_header_range_npt_time(const char* str, uint64_t *seconds
                 //*seconds = hours;
         }
 
+        // fraction is in ms, ".5" is 500, digits past ms are dropped
+        *fraction = 0;
         if(*p == '.')
-                p = string_token_int(p+1, fraction);
-        else
-                *fraction = 0;
+        {
+            for(v1 = 100, ++p; isdigit((unsigned char)*p); ++p, v1 /= 10)
+                *fraction += (*p - '0') * v1;
+        }
     }
 
     return p;
@@ -868,7 +961,8 @@ int parse_range(struct range_header *range, char* buf, int len)
     if (!found) {
         return 0;
     }
-    field = buf;
+    // value follows "Range:"
+    for (field = buf + 5; *field == ':' || *field == ' '; ++field) {}
     range->time = 0L;
     while (field && 0 == r) {
         if (0 == strncasecmp("clock=", field, 6)) {
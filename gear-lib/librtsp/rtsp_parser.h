@@ -24,6 +24,7 @@
 
 #include <stdint.h>
 #include <libsock.h>
+#include <libdstring.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -84,10 +85,33 @@ struct range_header
     uint64_t time; // range time parameter(in ms), 0 if no value
 };
 
+/*
+ * one message parsed in place, views point into the connection buffer
+ * and are valid until the message is consumed from it
+ */
+#define RTSP_HEADER_MAX         (32)
+struct rtsp_header {
+    struct strref name;
+    struct strref value;
+};
+
+struct rtsp_message {
+    struct strref raw;              /* start line to end of body */
+    struct strref method;
+    struct strref uri;
+    struct strref version;
+    struct rtsp_header headers[RTSP_HEADER_MAX];
+    int nheader;
+    struct strref body;
+    size_t scanned;                 /* resume point of end of headers search */
+};
+
 typedef struct rtsp_request {
     int fd;
     struct sock_addr client;
-    struct iovec *raw;
+    struct iovec *raw;              /* connection buffer, iov_len is buffered */
+    size_t raw_cap;
+    struct rtsp_message msg;        /* request being handled */
     uint32_t content_len;
     char cmd[RTSP_PARAM_STRING_MAX];
     char url_origin[RTSP_PARAM_STRING_MAX];
@@ -97,10 +121,22 @@ typedef struct rtsp_request {
     struct transport_header transport;//maybe multi
     struct session_header session;
     struct range_header range;
+    double scale;                   /* Scale of PLAY, 1.0 if absent */
     struct gevent *event;
     struct rtsp_server *rtsp_server;
+    struct rtsp_shard *shard;
 } rtsp_request_t;
 
+/* a response parses too, method is the version, uri the status code and
+ * version the reason phrase.
+ * return length of a complete message at buf, 0 if more data is needed,
+ * -1 if malformed. partial reads resume the search where it stopped */
+int rtsp_message_parse(struct rtsp_message *m, const char *buf, size_t len);
+const struct strref *rtsp_message_header(const struct rtsp_message *m, const char *name);
+/* '$' channel length, return length with header, 0 if more data is needed */
+int rtsp_interleaved_parse(const char *buf, size_t len, uint8_t *channel, struct strref *payload);
+
+/* fills request fields from req->msg */
 int parse_rtsp_request(struct rtsp_request *req);
 int parse_transport(struct transport_header *t, char *buf, int len);
 int parse_session(struct session_header *s, char *buf, int len);
@@ -329,3 +329,147 @@ int get_sdp(struct media_source *ms, char *sdp, size_t len)
 
   return 0;
 }
+
+static size_t sdp_base64(char *dst, size_t len, const uint8_t *src, size_t bytes)
+{
+    static const char tbl[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    size_t i, n = 0;
+    uint32_t v;
+    if (len < (bytes + 2) / 3 * 4 + 1) {
+        return 0;
+    }
+    for (i = 0; i < bytes; i += 3) {
+        v = (uint32_t)src[i] << 16;
+        if (i + 1 < bytes) v |= (uint32_t)src[i + 1] << 8;
+        if (i + 2 < bytes) v |= src[i + 2];
+        dst[n++] = tbl[(v >> 18) & 0x3F];
+        dst[n++] = tbl[(v >> 12) & 0x3F];
+        dst[n++] = (i + 1 < bytes) ? tbl[(v >> 6) & 0x3F] : '=';
+        dst[n++] = (i + 2 < bytes) ? tbl[v & 0x3F] : '=';
+    }
+    dst[n] = '\0';
+    return n;
+}
+
+static const uint8_t *sdp_nalu_next(const uint8_t *p, const uint8_t *end)
+{
+    for (; p + 3 <= end; p++) {
+        if (p[0] == 0 && p[1] == 0 && p[2] == 1) {
+            return p + 3;
+        }
+    }
+    return end;
+}
+
+int sdp_h264_media(char *buf, size_t len, int pt, const uint8_t *data, size_t bytes)
+{
+    /* sps 7, pps 8, only the first of each is announced */
+    char b64[2][256] = {{0}};
+    uint8_t profile[3] = {0};
+    const uint8_t *p, *next, *end = data + bytes;
+    size_t nalu_len;
+    int type, n;
+
+    for (p = sdp_nalu_next(data, end); p < end; p = next) {
+        next = sdp_nalu_next(p, end);
+        nalu_len = (next < end ? next - 3 : end) - p;
+        while (nalu_len > 0 && p[nalu_len - 1] == 0) {
+            nalu_len--;
+        }
+        type = p[0] & 0x1F;
+        if (type >= 7 && type <= 8 && b64[type - 7][0] == 0) {
+            sdp_base64(b64[type - 7], sizeof(b64[0]), p, nalu_len);
+            if (type == 7 && nalu_len >= 4) {
+                memcpy(profile, p + 1, 3);
+            }
+        }
+        if (b64[0][0] && b64[1][0]) {
+            break;
+        }
+    }
+    n = snprintf(buf, len, "m=video 0 RTP/AVP %d\r\n"
+                 "a=rtpmap:%d H264/90000\r\n"
+                 "a=rtcp-fb:%d nack\r\n", pt, pt, pt);
+    if (b64[0][0] && b64[1][0]) {
+        n += snprintf(buf + n, len - n, "a=fmtp:%d packetization-mode=1; "
+                      "profile-level-id=%02X%02X%02X; sprop-parameter-sets=%s,%s\r\n",
+                      pt, profile[0], profile[1], profile[2], b64[0], b64[1]);
+    } else {
+        logw("h264 parameter sets not found, sdp has no sprop\n");
+    }
+    return (n < (int)len) ? n : -1;
+}
+
+int sdp_h265_media(char *buf, size_t len, int pt, const uint8_t *data, size_t bytes)
+{
+    /* vps 32, sps 33, pps 34, only the first of each is announced */
+    static const char *keys[3] = {"sprop-vps", "sprop-sps", "sprop-pps"};
+    char b64[3][256] = {{0}};
+    const uint8_t *p, *next, *end = data + bytes;
+    size_t nalu_len;
+    int type, n;
+
+    for (p = sdp_nalu_next(data, end); p < end; p = next) {
+        next = sdp_nalu_next(p, end);
+        nalu_len = (next < end ? next - 3 : end) - p;
+        while (nalu_len > 0 && p[nalu_len - 1] == 0) {
+            nalu_len--;
+        }
+        type = (p[0] >> 1) & 0x3F;
+        if (type >= 32 && type <= 34 && b64[type - 32][0] == 0) {
+            sdp_base64(b64[type - 32], sizeof(b64[0]), p, nalu_len);
+        }
+        if (b64[0][0] && b64[1][0] && b64[2][0]) {
+            break;
+        }
+    }
+    n = snprintf(buf, len, "m=video 0 RTP/AVP %d\r\n"
+                 "a=rtpmap:%d H265/90000\r\n"
+                 "a=rtcp-fb:%d nack\r\n", pt, pt, pt);
+    if (b64[0][0] && b64[1][0] && b64[2][0]) {
+        n += snprintf(buf + n, len - n, "a=fmtp:%d %s=%s; %s=%s; %s=%s\r\n",
+                      pt, keys[0], b64[0], keys[1], b64[1], keys[2], b64[2]);
+    } else {
+        logw("h265 parameter sets not found, sdp has no sprop\n");
+    }
+    return (n < (int)len) ? n : -1;
+}
+
+int sdp_set_multicast(char *sdp, size_t len, const char *group, uint16_t port, uint8_t ttl)
+{
+    char *out;
+    const char *p, *eol, *end, *sp;
+    size_t n = 0;
+
+    out = calloc(1, len);
+    if (!out) {
+        return -1;
+    }
+    for (p = sdp; *p && n < len; p = eol) {
+        eol = p + strcspn(p, "\n");
+        if (*eol == '\n') {
+            eol++;
+        }
+        for (end = eol; end > p && (end[-1] == '\n' || end[-1] == '\r'); end--);
+        if (strncmp(p, "c=IN IP4 ", 9) == 0) {
+            n += snprintf(out + n, len - n, "c=IN IP4 %s/%d%.*s",
+                          group, ttl, (int)(eol - end), end);
+        } else if (strncmp(p, "m=", 2) == 0 && (sp = memchr(p, ' ', end - p))) {
+            /* port is the field after media type, the rest is kept */
+            sp++;
+            n += snprintf(out + n, len - n, "%.*s%d%.*s", (int)(sp - p), p,
+                          port, (int)(eol - sp - strspn(sp, "0123456789")),
+                          sp + strspn(sp, "0123456789"));
+        } else {
+            n += snprintf(out + n, len - n, "%.*s", (int)(eol - p), p);
+        }
+    }
+    if (n >= len) {
+        free(out);
+        return -1;
+    }
+    memcpy(sdp, out, n + 1);
+    free(out);
+    return 0;
+}
@@ -23,6 +23,7 @@
 #define SDP_H
 
 #include "media_source.h"
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -31,6 +32,24 @@ extern "C" {
 
 int get_sdp(struct media_source *ms, char *sdp, size_t len);
 
+/*
+ * m= line, rtpmap and fmtp of a H.264 stream, profile-level-id and
+ * sprop-parameter-sets from the first sps and pps in annex-b data
+ */
+int sdp_h264_media(char *buf, size_t len, int pt, const uint8_t *data, size_t bytes);
+
+/*
+ * m= line, rtpmap and fmtp of a H.265 stream, sprop-vps/sps/pps are taken
+ * from the first parameter sets found in annex-b data, return length
+ */
+int sdp_h265_media(char *buf, size_t len, int pt, const uint8_t *data, size_t bytes);
+
+/*
+ * rewrite c= lines to group/ttl and port of m= lines in place, so clients
+ * setup multicast, return -1 if result does not fit in len
+ */
+int sdp_set_multicast(char *sdp, size_t len, const char *group, uint16_t port, uint8_t ttl);
+
 #ifdef __cplusplus
 }
 #endif
@@ -26,7 +26,11 @@
 
 int main(int argc, char **argv)
 {
-    struct rtsp_server *ctx = rtsp_server_init(NULL, 8554);
+    int nshard = (argc > 1) ? atoi(argv[1]) : 1;
+    struct rtsp_server *ctx = rtsp_server_init_sharded(NULL, 8554, nshard);
+    if (argc > 2) {
+        rtsp_server_set_multicast(ctx, argv[2], 30000, 16);
+    }
     rtsp_server_dispatch(ctx);
     while (1) {
         sleep(1);
@@ -25,16 +25,38 @@
 #include <libdict.h>
 #include <libgevent.h>
 #include <libmedia-io.h>
+#include <libqueue.h>
 #include "transport_session.h"
 #include "media_source.h"
 #include "rtp.h"
+#include "rtp_pacer.h"
 
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <sys/time.h>
 #include <unistd.h>
+#include <pthread.h>
+#if defined (ENABLE_TRACE)
+#include <libtrace.h>
+#else
+#define TRACE_SCOPE(cat, name)
+#define TRACE_FLOW_END(cat, name, id)
+#endif
 
+static struct {
+    char group[INET_ADDRSTRLEN];    /* base address, empty if disabled */
+    uint16_t port;
+    uint8_t ttl;
+    int ngroup;
+    dict *groups;                   /* media source name to transport_mcast */
+    pthread_mutex_t lock;
+} g_mcast = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static struct {
+    bool enable;
+    uint32_t rate;                  /* bytes per second, 0 estimate */
+} g_pacing = {.enable = true};
 
 void *transport_session_pool_create()
 {
@@ -73,9 +95,11 @@ struct transport_session *transport_session_create(void *pool, struct transport_
     s->session_id = get_random_number();
     snprintf(key, sizeof(key), "%08X", s->session_id);
     s->rtp = rtp_create(90000, 0);
-    s->rtp->sock = rtp_socket_create(t->mode, t->fd, t->source, t->destination);
-    s->rtp->sock->rtp_dst_port = t->rtp.u.client_port1;
-    s->rtp->sock->rtcp_dst_port = t->rtp.u.client_port2;
+    if (!t->multicast) {
+        s->rtp->sock = rtp_socket_create(t->mode, t->fd, t->source, t->destination);
+        s->rtp->sock->rtp_dst_port = t->rtp.u.client_port1;
+        s->rtp->sock->rtcp_dst_port = t->rtp.u.client_port2;
+    }
     dict_add((dict *)pool, key, (char *)s);
     return s;
 }
@@ -99,77 +123,169 @@ struct transport_session *transport_session_lookup(void *pool, char *key)
 
 static int32_t get_ms_time_v(struct video_packet *packet, int64_t val)
 {
-    return (int32_t)(val * MILLISECOND_DEN / packet->encoder.timebase.den);
+    rational_t tb = packet->encoder.timebase;
+    rational_t ms = {1, MILLISECOND_DEN};
+
+    /* producers that only set the den mean 1/den */
+    if (tb.num <= 0) {
+        tb.num = 1;
+    }
+    return (int32_t)media_ts_rescale(val, tb, ms);
 }
 
-static void *send_thread(struct thread *t, void *ptr)
+static uint32_t get_frame_interval_ms(struct video_packet *packet)
 {
-    struct transport_session *ts = (struct transport_session *)ptr;
-    struct media_source *ms = ts->media_source;
-    void *data = NULL;
-    size_t len = 0;
-    unsigned int ssrc, seq;
+    rational_t *fr = &packet->encoder.framerate;
+    if (fr->num > 0 && fr->den > 0) {
+        return (uint32_t)((uint64_t)fr->den * MILLISECOND_DEN / fr->num);
+    }
+    return TRANSPORT_FRAME_INTERVAL_MS;
+}
+
+/* file source does not flag keyframes, an irap or parameter set nalu
+ * first in the frame starts one */
+static bool is_key_frame(const struct video_packet *vpkt, bool hevc)
+{
+    const uint8_t *p = vpkt->data;
+    size_t i = 0;
+    uint8_t type;
+
+    if (vpkt->key_frame) {
+        return true;
+    }
+    while (i < vpkt->size && p[i] == 0) {
+        i++;
+    }
+    if (i + 1 >= vpkt->size || p[i] != 1) {
+        return false;
+    }
+    if (hevc) {
+        type = (p[i + 1] >> 1) & 0x3f;
+        return (type >= 16 && type <= 23) || (type >= 32 && type <= 34);
+    }
+    type = p[i + 1] & 0x1f;
+    return type == 5 || type == 7;
+}
+
+static int transport_session_send(struct transport_session *ts, struct media_packet *mpkt)
+{
+    int ret = 0;
     uint64_t pts;
-    int ret;
-    struct media_packet *mpkt;
     struct video_packet *vpkt;
     struct rtp_packet *rpkt;
-    if (-1 == ms->_open(ms, "sample.264")) {
-        loge("open failed!\n");
-        return NULL;
-    }
-    ms->is_active = true;
-    ssrc = (unsigned int)rtp_ssrc();
-    pts = time_now_msec();
-    seq = ssrc;
-    logd("rtp send thread %s created\n", t->name);
-    while (t->run) {
-        if (-1 == ms->_read(ms, &data, &len) || data == NULL) {
-            loge("read failed!\n");
-            sleep(1);
-            continue;
-        }
-        mpkt = data;
-        switch (mpkt->type) {
-        case MEDIA_TYPE_AUDIO:
-            logd("MEDIA_TYPE_AUDIO\n");
+    bool hevc;
+
+    TRACE_SCOPE("rtsp", "packetize_send");
+    switch (mpkt->type) {
+    case MEDIA_TYPE_AUDIO:
+        logd("MEDIA_TYPE_AUDIO\n");
+        break;
+    case MEDIA_TYPE_VIDEO:
+        logd("MEDIA_TYPE_VIDEO\n");
+        vpkt = mpkt->video;
+        hevc = vpkt->encoder.type == VIDEO_CODEC_H265;
+        if (ts->wait_key && !is_key_frame(vpkt, hevc)) {
             break;
-        case MEDIA_TYPE_VIDEO: {
-            logd("MEDIA_TYPE_VIDEO\n");
-            vpkt = mpkt->video;
-            rpkt = rtp_packet_create(RTP_PT_H264, vpkt->size, seq, ssrc);
-            if (!rpkt) {
-                loge("rtp_packet_create failed!\n");
-                break;
-            }
-            pts = get_ms_time_v(vpkt, vpkt->dts);
-            logd("rtp_packet_create video size=%d, pts=%d\n", vpkt->size, pts);
-            ret = rtp_payload_h264_encode(ts->rtp->sock, rpkt, vpkt->data, vpkt->size, pts);
-            seq = rpkt->header.seq;
-            rtp_packet_destroy(rpkt);
-            if (ret == -1) {
-                loge("rtp_payload_h264_encode failed!\n");
-                t->run = false;
-            }
-        } break;
-        default:
-            loge("unsupport media type!\n");
+        }
+        /* interleaved backlog not written yet, drop the whole frame */
+        if (-1 == rtp_tcp_frame_begin(ts->rtp->sock)) {
+            logd("session %08X tcp backlog, drop frame\n", ts->session_id);
+            ts->wait_key = true;
             break;
         }
+        ts->wait_key = false;
+        rtp_udp_frame_begin(ts->rtp->sock);
+        TRACE_FLOW_END("packet", "packet", vpkt->pts);
+        rpkt = rtp_packet_create(hevc ? RTP_PT_H265 : RTP_PT_H264, vpkt->size, ts->seq, ts->ssrc);
+        if (!rpkt) {
+            loge("rtp_packet_create failed!\n");
+            rtp_tcp_frame_end(ts->rtp->sock);
+            rtp_udp_frame_end(ts->rtp->sock);
+            break;
+        }
+        pts = get_ms_time_v(vpkt, vpkt->dts);
+        rtp_pacer_frame(ts->rtp->sock->pacer, vpkt->size, get_frame_interval_ms(vpkt));
+        logd("rtp_packet_create video size=%d, pts=%d\n", vpkt->size, pts);
+        if (hevc) {
+            ret = rtp_payload_h265_encode(ts->rtp->sock, rpkt, vpkt->data, vpkt->size, pts);
+        } else {
+            ret = rtp_payload_h264_encode(ts->rtp->sock, rpkt, vpkt->data, vpkt->size, pts);
+        }
+        ts->seq = rpkt->header.seq;
+        ts->timestamp = pts;
+        ts->rtcp_clock = time_now_msec();
+        rtp_packet_destroy(rpkt);
+        if (ret == -1) {
+            loge("rtp_payload_%s_encode failed!\n", hevc ? "h265" : "h264");
+        }
+        if (-1 == rtp_tcp_frame_end(ts->rtp->sock)) {
+            loge("rtp_tcp_frame_end failed!\n");
+            ret = -1;
+        }
+        if (-1 == rtp_udp_frame_end(ts->rtp->sock)) {
+            loge("rtp_udp_frame_end failed!\n");
+            ret = -1;
+        }
+        break;
+    default:
+        loge("unsupport media type!\n");
+        break;
+    }
+    return ret;
+}
+
+/*
+ * one frame is sent per tick if the file source has no timing, a paced
+ * source gets all packets that are due
+ */
+static void on_tick(struct gevent_wtimer *t, void *arg)
+{
+    struct transport_session *ts = (struct transport_session *)arg;
+    struct media_source *ms = ts->media_source;
+    void *data = NULL;
+    size_t len = 0;
+    int ret;
+
+    do {
+        /* source read must not block, it runs in loop thread of shard */
+        ret = ms->_read(ms, &data, &len);
+        if (ret == 1 && ms->tick_ms) {
+            return;
+        }
+        if (ret == -1 || data == NULL) {
+            logi("session %08X end of stream\n", ts->session_id);
+            gevent_wtimer_del(ts->evbase, t);
+            return;
+        }
+        if (-1 == transport_session_send(ts, (struct media_packet *)data)) {
+            gevent_wtimer_del(ts->evbase, t);
+            return;
+        }
+    } while (ms->tick_ms);
+}
+
+/* fan-out source has packets in branch of this session, drain it */
+static void on_packet(int fd, void *arg)
+{
+    struct transport_session *ts = (struct transport_session *)arg;
+    struct media_source *ms = ts->media_source;
+    struct queue_item *it;
+
+    while ((it = ms->_pop(ms, ts->name)) != NULL) {
+        transport_session_send(ts, (struct media_packet *)it->opaque.iov_base);
+        ms->_release(ms, it);
     }
-    ms->is_active = false;
-    ms->_close(ms);
-    return NULL;
 }
 
 static void on_recv(int fd, void *arg)
 {
     int ret;
-    char buf[2048];
+    char buf[GEAR_CONFIG_RECV_BUF_SIZE];
+    struct transport_session *ts = (struct transport_session *)arg;
     memset(buf, 0, sizeof(buf));
-    ret = sock_recv(fd, buf, 2048);
+    ret = sock_recv(fd, buf, sizeof(buf));
     if (ret > 0) {
-        rtcp_parse(buf, ret);
+        rtcp_parse(ts->rtp, buf, ret);
     } else if (ret == 0) {
         loge("delete connection fd:%d\n", fd);
     } else if (ret < 0) {
@@ -177,46 +293,318 @@ static void on_recv(int fd, void *arg)
     }
 }
 
-static void on_error(int fd, void *arg)
+/* sender report lets the receiver compute lsr and dlsr, so rtt is known */
+static void on_rtcp_tick(struct gevent_wtimer *t, void *arg)
 {
-    loge("error: %d\n", errno);
+    struct transport_session *ts = (struct transport_session *)arg;
+    struct rtp_socket *sock = ts->rtp->sock;
+    uint8_t buf[128];
+    uint32_t rtpts;
+    int len;
+
+    if (sock->packets_sent == 0) {
+        return;
+    }
+    /* timestamp of last packet moved on by wall clock since it was sent */
+    rtpts = (uint32_t)(ts->timestamp + time_now_msec() - ts->rtcp_clock);
+    len = rtcp_sr_pack(ts->rtp, rtpts, buf, sizeof(buf));
+    if (len > 0 && -1 == rtcp_sendto(sock, sock->dst_ip, sock->rtcp_dst_port, buf, len)) {
+        logd("rtcp_sendto %s:%d failed\n", sock->dst_ip, sock->rtcp_dst_port);
+    }
 }
 
-static void *event_thread(struct thread *t, void *ptr)
+static void on_error(int fd, void *arg)
 {
-    struct transport_session *ts = (struct transport_session *)ptr;
-    gevent_base_loop(ts->evbase);
-    return NULL;
+    loge("error: %d\n", errno);
 }
 
-int transport_session_start(struct transport_session *ts, struct media_source *ms)
+static int transport_mcast_join(struct transport_session *ts,
+                struct media_source *ms, struct gevent_base *evbase);
+static void transport_mcast_leave(struct transport_session *ts);
+
+int transport_session_start(struct transport_session *ts, struct media_source *ms,
+                struct gevent_base *evbase)
 {
-    ts->evbase = gevent_base_create();
-    if (!ts->evbase) {
-        return -1;
+    if (ts->started) {
+        return 0;
     }
-    sock_set_noblk(ts->rtp->sock->rtcp_fd, true);
-    ts->ev_recv = gevent_create(ts->rtp->sock->rtcp_fd, on_recv, NULL, on_error, NULL);
-    if (-1 == gevent_add(ts->evbase, &ts->ev_recv)) {
-        loge("event_add failed!\n");
-        gevent_destroy(ts->ev_recv);
+    if (ts->mcast) {
+        return transport_mcast_join(ts, ms, evbase);
+    }
+    if (!ms->_subscribe) {
+        /* file source keeps its read position in opaque, each session
+         * reads through its own copy of the registered source */
+        struct media_source *inst = calloc(1, sizeof(struct media_source));
+        if (!inst) {
+            loge("calloc media_source failed!\n");
+            return -1;
+        }
+        memcpy(inst, ms, sizeof(struct media_source));
+        inst->sdp = NULL;
+        inst->opaque = NULL;
+        ms = inst;
     }
+    if (-1 == ms->_open(ms, ms->file ? ms->file : "sample.264")) {
+        loge("open failed!\n");
+        if (!ms->_subscribe) {
+            free(ms);
+        }
+        return -1;
+    }
+    ms->is_active = true;
     ts->media_source = ms;
-    ts->ev_thread = thread_create(event_thread, ts);
-    thread_set_name(ts->ev_thread, "event_thread");
-    ts->thread = thread_create(send_thread, ts);
-    thread_set_name(ts->thread, "send_thread");
+    ts->evbase = evbase;
+    ts->ssrc = (uint32_t)rtp_ssrc();
+    ts->sub_fd = -1;
+    ts->seq = ts->ssrc;
+    if (g_pacing.enable && ts->rtp->sock->mode == RTP_UDP) {
+        ts->rtp->sock->pacer = rtp_pacer_create(ts->rtp->sock, evbase, g_pacing.rate);
+        if (!ts->rtp->sock->pacer) {
+            loge("rtp_pacer_create failed, session is not paced\n");
+        }
+    }
+    if (ts->rtp->sock->mode == RTP_TCP) {
+        if (-1 == rtp_tcp_batch_enable(ts->rtp->sock, true)) {
+            loge("rtp_tcp_batch_enable failed, packets are written one by one\n");
+        }
+        ts->wait_key = false;
+    }
+    if (ts->rtp->sock->mode == RTP_UDP && !ts->rtp->sock->pacer) {
+        if (-1 == rtp_udp_batch_enable(ts->rtp->sock, true)) {
+            loge("rtp_udp_batch_enable failed, packets are sent one by one\n");
+        }
+    }
+    if (ts->rtp->sock->mode == RTP_UDP) {
+        if (-1 == rtp_history_enable(ts->rtp->sock, true)) {
+            loge("rtp_history_enable failed, nack is not served\n");
+        }
+        gevent_wtimer_init(&ts->rtcp_tick, on_rtcp_tick, ts);
+        if (-1 == gevent_wtimer_add(evbase, &ts->rtcp_tick, TRANSPORT_RTCP_INTERVAL_MS, TIMER_PERSIST)) {
+            loge("gevent_wtimer_add failed!\n");
+        }
+    }
+    ts->rtp->ssrc = ts->ssrc;
+    if (ts->rtp->sock->mode == RTP_UDP) {
+        /* interleaved rtcp comes in on the rtsp connection instead */
+        sock_set_noblk(ts->rtp->sock->rtcp_fd, true);
+        ts->ev_recv = gevent_create(ts->rtp->sock->rtcp_fd, on_recv, NULL, on_error, ts);
+        if (-1 == gevent_add(evbase, &ts->ev_recv)) {
+            loge("event_add failed!\n");
+            gevent_destroy(ts->ev_recv);
+            ts->ev_recv = NULL;
+        }
+    }
+    gevent_wtimer_init(&ts->tick, on_tick, ts);
+    if (ms->_subscribe) {
+        /* packets are pushed by the source, paced by its producer */
+        snprintf(ts->name, sizeof(ts->name), "%08X", ts->session_id);
+        ts->sub_fd = ms->_subscribe(ms, ts->name);
+        if (ts->sub_fd == -1) {
+            loge("subscribe %s failed!\n", ms->name);
+        } else {
+            ts->ev_packet = gevent_create(ts->sub_fd, on_packet, NULL, on_error, ts);
+            if (-1 == gevent_add(evbase, &ts->ev_packet)) {
+                loge("event_add failed!\n");
+                gevent_destroy(ts->ev_packet);
+                ts->ev_packet = NULL;
+            }
+        }
+    } else if (-1 == gevent_wtimer_add(evbase, &ts->tick,
+                    ms->tick_ms ? ms->tick_ms : TRANSPORT_FRAME_INTERVAL_MS, TIMER_PERSIST)) {
+        loge("gevent_wtimer_add failed!\n");
+    }
+    ts->started = true;
     logi("session_id = %d, name=%s\n", ts->session_id, ts->media_source->name);
     return 0;
 }
 
+/* called in loop thread of shard, same as tick and rtcp callback */
 void transport_session_stop(struct transport_session *ts)
 {
-    gevent_del(ts->evbase, &ts->ev_recv);
-    gevent_base_loop_break(ts->evbase);
-    ts->thread->run = false;
-    thread_join(ts->thread);
-    thread_destroy(ts->thread);
-    gevent_base_destroy(ts->evbase);
-    thread_destroy(ts->ev_thread);
+    if (!ts->started) {
+        return;
+    }
+    if (ts->mcast) {
+        transport_mcast_leave(ts);
+        return;
+    }
+    gevent_wtimer_del(ts->evbase, &ts->tick);
+    if (ts->rtp->sock->mode == RTP_UDP) {
+        gevent_wtimer_del(ts->evbase, &ts->rtcp_tick);
+        rtp_history_enable(ts->rtp->sock, false);
+    }
+    if (ts->rtp->sock->mode == RTP_TCP) {
+        rtp_tcp_batch_enable(ts->rtp->sock, false);
+    }
+    if (ts->ev_packet) {
+        gevent_del(ts->evbase, &ts->ev_packet);
+        gevent_destroy(ts->ev_packet);
+        ts->ev_packet = NULL;
+    }
+    if (ts->sub_fd != -1 && ts->media_source->_unsubscribe) {
+        ts->media_source->_unsubscribe(ts->media_source, ts->name);
+    }
+    if (ts->ev_recv) {
+        gevent_del(ts->evbase, &ts->ev_recv);
+        gevent_destroy(ts->ev_recv);
+        ts->ev_recv = NULL;
+    }
+    rtp_pacer_destroy(ts->rtp->sock->pacer);
+    ts->rtp->sock->pacer = NULL;
+    ts->media_source->is_active = false;
+    ts->media_source->_close(ts->media_source);
+    if (!ts->media_source->_subscribe) {
+        free(ts->media_source);
+    }
+    ts->media_source = NULL;
+    ts->started = false;
+}
+
+int64_t transport_session_seek(struct transport_session *ts, uint64_t from, double scale)
+{
+    struct media_source *ms = ts->media_source;
+    if (!ts->started || ts->mcast || !ms || !ms->_seek) {
+        return -1;
+    }
+    return ms->_seek(ms, from, scale);
+}
+
+void transport_session_pacing(bool enable, uint32_t rate)
+{
+    g_pacing.enable = enable;
+    g_pacing.rate = rate;
+}
+
+int transport_session_stats(struct transport_session *ts, struct rtcp_stats *stats)
+{
+    if (!ts || !stats) {
+        return -1;
+    }
+    if (ts->mcast) {
+        ts = &ts->mcast->sender;
+    }
+    memcpy(stats, &ts->rtp->stats, sizeof(*stats));
+    return 0;
+}
+
+int transport_mcast_config(const char *group, uint16_t port, uint8_t ttl)
+{
+    if (!group || !IN_MULTICAST(ntohl(sock_addr_pton(group))) || (port & 1)) {
+        loge("invalid multicast group %s:%d, port must be even\n", group, port);
+        return -1;
+    }
+    pthread_mutex_lock(&g_mcast.lock);
+    snprintf(g_mcast.group, sizeof(g_mcast.group), "%s", group);
+    g_mcast.port = port;
+    g_mcast.ttl = ttl;
+    pthread_mutex_unlock(&g_mcast.lock);
+    return 0;
+}
+
+bool transport_mcast_enabled(void)
+{
+    return g_mcast.group[0] != '\0';
+}
+
+struct transport_mcast *transport_mcast_get(struct media_source *ms)
+{
+    struct transport_mcast *m = NULL;
+    struct transport_session *s;
+    char group[SOCK_ADDR_LEN];
+    uint32_t ip;
+
+    pthread_mutex_lock(&g_mcast.lock);
+    if (!transport_mcast_enabled()) {
+        goto exit;
+    }
+    if (!g_mcast.groups) {
+        g_mcast.groups = dict_new();
+    }
+    m = (struct transport_mcast *)dict_get(g_mcast.groups, ms->name, NULL);
+    if (m) {
+        goto exit;
+    }
+    m = calloc(1, sizeof(struct transport_mcast));
+    if (!m) {
+        loge("calloc transport_mcast failed!\n");
+        goto exit;
+    }
+    /* next group address after the base, in host order */
+    ip = ntohl(sock_addr_pton(g_mcast.group)) + g_mcast.ngroup;
+    sock_addr_ntop(group, htonl(ip));
+    snprintf(m->group, sizeof(m->group), "%s", group);
+    snprintf(m->name, sizeof(m->name), "%s", ms->name);
+    m->port = g_mcast.port;
+    m->ttl = g_mcast.ttl;
+
+    s = &m->sender;
+    s->session_id = get_random_number();
+    s->rtp = rtp_create(90000, 0);
+    s->rtp->sock = rtp_socket_create(RTP_UDP, -1, NULL, m->group);
+    if (!s->rtp->sock ||
+        -1 == rtp_socket_set_multicast(s->rtp->sock, m->group, m->port, m->ttl)) {
+        loge("multicast socket of %s failed!\n", ms->name);
+        rtp_socket_destroy(s->rtp->sock);
+        free(m);
+        m = NULL;
+        goto exit;
+    }
+    g_mcast.ngroup++;
+    dict_add(g_mcast.groups, m->name, (char *)m);
+exit:
+    pthread_mutex_unlock(&g_mcast.lock);
+    return m;
+}
+
+/* runs in loop of sender, a member may have joined again meanwhile */
+static void transport_mcast_stop(void *arg)
+{
+    struct transport_mcast *m = (struct transport_mcast *)arg;
+    pthread_mutex_lock(&g_mcast.lock);
+    if (m->members == 0) {
+        transport_session_stop(&m->sender);
+    }
+    pthread_mutex_unlock(&g_mcast.lock);
+}
+
+static int transport_mcast_join(struct transport_session *ts,
+                struct media_source *ms, struct gevent_base *evbase)
+{
+    int ret = 0;
+    struct transport_mcast *m = ts->mcast;
+
+    pthread_mutex_lock(&g_mcast.lock);
+    if (!m->sender.started) {
+        ret = transport_session_start(&m->sender, ms, evbase);
+    }
+    if (ret == 0) {
+        m->members++;
+        ts->media_source = ms;
+        ts->evbase = evbase;
+        ts->started = true;
+    }
+    pthread_mutex_unlock(&g_mcast.lock);
+    logi("session %08X joined %s:%d, members=%d\n",
+         ts->session_id, m->group, m->port, m->members);
+    return ret;
+}
+
+static void transport_mcast_leave(struct transport_session *ts)
+{
+    struct transport_mcast *m = ts->mcast;
+    struct gevent_base *evbase = NULL;
+
+    pthread_mutex_lock(&g_mcast.lock);
+    ts->started = false;
+    if (--m->members == 0 && m->sender.started) {
+        if (m->sender.evbase == ts->evbase) {
+            transport_session_stop(&m->sender);
+        } else {
+            evbase = m->sender.evbase;
+        }
+    }
+    pthread_mutex_unlock(&g_mcast.lock);
+    if (evbase && -1 == gevent_base_post(evbase, transport_mcast_stop, m)) {
+        loge("gevent_base_post failed, %s keeps sending\n", m->group);
+    }
 }
@@ -25,7 +25,7 @@
 #include "media_source.h"
 #include "rtsp_parser.h"
 #include "rtp.h"
-#include <libthread.h>
+#include <libgevent.h>
 #include <stdint.h>
 #include <stddef.h>
 
@@ -33,11 +33,27 @@
 extern "C" {
 #endif
 
+/* 25fps, same as duration of h264 file source */
+#define TRANSPORT_FRAME_INTERVAL_MS     (40)
+/* sender report interval, RFC 3550 6.2 */
+#define TRANSPORT_RTCP_INTERVAL_MS      (5000)
+
+/*
+ * session has no thread, rtcp fd and frame tick live in the loop of the
+ * shard which handled the request, all sessions share the shard reactor
+ */
 typedef struct transport_session {
     uint32_t session_id;
     struct rtp_context *rtp;
-    struct gevent_base *evbase;
+    struct gevent_base *evbase;     /* loop of shard, not owned */
     struct gevent *ev_recv;
+    struct gevent_wtimer tick;
+    struct gevent_wtimer rtcp_tick;
+    struct gevent *ev_packet;       /* branch evfd of fan-out source */
+    int sub_fd;
+    uint32_t seq;
+    bool started;
+    bool wait_key;                  /* tcp dropped a frame, resume at key */
     //XXX
     int64_t dts_first; // first frame timestamp
     int64_t dts_last; // last frame timestamp
@@ -50,23 +66,54 @@ typedef struct transport_session {
     char name[64];
     int payload;
     void* packer; // rtp encoder
-    uint8_t packet[1450];
 
     int track; // mp4 track
-    struct thread *thread;
-    struct thread *ev_thread;
     struct media_source *media_source;
+    struct transport_mcast *mcast;  /* joined group, has no own socket */
 
 } transport_session_t;
 
+/*
+ * one multicast group per media source, members of all shards share its
+ * socket and sender session, sender runs in loop of shard of the first
+ * member and is stopped there when the last member leaves
+ */
+struct transport_mcast {
+    char name[STREAM_NAME_LEN];
+    char group[INET_ADDRSTRLEN];
+    uint16_t port;
+    uint8_t ttl;
+    int members;
+    struct transport_session sender;
+};
+
 void *transport_session_pool_create();
 void transport_session_pool_destroy(void *pool);
 struct transport_session *transport_session_create(void *pool, struct transport_header *hdr);
 void transport_session_destroy(void *pool, char *name);
 struct transport_session *transport_session_lookup(void *pool, char *name);
-int transport_session_start(struct transport_session *ts, struct media_source *ms);
+int transport_session_start(struct transport_session *ts, struct media_source *ms,
+                struct gevent_base *evbase);
 int transport_session_pause(struct transport_session *s);
+/* seek source of a started unicast session, returns ms moved to or -1 */
+int64_t transport_session_seek(struct transport_session *s, uint64_t from, double scale);
 void transport_session_stop(struct transport_session *s);
+/*
+ * udp sessions started after this are paced at rate bytes per second, or
+ * faster when needed to send a frame within its interval, rate 0 only
+ * spreads frames, pacing is on by default
+ */
+void transport_session_pacing(bool enable, uint32_t rate);
+/* loss, jitter and rtt reported by receiver, retransmissions on nack */
+int transport_session_stats(struct transport_session *ts, struct rtcp_stats *stats);
+
+/*
+ * groups are numbered up from base address, all of them use rtp port and
+ * port+1, multicast is disabled until configured
+ */
+int transport_mcast_config(const char *group, uint16_t port, uint8_t ttl);
+bool transport_mcast_enabled(void);
+struct transport_mcast *transport_mcast_get(struct media_source *ms);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,440 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#include "libsock_ext.h"
+#include <libthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <time.h>
+#if defined (OS_LINUX)
+#include <netdb.h>
+#include <arpa/inet.h>
+#endif
+
+/*
+ * getaddrinfo blocks for seconds on a slow resolver, run it in a small pool
+ * of threads. Results are cached by host name until ttl expires, failures
+ * are cached for a short time, and concurrent queries of one name wait on
+ * a single lookup.
+ */
+#define DNS_HASH_SIZE       (256)
+#define DNS_MAX_ADDR        (8)
+#define DNS_MAX_ENTRY       (1024)
+#define DNS_NEG_TTL_MS      (5 * 1000)
+#define DNS_DEFAULT_TTL_MS  (60 * 1000)
+#define DNS_DEFAULT_THREAD  (2)
+
+enum dns_state {
+    DNS_PENDING = 0,
+    DNS_DONE,
+};
+
+struct dns_waiter {
+    sock_dns_cb cb;
+    void *arg;
+    struct dns_waiter *next;
+};
+
+struct dns_entry {
+    char *host;
+    uint32_t hash;
+    enum dns_state state;
+    int err;
+    int naddr;
+    uint32_t addr[DNS_MAX_ADDR];
+    uint64_t expire;
+    struct dns_waiter *waiters;
+    struct dns_entry *next;
+    struct dns_entry *qnext;
+};
+
+struct sock_dns {
+    int running;
+    int nthread;
+    int ttl_ms;
+    size_t count;
+    struct sock_dns_stats stats;
+    struct thread **threads;
+    mutex_lock_t lock;
+    mutex_cond_t cond;
+    struct dns_entry *qhead;
+    struct dns_entry *qtail;
+    struct dns_entry *table[DNS_HASH_SIZE];
+};
+
+static uint64_t dns_now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static uint32_t dns_hash(const char *s)
+{
+    /* fnv-1a, host names are case insensitive */
+    uint32_t h = 2166136261u;
+    for (; *s; s++) {
+        h ^= (uint8_t)((*s >= 'A' && *s <= 'Z') ? *s + 32 : *s);
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/* build a list on caller stack, callback must copy what it keeps */
+static void dns_notify(const char *host, int err, const uint32_t *addr, int naddr,
+                struct dns_waiter *w)
+{
+    int i;
+    struct dns_waiter *next;
+    struct sock_addr_list al[DNS_MAX_ADDR];
+
+    memset(al, 0, sizeof(al));
+    for (i = 0; i < naddr; i++) {
+        al[i].addr.ip = addr[i];
+        sock_addr_ntop(al[i].addr.ip_str, addr[i]);
+        al[i].next = (i + 1 < naddr) ? &al[i + 1] : NULL;
+    }
+    for (; w; w = next) {
+        next = w->next;
+        w->cb(host, err, naddr ? al : NULL, w->arg);
+        free(w);
+    }
+}
+
+static int dns_query(const char *host, uint32_t *addr, int max)
+{
+    int n = 0, ret;
+    struct addrinfo hints, *res, *rp;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    ret = getaddrinfo(host, NULL, &hints, &res);
+    if (ret != 0) {
+        return ret;
+    }
+    for (rp = res; rp && n < max; rp = rp->ai_next) {
+        addr[n++] = ((struct sockaddr_in *)rp->ai_addr)->sin_addr.s_addr;
+    }
+    freeaddrinfo(res);
+    return n > 0 ? 0 : EAI_NONAME;
+}
+
+static void *dns_worker(struct thread *t, void *arg)
+{
+    int err, naddr;
+    char *host;
+    uint32_t addr[DNS_MAX_ADDR];
+    struct sock_dns *d = (struct sock_dns *)arg;
+    struct dns_entry *e;
+    struct dns_waiter *w;
+
+    mutex_lock(&d->lock);
+    while (d->running) {
+        e = d->qhead;
+        if (!e) {
+            mutex_cond_wait(&d->lock, &d->cond, 0);
+            continue;
+        }
+        d->qhead = e->qnext;
+        if (!d->qhead) {
+            d->qtail = NULL;
+        }
+        e->qnext = NULL;
+        /* entry may be evicted once done, keep own copy of name */
+        host = strdup(e->host);
+        mutex_unlock(&d->lock);
+        memset(addr, 0, sizeof(addr));
+        err = host ? dns_query(host, addr, DNS_MAX_ADDR) : EAI_MEMORY;
+        naddr = 0;
+        if (err == 0) {
+            while (naddr < DNS_MAX_ADDR && addr[naddr]) {
+                naddr++;
+            }
+        }
+        mutex_lock(&d->lock);
+        e->err = err;
+        e->naddr = naddr;
+        memcpy(e->addr, addr, sizeof(addr));
+        e->expire = dns_now_ms() + (err ? DNS_NEG_TTL_MS : d->ttl_ms);
+        e->state = DNS_DONE;
+        w = e->waiters;
+        e->waiters = NULL;
+        if (err) {
+            d->stats.failures++;
+        }
+        mutex_unlock(&d->lock);
+        dns_notify(host ? host : "", err, addr, naddr, w);
+        free(host);
+        mutex_lock(&d->lock);
+    }
+    mutex_unlock(&d->lock);
+    return NULL;
+}
+
+static void dns_entry_free(struct dns_entry *e)
+{
+    free(e->host);
+    free(e);
+}
+
+/* drop expired entries, called with lock held when cache is full */
+static void dns_evict(struct sock_dns *d, uint64_t now)
+{
+    int i;
+    struct dns_entry **pp, *e;
+    for (i = 0; i < DNS_HASH_SIZE; i++) {
+        pp = &d->table[i];
+        while ((e = *pp) != NULL) {
+            if (e->state == DNS_DONE && e->expire <= now) {
+                *pp = e->next;
+                dns_entry_free(e);
+                d->count--;
+                continue;
+            }
+            pp = &e->next;
+        }
+    }
+}
+
+struct sock_dns *sock_dns_create(int nthread, int ttl_ms)
+{
+    int i;
+    struct sock_dns *d = (struct sock_dns *)calloc(1, sizeof(struct sock_dns));
+    if (!d) {
+        printf("malloc sock_dns failed!\n");
+        return NULL;
+    }
+    d->nthread = (nthread > 0) ? nthread : DNS_DEFAULT_THREAD;
+    d->ttl_ms = (ttl_ms > 0) ? ttl_ms : DNS_DEFAULT_TTL_MS;
+    d->running = 1;
+    mutex_lock_init(&d->lock);
+    mutex_cond_init(&d->cond);
+    d->threads = (struct thread **)calloc(d->nthread, sizeof(struct thread *));
+    if (!d->threads) {
+        printf("malloc dns threads failed!\n");
+        goto failed;
+    }
+    for (i = 0; i < d->nthread; i++) {
+        d->threads[i] = thread_create(dns_worker, d);
+        if (!d->threads[i]) {
+            printf("dns thread_create failed!\n");
+            goto failed;
+        }
+    }
+    return d;
+
+failed:
+    sock_dns_destroy(d);
+    return NULL;
+}
+
+void sock_dns_destroy(struct sock_dns *d)
+{
+    int i;
+    struct dns_entry *e, *next;
+    if (!d) {
+        return;
+    }
+    mutex_lock(&d->lock);
+    d->running = 0;
+    mutex_cond_signal_all(&d->cond);
+    mutex_unlock(&d->lock);
+    for (i = 0; d->threads && i < d->nthread; i++) {
+        if (d->threads[i]) {
+            thread_join(d->threads[i]);
+            thread_destroy(d->threads[i]);
+        }
+    }
+    /* queries still queued are cancelled */
+    for (i = 0; i < DNS_HASH_SIZE; i++) {
+        for (e = d->table[i]; e; e = next) {
+            next = e->next;
+            if (e->waiters) {
+                dns_notify(e->host, EAI_AGAIN, NULL, 0, e->waiters);
+            }
+            dns_entry_free(e);
+        }
+    }
+    free(d->threads);
+    mutex_cond_deinit(&d->cond);
+    mutex_lock_deinit(&d->lock);
+    free(d);
+}
+
+int sock_dns_resolve(struct sock_dns *d, const char *host, sock_dns_cb cb, void *arg)
+{
+    uint32_t h, ip, addr[DNS_MAX_ADDR];
+    int err, naddr;
+    uint64_t now;
+    struct dns_entry *e;
+    struct dns_waiter *w;
+
+    if (!d || !host || !cb) {
+        printf("%s paraments invalid!\n", __func__);
+        return -1;
+    }
+    /* numeric address needs no lookup */
+    if (inet_pton(AF_INET, host, &ip) == 1) {
+        w = (struct dns_waiter *)calloc(1, sizeof(struct dns_waiter));
+        if (!w) {
+            return -1;
+        }
+        w->cb = cb;
+        w->arg = arg;
+        dns_notify(host, 0, &ip, 1, w);
+        return 0;
+    }
+    w = (struct dns_waiter *)calloc(1, sizeof(struct dns_waiter));
+    if (!w) {
+        printf("malloc dns_waiter failed!\n");
+        return -1;
+    }
+    w->cb = cb;
+    w->arg = arg;
+    h = dns_hash(host);
+    now = dns_now_ms();
+    mutex_lock(&d->lock);
+    for (e = d->table[h % DNS_HASH_SIZE]; e; e = e->next) {
+        if (e->hash == h && !strcasecmp(e->host, host)) {
+            break;
+        }
+    }
+    if (e && e->state == DNS_DONE && e->expire > now) {
+        d->stats.hits++;
+        err = e->err;
+        naddr = e->naddr;
+        memcpy(addr, e->addr, sizeof(addr));
+        mutex_unlock(&d->lock);
+        dns_notify(host, err, addr, naddr, w);
+        return 0;
+    }
+    if (e && e->state == DNS_PENDING) {
+        /* same name in flight, wait for that lookup */
+        d->stats.coalesced++;
+        w->next = e->waiters;
+        e->waiters = w;
+        mutex_unlock(&d->lock);
+        return 0;
+    }
+    d->stats.misses++;
+    if (!e) {
+        if (d->count >= DNS_MAX_ENTRY) {
+            dns_evict(d, now);
+        }
+        e = (struct dns_entry *)calloc(1, sizeof(struct dns_entry));
+        if (!e || !(e->host = strdup(host))) {
+            mutex_unlock(&d->lock);
+            printf("malloc dns_entry failed!\n");
+            free(e);
+            free(w);
+            return -1;
+        }
+        e->hash = h;
+        e->next = d->table[h % DNS_HASH_SIZE];
+        d->table[h % DNS_HASH_SIZE] = e;
+        d->count++;
+    }
+    e->state = DNS_PENDING;
+    e->waiters = w;
+    if (d->qtail) {
+        d->qtail->qnext = e;
+    } else {
+        d->qhead = e;
+    }
+    d->qtail = e;
+    mutex_cond_signal(&d->cond);
+    mutex_unlock(&d->lock);
+    return 0;
+}
+
+struct dns_sync {
+    int done;
+    int err;
+    uint32_t ip;
+    mutex_lock_t lock;
+    mutex_cond_t cond;
+};
+
+static void dns_sync_cb(const char *host, int err, const struct sock_addr_list *al, void *arg)
+{
+    struct dns_sync *s = (struct dns_sync *)arg;
+    mutex_lock(&s->lock);
+    s->err = err;
+    s->ip = al ? al->addr.ip : 0;
+    s->done = 1;
+    mutex_cond_signal(&s->cond);
+    mutex_unlock(&s->lock);
+}
+
+int sock_dns_lookup(struct sock_dns *d, const char *host, uint32_t *ip)
+{
+    struct dns_sync s;
+
+    memset(&s, 0, sizeof(s));
+    mutex_lock_init(&s.lock);
+    mutex_cond_init(&s.cond);
+    if (0 != sock_dns_resolve(d, host, dns_sync_cb, &s)) {
+        mutex_cond_deinit(&s.cond);
+        mutex_lock_deinit(&s.lock);
+        return -1;
+    }
+    mutex_lock(&s.lock);
+    while (!s.done) {
+        mutex_cond_wait(&s.lock, &s.cond, 0);
+    }
+    mutex_unlock(&s.lock);
+    mutex_cond_deinit(&s.cond);
+    mutex_lock_deinit(&s.lock);
+    if (s.err || !s.ip) {
+        return -1;
+    }
+    if (ip) {
+        *ip = s.ip;
+    }
+    return 0;
+}
+
+void sock_dns_flush(struct sock_dns *d)
+{
+    if (!d) {
+        return;
+    }
+    mutex_lock(&d->lock);
+    /* expire everything, pending lookups are kept */
+    dns_evict(d, UINT64_MAX);
+    mutex_unlock(&d->lock);
+}
+
+int sock_dns_get_stats(struct sock_dns *d, struct sock_dns_stats *stats)
+{
+    if (!d || !stats) {
+        return -1;
+    }
+    mutex_lock(&d->lock);
+    *stats = d->stats;
+    stats->entries = d->count;
+    mutex_unlock(&d->lock);
+    return 0;
+}
@@ -19,6 +19,9 @@
  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
  * SOFTWARE.
  ******************************************************************************/
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
 #include "libsock.h"
 #include <stdio.h>
 #include <stdlib.h>
@@ -33,6 +36,9 @@
 #include <sys/un.h>
 #include <sys/ioctl.h>
 #include <arpa/inet.h>
+#include <netinet/udp.h>
+#include <poll.h>
+#include <linux/errqueue.h>
 #elif defined (OS_RTOS)
 #include <net/if.h>
 #elif defined (OS_RTTHREAD)
@@ -47,6 +53,38 @@
 #define LISTEN_MAX_BACKLOG  (128)
 #define MTU                 (1500 - 42 - 200)
 #define MAX_RETRY_CNT       (3)
+#define SOCK_MMSG_BATCH     (64)
+#ifndef MSG_DONTWAIT
+#define MSG_DONTWAIT        (0)
+#endif
+#ifndef MSG_WAITFORONE
+#define MSG_WAITFORONE      (0)
+#endif
+#if defined (OS_LINUX)
+#ifndef SOL_UDP
+#define SOL_UDP             (17)
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT         (103)
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO             (104)
+#endif
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY         (60)
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY        (0x4000000)
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY       (5)
+#endif
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+#define SO_EE_CODE_ZEROCOPY_COPIED  (1)
+#endif
+#endif
+/* below it page pinning and completion cost more than the copy */
+#define SOCK_ZC_MIN_LEN     (16 * 1024)
 
 #define USE_IPV6    0
 
@@ -355,7 +393,9 @@ int sock_accept(uint64_t fd, uint32_t *ip, uint16_t *port)
     int afd = accept(fd, (struct sockaddr *)&si, &len);
 #endif
     if (afd == -1) {
-        printf("accept: %s\n", strerror(errno));
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            printf("accept: %s\n", strerror(errno));
+        }
         return -1;
     } else {
         *ip = si.sin_addr.s_addr;
@@ -374,6 +414,124 @@ void sock_close(int fd)
 #endif
 }
 
+int sock_set_tcp_nodelay(int fd, int enable)
+{
+    int on = !!enable;
+
+    if (-1 == setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on))) {
+        printf("setsockopt TCP_NODELAY: %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+int sock_set_tcp_cork(int fd, int enable)
+{
+    int on = !!enable;
+
+#if defined (TCP_CORK)
+    if (-1 == setsockopt(fd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on))) {
+        printf("setsockopt TCP_CORK: %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+#elif defined (TCP_NOPUSH)
+    if (-1 == setsockopt(fd, IPPROTO_TCP, TCP_NOPUSH, &on, sizeof(on))) {
+        printf("setsockopt TCP_NOPUSH: %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+#else
+    (void)on;
+    return -1;
+#endif
+}
+
+int sock_set_tcp_notsent_lowat(int fd, uint32_t bytes)
+{
+#if defined (TCP_NOTSENT_LOWAT)
+    if (-1 == setsockopt(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &bytes, sizeof(bytes))) {
+        printf("setsockopt TCP_NOTSENT_LOWAT: %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+int sock_set_pacing_rate(int fd, uint32_t bytes_per_sec)
+{
+#if defined (SO_MAX_PACING_RATE)
+    if (-1 == setsockopt(fd, SOL_SOCKET, SO_MAX_PACING_RATE,
+                         &bytes_per_sec, sizeof(bytes_per_sec))) {
+        printf("setsockopt SO_MAX_PACING_RATE: %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+int sock_set_tcp_congestion(int fd, const char *algo)
+{
+#if defined (TCP_CONGESTION)
+    if (!algo) {
+        return -1;
+    }
+    if (-1 == setsockopt(fd, IPPROTO_TCP, TCP_CONGESTION, algo, strlen(algo))) {
+        printf("setsockopt TCP_CONGESTION %s: %s\n", algo, strerror(errno));
+        return -1;
+    }
+    return 0;
+#else
+    (void)algo;
+    return -1;
+#endif
+}
+
+int sock_set_tcp_profile(int fd, enum sock_tcp_profile profile, uint32_t rate)
+{
+    int ok = 0, fail = 0;
+    uint32_t lowat;
+
+#define TCP_PROFILE_APPLY(x)    do { if (0 == (x)) ok++; else fail++; } while (0)
+    switch (profile) {
+    case SOCK_TCP_LOWLAT:
+        TCP_PROFILE_APPLY(sock_set_tcp_nodelay(fd, 1));
+        TCP_PROFILE_APPLY(sock_set_tcp_notsent_lowat(fd, 16 * 1024));
+        break;
+    case SOCK_TCP_MEDIA:
+        /*
+         * keep unsent data near 100ms of stream, late frames wait in
+         * application where they can still be dropped, not in kernel
+         */
+        lowat = rate ? MAX2(rate / 10, 32 * 1024) : 128 * 1024;
+        TCP_PROFILE_APPLY(sock_set_tcp_nodelay(fd, 1));
+        TCP_PROFILE_APPLY(sock_set_tcp_notsent_lowat(fd, lowat));
+        if (rate) {
+            /* some headroom over average rate for i-frame bursts */
+            TCP_PROFILE_APPLY(sock_set_pacing_rate(fd,
+                        rate > UINT32_MAX / 2 ? UINT32_MAX : rate * 2));
+        }
+        /* bbr keeps queues short on lossy uplinks, stay on default if absent */
+        TCP_PROFILE_APPLY(sock_set_tcp_congestion(fd, "bbr"));
+        break;
+    case SOCK_TCP_BULK:
+        TCP_PROFILE_APPLY(sock_set_tcp_nodelay(fd, 0));
+        TCP_PROFILE_APPLY(sock_set_buflen(fd, 1024 * 1024));
+        TCP_PROFILE_APPLY(sock_set_tcp_congestion(fd, "cubic"));
+        break;
+    case SOCK_TCP_DEFAULT:
+    default:
+        TCP_PROFILE_APPLY(sock_set_tcp_nodelay(fd, 0));
+        break;
+    }
+#undef TCP_PROFILE_APPLY
+    return (ok == 0 && fail > 0) ? -1 : 0;
+}
+
 #if defined (OS_LINUX)
 int sock_get_tcp_info(int fd, struct tcp_info *tcpi)
 {
@@ -826,6 +984,21 @@ int sock_set_buflen(int fd, int size)
     return 0;
 }
 
+int sock_set_mcast_ttl(int fd, uint8_t ttl)
+{
+#if defined (IP_MULTICAST_TTL)
+    int val = ttl;
+    if (-1 == setsockopt(fd, IPPROTO_IP, IP_MULTICAST_TTL,
+                         (const void *)&val, sizeof(val))) {
+        printf("setsockopt IP_MULTICAST_TTL: %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+#else
+    return -1;
+#endif
+}
+
 int sock_send(uint64_t fd, const void *buf, size_t len)
 {
     ssize_t n;
@@ -998,6 +1171,642 @@ int sock_recvfrom(int fd, uint32_t *ip, uint16_t *port, void *buf, size_t len)
     return (len - left);
 }
 
+static size_t iov_total(const struct iovec *iov, int iovcnt)
+{
+    int i;
+    size_t len = 0;
+    for (i = 0; i < iovcnt; i++) {
+        len += iov[i].iov_len;
+    }
+    return len;
+}
+
+#if defined (OS_LINUX)
+static int sock_sendmsg_all(int fd, struct sockaddr_in *sa,
+                const struct iovec *iov, int iovcnt)
+{
+    ssize_t n;
+    size_t off = 0, rest, total = 0;
+    int i, num, idx = 0, cnt = 0;
+    struct iovec vec[SOCK_IOV_MAX];
+    struct msghdr msg;
+
+    while (idx < iovcnt) {
+        if (off >= iov[idx].iov_len) {
+            idx++;
+            off = 0;
+            continue;
+        }
+        /* rebuild the window from the first unsent byte */
+        num = MIN2(iovcnt - idx, SOCK_IOV_MAX);
+        for (i = 0; i < num; i++) {
+            vec[i] = iov[idx + i];
+        }
+        vec[0].iov_base = (char *)vec[0].iov_base + off;
+        vec[0].iov_len -= off;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = vec;
+        msg.msg_iovlen = num;
+        if (sa) {
+            msg.msg_name = sa;
+            msg.msg_namelen = sizeof(*sa);
+        }
+        n = sendmsg(fd, &msg, 0);
+        if (n > 0) {
+            total += n;
+            while (n > 0 && idx < iovcnt) {
+                rest = iov[idx].iov_len - off;
+                if ((size_t)n < rest) {
+                    off += n;
+                    n = 0;
+                } else {
+                    n -= rest;
+                    idx++;
+                    off = 0;
+                }
+            }
+            continue;
+        } else if (n == 0) {
+            printf("%s peer connect shutdown\n", __func__);
+            return -1;
+        }
+        if (errno == EINTR || errno == EAGAIN) {
+            if (++cnt > MAX_RETRY_CNT) {
+                printf("reach max retry count\n");
+                break;
+            }
+            continue;
+        }
+        printf("%s: sendmsg failed: %d\n", __func__, errno);
+        return -1;
+    }
+    return total;
+}
+#endif
+
+int sock_sendv(int fd, const struct iovec *iov, int iovcnt)
+{
+#if !defined (OS_LINUX)
+    int i, n, total = 0;
+#endif
+    if (!iov || iovcnt <= 0 || iov_total(iov, iovcnt) == 0) {
+        printf("%s paraments invalid!\n", __func__);
+        return -1;
+    }
+#if defined (OS_LINUX)
+    return sock_sendmsg_all(fd, NULL, iov, iovcnt);
+#else
+    for (i = 0; i < iovcnt; i++) {
+        if (iov[i].iov_len == 0) {
+            continue;
+        }
+        n = sock_send(fd, iov[i].iov_base, iov[i].iov_len);
+        if (n < 0) {
+            return total > 0 ? total : -1;
+        }
+        total += n;
+        if (n < (int)iov[i].iov_len) {
+            break;
+        }
+    }
+    return total;
+#endif
+}
+
+int sock_sendtov(int fd, const char *ip, uint16_t port,
+                const struct iovec *iov, int iovcnt)
+{
+#if defined (OS_LINUX)
+    struct sockaddr_in sa;
+#else
+    int i;
+    size_t off = 0;
+    char buf[MTU];
+#endif
+    if (!iov || iovcnt <= 0 || iovcnt > SOCK_IOV_MAX) {
+        printf("%s paraments invalid!\n", __func__);
+        return -1;
+    }
+#if defined (OS_LINUX)
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = ip?inet_addr(ip):INADDR_ANY;
+    sa.sin_port = htons(port);
+    return sock_sendmsg_all(fd, &sa, iov, iovcnt);
+#else
+    /* no sendmsg, gather into one datagram */
+    if (iov_total(iov, iovcnt) > sizeof(buf)) {
+        printf("%s datagram too large!\n", __func__);
+        return -1;
+    }
+    for (i = 0; i < iovcnt; i++) {
+        memcpy(buf + off, iov[i].iov_base, iov[i].iov_len);
+        off += iov[i].iov_len;
+    }
+    return sock_sendto(fd, ip, port, buf, off);
+#endif
+}
+
+/*
+ * scatter one recv into iov, return as sock_recv
+ */
+int sock_recvv(int fd, const struct iovec *iov, int iovcnt)
+{
+    int n, cnt = 0;
+#if defined (OS_LINUX)
+    struct msghdr msg;
+#endif
+    if (!iov || iovcnt <= 0 || iovcnt > SOCK_IOV_MAX) {
+        printf("%s paraments invalid!\n", __func__);
+        return -1;
+    }
+    while (1) {
+#if defined (OS_LINUX)
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = (struct iovec *)iov;
+        msg.msg_iovlen = iovcnt;
+        n = recvmsg(fd, &msg, 0);
+#else
+        n = recv(fd, iov[0].iov_base, iov[0].iov_len, 0);
+#endif
+        if (n >= 0) {
+            return n;
+        }
+        if (errno == EINTR || errno == EAGAIN) {
+            if (++cnt > MAX_RETRY_CNT) {
+                break;
+            }
+            continue;
+        }
+        perror("recvmsg");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * return number of datagrams sent, may be less than num when socket buffer
+ * is full, 0 if nothing can be sent now, -1 on error
+ */
+int sock_sendmmsg(int fd, struct sock_msg *msgs, int num)
+{
+    int i, n, batch, sent = 0;
+#if defined (OS_LINUX)
+    struct mmsghdr hdr[SOCK_MMSG_BATCH];
+    struct iovec iov[SOCK_MMSG_BATCH];
+    struct sockaddr_in sa[SOCK_MMSG_BATCH];
+    char ctrl[SOCK_MMSG_BATCH][CMSG_SPACE(sizeof(uint16_t))];
+    struct cmsghdr *cm;
+#else
+    int off, seg;
+    struct sockaddr_in sa;
+#endif
+
+    if (!msgs || num <= 0) {
+        printf("%s paraments invalid!\n", __func__);
+        return -1;
+    }
+#if defined (OS_LINUX)
+    while (sent < num) {
+        batch = MIN2(num - sent, SOCK_MMSG_BATCH);
+        memset(hdr, 0, sizeof(struct mmsghdr) * batch);
+        for (i = 0; i < batch; i++) {
+            struct sock_msg *m = &msgs[sent + i];
+            iov[i].iov_base = m->buf;
+            iov[i].iov_len = m->len;
+            hdr[i].msg_hdr.msg_iov = &iov[i];
+            hdr[i].msg_hdr.msg_iovlen = 1;
+            if (m->ip) {
+                sa[i].sin_family = AF_INET;
+                sa[i].sin_addr.s_addr = m->ip;
+                sa[i].sin_port = htons(m->port);
+                hdr[i].msg_hdr.msg_name = &sa[i];
+                hdr[i].msg_hdr.msg_namelen = sizeof(sa[i]);
+            }
+            if (m->segment && m->len > m->segment) {
+                /* per message gso size, overrides sock_set_udp_gso */
+                memset(ctrl[i], 0, sizeof(ctrl[i]));
+                hdr[i].msg_hdr.msg_control = ctrl[i];
+                hdr[i].msg_hdr.msg_controllen = sizeof(ctrl[i]);
+                cm = CMSG_FIRSTHDR(&hdr[i].msg_hdr);
+                cm->cmsg_level = SOL_UDP;
+                cm->cmsg_type = UDP_SEGMENT;
+                cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+                memcpy(CMSG_DATA(cm), &m->segment, sizeof(uint16_t));
+            }
+        }
+        n = sendmmsg(fd, hdr, batch, 0);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            if (sent > 0) {
+                /* report error on next call */
+                break;
+            }
+            printf("%s: sendmmsg failed: %d\n", __func__, errno);
+            return -1;
+        }
+        sent += n;
+        if (n < batch) {
+            break;
+        }
+    }
+#else
+    for (i = 0; i < num; i++) {
+        sa.sin_family = AF_INET;
+        sa.sin_addr.s_addr = msgs[i].ip;
+        sa.sin_port = htons(msgs[i].port);
+        /* no gso, split segments by hand */
+        seg = msgs[i].segment ? msgs[i].segment : (int)msgs[i].len;
+        off = 0;
+        do {
+            n = sendto(fd, (char *)msgs[i].buf + off, MIN2(seg, (int)msgs[i].len - off), 0,
+                       msgs[i].ip ? (struct sockaddr *)&sa : NULL,
+                       msgs[i].ip ? sizeof(sa) : 0);
+            off += seg;
+        } while (n >= 0 && off < (int)msgs[i].len);
+        if (n < 0) {
+            if (sent > 0 || errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            printf("%s: sendto failed: %d\n", __func__, errno);
+            return -1;
+        }
+        sent++;
+    }
+    (void)batch;
+#endif
+    return sent;
+}
+
+/*
+ * wait for the first datagram unless nonblock, then take all which are
+ * already queued up to num, return number of datagrams received, 0 if
+ * nonblock and nothing queued, -1 on error
+ */
+int sock_recvmmsg(int fd, struct sock_msg *msgs, int num, int nonblock)
+{
+    int i, n, batch, recvd = 0;
+    int flags = nonblock ? MSG_DONTWAIT : MSG_WAITFORONE;
+#if defined (OS_LINUX)
+    struct mmsghdr hdr[SOCK_MMSG_BATCH];
+    struct iovec iov[SOCK_MMSG_BATCH];
+    struct sockaddr_in sa[SOCK_MMSG_BATCH];
+    char ctrl[SOCK_MMSG_BATCH][CMSG_SPACE(sizeof(int))];
+    struct cmsghdr *cm;
+    int gso;
+#else
+    struct sockaddr_in sa;
+    socklen_t sa_len;
+#endif
+
+    if (!msgs || num <= 0) {
+        printf("%s paraments invalid!\n", __func__);
+        return -1;
+    }
+#if defined (OS_LINUX)
+    while (recvd < num) {
+        batch = MIN2(num - recvd, SOCK_MMSG_BATCH);
+        memset(hdr, 0, sizeof(struct mmsghdr) * batch);
+        for (i = 0; i < batch; i++) {
+            iov[i].iov_base = msgs[recvd + i].buf;
+            iov[i].iov_len = msgs[recvd + i].len;
+            hdr[i].msg_hdr.msg_iov = &iov[i];
+            hdr[i].msg_hdr.msg_iovlen = 1;
+            hdr[i].msg_hdr.msg_name = &sa[i];
+            hdr[i].msg_hdr.msg_namelen = sizeof(sa[i]);
+            hdr[i].msg_hdr.msg_control = ctrl[i];
+            hdr[i].msg_hdr.msg_controllen = sizeof(ctrl[i]);
+        }
+        n = recvmmsg(fd, hdr, batch, flags, NULL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK || recvd > 0) {
+                break;
+            }
+            printf("%s: recvmmsg failed: %d\n", __func__, errno);
+            return -1;
+        }
+        for (i = 0; i < n; i++) {
+            struct sock_msg *m = &msgs[recvd + i];
+            m->len = hdr[i].msg_len;
+            m->ip = sa[i].sin_addr.s_addr;
+            m->port = ntohs(sa[i].sin_port);
+            m->truncated = !!(hdr[i].msg_hdr.msg_flags & MSG_TRUNC);
+            m->segment = 0;
+            for (cm = CMSG_FIRSTHDR(&hdr[i].msg_hdr); cm;
+                 cm = CMSG_NXTHDR(&hdr[i].msg_hdr, cm)) {
+                if (cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO) {
+                    memcpy(&gso, CMSG_DATA(cm), sizeof(int));
+                    m->segment = (uint16_t)gso;
+                }
+            }
+        }
+        recvd += n;
+        if (n < batch) {
+            break;
+        }
+        /* got first one, only take what is queued from now on */
+        flags = MSG_DONTWAIT;
+    }
+#else
+    for (i = 0; i < num; i++) {
+        sa_len = sizeof(sa);
+        memset(&sa, 0, sizeof(sa));
+        n = recvfrom(fd, msgs[i].buf, msgs[i].len, i == 0 ? (nonblock ? MSG_DONTWAIT : 0) : MSG_DONTWAIT,
+                     (struct sockaddr *)&sa, &sa_len);
+        if (n < 0) {
+            if (recvd > 0 || errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            printf("%s: recvfrom failed: %d\n", __func__, errno);
+            return -1;
+        }
+        msgs[i].len = n;
+        msgs[i].ip = sa.sin_addr.s_addr;
+        msgs[i].port = ntohs(sa.sin_port);
+        msgs[i].truncated = 0;
+        msgs[i].segment = 0;
+        recvd++;
+    }
+    (void)batch;
+    (void)flags;
+#endif
+    return recvd;
+}
+
+int sock_set_udp_gso(int fd, uint16_t segment)
+{
+#if defined (OS_LINUX)
+    int val = segment;
+    if (-1 == setsockopt(fd, SOL_UDP, UDP_SEGMENT, &val, sizeof(val))) {
+        printf("setsockopt UDP_SEGMENT: %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+int sock_set_udp_gro(int fd, int enable)
+{
+#if defined (OS_LINUX)
+    int on = !!enable;
+    if (-1 == setsockopt(fd, SOL_UDP, UDP_GRO, &on, sizeof(on))) {
+        printf("setsockopt UDP_GRO: %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+int sock_zc_init(struct sock_zc *zc, int fd)
+{
+    int on = 1;
+    if (!zc) {
+        printf("%s paraments invalid!\n", __func__);
+        return -1;
+    }
+    memset(zc, 0, sizeof(*zc));
+    zc->fd = fd;
+#if defined (OS_LINUX)
+    if (0 == setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on))) {
+        zc->enable = 1;
+        return 0;
+    }
+    printf("setsockopt SO_ZEROCOPY: %s\n", strerror(errno));
+#endif
+    (void)on;
+    return -1;
+}
+
+/*
+ * return bytes sent as sock_send, *seq is the last zerocopy send of buf,
+ * or an already completed seq if buf was copied
+ */
+static int zc_send(struct sock_zc *zc, const void *buf, size_t len, uint32_t *seq,
+                int allow)
+{
+    ssize_t n;
+    int flags, used = 0, cnt = 0;
+    const char *p = (const char *)buf;
+    size_t left = len;
+
+    if (!zc || !buf || len == 0) {
+        printf("%s paraments invalid!\n", __func__);
+        return -1;
+    }
+    flags = (allow && zc->enable && len >= SOCK_ZC_MIN_LEN) ? MSG_ZEROCOPY : 0;
+    while (left > 0) {
+        n = send(zc->fd, p, left, flags);
+        if (n > 0) {
+            p += n;
+            left -= n;
+            if (flags) {
+                /* kernel numbers each successful zerocopy send */
+                zc->next++;
+                used = 1;
+            }
+            continue;
+        }
+        if (n < 0 && errno == ENOBUFS && flags) {
+            /* optmem limit of pinned pages reached, copy the rest */
+            flags = 0;
+            continue;
+        }
+        if (n < 0 && (errno == EINTR || errno == EAGAIN)) {
+            if (++cnt > MAX_RETRY_CNT) {
+                printf("reach max retry count\n");
+                break;
+            }
+            continue;
+        }
+        printf("send failed(%d): %s\n", errno, strerror(errno));
+        return -1;
+    }
+    if (seq) {
+        *seq = used ? zc->next - 1 : zc->done - 1;
+    }
+    return (len - left);
+}
+
+int sock_zc_send(struct sock_zc *zc, const void *buf, size_t len, uint32_t *seq)
+{
+    return zc_send(zc, buf, len, seq, 1);
+}
+
+#define ZC_PEND_COUNT(zc)   ((zc)->pend_tail - (zc)->pend_head)
+#define ZC_PEND_SLOT(zc, i) (&(zc)->pend[(i) % SOCK_ZC_PENDING_MAX])
+
+/* tcp completes in order, the queue is released from its head */
+static void zc_release_done(struct sock_zc *zc)
+{
+    struct sock_zc_pending *pd;
+    while (ZC_PEND_COUNT(zc) > 0) {
+        pd = ZC_PEND_SLOT(zc, zc->pend_head);
+        if ((int32_t)(zc->done - pd->seq) <= 0) {
+            break;
+        }
+        /* pop before callback, it may send again */
+        zc->pend_head++;
+        pd->release(pd->arg);
+    }
+}
+
+int sock_zc_send_release(struct sock_zc *zc, const void *buf, size_t len,
+                sock_zc_release_cb release, void *arg)
+{
+    int n, allow = 1;
+    uint32_t seq;
+    struct sock_zc_pending *pd;
+
+    if (!zc || !release) {
+        printf("%s paraments invalid!\n", __func__);
+        return -1;
+    }
+    if (ZC_PEND_COUNT(zc) == SOCK_ZC_PENDING_MAX) {
+        sock_zc_reap(zc);
+        if (ZC_PEND_COUNT(zc) == SOCK_ZC_PENDING_MAX) {
+            /* nowhere to remember it, copy so buf is free on return */
+            allow = 0;
+        }
+    }
+    n = zc_send(zc, buf, len, &seq, allow);
+    if (n < 0) {
+        return -1;
+    }
+    if (sock_zc_done(zc, seq)) {
+        release(arg);
+        return n;
+    }
+    pd = ZC_PEND_SLOT(zc, zc->pend_tail);
+    pd->seq = seq;
+    pd->release = release;
+    pd->arg = arg;
+    zc->pend_tail++;
+    return n;
+}
+
+void sock_zc_release_all(struct sock_zc *zc)
+{
+    struct sock_zc_pending *pd;
+    if (!zc) {
+        return;
+    }
+    while (ZC_PEND_COUNT(zc) > 0) {
+        pd = ZC_PEND_SLOT(zc, zc->pend_head);
+        zc->pend_head++;
+        pd->release(pd->arg);
+    }
+}
+
+/*
+ * drain completion notifications from error queue, return how many were
+ * reaped, tcp completes in order so one range covers everything before it
+ */
+int sock_zc_reap(struct sock_zc *zc)
+{
+    int n = 0;
+#if defined (OS_LINUX)
+    struct msghdr msg;
+    struct cmsghdr *cm;
+    struct sock_extended_err *ee;
+    char ctrl[CMSG_SPACE(sizeof(struct sock_extended_err) + sizeof(struct sockaddr_in6))];
+
+    if (!zc) {
+        return -1;
+    }
+    while (1) {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = ctrl;
+        msg.msg_controllen = sizeof(ctrl);
+        if (-1 == recvmsg(zc->fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT)) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            printf("recvmsg MSG_ERRQUEUE failed(%d): %s\n", errno, strerror(errno));
+            return -1;
+        }
+        for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+            if (!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) &&
+                !(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)) {
+                continue;
+            }
+            ee = (struct sock_extended_err *)CMSG_DATA(cm);
+            if (ee->ee_errno != 0 || ee->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                continue;
+            }
+            /* ee_info..ee_data is the completed seq range */
+            if ((int32_t)(ee->ee_data + 1 - zc->done) > 0) {
+                zc->done = ee->ee_data + 1;
+            }
+            if (ee->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                /* e.g. loopback or nic without sg, zerocopy only costs more */
+                zc->copied++;
+                zc->enable = 0;
+            }
+            n++;
+        }
+    }
+    zc_release_done(zc);
+#endif
+    return n;
+}
+
+int sock_zc_done(struct sock_zc *zc, uint32_t seq)
+{
+    if (!zc) {
+        return -1;
+    }
+    return (int32_t)(zc->done - seq) > 0;
+}
+
+/*
+ * wait until seq is completed, return 0 on done, -1 on timeout or error
+ */
+int sock_zc_wait(struct sock_zc *zc, uint32_t seq, int timeout_ms)
+{
+#if defined (OS_LINUX)
+    int n, err = 0;
+    socklen_t len = sizeof(err);
+    struct pollfd pfd;
+    if (!zc) {
+        return -1;
+    }
+    while (!sock_zc_done(zc, seq)) {
+        pfd.fd = zc->fd;
+        pfd.events = 0;
+        pfd.revents = 0;
+        /* error queue readable is reported as POLLERR */
+        if (poll(&pfd, 1, timeout_ms) <= 0) {
+            return -1;
+        }
+        n = sock_zc_reap(zc);
+        if (n == -1 || (n == 0 && (pfd.revents & (POLLHUP | POLLNVAL)))) {
+            return -1;
+        }
+        if (n == 0 && 0 == getsockopt(zc->fd, SOL_SOCKET, SO_ERROR, &err, &len) && err) {
+            /* pending socket error, not a completion */
+            return -1;
+        }
+    }
+    return 0;
+#else
+    return sock_zc_done(zc, seq) ? 0 : -1;
+#endif
+}
+
 #ifdef ENABLE_PTCP
 uint64_t sock_ptcp_bind_listen(const char *host, uint16_t port)
 {
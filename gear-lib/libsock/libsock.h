@@ -92,6 +92,65 @@ GEAR_API struct sock_connection *sock_accept_connect(int fd);
 struct sock_connection *sock_udp_connect(const char *host, uint16_t port);
 int sock_udp_bind(const char *host, uint16_t port);
 
+//socket udp batch apis, one syscall for many datagrams
+typedef struct sock_msg {
+    void *buf;
+    size_t len;         /* send: datagram length, recv: buffer size, set to datagram length */
+    uint32_t ip;        /* network order as sock_recvfrom, 0 for connected socket when send */
+    uint16_t port;
+    int truncated;      /* recv: datagram was larger than buffer */
+    uint16_t segment;   /* send: gso segment size, recv: gro segment size, 0 if none */
+} sock_msg_t;
+
+int sock_sendmmsg(int fd, struct sock_msg *msgs, int num);
+int sock_recvmmsg(int fd, struct sock_msg *msgs, int num, int nonblock);
+
+/*
+ * udp segmentation offload, one send of up to 64 segments is split by kernel
+ * or nic, gro coalesces received datagrams of one flow into one buffer,
+ * return -1 if not supported by kernel
+ */
+int sock_set_udp_gso(int fd, uint16_t segment);
+int sock_set_udp_gro(int fd, int enable);
+
+/*
+ * MSG_ZEROCOPY tcp send, pages of buf are pinned and sent without copy,
+ * buf must not be changed or freed until sock_zc_done(zc, seq) is true,
+ * small payloads and kernels without SO_ZEROCOPY fall back to copy send.
+ * sock_zc_send_release calls release(arg) instead once buf is free again,
+ * from sock_zc_reap/sock_zc_wait, or at once if it was copied
+ */
+#define SOCK_ZC_PENDING_MAX (64)
+
+typedef void (*sock_zc_release_cb)(void *arg);
+
+struct sock_zc_pending {
+    uint32_t seq;
+    sock_zc_release_cb release;
+    void *arg;
+};
+
+typedef struct sock_zc {
+    int fd;
+    int enable;
+    uint32_t next;      /* seq of next zerocopy send */
+    uint32_t done;      /* all seq before it are completed */
+    uint32_t copied;    /* completions where kernel had to copy anyway */
+    uint32_t pend_head;
+    uint32_t pend_tail;
+    struct sock_zc_pending pend[SOCK_ZC_PENDING_MAX];
+} sock_zc_t;
+
+int sock_zc_init(struct sock_zc *zc, int fd);
+int sock_zc_send(struct sock_zc *zc, const void *buf, size_t len, uint32_t *seq);
+int sock_zc_send_release(struct sock_zc *zc, const void *buf, size_t len,
+                sock_zc_release_cb release, void *arg);
+/* call release of every pending send, only after fd is closed */
+void sock_zc_release_all(struct sock_zc *zc);
+int sock_zc_reap(struct sock_zc *zc);
+int sock_zc_done(struct sock_zc *zc, uint32_t seq);
+int sock_zc_wait(struct sock_zc *zc, uint32_t seq, int timeout_ms);
+
 //socket unix domain apis
 struct sock_connection *sock_unix_connect(const char *host, uint16_t port);
 int sock_unix_bind_listen(const char *host, uint16_t port);
@@ -107,6 +166,17 @@ int sock_send_sync_recv(int fd, const void *sbuf, size_t slen,
 int sock_recv(uint64_t fd, void *buf, size_t len);
 int sock_recvfrom(int fd, uint32_t *ip, uint16_t *port, void *buf, size_t len);
 
+/*
+ * vectored io, header and payload go out in one syscall without copying
+ * them together, sock_sendv retries partial writes as sock_send,
+ * sock_sendtov sends one datagram of at most SOCK_IOV_MAX pieces
+ */
+#define SOCK_IOV_MAX    (64)
+int sock_sendv(int fd, const struct iovec *iov, int iovcnt);
+int sock_sendtov(int fd, const char *ip, uint16_t port,
+                const struct iovec *iov, int iovcnt);
+int sock_recvv(int fd, const struct iovec *iov, int iovcnt);
+
 uint32_t sock_addr_pton(const char *ip);
 int sock_addr_ntop(char *str, uint32_t ip);
 
@@ -116,6 +186,33 @@ int sock_set_nonblock(int fd);
 int sock_set_reuse(int fd, int enable);
 int sock_set_tcp_keepalive(int fd, int enable);
 int sock_set_buflen(int fd, int len);
+int sock_set_mcast_ttl(int fd, uint8_t ttl);
+
+int sock_set_tcp_nodelay(int fd, int enable);
+int sock_set_tcp_cork(int fd, int enable);
+int sock_set_tcp_notsent_lowat(int fd, uint32_t bytes);
+int sock_set_pacing_rate(int fd, uint32_t bytes_per_sec);
+/* TCP_CONGESTION, algo like "bbr" or "cubic", must be loaded in kernel */
+int sock_set_tcp_congestion(int fd, const char *algo);
+
+/*
+ * tcp tuning profiles:
+ * LOWLAT: nodelay and shallow unsent queue, for signaling like rtsp
+ * MEDIA:  nodelay, unsent queue bounded to about 100ms of rate and paced
+ *         to rate, bbr congestion control if available, for interleaved
+ *         rtp and rtmp push, rate is bytes/s, 0 if unknown
+ * BULK:   nagle on, big buffers and cubic, for file transfer
+ * options not supported by kernel are skipped, return -1 only if none
+ * of them could be applied
+ */
+enum sock_tcp_profile {
+    SOCK_TCP_DEFAULT = 0,
+    SOCK_TCP_LOWLAT,
+    SOCK_TCP_MEDIA,
+    SOCK_TCP_BULK,
+};
+
+int sock_set_tcp_profile(int fd, enum sock_tcp_profile profile, uint32_t rate);
 
 #if defined (OS_LINUX)
 int sock_get_tcp_info(int fd, struct tcp_info *ti);
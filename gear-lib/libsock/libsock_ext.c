@@ -26,6 +26,11 @@
 #include "libptcp.h"
 #endif
 #include <errno.h>
+#include <unistd.h>
+#include <string.h>
+#if defined (OS_LINUX)
+#include <poll.h>
+#endif
 
 static void on_error(int fd, void *arg)
 {
@@ -35,11 +40,11 @@ static void on_error(int fd, void *arg)
 static void on_recv(int fd, void *arg)
 {
     struct sock_server *s;
-    char buf[2048];
+    char buf[GEAR_CONFIG_RECV_BUF_SIZE];
     int ret=0;
     memset(buf, 0, sizeof(buf));
-    s = (struct sock_server *)arg;
-    ret = sock_recv(fd, buf, 2048);
+    s = ((struct sock_shard *)arg)->server;
+    ret = sock_recv(fd, buf, sizeof(buf));
     if (ret > 0) {
         s->on_buffer(s, buf, ret);
     } else if (ret == 0) {
@@ -55,19 +60,21 @@ static void on_recv(int fd, void *arg)
 static void on_client_recv(int fd, void *arg)
 {
     struct sock_client *c;
-    char buf[2048];
+    char buf[GEAR_CONFIG_RECV_BUF_SIZE];
     int ret=0;
     memset(buf, 0, sizeof(buf));
     c = (struct sock_client *)arg;
-    ret = sock_recv(fd, buf, 2048);
+    ret = sock_recv(fd, buf, sizeof(buf));
     if (ret > 0) {
         c->on_buffer(c, buf, ret);
     } else if (ret == 0) {
         printf("delete connection fd:%d\n", fd);
+        c->broken = true;
         if (c->on_disconnect) {
             c->on_disconnect(c, NULL);
         }
     } else if (ret < 0) {
+        c->broken = true;
         printf("%s:%d recv failed!\n", __func__, __LINE__);
     }
 }
@@ -75,11 +82,11 @@ static void on_client_recv(int fd, void *arg)
 #ifdef ENABLE_PTCP
 static void on_ptcp_recv(int fd, void *arg)
 {
-    char buf[2048];
+    char buf[GEAR_CONFIG_RECV_BUF_SIZE];
     int ret=0;
     memset(buf, 0, sizeof(buf));
-    struct sock_server *s = (struct sock_server *)arg;
-    ret = sock_recv(s->fd64, buf, 2048);
+    struct sock_server *s = ((struct sock_shard *)arg)->server;
+    ret = sock_recv(s->fd64, buf, sizeof(buf));
     if (ret > 0) {
         s->on_buffer(fd, buf, ret);
     } else if (ret == 0) {
@@ -93,34 +100,188 @@ static void on_ptcp_recv(int fd, void *arg)
 }
 #endif
 
+static struct mem_account conn_mem = MEM_ACCOUNT_INIT("sock_server_conn");
+
+static void server_conn_free(struct sock_server_conn *c)
+{
+    struct sock_shard *sh = c->shard;
+    if (c->prev) {
+        c->prev->next = c->next;
+    } else {
+        sh->conns = c->next;
+    }
+    if (c->next) {
+        c->next->prev = c->prev;
+    }
+    sh->nconn--;
+    gevent_conn_destroy(c->gc);
+    free(c);
+    mem_account_charge(&conn_mem, -(int64_t)sizeof(struct sock_server_conn), -1);
+}
+
+static void server_conn_on_read(struct gevent_conn *gc, void *arg)
+{
+    size_t len, n;
+    void *buf;
+    struct sock_server_conn *c = (struct sock_server_conn *)arg;
+    struct sock_server *s = c->server;
+
+    buf = gevent_conn_peek(gc, &len);
+    c->in_cb = true;
+    n = s->conn_cbs.on_data(c, buf, len);
+    c->in_cb = false;
+    if (c->closed) {
+        /* closed by user in on_data, free it now it is not used any more */
+        server_conn_free(c);
+        return;
+    }
+    gevent_conn_consume(gc, MIN2(n, len));
+}
+
+static void server_conn_on_drain(struct gevent_conn *gc, void *arg)
+{
+    struct sock_server_conn *c = (struct sock_server_conn *)arg;
+    struct sock_server *s = c->server;
+    if (!c->closed && s->conn_cbs.on_drain) {
+        c->in_cb = true;
+        s->conn_cbs.on_drain(c);
+        c->in_cb = false;
+        if (c->closed) {
+            server_conn_free(c);
+        }
+    }
+}
+
+static void server_conn_on_close(struct gevent_conn *gc, int err, void *arg)
+{
+    struct sock_server_conn *c = (struct sock_server_conn *)arg;
+    struct sock_server *s = c->server;
+    bool in_cb = c->in_cb;
+    if (c->closed) {
+        return;
+    }
+    c->closed = true;
+    c->in_cb = true;
+    if (s->conn_cbs.on_close) {
+        s->conn_cbs.on_close(c, err);
+    }
+    c->in_cb = in_cb;
+    /* write failure inside user callback, free when callback returns */
+    if (!in_cb) {
+        server_conn_free(c);
+    }
+}
+
+static void server_conn_open(struct sock_shard *sh, int afd, uint32_t ip, uint16_t port)
+{
+    struct sock_server *s = sh->server;
+    struct sock_server_conn *c;
+    struct gevent_conn_cbs cbs = {
+        .on_read  = server_conn_on_read,
+        .on_drain = server_conn_on_drain,
+        .on_close = server_conn_on_close,
+    };
+
+    c = calloc(1, sizeof(struct sock_server_conn));
+    if (!c) {
+        printf("malloc sock_server_conn failed!\n");
+        sock_close(afd);
+        return;
+    }
+    c->server = s;
+    c->shard = sh;
+    c->info.fd = afd;
+    c->info.type = SOCK_STREAM;
+    if (-1 == sock_getaddr_by_fd(afd, &c->info.local)) {
+        printf("sock_getaddr_by_fd failed: %s\n", strerror(errno));
+    }
+    c->info.remote.ip = ip;
+    c->info.remote.port = port;
+    sock_addr_ntop(c->info.remote.ip_str, ip);
+    c->gc = gevent_conn_create(sh->evbase, afd, &cbs, c);
+    if (!c->gc) {
+        printf("gevent_conn_create failed!\n");
+        sock_close(afd);
+        free(c);
+        return;
+    }
+    c->next = sh->conns;
+    if (sh->conns) {
+        sh->conns->prev = c;
+    }
+    sh->conns = c;
+    sh->nconn++;
+    mem_account_charge(&conn_mem, sizeof(struct sock_server_conn), 1);
+    if (s->conn_cbs.on_open) {
+        c->in_cb = true;
+        s->conn_cbs.on_open(c);
+        c->in_cb = false;
+        if (c->closed) {
+            server_conn_free(c);
+        }
+    }
+}
+
+int sock_server_conn_write(struct sock_server_conn *c, const void *buf, size_t len)
+{
+    if (!c || c->closed) {
+        return -1;
+    }
+    return gevent_conn_write(c->gc, buf, len);
+}
+
+size_t sock_server_conn_pending(struct sock_server_conn *c)
+{
+    return c ? gevent_conn_pending(c->gc) : 0;
+}
+
+void sock_server_conn_close(struct sock_server_conn *c)
+{
+    if (!c || c->closed) {
+        return;
+    }
+    server_conn_on_close(c->gc, 0, c);
+}
+
 static void on_tcp_connect(int fd, void *arg)
 {
     int afd;
     uint32_t ip;
     uint16_t port;
     struct gevent *e = NULL;
-    struct sock_server *s = (struct sock_server *)arg;
+    struct sock_shard *sh = (struct sock_shard *)arg;
+    struct sock_server *s = sh->server;
     struct sock_connection sc;
 
-    afd = sock_accept(fd, &ip, &port);
-    if (afd == -1) {
-        printf("errno=%d %s\n", errno, strerror(errno));
-        return;
-    }
-    if (s->on_connect) {
-        sc.fd = afd;
-        sc.type = SOCK_STREAM;
-        if (-1 == sock_getaddr_by_fd(sc.fd, &sc.local)) {
-            printf("sock_getaddr_by_fd failed: %s\n", strerror(errno));
+    /* listen fd is nonblock, take all pending connections of this edge */
+    while (1) {
+        afd = sock_accept(fd, &ip, &port);
+        if (afd == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                printf("errno=%d %s\n", errno, strerror(errno));
+            }
+            return;
+        }
+        if (s->conn_cbs.on_data) {
+            server_conn_open(sh, afd, ip, port);
+            continue;
+        }
+        if (s->on_connect) {
+            sc.fd = afd;
+            sc.type = SOCK_STREAM;
+            if (-1 == sock_getaddr_by_fd(sc.fd, &sc.local)) {
+                printf("sock_getaddr_by_fd failed: %s\n", strerror(errno));
+            }
+            sc.remote.ip = ip;
+            sc.remote.port = port;
+            sock_addr_ntop(sc.remote.ip_str, ip);
+            s->on_connect(s, &sc);
+        }
+        /* connection stays in the loop of the shard which accepted it */
+        e = gevent_create(afd, on_recv, NULL, on_error, sh);
+        if (-1 == gevent_add(sh->evbase, &e)) {
+            printf("event_add failed!\n");
         }
-        sc.remote.ip = ip;
-        sc.remote.port = port;
-        sock_addr_ntop(sc.remote.ip_str, ip);
-        s->on_connect(s, &sc);
-    }
-    e = gevent_create(afd, on_recv, NULL, on_error, s);
-    if (-1 == gevent_add(s->evbase, &e)) {
-        printf("event_add failed!\n");
     }
 }
 
@@ -131,7 +292,8 @@ static void on_ptcp_connect(int fd, void *arg)
     uint32_t ip;
     uint16_t port;
     struct gevent *e = NULL;
-    struct sock_server *s = (struct sock_server *)arg;
+    struct sock_shard *sh = (struct sock_shard *)arg;
+    struct sock_server *s = sh->server;
     struct sock_connection sc;
 
     afd = sock_accept(s->fd64, &ip, &port);
@@ -150,105 +312,226 @@ static void on_ptcp_connect(int fd, void *arg)
         sock_addr_ntop(sc.remote.ip_str, ip);
         s->on_connect(fd, &sc);
     }
-    e = gevent_create(afd, on_ptcp_recv, NULL, on_error, s);
+    e = gevent_create(afd, on_ptcp_recv, NULL, on_error, sh);
     if (-1 == gevent_mod(s->evbase, &e)) {
         printf("event_add failed!\n");
     }
 }
 #endif
 
+static int sock_server_listen(const char *host, uint16_t port, enum sock_type type)
+{
+    int fd = -1;
+    switch (type) {
+    case SOCK_TYPE_TCP:
+        fd = sock_tcp_bind_listen(host, port);
+        if (fd != -1) {
+            sock_set_noblk(fd, 1);
+        }
+        break;
+    case SOCK_TYPE_UDP:
+        fd = sock_udp_bind(host, port);
+        //sock_set_noblk(s->fd, true);
+        break;
+    default:
+        printf("invalid sock_type!\n");
+        break;
+    }
+    return fd;
+}
+
 struct sock_server *sock_server_create(const char *host, uint16_t port, enum sock_type type)
 {
+    return sock_server_create_sharded(host, port, type, 1);
+}
+
+struct sock_server *sock_server_create_sharded(const char *host, uint16_t port,
+        enum sock_type type, int nshard)
+{
+    int i;
+    struct sock_addr addr;
     struct sock_server *s;
     if (type > SOCK_TYPE_MAX) {
         printf("invalid paraments\n");
         return NULL;
     }
+    if (nshard <= 0) {
+        nshard = sysconf(_SC_NPROCESSORS_ONLN);
+        if (nshard <= 0) {
+            nshard = 1;
+        }
+    }
+#ifdef ENABLE_PTCP
+    if (type == SOCK_TYPE_PTCP) {
+        nshard = 1;
+    }
+#endif
     s = calloc(1, sizeof(struct sock_server));
     if (!s) {
         printf("malloc sock_server failed!\n");
         return NULL;
     }
     s->type = type;
-    switch (type) {
-    case SOCK_TYPE_TCP:
-        s->fd = sock_tcp_bind_listen(host, port);
-        break;
-    case SOCK_TYPE_UDP:
-        s->fd = sock_udp_bind(host, port);
-        //sock_set_noblk(s->fd, true);
-        break;
-#ifdef ENABLE_PTCP
-    case SOCK_TYPE_PTCP:
-        s->fd64 = sock_ptcp_bind_listen(host, port);
-        break;
-#endif
-    default:
-        printf("invalid sock_type!\n");
-        break;
+    s->shards = calloc(nshard, sizeof(struct sock_shard));
+    if (!s->shards) {
+        printf("malloc sock_shard failed!\n");
+        goto failed;
+    }
+    if (nshard == 1) {
+        s->evbase = gevent_base_create();
+    } else {
+        s->group = gevent_base_group_create(nshard, GEVENT_GROUP_ROUND_ROBIN);
+        s->evbase = s->group ? s->group->bases[0] : NULL;
     }
-
-    s->evbase = gevent_base_create();
     if (!s->evbase) {
         printf("gevent_base_create failed!\n");
-        return NULL;
+        goto failed;
+    }
+#ifdef ENABLE_PTCP
+    if (type == SOCK_TYPE_PTCP) {
+        s->fd64 = sock_ptcp_bind_listen(host, port);
+    }
+#endif
+    for (i = 0; i < nshard; i++) {
+        struct sock_shard *sh = &s->shards[i];
+        sh->server = s;
+        sh->evbase = s->group ? s->group->bases[i] : s->evbase;
+#ifdef ENABLE_PTCP
+        if (type == SOCK_TYPE_PTCP) {
+            s->nshard++;
+            break;
+        }
+#endif
+        /* port 0 picks a random port, following shards have to share it */
+        sh->fd = sock_server_listen(host, port, type);
+        if (sh->fd == -1) {
+            printf("sock_server_listen shard %d failed!\n", i);
+            goto failed;
+        }
+        s->nshard++;
+        if (port == 0 && 0 == sock_getaddr_by_fd(sh->fd, &addr)) {
+            port = addr.port;
+        }
     }
+    s->fd = s->shards[0].fd;
     return s;
+
+failed:
+    sock_server_destroy(s);
+    return NULL;
 }
 
+static int sock_server_add_listeners(struct sock_server *s);
+
 int sock_server_set_callback(struct sock_server *s,
         void (*on_connect)(struct sock_server *s, struct sock_connection *conn),
         void (*on_buffer)(struct sock_server *s, void *buf, size_t len),
         void (*on_disconnect)(struct sock_server *s, struct sock_connection *conn))
 {
-    struct gevent *e;
     if (!s) {
         return -1;
     }
     s->on_connect = on_connect;
     s->on_buffer = on_buffer;
     s->on_disconnect = on_disconnect;
-    switch (s->type) {
-    case SOCK_TYPE_UDP:
-        e = gevent_create(s->fd, on_recv, NULL, on_error, s);
-        break;
-    case SOCK_TYPE_TCP:
-        e = gevent_create(s->fd, on_tcp_connect, NULL, on_error, s);
-        break;
+    return sock_server_add_listeners(s);
+}
+
+int sock_server_set_conn_callback(struct sock_server *s,
+        const struct sock_server_conn_cbs *cbs)
+{
+    if (!s || !cbs || !cbs->on_data || s->type != SOCK_TYPE_TCP) {
+        printf("%s paraments invalid!\n", __func__);
+        return -1;
+    }
+    s->conn_cbs = *cbs;
+    return sock_server_add_listeners(s);
+}
+
+static int sock_server_add_listeners(struct sock_server *s)
+{
+    int i;
+    struct gevent *e;
+    struct sock_shard *sh;
+    for (i = 0; i < s->nshard; i++) {
+        sh = &s->shards[i];
+        e = NULL;
+        switch (s->type) {
+        case SOCK_TYPE_UDP:
+            e = gevent_create(sh->fd, on_recv, NULL, on_error, sh);
+            break;
+        case SOCK_TYPE_TCP:
+            e = gevent_create(sh->fd, on_tcp_connect, NULL, on_error, sh);
+            break;
 #ifdef ENABLE_PTCP
-    case SOCK_TYPE_PTCP: {
-        ptcp_socket_t ptcp = *(ptcp_socket_t *) &s->fd64;
-        int fd = ptcp_get_socket_fd(ptcp);
-        printf("ptcp_get_socket_fd fd=%d\n", fd);
-        e = gevent_create(fd, on_ptcp_connect, NULL, on_error, s);
-    } break;
+        case SOCK_TYPE_PTCP: {
+            ptcp_socket_t ptcp = *(ptcp_socket_t *) &s->fd64;
+            int fd = ptcp_get_socket_fd(ptcp);
+            printf("ptcp_get_socket_fd fd=%d\n", fd);
+            e = gevent_create(fd, on_ptcp_connect, NULL, on_error, sh);
+        } break;
 #endif
-    default:
-        break;
-    }
-    if (-1 == gevent_add(s->evbase, &e)) {
-        printf("event_add failed!\n");
-        return -1;
+        default:
+            break;
+        }
+        if (-1 == gevent_add(sh->evbase, &e)) {
+            printf("event_add failed!\n");
+            gevent_destroy(e);
+            return -1;
+        }
+        sh->ev = e;
     }
     return 0;
 }
 
 int sock_server_dispatch(struct sock_server *s)
 {
+    int i;
     if (!s) {
         return -1;
     }
+    /* shard 0 runs in caller thread as before, others get own thread */
+    for (i = 1; i < s->nshard; i++) {
+        gevent_base_loop_start(s->shards[i].evbase);
+    }
     gevent_base_loop(s->evbase);
     return 0;
 }
 
 void sock_server_destroy(struct sock_server *s)
 {
+    int i;
+    struct sock_shard *sh;
     if (!s) {
         return;
     }
-    gevent_base_loop_break(s->evbase);
-    gevent_base_destroy(s->evbase);
+    if (s->evbase) {
+        gevent_base_loop_break(s->evbase);
+    }
+    for (i = 0; i < s->nshard; i++) {
+        sh = &s->shards[i];
+        if (i > 0 && sh->evbase->thread) {
+            gevent_base_loop_stop(sh->evbase);
+            sh->evbase->thread = NULL;
+        }
+        if (sh->ev) {
+            gevent_del(sh->evbase, &sh->ev);
+            gevent_destroy(sh->ev);
+        }
+        while (sh->conns) {
+            sock_server_conn_close(sh->conns);
+        }
+        if (sh->fd > 0) {
+            sock_close(sh->fd);
+        }
+    }
+    if (s->group) {
+        gevent_base_group_destroy(s->group);
+    } else if (s->evbase) {
+        gevent_base_destroy(s->evbase);
+    }
+    free(s->shards);
+    free(s);
 }
 
 
@@ -298,14 +581,27 @@ static void *sock_client_thread(struct thread *thread, void *arg)
     return NULL;
 }
 
+int sock_client_set_pool(struct sock_client *c, struct sock_pool *pool)
+{
+    if (!c) {
+        return -1;
+    }
+    c->pool = pool;
+    return 0;
+}
+
 GEAR_API int sock_client_connect(struct sock_client *c)
 {
-    struct gevent *e;
-    c->conn = sock_tcp_connect(c->host, c->port);
+    if (c->pool && c->type == SOCK_TYPE_TCP) {
+        c->conn = sock_pool_get(c->pool, c->host, c->port);
+    } else {
+        c->conn = sock_tcp_connect(c->host, c->port);
+    }
     if (!c->conn) {
         printf("sock_tcp_connect %s:%d failed!\n", c->host, c->port);
         return -1;
     }
+    c->broken = false;
     switch (c->type) {
     case SOCK_TYPE_TCP:
     case SOCK_TYPE_UDP:
@@ -320,8 +616,8 @@ GEAR_API int sock_client_connect(struct sock_client *c)
         printf("invalid sock_type!\n");
         break;
     }
-    e = gevent_create(c->fd, on_client_recv, NULL, on_error, c);
-    if (-1 == gevent_add(c->evbase, &e)) {
+    c->ev = gevent_create(c->fd, on_client_recv, NULL, on_error, c);
+    if (-1 == gevent_add(c->evbase, &c->ev)) {
         printf("event_add failed!\n");
     }
     if (c->conn) {
@@ -329,7 +625,200 @@ GEAR_API int sock_client_connect(struct sock_client *c)
             c->on_connect(c, c->conn);
         }
     }
+    /* loop flag is cleared by previous disconnect */
+    c->evbase->loop = 1;
     c->thread = thread_create(sock_client_thread, c);
 
     return 0;
 }
+
+GEAR_API int sock_client_disconnect(struct sock_client *c)
+{
+    if (!c || !c->conn) {
+        return -1;
+    }
+    if (c->ev) {
+        gevent_del(c->evbase, &c->ev);
+    }
+    if (c->thread) {
+        gevent_base_loop_break(c->evbase);
+        thread_join(c->thread);
+        thread_destroy(c->thread);
+        c->thread = NULL;
+    }
+    if (c->ev) {
+        gevent_destroy(c->ev);
+        c->ev = NULL;
+    }
+    if (c->pool && c->type == SOCK_TYPE_TCP) {
+        /* keep alive for next connect of any client to same host */
+        sock_pool_put(c->pool, c->host, c->port, c->conn, !c->broken);
+    } else {
+        sock_close(c->conn->fd);
+        free(c->conn);
+    }
+    c->conn = NULL;
+    c->fd = -1;
+    return 0;
+}
+
+GEAR_API void sock_client_destroy(struct sock_client *c)
+{
+    if (!c) {
+        return;
+    }
+    if (c->conn) {
+        sock_client_disconnect(c);
+    }
+    gevent_base_destroy(c->evbase);
+    free((void *)c->host);
+    free(c);
+}
+
+#if defined (OS_LINUX)
+struct sock_zc_event {
+    struct gevent_base *evbase;
+    struct gevent *ev;
+    struct sock_zc *zc;
+    void (*ev_in)(int fd, void *arg);
+    void (*ev_out)(int fd, void *arg);
+    void (*ev_err)(int fd, void *arg);
+    void *arg;
+};
+
+static void on_zc_in(int fd, void *arg)
+{
+    struct sock_zc_event *ze = (struct sock_zc_event *)arg;
+    ze->ev_in(fd, ze->arg);
+}
+
+static void on_zc_out(int fd, void *arg)
+{
+    struct sock_zc_event *ze = (struct sock_zc_event *)arg;
+    ze->ev_out(fd, ze->arg);
+}
+
+static void on_zc_err(int fd, void *arg)
+{
+    int err = 0;
+    socklen_t len = sizeof(err);
+    struct pollfd pfd;
+    struct sock_zc_event *ze = (struct sock_zc_event *)arg;
+
+    sock_zc_reap(ze->zc);
+    pfd.fd = fd;
+    pfd.events = (ze->ev_in ? POLLIN : 0) | (ze->ev_out ? POLLOUT : 0);
+    pfd.revents = 0;
+    if (poll(&pfd, 1, 0) < 0) {
+        pfd.revents = POLLERR;
+    }
+    if ((0 == getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) && err) ||
+        (pfd.revents & (POLLHUP | POLLNVAL))) {
+        if (ze->ev_err) {
+            errno = err;
+            ze->ev_err(fd, ze->arg);
+        }
+        return;
+    }
+    /* only completions, but readiness edges may share this wakeup */
+    if ((pfd.revents & POLLIN) && ze->ev_in) {
+        ze->ev_in(fd, ze->arg);
+    }
+    if ((pfd.revents & POLLOUT) && ze->ev_out) {
+        ze->ev_out(fd, ze->arg);
+    }
+}
+
+GEAR_API struct sock_zc_event *sock_zc_event_add(struct gevent_base *evbase,
+                struct sock_zc *zc, void (*ev_in)(int, void *),
+                void (*ev_out)(int, void *), void (*ev_err)(int, void *), void *arg)
+{
+    struct sock_zc_event *ze;
+    if (!evbase || !zc) {
+        return NULL;
+    }
+    ze = calloc(1, sizeof(struct sock_zc_event));
+    if (!ze) {
+        return NULL;
+    }
+    ze->evbase = evbase;
+    ze->zc = zc;
+    ze->ev_in = ev_in;
+    ze->ev_out = ev_out;
+    ze->ev_err = ev_err;
+    ze->arg = arg;
+    /* error callback is always on, it is how completions are seen */
+    ze->ev = gevent_create(zc->fd, ev_in ? on_zc_in : NULL,
+                    ev_out ? on_zc_out : NULL, on_zc_err, ze);
+    if (!ze->ev || 0 != gevent_add(evbase, &ze->ev)) {
+        printf("gevent_add zerocopy fd %d failed!\n", zc->fd);
+        gevent_destroy(ze->ev);
+        free(ze);
+        return NULL;
+    }
+    return ze;
+}
+
+GEAR_API void sock_zc_event_del(struct sock_zc_event *ze)
+{
+    if (!ze) {
+        return;
+    }
+    gevent_del(ze->evbase, &ze->ev);
+    gevent_destroy(ze->ev);
+    free(ze);
+}
+
+struct sock_tcp_sampler {
+    struct gevent_base *evbase;
+    struct gevent_wtimer timer;
+    int fd;
+    sock_tcp_info_cb cb;
+    void *arg;
+};
+
+static void on_tcp_sample(struct gevent_wtimer *t, void *arg)
+{
+    struct tcp_info ti;
+    struct sock_tcp_sampler *s = (struct sock_tcp_sampler *)arg;
+
+    if (0 != sock_get_tcp_info(s->fd, &ti)) {
+        printf("tcp_info of fd %d failed: %s\n", s->fd, strerror(errno));
+        gevent_wtimer_del(s->evbase, &s->timer);
+        return;
+    }
+    s->cb(s->fd, &ti, s->arg);
+}
+
+GEAR_API struct sock_tcp_sampler *sock_tcp_sampler_create(struct gevent_base *evbase,
+                int fd, uint32_t interval_ms, sock_tcp_info_cb cb, void *arg)
+{
+    struct sock_tcp_sampler *s;
+    if (!evbase || fd < 0 || !interval_ms || !cb) {
+        return NULL;
+    }
+    s = calloc(1, sizeof(struct sock_tcp_sampler));
+    if (!s) {
+        return NULL;
+    }
+    s->evbase = evbase;
+    s->fd = fd;
+    s->cb = cb;
+    s->arg = arg;
+    gevent_wtimer_init(&s->timer, on_tcp_sample, s);
+    if (0 != gevent_wtimer_add(evbase, &s->timer, interval_ms, TIMER_PERSIST)) {
+        free(s);
+        return NULL;
+    }
+    return s;
+}
+
+GEAR_API void sock_tcp_sampler_destroy(struct sock_tcp_sampler *s)
+{
+    if (!s) {
+        return;
+    }
+    gevent_wtimer_del(s->evbase, &s->timer);
+    free(s);
+}
+#endif
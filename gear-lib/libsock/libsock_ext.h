@@ -28,15 +28,59 @@
 extern "C" {
 #endif
 
+/*
+ * one listener with its own event loop and thread, shards of a server bind
+ * the same port with SO_REUSEPORT and kernel spreads connections on them
+ */
+struct sock_shard {
+    int fd;
+    struct gevent_base *evbase;
+    struct gevent *ev;
+    struct sock_server *server;
+    struct sock_server_conn *conns;
+    int nconn;
+};
+
+/*
+ * accepted tcp connection in connection mode, lives in loop thread of the
+ * shard which accepted it, ctx is for user per connection state
+ */
+struct sock_server_conn {
+    struct sock_connection info;
+    struct sock_server *server;
+    struct sock_shard *shard;
+    struct gevent_conn *gc;
+    void *ctx;
+    bool closed;
+    bool in_cb;
+    struct sock_server_conn *prev;
+    struct sock_server_conn *next;
+};
+
+/*
+ * on_data returns bytes consumed, the rest stays buffered and is passed
+ * again with more data, so partial messages need no copy by user
+ */
+struct sock_server_conn_cbs {
+    void (*on_open)(struct sock_server_conn *c);
+    size_t (*on_data)(struct sock_server_conn *c, void *buf, size_t len);
+    void (*on_drain)(struct sock_server_conn *c);
+    void (*on_close)(struct sock_server_conn *c, int err);
+};
+
 struct sock_server {
     int fd;
     uint64_t fd64;
     struct sock_connection *conn;
     enum sock_type type;
     struct gevent_base *evbase;
+    int nshard;
+    struct sock_shard *shards;
+    struct gevent_base_group *group;
     void (*on_buffer)(struct sock_server *s, void *buf, size_t len);
     void (*on_connect)(struct sock_server *s, struct sock_connection *conn);
     void (*on_disconnect)(struct sock_server *s, struct sock_connection *conn);
+    struct sock_server_conn_cbs conn_cbs;
     void *priv;
 };
 
@@ -44,10 +88,27 @@ struct sock_server {
  * socket server high-level API
  */
 GEAR_API struct sock_server *sock_server_create(const char *host, uint16_t port, enum sock_type type);
+/*
+ * nshard listeners on the same port, callbacks may run in nshard threads
+ * concurrently, nshard <= 0 means one shard per cpu
+ */
+GEAR_API struct sock_server *sock_server_create_sharded(const char *host, uint16_t port,
+        enum sock_type type, int nshard);
 GEAR_API int sock_server_set_callback(struct sock_server *s,
         void (*on_connect)(struct sock_server *s, struct sock_connection *conn),
         void (*on_buffer)(struct sock_server *s, void *buf, size_t len),
         void (*on_disconnect)(struct sock_server *s, struct sock_connection *conn));
+/*
+ * connection mode of tcp server, each connection is a buffered gevent_conn
+ * with own ctx, output which can't be written now is kept and flushed when
+ * fd is writable. Call conn apis only in loop thread of the connection,
+ * from other threads use gevent_base_post on c->shard->evbase
+ */
+GEAR_API int sock_server_set_conn_callback(struct sock_server *s,
+        const struct sock_server_conn_cbs *cbs);
+GEAR_API int sock_server_conn_write(struct sock_server_conn *c, const void *buf, size_t len);
+GEAR_API size_t sock_server_conn_pending(struct sock_server_conn *c);
+GEAR_API void sock_server_conn_close(struct sock_server_conn *c);
 GEAR_API int sock_server_dispatch(struct sock_server *s);
 GEAR_API void sock_server_destroy(struct sock_server *s);
 
@@ -62,6 +123,9 @@ struct sock_client {
     enum sock_type type;
     struct gevent_base *evbase;
     struct thread *thread;
+    struct gevent *ev;
+    struct sock_pool *pool;
+    bool broken;
     void (*on_buffer)(struct sock_client *c, void *buf, size_t len);
     void (*on_connect)(struct sock_client *c, struct sock_connection *conn);
     void (*on_disconnect)(struct sock_client *c, struct sock_connection *conn);
@@ -73,10 +137,89 @@ GEAR_API int sock_client_set_callback(struct sock_client *c,
         void (*on_connect)(struct sock_client *c, struct sock_connection *conn),
         void (*on_buffer)(struct sock_client *c, void *buf, size_t len),
         void (*on_disconnect)(struct sock_client *c, struct sock_connection *conn));
+/*
+ * take connection from pool on connect and give it back on disconnect,
+ * unless peer closed it, pool can be shared by many clients
+ */
+GEAR_API int sock_client_set_pool(struct sock_client *c, struct sock_pool *pool);
 GEAR_API int sock_client_connect(struct sock_client *c);
 GEAR_API int sock_client_disconnect(struct sock_client *c);
 GEAR_API void sock_client_destroy(struct sock_client *c);
 
+/*
+ * tcp connection pool, idle connections kept per host:port up to max_idle
+ * for timeout_ms, get reuses a live one or connects a new one with
+ * keepalive, put with reusable false or over the limit closes it
+ */
+struct sock_pool;
+struct sock_pool_stats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t dropped;
+    size_t idle;
+};
+
+GEAR_API struct sock_pool *sock_pool_create(int max_idle, int timeout_ms);
+GEAR_API void sock_pool_destroy(struct sock_pool *p);
+GEAR_API struct sock_connection *sock_pool_get(struct sock_pool *p, const char *host, uint16_t port);
+GEAR_API void sock_pool_put(struct sock_pool *p, const char *host, uint16_t port,
+                struct sock_connection *conn, bool reusable);
+GEAR_API int sock_pool_prune(struct sock_pool *p);
+GEAR_API int sock_pool_get_stats(struct sock_pool *p, struct sock_pool_stats *stats);
+
+/*
+ * asynchronous dns with cache, getaddrinfo runs in nthread worker threads,
+ * answers are cached ttl_ms and failures 5s, queries of one name in flight
+ * are merged. cb runs inline on cache hit, otherwise in a worker thread,
+ * err is 0 or an EAI_* code, al is only valid inside cb
+ */
+struct sock_dns;
+typedef void (*sock_dns_cb)(const char *host, int err,
+                const struct sock_addr_list *al, void *arg);
+
+struct sock_dns_stats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t coalesced;
+    uint64_t failures;
+    size_t entries;
+};
+
+GEAR_API struct sock_dns *sock_dns_create(int nthread, int ttl_ms);
+GEAR_API void sock_dns_destroy(struct sock_dns *d);
+GEAR_API int sock_dns_resolve(struct sock_dns *d, const char *host, sock_dns_cb cb, void *arg);
+GEAR_API int sock_dns_lookup(struct sock_dns *d, const char *host, uint32_t *ip);
+GEAR_API void sock_dns_flush(struct sock_dns *d);
+GEAR_API int sock_dns_get_stats(struct sock_dns *d, struct sock_dns_stats *stats);
+
+#if defined (OS_LINUX)
+/*
+ * drive sock_zc from a gevent_base: completions on the error queue raise
+ * EPOLLERR, they are reaped (running release callbacks) before anything
+ * else. ev_err only sees real socket errors or hangup, and since epoll may
+ * fold readable/writable into the same EPOLLERR wakeup, ev_in/ev_out are
+ * then called if fd is ready. add and del in loop thread of evbase, not
+ * from its own callbacks
+ */
+struct sock_zc_event;
+GEAR_API struct sock_zc_event *sock_zc_event_add(struct gevent_base *evbase,
+                struct sock_zc *zc, void (*ev_in)(int, void *),
+                void (*ev_out)(int, void *), void (*ev_err)(int, void *), void *arg);
+GEAR_API void sock_zc_event_del(struct sock_zc_event *ze);
+
+/*
+ * periodic TCP_INFO of one connection from the timing wheel of evbase,
+ * cb gets rtt, cwnd, retransmits, delivery rate etc. every interval_ms.
+ * create and destroy in loop thread of evbase, fd is not owned, destroy
+ * the sampler before closing it. a failed getsockopt stops sampling
+ */
+struct sock_tcp_sampler;
+typedef void (*sock_tcp_info_cb)(int fd, const struct tcp_info *ti, void *arg);
+
+GEAR_API struct sock_tcp_sampler *sock_tcp_sampler_create(struct gevent_base *evbase,
+                int fd, uint32_t interval_ms, sock_tcp_info_cb cb, void *arg);
+GEAR_API void sock_tcp_sampler_destroy(struct sock_tcp_sampler *s);
+#endif
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,102 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#ifndef LIBSOCK_RING_H
+#define LIBSOCK_RING_H
+
+#include "libsock.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * udp receive ring of one interface, linux only and needs CAP_NET_RAW
+ * (and CAP_BPF or CAP_SYS_ADMIN for xdp).
+ * SOCK_RING_XDP: AF_XDP socket on one rx queue, a small xdp program
+ *   redirects ipv4 udp of the port range to it and passes the rest, frames
+ *   are in a umem owned by the ring, packets skip the kernel udp stack.
+ * SOCK_RING_TPACKET: TPACKET_V3 block ring of AF_PACKET, a classic bpf
+ *   filter keeps the port range, blocks are read without a syscall.
+ * packets are demuxed to the consumer bound to their dst port, pkt->data
+ * points into the ring and is valid during the callback, sock_ring_hold
+ * keeps it longer. the port is also held by a udp socket which drops all,
+ * so the kernel does not answer icmp unreachable and nobody else binds it.
+ * bind, unbind and poll are called in one thread, release from any thread
+ */
+enum sock_ring_type {
+    SOCK_RING_AUTO = 0,             /* xdp, tpacket if xdp fails */
+    SOCK_RING_XDP,
+    SOCK_RING_TPACKET,
+};
+
+struct sock_ring_conf {
+    const char *ifname;
+    enum sock_ring_type type;
+    uint16_t port_min;              /* udp dst port range of the ring */
+    uint16_t port_max;
+    int queue;                      /* xdp rx queue */
+    int fanout;                     /* tpacket fanout group, 0 for none */
+    uint32_t frames;                /* xdp umem frames, 0 takes 4096 */
+    uint32_t block_size;            /* tpacket block, 0 takes 256KB */
+    uint32_t block_nr;              /* tpacket blocks, 0 takes 64 */
+    uint32_t block_tov_ms;          /* tpacket block retire, 0 takes 4ms */
+};
+
+struct sock_ring_pkt {
+    const uint8_t *data;            /* udp payload */
+    size_t len;
+    uint32_t ip;                    /* source, network order as sock_msg */
+    uint16_t port;                  /* source */
+    uint16_t dst_port;
+    void *owner;                    /* frame or block, for sock_ring_hold */
+};
+
+struct sock_ring_stats {
+    uint64_t packets;
+    uint64_t bytes;
+    uint64_t unmatched;             /* no consumer bound to dst port */
+    uint64_t invalid;               /* not ipv4 udp, or truncated */
+    uint64_t held;
+    uint64_t kernel_drops;          /* ring full, from kernel statistics */
+};
+
+struct sock_ring;
+typedef void (sock_ring_cb)(struct sock_ring *r, struct sock_ring_pkt *pkt, void *arg);
+
+struct sock_ring *sock_ring_create(const struct sock_ring_conf *conf);
+void sock_ring_destroy(struct sock_ring *r);
+enum sock_ring_type sock_ring_get_type(struct sock_ring *r);
+/* readable when packets are ready, e.g. for gevent */
+int sock_ring_fd(struct sock_ring *r);
+int sock_ring_bind(struct sock_ring *r, uint16_t port, sock_ring_cb *cb, void *arg);
+int sock_ring_unbind(struct sock_ring *r, uint16_t port);
+/* dispatch up to budget ready packets, 0 for all, return the number */
+int sock_ring_poll(struct sock_ring *r, int budget);
+/* keep pkt->data after the callback, the frame or block is pinned */
+void *sock_ring_hold(struct sock_ring *r, struct sock_ring_pkt *pkt);
+void sock_ring_release(struct sock_ring *r, void *hold);
+int sock_ring_get_stats(struct sock_ring *r, struct sock_ring_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,297 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#include "libsock_ext.h"
+#include <libthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#if defined (OS_LINUX)
+#include <sys/socket.h>
+#endif
+
+/*
+ * idle tcp connections kept per host:port for reuse, a reused connection
+ * skips the handshake and keeps its grown congestion window. The most
+ * recently returned one is handed out first, a connection idle longer than
+ * the timeout or closed by peer is dropped when met.
+ */
+#define POOL_HASH_SIZE          (64)
+#define POOL_DEFAULT_IDLE       (4)
+#define POOL_DEFAULT_TIMEOUT_MS (30 * 1000)
+
+struct pool_conn {
+    struct sock_connection *conn;
+    uint64_t expire;
+    struct pool_conn *next;
+};
+
+struct pool_host {
+    char host[SOCK_ADDR_LEN];
+    uint16_t port;
+    int nidle;
+    struct pool_conn *idle;
+    struct pool_host *next;
+};
+
+struct sock_pool {
+    int max_idle;
+    int timeout_ms;
+    mutex_lock_t lock;
+    struct sock_pool_stats stats;
+    struct pool_host *table[POOL_HASH_SIZE];
+};
+
+static uint64_t pool_now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static uint32_t pool_hash(const char *host, uint16_t port)
+{
+    uint32_t h = 2166136261u ^ port;
+    for (; *host; host++) {
+        h ^= (uint8_t)*host;
+        h *= 16777619u;
+    }
+    return h % POOL_HASH_SIZE;
+}
+
+static void pool_conn_close(struct sock_connection *conn)
+{
+    sock_close(conn->fd);
+    free(conn);
+}
+
+/*
+ * idle connection must have nothing to read, readable means peer closed
+ * it or sent something unexpected, both make it unusable
+ */
+static bool pool_conn_alive(struct sock_connection *conn)
+{
+#if defined (OS_LINUX)
+    char c;
+    ssize_t n = recv(conn->fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return true;
+    }
+    return false;
+#else
+    return true;
+#endif
+}
+
+static struct pool_host *pool_host_find(struct sock_pool *p, const char *host,
+                uint16_t port, bool create)
+{
+    uint32_t h = pool_hash(host, port);
+    struct pool_host *ph;
+    for (ph = p->table[h]; ph; ph = ph->next) {
+        if (ph->port == port && !strcmp(ph->host, host)) {
+            return ph;
+        }
+    }
+    if (!create) {
+        return NULL;
+    }
+    ph = (struct pool_host *)calloc(1, sizeof(struct pool_host));
+    if (!ph) {
+        printf("malloc pool_host failed!\n");
+        return NULL;
+    }
+    snprintf(ph->host, sizeof(ph->host), "%s", host);
+    ph->port = port;
+    ph->next = p->table[h];
+    p->table[h] = ph;
+    return ph;
+}
+
+struct sock_pool *sock_pool_create(int max_idle, int timeout_ms)
+{
+    struct sock_pool *p = (struct sock_pool *)calloc(1, sizeof(struct sock_pool));
+    if (!p) {
+        printf("malloc sock_pool failed!\n");
+        return NULL;
+    }
+    p->max_idle = (max_idle > 0) ? max_idle : POOL_DEFAULT_IDLE;
+    p->timeout_ms = (timeout_ms > 0) ? timeout_ms : POOL_DEFAULT_TIMEOUT_MS;
+    mutex_lock_init(&p->lock);
+    return p;
+}
+
+void sock_pool_destroy(struct sock_pool *p)
+{
+    int i;
+    struct pool_host *ph, *nph;
+    struct pool_conn *pc, *npc;
+    if (!p) {
+        return;
+    }
+    for (i = 0; i < POOL_HASH_SIZE; i++) {
+        for (ph = p->table[i]; ph; ph = nph) {
+            nph = ph->next;
+            for (pc = ph->idle; pc; pc = npc) {
+                npc = pc->next;
+                pool_conn_close(pc->conn);
+                free(pc);
+            }
+            free(ph);
+        }
+    }
+    mutex_lock_deinit(&p->lock);
+    free(p);
+}
+
+struct sock_connection *sock_pool_get(struct sock_pool *p, const char *host, uint16_t port)
+{
+    bool expired;
+    uint64_t now;
+    struct pool_host *ph;
+    struct pool_conn *pc;
+    struct sock_connection *conn = NULL;
+
+    if (!p || !host) {
+        printf("%s paraments invalid!\n", __func__);
+        return NULL;
+    }
+    now = pool_now_ms();
+    mutex_lock(&p->lock);
+    ph = pool_host_find(p, host, port, false);
+    while (ph && ph->idle) {
+        pc = ph->idle;
+        ph->idle = pc->next;
+        ph->nidle--;
+        conn = pc->conn;
+        expired = (now >= pc->expire);
+        free(pc);
+        /* peek never blocks, cheap enough under lock */
+        if (!expired && pool_conn_alive(conn)) {
+            p->stats.hits++;
+            mutex_unlock(&p->lock);
+            return conn;
+        }
+        p->stats.dropped++;
+        pool_conn_close(conn);
+        conn = NULL;
+    }
+    p->stats.misses++;
+    mutex_unlock(&p->lock);
+
+    conn = sock_tcp_connect(host, port);
+    if (conn) {
+        sock_set_tcp_keepalive(conn->fd, 1);
+    }
+    return conn;
+}
+
+void sock_pool_put(struct sock_pool *p, const char *host, uint16_t port,
+                struct sock_connection *conn, bool reusable)
+{
+    struct pool_host *ph;
+    struct pool_conn *pc;
+
+    if (!conn) {
+        return;
+    }
+    if (!p || !host || !reusable) {
+        pool_conn_close(conn);
+        return;
+    }
+    mutex_lock(&p->lock);
+    ph = pool_host_find(p, host, port, true);
+    if (!ph || ph->nidle >= p->max_idle) {
+        p->stats.dropped++;
+        mutex_unlock(&p->lock);
+        pool_conn_close(conn);
+        return;
+    }
+    pc = (struct pool_conn *)calloc(1, sizeof(struct pool_conn));
+    if (!pc) {
+        mutex_unlock(&p->lock);
+        pool_conn_close(conn);
+        return;
+    }
+    pc->conn = conn;
+    pc->expire = pool_now_ms() + p->timeout_ms;
+    pc->next = ph->idle;
+    ph->idle = pc;
+    ph->nidle++;
+    mutex_unlock(&p->lock);
+}
+
+/*
+ * close idle connections which are expired, call it from a timer
+ */
+int sock_pool_prune(struct sock_pool *p)
+{
+    int i, n = 0;
+    uint64_t now;
+    struct pool_host *ph;
+    struct pool_conn **pp, *pc;
+
+    if (!p) {
+        return -1;
+    }
+    now = pool_now_ms();
+    mutex_lock(&p->lock);
+    for (i = 0; i < POOL_HASH_SIZE; i++) {
+        for (ph = p->table[i]; ph; ph = ph->next) {
+            pp = &ph->idle;
+            while ((pc = *pp) != NULL) {
+                if (now >= pc->expire || !pool_conn_alive(pc->conn)) {
+                    *pp = pc->next;
+                    ph->nidle--;
+                    pool_conn_close(pc->conn);
+                    free(pc);
+                    p->stats.dropped++;
+                    n++;
+                    continue;
+                }
+                pp = &pc->next;
+            }
+        }
+    }
+    mutex_unlock(&p->lock);
+    return n;
+}
+
+int sock_pool_get_stats(struct sock_pool *p, struct sock_pool_stats *stats)
+{
+    int i;
+    struct pool_host *ph;
+    if (!p || !stats) {
+        return -1;
+    }
+    mutex_lock(&p->lock);
+    *stats = p->stats;
+    stats->idle = 0;
+    for (i = 0; i < POOL_HASH_SIZE; i++) {
+        for (ph = p->table[i]; ph; ph = ph->next) {
+            stats->idle += ph->nidle;
+        }
+    }
+    mutex_unlock(&p->lock);
+    return 0;
+}
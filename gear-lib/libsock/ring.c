@@ -0,0 +1,897 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#include "libsock_ring.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#if defined (OS_LINUX)
+#include <pthread.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+#include <linux/filter.h>
+#include <linux/bpf.h>
+
+#ifndef SOL_XDP
+#define SOL_XDP                 (283)
+#endif
+#ifndef AF_XDP
+#define AF_XDP                  (44)
+#endif
+
+#define RING_FRAME_SIZE         (2048)      /* umem chunk and tpacket frame */
+#define RING_FRAMES             (4096)
+#define RING_BLOCK_SIZE         (256 * 1024)
+#define RING_BLOCK_NR           (64)
+#define RING_BLOCK_TOV_MS       (4)
+#define RING_XSKMAP_MAX         (64)        /* rx queues of one interface */
+#define RING_SNAPLEN            (0x40000)
+
+struct ring_port {
+    sock_ring_cb *cb;
+    void *arg;
+    int sink_fd;
+};
+
+/* producer/consumer ring shared with kernel */
+struct xdp_queue {
+    uint32_t *producer;
+    uint32_t *consumer;
+    uint32_t *flags;
+    void *desc;
+    uint32_t mask;
+    void *map;
+    size_t map_len;
+};
+
+/* one xdp program and xskmap per interface, shared by rings of its queues */
+struct xdp_prog {
+    int ifindex;
+    int map_fd;
+    int prog_fd;
+    int link_fd;
+    int refs;
+    uint16_t port_min;
+    uint16_t port_max;
+    struct xdp_prog *next;
+};
+
+struct sock_ring {
+    struct sock_ring_conf conf;
+    enum sock_ring_type type;
+    int fd;
+    int ifindex;
+    struct ring_port **ports;       /* indexed by dst port - port_min */
+    struct sock_ring_stats stats;
+    uint64_t held;
+    /* tpacket */
+    uint8_t *map;
+    size_t map_len;
+    uint32_t block_cur;
+    int *block_refs;
+    /* xdp */
+    uint8_t *umem;
+    size_t umem_len;
+    struct xdp_queue fill;
+    struct xdp_queue comp;
+    struct xdp_queue rx;
+    int *frame_refs;
+    uint64_t *recycle;              /* frames released by other threads */
+    uint32_t nrecycle;
+    struct xdp_prog *prog;
+    pthread_mutex_t lock;
+};
+
+static pthread_mutex_t xdp_progs_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct xdp_prog *xdp_progs = NULL;
+
+/* ipv4 udp, not a fragment, dst port in [min, max] */
+static int ring_attach_filter(int fd, uint16_t min, uint16_t max)
+{
+    struct sock_filter code[] = {
+        BPF_STMT(BPF_LD  | BPF_H | BPF_ABS, 12),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETH_P_IP, 0, 9),
+        BPF_STMT(BPF_LD  | BPF_B | BPF_ABS, 23),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_UDP, 0, 7),
+        BPF_STMT(BPF_LD  | BPF_H | BPF_ABS, 20),
+        BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x1fff, 5, 0),
+        BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, 14),
+        BPF_STMT(BPF_LD  | BPF_H | BPF_IND, 16),
+        BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, min, 0, 2),
+        BPF_JUMP(BPF_JMP | BPF_JGT | BPF_K, max, 1, 0),
+        BPF_STMT(BPF_RET | BPF_K, RING_SNAPLEN),
+        BPF_STMT(BPF_RET | BPF_K, 0),
+    };
+    struct sock_fprog prog = {sizeof(code) / sizeof(code[0]), code};
+    return setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog));
+}
+
+/* udp socket holding a port, everything it would receive is dropped */
+static int ring_sink_open(uint16_t port)
+{
+    struct sock_filter code[] = {
+        BPF_STMT(BPF_RET | BPF_K, 0),
+    };
+    struct sock_fprog prog = {1, code};
+    struct sockaddr_in si;
+    int fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (fd == -1) {
+        return -1;
+    }
+    if (-1 == setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog))) {
+        close(fd);
+        return -1;
+    }
+    memset(&si, 0, sizeof(si));
+    si.sin_family = AF_INET;
+    si.sin_addr.s_addr = INADDR_ANY;
+    si.sin_port = htons(port);
+    if (-1 == bind(fd, (struct sockaddr *)&si, sizeof(si))) {
+        printf("%s: bind udp port %d failed: %d\n", __func__, port, errno);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void ring_input(struct sock_ring *r, const uint8_t *p, size_t len, uint32_t owner)
+{
+    struct sock_ring_pkt pkt;
+    struct ring_port *rp;
+    const uint8_t *ip, *udp;
+    size_t off = ETH_HLEN, ihl, ulen;
+    uint16_t proto, dport;
+
+    if (len < ETH_HLEN) {
+        goto invalid;
+    }
+    proto = ((uint16_t)p[12] << 8) | p[13];
+    if (proto == ETH_P_8021Q && len >= ETH_HLEN + 4) {
+        proto = ((uint16_t)p[16] << 8) | p[17];
+        off += 4;
+    }
+    if (proto != ETH_P_IP || len < off + 20) {
+        goto invalid;
+    }
+    ip = p + off;
+    ihl = (ip[0] & 0x0f) * 4;
+    if ((ip[0] >> 4) != 4 || ihl < 20 || len < off + ihl + 8 ||
+        ip[9] != IPPROTO_UDP || (((ip[6] << 8) | ip[7]) & 0x3fff)) {
+        goto invalid;
+    }
+    udp = ip + ihl;
+    ulen = ((size_t)udp[4] << 8) | udp[5];
+    if (ulen < 8 || udp + ulen > p + len) {
+        goto invalid;
+    }
+    dport = ((uint16_t)udp[2] << 8) | udp[3];
+    if (dport < r->conf.port_min || dport > r->conf.port_max ||
+        !(rp = r->ports[dport - r->conf.port_min])) {
+        r->stats.unmatched++;
+        return;
+    }
+    pkt.data = udp + 8;
+    pkt.len = ulen - 8;
+    memcpy(&pkt.ip, ip + 12, sizeof(pkt.ip));
+    pkt.port = ((uint16_t)udp[0] << 8) | udp[1];
+    pkt.dst_port = dport;
+    pkt.owner = (void *)(uintptr_t)(owner + 1);
+    r->stats.packets++;
+    r->stats.bytes += pkt.len;
+    rp->cb(r, &pkt, rp->arg);
+    return;
+invalid:
+    r->stats.invalid++;
+}
+
+/*
+ * TPACKET_V3, kernel fills whole blocks and hands one over when it is full
+ * or block_tov_ms passed, a block goes back when it is read and unheld
+ */
+static void tpacket_block_put(struct sock_ring *r, uint32_t idx)
+{
+    struct tpacket_block_desc *bd;
+    if (__atomic_sub_fetch(&r->block_refs[idx], 1, __ATOMIC_ACQ_REL) == 0) {
+        bd = (struct tpacket_block_desc *)(r->map + (size_t)idx * r->conf.block_size);
+        __atomic_store_n(&bd->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+    }
+}
+
+static int tpacket_poll(struct sock_ring *r, int budget)
+{
+    struct tpacket_block_desc *bd;
+    struct tpacket3_hdr *ppd;
+    uint32_t i, idx, num;
+    int n = 0;
+
+    while (!budget || n < budget) {
+        idx = r->block_cur;
+        /* still held from last lap, kernel waits on it as well */
+        if (__atomic_load_n(&r->block_refs[idx], __ATOMIC_ACQUIRE) != 0) {
+            break;
+        }
+        bd = (struct tpacket_block_desc *)(r->map + (size_t)idx * r->conf.block_size);
+        if (!(__atomic_load_n(&bd->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER)) {
+            break;
+        }
+        r->block_refs[idx] = 1;
+        num = bd->hdr.bh1.num_pkts;
+        ppd = (struct tpacket3_hdr *)((uint8_t *)bd + bd->hdr.bh1.offset_to_first_pkt);
+        for (i = 0; i < num; i++) {
+            ring_input(r, (uint8_t *)ppd + ppd->tp_mac, ppd->tp_snaplen, idx);
+            ppd = (struct tpacket3_hdr *)((uint8_t *)ppd + ppd->tp_next_offset);
+        }
+        n += num;
+        tpacket_block_put(r, idx);
+        r->block_cur = (idx + 1) % r->conf.block_nr;
+    }
+    return n;
+}
+
+static int tpacket_open(struct sock_ring *r)
+{
+    struct tpacket_req3 req;
+    struct sockaddr_ll sll;
+    int ver = TPACKET_V3, one = 1, fanout;
+
+    r->fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_IP));
+    if (r->fd == -1) {
+        printf("%s: socket AF_PACKET failed: %d\n", __func__, errno);
+        return -1;
+    }
+    if (-1 == ring_attach_filter(r->fd, r->conf.port_min, r->conf.port_max) ||
+        -1 == setsockopt(r->fd, SOL_PACKET, PACKET_VERSION, &ver, sizeof(ver))) {
+        printf("%s: setsockopt failed: %d\n", __func__, errno);
+        return -1;
+    }
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = r->conf.block_size;
+    req.tp_block_nr = r->conf.block_nr;
+    req.tp_frame_size = RING_FRAME_SIZE;
+    req.tp_frame_nr = r->conf.block_size / RING_FRAME_SIZE * r->conf.block_nr;
+    req.tp_retire_blk_tov = r->conf.block_tov_ms;
+    if (-1 == setsockopt(r->fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req))) {
+        printf("%s: PACKET_RX_RING failed: %d\n", __func__, errno);
+        return -1;
+    }
+    r->map_len = (size_t)r->conf.block_size * r->conf.block_nr;
+    r->map = mmap(NULL, r->map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, 0);
+    if (r->map == MAP_FAILED) {
+        r->map = NULL;
+        printf("%s: mmap ring failed: %d\n", __func__, errno);
+        return -1;
+    }
+    r->block_refs = calloc(r->conf.block_nr, sizeof(int));
+    if (!r->block_refs) {
+        return -1;
+    }
+    /* on loopback every packet is seen going out as well */
+    setsockopt(r->fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &one, sizeof(one));
+    memset(&sll, 0, sizeof(sll));
+    sll.sll_family = AF_PACKET;
+    sll.sll_protocol = htons(ETH_P_IP);
+    sll.sll_ifindex = r->ifindex;
+    if (-1 == bind(r->fd, (struct sockaddr *)&sll, sizeof(sll))) {
+        printf("%s: bind %s failed: %d\n", __func__, r->conf.ifname, errno);
+        return -1;
+    }
+    if (r->conf.fanout > 0) {
+        /* rings of one group share the interface by flow hash */
+        fanout = (r->conf.fanout & 0xffff) | (PACKET_FANOUT_HASH << 16);
+        if (-1 == setsockopt(r->fd, SOL_PACKET, PACKET_FANOUT, &fanout, sizeof(fanout))) {
+            printf("%s: PACKET_FANOUT failed: %d\n", __func__, errno);
+            return -1;
+        }
+    }
+    sock_set_noblk(r->fd, 1);
+    return 0;
+}
+
+static void tpacket_close(struct sock_ring *r)
+{
+    if (r->map) {
+        munmap(r->map, r->map_len);
+    }
+    free(r->block_refs);
+}
+
+/*
+ * AF_XDP, frames of the umem go to kernel through the fill ring and come
+ * back filled in the rx ring, a frame is refilled when read and unheld
+ */
+static int sys_bpf(int cmd, union bpf_attr *attr)
+{
+    return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+#define INSN(c, d, s, o, i) ((struct bpf_insn){.code = (c), .dst_reg = (d), .src_reg = (s), .off = (o), .imm = (i)})
+#define RING_XDP_PASS_AT        (25)
+#define JMP_PASS(i)             (RING_XDP_PASS_AT - (i) - 1)
+
+static int xdp_prog_load(int map_fd, uint16_t min, uint16_t max)
+{
+    struct bpf_insn insns[] = {
+        /* 0 */ INSN(BPF_ALU64 | BPF_MOV | BPF_X, 6, 1, 0, 0),
+        /* 1 */ INSN(BPF_LDX | BPF_MEM | BPF_W, 2, 6, offsetof(struct xdp_md, data), 0),
+        /* 2 */ INSN(BPF_LDX | BPF_MEM | BPF_W, 3, 6, offsetof(struct xdp_md, data_end), 0),
+        /* 3 */ INSN(BPF_ALU64 | BPF_MOV | BPF_X, 4, 2, 0, 0),
+        /* 4 */ INSN(BPF_ALU64 | BPF_ADD | BPF_K, 4, 0, 0, ETH_HLEN + 20 + 8),
+        /* 5 */ INSN(BPF_JMP | BPF_JGT | BPF_X, 4, 3, JMP_PASS(5), 0),
+        /* 6 */ INSN(BPF_LDX | BPF_MEM | BPF_H, 5, 2, 12, 0),
+        /* 7 */ INSN(BPF_JMP | BPF_JNE | BPF_K, 5, 0, JMP_PASS(7), htons(ETH_P_IP)),
+        /* ipv4 without options, others go to the kernel */
+        /* 8 */ INSN(BPF_LDX | BPF_MEM | BPF_B, 5, 2, 14, 0),
+        /* 9 */ INSN(BPF_JMP | BPF_JNE | BPF_K, 5, 0, JMP_PASS(9), 0x45),
+        /* 10 */ INSN(BPF_LDX | BPF_MEM | BPF_B, 5, 2, 23, 0),
+        /* 11 */ INSN(BPF_JMP | BPF_JNE | BPF_K, 5, 0, JMP_PASS(11), IPPROTO_UDP),
+        /* 12 */ INSN(BPF_LDX | BPF_MEM | BPF_H, 5, 2, 20, 0),
+        /* 13 */ INSN(BPF_ALU64 | BPF_AND | BPF_K, 5, 0, 0, htons(0x3fff)),
+        /* 14 */ INSN(BPF_JMP | BPF_JNE | BPF_K, 5, 0, JMP_PASS(14), 0),
+        /* 15 */ INSN(BPF_LDX | BPF_MEM | BPF_H, 5, 2, 36, 0),
+        /* 16 */ INSN(BPF_ALU | BPF_END | BPF_TO_BE, 5, 0, 0, 16),
+        /* 17 */ INSN(BPF_JMP | BPF_JLT | BPF_K, 5, 0, JMP_PASS(17), min),
+        /* 18 */ INSN(BPF_JMP | BPF_JGT | BPF_K, 5, 0, JMP_PASS(18), max),
+        /* redirect to xsk of the rx queue, pass if it has none */
+        /* 19 */ INSN(BPF_LD | BPF_DW | BPF_IMM, 1, BPF_PSEUDO_MAP_FD, 0, map_fd),
+        /* 20 */ INSN(0, 0, 0, 0, 0),
+        /* 21 */ INSN(BPF_LDX | BPF_MEM | BPF_W, 2, 6, offsetof(struct xdp_md, rx_queue_index), 0),
+        /* 22 */ INSN(BPF_ALU64 | BPF_MOV | BPF_K, 3, 0, 0, XDP_PASS),
+        /* 23 */ INSN(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map),
+        /* 24 */ INSN(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+        /* 25 */ INSN(BPF_ALU64 | BPF_MOV | BPF_K, 0, 0, 0, XDP_PASS),
+        /* 26 */ INSN(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+    };
+    char log[4096] = "";
+    union bpf_attr attr;
+    int fd;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.prog_type = BPF_PROG_TYPE_XDP;
+    attr.insns = (uintptr_t)insns;
+    attr.insn_cnt = sizeof(insns) / sizeof(insns[0]);
+    attr.license = (uintptr_t)"Dual MIT/GPL";
+    fd = sys_bpf(BPF_PROG_LOAD, &attr);
+    if (fd == -1) {
+        /* load again only to get the verifier log */
+        attr.log_buf = (uintptr_t)log;
+        attr.log_size = sizeof(log);
+        attr.log_level = 1;
+        sys_bpf(BPF_PROG_LOAD, &attr);
+        printf("%s: BPF_PROG_LOAD failed: %d\n%s\n", __func__, errno, log);
+    }
+    return fd;
+}
+
+static void xdp_prog_put(struct xdp_prog *p)
+{
+    struct xdp_prog **pp;
+
+    pthread_mutex_lock(&xdp_progs_lock);
+    if (--p->refs > 0) {
+        pthread_mutex_unlock(&xdp_progs_lock);
+        return;
+    }
+    for (pp = &xdp_progs; *pp; pp = &(*pp)->next) {
+        if (*pp == p) {
+            *pp = p->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&xdp_progs_lock);
+    /* closing the link detaches the program */
+    if (p->link_fd != -1) {
+        close(p->link_fd);
+    }
+    if (p->prog_fd != -1) {
+        close(p->prog_fd);
+    }
+    if (p->map_fd != -1) {
+        close(p->map_fd);
+    }
+    free(p);
+}
+
+static struct xdp_prog *xdp_prog_get(int ifindex, uint16_t min, uint16_t max)
+{
+    struct xdp_prog *p;
+    union bpf_attr attr;
+    uint32_t modes[] = {XDP_FLAGS_DRV_MODE, XDP_FLAGS_SKB_MODE};
+    int i;
+
+    pthread_mutex_lock(&xdp_progs_lock);
+    for (p = xdp_progs; p; p = p->next) {
+        if (p->ifindex == ifindex) {
+            if (p->port_min != min || p->port_max != max) {
+                printf("%s: rings of one interface need one port range\n", __func__);
+                p = NULL;
+            } else {
+                p->refs++;
+            }
+            pthread_mutex_unlock(&xdp_progs_lock);
+            return p;
+        }
+    }
+    p = calloc(1, sizeof(struct xdp_prog));
+    if (!p) {
+        pthread_mutex_unlock(&xdp_progs_lock);
+        return NULL;
+    }
+    p->ifindex = ifindex;
+    p->port_min = min;
+    p->port_max = max;
+    p->refs = 1;
+    p->prog_fd = p->link_fd = -1;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.map_type = BPF_MAP_TYPE_XSKMAP;
+    attr.key_size = sizeof(int);
+    attr.value_size = sizeof(int);
+    attr.max_entries = RING_XSKMAP_MAX;
+    p->map_fd = sys_bpf(BPF_MAP_CREATE, &attr);
+    if (p->map_fd == -1) {
+        printf("%s: BPF_MAP_CREATE failed: %d\n", __func__, errno);
+        goto fail;
+    }
+    p->prog_fd = xdp_prog_load(p->map_fd, min, max);
+    if (p->prog_fd == -1) {
+        goto fail;
+    }
+    /* native mode if the driver has it, generic otherwise */
+    for (i = 0; i < 2 && p->link_fd == -1; i++) {
+        memset(&attr, 0, sizeof(attr));
+        attr.link_create.prog_fd = p->prog_fd;
+        attr.link_create.target_ifindex = ifindex;
+        attr.link_create.attach_type = BPF_XDP;
+        attr.link_create.flags = modes[i];
+        p->link_fd = sys_bpf(BPF_LINK_CREATE, &attr);
+    }
+    if (p->link_fd == -1) {
+        printf("%s: attach xdp failed: %d\n", __func__, errno);
+        goto fail;
+    }
+    p->next = xdp_progs;
+    xdp_progs = p;
+    pthread_mutex_unlock(&xdp_progs_lock);
+    return p;
+
+fail:
+    pthread_mutex_unlock(&xdp_progs_lock);
+    if (p->prog_fd != -1) {
+        close(p->prog_fd);
+    }
+    if (p->map_fd != -1) {
+        close(p->map_fd);
+    }
+    free(p);
+    return NULL;
+}
+
+static int xdp_map_update(struct xdp_prog *p, int queue, int *fd)
+{
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = p->map_fd;
+    attr.key = (uintptr_t)&queue;
+    if (fd) {
+        attr.value = (uintptr_t)fd;
+        return sys_bpf(BPF_MAP_UPDATE_ELEM, &attr);
+    }
+    return sys_bpf(BPF_MAP_DELETE_ELEM, &attr);
+}
+
+static int xdp_queue_map(struct sock_ring *r, struct xdp_queue *q,
+                const struct xdp_ring_offset *off, uint32_t n, size_t desc_size, off_t pgoff)
+{
+    q->map_len = off->desc + n * desc_size;
+    q->map = mmap(NULL, q->map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, pgoff);
+    if (q->map == MAP_FAILED) {
+        q->map = NULL;
+        return -1;
+    }
+    q->producer = (uint32_t *)((uint8_t *)q->map + off->producer);
+    q->consumer = (uint32_t *)((uint8_t *)q->map + off->consumer);
+    q->flags = (uint32_t *)((uint8_t *)q->map + off->flags);
+    q->desc = (uint8_t *)q->map + off->desc;
+    q->mask = n - 1;
+    return 0;
+}
+
+/* poll thread only, fill ring has room for every frame */
+static void xdp_fill(struct sock_ring *r, uint32_t frame)
+{
+    uint32_t prod = *r->fill.producer;
+    ((uint64_t *)r->fill.desc)[prod & r->fill.mask] = (uint64_t)frame * RING_FRAME_SIZE;
+    __atomic_store_n(r->fill.producer, prod + 1, __ATOMIC_RELEASE);
+}
+
+static void xdp_frame_put(struct sock_ring *r, uint32_t frame, bool poller)
+{
+    if (__atomic_sub_fetch(&r->frame_refs[frame], 1, __ATOMIC_ACQ_REL) != 0) {
+        return;
+    }
+    if (poller) {
+        xdp_fill(r, frame);
+        return;
+    }
+    pthread_mutex_lock(&r->lock);
+    r->recycle[r->nrecycle++] = frame;
+    pthread_mutex_unlock(&r->lock);
+}
+
+static int xdp_poll(struct sock_ring *r, int budget)
+{
+    struct xdp_desc *desc;
+    uint32_t prod, cons, frame, i;
+    int n = 0;
+
+    prod = __atomic_load_n(r->rx.producer, __ATOMIC_ACQUIRE);
+    cons = *r->rx.consumer;
+    while (cons != prod && (!budget || n < budget)) {
+        desc = &((struct xdp_desc *)r->rx.desc)[cons & r->rx.mask];
+        frame = desc->addr / RING_FRAME_SIZE;
+        r->frame_refs[frame] = 1;
+        ring_input(r, r->umem + desc->addr, desc->len, frame);
+        xdp_frame_put(r, frame, true);
+        cons++;
+        n++;
+    }
+    __atomic_store_n(r->rx.consumer, cons, __ATOMIC_RELEASE);
+    if (r->nrecycle) {
+        pthread_mutex_lock(&r->lock);
+        for (i = 0; i < r->nrecycle; i++) {
+            xdp_fill(r, r->recycle[i]);
+        }
+        r->nrecycle = 0;
+        pthread_mutex_unlock(&r->lock);
+    }
+    if (__atomic_load_n(r->fill.flags, __ATOMIC_ACQUIRE) & XDP_RING_NEED_WAKEUP) {
+        recvfrom(r->fd, NULL, 0, MSG_DONTWAIT, NULL, NULL);
+    }
+    return n;
+}
+
+static int xdp_open(struct sock_ring *r)
+{
+    struct xdp_umem_reg mr;
+    struct xdp_mmap_offsets off;
+    struct sockaddr_xdp sxdp;
+    uint16_t binds[] = {XDP_ZEROCOPY | XDP_USE_NEED_WAKEUP, XDP_COPY | XDP_USE_NEED_WAKEUP, 0};
+    uint32_t n = r->conf.frames, comp = 64, i;
+    socklen_t len = sizeof(off);
+    int ret = -1, retry;
+
+    r->fd = socket(AF_XDP, SOCK_RAW, 0);
+    if (r->fd == -1) {
+        printf("%s: socket AF_XDP failed: %d\n", __func__, errno);
+        return -1;
+    }
+    r->umem_len = (size_t)n * RING_FRAME_SIZE;
+    r->umem = mmap(NULL, r->umem_len, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (r->umem == MAP_FAILED) {
+        r->umem = NULL;
+        return -1;
+    }
+    r->frame_refs = calloc(n, sizeof(int));
+    r->recycle = calloc(n, sizeof(uint64_t));
+    if (!r->frame_refs || !r->recycle) {
+        return -1;
+    }
+    memset(&mr, 0, sizeof(mr));
+    mr.addr = (uintptr_t)r->umem;
+    mr.len = r->umem_len;
+    mr.chunk_size = RING_FRAME_SIZE;
+    if (-1 == setsockopt(r->fd, SOL_XDP, XDP_UMEM_REG, &mr, sizeof(mr)) ||
+        -1 == setsockopt(r->fd, SOL_XDP, XDP_UMEM_FILL_RING, &n, sizeof(n)) ||
+        -1 == setsockopt(r->fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &comp, sizeof(comp)) ||
+        -1 == setsockopt(r->fd, SOL_XDP, XDP_RX_RING, &n, sizeof(n)) ||
+        -1 == getsockopt(r->fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &len)) {
+        printf("%s: setup umem failed: %d\n", __func__, errno);
+        return -1;
+    }
+    if (-1 == xdp_queue_map(r, &r->fill, &off.fr, n, sizeof(uint64_t), XDP_UMEM_PGOFF_FILL_RING) ||
+        -1 == xdp_queue_map(r, &r->comp, &off.cr, comp, sizeof(uint64_t), XDP_UMEM_PGOFF_COMPLETION_RING) ||
+        -1 == xdp_queue_map(r, &r->rx, &off.rx, n, sizeof(struct xdp_desc), XDP_PGOFF_RX_RING)) {
+        printf("%s: mmap rings failed: %d\n", __func__, errno);
+        return -1;
+    }
+    /* zerocopy needs driver support, copy mode works everywhere */
+    memset(&sxdp, 0, sizeof(sxdp));
+    sxdp.sxdp_family = AF_XDP;
+    sxdp.sxdp_ifindex = r->ifindex;
+    sxdp.sxdp_queue_id = r->conf.queue;
+    for (i = 0; i < sizeof(binds) / sizeof(binds[0]) && ret == -1; i++) {
+        sxdp.sxdp_flags = binds[i];
+        ret = bind(r->fd, (struct sockaddr *)&sxdp, sizeof(sxdp));
+        /* the queue of a just closed xsk is released deferred */
+        for (retry = 0; ret == -1 && errno == EBUSY && retry < 50; retry++) {
+            usleep(10 * 1000);
+            ret = bind(r->fd, (struct sockaddr *)&sxdp, sizeof(sxdp));
+        }
+    }
+    if (ret == -1) {
+        printf("%s: bind %s queue %d failed: %d\n", __func__, r->conf.ifname, r->conf.queue, errno);
+        return -1;
+    }
+    for (i = 0; i < n; i++) {
+        xdp_fill(r, i);
+    }
+    r->prog = xdp_prog_get(r->ifindex, r->conf.port_min, r->conf.port_max);
+    if (!r->prog || -1 == xdp_map_update(r->prog, r->conf.queue, &r->fd)) {
+        printf("%s: xskmap update failed: %d\n", __func__, errno);
+        return -1;
+    }
+    return 0;
+}
+
+static void xdp_close(struct sock_ring *r)
+{
+    if (r->prog) {
+        xdp_map_update(r->prog, r->conf.queue, NULL);
+        xdp_prog_put(r->prog);
+        r->prog = NULL;
+    }
+    if (r->rx.map) {
+        munmap(r->rx.map, r->rx.map_len);
+    }
+    if (r->fill.map) {
+        munmap(r->fill.map, r->fill.map_len);
+    }
+    if (r->comp.map) {
+        munmap(r->comp.map, r->comp.map_len);
+    }
+    if (r->umem) {
+        munmap(r->umem, r->umem_len);
+    }
+    free(r->frame_refs);
+    free(r->recycle);
+    memset(&r->rx, 0, sizeof(r->rx));
+    memset(&r->fill, 0, sizeof(r->fill));
+    memset(&r->comp, 0, sizeof(r->comp));
+    r->umem = NULL;
+    r->frame_refs = NULL;
+    r->recycle = NULL;
+}
+
+static void ring_close_fd(struct sock_ring *r)
+{
+    if (r->fd != -1) {
+        close(r->fd);
+        r->fd = -1;
+    }
+}
+
+struct sock_ring *sock_ring_create(const struct sock_ring_conf *conf)
+{
+    struct sock_ring *r;
+
+    if (!conf || !conf->ifname) {
+        printf("%s: paraments invalid!\n", __func__);
+        return NULL;
+    }
+    r = calloc(1, sizeof(struct sock_ring));
+    if (!r) {
+        return NULL;
+    }
+    memcpy(&r->conf, conf, sizeof(*conf));
+    r->fd = -1;
+    if (r->conf.port_min == 0 && r->conf.port_max == 0) {
+        r->conf.port_min = 1024;
+        r->conf.port_max = 65535;
+    }
+    if (r->conf.frames == 0 || (r->conf.frames & (r->conf.frames - 1))) {
+        r->conf.frames = RING_FRAMES;   /* rings are a power of 2 */
+    }
+    r->conf.block_size = r->conf.block_size ? r->conf.block_size : RING_BLOCK_SIZE;
+    r->conf.block_nr = r->conf.block_nr ? r->conf.block_nr : RING_BLOCK_NR;
+    r->conf.block_tov_ms = r->conf.block_tov_ms ? r->conf.block_tov_ms : RING_BLOCK_TOV_MS;
+    r->ifindex = if_nametoindex(conf->ifname);
+    if (r->conf.port_max < r->conf.port_min || r->ifindex == 0) {
+        printf("%s: no interface %s or bad port range\n", __func__, conf->ifname);
+        free(r);
+        return NULL;
+    }
+    r->ports = calloc(r->conf.port_max - r->conf.port_min + 1, sizeof(struct ring_port *));
+    if (!r->ports) {
+        free(r);
+        return NULL;
+    }
+    pthread_mutex_init(&r->lock, NULL);
+
+    if (conf->type != SOCK_RING_TPACKET) {
+        r->type = SOCK_RING_XDP;
+        if (0 == xdp_open(r)) {
+            return r;
+        }
+        xdp_close(r);
+        ring_close_fd(r);
+        if (conf->type == SOCK_RING_XDP) {
+            goto fail;
+        }
+        printf("%s: xdp unavailable on %s, use tpacket\n", __func__, conf->ifname);
+    }
+    r->type = SOCK_RING_TPACKET;
+    if (0 == tpacket_open(r)) {
+        return r;
+    }
+    tpacket_close(r);
+    ring_close_fd(r);
+fail:
+    pthread_mutex_destroy(&r->lock);
+    free(r->ports);
+    free(r);
+    return NULL;
+}
+
+void sock_ring_destroy(struct sock_ring *r)
+{
+    uint32_t i;
+    if (!r) {
+        return;
+    }
+    for (i = 0; i <= (uint32_t)(r->conf.port_max - r->conf.port_min); i++) {
+        if (r->ports[i]) {
+            close(r->ports[i]->sink_fd);
+            free(r->ports[i]);
+        }
+    }
+    if (r->type == SOCK_RING_XDP) {
+        xdp_close(r);
+    } else {
+        tpacket_close(r);
+    }
+    ring_close_fd(r);
+    pthread_mutex_destroy(&r->lock);
+    free(r->ports);
+    free(r);
+}
+
+enum sock_ring_type sock_ring_get_type(struct sock_ring *r)
+{
+    return r ? r->type : SOCK_RING_AUTO;
+}
+
+int sock_ring_fd(struct sock_ring *r)
+{
+    return r ? r->fd : -1;
+}
+
+int sock_ring_bind(struct sock_ring *r, uint16_t port, sock_ring_cb *cb, void *arg)
+{
+    struct ring_port *rp;
+
+    if (!r || !cb || port < r->conf.port_min || port > r->conf.port_max ||
+        r->ports[port - r->conf.port_min]) {
+        printf("%s: port %d out of range or bound\n", __func__, port);
+        return -1;
+    }
+    rp = calloc(1, sizeof(struct ring_port));
+    if (!rp) {
+        return -1;
+    }
+    rp->sink_fd = ring_sink_open(port);
+    if (rp->sink_fd == -1) {
+        free(rp);
+        return -1;
+    }
+    rp->cb = cb;
+    rp->arg = arg;
+    r->ports[port - r->conf.port_min] = rp;
+    return 0;
+}
+
+int sock_ring_unbind(struct sock_ring *r, uint16_t port)
+{
+    struct ring_port *rp;
+
+    if (!r || port < r->conf.port_min || port > r->conf.port_max) {
+        return -1;
+    }
+    rp = r->ports[port - r->conf.port_min];
+    if (!rp) {
+        return -1;
+    }
+    r->ports[port - r->conf.port_min] = NULL;
+    close(rp->sink_fd);
+    free(rp);
+    return 0;
+}
+
+int sock_ring_poll(struct sock_ring *r, int budget)
+{
+    if (!r) {
+        return -1;
+    }
+    if (r->type == SOCK_RING_XDP) {
+        return xdp_poll(r, budget);
+    }
+    return tpacket_poll(r, budget);
+}
+
+void *sock_ring_hold(struct sock_ring *r, struct sock_ring_pkt *pkt)
+{
+    uint32_t idx;
+    if (!r || !pkt || !pkt->owner) {
+        return NULL;
+    }
+    idx = (uint32_t)((uintptr_t)pkt->owner - 1);
+    if (r->type == SOCK_RING_XDP) {
+        __atomic_add_fetch(&r->frame_refs[idx], 1, __ATOMIC_RELAXED);
+    } else {
+        __atomic_add_fetch(&r->block_refs[idx], 1, __ATOMIC_RELAXED);
+    }
+    __atomic_add_fetch(&r->held, 1, __ATOMIC_RELAXED);
+    return pkt->owner;
+}
+
+void sock_ring_release(struct sock_ring *r, void *hold)
+{
+    uint32_t idx;
+    if (!r || !hold) {
+        return;
+    }
+    idx = (uint32_t)((uintptr_t)hold - 1);
+    __atomic_sub_fetch(&r->held, 1, __ATOMIC_RELAXED);
+    if (r->type == SOCK_RING_XDP) {
+        xdp_frame_put(r, idx, false);
+    } else {
+        tpacket_block_put(r, idx);
+    }
+}
+
+int sock_ring_get_stats(struct sock_ring *r, struct sock_ring_stats *stats)
+{
+    struct tpacket_stats_v3 ts;
+    struct xdp_statistics xs;
+    socklen_t len;
+
+    if (!r || !stats) {
+        return -1;
+    }
+    if (r->type == SOCK_RING_XDP) {
+        len = sizeof(xs);
+        if (0 == getsockopt(r->fd, SOL_XDP, XDP_STATISTICS, &xs, &len)) {
+            r->stats.kernel_drops = xs.rx_dropped + xs.rx_ring_full + xs.rx_fill_ring_empty_descs;
+        }
+    } else {
+        /* counters of AF_PACKET are reset by each read */
+        len = sizeof(ts);
+        if (0 == getsockopt(r->fd, SOL_PACKET, PACKET_STATISTICS, &ts, &len)) {
+            r->stats.kernel_drops += ts.tp_drops;
+        }
+    }
+    memcpy(stats, &r->stats, sizeof(*stats));
+    stats->held = __atomic_load_n(&r->held, __ATOMIC_RELAXED);
+    return 0;
+}
+
+#endif
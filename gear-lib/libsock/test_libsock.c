@@ -21,11 +21,14 @@
  ******************************************************************************/
 #include "libsock.h"
 #include "libsock_ext.h"
+#include <libgevent.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <errno.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <inttypes.h>
 #if defined (OS_LINUX)
 #include <signal.h>
 #endif
@@ -84,7 +87,9 @@ static void on_recv_buf_cli(struct sock_client *c, void *buf, size_t len)
 void usage()
 {
     fprintf(stderr, "./test_libsock -s port\n"
-                    "./test_libsock -c ip port\n");
+                    "./test_libsock -m port nshard\n"
+                    "./test_libsock -c ip port\n"
+                    "./test_libsock -u\n");
 }
 
 void addr_test()
@@ -131,6 +136,558 @@ void domain_test()
     #endif
 }
 
+void udp_batch_test()
+{
+    int i, n, fd, cli;
+    char sbuf[16][32], rbuf[16][64];
+    struct sock_msg smsg[16], rmsg[16];
+    struct sock_addr addr;
+
+    fd = sock_udp_bind("127.0.0.1", 0);
+    if (fd == -1) {
+        printf("sock_udp_bind failed!\n");
+        return;
+    }
+    sock_getaddr_by_fd(fd, &addr);
+    cli = sock_udp_bind("127.0.0.1", 0);
+    memset(smsg, 0, sizeof(smsg));
+    memset(rmsg, 0, sizeof(rmsg));
+    for (i = 0; i < 16; i++) {
+        snprintf(sbuf[i], sizeof(sbuf[i]), "datagram %d", i);
+        smsg[i].buf = sbuf[i];
+        smsg[i].len = strlen(sbuf[i]) + 1;
+        smsg[i].ip = sock_addr_pton("127.0.0.1");
+        smsg[i].port = addr.port;
+        rmsg[i].buf = rbuf[i];
+        rmsg[i].len = sizeof(rbuf[i]);
+    }
+    n = sock_sendmmsg(cli, smsg, 16);
+    printf("sock_sendmmsg sent %d\n", n);
+    n = sock_recvmmsg(fd, rmsg, 16, 0);
+    printf("sock_recvmmsg recv %d\n", n);
+    for (i = 0; i < n; i++) {
+        if (rmsg[i].len != smsg[i].len || strcmp(rbuf[i], sbuf[i])) {
+            printf("datagram %d mismatch: %s\n", i, rbuf[i]);
+        }
+    }
+    n = sock_recvmmsg(fd, rmsg, 16, 1);
+    printf("sock_recvmmsg nonblock recv %d\n", n);
+    sock_close(cli);
+    sock_close(fd);
+}
+
+void udp_gso_test()
+{
+    int i, n, fd, cli, total = 0;
+    static char sbuf[8 * 1000], rbuf[8][64 * 1024];
+    struct sock_msg smsg, rmsg[8];
+    struct sock_addr addr;
+
+    fd = sock_udp_bind("127.0.0.1", 0);
+    cli = sock_udp_bind("127.0.0.1", 0);
+    if (fd == -1 || cli == -1) {
+        printf("sock_udp_bind failed!\n");
+        return;
+    }
+    sock_getaddr_by_fd(fd, &addr);
+    if (0 != sock_set_udp_gro(fd, 1)) {
+        printf("udp gro not supported\n");
+    }
+    memset(sbuf, 'g', sizeof(sbuf));
+    memset(&smsg, 0, sizeof(smsg));
+    memset(rmsg, 0, sizeof(rmsg));
+    smsg.buf = sbuf;
+    smsg.len = sizeof(sbuf);
+    smsg.ip = sock_addr_pton("127.0.0.1");
+    smsg.port = addr.port;
+    smsg.segment = 1000;
+    n = sock_sendmmsg(cli, &smsg, 1);
+    printf("sock_sendmmsg gso sent %d\n", n);
+    for (i = 0; i < 8; i++) {
+        rmsg[i].buf = rbuf[i];
+        rmsg[i].len = sizeof(rbuf[i]);
+    }
+    while (n > 0 && total < (int)sizeof(sbuf)) {
+        n = sock_recvmmsg(fd, rmsg, 8, 0);
+        for (i = 0; i < n; i++) {
+            printf("recv %zu bytes, gro segment %d\n", rmsg[i].len, rmsg[i].segment);
+            total += rmsg[i].len;
+            rmsg[i].len = sizeof(rbuf[i]);
+        }
+    }
+    printf("udp gso recv total %d\n", total);
+    sock_close(cli);
+    sock_close(fd);
+}
+
+static void *zc_sink(void *arg)
+{
+    char buf[4096];
+    long total = 0;
+    int n, fd = *(int *)arg;
+    while ((n = recv(fd, buf, sizeof(buf), 0)) > 0) {
+        total += n;
+    }
+    printf("zerocopy sink recv %ld bytes\n", total);
+    return NULL;
+}
+
+void zerocopy_test()
+{
+    int i, fd, afd, n;
+    uint32_t ip, seq;
+    uint16_t port;
+    pthread_t tid;
+    struct sock_zc zc;
+    struct sock_addr addr;
+    struct sock_connection *conn;
+    static char buf[256 * 1024];
+
+    fd = sock_tcp_bind_listen("127.0.0.1", 0);
+    sock_getaddr_by_fd(fd, &addr);
+    conn = sock_tcp_connect("127.0.0.1", addr.port);
+    afd = sock_accept(fd, &ip, &port);
+    if (!conn || afd == -1) {
+        printf("zerocopy connect failed!\n");
+        return;
+    }
+    pthread_create(&tid, NULL, zc_sink, &afd);
+    if (0 != sock_zc_init(&zc, conn->fd)) {
+        printf("zerocopy not supported, copy send\n");
+    }
+    for (i = 0; i < 4; i++) {
+        memset(buf, 'a' + i, sizeof(buf));
+        n = sock_zc_send(&zc, buf, sizeof(buf), &seq);
+        /* buf is reused in next round, wait for kernel to release it */
+        if (0 != sock_zc_wait(&zc, seq, 1000)) {
+            printf("sock_zc_wait seq %u timeout\n", seq);
+        }
+        printf("sock_zc_send %d bytes seq=%u done=%u copied=%u\n", n, seq, zc.done, zc.copied);
+    }
+    sock_close(conn->fd);
+    free(conn);
+    pthread_join(tid, NULL);
+    sock_close(afd);
+    sock_close(fd);
+}
+
+#if defined (OS_LINUX)
+static int g_zc_released;
+static char g_zc_bufs[4][64 * 1024];
+
+static void on_zc_release(void *arg)
+{
+    memset(arg, 0, 64 * 1024);
+    g_zc_released++;
+}
+
+static void on_zc_check(struct gevent_wtimer *t, void *arg)
+{
+    if (g_zc_released == 4) {
+        gevent_base_loop_break((struct gevent_base *)arg);
+    }
+}
+
+static void on_zc_error(int fd, void *arg)
+{
+    printf("zerocopy event error %d\n", errno);
+}
+
+void zerocopy_release_test()
+{
+    int i, fd, afd;
+    uint32_t ip;
+    uint16_t port;
+    pthread_t tid;
+    struct sock_zc zc;
+    struct sock_addr addr;
+    struct sock_connection *conn;
+    struct sock_zc_event *ze;
+    struct gevent_wtimer timer;
+    struct gevent_base *evbase = gevent_base_create();
+
+    fd = sock_tcp_bind_listen("127.0.0.1", 0);
+    sock_getaddr_by_fd(fd, &addr);
+    conn = sock_tcp_connect("127.0.0.1", addr.port);
+    afd = sock_accept(fd, &ip, &port);
+    if (!conn || afd == -1) {
+        printf("zerocopy connect failed!\n");
+        return;
+    }
+    pthread_create(&tid, NULL, zc_sink, &afd);
+    sock_zc_init(&zc, conn->fd);
+    ze = sock_zc_event_add(evbase, &zc, NULL, NULL, on_zc_error, NULL);
+    for (i = 0; i < 4; i++) {
+        memset(g_zc_bufs[i], 'a' + i, sizeof(g_zc_bufs[i]));
+        sock_zc_send_release(&zc, g_zc_bufs[i], sizeof(g_zc_bufs[i]),
+                        on_zc_release, g_zc_bufs[i]);
+    }
+    /* completions arrive as EPOLLERR and are reaped by the event */
+    gevent_wtimer_init(&timer, on_zc_check, evbase);
+    gevent_wtimer_add(evbase, &timer, 10, TIMER_PERSIST);
+    gevent_base_loop(evbase);
+    gevent_wtimer_del(evbase, &timer);
+    sock_zc_event_del(ze);
+    printf("sock_zc_send_release released=%d pending=%u copied=%u\n",
+           g_zc_released, zc.pend_tail - zc.pend_head, zc.copied);
+    sock_close(conn->fd);
+    sock_zc_release_all(&zc);
+    free(conn);
+    pthread_join(tid, NULL);
+    sock_close(afd);
+    sock_close(fd);
+    gevent_base_destroy(evbase);
+}
+#endif
+
+void vector_test()
+{
+    int i, n, fd, afd, ufd, cli, total = 0;
+    uint32_t ip;
+    uint16_t port;
+    char hdr[8] = "header:", body[200][4], rbuf[1024], rhdr[7];
+    struct iovec iov[201], riov[2];
+    struct sock_addr addr;
+    struct sock_connection *conn;
+
+    fd = sock_tcp_bind_listen("127.0.0.1", 0);
+    sock_getaddr_by_fd(fd, &addr);
+    conn = sock_tcp_connect("127.0.0.1", addr.port);
+    afd = sock_accept(fd, &ip, &port);
+    iov[0].iov_base = hdr;
+    iov[0].iov_len = 7;
+    for (i = 0; i < 200; i++) {
+        snprintf(body[i], sizeof(body[i]), "%03d", i);
+        iov[i + 1].iov_base = body[i];
+        iov[i + 1].iov_len = 3;
+    }
+    /* more pieces than SOCK_IOV_MAX, sent in several windows */
+    n = sock_sendv(conn->fd, iov, 201);
+    printf("sock_sendv sent %d bytes\n", n);
+    riov[0].iov_base = rhdr;
+    riov[0].iov_len = sizeof(rhdr);
+    riov[1].iov_base = rbuf;
+    riov[1].iov_len = sizeof(rbuf);
+    while (total < n) {
+        i = sock_recvv(afd, riov, 2);
+        if (i <= 0) {
+            break;
+        }
+        total += i;
+        if (total >= (int)sizeof(rhdr)) {
+            riov[0].iov_len = 0;
+            riov[1].iov_base = rbuf + total - sizeof(rhdr);
+            riov[1].iov_len = sizeof(rbuf) - (total - sizeof(rhdr));
+        }
+    }
+    printf("sock_recvv recv %d bytes, %.7s %.6s...%.3s\n", total, rhdr, rbuf,
+           rbuf + total - sizeof(rhdr) - 3);
+    sock_close(conn->fd);
+    free(conn);
+    sock_close(afd);
+    sock_close(fd);
+
+    ufd = sock_udp_bind("127.0.0.1", 0);
+    cli = sock_udp_bind("127.0.0.1", 0);
+    sock_getaddr_by_fd(ufd, &addr);
+    n = sock_sendtov(cli, "127.0.0.1", addr.port, iov, 4);
+    memset(rbuf, 0, sizeof(rbuf));
+    riov[0].iov_base = rbuf;
+    riov[0].iov_len = sizeof(rbuf);
+    i = sock_recvv(ufd, riov, 1);
+    printf("sock_sendtov sent %d, recv %d: %s\n", n, i, rbuf);
+    sock_close(cli);
+    sock_close(ufd);
+}
+
+void pool_test()
+{
+    int fd, afd, first;
+    uint32_t ip;
+    uint16_t port;
+    struct sock_addr addr;
+    struct sock_pool_stats st;
+    struct sock_connection *conn;
+    struct sock_client *sc;
+    struct sock_pool *p = sock_pool_create(2, 1000);
+
+    fd = sock_tcp_bind_listen("127.0.0.1", 0);
+    sock_getaddr_by_fd(fd, &addr);
+    conn = sock_pool_get(p, "127.0.0.1", addr.port);
+    afd = sock_accept(fd, &ip, &port);
+    first = conn->fd;
+    sock_pool_put(p, "127.0.0.1", addr.port, conn, true);
+    conn = sock_pool_get(p, "127.0.0.1", addr.port);
+    printf("sock_pool reuse %s\n", conn->fd == first ? "ok" : "failed");
+    sock_pool_put(p, "127.0.0.1", addr.port, conn, true);
+    /* peer closes idle connection, pool must not hand it out */
+    sock_close(afd);
+    usleep(10 * 1000);
+    conn = sock_pool_get(p, "127.0.0.1", addr.port);
+    afd = sock_accept(fd, &ip, &port);
+    sock_pool_put(p, "127.0.0.1", addr.port, conn, true);
+
+    sc = sock_client_create("127.0.0.1", addr.port, SOCK_TYPE_TCP);
+    sock_client_set_pool(sc, p);
+    sock_client_connect(sc);
+    first = sc->fd;
+    sock_client_disconnect(sc);
+    sock_client_connect(sc);
+    printf("sock_client reuse %s\n", sc->fd == first ? "ok" : "failed");
+    sock_client_destroy(sc);
+
+    sock_pool_get_stats(p, &st);
+    printf("sock_pool hits=%" PRIu64 " misses=%" PRIu64 " dropped=%" PRIu64 " idle=%zu\n",
+           st.hits, st.misses, st.dropped, st.idle);
+    sock_pool_destroy(p);
+    sock_close(afd);
+    sock_close(fd);
+}
+
+static int g_dns_done = 0;
+
+static void on_dns(const char *host, int err, const struct sock_addr_list *al, void *arg)
+{
+    printf("dns %s err=%d ip=%s\n", host, err, al ? al->addr.ip_str : "none");
+    __sync_fetch_and_add(&g_dns_done, 1);
+}
+
+void dns_test()
+{
+    int i;
+    uint32_t ip = 0;
+    struct sock_dns_stats st;
+    struct sock_dns *d = sock_dns_create(2, 1000);
+
+    /* 4 queries in flight share one lookup */
+    for (i = 0; i < 4; i++) {
+        sock_dns_resolve(d, "localhost", on_dns, NULL);
+    }
+    sock_dns_resolve(d, "127.0.0.1", on_dns, NULL);
+    sock_dns_resolve(d, "no-such-host.invalid", on_dns, NULL);
+    for (i = 0; i < 500 && g_dns_done < 6; i++) {
+        usleep(10 * 1000);
+    }
+    sock_dns_lookup(d, "LOCALHOST", &ip);
+    sock_dns_get_stats(d, &st);
+    printf("sock_dns lookup %x hits=%" PRIu64 " misses=%" PRIu64 " coalesced=%" PRIu64
+           " failures=%" PRIu64 " entries=%zu\n", ip, st.hits, st.misses,
+           st.coalesced, st.failures, st.entries);
+    sock_dns_destroy(d);
+}
+
+static int g_shard_conn = 0;
+
+static void on_connect_shard(struct sock_server *s, struct sock_connection *conn)
+{
+    __sync_fetch_and_add(&g_shard_conn, 1);
+}
+
+static void *shard_dispatch(void *arg)
+{
+    sock_server_dispatch((struct sock_server *)arg);
+    return NULL;
+}
+
+void shard_test()
+{
+    int i;
+    pthread_t tid;
+    struct sock_addr addr;
+    struct sock_server *ss;
+    struct sock_connection *conn[32];
+
+    ss = sock_server_create_sharded("127.0.0.1", 0, SOCK_TYPE_TCP, 4);
+    if (!ss) {
+        printf("sock_server_create_sharded failed!\n");
+        return;
+    }
+    sock_server_set_callback(ss, on_connect_shard, on_recv_buf, NULL);
+    pthread_create(&tid, NULL, shard_dispatch, ss);
+    sock_getaddr_by_fd(ss->fd, &addr);
+    for (i = 0; i < 32; i++) {
+        conn[i] = sock_tcp_connect("127.0.0.1", addr.port);
+    }
+    for (i = 0; i < 100 && g_shard_conn < 32; i++) {
+        usleep(10 * 1000);
+    }
+    printf("sock_server %d shards accepted %d connections\n", ss->nshard, g_shard_conn);
+    for (i = 0; i < 32; i++) {
+        if (conn[i]) {
+            sock_close(conn[i]->fd);
+            free(conn[i]);
+        }
+    }
+    gevent_base_loop_break(ss->evbase);
+    pthread_join(tid, NULL);
+    sock_server_destroy(ss);
+}
+
+static int g_conn_open = 0;
+static int g_conn_frames = 0;
+
+static void conn_on_open(struct sock_server_conn *c)
+{
+    c->ctx = calloc(1, sizeof(int));
+    __sync_fetch_and_add(&g_conn_open, 1);
+}
+
+/* frame is one byte length and payload, echo whole frames only */
+static size_t conn_on_data(struct sock_server_conn *c, void *buf, size_t len)
+{
+    size_t off = 0, flen;
+    uint8_t *p = (uint8_t *)buf;
+    while (off < len) {
+        flen = 1 + p[off];
+        if (len - off < flen) {
+            break;
+        }
+        sock_server_conn_write(c, p + off, flen);
+        (*(int *)c->ctx)++;
+        off += flen;
+    }
+    return off;
+}
+
+static void conn_on_close(struct sock_server_conn *c, int err)
+{
+    __sync_fetch_and_add(&g_conn_frames, *(int *)c->ctx);
+    free(c->ctx);
+    c->ctx = NULL;
+}
+
+void conn_mode_test()
+{
+    int i, j, ok = 0;
+    pthread_t tid;
+    struct sock_addr addr;
+    struct sock_server *ss;
+    struct sock_connection *conn[8];
+    struct sock_server_conn_cbs cbs = {
+        .on_open  = conn_on_open,
+        .on_data  = conn_on_data,
+        .on_close = conn_on_close,
+    };
+    uint8_t frame[50 * 17], echo[sizeof(frame)];
+    size_t flen = 0;
+
+    for (i = 0; i < 50; i++) {
+        frame[flen] = i % 17;
+        memset(frame + flen + 1, 'a' + i % 26, frame[flen]);
+        flen += 1 + frame[flen];
+    }
+    ss = sock_server_create_sharded("127.0.0.1", 0, SOCK_TYPE_TCP, 2);
+    if (!ss) {
+        printf("sock_server_create_sharded failed!\n");
+        return;
+    }
+    sock_server_set_conn_callback(ss, &cbs);
+    pthread_create(&tid, NULL, shard_dispatch, ss);
+    sock_getaddr_by_fd(ss->fd, &addr);
+    for (i = 0; i < 8; i++) {
+        conn[i] = sock_tcp_connect("127.0.0.1", addr.port);
+        if (!conn[i]) {
+            continue;
+        }
+        /* split frames across sends to exercise partial consume */
+        for (j = 0; j < (int)flen; j += 7) {
+            sock_send(conn[i]->fd, frame + j, MIN2(7, (int)flen - j));
+        }
+    }
+    for (i = 0; i < 8; i++) {
+        if (!conn[i]) {
+            continue;
+        }
+        for (j = 0; j < (int)flen; ) {
+            int n = sock_recv(conn[i]->fd, echo + j, flen - j);
+            if (n <= 0) {
+                break;
+            }
+            j += n;
+        }
+        if (j == (int)flen && !memcmp(frame, echo, flen)) {
+            ok++;
+        }
+        sock_close(conn[i]->fd);
+        free(conn[i]);
+    }
+    for (i = 0; i < 100 && g_conn_frames < ok * 50; i++) {
+        usleep(10 * 1000);
+    }
+    gevent_base_loop_break(ss->evbase);
+    pthread_join(tid, NULL);
+    sock_server_destroy(ss);
+    printf("sock_server conn mode open=%d echo_ok=%d frames=%d\n",
+           g_conn_open, ok, g_conn_frames);
+}
+
+#if defined (OS_LINUX)
+static int g_tcp_samples;
+
+static void on_tcp_sample(int fd, const struct tcp_info *ti, void *arg)
+{
+    struct gevent_base *evbase = (struct gevent_base *)arg;
+    printf("tcp sample fd=%d rtt=%uus cwnd=%u\n", fd, ti->tcpi_rtt, ti->tcpi_snd_cwnd);
+    if (++g_tcp_samples == 3) {
+        gevent_base_loop_break(evbase);
+    }
+}
+#endif
+
+void tcp_profile_test()
+{
+    int on = 0;
+    char cc[16] = {0};
+    uint32_t lowat = 0;
+    socklen_t len;
+    struct sock_addr addr;
+    struct sock_connection *c;
+    int lfd = sock_tcp_bind_listen("127.0.0.1", 0);
+
+    sock_getaddr_by_fd(lfd, &addr);
+    c = sock_tcp_connect("127.0.0.1", addr.port);
+    if (!c) {
+        sock_close(lfd);
+        return;
+    }
+    sock_set_tcp_profile(c->fd, SOCK_TCP_MEDIA, 4 * 1024 * 1024);
+    len = sizeof(on);
+    getsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &on, &len);
+#if defined (TCP_NOTSENT_LOWAT)
+    len = sizeof(lowat);
+    getsockopt(c->fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &lowat, &len);
+#endif
+#if defined (TCP_CONGESTION)
+    len = sizeof(cc) - 1;
+    getsockopt(c->fd, IPPROTO_TCP, TCP_CONGESTION, cc, &len);
+#endif
+    printf("tcp media profile nodelay=%d notsent_lowat=%u cc=%s\n", on, lowat, cc);
+    sock_set_tcp_profile(c->fd, SOCK_TCP_BULK, 0);
+    len = sizeof(on);
+    getsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &on, &len);
+#if defined (TCP_CONGESTION)
+    len = sizeof(cc) - 1;
+    getsockopt(c->fd, IPPROTO_TCP, TCP_CONGESTION, cc, &len);
+#endif
+    printf("tcp bulk profile nodelay=%d cc=%s\n", on, cc);
+#if defined (OS_LINUX)
+    {
+        struct gevent_base *evbase = gevent_base_create();
+        struct sock_tcp_sampler *ts = sock_tcp_sampler_create(evbase, c->fd, 10,
+                        on_tcp_sample, evbase);
+        if (ts) {
+            gevent_base_loop(evbase);
+            sock_tcp_sampler_destroy(ts);
+        }
+        printf("tcp sampler samples=%d\n", g_tcp_samples);
+        gevent_base_destroy(evbase);
+    }
+#endif
+    sock_close(c->fd);
+    free(c);
+    sock_close(lfd);
+}
+
 void ctrl_c_op(int signo)
 {
     exit(0);
@@ -160,6 +717,12 @@ int main(int argc, char **argv)
         ss = sock_server_create(NULL, port, SOCK_TYPE_TCP);
         sock_server_set_callback(ss, on_connect_server, on_recv_buf, NULL);
         sock_server_dispatch(ss);
+    } else if (!strcmp(argv[1], "-m")) {
+        port = (argc >= 3) ? atoi(argv[2]) : 0;
+        n = (argc >= 4) ? atoi(argv[3]) : 0;
+        ss = sock_server_create_sharded(NULL, port, SOCK_TYPE_TCP, n);
+        sock_server_set_callback(ss, on_connect_server, on_recv_buf, NULL);
+        sock_server_dispatch(ss);
     } else if (!strcmp(argv[1], "-S")) {
         if (argc == 3)
             port = atoi(argv[2]);
@@ -229,6 +792,21 @@ int main(int argc, char **argv)
     if (!strcmp(argv[1], "-d")) {
         domain_test();
     }
+    if (!strcmp(argv[1], "-u")) {
+        udp_batch_test();
+        udp_gso_test();
+        shard_test();
+        zerocopy_test();
+#if defined (OS_LINUX)
+        zerocopy_release_test();
+#endif
+        vector_test();
+        dns_test();
+        pool_test();
+        conn_mode_test();
+        tcp_profile_test();
+        return 0;
+    }
     while (1) sleep(1);
     return 0;
 }
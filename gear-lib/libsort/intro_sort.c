@@ -0,0 +1,207 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#include "common.h"
+#include <string.h>
+
+/*
+ * introsort: quick sort with median of three pivot, falls back to heap
+ * sort when recursion goes deeper than 2*log2(n), small ranges finished
+ * by insertion sort. O(n log n) worst case, no extra memory.
+ */
+#define INSERTION_THRESHOLD     16
+
+static void elem_swap(byte *p, byte *q, size_t size)
+{
+    if (size == sizeof(uint32_t)) {
+        uint32_t t;
+        memcpy(&t, p, sizeof(t));
+        memcpy(p, q, sizeof(t));
+        memcpy(q, &t, sizeof(t));
+    } else if (size == sizeof(uint64_t)) {
+        uint64_t t;
+        memcpy(&t, p, sizeof(t));
+        memcpy(p, q, sizeof(t));
+        memcpy(q, &t, sizeof(t));
+    } else {
+        byte_swap(p, q, size);
+    }
+}
+
+static void insertion_sort(byte *base, size_t num, size_t size, fp_cmp cmp)
+{
+    byte *i, *j, *end = base + num * size;
+    for (i = base + size; i < end; i += size) {
+        for (j = i; j > base && cmp(j - size, j, size) > 0; j -= size) {
+            elem_swap(j - size, j, size);
+        }
+    }
+}
+
+/*
+ * partition around median of three, return final pivot position,
+ * num must be larger than 3
+ */
+static byte *partition(byte *base, size_t num, size_t size, fp_cmp cmp)
+{
+    byte *mid, *last, *lo, *hi;
+
+    mid = base + (num / 2) * size;
+    last = base + (num - 1) * size;
+    /* order first, mid, last, then use median as pivot at base */
+    if (cmp(mid, base, size) < 0)
+        elem_swap(mid, base, size);
+    if (cmp(last, mid, size) < 0) {
+        elem_swap(last, mid, size);
+        if (cmp(mid, base, size) < 0)
+            elem_swap(mid, base, size);
+    }
+    elem_swap(base, mid, size);
+
+    /* hoare partition, last >= pivot and pivot itself are sentinels */
+    lo = base + size;
+    hi = last;
+    while (1) {
+        while (cmp(lo, base, size) < 0)
+            lo += size;
+        while (cmp(base, hi, size) < 0)
+            hi -= size;
+        if (lo >= hi)
+            break;
+        elem_swap(lo, hi, size);
+        lo += size;
+        hi -= size;
+    }
+    elem_swap(base, hi, size);
+    return hi;
+}
+
+static void introsort_loop(byte *base, size_t num, size_t size, fp_cmp cmp,
+                int depth)
+{
+    byte *hi;
+    size_t nl, nr;
+
+    while (num > INSERTION_THRESHOLD) {
+        if (depth-- == 0) {
+            heap_sort(base, num, size, cmp);
+            return;
+        }
+        hi = partition(base, num, size, cmp);
+
+        /* recurse into smaller side, loop on larger, stack is O(log n) */
+        nl = (hi - base) / size;
+        nr = num - nl - 1;
+        if (nl < nr) {
+            introsort_loop(base, nl, size, cmp, depth);
+            base = hi + size;
+            num = nr;
+        } else {
+            introsort_loop(hi + size, nr, size, cmp, depth);
+            num = nl;
+        }
+    }
+    insertion_sort(base, num, size, cmp);
+}
+
+/* depth limit before falling back to heap sort */
+static int log2_depth(size_t num)
+{
+    int depth = 0;
+    for (; num > 1; num >>= 1) {
+        depth += 2;
+    }
+    return depth;
+}
+
+int intro_sort(void *array, size_t num, size_t size, fp_cmp cmp)
+{
+    if (!array || !size) {
+        printf("invalid parameter!\n");
+        return -1;
+    }
+    if (num < 2) {
+        return 0;
+    }
+    if (!cmp) cmp = default_cmp;
+    introsort_loop((byte *)array, num, size, cmp, log2_depth(num));
+    return 0;
+}
+
+/*
+ * introselect: partition only the side holding k, so element k ends up
+ * in sorted position with smaller before and larger after, O(n) average
+ */
+static void nth_element_loop(byte *base, size_t num, size_t size, size_t k,
+                fp_cmp cmp, int depth)
+{
+    byte *hi;
+    size_t idx;
+
+    while (num > INSERTION_THRESHOLD) {
+        if (depth-- == 0) {
+            heap_sort(base, num, size, cmp);
+            return;
+        }
+        hi = partition(base, num, size, cmp);
+        idx = (hi - base) / size;
+        if (k == idx) {
+            return;
+        }
+        if (k < idx) {
+            num = idx;
+        } else {
+            base = hi + size;
+            k -= idx + 1;
+            num -= idx + 1;
+        }
+    }
+    insertion_sort(base, num, size, cmp);
+}
+
+int nth_element(void *array, size_t num, size_t size, size_t k, fp_cmp cmp)
+{
+    if (!array || !size || k >= num) {
+        printf("invalid parameter!\n");
+        return -1;
+    }
+    if (!cmp) cmp = default_cmp;
+    nth_element_loop((byte *)array, num, size, k, cmp, log2_depth(num));
+    return 0;
+}
+
+int partial_sort(void *array, size_t num, size_t size, size_t k, fp_cmp cmp)
+{
+    if (!array || !size) {
+        printf("invalid parameter!\n");
+        return -1;
+    }
+    if (!cmp) cmp = default_cmp;
+    if (k == 0) {
+        return 0;
+    }
+    if (k < num) {
+        /* select k smallest to front, then only sort them */
+        nth_element_loop((byte *)array, num, size, k - 1, cmp, log2_depth(num));
+        num = k;
+    }
+    return intro_sort(array, num, size, cmp);
+}
@@ -22,6 +22,124 @@ typedef int (*fp_cmp)(const void *a, const void *b, size_t size);
 void heap_sort(void *base, size_t num, size_t size, fp_cmp cmp);
 int bubble_sort(void *array, size_t num, size_t size, fp_cmp cmp);
 
+/* quick sort + heap sort fallback + insertion sort, O(n log n) worst case */
+int intro_sort(void *array, size_t num, size_t size, fp_cmp cmp);
+
+/*
+ * nth_element: element k goes to its sorted position, smaller ones before
+ * it and larger after in any order, O(n) average
+ * partial_sort: k smallest elements sorted at front, rest in any order,
+ * top-k largest with reversed cmp
+ */
+int nth_element(void *array, size_t num, size_t size, size_t k, fp_cmp cmp);
+int partial_sort(void *array, size_t num, size_t size, size_t k, fp_cmp cmp);
+
+/*
+ * streaming top-k: keeps the k largest elements pushed by cmp, reversed cmp
+ * keeps the k smallest. topk_result writes them to out largest first and
+ * returns count, the set is kept so pushing can go on
+ */
+struct topk;
+struct topk *topk_create(size_t k, size_t size, fp_cmp cmp);
+void topk_destroy(struct topk *t);
+void topk_reset(struct topk *t);
+int topk_push(struct topk *t, const void *elem);
+size_t topk_result(struct topk *t, void *out);
+
+/* lsd radix sort of integer keys, O(n), allocates n elements buffer */
+int radix_sort_u32(uint32_t *array, size_t num);
+int radix_sort_u64(uint64_t *array, size_t num);
+int radix_sort_i32(int32_t *array, size_t num);
+int radix_sort_i64(int64_t *array, size_t num);
+
+/* intro_sort runs in nthread threads then merge, stable across runs only */
+int parallel_sort(void *array, size_t num, size_t size, fp_cmp cmp, int nthread);
+/* same, sort runs and merge passes are tasks of a libworkq pool */
+struct workq_pool;
+int parallel_sort_pool(void *array, size_t num, size_t size, fp_cmp cmp,
+                struct workq_pool *pool);
+
+/*
+ * DEFINE_SORT(name, type, cmp) defines static void name(type *a, size_t n),
+ * an intro_sort specialized for type, cmp(const type *, const type *)
+ * returns <0/0/>0 like fp_cmp and can be a macro, so compare and element
+ * copy are inlined instead of called through fp_cmp and byte swap
+ */
+#define DEFINE_SORT(name, type, cmp)                                          \
+static void name##_sift(type *a, size_t i, size_t n)                          \
+{                                                                             \
+    size_t c;                                                                 \
+    type t;                                                                   \
+    while ((c = i * 2 + 1) < n) {                                             \
+        if (c + 1 < n && cmp(&a[c], &a[c + 1]) < 0)                           \
+            c++;                                                              \
+        if (cmp(&a[i], &a[c]) >= 0)                                           \
+            break;                                                            \
+        t = a[i]; a[i] = a[c]; a[c] = t;                                      \
+        i = c;                                                                \
+    }                                                                         \
+}                                                                             \
+static void name##_loop(type *a, size_t n, int depth)                         \
+{                                                                             \
+    size_t i, j, m;                                                           \
+    type p, t;                                                                \
+    while (n > 16) {                                                          \
+        if (depth-- == 0) {                                                   \
+            for (i = n / 2; i-- > 0;)                                         \
+                name##_sift(a, i, n);                                         \
+            for (i = n - 1; i > 0; i--) {                                     \
+                t = a[0]; a[0] = a[i]; a[i] = t;                              \
+                name##_sift(a, 0, i);                                         \
+            }                                                                 \
+            return;                                                           \
+        }                                                                     \
+        /* median of three, first and last are sentinels */                   \
+        m = n / 2;                                                            \
+        if (cmp(&a[m], &a[0]) < 0) { t = a[m]; a[m] = a[0]; a[0] = t; }       \
+        if (cmp(&a[n - 1], &a[m]) < 0) {                                      \
+            t = a[n - 1]; a[n - 1] = a[m]; a[m] = t;                          \
+            if (cmp(&a[m], &a[0]) < 0) { t = a[m]; a[m] = a[0]; a[0] = t; }   \
+        }                                                                     \
+        p = a[m];                                                             \
+        i = 0;                                                                \
+        j = n - 1;                                                            \
+        for (;;) {                                                            \
+            while (cmp(&a[i], &p) < 0)                                        \
+                i++;                                                          \
+            while (cmp(&p, &a[j]) < 0)                                        \
+                j--;                                                          \
+            if (i >= j)                                                       \
+                break;                                                        \
+            t = a[i]; a[i] = a[j]; a[j] = t;                                  \
+            i++;                                                              \
+            j--;                                                              \
+        }                                                                     \
+        /* [0, j] <= pivot <= [j + 1, n), loop on the larger side */          \
+        if (j + 1 < n - j - 1) {                                              \
+            name##_loop(a, j + 1, depth);                                     \
+            a += j + 1;                                                       \
+            n -= j + 1;                                                       \
+        } else {                                                              \
+            name##_loop(a + j + 1, n - j - 1, depth);                         \
+            n = j + 1;                                                        \
+        }                                                                     \
+    }                                                                         \
+    for (i = 1; i < n; i++) {                                                 \
+        t = a[i];                                                             \
+        for (j = i; j > 0 && cmp(&t, &a[j - 1]) < 0; j--)                     \
+            a[j] = a[j - 1];                                                  \
+        a[j] = t;                                                             \
+    }                                                                         \
+}                                                                             \
+static void name(type *a, size_t n)                                           \
+{                                                                             \
+    int depth = 0;                                                            \
+    size_t k;                                                                 \
+    for (k = n; k > 1; k >>= 1)                                               \
+        depth += 2;                                                           \
+    name##_loop(a, n, depth);                                                 \
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,215 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#include "common.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <libworkq.h>
+
+/*
+ * parallel sort: split array into one run per thread, intro_sort each
+ * run in its own thread, then merge adjacent runs pair by pair, merges of
+ * one pass also run in parallel. needs n extra memory for merging.
+ * with a workq pool, runs and merges are workq_parallel_for indexes, so no
+ * thread is created per pass and the caller sorts its share too
+ */
+#define PARALLEL_MIN_RUN    4096
+#define PARALLEL_MAX_THREAD 64
+
+struct sort_task {
+    byte *src;
+    byte *dst;
+    size_t lo;
+    size_t mid;
+    size_t hi;
+    size_t size;
+    fp_cmp cmp;
+};
+
+struct sort_pass {
+    struct sort_task *task;
+    void *(*fn)(void *);
+};
+
+static void sort_run_for(int i, void *arg)
+{
+    struct sort_pass *s = (struct sort_pass *)arg;
+    s->fn(&s->task[i]);
+}
+
+static void *sort_run(void *arg)
+{
+    struct sort_task *t = (struct sort_task *)arg;
+    intro_sort(t->src + t->lo * t->size, t->hi - t->lo, t->size, t->cmp);
+    return NULL;
+}
+
+/* stable merge of src[lo, mid) and src[mid, hi) into dst[lo, hi) */
+static void *merge_run(void *arg)
+{
+    struct sort_task *t = (struct sort_task *)arg;
+    size_t size = t->size;
+    byte *a = t->src + t->lo * size, *ae = t->src + t->mid * size;
+    byte *b = ae, *be = t->src + t->hi * size;
+    byte *d = t->dst + t->lo * size;
+
+    while (a < ae && b < be) {
+        if (t->cmp(b, a, size) < 0) {
+            memcpy(d, b, size);
+            b += size;
+        } else {
+            memcpy(d, a, size);
+            a += size;
+        }
+        d += size;
+    }
+    memcpy(d, a, ae - a);
+    d += ae - a;
+    memcpy(d, b, be - b);
+    return NULL;
+}
+
+static void run_tasks(struct workq_pool *pool, struct sort_task *task, int n,
+                void *(*fn)(void *))
+{
+    int i;
+    pthread_t tid[PARALLEL_MAX_THREAD];
+    int started[PARALLEL_MAX_THREAD];
+    struct sort_pass pass;
+
+    if (pool) {
+        pass.task = task;
+        pass.fn = fn;
+        if (0 == workq_parallel_for(pool, 0, n, 1, sort_run_for, &pass)) {
+            return;
+        }
+        /* invalid pool, nothing ran, do it on threads */
+    }
+
+    /* current thread takes first task itself */
+    for (i = 1; i < n; i++) {
+        started[i] = (0 == pthread_create(&tid[i], NULL, fn, &task[i]));
+        if (!started[i]) {
+            fn(&task[i]);
+        }
+    }
+    fn(&task[0]);
+    for (i = 1; i < n; i++) {
+        if (started[i]) {
+            pthread_join(tid[i], NULL);
+        }
+    }
+}
+
+static int sort_split(void *array, size_t num, size_t size, fp_cmp cmp,
+                int nthread, struct workq_pool *pool)
+{
+    int i, nrun;
+    size_t bound[PARALLEL_MAX_THREAD + 1];
+    struct sort_task task[PARALLEL_MAX_THREAD];
+    byte *src = (byte *)array, *dst, *tmp;
+
+    if (!array || !size) {
+        printf("invalid parameter!\n");
+        return -1;
+    }
+    if (!cmp) cmp = default_cmp;
+    if (nthread > PARALLEL_MAX_THREAD) {
+        nthread = PARALLEL_MAX_THREAD;
+    }
+    while (nthread > 1 && num / nthread < PARALLEL_MIN_RUN) {
+        nthread--;
+    }
+    if (nthread <= 1) {
+        return intro_sort(array, num, size, cmp);
+    }
+    dst = (byte *)malloc(num * size);
+    if (!dst) {
+        printf("malloc merge buffer failed!\n");
+        return intro_sort(array, num, size, cmp);
+    }
+
+    nrun = nthread;
+    for (i = 0; i <= nrun; i++) {
+        bound[i] = num * i / nrun;
+    }
+    for (i = 0; i < nrun; i++) {
+        task[i].src = src;
+        task[i].lo = bound[i];
+        task[i].hi = bound[i + 1];
+        task[i].size = size;
+        task[i].cmp = cmp;
+    }
+    run_tasks(pool, task, nrun, sort_run);
+
+    while (nrun > 1) {
+        int n = 0;
+        for (i = 0; i + 1 < nrun; i += 2, n++) {
+            task[n].src = src;
+            task[n].dst = dst;
+            task[n].lo = bound[i];
+            task[n].mid = bound[i + 1];
+            task[n].hi = bound[i + 2];
+            task[n].size = size;
+            task[n].cmp = cmp;
+        }
+        if (nrun & 1) {
+            /* odd run out, copy as is */
+            memcpy(dst + bound[nrun - 1] * size, src + bound[nrun - 1] * size,
+                   (bound[nrun] - bound[nrun - 1]) * size);
+        }
+        run_tasks(pool, task, n, merge_run);
+        for (i = 0; i < n; i++) {
+            bound[i] = bound[2 * i];
+        }
+        bound[n] = bound[nrun - (nrun & 1)];
+        if (nrun & 1) {
+            bound[++n] = num;
+        }
+        nrun = n;
+        tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+    if (src != (byte *)array) {
+        memcpy(array, src, num * size);
+        dst = src;
+    }
+    free(dst);
+    return 0;
+}
+
+int parallel_sort(void *array, size_t num, size_t size, fp_cmp cmp, int nthread)
+{
+    return sort_split(array, num, size, cmp, nthread, NULL);
+}
+
+int parallel_sort_pool(void *array, size_t num, size_t size, fp_cmp cmp,
+                struct workq_pool *pool)
+{
+    if (!pool) {
+        printf("invalid parameter!\n");
+        return -1;
+    }
+    /* one run per workq plus caller, as workq_parallel_for spreads them */
+    return sort_split(array, num, size, cmp, pool->wq_array.num + 1, pool);
+}
@@ -0,0 +1,103 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#include "libsort.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * lsd radix sort of integer keys, one histogram pass counts all digits,
+ * then one scatter pass per 8 bit digit, digits where all keys fall in
+ * the same bucket are skipped. O(n) with n extra memory.
+ */
+#define RADIX_BITS      8
+#define RADIX_SIZE      (1 << RADIX_BITS)
+#define RADIX_MASK      (RADIX_SIZE - 1)
+
+#define DEFINE_RADIX_SORT(name, type, flip)                                   \
+int name(type *array, size_t num)                                             \
+{                                                                             \
+    size_t i, d, digits = sizeof(type);                                       \
+    size_t hist[sizeof(type)][RADIX_SIZE];                                    \
+    type *src = array, *dst, *tmp;                                            \
+                                                                              \
+    if (!array) {                                                             \
+        printf("invalid parameter!\n");                                       \
+        return -1;                                                            \
+    }                                                                         \
+    if (num < 2) {                                                            \
+        return 0;                                                             \
+    }                                                                         \
+    dst = (type *)malloc(num * sizeof(type));                                 \
+    if (!dst) {                                                               \
+        printf("malloc radix buffer failed!\n");                              \
+        return -1;                                                            \
+    }                                                                         \
+    memset(hist, 0, sizeof(hist));                                            \
+    for (i = 0; i < num; i++) {                                               \
+        type k = array[i] ^ (flip);                                           \
+        for (d = 0; d < digits; d++) {                                        \
+            hist[d][(k >> (d * RADIX_BITS)) & RADIX_MASK]++;                  \
+        }                                                                     \
+    }                                                                         \
+    for (d = 0; d < digits; d++) {                                            \
+        size_t sum = 0, *h = hist[d];                                         \
+        type k0 = src[0] ^ (flip);                                            \
+        if (h[(k0 >> (d * RADIX_BITS)) & RADIX_MASK] == num) {                \
+            continue;   /* all keys share this digit */                       \
+        }                                                                     \
+        for (i = 0; i < RADIX_SIZE; i++) {                                    \
+            size_t c = h[i];                                                  \
+            h[i] = sum;                                                       \
+            sum += c;                                                         \
+        }                                                                     \
+        for (i = 0; i < num; i++) {                                           \
+            type k = src[i] ^ (flip);                                         \
+            dst[h[(k >> (d * RADIX_BITS)) & RADIX_MASK]++] = src[i];          \
+        }                                                                     \
+        tmp = src;                                                            \
+        src = dst;                                                            \
+        dst = tmp;                                                            \
+    }                                                                         \
+    if (src != array) {                                                       \
+        memcpy(array, src, num * sizeof(type));                               \
+        dst = src;                                                            \
+    }                                                                         \
+    free(dst);                                                                \
+    return 0;                                                                 \
+}
+
+/* signed keys flip sign bit so negative sort before positive */
+DEFINE_RADIX_SORT(radix_sort_u32, uint32_t, 0)
+DEFINE_RADIX_SORT(radix_sort_u64, uint64_t, 0)
+static DEFINE_RADIX_SORT(radix_sort_flip32, uint32_t, (uint32_t)1 << 31)
+static DEFINE_RADIX_SORT(radix_sort_flip64, uint64_t, (uint64_t)1 << 63)
+
+int radix_sort_i32(int32_t *array, size_t num)
+{
+    return radix_sort_flip32((uint32_t *)array, num);
+}
+
+int radix_sort_i64(int64_t *array, size_t num)
+{
+    return radix_sort_flip64((uint64_t *)array, num);
+}
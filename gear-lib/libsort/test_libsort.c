@@ -8,7 +8,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
+#include <sys/time.h>
 #include "libsort.h"
+#include <libworkq.h>
 
 #define print_array(type, format, array) \
     do {\
@@ -71,9 +74,176 @@ void test_bsort()
     print_array(float, "%f\t", f);
 
 }
+static int int_compare(const void *a, const void *b, size_t size)
+{
+    int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+static uint64_t now_us(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static int check_sorted(const int *a, size_t n)
+{
+    size_t i;
+    for (i = 1; i < n; i++) {
+        if (a[i - 1] > a[i]) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+#define FAST_N  (1 << 20)
+
+#define INT_CMP(x, y)   ((*(x) > *(y)) - (*(x) < *(y)))
+DEFINE_SORT(int_sort, int, INT_CMP)
+
+void test_fastsort()
+{
+    size_t i;
+    uint64_t t;
+    int *a = (int *)malloc(FAST_N * sizeof(int));
+    int *b = (int *)malloc(FAST_N * sizeof(int));
+    int *c = (int *)malloc(FAST_N * sizeof(int));
+    uint32_t r = 12345;
+
+    for (i = 0; i < FAST_N; i++) {
+        r = r * 1103515245 + 12345;
+        a[i] = (int)(r >> 1) - (1 << 30);
+    }
+    memcpy(b, a, FAST_N * sizeof(int));
+    memcpy(c, a, FAST_N * sizeof(int));
+
+    t = now_us();
+    intro_sort(a, FAST_N, sizeof(int), int_compare);
+    printf("intro_sort    %d: %6lu us %s\n", FAST_N, (unsigned long)(now_us() - t),
+           check_sorted(a, FAST_N) ? "failed" : "ok");
+    t = now_us();
+    radix_sort_i32((int32_t *)b, FAST_N);
+    printf("radix_sort    %d: %6lu us %s\n", FAST_N, (unsigned long)(now_us() - t),
+           memcmp(a, b, FAST_N * sizeof(int)) ? "failed" : "ok");
+    t = now_us();
+    parallel_sort(c, FAST_N, sizeof(int), int_compare, 4);
+    printf("parallel_sort %d: %6lu us %s\n", FAST_N, (unsigned long)(now_us() - t),
+           memcmp(a, c, FAST_N * sizeof(int)) ? "failed" : "ok");
+    memcpy(c, b, FAST_N * sizeof(int));
+    {
+        struct workq_pool *pool = workq_pool_create();
+        t = now_us();
+        parallel_sort_pool(c, FAST_N, sizeof(int), int_compare, pool);
+        printf("parallel_sort_pool %d: %6lu us %s\n", FAST_N, (unsigned long)(now_us() - t),
+               memcmp(a, c, FAST_N * sizeof(int)) ? "failed" : "ok");
+        workq_pool_destroy(pool);
+    }
+    memcpy(c, b, FAST_N * sizeof(int));
+    t = now_us();
+    int_sort(c, FAST_N);
+    printf("DEFINE_SORT   %d: %6lu us %s\n", FAST_N, (unsigned long)(now_us() - t),
+           memcmp(a, c, FAST_N * sizeof(int)) ? "failed" : "ok");
+
+    /* sorted, reversed and all equal input must not go quadratic */
+    intro_sort(a, FAST_N, sizeof(int), int_compare);
+    for (i = 0; i < FAST_N; i++) {
+        b[i] = FAST_N - i;
+        c[i] = 7;
+    }
+    intro_sort(b, FAST_N, sizeof(int), int_compare);
+    intro_sort(c, FAST_N, sizeof(int), int_compare);
+    printf("intro_sort patterns: %s\n", (check_sorted(a, FAST_N) ||
+           check_sorted(b, FAST_N) || check_sorted(c, FAST_N)) ? "failed" : "ok");
+    for (i = 0; i < FAST_N; i++) {
+        b[i] = FAST_N - i;
+        c[i] = i % 3;
+    }
+    int_sort(a, FAST_N);
+    int_sort(b, FAST_N);
+    int_sort(c, FAST_N);
+    printf("DEFINE_SORT patterns: %s\n", (check_sorted(a, FAST_N) ||
+           check_sorted(b, FAST_N) || check_sorted(c, FAST_N)) ? "failed" : "ok");
+    free(a);
+    free(b);
+    free(c);
+}
+
+#define TOPK_N  (100000)
+
+void test_topk()
+{
+    size_t i, j;
+    int fail = 0;
+    size_t ks[] = {0, 1, 10, 1000, TOPK_N / 2, TOPK_N - 1, TOPK_N};
+    int *a = (int *)malloc(TOPK_N * sizeof(int));
+    int *s = (int *)malloc(TOPK_N * sizeof(int));
+    uint32_t r = 54321;
+
+    for (i = 0; i < TOPK_N; i++) {
+        r = r * 1103515245 + 12345;
+        s[i] = (int)((r >> 8) % 5000);
+    }
+    for (j = 0; j < sizeof(ks) / sizeof(ks[0]); j++) {
+        memcpy(a, s, TOPK_N * sizeof(int));
+        partial_sort(a, TOPK_N, sizeof(int), ks[j], int_compare);
+        intro_sort(s, TOPK_N, sizeof(int), int_compare);
+        if (memcmp(a, s, ks[j] * sizeof(int))) {
+            fail = 1;
+        }
+        /* reshuffle for next round */
+        for (i = TOPK_N - 1; i > 0; i--) {
+            int tmp;
+            size_t x;
+            r = r * 1103515245 + 12345;
+            x = (r >> 8) % (i + 1);
+            tmp = s[i]; s[i] = s[x]; s[x] = tmp;
+        }
+        if (ks[j] >= TOPK_N) {
+            continue;
+        }
+        memcpy(a, s, TOPK_N * sizeof(int));
+        nth_element(a, TOPK_N, sizeof(int), ks[j], int_compare);
+        for (i = 0; i < TOPK_N; i++) {
+            if ((i < ks[j] && a[i] > a[ks[j]]) ||
+                (i > ks[j] && a[i] < a[ks[j]])) {
+                fail = 1;
+                break;
+            }
+        }
+    }
+    printf("partial_sort/nth_element: %s\n", fail ? "failed" : "ok");
+
+    fail = 0;
+    for (j = 1; j < sizeof(ks) / sizeof(ks[0]); j++) {
+        size_t n;
+        struct topk *t = topk_create(ks[j], sizeof(int), int_compare);
+        for (i = 0; i < TOPK_N; i++) {
+            topk_push(t, &s[i]);
+        }
+        n = topk_result(t, a);
+        topk_destroy(t);
+        intro_sort(s, TOPK_N, sizeof(int), int_compare);
+        for (i = 0; i < n; i++) {
+            if (a[i] != s[TOPK_N - 1 - i]) {
+                fail = 1;
+            }
+        }
+        if (n != ks[j]) {
+            fail = 1;
+        }
+    }
+    printf("topk stream: %s\n", fail ? "failed" : "ok");
+    free(a);
+    free(s);
+}
+
 int main(int argc, char **argv)
 {
     test_bsort();
     test_heapsort();
+    test_fastsort();
+    test_topk();
     return 0;
 }
@@ -0,0 +1,138 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#include "common.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * streaming top-k, min-heap of the k largest elements seen so far by cmp,
+ * root is the smallest kept one, so a new element only costs one compare
+ * unless it beats the root. O(n log k) time and k elements of memory.
+ */
+struct topk {
+    byte   *heap;
+    size_t  k;
+    size_t  size;
+    size_t  count;
+    fp_cmp  cmp;
+};
+
+static void sift_up(byte *h, size_t i, size_t size, fp_cmp cmp)
+{
+    size_t p;
+    while (i > 0) {
+        p = (i - 1) / 2;
+        if (cmp(h + p * size, h + i * size, size) <= 0) {
+            break;
+        }
+        byte_swap(h + p * size, h + i * size, size);
+        i = p;
+    }
+}
+
+static void sift_down(byte *h, size_t i, size_t n, size_t size, fp_cmp cmp)
+{
+    size_t c;
+    while ((c = i * 2 + 1) < n) {
+        if (c + 1 < n && cmp(h + (c + 1) * size, h + c * size, size) < 0) {
+            c++;
+        }
+        if (cmp(h + i * size, h + c * size, size) <= 0) {
+            break;
+        }
+        byte_swap(h + i * size, h + c * size, size);
+        i = c;
+    }
+}
+
+struct topk *topk_create(size_t k, size_t size, fp_cmp cmp)
+{
+    struct topk *t;
+    if (!k || !size) {
+        printf("invalid parameter!\n");
+        return NULL;
+    }
+    t = (struct topk *)calloc(1, sizeof(struct topk));
+    if (!t) {
+        return NULL;
+    }
+    t->heap = (byte *)malloc(k * size);
+    if (!t->heap) {
+        free(t);
+        return NULL;
+    }
+    t->k = k;
+    t->size = size;
+    t->cmp = cmp ? cmp : default_cmp;
+    return t;
+}
+
+void topk_destroy(struct topk *t)
+{
+    if (!t) {
+        return;
+    }
+    free(t->heap);
+    free(t);
+}
+
+void topk_reset(struct topk *t)
+{
+    if (t) {
+        t->count = 0;
+    }
+}
+
+int topk_push(struct topk *t, const void *elem)
+{
+    if (!t || !elem) {
+        return -1;
+    }
+    if (t->count < t->k) {
+        memcpy(t->heap + t->count * t->size, elem, t->size);
+        sift_up(t->heap, t->count, t->size, t->cmp);
+        t->count++;
+        return 0;
+    }
+    if (t->cmp(elem, t->heap, t->size) <= 0) {
+        return 0;
+    }
+    memcpy(t->heap, elem, t->size);
+    sift_down(t->heap, 0, t->k, t->size, t->cmp);
+    return 0;
+}
+
+size_t topk_result(struct topk *t, void *out)
+{
+    size_t n;
+    byte *o = (byte *)out;
+    if (!t || !out) {
+        return 0;
+    }
+    /* heap sort on a copy, popping the min to the tail leaves largest first */
+    memcpy(o, t->heap, t->count * t->size);
+    for (n = t->count; n > 1; n--) {
+        byte_swap(o, o + (n - 1) * t->size, t->size);
+        sift_down(o, 0, n - 1, t->size, t->cmp);
+    }
+    return t->count;
+}
@@ -25,6 +25,38 @@
 #include <ctype.h>
 #include "libstrex.h"
 
+/*
+ * base64/base16 simd paths: sse2 is baseline on x86_64, avx2 and ssse3
+ * are picked at runtime with gcc/clang target attribute, neon is
+ * baseline on aarch64, otherwise scalar only
+ */
+#if defined (__SSE2__) || defined (_M_X64)
+#include <emmintrin.h>
+#define STREX_SSE2
+#endif
+#if defined (STREX_SSE2) && defined (__GNUC__)
+#include <tmmintrin.h>
+#define STREX_SSSE3
+#if defined (__SSSE3__)
+#define strex_have_ssse3()  1
+#else
+#define strex_have_ssse3()  __builtin_cpu_supports("ssse3")
+#endif
+#define STREX_TARGET_SSSE3  __attribute__((target("ssse3")))
+#include <immintrin.h>
+#define STREX_AVX2
+#if defined (__AVX2__)
+#define strex_have_avx2()   1
+#else
+#define strex_have_avx2()   __builtin_cpu_supports("avx2")
+#endif
+#define STREX_TARGET_AVX2   __attribute__((target("avx2")))
+#endif
+#if defined (__aarch64__) && defined (__ARM_NEON)
+#include <arm_neon.h>
+#define STREX_NEON
+#endif
+
 char *strtrim(char *s)
 {
     char *p = s;
@@ -126,6 +158,247 @@ int strhex2bin(char ch)
 	return -1;
 }
 
+#if defined (STREX_SSE2)
+static int strex_ctz(unsigned int x)
+{
+#if defined (_MSC_VER)
+    unsigned long i;
+    _BitScanForward(&i, x);
+    return (int)i;
+#else
+    return __builtin_ctz(x);
+#endif
+}
+
+/*
+ * compare first and last needle byte at 16 positions per round, only
+ * candidates matching both go to memcmp, so false hits are rare even
+ * for text with skewed byte distribution
+ */
+static const uint8_t *memfind_sse2(const uint8_t *h, size_t hlen,
+                const uint8_t *n, size_t nlen, size_t *pos)
+{
+    size_t i;
+    unsigned int mask;
+    __m128i a, b;
+    const __m128i first = _mm_set1_epi8((char)n[0]);
+    const __m128i last = _mm_set1_epi8((char)n[nlen - 1]);
+
+    for (i = 0; i + nlen - 1 + 16 <= hlen; i += 16) {
+        a = _mm_cmpeq_epi8(first, _mm_loadu_si128((const __m128i *)(h + i)));
+        b = _mm_cmpeq_epi8(last, _mm_loadu_si128((const __m128i *)(h + i + nlen - 1)));
+        mask = _mm_movemask_epi8(_mm_and_si128(a, b));
+        while (mask) {
+            const uint8_t *c = h + i + strex_ctz(mask);
+            if (!memcmp(c + 1, n + 1, nlen - 2)) {
+                return c;
+            }
+            mask &= mask - 1;
+        }
+    }
+    *pos = i;
+    return NULL;
+}
+#endif
+
+void *memfind(const void *haystack, size_t hlen, const void *needle, size_t nlen)
+{
+    size_t i = 0;
+    const uint8_t *c;
+    const uint8_t *h = (const uint8_t *)haystack;
+    const uint8_t *n = (const uint8_t *)needle;
+
+    if (nlen == 0) {
+        return (void *)h;
+    }
+    if (nlen > hlen) {
+        return NULL;
+    }
+    if (nlen == 1) {
+        return memchr(h, n[0], hlen);
+    }
+#if defined (STREX_SSE2)
+    c = memfind_sse2(h, hlen, n, nlen, &i);
+    if (c) {
+        return (void *)c;
+    }
+#endif
+    /* tail, memchr to first byte then check last byte before memcmp */
+    while (i + nlen <= hlen) {
+        c = (const uint8_t *)memchr(h + i, n[0], hlen - nlen + 1 - i);
+        if (!c) {
+            break;
+        }
+        if (c[nlen - 1] == n[nlen - 1] && !memcmp(c + 1, n + 1, nlen - 2)) {
+            return (void *)c;
+        }
+        i = c - h + 1;
+    }
+    return NULL;
+}
+
+char *strfind(const char *s, const char *needle)
+{
+    return (char *)memfind(s, strlen(s), needle, strlen(needle));
+}
+
+void *memchr2(const void *s, int c1, int c2, size_t n)
+{
+    size_t i = 0;
+    const uint8_t *p = (const uint8_t *)s;
+#if defined (STREX_SSE2)
+    unsigned int mask;
+    __m128i v;
+    const __m128i a = _mm_set1_epi8((char)c1);
+    const __m128i b = _mm_set1_epi8((char)c2);
+
+    for (; i + 16 <= n; i += 16) {
+        v = _mm_loadu_si128((const __m128i *)(p + i));
+        mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, a),
+                                              _mm_cmpeq_epi8(v, b)));
+        if (mask) {
+            return (void *)(p + i + strex_ctz(mask));
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        if (p[i] == (uint8_t)c1 || p[i] == (uint8_t)c2) {
+            return (void *)(p + i);
+        }
+    }
+    return NULL;
+}
+
+void *memchr3(const void *s, int c1, int c2, int c3, size_t n)
+{
+    size_t i = 0;
+    const uint8_t *p = (const uint8_t *)s;
+#if defined (STREX_SSE2)
+    unsigned int mask;
+    __m128i v;
+    const __m128i a = _mm_set1_epi8((char)c1);
+    const __m128i b = _mm_set1_epi8((char)c2);
+    const __m128i c = _mm_set1_epi8((char)c3);
+
+    for (; i + 16 <= n; i += 16) {
+        v = _mm_loadu_si128((const __m128i *)(p + i));
+        mask = _mm_movemask_epi8(_mm_or_si128(
+                        _mm_or_si128(_mm_cmpeq_epi8(v, a), _mm_cmpeq_epi8(v, b)),
+                        _mm_cmpeq_epi8(v, c)));
+        if (mask) {
+            return (void *)(p + i + strex_ctz(mask));
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        if (p[i] == (uint8_t)c1 || p[i] == (uint8_t)c2 || p[i] == (uint8_t)c3) {
+            return (void *)(p + i);
+        }
+    }
+    return NULL;
+}
+
+/* libc memchr is vectorized already, a lone CR is kept in the line */
+struct strref strline(const char **cursor, const char *end)
+{
+    const char *p, *nl;
+    struct strref line = {NULL, 0};
+
+    if (!cursor || !*cursor || !end || *cursor >= end) {
+        return line;
+    }
+    p = *cursor;
+    nl = (const char *)memchr(p, '\n', end - p);
+    line.array = p;
+    if (!nl) {
+        line.len = end - p;
+        *cursor = end;
+        return line;
+    }
+    line.len = nl - p;
+    if (line.len && nl[-1] == '\r') {
+        line.len--;
+    }
+    *cursor = nl + 1;
+    return line;
+}
+
+/* 256 bit membership map, one lookup per byte instead of strchr */
+struct delim_map {
+    uint32_t bits[8];
+};
+
+static void delim_map_init(struct delim_map *m, const char *delims)
+{
+    const uint8_t *d = (const uint8_t *)delims;
+    memset(m, 0, sizeof(*m));
+    for (; *d; d++) {
+        m->bits[*d >> 5] |= 1u << (*d & 31);
+    }
+}
+
+static int delim_map_has(const struct delim_map *m, uint8_t c)
+{
+    return (m->bits[c >> 5] >> (c & 31)) & 1;
+}
+
+struct strref strtoken(const char **cursor, const char *delims)
+{
+    struct delim_map m;
+    const uint8_t *p, *start;
+    struct strref tok = {NULL, 0};
+
+    if (!cursor || !*cursor || !delims) {
+        return tok;
+    }
+    delim_map_init(&m, delims);
+    p = (const uint8_t *)*cursor;
+    while (*p && delim_map_has(&m, *p)) {
+        p++;
+    }
+    if (!*p) {
+        *cursor = (const char *)p;
+        return tok;
+    }
+    start = p;
+    while (*p && !delim_map_has(&m, *p)) {
+        p++;
+    }
+    tok.array = (const char *)start;
+    tok.len = p - start;
+    *cursor = (const char *)p;
+    return tok;
+}
+
+int strsplit(char *s, const char *delims, char **tokens, int max)
+{
+    int n = 0;
+    struct delim_map m;
+    uint8_t *p = (uint8_t *)s;
+
+    if (!s || !delims || !tokens || max <= 0) {
+        return -1;
+    }
+    delim_map_init(&m, delims);
+    while (n < max) {
+        while (*p && delim_map_has(&m, *p)) {
+            p++;
+        }
+        if (!*p) {
+            break;
+        }
+        tokens[n++] = (char *)p;
+        while (*p && !delim_map_has(&m, *p)) {
+            p++;
+        }
+        if (!*p) {
+            break;
+        }
+        *p++ = '\0';
+    }
+    return n;
+}
+
 static char s_base64_enc[64] = {
     'A','B','C','D','E','F','G','H','I','J','K','L','M',
     'N','O','P','Q','R','S','T','U','V','W','X','Y','Z',
@@ -153,12 +426,306 @@ static const uint8_t s_base64_dec[256] = {
     41,42,43,44,45,46,47,48,49,50,51, 0, 0, 0, 0, 0,
 };
 
-static size_t base64_encode_table(char* target, const void *source, size_t bytes, const char* table)
+#if defined (STREX_SSSE3)
+/*
+ * 12 input bytes to 16 output chars per round, split 3 bytes into four
+ * 6 bit indexes with shuffle and multiply, then map index to ascii by
+ * adding a per range offset (A-Z, a-z, 0-9, c62, c63)
+ * loads 16 bytes, so caller leaves 4 bytes readable after the last round
+ */
+STREX_TARGET_SSSE3
+static size_t base64_encode_ssse3(char *target, const uint8_t *src, size_t bytes,
+                char c62, char c63)
+{
+    size_t i, j;
+    __m128i in, t0, t1, t2, t3, idx, res, less;
+    const __m128i shuf = _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4,
+                                       7, 6, 8, 7, 10, 9, 11, 10);
+    const __m128i lut = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52,
+                                      '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                      '0' - 52, '0' - 52, '0' - 52,
+                                      c62 - 62, c63 - 63, 'A', 0, 0);
+
+    for (i = j = 0; i + 16 <= bytes; i += 12, j += 16) {
+        in = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + i)), shuf);
+        t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+        t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+        t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+        t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+        idx = _mm_or_si128(t1, t3);
+
+        /* 0-25 -> 13, 26-51 -> 0, 52-63 -> 1-12 */
+        res = _mm_subs_epu8(idx, _mm_set1_epi8(51));
+        less = _mm_cmpgt_epi8(_mm_set1_epi8(26), idx);
+        res = _mm_or_si128(res, _mm_and_si128(less, _mm_set1_epi8(13)));
+        res = _mm_add_epi8(_mm_shuffle_epi8(lut, res), idx);
+        _mm_storeu_si128((__m128i *)(target + j), res);
+    }
+    return i;
+}
+
+static __m128i range_mask(__m128i in, char lo, char hi)
+{
+    return _mm_and_si128(_mm_cmpgt_epi8(in, _mm_set1_epi8(lo - 1)),
+                         _mm_cmpgt_epi8(_mm_set1_epi8(hi + 1), in));
+}
+
+/*
+ * 16 input chars to 12 output bytes per round, accept both standard and
+ * url alphabet like s_base64_dec, stop at first round with other chars
+ * (padding or invalid) and let scalar code finish it
+ */
+STREX_TARGET_SSSE3
+static size_t base64_decode_ssse3(uint8_t *target, const uint8_t *src, size_t bytes)
 {
     size_t i, j;
+    __m128i in, m, valid, off, v;
+    const __m128i pack = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9,
+                                       8, 14, 13, 12, -1, -1, -1, -1);
+
+    for (i = j = 0; i + 16 <= bytes; i += 16, j += 12) {
+        in = _mm_loadu_si128((const __m128i *)(src + i));
+        m = range_mask(in, 'A', 'Z');
+        valid = m;
+        off = _mm_and_si128(m, _mm_set1_epi8(-65));
+        m = range_mask(in, 'a', 'z');
+        valid = _mm_or_si128(valid, m);
+        off = _mm_or_si128(off, _mm_and_si128(m, _mm_set1_epi8(-71)));
+        m = range_mask(in, '0', '9');
+        valid = _mm_or_si128(valid, m);
+        off = _mm_or_si128(off, _mm_and_si128(m, _mm_set1_epi8(4)));
+        m = _mm_cmpeq_epi8(in, _mm_set1_epi8('+'));
+        valid = _mm_or_si128(valid, m);
+        off = _mm_or_si128(off, _mm_and_si128(m, _mm_set1_epi8(62 - '+')));
+        m = _mm_cmpeq_epi8(in, _mm_set1_epi8('-'));
+        valid = _mm_or_si128(valid, m);
+        off = _mm_or_si128(off, _mm_and_si128(m, _mm_set1_epi8(62 - '-')));
+        m = _mm_cmpeq_epi8(in, _mm_set1_epi8('/'));
+        valid = _mm_or_si128(valid, m);
+        off = _mm_or_si128(off, _mm_and_si128(m, _mm_set1_epi8(63 - '/')));
+        m = _mm_cmpeq_epi8(in, _mm_set1_epi8('_'));
+        valid = _mm_or_si128(valid, m);
+        off = _mm_or_si128(off, _mm_and_si128(m, _mm_set1_epi8(63 - '_')));
+        if (_mm_movemask_epi8(valid) != 0xFFFF) {
+            break;
+        }
+        v = _mm_add_epi8(in, off);
+
+        /* merge 4 x 6 bits into 24 bits per dword, then pack big endian */
+        v = _mm_maddubs_epi16(v, _mm_set1_epi32(0x01400140));
+        v = _mm_madd_epi16(v, _mm_set1_epi32(0x00011000));
+        v = _mm_shuffle_epi8(v, pack);
+        _mm_storel_epi64((__m128i *)(target + j), v);
+        v = _mm_srli_si128(v, 8);
+        memcpy(target + j + 8, &v, 4);
+    }
+    return i;
+}
+#endif
+
+#if defined (STREX_AVX2)
+/*
+ * same steps as ssse3 with 12 bytes in each 128 bit lane, 24 input bytes
+ * to 32 chars per round, loads 28 bytes
+ */
+STREX_TARGET_AVX2
+static size_t base64_encode_avx2(char *target, const uint8_t *src, size_t bytes,
+                char c62, char c63)
+{
+    size_t i, j;
+    __m256i in, t0, t1, t2, t3, idx, res, less;
+    const __m256i shuf = _mm256_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4,
+                                          7, 6, 8, 7, 10, 9, 11, 10,
+                                          1, 0, 2, 1, 4, 3, 5, 4,
+                                          7, 6, 8, 7, 10, 9, 11, 10);
+    const __m256i lut = _mm256_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52,
+                                         '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                         '0' - 52, '0' - 52, '0' - 52,
+                                         c62 - 62, c63 - 63, 'A', 0, 0,
+                                         'a' - 26, '0' - 52, '0' - 52, '0' - 52,
+                                         '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                         '0' - 52, '0' - 52, '0' - 52,
+                                         c62 - 62, c63 - 63, 'A', 0, 0);
+
+    for (i = j = 0; i + 28 <= bytes; i += 24, j += 32) {
+        in = _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(src + i)));
+        in = _mm256_inserti128_si256(in, _mm_loadu_si128((const __m128i *)(src + i + 12)), 1);
+        in = _mm256_shuffle_epi8(in, shuf);
+        t0 = _mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00));
+        t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+        t2 = _mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0));
+        t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+        idx = _mm256_or_si256(t1, t3);
+
+        res = _mm256_subs_epu8(idx, _mm256_set1_epi8(51));
+        less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), idx);
+        res = _mm256_or_si256(res, _mm256_and_si256(less, _mm256_set1_epi8(13)));
+        res = _mm256_add_epi8(_mm256_shuffle_epi8(lut, res), idx);
+        _mm256_storeu_si256((__m256i *)(target + j), res);
+    }
+    return i;
+}
+
+STREX_TARGET_AVX2
+static __m256i range_mask_avx2(__m256i in, char lo, char hi)
+{
+    return _mm256_and_si256(_mm256_cmpgt_epi8(in, _mm256_set1_epi8(lo - 1)),
+                            _mm256_cmpgt_epi8(_mm256_set1_epi8(hi + 1), in));
+}
+
+/* 32 chars to 24 bytes per round, lanes packed together with permute */
+STREX_TARGET_AVX2
+static size_t base64_decode_avx2(uint8_t *target, const uint8_t *src, size_t bytes)
+{
+    size_t i, j;
+    __m256i in, m, valid, off, v;
+    const __m256i pack = _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9,
+                                          8, 14, 13, 12, -1, -1, -1, -1,
+                                          2, 1, 0, 6, 5, 4, 10, 9,
+                                          8, 14, 13, 12, -1, -1, -1, -1);
+    const __m256i join = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+
+    for (i = j = 0; i + 32 <= bytes; i += 32, j += 24) {
+        in = _mm256_loadu_si256((const __m256i *)(src + i));
+        m = range_mask_avx2(in, 'A', 'Z');
+        valid = m;
+        off = _mm256_and_si256(m, _mm256_set1_epi8(-65));
+        m = range_mask_avx2(in, 'a', 'z');
+        valid = _mm256_or_si256(valid, m);
+        off = _mm256_or_si256(off, _mm256_and_si256(m, _mm256_set1_epi8(-71)));
+        m = range_mask_avx2(in, '0', '9');
+        valid = _mm256_or_si256(valid, m);
+        off = _mm256_or_si256(off, _mm256_and_si256(m, _mm256_set1_epi8(4)));
+        m = _mm256_cmpeq_epi8(in, _mm256_set1_epi8('+'));
+        valid = _mm256_or_si256(valid, m);
+        off = _mm256_or_si256(off, _mm256_and_si256(m, _mm256_set1_epi8(62 - '+')));
+        m = _mm256_cmpeq_epi8(in, _mm256_set1_epi8('-'));
+        valid = _mm256_or_si256(valid, m);
+        off = _mm256_or_si256(off, _mm256_and_si256(m, _mm256_set1_epi8(62 - '-')));
+        m = _mm256_cmpeq_epi8(in, _mm256_set1_epi8('/'));
+        valid = _mm256_or_si256(valid, m);
+        off = _mm256_or_si256(off, _mm256_and_si256(m, _mm256_set1_epi8(63 - '/')));
+        m = _mm256_cmpeq_epi8(in, _mm256_set1_epi8('_'));
+        valid = _mm256_or_si256(valid, m);
+        off = _mm256_or_si256(off, _mm256_and_si256(m, _mm256_set1_epi8(63 - '_')));
+        if (_mm256_movemask_epi8(valid) != -1) {
+            break;
+        }
+        v = _mm256_add_epi8(in, off);
+
+        v = _mm256_maddubs_epi16(v, _mm256_set1_epi32(0x01400140));
+        v = _mm256_madd_epi16(v, _mm256_set1_epi32(0x00011000));
+        v = _mm256_shuffle_epi8(v, pack);
+        v = _mm256_permutevar8x32_epi32(v, join);
+        _mm_storeu_si128((__m128i *)(target + j), _mm256_castsi256_si128(v));
+        _mm_storel_epi64((__m128i *)(target + j + 16), _mm256_extracti128_si256(v, 1));
+    }
+    return i;
+}
+#endif
+
+#if defined (STREX_NEON)
+/* 48 bytes to 64 chars per round, de-interleaving load and 64 entry lookup */
+static size_t base64_encode_neon(char *target, const uint8_t *src, size_t bytes,
+                const char *table)
+{
+    int k;
+    size_t i, j;
+    uint8x16x3_t in;
+    uint8x16x4_t out, lut;
+    const uint8x16_t m6 = vdupq_n_u8(0x3F);
+
+    for (k = 0; k < 4; k++) {
+        lut.val[k] = vld1q_u8((const uint8_t *)table + k * 16);
+    }
+    for (i = j = 0; i + 48 <= bytes; i += 48, j += 64) {
+        in = vld3q_u8(src + i);
+        out.val[0] = vshrq_n_u8(in.val[0], 2);
+        out.val[1] = vandq_u8(vorrq_u8(vshlq_n_u8(in.val[0], 4), vshrq_n_u8(in.val[1], 4)), m6);
+        out.val[2] = vandq_u8(vorrq_u8(vshlq_n_u8(in.val[1], 2), vshrq_n_u8(in.val[2], 6)), m6);
+        out.val[3] = vandq_u8(in.val[2], m6);
+        for (k = 0; k < 4; k++) {
+            out.val[k] = vqtbl4q_u8(lut, out.val[k]);
+        }
+        vst4q_u8((uint8_t *)target + j, out);
+    }
+    return i;
+}
+
+/* char to 6 bit value of both alphabets, valid cleared for other chars */
+static uint8x16_t base64_value_neon(uint8x16_t in, uint8x16_t *valid)
+{
+    uint8x16_t t, m, v, ok;
+    t = vsubq_u8(in, vdupq_n_u8('A'));
+    ok = vcltq_u8(t, vdupq_n_u8(26));
+    v = vandq_u8(ok, t);
+    t = vsubq_u8(in, vdupq_n_u8('a'));
+    m = vcltq_u8(t, vdupq_n_u8(26));
+    v = vorrq_u8(v, vandq_u8(m, vaddq_u8(t, vdupq_n_u8(26))));
+    ok = vorrq_u8(ok, m);
+    t = vsubq_u8(in, vdupq_n_u8('0'));
+    m = vcltq_u8(t, vdupq_n_u8(10));
+    v = vorrq_u8(v, vandq_u8(m, vaddq_u8(t, vdupq_n_u8(52))));
+    ok = vorrq_u8(ok, m);
+    m = vorrq_u8(vceqq_u8(in, vdupq_n_u8('+')), vceqq_u8(in, vdupq_n_u8('-')));
+    v = vorrq_u8(v, vandq_u8(m, vdupq_n_u8(62)));
+    ok = vorrq_u8(ok, m);
+    m = vorrq_u8(vceqq_u8(in, vdupq_n_u8('/')), vceqq_u8(in, vdupq_n_u8('_')));
+    v = vorrq_u8(v, vandq_u8(m, vdupq_n_u8(63)));
+    ok = vorrq_u8(ok, m);
+    *valid = vandq_u8(*valid, ok);
+    return v;
+}
+
+/* 64 chars to 48 bytes per round, stop at first round with other chars */
+static size_t base64_decode_neon(uint8_t *target, const uint8_t *src, size_t bytes)
+{
+    size_t i, j;
+    uint8x16x4_t in;
+    uint8x16x3_t out;
+    uint8x16_t a, b, c, d, valid;
+
+    for (i = j = 0; i + 64 <= bytes; i += 64, j += 48) {
+        in = vld4q_u8(src + i);
+        valid = vdupq_n_u8(0xFF);
+        a = base64_value_neon(in.val[0], &valid);
+        b = base64_value_neon(in.val[1], &valid);
+        c = base64_value_neon(in.val[2], &valid);
+        d = base64_value_neon(in.val[3], &valid);
+        if (vminvq_u8(valid) != 0xFF) {
+            break;
+        }
+        out.val[0] = vorrq_u8(vshlq_n_u8(a, 2), vshrq_n_u8(b, 4));
+        out.val[1] = vorrq_u8(vshlq_n_u8(b, 4), vshrq_n_u8(c, 2));
+        out.val[2] = vorrq_u8(vshlq_n_u8(c, 6), d);
+        vst3q_u8(target + j, out);
+    }
+    return i;
+}
+#endif
+
+static size_t base64_encode_table(char* target, const void *source, size_t bytes, const char* table)
+{
+    size_t i = 0, j = 0;
     const uint8_t *ptr = (const uint8_t*)source;
 
-    for (j = i = 0; i < bytes / 3 * 3; i += 3) {
+#if defined (STREX_AVX2)
+    if (bytes >= 28 && strex_have_avx2()) {
+        i = base64_encode_avx2(target, ptr, bytes, table[62], table[63]);
+    }
+#endif
+#if defined (STREX_SSSE3)
+    if (bytes - i >= 16 && strex_have_ssse3()) {
+        i += base64_encode_ssse3(target + i / 3 * 4, ptr + i, bytes - i,
+                                 table[62], table[63]);
+    }
+#endif
+#if defined (STREX_NEON)
+    i = base64_encode_neon(target, ptr, bytes, table);
+#endif
+    /* simd rounds take multiples of 3 bytes */
+    j = i / 3 * 4;
+    for (; i < bytes / 3 * 3; i += 3) {
         target[j++] = table[(ptr[i] >> 2) & 0x3F]; /* c1 */
         target[j++] = table[((ptr[i] & 0x03) << 4) | ((ptr[i + 1] >> 4) & 0x0F)]; /*c2*/
         target[j++] = table[((ptr[i + 1] & 0x0F) << 2) | ((ptr[i + 2] >> 6) & 0x03)];/*c3*/
@@ -193,7 +760,10 @@ size_t base64_encode_url(char* target, const void *source, size_t bytes)
 
 size_t base64_decode(void* target, const char *src, size_t bytes)
 {
-    size_t i, j;
+    size_t i;
+#if defined (STREX_SSSE3) || defined (STREX_NEON)
+    size_t j;
+#endif
     uint8_t* p = (uint8_t*)target;
     const uint8_t* source = (const uint8_t*)src;
     const uint8_t* end;
@@ -204,7 +774,29 @@ size_t base64_decode(void* target, const char *src, size_t bytes)
 
     i = 0;
     end = source + bytes;
-    for (j = 1; j < bytes / 4; j++) {
+    /* keep last quartet for scalar, it may carry padding */
+#if defined (STREX_AVX2)
+    if (bytes > 32 && strex_have_avx2()) {
+        j = base64_decode_avx2(p, source, bytes - 4);
+        i = j / 4 * 3;
+        source += j;
+    }
+#endif
+#if defined (STREX_SSSE3)
+    if (end - source > 16 && strex_have_ssse3()) {
+        j = base64_decode_ssse3(p + i, source, end - source - 4);
+        i += j / 4 * 3;
+        source += j;
+    }
+#endif
+#if defined (STREX_NEON)
+    if (bytes > 64) {
+        j = base64_decode_neon(p, source, bytes - 4);
+        i = j / 4 * 3;
+        source += j;
+    }
+#endif
+    for (; source + 4 < end; ) {
         p[i++] = (s_base64_dec[source[0]] << 2) | (s_base64_dec[source[1]] >> 4);
         p[i++] = (s_base64_dec[source[1]] << 4) | (s_base64_dec[source[2]] >> 2);
         p[i++] = (s_base64_dec[source[2]] << 6) | s_base64_dec[source[3]];
@@ -233,12 +825,200 @@ static const uint8_t s_base16_dec[128] = {
     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
 };
 
-size_t base16_encode(char* target, const void *source, size_t bytes)
+#if defined (STREX_SSE2)
+/* nibble to uppercase hex digit, x + '0' and 7 more when above 9 */
+static __m128i hex_digit_sse2(__m128i x)
+{
+    __m128i gt9 = _mm_cmpgt_epi8(x, _mm_set1_epi8(9));
+    return _mm_add_epi8(_mm_add_epi8(x, _mm_set1_epi8('0')),
+                        _mm_and_si128(gt9, _mm_set1_epi8('A' - '0' - 10)));
+}
+
+static size_t base16_encode_sse2(char *target, const uint8_t *src, size_t bytes)
 {
     size_t i;
+    __m128i in, hi, lo;
+    const __m128i mask = _mm_set1_epi8(0x0F);
+
+    for (i = 0; i + 16 <= bytes; i += 16) {
+        in = _mm_loadu_si128((const __m128i *)(src + i));
+        hi = hex_digit_sse2(_mm_and_si128(_mm_srli_epi16(in, 4), mask));
+        lo = hex_digit_sse2(_mm_and_si128(in, mask));
+        _mm_storeu_si128((__m128i *)(target + i * 2), _mm_unpacklo_epi8(hi, lo));
+        _mm_storeu_si128((__m128i *)(target + i * 2 + 16), _mm_unpackhi_epi8(hi, lo));
+    }
+    return i;
+}
+
+/* hex digit to nibble, valid mask set for 0-9, A-F and a-f */
+static __m128i hex_value_sse2(__m128i in, __m128i *valid)
+{
+    __m128i low = _mm_or_si128(in, _mm_set1_epi8(0x20));
+    __m128i dm = _mm_and_si128(_mm_cmpgt_epi8(in, _mm_set1_epi8('0' - 1)),
+                               _mm_cmpgt_epi8(_mm_set1_epi8('9' + 1), in));
+    __m128i am = _mm_and_si128(_mm_cmpgt_epi8(low, _mm_set1_epi8('a' - 1)),
+                               _mm_cmpgt_epi8(_mm_set1_epi8('f' + 1), low));
+    *valid = _mm_and_si128(*valid, _mm_or_si128(dm, am));
+    return _mm_or_si128(_mm_and_si128(dm, _mm_sub_epi8(in, _mm_set1_epi8('0'))),
+                        _mm_and_si128(am, _mm_sub_epi8(low, _mm_set1_epi8('a' - 10))));
+}
+
+/* 32 chars to 16 bytes per round, stop at first round with invalid digit */
+static size_t base16_decode_sse2(uint8_t *target, const char *src, size_t bytes)
+{
+    size_t i;
+    __m128i a, b, valid;
+    const __m128i mask = _mm_set1_epi16(0x00FF);
+
+    for (i = 0; i + 32 <= bytes; i += 32) {
+        valid = _mm_set1_epi8(-1);
+        a = hex_value_sse2(_mm_loadu_si128((const __m128i *)(src + i)), &valid);
+        b = hex_value_sse2(_mm_loadu_si128((const __m128i *)(src + i + 16)), &valid);
+        if (_mm_movemask_epi8(valid) != 0xFFFF) {
+            break;
+        }
+        /* each word holds high nibble in low byte, low nibble in high byte */
+        a = _mm_and_si128(_mm_or_si128(_mm_slli_epi16(a, 4), _mm_srli_epi16(a, 8)), mask);
+        b = _mm_and_si128(_mm_or_si128(_mm_slli_epi16(b, 4), _mm_srli_epi16(b, 8)), mask);
+        _mm_storeu_si128((__m128i *)(target + i / 2), _mm_packus_epi16(a, b));
+    }
+    return i;
+}
+#endif
+
+#if defined (STREX_AVX2)
+STREX_TARGET_AVX2
+static __m256i hex_digit_avx2(__m256i x)
+{
+    __m256i gt9 = _mm256_cmpgt_epi8(x, _mm256_set1_epi8(9));
+    return _mm256_add_epi8(_mm256_add_epi8(x, _mm256_set1_epi8('0')),
+                           _mm256_and_si256(gt9, _mm256_set1_epi8('A' - '0' - 10)));
+}
+
+/* unpack interleaves within lanes, permute puts lanes back in order */
+STREX_TARGET_AVX2
+static size_t base16_encode_avx2(char *target, const uint8_t *src, size_t bytes)
+{
+    size_t i;
+    __m256i in, hi, lo, a, b;
+    const __m256i mask = _mm256_set1_epi8(0x0F);
+
+    for (i = 0; i + 32 <= bytes; i += 32) {
+        in = _mm256_loadu_si256((const __m256i *)(src + i));
+        hi = hex_digit_avx2(_mm256_and_si256(_mm256_srli_epi16(in, 4), mask));
+        lo = hex_digit_avx2(_mm256_and_si256(in, mask));
+        a = _mm256_unpacklo_epi8(hi, lo);
+        b = _mm256_unpackhi_epi8(hi, lo);
+        _mm256_storeu_si256((__m256i *)(target + i * 2), _mm256_permute2x128_si256(a, b, 0x20));
+        _mm256_storeu_si256((__m256i *)(target + i * 2 + 32), _mm256_permute2x128_si256(a, b, 0x31));
+    }
+    return i;
+}
+
+STREX_TARGET_AVX2
+static __m256i hex_value_avx2(__m256i in, __m256i *valid)
+{
+    __m256i low = _mm256_or_si256(in, _mm256_set1_epi8(0x20));
+    __m256i dm = _mm256_and_si256(_mm256_cmpgt_epi8(in, _mm256_set1_epi8('0' - 1)),
+                                  _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), in));
+    __m256i am = _mm256_and_si256(_mm256_cmpgt_epi8(low, _mm256_set1_epi8('a' - 1)),
+                                  _mm256_cmpgt_epi8(_mm256_set1_epi8('f' + 1), low));
+    *valid = _mm256_and_si256(*valid, _mm256_or_si256(dm, am));
+    return _mm256_or_si256(_mm256_and_si256(dm, _mm256_sub_epi8(in, _mm256_set1_epi8('0'))),
+                           _mm256_and_si256(am, _mm256_sub_epi8(low, _mm256_set1_epi8('a' - 10))));
+}
+
+/* 64 chars to 32 bytes per round, pack works in lanes, permute fixes order */
+STREX_TARGET_AVX2
+static size_t base16_decode_avx2(uint8_t *target, const char *src, size_t bytes)
+{
+    size_t i;
+    __m256i a, b, valid;
+    const __m256i mask = _mm256_set1_epi16(0x00FF);
+
+    for (i = 0; i + 64 <= bytes; i += 64) {
+        valid = _mm256_set1_epi8(-1);
+        a = hex_value_avx2(_mm256_loadu_si256((const __m256i *)(src + i)), &valid);
+        b = hex_value_avx2(_mm256_loadu_si256((const __m256i *)(src + i + 32)), &valid);
+        if (_mm256_movemask_epi8(valid) != -1) {
+            break;
+        }
+        a = _mm256_and_si256(_mm256_or_si256(_mm256_slli_epi16(a, 4), _mm256_srli_epi16(a, 8)), mask);
+        b = _mm256_and_si256(_mm256_or_si256(_mm256_slli_epi16(b, 4), _mm256_srli_epi16(b, 8)), mask);
+        a = _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xD8);
+        _mm256_storeu_si256((__m256i *)(target + i / 2), a);
+    }
+    return i;
+}
+#endif
+
+#if defined (STREX_NEON)
+/* 16 bytes to 32 chars per round, interleaving store of both nibbles */
+static size_t base16_encode_neon(char *target, const uint8_t *src, size_t bytes)
+{
+    size_t i;
+    uint8x16_t in;
+    uint8x16x2_t out;
+    const uint8x16_t lut = vld1q_u8((const uint8_t *)"0123456789ABCDEF");
+
+    for (i = 0; i + 16 <= bytes; i += 16) {
+        in = vld1q_u8(src + i);
+        out.val[0] = vqtbl1q_u8(lut, vshrq_n_u8(in, 4));
+        out.val[1] = vqtbl1q_u8(lut, vandq_u8(in, vdupq_n_u8(0x0F)));
+        vst2q_u8((uint8_t *)target + i * 2, out);
+    }
+    return i;
+}
+
+static uint8x16_t hex_value_neon(uint8x16_t in, uint8x16_t *valid)
+{
+    uint8x16_t d = vsubq_u8(in, vdupq_n_u8('0'));
+    uint8x16_t a = vsubq_u8(vorrq_u8(in, vdupq_n_u8(0x20)), vdupq_n_u8('a'));
+    uint8x16_t dm = vcltq_u8(d, vdupq_n_u8(10));
+    uint8x16_t am = vcltq_u8(a, vdupq_n_u8(6));
+    *valid = vandq_u8(*valid, vorrq_u8(dm, am));
+    return vorrq_u8(vandq_u8(dm, d), vandq_u8(am, vaddq_u8(a, vdupq_n_u8(10))));
+}
+
+/* 32 chars to 16 bytes per round, stop at first round with invalid digit */
+static size_t base16_decode_neon(uint8_t *target, const char *src, size_t bytes)
+{
+    size_t i;
+    uint8x16x2_t in;
+    uint8x16_t hi, lo, valid;
+
+    for (i = 0; i + 32 <= bytes; i += 32) {
+        in = vld2q_u8((const uint8_t *)src + i);
+        valid = vdupq_n_u8(0xFF);
+        hi = hex_value_neon(in.val[0], &valid);
+        lo = hex_value_neon(in.val[1], &valid);
+        if (vminvq_u8(valid) != 0xFF) {
+            break;
+        }
+        vst1q_u8(target + i / 2, vorrq_u8(vshlq_n_u8(hi, 4), lo));
+    }
+    return i;
+}
+#endif
+
+size_t base16_encode(char* target, const void *source, size_t bytes)
+{
+    size_t i = 0;
     const uint8_t* p;
     p = (const uint8_t*)source;
-    for (i = 0; i < bytes; i++) {
+#if defined (STREX_AVX2)
+    if (bytes >= 32 && strex_have_avx2()) {
+        i = base16_encode_avx2(target, p, bytes);
+    }
+#endif
+#if defined (STREX_SSE2)
+    i += base16_encode_sse2(target + i * 2, p + i, bytes - i);
+#endif
+#if defined (STREX_NEON)
+    i = base16_encode_neon(target, p, bytes);
+#endif
+    p += i;
+    for (; i < bytes; i++) {
         target[i * 2] = s_base16_enc[(*p >> 4) & 0x0F];
         target[i * 2 + 1] = s_base16_enc[*p & 0x0F];
         ++p;
@@ -254,7 +1034,21 @@ size_t base16_decode(void* target, const char *source, size_t bytes)
     if (0 != bytes % 2) {
         return -1;
     }
-    for (i = 0; i < bytes / 2; i++) {
+    /* simd rounds return chars consumed */
+    i = 0;
+#if defined (STREX_AVX2)
+    if (bytes >= 64 && strex_have_avx2()) {
+        i = base16_decode_avx2(p, source, bytes);
+    }
+#endif
+#if defined (STREX_SSE2)
+    i += base16_decode_sse2(p + i / 2, source + i, bytes - i);
+#endif
+#if defined (STREX_NEON)
+    i = base16_decode_neon(p, source, bytes);
+#endif
+    i /= 2;
+    for (; i < bytes / 2; i++) {
         p[i] = s_base16_dec[source[i * 2] & 0x7F] << 4;
         p[i] |= s_base16_dec[source[i * 2 + 1] & 0x7F];
     }
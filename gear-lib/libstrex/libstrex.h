@@ -23,6 +23,7 @@
 #define LIBSTREX_H
 
 #include <libposix.h>
+#include <libdstring.h>
 #include <stdlib.h>
 
 #ifdef __cplusplus
@@ -62,6 +63,39 @@ char *strtolower(char *dst, char *src, size_t n);
 
 int strhex2bin(char ch);
 
+/**
+ * @memfind find first occurrence of needle in haystack, like memmem,
+ *  sse2 filter on first and last needle byte when available
+ * @strfind same for nul terminated strings, like strstr
+ */
+GEAR_API void *memfind(const void *haystack, size_t hlen, const void *needle, size_t nlen);
+GEAR_API char *strfind(const char *s, const char *needle);
+
+/**
+ * @memchr2/memchr3 first byte equal to any of c1..c3 within n bytes,
+ *  sse2 compares 16 bytes per round when available
+ */
+GEAR_API void *memchr2(const void *s, int c1, int c2, size_t n);
+GEAR_API void *memchr3(const void *s, int c1, int c2, int c3, size_t n);
+
+/**
+ * @strline CRLF or LF line splitter over [*cursor, end), zero copy.
+ *  return next line without its terminator, advance *cursor past it,
+ *  last line may have no terminator, array is NULL when no more line
+ */
+GEAR_API struct strref strline(const char **cursor, const char *end);
+
+/**
+ * @strtoken reentrant tokenizer, does not modify string.
+ *  return next token as view into string, advance *cursor past it,
+ *  array is NULL when no more token
+ *
+ * @strsplit split s in place at any char of delims, empty tokens skipped
+ * @return number of tokens stored in tokens, at most max, -1 on error
+ */
+GEAR_API struct strref strtoken(const char **cursor, const char *delims);
+GEAR_API int strsplit(char *s, const char *delims, char **tokens, int max);
+
 GEAR_API size_t base64_encode(char* target, const void *source, size_t bytes);
 GEAR_API size_t base64_encode_url(char* target, const void *source, size_t bytes);
 GEAR_API size_t base64_decode(void* target, const char *source, size_t bytes);
@@ -43,10 +43,137 @@ void base64_test()
     printf("return byte: %d , target2: %s \n", ret_bytes, target2);
 }
 
+/* long input runs through simd rounds, check against scalar sized tails */
+void base_codec_test()
+{
+    size_t len, n, m;
+    int fail = 0;
+    uint8_t src[300], dec[300];
+    char enc[640], hex[8];
+    const char *vec = "The quick brown fox jumps over the lazy dog, 0123456789!?";
+    const char *vec64 = "VGhlIHF1aWNrIGJyb3duIGZveCBqdW1wcyBvdmVyIHRoZSBsYXp5IGRvZywgMDEyMzQ1Njc4OSE/";
+
+    n = base64_encode(enc, vec, strlen(vec));
+    if (n != strlen(vec64) || memcmp(enc, vec64, n)) {
+        fail = 1;
+    }
+    for (len = 0; len < sizeof(src); len++) {
+        src[len] = (uint8_t)(len * 151 + 7);
+    }
+    for (len = 0; len <= sizeof(src); len++) {
+        n = base64_encode(enc, src, len);
+        m = base64_decode(dec, enc, n);
+        if (n != (len + 2) / 3 * 4 || m != len || memcmp(src, dec, len)) {
+            fail = 1;
+        }
+        n = base64_encode_url(enc, src, len);
+        m = base64_decode(dec, enc, n);
+        if (m != len || memcmp(src, dec, len) || memchr(enc, '+', n) || memchr(enc, '/', n)) {
+            fail = 1;
+        }
+        n = base16_encode(enc, src, len);
+        for (m = 0; m < len; m++) {
+            snprintf(hex, sizeof(hex), "%02X", src[m]);
+            if (memcmp(enc + m * 2, hex, 2)) {
+                fail = 1;
+            }
+        }
+        for (m = 0; m < n; m++) {
+            enc[m] = tolower(enc[m]);
+        }
+        m = base16_decode(dec, enc, n);
+        if (m != len || memcmp(src, dec, len)) {
+            fail = 1;
+        }
+    }
+    printf("base64/base16 codec: %s\n", fail ? "failed" : "ok");
+}
+
+static const char *naive_find(const char *h, size_t hlen, const char *n, size_t nlen)
+{
+    size_t i;
+    for (i = 0; i + nlen <= hlen; i++) {
+        if (!memcmp(h + i, n, nlen)) {
+            return h + i;
+        }
+    }
+    return NULL;
+}
+
+void search_test()
+{
+    int i, n, fail = 0;
+    size_t len, pos, nl;
+    char hay[1024];
+    char needle[64];
+    char line[] = "  GET /index.html\tHTTP/1.1\r\n";
+    char *tok[8];
+    const char *cur = "a,,b, c";
+    const char *req = "OPTIONS * RTSP/1.0\r\nCSeq: 1\n\r\nlast";
+    const char *end = req + strlen(req);
+    const char *lines[] = {"OPTIONS * RTSP/1.0", "CSeq: 1", "", "last"};
+    struct strref t;
+
+    /* periodic text gives many first/last byte candidates */
+    for (len = 0; len < sizeof(hay) - 1; len++) {
+        hay[len] = 'a' + len % 3;
+    }
+    hay[len] = '\0';
+    hay[700] = 'z';
+    for (pos = 0; pos < 960; pos += 37) {
+        for (nl = 1; nl < 60; nl += 7) {
+            memcpy(needle, &hay[pos], nl);
+            needle[nl] = '\0';
+            if (memfind(hay, len, needle, nl) != naive_find(hay, len, needle, nl) ||
+                strfind(hay, needle) != strstr(hay, needle)) {
+                fail = 1;
+            }
+        }
+    }
+    if (memfind(hay, len, "abd", 3) || memfind("ab", 2, "abc", 3) ||
+        strfind("hello", "") == NULL) {
+        fail = 1;
+    }
+    n = strsplit(line, " \t\r\n", tok, 8);
+    if (n != 3 || strcmp(tok[0], "GET") || strcmp(tok[1], "/index.html") ||
+        strcmp(tok[2], "HTTP/1.1")) {
+        fail = 1;
+    }
+    for (i = 0; (t = strtoken(&cur, ", ")).array; i++) {
+        if (t.len != 1 || *t.array != "abc"[i]) {
+            fail = 1;
+        }
+    }
+    if (i != 3) {
+        fail = 1;
+    }
+    for (i = 0; (t = strline(&req, end)).array; i++) {
+        if (i >= 4 || t.len != strlen(lines[i]) || memcmp(t.array, lines[i], t.len)) {
+            fail = 1;
+        }
+    }
+    if (i != 4) {
+        fail = 1;
+    }
+    for (pos = 0; pos < sizeof(hay) - 1; pos += 61) {
+        hay[pos] = 'x';
+        if (memchr2(hay, 'x', 'z', len) != strpbrk(hay, "xz") ||
+            memchr3(hay + pos + 1, 'q', 'x', 'z', len - pos - 1) !=
+            strpbrk(hay + pos + 1, "qxz")) {
+            fail = 1;
+        }
+        hay[pos] = 'a' + pos % 3;
+    }
+    if (memchr2(hay, 'q', 'r', len) || memchr3("ab", 'c', 'd', 'e', 2)) {
+        fail = 1;
+    }
+    printf("memfind/memchr2/strline/strtoken/strsplit: %s\n", fail ? "failed" : "ok");
+}
+
 void strex_test()
 {
     char *mix = "Hello World";
-    char tmp[10] = "\n\t a\nb\t cd";
+    char tmp[] = "\n\t a\nb\t cd";
     char upper[20] = {0};
     char lower[20] = {0};
     printf("tmp=%s\n", tmp);
@@ -58,6 +185,8 @@ void strex_test()
 int main(int argc, char **argv)
 {
     base64_test();
+    base_codec_test();
+    search_test();
     strex_test();
     return 0;
 }
@@ -453,3 +453,219 @@ int submask_iserror(char ip[16], char mask[16])
   return 0;
 }
 
+
+#define LPM_GROUP       0x80000000u
+#define LPM_L1_SIZE     65536
+#define LPM_BATCH       16
+
+struct lpm_rule {
+    unsigned int ip;
+    int prefixlen;
+    unsigned int value;
+    int seq;
+};
+
+struct submask_lpm {
+    unsigned int *l1;
+    unsigned int *groups;       /* 256 entries each */
+    int ngroups;
+    int cap_groups;
+    struct lpm_rule *rules;
+    int nrules;
+    int cap_rules;
+};
+
+struct submask_lpm *submask_lpm_create(void)
+{
+    struct submask_lpm *t = (struct submask_lpm *)calloc(1, sizeof(struct submask_lpm));
+    if (!t) {
+        return NULL;
+    }
+    t->l1 = (unsigned int *)calloc(LPM_L1_SIZE, sizeof(unsigned int));
+    if (!t->l1) {
+        free(t);
+        return NULL;
+    }
+    return t;
+}
+
+void submask_lpm_destroy(struct submask_lpm *t)
+{
+    if (!t) {
+        return;
+    }
+    free(t->l1);
+    free(t->groups);
+    free(t->rules);
+    free(t);
+}
+
+int submask_lpm_add(struct submask_lpm *t, unsigned int ip, int prefixlen, unsigned int value)
+{
+    struct lpm_rule *r;
+    if (!t || prefixlen < 0 || prefixlen > 32 || value == 0 || value > SUBMASK_LPM_VALUE_MAX) {
+        return -1;
+    }
+    if (t->nrules == t->cap_rules) {
+        int cap = t->cap_rules ? t->cap_rules * 2 : 64;
+        r = (struct lpm_rule *)realloc(t->rules, cap * sizeof(struct lpm_rule));
+        if (!r) {
+            return -1;
+        }
+        t->rules = r;
+        t->cap_rules = cap;
+    }
+    r = &t->rules[t->nrules++];
+    r->ip = prefixlen ? ip & (0xffffffffu << (32 - prefixlen)) : 0;
+    r->prefixlen = prefixlen;
+    r->value = value;
+    r->seq = t->nrules - 1;
+    return 0;
+}
+
+int submask_lpm_add_cidr(struct submask_lpm *t, const char *cidr, unsigned int value)
+{
+    unsigned int a, b, c, d;
+    int prefixlen = 32, n;
+
+    if (!cidr) {
+        return -1;
+    }
+    n = sscanf(cidr, "%u.%u.%u.%u/%d", &a, &b, &c, &d, &prefixlen);
+    if (n < 4 || a > 255 || b > 255 || c > 255 || d > 255) {
+        return -1;
+    }
+    return submask_lpm_add(t, submask_zip(a, b, c, d), prefixlen, value);
+}
+
+static int lpm_rule_cmp(const void *a, const void *b)
+{
+    const struct lpm_rule *ra = (const struct lpm_rule *)a;
+    const struct lpm_rule *rb = (const struct lpm_rule *)b;
+    if (ra->prefixlen != rb->prefixlen) {
+        return ra->prefixlen - rb->prefixlen;
+    }
+    return ra->seq - rb->seq;
+}
+
+/*
+ * group filled with the value the entry had, so shorter prefixes still
+ * match, return the entry pointing to it. groups move when they grow, so
+ * the caller stores it
+ */
+static unsigned int lpm_expand(struct submask_lpm *t, unsigned int entry)
+{
+    unsigned int *g;
+    int i;
+
+    if (entry & LPM_GROUP) {
+        return entry;
+    }
+    if (t->ngroups == t->cap_groups) {
+        int cap = t->cap_groups ? t->cap_groups * 2 : 16;
+        g = (unsigned int *)realloc(t->groups, (size_t)cap * 256 * sizeof(unsigned int));
+        if (!g) {
+            return 0;
+        }
+        t->groups = g;
+        t->cap_groups = cap;
+    }
+    g = t->groups + (size_t)t->ngroups * 256;
+    for (i = 0; i < 256; i++) {
+        g[i] = entry;
+    }
+    return LPM_GROUP | t->ngroups++;
+}
+
+#define LPM_GROUP_AT(t, e, idx) (&(t)->groups[(size_t)((e) & ~LPM_GROUP) * 256 + (idx)])
+
+int submask_lpm_build(struct submask_lpm *t)
+{
+    struct lpm_rule *r;
+    unsigned int hi, mid, lo, n, i, e1, e2;
+    int k;
+
+    if (!t) {
+        return -1;
+    }
+    memset(t->l1, 0, LPM_L1_SIZE * sizeof(unsigned int));
+    t->ngroups = 0;
+    /* shorter prefixes first, a longer one overwrites what it covers */
+    qsort(t->rules, t->nrules, sizeof(struct lpm_rule), lpm_rule_cmp);
+    for (k = 0; k < t->nrules; k++) {
+        r = &t->rules[k];
+        hi = r->ip >> 16;
+        mid = (r->ip >> 8) & 0xff;
+        lo = r->ip & 0xff;
+        if (r->prefixlen <= 16) {
+            n = 1u << (16 - r->prefixlen);
+            for (i = 0; i < n; i++) {
+                t->l1[hi + i] = r->value;
+            }
+            continue;
+        }
+        e1 = lpm_expand(t, t->l1[hi]);
+        if (!e1) {
+            return -1;
+        }
+        t->l1[hi] = e1;
+        if (r->prefixlen <= 24) {
+            n = 1u << (24 - r->prefixlen);
+            for (i = 0; i < n; i++) {
+                *LPM_GROUP_AT(t, e1, mid + i) = r->value;
+            }
+            continue;
+        }
+        e2 = lpm_expand(t, *LPM_GROUP_AT(t, e1, mid));
+        if (!e2) {
+            return -1;
+        }
+        *LPM_GROUP_AT(t, e1, mid) = e2;
+        n = 1u << (32 - r->prefixlen);
+        for (i = 0; i < n; i++) {
+            *LPM_GROUP_AT(t, e2, lo + i) = r->value;
+        }
+    }
+    return 0;
+}
+
+unsigned int submask_lpm_lookup(const struct submask_lpm *t, unsigned int ip)
+{
+    unsigned int e = t->l1[ip >> 16];
+    if (e & LPM_GROUP) {
+        e = *LPM_GROUP_AT(t, e, (ip >> 8) & 0xff);
+        if (e & LPM_GROUP) {
+            e = *LPM_GROUP_AT(t, e, ip & 0xff);
+        }
+    }
+    return e;
+}
+
+void submask_lpm_lookup_batch(const struct submask_lpm *t, const unsigned int *ips,
+                unsigned int *values, int n)
+{
+    int i, j, m;
+
+    /* first level of a whole batch, then the groups it points to */
+    for (i = 0; i < n; i += LPM_BATCH) {
+        m = n - i < LPM_BATCH ? n - i : LPM_BATCH;
+        for (j = 0; j < m; j++) {
+            values[i + j] = t->l1[ips[i + j] >> 16];
+#if defined (__GNUC__)
+            if (values[i + j] & LPM_GROUP) {
+                __builtin_prefetch(LPM_GROUP_AT(t, values[i + j], (ips[i + j] >> 8) & 0xff));
+            }
+#endif
+        }
+        for (j = 0; j < m; j++) {
+            unsigned int e = values[i + j];
+            if (e & LPM_GROUP) {
+                e = *LPM_GROUP_AT(t, e, (ips[i + j] >> 8) & 0xff);
+                if (e & LPM_GROUP) {
+                    e = *LPM_GROUP_AT(t, e, ips[i + j] & 0xff);
+                }
+                values[i + j] = e;
+            }
+        }
+    }
+}
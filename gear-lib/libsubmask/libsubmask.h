@@ -65,6 +65,30 @@ int submask_prefixtomask(int prefixlen, char* ip_str);
 int submask_masktoprefix(const char* ip_str);
 /******************************************************************/
 
+/*
+ * longest prefix match of ipv4 addresses against a list of cidrs, e.g.
+ * allow/deny lists. DIR-16-8-8 layout: a 65536 entry first level indexed
+ * by the high 16 bits, 256 entry groups for the next 8 bits and the last
+ * 8 bits where a longer prefix needs them, a lookup is at most 3 reads.
+ * addresses are host order as submask_zip. add rules, then build once,
+ * lookups are lock free after build, build a new table to change rules
+ */
+#define SUBMASK_LPM_VALUE_MAX   0x7fffffff
+
+struct submask_lpm;
+
+struct submask_lpm *submask_lpm_create(void);
+void submask_lpm_destroy(struct submask_lpm *t);
+/* value 1..SUBMASK_LPM_VALUE_MAX is returned for matches, same prefix overrides */
+int submask_lpm_add(struct submask_lpm *t, unsigned int ip, int prefixlen, unsigned int value);
+/* "10.1.0.0/16" or a single address */
+int submask_lpm_add_cidr(struct submask_lpm *t, const char *cidr, unsigned int value);
+int submask_lpm_build(struct submask_lpm *t);
+/* value of the longest matching prefix, 0 if none */
+unsigned int submask_lpm_lookup(const struct submask_lpm *t, unsigned int ip);
+void submask_lpm_lookup_batch(const struct submask_lpm *t, const unsigned int *ips,
+                unsigned int *values, int n);
+
 
 #ifdef __cplusplus
 }
@@ -102,10 +102,28 @@ int foo1()
 	return 0;
 }
 
+int foo_lpm()
+{
+  struct submask_lpm *t = submask_lpm_create();
+  unsigned int ips[3], vals[3];
+  submask_lpm_add_cidr(t, "0.0.0.0/0", 1);        /* deny all */
+  submask_lpm_add_cidr(t, "192.168.0.0/16", 2);   /* allow lan */
+  submask_lpm_add_cidr(t, "192.168.1.66", 1);     /* except one host */
+  submask_lpm_build(t);
+  ips[0] = submask_zip(8, 8, 8, 8);
+  ips[1] = submask_zip(192, 168, 1, 5);
+  ips[2] = submask_zip(192, 168, 1, 66);
+  submask_lpm_lookup_batch(t, ips, vals, 3);
+  printf("lpm: %u %u %u\n", vals[0], vals[1], vals[2]);
+  submask_lpm_destroy(t);
+  return (vals[0] == 1 && vals[1] == 2 && vals[2] == 1) ? 0 : -1;
+}
+
 int main(int argc, char **argv)
 {
 		foo("192.168.1.1","255.255.255.0");
 		foo("192.168.2.1","28");
 		foo1();
+		foo_lpm();
     return 0;
 }
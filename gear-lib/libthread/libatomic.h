@@ -22,6 +22,13 @@
 #ifndef LIBATOMIC_H
 #define LIBATOMIC_H
 
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#if defined (_MSC_VER)
+#include <intrin.h>
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -68,6 +75,156 @@ int atomic_int_dec(volatile int *ptr);
  */
 void *atomic_ptr_cas(void * volatile *ptr, void *oldval, void *newval);
 
+/**
+ * C11 style atomics with explicit memory order, all inline.
+ *
+ * atomic_<t>_load/store/exchange/cas/cas_weak/fetch_add/fetch_sub/
+ * fetch_and/fetch_or/fetch_xor for t in i32 u32 i64 u64 size,
+ * atomic_ptr_load/store/exchange/cas for pointers.
+ *
+ * cas writes the current value to *expected on failure and returns false,
+ * cas_weak may fail spuriously and fits retry loops better on ll/sc cpus.
+ * @note on msvc every operation is seq_cst whatever order is given.
+ */
+enum atomic_order {
+    ATOMIC_RELAXED = 0,
+    ATOMIC_CONSUME,
+    ATOMIC_ACQUIRE,
+    ATOMIC_RELEASE,
+    ATOMIC_ACQ_REL,
+    ATOMIC_SEQ_CST,
+};
+
+#if defined (__GNUC__) || defined (__clang__)
+
+/* enum values are the same as __ATOMIC_xxx, failure order can not be release */
+#define ATOMIC_FAIL_ORDER(o) \
+    ((o) == ATOMIC_RELEASE ? ATOMIC_RELAXED : (o) == ATOMIC_ACQ_REL ? ATOMIC_ACQUIRE : (o))
+
+#define ATOMIC_DEFINE(name, type)                                              \
+static inline type atomic_##name##_load(volatile type *p, enum atomic_order o) \
+{ return __atomic_load_n(p, o); }                                              \
+static inline void atomic_##name##_store(volatile type *p, type v,             \
+                enum atomic_order o)                                           \
+{ __atomic_store_n(p, v, o); }                                                 \
+static inline type atomic_##name##_exchange(volatile type *p, type v,          \
+                enum atomic_order o)                                           \
+{ return __atomic_exchange_n(p, v, o); }                                       \
+static inline bool atomic_##name##_cas(volatile type *p, type *expected,       \
+                type v, enum atomic_order o)                                   \
+{ return __atomic_compare_exchange_n(p, expected, v, false, o,                 \
+                ATOMIC_FAIL_ORDER(o)); }                                       \
+static inline bool atomic_##name##_cas_weak(volatile type *p, type *expected,  \
+                type v, enum atomic_order o)                                   \
+{ return __atomic_compare_exchange_n(p, expected, v, true, o,                  \
+                ATOMIC_FAIL_ORDER(o)); }                                       \
+static inline type atomic_##name##_fetch_add(volatile type *p, type v,         \
+                enum atomic_order o)                                           \
+{ return __atomic_fetch_add(p, v, o); }                                        \
+static inline type atomic_##name##_fetch_sub(volatile type *p, type v,         \
+                enum atomic_order o)                                           \
+{ return __atomic_fetch_sub(p, v, o); }                                        \
+static inline type atomic_##name##_fetch_and(volatile type *p, type v,         \
+                enum atomic_order o)                                           \
+{ return __atomic_fetch_and(p, v, o); }                                        \
+static inline type atomic_##name##_fetch_or(volatile type *p, type v,          \
+                enum atomic_order o)                                           \
+{ return __atomic_fetch_or(p, v, o); }                                         \
+static inline type atomic_##name##_fetch_xor(volatile type *p, type v,         \
+                enum atomic_order o)                                           \
+{ return __atomic_fetch_xor(p, v, o); }
+
+static inline void *atomic_ptr_load(void * volatile *p, enum atomic_order o)
+{ return __atomic_load_n(p, o); }
+static inline void atomic_ptr_store(void * volatile *p, void *v, enum atomic_order o)
+{ __atomic_store_n(p, v, o); }
+static inline void *atomic_ptr_exchange(void * volatile *p, void *v, enum atomic_order o)
+{ return __atomic_exchange_n(p, v, o); }
+static inline bool atomic_ptr_cas_explicit(void * volatile *p, void **expected,
+                void *v, enum atomic_order o)
+{ return __atomic_compare_exchange_n(p, expected, v, false, o, ATOMIC_FAIL_ORDER(o)); }
+
+static inline void atomic_fence(enum atomic_order o)
+{ __atomic_thread_fence(o); }
+static inline void atomic_compiler_fence(enum atomic_order o)
+{ __atomic_signal_fence(o); }
+
+#elif defined (_MSC_VER)
+
+#define ATOMIC_DEFINE_MSVC(name, type, itype, sfx)                             \
+static inline type atomic_##name##_load(volatile type *p, enum atomic_order o) \
+{ return (type)_InterlockedOr##sfx((volatile itype *)p, 0); }                  \
+static inline void atomic_##name##_store(volatile type *p, type v,             \
+                enum atomic_order o)                                           \
+{ _InterlockedExchange##sfx((volatile itype *)p, (itype)v); }                  \
+static inline type atomic_##name##_exchange(volatile type *p, type v,          \
+                enum atomic_order o)                                           \
+{ return (type)_InterlockedExchange##sfx((volatile itype *)p, (itype)v); }     \
+static inline bool atomic_##name##_cas(volatile type *p, type *expected,       \
+                type v, enum atomic_order o)                                   \
+{                                                                              \
+    itype old = _InterlockedCompareExchange##sfx((volatile itype *)p,          \
+                (itype)v, (itype)*expected);                                   \
+    if (old == (itype)*expected) return true;                                  \
+    *expected = (type)old;                                                     \
+    return false;                                                              \
+}                                                                              \
+static inline bool atomic_##name##_cas_weak(volatile type *p, type *expected,  \
+                type v, enum atomic_order o)                                   \
+{ return atomic_##name##_cas(p, expected, v, o); }                             \
+static inline type atomic_##name##_fetch_add(volatile type *p, type v,         \
+                enum atomic_order o)                                           \
+{ return (type)_InterlockedExchangeAdd##sfx((volatile itype *)p, (itype)v); }  \
+static inline type atomic_##name##_fetch_sub(volatile type *p, type v,         \
+                enum atomic_order o)                                           \
+{ return (type)_InterlockedExchangeAdd##sfx((volatile itype *)p, -(itype)v); } \
+static inline type atomic_##name##_fetch_and(volatile type *p, type v,         \
+                enum atomic_order o)                                           \
+{ return (type)_InterlockedAnd##sfx((volatile itype *)p, (itype)v); }          \
+static inline type atomic_##name##_fetch_or(volatile type *p, type v,          \
+                enum atomic_order o)                                           \
+{ return (type)_InterlockedOr##sfx((volatile itype *)p, (itype)v); }           \
+static inline type atomic_##name##_fetch_xor(volatile type *p, type v,         \
+                enum atomic_order o)                                           \
+{ return (type)_InterlockedXor##sfx((volatile itype *)p, (itype)v); }
+
+#define ATOMIC_DEFINE(name, type) \
+    ATOMIC_DEFINE_MSVC(name, type, __int64, 64)
+
+static inline void *atomic_ptr_load(void * volatile *p, enum atomic_order o)
+{ return _InterlockedCompareExchangePointer(p, NULL, NULL); }
+static inline void atomic_ptr_store(void * volatile *p, void *v, enum atomic_order o)
+{ _InterlockedExchangePointer(p, v); }
+static inline void *atomic_ptr_exchange(void * volatile *p, void *v, enum atomic_order o)
+{ return _InterlockedExchangePointer(p, v); }
+static inline bool atomic_ptr_cas_explicit(void * volatile *p, void **expected,
+                void *v, enum atomic_order o)
+{
+    void *old = _InterlockedCompareExchangePointer(p, v, *expected);
+    if (old == *expected) return true;
+    *expected = old;
+    return false;
+}
+
+static inline void atomic_fence(enum atomic_order o)
+{ MemoryBarrier(); }
+static inline void atomic_compiler_fence(enum atomic_order o)
+{ _ReadWriteBarrier(); }
+
+#endif
+
+#if defined (_MSC_VER)
+/* 32 bit types use 32 bit intrinsics */
+ATOMIC_DEFINE_MSVC(i32, int32_t, long, )
+ATOMIC_DEFINE_MSVC(u32, uint32_t, long, )
+#else
+ATOMIC_DEFINE(i32, int32_t)
+ATOMIC_DEFINE(u32, uint32_t)
+#endif
+ATOMIC_DEFINE(i64, int64_t)
+ATOMIC_DEFINE(u64, uint64_t)
+ATOMIC_DEFINE(size, size_t)
+
 
 #ifdef __cplusplus
 }
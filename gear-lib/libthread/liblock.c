@@ -27,6 +27,11 @@
 #include <unistd.h>
 #include <sched.h>
 #include <pthread.h>
+#include <time.h>
+#endif
+#if defined (__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
 #endif
 #include <errno.h>
 
@@ -44,16 +49,71 @@
     __sync_bool_compare_and_swap(lock, old, set)
 #endif
 
+static long lock_ncpu(void)
+{
+    static long ncpu = 0;
+    long n = __atomic_load_n(&ncpu, __ATOMIC_RELAXED);
+    if (n == 0) {
+#if defined (OS_LINUX) || defined (OS_APPLE)
+        n = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+        n = (n > 0) ? n : 1;
+        __atomic_store_n(&ncpu, n, __ATOMIC_RELAXED);
+    }
+    return n;
+}
+
+static uint64_t lock_now_ns(void)
+{
+#if defined (OS_LINUX) || defined (OS_APPLE)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#else
+    return 0;
+#endif
+}
+
+/******************************************************************************
+ * lock wait hook
+ *****************************************************************************/
+static lock_wait_hook_t lock_wait_hook = NULL;
+
+void lock_set_wait_hook(lock_wait_hook_t hook)
+{
+    __atomic_store_n(&lock_wait_hook, hook, __ATOMIC_RELEASE);
+}
+
+/* 0 means nobody is listening, skip the clock */
+static inline uint64_t lock_wait_begin(void)
+{
+    return __atomic_load_n(&lock_wait_hook, __ATOMIC_RELAXED) ? lock_now_ns() : 0;
+}
+
+static inline void lock_wait_end(void *lock, uint64_t start)
+{
+    lock_wait_hook_t hook = __atomic_load_n(&lock_wait_hook, __ATOMIC_ACQUIRE);
+    if (start && hook) {
+        hook(lock, lock_now_ns() - start);
+    }
+}
+
 int spin_lock(spin_lock_t *lock)
 {
 #if defined (__linux__) || defined (__CYGWIN__)
     int spin = 2048;
     int value = 1;
     int i, n;
-    long g_ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    long g_ncpu;
+    uint64_t start;
+    if (*lock == 0 && atomic_cmp_set(lock, 0, value)) {
+        return 0;
+    }
+    g_ncpu = lock_ncpu();
+    start = lock_wait_begin();
     for ( ;; ) {
         if (*lock == 0 && atomic_cmp_set(lock, 0, value)) {
-            return 0;
+            break;
         }
         if (g_ncpu > 1) {
             for (n = 1; n < spin; n <<= 1) {
@@ -61,19 +121,21 @@ int spin_lock(spin_lock_t *lock)
                     cpu_pause();
                 }
                 if (*lock == 0 && atomic_cmp_set(lock, 0, value)) {
-                    return 0;
+                    goto out;
                 }
             }
         }
         sched_yield();
     }
+out:
+    lock_wait_end(lock, start);
 #endif
     return 0;
 }
 
 int spin_unlock(spin_lock_t *lock)
 {
-    *(lock) = 0;
+    __atomic_store_n(lock, 0, __ATOMIC_RELEASE);
     return 0;
 }
 
@@ -86,6 +148,352 @@ int spin_trylock(spin_lock_t *lock)
 #endif
 }
 
+/******************************************************************************
+ * adaptive lock APIs
+ *****************************************************************************/
+#define ADAPTIVE_SPIN_MIN   (16)
+#define ADAPTIVE_SPIN_MAX   (1024)
+
+/* owner updates stats, plain load and store is enough and keeps lock prefix off */
+#define LOCK_STAT_ADD(lock, f, v) \
+    __atomic_store_n(&(lock)->stats.f, \
+        __atomic_load_n(&(lock)->stats.f, __ATOMIC_RELAXED) + (v), __ATOMIC_RELAXED)
+
+static void lock_park(int *addr, int val)
+{
+#if defined (__linux__)
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+#else
+    sched_yield();
+#endif
+}
+
+static void lock_unpark(int *addr)
+{
+#if defined (__linux__)
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+#endif
+}
+
+int adaptive_lock_init(adaptive_lock_t *lock)
+{
+    if (!lock) {
+        return -1;
+    }
+    memset(lock, 0, sizeof(*lock));
+    lock->spin = ADAPTIVE_SPIN_MIN;
+    return 0;
+}
+
+void adaptive_lock_deinit(adaptive_lock_t *lock)
+{
+    if (lock && __atomic_load_n(&lock->state, __ATOMIC_RELAXED) != 0) {
+        printf("the adaptive lock is currently locked.\n");
+    }
+}
+
+int adaptive_trylock(adaptive_lock_t *lock)
+{
+    int c = 0;
+    if (!lock) {
+        return -1;
+    }
+    if (!__atomic_compare_exchange_n(&lock->state, &c, 1, false,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return -1;
+    }
+    LOCK_STAT_ADD(lock, acquire, 1);
+    return 0;
+}
+
+int adaptive_lock(adaptive_lock_t *lock)
+{
+    int i, c = 0, budget, spin;
+    bool parked = false;
+    uint64_t start, wait;
+
+    if (!lock) {
+        return -1;
+    }
+    if (__atomic_compare_exchange_n(&lock->state, &c, 1, false,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        LOCK_STAT_ADD(lock, acquire, 1);
+        return 0;
+    }
+    start = lock_now_ns();
+    spin = __atomic_load_n(&lock->spin, __ATOMIC_RELAXED);
+    /* spinning on one cpu only delays the owner */
+    budget = (lock_ncpu() > 1) ? MIN2(spin * 2 + ADAPTIVE_SPIN_MIN, ADAPTIVE_SPIN_MAX) : 0;
+    for (i = 0; i < budget; i++) {
+        cpu_pause();
+        c = 0;
+        if (__atomic_load_n(&lock->state, __ATOMIC_RELAXED) == 0 &&
+            __atomic_compare_exchange_n(&lock->state, &c, 1, false,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+    if (i < budget) {
+        /* move spin budget toward what this acquire needed */
+        spin += (i - spin) / 8;
+        LOCK_STAT_ADD(lock, spin_hit, 1);
+    } else {
+        /* drepper futex mutex, state 2 tells unlock to wake someone */
+        c = __atomic_exchange_n(&lock->state, 2, __ATOMIC_ACQUIRE);
+        while (c != 0) {
+            parked = true;
+            lock_park(&lock->state, 2);
+            c = __atomic_exchange_n(&lock->state, 2, __ATOMIC_ACQUIRE);
+        }
+        spin -= spin / 8;
+        if (parked) {
+            LOCK_STAT_ADD(lock, park, 1);
+        }
+    }
+    __atomic_store_n(&lock->spin, MAX2(spin, ADAPTIVE_SPIN_MIN), __ATOMIC_RELAXED);
+    wait = lock_now_ns() - start;
+    LOCK_STAT_ADD(lock, acquire, 1);
+    LOCK_STAT_ADD(lock, contended, 1);
+    LOCK_STAT_ADD(lock, wait_ns, wait);
+    if (wait > __atomic_load_n(&lock->stats.wait_ns_max, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&lock->stats.wait_ns_max, wait, __ATOMIC_RELAXED);
+    }
+    if (UNLIKELY(__atomic_load_n(&lock_wait_hook, __ATOMIC_RELAXED) != NULL)) {
+        lock_wait_end(lock, start);
+    }
+    return 0;
+}
+
+int adaptive_unlock(adaptive_lock_t *lock)
+{
+    if (!lock) {
+        return -1;
+    }
+    if (__atomic_exchange_n(&lock->state, 0, __ATOMIC_RELEASE) == 2) {
+        lock_unpark(&lock->state);
+    }
+    return 0;
+}
+
+void adaptive_lock_get_stats(adaptive_lock_t *lock, struct lock_stats *stats)
+{
+    if (!lock || !stats) {
+        return;
+    }
+    stats->acquire = __atomic_load_n(&lock->stats.acquire, __ATOMIC_RELAXED);
+    stats->contended = __atomic_load_n(&lock->stats.contended, __ATOMIC_RELAXED);
+    stats->spin_hit = __atomic_load_n(&lock->stats.spin_hit, __ATOMIC_RELAXED);
+    stats->park = __atomic_load_n(&lock->stats.park, __ATOMIC_RELAXED);
+    stats->wait_ns = __atomic_load_n(&lock->stats.wait_ns, __ATOMIC_RELAXED);
+    stats->wait_ns_max = __atomic_load_n(&lock->stats.wait_ns_max, __ATOMIC_RELAXED);
+}
+
+void adaptive_lock_reset_stats(adaptive_lock_t *lock)
+{
+    if (!lock) {
+        return;
+    }
+    /* take the lock so owner updates are not lost half way */
+    adaptive_lock(lock);
+    memset(&lock->stats, 0, sizeof(lock->stats));
+    adaptive_unlock(lock);
+}
+
+/******************************************************************************
+ * seqlock APIs
+ *****************************************************************************/
+void seqlock_init(seq_lock_t *sl)
+{
+    sl->seq = 0;
+    sl->lock = 0;
+}
+
+void seqlock_write_begin(seq_lock_t *sl)
+{
+    spin_lock(&sl->lock);
+    __atomic_store_n(&sl->seq, sl->seq + 1, __ATOMIC_RELAXED);
+    /* odd seq must be visible before any data store */
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void seqlock_write_end(seq_lock_t *sl)
+{
+    __atomic_store_n(&sl->seq, sl->seq + 1, __ATOMIC_RELEASE);
+    spin_unlock(&sl->lock);
+}
+
+unsigned int seqlock_read_begin(seq_lock_t *sl)
+{
+    unsigned int seq;
+    while ((seq = __atomic_load_n(&sl->seq, __ATOMIC_ACQUIRE)) & 1) {
+        cpu_pause();
+    }
+    return seq;
+}
+
+bool seqlock_read_retry(seq_lock_t *sl, unsigned int seq)
+{
+    /* data loads must finish before seq is checked again */
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&sl->seq, __ATOMIC_RELAXED) != seq;
+}
+
+/******************************************************************************
+ * rcu APIs
+ *****************************************************************************/
+#define RCU_DEFER_BATCH     (64)
+
+struct rcu_defer_item {
+    void (*func)(void *);
+    void *arg;
+    struct rcu_defer_item *next;
+};
+
+int rcu_init(struct rcu *rcu)
+{
+    if (!rcu) {
+        return -1;
+    }
+    memset(rcu, 0, sizeof(*rcu));
+    rcu->epoch = 1;
+    INIT_LIST_HEAD(&rcu->readers);
+    mutex_lock_init(&rcu->lock);
+    mutex_lock_init(&rcu->defer_lock);
+    return 0;
+}
+
+void rcu_deinit(struct rcu *rcu)
+{
+    if (!rcu) {
+        return;
+    }
+    rcu_barrier(rcu);
+    mutex_lock_deinit(&rcu->defer_lock);
+    mutex_lock_deinit(&rcu->lock);
+}
+
+int rcu_register(struct rcu *rcu, struct rcu_reader *r)
+{
+    if (!rcu || !r) {
+        return -1;
+    }
+    r->epoch = 0;
+    r->nest = 0;
+    mutex_lock(&rcu->lock);
+    list_add_tail(&r->entry, &rcu->readers);
+    mutex_unlock(&rcu->lock);
+    return 0;
+}
+
+void rcu_unregister(struct rcu *rcu, struct rcu_reader *r)
+{
+    if (!rcu || !r) {
+        return;
+    }
+    mutex_lock(&rcu->lock);
+    list_del(&r->entry);
+    mutex_unlock(&rcu->lock);
+}
+
+/*
+ * reader epoch store and writer epoch increment are both seq_cst, so
+ * either writer sees this reader in its scan, or reader sees the new
+ * epoch and then also the pointer published before it
+ */
+void rcu_read_lock(struct rcu *rcu, struct rcu_reader *r)
+{
+    if (r->nest++ == 0) {
+        __atomic_store_n(&r->epoch, __atomic_load_n(&rcu->epoch, __ATOMIC_SEQ_CST),
+                         __ATOMIC_SEQ_CST);
+    }
+}
+
+void rcu_read_unlock(struct rcu *rcu, struct rcu_reader *r)
+{
+    if (--r->nest == 0) {
+        __atomic_store_n(&r->epoch, 0, __ATOMIC_RELEASE);
+    }
+}
+
+void rcu_synchronize(struct rcu *rcu)
+{
+    uint64_t e, re;
+    struct rcu_reader *r;
+    if (!rcu) {
+        return;
+    }
+    mutex_lock(&rcu->lock);
+    e = __atomic_add_fetch(&rcu->epoch, 1, __ATOMIC_SEQ_CST);
+    list_for_each_entry(r, &rcu->readers, entry) {
+        /* wait readers entered before the new epoch */
+        while ((re = __atomic_load_n(&r->epoch, __ATOMIC_SEQ_CST)) != 0 && re < e) {
+            cpu_pause();
+            sched_yield();
+        }
+    }
+    mutex_unlock(&rcu->lock);
+}
+
+static void rcu_run_defer(struct rcu_defer_item *item)
+{
+    struct rcu_defer_item *next;
+    while (item) {
+        next = item->next;
+        item->func(item->arg);
+        free(item);
+        item = next;
+    }
+}
+
+/* one grace period for a batch, caller must not be inside read lock */
+int rcu_defer(struct rcu *rcu, void (*func)(void *), void *arg)
+{
+    struct rcu_defer_item *item, *batch = NULL;
+    if (!rcu || !func) {
+        return -1;
+    }
+    item = calloc(1, sizeof(struct rcu_defer_item));
+    if (!item) {
+        /* no memory, wait grace period in place */
+        rcu_synchronize(rcu);
+        func(arg);
+        return 0;
+    }
+    item->func = func;
+    item->arg = arg;
+    mutex_lock(&rcu->defer_lock);
+    item->next = rcu->defer;
+    rcu->defer = item;
+    if (++rcu->defer_nr >= RCU_DEFER_BATCH) {
+        batch = rcu->defer;
+        rcu->defer = NULL;
+        rcu->defer_nr = 0;
+    }
+    mutex_unlock(&rcu->defer_lock);
+    if (batch) {
+        rcu_synchronize(rcu);
+        rcu_run_defer(batch);
+    }
+    return 0;
+}
+
+void rcu_barrier(struct rcu *rcu)
+{
+    struct rcu_defer_item *batch;
+    if (!rcu) {
+        return;
+    }
+    mutex_lock(&rcu->defer_lock);
+    batch = rcu->defer;
+    rcu->defer = NULL;
+    rcu->defer_nr = 0;
+    mutex_unlock(&rcu->defer_lock);
+    if (batch) {
+        rcu_synchronize(rcu);
+        rcu_run_defer(batch);
+    }
+}
+
 /******************************************************************************
  * mutex lock APIs
  *****************************************************************************/
@@ -163,11 +571,26 @@ int mutex_trylock(mutex_lock_t *ptr)
 int mutex_lock(mutex_lock_t *ptr)
 {
     int ret;
+    uint64_t start;
     pthread_mutex_t *lock = (pthread_mutex_t *)ptr;
     if (!ptr) {
         return -1;
     }
-    ret = pthread_mutex_lock(lock);
+    if (UNLIKELY(__atomic_load_n(&lock_wait_hook, __ATOMIC_RELAXED) != NULL)) {
+        /* only time the contended path */
+        ret = pthread_mutex_trylock(lock);
+        if (ret == 0) {
+            return 0;
+        }
+        start = lock_wait_begin();
+        ret = pthread_mutex_lock(lock);
+        if (ret == 0) {
+            lock_wait_end(ptr, start);
+            return 0;
+        }
+    } else {
+        ret = pthread_mutex_lock(lock);
+    }
     if (ret != 0) {
         switch (ret) {
         case EDEADLK:
@@ -257,10 +680,10 @@ int mutex_cond_wait(mutex_lock_t *mutexp, mutex_cond_t *condp, int64_t ms)
         pthread_cond_wait(cond, mutex);
     } else {
         clock_gettime(CLOCK_REALTIME, &ts);
-        uint64_t ns = ts.tv_sec * 1000 * 1000 * 1000 + ts.tv_nsec;
+        uint64_t ns = (uint64_t)ts.tv_sec * 1000 * 1000 * 1000 + ts.tv_nsec;
         ns += ms * 1000 * 1000;
         ts.tv_sec = ns / (1000 * 1000 * 1000);
-        ts.tv_nsec = ns % 1000 * 1000 * 1000;
+        ts.tv_nsec = ns % (1000 * 1000 * 1000);
 wait:
         ret = pthread_cond_timedwait(cond, mutex, &ts);
         if (ret != 0) {
@@ -535,10 +958,10 @@ int sem_lock_wait(sem_lock_t *ptr, int64_t ms)
         }
     } else {
         clock_gettime(CLOCK_REALTIME, &ts);
-        uint64_t ns = ts.tv_sec * 1000 * 1000 * 1000 + ts.tv_nsec;
+        uint64_t ns = (uint64_t)ts.tv_sec * 1000 * 1000 * 1000 + ts.tv_nsec;
         ns += ms * 1000 * 1000;
         ts.tv_sec = ns / (1000 * 1000 * 1000);
-        ts.tv_nsec = ns % 1000 * 1000 * 1000;
+        ts.tv_nsec = ns % (1000 * 1000 * 1000);
         ret = sem_timedwait(lock, &ts);
         if (ret != 0) {
             switch (errno) {
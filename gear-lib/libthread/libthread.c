@@ -31,6 +31,10 @@
 #include <string.h>
 #include <errno.h>
 #include <stdarg.h>
+#if defined (OS_LINUX)
+#include <sched.h>
+#include <unistd.h>
+#endif
 
 
 static void *__thread_func(void *arg)
@@ -210,6 +214,145 @@ void thread_get_info(struct thread *t)
 #endif
 }
 
+#if defined (OS_LINUX)
+#define THREAD_MAX_CPUS     (1024)
+
+/* parse cpulist like "0-3,8,10-11" */
+static int parse_cpulist(const char *str, int *cpus, int max)
+{
+    int n = 0, begin, end;
+    char *p = (char *)str;
+    while (*p && n < max) {
+        begin = end = (int)strtol(p, &p, 10);
+        if (*p == '-') {
+            end = (int)strtol(p + 1, &p, 10);
+        }
+        while (begin <= end && n < max) {
+            cpus[n++] = begin++;
+        }
+        if (*p != ',') {
+            break;
+        }
+        p++;
+    }
+    return n;
+}
+#endif
+
+int thread_set_affinity(struct thread *t, const int *cpus, int n)
+{
+#if defined (OS_LINUX)
+    int i, ret;
+    cpu_set_t set;
+    pthread_t tid = t ? t->tid : pthread_self();
+    if (n < 0 || (n > 0 && !cpus)) {
+        printf("%s invalid paramenters!\n", __func__);
+        return -1;
+    }
+    CPU_ZERO(&set);
+    if (n == 0) {
+        for (i = 0; i < sysconf(_SC_NPROCESSORS_CONF) && i < CPU_SETSIZE; i++) {
+            CPU_SET(i, &set);
+        }
+    }
+    for (i = 0; i < n; i++) {
+        if (cpus[i] >= 0 && cpus[i] < CPU_SETSIZE) {
+            CPU_SET(cpus[i], &set);
+        }
+    }
+    ret = pthread_setaffinity_np(tid, sizeof(set), &set);
+    if (ret != 0) {
+        printf("pthread_setaffinity_np failed: %s\n", strerror(ret));
+        return -1;
+    }
+    return 0;
+#else
+    printf("%s not support!\n", __func__);
+    return -1;
+#endif
+}
+
+int thread_set_numa_node(struct thread *t, int node)
+{
+#if defined (OS_LINUX)
+    int n;
+    FILE *fp;
+    char path[128];
+    char buf[1024];
+    int cpus[THREAD_MAX_CPUS];
+
+    if (node < 0) {
+        printf("%s invalid paramenters!\n", __func__);
+        return -1;
+    }
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+    fp = fopen(path, "r");
+    if (!fp) {
+        printf("open %s failed: %s\n", path, strerror(errno));
+        return -1;
+    }
+    if (!fgets(buf, sizeof(buf), fp)) {
+        fclose(fp);
+        return -1;
+    }
+    fclose(fp);
+    n = parse_cpulist(buf, cpus, THREAD_MAX_CPUS);
+    if (n <= 0) {
+        printf("numa node %d has no cpu\n", node);
+        return -1;
+    }
+    return thread_set_affinity(t, cpus, n);
+#else
+    printf("%s not support!\n", __func__);
+    return -1;
+#endif
+}
+
+int thread_set_sched(struct thread *t, enum thread_sched policy, int priority)
+{
+#if defined (OS_LINUX) || defined (OS_APPLE)
+    int ret, min, max, pol;
+    struct sched_param sp;
+    pthread_t tid = t ? t->tid : pthread_self();
+
+    switch (policy) {
+    case THREAD_SCHED_FIFO:
+        pol = SCHED_FIFO;
+        break;
+    case THREAD_SCHED_RR:
+        pol = SCHED_RR;
+        break;
+    case THREAD_SCHED_OTHER:
+    default:
+        pol = SCHED_OTHER;
+        break;
+    }
+    min = sched_get_priority_min(pol);
+    max = sched_get_priority_max(pol);
+    memset(&sp, 0, sizeof(sp));
+    sp.sched_priority = priority < min ? min : (priority > max ? max : priority);
+    ret = pthread_setschedparam(tid, pol, &sp);
+    if (ret != 0) {
+        printf("pthread_setschedparam failed: %s%s\n", strerror(ret),
+               ret == EPERM ? ", need CAP_SYS_NICE or rtprio limit" : "");
+        return -1;
+    }
+    return 0;
+#else
+    printf("%s not support!\n", __func__);
+    return -1;
+#endif
+}
+
+int thread_get_cpu(void)
+{
+#if defined (OS_LINUX)
+    return sched_getcpu();
+#else
+    return -1;
+#endif
+}
+
 int thread_lock(struct thread *t)
 {
     if (!t) {
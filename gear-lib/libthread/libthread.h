@@ -27,7 +27,9 @@
 #include <stdint.h>
 #if defined (OS_LINUX) || defined (OS_APPLE)
 #include <stdbool.h>
+#ifndef _GNU_SOURCE
 #define _GNU_SOURCE
+#endif
 #include <pthread.h>
 #include <semaphore.h>
 #define _POSIX_RW_LOCKS
@@ -60,6 +62,43 @@ int spin_lock(spin_lock_t *lock);
 int spin_unlock(spin_lock_t *lock);
 int spin_trylock(spin_lock_t *lock);
 
+/*
+ * adaptive lock: spin for a while then park in kernel (futex on linux),
+ * spin budget follows how long recent owners held the lock.
+ * stats are updated by the owner inside the lock, reading them is racy
+ * but cheap, no extra atomic on the fast path
+ */
+struct lock_stats {
+    uint64_t acquire;       /* all successful lock */
+    uint64_t contended;     /* first try failed */
+    uint64_t spin_hit;      /* got it while spinning */
+    uint64_t park;          /* slept in kernel */
+    uint64_t wait_ns;       /* total wait time of contended lock */
+    uint64_t wait_ns_max;
+};
+
+typedef struct adaptive_lock {
+    int state;      /* 0 unlocked, 1 locked, 2 locked with waiters */
+    int spin;
+    struct lock_stats stats;
+} adaptive_lock_t;
+
+int adaptive_lock_init(adaptive_lock_t *lock);
+int adaptive_lock(adaptive_lock_t *lock);
+int adaptive_trylock(adaptive_lock_t *lock);
+int adaptive_unlock(adaptive_lock_t *lock);
+void adaptive_lock_deinit(adaptive_lock_t *lock);
+void adaptive_lock_get_stats(adaptive_lock_t *lock, struct lock_stats *stats);
+void adaptive_lock_reset_stats(adaptive_lock_t *lock);
+
+/*
+ * lock wait hook, called by the waiter after a contended spin, adaptive or
+ * mutex lock with lock address and wait ns, e.g. debug_lock_trace_wait of
+ * libdebug. NULL disables, uncontended lock never calls it
+ */
+typedef void (*lock_wait_hook_t)(void *lock, uint64_t wait_ns);
+void lock_set_wait_hook(lock_wait_hook_t hook);
+
 /*
  * mutex lock implemented by pthread_mutex APIs
  */
@@ -81,6 +120,62 @@ void mutex_cond_signal(mutex_cond_t *cond);
 void mutex_cond_signal_all(mutex_cond_t *cond);
 void mutex_cond_deinit(mutex_cond_t *cond);
 
+/*
+ * seqlock: writers serialize on spin lock and make seq odd while writing,
+ * readers never block writer, they retry when seq changed:
+ *     do {
+ *         seq = seqlock_read_begin(&sl);
+ *         copy shared data;
+ *     } while (seqlock_read_retry(&sl, seq));
+ */
+typedef struct seq_lock {
+    unsigned int seq;
+    spin_lock_t lock;
+} seq_lock_t;
+
+void seqlock_init(seq_lock_t *sl);
+void seqlock_write_begin(seq_lock_t *sl);
+void seqlock_write_end(seq_lock_t *sl);
+unsigned int seqlock_read_begin(seq_lock_t *sl);
+bool seqlock_read_retry(seq_lock_t *sl, unsigned int seq);
+
+/*
+ * rcu: epoch based read-copy-update, each reader thread registers one
+ * rcu_reader, read side is one store on enter and exit without lock.
+ * writer publishes new pointer by rcu_assign_pointer, then
+ * rcu_synchronize waits all readers entered before it, or rcu_defer
+ * queues old object to be freed after a later grace period
+ */
+struct rcu_reader {
+    uint64_t epoch;     /* epoch seen at read lock, 0 when outside */
+    int nest;
+    struct list_head entry;
+};
+
+struct rcu_defer_item;
+
+typedef struct rcu {
+    uint64_t epoch;
+    mutex_lock_t lock;
+    struct list_head readers;
+    mutex_lock_t defer_lock;
+    struct rcu_defer_item *defer;
+    int defer_nr;
+} rcu_t;
+
+#define rcu_dereference(p)          __atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+#define rcu_assign_pointer(p, v)    __atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+
+int rcu_init(struct rcu *rcu);
+void rcu_deinit(struct rcu *rcu);
+int rcu_register(struct rcu *rcu, struct rcu_reader *r);
+void rcu_unregister(struct rcu *rcu, struct rcu_reader *r);
+void rcu_read_lock(struct rcu *rcu, struct rcu_reader *r);
+void rcu_read_unlock(struct rcu *rcu, struct rcu_reader *r);
+void rcu_synchronize(struct rcu *rcu);
+int rcu_defer(struct rcu *rcu, void (*func)(void *), void *arg);
+void rcu_barrier(struct rcu *rcu);
+
 
 /*
  * read-write lock implemented by pthread_rwlock APIs
@@ -134,6 +229,21 @@ GEAR_API void thread_destroy(struct thread *t);
 GEAR_API void thread_get_info(struct thread *t);
 GEAR_API int thread_set_name(struct thread *t, const char *name);
 
+/*
+ * cpu affinity and scheduling, t == NULL means the calling thread
+ * affinity with n == 0 allows all cpus, numa node binds to cpus of node
+ * realtime policy needs CAP_SYS_NICE, priority is clamped to policy range
+ */
+enum thread_sched {
+    THREAD_SCHED_OTHER = 0,
+    THREAD_SCHED_FIFO,
+    THREAD_SCHED_RR,
+};
+GEAR_API int thread_set_affinity(struct thread *t, const int *cpus, int n);
+GEAR_API int thread_set_numa_node(struct thread *t, int node);
+GEAR_API int thread_set_sched(struct thread *t, enum thread_sched policy, int priority);
+GEAR_API int thread_get_cpu(void);
+
 GEAR_API int thread_lock(struct thread *t);
 GEAR_API int thread_unlock(struct thread *t);
 GEAR_API int thread_wait(struct thread *t, int64_t ms);
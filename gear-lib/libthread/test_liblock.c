@@ -20,6 +20,7 @@
  * SOFTWARE.
  ******************************************************************************/
 #include "libthread.h"
+#include "libatomic.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
@@ -31,6 +32,7 @@
 
 static spin_lock_t spin;
 static mutex_lock_t mutex;
+static adaptive_lock_t adaptive;
 
 static int64_t value = 0;
 struct thread_arg {
@@ -43,7 +45,7 @@ void usage(int argc, char **argv)
 {
     if (argc != 3) {
         printf("Usage: %s <type> <count>\n", argv[0]);
-        printf("type: spin | mutex\n");
+        printf("type: spin | mutex | adaptive | atomic | seqlock | rcu\n");
         printf("count: 2 ~ 10\n");
         exit(0);
     }
@@ -106,6 +108,110 @@ static void *print_spin_lock(void *arg)
     return NULL;
 }
 
+static void *print_adaptive_lock(void *arg)
+{
+    struct thread_arg *argp = (struct thread_arg *)arg;
+    int c = argp->flag;
+    uint64_t n = argp->count;
+    uint64_t i;
+
+    printf("c = %d\n", c);
+    for (i = 0; i < n; ++ i) {
+        adaptive_lock(&adaptive);
+        if (c) {
+            ++ value;
+        } else {
+            -- value;
+        }
+        adaptive_unlock(&adaptive);
+    }
+    return NULL;
+}
+
+static void *print_atomic(void *arg)
+{
+    struct thread_arg *argp = (struct thread_arg *)arg;
+    int64_t inc = argp->flag ? 1 : -1;
+    uint64_t i;
+
+    printf("c = %d\n", argp->flag);
+    for (i = 0; i < argp->count; ++ i) {
+        atomic_i64_fetch_add((volatile int64_t *)&value, inc, ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+/* writer keeps pair equal, reader checks it never sees a torn pair */
+static seq_lock_t seqlock;
+static int64_t pair[2];
+static uint64_t torn;
+
+static void *print_seqlock(void *arg)
+{
+    struct thread_arg *argp = (struct thread_arg *)arg;
+    unsigned int seq;
+    int64_t a, b;
+    uint64_t i;
+
+    for (i = 0; i < argp->count; ++ i) {
+        if (argp->flag) {
+            seqlock_write_begin(&seqlock);
+            __atomic_store_n(&pair[0], i, __ATOMIC_RELAXED);
+            __atomic_store_n(&pair[1], i, __ATOMIC_RELAXED);
+            seqlock_write_end(&seqlock);
+        } else {
+            do {
+                seq = seqlock_read_begin(&seqlock);
+                a = __atomic_load_n(&pair[0], __ATOMIC_RELAXED);
+                b = __atomic_load_n(&pair[1], __ATOMIC_RELAXED);
+            } while (seqlock_read_retry(&seqlock, seq));
+            if (a != b) {
+                torn++;
+            }
+        }
+    }
+    return NULL;
+}
+
+/* reader dereferences shared config, writer replaces and frees old one */
+struct config {
+    int64_t a;
+    int64_t b;
+};
+static struct rcu rcu;
+static struct config *g_conf;
+
+static void *print_rcu(void *arg)
+{
+    struct thread_arg *argp = (struct thread_arg *)arg;
+    struct rcu_reader reader;
+    struct config *c;
+    uint64_t i;
+
+    if (!argp->flag) {
+        rcu_register(&rcu, &reader);
+    }
+    for (i = 0; i < argp->count; ++ i) {
+        if (argp->flag) {
+            c = calloc(1, sizeof(struct config));
+            c->a = c->b = i;
+            c = __atomic_exchange_n(&g_conf, c, __ATOMIC_ACQ_REL);
+            rcu_defer(&rcu, free, c);
+        } else {
+            rcu_read_lock(&rcu, &reader);
+            c = rcu_dereference(g_conf);
+            if (c->a != c->b) {
+                torn++;
+            }
+            rcu_read_unlock(&rcu, &reader);
+        }
+    }
+    if (!argp->flag) {
+        rcu_unregister(&rcu, &reader);
+    }
+    return NULL;
+}
+
 int main(int argc, char **argv)
 {
     usage(argc, argv);
@@ -128,6 +234,26 @@ int main(int argc, char **argv)
         mutex_lock_init(&mutex);
         pthread_create(&tid1, NULL, print_mutex_lock, (void *)&arg1);
         pthread_create(&tid2, NULL, print_mutex_lock, (void *)&arg2);
+    } else if (!strcmp(argv[1], "seqlock")) {
+        gettimeofday(&start, NULL);
+        seqlock_init(&seqlock);
+        pthread_create(&tid1, NULL, print_seqlock, (void *)&arg1);
+        pthread_create(&tid2, NULL, print_seqlock, (void *)&arg2);
+    } else if (!strcmp(argv[1], "rcu")) {
+        gettimeofday(&start, NULL);
+        rcu_init(&rcu);
+        g_conf = calloc(1, sizeof(struct config));
+        pthread_create(&tid1, NULL, print_rcu, (void *)&arg1);
+        pthread_create(&tid2, NULL, print_rcu, (void *)&arg2);
+    } else if (!strcmp(argv[1], "atomic")) {
+        gettimeofday(&start, NULL);
+        pthread_create(&tid1, NULL, print_atomic, (void *)&arg1);
+        pthread_create(&tid2, NULL, print_atomic, (void *)&arg2);
+    } else if (!strcmp(argv[1], "adaptive")) {
+        gettimeofday(&start, NULL);
+        adaptive_lock_init(&adaptive);
+        pthread_create(&tid1, NULL, print_adaptive_lock, (void *)&arg1);
+        pthread_create(&tid2, NULL, print_adaptive_lock, (void *)&arg2);
     }
     printf("tid1=%d, tid2=%d\n", (int)tid1, (int)tid2);
 
@@ -142,6 +268,21 @@ int main(int argc, char **argv)
         fprintf(stdout, "Value is %" PRIu64 ", Used %" PRIu64 "us:%" PRIu64 "\n",
                 value, (endUs - startUs) / 1000000, (endUs - startUs) % 1000000);
     }
+    if (!strcmp(argv[1], "seqlock") || !strcmp(argv[1], "rcu")) {
+        printf("torn read %" PRIu64 "\n", torn);
+        if (!strcmp(argv[1], "rcu")) {
+            rcu_deinit(&rcu);
+            free(g_conf);
+        }
+    }
+    if (!strcmp(argv[1], "adaptive")) {
+        struct lock_stats st;
+        adaptive_lock_get_stats(&adaptive, &st);
+        printf("acquire=%" PRIu64 " contended=%" PRIu64 " spin_hit=%" PRIu64
+               " park=%" PRIu64 " wait_max=%" PRIu64 "ns\n", st.acquire,
+               st.contended, st.spin_hit, st.park, st.wait_ns_max);
+        adaptive_lock_deinit(&adaptive);
+    }
     mutex_lock_deinit(&mutex);
 
     return 0;
@@ -69,10 +69,25 @@ void foo2()
     thread_destroy(t1);
 }
 
+void foo3()
+{
+    int cpu = 0;
+    struct thread *t1 = thread_create(thread, NULL);
+    if (0 == thread_set_affinity(t1, &cpu, 1)) {
+        printf("bind thread to cpu %d\n", cpu);
+    }
+    thread_set_numa_node(NULL, 0);
+    printf("current cpu = %d\n", thread_get_cpu());
+    thread_set_sched(t1, THREAD_SCHED_FIFO, 10);
+    thread_get_info(t1);
+    thread_destroy(t1);
+}
+
 int main(int argc, char **argv)
 {
     foo();
     foo2();
+    foo3();
     while (1) {
         //printf("%s:%d xxx\n", __func__, __LINE__);
         sleep(1);
@@ -28,10 +28,40 @@
 #include <sys/time.h>
 #if defined (OS_LINUX) || defined (OS_APPLE)
 #include <sys/timeb.h>
+#include <pthread.h>
+#endif
+#if defined (__x86_64__) || defined (__i386__)
+#include <cpuid.h>
 #endif
 
 #define TIME_FORMAT "%Y%m%d%H%M%S"
 
+#if defined (OS_WINDOWS)
+#define TIME_TLS __declspec(thread)
+#else
+#define TIME_TLS __thread
+#endif
+
+#if (defined (OS_LINUX) || defined (OS_APPLE)) && \
+    (defined (__x86_64__) || defined (__aarch64__))
+#define TIME_HAVE_COUNTER
+#endif
+
+#define TIME_CALIBRATE_NS   (10 * 1000 * 1000)
+#define TIME_RESYNC_NS      (1000 * 1000 * 1000ULL)
+#define TIME_SLEW_MAX_NS    (500 * 1000)        /* per resync period */
+
+/* msec render with date prefix cached until the minute changes */
+struct time_fmt_cache {
+    int64_t minute;
+    char prefix[20];                /* "YYYY-mm-dd HH:MM:" */
+};
+
+static TIME_TLS struct time_fmt_cache _fmt_cache = {-1, {0}};
+
+static uint64_t _coarse_msec;
+static uint64_t _coarse_mono_msec;
+
 
 uint64_t time_now_sec()
 {
@@ -80,9 +110,40 @@ char *time_str_format_by_utc(uint32_t utc, char *str, int len)
     return str;
 }
 
+static char *time_fmt_msec(uint64_t msec, char *str)
+{
+    struct time_fmt_cache *c = &_fmt_cache;
+    time_t sec = (time_t)(msec / 1000);
+    int64_t minute = sec / 60;
+    int s = sec % 60;
+    int ms = msec % 1000;
+    struct tm tm;
+
+    if (c->minute != minute) {
+        if (NULL == localtime_r(&sec, &tm)) {
+            printf("localtime_r failed %d:%s\n", errno, strerror(errno));
+            return NULL;
+        }
+        strftime(c->prefix, sizeof(c->prefix), "%Y-%m-%d %H:%M:", &tm);
+        c->minute = minute;
+    }
+    memcpy(str, c->prefix, 17);
+    str[17] = '0' + s / 10;
+    str[18] = '0' + s % 10;
+    str[19] = '.';
+    str[20] = '0' + ms / 100;
+    str[21] = '0' + ms / 10 % 10;
+    str[22] = '0' + ms % 10;
+    str[23] = '\0';
+    return str;
+}
+
 char *time_str_format_by_msec(uint64_t msec, char *str, int len)
 {
     struct time_info ti;
+    if (len >= 24) {
+        return time_fmt_msec(msec, str);
+    }
     if (-1 == time_info_by_msec(msec, &ti)) {
         return NULL;
     }
@@ -107,7 +168,7 @@ uint64_t time_now_usec(struct timeval *val)
         printf("gettimeofday failed %d:%s\n", errno, strerror(errno));
         return -1;
     }
-    return (uint64_t)(((uint64_t)tv.tv_sec)*1000*1000 + (uint64_t)tv.tv_usec);
+    return (uint64_t)(((uint64_t)val->tv_sec)*1000*1000 + (uint64_t)val->tv_usec);
 }
 
 static uint64_t _time_clock_gettime(clockid_t clk_id)
@@ -137,12 +198,7 @@ uint64_t time_bootup_nsec()
 
 char *time_now_msec_str(char *str, int len)
 {
-    char date_fmt[20];
-    char date_ms[4];
     struct timeval tv;
-    struct tm now_tm;
-    int now_ms;
-    time_t now_sec;
     if (len < 24) {
         printf("time string len must bigger than 24\n");
         return NULL;
@@ -151,17 +207,209 @@ char *time_now_msec_str(char *str, int len)
         printf("gettimeofday failed %d:%s\n", errno, strerror(errno));
         return NULL;
     }
-    now_sec = tv.tv_sec;
-    now_ms = tv.tv_usec/1000;
-    if (NULL == localtime_r(&now_sec, &now_tm)) {
-        printf("localtime_r failed %d:%s\n", errno, strerror(errno));
-        return NULL;
+    return time_fmt_msec((uint64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000, str);
+}
+
+/*
+ * fast clock: ns = base_ns + ((cycles - base_cyc) * mult) >> 32
+ * params are published under a seqlock, resync keeps the clock continuous
+ * and slews it toward CLOCK_MONOTONIC so it never steps backward
+ */
+struct time_clock {
+    enum time_clock_source source;
+    uint32_t seq;
+    uint64_t base_cyc;
+    uint64_t base_ns;
+    uint64_t mult;
+    uint64_t cal_cyc;               /* first anchor, long baseline for resync */
+    uint64_t cal_ns;
+};
+
+static struct time_clock _clock;
+
+#if defined (TIME_HAVE_COUNTER)
+static pthread_once_t _clock_once = PTHREAD_ONCE_INIT;
+
+static inline uint64_t time_cycles()
+{
+#if defined (__x86_64__)
+    return __builtin_ia32_rdtsc();
+#else
+    uint64_t v;
+    __asm__ __volatile__("isb; mrs %0, cntvct_el0" : "=r"(v) :: "memory");
+    return v;
+#endif
+}
+
+#if defined (__x86_64__)
+static int time_tsc_usable()
+{
+    unsigned int a, b, c, d;
+    char cs[32] = {0};
+    FILE *fp;
+
+    if (!__get_cpuid(0x80000007, &a, &b, &c, &d) || !(d & (1 << 8))) {
+        return 0;               /* not invariant */
     }
+    /* the kernel knows better if it has marked tsc unstable */
+    fp = fopen("/sys/devices/system/clocksource/clocksource0/current_clocksource", "r");
+    if (fp) {
+        if (!fgets(cs, sizeof(cs), fp)) {
+            cs[0] = '\0';
+        }
+        fclose(fp);
+        return 0 == strncmp(cs, "tsc", 3);
+    }
+    return 1;
+}
+#endif
 
-    strftime(date_fmt, 20, "%Y-%m-%d %H:%M:%S", &now_tm);
-    snprintf(date_ms, sizeof(date_ms), "%03d", now_ms);
-    snprintf(str, len, "%s.%s", date_fmt, date_ms);
-    return str;
+/* read counter and monotonic as close together as possible */
+static void time_clock_anchor(uint64_t *cyc, uint64_t *ns)
+{
+    uint64_t c0 = time_cycles();
+    *ns = _time_clock_gettime(CLOCK_MONOTONIC);
+    *cyc = c0 + (time_cycles() - c0) / 2;
+}
+
+static void time_clock_setup()
+{
+    uint64_t c0, t0, c1, t1;
+    struct timespec ts = {0, TIME_CALIBRATE_NS};
+
+#if defined (__x86_64__)
+    if (!time_tsc_usable()) {
+        return;
+    }
+    time_clock_anchor(&c0, &t0);
+    nanosleep(&ts, NULL);
+    time_clock_anchor(&c1, &t1);
+    if (c1 <= c0 || t1 <= t0) {
+        return;
+    }
+    _clock.mult = (uint64_t)(((unsigned __int128)(t1 - t0) << 32) / (c1 - c0));
+    _clock.source = TIME_CLOCK_TSC;
+#else
+    uint64_t freq;
+    (void)ts;
+    __asm__ __volatile__("mrs %0, cntfrq_el0" : "=r"(freq));
+    if (!freq) {
+        return;
+    }
+    _clock.mult = (uint64_t)(((unsigned __int128)1000000000ULL << 32) / freq);
+    time_clock_anchor(&c1, &t1);
+    _clock.source = TIME_CLOCK_CNTVCT;
+#endif
+    _clock.base_cyc = _clock.cal_cyc = c1;
+    _clock.base_ns = _clock.cal_ns = t1;
+}
+
+static inline uint64_t time_clock_read(uint64_t cyc, uint64_t base_cyc,
+                uint64_t base_ns, uint64_t mult)
+{
+    /* another cpu may be a few cycles behind the anchor */
+    uint64_t delta = cyc > base_cyc ? cyc - base_cyc : 0;
+    return base_ns + (uint64_t)(((unsigned __int128)delta * mult) >> 32);
+}
+
+static void time_clock_resync()
+{
+    uint64_t cyc, ns, now, rate, mult;
+    int64_t err;
+    uint32_t seq = __atomic_load_n(&_clock.seq, __ATOMIC_RELAXED);
+
+    if ((seq & 1) || !__atomic_compare_exchange_n(&_clock.seq, &seq, seq + 1,
+                    false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return;                 /* another thread is resyncing */
+    }
+    time_clock_anchor(&cyc, &ns);
+    now = time_clock_read(cyc, _clock.base_cyc, _clock.base_ns, _clock.mult);
+    if (ns - _clock.base_ns >= TIME_RESYNC_NS && cyc > _clock.cal_cyc) {
+        /* rate over the whole run, then slew the error out over a period */
+        rate = (uint64_t)(((unsigned __int128)(ns - _clock.cal_ns) << 32) /
+                          (cyc - _clock.cal_cyc));
+        err = (int64_t)(now - ns);
+        if (err > TIME_SLEW_MAX_NS) {
+            err = TIME_SLEW_MAX_NS;
+        } else if (err < -TIME_SLEW_MAX_NS) {
+            err = -TIME_SLEW_MAX_NS;
+        }
+        mult = (uint64_t)((unsigned __int128)rate * (TIME_RESYNC_NS - err) / TIME_RESYNC_NS);
+        __atomic_store_n(&_clock.base_cyc, cyc, __ATOMIC_RELAXED);
+        __atomic_store_n(&_clock.base_ns, now, __ATOMIC_RELAXED);
+        __atomic_store_n(&_clock.mult, mult, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&_clock.seq, seq + 2, __ATOMIC_RELEASE);
+}
+#endif
+
+int time_clock_init()
+{
+#if defined (TIME_HAVE_COUNTER)
+    pthread_once(&_clock_once, time_clock_setup);
+#endif
+    return 0;
+}
+
+enum time_clock_source time_clock_source()
+{
+    time_clock_init();
+    return _clock.source;
+}
+
+uint64_t time_fast_nsec()
+{
+#if defined (TIME_HAVE_COUNTER)
+    uint64_t ns, base_cyc, base_ns, mult;
+    uint32_t seq;
+
+    time_clock_init();
+    if (UNLIKELY(_clock.source == TIME_CLOCK_VDSO)) {
+        return _time_clock_gettime(CLOCK_MONOTONIC);
+    }
+    do {
+        seq = __atomic_load_n(&_clock.seq, __ATOMIC_ACQUIRE);
+        base_cyc = __atomic_load_n(&_clock.base_cyc, __ATOMIC_RELAXED);
+        base_ns = __atomic_load_n(&_clock.base_ns, __ATOMIC_RELAXED);
+        mult = __atomic_load_n(&_clock.mult, __ATOMIC_RELAXED);
+        ns = time_clock_read(time_cycles(), base_cyc, base_ns, mult);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || seq != __atomic_load_n(&_clock.seq, __ATOMIC_RELAXED));
+    return ns;
+#else
+    return _time_clock_gettime(CLOCK_MONOTONIC);
+#endif
+}
+
+void time_coarse_update()
+{
+    uint64_t mono = time_fast_nsec();
+    __atomic_store_n(&_coarse_msec, time_now_msec(), __ATOMIC_RELAXED);
+    __atomic_store_n(&_coarse_mono_msec, mono / 1000000, __ATOMIC_RELAXED);
+#if defined (TIME_HAVE_COUNTER)
+    if (_clock.source != TIME_CLOCK_VDSO &&
+        mono - __atomic_load_n(&_clock.base_ns, __ATOMIC_RELAXED) >= TIME_RESYNC_NS) {
+        time_clock_resync();
+    }
+#endif
+}
+
+uint64_t time_coarse_msec()
+{
+    uint64_t ms = __atomic_load_n(&_coarse_msec, __ATOMIC_RELAXED);
+    if (UNLIKELY(!ms)) {
+        ms = time_now_msec();   /* nobody updates it yet */
+    }
+    return ms;
+}
+
+uint64_t time_coarse_mono_msec()
+{
+    uint64_t ms = __atomic_load_n(&_coarse_mono_msec, __ATOMIC_RELAXED);
+    if (UNLIKELY(!ms)) {
+        ms = time_fast_nsec() / 1000000;
+    }
+    return ms;
 }
 
 int time_sleep_ms(uint64_t ms)
@@ -53,6 +53,10 @@ uint64_t time_now_sec();
 char *time_now_sec_str();
 char *time_now_format(char *str, int len);
 char *time_str_format_by_utc(uint32_t utc, char *str, int len);
+/*
+ * "YYYY-mm-dd HH:MM:SS.mmm", the date and minute part is cached per thread
+ * and only re-rendered by localtime/strftime when the minute changes
+ */
 char *time_str_format_by_msec(uint64_t msec, char *str, int len);
 char *time_str_format_by_timeval(struct timeval *val, char *str, int len);
 
@@ -75,6 +79,32 @@ uint64_t time_now_nsec();
 uint64_t time_bootup_nsec();
 char *time_nsec_to_str(uint64_t nsec);
 
+/*
+ * fast monotonic clock, a calibrated invariant TSC on x86 or CNTVCT on
+ * aarch64, converted with one multiply. falls back to clock_gettime
+ * (vDSO) when the counter can't be trusted. the first call calibrates,
+ * call time_clock_init early to keep the ~10ms off the hot path
+ */
+enum time_clock_source {
+    TIME_CLOCK_VDSO = 0,
+    TIME_CLOCK_TSC,
+    TIME_CLOCK_CNTVCT,
+};
+
+int time_clock_init();
+enum time_clock_source time_clock_source();
+uint64_t time_fast_nsec();
+
+/*
+ * coarse "now" cached by time_coarse_update, reading it is a load.
+ * call time_coarse_update once per event loop wakeup, for example
+ * gevent_base_set_tick(eb, time_coarse_update), it also resyncs the
+ * fast clock to CLOCK_MONOTONIC once a second
+ */
+void time_coarse_update();
+uint64_t time_coarse_msec();
+uint64_t time_coarse_mono_msec();
+
 int time_now_info(struct time_info *ti);
 int time_info_by_utc(uint32_t utc, struct time_info *ti);
 int time_info_by_msec(uint64_t msec, struct time_info *ti);
@@ -47,10 +47,39 @@ void foo()
     printf("time_str_by_msec:     %s\n", time_str_format_by_msec(ti.utc_msec, ts, sizeof(ts)));
 }
 
+void fast_clock()
+{
+    int i;
+    uint64_t t0, t1, last = 0, now;
+    char s1[32], s2[32];
+    struct time_info ti;
+    printf("time_clock_source:    %d\n", time_clock_source());
+    t0 = time_bootup_nsec();
+    for (i = 0; i < 1000000; i++) {
+        now = time_fast_nsec();
+        if (now < last) {
+            printf("time_fast_nsec went backward %" PRIu64 " < %" PRIu64 "\n", now, last);
+        }
+        last = now;
+    }
+    t1 = time_bootup_nsec();
+    printf("time_fast_nsec:       %" PRIu64 " (%" PRIu64 " ns/call)\n", last, (t1 - t0) / 1000000);
+    printf("fast - monotonic:     %" PRId64 " ns\n", (int64_t)(time_fast_nsec() - time_bootup_nsec()));
+    time_coarse_update();
+    printf("time_coarse_msec:     %" PRIu64 "\n", time_coarse_msec());
+    printf("time_coarse_mono_msec:%" PRIu64 "\n", time_coarse_mono_msec());
+    time_info_by_msec(time_now_msec(), &ti);
+    time_str_format_by_msec(ti.utc_msec, s1, sizeof(s1));
+    snprintf(s2, sizeof(s2), "%04d-%02d-%02d %02d:%02d:%02d.%03d",
+             ti.year, ti.mon, ti.day, ti.hour, ti.min, ti.sec, ti.msec);
+    printf("format cached:        %s %s\n", s1, strcmp(s1, s2) ? "mismatch" : "ok");
+}
+
 int main(int argc, char **argv)
 {
     foo();
     time_sleep_ms(1000);
     foo();
+    fast_clock();
     return 0;
 }
@@ -0,0 +1,317 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#include "libtrace.h"
+#include <libtime.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <unistd.h>
+#if defined (__linux__)
+#include <sys/syscall.h>
+#endif
+
+#define TRACE_NAME_MAX          (32)
+
+struct trace_event {
+    uint64_t ts;
+    const char *cat;
+    const char *name;
+    uint64_t arg;
+    char ph;
+};
+
+/*
+ * one ring per thread, only the owner thread writes events and head.
+ * head counts all events of this generation, slot is head & (cap - 1)
+ */
+struct trace_buf {
+    struct list_head entry;
+    uint64_t tid;
+    char name[TRACE_NAME_MAX];
+    uint64_t head;
+    size_t cap;
+    uint32_t gen;
+    int exited;
+    struct trace_event events[];
+};
+
+int trace_enabled = 0;
+
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static LIST_HEAD(g_bufs);
+static pthread_key_t g_key;
+static pthread_once_t g_once = PTHREAD_ONCE_INIT;
+static size_t g_cap = TRACE_EVENTS_DEFAULT;
+static uint32_t g_gen = 1;
+static uint64_t g_t0;
+static __thread struct trace_buf *t_buf;
+
+static uint64_t trace_tid(void)
+{
+#if defined (__linux__)
+    return (uint64_t)syscall(SYS_gettid);
+#else
+    return (uint64_t)(uintptr_t)pthread_self();
+#endif
+}
+
+/* keep the ring for dump, it is freed by the next start or reset */
+static void trace_thread_exit(void *arg)
+{
+    struct trace_buf *b = (struct trace_buf *)arg;
+    pthread_mutex_lock(&g_lock);
+    b->exited = 1;
+    pthread_mutex_unlock(&g_lock);
+}
+
+static void trace_key_init(void)
+{
+    pthread_key_create(&g_key, trace_thread_exit);
+}
+
+/* called with g_lock held */
+static void trace_free_exited(void)
+{
+    struct trace_buf *b, *tmp;
+    list_for_each_entry_safe(b, tmp, &g_bufs, entry) {
+        if (b->exited) {
+            list_del(&b->entry);
+            free(b);
+        }
+    }
+}
+
+static struct trace_buf *trace_buf_get(void)
+{
+    struct trace_buf *b = t_buf;
+    uint32_t gen = __atomic_load_n(&g_gen, __ATOMIC_ACQUIRE);
+    char name[TRACE_NAME_MAX] = {0};
+
+    if (LIKELY(b != NULL && b->gen == gen)) {
+        return b;
+    }
+    pthread_mutex_lock(&g_lock);
+    if (b && b->cap == g_cap) {
+        __atomic_store_n(&b->head, 0, __ATOMIC_RELEASE);
+        b->gen = gen;
+        pthread_mutex_unlock(&g_lock);
+        return b;
+    }
+    if (b) {
+        memcpy(name, b->name, sizeof(name));
+        list_del(&b->entry);
+        free(b);
+    }
+    b = (struct trace_buf *)calloc(1, sizeof(*b) + g_cap * sizeof(struct trace_event));
+    if (b) {
+        b->tid = trace_tid();
+        b->cap = g_cap;
+        b->gen = gen;
+        memcpy(b->name, name, sizeof(name));
+        list_add_tail(&b->entry, &g_bufs);
+    }
+    pthread_mutex_unlock(&g_lock);
+    pthread_once(&g_once, trace_key_init);
+    pthread_setspecific(g_key, b);
+    t_buf = b;
+    return b;
+}
+
+void trace_emit(char ph, const char *cat, const char *name, uint64_t arg)
+{
+    struct trace_buf *b = trace_buf_get();
+    struct trace_event *e;
+    uint64_t head;
+
+    if (UNLIKELY(b == NULL)) {
+        return;
+    }
+    head = b->head;
+    e = &b->events[head & (b->cap - 1)];
+    e->ts = time_fast_nsec();
+    e->cat = cat;
+    e->name = name;
+    e->arg = arg;
+    e->ph = ph;
+    __atomic_store_n(&b->head, head + 1, __ATOMIC_RELEASE);
+}
+
+void trace_set_thread_name(const char *name)
+{
+    struct trace_buf *b = trace_buf_get();
+    if (!b || !name) {
+        return;
+    }
+    pthread_mutex_lock(&g_lock);
+    snprintf(b->name, sizeof(b->name), "%s", name);
+    pthread_mutex_unlock(&g_lock);
+}
+
+static size_t roundup_pow2(size_t n)
+{
+    size_t r = 1;
+    while (r < n) {
+        r <<= 1;
+    }
+    return r;
+}
+
+int trace_start(size_t events_per_thread)
+{
+    time_clock_init();
+    pthread_mutex_lock(&g_lock);
+    trace_free_exited();
+    g_cap = roundup_pow2(events_per_thread ? events_per_thread : TRACE_EVENTS_DEFAULT);
+    g_t0 = time_fast_nsec();
+    __atomic_add_fetch(&g_gen, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&g_lock);
+    __atomic_store_n(&trace_enabled, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void trace_stop(void)
+{
+    __atomic_store_n(&trace_enabled, 0, __ATOMIC_RELEASE);
+}
+
+void trace_reset(void)
+{
+    pthread_mutex_lock(&g_lock);
+    trace_free_exited();
+    g_t0 = time_fast_nsec();
+    __atomic_add_fetch(&g_gen, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&g_lock);
+}
+
+static void json_str(FILE *fp, const char *s)
+{
+    fputc('"', fp);
+    for (; s && *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') {
+            fputc('\\', fp);
+            fputc(c, fp);
+        } else if (c < 0x20) {
+            fprintf(fp, "\\u%04x", c);
+        } else {
+            fputc(c, fp);
+        }
+    }
+    fputc('"', fp);
+}
+
+static void dump_event(FILE *fp, int pid, uint64_t tid, const struct trace_event *e)
+{
+    uint64_t ns = e->ts > g_t0 ? e->ts - g_t0 : 0;
+
+    fprintf(fp, ",\n{\"ph\":\"%c\",\"cat\":", e->ph);
+    json_str(fp, e->cat);
+    fputs(",\"name\":", fp);
+    json_str(fp, e->name);
+    fprintf(fp, ",\"pid\":%d,\"tid\":%" PRIu64 ",\"ts\":%" PRIu64 ".%03u",
+            pid, tid, ns / 1000, (unsigned)(ns % 1000));
+    switch (e->ph) {
+    case 'C':
+        fprintf(fp, ",\"args\":{\"value\":%" PRIu64 "}", e->arg);
+        break;
+    case 'i':
+        fputs(",\"s\":\"t\"", fp);
+        break;
+    case 'f':
+        fputs(",\"bp\":\"e\"", fp);
+        /* fall through */
+    case 's':
+    case 't':
+        fprintf(fp, ",\"id\":%" PRIu64, e->arg);
+        break;
+    }
+    fputc('}', fp);
+}
+
+/*
+ * events are copied out of a ring and checked against head again, slots
+ * the owner overwrote meanwhile are dropped, so dumping a live trace is
+ * safe but may lose the oldest events
+ */
+static void dump_buf(FILE *fp, int pid, struct trace_buf *b,
+                     struct trace_event *tmp)
+{
+    uint64_t head, first, after, i;
+    size_t n;
+
+    head = __atomic_load_n(&b->head, __ATOMIC_ACQUIRE);
+    first = head > b->cap ? head - b->cap : 0;
+    n = (size_t)(head - first);
+    for (i = 0; i < n; i++) {
+        tmp[i] = b->events[(first + i) & (b->cap - 1)];
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    after = __atomic_load_n(&b->head, __ATOMIC_RELAXED);
+    if (after < head) {
+        return;     /* reset by the owner */
+    }
+    i = after > b->cap + first ? after - b->cap - first : 0;
+    for (; i < n; i++) {
+        dump_event(fp, pid, b->tid, &tmp[i]);
+    }
+}
+
+int trace_dump(const char *path)
+{
+    struct trace_buf *b;
+    struct trace_event *tmp;
+    uint32_t gen;
+    int pid = (int)getpid();
+    FILE *fp = fopen(path, "w");
+
+    if (!fp) {
+        return -1;
+    }
+    pthread_mutex_lock(&g_lock);
+    tmp = (struct trace_event *)malloc(g_cap * sizeof(struct trace_event));
+    if (!tmp) {
+        pthread_mutex_unlock(&g_lock);
+        fclose(fp);
+        return -1;
+    }
+    gen = __atomic_load_n(&g_gen, __ATOMIC_ACQUIRE);
+    fprintf(fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n"
+            "{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":%d,"
+            "\"args\":{\"name\":\"gear-lib\"}}", pid);
+    list_for_each_entry(b, &g_bufs, entry) {
+        if (b->name[0]) {
+            fprintf(fp, ",\n{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%d,"
+                    "\"tid\":%" PRIu64 ",\"args\":{\"name\":", pid, b->tid);
+            json_str(fp, b->name);
+            fputs("}}", fp);
+        }
+        if (b->gen == gen && b->cap <= g_cap) {
+            dump_buf(fp, pid, b, tmp);
+        }
+    }
+    pthread_mutex_unlock(&g_lock);
+    fputs("\n]}\n", fp);
+    free(tmp);
+    return fclose(fp) == 0 ? 0 : -1;
+}
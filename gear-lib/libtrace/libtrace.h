@@ -0,0 +1,115 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#ifndef LIBTRACE_H
+#define LIBTRACE_H
+
+#include <libposix.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define LIBTRACE_VERSION "0.1.0"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * timeline tracing in chrome trace event format.
+ *
+ * each thread writes fixed size events into its own ring, no lock and no
+ * shared cache line on the record path, the oldest events are overwritten
+ * when the ring is full. timestamps are time_fast_nsec. trace_dump merges
+ * all rings into one json file for chrome://tracing or ui.perfetto.dev.
+ *
+ * when tracing is off every trace point is one load and a predicted
+ * branch. cat and name are stored as pointers, pass string literals.
+ */
+
+#define TRACE_EVENTS_DEFAULT    (64 * 1024)     /* per thread */
+
+GEAR_API extern int trace_enabled;
+
+/* events_per_thread is rounded up to a power of two, 0 for default */
+GEAR_API int trace_start(size_t events_per_thread);
+GEAR_API void trace_stop(void);
+/* drop events recorded so far, buffers are kept */
+GEAR_API void trace_reset(void);
+/* write json of all threads, usually after trace_stop */
+GEAR_API int trace_dump(const char *path);
+/* name shown for the calling thread, copied */
+GEAR_API void trace_set_thread_name(const char *name);
+
+/*
+ * ph is the chrome event phase: B/E duration, i instant, C counter,
+ * s/t/f flow start/step/end with arg as flow id
+ */
+GEAR_API void trace_emit(char ph, const char *cat, const char *name, uint64_t arg);
+
+#define TRACE_ON()      UNLIKELY(trace_enabled)
+
+#define TRACE_BEGIN(cat, name) \
+    do { if (TRACE_ON()) trace_emit('B', cat, name, 0); } while (0)
+#define TRACE_END(cat, name) \
+    do { if (TRACE_ON()) trace_emit('E', cat, name, 0); } while (0)
+#define TRACE_INSTANT(cat, name) \
+    do { if (TRACE_ON()) trace_emit('i', cat, name, 0); } while (0)
+#define TRACE_COUNTER(cat, name, value) \
+    do { if (TRACE_ON()) trace_emit('C', cat, name, (uint64_t)(value)); } while (0)
+
+/*
+ * flows link slices across threads, e.g. a frame from capture to encode
+ * to send. id is any value unique within cat, such as frame_id or pts,
+ * each point binds to the enclosing slice on its thread
+ */
+#define TRACE_FLOW_BEGIN(cat, name, id) \
+    do { if (TRACE_ON()) trace_emit('s', cat, name, (uint64_t)(id)); } while (0)
+#define TRACE_FLOW_STEP(cat, name, id) \
+    do { if (TRACE_ON()) trace_emit('t', cat, name, (uint64_t)(id)); } while (0)
+#define TRACE_FLOW_END(cat, name, id) \
+    do { if (TRACE_ON()) trace_emit('f', cat, name, (uint64_t)(id)); } while (0)
+
+#if defined (__GNUC__)
+struct trace_scope {
+    const char *cat;
+    const char *name;   /* NULL when tracing was off at begin */
+};
+
+static inline void trace_scope_end(struct trace_scope *s)
+{
+    if (UNLIKELY(s->name != NULL))
+        trace_emit('E', s->cat, s->name, 0);
+}
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+/* slice from here to the end of the enclosing block */
+#define TRACE_SCOPE(cat, name) \
+    struct trace_scope TRACE_CONCAT(_trace_scope_, __LINE__) \
+        __attribute__((cleanup(trace_scope_end))) = { \
+        cat, TRACE_ON() ? (trace_emit('B', cat, name, 0), name) : NULL }
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,109 @@
+/******************************************************************************
+ * Copyright (C) 2014-2020 Zhifeng Gong <gozfree@163.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "libtrace.h"
+
+#define FRAMES          200
+#define RING_SIZE       16
+
+/* capture thread hands frame ids to an encode thread, linked by flows */
+static uint64_t ring[RING_SIZE];
+static int ring_head, ring_tail;
+static pthread_mutex_t ring_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ring_cond = PTHREAD_COND_INITIALIZER;
+
+static void busy(int us)
+{
+    usleep(us);
+}
+
+static void *capture(void *arg)
+{
+    uint64_t id;
+    trace_set_thread_name("capture");
+    for (id = 1; id <= FRAMES; id++) {
+        TRACE_SCOPE("avcap", "capture");
+        busy(200);
+        TRACE_FLOW_BEGIN("frame", "frame", id);
+        pthread_mutex_lock(&ring_lock);
+        while (ring_head - ring_tail == RING_SIZE) {
+            pthread_cond_wait(&ring_cond, &ring_lock);
+        }
+        ring[ring_head++ % RING_SIZE] = id;
+        TRACE_COUNTER("queue", "depth", ring_head - ring_tail);
+        pthread_cond_broadcast(&ring_cond);
+        pthread_mutex_unlock(&ring_lock);
+    }
+    return NULL;
+}
+
+static void *encode(void *arg)
+{
+    int n;
+    uint64_t id;
+    trace_set_thread_name("encode");
+    for (n = 0; n < FRAMES; n++) {
+        pthread_mutex_lock(&ring_lock);
+        while (ring_head == ring_tail) {
+            pthread_cond_wait(&ring_cond, &ring_lock);
+        }
+        id = ring[ring_tail++ % RING_SIZE];
+        pthread_cond_broadcast(&ring_cond);
+        pthread_mutex_unlock(&ring_lock);
+
+        TRACE_SCOPE("encode", "encode");
+        TRACE_FLOW_END("frame", "frame", id);
+        busy(300);
+        if (id % 50 == 0) {
+            TRACE_INSTANT("encode", "keyframe");
+        }
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    pthread_t t1, t2;
+    const char *path = argc > 1 ? argv[1] : "trace.json";
+
+    trace_start(0);
+    trace_set_thread_name("main");
+    TRACE_BEGIN("demo", "run");
+    pthread_create(&t1, NULL, capture, NULL);
+    pthread_create(&t2, NULL, encode, NULL);
+    pthread_join(t1, NULL);
+    pthread_join(t2, NULL);
+    TRACE_END("demo", "run");
+    trace_stop();
+
+    if (trace_dump(path) != 0) {
+        printf("trace_dump %s failed!\n", path);
+        return -1;
+    }
+    printf("trace written to %s, open in chrome://tracing or ui.perfetto.dev\n", path);
+    return 0;
+}
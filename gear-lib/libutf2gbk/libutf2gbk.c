@@ -1,4 +1,11 @@
 #include "libutf2gbk.h"
+#include <stdint.h>
+#include <pthread.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 
 typedef struct
@@ -4486,20 +4493,49 @@ void UnicodeToGB2312(char*pOut, char *pInput)
 	memcpy(pOut, &gb2312_tmp, 2);
 }
 
-static unsigned short SearchCodeTable(unsigned short unicode) // 二分法查表
+/*
+ * two level tables built once from unicode_gb_table: high byte selects a
+ * 256 entry page, pages without any mapping share the zero page. CJK text
+ * touches about 80 pages of 512 bytes instead of a binary search over
+ * the 87KB flat table
+ */
+#define PAGE_POOL	128
+
+static uint16_t zero_page[256];
+static uint16_t u2g_pool[PAGE_POOL][256];
+static const uint16_t *u2g_page[256];
+static uint16_t g2u_table[128][256];	/* [lead - 0x80][trail] */
+static pthread_once_t table_once = PTHREAD_ONCE_INIT;
+
+static void table_build(void)
 {
-	int mid, start = 0, end = TABLE_LEN - 1;
-	while (start <= end)
-	{
-		mid = (start + end) / 2;
-		if (unicode_gb_table[mid].unicode == unicode)
-			return unicode_gb_table[mid].gb2312;
-		else if (unicode_gb_table[mid].unicode < unicode)
-			start = mid + 1;
-		else
-			end = mid - 1;
+	int i, hi, used = 0;
+	unsigned short u, g;
+
+	for (i = 0; i < 256; i++)
+		u2g_page[i] = zero_page;
+	for (i = 0; i < TABLE_LEN; i++) {
+		u = unicode_gb_table[i].unicode;
+		g = unicode_gb_table[i].gb2312;
+		hi = u >> 8;
+		if (u2g_page[hi] == zero_page && used < PAGE_POOL)
+			u2g_page[hi] = u2g_pool[used++];
+		if (u2g_page[hi] != zero_page)
+			((uint16_t *)u2g_page[hi])[u & 0xff] = g;
+		if (g >= 0x8100)
+			g2u_table[(g >> 8) - 0x80][g & 0xff] = u;
 	}
-	return 0;
+}
+
+static inline unsigned short u2g_lookup(unsigned short unicode)
+{
+	return u2g_page[unicode >> 8][unicode & 0xff];
+}
+
+static unsigned short SearchCodeTable(unsigned short unicode)
+{
+	pthread_once(&table_once, table_build);
+	return u2g_lookup(unicode);
 }
 
 static int enc_get_utf8_size(const unsigned char pInput)
@@ -4511,4 +4547,237 @@ static int enc_get_utf8_size(const unsigned char pInput)
 		temp = (temp >> 1);
 	}
 	return num;
-}
\ No newline at end of file
+}
+
+/* copy the leading ascii run of in, 32 or 16 bytes per step */
+static size_t ascii_copy(unsigned char *out, const unsigned char *in, size_t n)
+{
+	size_t i = 0;
+	uint64_t w;
+#if defined(__AVX2__)
+	for (; i + 32 <= n; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(in + i));
+		if (_mm256_movemask_epi8(v))
+			break;
+		_mm256_storeu_si256((__m256i *)(out + i), v);
+	}
+#endif
+#if defined(__SSE2__)
+	for (; i + 16 <= n; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+		if (_mm_movemask_epi8(v))
+			break;
+		_mm_storeu_si128((__m128i *)(out + i), v);
+	}
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+	for (; i + 16 <= n; i += 16) {
+		uint8x16_t v = vld1q_u8(in + i);
+		if (vmaxvq_u8(v) & 0x80)
+			break;
+		vst1q_u8(out + i, v);
+	}
+#endif
+	for (; i + 8 <= n; i += 8) {
+		memcpy(&w, in + i, 8);
+		if (w & 0x8080808080808080ULL)
+			break;
+		memcpy(out + i, &w, 8);
+	}
+	for (; i < n && in[i] < 0x80; i++)
+		out[i] = in[i];
+	return i;
+}
+
+/* length of utf-8 sequence from its lead byte, 0 if it can not lead */
+static inline int utf8_seq_len(unsigned char c)
+{
+	if (c >= 0xC2 && c <= 0xDF)
+		return 2;
+	if (c >= 0xE0 && c <= 0xEF)
+		return 3;
+	if (c >= 0xF0 && c <= 0xF4)
+		return 4;
+	return 0;
+}
+
+/* code point of a complete sequence, -1 if malformed */
+static int utf8_decode(const unsigned char *p, int len)
+{
+	int cp, i;
+	for (i = 1; i < len; i++) {
+		if ((p[i] & 0xC0) != 0x80)
+			return -1;
+	}
+	switch (len) {
+	case 2:
+		return ((p[0] & 0x1F) << 6) | (p[1] & 0x3F);
+	case 3:
+		cp = ((p[0] & 0x0F) << 12) | ((p[1] & 0x3F) << 6) | (p[2] & 0x3F);
+		return (cp < 0x800 || (cp >= 0xD800 && cp <= 0xDFFF)) ? -1 : cp;
+	case 4:
+		cp = ((p[0] & 0x07) << 18) | ((p[1] & 0x3F) << 12) |
+		     ((p[2] & 0x3F) << 6) | (p[3] & 0x3F);
+		return (cp < 0x10000 || cp > 0x10FFFF) ? -1 : cp;
+	}
+	return -1;
+}
+
+/*
+ * convert in, stop before an incomplete sequence at the end unless last,
+ * *used is the input consumed, return output length or -1 if out is full
+ */
+static int utf8_gbk_conv(unsigned char *out, size_t outlen, const unsigned char *in,
+		size_t inlen, size_t *used, int last)
+{
+	size_t i = 0, o = 0, n;
+	unsigned short g = 0;
+	int len, cp;
+
+	while (i < inlen) {
+		n = ascii_copy(out + o, in + i, (inlen - i < outlen - o) ? inlen - i : outlen - o);
+		i += n;
+		o += n;
+		if (i == inlen)
+			break;
+		if (o == outlen)
+			return -1;
+		len = utf8_seq_len(in[i]);
+		if (len && i + len > inlen && !last)
+			break;
+		cp = (len && i + len <= inlen) ? utf8_decode(in + i, len) : -1;
+		if (cp < 0) {
+			out[o++] = '?';
+			i = len ? ((i + len > inlen) ? inlen : i + 1) : i + 1;
+			continue;
+		}
+		g = cp <= 0xFFFF ? u2g_lookup(cp) : 0;
+		if (!g) {
+			out[o++] = '?';
+		} else if (o + 2 > outlen) {
+			return -1;
+		} else {
+			out[o++] = g >> 8;
+			out[o++] = g & 0xff;
+		}
+		i += len;
+	}
+	*used = i;
+	return o;
+}
+
+static int gbk_utf8_conv(unsigned char *out, size_t outlen, const unsigned char *in,
+		size_t inlen, size_t *used, int last)
+{
+	size_t i = 0, o = 0, n;
+	unsigned short u;
+	unsigned char c;
+
+	while (i < inlen) {
+		n = ascii_copy(out + o, in + i, (inlen - i < outlen - o) ? inlen - i : outlen - o);
+		i += n;
+		o += n;
+		if (i == inlen)
+			break;
+		if (o == outlen)
+			return -1;
+		c = in[i];
+		if (i + 1 == inlen && !last && c != 0x80 && c != 0xFF)
+			break;
+		u = (c == 0x80 || c == 0xFF || i + 1 == inlen) ? 0 : g2u_table[c - 0x80][in[i + 1]];
+		if (!u) {
+			out[o++] = '?';
+			i += (i + 1 < inlen && in[i + 1] >= 0x40 && c != 0x80 && c != 0xFF) ? 2 : 1;
+			continue;
+		}
+		if (o + (u < 0x800 ? 2 : 3) > outlen)
+			return -1;
+		if (u < 0x800) {
+			out[o++] = 0xC0 | (u >> 6);
+			out[o++] = 0x80 | (u & 0x3F);
+		} else {
+			out[o++] = 0xE0 | (u >> 12);
+			out[o++] = 0x80 | ((u >> 6) & 0x3F);
+			out[o++] = 0x80 | (u & 0x3F);
+		}
+		i += 2;
+	}
+	*used = i;
+	return o;
+}
+
+int utf8_to_gbk(char *out, size_t outlen, const char *in, size_t inlen)
+{
+	size_t used;
+	pthread_once(&table_once, table_build);
+	return utf8_gbk_conv((unsigned char *)out, outlen, (const unsigned char *)in,
+			inlen, &used, 1);
+}
+
+int gbk_to_utf8(char *out, size_t outlen, const char *in, size_t inlen)
+{
+	size_t used;
+	pthread_once(&table_once, table_build);
+	return gbk_utf8_conv((unsigned char *)out, outlen, (const unsigned char *)in,
+			inlen, &used, 1);
+}
+
+void utf2gbk_stream_init(struct utf2gbk_stream *s)
+{
+	memset(s, 0, sizeof(*s));
+	pthread_once(&table_once, table_build);
+}
+
+typedef int (*conv_fn)(unsigned char *out, size_t outlen, const unsigned char *in,
+		size_t inlen, size_t *used, int last);
+
+/* finish the sequence split at the last boundary, then convert in place */
+static int stream_conv(conv_fn fn, struct utf2gbk_stream *s, char *out, size_t outlen,
+		const char *in, size_t inlen, int last)
+{
+	unsigned char *o = (unsigned char *)out;
+	const unsigned char *p = (const unsigned char *)in;
+	unsigned char tmp[sizeof(s->pend) * 2];
+	size_t used = 0, take, n;
+	int r, head = 0;
+
+	if (s->npend) {
+		take = sizeof(s->pend) - s->npend;
+		take = take < inlen ? take : inlen;
+		memcpy(tmp, s->pend, s->npend);
+		if (take)
+			memcpy(tmp + s->npend, p, take);
+		n = s->npend + take;
+		r = fn(o, outlen, tmp, n, &used, last && take == inlen);
+		if (r < 0)
+			return -1;
+		if (used < (size_t)s->npend) {
+			/* still incomplete, input was shorter than the sequence */
+			s->npend = n - used;
+			memmove(s->pend, tmp + used, s->npend);
+			return r;
+		}
+		head = r;
+		p += used - s->npend;
+		inlen -= used - s->npend;
+		s->npend = 0;
+	}
+	r = fn(o + head, outlen - head, p, inlen, &used, last);
+	if (r < 0)
+		return -1;
+	s->npend = inlen - used;
+	if (s->npend)
+		memcpy(s->pend, p + used, s->npend);
+	return head + r;
+}
+
+int utf8_to_gbk_stream(struct utf2gbk_stream *s, char *out, size_t outlen,
+		const char *in, size_t inlen, int last)
+{
+	return stream_conv(utf8_gbk_conv, s, out, outlen, in, inlen, last);
+}
+
+int gbk_to_utf8_stream(struct utf2gbk_stream *s, char *out, size_t outlen,
+		const char *in, size_t inlen, int last)
+{
+	return stream_conv(gbk_utf8_conv, s, out, outlen, in, inlen, last);
+}
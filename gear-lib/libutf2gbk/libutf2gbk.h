@@ -12,6 +12,31 @@ int  UTF_8ToGB2312(char*pOut, char *pInput, int pLen);
 int UTF_8ToUnicode(char* pOutput, char *pInput);
 void UnicodeToGB2312(char*pOut, char *pInput);
 
+/*
+ * ascii runs are copied 16 or 32 bytes at a time, other characters go
+ * through two level tables. unmappable or malformed input becomes '?'.
+ * return output length, -1 if out is too small: inlen bytes always fit
+ * for utf8_to_gbk, gbk_to_utf8 needs up to inlen * 3 / 2
+ */
+int utf8_to_gbk(char *out, size_t outlen, const char *in, size_t inlen);
+int gbk_to_utf8(char *out, size_t outlen, const char *in, size_t inlen);
+
+/*
+ * streaming, a sequence split at the end of in is kept in the stream and
+ * completed by the next call, last flushes it as '?'. out needs room for
+ * 4 more bytes than the one shot call
+ */
+struct utf2gbk_stream {
+	unsigned char pend[4];
+	int npend;
+};
+
+void utf2gbk_stream_init(struct utf2gbk_stream *s);
+int utf8_to_gbk_stream(struct utf2gbk_stream *s, char *out, size_t outlen,
+		const char *in, size_t inlen, int last);
+int gbk_to_utf8_stream(struct utf2gbk_stream *s, char *out, size_t outlen,
+		const char *in, size_t inlen, int last);
+
 #ifdef __cplusplus
 }
 #endif
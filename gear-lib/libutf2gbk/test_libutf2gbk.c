@@ -10,5 +10,16 @@ int main()
 	UTF_8ToGB2312(buf2,buf,strlen(buf));
 	printf("buf : %s \nbuf 2 : %s \n",buf,buf2);
 	printf("utf8-len : %lu,gb2312-len : %lu\n",strlen(buf),strlen(buf2));
+
+	/* split in the middle of a character, the stream keeps the partial one */
+	struct utf2gbk_stream s;
+	char gbk[sizeof(buf) + 8], utf8[sizeof(buf) * 2];
+	int n, m, half = strlen("nininihhahahhh") + 1;
+	utf2gbk_stream_init(&s);
+	n = utf8_to_gbk_stream(&s, gbk, sizeof(gbk), buf, half, 0);
+	n += utf8_to_gbk_stream(&s, gbk + n, sizeof(gbk) - n, buf + half, strlen(buf) - half, 1);
+	m = gbk_to_utf8(utf8, sizeof(utf8), gbk, n);
+	printf("stream gbk-len : %d, round trip %s\n", n,
+	       (m == (int)strlen(buf) && !memcmp(utf8, buf, m)) ? "ok" : "failed");
 	return 0;
 }
\ No newline at end of file
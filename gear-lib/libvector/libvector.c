@@ -27,33 +27,142 @@
 
 #define VECTOR_DEFAULT_BUF_LEN  (1024)
 
-void _vector_push_back(struct vector *v, void *e, size_t type_size)
+/* grow storage geometrically to hold at least n elements */
+static int vector_grow(struct vector *v, size_t n)
 {
     size_t resize;
     void *pnew;
+    if (n <= v->capacity / v->type_size) {
+        return 0;
+    }
+    if (n > v->max_size) {
+        printf("vector size %zu exceed max_size!\n", n);
+        return -1;
+    }
+    resize = v->capacity ? v->capacity : VECTOR_DEFAULT_BUF_LEN;
+    while (resize / v->type_size < n) {
+        resize *= 2;
+    }
+    pnew = realloc(v->buf.iov_base, resize);
+    if (!pnew) {
+        printf("realloc failed!\n");
+        return -1;
+    }
+    v->buf.iov_base = pnew;
+    v->buf.iov_len = resize;
+    v->capacity = resize;
+    return 0;
+}
+
+void _vector_push_back(struct vector *v, void *e, size_t type_size)
+{
     void *ptop;
     if (!v || !e || type_size != v->type_size) {
         printf("%s: paraments invalid!\n", __func__);
         return;
     }
-check:
-    if ((v->size + 1) * v->type_size >= v->capacity) {
-        resize = v->capacity + VECTOR_DEFAULT_BUF_LEN;
-        pnew = realloc(v->buf.iov_base, resize);
-        if (!pnew) {
-            printf("realloc failed!\n");
-            return;
-        }
-        v->buf.iov_base = pnew;
-        v->buf.iov_len = resize;
-        v->capacity = resize;
-        goto check;
+    if (0 != vector_grow(v, v->size + 1)) {
+        return;
     }
     ptop = (uint8_t *)v->buf.iov_base + v->size * v->type_size;
     memcpy(ptop, e, v->type_size);
     v->size++;
 }
 
+int _vector_push_back_n(struct vector *v, const void *e, size_t n, size_t type_size)
+{
+    if (!v || !e || type_size != v->type_size) {
+        printf("%s: paraments invalid!\n", __func__);
+        return -1;
+    }
+    if (0 != vector_grow(v, v->size + n)) {
+        return -1;
+    }
+    memcpy((uint8_t *)v->buf.iov_base + v->size * v->type_size, e,
+           n * v->type_size);
+    v->size += n;
+    return 0;
+}
+
+void *vector_emplace_back(struct vector *v)
+{
+    void *ptop;
+    if (!v) {
+        printf("%s: paraments invalid!\n", __func__);
+        return NULL;
+    }
+    if (0 != vector_grow(v, v->size + 1)) {
+        return NULL;
+    }
+    ptop = (uint8_t *)v->buf.iov_base + v->size * v->type_size;
+    v->size++;
+    return ptop;
+}
+
+int _vector_insert_n(struct vector *v, size_t pos, const void *e, size_t n,
+                size_t type_size)
+{
+    uint8_t *p;
+    if (!v || !e || type_size != v->type_size || pos > v->size) {
+        printf("%s: paraments invalid!\n", __func__);
+        return -1;
+    }
+    if (0 != vector_grow(v, v->size + n)) {
+        return -1;
+    }
+    p = (uint8_t *)v->buf.iov_base + pos * v->type_size;
+    memmove(p + n * v->type_size, p, (v->size - pos) * v->type_size);
+    memcpy(p, e, n * v->type_size);
+    v->size += n;
+    return 0;
+}
+
+int vector_erase_n(struct vector *v, size_t pos, size_t n)
+{
+    uint8_t *p;
+    if (!v || pos > v->size || n > v->size - pos) {
+        printf("%s: paraments invalid!\n", __func__);
+        return -1;
+    }
+    p = (uint8_t *)v->buf.iov_base + pos * v->type_size;
+    memmove(p, p + n * v->type_size, (v->size - pos - n) * v->type_size);
+    v->size -= n;
+    return 0;
+}
+
+int vector_reserve(struct vector *v, size_t n)
+{
+    if (!v) {
+        printf("%s: paraments invalid!\n", __func__);
+        return -1;
+    }
+    return vector_grow(v, n);
+}
+
+int vector_resize(struct vector *v, size_t n)
+{
+    if (!v) {
+        printf("%s: paraments invalid!\n", __func__);
+        return -1;
+    }
+    if (0 != vector_grow(v, n)) {
+        return -1;
+    }
+    if (n > v->size) {
+        memset((uint8_t *)v->buf.iov_base + v->size * v->type_size, 0,
+               (n - v->size) * v->type_size);
+    }
+    v->size = n;
+    return 0;
+}
+
+void vector_clear(struct vector *v)
+{
+    if (v) {
+        v->size = 0;
+    }
+}
+
 void vector_pop_back(struct vector *v)
 {
     if (!v) {
@@ -58,6 +58,13 @@ typedef struct vector {
  * vector_at
  * vector_next
  * vector_prev
+ * vector_reserve
+ * vector_resize
+ * vector_clear
+ * vector_emplace_back
+ * vector_push_back_array
+ * vector_insert_array
+ * vector_erase_n
 */
 
 /*
@@ -72,6 +79,9 @@ vector_iter vector_next(struct vector *v, vector_iter iter);
 vector_iter vector_prev(struct vector *v, vector_iter iter);
 void *_vector_iter_value(struct vector *v, vector_iter iter);
 void *_vector_at(struct vector *v, int pos);
+int _vector_push_back_n(struct vector *v, const void *e, size_t n, size_t type_size);
+int _vector_insert_n(struct vector *v, size_t pos, const void *e, size_t n,
+                size_t type_size);
 
 
 #if defined (__linux__) || defined (__CYGWIN__)
@@ -84,22 +94,42 @@ void vector_destroy(struct vector *v);
 int vector_empty(struct vector *v);
 #define vector_push_back(v, e) _vector_push_back(v, (void *)&e, sizeof(e))
 void vector_pop_back(struct vector *v);
-#if defined (__linux__) || defined (__CYGWIN__)
-#define vector_back(v, type_t) \
-    ({ \
-        type_t __tmp; \
-        memcpy(&__tmp, vector_last(v), v->type_size); \
-        &__tmp; \
-    })
-#else
-#define vector_back(v, type_t) (type_t *)vector_last(v)
-#endif
+/* pointer to last element in place, valid until next growth */
+#define vector_back(v, type_t) ((type_t *)vector_last(v))
+
+/* bulk insert n elements of array with one grow and one memcpy */
+#define vector_push_back_array(v, array, n) \
+    _vector_push_back_n(v, array, n, sizeof(*(array)))
+#define vector_insert_array(v, pos, array, n) \
+    _vector_insert_n(v, pos, array, n, sizeof(*(array)))
+
+/* append uninitialized slot and return it, fill in place without copy */
+void *vector_emplace_back(struct vector *v);
+int vector_erase_n(struct vector *v, size_t pos, size_t n);
+int vector_reserve(struct vector *v, size_t n);
+int vector_resize(struct vector *v, size_t n);
+void vector_clear(struct vector *v);
+
+#define vector_size(v) ((v)->size)
+#define vector_data(v, type_t) ((type_t *)(v)->buf.iov_base)
+
+/*
+ * typed access inline, no call and no check, caller keeps pos < size
+ *
+ *   int *p;
+ *   vector_foreach(v, int, p) {
+ *       sum += *p;
+ *   }
+ */
+#define VECTOR_AT(v, type_t, pos) (vector_data(v, type_t)[pos])
+#define vector_foreach(v, type_t, p) \
+    for (p = vector_data(v, type_t); p < vector_data(v, type_t) + (v)->size; p++)
 
 #define vector_iter_valuep(vector, iter, type_t) \
-    (type_t *)_vector_iter_value(vector, iter)
+    ((type_t *)_vector_iter_value(vector, iter))
 
 #define vector_at(v, pos, type_t) \
-    (type_t *)_vector_at(v, pos)
+    ((type_t *)_vector_at(v, pos))
 
 
 #ifdef __cplusplus
@@ -105,9 +105,41 @@ void default_struct()
     vector_destroy(a);
 }
 
+void bulk_struct()
+{
+    int i, sum = 0;
+    int arr[100];
+    int *p;
+    struct tmp_box *tb;
+    vector_t *a = _vector_create(sizeof(int));
+    vector_t *b = _vector_create(sizeof(struct tmp_box));
+
+    for (i = 0; i < 100; i++) {
+        arr[i] = i;
+    }
+    vector_push_back_array(a, arr, 100);
+    vector_insert_array(a, 0, arr, 10);
+    vector_erase_n(a, 0, 10);
+    vector_foreach(a, int, p) {
+        sum += *p;
+    }
+    printf("bulk size=%zu sum=%d at[50]=%d capacity=%zu\n", vector_size(a), sum,
+           VECTOR_AT(a, int, 50), a->capacity);
+
+    tb = (struct tmp_box *)vector_emplace_back(b);
+    tb->c = 'b';
+    tb->i = 2;
+    tb->f = 2.5;
+    printf("emplace back c=%c i=%d\n", vector_back(b, struct tmp_box)->c,
+           vector_back(b, struct tmp_box)->i);
+    vector_destroy(a);
+    vector_destroy(b);
+}
+
 int main(int argc, char **argv)
 {
     mix_struct();
     default_struct();
+    bulk_struct();
     return 0;
 }
@@ -22,111 +22,630 @@
 #include "libworkq.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <stdint.h>
+#include <sched.h>
+#include <time.h>
+#include <errno.h>
 #if defined (OS_LINUX)
 #include <sys/sysinfo.h>
 #endif
 
+#define WORKQ_LOCAL_CACHE   (64)
+#define WORKQ_POOL_CACHE    (4096)
+#define WORKQ_IDLE_MS       (5000)
+#define WORKQ_DEQUE_SIZE    (256)   /* power of 2, full deque spills to list */
+#define WORKQ_DEQUE_MASK    (WORKQ_DEQUE_SIZE - 1)
+
 struct task {
     struct list_head entry;
     task_func_t func;
     void *data;
-    struct workq *wq;
 };
 
 
 static bool is_workq_underload(struct workq_pool *pool, struct workq *wq)
 {
-    return (wq->load == 0 || wq->load < pool->threshold);
+    int load = __atomic_load_n(&wq->load, __ATOMIC_RELAXED);
+    return (load == 0 || load < pool->threshold);
 }
 
 bool is_workq_overload(struct workq_pool *pool, struct workq *wq)
 {
-    return (wq->load == 1 || wq->load > pool->threshold);
+    int load = __atomic_load_n(&wq->load, __ATOMIC_RELAXED);
+    return (load == 1 || load > pool->threshold);
+}
+
+static struct workq *workq_self(struct workq_pool *pool)
+{
+    return (struct workq *)pthread_getspecific(pool->key);
+}
+
+/*
+ * pending is increased before idle flags are scanned, and a worker sets
+ * idle before checking pending, so one side always sees the other
+ */
+static bool wake_idle_workq(struct workq_pool *pool, struct workq *except)
+{
+    int i;
+    struct workq *wq;
+    for (i = 0; i < pool->wq_array.num; i++) {
+        wq = pool->wq_array.array[i];
+        if (wq == except || !__atomic_load_n(&wq->idle, __ATOMIC_SEQ_CST)) {
+            continue;
+        }
+        mutex_lock(&wq->lock);
+        mutex_cond_signal(&wq->cond);
+        mutex_unlock(&wq->lock);
+        return true;
+    }
+    return false;
+}
+
+static bool workq_active(struct workq *wq)
+{
+    return __atomic_load_n(&wq->active, __ATOMIC_ACQUIRE);
+}
+
+static void *_task_thread(struct thread *thread, void *arg);
+
+/* start worker thread of a stopped workq, old thread has exited already */
+static int workq_start(struct workq *wq)
+{
+    int ret = 0;
+    struct workq_pool *pool = wq->pool;
+    mutex_lock(&pool->size_lock);
+    if (!workq_active(wq)) {
+        if (wq->thread) {
+            thread_join(wq->thread);
+            thread_destroy(wq->thread);
+            wq->thread = NULL;
+        }
+        __atomic_store_n(&wq->active, 1, __ATOMIC_RELEASE);
+        wq->thread = thread_create(_task_thread, wq);
+        if (wq->thread) {
+            __atomic_add_fetch(&pool->active, 1, __ATOMIC_RELAXED);
+        } else {
+            printf("thread create failed!\n");
+            __atomic_store_n(&wq->active, 0, __ATOMIC_RELEASE);
+            ret = -1;
+        }
+    }
+    mutex_unlock(&pool->size_lock);
+    return ret;
 }
 
-static struct task *task_create(struct workq *wq, task_func_t func, void *data)
+/* all workers are busy, bring up one more stopped workq to steal */
+static void workq_pool_grow(struct workq_pool *pool)
 {
-    struct task *t = calloc(1, sizeof(struct task));
+    int i;
+    struct workq *wq;
+    if (__atomic_load_n(&pool->active, __ATOMIC_RELAXED) >= pool->max) {
+        return;
+    }
+    for (i = 0; i < pool->wq_array.num; i++) {
+        wq = pool->wq_array.array[i];
+        if (!workq_active(wq)) {
+            workq_start(wq);
+            return;
+        }
+    }
+}
+
+static struct task *task_alloc(struct workq_pool *pool, struct workq *self)
+{
+    struct task *t = NULL;
+    if (self && !list_empty(&self->cache)) {
+        t = list_first_entry(&self->cache, struct task, entry);
+        list_del_init(&t->entry);
+        self->cache_nr--;
+        return t;
+    }
+    mutex_lock(&pool->cache_lock);
+    t = list_first_entry_or_null(&pool->cache, struct task, entry);
+    if (t) {
+        list_del_init(&t->entry);
+        pool->cache_nr--;
+    }
+    mutex_unlock(&pool->cache_lock);
     if (!t) {
+        t = gear_calloc(sizeof(struct task));
+        if (t) {
+            INIT_LIST_HEAD(&t->entry);
+        }
+    }
+    return t;
+}
+
+/*
+ * called only by worker thread of wq, keep it in local cache without
+ * lock, give half back to pool cache when local one is full
+ */
+static void task_free(struct workq *wq, struct task *t)
+{
+    int i;
+    struct workq_pool *pool = wq->pool;
+    list_add(&t->entry, &wq->cache);
+    if (++wq->cache_nr < WORKQ_LOCAL_CACHE) {
+        return;
+    }
+    mutex_lock(&pool->cache_lock);
+    for (i = 0; i < WORKQ_LOCAL_CACHE / 2; i++) {
+        t = list_last_entry(&wq->cache, struct task, entry);
+        list_del_init(&t->entry);
+        if (pool->cache_nr < WORKQ_POOL_CACHE) {
+            list_add(&t->entry, &pool->cache);
+            pool->cache_nr++;
+        } else {
+            gear_free(t, sizeof(*t));
+        }
+    }
+    mutex_unlock(&pool->cache_lock);
+    wq->cache_nr -= WORKQ_LOCAL_CACHE / 2;
+}
+
+static void task_list_free(struct list_head *head)
+{
+    struct task *t, *next;
+    list_for_each_entry_safe(t, next, head, entry) {
+        list_del_init(&t->entry);
+        gear_free(t, sizeof(*t));
+    }
+}
+
+/*
+ * Chase-Lev deque with fixed ring: owner pushes and pops at bottom
+ * without lock, stealers take one task from top with cas. owner and
+ * stealer race only for the last task, both sides cas top for it.
+ * a slot is reused only after top passed it, so a stealer never reads
+ * an overwritten slot before its cas succeeds
+ */
+static bool deque_push(struct workq *wq, struct task *t)
+{
+    int64_t b = __atomic_load_n(&wq->bottom, __ATOMIC_RELAXED);
+    int64_t top = __atomic_load_n(&wq->top, __ATOMIC_ACQUIRE);
+    if (b - top >= WORKQ_DEQUE_SIZE) {
+        return false;
+    }
+    __atomic_store_n(&wq->deque[b & WORKQ_DEQUE_MASK], t, __ATOMIC_RELAXED);
+    __atomic_store_n(&wq->bottom, b + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+static struct task *deque_pop(struct workq *wq)
+{
+    struct task *t = NULL;
+    int64_t b = __atomic_load_n(&wq->bottom, __ATOMIC_RELAXED) - 1;
+    int64_t top;
+    __atomic_store_n(&wq->bottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    top = __atomic_load_n(&wq->top, __ATOMIC_RELAXED);
+    if (top <= b) {
+        t = __atomic_load_n(&wq->deque[b & WORKQ_DEQUE_MASK], __ATOMIC_RELAXED);
+        if (top == b) {
+            if (!__atomic_compare_exchange_n(&wq->top, &top, top + 1, false,
+                            __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+                t = NULL;
+            }
+            __atomic_store_n(&wq->bottom, b + 1, __ATOMIC_RELAXED);
+        }
+    } else {
+        __atomic_store_n(&wq->bottom, b + 1, __ATOMIC_RELAXED);
+    }
+    return t;
+}
+
+static struct task *deque_steal(struct workq *wq)
+{
+    struct task *t;
+    int64_t top = __atomic_load_n(&wq->top, __ATOMIC_ACQUIRE);
+    int64_t b;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    b = __atomic_load_n(&wq->bottom, __ATOMIC_ACQUIRE);
+    if (top >= b) {
         return NULL;
     }
-    t->wq = wq;
+    t = __atomic_load_n(&wq->deque[top & WORKQ_DEQUE_MASK], __ATOMIC_RELAXED);
+    if (!__atomic_compare_exchange_n(&wq->top, &top, top + 1, false,
+                    __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        /* lost to owner or another stealer */
+        return NULL;
+    }
+    return t;
+}
+
+/* owner queues one task to its deque, false if deque is full */
+static bool workq_push_local(struct workq *wq, struct task *t)
+{
+    struct workq_pool *pool = wq->pool;
+    /* counted before published, a stealer may take it right away */
+    __atomic_add_fetch(&wq->nr, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&pool->pending, 1, __ATOMIC_SEQ_CST);
+    if (!deque_push(wq, t)) {
+        __atomic_sub_fetch(&wq->nr, 1, __ATOMIC_RELAXED);
+        __atomic_sub_fetch(&pool->pending, 1, __ATOMIC_SEQ_CST);
+        return false;
+    }
+    return true;
+}
+
+/* owner is running, hand the work to an idle workq or a new one */
+static void workq_wake_stealer(struct workq *wq)
+{
+    if (!wake_idle_workq(wq->pool, wq)) {
+        workq_pool_grow(wq->pool);
+    }
+}
+
+/* move n prepared tasks to wq with one lock and one wakeup */
+static void workq_enqueue(struct workq *wq, struct list_head *tasks, int n,
+                enum workq_prio prio)
+{
+    bool active;
+    struct workq_pool *pool = wq->pool;
+    mutex_lock(&wq->lock);
+    if (prio == WORKQ_PRIO_HIGH) {
+        list_splice_tail_init(tasks, &wq->hi_list);
+        __atomic_add_fetch(&wq->hi_nr, n, __ATOMIC_RELAXED);
+    } else {
+        list_splice_tail_init(tasks, &wq->wq_list);
+    }
+    __atomic_add_fetch(&wq->nr, n, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&pool->pending, n, __ATOMIC_SEQ_CST);
+    mutex_cond_signal(&wq->cond);
+    /* worker marks itself stopped under this lock with empty lists */
+    active = workq_active(wq);
+    mutex_unlock(&wq->lock);
+    if (!active) {
+        workq_start(wq);
+        return;
+    }
+    if (n > 1 || !__atomic_load_n(&wq->idle, __ATOMIC_SEQ_CST)) {
+        /* target is busy, let an idle workq steal it */
+        if (!wake_idle_workq(pool, wq)) {
+            workq_pool_grow(pool);
+        }
+    }
+}
+
+static int task_create(struct workq *wq, struct workq *self,
+                enum workq_prio prio, task_func_t func, void *data)
+{
+    struct list_head tasks;
+    struct task *t = task_alloc(wq->pool, self);
+    if (!t) {
+        return -1;
+    }
     t->func = func;
     t->data = data;
-    thread_lock(wq->thread);
-    list_add_tail(&t->entry, &wq->wq_list);
-    thread_signal(wq->thread);
-    thread_unlock(wq->thread);
+    if (wq == self && prio == WORKQ_PRIO_NORMAL && workq_push_local(wq, t)) {
+        workq_wake_stealer(wq);
+        return 0;
+    }
+    INIT_LIST_HEAD(&tasks);
+    list_add_tail(&t->entry, &tasks);
+    workq_enqueue(wq, &tasks, 1, prio);
+    return 0;
+}
+
+static struct task *workq_pop(struct workq *wq)
+{
+    struct task *t;
+    mutex_lock(&wq->lock);
+    t = list_first_entry_or_null(&wq->hi_list, struct task, entry);
+    if (t) {
+        __atomic_sub_fetch(&wq->hi_nr, 1, __ATOMIC_RELAXED);
+    } else {
+        t = list_first_entry_or_null(&wq->wq_list, struct task, entry);
+    }
+    if (t) {
+        list_del_init(&t->entry);
+        __atomic_sub_fetch(&wq->nr, 1, __ATOMIC_RELAXED);
+        __atomic_sub_fetch(&wq->pool->pending, 1, __ATOMIC_SEQ_CST);
+    }
+    mutex_unlock(&wq->lock);
     return t;
 }
 
-static void task_destroy(struct task *t)
+/*
+ * take half of the busiest workq from tail of its high priority list,
+ * or normal list if no high one, run the first one and keep the rest
+ * in own list of same priority, only one lock is held at a time.
+ * with both lists empty take one task from top of its deque
+ */
+static struct task *workq_steal(struct workq *wq)
 {
-    struct workq *wq = t->wq;
-    thread_lock(wq->thread);
-    list_del_init(&t->entry);
-    thread_unlock(wq->thread);
-    free(t);
+    int i, n, max = 0;
+    struct task *t, *first = NULL;
+    struct workq *victim = NULL, *v;
+    struct workq_pool *pool = wq->pool;
+    struct list_head stolen, *from, *to;
+
+    for (i = 0; i < pool->wq_array.num; i++) {
+        v = pool->wq_array.array[i];
+        n = __atomic_load_n(&v->nr, __ATOMIC_RELAXED);
+        if (v != wq && n > max) {
+            max = n;
+            victim = v;
+        }
+    }
+    if (!victim) {
+        return NULL;
+    }
+    INIT_LIST_HEAD(&stolen);
+    mutex_lock(&victim->lock);
+    from = list_empty(&victim->hi_list) ? &victim->wq_list : &victim->hi_list;
+    to = (from == &victim->hi_list) ? &wq->hi_list : &wq->wq_list;
+    max = (__atomic_load_n(&victim->nr, __ATOMIC_RELAXED) + 1) / 2;
+    n = 0;
+    while (n < max && !list_empty(from)) {
+        t = list_last_entry(from, struct task, entry);
+        list_move(&t->entry, &stolen);
+        n++;
+    }
+    __atomic_sub_fetch(&victim->nr, n, __ATOMIC_RELAXED);
+    if (from == &victim->hi_list) {
+        __atomic_sub_fetch(&victim->hi_nr, n, __ATOMIC_RELAXED);
+    }
+    mutex_unlock(&victim->lock);
+    if (n == 0) {
+        first = deque_steal(victim);
+        if (!first) {
+            return NULL;
+        }
+        __atomic_sub_fetch(&victim->nr, 1, __ATOMIC_RELAXED);
+        __atomic_sub_fetch(&pool->pending, 1, __ATOMIC_SEQ_CST);
+        __atomic_add_fetch(&wq->steals, 1, __ATOMIC_RELAXED);
+        return first;
+    }
+    first = list_first_entry(&stolen, struct task, entry);
+    list_del_init(&first->entry);
+    mutex_lock(&wq->lock);
+    __atomic_add_fetch(&wq->nr, n - 1, __ATOMIC_RELAXED);
+    if (to == &wq->hi_list) {
+        __atomic_add_fetch(&wq->hi_nr, n - 1, __ATOMIC_RELAXED);
+    }
+    list_splice_tail(&stolen, to);
+    mutex_unlock(&wq->lock);
+    __atomic_sub_fetch(&pool->pending, 1, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&wq->steals, 1, __ATOMIC_RELAXED);
+    return first;
+}
+
+static void task_run(struct workq *wq, struct task *t)
+{
+    int load = __atomic_load_n(&wq->load, __ATOMIC_RELAXED);
+    if (t->func) {
+        __atomic_store_n(&wq->load, 1, __ATOMIC_RELAXED);
+        t->func(t->data);
+        __atomic_store_n(&wq->load, load, __ATOMIC_RELAXED);
+    }
+    task_free(wq, t);
+}
+
+/* high priority list, own deque, normal list, then other workq */
+static struct task *workq_next(struct workq *wq)
+{
+    struct task *t = NULL;
+    if (!__atomic_load_n(&wq->hi_nr, __ATOMIC_RELAXED)) {
+        t = deque_pop(wq);
+    }
+    if (t) {
+        __atomic_sub_fetch(&wq->nr, 1, __ATOMIC_RELAXED);
+        __atomic_sub_fetch(&wq->pool->pending, 1, __ATOMIC_SEQ_CST);
+        return t;
+    }
+    t = workq_pop(wq);
+    if (!t) {
+        t = workq_steal(wq);
+    }
+    return t;
+}
+
+/* run one queued task in worker wq, used when a worker has to wait */
+static bool workq_help(struct workq *wq)
+{
+    struct task *t = workq_next(wq);
+    if (!t) {
+        return false;
+    }
+    task_run(wq, t);
+    return true;
+}
+
+static int cond_wait_ms(mutex_lock_t *lock, mutex_cond_t *cond, int ms)
+{
+    struct timespec ts;
+    uint64_t ns;
+    if (ms < 0) {
+        return pthread_cond_wait(cond, lock);
+    }
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ns = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec + (uint64_t)ms * 1000000ULL;
+    ts.tv_sec = ns / 1000000000ULL;
+    ts.tv_nsec = ns % 1000000000ULL;
+    return pthread_cond_timedwait(cond, lock, &ts);
+}
+
+static uint64_t now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* pin worker to one cpu when affinity is on, else allow all cpus */
+static void workq_bind(struct workq *wq)
+{
+    int cpu = wq->id % wq->pool->cpus;
+    int affinity = __atomic_load_n(&wq->pool->affinity, __ATOMIC_RELAXED);
+    if (0 != thread_set_affinity(NULL, &cpu, affinity ? 1 : 0)) {
+        printf("bind workq %d failed!\n", wq->id);
+    }
+    wq->bound = affinity;
+}
+
+static bool workq_has_task(struct workq *wq)
+{
+    return !list_empty(&wq->wq_list) || !list_empty(&wq->hi_list);
+}
+
+/*
+ * sleep until there is work, return false if this spare worker (id not
+ * less than min) stayed idle for idle_ms and retired, enqueue restarts it
+ */
+static bool workq_idle_wait(struct workq *wq)
+{
+    int ret;
+    bool retire = false;
+    struct workq_pool *pool = wq->pool;
+
+    mutex_lock(&wq->lock);
+    __atomic_store_n(&wq->idle, 1, __ATOMIC_SEQ_CST);
+    while (!workq_has_task(wq) && wq->run &&
+           wq->bound == __atomic_load_n(&pool->affinity, __ATOMIC_RELAXED) &&
+           __atomic_load_n(&pool->pending, __ATOMIC_SEQ_CST) == 0) {
+        if (wq->id < pool->min) {
+            mutex_cond_wait(&wq->lock, &wq->cond, 0);
+            continue;
+        }
+        ret = cond_wait_ms(&wq->lock, &wq->cond,
+                           __atomic_load_n(&pool->idle_ms, __ATOMIC_RELAXED));
+        if (ret == ETIMEDOUT && !workq_has_task(wq) && wq->run &&
+            __atomic_load_n(&pool->pending, __ATOMIC_SEQ_CST) == 0) {
+            __atomic_store_n(&wq->active, 0, __ATOMIC_RELEASE);
+            __atomic_sub_fetch(&pool->active, 1, __ATOMIC_RELAXED);
+            retire = true;
+            break;
+        }
+    }
+    __atomic_store_n(&wq->idle, 0, __ATOMIC_SEQ_CST);
+    mutex_unlock(&wq->lock);
+    return !retire;
 }
 
 static void *_task_thread(struct thread *thread, void *arg)
 {
     struct workq *wq = (struct workq *)arg;
+    struct workq_pool *pool = wq->pool;
     struct task *t;
-    while (wq->run) {
-        thread_lock(thread);
-        while (list_empty(&wq->wq_list) && wq->run) {
-            thread_wait(thread, 0);
+    pthread_setspecific(pool->key, wq);
+    wq->bound = 0;
+    while (__atomic_load_n(&wq->run, __ATOMIC_ACQUIRE)) {
+        if (wq->bound != __atomic_load_n(&pool->affinity, __ATOMIC_RELAXED)) {
+            workq_bind(wq);
         }
-        t = list_first_entry_or_null(&wq->wq_list, struct task, entry);
-        thread_unlock(thread);
-        if (t && t->func) {
-            wq->load = 1;
-            t->func(t->data);
-            task_destroy(t);
-            wq->load = 0;
+        t = workq_next(wq);
+        if (!t) {
+            if (!workq_idle_wait(wq)) {
+                break;
+            }
+            continue;
         }
+        task_run(wq, t);
     }
     return NULL;
 }
 
-static struct workq *workq_create()
+static struct workq *workq_create(struct workq_pool *pool, int id)
 {
     struct workq *wq = calloc(1, sizeof(struct workq));
     if (!wq) {
         return NULL;
     }
     INIT_LIST_HEAD(&wq->wq_list);
-    wq->run = 1;
-    wq->load = 0;
-    wq->thread = thread_create(_task_thread, wq);
-    if (!wq->thread) {
-        printf("thread create failed!\n");
+    INIT_LIST_HEAD(&wq->hi_list);
+    INIT_LIST_HEAD(&wq->cache);
+    wq->deque = calloc(WORKQ_DEQUE_SIZE, sizeof(struct task *));
+    if (!wq->deque) {
         free(wq);
         return NULL;
     }
+    mutex_lock_init(&wq->lock);
+    mutex_cond_init(&wq->cond);
+    wq->id = id;
+    wq->run = 1;
+    wq->load = 0;
+    wq->pool = pool;
     return wq;
 }
 
-static void workq_destroy(struct workq *wq)
+static void workq_stop(struct workq *wq)
 {
-    struct task *t;
+    mutex_lock(&wq->lock);
+    __atomic_store_n(&wq->run, 0, __ATOMIC_RELEASE);
+    mutex_cond_signal(&wq->cond);
+    mutex_unlock(&wq->lock);
+}
 
-    thread_lock(wq->thread);
-    while (!list_empty(&wq->wq_list)) {
-        t = list_first_entry_or_null(&wq->wq_list, struct task, entry);
-        task_destroy(t);
+static void workq_destroy(struct workq *wq)
+{
+    if (wq->thread) {
+        thread_join(wq->thread);
+        thread_destroy(wq->thread);
     }
-    wq->run = 0;
-    thread_signal(wq->thread);
-    thread_unlock(wq->thread);
+    /* tasks not run yet are dropped */
+    while (wq->top < wq->bottom) {
+        gear_free(wq->deque[wq->top++ & WORKQ_DEQUE_MASK], sizeof(struct task));
+    }
+    free(wq->deque);
+    task_list_free(&wq->hi_list);
+    task_list_free(&wq->wq_list);
+    task_list_free(&wq->cache);
+    mutex_cond_deinit(&wq->cond);
+    mutex_lock_deinit(&wq->lock);
+    free(wq);
+}
+
+/* all workq must be stopped before any is freed, others may steal from it */
+static void timer_release(struct workq_pool *pool);
 
-    thread_join(wq->thread);
-    thread_destroy(wq->thread);
+static void workq_pool_release(struct workq_pool *pool)
+{
+    int i;
+    /* stop timer first so no more tasks are queued */
+    if (pool->timer_thread) {
+        mutex_lock(&pool->timer_lock);
+        pool->timer_run = 0;
+        mutex_cond_signal(&pool->timer_cond);
+        mutex_unlock(&pool->timer_lock);
+        thread_join(pool->timer_thread);
+        thread_destroy(pool->timer_thread);
+    }
+    for (i = 0; i < pool->wq_array.num; i++) {
+        workq_stop(pool->wq_array.array[i]);
+    }
+    for (i = 0; i < pool->wq_array.num; i++) {
+        workq_destroy(pool->wq_array.array[i]);
+    }
+    da_free(pool->wq_array);
+    /* timers whose wrapper task was dropped are freed here */
+    timer_release(pool);
+    task_list_free(&pool->cache);
+    mutex_lock_deinit(&pool->cache_lock);
+    mutex_lock_deinit(&pool->size_lock);
+    pthread_key_delete(pool->key);
+    free(pool);
 }
 
+static struct workq_pool *pool_create(int min, int max, bool lazy);
+
 struct workq_pool *workq_pool_create()
+{
+    return pool_create(0, 0, false);
+}
+
+struct workq_pool *workq_pool_create_by(int min, int max)
+{
+    return pool_create(min, max, false);
+}
+
+struct workq_pool *workq_pool_create_lazy(int min, int max)
+{
+    return pool_create(min, max, true);
+}
+
+static struct workq_pool *pool_create(int min, int max, bool lazy)
 {
     int i;
     int cpus = 1;
@@ -143,91 +662,833 @@ struct workq_pool *workq_pool_create()
 #endif
     if (cpus <= 0) {
         printf("cpu number is invalid!\n");
-        goto failed;
+        free(pool);
+        return NULL;
     }
     printf("cpu number is %d\n", cpus);
 
+    if (max <= 0) {
+        max = cpus;
+    }
+    if (min <= 0 || min > max) {
+        min = max;
+    }
+    if (0 != pthread_key_create(&pool->key, NULL)) {
+        printf("pthread_key_create failed!\n");
+        free(pool);
+        return NULL;
+    }
     pool->cpus = cpus;
     pool->threshold = 0;
+    pool->min = min;
+    pool->max = max;
+    pool->idle_ms = WORKQ_IDLE_MS;
+    INIT_LIST_HEAD(&pool->cache);
+    mutex_lock_init(&pool->cache_lock);
+    mutex_lock_init(&pool->size_lock);
+    mutex_lock_init(&pool->timer_lock);
+    mutex_cond_init(&pool->timer_cond);
+    INIT_LIST_HEAD(&pool->timer_list);
+    da_init(pool->timer_heap);
     da_init(pool->wq_array);
 
-    for (i = 0; i < cpus; ++i) {
-        wq = workq_create();
+    /* build all workq before any worker runs, workers steal from each other */
+    for (i = 0; i < max; ++i) {
+        wq = workq_create(pool, i);
         if (!wq) {
             goto failed;
         }
         da_push_back(pool->wq_array, &wq);
     }
+    /* lazy pool starts workers from enqueue, first push starts workq[0] */
+    for (i = 0; !lazy && i < min; ++i) {
+        if (0 != workq_start(pool->wq_array.array[i])) {
+            goto failed;
+        }
+    }
 
     return pool;
 
 failed:
-    if (pool) {
-        do {
-            wq = pool->wq_array.array[pool->wq_array.num-1];
-            da_erase_item(pool->wq_array, &wq);
-            free(wq);
-        } while (pool->wq_array.num > 0);
-    }
-    if (!pool) {
-        free(pool);
-    }
+    workq_pool_release(pool);
     return NULL;
 }
 
-static struct workq *find_underrun_workq(struct workq_pool *pool)
+int workq_pool_set_affinity(struct workq_pool *pool, bool enable)
 {
     int i;
     struct workq *wq;
+    if (!pool) {
+        return -1;
+    }
+    __atomic_store_n(&pool->affinity, enable ? 1 : 0, __ATOMIC_RELAXED);
+    /* idle workers rebind when woken */
     for (i = 0; i < pool->wq_array.num; i++) {
         wq = pool->wq_array.array[i];
-        if (is_workq_underload(pool, wq))
-            break;
+        mutex_lock(&wq->lock);
+        mutex_cond_signal(&wq->cond);
+        mutex_unlock(&wq->lock);
     }
-    if (i == pool->wq_array.num) {
-        /*
-         * TODO: need do load blance
-         */
-        i = pool->wq_array.num - 1;
-        printf("all workq are overload, need expand, just force to last workq!\n");
+    return 0;
+}
+
+int workq_pool_set_idle_timeout(struct workq_pool *pool, int ms)
+{
+    if (!pool || ms <= 0) {
+        return -1;
     }
-    return pool->wq_array.array[i];
+    __atomic_store_n(&pool->idle_ms, ms, __ATOMIC_RELAXED);
+    return 0;
 }
 
-int workq_pool_task_push(struct workq_pool *pool, task_func_t func, void *data)
+int workq_pool_threads(struct workq_pool *pool)
 {
-    struct task *t;
-    struct workq *wq;
+    return pool ? __atomic_load_n(&pool->active, __ATOMIC_RELAXED) : 0;
+}
+
+static struct workq *find_underrun_workq(struct workq_pool *pool)
+{
+    int i, n, min = -1;
+    struct workq *wq, *best = NULL;
+    for (i = 0; i < pool->wq_array.num; i++) {
+        wq = pool->wq_array.array[i];
+        if (!workq_active(wq)) {
+            continue;
+        }
+        n = __atomic_load_n(&wq->nr, __ATOMIC_RELAXED);
+        if (n == 0 && is_workq_underload(pool, wq)) {
+            return wq;
+        }
+        if (min < 0 || n < min) {
+            min = n;
+            best = wq;
+        }
+    }
+    /* all workq are busy, queue to the shortest, idle ones steal later */
+    return best ? best : pool->wq_array.array[0];
+}
+
+int workq_pool_task_push_prio(struct workq_pool *pool, enum workq_prio prio,
+                task_func_t func, void *data)
+{
+    struct workq *wq, *self;
     if (!pool || !func) {
         printf("invalid paraments!\n");
         return -1;
     }
-    wq = find_underrun_workq(pool);
+    self = workq_self(pool);
+    wq = self ? self : find_underrun_workq(pool);
     if (!wq) {
         printf("all workq are not idle, need expand\n");
         return -1;
     }
-    t = task_create(wq, func, data);
-    if (!t) {
+    return task_create(wq, self, prio, func, data);
+}
+
+int workq_pool_task_push(struct workq_pool *pool, task_func_t func, void *data)
+{
+    return workq_pool_task_push_prio(pool, WORKQ_PRIO_NORMAL, func, data);
+}
+
+int workq_pool_task_push_batch(struct workq_pool *pool, task_func_t func,
+                void **data, int n)
+{
+    int i, j, k, per, num, done = 0;
+    struct task *t;
+    struct workq *wq, *self;
+    struct list_head tasks;
+
+    if (!pool || !func || !data || n <= 0) {
+        printf("invalid paraments!\n");
+        return -1;
+    }
+    self = workq_self(pool);
+    /* inside a worker keep all local, others steal, else split evenly */
+    num = self ? 1 : workq_pool_threads(pool);
+    num = MAX2(num, 1);
+    per = (n + num - 1) / num;
+    /* workq[0] never retires, wrap around if some retired meanwhile */
+    for (i = 0; done < n; i = (i + 1) % pool->wq_array.num) {
+        wq = self ? self : pool->wq_array.array[i];
+        if (!self && i > 0 && !workq_active(wq)) {
+            continue;
+        }
+        INIT_LIST_HEAD(&tasks);
+        for (j = 0, k = 0; j < per && done + j < n; j++) {
+            t = task_alloc(pool, self);
+            if (!t) {
+                break;
+            }
+            t->func = func;
+            t->data = data[done + j];
+            list_add_tail(&t->entry, &tasks);
+            k++;
+        }
+        if (k > 0) {
+            workq_enqueue(wq, &tasks, k, WORKQ_PRIO_NORMAL);
+        }
+        done += k;
+        if (k < per && done < n) {
+            printf("malloc task failed!\n");
+            break;
+        }
+    }
+    return done;
+}
+
+struct workq_future {
+    int ref;
+    bool done;
+    void *result;
+    void *(*func)(void *);
+    void *data;
+    struct workq_pool *pool;
+    mutex_lock_t lock;
+    mutex_cond_t cond;
+};
+
+static void future_put(struct workq_future *f)
+{
+    if (__atomic_sub_fetch(&f->ref, 1, __ATOMIC_ACQ_REL) != 0) {
+        return;
+    }
+    mutex_cond_deinit(&f->cond);
+    mutex_lock_deinit(&f->lock);
+    free(f);
+}
+
+static void future_task(void *arg)
+{
+    struct workq_future *f = (struct workq_future *)arg;
+    void *result = f->func(f->data);
+    mutex_lock(&f->lock);
+    f->result = result;
+    f->done = true;
+    mutex_cond_signal_all(&f->cond);
+    mutex_unlock(&f->lock);
+    future_put(f);
+}
+
+struct workq_future *workq_pool_task_submit(struct workq_pool *pool,
+                void *(*func)(void *), void *data)
+{
+    struct workq_future *f;
+    if (!pool || !func) {
+        printf("invalid paraments!\n");
+        return NULL;
+    }
+    f = calloc(1, sizeof(struct workq_future));
+    if (!f) {
+        printf("malloc workq_future failed!\n");
+        return NULL;
+    }
+    /* one for the task, one for the caller */
+    f->ref = 2;
+    f->func = func;
+    f->data = data;
+    f->pool = pool;
+    mutex_lock_init(&f->lock);
+    mutex_cond_init(&f->cond);
+    if (0 != workq_pool_task_push(pool, future_task, f)) {
+        mutex_cond_deinit(&f->cond);
+        mutex_lock_deinit(&f->lock);
+        free(f);
+        return NULL;
+    }
+    return f;
+}
+
+bool workq_future_done(struct workq_future *f)
+{
+    bool done;
+    if (!f) {
+        return false;
+    }
+    mutex_lock(&f->lock);
+    done = f->done;
+    mutex_unlock(&f->lock);
+    return done;
+}
+
+/*
+ * a worker thread waiting on a future keeps running queued tasks,
+ * otherwise the future task may be stuck behind the waiter itself
+ */
+int workq_future_wait(struct workq_future *f, int timeout_ms, void **result)
+{
+    int ret = 0;
+    uint64_t deadline = 0, now;
+    struct workq *self;
+    if (!f) {
+        return -1;
+    }
+    if (timeout_ms >= 0) {
+        deadline = now_ms() + timeout_ms;
+    }
+    self = workq_self(f->pool);
+    mutex_lock(&f->lock);
+    while (!f->done) {
+        now = now_ms();
+        if (timeout_ms >= 0 && now >= deadline) {
+            ret = -1;
+            break;
+        }
+        if (self) {
+            mutex_unlock(&f->lock);
+            if (!workq_help(self)) {
+                sched_yield();
+            }
+            mutex_lock(&f->lock);
+        } else {
+            cond_wait_ms(&f->lock, &f->cond,
+                         timeout_ms < 0 ? -1 : (int)(deadline - now));
+        }
+    }
+    if (ret == 0 && result) {
+        *result = f->result;
+    }
+    mutex_unlock(&f->lock);
+    return ret;
+}
+
+void workq_future_destroy(struct workq_future *f)
+{
+    if (!f) {
+        return;
+    }
+    future_put(f);
+}
+
+struct parallel_ctx {
+    int next;
+    int end;
+    int grain;
+    int runners;
+    void (*func)(int i, void *arg);
+    void *arg;
+    mutex_lock_t lock;
+    mutex_cond_t cond;
+};
+
+/* grab chunks until range is exhausted, so slow chunks do not stall others */
+static void parallel_run(struct parallel_ctx *c)
+{
+    int i, begin, end;
+    while (1) {
+        begin = __atomic_fetch_add(&c->next, c->grain, __ATOMIC_RELAXED);
+        if (begin >= c->end) {
+            break;
+        }
+        end = (c->end - begin < c->grain) ? c->end : begin + c->grain;
+        for (i = begin; i < end; i++) {
+            c->func(i, c->arg);
+        }
+    }
+}
+
+static void parallel_task(void *arg)
+{
+    struct parallel_ctx *c = (struct parallel_ctx *)arg;
+    parallel_run(c);
+    mutex_lock(&c->lock);
+    if (--c->runners == 0) {
+        mutex_cond_signal(&c->cond);
+    }
+    mutex_unlock(&c->lock);
+}
+
+int workq_parallel_for(struct workq_pool *pool, int begin, int end, int grain,
+                void (*func)(int i, void *arg), void *arg)
+{
+    int i, n, chunks;
+    struct workq *self;
+    struct parallel_ctx c;
+    void **data;
+
+    if (!pool || !func || end < begin) {
+        printf("invalid paraments!\n");
         return -1;
     }
+    if (end == begin) {
+        return 0;
+    }
+    if (grain <= 0) {
+        /* 4 chunks per worker balance well without too many grabs */
+        grain = (end - begin + pool->wq_array.num * 4 - 1) / (pool->wq_array.num * 4);
+    }
+    chunks = (end - begin + grain - 1) / grain;
+    /* caller is one of the runners */
+    n = MIN2(chunks, pool->wq_array.num) - 1;
+    memset(&c, 0, sizeof(c));
+    c.next = begin;
+    c.end = end;
+    c.grain = grain;
+    c.func = func;
+    c.arg = arg;
+    mutex_lock_init(&c.lock);
+    mutex_cond_init(&c.cond);
+    if (n > 0) {
+        data = calloc(n, sizeof(void *));
+        if (data) {
+            for (i = 0; i < n; i++) {
+                data[i] = &c;
+            }
+            c.runners = n;
+            i = workq_pool_task_push_batch(pool, parallel_task, data, n);
+            mutex_lock(&c.lock);
+            c.runners -= n - (i > 0 ? i : 0);
+            mutex_unlock(&c.lock);
+            free(data);
+        }
+    }
+    parallel_run(&c);
 
+    self = workq_self(pool);
+    mutex_lock(&c.lock);
+    while (c.runners > 0) {
+        if (self) {
+            mutex_unlock(&c.lock);
+            if (!workq_help(self)) {
+                sched_yield();
+            }
+            mutex_lock(&c.lock);
+        } else {
+            mutex_cond_wait(&c.lock, &c.cond, 0);
+        }
+    }
+    mutex_unlock(&c.lock);
+    mutex_cond_deinit(&c.cond);
+    mutex_lock_deinit(&c.lock);
     return 0;
 }
 
-void workq_pool_destroy(struct workq_pool *pool)
+struct workq_timer {
+    uint64_t id;
+    uint64_t deadline;  /* monotonic ms */
+    int period;         /* 0 is oneshot */
+    int idx;            /* index in timer_heap, -1 if not queued */
+    bool running;
+    bool canceled;
+    task_func_t func;
+    void *data;
+    struct workq_pool *pool;
+    struct list_head entry;
+};
+
+/* binary min heap on deadline, every timer knows its index to remove */
+static void heap_set(struct workq_pool *pool, int i, struct workq_timer *t)
+{
+    pool->timer_heap.array[i] = t;
+    t->idx = i;
+}
+
+static void heap_up(struct workq_pool *pool, int i)
+{
+    struct workq_timer *t = pool->timer_heap.array[i];
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (pool->timer_heap.array[parent]->deadline <= t->deadline) {
+            break;
+        }
+        heap_set(pool, i, pool->timer_heap.array[parent]);
+        i = parent;
+    }
+    heap_set(pool, i, t);
+}
+
+static void heap_down(struct workq_pool *pool, int i)
+{
+    int n = pool->timer_heap.num;
+    struct workq_timer *t = pool->timer_heap.array[i];
+    while (2 * i + 1 < n) {
+        int child = 2 * i + 1;
+        if (child + 1 < n && pool->timer_heap.array[child + 1]->deadline <
+                             pool->timer_heap.array[child]->deadline) {
+            child++;
+        }
+        if (t->deadline <= pool->timer_heap.array[child]->deadline) {
+            break;
+        }
+        heap_set(pool, i, pool->timer_heap.array[child]);
+        i = child;
+    }
+    heap_set(pool, i, t);
+}
+
+static void heap_push(struct workq_pool *pool, struct workq_timer *t)
+{
+    da_push_back(pool->timer_heap, &t);
+    heap_up(pool, pool->timer_heap.num - 1);
+}
+
+static void heap_remove(struct workq_pool *pool, struct workq_timer *t)
+{
+    int i = t->idx;
+    struct workq_timer *last = pool->timer_heap.array[pool->timer_heap.num - 1];
+    da_pop_back(pool->timer_heap);
+    t->idx = -1;
+    if (last != t) {
+        heap_set(pool, i, last);
+        heap_up(pool, i);
+        heap_down(pool, last->idx);
+    }
+}
+
+static void timer_free(struct workq_timer *t)
+{
+    list_del(&t->entry);
+    free(t);
+}
+
+/* wrapper queued to workq, rearm periodic timer only after func returns */
+static void timer_task(void *arg)
+{
+    uint64_t now;
+    struct workq_timer *t = (struct workq_timer *)arg;
+    struct workq_pool *pool = t->pool;
+
+    t->func(t->data);
+    mutex_lock(&pool->timer_lock);
+    t->running = false;
+    if (t->period > 0 && !t->canceled) {
+        now = now_ms();
+        t->deadline += t->period;
+        if (t->deadline < now) {
+            t->deadline = now;
+        }
+        heap_push(pool, t);
+        mutex_cond_signal(&pool->timer_cond);
+    } else {
+        timer_free(t);
+    }
+    mutex_unlock(&pool->timer_lock);
+}
+
+static void *_timer_thread(struct thread *thread, void *arg)
+{
+    uint64_t now;
+    struct workq_timer *t;
+    struct workq_pool *pool = (struct workq_pool *)arg;
+
+    mutex_lock(&pool->timer_lock);
+    while (pool->timer_run) {
+        if (pool->timer_heap.num == 0) {
+            mutex_cond_wait(&pool->timer_lock, &pool->timer_cond, 0);
+            continue;
+        }
+        t = pool->timer_heap.array[0];
+        now = now_ms();
+        if (t->deadline > now) {
+            cond_wait_ms(&pool->timer_lock, &pool->timer_cond,
+                         (int)(t->deadline - now));
+            continue;
+        }
+        heap_remove(pool, t);
+        t->running = true;
+        mutex_unlock(&pool->timer_lock);
+        if (0 != workq_pool_task_push(pool, timer_task, t)) {
+            mutex_lock(&pool->timer_lock);
+            /* retry on next period, or drop oneshot */
+            t->running = false;
+            if (t->period > 0 && !t->canceled) {
+                t->deadline = now_ms() + t->period;
+                heap_push(pool, t);
+            } else {
+                timer_free(t);
+            }
+            continue;
+        }
+        mutex_lock(&pool->timer_lock);
+    }
+    mutex_unlock(&pool->timer_lock);
+    return NULL;
+}
+
+static uint64_t timer_add(struct workq_pool *pool, int delay_ms, int period_ms,
+                task_func_t func, void *data)
+{
+    uint64_t id;
+    struct workq_timer *t;
+    if (!pool || !func || delay_ms < 0) {
+        printf("invalid paraments!\n");
+        return 0;
+    }
+    t = calloc(1, sizeof(struct workq_timer));
+    if (!t) {
+        printf("malloc workq_timer failed!\n");
+        return 0;
+    }
+    t->func = func;
+    t->data = data;
+    t->pool = pool;
+    t->period = period_ms;
+    t->idx = -1;
+    mutex_lock(&pool->timer_lock);
+    if (!pool->timer_thread) {
+        pool->timer_run = 1;
+        pool->timer_thread = thread_create(_timer_thread, pool);
+        if (!pool->timer_thread) {
+            printf("timer thread create failed!\n");
+            pool->timer_run = 0;
+            mutex_unlock(&pool->timer_lock);
+            free(t);
+            return 0;
+        }
+    }
+    id = t->id = ++pool->timer_id;
+    t->deadline = now_ms() + delay_ms;
+    list_add_tail(&t->entry, &pool->timer_list);
+    heap_push(pool, t);
+    if (t->idx == 0) {
+        /* new earliest deadline */
+        mutex_cond_signal(&pool->timer_cond);
+    }
+    mutex_unlock(&pool->timer_lock);
+    return id;
+}
+
+uint64_t workq_pool_task_delay(struct workq_pool *pool, int delay_ms,
+                task_func_t func, void *data)
+{
+    return timer_add(pool, delay_ms, 0, func, data);
+}
+
+uint64_t workq_pool_task_periodic(struct workq_pool *pool, int period_ms,
+                task_func_t func, void *data)
+{
+    if (period_ms <= 0) {
+        printf("invalid paraments!\n");
+        return 0;
+    }
+    return timer_add(pool, period_ms, period_ms, func, data);
+}
+
+int workq_pool_task_cancel(struct workq_pool *pool, uint64_t id)
+{
+    int ret = -1;
+    struct workq_timer *t;
+    if (!pool || id == 0) {
+        return -1;
+    }
+    mutex_lock(&pool->timer_lock);
+    list_for_each_entry(t, &pool->timer_list, entry) {
+        if (t->id != id) {
+            continue;
+        }
+        if (t->running) {
+            /* timer_task frees it after run */
+            t->canceled = true;
+        } else {
+            heap_remove(pool, t);
+            timer_free(t);
+        }
+        ret = 0;
+        break;
+    }
+    mutex_unlock(&pool->timer_lock);
+    return ret;
+}
+
+static void timer_release(struct workq_pool *pool)
 {
+    struct workq_timer *t, *next;
+    list_for_each_entry_safe(t, next, &pool->timer_list, entry) {
+        timer_free(t);
+    }
+    da_free(pool->timer_heap);
+    mutex_cond_deinit(&pool->timer_cond);
+    mutex_lock_deinit(&pool->timer_lock);
+}
+
+uint64_t workq_pool_steals(struct workq_pool *pool)
+{
+    int i;
+    uint64_t steals = 0;
     struct workq *wq;
     if (!pool) {
-        return;
+        return 0;
     }
+    for (i = 0; i < pool->wq_array.num; i++) {
+        wq = pool->wq_array.array[i];
+        steals += __atomic_load_n(&wq->steals, __ATOMIC_RELAXED);
+    }
+    return steals;
+}
 
-    while (pool->wq_array.num > 0) {
-        wq = pool->wq_array.array[pool->wq_array.num-1];
-        workq_destroy(wq);
-        da_erase_item(pool->wq_array, &wq);
-        free(wq);
+struct init_ctx {
+    struct workq_init_step *steps;
+    int n;
+    uint64_t done;
+    uint64_t failed;
+    uint64_t started;
+    int running;
+    mutex_lock_t lock;
+    mutex_cond_t cond;
+};
+
+struct init_task {
+    struct init_ctx *ctx;
+    int idx;
+};
+
+static void init_step_run(struct init_ctx *c, int i)
+{
+    struct workq_init_step *st = &c->steps[i];
+    uint64_t start = now_ms();
+    int ret = st->func(st->arg);
+    mutex_lock(&c->lock);
+    st->result = ret;
+    st->cost_ms = now_ms() - start;
+    c->done |= 1ULL << i;
+    if (ret != 0) {
+        c->failed |= 1ULL << i;
     }
-    da_free(pool->wq_array);
-    free(pool);
+    mutex_cond_signal(&c->cond);
+    mutex_unlock(&c->lock);
+}
+
+static void init_task(void *arg)
+{
+    struct init_task *t = (struct init_task *)arg;
+    struct init_ctx *c = t->ctx;
+    init_step_run(c, t->idx);
+    mutex_lock(&c->lock);
+    c->running--;
+    mutex_cond_signal(&c->cond);
+    mutex_unlock(&c->lock);
+}
+
+/* called with lock, returns a ready step for caller or -1 */
+static int init_dispatch(struct workq_pool *pool, struct init_ctx *c,
+                struct init_task *tasks)
+{
+    int i, mine = -1;
+    uint64_t bit;
+    for (i = 0; i < c->n; i++) {
+        bit = 1ULL << i;
+        if ((c->started & bit) || (c->steps[i].deps & ~c->done)) {
+            continue;
+        }
+        c->started |= bit;
+        if (c->steps[i].deps & c->failed) {
+            c->steps[i].result = -1;
+            c->done |= bit;
+            c->failed |= bit;
+            i = -1;     /* rescan, more may be skipped now */
+            continue;
+        }
+        if (mine < 0) {
+            mine = i;
+            continue;
+        }
+        tasks[i].ctx = c;
+        tasks[i].idx = i;
+        c->running++;
+        if (0 != workq_pool_task_push(pool, init_task, &tasks[i])) {
+            c->running--;
+            c->started &= ~bit;
+            break;
+        }
+    }
+    return mine;
+}
+
+int workq_init_run(struct workq_pool *pool, struct workq_init_step *steps, int n)
+{
+    int i, mine;
+    uint64_t all;
+    struct init_ctx c;
+    struct workq *self;
+    struct init_task tasks[WORKQ_INIT_STEP_MAX];
+
+    if (!steps || n <= 0 || n > WORKQ_INIT_STEP_MAX) {
+        printf("invalid paraments!\n");
+        return -1;
+    }
+    all = n == 64 ? ~0ULL : (1ULL << n) - 1;
+    for (i = 0; i < n; i++) {
+        if (!steps[i].func || (steps[i].deps & ~all) ||
+            (steps[i].deps & (1ULL << i))) {
+            printf("invalid init step %d!\n", i);
+            return -1;
+        }
+        steps[i].result = 0;
+        steps[i].cost_ms = 0;
+    }
+    memset(&c, 0, sizeof(c));
+    c.steps = steps;
+    c.n = n;
+    mutex_lock_init(&c.lock);
+    mutex_cond_init(&c.cond);
+    self = pool ? workq_self(pool) : NULL;
+
+    mutex_lock(&c.lock);
+    while (c.done != all) {
+        if (pool) {
+            mine = init_dispatch(pool, &c, tasks);
+        } else {
+            /* serial in index order, deps must point backward */
+            for (mine = -1, i = 0; i < n && mine < 0; i++) {
+                if (!(c.started & (1ULL << i)) && !(steps[i].deps & ~c.done)) {
+                    mine = i;
+                }
+            }
+            if (mine >= 0 && (steps[mine].deps & c.failed)) {
+                c.started |= 1ULL << mine;
+                c.done |= 1ULL << mine;
+                c.failed |= 1ULL << mine;
+                steps[mine].result = -1;
+                continue;
+            }
+            if (mine >= 0) {
+                c.started |= 1ULL << mine;
+            }
+        }
+        if (mine >= 0) {
+            /* caller runs one ready step itself */
+            mutex_unlock(&c.lock);
+            init_step_run(&c, mine);
+            mutex_lock(&c.lock);
+            continue;
+        }
+        if (c.running == 0) {
+            if (c.done == all) {
+                break;
+            }
+            /* left steps wait on each other */
+            printf("init steps have a dependency cycle!\n");
+            for (i = 0; i < n; i++) {
+                if (!(c.done & (1ULL << i))) {
+                    steps[i].result = -1;
+                }
+            }
+            c.failed |= all & ~c.done;
+            break;
+        }
+        if (self) {
+            mutex_unlock(&c.lock);
+            if (!workq_help(self)) {
+                sched_yield();
+            }
+            mutex_lock(&c.lock);
+        } else {
+            mutex_cond_wait(&c.lock, &c.cond, 0);
+        }
+    }
+    /* workers touch ctx until running drops */
+    while (c.running > 0) {
+        mutex_cond_wait(&c.lock, &c.cond, 0);
+    }
+    mutex_unlock(&c.lock);
+    mutex_cond_deinit(&c.cond);
+    mutex_lock_deinit(&c.lock);
+    return c.failed ? -1 : 0;
+}
+
+void workq_pool_destroy(struct workq_pool *pool)
+{
+    if (!pool) {
+        return;
+    }
+    workq_pool_release(pool);
 }
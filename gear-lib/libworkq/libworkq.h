@@ -48,25 +48,154 @@ extern "C" {
  *   suppose each task is not infinite loop
  */
 
+/*
+ *   each workq owns its task list, owner pops from head, idle workq
+ *   steals from tail of the busiest workq before going to sleep,
+ *   task pushed by a worker thread stays in its own workq, in a
+ *   lock-free Chase-Lev deque which only owner pushes and pops
+ */
+struct workq_pool;
+struct workq_timer;
+
 struct workq {
+    int id;
     int run;
     int load;
     int priority;
+    int active;     /* worker thread is running */
+    int bound;      /* affinity applied by worker */
+    int idle;       /* sleeping on its own cond */
+    int nr;         /* queued tasks, read without lock as hint */
+    int hi_nr;      /* tasks in hi_list, owner checks it before deque */
+    uint64_t steals;
+    int cache_nr;
+    struct list_head cache;     /* freed tasks, only touched by worker */
+    mutex_lock_t lock;
+    mutex_cond_t cond;
+    struct workq_pool *pool;
     struct thread *thread;
     struct list_head wq_list;
+    struct list_head hi_list;
+    struct task **deque;
+    char pad0[64];
+    int64_t top;    /* stealers take from top with cas */
+    char pad1[56];
+    int64_t bottom; /* only stored by owner */
+    char pad2[56];
 };
 
 typedef struct workq_pool {
     int cpus;
     int threshold;
+    int min;        /* workq[0, min) never retire */
+    int max;        /* size of wq_array */
+    int active;     /* running worker threads */
+    int idle_ms;    /* spare worker retires after idle so long */
+    int affinity;
+    mutex_lock_t size_lock;
+    int pending;    /* queued tasks in all workq */
+    pthread_key_t key;  /* workq of current worker thread */
+    int cache_nr;
+    mutex_lock_t cache_lock;
+    struct list_head cache;     /* freed tasks shared by all pushers */
+    /* delayed and periodic tasks, timer thread starts on first use */
+    int timer_run;
+    uint64_t timer_id;
+    mutex_lock_t timer_lock;
+    mutex_cond_t timer_cond;
+    struct thread *timer_thread;
+    struct list_head timer_list;
+    DARRAY(struct workq_timer *) timer_heap;
     DARRAY(struct workq *) wq_array;
 } workq_pool_t;
 
 typedef void (*task_func_t)(void *);
 
+enum workq_prio {
+    WORKQ_PRIO_NORMAL = 0,
+    WORKQ_PRIO_HIGH,
+};
+
 GEAR_API struct workq_pool *workq_pool_create();
+
+/*
+ * min threads always run, up to max are started when all are busy and
+ * retire after idle timeout, max <= 0 means cpu number, min <= 0 means max
+ */
+GEAR_API struct workq_pool *workq_pool_create_by(int min, int max);
+/* same sizing, but no thread is created until the first task is pushed */
+GEAR_API struct workq_pool *workq_pool_create_lazy(int min, int max);
+GEAR_API int workq_pool_set_idle_timeout(struct workq_pool *p, int ms);
+GEAR_API int workq_pool_threads(struct workq_pool *p);
+
+/* pin workq[i] to cpu (i % cpus) */
+GEAR_API int workq_pool_set_affinity(struct workq_pool *p, bool enable);
+
+/*
+ * run task once after delay ms, or every period ms, return timer id,
+ * 0 on failure. periodic task is rearmed when its run returns, so it
+ * never overlaps itself, missed periods are skipped not bursted
+ */
+GEAR_API uint64_t workq_pool_task_delay(struct workq_pool *p, int delay_ms,
+                task_func_t f, void *d);
+GEAR_API uint64_t workq_pool_task_periodic(struct workq_pool *p, int period_ms,
+                task_func_t f, void *d);
+/* task will not be queued again after cancel, it may be running now */
+GEAR_API int workq_pool_task_cancel(struct workq_pool *p, uint64_t id);
+
+/* high priority task runs before normal ones of same workq, and stolen first */
+GEAR_API int workq_pool_task_push_prio(struct workq_pool *p, enum workq_prio prio,
+                task_func_t f, void *d);
 GEAR_API int workq_pool_task_push(struct workq_pool *p, task_func_t f, void *d);
+
+/*
+ * push n tasks of same func with one lock per workq,
+ * return number of tasks pushed, -1 on invalid paraments
+ */
+GEAR_API int workq_pool_task_push_batch(struct workq_pool *p, task_func_t f,
+                void **d, int n);
 GEAR_API void workq_pool_destroy(struct workq_pool *pool);
+GEAR_API uint64_t workq_pool_steals(struct workq_pool *pool);
+
+/*
+ * future: completion handle of a task returning a result,
+ * wait return 0 when done, -1 on timeout, timeout_ms < 0 waits forever,
+ * destroy can be called before task finished
+ */
+struct workq_future;
+GEAR_API struct workq_future *workq_pool_task_submit(struct workq_pool *p,
+                void *(*f)(void *), void *d);
+GEAR_API bool workq_future_done(struct workq_future *f);
+GEAR_API int workq_future_wait(struct workq_future *f, int timeout_ms, void **result);
+GEAR_API void workq_future_destroy(struct workq_future *f);
+
+/*
+ * run func(i, arg) for i in [begin, end) on all workq and caller thread,
+ * grain is indexes per chunk, <= 0 picks one, return after all done
+ */
+GEAR_API int workq_parallel_for(struct workq_pool *p, int begin, int end,
+                int grain, void (*func)(int i, void *arg), void *arg);
+
+/*
+ * parallel init: each step runs on the pool once the steps in its deps
+ * mask are done, WORKQ_INIT_DEP(i) means after steps[i]. a step whose dep
+ * failed is skipped with result -1. caller thread runs ready steps too,
+ * pool NULL runs them in order on caller thread. result and cost_ms are
+ * filled per step, return 0 if all steps returned 0
+ */
+#define WORKQ_INIT_STEP_MAX     64
+#define WORKQ_INIT_DEP(i)       (1ULL << (i))
+
+struct workq_init_step {
+    const char *name;
+    int (*func)(void *arg);
+    void *arg;
+    uint64_t deps;
+    int result;
+    uint64_t cost_ms;
+};
+
+GEAR_API int workq_init_run(struct workq_pool *p, struct workq_init_step *steps, int n);
 
 #ifdef __cplusplus
 }
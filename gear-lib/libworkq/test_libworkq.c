@@ -22,6 +22,8 @@
 #include "libworkq.h"
 #include <stdio.h>
 #include <unistd.h>
+#include <inttypes.h>
+#include <sys/time.h>
 
 void test(void *arg)
 {
@@ -53,8 +55,211 @@ int foo()
     return 0;
 }
 
+#define STEAL_TASKS 64
+
+static struct workq_pool *g_pool;
+static int g_done;
+
+static void sub_task(void *arg)
+{
+    usleep(10 * 1000);
+    __atomic_add_fetch(&g_done, 1, __ATOMIC_RELAXED);
+}
+
+static void spawn_task(void *arg)
+{
+    int i;
+    /* all pushed to this worker, idle workers steal them */
+    for (i = 0; i < STEAL_TASKS; i++) {
+        workq_pool_task_push(g_pool, sub_task, NULL);
+    }
+}
+
+int foo_steal()
+{
+    g_pool = workq_pool_create();
+    workq_pool_task_push(g_pool, spawn_task, NULL);
+    while (__atomic_load_n(&g_done, __ATOMIC_RELAXED) < STEAL_TASKS) {
+        usleep(10 * 1000);
+    }
+    printf("%d tasks done, steals=%" PRIu64 "\n", STEAL_TASKS,
+           workq_pool_steals(g_pool));
+    workq_pool_destroy(g_pool);
+    return 0;
+}
+
+#define TREE_DEPTH 12
+
+static int g_leaves;
+
+/* each node spawns two children from worker, owner deque races stealers */
+static void tree_task(void *arg)
+{
+    long depth = (long)arg;
+    if (depth == 0) {
+        __atomic_add_fetch(&g_leaves, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    workq_pool_task_push(g_pool, tree_task, (void *)(depth - 1));
+    workq_pool_task_push(g_pool, tree_task, (void *)(depth - 1));
+}
+
+int foo_deque()
+{
+    g_leaves = 0;
+    /* enough workers to steal even on a single cpu */
+    g_pool = workq_pool_create_by(4, 4);
+    workq_pool_task_push(g_pool, tree_task, (void *)TREE_DEPTH);
+    while (__atomic_load_n(&g_leaves, __ATOMIC_RELAXED) < (1 << TREE_DEPTH)) {
+        usleep(10 * 1000);
+    }
+    printf("deque tree %d leaves, steals=%" PRIu64 "\n", g_leaves,
+           workq_pool_steals(g_pool));
+    workq_pool_destroy(g_pool);
+    return 0;
+}
+
+int foo_batch()
+{
+    int i, n;
+    void *data[STEAL_TASKS];
+    g_done = 0;
+    g_pool = workq_pool_create();
+    for (i = 0; i < STEAL_TASKS; i++) {
+        data[i] = NULL;
+    }
+    n = workq_pool_task_push_batch(g_pool, sub_task, data, STEAL_TASKS);
+    while (__atomic_load_n(&g_done, __ATOMIC_RELAXED) < n) {
+        usleep(10 * 1000);
+    }
+    printf("batch %d tasks done\n", n);
+    workq_pool_destroy(g_pool);
+    return 0;
+}
+
+static void *square(void *arg)
+{
+    long v = (long)arg;
+    return (void *)(v * v);
+}
+
+static void add_one(int i, void *arg)
+{
+    int *array = (int *)arg;
+    array[i] += 1;
+}
+
+int foo_future()
+{
+    int i, sum = 0;
+    void *result = NULL;
+    int array[1000] = {0};
+    struct workq_future *f;
+    g_pool = workq_pool_create();
+    f = workq_pool_task_submit(g_pool, square, (void *)12);
+    if (0 == workq_future_wait(f, 1000, &result)) {
+        printf("future result=%ld\n", (long)result);
+    }
+    workq_future_destroy(f);
+
+    workq_parallel_for(g_pool, 0, 1000, 0, add_one, array);
+    for (i = 0; i < 1000; i++) {
+        sum += array[i];
+    }
+    printf("parallel_for sum=%d\n", sum);
+    workq_pool_destroy(g_pool);
+    return 0;
+}
+
+static void prio_task(void *arg)
+{
+    printf("%s task done\n", (char *)arg);
+}
+
+int foo_dynamic()
+{
+    int i;
+    g_done = 0;
+    g_pool = workq_pool_create_by(1, 4);
+    workq_pool_set_idle_timeout(g_pool, 200);
+    workq_pool_set_affinity(g_pool, true);
+    for (i = 0; i < STEAL_TASKS; i++) {
+        workq_pool_task_push(g_pool, sub_task, NULL);
+    }
+    workq_pool_task_push_prio(g_pool, WORKQ_PRIO_HIGH, prio_task, "high");
+    usleep(50 * 1000);
+    printf("busy threads=%d\n", workq_pool_threads(g_pool));
+    while (__atomic_load_n(&g_done, __ATOMIC_RELAXED) < STEAL_TASKS) {
+        usleep(10 * 1000);
+    }
+    usleep(500 * 1000);
+    printf("idle threads=%d\n", workq_pool_threads(g_pool));
+    workq_pool_destroy(g_pool);
+    return 0;
+}
+
+static int g_ticks;
+
+static void tick_task(void *arg)
+{
+    __atomic_add_fetch(&g_ticks, 1, __ATOMIC_RELAXED);
+}
+
+int foo_timer()
+{
+    uint64_t id;
+    g_pool = workq_pool_create();
+    workq_pool_task_delay(g_pool, 100, prio_task, "delay");
+    id = workq_pool_task_periodic(g_pool, 50, tick_task, NULL);
+    usleep(320 * 1000);
+    workq_pool_task_cancel(g_pool, id);
+    printf("periodic ticks=%d\n", __atomic_load_n(&g_ticks, __ATOMIC_RELAXED));
+    workq_pool_destroy(g_pool);
+    return 0;
+}
+
+static int init_sleep(void *arg)
+{
+    usleep(100 * 1000);
+    return arg ? -1 : 0;
+}
+
+int foo_init()
+{
+    int ret;
+    uint64_t start;
+    struct timeval tv;
+    struct workq_init_step steps[] = {
+        {"log",    init_sleep, NULL, 0},
+        {"config", init_sleep, NULL, 0},
+        {"rtsp",   init_sleep, NULL, WORKQ_INIT_DEP(1)},
+        {"media",  init_sleep, NULL, 0},
+        {"bad",    init_sleep, "fail", 0},
+        {"skip",   init_sleep, NULL, WORKQ_INIT_DEP(4)},
+    };
+    g_pool = workq_pool_create_lazy(4, 4);
+    printf("lazy pool threads=%d\n", workq_pool_threads(g_pool));
+    gettimeofday(&tv, NULL);
+    start = tv.tv_sec * 1000 + tv.tv_usec / 1000;
+    ret = workq_init_run(g_pool, steps, sizeof(steps) / sizeof(steps[0]));
+    gettimeofday(&tv, NULL);
+    printf("init ret=%d rtsp=%d skip=%d in %dms, threads=%d\n", ret,
+           steps[2].result, steps[5].result,
+           (int)(tv.tv_sec * 1000 + tv.tv_usec / 1000 - start),
+           workq_pool_threads(g_pool));
+    workq_pool_destroy(g_pool);
+    return 0;
+}
+
 int main()
 {
+    foo_init();
+    foo_timer();
+    foo_dynamic();
+    foo_future();
+    foo_batch();
+    foo_steal();
+    foo_deque();
     foo();
     while (1) {
         printf("main loop\n");